@@ -0,0 +1,140 @@
+/* arch/x86_64/boot/ap_trampoline.s - Application processor startup
+ *
+ * smp_init() copies ap_trampoline_start..ap_trampoline_end to
+ * SMP_TRAMPOLINE_PHYS and fills in the parameter block at its end. Each
+ * AP starts here in real mode from the startup IPI, goes through
+ * protected mode into long mode on the BSP's page tables, switches to the
+ * BSP's GDT and IDT, claims a cpu id and a stack and calls
+ * ap_main(cpu_id). The code runs at SMP_TRAMPOLINE_PHYS, not where it is
+ * linked, so every address is TRAMP_BASE + (sym - ap_trampoline_start).
+ */
+
+.set TRAMP_BASE,    0x8000              /* SMP_TRAMPOLINE_PHYS */
+.set SMP_MAX_CPUS,  32                  /* percpu.h */
+.set AP_STACK_SHIFT, 14                 /* SMP_AP_STACK_SIZE = 16KB */
+
+.set CR0_PE,   0x00000001
+.set CR0_PG,   0x80000000
+.set CR4_PAE,  0x00000020
+.set EFER_MSR, 0xC0000080
+.set EFER_LME, 0x00000100
+
+.section .rodata
+.global ap_trampoline_start
+.global ap_trampoline_end
+.global ap_tramp_params
+
+.code16
+ap_trampoline_start:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+
+    lgdtl (TRAMP_BASE + tramp_gdt_ptr - ap_trampoline_start)
+    mov %cr0, %eax
+    or $CR0_PE, %eax
+    mov %eax, %cr0
+    ljmpl $0x08, $(TRAMP_BASE + ap_pm32 - ap_trampoline_start)
+
+.code32
+ap_pm32:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %ss
+
+    /* Same long mode setup as start.s, on the BSP's PML4 */
+    mov %cr4, %eax
+    or $CR4_PAE, %eax
+    mov %eax, %cr4
+    mov (TRAMP_BASE + tramp_cr3 - ap_trampoline_start), %eax
+    mov %eax, %cr3
+    mov $EFER_MSR, %ecx
+    rdmsr
+    or $EFER_LME, %eax
+    wrmsr
+    mov %cr0, %eax
+    or $CR0_PG, %eax
+    mov %eax, %cr0
+    ljmp $0x18, $(TRAMP_BASE + ap_lm64 - ap_trampoline_start)
+
+.code64
+ap_lm64:
+    /* Kernel GDT (0x08 code, 0x10 data as in start.s) and the shared IDT */
+    lgdt (TRAMP_BASE + tramp_gdtr - ap_trampoline_start)
+    lidt (TRAMP_BASE + tramp_idtr - ap_trampoline_start)
+    pushq $0x08
+    pushq $(TRAMP_BASE + ap_lm64_cs - ap_trampoline_start)
+    lretq
+ap_lm64_cs:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %ss
+    xor %ax, %ax
+    mov %ax, %fs
+    mov %ax, %gs
+
+    /* Claim a cpu id; past SMP_MAX_CPUS there is no stack or percpu_t */
+    mov $1, %eax
+    lock xadd %eax, (TRAMP_BASE + tramp_next_cpu - ap_trampoline_start)
+    cmp $SMP_MAX_CPUS, %eax
+    jae ap_park
+
+    /* Stack: the top of ap_stacks[cpu - 1] */
+    mov %eax, %ecx
+    shl $AP_STACK_SHIFT, %rcx
+    mov (TRAMP_BASE + tramp_stacks - ap_trampoline_start), %rsp
+    add %rcx, %rsp
+    and $-16, %rsp
+
+    /* SSE, as the BSP enables it in start.s */
+    mov %cr0, %rdx
+    and $0xFFFB, %dx
+    or $0x0002, %dx
+    mov %rdx, %cr0
+    mov %cr4, %rdx
+    or $0x0600, %rdx
+    mov %rdx, %cr4
+
+    mov %eax, %edi
+    mov (TRAMP_BASE + tramp_entry - ap_trampoline_start), %rax
+    call *%rax
+
+ap_park:
+    cli
+    hlt
+    jmp ap_park
+
+.align 8
+tramp_gdt:
+    .quad 0x0000000000000000
+    .quad 0x00CF9A000000FFFF          /* 0x08: 32-bit code */
+    .quad 0x00CF92000000FFFF          /* 0x10: data */
+    .quad 0x00AF9A000000FFFF          /* 0x18: 64-bit code */
+tramp_gdt_end:
+
+tramp_gdt_ptr:
+    .word (tramp_gdt_end - tramp_gdt - 1)
+    .long (TRAMP_BASE + tramp_gdt - ap_trampoline_start)
+
+/* Parameter block, filled in by smp_init() (ap_tramp_params_t) */
+.align 8
+ap_tramp_params:
+tramp_cr3:
+    .quad 0
+tramp_stacks:
+    .quad 0
+tramp_entry:
+    .quad 0
+tramp_next_cpu:
+    .long 1                           /* 0 is the BSP */
+    .long 0
+tramp_gdtr:
+    .skip 16
+tramp_idtr:
+    .skip 16
+ap_trampoline_end:
+
+.section .note.GNU-stack,"",@progbits
@@ -153,9 +153,9 @@ long_mode_entry:
     and $-16, %rsp
     /* sub $8, %rsp <-- REMOVED */
 
-    /* Prepare args: kmain64(uint32_t magic, uint32_t info_ptr) */
-    mov mb2_magic(%rip), %edi
-    mov mb2_info(%rip), %esi
+    /* Prepare args: kmain64(void *info_ptr, uint32_t magic) */
+    mov mb2_info(%rip), %edi
+    mov mb2_magic(%rip), %esi
 
     /* Jump to higher-half entrypoint (linked at KERN_BASE + phys) */
     movabs $higher_half_entry, %rax
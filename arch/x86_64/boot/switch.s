@@ -0,0 +1,32 @@
+/* arch/x86_64/boot/switch.s - Fiber context switch (x86_64)
+ *
+ * void fiber_switch(uintptr_t *save_sp, uintptr_t next_sp)
+ *
+ * The x86_64 twin of fiber_switch in kernel/arch/switch.s: push the
+ * callee-saved registers, save the stack pointer to *save_sp (%rdi),
+ * continue on next_sp (%rsi).
+ */
+
+.section .text
+.global fiber_switch
+
+fiber_switch:
+    push %rbp
+    push %rbx
+    push %r12
+    push %r13
+    push %r14
+    push %r15
+
+    mov %rsp, (%rdi)
+    mov %rsi, %rsp
+
+    pop %r15
+    pop %r14
+    pop %r13
+    pop %r12
+    pop %rbx
+    pop %rbp
+    ret
+
+.section .note.GNU-stack,"",@progbits
@@ -0,0 +1,72 @@
+"""
+Host actuators for CMD_ACT_APPLY.
+
+A batch of settings for one device is applied in order, and the time the
+last one took effect (time.monotonic_ns()) is reported back so ZENEDGE can
+start its monitoring window there. With ZENEDGE_NVML=1 and pynvml
+installed the settings go to NVML (locked graphics clock, power limit) and
+a clock counts as in effect once the device reports it; otherwise they are
+only recorded, which is all the mock kernels need.
+"""
+
+import os
+import time
+from typing import Dict, List, Tuple
+
+from .protocol import ACT_KNOB_CLOCK_MHZ, ACT_KNOB_POWER_W
+
+# How long to watch for a locked clock to show up before calling it applied
+CLOCK_SETTLE_TIMEOUT = 0.05
+CLOCK_SETTLE_POLL = 0.001
+
+
+class HostActuators:
+    def __init__(self, use_nvml: bool = None):
+        if use_nvml is None:
+            use_nvml = os.getenv("ZENEDGE_NVML") == "1"
+        self.nvml = None
+        self.state: Dict[int, Dict[int, int]] = {}
+        if use_nvml:
+            try:
+                import pynvml
+                pynvml.nvmlInit()
+                self.nvml = pynvml
+            except Exception as e:
+                print(f"[ACT] NVML unavailable ({e}); recording settings only")
+
+    def _apply_nvml(self, device: int, knob: int, value: int) -> None:
+        nv = self.nvml
+        handle = nv.nvmlDeviceGetHandleByIndex(device)
+        if knob == ACT_KNOB_CLOCK_MHZ:
+            nv.nvmlDeviceSetGpuLockedClocks(handle, value, value)
+            deadline = time.monotonic() + CLOCK_SETTLE_TIMEOUT
+            while time.monotonic() < deadline:
+                if nv.nvmlDeviceGetClockInfo(handle, nv.NVML_CLOCK_GRAPHICS) <= value:
+                    break
+                time.sleep(CLOCK_SETTLE_POLL)
+        elif knob == ACT_KNOB_POWER_W:
+            nv.nvmlDeviceSetPowerManagementLimit(handle, value * 1000)
+        else:
+            raise ValueError(f"unknown knob {knob}")
+
+    def apply(self, device: int, settings: List[Tuple[int, int]]) -> Tuple[int, int]:
+        """
+        Apply (knob, value) settings to device in order.
+
+        Returns:
+            (mask of failed settings, monotonic_ns when the last one took effect)
+        """
+        failed = 0
+        effect_ns = time.monotonic_ns()
+        for i, (knob, value) in enumerate(settings):
+            try:
+                if self.nvml:
+                    self._apply_nvml(device, knob, value)
+                elif knob not in (ACT_KNOB_CLOCK_MHZ, ACT_KNOB_POWER_W):
+                    raise ValueError(f"unknown knob {knob}")
+                self.state.setdefault(device, {})[knob] = value
+                effect_ns = time.monotonic_ns()
+            except Exception as e:
+                print(f"[ACT] device {device} knob {knob}={value} failed: {e}")
+                failed |= 1 << i
+        return failed, effect_ns
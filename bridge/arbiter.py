@@ -8,7 +8,8 @@ import os
 import urllib.request
 from typing import Any, Dict
 
-from .ifr import parse_ifr_blob
+from .ifr_archive import IFR_ARCHIVE_DIR, IfrArchive
+from .trace import verify_seal
 
 
 def query_next_profile(ifr_raw: bytes, ifr_record: Dict[str, Any]) -> Dict[str, Any]:
@@ -44,25 +45,41 @@ def query_next_profile(ifr_raw: bytes, ifr_record: Dict[str, Any]) -> Dict[str,
     return {"decision_code": 0}
 
 
-def verify_ifr_archive(out_dir: str = "/tmp/zenedge_ifr") -> None:
-    if not os.path.isdir(out_dir):
+def verify_trace_seal(trace_path: str, seal: bytes) -> None:
+    """Recompute an IFR's flight recorder seal from the bridge's trace file."""
+    if not os.path.exists(trace_path):
         return
+    ok = verify_seal(trace_path, seal)
+    if ok:
+        print(f"[ARBITER] flight recorder seal ok: {trace_path}")
+    elif ok is None:
+        print(f"[ARBITER] flight recorder seal not in trace: {trace_path}")
+    else:
+        print(f"[ARBITER] flight recorder seal mismatch: {trace_path}")
+
 
-    bin_files = [f for f in os.listdir(out_dir) if f.endswith(".bin")]
-    if not bin_files:
+def verify_ifr_archive(out_dir: str = "", trace_path: str = "") -> None:
+    """Verify the IFR records archived since the last checkpoint."""
+    out_dir = out_dir or os.getenv("ZENEDGE_IFR_DIR", "").strip() or IFR_ARCHIVE_DIR
+    trace_path = trace_path or os.getenv("ZENEDGE_TRACE", "").strip()
+    if not os.path.isdir(out_dir):
         return
 
-    latest = max(bin_files, key=lambda f: os.path.getmtime(os.path.join(out_dir, f)))
-    path = os.path.join(out_dir, latest)
+    archive = IfrArchive(out_dir)
     try:
-        with open(path, "rb") as f:
-            data = f.read()
-        rec = parse_ifr_blob(data)
-        if not rec:
-            print(f"[ARBITER] IFR verify failed: {path}")
-        elif rec["hash_ok"]:
-            print(f"[ARBITER] IFR verify ok: {path}")
-        else:
-            print(f"[ARBITER] IFR hash mismatch: {path}")
+        res = archive.verify()
     except Exception as exc:
         print(f"[ARBITER] IFR verify error: {exc}")
+        return
+    finally:
+        archive.close()
+
+    if res["bad"]:
+        seg, slot, _ = res["location"]
+        print(f"[ARBITER] IFR {res['bad']}: {out_dir} segment {seg} slot {slot}")
+    if res["verified"]:
+        print(f"[ARBITER] IFR verify ok: {res['verified']} new records in {out_dir} "
+              f"({res['total']} episodes archived)")
+    rec = res["latest"]
+    if rec and trace_path and rec.get("flightrec_seal_hash"):
+        verify_trace_seal(trace_path, rec["flightrec_seal_hash"])
\ No newline at end of file
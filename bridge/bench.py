@@ -0,0 +1,96 @@
+"""
+Kernel microbenchmark results (CMD_BENCH_RESULTS).
+
+Each `bench` run in the ZENEDGE shell sends its results; the bridge keeps
+one file per run, so runs can be compared across builds and hosts.
+
+    python3 -m bridge.bench /tmp/zenedge_bench/latest.bin [older.bin]
+"""
+
+import argparse
+from typing import Optional, Dict, Any
+
+from .protocol import (
+    IPC_BENCH_MAGIC,
+    IPC_BENCH_VERSION,
+    IPC_BENCH_RDTSCP,
+    BENCH_HDR_STRUCT,
+    BENCH_REC_STRUCT,
+)
+
+
+def parse_bench(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode a bench results blob, or None if it is not one."""
+    if not data or len(data) < BENCH_HDR_STRUCT.size:
+        return None
+
+    magic, version, count, tsc_khz, overhead, flags, usec = BENCH_HDR_STRUCT.unpack_from(data, 0)
+    if magic != IPC_BENCH_MAGIC or version != IPC_BENCH_VERSION:
+        return None
+    if len(data) < BENCH_HDR_STRUCT.size + count * BENCH_REC_STRUCT.size:
+        return None
+
+    tests = []
+    off = BENCH_HDR_STRUCT.size
+    for _ in range(count):
+        name, batch, samples, nbytes, lo, p50, p99, hi, mean = BENCH_REC_STRUCT.unpack_from(data, off)
+        off += BENCH_REC_STRUCT.size
+        batch = batch or 1
+        # Per operation from here on
+        tests.append({
+            "name": name.split(b'\x00')[0].decode('utf-8', errors='replace'),
+            "batch": batch,
+            "samples": samples,
+            "bytes": nbytes,
+            "min": lo / batch,
+            "p50": p50 / batch,
+            "p99": p99 / batch,
+            "max": hi / batch,
+            "mean": mean / 256.0 / batch,
+        })
+
+    return {"tsc_khz": tsc_khz, "overhead": overhead, "rdtscp": bool(flags & IPC_BENCH_RDTSCP),
+            "usec": usec, "tests": tests}
+
+
+def render(results: Dict[str, Any], baseline: Optional[Dict[str, Any]] = None) -> str:
+    """Cycles per operation, the median as time, and the median's change
+    against baseline (a parse_bench() of an earlier run), if given."""
+    khz = results["tsc_khz"]
+    lines = [f"bench: tsc={khz} kHz, {results['overhead']} cycles timing overhead "
+             f"({'rdtscp' if results['rdtscp'] else 'rdtsc'})"]
+    lines.append(f"  {'test':<16} {'min':>9} {'p50':>9} {'p99':>9} {'max':>9} {'p50 ns':>10}"
+                 + (f" {'vs base':>8}" if baseline else ""))
+    base = {t["name"]: t for t in baseline["tests"]} if baseline else {}
+    for t in results["tests"]:
+        ns = t["p50"] * 1e6 / khz if khz else 0.0
+        line = (f"  {t['name']:<16} {t['min']:>9.0f} {t['p50']:>9.0f} {t['p99']:>9.0f} "
+                f"{t['max']:>9.0f} {ns:>10.1f}")
+        if baseline:
+            b = base.get(t["name"])
+            line += f" {100.0 * (t['p50'] / b['p50'] - 1):>+7.1f}%" if b and b["p50"] else f" {'-':>8}"
+        if t["bytes"] and ns:
+            line += f"  {t['bytes'] * 1e3 / ns:.0f} MB/s"
+        lines.append(line)
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Render ZENEDGE bench results")
+    parser.add_argument("path", help="saved CMD_BENCH_RESULTS blob")
+    parser.add_argument("baseline", nargs="?", help="earlier run to compare against")
+    args = parser.parse_args()
+
+    runs = []
+    for path in filter(None, (args.path, args.baseline)):
+        with open(path, 'rb') as f:
+            results = parse_bench(f.read())
+        if results is None:
+            print(f"{path}: not bench results")
+            return
+        runs.append(results)
+    print(render(runs[0], runs[1] if len(runs) > 1 else None))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,76 @@
+"""
+Boot profiles (CMD_BOOT_PROFILE).
+
+ZENEDGE timestamps each boot phase from kmain64 onward and sends the list
+once, right after its first action; the bridge keeps one file per boot.
+
+    python3 -m bridge.bootprof /tmp/zenedge_boot_prof/latest.bin
+"""
+
+import argparse
+from typing import Optional, Dict, Any
+
+from .protocol import (
+    IPC_BOOT_PROF_MAGIC,
+    IPC_BOOT_PROF_VERSION,
+    IPC_BOOT_PROF_FAST,
+    BOOT_PROF_HDR_STRUCT,
+    BOOT_PROF_REC_STRUCT,
+)
+
+
+def parse_boot_profile(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode a boot profile blob, or None if it is not one."""
+    if not data or len(data) < BOOT_PROF_HDR_STRUCT.size:
+        return None
+
+    magic, version, flags, count, tsc_khz = BOOT_PROF_HDR_STRUCT.unpack_from(data, 0)
+    if magic != IPC_BOOT_PROF_MAGIC or version != IPC_BOOT_PROF_VERSION:
+        return None
+    if len(data) < BOOT_PROF_HDR_STRUCT.size + count * BOOT_PROF_REC_STRUCT.size:
+        return None
+
+    phases = []
+    off = BOOT_PROF_HDR_STRUCT.size
+    for _ in range(count):
+        usec, name = BOOT_PROF_REC_STRUCT.unpack_from(data, off)
+        off += BOOT_PROF_REC_STRUCT.size
+        phases.append({
+            "name": name.split(b'\x00')[0].decode('utf-8', errors='replace'),
+            "usec": usec,
+        })
+
+    return {"fast": bool(flags & IPC_BOOT_PROF_FAST), "tsc_khz": tsc_khz, "phases": phases}
+
+
+def render(profile: Dict[str, Any]) -> str:
+    """Phases in order: when each finished and how long it took."""
+    phases = profile["phases"]
+    total = phases[-1]["usec"] if phases else 0
+    lines = [f"boot profile: {'fast' if profile['fast'] else 'full'} boot, "
+             f"tsc={profile['tsc_khz']} kHz, {total / 1000.0:.2f} ms"]
+    lines.append(f"  {'phase':<20} {'at us':>10} {'took us':>10} {'%':>6}")
+    prev = 0
+    for p in phases:
+        took = p["usec"] - prev
+        prev = p["usec"]
+        pct = 100.0 * took / total if total else 0.0
+        lines.append(f"  {p['name']:<20} {p['usec']:>10} {took:>10} {pct:>6.1f}")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Render a ZENEDGE boot profile")
+    parser.add_argument("path", help="saved CMD_BOOT_PROFILE blob")
+    args = parser.parse_args()
+
+    with open(args.path, 'rb') as f:
+        profile = parse_boot_profile(f.read())
+    if profile is None:
+        print(f"{args.path}: not a boot profile")
+        return
+    print(render(profile))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+"""
+Bulk upload ring (bridge -> ZENEDGE, credit flow controlled).
+
+Payloads too big for the shared heap, model weights above all, go over
+IPC_REGION_BULK in IPC_BULK_CHUNK_SIZE chunks that ZENEDGE copies out into
+kernel pages. ZENEDGE grants credit as it drains slots, so with two slots
+the bridge fills one while the kernel copies the other, and the upload
+advances a little on every pump() without holding up the command loop.
+
+Kernel:
+- Accepts offers, consumes chunks, grants credit
+
+Host:
+- Offers transfers, produces chunks
+"""
+
+import time
+from typing import Optional
+
+from .protocol import (
+    IPC_BULK_MAGIC,
+    IPC_BULK_CHUNK_SIZE,
+    IPC_BULK_MAX_SIZE,
+    IPC_BULK_OPEN,
+    IPC_BULK_DONE,
+    BULK_LINE0_STRUCT,
+    BULK_BRIDGE_OFFSET,
+    BULK_KERNEL_OFFSET,
+    BULK_KERNEL_STRUCT,
+    BULK_HEADER_SIZE,
+    BULK_CHUNK_HDR_STRUCT,
+    BULK_CHUNK_SIZE,
+)
+
+
+class BulkUpload:
+    """One transfer in progress; advance it with BulkRing.pump()."""
+
+    def __init__(self, xfer_id: int, data: bytes):
+        self.xfer_id = xfer_id
+        self.data = data
+        self.chunks = (len(data) + IPC_BULK_CHUNK_SIZE - 1) // IPC_BULK_CHUNK_SIZE
+        self.head = 0
+        self.accepted = False
+        self.model_id = 0       # ZENEDGE's id for the payload once done
+        self.failed = False
+
+    @property
+    def done(self) -> bool:
+        return self.model_id != 0
+
+
+class BulkRing:
+    def __init__(self, shm, offset: int):
+        self.shm = shm
+        self.offset = offset
+        self.upload: Optional[BulkUpload] = None
+        self._next_xfer = 0
+
+    def _read_u32(self, offset: int) -> int:
+        self.shm.seek(self.offset + offset)
+        return int.from_bytes(self.shm.read(4), 'little')
+
+    def _write_u32(self, offset: int, value: int) -> None:
+        self.shm.seek(self.offset + offset)
+        self.shm.write((value & 0xFFFFFFFF).to_bytes(4, 'little'))
+
+    def _slots(self) -> int:
+        self.shm.seek(self.offset)
+        magic, slots, chunk_size = BULK_LINE0_STRUCT.unpack(self.shm.read(BULK_LINE0_STRUCT.size))
+        if magic != IPC_BULK_MAGIC or chunk_size != IPC_BULK_CHUNK_SIZE:
+            return 0
+        return slots
+
+    def _kernel_state(self):
+        """(accepted, status, credit, tail, model_id)"""
+        self.shm.seek(self.offset + BULK_KERNEL_OFFSET)
+        return BULK_KERNEL_STRUCT.unpack(self.shm.read(BULK_KERNEL_STRUCT.size))
+
+    def ready(self) -> bool:
+        return self._slots() > 0
+
+    def start(self, data: bytes) -> Optional[BulkUpload]:
+        """
+        Offer data for upload, replacing any unfinished transfer. Returns the
+        upload to pump, or None if the ring is absent or data is out of range.
+        """
+        if not self.ready() or not 0 < len(data) <= IPC_BULK_MAX_SIZE:
+            return None
+
+        # Fresh nonzero id, distinct from whatever the ring last carried
+        self._next_xfer = max(self._next_xfer, self._read_u32(BULK_BRIDGE_OFFSET)) + 1
+        if self._next_xfer > 0xFFFFFFFF:
+            self._next_xfer = 1
+        upload = BulkUpload(self._next_xfer, bytes(data))
+
+        self._write_u32(BULK_BRIDGE_OFFSET + 4, len(data))  # total_size
+        self._write_u32(BULK_BRIDGE_OFFSET + 8, 0)          # head
+        self._write_u32(BULK_BRIDGE_OFFSET, upload.xfer_id)  # offer last
+        self.upload = upload
+        print(f"[BULK] Offered {len(data)} bytes as transfer {upload.xfer_id} "
+              f"({upload.chunks} chunks)")
+        return upload
+
+    def pump(self) -> Optional[BulkUpload]:
+        """
+        Publish as many chunks as ZENEDGE has granted credit for. Returns the
+        upload once it finishes or fails (and clears it), else None.
+        """
+        upload = self.upload
+        if upload is None:
+            return None
+
+        accepted, status, credit, _tail, model_id = self._kernel_state()
+        if accepted != upload.xfer_id:
+            return None  # Not answered yet
+
+        if status == IPC_BULK_DONE:
+            upload.model_id = model_id
+            self.upload = None
+            print(f"[BULK] Transfer {upload.xfer_id} done: model {model_id:#x}")
+            return upload
+        if status != IPC_BULK_OPEN:
+            upload.failed = True
+            self.upload = None
+            print(f"[BULK] Transfer {upload.xfer_id} refused (status {status})")
+            return upload
+
+        upload.accepted = True
+        slots = self._slots()
+        if slots == 0:
+            return None
+        while upload.head < upload.chunks and upload.head < credit:
+            index = upload.head
+            payload = upload.data[index * IPC_BULK_CHUNK_SIZE:(index + 1) * IPC_BULK_CHUNK_SIZE]
+            self.shm.seek(self.offset + BULK_HEADER_SIZE + (index % slots) * BULK_CHUNK_SIZE)
+            self.shm.write(BULK_CHUNK_HDR_STRUCT.pack(upload.xfer_id, index, len(payload), 0))
+            self.shm.write(payload)
+            upload.head += 1
+            self._write_u32(BULK_BRIDGE_OFFSET + 8, upload.head)  # publish
+        return None
+
+    def upload_blocking(self, data: bytes, timeout: float = 10.0,
+                        poll_interval: float = 0.0005) -> Optional[int]:
+        """Upload data and wait for it; returns ZENEDGE's model id or None."""
+        if self.start(data) is None:
+            return None
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            finished = self.pump()
+            if finished is not None:
+                return finished.model_id or None
+            time.sleep(poll_interval)
+        print("[BULK] Upload timed out")
+        self.upload = None
+        return None
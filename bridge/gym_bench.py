@@ -0,0 +1,287 @@
+"""
+Closed-loop control benchmark (CMD_ENV_BENCH).
+
+A kernel built with GYM_BENCH=<steps> runs its control loop through a
+warmup, sends CMD_ENV_BENCH, times the next <steps> env steps and sends its
+figures in a second CMD_ENV_BENCH: loop period, obs-to-action time, and how
+much of the window it spent spinning or halted waiting for the bridge. The
+bridge times the same window from the first message: obs publish -> action
+consume for every step, and its own CPU time.
+
+Each bridge writes its run as JSON; run_gym_bench.sh runs every mode and
+merges the runs into one report, compared against a stored baseline:
+
+    python3 -m bridge.gym_bench stream.json blob.json --baseline gym_bench_baseline.json
+"""
+
+import argparse
+import json
+import platform
+import sys
+import time
+from typing import Optional, Dict, Any, List
+
+from .protocol import (
+    IPC_ENV_BENCH_MAGIC,
+    IPC_ENV_BENCH_VERSION,
+    IPC_ENV_BENCH_STREAM,
+    IPC_ENV_BENCH_DONE,
+    IPC_ENV_BENCH_PIPELINE,
+    ENV_BENCH_STRUCT,
+)
+
+REPORT_VERSION = 1
+
+# (metric, +1 if higher is better else -1): what a regression is judged on
+GATED_METRICS = [
+    ("steps_per_sec", +1),
+    ("step_latency_us.p50", -1),
+    ("step_latency_us.p99", -1),
+    ("bridge_cpu_pct", -1),
+    ("kernel.infer_us.p50", -1),
+]
+
+
+def parse_env_bench(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode an ipc_env_bench_t, or None if it is not one."""
+    if not data or len(data) < ENV_BENCH_STRUCT.size:
+        return None
+    f = ENV_BENCH_STRUCT.unpack_from(data, 0)
+    magic, version, flags, envs, steps, episodes, elapsed_us, spin_us, sleep_us = f[:9]
+    if magic != IPC_ENV_BENCH_MAGIC or version != IPC_ENV_BENCH_VERSION:
+        return None
+    return {
+        "mode": ("pipeline" if flags & IPC_ENV_BENCH_PIPELINE else "stream")
+                if flags & IPC_ENV_BENCH_STREAM else "blob",
+        "done": bool(flags & IPC_ENV_BENCH_DONE),
+        "envs": envs,
+        "steps": steps,
+        "episodes": episodes,
+        "elapsed_us": elapsed_us,
+        "spin_us": spin_us,
+        "sleep_us": sleep_us,
+        "period_ns": list(f[9:13]),
+        "infer_ns": list(f[13:17]),
+    }
+
+
+def _pcts_us(ns: List[int]) -> Dict[str, float]:
+    """p50/p90/p99/max/mean of nanosecond samples, in microseconds."""
+    if not ns:
+        return {"p50": 0.0, "p90": 0.0, "p99": 0.0, "max": 0.0, "mean": 0.0}
+    s = sorted(ns)
+
+    def at(q):
+        return s[min(len(s) - 1, int(q * len(s)))] / 1e3
+
+    return {"p50": at(0.50), "p90": at(0.90), "p99": at(0.99),
+            "max": s[-1] / 1e3, "mean": sum(s) / len(s) / 1e3}
+
+
+def _kernel_pcts_us(ns: List[int]) -> Dict[str, float]:
+    return {k: v / 1e3 for k, v in zip(("p50", "p90", "p99", "max"), ns)}
+
+
+def make_run(kernel: Dict[str, Any], bridge: str, env: str, seed: Optional[int],
+             latency_ns: List[int], bridge_steps: int, wall_s: float,
+             cpu_s: float) -> Dict[str, Any]:
+    """One run: the kernel's final CMD_ENV_BENCH and the bridge's window."""
+    elapsed_us = kernel["elapsed_us"] or 1
+    spin, sleep = kernel["spin_us"], kernel["sleep_us"]
+    return {
+        "name": f"{bridge}-{kernel['mode']}",
+        "mode": kernel["mode"],
+        "bridge": bridge,
+        "env": env,
+        "seed": seed,
+        "envs": kernel["envs"],
+        "steps": kernel["steps"],
+        "episodes": kernel["episodes"],
+        "elapsed_s": elapsed_us / 1e6,
+        "steps_per_sec": kernel["steps"] * 1e6 / elapsed_us,
+        "step_latency_us": _pcts_us(latency_ns),
+        "bridge_steps": bridge_steps,
+        "bridge_cpu_pct": 100.0 * cpu_s / wall_s if wall_s > 0 else 0.0,
+        "kernel": {
+            "spin_us": spin,
+            "sleep_us": sleep,
+            "spin_pct": 100.0 * spin / elapsed_us,
+            "idle_pct": 100.0 * sleep / elapsed_us,
+            "busy_pct": max(0.0, 100.0 * (elapsed_us - spin - sleep) / elapsed_us),
+            "period_us": _kernel_pcts_us(kernel["period_ns"]),
+            "infer_us": _kernel_pcts_us(kernel["infer_ns"]),
+        },
+    }
+
+
+class BenchRecorder:
+    """The bridge's side of a GYM_BENCH window.
+
+    The gym agent calls published() when an observation is out (stream
+    push, or the blob handed back in a CMD_ENV_RESET / CMD_ENV_STEP reply)
+    and consumed() when the action for it is in (a full batch, in vector
+    mode). A pipelined vector has two groups in flight, each timed on its
+    own. command() takes the CMD_ENV_BENCH payloads; after the second,
+    run holds the result and finished is set.
+    """
+
+    def __init__(self, bridge: str, env: str, seed: Optional[int], out_path: Optional[str]):
+        self.bridge = bridge
+        self.env = env
+        self.seed = seed
+        self.out_path = out_path
+        self.active = False
+        self.finished = False
+        self.run: Optional[Dict[str, Any]] = None
+        self._pub_ns: Dict[int, int] = {}  # Group -> its obs publish time
+        self._lat_ns: List[int] = []
+        self._steps = 0
+        self._envs = 1
+        self._wall0 = 0.0
+        self._cpu0 = 0.0
+
+    def published(self, group: int = 0):
+        if self.active:
+            self._pub_ns[group] = time.monotonic_ns()
+
+    def consumed(self, envs: int = 1, group: int = 0):
+        pub_ns = self._pub_ns.pop(group, 0) if self.active else 0
+        if pub_ns:
+            self._lat_ns.append(time.monotonic_ns() - pub_ns)
+            self._steps += envs
+
+    def command(self, data: bytes) -> bool:
+        k = parse_env_bench(data)
+        if k is None:
+            return False
+        if not k["done"]:
+            self._lat_ns = []
+            self._steps = 0
+            self._pub_ns = {}
+            self._wall0 = time.monotonic()
+            self._cpu0 = time.process_time()
+            self.active = True
+            print(f"[BENCH] Window open: {k['mode']} mode, {k['envs']} env(s) per step")
+            return True
+
+        wall_s = time.monotonic() - self._wall0
+        cpu_s = time.process_time() - self._cpu0
+        self.active = False
+        self.run = make_run(k, self.bridge, self.env, self.seed, self._lat_ns,
+                            self._steps, wall_s, cpu_s)
+        self.finished = True
+        print(render({"runs": {self.run["name"]: self.run}}))
+        if self.out_path:
+            with open(self.out_path, "w") as f:
+                json.dump(self.run, f, indent=2)
+            print(f"[BENCH] Run saved to {self.out_path}")
+        return True
+
+
+def _metric(run: Dict[str, Any], path: str) -> Optional[float]:
+    v: Any = run
+    for key in path.split("."):
+        if not isinstance(v, dict) or key not in v:
+            return None
+        v = v[key]
+    return float(v)
+
+
+def compare(report: Dict[str, Any], baseline: Dict[str, Any],
+            threshold_pct: float) -> List[Dict[str, Any]]:
+    """Gated metrics of every run the baseline also has, with their change;
+    `regressed` is set where one moved the wrong way by more than threshold_pct."""
+    rows = []
+    base_runs = baseline.get("runs", {})
+    for name, run in report["runs"].items():
+        base = base_runs.get(name)
+        if not base:
+            continue
+        for metric, sign in GATED_METRICS:
+            now, was = _metric(run, metric), _metric(base, metric)
+            if now is None or was is None or was == 0:
+                continue
+            change = 100.0 * (now / was - 1.0)
+            rows.append({"run": name, "metric": metric, "baseline": was, "value": now,
+                         "change_pct": change, "regressed": -sign * change > threshold_pct})
+    return rows
+
+
+def render(report: Dict[str, Any], rows: Optional[List[Dict[str, Any]]] = None) -> str:
+    lines = []
+    for name, r in report["runs"].items():
+        lat, k = r["step_latency_us"], r["kernel"]
+        lines.append(f"{name}: {r['env']} seed={r['seed']} envs={r['envs']} "
+                     f"{r['steps']} steps, {r['episodes']} episodes in {r['elapsed_s']:.2f} s")
+        lines.append(f"  {r['steps_per_sec']:10.0f} steps/s   bridge CPU {r['bridge_cpu_pct']:5.1f}%")
+        lines.append(f"  obs publish -> action consume (us): p50 {lat['p50']:.1f}  "
+                     f"p90 {lat['p90']:.1f}  p99 {lat['p99']:.1f}  max {lat['max']:.1f}")
+        lines.append(f"  kernel: spin {k['spin_pct']:.1f}%  idle {k['idle_pct']:.1f}%  "
+                     f"busy {k['busy_pct']:.1f}%   infer p50 {k['infer_us']['p50']:.1f} us  "
+                     f"period p50 {k['period_us']['p50']:.1f} p99 {k['period_us']['p99']:.1f} us")
+    if rows:
+        lines.append(f"  {'run':<16} {'metric':<22} {'baseline':>10} {'now':>10} {'change':>8}")
+        for row in rows:
+            lines.append(f"  {row['run']:<16} {row['metric']:<22} {row['baseline']:>10.1f} "
+                         f"{row['value']:>10.1f} {row['change_pct']:>+7.1f}%"
+                         + ("  REGRESSION" if row["regressed"] else ""))
+    return "\n".join(lines)
+
+
+def _load_runs(paths: List[str]) -> Dict[str, Dict[str, Any]]:
+    """Runs from per-bridge run files or earlier merged reports."""
+    runs = {}
+    for path in paths:
+        with open(path) as f:
+            doc = json.load(f)
+        for run in doc["runs"].values() if "runs" in doc else [doc]:
+            runs[run["name"]] = run
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Merge and compare ZENEDGE control-loop benchmark runs")
+    parser.add_argument("runs", nargs="+", help="run files written by the bridges (or merged reports)")
+    parser.add_argument("--baseline", help="report to compare against")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="percent a gated metric may worsen before it is a regression")
+    parser.add_argument("--out", help="write the merged report here")
+    parser.add_argument("--save-baseline", action="store_true",
+                        help="write the merged report over --baseline instead of comparing")
+    args = parser.parse_args()
+
+    report = {"version": REPORT_VERSION,
+              "created": time.strftime("%Y-%m-%dT%H:%M:%S"),
+              "host": platform.node(),
+              "runs": _load_runs(args.runs)}
+
+    rows = []
+    if args.baseline and not args.save_baseline:
+        try:
+            with open(args.baseline) as f:
+                baseline = json.load(f)
+        except OSError:
+            print(f"{args.baseline}: no baseline yet (run with --save-baseline)")
+        else:
+            rows = compare(report, baseline, args.threshold)
+            report["baseline"] = {"path": args.baseline, "created": baseline.get("created"),
+                                  "threshold_pct": args.threshold}
+            report["comparison"] = rows
+
+    print(render(report, rows))
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(report, f, indent=2)
+    if args.save_baseline and args.baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(report, f, indent=2)
+        print(f"Baseline saved to {args.baseline}")
+
+    regressions = [r for r in rows if r["regressed"]]
+    if regressions:
+        print(f"{len(regressions)} regression(s) beyond {args.threshold:.1f}%")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -5,15 +5,24 @@ Handler functions for each IPC command type.
 Each handler receives the bridge and packet, returns (status, result).
 """
 
-from typing import Tuple, TYPE_CHECKING
+from typing import Dict, Optional, Tuple, TYPE_CHECKING
 import numpy as np
 
 from .protocol import (
     CMD_PING,
     CMD_PRINT,
     CMD_RUN_MODEL,
+    CMD_RUN_MODEL_BATCH,
     CMD_IFR_PERSIST,
     CMD_TELEMETRY_POLL,
+    CMD_ACT_APPLY,
+    CMD_WASM_PROFILE,
+    CMD_BOOT_PROFILE,
+    CMD_BENCH_RESULTS,
+    CMD_PROF_SAMPLES,
+    CMD_JOB_STATUS,
+    ACT_MAX_SETTINGS,
+    ACT_SETTING_STRUCT,
     RSP_OK,
     RSP_ERROR,
     RSP_BUSY,
@@ -21,12 +30,20 @@ from .protocol import (
     BLOB_TYPE_RESULT,
     BLOB_TYPE_RAW,
     IFR_V2_STRUCT,
-    TELEMETRY_STRUCT,
+    IFR_VERSION_V4,
+    IPC_RUN_BATCH_MAX,
+    RUN_BATCH_ENTRY_STRUCT,
+    RUN_BATCH_HDR_STRUCT,
     Packet,
 )
 from .ifr import parse_ifr_blob
+from .telemetry import sample_telemetry
+from .wasm_prof import parse_profile, render as render_wasm_profile
+from .bootprof import parse_boot_profile, render as render_boot_profile
+from .bench import parse_bench, render as render_bench
+from .prof import parse_prof, load_symbols, render as render_prof
+from .jobs import parse_status, render_status
 
-import json
 import os
 import time
 
@@ -46,15 +63,17 @@ def handle_ping(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
 
 def handle_print(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
     """
-    Handle CMD_PRINT - print string from heap blob.
+    Handle CMD_PRINT - print string from heap blob or inline payload.
 
     The payload_id should reference a blob containing a UTF-8 string.
     """
-    if packet.payload_id == 0:
+    if packet.inline:
+        data = packet.inline
+    elif packet.payload_id == 0:
         print("[HANDLER] PRINT: (no payload)")
         return RSP_OK, 0
-
-    data = bridge.heap.read_blob_data(packet.payload_id)
+    else:
+        data = bridge.heap.read_blob_data(packet.payload_id)
     if data is None:
         print(f"[HANDLER] PRINT: blob {packet.payload_id} not found")
         return RSP_ERROR, 0
@@ -72,13 +91,21 @@ def handle_print(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
 
 def handle_ifr_persist(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
     """
-    Handle CMD_IFR_PERSIST - persist a kernel-generated IFR record.
+    Handle CMD_IFR_PERSIST - append a kernel-generated IFR record to the
+    archive (bridge/ifr_archive.py).
+
+    v4 batches (header + episode leaves) come in a blob ZENEDGE leaves to
+    us, so it is freed whatever the outcome.
     """
-    if packet.payload_id == 0:
+    if packet.inline:
+        data = packet.inline
+    elif packet.payload_id == 0:
         print("[HANDLER] IFR_PERSIST: missing payload")
         return RSP_ERROR, 0
-
-    data = bridge.heap.read_blob_data(packet.payload_id)
+    else:
+        data = bridge.heap.read_blob_data(packet.payload_id)
+        if data and int.from_bytes(data[4:6], "little") == IFR_VERSION_V4:
+            bridge.heap.free_blob(packet.payload_id)
     if not data or len(data) < IFR_V2_STRUCT.size:
         print("[HANDLER] IFR_PERSIST: invalid blob data")
         return RSP_ERROR, 0
@@ -88,52 +115,32 @@ def handle_ifr_persist(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, in
         print("[HANDLER] IFR_PERSIST: invalid IFR record")
         return RSP_ERROR, 0
 
-    hash_ok = parsed["hash_ok"]
-
-    record = {
-        "magic": hex(parsed["magic"]),
-        "version": parsed["version"],
-        "flags": parsed["flags"],
-        "job_id": parsed["job_id"],
-        "episode_id": parsed["episode_id"],
-        "model_id": parsed["model_id"],
-        "record_size": parsed["record_size"],
-        "ts_usec": parsed["ts_usec"],
-        "goodput": parsed["goodput"],
-        "profile_len": parsed["profile_len"],
-        "profile": parsed["profile"],
-        "hash": parsed["hash"].hex(),
-        "hash_ok": hash_ok,
-    }
-
-    out_dir = "/tmp/zenedge_ifr"
-    os.makedirs(out_dir, exist_ok=True)
-    stamp = int(time.time())
-    base = f"{out_dir}/ifr-{parsed['job_id']}-{parsed['episode_id']}-{stamp}"
-    with open(base + ".json", "w", encoding="utf-8") as f:
-        json.dump(record, f, indent=2, sort_keys=True)
-    with open(base + ".bin", "wb") as f:
-        record_size = int(parsed.get("record_size", len(data)))
-        f.write(data[:record_size])
-
-    if not hash_ok:
-        print("[HANDLER] IFR_PERSIST: hash mismatch")
+    # A record that fails its own hash would stop every later verification
+    if not parsed["hash_ok"]:
+        print("[HANDLER] IFR_PERSIST: hash mismatch, not archived")
         return RSP_ERROR, 0
 
-    print(f"[HANDLER] IFR_PERSIST: wrote {base}.json")
+    # One copy into the mapped segment log; the index entries follow it
+    seg, slot, _ = bridge.ifr_archive.append(data, parsed)
+
+    what = (f"batch of {parsed['count']}" if parsed["version"] == IFR_VERSION_V4
+            else f"episode {parsed['episode_id']}")
+    print(f"[HANDLER] IFR_PERSIST: job {parsed['job_id']} {what} at segment {seg} slot {slot}")
     return RSP_OK, 0
 
 
 def handle_telemetry_poll(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
     """
-    Handle CMD_TELEMETRY_POLL - return a telemetry snapshot blob.
+    Handle CMD_TELEMETRY_POLL - return a telemetry snapshot blob, or the
+    snapshot inline when asked over the message ring.
+
+    Current kernels read the seqlock telemetry page instead; this remains
+    for older images.
     """
-    ts_usec = int(time.time() * 1_000_000)
-    gpu_temp = float(os.getenv("ZENEDGE_GPU_TEMP_C", "70.0"))
-    rdma_qp_depth = float(os.getenv("ZENEDGE_RDMA_QP_DEPTH", "128.0"))
-    numa_locality = float(os.getenv("ZENEDGE_NUMA_LOCALITY", "1.0"))
+    data = sample_telemetry()
+    if packet.via_msg:
+        return RSP_OK, len(data), data
 
-    data = TELEMETRY_STRUCT.pack(ts_usec, gpu_temp, rdma_qp_depth, numa_locality)
     blob_id = bridge.heap.allocate_blob(len(data), BLOB_TYPE_RAW)
     if not blob_id:
         return RSP_ERROR, 0
@@ -142,6 +149,174 @@ def handle_telemetry_poll(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int,
     return RSP_OK, blob_id
 
 
+def handle_act_apply(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_ACT_APPLY - apply a batch of actuator settings to device
+    payload_id and report how long ago the last one took effect.
+    """
+    data = packet.inline or b''
+    count = len(data) // ACT_SETTING_STRUCT.size
+    if count == 0 or count > ACT_MAX_SETTINGS:
+        return RSP_ERROR, 0
+
+    settings = []
+    for i in range(count):
+        knob, _reserved, value = ACT_SETTING_STRUCT.unpack_from(data, i * ACT_SETTING_STRUCT.size)
+        settings.append((knob, value))
+    failed, effect_ns = bridge.actuators.apply(packet.payload_id, settings)
+    if failed:
+        return RSP_ERROR, failed
+
+    age_us = max(0, (time.monotonic_ns() - effect_ns) // 1000)
+    return RSP_OK, min(age_us, 0xFFFFFFFF)
+
+
+def handle_job_status(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_JOB_STATUS - how a graph queued on the job ring fared.
+    payload_id is the graph's blob, ours again now: free it.
+    """
+    data = packet.inline or b''
+    st = bridge.jobs.complete(packet.payload_id, data) if bridge.jobs else parse_status(data)
+    bridge.heap.free_blob(packet.payload_id)
+    if st is None:
+        return RSP_ERROR, 0
+    print(f"[HANDLER] JOB_STATUS: {render_status(st)}")
+    return RSP_OK, 0
+
+
+def handle_wasm_profile(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_WASM_PROFILE - save and print a wasm agent profile dump.
+
+    ZENEDGE leaves the blob to us, so it is freed whatever the outcome.
+    """
+    if packet.payload_id == 0:
+        return RSP_ERROR, 0
+
+    data = bridge.heap.read_blob_data(packet.payload_id)
+    bridge.heap.free_blob(packet.payload_id)
+    profile = parse_profile(data) if data else None
+    if profile is None:
+        print("[HANDLER] WASM_PROFILE: invalid dump")
+        return RSP_ERROR, 0
+
+    out_dir = "/tmp/zenedge_wasm_prof"
+    os.makedirs(out_dir, exist_ok=True)
+    path = os.path.join(out_dir, f"wasm_prof_{int(time.time())}.bin")
+    with open(path, "wb") as f:
+        f.write(data)
+    latest = os.path.join(out_dir, "latest.bin")
+    with open(latest, "wb") as f:
+        f.write(data)
+
+    print(f"[HANDLER] WASM_PROFILE: {len(profile['records'])} records -> {path}")
+    print(render_wasm_profile(profile, top=10))
+    return RSP_OK, 0
+
+
+def handle_boot_profile(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_BOOT_PROFILE - save and print a guest's boot phase times.
+
+    ZENEDGE leaves the blob to us, so it is freed whatever the outcome.
+    """
+    if packet.payload_id == 0:
+        return RSP_ERROR, 0
+
+    data = bridge.heap.read_blob_data(packet.payload_id)
+    bridge.heap.free_blob(packet.payload_id)
+    profile = parse_boot_profile(data) if data else None
+    if profile is None:
+        print("[HANDLER] BOOT_PROFILE: invalid profile")
+        return RSP_ERROR, 0
+
+    out_dir = "/tmp/zenedge_boot_prof"
+    os.makedirs(out_dir, exist_ok=True)
+    path = os.path.join(out_dir, f"boot_prof_{int(time.time())}.bin")
+    with open(path, "wb") as f:
+        f.write(data)
+    latest = os.path.join(out_dir, "latest.bin")
+    with open(latest, "wb") as f:
+        f.write(data)
+
+    print(f"[HANDLER] BOOT_PROFILE: {len(profile['phases'])} phases -> {path}")
+    print(render_boot_profile(profile))
+    return RSP_OK, 0
+
+
+def handle_bench_results(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_BENCH_RESULTS - archive and print a shell `bench` run.
+
+    ZENEDGE leaves the blob to us, so it is freed whatever the outcome.
+    """
+    if packet.payload_id == 0:
+        return RSP_ERROR, 0
+
+    data = bridge.heap.read_blob_data(packet.payload_id)
+    bridge.heap.free_blob(packet.payload_id)
+    results = parse_bench(data) if data else None
+    if results is None:
+        print("[HANDLER] BENCH_RESULTS: invalid results")
+        return RSP_ERROR, 0
+
+    out_dir = "/tmp/zenedge_bench"
+    os.makedirs(out_dir, exist_ok=True)
+    latest = os.path.join(out_dir, "latest.bin")
+    baseline = None
+    if os.path.exists(latest):
+        with open(latest, "rb") as f:
+            baseline = parse_bench(f.read())
+    path = os.path.join(out_dir, f"bench_{time.time_ns()}.bin")
+    with open(path, "wb") as f:
+        f.write(data)
+    with open(latest, "wb") as f:
+        f.write(data)
+
+    print(f"[HANDLER] BENCH_RESULTS: {len(results['tests'])} tests -> {path}")
+    print(render_bench(results, baseline))
+    return RSP_OK, 0
+
+
+def handle_prof_samples(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_PROF_SAMPLES - save a shell `prof` run and print its flat
+    profile, symbolized if the kernel image is at hand ($ZENEDGE_ELF or
+    ./zenedge.bin; `python3 -m bridge.prof` does more with the file).
+
+    ZENEDGE leaves the blob to us, so it is freed whatever the outcome.
+    """
+    if packet.payload_id == 0:
+        return RSP_ERROR, 0
+
+    data = bridge.heap.read_blob_data(packet.payload_id)
+    bridge.heap.free_blob(packet.payload_id)
+    profile = parse_prof(data) if data else None
+    if profile is None:
+        print("[HANDLER] PROF_SAMPLES: invalid profile")
+        return RSP_ERROR, 0
+
+    out_dir = "/tmp/zenedge_prof"
+    os.makedirs(out_dir, exist_ok=True)
+    path = os.path.join(out_dir, f"prof_{time.time_ns()}.bin")
+    for p in (path, os.path.join(out_dir, "latest.bin")):
+        with open(p, "wb") as f:
+            f.write(data)
+
+    print(f"[HANDLER] PROF_SAMPLES: {len(profile['samples'])} samples -> {path}")
+    print(render_prof(profile, load_symbols(None), top=15))
+    return RSP_OK, 0
+
+
+def _model_for_shape(shape) -> str:
+    """Model to run on an input of this shape (CMD_RUN_MODEL carries no name)."""
+    # Heuristic for demo until protocol allows passing model name in Run
+    if tuple(shape) == (1, 784):
+        return "linear"
+    return "default"
+
+
 def handle_run_model(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
     """
     Handle CMD_RUN_MODEL - run ORT inference on tensor.
@@ -154,7 +329,7 @@ def handle_run_model(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]
         print("[HANDLER] RUN_MODEL: no input tensor")
         return RSP_ERROR, 0
 
-    # Read input tensor (Note: HeapManager could return a zero-copy view if optimized that way)
+    # A view on the blob in the mmap
     input_tensor = bridge.heap.read_tensor(packet.payload_id)
     if input_tensor is None:
         print(f"[HANDLER] RUN_MODEL: tensor {packet.payload_id} not found")
@@ -162,40 +337,18 @@ def handle_run_model(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]
 
     # Ensure float32 (ORT standard)
     if input_tensor.dtype != np.float32:
-        # print(f"[HANDLER] Promoting {input_tensor.dtype} to float32")
         input_tensor = input_tensor.astype(np.float32)
 
-    # print(f"[HANDLER] RUN_MODEL: input shape={input_tensor.shape}")
-
     try:
-        # Get ORT session (using "default" if no model ID/flag passed yet - protocol limitation?)
-        # TODO: Protocol upgrade should pass Model Name ID. For now, we reuse packet.flags or similar?
-        # Actually CMD_MODEL_LOAD sets context?
-        # Let's default to "default" for M0 parity, or "linear" if shape matches 784
-        
-        model_name = "default"
-        # Heuristic for demo until protocol allows passing model name in Run
-        if input_tensor.shape == (1, 784):
-            model_name = "linear"
-
-        session = bridge.model_cache.get_or_load(model_name)
-
-        # Get input name (assume single input for now)
-        input_name = session.get_inputs()[0].name
-        output_name = session.get_outputs()[0].name
-        
-        # Run inference
-        result = session.run([output_name], {input_name: input_tensor})[0]
-
-        # print(f"[HANDLER] RUN_MODEL: output shape={result.shape}")
-
-        # Allocate result blob and write tensor
-        result_id = bridge.heap.allocate_tensor(result)
+        # CMD_RUN_MODEL carries no model name: pick by input shape
+        name = _model_for_shape(input_tensor.shape)
+        session = bridge.model_cache.get_or_load(name)
+
+        with bridge.span('onnx', 'onnx', shape=list(input_tensor.shape)):
+            result_id = _run_to_blob(bridge, session, name, input_tensor)
         if result_id is None:
             print("[HANDLER] RUN_MODEL: failed to allocate result blob")
             return RSP_ERROR, 0
-
-        # print(f"[HANDLER] RUN_MODEL: result in blob {result_id}")
         return RSP_OK, result_id
 
     except Exception as e:
@@ -205,6 +358,138 @@ def handle_run_model(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]
         return RSP_ERROR, 0
 
 
+def _run_session(session, inputs: np.ndarray) -> np.ndarray:
+    input_name = session.get_inputs()[0].name
+    output_name = session.get_outputs()[0].name
+    return session.run([output_name], {input_name: inputs})[0]
+
+
+# (model, input shape) -> output shape, for outputs whose declared shape
+# has symbolic dimensions: learned from the first run, copied out as usual
+_output_shapes: Dict[Tuple[str, Tuple[int, ...]], Tuple[int, ...]] = {}
+
+
+def _output_shape(session, name: str, shape: Tuple[int, ...]) -> Optional[Tuple[int, ...]]:
+    """The float32 output's shape for this input, if known before running."""
+    output = session.get_outputs()[0]
+    if output.type != 'tensor(float)':
+        return None
+    dims = tuple(output.shape or ())
+    if dims and all(isinstance(d, int) and d > 0 for d in dims):
+        return dims
+    return _output_shapes.get((name, tuple(shape)))
+
+
+def _run_to_blob(bridge: 'ZenedgeBridge', session, name: str,
+                 inputs: np.ndarray) -> Optional[int]:
+    """
+    Run the session on inputs and return the result blob.
+
+    With the output shape known, ORT reads the input where it lies (the
+    read_tensor() view into the mmap) and writes its output straight into
+    a freshly allocated tensor blob through IOBinding: no copy either way.
+    Otherwise (first run of a dynamic-shape model, no single chunk big
+    enough, no IOBinding) the output is run into ORT's own buffer and
+    copied into the heap.
+    """
+    inputs = np.ascontiguousarray(inputs)
+    out_shape = _output_shape(session, name, inputs.shape)
+    target = (bridge.heap.allocate_tensor_view(out_shape)
+              if out_shape is not None and hasattr(session, 'io_binding') else None)
+    if target is not None:
+        blob_id, out = target
+        try:
+            binding = session.io_binding()
+            binding.bind_cpu_input(session.get_inputs()[0].name, inputs)
+            binding.bind_output(session.get_outputs()[0].name, 'cpu', 0, np.float32,
+                                list(out_shape), out.ctypes.data)
+            session.run_with_iobinding(binding)
+            out = None  # Drop the mmap export before anything can close it
+            bridge.heap.seal_blob(blob_id)
+            return blob_id
+        except Exception as e:
+            print(f"[HANDLER] IOBinding run failed ({e}), copying the output instead")
+            out = None
+            bridge.heap.free_blob(blob_id)
+
+    result = _run_session(session, inputs)
+    if result.dtype == np.float32:
+        _output_shapes[(name, tuple(inputs.shape))] = tuple(result.shape)
+    return bridge.heap.allocate_tensor(np.ascontiguousarray(result))
+
+
+def handle_run_model_batch(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
+    """
+    Handle CMD_RUN_MODEL_BATCH - one ORT call for several CMD_RUN_MODELs.
+
+    The payload blob (ours to free) lists (input blob, tag) entries. Inputs
+    of the same shape are stacked along the batch axis and run together;
+    each entry is answered with its own CMD_RUN_MODEL response carrying its
+    tag, before this command's response (result = entries answered).
+    """
+    data = bridge.heap.read_blob_data(packet.payload_id) if packet.payload_id else None
+    if packet.payload_id:
+        bridge.heap.free_blob(packet.payload_id)
+    if not data or len(data) < RUN_BATCH_HDR_STRUCT.size:
+        print("[HANDLER] RUN_MODEL_BATCH: invalid batch blob")
+        return RSP_ERROR, 0
+
+    count, model = RUN_BATCH_HDR_STRUCT.unpack_from(data, 0)
+    if (count == 0 or count > IPC_RUN_BATCH_MAX or
+            len(data) < RUN_BATCH_HDR_STRUCT.size + count * RUN_BATCH_ENTRY_STRUCT.size):
+        print(f"[HANDLER] RUN_MODEL_BATCH: bad entry count {count}")
+        return RSP_ERROR, 0
+    entries = [RUN_BATCH_ENTRY_STRUCT.unpack_from(
+                   data, RUN_BATCH_HDR_STRUCT.size + i * RUN_BATCH_ENTRY_STRUCT.size)
+               for i in range(count)]
+
+    t_start = time.time()
+    answers = {}  # entry index -> (status, result blob)
+    groups = {}   # input shape -> [(entry index, tensor)]
+    for i, (blob_id, _tag) in enumerate(entries):
+        tensor = bridge.heap.read_tensor(blob_id) if blob_id else None
+        if tensor is None:
+            answers[i] = (RSP_ERROR, 0)
+            continue
+        groups.setdefault(tensor.shape, []).append((i, tensor.astype(np.float32, copy=False)))
+
+    for shape, items in groups.items():
+        try:
+            # model 0: pick by input shape, as for CMD_RUN_MODEL
+            name = f"model{model}" if model else _model_for_shape(shape)
+            session = bridge.model_cache.get_or_load(name)
+            outputs = None
+            with bridge.span('onnx', 'onnx', shape=list(shape), count=len(items)):
+                if len(items) > 1 and len(shape) >= 2:
+                    try:
+                        stacked = _run_session(session, np.concatenate([t for _, t in items]))
+                        if stacked.shape[0] == len(items) * shape[0]:
+                            outputs = np.split(stacked, len(items))
+                    except Exception:
+                        pass  # Fixed batch dimension: run them one by one
+                if outputs is None:
+                    for i, t in items:
+                        result_id = _run_to_blob(bridge, session, name, t)
+                        answers[i] = ((RSP_OK, result_id) if result_id is not None
+                                      else (RSP_ERROR, 0))
+                    continue
+            for (i, _), result in zip(items, outputs):
+                result_id = bridge.heap.allocate_tensor(np.ascontiguousarray(result))
+                answers[i] = (RSP_OK, result_id) if result_id is not None else (RSP_ERROR, 0)
+        except Exception as e:
+            print(f"[HANDLER] RUN_MODEL_BATCH error: {e}")
+            for i, _ in items:
+                answers[i] = (RSP_ERROR, 0)
+
+    duration_us = int((time.time() - t_start) * 1_000_000)
+    for i, (_blob_id, tag) in enumerate(entries):
+        status, result = answers.get(i, (RSP_ERROR, 0))
+        bridge.send_response(status, CMD_RUN_MODEL, result, duration_us, tag)
+
+    print(f"[HANDLER] RUN_MODEL_BATCH: {count} requests in {len(groups)} ORT call group(s)")
+    return RSP_OK, count
+
+
 def handle_tensor_alloc(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int]:
     """
     Handle tensor allocation request.
@@ -252,6 +537,8 @@ def handle_heap_stats(bridge: 'ZenedgeBridge', packet: Packet) -> Tuple[int, int
     print(f"  Free: {stats['free_bytes']} bytes ({stats['free_blocks']} blocks)")
     print(f"  Used: {stats['total_bytes'] - stats['free_bytes']} bytes")
     print(f"  Next blob_id: {stats['next_blob_id']}")
+    if stats['blob_slots']:
+        print(f"  Blobs: {stats['blob_count']}/{stats['blob_slots']} slots live")
 
     return RSP_OK, stats['free_blocks']
 
@@ -302,7 +589,14 @@ def register_all_handlers(bridge: 'ZenedgeBridge'):
     bridge.register_handler(CMD_PRINT, handle_print)
     bridge.register_handler(CMD_IFR_PERSIST, handle_ifr_persist)
     bridge.register_handler(CMD_TELEMETRY_POLL, handle_telemetry_poll)
+    bridge.register_handler(CMD_ACT_APPLY, handle_act_apply)
     bridge.register_handler(CMD_RUN_MODEL, handle_run_model)
+    bridge.register_handler(CMD_RUN_MODEL_BATCH, handle_run_model_batch)
+    bridge.register_handler(CMD_WASM_PROFILE, handle_wasm_profile)
+    bridge.register_handler(CMD_BOOT_PROFILE, handle_boot_profile)
+    bridge.register_handler(CMD_BENCH_RESULTS, handle_bench_results)
+    bridge.register_handler(CMD_PROF_SAMPLES, handle_prof_samples)
+    bridge.register_handler(CMD_JOB_STATUS, handle_job_status)
 
     # Extended commands
     bridge.register_handler(CMD_TENSOR_ALLOC, handle_tensor_alloc)
@@ -315,7 +609,14 @@ def register_all_handlers(bridge: 'ZenedgeBridge'):
     print(f"  CMD_PRINT ({CMD_PRINT:#06x})")
     print(f"  CMD_IFR_PERSIST ({CMD_IFR_PERSIST:#06x})")
     print(f"  CMD_TELEMETRY_POLL ({CMD_TELEMETRY_POLL:#06x})")
+    print(f"  CMD_ACT_APPLY ({CMD_ACT_APPLY:#06x})")
     print(f"  CMD_RUN_MODEL ({CMD_RUN_MODEL:#06x})")
+    print(f"  CMD_RUN_MODEL_BATCH ({CMD_RUN_MODEL_BATCH:#06x})")
+    print(f"  CMD_WASM_PROFILE ({CMD_WASM_PROFILE:#06x})")
+    print(f"  CMD_BOOT_PROFILE ({CMD_BOOT_PROFILE:#06x})")
+    print(f"  CMD_BENCH_RESULTS ({CMD_BENCH_RESULTS:#06x})")
+    print(f"  CMD_PROF_SAMPLES ({CMD_PROF_SAMPLES:#06x})")
+    print(f"  CMD_JOB_STATUS ({CMD_JOB_STATUS:#06x})")
     print(f"  CMD_TENSOR_ALLOC ({CMD_TENSOR_ALLOC:#06x})")
     print(f"  CMD_TENSOR_FREE ({CMD_TENSOR_FREE:#06x})")
     print(f"  CMD_HEAP_STATS ({CMD_HEAP_STATS:#06x})")
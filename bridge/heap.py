@@ -2,11 +2,21 @@
 ZENEDGE Shared Heap Manager
 
 Manages blob and tensor read/write operations in the shared memory heap.
-The heap uses a bitmap allocator with 64-byte blocks.
+Version 3 heaps are split into a kernel arena and a bridge arena, each a
+buddy allocator over 64-byte blocks with its free lists in the shared control
+block. The bridge only writes its own arena, so it allocates concurrently with
+ZENEDGE; kernel-owned blobs freed here go back through the kernel arena's
+return queue. Version 4 adds slab pools of preformatted same-size blobs that
+are drawn and recycled without touching the allocator, and version 5
+reference counts blobs so either side can share one: free_blob releases a
+reference and the last release frees the blob. Payloads larger than any
+free chunk go in scatter-gather chains (BLOB_TYPE_SG) of ordinary blobs,
+read back as a list of memoryviews. Version 1 heaps only
+have the used-block bitmap, which is searched a 64-bit word at a time.
 """
 
 import mmap
-from typing import Optional, Dict, Tuple
+from typing import Optional, Dict, List, Tuple
 import numpy as np
 
 from .protocol import (
@@ -14,79 +24,323 @@ from .protocol import (
     IPC_HEAP_DATA_OFFSET,
     IPC_HEAP_DATA_SIZE,
     HEAP_BLOCK_SIZE,
-    HEAP_MAX_BLOCKS,
-    HEAP_BITMAP_SIZE,
     HEAP_CTL_HEADER_SIZE,
+    HEAP_CTL_V4_SIZE,
+    HEAP_ARENA_KERNEL,
+    HEAP_ARENA_BRIDGE,
+    HEAP_POOLS,
+    HEAP_SG_MAX_EXTENTS,
+    HEAP_SG_SIZE,
+    HEAP_POOL_DEPTH,
+    HEAP_POOL_FREE_COUNT_OFFSET,
+    HEAP_POOL_FREE_IDS_OFFSET,
+    HEAP_POOL_STRUCT,
+    HEAP_ARENA_FREE_HEAD_OFFSET,
+    HEAP_ARENA_RET_HEAD_OFFSET,
+    HEAP_ARENA_RET_IDS_OFFSET,
+    HEAP_RETURN_SLOTS,
+    HEAP_BUDDY_NIL,
+    HEAP_FREE_MAGIC,
+    HEAP_FREE_CHUNK_STRUCT,
+    HEAP_BLOB_SLOT_STRUCT,
+    HEAP_BLOB_SLOT_SIZE,
     BLOB_MAGIC,
+    BLOB_FLAG_POOLED,
+    BLOB_FLAG_CSUM_CRC32C,
+    BLOB_FLAG_CSUM_NONE,
+    BLOB_TAKEN_OFFSET,
+    BLOB_DROPPED_OFFSET,
+    IPC_HEAP_VERSION_REFS,
     IPC_HEAP_MAGIC,
+    BLOB_TYPE_RAW,
     BLOB_TYPE_TENSOR,
     BLOB_TYPE_RESULT,
+    BLOB_TYPE_SG,
     BLOB_HEADER_SIZE,
     TENSOR_HEADER_SIZE,
+    TENSOR_QUANT_NONE,
+    TENSOR_QUANT_PER_TENSOR,
+    TENSOR_QUANT_PER_CHANNEL,
+    tensor_quant_params,
+    DTYPE_BFLOAT16,
     DTYPE_TO_NUMPY,
     NUMPY_TO_DTYPE,
     DTYPE_SIZES,
     BlobHeader,
     TensorHeader,
+    HeapArena,
+    HeapPool,
+    HeapSg,
     HeapControl,
-    compute_checksum,
+    blob_checksum,
 )
 
 
+def _quant_mode(quant) -> int:
+    if quant is None:
+        return TENSOR_QUANT_NONE
+    return TENSOR_QUANT_PER_TENSOR if len(quant[0]) == 1 else TENSOR_QUANT_PER_CHANNEL
+
+
+def to_bfloat16(arr: np.ndarray) -> np.ndarray:
+    """float values -> bfloat16 bit patterns (uint16), round to nearest even."""
+    u = np.ascontiguousarray(arr, dtype=np.float32).view(np.uint32)
+    rounded = ((u + 0x7FFF + ((u >> 16) & 1)) >> 16).astype(np.uint16)
+    quiet_nan = ((u >> 16) | 0x40).astype(np.uint16)
+    return np.where((u & 0x7FFFFFFF) > 0x7F800000, quiet_nan, rounded)
+
+
+def from_bfloat16(bits: np.ndarray) -> np.ndarray:
+    """bfloat16 bit patterns (as read from a DTYPE_BFLOAT16 tensor) -> float32."""
+    return (np.asarray(bits, dtype=np.uint16).astype(np.uint32) << 16).view(np.float32)
+
+
+def _as_dtype(arr: np.ndarray, dtype: int) -> np.ndarray:
+    """arr in the numpy type that carries DTYPE_* dtype."""
+    if dtype == DTYPE_BFLOAT16:
+        return arr if arr.dtype == np.uint16 else to_bfloat16(arr)
+    if dtype not in DTYPE_TO_NUMPY:
+        raise ValueError(f"unknown tensor dtype {dtype}")
+    return np.ascontiguousarray(arr, dtype=DTYPE_TO_NUMPY[dtype])
+
+
+def _tensor_bytes(arr: np.ndarray, quant) -> bytes:
+    """Elements, then the quantization parameters if any."""
+    data = arr.tobytes()
+    if quant is None:
+        return data
+    scale, zero_point = quant
+    if len(scale) not in (1, arr.shape[0]):
+        raise ValueError(f"{len(scale)} scales for a tensor of {arr.shape[0]} channels")
+    return data + tensor_quant_params(len(data), list(scale), list(zero_point))
+
+
 class HeapManager:
     """
     Manages the shared heap region for blob and tensor storage.
 
     The heap layout:
-    - Control block at IPC_HEAP_CTL_OFFSET (magic, counters, bitmap)
-    - Data region at IPC_HEAP_DATA_OFFSET (blob headers + data)
+    - Control block (magic, counters, bitmap, blob table)
+    - Data region (blob headers + data)
+
+    Blob ids resolve through the shared blob table in O(1). Images without
+    a table (blob_slots == 0) fall back to scanning the data region.
+
+    Offsets default to the fixed 1MB layout; pass the negotiated heap
+    regions when ZENEDGE published a layout descriptor.
     """
 
-    def __init__(self, shm: mmap.mmap):
+    def __init__(self, shm: mmap.mmap, ctl_offset: int = IPC_HEAP_CTL_OFFSET,
+                 data_offset: int = IPC_HEAP_DATA_OFFSET,
+                 data_size: int = IPC_HEAP_DATA_SIZE):
         self.shm = shm
-        self.ctl_offset = IPC_HEAP_CTL_OFFSET
-        self.data_offset = IPC_HEAP_DATA_OFFSET
-        self.data_size = IPC_HEAP_DATA_SIZE
-
-        # Cache of known blob locations: blob_id -> offset from data_offset
+        self.ctl_offset = ctl_offset
+        self.data_offset = data_offset
+        self.data_size = data_size
+        self.max_blocks = data_size // HEAP_BLOCK_SIZE
+        self.alloc_failures: Dict[int, int] = {}  # Chunk bytes -> failed allocations
+        self.bitmap_size = (self.max_blocks + 7) // 8
+
+        # Legacy (no blob table) scan cache: blob_id -> offset from data_offset
         self._blob_cache: Dict[int, int] = {}
 
     def _read_heap_control(self) -> HeapControl:
         """Read the heap control block."""
         self.shm.seek(self.ctl_offset)
-        data = self.shm.read(HEAP_CTL_HEADER_SIZE)
+        data = self.shm.read(HEAP_CTL_V4_SIZE)
         return HeapControl.unpack(data)
 
-    def _read_bitmap(self) -> bytes:
+    def _read_bitmap(self, ctl: HeapControl) -> bytes:
         """Read the heap bitmap."""
-        self.shm.seek(self.ctl_offset + HEAP_CTL_HEADER_SIZE)
-        return self.shm.read(HEAP_BITMAP_SIZE)
+        self.shm.seek(self.ctl_offset + ctl.header_size)
+        return self.shm.read(self.bitmap_size)
+
+    def _bitmap_fill(self, ctl: HeapControl, start: int, count: int, used: bool):
+        """Mark [start, start + count) used or free, touching only those bytes."""
+        end = min(start + count, self.max_blocks)
+        if start >= end:
+            return
+        first, last = start // 8, (end - 1) // 8
+        base = self.ctl_offset + ctl.header_size
+        self.shm.seek(base + first)
+        span = bytearray(self.shm.read(last - first + 1))
+        head_mask = (0xFF << (start % 8)) & 0xFF
+        tail_mask = 0xFF >> (7 - (end - 1) % 8)
+        masks = [0xFF] * len(span)
+        masks[0] &= head_mask
+        masks[-1] &= tail_mask
+        for i, mask in enumerate(masks):
+            span[i] = (span[i] | mask) if used else (span[i] & ~mask & 0xFF)
+        self.shm.seek(base + first)
+        self.shm.write(bytes(span))
+
+    def _bitmap_test(self, ctl: HeapControl, block: int) -> bool:
+        if block >= self.max_blocks:
+            return True  # Out of range = used
+        self.shm.seek(self.ctl_offset + ctl.header_size + block // 8)
+        return bool((self.shm.read(1)[0] >> (block % 8)) & 1)
+
+    # -- Arena fields (only the bridge arena is ever written) ----------------
+
+    def _arena_offset(self, arena: HeapArena) -> int:
+        return self.ctl_offset + arena.offset
+
+    def _write_arena_u32(self, arena: HeapArena, offset: int, value: int):
+        self.shm.seek(self._arena_offset(arena) + offset)
+        self.shm.write((value & 0xFFFFFFFF).to_bytes(4, 'little'))
+
+    def _set_arena(self, arena: HeapArena, **fields):
+        """Write counters of our own arena (free_blocks, next_slot, ...)."""
+        offsets = {'free_blocks': 8, 'next_slot': 24, 'blob_count': 28}
+        for name, value in fields.items():
+            setattr(arena, name, value)
+            self._write_arena_u32(arena, offsets[name], value)
+
+    # -- Buddy free lists (mirrors kernel/ipc/heap.c, arena-relative) ---------
+
+    def _chunk_offset(self, arena: HeapArena, block: int) -> int:
+        return self.data_offset + (arena.base_block + block) * HEAP_BLOCK_SIZE
+
+    def _read_chunk(self, arena: HeapArena, block: int) -> Tuple[int, int, int, int]:
+        """(magic, order, next, prev) of the free chunk header at a block."""
+        self.shm.seek(self._chunk_offset(arena, block))
+        return HEAP_FREE_CHUNK_STRUCT.unpack(self.shm.read(HEAP_FREE_CHUNK_STRUCT.size))
+
+    def _write_chunk(self, arena: HeapArena, block: int, magic: int, order: int,
+                     nxt: int, prev: int):
+        self.shm.seek(self._chunk_offset(arena, block))
+        self.shm.write(HEAP_FREE_CHUNK_STRUCT.pack(magic, order, nxt, prev))
+
+    def _write_free_head(self, arena: HeapArena, order: int, block: int):
+        arena.free_head[order] = block
+        self._write_arena_u32(arena, HEAP_ARENA_FREE_HEAD_OFFSET + order * 4, block)
+
+    def _buddy_push(self, arena: HeapArena, block: int, order: int):
+        head = arena.free_head[order]
+        self._write_chunk(arena, block, HEAP_FREE_MAGIC, order, head, HEAP_BUDDY_NIL)
+        if head != HEAP_BUDDY_NIL:
+            magic, o, nxt, _prev = self._read_chunk(arena, head)
+            self._write_chunk(arena, head, magic, o, nxt, block)
+        self._write_free_head(arena, order, block)
+
+    def _buddy_unlink(self, arena: HeapArena, block: int, order: int):
+        _magic, _o, nxt, prev = self._read_chunk(arena, block)
+        if prev != HEAP_BUDDY_NIL:
+            m, o, _n, p = self._read_chunk(arena, prev)
+            self._write_chunk(arena, prev, m, o, nxt, p)
+        else:
+            self._write_free_head(arena, order, nxt)
+        if nxt != HEAP_BUDDY_NIL:
+            m, o, n, _p = self._read_chunk(arena, nxt)
+            self._write_chunk(arena, nxt, m, o, n, prev)
+        self._write_chunk(arena, block, 0, order, HEAP_BUDDY_NIL, HEAP_BUDDY_NIL)
+
+    def _buddy_alloc(self, ctl: HeapControl, arena: HeapArena, order: int) -> Optional[int]:
+        """Take a 2^order chunk (arena-relative block), splitting if needed."""
+        k = order
+        while k < arena.buddy_orders and arena.free_head[k] == HEAP_BUDDY_NIL:
+            k += 1
+        if k >= arena.buddy_orders:
+            return None
+        block = arena.free_head[k]
+        self._buddy_unlink(arena, block, k)
+        while k > order:
+            k -= 1
+            self._buddy_push(arena, block + (1 << k), k)
+        self._bitmap_fill(ctl, arena.base_block + block, 1 << order, True)
+        return block
+
+    def _buddy_free(self, ctl: HeapControl, arena: HeapArena, block: int, order: int):
+        """Free a 2^order chunk, merging with free buddies."""
+        self._bitmap_fill(ctl, arena.base_block + block, 1 << order, False)
+        while order + 1 < arena.buddy_orders:
+            buddy = block ^ (1 << order)
+            if buddy + (1 << order) > arena.blocks:
+                break
+            magic, buddy_order, _n, _p = self._read_chunk(arena, buddy)
+            if (self._bitmap_test(ctl, arena.base_block + buddy) or
+                    magic != HEAP_FREE_MAGIC or buddy_order != order):
+                break
+            self._buddy_unlink(arena, buddy, order)
+            block = min(block, buddy)
+            order += 1
+        self._buddy_push(arena, block, order)
 
-    def _write_bitmap(self, bitmap: bytes):
-        """Write the heap bitmap."""
-        self.shm.seek(self.ctl_offset + HEAP_CTL_HEADER_SIZE)
-        self.shm.write(bitmap)
+    def _largest_order(self, arena: HeapArena) -> Optional[int]:
+        """Order of an arena's largest free chunk; list heads only, safe on ZENEDGE's."""
+        return next((k for k in reversed(range(arena.buddy_orders))
+                     if arena.free_head[k] != HEAP_BUDDY_NIL), None)
 
-    def _update_heap_control(self, free_blocks: int, next_blob_id: int):
-        """Update free_blocks and next_blob_id in heap control."""
-        # Read current control to preserve other fields
-        ctl = self._read_heap_control()
+    def _alloc_failed(self, order: int):
+        size = HEAP_BLOCK_SIZE << order
+        self.alloc_failures[size] = self.alloc_failures.get(size, 0) + 1
+
+    # -- Return queues: frees of blobs the other side owns --------------------
 
-        # Write back with updated values
+    def _push_return(self, arena: HeapArena, blob_id: int) -> bool:
+        """Hand a foreign blob back to its owner (we only write ret.head)."""
+        if arena.ret_head - arena.ret_tail >= HEAP_RETURN_SLOTS:
+            return False
+        slot = arena.ret_head & (HEAP_RETURN_SLOTS - 1)
+        self.shm.seek(self._arena_offset(arena) + HEAP_ARENA_RET_IDS_OFFSET + slot * 2)
+        self.shm.write(blob_id.to_bytes(2, 'little'))
+        self._write_arena_u32(arena, HEAP_ARENA_RET_HEAD_OFFSET, arena.ret_head + 1)
+        return True
+
+    def _drain_returns(self, ctl: HeapControl):
+        """Free the blobs ZENEDGE handed back to the bridge arena."""
+        arena = ctl.arenas[HEAP_ARENA_BRIDGE]
+        tail, head = arena.ret_tail, arena.ret_head
+        while tail != head:
+            slot = tail & (HEAP_RETURN_SLOTS - 1)
+            self.shm.seek(self._arena_offset(arena) + HEAP_ARENA_RET_IDS_OFFSET + slot * 2)
+            self._free_local(ctl, int.from_bytes(self.shm.read(2), 'little'), queued=True)
+            tail = (tail + 1) & 0xFFFFFFFF
+        if tail != arena.ret_tail:
+            arena.ret_tail = tail
+            self._write_arena_u32(arena, HEAP_ARENA_RET_HEAD_OFFSET + 4, tail)
+
+    def _update_heap_control(self, **fields):
+        """Update counters in heap control, preserving the other fields."""
+        ctl = self._read_heap_control()
+        for name, value in fields.items():
+            setattr(ctl, name, value)
         self.shm.seek(self.ctl_offset)
-        import struct
-        from .protocol import HEAP_CTL_STRUCT
-        data = HEAP_CTL_STRUCT.pack(
-            ctl.magic, ctl.version, ctl.total_blocks,
-            free_blocks, next_blob_id, 0, 0, 0
-        )
-        self.shm.write(data)
+        self.shm.write(ctl.pack())
+
+    def _slot_offset(self, ctl: HeapControl, slot: int) -> int:
+        return self.ctl_offset + ctl.blob_table + slot * HEAP_BLOB_SLOT_SIZE
+
+    def _read_slot(self, ctl: HeapControl, slot: int) -> Tuple[int, int, int, int]:
+        """(offset, blocks, blob_id, generation) of a blob table entry."""
+        self.shm.seek(self._slot_offset(ctl, slot))
+        return HEAP_BLOB_SLOT_STRUCT.unpack(self.shm.read(HEAP_BLOB_SLOT_SIZE))
+
+    def _write_slot_id(self, ctl: HeapControl, slot: int, blob_id: int):
+        self.shm.seek(self._slot_offset(ctl, slot) + 8)
+        self.shm.write(blob_id.to_bytes(2, 'little'))
+
+    def _lookup_slot(self, blob_id: int) -> Optional[Tuple[int, int]]:
+        """(offset, blocks) for a live blob via the blob table, or None."""
+        ctl = self._read_heap_control()
+        if blob_id == 0 or ctl.magic != IPC_HEAP_MAGIC or not ctl.blob_slots:
+            return None
+        offset, blocks, live_id, _gen = self._read_slot(ctl, blob_id & (ctl.blob_slots - 1))
+        if live_id != blob_id or offset + BLOB_HEADER_SIZE > self.data_size:
+            return None
+        return offset, blocks
 
     def _find_blob_offset(self, blob_id: int) -> Optional[int]:
         """
-        Find a blob by ID by scanning the heap data region.
+        Find a blob by ID: one blob table read, or a scan of the heap data
+        region on images without a table.
         Returns offset from data_offset, or None if not found.
         """
+        ctl = self._read_heap_control()
+        if ctl.blob_slots:
+            entry = self._lookup_slot(blob_id)
+            return entry[0] if entry else None
+
         # Check cache first
         if blob_id in self._blob_cache:
             return self._blob_cache[blob_id]
@@ -169,6 +423,9 @@ class HeapManager:
             print(f"[HEAP] Invalid blob magic for blob {blob_id}")
             return None
 
+        if blob_header.type == BLOB_TYPE_SG:
+            return self._read_sg_tensor(blob_id)
+
         if blob_header.type != BLOB_TYPE_TENSOR:
             print(f"[HEAP] Blob {blob_id} is not a tensor (type={blob_header.type})")
             return None
@@ -216,6 +473,108 @@ class HeapManager:
              arr = arr.reshape(tensor_header.shape)
              return arr
 
+    # -- Scatter-gather chains ------------------------------------------------
+
+    def read_sg(self, blob_id: int) -> Optional[HeapSg]:
+        """Read a chain's descriptor, or None if blob_id is not a chain."""
+        header = self.read_blob_header(blob_id)
+        if header is None or header.magic != BLOB_MAGIC or header.type != BLOB_TYPE_SG:
+            return None
+        return HeapSg.unpack(self.read_blob_data(blob_id))
+
+    def sg_view(self, blob_id: int) -> Optional[List[memoryview]]:
+        """
+        Zero-copy iovec of a chain: one writable memoryview per extent, in
+        payload order. None if blob_id is not a chain or an extent is gone.
+        """
+        sg = self.read_sg(blob_id)
+        if sg is None:
+            return None
+        views = []
+        for ext_id, size in sg.extents:
+            offset = self._find_blob_offset(ext_id)
+            if offset is None or self._read_header(offset).size < size:
+                print(f"[HEAP] Chain {blob_id}: extent {ext_id} missing")
+                return None
+            start = self.data_offset + offset + BLOB_HEADER_SIZE
+            views.append(memoryview(self.shm)[start:start + size])
+        return views
+
+    def write_sg(self, blob_id: int, data: bytes) -> bool:
+        """Scatter data over a chain's extents from the start of its payload."""
+        views = self.sg_view(blob_id)
+        if views is None:
+            return False
+        if len(data) > sum(len(v) for v in views):
+            print(f"[HEAP] Data too large for chain {blob_id}")
+            return False
+        pos = 0
+        for view in views:
+            n = min(len(view), len(data) - pos)
+            view[:n] = data[pos:pos + n]
+            pos += n
+        return True
+
+    def _read_sg_tensor(self, blob_id: int) -> Optional[np.ndarray]:
+        """A chained tensor, gathered into one contiguous copy."""
+        sg = self.read_sg(blob_id)
+        views = self.sg_view(blob_id)
+        if sg is None or views is None or sg.inner_type != BLOB_TYPE_TENSOR:
+            print(f"[HEAP] Blob {blob_id} is not a chained tensor")
+            return None
+        payload = b''.join(views)
+        if len(payload) < TENSOR_HEADER_SIZE:
+            print(f"[HEAP] Chain {blob_id} too small for a tensor header")
+            return None
+
+        tensor_header = TensorHeader.unpack(payload)
+        if tensor_header.dtype not in DTYPE_TO_NUMPY:
+            print(f"[HEAP] Unknown tensor dtype {tensor_header.dtype}")
+            return None
+        num_elements = 1
+        for dim in tensor_header.shape:
+            num_elements *= dim
+        if TENSOR_HEADER_SIZE + num_elements * DTYPE_SIZES[tensor_header.dtype] > len(payload):
+            print(f"[HEAP] Tensor shape exceeds chain {blob_id}")
+            return None
+
+        arr = np.frombuffer(payload, dtype=DTYPE_TO_NUMPY[tensor_header.dtype],
+                            count=num_elements, offset=TENSOR_HEADER_SIZE)
+        return arr.reshape(tensor_header.shape)
+
+    def allocate_sg(self, size: int, inner_type: int = BLOB_TYPE_RAW) -> Optional[int]:
+        """
+        Allocate a chain of size payload bytes from the bridge arena, like
+        heap_alloc_sg(): each extent fills the largest free chunk. free_blob
+        of the chain frees its extents too. Version 5 heaps only.
+        """
+        ctl = self._read_heap_control()
+        if ctl.magic != IPC_HEAP_MAGIC or ctl.version < IPC_HEAP_VERSION_REFS or size <= 0:
+            return None
+
+        sg_id = self.allocate_blob(HEAP_SG_SIZE, BLOB_TYPE_SG)
+        if sg_id is None:
+            return None
+        sg = HeapSg(size, inner_type, [])
+
+        left = size
+        while left > 0:
+            order = self._largest_order(self._read_heap_control().arenas[HEAP_ARENA_BRIDGE])
+            ext_id = None
+            if order is not None and len(sg.extents) < HEAP_SG_MAX_EXTENTS:
+                piece = min(left, (HEAP_BLOCK_SIZE << order) - BLOB_HEADER_SIZE)
+                ext_id = self.allocate_blob(piece, BLOB_TYPE_RAW, BLOB_FLAG_CSUM_NONE)
+            if ext_id is None:
+                print(f"[HEAP] Chain allocation failed: {left} bytes unplaced")
+                self.write_blob_data(sg_id, sg.pack())
+                self.free_blob(sg_id)  # Takes the extents placed so far with it
+                return None
+            sg.extents.append((ext_id, piece))
+            left -= piece
+
+        self.write_blob_data(sg_id, sg.pack())
+        return sg_id
+
     def write_blob_data(self, blob_id: int, data: bytes) -> bool:
         """
         Write data to an existing blob (overwrites data portion only).
@@ -243,18 +602,25 @@ class HeapManager:
         self.shm.seek(self.data_offset + offset + BLOB_HEADER_SIZE)
         self.shm.write(data)
 
-        # Update checksum in header
-        header.checksum = compute_checksum(data)
-        self.shm.seek(self.data_offset + offset)
-        self.shm.write(header.pack())
+        # Update checksum in header, in the blob's checksum mode
+        if not header.flags & BLOB_FLAG_CSUM_NONE:
+            self._seal(offset, header)
 
         return True
 
-    def write_tensor_to_blob(self, blob_id: int, arr: np.ndarray) -> bool:
+    def write_tensor_to_blob(self, blob_id: int, arr: np.ndarray,
+                             quant: Optional[Tuple[List[float], List[int]]] = None,
+                             dtype: Optional[int] = None) -> bool:
         """
         Write a numpy array to an existing tensor blob.
         The blob must already be allocated with BLOB_TYPE_TENSOR.
+        quant: (scales, zero points) of an integer array, one pair for the
+        whole tensor or one per index of its first dimension.
+        dtype: store as this DTYPE_*; DTYPE_BFLOAT16 converts float arrays
+        (uint16 arrays are taken as bit patterns).
         """
+        if dtype is not None:
+            arr = _as_dtype(arr, dtype)
         offset = self._find_blob_offset(blob_id)
         if offset is None:
             print(f"[HEAP] Blob {blob_id} not found for tensor write")
@@ -271,11 +637,12 @@ class HeapManager:
 
         # Get dtype
         dtype_str = str(arr.dtype)
-        if dtype_str not in NUMPY_TO_DTYPE:
+        if dtype is None and dtype_str not in NUMPY_TO_DTYPE:
             print(f"[HEAP] Unsupported numpy dtype {dtype_str}")
             return False
 
-        dtype = NUMPY_TO_DTYPE[dtype_str]
+        if dtype is None:
+            dtype = NUMPY_TO_DTYPE[dtype_str]
         ndim = len(arr.shape)
 
         if ndim > 4:
@@ -288,10 +655,10 @@ class HeapManager:
         strides = arr.strides
 
         # Create tensor header
-        tensor_header = TensorHeader(dtype, ndim, arr.shape, strides)
+        tensor_header = TensorHeader(dtype, ndim, arr.shape, strides, _quant_mode(quant))
 
         # Check if data fits
-        tensor_data = arr.tobytes()
+        tensor_data = _tensor_bytes(arr, quant)
         total_size = TENSOR_HEADER_SIZE + len(tensor_data)
 
         if total_size > header.size:
@@ -306,18 +673,28 @@ class HeapManager:
         self.shm.write(tensor_data)
 
         # Update blob header checksum
-        all_data = tensor_header.pack() + tensor_data
-        header.checksum = compute_checksum(all_data)
-        self.shm.seek(self.data_offset + offset)
-        self.shm.write(header.pack())
+        if not header.flags & BLOB_FLAG_CSUM_NONE:
+            self._seal(offset, header)
 
         return True
 
-    def allocate_blob(self, size: int, blob_type: int = BLOB_TYPE_RESULT) -> Optional[int]:
+    def _seal(self, offset: int, header: BlobHeader):
+        """Checksum the whole data region like heap_blob_seal(); store only that word."""
+        start = self.data_offset + offset + BLOB_HEADER_SIZE
+        checksum = blob_checksum(self.shm[start:start + header.size], header.flags)
+        self.shm.seek(self.data_offset + offset + 16)  # heap_blob_t.checksum
+        self.shm.write(checksum.to_bytes(4, 'little'))
+
+    def allocate_blob(self, size: int, blob_type: int = BLOB_TYPE_RESULT,
+                      flags: Optional[int] = None) -> Optional[int]:
         """
         Allocate a new blob in the heap.
 
-        This modifies the bitmap and heap control block.
+        flags selects the checksum mode (BLOB_FLAG_CSUM_*); by default tensors
+        use CRC32C, like heap_alloc_tensor, and other blobs the legacy sum.
+
+        Version 3 heaps allocate from the bridge arena only; version 1 heaps
+        modify the shared bitmap and heap control block.
         Returns blob_id on success, None on failure.
         """
         # Calculate blocks needed (including blob header)
@@ -331,100 +708,197 @@ class HeapManager:
             print("[HEAP] Heap not initialized (invalid magic)")
             return None
 
+        if flags is None:
+            flags = BLOB_FLAG_CSUM_CRC32C if blob_type == BLOB_TYPE_TENSOR else 0
+
+        if ctl.arenas:
+            return self._allocate_arena(ctl, size, blob_type, flags, blocks_needed)
+
         if ctl.free_blocks < blocks_needed:
             print(f"[HEAP] Not enough free blocks ({ctl.free_blocks} < {blocks_needed})")
             return None
 
-        # Read bitmap
-        bitmap = bytearray(self._read_bitmap())
-
-        # Find contiguous free blocks
-        start_block = self._find_free_blocks(bitmap, blocks_needed)
+        # Get next blob ID: a free table slot plus its next generation
+        slot = None
+        if ctl.blob_slots:
+            slot = self._find_free_slot(ctl, 0, ctl.blob_slots, ctl.next_blob_id)
+            if slot is None:
+                print(f"[HEAP] All {ctl.blob_slots} blob slots live")
+                return None
+            blob_id, generation = self._next_id(ctl, slot)
+        else:
+            blob_id = ctl.next_blob_id
+            if blob_id == 0:
+                blob_id = 1  # IDs start at 1
+
+        start_block = self._find_free_blocks(self._read_bitmap(ctl), blocks_needed)
         if start_block is None:
             print(f"[HEAP] No contiguous region of {blocks_needed} blocks")
             return None
+        self._bitmap_fill(ctl, start_block, blocks_needed, True)
 
-        # Mark blocks as used
-        for i in range(blocks_needed):
-            block = start_block + i
-            byte_idx = block // 8
-            bit_idx = block % 8
-            bitmap[byte_idx] |= (1 << bit_idx)
+        data_offset = start_block * HEAP_BLOCK_SIZE
+        self._write_blob_header(blob_id, blob_type, flags, size, data_offset)
+
+        if slot is not None:
+            self._publish_slot(ctl, slot, blob_id, generation, data_offset, blocks_needed)
+            self._update_heap_control(
+                free_blocks=ctl.free_blocks - blocks_needed,
+                next_blob_id=(slot + 1) & (ctl.blob_slots - 1),
+                blob_count=ctl.blob_count + 1
+            )
+        else:
+            self._update_heap_control(
+                free_blocks=ctl.free_blocks - blocks_needed,
+                next_blob_id=blob_id + 1
+            )
+            # Cache the new blob location
+            self._blob_cache[blob_id] = data_offset
 
-        # Get next blob ID
-        blob_id = ctl.next_blob_id
-        if blob_id == 0:
-            blob_id = 1  # IDs start at 1
+        print(f"[HEAP] Allocated blob {blob_id}: {blocks_needed} blocks at offset {data_offset:#x}")
+        return blob_id
 
-        # Calculate offset in data region
-        data_offset = start_block * HEAP_BLOCK_SIZE
+    def _allocate_arena(self, ctl: HeapControl, size: int, blob_type: int, flags: int,
+                        blocks_needed: int) -> Optional[int]:
+        """Version 3: buddy-allocate from the bridge arena, lock-free."""
+        self._drain_returns(ctl)
+        arena = ctl.arenas[HEAP_ARENA_BRIDGE]
+
+        # Buddy arenas hand out power-of-two chunks
+        order = (blocks_needed - 1).bit_length()
+        if order >= arena.buddy_orders:
+            self._alloc_failed(arena.buddy_orders - 1)
+            print(f"[HEAP] {size} bytes exceeds the bridge arena")
+            return None
+        blocks_needed = 1 << order
+
+        slot = self._find_free_slot(ctl, arena.slot_base, arena.slot_count, arena.next_slot)
+        if slot is None:
+            self._alloc_failed(order)
+            print(f"[HEAP] All {arena.slot_count} bridge blob slots live")
+            return None
+
+        block = self._buddy_alloc(ctl, arena, order)
+        if block is None:
+            self._alloc_failed(order)
+            print(f"[HEAP] No free chunk of {blocks_needed} blocks in the bridge arena")
+            return None
+
+        blob_id, generation = self._next_id(ctl, slot)
+        data_offset = (arena.base_block + block) * HEAP_BLOCK_SIZE
+        self._write_blob_header(blob_id, blob_type, flags, size, data_offset)
+        self._publish_slot(ctl, slot, blob_id, generation, data_offset, blocks_needed)
+        self._set_arena(arena,
+                        free_blocks=arena.free_blocks - blocks_needed,
+                        next_slot=(slot - arena.slot_base + 1) % arena.slot_count,
+                        blob_count=arena.blob_count + 1)
+
+        print(f"[HEAP] Allocated blob {blob_id}: {blocks_needed} blocks at offset {data_offset:#x}")
+        return blob_id
 
-        # Create blob header
+    def _find_free_slot(self, ctl: HeapControl, base: int, count: int,
+                        start: int) -> Optional[int]:
+        """First free blob table slot in [base, base + count), from start."""
+        for i in range(count):
+            slot = base + (start + i) % count
+            if self._read_slot(ctl, slot)[2] == 0:
+                return slot
+        return None
+
+    def _next_id(self, ctl: HeapControl, slot: int) -> Tuple[int, int]:
+        """(blob_id, generation) for the slot's next generation, never 0."""
+        generation = self._read_slot(ctl, slot)[3]
+        shift = ctl.blob_slots.bit_length() - 1
+        blob_id = 0
+        while blob_id == 0:
+            generation = (generation + 1) & 0xFFFF
+            blob_id = ((generation << shift) | slot) & 0xFFFF
+        return blob_id, generation
+
+    def _write_blob_header(self, blob_id: int, blob_type: int, flags: int, size: int,
+                           data_offset: int):
         header = BlobHeader(
             magic=BLOB_MAGIC,
             blob_id=blob_id,
             type=blob_type,
-            flags=0,
+            flags=flags,
             size=size,
-            offset=data_offset,
-            checksum=0
+            offset=data_offset + BLOB_HEADER_SIZE,  # Data, as heap_get_data() reads it
+            checksum=0,
+            taken=[0, 1]  # The caller's reference (HEAP_ARENA_BRIDGE)
         )
-
-        # Write blob header
         self.shm.seek(self.data_offset + data_offset)
         self.shm.write(header.pack())
 
-        # Write updated bitmap
-        self._write_bitmap(bytes(bitmap))
-
-        # Update heap control
-        self._update_heap_control(
-            free_blocks=ctl.free_blocks - blocks_needed,
-            next_blob_id=blob_id + 1
-        )
+    def _publish_slot(self, ctl: HeapControl, slot: int, blob_id: int, generation: int,
+                      data_offset: int, blocks: int):
+        """Fill a blob table entry, blob_id last so lookups never see half of it."""
+        self.shm.seek(self._slot_offset(ctl, slot))
+        self.shm.write(HEAP_BLOB_SLOT_STRUCT.pack(data_offset, blocks, 0, generation))
+        self._write_slot_id(ctl, slot, blob_id)
 
-        # Cache the new blob location
-        self._blob_cache[blob_id] = data_offset
-
-        print(f"[HEAP] Allocated blob {blob_id}: {blocks_needed} blocks at offset {data_offset:#x}")
-        return blob_id
-
-    def _find_free_blocks(self, bitmap: bytearray, count: int) -> Optional[int]:
-        """Find a contiguous run of 'count' free blocks in the bitmap."""
-        run_start = None
+    def _find_free_blocks(self, bitmap: bytes, count: int) -> Optional[int]:
+        """
+        Find a contiguous run of 'count' free blocks in the bitmap (version 1
+        heaps). Scans 64-bit words, jumping between runs with a
+        count-trailing-zeros instead of testing every bit.
+        """
+        full = (1 << 64) - 1
+        run_start = 0
         run_length = 0
-
-        for block in range(HEAP_MAX_BLOCKS):
-            byte_idx = block // 8
-            bit_idx = block % 8
-
-            if byte_idx >= len(bitmap):
-                break
-
-            is_used = (bitmap[byte_idx] >> bit_idx) & 1
-
-            if not is_used:
-                if run_start is None:
-                    run_start = block
-                run_length += 1
-
+        nwords = (self.max_blocks + 63) // 64
+        padded = bytes(bitmap) + b'\xff' * (nwords * 8 - len(bitmap))
+
+        for w in range(nwords):
+            used = int.from_bytes(padded[w * 8:w * 8 + 8], 'little')
+            if w == nwords - 1 and self.max_blocks % 64:
+                used |= full << (self.max_blocks % 64) & full  # Past the end = used
+            if used == full:
+                run_length = 0
+                continue
+            if used == 0:
+                if run_length == 0:
+                    run_start = w * 64
+                run_length += 64
                 if run_length >= count:
                     return run_start
-            else:
-                run_start = None
-                run_length = 0
+                continue
+
+            bit = 0
+            while bit < 64:
+                if run_length == 0:
+                    free = (~used & full) >> bit
+                    if free == 0:
+                        break
+                    bit += (free & -free).bit_length() - 1  # tzcnt
+                    run_start = w * 64 + bit
+                rest = used >> bit
+                span = 64 - bit if rest == 0 else (rest & -rest).bit_length() - 1
+                run_length += span
+                if run_length >= count:
+                    return run_start
+                bit += span
+                if rest != 0:
+                    run_length = 0
 
         return None
 
-    def allocate_tensor(self, arr: np.ndarray) -> Optional[int]:
+    def allocate_tensor(self, arr: np.ndarray,
+                        quant: Optional[Tuple[List[float], List[int]]] = None,
+                        dtype: Optional[int] = None) -> Optional[int]:
         """
-        Allocate a new tensor blob and write the array to it.
+        Allocate a new tensor blob and write the array to it (with its
+        quantization parameters and storage dtype, see write_tensor_to_blob).
         Returns blob_id on success, None on failure.
         """
-        dtype_str = str(arr.dtype)
-        if dtype_str not in NUMPY_TO_DTYPE:
-            print(f"[HEAP] Unsupported numpy dtype {dtype_str}")
-            return None
+        if dtype is not None:
+            arr = _as_dtype(arr, dtype)
+        else:
+            dtype_str = str(arr.dtype)
+            if dtype_str not in NUMPY_TO_DTYPE:
+                print(f"[HEAP] Unsupported numpy dtype {dtype_str}")
+                return None
+            dtype = NUMPY_TO_DTYPE[dtype_str]
 
         ndim = len(arr.shape)
         if ndim > 4:
@@ -432,23 +906,131 @@ class HeapManager:
             return None
 
         # Calculate size needed
-        tensor_data = arr.tobytes()
+        tensor_data = _tensor_bytes(arr, quant)
         total_size = TENSOR_HEADER_SIZE + len(tensor_data)
 
         # Allocate blob
         blob_id = self.allocate_blob(total_size, BLOB_TYPE_TENSOR)
         if blob_id is None:
-            return None
+            # No free chunk is big enough: chain it
+            blob_id = self.allocate_sg(total_size, BLOB_TYPE_TENSOR)
+            if blob_id is None:
+                return None
+            tensor_header = TensorHeader(dtype, ndim, arr.shape, arr.strides,
+                                         _quant_mode(quant))
+            if not self.write_sg(blob_id, tensor_header.pack() + tensor_data):
+                self.free_blob(blob_id)
+                return None
+            return blob_id
 
         # Write tensor
-        if not self.write_tensor_to_blob(blob_id, arr):
-            # TODO: free the blob on failure
+        if not self.write_tensor_to_blob(blob_id, arr, quant, dtype):
+            self.free_blob(blob_id)
             return None
 
         return blob_id
 
+    def allocate_tensor_view(self, shape: Tuple[int, ...],
+                             dtype=np.float32) -> Optional[Tuple[int, np.ndarray]]:
+        """
+        Allocate a tensor blob for a C-contiguous array of this shape and
+        hand back (blob_id, a writable ndarray on its data in the mmap), so
+        a producer (ORT IOBinding) can write the result in place. Only
+        single-chunk blobs qualify: None if the heap has no chunk that big,
+        and the caller falls back to allocate_tensor(). The checksum covers
+        the data, so call seal_blob() once it is written.
+        """
+        dtype = np.dtype(dtype)
+        if str(dtype) not in NUMPY_TO_DTYPE or len(shape) > 4:
+            return None
+        count = 1
+        for dim in shape:
+            count *= dim
+        strides = []
+        stride = dtype.itemsize
+        for dim in reversed(shape):
+            strides.insert(0, stride)
+            stride *= dim
+
+        blob_id = self.allocate_blob(TENSOR_HEADER_SIZE + count * dtype.itemsize,
+                                     BLOB_TYPE_TENSOR)
+        if blob_id is None:
+            return None
+        offset = self._find_blob_offset(blob_id)
+        start = self.data_offset + offset + BLOB_HEADER_SIZE
+        self.shm.seek(start)
+        self.shm.write(TensorHeader(NUMPY_TO_DTYPE[str(dtype)], len(shape), tuple(shape),
+                                    tuple(strides)).pack())
+        start += TENSOR_HEADER_SIZE
+        view = np.frombuffer(memoryview(self.shm)[start:start + count * dtype.itemsize],
+                             dtype=dtype)
+        return blob_id, view.reshape(shape)
+
+    def seal_blob(self, blob_id: int) -> bool:
+        """Checksum a blob whose data was written in place (allocate_tensor_view)."""
+        offset = self._find_blob_offset(blob_id)
+        if offset is None:
+            return False
+        header = self._read_header(offset)
+        if not header.flags & BLOB_FLAG_CSUM_NONE:
+            self._seal(offset, header)
+        return True
+
+    def _read_header(self, offset: int) -> BlobHeader:
+        self.shm.seek(self.data_offset + offset)
+        return BlobHeader.unpack(self.shm.read(BLOB_HEADER_SIZE))
+
+    def _write_count(self, offset: int, field_offset: int, value: int):
+        """Store one of our (HEAP_ARENA_BRIDGE) taken/dropped counters."""
+        self.shm.seek(self.data_offset + offset + field_offset + 2 * HEAP_ARENA_BRIDGE)
+        self.shm.write((value & 0xFFFF).to_bytes(2, 'little'))
+
+    def retain_blob(self, blob_id: int) -> bool:
+        """
+        Take another reference to a blob we already hold one on (our own,
+        or one ZENEDGE handed over with the id). Version 5 heaps only.
+        """
+        ctl = self._read_heap_control()
+        entry = self._lookup_slot(blob_id) if ctl.version >= IPC_HEAP_VERSION_REFS else None
+        if entry is None:
+            return False
+        header = self._read_header(entry[0])
+        if header.magic != BLOB_MAGIC or header.refs == 0:
+            return False
+        self._write_count(entry[0], BLOB_TAKEN_OFFSET, header.taken[HEAP_ARENA_BRIDGE] + 1)
+        return True
+
+    def _drop_ref(self, offset: int) -> int:
+        """Release one bridge reference; returns the references left."""
+        header = self._read_header(offset)
+        header.dropped[HEAP_ARENA_BRIDGE] += 1
+        self._write_count(offset, BLOB_DROPPED_OFFSET, header.dropped[HEAP_ARENA_BRIDGE])
+        # Re-read: ZENEDGE may have released at the same time
+        return self._read_header(offset).refs
+
     def free_blob(self, blob_id: int) -> bool:
-        """Free a blob and return its blocks to the free pool."""
+        """
+        Release our reference to a blob; the last reference frees it and
+        returns its blocks to the free pool.
+        """
+        ctl = self._read_heap_control()
+        if ctl.arenas:
+            entry = self._lookup_slot(blob_id)
+            if entry is None:
+                print(f"[HEAP] Blob {blob_id} not found for free")
+                return False
+            if ctl.version >= IPC_HEAP_VERSION_REFS and self._drop_ref(entry[0]) != 0:
+                return True
+            if ctl.arenas[HEAP_ARENA_BRIDGE].owns_slot(blob_id & (ctl.blob_slots - 1)):
+                return self._free_local(ctl, blob_id)
+            # ZENEDGE owns it: queue it for the kernel to free
+            if not self._push_return(ctl.arenas[HEAP_ARENA_KERNEL], blob_id):
+                print(f"[HEAP] Kernel return queue full, blob {blob_id} not freed")
+                return False
+            return True
+        if ctl.blob_slots:
+            return self._free_slot(ctl, blob_id)
+
         offset = self._find_blob_offset(blob_id)
         if offset is None:
             print(f"[HEAP] Blob {blob_id} not found for free")
@@ -467,23 +1049,13 @@ class HeapManager:
         blocks_used = (total_size + HEAP_BLOCK_SIZE - 1) // HEAP_BLOCK_SIZE
         start_block = offset // HEAP_BLOCK_SIZE
 
-        # Read bitmap
-        bitmap = bytearray(self._read_bitmap())
-
         # Clear blocks
-        for i in range(blocks_used):
-            block = start_block + i
-            byte_idx = block // 8
-            bit_idx = block % 8
-            bitmap[byte_idx] &= ~(1 << bit_idx)
+        self._bitmap_fill(ctl, start_block, blocks_used, False)
 
         # Clear blob header magic to mark as free
         self.shm.seek(self.data_offset + offset)
         self.shm.write(b'\x00' * 4)  # Clear magic
 
-        # Write updated bitmap
-        self._write_bitmap(bytes(bitmap))
-
         # Update heap control
         ctl = self._read_heap_control()
         self._update_heap_control(
@@ -498,18 +1070,222 @@ class HeapManager:
         print(f"[HEAP] Freed blob {blob_id}: {blocks_used} blocks")
         return True
 
+    def _free_slot(self, ctl: HeapControl, blob_id: int) -> bool:
+        """Version 1 blob table free: unpublish the id first, then release blocks."""
+        entry = self._lookup_slot(blob_id)
+        if entry is None:
+            print(f"[HEAP] Blob {blob_id} not found for free")
+            return False
+        offset, blocks_used = entry
+
+        self._write_slot_id(ctl, blob_id & (ctl.blob_slots - 1), 0)
+
+        # Clear blob header magic to mark as free
+        self.shm.seek(self.data_offset + offset)
+        self.shm.write(b'\x00' * 4)
+        self._bitmap_fill(ctl, offset // HEAP_BLOCK_SIZE, blocks_used, False)
+
+        ctl = self._read_heap_control()
+        self._update_heap_control(
+            free_blocks=ctl.free_blocks + blocks_used,
+            blob_count=max(ctl.blob_count - 1, 0)
+        )
+
+        print(f"[HEAP] Freed blob {blob_id}: {blocks_used} blocks")
+        return True
+
+    def _free_local(self, ctl: HeapControl, blob_id: int, queued: bool = False) -> bool:
+        """
+        Version 3+: free an unreferenced bridge-arena blob into the bridge
+        arena. queued: the id came off our return queue, where both sides
+        releasing at once can leave a duplicate of a recycled pool blob.
+        """
+        arena = ctl.arenas[HEAP_ARENA_BRIDGE]
+        entry = self._lookup_slot(blob_id)
+        if entry is None or not arena.owns_slot(blob_id & (ctl.blob_slots - 1)):
+            return False
+        offset, blocks_used = entry
+
+        header = self._read_header(offset)
+        if ctl.version >= IPC_HEAP_VERSION_REFS and header.refs != 0:
+            return True  # Someone still holds a reference
+
+        # Pooled blobs stay published: just put the id back on the free stack
+        if header.flags & BLOB_FLAG_POOLED and header.pool < len(arena.pools):
+            pool = arena.pools[header.pool]
+            if queued and blob_id in self._pool_free_ids(arena, pool):
+                return True
+            return self._pool_push(arena, pool, blob_id)
+
+        # A chain holds the one reference on each of its extents (our own)
+        if header.type == BLOB_TYPE_SG:
+            self.shm.seek(self.data_offset + offset + BLOB_HEADER_SIZE)
+            for ext_id, _size in HeapSg.unpack(self.shm.read(HEAP_SG_SIZE)).extents:
+                ext = self._lookup_slot(ext_id)
+                if ext is not None and self._drop_ref(ext[0]) == 0:
+                    self._free_local(ctl, ext_id)
+
+        # Unpublish first, then release the header and blocks
+        self._write_slot_id(ctl, blob_id & (ctl.blob_slots - 1), 0)
+        arena.blob_count = max(arena.blob_count - 1, 0)
+        self._set_arena(arena, blob_count=arena.blob_count)
+
+        block = offset // HEAP_BLOCK_SIZE - arena.base_block
+        if (blocks_used & (blocks_used - 1) or block & (blocks_used - 1) or
+                block + blocks_used > arena.blocks):
+            print(f"[HEAP] Corrupt blob table entry for blob {blob_id}")
+            return False
+
+        self.shm.seek(self.data_offset + offset)
+        self.shm.write(b'\x00' * 4)  # Clear magic
+        self._buddy_free(ctl, arena, block, blocks_used.bit_length() - 1)
+        self._set_arena(arena, free_blocks=arena.free_blocks + blocks_used)
+
+        print(f"[HEAP] Freed blob {blob_id}: {blocks_used} blocks")
+        return True
+
+    # -- Slab pools (version 4, bridge arena only) ----------------------------
+
+    def _pool_push(self, arena: HeapArena, pool: HeapPool, blob_id: int) -> bool:
+        if pool.free_count >= pool.count:
+            return False
+        base = arena.pool_offset(pool.index)
+        self.shm.seek(self.ctl_offset + base + HEAP_POOL_FREE_IDS_OFFSET + pool.free_count * 2)
+        self.shm.write(blob_id.to_bytes(2, 'little'))
+        pool.free_count += 1
+        self.shm.seek(self.ctl_offset + base + HEAP_POOL_FREE_COUNT_OFFSET)
+        self.shm.write(pool.free_count.to_bytes(2, 'little'))
+        return True
+
+    def _pool_free_ids(self, arena: HeapArena, pool: HeapPool) -> list:
+        self.shm.seek(self.ctl_offset + arena.pool_offset(pool.index) + HEAP_POOL_FREE_IDS_OFFSET)
+        data = self.shm.read(2 * pool.free_count)
+        return [int.from_bytes(data[i:i + 2], 'little') for i in range(0, len(data), 2)]
+
+    def pool_find(self, size: int) -> Optional[int]:
+        """Index of an existing bridge pool of this blob size, or None."""
+        ctl = self._read_heap_control()
+        if ctl.magic != IPC_HEAP_MAGIC or not ctl.arenas:
+            return None
+        for pool in ctl.arenas[HEAP_ARENA_BRIDGE].pools:
+            if pool.blob_size == size:
+                return pool.index
+        return None
+
+    def pool_create(self, size: int, count: int, blob_type: int = BLOB_TYPE_RESULT,
+                    flags: Optional[int] = None) -> Optional[int]:
+        """
+        Carve count preformatted blobs of one size out of the bridge arena.
+
+        Returns the pool index for pool_alloc, or None on failure. The blobs
+        stay allocated for the life of the heap; free_blob recycles them.
+        """
+        ctl = self._read_heap_control()
+        if ctl.magic != IPC_HEAP_MAGIC or not ctl.arenas or not ctl.arenas[0].pools:
+            print("[HEAP] Heap has no slab pools")
+            return None
+        if size <= 0 or not 0 < count <= HEAP_POOL_DEPTH:
+            return None
+        arena = ctl.arenas[HEAP_ARENA_BRIDGE]
+        pool = next((p for p in arena.pools if p.blob_size == 0), None)
+        if pool is None:
+            print(f"[HEAP] All {HEAP_POOLS} bridge pools in use")
+            return None
+
+        ids = []
+        for _ in range(count):
+            blob_id = self.allocate_blob(size, blob_type, flags)
+            if not blob_id:
+                for blob_id in ids:
+                    self.free_blob(blob_id)
+                return None
+            ids.append(blob_id)
+
+        # Mark the headers pooled, then publish the pool (blob_size last)
+        for blob_id in ids:
+            offset = self._lookup_slot(blob_id)[0]
+            self.shm.seek(self.data_offset + offset)
+            header = BlobHeader.unpack(self.shm.read(BLOB_HEADER_SIZE))
+            header.flags |= BLOB_FLAG_POOLED
+            header.pool = pool.index
+            header.dropped[HEAP_ARENA_BRIDGE] = header.taken[HEAP_ARENA_BRIDGE]  # Idle
+            self.shm.seek(self.data_offset + offset)
+            self.shm.write(header.pack())
+
+        base = self.ctl_offset + arena.pool_offset(pool.index)
+        self.shm.seek(base + HEAP_POOL_FREE_IDS_OFFSET)
+        self.shm.write(b''.join(i.to_bytes(2, 'little') for i in ids))
+        blocks = self._lookup_slot(ids[0])[1]
+        self.shm.seek(base)
+        self.shm.write(HEAP_POOL_STRUCT.pack(0, blocks, count, count, blob_type))
+        self.shm.seek(base)
+        self.shm.write(size.to_bytes(4, 'little'))
+
+        print(f"[HEAP] Pool {pool.index}: {count} x {size} bytes")
+        return pool.index
+
+    def pool_alloc(self, pool_index: int) -> int:
+        """Draw a blob from a bridge pool in O(1); 0 if the pool is empty."""
+        ctl = self._read_heap_control()
+        if ctl.magic != IPC_HEAP_MAGIC or not ctl.arenas:
+            return 0
+        arena = ctl.arenas[HEAP_ARENA_BRIDGE]
+        if not 0 <= pool_index < len(arena.pools):
+            return 0
+        pool = arena.pools[pool_index]
+        if pool.free_count == 0:
+            self._drain_returns(ctl)  # ZENEDGE may be holding some for us
+            if pool.free_count == 0:
+                return 0
+
+        base = self.ctl_offset + arena.pool_offset(pool_index)
+        pool.free_count -= 1
+        self.shm.seek(base + HEAP_POOL_FREE_IDS_OFFSET + pool.free_count * 2)
+        blob_id = int.from_bytes(self.shm.read(2), 'little')
+        self.shm.seek(base + HEAP_POOL_FREE_COUNT_OFFSET)
+        self.shm.write(pool.free_count.to_bytes(2, 'little'))
+
+        # The caller's reference
+        offset = self._lookup_slot(blob_id)[0]
+        self._write_count(offset, BLOB_TAKEN_OFFSET,
+                          self._read_header(offset).taken[HEAP_ARENA_BRIDGE] + 1)
+        return blob_id
+
     def get_stats(self) -> dict:
-        """Get heap statistics."""
+        """
+        Get heap statistics. On arena heaps this includes fragmentation of
+        the bridge arena: its largest free chunk, free chunks per chunk size,
+        and our failed allocations per chunk size.
+        """
         ctl = self._read_heap_control()
-        return {
+        stats = {
             'magic_valid': ctl.magic == IPC_HEAP_MAGIC,
             'total_blocks': ctl.total_blocks,
             'free_blocks': ctl.free_blocks,
             'used_blocks': ctl.total_blocks - ctl.free_blocks,
             'next_blob_id': ctl.next_blob_id,
+            'blob_slots': ctl.blob_slots,
+            'blob_count': ctl.blob_count,
             'total_bytes': ctl.total_blocks * HEAP_BLOCK_SIZE,
             'free_bytes': ctl.free_blocks * HEAP_BLOCK_SIZE,
+            'alloc_failures': dict(self.alloc_failures),
         }
+        if ctl.arenas:
+            for key, arena in (('largest_free_bytes', ctl.arenas[HEAP_ARENA_BRIDGE]),
+                               ('peer_largest_free_bytes', ctl.arenas[HEAP_ARENA_KERNEL])):
+                top = self._largest_order(arena)
+                stats[key] = HEAP_BLOCK_SIZE << top if top is not None else 0
+            arena = ctl.arenas[HEAP_ARENA_BRIDGE]
+            free_chunks = {}
+            for k in range(arena.buddy_orders):
+                n, block = 0, arena.free_head[k]
+                while block != HEAP_BUDDY_NIL and n < arena.blocks:
+                    n += 1
+                    block = self._read_chunk(arena, block)[2]
+                if n:
+                    free_chunks[HEAP_BLOCK_SIZE << k] = n
+            stats['free_chunks'] = free_chunks
+        return stats
 
     def clear_cache(self):
         """Clear the blob location cache."""
@@ -1,22 +1,101 @@
 """
 IFR parsing and verification helpers.
+
+v4 records are batches: a header whose merkle_root is the RFC 6962 tree
+hash of the episode leaves stored after it. Any one episode can be shown
+to be in a batch with an inclusion proof of log2(count) hashes:
+
+    python3 -m bridge.ifr batch.bin --prove 3
+
+(bridge.ifr_archive --get JOB EPISODE --prove N does the same for archived
+batches.)
 """
 
+import argparse
 import hashlib
-from typing import Optional, Dict, Any
+import json
+from typing import Optional, Dict, Any, List
 
 from .protocol import (
     IFR_V2_STRUCT,
     IFR_V3_STRUCT,
+    IFR_V4_STRUCT,
+    IFR_LEAF_STRUCT,
     IFR_MAGIC,
     IFR_VERSION_V2,
     IFR_VERSION_V3,
+    IFR_VERSION_V4,
+    IFR_BATCH_MAX,
     IFR_PROFILE_MAX,
     IFR_V2_HASH_OFFSET,
     IFR_V3_HASH_OFFSET,
+    IFR_V4_HASH_OFFSET,
 )
 
 
+# ---- Merkle tree (RFC 6962 section 2.1) ----
+
+def merkle_leaf_hash(leaf: bytes) -> bytes:
+    return hashlib.sha256(b'\x00' + leaf).digest()
+
+
+def _node(left: bytes, right: bytes) -> bytes:
+    return hashlib.sha256(b'\x01' + left + right).digest()
+
+
+def _split(n: int) -> int:
+    """Largest power of two below n (n > 1)."""
+    k = 1
+    while k * 2 < n:
+        k *= 2
+    return k
+
+
+def merkle_root(leaf_hashes: List[bytes]) -> bytes:
+    if len(leaf_hashes) == 1:
+        return leaf_hashes[0]
+    k = _split(len(leaf_hashes))
+    return _node(merkle_root(leaf_hashes[:k]), merkle_root(leaf_hashes[k:]))
+
+
+def inclusion_proof(leaf_hashes: List[bytes], index: int) -> List[bytes]:
+    """Audit path of leaf index, from the bottom up."""
+    if len(leaf_hashes) <= 1:
+        return []
+    k = _split(len(leaf_hashes))
+    if index < k:
+        return inclusion_proof(leaf_hashes[:k], index) + [merkle_root(leaf_hashes[k:])]
+    return inclusion_proof(leaf_hashes[k:], index - k) + [merkle_root(leaf_hashes[:k])]
+
+
+def verify_inclusion(leaf_hash: bytes, index: int, count: int, proof: List[bytes],
+                     root: bytes) -> bool:
+    """RFC 9162 section 2.1.3.2: does proof put leaf_hash at index of a
+    count-leaf tree with this root?"""
+    if index >= count:
+        return False
+    fn, sn, h = index, count - 1, leaf_hash
+    for p in proof:
+        if sn == 0:
+            return False
+        if fn & 1 or fn == sn:
+            h = _node(p, h)
+            while fn and not fn & 1:
+                fn >>= 1
+                sn >>= 1
+        else:
+            h = _node(h, p)
+        fn >>= 1
+        sn >>= 1
+    return sn == 0 and h == root
+
+
+def _chain_hash(prev: bytes, ifr_hash: bytes, seal: bytes, nonce: bytes,
+                model_digest: bytes, policy_digest: bytes) -> bytes:
+    """The chain step v3 records and v4 batches share."""
+    return hashlib.sha256(prev + ifr_hash + seal + nonce + model_digest + policy_digest).digest()
+
+
 def parse_ifr_blob(data: bytes) -> Optional[Dict[str, Any]]:
     if not data or len(data) < 8:
         return None
@@ -69,14 +148,8 @@ def parse_ifr_blob(data: bytes) -> Optional[Dict[str, Any]]:
         expected_ifr = hashlib.sha256(data[:IFR_V3_HASH_OFFSET]).digest()
         ifr_ok = (expected_ifr == ifr_hash)
 
-        chain_ctx = hashlib.sha256()
-        chain_ctx.update(prev_chain_hash)
-        chain_ctx.update(ifr_hash)
-        chain_ctx.update(flightrec_seal_hash)
-        chain_ctx.update(nonce)
-        chain_ctx.update(model_digest)
-        chain_ctx.update(policy_digest)
-        expected_chain = chain_ctx.digest()
+        expected_chain = _chain_hash(prev_chain_hash, ifr_hash, flightrec_seal_hash,
+                                     nonce, model_digest, policy_digest)
         chain_ok = (expected_chain == chain_hash)
 
         return {
@@ -101,4 +174,100 @@ def parse_ifr_blob(data: bytes) -> Optional[Dict[str, Any]]:
             "chain_ok": chain_ok,
         }
 
+    if version == IFR_VERSION_V4 and len(data) >= IFR_V4_STRUCT.size:
+        (magic, version, flags, record_size, job_id, count, model_id, ts_usec,
+         nonce, model_digest, policy_digest, flightrec_seal_hash, root,
+         prev_chain_hash, ifr_hash, chain_hash,
+         sig_classical) = IFR_V4_STRUCT.unpack(data[:IFR_V4_STRUCT.size])
+
+        end = record_size + count * IFR_LEAF_STRUCT.size
+        if record_size != IFR_V4_STRUCT.size or not 0 < count <= IFR_BATCH_MAX or len(data) < end:
+            return None
+
+        raw_leaves = [data[off:off + IFR_LEAF_STRUCT.size]
+                      for off in range(record_size, end, IFR_LEAF_STRUCT.size)]
+        leaf_hashes = [merkle_leaf_hash(leaf) for leaf in raw_leaves]
+        leaves = []
+        for raw in raw_leaves:
+            episode_id, env, leaf_model, steps, leaf_ts, goodput, _ = IFR_LEAF_STRUCT.unpack(raw)
+            leaves.append({"episode_id": episode_id, "env": env, "model_id": leaf_model,
+                           "steps": steps, "ts_usec": leaf_ts, "goodput": goodput})
+
+        root_ok = (merkle_root(leaf_hashes) == root)
+        ifr_ok = (hashlib.sha256(data[:IFR_V4_HASH_OFFSET]).digest() == ifr_hash)
+        chain_ok = (_chain_hash(prev_chain_hash, ifr_hash, flightrec_seal_hash,
+                                nonce, model_digest, policy_digest) == chain_hash)
+
+        return {
+            "magic": magic,
+            "version": version,
+            "flags": flags,
+            "job_id": job_id,
+            "count": count,
+            "model_id": model_id,
+            "record_size": record_size,
+            "batch_size": end,
+            "ts_usec": ts_usec,
+            "nonce": nonce,
+            "model_digest": model_digest,
+            "policy_digest": policy_digest,
+            "flightrec_seal_hash": flightrec_seal_hash,
+            "merkle_root": root,
+            "prev_chain_hash": prev_chain_hash,
+            "ifr_hash": ifr_hash,
+            "chain_hash": chain_hash,
+            "sig_classical": sig_classical,
+            "leaves": leaves,
+            "leaf_hashes": leaf_hashes,
+            "hash_ok": root_ok and ifr_ok and chain_ok,
+            "root_ok": root_ok,
+            "chain_ok": chain_ok,
+        }
+
     return None
+
+
+def batch_proof(batch: Dict[str, Any], index: int) -> Dict[str, Any]:
+    """Inclusion proof for episode index of a parsed v4 batch, as JSON-ready hex."""
+    hashes = batch["leaf_hashes"]
+    return {
+        "index": index,
+        "count": len(hashes),
+        "leaf": batch["leaves"][index],
+        "leaf_hash": hashes[index].hex(),
+        "proof": [h.hex() for h in inclusion_proof(hashes, index)],
+        "merkle_root": batch["merkle_root"].hex(),
+        "chain_hash": batch["chain_hash"].hex(),
+    }
+
+
+def check_batch_proof(proof: Dict[str, Any]) -> bool:
+    return verify_inclusion(bytes.fromhex(proof["leaf_hash"]), proof["index"], proof["count"],
+                            [bytes.fromhex(h) for h in proof["proof"]],
+                            bytes.fromhex(proof["merkle_root"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Verify an archived IFR record")
+    parser.add_argument("path", help="a raw IFR record or batch")
+    parser.add_argument("--prove", type=int, default=None, metavar="INDEX",
+                        help="print the inclusion proof of a v4 batch's episode INDEX")
+    args = parser.parse_args()
+
+    with open(args.path, "rb") as f:
+        rec = parse_ifr_blob(f.read())
+    if rec is None:
+        raise SystemExit(f"{args.path}: not an IFR record")
+
+    what = f"v{rec['version']}" + (f" batch of {rec['count']}" if rec["version"] == IFR_VERSION_V4 else "")
+    print(f"{args.path}: {what}, {'ok' if rec['hash_ok'] else 'HASH MISMATCH'}")
+    if args.prove is not None:
+        if rec["version"] != IFR_VERSION_V4 or not 0 <= args.prove < rec["count"]:
+            raise SystemExit("--prove needs a v4 batch and an episode index in it")
+        proof = batch_proof(rec, args.prove)
+        print(json.dumps(proof, indent=2))
+        print("proof", "ok" if check_batch_proof(proof) else "FAILED")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,340 @@
+"""
+Append-only IFR archive: a memory-mapped segment log.
+
+Records persisted by CMD_IFR_PERSIST are copied into fixed-size slots of
+preallocated segment files (seg-000000.ifr, ...), mapped shared, so an
+append is one copy into the page cache. SLOT_SIZE holds a v3 record; a v4
+batch takes as many consecutive slots as it needs and never straddles two
+segments.
+
+index.bin is the sidecar index: one IDX_STRUCT entry per (job_id,
+episode_id), written after the record, a batch getting one per episode. An
+append that lost its index entry to a crash is found again on the next
+open by scanning the slots after the last indexed record.
+
+checkpoint.json is where verification stopped: index entries covered and
+the chain hash they ended on. verify() checks only what came after it,
+and flushes the segments before moving it, so a checkpoint never vouches
+for records that are not on disk.
+
+    python3 -m bridge.ifr_archive /tmp/zenedge_ifr --verify
+    python3 -m bridge.ifr_archive /tmp/zenedge_ifr --get 1 7 --prove 3
+"""
+
+import argparse
+import json
+import mmap
+import os
+import struct
+from typing import Any, Dict, Iterator, List, Optional, Tuple
+
+from .ifr import batch_proof, check_batch_proof, parse_ifr_blob
+from .protocol import (
+    IFR_BATCH_MAX,
+    IFR_LEAF_SIZE,
+    IFR_MAGIC,
+    IFR_V3_SIZE,
+    IFR_V4_SIZE,
+    IFR_VERSION_V4,
+)
+
+IFR_ARCHIVE_DIR = "/tmp/zenedge_ifr"
+
+SLOT_SIZE = (IFR_V3_SIZE + 63) & ~63  # 384: a v3 record, cache-line padded
+SEGMENT_SLOTS = 4096                  # 1.5 MiB segments
+RECORD_MAX = IFR_V4_SIZE + IFR_BATCH_MAX * IFR_LEAF_SIZE
+
+# job_id, episode_id, segment, first slot, record bytes
+IDX_STRUCT = struct.Struct('<IIIII')
+
+ZERO_HASH = bytes(32)
+
+Location = Tuple[int, int, int]  # segment, slot, length
+
+
+def _slots(length: int) -> int:
+    return (length + SLOT_SIZE - 1) // SLOT_SIZE
+
+
+def _record_size(parsed: Dict[str, Any], data: bytes) -> int:
+    return int(parsed.get("batch_size", parsed.get("record_size", len(data))))
+
+
+def _record_keys(parsed: Dict[str, Any]) -> List[Tuple[int, int]]:
+    if parsed["version"] == IFR_VERSION_V4:
+        return [(parsed["job_id"], leaf["episode_id"]) for leaf in parsed["leaves"]]
+    return [(parsed["job_id"], parsed["episode_id"])]
+
+
+class IfrArchive:
+    """Segment log of IFR records. Nothing touches the disk until first use."""
+
+    def __init__(self, out_dir: str = IFR_ARCHIVE_DIR):
+        self.out_dir = out_dir
+        self._maps: Dict[int, Tuple[int, mmap.mmap]] = {}
+        self._index_f = None
+        self._entries: List[Tuple[int, int, int, int, int]] = []
+        self._by_key: Dict[Tuple[int, int], Location] = {}
+        self._next: Optional[Tuple[int, int]] = None  # Segment, slot of the next append
+
+    # ---- Files ----
+
+    def _path(self, name: str) -> str:
+        return os.path.join(self.out_dir, name)
+
+    def _segment(self, seg: int, create: bool = False) -> Optional[mmap.mmap]:
+        if seg in self._maps:
+            return self._maps[seg][1]
+        path = self._path(f"seg-{seg:06d}.ifr")
+        if not create and not os.path.exists(path):
+            return None
+        fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o644)
+        if os.fstat(fd).st_size < SEGMENT_SLOTS * SLOT_SIZE:
+            os.ftruncate(fd, SEGMENT_SLOTS * SLOT_SIZE)
+        mm = mmap.mmap(fd, SEGMENT_SLOTS * SLOT_SIZE)
+        self._maps[seg] = (fd, mm)
+        return mm
+
+    def _open(self) -> None:
+        if self._next is not None:
+            return
+        os.makedirs(self.out_dir, exist_ok=True)
+        self._load_index()
+        self._index_f = open(self._path("index.bin"), "ab")
+        if self._entries:
+            _, _, seg, slot, length = self._entries[-1]
+            self._next = (seg, slot + _slots(length))
+        else:
+            self._next = (0, 0)
+        self._recover()
+
+    def _load_index(self) -> None:
+        self._entries = []
+        self._by_key = {}
+        try:
+            with open(self._path("index.bin"), "rb") as f:
+                raw = f.read()
+        except FileNotFoundError:
+            return
+        whole = len(raw) - len(raw) % IDX_STRUCT.size  # A torn last entry is dropped
+        self._entries = list(IDX_STRUCT.iter_unpack(raw[:whole]))
+        for job_id, episode_id, seg, slot, length in self._entries:
+            self._by_key[(job_id, episode_id)] = (seg, slot, length)
+        if whole != len(raw):
+            with open(self._path("index.bin"), "r+b") as f:
+                f.truncate(whole)
+
+    def _recover(self) -> None:
+        """Index records that were copied in but not indexed before a crash."""
+        seg, slot = self._next
+        while True:
+            if slot >= SEGMENT_SLOTS:
+                seg, slot = seg + 1, 0
+            mm = self._segment(seg)
+            if mm is None:
+                break
+            off = slot * SLOT_SIZE
+            if int.from_bytes(mm[off:off + 4], "little") != IFR_MAGIC:
+                if slot == 0:
+                    break
+                seg, slot = seg + 1, 0  # The writer may have moved on to a fresh segment
+                continue
+            data = mm[off:off + RECORD_MAX]
+            parsed = parse_ifr_blob(data)
+            if not parsed:
+                break  # Torn: the next append overwrites it
+            length = _record_size(parsed, data)
+            self._add_index(parsed, seg, slot, length)
+            slot += _slots(length)
+            self._next = (seg, slot)
+
+    def _add_index(self, parsed: Dict[str, Any], seg: int, slot: int, length: int) -> None:
+        raw = bytearray()
+        for job_id, episode_id in _record_keys(parsed):
+            self._entries.append((job_id, episode_id, seg, slot, length))
+            self._by_key[(job_id, episode_id)] = (seg, slot, length)
+            raw += IDX_STRUCT.pack(job_id, episode_id, seg, slot, length)
+        self._index_f.write(raw)
+        self._index_f.flush()
+
+    # ---- Records ----
+
+    def append(self, data: bytes, parsed: Optional[Dict[str, Any]] = None) -> Location:
+        """Copy a record into the log and index it. Returns its location."""
+        self._open()
+        parsed = parsed or parse_ifr_blob(data)
+        if not parsed:
+            raise ValueError("not an IFR record")
+        length = _record_size(parsed, data)
+        need = _slots(length)
+        if need > SEGMENT_SLOTS:
+            raise ValueError(f"IFR record of {length} bytes does not fit a segment")
+
+        seg, slot = self._next
+        if slot + need > SEGMENT_SLOTS:
+            seg, slot = seg + 1, 0
+        mm = self._segment(seg, create=True)
+        off = slot * SLOT_SIZE
+        mm[off:off + length] = data[:length]
+        self._next = (seg, slot + need)
+        self._add_index(parsed, seg, slot, length)
+        return seg, slot, length
+
+    def read(self, loc: Location) -> Optional[bytes]:
+        seg, slot, length = loc
+        mm = self._segment(seg)
+        if mm is None:
+            return None
+        return mm[slot * SLOT_SIZE:slot * SLOT_SIZE + length]
+
+    def find(self, job_id: int, episode_id: int) -> Optional[bytes]:
+        """The newest record holding (job_id, episode_id), or None."""
+        self._open()
+        loc = self._by_key.get((job_id, episode_id))
+        return self.read(loc) if loc else None
+
+    def records(self, start: int = 0) -> Iterator[Tuple[int, Location]]:
+        """(index entries up to and including the record, location) from entry start."""
+        self._open()
+        i = start
+        while i < len(self._entries):
+            _, _, seg, slot, length = self._entries[i]
+            i += 1
+            while (i < len(self._entries) and self._entries[i][2] == seg
+                   and self._entries[i][3] == slot):
+                i += 1  # The other episodes of a batch
+            yield i, (seg, slot, length)
+
+    # ---- Verification ----
+
+    def _load_checkpoint(self) -> Dict[str, Any]:
+        try:
+            with open(self._path("checkpoint.json"), "r", encoding="utf-8") as f:
+                ckpt = json.load(f)
+            if ckpt.get("entries", 0) <= len(self._entries):
+                return ckpt
+            print("[IFR] checkpoint is past the end of the index: verifying from the start")
+        except (FileNotFoundError, ValueError):
+            pass
+        return {"entries": 0, "chain_hash": "", "parent_hash": ""}
+
+    def _save_checkpoint(self, ckpt: Dict[str, Any]) -> None:
+        for fd, mm in self._maps.values():
+            mm.flush()
+            os.fsync(fd)
+        os.fsync(self._index_f.fileno())
+
+        tmp = self._path("checkpoint.json.tmp")
+        with open(tmp, "w", encoding="utf-8") as f:
+            json.dump(ckpt, f, indent=2, sort_keys=True)
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(tmp, self._path("checkpoint.json"))
+        dfd = os.open(self.out_dir, os.O_RDONLY)
+        try:
+            os.fsync(dfd)
+        finally:
+            os.close(dfd)
+
+    def verify(self) -> Dict[str, Any]:
+        """
+        Check the records after the checkpoint: each one's hash, every batch
+        episode's inclusion proof, and that it chains from the record before.
+        A record may chain from the one before it, from that one's parent (the
+        arbiter did not accept the one before, so the kernel's chain did not
+        advance), or from zero (the kernel rebooted). Verification stops at
+        the first record that fails; the checkpoint moves up to it.
+
+        Returns: {"verified", "total", "bad" (None or a reason), "latest"
+        (the parsed last good record, or None), "location" (of a bad one)}
+        """
+        self._open()
+        ckpt = self._load_checkpoint()
+        chain = bytes.fromhex(ckpt["chain_hash"])
+        parent = bytes.fromhex(ckpt["parent_hash"])
+        done = ckpt["entries"]
+        result: Dict[str, Any] = {"verified": 0, "bad": None, "latest": None, "location": None}
+
+        for end, loc in self.records(done):
+            rec = parse_ifr_blob(self.read(loc) or b"")
+            bad = None
+            if not rec or not rec["hash_ok"]:
+                bad = "hash mismatch"
+            elif rec["version"] == IFR_VERSION_V4:
+                failed = [i for i in range(rec["count"]) if not check_batch_proof(batch_proof(rec, i))]
+                if failed:
+                    bad = f"batch proof failed for episodes {failed}"
+            if not bad and rec.get("prev_chain_hash") is not None:
+                prev = rec["prev_chain_hash"]
+                if not chain or prev == chain:
+                    parent, chain = prev, rec["chain_hash"]
+                elif prev == parent:
+                    chain = rec["chain_hash"]
+                elif prev == ZERO_HASH:
+                    parent, chain = ZERO_HASH, rec["chain_hash"]
+                else:
+                    bad = "chain break"
+            if bad:
+                result["bad"] = bad
+                result["location"] = loc
+                break
+            done = end
+            result["verified"] += 1
+            result["latest"] = rec
+
+        if result["verified"]:
+            self._save_checkpoint({"entries": done, "chain_hash": chain.hex(),
+                                   "parent_hash": parent.hex()})
+        result["total"] = len(self._entries)
+        return result
+
+    def close(self) -> None:
+        for fd, mm in self._maps.values():
+            mm.close()
+            os.close(fd)
+        self._maps = {}
+        if self._index_f:
+            self._index_f.close()
+            self._index_f = None
+        self._next = None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Inspect or verify the IFR archive")
+    parser.add_argument("dir", nargs="?", default=IFR_ARCHIVE_DIR)
+    parser.add_argument("--verify", action="store_true",
+                        help="verify the records after the checkpoint and move it")
+    parser.add_argument("--get", type=int, nargs=2, metavar=("JOB", "EPISODE"),
+                        help="print the record holding an episode")
+    parser.add_argument("--prove", type=int, default=None, metavar="INDEX",
+                        help="with --get, the inclusion proof of a v4 batch's episode INDEX")
+    args = parser.parse_args()
+
+    archive = IfrArchive(args.dir)
+    try:
+        if args.verify:
+            res = archive.verify()
+            print(f"{args.dir}: {res['verified']} records verified, {res['total']} episodes indexed")
+            if res["bad"]:
+                raise SystemExit(f"{args.dir}: {res['bad']} at segment {res['location'][0]} "
+                                 f"slot {res['location'][1]}")
+        if args.get:
+            data = archive.find(*args.get)
+            rec = parse_ifr_blob(data) if data else None
+            if rec is None:
+                raise SystemExit(f"job {args.get[0]} episode {args.get[1]}: not archived")
+            printable = {k: (v.hex() if isinstance(v, bytes) else v)
+                         for k, v in rec.items() if k != "leaf_hashes"}
+            print(json.dumps(printable, indent=2, sort_keys=True))
+            if args.prove is not None:
+                if rec["version"] != IFR_VERSION_V4 or not 0 <= args.prove < rec["count"]:
+                    raise SystemExit("--prove needs a v4 batch and an episode index in it")
+                proof = batch_proof(rec, args.prove)
+                print(json.dumps(proof, indent=2))
+                print("proof", "ok" if check_batch_proof(proof) else "FAILED")
+    finally:
+        archive.close()
+
+
+if __name__ == '__main__':
+    main()
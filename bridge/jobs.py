@@ -0,0 +1,230 @@
+"""
+Job graph submission ring (bridge -> ZENEDGE, IPC_REGION_JOBS).
+
+A JobGraph packs into the flat format of kernel/ipc/ipc_proto.h; JobRing
+writes it into a BLOB_TYPE_JOB blob and queues it. ZENEDGE validates and
+admits it under the contract it carries, runs it from its main loop and
+answers with CMD_JOB_STATUS (handlers.handle_job_status), which frees the
+blob. Graphs can also come from a JSON spec (zenedge_bridge --submit-job):
+
+    {"job_id": 7, "contract": {"cpu_budget_us": 20000, "memory_kb": 4096},
+     "tensors": [{"id": 1, "elements": 1024}, {"id": 2, "elements": 1024}],
+     "steps": [{"id": 1, "type": "io", "outputs": [1]},
+               {"id": 2, "type": "compute", "inputs": [1], "outputs": [2],
+                "deps": [1], "memoize": true}]}
+"""
+
+import json
+import time
+from typing import Any, Dict, List, Optional, Sequence
+
+from .protocol import (
+    ADMIT_NAMES,
+    BLOB_TYPE_JOB,
+    CMD_JOB_SUBMIT,
+    IPC_JOBQ_MAGIC,
+    IPC_JOB_GRAPH_MAGIC,
+    IPC_JOB_GRAPH_VERSION,
+    IPC_JOB_MAX_DEPS,
+    IPC_JOB_MAX_STEPS,
+    IPC_JOB_MAX_TENSORS,
+    IPC_JOB_REJECTED,
+    IPC_JOB_STATE_NAMES,
+    IPC_JOB_STEP_INPUTS,
+    IPC_JOB_STEP_MEMOIZE,
+    IPC_JOB_STEP_OUTPUTS,
+    IPC_RING_POLICY_FIFO,
+    IPC_RING_POLICY_MASK,
+    JOB_GRAPH_STRUCT,
+    JOB_STATUS_STRUCT,
+    JOB_STEP_STRUCT,
+    JOB_SUBMIT_STRUCT,
+    JOB_TENSOR_STRUCT,
+    RING_HEADER_STRUCT,
+    RING_LAYOUT_V2,
+    STEP_TYPE_COLLECTIVE,
+    STEP_TYPE_COMPUTE,
+    STEP_TYPE_CONTROL,
+    STEP_TYPE_IO,
+    RingHeader,
+)
+
+STEP_TYPES = {"compute": STEP_TYPE_COMPUTE, "collective": STEP_TYPE_COLLECTIVE,
+              "io": STEP_TYPE_IO, "control": STEP_TYPE_CONTROL}
+DTYPES = {"fp32": 0, "fp16": 1, "bf16": 2, "int8": 3, "int32": 4}
+PRIORITIES = {"low": 0, "normal": 1, "high": 2, "realtime": 3}
+
+
+class JobGraph:
+    """Steps (by id, with parents by id), tensors and the job's contract."""
+
+    def __init__(self, job_id: int, cpu_budget_us: int = 0, memory_kb: int = 0,
+                 prio: int = 1, preferred_node: int = 0, deadline_us: int = 0,
+                 max_inflight: int = 0):
+        self.job_id = job_id
+        self.contract = (cpu_budget_us, memory_kb, deadline_us, prio, preferred_node,
+                         max_inflight)
+        self.steps: List[Dict[str, Any]] = []
+        self.tensors: List[tuple] = []
+
+    def tensor(self, tensor_id: int, num_elements: int, dtype: int = 0,
+               pinned: bool = False, node_affinity: int = 0xFF) -> 'JobGraph':
+        self.tensors.append((tensor_id, num_elements, dtype, 1 if pinned else 0, node_affinity))
+        return self
+
+    def step(self, step_id: int, step_type: int = STEP_TYPE_COMPUTE,
+             inputs: Sequence[int] = (), outputs: Sequence[int] = (),
+             deps: Sequence[int] = (), est_us: int = 0, memoize: bool = False,
+             coll_op: int = 0) -> 'JobGraph':
+        if len(inputs) > IPC_JOB_STEP_INPUTS or len(outputs) > IPC_JOB_STEP_OUTPUTS:
+            raise ValueError(f"step {step_id}: at most {IPC_JOB_STEP_INPUTS} inputs "
+                             f"and {IPC_JOB_STEP_OUTPUTS} outputs")
+        self.steps.append({"id": step_id, "type": step_type, "inputs": list(inputs),
+                           "outputs": list(outputs), "deps": list(deps), "est_us": est_us,
+                           "memoize": memoize, "coll_op": coll_op})
+        return self
+
+    @classmethod
+    def from_spec(cls, spec: Dict[str, Any]) -> 'JobGraph':
+        c = spec.get("contract", {})
+        prio = c.get("prio", 1)
+        graph = cls(spec["job_id"], c.get("cpu_budget_us", 0), c.get("memory_kb", 0),
+                    PRIORITIES.get(prio, prio), c.get("preferred_node", 0),
+                    c.get("deadline_us", 0), c.get("max_inflight", 0))
+        for t in spec.get("tensors", []):
+            dtype = t.get("dtype", 0)
+            graph.tensor(t["id"], t["elements"], DTYPES.get(dtype, dtype),
+                         t.get("pinned", False), t.get("node", 0xFF))
+        for s in spec.get("steps", []):
+            kind = s.get("type", "compute")
+            graph.step(s["id"], STEP_TYPES.get(kind, kind), s.get("inputs", ()),
+                       s.get("outputs", ()), s.get("deps", ()), s.get("est_us", 0),
+                       s.get("memoize", False), s.get("coll_op", 0))
+        return graph
+
+    def pack(self) -> bytes:
+        """The flat graph: header, steps, dep_off, dep_idx, tensors."""
+        index = {s["id"]: i for i, s in enumerate(self.steps)}
+        if len(index) != len(self.steps):
+            raise ValueError("duplicate step id")
+        dep_off = [0]
+        dep_idx: List[int] = []
+        for s in self.steps:
+            for parent in s["deps"]:
+                if parent not in index:
+                    raise ValueError(f"step {s['id']} depends on unknown step {parent}")
+                dep_idx.append(index[parent])
+            dep_off.append(len(dep_idx))
+        if (not self.steps or len(self.steps) > IPC_JOB_MAX_STEPS or
+                len(dep_idx) > IPC_JOB_MAX_DEPS or len(self.tensors) > IPC_JOB_MAX_TENSORS):
+            raise ValueError("graph size out of range")
+
+        steps = b"".join(
+            JOB_STEP_STRUCT.pack(s["id"], s["type"],
+                                 IPC_JOB_STEP_MEMOIZE if s["memoize"] else 0, s["coll_op"],
+                                 len(s["inputs"]), len(s["outputs"]), s["est_us"],
+                                 *(s["inputs"] + [0] * (IPC_JOB_STEP_INPUTS - len(s["inputs"]))),
+                                 *(s["outputs"] + [0] * (IPC_JOB_STEP_OUTPUTS - len(s["outputs"]))))
+            for s in self.steps)
+        deps = b"".join(x.to_bytes(4, "little") for x in dep_off + dep_idx)
+        tensors = b"".join(JOB_TENSOR_STRUCT.pack(*t) for t in self.tensors)
+
+        steps_off = JOB_GRAPH_STRUCT.size
+        dep_off_at = steps_off + len(steps)
+        dep_idx_at = dep_off_at + 4 * len(dep_off)
+        tensors_off = dep_idx_at + 4 * len(dep_idx)
+        size = tensors_off + len(tensors)
+        hdr = JOB_GRAPH_STRUCT.pack(IPC_JOB_GRAPH_MAGIC, IPC_JOB_GRAPH_VERSION, size,
+                                    self.job_id, len(self.steps), len(dep_idx),
+                                    len(self.tensors), steps_off, dep_off_at, dep_idx_at,
+                                    tensors_off, 0, *self.contract, 0)
+        return hdr + steps + deps + tensors
+
+
+def load_spec(path: str) -> JobGraph:
+    with open(path) as f:
+        return JobGraph.from_spec(json.load(f))
+
+
+def parse_status(data: bytes) -> Optional[Dict[str, Any]]:
+    if len(data) < JOB_STATUS_STRUCT.size:
+        return None
+    (job_id, tag, state, admit, steps, peak_kb, critical_us, wait_us,
+     run_us) = JOB_STATUS_STRUCT.unpack_from(data, 0)
+    return {"job_id": job_id, "tag": tag, "state": state, "admit": admit, "steps": steps,
+            "peak_memory_kb": peak_kb, "critical_path_us": critical_us,
+            "wait_us": wait_us, "run_us": run_us}
+
+
+def render_status(st: Dict[str, Any]) -> str:
+    state = IPC_JOB_STATE_NAMES.get(st["state"], f"state {st['state']}")
+    if st["state"] == IPC_JOB_REJECTED:
+        admit = st["admit"]
+        state += f" ({ADMIT_NAMES[admit] if admit < len(ADMIT_NAMES) else admit})"
+    line = f"job {st['job_id']}: {state}"
+    if st["run_us"]:
+        line += (f", {st['steps']} steps in {st['run_us']} us after {st['wait_us']} us "
+                 f"queued")
+    line += f", peak {st['peak_memory_kb']} KB, critical path {st['critical_path_us']} us"
+    if "round_trip_us" in st:
+        line += f", {st['round_trip_us']} us round trip"
+    return line
+
+
+class JobRing:
+    """Producer side of the job submission ring."""
+
+    def __init__(self, shm, offset: int, region_bytes: int):
+        self.shm = shm
+        self.offset = offset
+        self.region_bytes = region_bytes
+        self.layout = RING_LAYOUT_V2
+        self.pending: Dict[int, tuple] = {}   # blob_id -> (job_id, tag, monotonic_ns)
+        self._next_tag = 0
+
+    def _header(self) -> Optional[RingHeader]:
+        self.shm.seek(self.offset)
+        hdr = RingHeader.unpack(self.shm.read(RING_HEADER_STRUCT.size), self.layout)
+        if hdr.magic != IPC_JOBQ_MAGIC or hdr.entry_size != JOB_SUBMIT_STRUCT.size:
+            return None
+        if hdr.size == 0 or hdr.size & (hdr.size - 1):
+            return None
+        if (hdr.flags & IPC_RING_POLICY_MASK) != IPC_RING_POLICY_FIFO:
+            return None
+        if self.layout.header_size + hdr.size * JOB_SUBMIT_STRUCT.size > self.region_bytes:
+            return None
+        return hdr
+
+    def ready(self) -> bool:
+        return self._header() is not None
+
+    def submit(self, heap, graph: JobGraph) -> Optional[int]:
+        """Queue a graph; returns its blob id or None if the ring is absent
+        or full, or the heap has no room for it."""
+        hdr = self._header()
+        if hdr is None or ((hdr.head - hdr.tail) & 0xFFFFFFFF) >= hdr.size:
+            return None
+        data = graph.pack()
+        blob_id = heap.allocate_blob(len(data), BLOB_TYPE_JOB)
+        if not blob_id:
+            return None
+        if not heap.write_blob_data(blob_id, data):  # Seals it too
+            heap.free_blob(blob_id)
+            return None
+
+        self._next_tag = (self._next_tag % 0xFFFFFFFF) + 1
+        slot = hdr.head & (hdr.size - 1)
+        self.shm.seek(self.offset + self.layout.header_size + slot * JOB_SUBMIT_STRUCT.size)
+        self.shm.write(JOB_SUBMIT_STRUCT.pack(CMD_JOB_SUBMIT, blob_id, self._next_tag))
+        self.shm.seek(self.offset + self.layout.head_offset)
+        self.shm.write(((hdr.head + 1) & 0xFFFFFFFF).to_bytes(4, "little"))  # publish
+        self.pending[blob_id] = (graph.job_id, self._next_tag, time.monotonic_ns())
+        return blob_id
+
+    def complete(self, blob_id: int, data: bytes) -> Optional[Dict[str, Any]]:
+        """The status for a submitted blob, or None if it does not decode."""
+        st = parse_status(data)
+        sent = self.pending.pop(blob_id, None)
+        if st is not None and sent is not None and sent[1] == st["tag"]:
+            st["round_trip_us"] = (time.monotonic_ns() - sent[2]) // 1000
+        return st
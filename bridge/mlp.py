@@ -0,0 +1,214 @@
+"""
+Dense MLP models for in-kernel inference (ipc_mlp_desc_t).
+
+Each layer's weights ([out, in] float32) and bias ([out]) go into the
+shared heap as ordinary tensor blobs; a BLOB_TYPE_MODEL_REF descriptor
+blob lists them with one activation per layer. Observations that carry
+the descriptor's blob id as model_id are then answered by ZENEDGE itself,
+with no CMD_RUN_MODEL round trip.
+
+With quantize=True the weights are shipped as int8 with one symmetric
+scale per output row (a quarter of the memory); ZENEDGE then quantizes
+each layer's input on the fly and runs its int8 kernels. half="float16"
+or "bfloat16" stores weights and biases half width instead, widened a
+row at a time in the kernel.
+
+    desc_id = upload_mlp(heap, [(w1, b1, "relu"), (w2, b2, "none")])
+    desc_id = upload_mlp(heap, layers, quantize=True)
+    desc_id = upload_mlp(heap, layers, half="bfloat16")
+
+A small ONNX policy (a chain of Gemm/MatMul/Add/activation nodes on
+float32) can instead be shipped as is: upload_onnx() puts the serialized
+model in a BLOB_TYPE_ONNX blob and ZENEDGE lowers it onto the same engine.
+
+    model_id = upload_onnx(heap, open("policy.onnx", "rb").read())
+"""
+
+from typing import List, Optional, Sequence, Tuple
+
+import numpy as np
+
+from .heap import to_bfloat16, from_bfloat16
+from .protocol import (
+    BLOB_TYPE_MODEL_REF,
+    BLOB_TYPE_ONNX,
+    DTYPE_FLOAT16,
+    DTYPE_BFLOAT16,
+    IPC_MLP_MAGIC,
+    IPC_MLP_VERSION,
+    IPC_MLP_MAX_LAYERS,
+    IPC_MLP_MAX_WIDTH,
+    MLP_ACT_NONE,
+    MLP_ACT_RELU,
+    MLP_ACT_TANH,
+    MLP_ACT_SOFTMAX,
+    MLP_DESC_HDR_STRUCT,
+    MLP_LAYER_STRUCT,
+    MLP_DESC_SIZE,
+)
+
+ACT_NAMES = {
+    "none": MLP_ACT_NONE,
+    "relu": MLP_ACT_RELU,
+    "tanh": MLP_ACT_TANH,
+    "softmax": MLP_ACT_SOFTMAX,
+}
+
+HALF_DTYPES = {
+    "float16": DTYPE_FLOAT16,
+    "bfloat16": DTYPE_BFLOAT16,
+}
+
+Layer = Tuple[np.ndarray, Optional[np.ndarray], str]
+
+
+def check_layers(layers: Sequence[Layer]) -> None:
+    """Raise ValueError unless the kernel would accept these layers."""
+    if not 1 <= len(layers) <= IPC_MLP_MAX_LAYERS:
+        raise ValueError(f"1..{IPC_MLP_MAX_LAYERS} layers, got {len(layers)}")
+    width = None
+    for i, (w, b, act) in enumerate(layers):
+        if w.ndim != 2:
+            raise ValueError(f"layer {i}: weights must be [out, in]")
+        out_dim, in_dim = w.shape
+        if width is not None and in_dim != width:
+            raise ValueError(f"layer {i}: takes {in_dim} inputs, previous layer gives {width}")
+        if max(out_dim, in_dim) > IPC_MLP_MAX_WIDTH:
+            raise ValueError(f"layer {i}: wider than {IPC_MLP_MAX_WIDTH}")
+        if b is not None and b.shape != (out_dim,):
+            raise ValueError(f"layer {i}: bias must be [{out_dim}]")
+        if act not in ACT_NAMES:
+            raise ValueError(f"layer {i}: unknown activation '{act}'")
+        if act == "softmax" and i != len(layers) - 1:
+            raise ValueError(f"layer {i}: softmax is only allowed on the last layer")
+        width = out_dim
+
+
+def pack_desc(in_dim: int, blobs: List[Tuple[int, int, int]]) -> bytes:
+    """Descriptor bytes for (weight_blob, bias_blob or 0, MLP_ACT_*) per layer."""
+    data = bytearray(MLP_DESC_SIZE)
+    MLP_DESC_HDR_STRUCT.pack_into(data, 0, IPC_MLP_MAGIC, IPC_MLP_VERSION, len(blobs), in_dim)
+    for i, (w_id, b_id, act) in enumerate(blobs):
+        MLP_LAYER_STRUCT.pack_into(data, MLP_DESC_HDR_STRUCT.size + i * MLP_LAYER_STRUCT.size,
+                                   w_id, b_id, act)
+    return bytes(data)
+
+
+def quantize_weights(w: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
+    """Per-row symmetric int8: (q, scale) with w ~= scale[:, None] * q."""
+    w = np.asarray(w, dtype=np.float32)
+    amax = np.abs(w).max(axis=1)
+    scale = np.where(amax > 0, amax / 127.0, 1.0).astype(np.float32)
+    q = np.clip(np.rint(w / scale[:, None]), -127, 127).astype(np.int8)
+    return q, scale
+
+
+def round_half(arr: np.ndarray, half: Optional[str]) -> np.ndarray:
+    """arr as float32 after a round trip through the half-width format."""
+    arr = np.asarray(arr, dtype=np.float32)
+    if half == "float16":
+        return arr.astype(np.float16).astype(np.float32)
+    if half == "bfloat16":
+        return from_bfloat16(to_bfloat16(arr))
+    return arr
+
+
+def upload_mlp(heap, layers: Sequence[Layer], quantize: bool = False,
+               half: Optional[str] = None) -> Optional[int]:
+    """Write the tensors and descriptor into the heap; returns the model id.
+
+    The caller keeps the blobs' references: ZENEDGE takes its own while a
+    model is loaded, so freeing them after the last use is safe.
+    """
+    check_layers(layers)
+    if half is not None and (half not in HALF_DTYPES or quantize):
+        raise ValueError(f"half must be one of {sorted(HALF_DTYPES)}, without quantize")
+    uploaded: List[int] = []
+    blobs = []
+
+    def put(arr: np.ndarray, quant=None) -> Optional[int]:
+        dtype = HALF_DTYPES.get(half) if quant is None else None
+        if quant is None and dtype is None:
+            arr = np.ascontiguousarray(arr, dtype=np.float32)
+        blob_id = heap.allocate_tensor(arr, quant, dtype)
+        if blob_id is not None:
+            uploaded.append(blob_id)
+        return blob_id
+
+    for w, b, act in layers:
+        if quantize:
+            q, scale = quantize_weights(w)
+            w_id = put(q, (scale.tolist(), [0] * len(scale)))
+        else:
+            w_id = put(w)
+        b_id = put(b) if b is not None else 0
+        if w_id is None or b_id is None:
+            break
+        blobs.append((w_id, b_id, ACT_NAMES[act]))
+    else:
+        desc = pack_desc(layers[0][0].shape[1], blobs)
+        desc_id = heap.allocate_blob(len(desc), BLOB_TYPE_MODEL_REF)
+        if desc_id is not None and heap.write_blob_data(desc_id, desc):
+            return desc_id
+        if desc_id is not None:
+            heap.free_blob(desc_id)
+
+    for blob_id in uploaded:
+        heap.free_blob(blob_id)
+    return None
+
+
+def upload_onnx(heap, model: bytes) -> Optional[int]:
+    """Write a serialized ONNX ModelProto into the heap; returns the model id.
+
+    Nothing is checked here: a graph ZENEDGE cannot lower is refused (and
+    logged) on first use. Initializers must be stored in the model, not as
+    external data.
+    """
+    blob_id = heap.allocate_blob(len(model), BLOB_TYPE_ONNX)
+    if blob_id is None:
+        return None
+    if not heap.write_blob_data(blob_id, model):
+        heap.free_blob(blob_id)
+        return None
+    return blob_id
+
+
+def _quantize_input(h: np.ndarray) -> np.ndarray:
+    """The kernel's per-layer input quantization, dequantized again."""
+    amax = np.abs(h).max()
+    if amax == 0:
+        return h
+    return (np.clip(np.rint(h * (127.0 / amax)), -127, 127) * (amax / 127.0)).astype(np.float32)
+
+
+def forward(layers: Sequence[Layer], obs: np.ndarray, quantize: bool = False,
+            half: Optional[str] = None) -> np.ndarray:
+    """Reference forward pass (what the kernel computes, for a model
+    uploaded with the same quantize and half)."""
+    h = np.asarray(obs, dtype=np.float32)[:layers[0][0].shape[1]]
+    for w, b, act in layers:
+        if quantize:
+            q, scale = quantize_weights(w)
+            h = (q.astype(np.float32) * scale[:, None]) @ _quantize_input(h)
+        else:
+            h = round_half(w, half) @ h
+        if b is not None:
+            h = h + round_half(b, half)
+        if act == "relu":
+            h = np.maximum(h, 0)
+        elif act == "tanh":
+            h = np.tanh(h)
+        elif act == "softmax":
+            e = np.exp(h - h.max())
+            h = e / e.sum()
+    return h
+
+
+def action(layers: Sequence[Layer], obs: np.ndarray, quantize: bool = False,
+           half: Optional[str] = None) -> int:
+    """The kernel's action: argmax, or sign for a single output."""
+    out = forward(layers, obs, quantize, half)
+    if out.shape[0] == 1:
+        return 1 if out[0] > 0 else 0
+    return int(np.argmax(out))
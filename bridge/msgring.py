@@ -0,0 +1,111 @@
+"""
+Variable-length message rings (SPSC, byte-indexed).
+
+Each record is an ipc_msg_hdr_t followed by up to IPC_MSG_MAX_INLINE bytes of
+inline payload, padded to IPC_MSG_ALIGN. A record never straddles the end of
+the data area: the producer writes an IPC_MSG_KIND_WRAP header and restarts
+at offset 0.
+
+Kernel:
+- Produces commands (message command ring)
+- Consumes responses (message response ring)
+
+Host:
+- Consumes commands
+- Produces responses
+"""
+
+from typing import Optional, Tuple
+
+from .protocol import (
+    IPC_MSG_MAGIC,
+    IPC_MSG_MAX_INLINE,
+    IPC_MSG_KIND_DATA,
+    IPC_MSG_KIND_WRAP,
+    MSG_HDR_STRUCT,
+    MSG_HDR_SIZE,
+    RING_HEADER_STRUCT,
+    RING_LAYOUT_V3,
+    RingHeader,
+    RingLayout,
+    msg_record_size,
+)
+
+
+class MsgRing:
+    def __init__(self, shm, offset: int, layout: RingLayout = RING_LAYOUT_V3):
+        self.shm = shm
+        self.offset = offset
+        self.layout = layout
+
+    @property
+    def data_offset(self) -> int:
+        return self.offset + self.layout.header_size
+
+    def _read_header(self) -> RingHeader:
+        self.shm.seek(self.offset)
+        data = self.shm.read(RING_HEADER_STRUCT.size)
+        return RingHeader.unpack(data, self.layout)
+
+    def _write_head(self, head: int) -> None:
+        self.shm.seek(self.offset + self.layout.head_offset)
+        self.shm.write(head.to_bytes(4, 'little'))
+
+    def _write_tail(self, tail: int) -> None:
+        self.shm.seek(self.offset + self.layout.tail_offset)
+        self.shm.write(tail.to_bytes(4, 'little'))
+
+    def ready(self) -> bool:
+        return self._read_header().magic == IPC_MSG_MAGIC
+
+    def pop(self) -> Optional[Tuple[Tuple[int, int, int, int, int, int], bytes]]:
+        """Consume one record: ((kind, len, cmd, status, arg, tag), inline)."""
+        hdr = self._read_header()
+        if hdr.magic != IPC_MSG_MAGIC:
+            return None
+
+        tail = hdr.tail
+        while tail != hdr.head:
+            off = tail & (hdr.size - 1)
+            self.shm.seek(self.data_offset + off)
+            fields = MSG_HDR_STRUCT.unpack(self.shm.read(MSG_HDR_SIZE))
+            if fields[0] == IPC_MSG_KIND_WRAP:
+                tail = (tail + hdr.size - off) & 0xFFFFFFFF
+                continue
+
+            length = min(fields[1], IPC_MSG_MAX_INLINE)
+            data = self.shm.read(length)
+            self._write_tail((tail + msg_record_size(fields[1])) & 0xFFFFFFFF)
+            return fields, data
+
+        if tail != hdr.tail:
+            self._write_tail(tail)
+        return None
+
+    def push(self, cmd: int, status: int, arg: int, tag: int,
+             data: bytes = b'') -> bool:
+        hdr = self._read_header()
+        if hdr.magic != IPC_MSG_MAGIC or len(data) > IPC_MSG_MAX_INLINE:
+            return False
+
+        need = msg_record_size(len(data))
+        head = hdr.head
+        off = head & (hdr.size - 1)
+        skip = hdr.size - off if hdr.size - off < need else 0
+        if ((head + skip + need - hdr.tail) & 0xFFFFFFFF) > hdr.size:
+            return False
+
+        if skip:
+            self.shm.seek(self.data_offset + off)
+            self.shm.write(MSG_HDR_STRUCT.pack(IPC_MSG_KIND_WRAP, 0, 0, 0, 0, 0))
+            head = (head + skip) & 0xFFFFFFFF
+            off = 0
+
+        self.shm.seek(self.data_offset + off)
+        self.shm.write(MSG_HDR_STRUCT.pack(IPC_MSG_KIND_DATA, len(data), cmd,
+                                           status, arg & 0xFFFFFFFF, tag))
+        if data:
+            self.shm.write(data)
+
+        self._write_head((head + need) & 0xFFFFFFFF)
+        return True
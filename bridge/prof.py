@@ -0,0 +1,218 @@
+"""
+Kernel sampling profiles (CMD_PROF_SAMPLES).
+
+`prof start [hz]` in the ZENEDGE shell samples the interrupted instruction
+pointer and a short frame-pointer backtrace off the timer interrupt;
+`prof stop` sends the samples. The bridge keeps one file per profile, and
+this module symbolizes them against the kernel image it came from:
+
+    python3 -m bridge.prof /tmp/zenedge_prof/latest.bin --elf zenedge.bin --graph
+    python3 -m bridge.prof /tmp/zenedge_prof/latest.bin --folded out.folded
+    flamegraph.pl out.folded > prof.svg
+
+Backtraces only mean something in a kernel built with FRAME_POINTERS=1.
+"""
+
+import argparse
+import bisect
+import os
+import shutil
+import subprocess
+import sys
+from collections import Counter, defaultdict
+from typing import Optional, Dict, Any, List, Tuple
+
+from .protocol import (
+    IPC_PROF_MAGIC,
+    IPC_PROF_VERSION,
+    IPC_PROF_DEPTH,
+    IPC_PROF_FRAMES,
+    IPC_PROF_USER,
+    PROF_HDR_STRUCT,
+    PROF_REC_STRUCT,
+)
+
+USER_FRAME = "[user]"
+
+
+def parse_prof(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode a profile blob, or None if it is not one."""
+    if not data or len(data) < PROF_HDR_STRUCT.size:
+        return None
+
+    magic, version, count, hz, flags, dropped, start_us, end_us = PROF_HDR_STRUCT.unpack_from(data, 0)
+    if magic != IPC_PROF_MAGIC or version != IPC_PROF_VERSION:
+        return None
+    if len(data) < PROF_HDR_STRUCT.size + count * PROF_REC_STRUCT.size:
+        return None
+
+    samples = []
+    off = PROF_HDR_STRUCT.size
+    for _ in range(count):
+        f = PROF_REC_STRUCT.unpack_from(data, off)
+        off += PROF_REC_STRUCT.size
+        ip, pid, cpu, depth, rflags = f[:5]
+        samples.append({
+            "ip": ip,
+            "pid": pid,
+            "cpu": cpu,
+            "user": bool(rflags & IPC_PROF_USER),
+            "frames": list(f[5:5 + min(depth, IPC_PROF_DEPTH)]),
+        })
+
+    return {"hz": hz, "frame_pointers": bool(flags & IPC_PROF_FRAMES), "dropped": dropped,
+            "start_us": start_us, "end_us": end_us, "samples": samples}
+
+
+class Symbols:
+    """Function symbols of a kernel image (nm), looked up by address."""
+
+    def __init__(self, syms: List[Tuple[int, int, str]]):
+        # (start, end, name) sorted by start; end 0 = up to the next one
+        self._starts = [s[0] for s in syms]
+        self._syms = syms
+
+    @classmethod
+    def from_elf(cls, path: str) -> 'Symbols':
+        nm = shutil.which("nm") or shutil.which("llvm-nm")
+        if not nm:
+            raise OSError("no nm (binutils or llvm) to read symbols with")
+        out = subprocess.run([nm, "-n", "-S", "-C", "--defined-only", path],
+                             capture_output=True, text=True, check=True).stdout
+        syms = []
+        for line in out.splitlines():
+            parts = line.split(None, 3)
+            # addr [size] type name; names may have spaces once demangled
+            if len(parts) == 4 and len(parts[2]) == 1:
+                addr, size, kind, name = int(parts[0], 16), int(parts[1], 16), parts[2], parts[3]
+            elif len(parts) >= 3 and len(parts[1]) == 1:
+                addr, size, kind, name = int(parts[0], 16), 0, parts[1], line.split(None, 2)[2]
+            else:
+                continue
+            if kind in "tTwW":
+                syms.append((addr, addr + size if size else 0, name))
+        return cls(syms)
+
+    def lookup(self, addr: int) -> str:
+        i = bisect.bisect_right(self._starts, addr) - 1
+        if i >= 0:
+            start, end, name = self._syms[i]
+            nxt = self._syms[i + 1][0] if i + 1 < len(self._syms) else None
+            if (end and addr < end) or (not end and (nxt is None or addr < nxt)):
+                return name
+        return f"{addr:#x}"
+
+
+def stacks(profile: Dict[str, Any], syms: Optional[Symbols]) -> List[List[str]]:
+    """Each sample as function names, innermost first. Return addresses are
+    looked up one byte back, inside the call that made them."""
+    def name(addr: int) -> str:
+        return syms.lookup(addr) if syms else f"{addr:#x}"
+
+    out = []
+    for s in profile["samples"]:
+        if s["user"]:
+            out.append([USER_FRAME])
+            continue
+        out.append([name(s["ip"])] + [name(ret - 1) for ret in s["frames"]])
+    return out
+
+
+def folded(profile: Dict[str, Any], syms: Optional[Symbols], by_pid: bool = False) -> List[str]:
+    """Folded stacks for flamegraph.pl / speedscope: root first, `;`-joined,
+    then the sample count."""
+    counts: Counter = Counter()
+    for s, stack in zip(profile["samples"], stacks(profile, syms)):
+        frames = list(reversed(stack))
+        if by_pid:
+            frames.insert(0, f"pid {s['pid']}")
+        counts[";".join(frames)] += 1
+    return [f"{k} {v}" for k, v in sorted(counts.items())]
+
+
+def render(profile: Dict[str, Any], syms: Optional[Symbols] = None, top: int = 25,
+           graph: bool = False) -> str:
+    """Flat profile (self and inclusive share per function) and, with graph,
+    each hot function's callers and callees."""
+    samples = profile["samples"]
+    n = len(samples)
+    secs = (profile["end_us"] - profile["start_us"]) / 1e6 if profile["end_us"] else 0.0
+    lines = [f"prof: {n} samples at {profile['hz']} Hz over {secs:.2f} s"
+             + (f", {profile['dropped']} dropped" if profile["dropped"] else "")
+             + ("" if profile["frame_pointers"] else
+                " (no frame pointers: callers unreliable, build with FRAME_POINTERS=1)")]
+    if not n:
+        return "\n".join(lines)
+
+    all_stacks = stacks(profile, syms)
+    self_n: Counter = Counter()
+    total_n: Counter = Counter()
+    callers: Dict[str, Counter] = defaultdict(Counter)
+    callees: Dict[str, Counter] = defaultdict(Counter)
+    for stack in all_stacks:
+        self_n[stack[0]] += 1
+        for fn in set(stack):
+            total_n[fn] += 1
+        for callee, caller in zip(stack, stack[1:]):
+            callers[callee][caller] += 1
+            callees[caller][callee] += 1
+
+    lines.append(f"  {'self %':>7} {'self':>6} {'total %':>8} {'total':>6}  function")
+    for fn, cnt in self_n.most_common(top):
+        lines.append(f"  {100.0 * cnt / n:>7.2f} {cnt:>6} {100.0 * total_n[fn] / n:>8.2f} "
+                     f"{total_n[fn]:>6}  {fn}")
+
+    if graph:
+        lines.append("")
+        lines.append("call graph (by inclusive samples):")
+        for fn, cnt in total_n.most_common(top):
+            lines.append(f"  {fn}  total {100.0 * cnt / n:.2f}%  self {100.0 * self_n[fn] / n:.2f}%")
+            for caller, c in callers[fn].most_common(5):
+                lines.append(f"      <- {caller} ({c})")
+            for callee, c in callees[fn].most_common(5):
+                lines.append(f"      -> {callee} ({c})")
+    return "\n".join(lines)
+
+
+def load_symbols(elf: Optional[str]) -> Optional[Symbols]:
+    """Symbols of elf (default $ZENEDGE_ELF, then ./zenedge.bin), or None
+    if there is no image or nothing to read it with."""
+    path = elf or os.environ.get("ZENEDGE_ELF") or "zenedge.bin"
+    if not os.path.exists(path):
+        return None
+    try:
+        return Symbols.from_elf(path)
+    except (OSError, subprocess.CalledProcessError) as e:
+        print(f"{path}: no symbols ({e})", file=sys.stderr)
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize and render a ZENEDGE sampling profile")
+    parser.add_argument("path", help="saved CMD_PROF_SAMPLES blob")
+    parser.add_argument("--elf", help="kernel image the profile was taken on (default zenedge.bin)")
+    parser.add_argument("--top", type=int, default=25, help="functions to list")
+    parser.add_argument("--graph", action="store_true", help="also print callers and callees")
+    parser.add_argument("--folded", metavar="FILE", help="write folded stacks here ('-' = stdout)")
+    parser.add_argument("--by-pid", action="store_true", help="root folded stacks at their process")
+    args = parser.parse_args()
+
+    with open(args.path, 'rb') as f:
+        profile = parse_prof(f.read())
+    if profile is None:
+        print(f"{args.path}: not a profile")
+        sys.exit(1)
+
+    syms = load_symbols(args.elf)
+    if args.folded:
+        text = "\n".join(folded(profile, syms, args.by_pid)) + "\n"
+        if args.folded == "-":
+            sys.stdout.write(text)
+            return
+        with open(args.folded, "w") as f:
+            f.write(text)
+    print(render(profile, syms, args.top, args.graph))
+
+
+if __name__ == "__main__":
+    main()
@@ -6,8 +6,13 @@ in kernel/ipc/ipc_proto.h. All values must match exactly for interoperability.
 """
 
 import struct
-from dataclasses import dataclass
-from typing import Tuple
+from dataclasses import dataclass, field
+from typing import Dict, List, Optional, Tuple
+
+try:
+    from crc32c import crc32c as _crc32c_native  # SSE4.2 / ARMv8 CRC32C
+except ImportError:
+    _crc32c_native = None
 
 # =============================================================================
 # SHARED MEMORY LAYOUT (1MB total)
@@ -16,7 +21,10 @@ from typing import Tuple
 # 0x08000 - 0x0FFFF: Response ring (32KB)   - Linux -> ZENEDGE
 # 0x10000 - 0x100FF: Doorbell control (256B) - Interrupt signaling
 # 0x10100 - 0x10FFF: Heap control block (~4KB)
-# 0x11000 - 0xFDFFF: Heap data region (~948KB for tensors/models)
+# 0x10F00 - 0x10F3F: Telemetry page (seqlock, in the mesh page tail)
+# 0x11000 - 0xF8FFF: Heap data region (~928KB for tensors/models)
+# 0xF9000 - 0xFB7FF: Message command ring (variable-length, inline payloads)
+# 0xFB800 - 0xFDFFF: Message response ring
 # 0xFE000 - 0xFEFFF: OBS ring (streaming)
 # 0xFF000 - 0xFFFFF: ACTION ring (streaming)
 
@@ -25,19 +33,73 @@ IPC_RSP_RING_OFFSET  = 0x08000
 IPC_DOORBELL_OFFSET  = 0x10000
 IPC_HEAP_CTL_OFFSET  = 0x10100
 IPC_HEAP_DATA_OFFSET = 0x11000
-IPC_HEAP_DATA_SIZE   = 0xED000  # ~948KB (reserve tail for stream rings)
+IPC_HEAP_DATA_SIZE   = 0xE8000  # ~928KB (reserve tail for msg/stream rings)
+
+# Variable-length message rings (byte-indexed, 16-byte aligned records)
+IPC_MSG_MAGIC        = 0x4D534752  # "MSGR"
+IPC_MSG_RING_BYTES   = 0x2800
+IPC_MSG_DATA_BYTES   = 0x2000
+IPC_MSG_CMD_RING_OFFSET = IPC_HEAP_DATA_OFFSET + IPC_HEAP_DATA_SIZE
+IPC_MSG_RSP_RING_OFFSET = IPC_MSG_CMD_RING_OFFSET + IPC_MSG_RING_BYTES
+IPC_MSG_ALIGN        = 16
+IPC_MSG_MAX_INLINE   = 512
+IPC_MSG_KIND_DATA    = 0x0001
+IPC_MSG_KIND_WRAP    = 0x0002
 
 # Streaming obs/action rings (SPSC)
 IPC_STREAM_MAGIC     = 0x5354524D  # "STRM"
 IPC_OBS_RING_BYTES   = 0x1000
 IPC_ACT_RING_BYTES   = 0x1000
-IPC_OBS_RING_OFFSET  = IPC_HEAP_DATA_OFFSET + IPC_HEAP_DATA_SIZE
+IPC_OBS_RING_OFFSET  = IPC_MSG_RSP_RING_OFFSET + IPC_MSG_RING_BYTES
 IPC_ACT_RING_OFFSET  = IPC_OBS_RING_OFFSET + IPC_OBS_RING_BYTES
 IPC_OBS_RING_SIZE    = 64
 IPC_ACT_RING_SIZE    = 64
+IPC_OBS_DIM_DEFAULT  = 4     # Obs width when the ring header leaves obs_dim 0
+IPC_OBS_DIM_MAX      = 512
 
 IPC_SHARED_MEM_SIZE  = 0x100000  # 1MB total
 
+# =============================================================================
+# LAYOUT DESCRIPTOR (offset 0 when present; see kernel/ipc/layout.c)
+# =============================================================================
+# Images that size the region from BAR2 publish a region table at offset 0.
+# Without one (magic mismatch) the fixed 1MB layout above applies.
+# typedef struct { uint32_t offset, size, entries, reserved; } ipc_region_t;
+# typedef struct {
+#   uint32_t magic, version, total_size, region_count;
+#   uint32_t reserved[12];
+#   ipc_region_t regions[IPC_REGION_MAX];
+# } ipc_layout_t;
+
+IPC_LAYOUT_MAGIC     = 0x5459414C  # "LAYT"
+IPC_LAYOUT_VERSION   = 1
+IPC_REGION_MAX       = 32
+IPC_SHARED_MEM_MIN   = IPC_SHARED_MEM_SIZE
+
+IPC_REGION_CMD_RING  = 0
+IPC_REGION_RSP_RING  = 1
+IPC_REGION_DOORBELL  = 2
+IPC_REGION_HEAP_CTL  = 3
+IPC_REGION_HEAP_DATA = 4
+IPC_REGION_MESH      = 5
+IPC_REGION_TELEMETRY = 6
+IPC_REGION_MSG_CMD   = 7
+IPC_REGION_MSG_RSP   = 8
+IPC_REGION_OBS_RING  = 9
+IPC_REGION_ACT_RING  = 10
+IPC_REGION_BULK      = 11  # Optional: images before it publish 11 regions
+IPC_REGION_STREAM_CHAN = 12  # Optional: stream channels 1..
+IPC_REGION_MESH_WORK = 13  # Optional: kernel-to-kernel step rings
+IPC_REGION_MESH_COLL = 14  # Optional: kernel-to-kernel collective chunks
+IPC_REGION_TRACE     = 15  # Optional: flight recorder export ring
+IPC_REGION_STATS     = 16  # Optional: kernel statistics page
+IPC_REGION_JOBS      = 17  # Optional: job graph submission ring
+IPC_REGION_COUNT     = 18
+IPC_REGION_REQUIRED  = 11
+
+LAYOUT_HDR_STRUCT = struct.Struct('<IIII48x')
+REGION_STRUCT     = struct.Struct('<IIII')
+
 # =============================================================================
 # MAGIC NUMBERS
 # =============================================================================
@@ -53,7 +115,52 @@ DOORBELL_MAGIC = 0x444F4F52  # "DOOR"
 # =============================================================================
 
 IPC_RING_SIZE = 1024  # Number of packets in ring
-RING_HEADER_SIZE = 32  # 4 uint32 + 4 reserved uint32
+
+# Ring protocol versions (doorbell_ctl_t.version / peer_version)
+IPC_PROTO_VERSION_V1 = 1  # Packed 32-byte header, modulo indices
+IPC_PROTO_VERSION_V2 = 2  # Cache-line split header, free-running indices
+IPC_PROTO_VERSION_V3 = 3  # v2 rings + 24-byte tagged packets/responses
+IPC_PROTO_VERSION    = IPC_PROTO_VERSION_V3
+
+# Request tag 0 = untagged (response goes to whoever polls next)
+IPC_TAG_NONE = 0
+
+# v2 ring header: three 64-byte lines
+#   line 0: magic, version, size, mask (init only)
+#   line 1: head (producer-owned)
+#   line 2: tail (consumer-owned)
+IPC_CACHE_LINE = 64
+RING_V2_HEADER_SIZE = 3 * IPC_CACHE_LINE
+RING_V2_HEAD_OFFSET = 1 * IPC_CACHE_LINE
+RING_V2_TAIL_OFFSET = 2 * IPC_CACHE_LINE
+
+# Obs stream ring clock sync (line 1, after head/overruns/max_occupancy):
+# the bridge writes clock_ns (uint64) then bumps clock_seq at CMD_ENV_RESET
+RING_V2_CLOCK_SEQ_OFFSET = RING_V2_HEAD_OFFSET + 12
+RING_V2_CLOCK_NS_OFFSET = RING_V2_HEAD_OFFSET + 16
+
+# Trace export ring: events ZENEDGE lost before exporting them (line 1)
+RING_V2_LOST_OFFSET = RING_V2_HEAD_OFFSET + 24
+
+RING_HEADER_SIZE = RING_V2_HEADER_SIZE
+
+# Ring flags (line 0, after mask)
+RING_V2_FLAGS_OFFSET = 16
+IPC_RING_FLAG_MPSC = 0x00000001  # Per-slot uint32 seq array follows data[]
+
+# Stream ring overflow policy (flags bits 2:1). FIFO refuses pushes while
+# full; DROP_OLDEST overwrites unread entries and a lapped consumer skips
+# ahead; LATEST also overwrites and the consumer always takes the newest.
+IPC_RING_POLICY_SHIFT       = 1
+IPC_RING_POLICY_MASK        = 3 << IPC_RING_POLICY_SHIFT
+IPC_RING_POLICY_FIFO        = 0 << IPC_RING_POLICY_SHIFT
+IPC_RING_POLICY_DROP_OLDEST = 1 << IPC_RING_POLICY_SHIFT
+IPC_RING_POLICY_LATEST      = 2 << IPC_RING_POLICY_SHIFT
+IPC_RING_POLICY_NAMES = {
+    IPC_RING_POLICY_FIFO: "fifo",
+    IPC_RING_POLICY_DROP_OLDEST: "drop-oldest",
+    IPC_RING_POLICY_LATEST: "latest",
+}
 
 # =============================================================================
 # COMMAND IDs (0x0000-0x7FFF)
@@ -62,14 +169,61 @@ RING_HEADER_SIZE = 32  # 4 uint32 + 4 reserved uint32
 CMD_PING      = 0x0001
 CMD_PRINT     = 0x0002
 CMD_RUN_MODEL = 0x0010
+CMD_AGENT_LOAD = 0x0011  # Result: blob/bulk id of the wasm agent, 0 = none
+CMD_WASM_PROFILE = 0x0012  # Payload: blob holding a wasm profile dump
+CMD_RUN_MODEL_BATCH = 0x0013  # Payload: blob holding an ipc_run_batch_t
+CMD_BOOT_PROFILE = 0x0014  # Payload: blob holding the boot phase profile
+CMD_BENCH_RESULTS = 0x0015  # Payload: blob holding shell bench results
+CMD_PROF_SAMPLES = 0x0016  # Payload: blob holding sampling profiler records
 CMD_ENV_RESET = 0x0100
 CMD_ENV_STEP  = 0x0101
+CMD_ENV_BENCH = 0x0102  # Inline: ipc_env_bench_t, control-loop benchmark
 CMD_IFR_PERSIST = 0x0200
 CMD_ARB_EPISODE = 0x0201
 CMD_TELEMETRY_POLL = 0x0300
+CMD_ACT_APPLY = 0x0301  # Inline: actuator settings for one device
+CMD_JOB_SUBMIT = 0x0400  # Job ring entry: blob holding a flat job graph
+CMD_JOB_STATUS = 0x0401  # Inline: ipc_job_status_t, payload = the graph's blob
+
+# CMD_ACT_APPLY (message ring): arg = device index, payload = up to
+# ACT_MAX_SETTINGS settings (knob u16, reserved u16, value u32) applied in
+# order. RSP_OK's result is how many microseconds before the reply the last
+# setting took effect; RSP_ERROR's is a mask of the settings that failed.
+ACT_MAX_SETTINGS = 16
+ACT_KNOB_CLOCK_MHZ = 1
+ACT_KNOB_POWER_W = 2
+ACT_SETTING_STRUCT = struct.Struct('<HHI')
 
 # CMD_ENV_RESET payload flags
 ENV_RESET_FLAG_STREAM = 0x00000001
+ENV_RESET_FLAG_PIPELINE = 0x00000002  # Vector stepped in two groups, see env_pipeline_groups
+
+# CMD_ENV_RESET payload: [15:0] flags, [31:16] env count (0 = 1). More than
+# one env runs a vector: each stream step is a batch of `envs` obs entries
+# (env i at position i) answered by a batch of `envs` actions, and finished
+# envs reset themselves.
+ENV_RESET_FLAGS_MASK = 0x0000FFFF
+ENV_RESET_ENVS_SHIFT = 16
+
+
+def env_reset_pack(flags: int, envs: int = 1) -> int:
+    return ((envs & 0xFFFF) << ENV_RESET_ENVS_SHIFT) | (flags & ENV_RESET_FLAGS_MASK)
+
+
+def env_reset_envs(payload: int) -> int:
+    return ((payload >> ENV_RESET_ENVS_SHIFT) & 0xFFFF) or 1
+
+
+def env_pipeline_groups(envs: int, pipeline: bool):
+    """(first env, count) of each group in stepping order: one group of all
+    envs, or with ENV_RESET_FLAG_PIPELINE the first (envs + 1) // 2 and the
+    rest, stepped in turns so ZENEDGE infers one while the bridge steps the
+    other."""
+    if not pipeline or envs < 2:
+        return [(0, envs)]
+    split = (envs + 1) // 2
+    return [(0, split), (split, envs - split)]
+
 
 # CMD_ENV_STEP payload encoding (single-trip control loop)
 # [31:16] = ack blob id, [15:0] = action
@@ -84,16 +238,39 @@ def env_step_unpack(payload: int) -> Tuple[int, int]:
     ack_blob_id = (payload >> ENV_STEP_ACK_SHIFT) & 0xFFFF
     return action, ack_blob_id
 
+# CMD_ENV_BENCH (message ring): a GYM_BENCH kernel sends one when its warmup
+# is over and one with its figures (IPC_ENV_BENCH_DONE) after `steps` steps
+# typedef struct { uint32_t magic, version, flags, envs, steps, episodes;
+#                  uint64_t elapsed_us, spin_us, sleep_us;
+#                  uint32_t period_ns[4], infer_ns[4]; } ipc_env_bench_t;  (p50/p90/p99/max)
+IPC_ENV_BENCH_MAGIC   = 0x48434245  # "EBCH"
+IPC_ENV_BENCH_VERSION = 1
+IPC_ENV_BENCH_STREAM  = 0x01  # Stream rings, else CMD_ENV_STEP blobs
+IPC_ENV_BENCH_DONE    = 0x02  # The window is over: figures are final
+IPC_ENV_BENCH_PIPELINE = 0x04  # Vector stepped in two groups
+
+ENV_BENCH_STRUCT = struct.Struct('<6I3Q4I4I')
+
 # Command names for logging
 CMD_NAMES = {
     CMD_PING: "PING",
     CMD_PRINT: "PRINT",
     CMD_RUN_MODEL: "RUN_MODEL",
+    CMD_AGENT_LOAD: "AGENT_LOAD",
+    CMD_WASM_PROFILE: "WASM_PROFILE",
+    CMD_RUN_MODEL_BATCH: "RUN_MODEL_BATCH",
+    CMD_BOOT_PROFILE: "BOOT_PROFILE",
+    CMD_BENCH_RESULTS: "BENCH_RESULTS",
+    CMD_PROF_SAMPLES: "PROF_SAMPLES",
     CMD_ENV_RESET: "ENV_RESET",
     CMD_ENV_STEP: "ENV_STEP",
+    CMD_ENV_BENCH: "ENV_BENCH",
     CMD_IFR_PERSIST: "IFR_PERSIST",
     CMD_ARB_EPISODE: "ARB_EPISODE",
     CMD_TELEMETRY_POLL: "TELEMETRY_POLL",
+    CMD_ACT_APPLY: "ACT_APPLY",
+    CMD_JOB_SUBMIT: "JOB_SUBMIT",
+    CMD_JOB_STATUS: "JOB_STATUS",
 }
 
 # =============================================================================
@@ -120,15 +297,193 @@ FLAG_IRQ_ON_COMPLETE = 0x0001  # Request interrupt on completion
 DOORBELL_FLAG_IRQ_ENABLED = 0x01
 DOORBELL_FLAG_PENDING     = 0x02
 
+# Bulk ring (IPC_REGION_BULK): chunked uploads into kernel pages
+# typedef struct {
+#   uint32_t magic, slots, chunk_size, reserved0[13];         /* line 0 */
+#   uint32_t xfer_id, total_size, head, reserved1[13];        /* line 1: bridge */
+#   uint32_t accepted, status, credit, tail, model_id, ...;   /* line 2: kernel */
+# } ipc_bulk_ring_t;
+# typedef struct { uint32_t xfer_id, index, len, reserved; uint8_t data[]; } ipc_bulk_chunk_t;
+IPC_BULK_MAGIC       = 0x524B4C42  # "BLKR"
+IPC_BULK_CHUNK_SIZE  = 16384
+IPC_BULK_MAX_SIZE    = 16 << 20
+IPC_BULK_MODEL_BASE  = 0x10000  # Model ids at or above name bulk uploads
+
+IPC_BULK_IDLE    = 0
+IPC_BULK_OPEN    = 1
+IPC_BULK_DONE    = 2
+IPC_BULK_NOMEM   = 3
+IPC_BULK_INVALID = 4
+
+BULK_LINE0_STRUCT = struct.Struct('<III')
+BULK_BRIDGE_OFFSET = 1 * IPC_CACHE_LINE   # xfer_id, total_size, head
+BULK_KERNEL_OFFSET = 2 * IPC_CACHE_LINE   # accepted, status, credit, tail, model_id
+BULK_KERNEL_STRUCT = struct.Struct('<IIIII')
+BULK_HEADER_SIZE = 3 * IPC_CACHE_LINE
+BULK_CHUNK_HDR_STRUCT = struct.Struct('<IIII')
+BULK_CHUNK_SIZE = BULK_CHUNK_HDR_STRUCT.size + IPC_BULK_CHUNK_SIZE
+
+# Trace export ring (IPC_REGION_TRACE): common ring header, FIFO, then
+# trace_event_t entries (kernel/trace/flightrec.h):
+# typedef struct __attribute__((packed)) {
+#   uint64_t ts_usec, ts_cycles;
+#   uint8_t  type, sig; uint16_t cpu_id;
+#   uint32_t job_id, step_id, extra;
+# } trace_event_t;
+IPC_TRACE_MAGIC      = 0x45435254  # "TRCE"
+IPC_TRACE_ENTRY_SIZE = 32
+TRACE_EVENT_STRUCT = struct.Struct('<QQBBHIII')
+TRACE_EVT_JOB_SUBMIT = 0x01
+TRACE_EVT_JOB_COMPLETE = 0x02  # Ends the job's span: extra = its duration in us
+TRACE_EVT_STEP_START = 0x03
+TRACE_EVT_STEP_END = 0x04    # Ends a step's span: extra = its duration in us
+TRACE_EVT_IPC_SEND = 0x70    # job = 0, step = tag, extra = cmd
+TRACE_EVT_IPC_RESPONSE = 0x71  # job = 0, step = tag, extra = status << 16 | cmd
+TRACE_EVT_IPC_DOORBELL = 0x72  # extra = packets since the last doorbell
+TRACE_EVT_TRACE_LOST = 0xF2  # extra = events lost before this one
+TRACE_EVT_SEAL = 0xF3        # job = CPUs << 16 | cpu, step = its events, extra = seal[0:4]
+TRACE_EVT_CLOCK_SYNC = 0xF4  # CLOCK_MONOTONIC ns at ts_usec = step << 32 | job, extra = error ns
+TRACE_SEAL_BLOCK = 16        # Events per link of a CPU's seal chain
+TRACE_EVT_PMU_INSTR = 0x60   # After a span's end event: extra = counter delta
+TRACE_PMU_EVENTS = ('instr', 'cycles', 'llc_miss', 'br_miss', 'dtlb_miss')  # 0x60 + index
+
+# Job submission ring (IPC_REGION_JOBS): common ring header, FIFO, produced
+# by the bridge, of ipc_job_submit_t { uint16_t cmd, blob_id; uint32_t tag; }.
+# The blob (BLOB_TYPE_JOB) holds a flat graph, offsets from its data start:
+#   ipc_job_graph_t { magic, version, size, job_id, num_steps, num_deps,
+#                     num_tensors, steps_off, dep_off, dep_idx_off,
+#                     tensors_off, reserved; ipc_job_contract_t contract; }
+#   ipc_job_contract_t { uint32_t cpu_budget_us, memory_kb, deadline_us;
+#                        uint8_t prio, preferred_node, max_inflight, reserved; }
+#   ipc_job_step_t { uint32_t id; uint8_t type, flags, coll_op, num_inputs,
+#                    num_outputs, reserved[3]; uint32_t est_us, inputs[4], outputs[2]; }
+#   uint32_t dep_off[num_steps + 1], dep_idx[num_deps]  (CSR: parents by index)
+#   ipc_job_tensor_t { uint32_t id, num_elements; uint8_t dtype, pinned,
+#                      node_affinity, reserved; }
+# Answered by CMD_JOB_STATUS with an inline ipc_job_status_t.
+IPC_JOBQ_MAGIC        = 0x4A4F4251  # "JOBQ"
+IPC_JOB_GRAPH_MAGIC   = 0x4A475048  # "JGPH"
+IPC_JOB_GRAPH_VERSION = 1
+IPC_JOB_MAX_STEPS     = 4096
+IPC_JOB_MAX_DEPS      = 16384
+IPC_JOB_MAX_TENSORS   = 4096
+IPC_JOB_STEP_INPUTS   = 4
+IPC_JOB_STEP_OUTPUTS  = 2
+IPC_JOB_STEP_MEMOIZE  = 0x01
+
+IPC_JOB_DONE     = 1
+IPC_JOB_REJECTED = 2  # admit = admit_result_t
+IPC_JOB_INVALID  = 3
+IPC_JOB_NOMEM    = 4
+IPC_JOB_STATE_NAMES = {IPC_JOB_DONE: "done", IPC_JOB_REJECTED: "rejected",
+                       IPC_JOB_INVALID: "invalid", IPC_JOB_NOMEM: "no memory"}
+ADMIT_NAMES = ("ok", "memory", "cpu", "priority", "no resources")
+
+STEP_TYPE_COMPUTE    = 0
+STEP_TYPE_COLLECTIVE = 1
+STEP_TYPE_IO         = 2
+STEP_TYPE_CONTROL    = 3
+
+JOB_SUBMIT_STRUCT = struct.Struct('<HHI')
+JOB_GRAPH_STRUCT = struct.Struct('<12I3IBBBB')
+JOB_STEP_STRUCT = struct.Struct('<I5B3xI4I2I')
+JOB_TENSOR_STRUCT = struct.Struct('<IIBBBx')
+# job_id, tag, state, admit, steps, peak_memory_kb, critical_path_us, wait_us, run_us
+JOB_STATUS_STRUCT = struct.Struct('<IIHH5I')
+
+# WASM profile dump (CMD_WASM_PROFILE blob)
+# typedef struct { uint32_t magic, version, mode, count, cpu_mhz, reserved[3]; } ipc_wasm_prof_hdr_t;
+# typedef struct { uint32_t kind, reserved; uint64_t calls, cycles; char name[40]; } ipc_wasm_prof_rec_t;
+IPC_WASM_PROF_MAGIC   = 0x46525057  # "WPRF"
+IPC_WASM_PROF_VERSION = 1
+
+IPC_WASM_PROF_CALLS = 0x01  # Exported function calls: count, cycles
+IPC_WASM_PROF_HOST  = 0x02  # Host imports: count, cycles
+IPC_WASM_PROF_OPS   = 0x04  # Opcode counts (WASM_OPPROF=1 builds)
+
+IPC_WASM_PROF_KIND_FUNC = 1
+IPC_WASM_PROF_KIND_HOST = 2
+IPC_WASM_PROF_KIND_OP   = 3
+
+WASM_PROF_HDR_STRUCT = struct.Struct('<IIIII12x')
+WASM_PROF_REC_STRUCT = struct.Struct('<IIQQ40s')
+
+# Boot profile (CMD_BOOT_PROFILE blob), times in us since kmain64 entry
+# typedef struct { uint32_t magic, version, flags, count, tsc_khz, reserved[3]; } ipc_boot_prof_hdr_t;
+# typedef struct { uint64_t usec; char name[24]; } ipc_boot_prof_rec_t;
+IPC_BOOT_PROF_MAGIC   = 0x46525042  # "BPRF"
+IPC_BOOT_PROF_VERSION = 1
+IPC_BOOT_PROF_FAST    = 0x01  # Fast-boot build (FAST_BOOT=1)
+
+BOOT_PROF_HDR_STRUCT = struct.Struct('<IIIII12x')
+BOOT_PROF_REC_STRUCT = struct.Struct('<Q24s')
+
+# Microbenchmark results (CMD_BENCH_RESULTS blob), cycles per sample of batch ops
+# typedef struct { uint32_t magic, version, count, tsc_khz, overhead, flags; uint64_t usec; } ipc_bench_hdr_t;
+# typedef struct { char name[24]; uint32_t batch, samples, bytes, reserved;
+#                  uint32_t min, p50, p99, max; uint64_t mean; } ipc_bench_rec_t;  (mean x256)
+IPC_BENCH_MAGIC   = 0x48434E42  # "BNCH"
+IPC_BENCH_VERSION = 1
+IPC_BENCH_RDTSCP  = 0x01  # Samples end on rdtscp
+
+BENCH_HDR_STRUCT = struct.Struct('<IIIIIIQ')
+BENCH_REC_STRUCT = struct.Struct('<24sIII4x4IQ')
+
+# Sampling profile (CMD_PROF_SAMPLES blob), samples oldest first
+# typedef struct { uint32_t magic, version, count, hz, flags, dropped;
+#                  uint64_t start_us, end_us; } ipc_prof_hdr_t;
+# typedef struct { uint64_t ip; uint32_t pid; uint8_t cpu, depth, flags, reserved;
+#                  uint64_t frames[6]; } ipc_prof_rec_t;  (return addresses, innermost first)
+IPC_PROF_MAGIC   = 0x464F5250  # "PROF"
+IPC_PROF_VERSION = 1
+IPC_PROF_DEPTH   = 6
+IPC_PROF_FRAMES  = 0x01  # Header: built with frame pointers (FRAME_POINTERS=1)
+IPC_PROF_USER    = 0x01  # Record: interrupted in ring 3, ip only
+
+PROF_HDR_STRUCT = struct.Struct('<6I2Q')
+PROF_REC_STRUCT = struct.Struct('<QIBBBx6Q')
+
+# Batched inference (CMD_RUN_MODEL_BATCH blob)
+# typedef struct { uint32_t input_blob, tag; } ipc_run_batch_entry_t;
+# typedef struct { uint32_t count, model; ipc_run_batch_entry_t entries[]; } ipc_run_batch_t;
+IPC_RUN_BATCH_MAX = 16
+
+RUN_BATCH_HDR_STRUCT = struct.Struct('<II')
+RUN_BATCH_ENTRY_STRUCT = struct.Struct('<II')
+
+# Stream channel table (front of IPC_REGION_STREAM_CHAN)
+# typedef struct {
+#   uint32_t magic, count, reserved[14];                       /* line 0 */
+#   struct { uint32_t state, id, job_id, cpu,
+#            obs_offset, obs_size, act_offset, act_size, reserved[8]; } chans[];
+# } ipc_stream_chan_table_t;
+# Offsets are absolute; channel 0 points at IPC_REGION_OBS_RING/ACT_RING.
+IPC_CHAN_MAGIC          = 0x4E414843  # "CHAN"
+IPC_STREAM_CHANNELS_MAX = 16
+IPC_CHAN_CLOSED         = 0
+IPC_CHAN_OPEN           = 1
+IPC_CHAN_CPU_ANY        = 0xFFFFFFFF
+
+CHAN_TABLE_HDR_STRUCT = struct.Struct('<II')
+CHAN_TABLE_ENTRIES_OFFSET = IPC_CACHE_LINE
+CHAN_ENTRY_STRUCT = struct.Struct('<IIIIIIII32x')
+
 # Blob types
 BLOB_TYPE_RAW       = 0x00
 BLOB_TYPE_TENSOR    = 0x01
 BLOB_TYPE_MODEL_REF = 0x02
 BLOB_TYPE_RESULT    = 0x03
+BLOB_TYPE_SG        = 0x04  # Scatter-gather chain (HeapSg)
+BLOB_TYPE_ONNX      = 0x05  # Serialized ONNX ModelProto, run in-kernel
+BLOB_TYPE_JOB       = 0x06  # Flat job graph (CMD_JOB_SUBMIT)
 
 # Blob flags
 BLOB_FLAG_PINNED   = 0x01
 BLOB_FLAG_READONLY = 0x02
+BLOB_FLAG_POOLED   = 0x04  # Slab pool blob: freeing recycles it
+BLOB_FLAG_CSUM_CRC32C = 0x08  # checksum is CRC32C of the data
+BLOB_FLAG_CSUM_NONE = 0x10  # No checksum (trusted hot-path blobs)
+BLOB_CSUM_MASK     = BLOB_FLAG_CSUM_CRC32C | BLOB_FLAG_CSUM_NONE
 
 # =============================================================================
 # DATA TYPES (for tensors)
@@ -140,6 +495,7 @@ DTYPE_INT32   = 0x02
 DTYPE_INT16   = 0x03
 DTYPE_INT8    = 0x04
 DTYPE_UINT8   = 0x05
+DTYPE_BFLOAT16 = 0x06  # No numpy type: carried as uint16 bit patterns
 
 # Map to numpy dtype strings
 DTYPE_TO_NUMPY = {
@@ -149,10 +505,36 @@ DTYPE_TO_NUMPY = {
     DTYPE_INT16:   'int16',
     DTYPE_INT8:    'int8',
     DTYPE_UINT8:   'uint8',
+    DTYPE_BFLOAT16: 'uint16',
 }
 
-# Map numpy dtype to protocol dtype
-NUMPY_TO_DTYPE = {v: k for k, v in DTYPE_TO_NUMPY.items()}
+# Map numpy dtype to protocol dtype (bfloat16 is only written on request)
+NUMPY_TO_DTYPE = {v: k for k, v in DTYPE_TO_NUMPY.items() if k != DTYPE_BFLOAT16}
+
+# Tensor quantization (tensor_header_t.quant): real = scale * (q - zero_point)
+TENSOR_QUANT_NONE        = 0
+TENSOR_QUANT_PER_TENSOR  = 1
+TENSOR_QUANT_PER_CHANNEL = 2  # One scale/zero_point per index of dim 0
+
+# Dense MLP descriptor (data of a BLOB_TYPE_MODEL_REF blob), run in-kernel
+# typedef struct { uint16_t weight_blob, bias_blob; uint8_t act, reserved[3]; } ipc_mlp_layer_t;
+# typedef struct {
+#   uint32_t magic, version, num_layers, in_dim;
+#   ipc_mlp_layer_t layer[IPC_MLP_MAX_LAYERS];
+# } ipc_mlp_desc_t;
+IPC_MLP_MAGIC      = 0x504C4D5A  # "ZMLP"
+IPC_MLP_VERSION    = 1
+IPC_MLP_MAX_LAYERS = 8
+IPC_MLP_MAX_WIDTH  = 256
+
+MLP_ACT_NONE    = 0
+MLP_ACT_RELU    = 1
+MLP_ACT_TANH    = 2
+MLP_ACT_SOFTMAX = 3  # Last layer only
+
+MLP_DESC_HDR_STRUCT = struct.Struct('<IIII')
+MLP_LAYER_STRUCT = struct.Struct('<HHB3x')
+MLP_DESC_SIZE = MLP_DESC_HDR_STRUCT.size + IPC_MLP_MAX_LAYERS * MLP_LAYER_STRUCT.size  # 80 bytes
 
 # Dtype sizes in bytes
 DTYPE_SIZES = {
@@ -162,6 +544,7 @@ DTYPE_SIZES = {
     DTYPE_INT16:   2,
     DTYPE_INT8:    1,
     DTYPE_UINT8:   1,
+    DTYPE_BFLOAT16: 2,
 }
 
 # =============================================================================
@@ -170,14 +553,14 @@ DTYPE_SIZES = {
 
 HEAP_BLOCK_SHIFT = 6  # 64 byte minimum block
 HEAP_BLOCK_SIZE  = 1 << HEAP_BLOCK_SHIFT  # 64 bytes
-HEAP_MAX_BLOCKS  = IPC_HEAP_DATA_SIZE // HEAP_BLOCK_SIZE
+HEAP_MAX_BLOCKS  = IPC_HEAP_DATA_SIZE // HEAP_BLOCK_SIZE  # fixed layout only
 HEAP_BITMAP_SIZE = (HEAP_MAX_BLOCKS + 7) // 8
 
 # =============================================================================
 # STRUCT FORMATS (little-endian)
 # =============================================================================
 
-# Ring buffer header: magic, head, tail, size, reserved[4]
+# v1 ring buffer header: magic, head, tail, size, reserved[4]
 # typedef struct {
 #   uint32_t magic;
 #   uint32_t head;
@@ -186,38 +569,78 @@ HEAP_BITMAP_SIZE = (HEAP_MAX_BLOCKS + 7) // 8
 #   uint32_t reserved[4];
 #   ... data[]
 # }
-RING_HEADER_FMT = '<IIII4I'
-RING_HEADER_STRUCT = struct.Struct(RING_HEADER_FMT)
+RING_V1_HEADER_FMT = '<IIII4I'
+RING_V1_HEADER_STRUCT = struct.Struct(RING_V1_HEADER_FMT)
+
+# v2 ring header line 0: magic, version, size, mask, flags, entry_size, obs_dim
+RING_V2_LINE0_FMT = '<IIIIIII'
+RING_V2_LINE0_STRUCT = struct.Struct(RING_V2_LINE0_FMT)
 
-# Command packet: cmd, flags, payload_id, timestamp
+# Whole-header read size (large enough for either layout)
+RING_HEADER_STRUCT = struct.Struct('<%dx' % RING_V2_HEADER_SIZE)
+
+# Command packet: cmd, flags, payload_id, timestamp, tag, reserved
 # typedef struct {
 #   uint16_t cmd;
 #   uint16_t flags;
 #   uint32_t payload_id;
 #   uint64_t timestamp;
+#   uint32_t tag;
+#   uint32_t reserved;
 # }
-PACKET_FMT = '<HHIQ'
+PACKET_FMT = '<HHIQII'
 PACKET_STRUCT = struct.Struct(PACKET_FMT)
-PACKET_SIZE = PACKET_STRUCT.size  # 16 bytes
+PACKET_SIZE = PACKET_STRUCT.size  # 24 bytes
 
-# Response packet: status, orig_cmd, result, timestamp
+# Response packet: status, orig_cmd, result, timestamp, tag, reserved
 # typedef struct {
 #   uint16_t status;
 #   uint16_t orig_cmd;
 #   uint32_t result;
 #   uint64_t timestamp;
+#   uint32_t tag;
+#   uint32_t reserved;
 # }
-RESPONSE_FMT = '<HHIQ'
+RESPONSE_FMT = '<HHIQII'
 RESPONSE_STRUCT = struct.Struct(RESPONSE_FMT)
-RESPONSE_SIZE = RESPONSE_STRUCT.size  # 16 bytes
+RESPONSE_SIZE = RESPONSE_STRUCT.size  # 24 bytes
+
+# v1/v2 untagged packet and response (no tag/reserved)
+PACKET_V1_STRUCT = struct.Struct('<HHIQ')
+RESPONSE_V1_STRUCT = struct.Struct('<HHIQ')
+
+# Message ring record header: kind, len, cmd, status, arg, tag
+# typedef struct {
+#   uint16_t kind;
+#   uint16_t len;
+#   uint16_t cmd;
+#   uint16_t status;
+#   uint32_t arg;
+#   uint32_t tag;
+# }
+MSG_HDR_FMT = '<HHHHII'
+MSG_HDR_STRUCT = struct.Struct(MSG_HDR_FMT)
+MSG_HDR_SIZE = MSG_HDR_STRUCT.size  # 16 bytes
+
+
+def msg_record_size(length: int) -> int:
+    """Bytes a message record with `length` inline bytes occupies."""
+    return (MSG_HDR_SIZE + length + IPC_MSG_ALIGN - 1) & ~(IPC_MSG_ALIGN - 1)
+
 
 # Streaming ring entries
-# obs_entry_t: seq, obs[4], reward, done, model_id
-OBS_ENTRY_FMT = '<I4ffff'
-OBS_ENTRY_STRUCT = struct.Struct(OBS_ENTRY_FMT)
-OBS_ENTRY_SIZE = OBS_ENTRY_STRUCT.size  # 32 bytes
+# obs_entry_t: seq, obs[dim], reward, done, model_id, ts
+# ts is the bridge's publish time, CLOCK_MONOTONIC ns truncated to 32 bits
+def obs_entry_struct(dim: int) -> struct.Struct:
+    """Format of an obs entry `dim` floats wide (the ring header's obs_dim)."""
+    return struct.Struct('<I%dffffI' % dim)
 
-# action_entry_t: seq, action, flags, ack_seq, reserved
+
+OBS_ENTRY_STRUCT = obs_entry_struct(IPC_OBS_DIM_DEFAULT)
+OBS_ENTRY_FMT = OBS_ENTRY_STRUCT.format
+OBS_ENTRY_SIZE = OBS_ENTRY_STRUCT.size  # 36 bytes
+
+# action_entry_t: seq, action, flags, ack_seq, ts (ZENEDGE TSC, low 32 bits)
 ACT_ENTRY_FMT = '<IHHII'
 ACT_ENTRY_STRUCT = struct.Struct(ACT_ENTRY_FMT)
 ACT_ENTRY_SIZE = ACT_ENTRY_STRUCT.size  # 16 bytes
@@ -244,11 +667,77 @@ IFR_V3_STRUCT = struct.Struct(IFR_V3_FMT)
 IFR_V3_SIZE = IFR_V3_STRUCT.size
 IFR_V3_HASH_OFFSET = IFR_V3_SIZE - (32 + 32 + 64)
 
+# v4 batch header, followed by count leaves: magic, version, flags,
+# record_size, job_id, count, model_id, ts_usec, nonce[32], model_digest[32],
+# policy_digest[32], flightrec_seal_hash[32], merkle_root[32],
+# prev_chain_hash[32], ifr_hash[32], chain_hash[32], sig_classical[64]
+IFR_VERSION_V4 = 4
+IFR_BATCH_MAX = 64
+IFR_V4_FMT = '<IHHI III Q 32s32s32s32s32s32s32s32s64s'
+IFR_V4_STRUCT = struct.Struct(IFR_V4_FMT)
+IFR_V4_SIZE = IFR_V4_STRUCT.size  # 352 bytes
+IFR_V4_HASH_OFFSET = IFR_V4_SIZE - (32 + 32 + 64)
+
+# ifr_leaf_t: episode_id, env, model_id, steps, ts_usec, goodput, reserved
+IFR_LEAF_FMT = '<IIII Q f I'
+IFR_LEAF_STRUCT = struct.Struct(IFR_LEAF_FMT)
+IFR_LEAF_SIZE = IFR_LEAF_STRUCT.size  # 32 bytes
+
 # Telemetry snapshot
 TELEMETRY_FMT = '<Qfff'
 TELEMETRY_STRUCT = struct.Struct(TELEMETRY_FMT)
 TELEMETRY_SIZE = TELEMETRY_STRUCT.size
 
+# Telemetry page (seqlock, bridge -> ZENEDGE)
+# typedef struct {
+#   uint32_t magic;
+#   uint32_t seq;            /* odd while an update is in progress */
+#   uint64_t publish_count;
+#   telemetry_snapshot_t snap;
+#   uint8_t  reserved[28];
+# }
+IPC_TELEMETRY_OFFSET = 0x10F00
+IPC_TELEMETRY_MAGIC  = 0x54454C4D  # "TELM"
+TELEMETRY_PAGE_SEQ_OFFSET = 4
+TELEMETRY_PAGE_COUNT_OFFSET = 8
+TELEMETRY_PAGE_SNAP_OFFSET = 16
+TELEMETRY_PAGE_SIZE = 64
+
+# Statistics page (seqlock, ZENEDGE -> bridge, IPC_REGION_STATS): a 64-byte
+# header, then one section per subsystem (ipc_stats_page_t, ipc_proto.h)
+IPC_STATS_MAGIC     = 0x5354534B  # "KSTS"
+IPC_STATS_VERSION   = 1
+IPC_STATS_CPUS      = 8
+IPC_STATS_PRIOS     = 4
+IPC_STATS_CONTRACTS = 16
+IPC_STATS_HAS_IPC      = 0x01
+IPC_STATS_HAS_HEAP     = 0x02
+IPC_STATS_HAS_MEM      = 0x04
+IPC_STATS_HAS_TRACE    = 0x08
+IPC_STATS_HAS_SCHED    = 0x10
+IPC_STATS_HAS_CONTRACT = 0x20
+IPC_STATS_HAS_INFER    = 0x40
+STATS_SEQ_OFFSET = 16
+# magic, version, size, present, seq, period_us, tsc_khz, _, publish_count, usec
+STATS_HDR_STRUCT      = struct.Struct('<8IQQ16x')
+STATS_IPC_STRUCT      = struct.Struct('<14IQQ')
+STATS_HEAP_STRUCT     = struct.Struct('<8I')
+STATS_MEM_STRUCT      = struct.Struct('<11I4x')
+STATS_SCHED_STRUCT    = struct.Struct('<4Q8I')  # ..., rq_len[IPC_STATS_PRIOS]
+STATS_INFER_STRUCT    = struct.Struct('<16I')
+STATS_TRACE_STRUCT    = struct.Struct('<3I4x')
+STATS_CPU_STRUCT      = struct.Struct('<IIQQ')
+STATS_CONTRACT_STRUCT = struct.Struct('<8I')
+STATS_IPC_OFFSET      = 64
+STATS_HEAP_OFFSET     = 136
+STATS_MEM_OFFSET      = 168
+STATS_SCHED_OFFSET    = 216
+STATS_INFER_OFFSET    = 280
+STATS_TRACE_OFFSET    = 344
+STATS_CPU_OFFSET      = 360
+STATS_CONTRACTS_OFFSET = 552  # contracts_registered, contracts_listed, then the entries
+STATS_PAGE_SIZE       = 1072
+
 # Doorbell control block (256 bytes)
 # typedef struct {
 #   uint32_t magic;
@@ -261,10 +750,21 @@ TELEMETRY_SIZE = TELEMETRY_STRUCT.size
 #   volatile uint32_t rsp_irq_count;
 #   volatile uint32_t cmd_writes;
 #   volatile uint32_t rsp_writes;
-#   uint32_t reserved[54];
+#   volatile uint32_t peer_version;
+#   volatile uint32_t zen_peer_id;     /* ivshmem IVPosition + 1, 0 = none */
+#   volatile uint32_t bridge_peer_id;
+#   volatile uint32_t wasm_prof_mode;  /* IPC_WASM_PROF_*, written by Linux */
+#   volatile uint32_t wasm_prof_dump;  /* Bumped by Linux to request a dump */
+#   uint32_t reserved[49];
 # }
-DOORBELL_FMT = '<IIIIIIIIII54I'
+DOORBELL_FMT = '<IIIIIIIIIIIIIII49I'
 DOORBELL_STRUCT = struct.Struct(DOORBELL_FMT)
+DOORBELL_VERSION_OFFSET = 4
+DOORBELL_PEER_VERSION_OFFSET = 40
+DOORBELL_ZEN_PEER_ID_OFFSET = 44
+DOORBELL_BRIDGE_PEER_ID_OFFSET = 48
+DOORBELL_WASM_PROF_MODE_OFFSET = 52
+DOORBELL_WASM_PROF_DUMP_OFFSET = 56
 
 # Blob header (32 bytes)
 # typedef struct {
@@ -275,9 +775,13 @@ DOORBELL_STRUCT = struct.Struct(DOORBELL_FMT)
 #   uint32_t size;
 #   uint32_t offset;
 #   uint32_t checksum;
-#   uint32_t reserved[3];
+#   uint32_t pool;          /* owner arena's pool index (BLOB_FLAG_POOLED) */
+#   uint16_t taken[2];      /* references taken, per HEAP_ARENA_* (version 5) */
+#   uint16_t dropped[2];    /* references released, per HEAP_ARENA_* */
 # }
-BLOB_HEADER_FMT = '<IHBBIII3I'
+BLOB_HEADER_FMT = '<IHBBIIII4H'
+BLOB_TAKEN_OFFSET = 24
+BLOB_DROPPED_OFFSET = 28
 BLOB_HEADER_STRUCT = struct.Struct(BLOB_HEADER_FMT)
 BLOB_HEADER_SIZE = BLOB_HEADER_STRUCT.size  # 32 bytes
 
@@ -285,45 +789,251 @@ BLOB_HEADER_SIZE = BLOB_HEADER_STRUCT.size  # 32 bytes
 # typedef struct {
 #   uint8_t  dtype;
 #   uint8_t  ndim;
-#   uint16_t reserved;
+#   uint16_t quant;           /* TENSOR_QUANT_* */
 #   uint32_t shape[4];
 #   uint32_t strides[4];
 # }
+# A quantized tensor is followed, from the first 4-byte boundary past its
+# elements, by float scale[n] and int32_t zero_point[n] (n = 1, or shape[0]
+# per channel); see tensor_quant_params().
 TENSOR_HEADER_FMT = '<BBH4I4I'
 TENSOR_HEADER_STRUCT = struct.Struct(TENSOR_HEADER_FMT)
 TENSOR_HEADER_SIZE = TENSOR_HEADER_STRUCT.size  # 40 bytes
 
+# Scatter-gather chain (data of a BLOB_TYPE_SG blob): the payload is the
+# extents' data concatenated, laid out as a contiguous inner_type blob
+# typedef struct { uint16_t blob_id, reserved; uint32_t size; } heap_sg_extent_t;
+# typedef struct {
+#   uint32_t total_size;
+#   uint8_t  inner_type, reserved;
+#   uint16_t count;
+#   heap_sg_extent_t extent[HEAP_SG_MAX_EXTENTS];
+# } heap_sg_t;
+HEAP_SG_MAX_EXTENTS = 64
+HEAP_SG_STRUCT = struct.Struct('<IBxH')
+HEAP_SG_EXTENT_STRUCT = struct.Struct('<H2xI')
+HEAP_SG_SIZE = HEAP_SG_STRUCT.size + HEAP_SG_MAX_EXTENTS * HEAP_SG_EXTENT_STRUCT.size  # 520
+
 # Heap control block
+# Version 1:
 # typedef struct {
-#   uint32_t magic;
-#   uint32_t version;
-#   uint32_t total_blocks;
-#   uint32_t free_blocks;
+#   uint32_t magic, version, total_blocks, free_blocks;
 #   uint32_t next_blob_id;
-#   uint32_t reserved[3];
+#   uint32_t blob_slots;     /* 0 = image without a blob table */
+#   uint32_t blob_table;     /* byte offset from the control block */
+#   uint32_t blob_count;
 #   uint8_t  bitmap[];
 # }
-HEAP_CTL_FMT = '<IIIII3I'
+# Version 3 (per-side buddy arenas):
+# typedef struct {
+#   uint32_t magic, version, total_blocks, arena_count;
+#   uint32_t reserved, blob_slots, blob_table, reserved2;
+#   heap_arena_t arena[HEAP_ARENA_COUNT];
+#   uint8_t  bitmap[];
+# }
+# typedef struct {
+#   uint32_t base_block, blocks, free_blocks, buddy_orders;
+#   uint32_t slot_base, slot_count, next_slot, blob_count;
+#   uint32_t free_head[HEAP_BUDDY_ORDERS];  /* arena-relative block or NIL */
+#   struct { uint32_t head, tail; uint16_t ids[HEAP_RETURN_SLOTS]; } ret;
+#   heap_pool_t pool[HEAP_POOLS];          /* version 4 only */
+# } heap_arena_t;
+# typedef struct {
+#   uint32_t blob_size, blocks;
+#   uint16_t count, free_count;
+#   uint8_t  type, reserved[3];
+#   uint16_t free_ids[HEAP_POOL_DEPTH];    /* free stack */
+# } heap_pool_t;
+IPC_HEAP_VERSION_ARENAS = 3
+IPC_HEAP_VERSION_POOLS = 4
+IPC_HEAP_VERSION_REFS = 5
+HEAP_BUDDY_ORDERS = 28
+HEAP_BUDDY_NIL = 0xFFFFFFFF
+HEAP_ARENA_KERNEL = 0
+HEAP_ARENA_BRIDGE = 1
+HEAP_ARENA_COUNT = 2
+HEAP_RETURN_SLOTS = 512
+HEAP_POOLS = 4
+HEAP_POOL_DEPTH = 128
+HEAP_CTL_FMT = '<8I'
 HEAP_CTL_STRUCT = struct.Struct(HEAP_CTL_FMT)
 HEAP_CTL_HEADER_SIZE = HEAP_CTL_STRUCT.size  # 32 bytes
+HEAP_ARENA_STRUCT = struct.Struct(f'<8I{HEAP_BUDDY_ORDERS}III')  # up to ret.ids
+HEAP_ARENA_FREE_HEAD_OFFSET = 32
+HEAP_ARENA_RET_HEAD_OFFSET = HEAP_ARENA_FREE_HEAD_OFFSET + 4 * HEAP_BUDDY_ORDERS
+HEAP_ARENA_RET_IDS_OFFSET = HEAP_ARENA_RET_HEAD_OFFSET + 8
+HEAP_ARENA_V3_SIZE = HEAP_ARENA_RET_IDS_OFFSET + 2 * HEAP_RETURN_SLOTS  # 1176 bytes
+HEAP_POOL_STRUCT = struct.Struct('<IIHHB3x')  # up to free_ids
+HEAP_POOL_FREE_COUNT_OFFSET = 10
+HEAP_POOL_FREE_IDS_OFFSET = HEAP_POOL_STRUCT.size
+HEAP_POOL_SIZE = HEAP_POOL_FREE_IDS_OFFSET + 2 * HEAP_POOL_DEPTH  # 272 bytes
+HEAP_ARENA_POOL_OFFSET = HEAP_ARENA_V3_SIZE
+HEAP_ARENA_SIZE = HEAP_ARENA_POOL_OFFSET + HEAP_POOLS * HEAP_POOL_SIZE  # 2264 bytes
+HEAP_CTL_V3_SIZE = HEAP_CTL_HEADER_SIZE + HEAP_ARENA_COUNT * HEAP_ARENA_V3_SIZE
+HEAP_CTL_V4_SIZE = HEAP_CTL_HEADER_SIZE + HEAP_ARENA_COUNT * HEAP_ARENA_SIZE
+
+# Free chunk header at the start of each free buddy chunk (heap data)
+# typedef struct { uint32_t magic, order, next, prev; } heap_free_chunk_t;
+HEAP_FREE_MAGIC = 0x45455246  # "FREE"
+HEAP_FREE_CHUNK_STRUCT = struct.Struct('<IIII')
+
+# Blob table entry, indexed by blob_id & (blob_slots - 1)
+# typedef struct {
+#   uint32_t offset;      /* blob header offset from heap data */
+#   uint32_t blocks;
+#   uint16_t blob_id;     /* 0 = free; published last, cleared first */
+#   uint16_t generation;
+# } heap_blob_slot_t;
+HEAP_BLOB_SLOT_FMT = '<IIHH'
+HEAP_BLOB_SLOT_STRUCT = struct.Struct(HEAP_BLOB_SLOT_FMT)
+HEAP_BLOB_SLOT_SIZE = HEAP_BLOB_SLOT_STRUCT.size  # 12 bytes
 
 
 # =============================================================================
 # DATA CLASSES
 # =============================================================================
 
+@dataclass(frozen=True)
+class RingLayout:
+    """Where the indices live and how they wrap, per protocol version."""
+    version: int
+    header_size: int
+    head_offset: int
+    tail_offset: int
+    tagged: bool = False
+
+    @property
+    def packet_size(self) -> int:
+        return PACKET_SIZE if self.tagged else PACKET_V1_STRUCT.size
+
+    @property
+    def response_size(self) -> int:
+        return RESPONSE_SIZE if self.tagged else RESPONSE_V1_STRUCT.size
+
+    def slot(self, index: int, size: int) -> int:
+        if self.version >= IPC_PROTO_VERSION_V2:
+            return index & (size - 1)
+        return index % size
+
+    def advance(self, index: int, size: int, count: int = 1) -> int:
+        if self.version >= IPC_PROTO_VERSION_V2:
+            return (index + count) & 0xFFFFFFFF
+        return (index + count) % size
+
+    def used(self, head: int, tail: int, size: int) -> int:
+        if self.version >= IPC_PROTO_VERSION_V2:
+            return (head - tail) & 0xFFFFFFFF
+        return (head - tail) % size
+
+    def full(self, head: int, tail: int, size: int) -> bool:
+        if self.version >= IPC_PROTO_VERSION_V2:
+            return self.used(head, tail, size) >= size
+        return (head + 1) % size == tail
+
+    def space(self, head: int, tail: int, size: int) -> int:
+        """Entries a producer can still publish (v1 keeps one slot empty)."""
+        if self.version >= IPC_PROTO_VERSION_V2:
+            return size - self.used(head, tail, size)
+        return size - 1 - self.used(head, tail, size)
+
+
+RING_LAYOUT_V1 = RingLayout(IPC_PROTO_VERSION_V1, RING_V1_HEADER_STRUCT.size, 4, 8)
+RING_LAYOUT_V2 = RingLayout(IPC_PROTO_VERSION_V2, RING_V2_HEADER_SIZE,
+                            RING_V2_HEAD_OFFSET, RING_V2_TAIL_OFFSET)
+RING_LAYOUT_V3 = RingLayout(IPC_PROTO_VERSION_V3, RING_V2_HEADER_SIZE,
+                            RING_V2_HEAD_OFFSET, RING_V2_TAIL_OFFSET, tagged=True)
+RING_LAYOUTS = {
+    IPC_PROTO_VERSION_V1: RING_LAYOUT_V1,
+    IPC_PROTO_VERSION_V2: RING_LAYOUT_V2,
+    IPC_PROTO_VERSION_V3: RING_LAYOUT_V3,
+}
+
+
+def ring_layout(version: int) -> RingLayout:
+    """Layout for a doorbell version; unknown versions fall back to v1."""
+    return RING_LAYOUTS.get(version, RING_LAYOUT_V1)
+
+
+@dataclass
+class ShmLayout:
+    """Region table: region id -> (offset, size, entries)."""
+    total_size: int
+    regions: Dict[int, Tuple[int, int, int]]
+    negotiated: bool = False
+
+    def has(self, region: int) -> bool:
+        return region in self.regions
+
+    def offset(self, region: int) -> int:
+        return self.regions[region][0]
+
+    def size(self, region: int) -> int:
+        return self.regions[region][1]
+
+    def entries(self, region: int) -> int:
+        return self.regions[region][2]
+
+    @classmethod
+    def legacy(cls) -> 'ShmLayout':
+        """The fixed 1MB layout used by images without a descriptor."""
+        return cls(IPC_SHARED_MEM_SIZE, {
+            IPC_REGION_CMD_RING:  (IPC_CMD_RING_OFFSET, IPC_RSP_RING_OFFSET, IPC_RING_SIZE),
+            IPC_REGION_RSP_RING:  (IPC_RSP_RING_OFFSET, IPC_DOORBELL_OFFSET - IPC_RSP_RING_OFFSET,
+                                   IPC_RING_SIZE),
+            IPC_REGION_DOORBELL:  (IPC_DOORBELL_OFFSET, 0x100, 0),
+            IPC_REGION_HEAP_CTL:  (IPC_HEAP_CTL_OFFSET, IPC_HEAP_DATA_OFFSET - IPC_HEAP_CTL_OFFSET, 0),
+            IPC_REGION_HEAP_DATA: (IPC_HEAP_DATA_OFFSET, IPC_HEAP_DATA_SIZE,
+                                   IPC_HEAP_DATA_SIZE // HEAP_BLOCK_SIZE),
+            IPC_REGION_TELEMETRY: (IPC_TELEMETRY_OFFSET, TELEMETRY_PAGE_SIZE, 0),
+            IPC_REGION_MSG_CMD:   (IPC_MSG_CMD_RING_OFFSET, IPC_MSG_RING_BYTES, IPC_MSG_DATA_BYTES),
+            IPC_REGION_MSG_RSP:   (IPC_MSG_RSP_RING_OFFSET, IPC_MSG_RING_BYTES, IPC_MSG_DATA_BYTES),
+            IPC_REGION_OBS_RING:  (IPC_OBS_RING_OFFSET, IPC_OBS_RING_BYTES, IPC_OBS_RING_SIZE),
+            IPC_REGION_ACT_RING:  (IPC_ACT_RING_OFFSET, IPC_ACT_RING_BYTES, IPC_ACT_RING_SIZE),
+        })
+
+    @classmethod
+    def read(cls, shm, shm_size: int) -> Optional['ShmLayout']:
+        """Parse the descriptor at offset 0; None if absent or inconsistent."""
+        shm.seek(0)
+        magic, version, total, count = LAYOUT_HDR_STRUCT.unpack(
+            shm.read(LAYOUT_HDR_STRUCT.size))
+        if (magic != IPC_LAYOUT_MAGIC or version != IPC_LAYOUT_VERSION or
+                count < IPC_REGION_REQUIRED or count > IPC_REGION_MAX or total > shm_size):
+            return None
+        regions = {}
+        for region in range(min(count, IPC_REGION_COUNT)):
+            offset, size, entries, _ = REGION_STRUCT.unpack(shm.read(REGION_STRUCT.size))
+            if size == 0 or offset + size > total:
+                return None
+            regions[region] = (offset, size, entries)
+        return cls(total, regions, negotiated=True)
+
+
 @dataclass
 class RingHeader:
     magic: int
     head: int
     tail: int
     size: int
+    flags: int = 0
+    entry_size: int = 0     # Stream rings: bytes per entry (0 = implied)
+    obs_dim: int = 0        # Obs stream ring: floats per observation
 
     @classmethod
-    def unpack(cls, data: bytes) -> 'RingHeader':
-        magic, head, tail, size, *_ = RING_HEADER_STRUCT.unpack(data[:RING_HEADER_STRUCT.size])
+    def unpack(cls, data: bytes, layout: RingLayout = RING_LAYOUT_V2) -> 'RingHeader':
+        if layout.version >= IPC_PROTO_VERSION_V2:
+            magic, _version, size, _mask, flags, entry_size, obs_dim = \
+                RING_V2_LINE0_STRUCT.unpack_from(data, 0)
+            head, = struct.unpack_from('<I', data, layout.head_offset)
+            tail, = struct.unpack_from('<I', data, layout.tail_offset)
+            return cls(magic, head, tail, size, flags, entry_size, obs_dim)
+        magic, head, tail, size, *_ = RING_V1_HEADER_STRUCT.unpack_from(data, 0)
         return cls(magic, head, tail, size)
 
+    @property
+    def mpsc(self) -> bool:
+        return bool(self.flags & IPC_RING_FLAG_MPSC)
+
 
 @dataclass
 class Packet:
@@ -331,13 +1041,22 @@ class Packet:
     flags: int
     payload_id: int
     timestamp: int
+    tag: int = IPC_TAG_NONE
+    inline: bytes = b''     # Inline payload (message ring only)
+    via_msg: bool = False   # Arrived on the message ring; answer there too
 
     @classmethod
     def unpack(cls, data: bytes) -> 'Packet':
-        return cls(*PACKET_STRUCT.unpack(data[:PACKET_SIZE]))
+        if len(data) >= PACKET_SIZE:
+            cmd, flags, payload_id, timestamp, tag, _ = PACKET_STRUCT.unpack(data[:PACKET_SIZE])
+            return cls(cmd, flags, payload_id, timestamp, tag)
+        return cls(*PACKET_V1_STRUCT.unpack(data[:PACKET_V1_STRUCT.size]))
 
-    def pack(self) -> bytes:
-        return PACKET_STRUCT.pack(self.cmd, self.flags, self.payload_id, self.timestamp)
+    def pack(self, tagged: bool = True) -> bytes:
+        if not tagged:
+            return PACKET_V1_STRUCT.pack(self.cmd, self.flags, self.payload_id, self.timestamp)
+        return PACKET_STRUCT.pack(self.cmd, self.flags, self.payload_id, self.timestamp,
+                                  self.tag, 0)
 
 
 @dataclass
@@ -346,13 +1065,21 @@ class Response:
     orig_cmd: int
     result: int
     timestamp: int
+    tag: int = IPC_TAG_NONE
 
     @classmethod
     def unpack(cls, data: bytes) -> 'Response':
-        return cls(*RESPONSE_STRUCT.unpack(data[:RESPONSE_SIZE]))
+        if len(data) >= RESPONSE_SIZE:
+            status, orig_cmd, result, timestamp, tag, _ = RESPONSE_STRUCT.unpack(data[:RESPONSE_SIZE])
+            return cls(status, orig_cmd, result, timestamp, tag)
+        return cls(*RESPONSE_V1_STRUCT.unpack(data[:RESPONSE_V1_STRUCT.size]))
 
-    def pack(self) -> bytes:
-        return RESPONSE_STRUCT.pack(self.status, self.orig_cmd, self.result, self.timestamp)
+    def pack(self, tagged: bool = True) -> bytes:
+        if not tagged:
+            return RESPONSE_V1_STRUCT.pack(self.status, self.orig_cmd, self.result,
+                                           self.timestamp)
+        return RESPONSE_STRUCT.pack(self.status, self.orig_cmd, self.result, self.timestamp,
+                                    self.tag, 0)
 
 
 @dataclass
@@ -364,19 +1091,29 @@ class BlobHeader:
     size: int
     offset: int
     checksum: int
+    pool: int = 0
+    taken: List[int] = field(default_factory=lambda: [0, 0])
+    dropped: List[int] = field(default_factory=lambda: [0, 0])
 
     @classmethod
     def unpack(cls, data: bytes) -> 'BlobHeader':
-        magic, blob_id, type_, flags, size, offset, checksum, *_ = \
+        magic, blob_id, type_, flags, size, offset, checksum, pool, t0, t1, d0, d1 = \
             BLOB_HEADER_STRUCT.unpack(data[:BLOB_HEADER_SIZE])
-        return cls(magic, blob_id, type_, flags, size, offset, checksum)
+        return cls(magic, blob_id, type_, flags, size, offset, checksum, pool,
+                   [t0, t1], [d0, d1])
 
     def pack(self) -> bytes:
         return BLOB_HEADER_STRUCT.pack(
             self.magic, self.blob_id, self.type, self.flags,
-            self.size, self.offset, self.checksum, 0, 0, 0
+            self.size, self.offset, self.checksum, self.pool,
+            *self.taken, *self.dropped
         )
 
+    @property
+    def refs(self) -> int:
+        """References still held by either side (version 5 heaps)."""
+        return (sum(self.taken) - sum(self.dropped)) & 0xFFFF
+
 
 @dataclass
 class TensorHeader:
@@ -384,27 +1121,109 @@ class TensorHeader:
     ndim: int
     shape: Tuple[int, ...]
     strides: Tuple[int, ...]
+    quant: int = TENSOR_QUANT_NONE
 
     @classmethod
     def unpack(cls, data: bytes) -> 'TensorHeader':
         values = TENSOR_HEADER_STRUCT.unpack(data[:TENSOR_HEADER_SIZE])
         dtype = values[0]
         ndim = values[1]
-        # reserved = values[2]
+        quant = values[2]
         shape = values[3:7]
         strides = values[7:11]
-        return cls(dtype, ndim, shape[:ndim], strides[:ndim])
+        return cls(dtype, ndim, shape[:ndim], strides[:ndim], quant)
 
     def pack(self) -> bytes:
         # Pad shape and strides to 4 elements
         shape_padded = tuple(self.shape) + (0,) * (4 - len(self.shape))
         strides_padded = tuple(self.strides) + (0,) * (4 - len(self.strides))
         return TENSOR_HEADER_STRUCT.pack(
-            self.dtype, self.ndim, 0,  # reserved
+            self.dtype, self.ndim, self.quant,
             *shape_padded, *strides_padded
         )
 
 
+def tensor_quant_params(data_len: int, scale: List[float],
+                        zero_point: List[int]) -> bytes:
+    """Bytes to append to data_len bytes of quantized elements: padding to
+    4 bytes, then the scales and zero points."""
+    n = len(scale)
+    if n == 0 or len(zero_point) != n:
+        raise ValueError("need one zero point per scale")
+    return bytes(-data_len % 4) + struct.pack(f'<{n}f{n}i', *scale, *zero_point)
+
+
+@dataclass
+class HeapSg:
+    """A scatter-gather chain descriptor (see heap_sg_t)."""
+    total_size: int
+    inner_type: int
+    extents: List[Tuple[int, int]]  # (blob_id, payload bytes), in order
+
+    @classmethod
+    def unpack(cls, data: bytes) -> 'HeapSg':
+        total_size, inner_type, count = HEAP_SG_STRUCT.unpack(data[:HEAP_SG_STRUCT.size])
+        count = min(count, HEAP_SG_MAX_EXTENTS)
+        extents = [HEAP_SG_EXTENT_STRUCT.unpack_from(
+                       data, HEAP_SG_STRUCT.size + i * HEAP_SG_EXTENT_STRUCT.size)
+                   for i in range(count)]
+        return cls(total_size, inner_type, extents)
+
+    def pack(self) -> bytes:
+        return HEAP_SG_STRUCT.pack(self.total_size, self.inner_type, len(self.extents)) + \
+            b''.join(HEAP_SG_EXTENT_STRUCT.pack(*e) for e in self.extents)
+
+
+@dataclass
+class HeapPool:
+    """A slab pool in an arena (see heap_pool_t); free_ids are read on demand."""
+    index: int
+    blob_size: int
+    blocks: int
+    count: int
+    free_count: int
+    type: int
+
+    @classmethod
+    def unpack(cls, index: int, data: bytes) -> 'HeapPool':
+        return cls(index, *HEAP_POOL_STRUCT.unpack(data[:HEAP_POOL_STRUCT.size]))
+
+
+@dataclass
+class HeapArena:
+    """One side's share of a version 3+ heap (see heap_arena_t)."""
+    index: int
+    offset: int         # From the control block
+    base_block: int
+    blocks: int
+    free_blocks: int
+    buddy_orders: int
+    slot_base: int
+    slot_count: int
+    next_slot: int
+    blob_count: int
+    free_head: List[int]
+    ret_head: int
+    ret_tail: int
+    pools: List[HeapPool] = field(default_factory=list)  # Version 4
+
+    @classmethod
+    def unpack(cls, index: int, offset: int, data: bytes, pools: bool) -> 'HeapArena':
+        fields = HEAP_ARENA_STRUCT.unpack(data[:HEAP_ARENA_STRUCT.size])
+        arena = cls(index, offset, *fields[:8], list(fields[8:8 + HEAP_BUDDY_ORDERS]),
+                    *fields[8 + HEAP_BUDDY_ORDERS:])
+        if pools:
+            arena.pools = [HeapPool.unpack(p, data[HEAP_ARENA_POOL_OFFSET + p * HEAP_POOL_SIZE:])
+                           for p in range(HEAP_POOLS)]
+        return arena
+
+    def pool_offset(self, pool: int) -> int:
+        return self.offset + HEAP_ARENA_POOL_OFFSET + pool * HEAP_POOL_SIZE
+
+    def owns_slot(self, slot: int) -> bool:
+        return self.slot_base <= slot < self.slot_base + self.slot_count
+
+
 @dataclass
 class HeapControl:
     magic: int
@@ -412,12 +1231,45 @@ class HeapControl:
     total_blocks: int
     free_blocks: int
     next_blob_id: int
+    blob_slots: int = 0
+    blob_table: int = 0
+    blob_count: int = 0
+    arenas: List[HeapArena] = field(default_factory=list)
+
+    @property
+    def arena_size(self) -> int:
+        return HEAP_ARENA_SIZE if self.version >= IPC_HEAP_VERSION_POOLS else HEAP_ARENA_V3_SIZE
+
+    @property
+    def header_size(self) -> int:
+        """Bytes before the bitmap."""
+        if not self.arenas:
+            return HEAP_CTL_HEADER_SIZE
+        return HEAP_CTL_HEADER_SIZE + HEAP_ARENA_COUNT * self.arena_size
 
     @classmethod
     def unpack(cls, data: bytes) -> 'HeapControl':
-        magic, version, total_blocks, free_blocks, next_blob_id, *_ = \
-            HEAP_CTL_STRUCT.unpack(data[:HEAP_CTL_HEADER_SIZE])
-        return cls(magic, version, total_blocks, free_blocks, next_blob_id)
+        words = HEAP_CTL_STRUCT.unpack(data[:HEAP_CTL_HEADER_SIZE])
+        if words[1] < IPC_HEAP_VERSION_ARENAS or len(data) < HEAP_CTL_V3_SIZE:
+            return cls(*words)
+
+        magic, version, total_blocks, arena_count, _r, blob_slots, blob_table, _r2 = words
+        pools = version >= IPC_HEAP_VERSION_POOLS and len(data) >= HEAP_CTL_V4_SIZE
+        stride = HEAP_ARENA_SIZE if pools else HEAP_ARENA_V3_SIZE
+        arenas = []
+        for i in range(min(arena_count, HEAP_ARENA_COUNT)):
+            offset = HEAP_CTL_HEADER_SIZE + i * stride
+            arenas.append(HeapArena.unpack(i, offset, data[offset:], pools))
+        # Each side writes only its own counters: the totals are a snapshot
+        return cls(magic, version, total_blocks,
+                   sum(a.free_blocks for a in arenas), 0, blob_slots, blob_table,
+                   sum(a.blob_count for a in arenas), arenas)
+
+    def pack(self) -> bytes:
+        """Version 1 header (version 3 fields are written per arena)."""
+        return HEAP_CTL_STRUCT.pack(
+            self.magic, self.version, self.total_blocks, self.free_blocks,
+            self.next_blob_id, self.blob_slots, self.blob_table, self.blob_count)
 
 
 # =============================================================================
@@ -431,8 +1283,42 @@ def get_timestamp() -> int:
 
 
 def compute_checksum(data: bytes) -> int:
-    """Simple checksum matching ZENEDGE heap implementation."""
+    """Legacy rotate/xor checksum matching ZENEDGE heap implementation."""
     checksum = 0
     for b in data:
-        checksum = (checksum + b) & 0xFFFFFFFF
+        checksum = ((checksum << 1) | (checksum >> 31)) & 0xFFFFFFFF
+        checksum ^= b
     return checksum
+
+
+def _crc32c_table() -> List[int]:
+    table = []
+    for i in range(256):
+        c = i
+        for _ in range(8):
+            c = (c >> 1) ^ (0x82F63B78 if c & 1 else 0)
+        table.append(c)
+    return table
+
+
+_CRC32C_TABLE = _crc32c_table()
+
+
+def crc32c(data: bytes, crc: int = 0) -> int:
+    """CRC32C (Castagnoli), zlib-style like kernel/lib/crc32c.c."""
+    if _crc32c_native is not None:
+        return _crc32c_native(data, crc)
+    crc ^= 0xFFFFFFFF
+    table = _CRC32C_TABLE
+    for b in data:
+        crc = table[(crc ^ b) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+def blob_checksum(data: bytes, flags: int) -> int:
+    """Checksum of blob data in the mode its BLOB_CSUM_MASK flags select."""
+    if flags & BLOB_FLAG_CSUM_NONE:
+        return 0
+    if flags & BLOB_FLAG_CSUM_CRC32C:
+        return crc32c(data)
+    return compute_checksum(data)
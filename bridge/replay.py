@@ -0,0 +1,123 @@
+"""
+Recorded environment streams (tools/bridge/replay_log.h).
+
+`zenedge_gym_agent.py --record LOG` (or the C bridge's `--record`) saves
+every reset and step its environments make for the kernel; the C bridge
+plays the log back as a native environment, the same observations every
+run, without gym in the loop:
+
+    python3 bridge/zenedge_gym_agent.py --shm /dev/shm/zenedge.shm --record cartpole.zrpl
+    tools/bridge/bridge --file /dev/shm/zenedge.shm --env tools/bridge/envs/replay.so \\
+        --env-args cartpole.zrpl[,paced]
+    python3 -m bridge.replay cartpole.zrpl
+"""
+
+import argparse
+import struct
+import sys
+import time
+from typing import Any, Dict, List, Optional, Sequence
+
+REPLAY_MAGIC = 0x4C50525A  # "ZRPL"
+REPLAY_VERSION = 1
+REPLAY_NAME_LEN = 32
+
+REPLAY_REC_RESET = 1
+REPLAY_REC_STEP = 2
+
+# replay_hdr_t: magic, version, obs_dim, start_ns, name[32]
+REPLAY_HDR_STRUCT = struct.Struct("<IHHQ32s")
+# replay_rec_t: t_ns, env_ns, env, kind, done, action, reward (obs[] follows)
+REPLAY_REC_STRUCT = struct.Struct("<QIHBBIf")
+
+
+class ReplayRecorder:
+    """Writes a log as an environment is driven: reset() and step() take
+    the time the call started (time.monotonic_ns()) and what it returned."""
+
+    def __init__(self, path: str, obs_dim: int, name: str = ""):
+        self.path = path
+        self.obs_dim = obs_dim
+        self.records = 0
+        self._obs = struct.Struct(f"<{obs_dim}f")
+        self._t0 = time.monotonic_ns()
+        self._f = open(path, "wb")
+        self._f.write(REPLAY_HDR_STRUCT.pack(REPLAY_MAGIC, REPLAY_VERSION, obs_dim, self._t0,
+                                             name.encode()[:REPLAY_NAME_LEN - 1]))
+
+    def _write(self, kind: int, env: int, t0_ns: int, action: int, reward: float,
+               done: bool, obs: Sequence[float]):
+        now = time.monotonic_ns()
+        self._f.write(REPLAY_REC_STRUCT.pack(now - self._t0, min(now - t0_ns, 0xFFFFFFFF),
+                                             env, kind, 1 if done else 0, action & 0xFFFFFFFF,
+                                             float(reward)))
+        self._f.write(self._obs.pack(*(float(x) for x in obs)))
+        self.records += 1
+
+    def reset(self, env: int, t0_ns: int, obs: Sequence[float]):
+        self._write(REPLAY_REC_RESET, env, t0_ns, 0, 0.0, False, obs)
+
+    def step(self, env: int, t0_ns: int, action: int, obs: Sequence[float], reward: float,
+             done: bool):
+        self._write(REPLAY_REC_STEP, env, t0_ns, action, reward, done, obs)
+
+    def close(self):
+        if not self._f.closed:
+            self._f.close()
+
+
+def read_log(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode a log, or None if it is not one. A torn last record is dropped."""
+    if len(data) < REPLAY_HDR_STRUCT.size:
+        return None
+    magic, version, obs_dim, start_ns, name = REPLAY_HDR_STRUCT.unpack_from(data, 0)
+    if magic != REPLAY_MAGIC or version != REPLAY_VERSION:
+        return None
+
+    size = REPLAY_REC_STRUCT.size + 4 * obs_dim
+    obs = struct.Struct(f"<{obs_dim}f")
+    records = []
+    for off in range(REPLAY_HDR_STRUCT.size, len(data) - size + 1, size):
+        t_ns, env_ns, env, kind, done, action, reward = REPLAY_REC_STRUCT.unpack_from(data, off)
+        records.append({"t_ns": t_ns, "env_ns": env_ns, "env": env, "kind": kind,
+                        "done": bool(done), "action": action, "reward": reward,
+                        "obs": list(obs.unpack_from(data, off + REPLAY_REC_STRUCT.size))})
+    return {"obs_dim": obs_dim, "start_ns": start_ns,
+            "name": name.split(b"\0", 1)[0].decode(errors="replace"), "records": records}
+
+
+def summarize(log: Dict[str, Any]) -> str:
+    recs: List[Dict[str, Any]] = log["records"]
+    steps = [r for r in recs if r["kind"] == REPLAY_REC_STEP]
+    envs = len({r["env"] for r in recs})
+    secs = recs[-1]["t_ns"] / 1e9 if recs else 0.0
+    lines = [f"replay: {log['name'] or '?'}, obs_dim {log['obs_dim']}, {envs} env(s), "
+             f"{len(recs)} records over {secs:.2f} s"]
+    if steps:
+        env_ns = sorted(r["env_ns"] for r in steps)
+        mean = sum(env_ns) / len(env_ns)
+        lines.append(f"  steps {len(steps)}, episodes ended {sum(r['done'] for r in steps)}, "
+                     f"reward {sum(r['reward'] for r in steps):.1f}")
+        lines.append(f"  env time per step: mean {mean / 1000:.1f} us, "
+                     f"p50 {env_ns[len(env_ns) // 2] / 1000:.1f} us, "
+                     f"p99 {env_ns[min(len(env_ns) - 1, len(env_ns) * 99 // 100)] / 1000:.1f} us")
+        if secs > 0:
+            lines.append(f"  recorded rate: {len(steps) / secs:.0f} steps/s")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Summarize a recorded environment stream")
+    parser.add_argument("path", help="log from --record")
+    args = parser.parse_args()
+
+    with open(args.path, "rb") as f:
+        log = read_log(f.read())
+    if log is None:
+        print(f"{args.path}: not a recording")
+        sys.exit(1)
+    print(summarize(log))
+
+
+if __name__ == "__main__":
+    main()
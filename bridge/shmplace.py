@@ -0,0 +1,172 @@
+"""
+Shared memory placement: huge pages, prefaulting and NUMA binding.
+
+Every ring access goes through the shared region, so a host page fault or
+a remote-socket miss there lands on the control loop. A file on hugetlbfs
+maps with huge pages by itself; on tmpfs (/dev/shm) the bridge asks for
+transparent huge pages instead. A NUMA policy is set before anything is
+touched, so prefaulting allocates on the node of the QEMU vCPUs, and
+mlock() then faults in and pins the whole region. Same options as
+tools/bridge (--hugepages, --prefault, --numa-cpu, --numa-thread).
+"""
+
+import ctypes
+import mmap
+import os
+from pathlib import Path
+from typing import Optional, Set
+
+MPOL_BIND = 2
+MPOL_MF_MOVE = 1 << 1
+MAX_NODES = 1024
+
+# No mbind() in libc (it is libnuma's), so through syscall()
+SYS_MBIND = {"x86_64": 237, "aarch64": 235, "i686": 274, "i386": 274}
+
+_libc = None
+
+
+def _c():
+    global _libc
+    if _libc is None:
+        _libc = ctypes.CDLL(None, use_errno=True)
+    return _libc
+
+
+def hugetlbfs_page_size(path: Path) -> int:
+    """Huge page size if path (or its directory, if new) is on hugetlbfs, else 0."""
+    path = Path(os.path.abspath(path))
+    probe = path if path.exists() else path.parent
+    best, fstype = "", None
+    try:
+        with open("/proc/mounts") as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) < 3:
+                    continue
+                mnt = parts[1]
+                inside = str(probe) == mnt or str(probe).startswith(mnt.rstrip("/") + "/")
+                if inside and len(mnt) > len(best):
+                    best, fstype = mnt, parts[2]
+    except OSError:
+        return 0
+    if fstype != "hugetlbfs":
+        return 0
+    return os.statvfs(probe).f_bsize
+
+
+def cpu_node(cpu: int) -> Optional[int]:
+    """NUMA node of a host CPU."""
+    try:
+        for name in os.listdir(f"/sys/devices/system/cpu/cpu{cpu}"):
+            if name.startswith("node") and name[4:].isdigit():
+                return int(name[4:])
+    except OSError:
+        pass
+    return None
+
+
+def thread_cpu(tid: int) -> Optional[int]:
+    """CPU a thread (e.g. a QEMU vCPU thread) last ran on."""
+    try:
+        with open(f"/proc/{tid}/stat") as f:
+            stat = f.read()
+    except OSError:
+        return None
+    # Field 39; the command name before the fields may hold spaces
+    fields = stat[stat.rfind(")") + 2:].split()
+    return int(fields[36]) if len(fields) > 36 else None
+
+
+def node_cpus(node: int) -> Set[int]:
+    """The CPUs of a NUMA node."""
+    cpus: Set[int] = set()
+    try:
+        with open(f"/sys/devices/system/node/node{node}/cpulist") as f:
+            spec = f.read().strip()
+    except OSError:
+        return cpus
+    for part in filter(None, spec.split(",")):
+        lo, _, hi = part.partition("-")
+        cpus.update(range(int(lo), int(hi or lo) + 1))
+    return cpus
+
+
+def _mbind(addr: int, size: int, node: int) -> None:
+    nr = SYS_MBIND.get(os.uname().machine)
+    if nr is None:
+        raise OSError("mbind: unknown syscall number on this machine")
+    bits = 8 * ctypes.sizeof(ctypes.c_ulong)
+    mask = (ctypes.c_ulong * (MAX_NODES // bits))()
+    mask[node // bits] = 1 << (node % bits)
+    # Pages already there move when only this process maps them
+    rc = _c().syscall(ctypes.c_long(nr), ctypes.c_void_p(addr), ctypes.c_ulong(size),
+                      ctypes.c_int(MPOL_BIND), mask, ctypes.c_ulong(MAX_NODES),
+                      ctypes.c_uint(MPOL_MF_MOVE))
+    if rc != 0:
+        err = ctypes.get_errno()
+        raise OSError(err, f"mbind: {os.strerror(err)}")
+
+
+def map_shared(fd: int, size: int, hugepages: bool = False, prefault: bool = False,
+               node: Optional[int] = None, huge_page: int = 0) -> mmap.mmap:
+    """
+    Map size bytes of fd shared, placed as asked.
+
+    Args:
+        hugepages: On tmpfs, ask for transparent huge pages
+        prefault: Fault in and mlock the region now
+        node: NUMA node to bind the region to
+        huge_page: Huge page size if fd is on hugetlbfs (hugetlbfs_page_size)
+    """
+    flags = mmap.MAP_SHARED
+    if prefault and node is None:
+        flags |= getattr(mmap, "MAP_POPULATE", 0)
+    shm = mmap.mmap(fd, size, flags=flags)
+
+    if huge_page:
+        print(f"[BRIDGE] Shared memory on hugetlbfs ({huge_page // 1024} KB pages)")
+    elif hugepages:
+        try:
+            shm.madvise(mmap.MADV_HUGEPAGE)
+            print("[BRIDGE] Shared memory: transparent huge pages requested")
+        except (AttributeError, OSError) as e:
+            print(f"[BRIDGE] madvise(MADV_HUGEPAGE): {e}")
+
+    if node is None and not prefault:
+        return shm
+
+    # The buffer export has to go before shm can be closed
+    view = ctypes.c_char.from_buffer(shm)
+    addr = ctypes.addressof(view)
+    del view
+
+    if node is not None:
+        try:
+            _mbind(addr, size, node)
+            print(f"[BRIDGE] Shared memory bound to NUMA node {node}")
+        except OSError as e:
+            print(f"[BRIDGE] {e}")
+
+    if prefault:
+        if _c().mlock(ctypes.c_void_p(addr), ctypes.c_size_t(size)) == 0:
+            print("[BRIDGE] Shared memory prefaulted and locked")
+        else:
+            err = ctypes.get_errno()
+            print(f"[BRIDGE] mlock: {os.strerror(err)} (raise RLIMIT_MEMLOCK)")
+            # Still fault the page tables in, a read per page
+            for off in range(0, size, mmap.PAGESIZE):
+                shm[off]
+    return shm
+
+
+def pin_to_node(node: int) -> None:
+    """Run the calling thread (the poll loop) on the CPUs of a node."""
+    cpus = node_cpus(node)
+    try:
+        if not cpus:
+            raise OSError(f"no CPUs listed for node {node}")
+        os.sched_setaffinity(0, cpus)
+        print(f"[BRIDGE] Polling on node {node} ({len(cpus)} CPUs)")
+    except OSError as e:
+        print(f"[BRIDGE] Pinning to node {node}: {e}")
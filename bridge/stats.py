@@ -0,0 +1,287 @@
+"""
+Kernel statistics page (ZENEDGE -> bridge, IPC_REGION_STATS).
+
+ZENEDGE copies its subsystems' counters into a seqlock page in shared
+memory every period_us (10 ms by default): ring depths and doorbells, heap
+and memory, scheduler, contracts, inference and caches. Reading it needs
+no command and costs the kernel nothing, so it can be scraped as often as
+anyone likes, by this module or by anything else that maps the file:
+
+    python3 -m bridge.stats --shm /dev/shm/zenedge.shm --once   # print once
+    python3 -m bridge.stats --listen 0.0.0.0:9464               # Prometheus /metrics
+
+Reader protocol: retry while seq is odd or changed across the copy.
+"""
+
+import argparse
+import mmap
+import os
+import struct
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from typing import Optional, Dict, Any, List, Tuple
+
+from .protocol import (
+    IPC_REGION_STATS,
+    IPC_STATS_MAGIC,
+    IPC_STATS_VERSION,
+    IPC_STATS_CPUS,
+    IPC_STATS_PRIOS,
+    IPC_STATS_CONTRACTS,
+    IPC_STATS_HAS_IPC,
+    IPC_STATS_HAS_HEAP,
+    IPC_STATS_HAS_MEM,
+    IPC_STATS_HAS_TRACE,
+    IPC_STATS_HAS_SCHED,
+    IPC_STATS_HAS_CONTRACT,
+    IPC_STATS_HAS_INFER,
+    STATS_SEQ_OFFSET,
+    STATS_HDR_STRUCT,
+    STATS_IPC_STRUCT,
+    STATS_HEAP_STRUCT,
+    STATS_MEM_STRUCT,
+    STATS_SCHED_STRUCT,
+    STATS_INFER_STRUCT,
+    STATS_TRACE_STRUCT,
+    STATS_CPU_STRUCT,
+    STATS_CONTRACT_STRUCT,
+    STATS_IPC_OFFSET,
+    STATS_HEAP_OFFSET,
+    STATS_MEM_OFFSET,
+    STATS_SCHED_OFFSET,
+    STATS_INFER_OFFSET,
+    STATS_TRACE_OFFSET,
+    STATS_CPU_OFFSET,
+    STATS_CONTRACTS_OFFSET,
+    STATS_PAGE_SIZE,
+    ShmLayout,
+)
+
+# Section fields in struct order; names ending in _total are counters
+IPC_FIELDS = ("cmd_pending", "cmd_depth", "rsp_pending", "rsp_depth",
+              "cmd_doorbells_total", "rsp_doorbells_total", "irqs_total",
+              "kicks_sent_total", "kicks_coalesced_total", "spin_hits_total",
+              "spin_misses_total", "mode_switches_total", "stream_timeouts_total",
+              "stream_wait_max_us", "spin_us_total", "sleep_us_total")
+HEAP_FIELDS = ("total_bytes", "free_bytes", "largest_free_bytes", "peer_largest_free_bytes",
+               "blobs", "alloc_failures_total", "compact_moves_total", "frag_permille")
+MEM_FIELDS = ("pmm_total_kb", "pmm_free_kb", "pmm_reserved_kb", "pmm_cached_pages",
+              "kheap_total_bytes", "kheap_free_bytes", "kheap_largest_free_bytes",
+              "kheap_frag_permille", "kheap_allocs_total", "kheap_frees_total",
+              "kheap_failures_total")
+SCHED_FIELDS = ("switches_total", "preemptions_total", "starved_total", "timer_irqs_total",
+                "switches_per_sec", "rq_latency_avg_us", "rq_latency_max_us", "blocked")
+INFER_FIELDS = ("requests_total", "direct_total", "batches_total", "failed_total", "max_batch",
+                "model_hits_total", "model_misses_total", "model_evictions_total",
+                "model_entries", "model_copy_bytes", "memo_lookups_total", "memo_hits_total",
+                "memo_inserts_total", "memo_evictions_total", "policy_lookups_total",
+                "policy_hits_total")
+TRACE_FIELDS = ("flightrec_cats", "klog_dropped_total", "cpus")
+CPU_FIELDS = ("online", "trace_dropped_total", "idle_wakeups_total", "trace_events_total")
+CONTRACT_FIELDS = ("job_id", "state", "prio", "cpu_used_us", "cpu_budget_us",
+                   "mem_used_kb", "mem_budget_kb", "violations_total")
+
+SECTIONS = (
+    ("ipc", IPC_STATS_HAS_IPC, STATS_IPC_OFFSET, STATS_IPC_STRUCT, IPC_FIELDS),
+    ("heap", IPC_STATS_HAS_HEAP, STATS_HEAP_OFFSET, STATS_HEAP_STRUCT, HEAP_FIELDS),
+    ("mem", IPC_STATS_HAS_MEM, STATS_MEM_OFFSET, STATS_MEM_STRUCT, MEM_FIELDS),
+    ("sched", IPC_STATS_HAS_SCHED, STATS_SCHED_OFFSET, STATS_SCHED_STRUCT, SCHED_FIELDS),
+    ("infer", IPC_STATS_HAS_INFER, STATS_INFER_OFFSET, STATS_INFER_STRUCT, INFER_FIELDS),
+    ("trace", IPC_STATS_HAS_TRACE, STATS_TRACE_OFFSET, STATS_TRACE_STRUCT, TRACE_FIELDS),
+)
+
+CONTRACT_STATES = ("ok", "warned", "safe_mode")
+CONTRACT_PRIOS = ("low", "normal", "high", "realtime")
+
+SEQ_RETRIES = 100
+
+
+def parse_stats(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode a consistent copy of the page, or None if it is not one."""
+    if not data or len(data) < STATS_PAGE_SIZE:
+        return None
+    magic, version, size, present, seq, period_us, tsc_khz, _, count, usec = \
+        STATS_HDR_STRUCT.unpack_from(data, 0)
+    if magic != IPC_STATS_MAGIC or version != IPC_STATS_VERSION or size < STATS_PAGE_SIZE:
+        return None
+
+    stats: Dict[str, Any] = {"seq": seq, "period_us": period_us, "tsc_khz": tsc_khz,
+                             "publish_count": count, "usec": usec, "present": present}
+    for name, bit, off, st, fields in SECTIONS:
+        if not present & bit:
+            continue
+        values = st.unpack_from(data, off)
+        stats[name] = dict(zip(fields, values))
+        if name == "sched":
+            stats[name]["rq_len"] = list(values[len(fields):len(fields) + IPC_STATS_PRIOS])
+
+    if present & IPC_STATS_HAS_TRACE:
+        cpus = min(stats["trace"]["cpus"], IPC_STATS_CPUS)
+        stats["cpu"] = [dict(zip(CPU_FIELDS, STATS_CPU_STRUCT.unpack_from(
+            data, STATS_CPU_OFFSET + i * STATS_CPU_STRUCT.size))) for i in range(cpus)]
+
+    if present & IPC_STATS_HAS_CONTRACT:
+        registered, listed = struct.unpack_from('<II', data, STATS_CONTRACTS_OFFSET)
+        listed = min(listed, IPC_STATS_CONTRACTS)
+        base = STATS_CONTRACTS_OFFSET + 8
+        stats["contracts_registered"] = registered
+        stats["contract"] = [dict(zip(CONTRACT_FIELDS, STATS_CONTRACT_STRUCT.unpack_from(
+            data, base + i * STATS_CONTRACT_STRUCT.size))) for i in range(listed)]
+    return stats
+
+
+def read_page(buf, offset: int) -> Optional[bytes]:
+    """A copy of the page at offset taken between two equal, even seqs."""
+    for _ in range(SEQ_RETRIES):
+        seq, = struct.unpack_from('<I', buf, offset + STATS_SEQ_OFFSET)
+        if seq & 1:
+            continue
+        data = bytes(buf[offset:offset + STATS_PAGE_SIZE])
+        again, = struct.unpack_from('<I', buf, offset + STATS_SEQ_OFFSET)
+        if again == seq:
+            return data
+    return None
+
+
+class StatsPage:
+    """The statistics page of a shared memory file, mapped read-only."""
+
+    def __init__(self, shm_path: str):
+        self.fd = os.open(shm_path, os.O_RDONLY)
+        size = os.fstat(self.fd).st_size
+        self.shm = mmap.mmap(self.fd, size, prot=mmap.PROT_READ)
+        layout = ShmLayout.read(self.shm, size)
+        if layout is None or not layout.has(IPC_REGION_STATS):
+            self.close()
+            raise ValueError(f"{shm_path}: no statistics page (kernel without one, or not booted)")
+        if layout.size(IPC_REGION_STATS) < STATS_PAGE_SIZE:
+            self.close()
+            raise ValueError(f"{shm_path}: statistics page too small")
+        self.offset = layout.offset(IPC_REGION_STATS)
+
+    def read(self) -> Optional[Dict[str, Any]]:
+        data = read_page(self.shm, self.offset)
+        return parse_stats(data) if data else None
+
+    def close(self):
+        if getattr(self, "shm", None):
+            self.shm.close()
+            self.shm = None
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+
+
+def _metric(lines: List[str], seen: set, name: str, value, labels: str = ""):
+    kind = "counter" if name.endswith("_total") else "gauge"
+    if name not in seen:
+        lines.append(f"# TYPE {name} {kind}")
+        seen.add(name)
+    lines.append(f"{name}{{{labels}}} {value}" if labels else f"{name} {value}")
+
+
+def render_prometheus(stats: Dict[str, Any]) -> str:
+    """Prometheus text exposition: zenedge_<section>_<field>, with cpu,
+    prio and job labels where a section has several rows."""
+    lines: List[str] = []
+    seen: set = set()
+    _metric(lines, seen, "zenedge_stats_publish_total", stats["publish_count"])
+    _metric(lines, seen, "zenedge_stats_kernel_usec", stats["usec"])
+    _metric(lines, seen, "zenedge_stats_period_us", stats["period_us"])
+
+    for name, _, _, _, fields in SECTIONS:
+        section = stats.get(name)
+        if section is None:
+            continue
+        for field in fields:
+            _metric(lines, seen, f"zenedge_{name}_{field}", section[field])
+        if name == "sched":
+            for prio, n in enumerate(section["rq_len"]):
+                label = CONTRACT_PRIOS[prio] if prio < len(CONTRACT_PRIOS) else str(prio)
+                _metric(lines, seen, "zenedge_sched_rq_len", n, f'prio="{label}"')
+
+    # A family's samples have to stay together: field by field, then row by row
+    for field in CPU_FIELDS:
+        for i, cpu in enumerate(stats.get("cpu", [])):
+            _metric(lines, seen, f"zenedge_cpu_{field}", cpu[field], f'cpu="{i}"')
+
+    if "contract" in stats:
+        _metric(lines, seen, "zenedge_contracts_registered", stats["contracts_registered"])
+        for field in CONTRACT_FIELDS[3:]:
+            for c in stats["contract"]:
+                _metric(lines, seen, f"zenedge_contract_{field}", c[field], f'job="{c["job_id"]}"')
+        for c in stats["contract"]:
+            job = f'job="{c["job_id"]}"'
+            state = CONTRACT_STATES[c["state"]] if c["state"] < len(CONTRACT_STATES) else str(c["state"])
+            prio = CONTRACT_PRIOS[c["prio"]] if c["prio"] < len(CONTRACT_PRIOS) else str(c["prio"])
+            _metric(lines, seen, "zenedge_contract_info", 1, f'{job},state="{state}",prio="{prio}"')
+    return "\n".join(lines) + "\n"
+
+
+def serve(page: StatsPage, host: str, port: int):
+    """Serve /metrics, reading the page afresh on every scrape."""
+    class Handler(BaseHTTPRequestHandler):
+        def do_GET(self):
+            if self.path.split("?")[0] != "/metrics":
+                self.send_error(404)
+                return
+            stats = page.read()
+            if stats is None:
+                self.send_error(503, "statistics page not published")
+                return
+            body = render_prometheus(stats).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "text/plain; version=0.0.4")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, fmt, *args):
+            pass
+
+    server = HTTPServer((host, port), Handler)
+    print(f"[STATS] Serving http://{host}:{port}/metrics")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+
+
+def _host_port(text: str) -> Tuple[str, int]:
+    host, _, port = text.rpartition(":")
+    return host or "127.0.0.1", int(port)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read the ZENEDGE statistics page")
+    parser.add_argument("--shm", default="/dev/shm/zenedge.shm", help="shared memory file")
+    parser.add_argument("--once", action="store_true", help="print the metrics once and exit")
+    parser.add_argument("--listen", default="127.0.0.1:9464", type=_host_port,
+                        help="host:port to serve Prometheus /metrics on")
+    args = parser.parse_args()
+
+    try:
+        page = StatsPage(args.shm)
+    except (OSError, ValueError) as e:
+        print(e)
+        sys.exit(1)
+
+    if args.once:
+        for _ in range(50):  # The first snapshot lands right after ipc_init
+            stats = page.read()
+            if stats is not None:
+                break
+            time.sleep(0.01)
+        else:
+            print(f"{args.shm}: statistics page not published")
+            sys.exit(1)
+        sys.stdout.write(render_prometheus(stats))
+        return
+    serve(page, *args.listen)
+
+
+if __name__ == "__main__":
+    main()
@@ -8,84 +8,315 @@ Kernel:
 Host:
 - Consumes actions
 - Produces observations
+
+ZENEDGE fixes each ring's depth and entry layout at build time and
+publishes them in the ring header (size, entry_size, obs_dim); the rings
+here adopt that geometry instead of assuming CartPole's 4-wide obs.
 """
 
-from typing import Optional, Tuple
+import time
+from typing import List, Optional, Sequence, Tuple
 
 from .protocol import (
     IPC_STREAM_MAGIC,
-    IPC_OBS_RING_OFFSET,
-    IPC_ACT_RING_OFFSET,
-    IPC_OBS_RING_SIZE,
-    IPC_ACT_RING_SIZE,
+    IPC_REGION_OBS_RING,
+    IPC_REGION_ACT_RING,
+    IPC_REGION_STREAM_CHAN,
+    IPC_CHAN_MAGIC,
+    IPC_CHAN_OPEN,
+    IPC_STREAM_CHANNELS_MAX,
+    CHAN_TABLE_HDR_STRUCT,
+    CHAN_TABLE_ENTRIES_OFFSET,
+    CHAN_ENTRY_STRUCT,
+    IPC_OBS_DIM_DEFAULT,
+    IPC_OBS_DIM_MAX,
+    IPC_PROTO_VERSION_V2,
+    IPC_RING_POLICY_MASK,
+    IPC_RING_POLICY_FIFO,
+    IPC_RING_POLICY_LATEST,
+    IPC_RING_POLICY_NAMES,
     RING_HEADER_STRUCT,
-    RING_HEADER_SIZE,
+    RING_LAYOUT_V2,
+    RING_V2_CLOCK_SEQ_OFFSET,
+    RING_V2_CLOCK_NS_OFFSET,
     RingHeader,
+    RingLayout,
+    ShmLayout,
     OBS_ENTRY_STRUCT,
     ACT_ENTRY_STRUCT,
+    obs_entry_struct,
 )
 
 
 class StreamRing:
-    def __init__(self, shm, offset: int, entry_struct, size: int):
+    def __init__(self, shm, offset: int, entry_struct, size: int,
+                 layout: RingLayout = RING_LAYOUT_V2, region_bytes: int = 0,
+                 obs: bool = False):
         self.shm = shm
         self.offset = offset
         self.entry_struct = entry_struct
         self.entry_size = entry_struct.size
         self.size = size
+        self.layout = layout
+        self.region_bytes = region_bytes  # 0 = unchecked
+        self.obs = obs                    # Entry width follows the header's obs_dim
+        self.obs_dim = IPC_OBS_DIM_DEFAULT if obs else 0
+        self._stalled = False             # FIFO producer refused; one overrun per stall
 
     def _read_header(self) -> RingHeader:
         self.shm.seek(self.offset)
         data = self.shm.read(RING_HEADER_STRUCT.size)
-        return RingHeader.unpack(data)
+        return RingHeader.unpack(data, self.layout)
 
     def _write_head(self, head: int) -> None:
-        self.shm.seek(self.offset + 4)
+        self.shm.seek(self.offset + self.layout.head_offset)
         self.shm.write(head.to_bytes(4, 'little'))
 
     def _write_tail(self, tail: int) -> None:
-        self.shm.seek(self.offset + 8)
+        self.shm.seek(self.offset + self.layout.tail_offset)
         self.shm.write(tail.to_bytes(4, 'little'))
 
+    def _adopt(self, hdr: RingHeader) -> bool:
+        """Take on the depth and entry layout ZENEDGE published; False if unusable."""
+        if hdr.magic != IPC_STREAM_MAGIC or hdr.size == 0 or hdr.size & (hdr.size - 1):
+            return False
+        if self.obs:
+            dim = hdr.obs_dim or IPC_OBS_DIM_DEFAULT
+            if dim > IPC_OBS_DIM_MAX:
+                return False
+            if dim != self.obs_dim:
+                self.entry_struct = obs_entry_struct(dim)
+                self.entry_size = self.entry_struct.size
+                self.obs_dim = dim
+        if hdr.entry_size and hdr.entry_size != self.entry_size:
+            return False
+        if self.region_bytes and \
+                self.layout.header_size + hdr.size * self.entry_size > self.region_bytes:
+            return False
+        self.size = hdr.size
+        return True
+
     def ready(self) -> bool:
-        hdr = self._read_header()
-        return hdr.magic == IPC_STREAM_MAGIC and hdr.size == self.size
+        return self._adopt(self._read_header())
+
+    def _read_span(self, index: int, size: int, count: int) -> bytes:
+        """count entries from index on, in at most two contiguous reads."""
+        first = min(count, size - self.layout.slot(index, size))
+        self.shm.seek(self._slot_offset(index, size))
+        data = self.shm.read(first * self.entry_size)
+        if count > first:
+            self.shm.seek(self.offset + self.layout.header_size)
+            data += self.shm.read((count - first) * self.entry_size)
+        return data
+
+    def _slot_offset(self, index: int, size: int) -> int:
+        return self.offset + self.layout.header_size + \
+            self.layout.slot(index, size) * self.entry_size
+
+    def _counters(self) -> bool:
+        return self.layout.version >= IPC_PROTO_VERSION_V2
+
+    def _bump(self, offset: int, delta: int) -> None:
+        self._write_u32(offset, self._read_u32(offset) + delta)
+
+    def _read_u32(self, offset: int) -> int:
+        self.shm.seek(self.offset + offset)
+        return int.from_bytes(self.shm.read(4), 'little')
+
+    def _write_u32(self, offset: int, value: int) -> None:
+        self.shm.seek(self.offset + offset)
+        self.shm.write((value & 0xFFFFFFFF).to_bytes(4, 'little'))
 
     def pop(self) -> Optional[Tuple]:
+        entries = self.pop_many(1)
+        return entries[0] if entries else None
+
+    def push(self, entry: Tuple) -> bool:
+        return self.push_many([entry]) == 1
+
+    def pop_many(self, max_entries: int) -> List[Tuple]:
+        """
+        Pop up to max_entries with one tail update; [] if empty. Under the
+        overwrite policies skipped entries count as drops, and LATEST
+        returns only the newest entry.
+        """
         hdr = self._read_header()
-        if hdr.magic != IPC_STREAM_MAGIC or hdr.head == hdr.tail:
-            return None
+        if not self._adopt(hdr) or max_entries <= 0:
+            return []
+        policy = hdr.flags & IPC_RING_POLICY_MASK
+        size, tail, head = hdr.size, hdr.tail, hdr.head
+        if head == tail:
+            return []
 
-        entry_offset = self.offset + RING_HEADER_SIZE + (hdr.tail * self.entry_size)
-        self.shm.seek(entry_offset)
-        data = self.shm.read(self.entry_size)
-        entry = self.entry_struct.unpack(data)
+        if policy == IPC_RING_POLICY_FIFO:
+            count = min(self.layout.used(head, tail, size), max_entries)
+            entries = list(self.entry_struct.iter_unpack(self._read_span(tail, size, count)))
+            self._write_tail(self.layout.advance(tail, size, count))
+            return entries
 
-        new_tail = (hdr.tail + 1) % hdr.size
-        self._write_tail(new_tail)
-        return entry
+        # The producer may be rewriting any slot at or below head - size:
+        # copy, then re-check head and retry if we were lapped meanwhile
+        if policy == IPC_RING_POLICY_LATEST:
+            max_entries = 1
+        while True:
+            pos = tail
+            if policy == IPC_RING_POLICY_LATEST:
+                pos = (head - 1) & 0xFFFFFFFF
+            elif self.layout.used(head, tail, size) >= size:
+                pos = (head - max(size // 2, 1)) & 0xFFFFFFFF  # Keep the newer half
+            count = min((head - pos) & 0xFFFFFFFF, max_entries)
+            data = self._read_span(pos, size, count)
+            now = self._read_u32(self.layout.head_offset)
+            if (now - pos) & 0xFFFFFFFF < size:
+                break
+            head = now
+        dropped = (pos - tail) & 0xFFFFFFFF
+        if dropped:
+            self._bump(self.layout.tail_offset + 4, dropped)
+        self._write_tail((pos + count) & 0xFFFFFFFF)
+        return list(self.entry_struct.iter_unpack(data))
 
-    def push(self, entry: Tuple) -> bool:
+    def push_many(self, entries: Sequence[Tuple]) -> int:
+        """
+        Push as many entries as the ring's policy allows with one head
+        update; returns the count. FIFO stops at full, the overwrite
+        policies take up to a ring's worth and lap the consumer.
+        """
         hdr = self._read_header()
-        if hdr.magic != IPC_STREAM_MAGIC:
-            return False
+        if not self._adopt(hdr) or not entries:
+            return 0
+        policy = hdr.flags & IPC_RING_POLICY_MASK
+        size = hdr.size
+        used = min(self.layout.used(hdr.head, hdr.tail, size), size)
+        space = self.layout.space(hdr.head, hdr.tail, size) if used < size else 0
 
-        next_head = (hdr.head + 1) % hdr.size
-        if next_head == hdr.tail:
-            return False
+        count = len(entries)
+        if count > space:
+            if policy == IPC_RING_POLICY_FIFO:
+                if self._counters() and not self._stalled:
+                    self._bump(self.layout.head_offset + 4, 1)  # overruns
+                count = space
+                self._stalled = count == 0
+            else:
+                count = min(count, size)
+                if self._counters():
+                    self._bump(self.layout.head_offset + 4, used + count - size)
+        else:
+            self._stalled = False
+        if count <= 0:
+            return 0
+
+        pack = self.entry_struct.pack
+        first = min(count, size - self.layout.slot(hdr.head, size))
+        self.shm.seek(self._slot_offset(hdr.head, size))
+        self.shm.write(b''.join(pack(*e) for e in entries[:first]))
+        if count > first:
+            self.shm.seek(self.offset + self.layout.header_size)
+            self.shm.write(b''.join(pack(*e) for e in entries[first:count]))
+
+        self._write_head(self.layout.advance(hdr.head, size, count))
 
-        entry_offset = self.offset + RING_HEADER_SIZE + (hdr.head * self.entry_size)
-        self.shm.seek(entry_offset)
-        self.shm.write(self.entry_struct.pack(*entry))
+        if self._counters():
+            occupancy = min(used + count, size)
+            max_occupancy = self._read_u32(self.layout.head_offset + 8)
+            if occupancy > max_occupancy:
+                self._write_u32(self.layout.head_offset + 8, occupancy)
+        return count
 
-        self._write_head(next_head)
+    def publish_clock(self, ns: Optional[int] = None) -> bool:
+        """
+        Publish our CLOCK_MONOTONIC (obs ring producer, while answering
+        CMD_ENV_RESET) so ZENEDGE can place entry timestamps on its TSC.
+        """
+        if not self._counters() or not self.ready():
+            return False
+        if ns is None:
+            ns = time.monotonic_ns()
+        self.shm.seek(self.offset + RING_V2_CLOCK_NS_OFFSET)
+        self.shm.write((ns & 0xFFFFFFFFFFFFFFFF).to_bytes(8, 'little'))
+        seq = self._read_u32(RING_V2_CLOCK_SEQ_OFFSET) + 1
+        self._write_u32(RING_V2_CLOCK_SEQ_OFFSET, seq or 1)  # clock_seq last
         return True
 
+    def stats(self) -> dict:
+        """Policy and backpressure counters from the ring header."""
+        hdr = self._read_header()
+        policy = hdr.flags & IPC_RING_POLICY_MASK
+        stats = {
+            'policy': IPC_RING_POLICY_NAMES.get(policy, policy),
+            'size': hdr.size,
+            'occupancy': min(self.layout.used(hdr.head, hdr.tail, hdr.size), hdr.size)
+                         if hdr.size else 0,
+        }
+        if self._counters():
+            stats['overruns'] = self._read_u32(self.layout.head_offset + 4)
+            stats['max_occupancy'] = self._read_u32(self.layout.head_offset + 8)
+            stats['drops'] = self._read_u32(self.layout.tail_offset + 4)
+        return stats
+
+
+def read_channel(shm, shm_layout: ShmLayout, channel: int) -> Optional[Tuple[int, int, int, int]]:
+    """
+    (obs_offset, obs_size, act_offset, act_size) of an open stream channel,
+    or None if the image has no channel table or the channel is closed.
+    """
+    if not shm_layout.has(IPC_REGION_STREAM_CHAN) or not 0 <= channel < IPC_STREAM_CHANNELS_MAX:
+        return None
+    base = shm_layout.offset(IPC_REGION_STREAM_CHAN)
+    shm.seek(base)
+    magic, count = CHAN_TABLE_HDR_STRUCT.unpack(shm.read(CHAN_TABLE_HDR_STRUCT.size))
+    if magic != IPC_CHAN_MAGIC or channel >= count:
+        return None
+    shm.seek(base + CHAN_TABLE_ENTRIES_OFFSET + channel * CHAN_ENTRY_STRUCT.size)
+    state, _id, _job, _cpu, obs_off, obs_size, act_off, act_size = \
+        CHAN_ENTRY_STRUCT.unpack(shm.read(CHAN_ENTRY_STRUCT.size))
+    if state != IPC_CHAN_OPEN:
+        return None
+    return obs_off, obs_size, act_off, act_size
+
 
 class StreamRings:
-    def __init__(self, shm):
-        self.obs_ring = StreamRing(shm, IPC_OBS_RING_OFFSET, OBS_ENTRY_STRUCT, IPC_OBS_RING_SIZE)
-        self.act_ring = StreamRing(shm, IPC_ACT_RING_OFFSET, ACT_ENTRY_STRUCT, IPC_ACT_RING_SIZE)
+    """
+    One stream channel's obs/action ring pair. Channel 0 is the legacy
+    IPC_REGION_OBS_RING/ACT_RING pair; other channels are looked up in the
+    channel table each ready(), since ZENEDGE opens them at run time.
+    """
+
+    def __init__(self, shm, layout: RingLayout = RING_LAYOUT_V2,
+                 shm_layout: Optional[ShmLayout] = None, channel: int = 0):
+        if shm_layout is None:
+            shm_layout = ShmLayout.legacy()
+        self.shm = shm
+        self.shm_layout = shm_layout
+        self.channel = channel
+        self.obs_ring = StreamRing(shm, shm_layout.offset(IPC_REGION_OBS_RING),
+                                   OBS_ENTRY_STRUCT,
+                                   shm_layout.entries(IPC_REGION_OBS_RING), layout,
+                                   shm_layout.size(IPC_REGION_OBS_RING), obs=True)
+        self.act_ring = StreamRing(shm, shm_layout.offset(IPC_REGION_ACT_RING),
+                                   ACT_ENTRY_STRUCT,
+                                   shm_layout.entries(IPC_REGION_ACT_RING), layout,
+                                   shm_layout.size(IPC_REGION_ACT_RING))
+
+    def _locate(self) -> bool:
+        """Point the rings at this channel's slice; False if it is not open."""
+        if self.channel == 0:
+            return True
+        placement = read_channel(self.shm, self.shm_layout, self.channel)
+        if placement is None:
+            return False
+        obs_off, obs_size, act_off, act_size = placement
+        self.obs_ring.offset, self.obs_ring.region_bytes = obs_off, obs_size
+        self.act_ring.offset, self.act_ring.region_bytes = act_off, act_size
+        return True
 
     def ready(self) -> bool:
-        return self.obs_ring.ready() and self.act_ring.ready()
+        return self._locate() and self.obs_ring.ready() and self.act_ring.ready()
+
+    def stats(self) -> dict:
+        return {'obs': self.obs_ring.stats(), 'act': self.act_ring.stats()}
+
+    @property
+    def obs_dim(self) -> int:
+        """Floats per observation the obs ring carries (valid once ready())."""
+        return self.obs_ring.obs_dim
@@ -0,0 +1,74 @@
+"""
+Telemetry page publisher (seqlock).
+
+The bridge rewrites the snapshot in the telemetry region continuously so
+ZENEDGE can read fresh telemetry without a CMD_TELEMETRY_POLL round trip.
+
+Writer protocol: seq -> odd, write snapshot, seq -> even. The kernel retries
+its copy while seq is odd or changes underneath it.
+"""
+
+import os
+import struct
+import time
+
+from .protocol import (
+    IPC_TELEMETRY_OFFSET,
+    IPC_TELEMETRY_MAGIC,
+    TELEMETRY_PAGE_SEQ_OFFSET,
+    TELEMETRY_PAGE_COUNT_OFFSET,
+    TELEMETRY_PAGE_SNAP_OFFSET,
+    TELEMETRY_STRUCT,
+)
+
+
+def sample_telemetry() -> bytes:
+    """Current host telemetry as a packed telemetry_snapshot_t."""
+    ts_usec = int(time.time() * 1_000_000)
+    gpu_temp = float(os.getenv("ZENEDGE_GPU_TEMP_C", "70.0"))
+    rdma_qp_depth = float(os.getenv("ZENEDGE_RDMA_QP_DEPTH", "128.0"))
+    numa_locality = float(os.getenv("ZENEDGE_NUMA_LOCALITY", "1.0"))
+    return TELEMETRY_STRUCT.pack(ts_usec, gpu_temp, rdma_qp_depth, numa_locality)
+
+
+class TelemetryPage:
+    def __init__(self, shm, interval: float = 0.1,
+                 offset: int = IPC_TELEMETRY_OFFSET):
+        self.shm = shm
+        self.offset = offset
+        self.interval = interval
+        self.last_publish = 0.0
+        self.count = 0
+
+    def _read_u32(self, offset: int) -> int:
+        self.shm.seek(self.offset + offset)
+        return int.from_bytes(self.shm.read(4), 'little')
+
+    def _write_u32(self, offset: int, value: int) -> None:
+        self.shm.seek(self.offset + offset)
+        self.shm.write((value & 0xFFFFFFFF).to_bytes(4, 'little'))
+
+    def publish(self, snapshot: bytes = None) -> None:
+        if snapshot is None:
+            snapshot = sample_telemetry()
+
+        seq = self._read_u32(TELEMETRY_PAGE_SEQ_OFFSET)
+        seq |= 1  # Recover if a previous writer died mid-update
+        self._write_u32(TELEMETRY_PAGE_SEQ_OFFSET, seq)
+
+        self.count += 1
+        self.shm.seek(self.offset + TELEMETRY_PAGE_COUNT_OFFSET)
+        self.shm.write(struct.pack('<Q', self.count))
+        self.shm.seek(self.offset + TELEMETRY_PAGE_SNAP_OFFSET)
+        self.shm.write(snapshot)
+
+        self._write_u32(TELEMETRY_PAGE_SEQ_OFFSET, seq + 1)
+        self._write_u32(0, IPC_TELEMETRY_MAGIC)
+        self.last_publish = time.time()
+
+    def maybe_publish(self) -> bool:
+        """Publish if the interval has elapsed. Cheap enough for every poll."""
+        if time.time() - self.last_publish < self.interval:
+            return False
+        self.publish()
+        return True
@@ -0,0 +1,276 @@
+"""
+Kernel and bridge on one timeline (Chrome trace JSON; Perfetto and
+chrome://tracing both load it).
+
+The bridge writes its own spans - command handlers, the ONNX runs inside
+them - as JSON lines beside the flight recorder trace (trace.zet.host),
+timed with CLOCK_MONOTONIC. The kernel logs TRACE_EVT_CLOCK_SYNC when it
+syncs to the bridge's clock at CMD_ENV_RESET, with the bridge's clock at
+that event's time, so host times map onto the kernel's ts_usec to within
+the sync error (half the reset's round trip). Without a sync the bridge
+is drawn on its own clock and the export says so.
+
+Kernel events become:
+  - steps: slices on their CPU's track (STEP_END carries the duration),
+    with the PMU deltas that follow them as arguments
+  - jobs: async slices from submit to completion
+  - IPC sends and responses: zero-length slices joined by flow arrows to
+    the bridge handler that served them
+  - everything else: instant events
+
+    python3 -m bridge.timeline /tmp/zenedge.zet -o /tmp/zenedge.json
+"""
+
+import argparse
+import collections
+import contextlib
+import json
+import os
+import time
+from typing import Dict, Iterable, List, Optional, Tuple
+
+from .protocol import (
+    CMD_NAMES,
+    TRACE_EVT_CLOCK_SYNC,
+    TRACE_EVT_IPC_DOORBELL,
+    TRACE_EVT_IPC_RESPONSE,
+    TRACE_EVT_IPC_SEND,
+    TRACE_EVT_JOB_COMPLETE,
+    TRACE_EVT_JOB_SUBMIT,
+    TRACE_EVT_PMU_INSTR,
+    TRACE_EVT_STEP_END,
+    TRACE_EVT_STEP_START,
+    TRACE_PMU_EVENTS,
+)
+from .trace import TraceRecord, read_records
+
+HOST_SPAN_SUFFIX = '.host'
+
+KERNEL_PID = 1
+BRIDGE_PID = 2
+BRIDGE_TID = 1
+
+# Names for the instants, as the kernel's flightrec dump has them
+EVENT_NAMES = {
+    0x00: "SCHED_TICK", 0x05: "STEP_PREEMPT", 0x06: "JOB_ADMIT", 0x07: "JOB_REJECT",
+    0x08: "SCHED_STATS", 0x09: "MEMO_HIT", 0x0A: "MEMO_MISS", 0x0B: "GANG_RELEASE",
+    0x0C: "GANG_TIMEOUT", 0x0D: "COLL_DONE", 0x0E: "MESH_PLACE", 0x0F: "MESH_REGRET",
+    0x10: "CONTRACT_APPLY", 0x11: "BUDGET_WARN", 0x12: "BUDGET_EXCEED", 0x13: "VIOLATION",
+    0x14: "STATE_CHANGE", 0x15: "SAFE_MODE", 0x20: "MEM_ALLOC", 0x21: "MEM_FREE",
+    0x22: "MEM_ALLOC_FAIL", 0x23: "LOCALITY_MISS", 0x24: "MEM_EXCEED", 0x25: "NODE_UNSUP",
+    0x72: "IPC_DOORBELL", 0xF0: "BOOT", 0xF1: "HALT", 0xF2: "TRACE_LOST", 0xF3: "SEAL",
+    0xF4: "CLOCK_SYNC", 0xF5: "BENCH", 0xFF: "PANIC",
+}
+
+CATEGORIES = {0x0: "sched", 0x1: "contract", 0x2: "mem", 0x3: "io", 0x4: "accel",
+              0x5: "thermal", 0x6: "pmu", 0x7: "ipc", 0xF: "system"}
+
+
+class HostSpans:
+    """Bridge-side spans, one JSON object per line, rotated once at max_bytes."""
+
+    def __init__(self, path: str, max_bytes: int = 16 << 20):
+        self.path = path
+        self.max_bytes = max_bytes
+        self._f = None
+
+    def record(self, name: str, cat: str, start_ns: int, dur_ns: int, **args) -> None:
+        if self._f is None:
+            self._f = open(self.path, 'a')
+        if self._f.tell() > self.max_bytes:
+            self._f.close()
+            os.replace(self.path, self.path + '.1')
+            self._f = open(self.path, 'a')
+        self._f.write(json.dumps({'name': name, 'cat': cat, 'ns': start_ns,
+                                  'dur': dur_ns, 'args': args}) + '\n')
+        self._f.flush()
+
+    @contextlib.contextmanager
+    def span(self, name: str, cat: str, **args):
+        start = time.monotonic_ns()
+        try:
+            yield
+        finally:
+            self.record(name, cat, start, time.monotonic_ns() - start, **args)
+
+    def close(self) -> None:
+        if self._f is not None:
+            self._f.close()
+            self._f = None
+
+
+def read_host_spans(path: str) -> List[dict]:
+    """Spans of a HostSpans file (and its rotated predecessor), oldest first."""
+    spans = []
+    for p in (path + '.1', path):
+        try:
+            with open(p) as f:
+                for line in f:
+                    try:
+                        spans.append(json.loads(line))
+                    except ValueError:
+                        pass  # Torn last line of a live file
+        except FileNotFoundError:
+            pass
+    spans.sort(key=lambda s: s['ns'])
+    return spans
+
+
+def clock_syncs(records: Iterable[TraceRecord]) -> List[Tuple[int, int, int]]:
+    """(bridge ns, offset ns, error ns) of each TRACE_EVT_CLOCK_SYNC, where
+    offset = bridge clock - kernel ts_usec * 1000."""
+    syncs = []
+    for ts_usec, _cycles, evt, _sig, _cpu, job, step, extra in records:
+        if evt == TRACE_EVT_CLOCK_SYNC:
+            ns = step << 32 | job
+            syncs.append((ns, ns - ts_usec * 1000, extra))
+    return syncs
+
+
+def _host_to_kernel_us(ns: int, syncs: List[Tuple[int, int, int]], base_ns: int) -> float:
+    """Kernel ts_usec for a bridge time: the latest sync before it (or the first)."""
+    if not syncs:
+        return (ns - base_ns) / 1000.0
+    offset = syncs[0][1]
+    for sync_ns, off, _err in syncs:
+        if sync_ns > ns:
+            break
+        offset = off
+    return (ns - offset) / 1000.0
+
+
+def _cmd_name(cmd: int) -> str:
+    return CMD_NAMES.get(cmd, f"{cmd:#06x}")
+
+
+def to_chrome(records: List[TraceRecord], host_spans: List[dict]) -> dict:
+    """Chrome trace event format (JSON object form) for a trace and its host spans."""
+    events = []
+    cpus = set()
+    syncs = clock_syncs(records)
+
+    def meta(pid: int, tid: Optional[int], what: str, name: str) -> None:
+        ev = {'ph': 'M', 'pid': pid, 'name': what, 'args': {'name': name}}
+        if tid is not None:
+            ev['tid'] = tid
+        events.append(ev)
+
+    # Flows: kernel send -> bridge handler -> kernel response, matched by
+    # (cmd, tag) in order
+    flow_ids = iter(range(1, 1 << 62))
+    to_bridge: Dict[Tuple[int, int], collections.deque] = collections.defaultdict(collections.deque)
+    to_kernel: Dict[Tuple[int, int], collections.deque] = collections.defaultdict(collections.deque)
+
+    last_slice: Dict[int, dict] = {}          # cpu -> its newest step slice
+    for rec in records:
+        ts_usec, _cycles, evt, _sig, cpu, job, step, extra = rec
+        cpus.add(cpu)
+        cat = CATEGORIES.get(evt >> 4, "other")
+        base = {'pid': KERNEL_PID, 'tid': cpu, 'cat': cat}
+
+        if evt == TRACE_EVT_STEP_END:
+            ev = dict(base, ph='X', name=f"step {step}", ts=ts_usec - extra, dur=extra,
+                      args={'job': job, 'step': step})
+            events.append(ev)
+            last_slice[cpu] = ev
+        elif TRACE_EVT_PMU_INSTR <= evt < TRACE_EVT_PMU_INSTR + len(TRACE_PMU_EVENTS):
+            ev = last_slice.get(cpu)
+            if ev is not None and ev['args'].get('job') == job and ev['args'].get('step') == step:
+                ev['args'][TRACE_PMU_EVENTS[evt - TRACE_EVT_PMU_INSTR]] = extra
+        elif evt == TRACE_EVT_JOB_COMPLETE and extra:
+            job_base = dict(base, cat='job', id=job, name=f"job {job}")
+            events.append(dict(job_base, ph='b', ts=ts_usec - extra))
+            events.append(dict(job_base, ph='e', ts=ts_usec))
+        elif evt in (TRACE_EVT_STEP_START, TRACE_EVT_JOB_SUBMIT):
+            continue   # Drawn by the slice their end event makes
+        elif evt in (TRACE_EVT_IPC_SEND, TRACE_EVT_IPC_RESPONSE):
+            cmd = extra & 0xFFFF
+            sending = evt == TRACE_EVT_IPC_SEND
+            name = ("send " if sending else "response ") + _cmd_name(cmd)
+            args = {'tag': step} if sending else {'tag': step, 'status': extra >> 16}
+            events.append(dict(base, ph='X', name=name, ts=ts_usec, dur=0, args=args))
+            if sending:
+                fid = next(flow_ids)
+                to_bridge[(cmd, step)].append(fid)
+                events.append(dict(base, ph='s', id=fid, name='ipc', ts=ts_usec))
+        else:
+            name = EVENT_NAMES.get(evt, f"type {evt:#04x}")
+            if evt == TRACE_EVT_IPC_DOORBELL:
+                args = {'packets': extra}
+            elif evt == TRACE_EVT_CLOCK_SYNC:
+                args = {'bridge_ns': step << 32 | job, 'error_ns': extra}
+            else:
+                args = {'job': job, 'step': step, 'extra': extra}
+            events.append(dict(base, ph='i', s='t', name=name, ts=ts_usec, args=args))
+
+    # Bridge spans; a handler's flows attach at its two ends
+    base_ns = host_spans[0]['ns'] if host_spans else 0
+    for span in host_spans:
+        ts = _host_to_kernel_us(span['ns'], syncs, base_ns)
+        dur = span['dur'] / 1000.0
+        args = span.get('args', {})
+        events.append({'ph': 'X', 'pid': BRIDGE_PID, 'tid': BRIDGE_TID, 'cat': span['cat'],
+                       'name': span['name'], 'ts': ts, 'dur': dur, 'args': args})
+        if span['cat'] == 'handler' and 'cmd' in args:
+            key = (args['cmd'], args.get('tag', 0))
+            flow = {'pid': BRIDGE_PID, 'tid': BRIDGE_TID, 'cat': 'ipc', 'name': 'ipc'}
+            if to_bridge[key]:
+                events.append(dict(flow, ph='f', bp='e', id=to_bridge[key].popleft(), ts=ts))
+            fid = next(flow_ids)
+            to_kernel[key].append(fid)
+            events.append(dict(flow, ph='s', id=fid, ts=ts + dur))
+
+    # Responses close the flows their handlers opened, so they go last
+    for rec in records:
+        ts_usec, _cycles, evt, _sig, cpu, job, step, extra = rec
+        if evt == TRACE_EVT_IPC_RESPONSE and to_kernel[(extra & 0xFFFF, step)]:
+            fid = to_kernel[(extra & 0xFFFF, step)].popleft()
+            events.append({'ph': 'f', 'bp': 'e', 'pid': KERNEL_PID, 'tid': cpu, 'cat': 'ipc',
+                           'id': fid, 'name': 'ipc', 'ts': ts_usec})
+
+    meta(KERNEL_PID, None, 'process_name', 'ZENEDGE kernel')
+    for cpu in sorted(cpus):
+        meta(KERNEL_PID, cpu, 'thread_name', f"cpu {cpu}")
+    if host_spans:
+        meta(BRIDGE_PID, None, 'process_name', 'bridge')
+        meta(BRIDGE_PID, BRIDGE_TID, 'thread_name', 'handlers')
+
+    return {
+        'traceEvents': events,
+        'displayTimeUnit': 'ns',
+        'otherData': {
+            'clock': 'kernel ts_usec',
+            'bridge_clock_synced': bool(syncs),
+            'sync_error_ns': max((err for _ns, _off, err in syncs), default=None),
+        },
+    }
+
+
+def export(trace_path: str, out_path: str, host_path: Optional[str] = None) -> dict:
+    """Write the merged timeline of trace_path (and its host spans) to out_path."""
+    records = list(read_records(trace_path))
+    spans = read_host_spans(host_path or trace_path + HOST_SPAN_SUFFIX)
+    doc = to_chrome(records, spans)
+    with open(out_path, 'w') as f:
+        json.dump(doc, f)
+    return doc
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ZENEDGE trace -> Chrome/Perfetto timeline")
+    parser.add_argument("path", help="trace file written by the bridge (--trace)")
+    parser.add_argument("-o", "--output", default=None,
+                        help="JSON file to write (default: <path>.json)")
+    parser.add_argument("--host", default=None,
+                        help=f"bridge span file (default: <path>{HOST_SPAN_SUFFIX})")
+    args = parser.parse_args()
+
+    out = args.output or args.path + '.json'
+    doc = export(args.path, out, args.host)
+    synced = doc['otherData']['bridge_clock_synced']
+    print(f"{out}: {len(doc['traceEvents'])} events"
+          + ("" if synced else " (no CLOCK_SYNC in the trace: bridge on its own clock)"))
+
+
+if __name__ == '__main__':
+    main()
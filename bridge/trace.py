@@ -0,0 +1,371 @@
+"""
+Flight recorder export (ZENEDGE -> bridge, IPC_REGION_TRACE).
+
+ZENEDGE streams every flight recorder event into an SPSC ring; the bridge
+drains it on every poll and appends the events to a trace file, so a long
+run keeps its whole history instead of the recorder's last few thousand
+events. While the bridge falls behind the ring stays full and the kernel
+holds events back; the ring header counts what it lost anyway, and a
+TRACE_EVT_TRACE_LOST record marks where in the stream it happened.
+
+File format: a 16-byte header (magic "ZTRC", version, record size,
+creation time), then the kernel's 32-byte records unchanged. Files rotate
+at a size limit to trace.zet.1, trace.zet.2, ...
+
+    python3 -m bridge.trace /tmp/zenedge.zet            # print a file
+    python3 -m bridge.trace -f /tmp/zenedge.zet         # follow it live
+    python3 -m bridge.trace --seals /tmp/zenedge.zet    # recompute its seals
+"""
+
+import argparse
+import collections
+import hashlib
+import os
+import struct
+import time
+from typing import Dict, Iterable, Iterator, List, Optional, Tuple
+
+from .protocol import (
+    IPC_TRACE_MAGIC,
+    IPC_TRACE_ENTRY_SIZE,
+    IPC_RING_POLICY_MASK,
+    IPC_RING_POLICY_FIFO,
+    RING_HEADER_STRUCT,
+    RING_LAYOUT_V2,
+    RING_V2_LOST_OFFSET,
+    TRACE_EVENT_STRUCT,
+    TRACE_EVT_PMU_INSTR,
+    TRACE_EVT_SEAL,
+    TRACE_EVT_TRACE_LOST,
+    TRACE_PMU_EVENTS,
+    TRACE_SEAL_BLOCK,
+    RingHeader,
+)
+
+TRACE_FILE_MAGIC = b'ZTRC'
+TRACE_FILE_VERSION = 1
+TRACE_FILE_HDR_STRUCT = struct.Struct('<4sHHII')  # magic, version, record size, time, 0
+
+# (ts_usec, ts_cycles, type, sig, cpu_id, job_id, step_id, extra)
+TraceRecord = Tuple[int, int, int, int, int, int, int, int]
+
+
+class TraceWriter:
+    """Appends records to path, rotating at max_bytes and keeping `keep` old files."""
+
+    def __init__(self, path: str, max_bytes: int = 64 << 20, keep: int = 8):
+        self.path = path
+        self.max_bytes = max(max_bytes, 1 << 16)
+        self.keep = keep
+        self.records = 0
+        self._f = None
+        self._size = 0
+
+    def _open(self) -> None:
+        self._f = open(self.path, 'ab')
+        self._size = self._f.tell()
+        if self._size == 0:
+            self._f.write(TRACE_FILE_HDR_STRUCT.pack(TRACE_FILE_MAGIC, TRACE_FILE_VERSION,
+                                                     IPC_TRACE_ENTRY_SIZE, int(time.time()), 0))
+            self._size = TRACE_FILE_HDR_STRUCT.size
+
+    def rotate(self) -> None:
+        """Start a new file; the current one becomes path.1, and so on."""
+        self.close()
+        for n in range(self.keep - 1, 0, -1):
+            if os.path.exists(f"{self.path}.{n}"):
+                os.replace(f"{self.path}.{n}", f"{self.path}.{n + 1}")
+        if self.keep > 0 and os.path.exists(self.path):
+            os.replace(self.path, f"{self.path}.1")
+        elif os.path.exists(self.path):
+            os.remove(self.path)
+        self._open()
+
+    def write(self, data: bytes) -> None:
+        if not data:
+            return
+        if self._f is None:
+            self._open()
+        if self._size + len(data) > self.max_bytes:
+            self.rotate()
+        self._f.write(data)
+        self._f.flush()  # Followers see whole records as they land
+        self._size += len(data)
+        self.records += len(data) // IPC_TRACE_ENTRY_SIZE
+
+    def close(self) -> None:
+        if self._f is not None:
+            self._f.close()
+            self._f = None
+
+
+class TraceExport:
+    """Consumer side of the trace export ring."""
+
+    def __init__(self, shm, offset: int, region_bytes: int, writer: TraceWriter):
+        self.shm = shm
+        self.offset = offset
+        self.region_bytes = region_bytes
+        self.writer = writer
+        self.layout = RING_LAYOUT_V2
+        self.exported = 0
+        self.lost_reported = 0  # Sum of TRACE_EVT_TRACE_LOST records seen
+
+    def _read_u32(self, offset: int) -> int:
+        self.shm.seek(self.offset + offset)
+        return int.from_bytes(self.shm.read(4), 'little')
+
+    def _header(self) -> Optional[RingHeader]:
+        self.shm.seek(self.offset)
+        hdr = RingHeader.unpack(self.shm.read(RING_HEADER_STRUCT.size), self.layout)
+        if hdr.magic != IPC_TRACE_MAGIC or hdr.entry_size != IPC_TRACE_ENTRY_SIZE:
+            return None
+        if hdr.size == 0 or hdr.size & (hdr.size - 1):
+            return None
+        if (hdr.flags & IPC_RING_POLICY_MASK) != IPC_RING_POLICY_FIFO:
+            return None
+        if self.layout.header_size + hdr.size * IPC_TRACE_ENTRY_SIZE > self.region_bytes:
+            return None
+        return hdr
+
+    def ready(self) -> bool:
+        return self._header() is not None
+
+    def pump(self, max_entries: int = 8192) -> int:
+        """Move whatever ZENEDGE has published to the writer; returns records moved."""
+        hdr = self._header()
+        if hdr is None:
+            return 0
+        used = (hdr.head - hdr.tail) & 0xFFFFFFFF
+        if used > hdr.size:
+            self._write_tail(hdr.head)  # Kernel re-initialized the ring under us
+            return 0
+        count = min(used, max_entries)
+        if count == 0:
+            return 0
+
+        # At most two contiguous reads
+        base = self.offset + self.layout.header_size
+        slot = hdr.tail & (hdr.size - 1)
+        first = min(count, hdr.size - slot)
+        self.shm.seek(base + slot * IPC_TRACE_ENTRY_SIZE)
+        data = self.shm.read(first * IPC_TRACE_ENTRY_SIZE)
+        if count > first:
+            self.shm.seek(base)
+            data += self.shm.read((count - first) * IPC_TRACE_ENTRY_SIZE)
+        self._write_tail((hdr.tail + count) & 0xFFFFFFFF)
+
+        for rec in TRACE_EVENT_STRUCT.iter_unpack(data):
+            if rec[2] == TRACE_EVT_TRACE_LOST:
+                self.lost_reported += rec[7]
+        self.writer.write(data)
+        self.exported += count
+        return count
+
+    def _write_tail(self, tail: int) -> None:
+        self.shm.seek(self.offset + self.layout.tail_offset)
+        self.shm.write(tail.to_bytes(4, 'little'))
+
+    def stats(self) -> dict:
+        return {
+            'exported': self.exported,
+            'overruns': self._read_u32(self.layout.head_offset + 4),
+            'max_occupancy': self._read_u32(self.layout.head_offset + 8),
+            'lost': self._read_u32(RING_V2_LOST_OFFSET),
+        }
+
+
+def read_records(path: str, follow: bool = False,
+                 poll_interval: float = 0.2) -> Iterator[TraceRecord]:
+    """
+    Records of a trace file. With follow, keeps waiting for new ones and
+    moves on to the fresh file when the writer rotates.
+    """
+    f = None
+    try:
+        while True:
+            if f is None:
+                try:
+                    f = open(path, 'rb')
+                except FileNotFoundError:
+                    if not follow:
+                        return
+                    time.sleep(poll_interval)
+                    continue
+                hdr = f.read(TRACE_FILE_HDR_STRUCT.size)
+                magic, _version, rec_size, _t, _ = TRACE_FILE_HDR_STRUCT.unpack(hdr) \
+                    if len(hdr) == TRACE_FILE_HDR_STRUCT.size else (b'', 0, 0, 0, 0)
+                if magic != TRACE_FILE_MAGIC or rec_size != IPC_TRACE_ENTRY_SIZE:
+                    if not follow or len(hdr) == TRACE_FILE_HDR_STRUCT.size:
+                        raise ValueError(f"{path}: not a ZENEDGE trace file")
+                    f.close()  # Header not written yet
+                    f = None
+                    time.sleep(poll_interval)
+                    continue
+
+            pos = f.tell()
+            data = f.read(IPC_TRACE_ENTRY_SIZE)
+            if len(data) == IPC_TRACE_ENTRY_SIZE:
+                yield TRACE_EVENT_STRUCT.unpack(data)
+                continue
+            f.seek(pos)  # Partial record: the writer is mid-append
+            if not follow:
+                return
+
+            # At the end: a rotation leaves us on the old file
+            try:
+                rotated = os.stat(path).st_ino != os.fstat(f.fileno()).st_ino
+            except FileNotFoundError:
+                rotated = False
+            if rotated and len(f.read(1)) == 0:
+                f.close()
+                f = None
+                continue
+            f.seek(pos)
+            time.sleep(poll_interval)
+    finally:
+        if f is not None:
+            f.close()
+
+
+class SealVerifier:
+    """
+    Replays the kernel's per-CPU seal chains over a trace, so each
+    flightrec_seal_hash() it contains can be recomputed from the records.
+
+    Every CPU's chain starts at 32 zero bytes and folds its events
+    TRACE_SEAL_BLOCK at a time: chain = SHA-256(chain || 16 records). A
+    seal is SHA-256 over, for each CPU with events in id order, u32 cpu,
+    u32 events, the chain over its whole blocks and its records past them.
+    The TRACE_EVT_SEAL records that follow a seal say where it cut each CPU;
+    other CPUs' records can land on either side of them, so a seal is
+    worked out once every CPU it covers has got that far.
+    """
+
+    def __init__(self, history_blocks: int = 64):
+        self.history_blocks = history_blocks
+        self.counts: Dict[int, int] = {}
+        self.chains: Dict[int, bytes] = {}
+        self.checkpoints: Dict[int, collections.deque] = {}  # cpu -> (events, chain)
+        self.recent: Dict[int, collections.deque] = {}       # cpu -> raw records
+        self.pending: Dict[Tuple[int, int], List[Tuple[int, int]]] = {}
+        self.lost = 0
+
+    def feed(self, rec: TraceRecord) -> List[Tuple[bytes, bool]]:
+        """Take the next record; returns (seal, verifiable) for seals completed by it."""
+        if rec[2] == TRACE_EVT_TRACE_LOST:
+            # Which CPUs lost is unknown: no chain past this point holds
+            self.lost += rec[7]
+            return []
+
+        cpu = rec[4]
+        if cpu not in self.counts:
+            self.counts[cpu] = 0
+            self.chains[cpu] = bytes(32)
+            self.checkpoints[cpu] = collections.deque([(0, bytes(32))],
+                                                      maxlen=self.history_blocks)
+            self.recent[cpu] = collections.deque(maxlen=self.history_blocks * TRACE_SEAL_BLOCK)
+        raw = TRACE_EVENT_STRUCT.pack(*rec)
+        self.recent[cpu].append(raw)
+        self.counts[cpu] += 1
+        if self.counts[cpu] % TRACE_SEAL_BLOCK == 0:
+            block = b''.join(list(self.recent[cpu])[-TRACE_SEAL_BLOCK:])
+            self.chains[cpu] = hashlib.sha256(self.chains[cpu] + block).digest()
+            self.checkpoints[cpu].append((self.counts[cpu], self.chains[cpu]))
+
+        if rec[2] == TRACE_EVT_SEAL:
+            key = (rec[5] >> 16, rec[7])
+            self.pending.setdefault(key, []).append((rec[5] & 0xFFFF, rec[6]))
+        return self._settle()
+
+    def _settle(self) -> List[Tuple[bytes, bool]]:
+        done = []
+        for key, cuts in list(self.pending.items()):
+            ncpus, tag = key
+            if len(cuts) < ncpus:
+                continue
+            if any(self.counts.get(cpu, 0) < events for cpu, events in cuts):
+                continue
+            del self.pending[key]
+            seal = self._seal(sorted(cuts))
+            ok = seal is not None and self.lost == 0 and \
+                int.from_bytes(seal[:4], 'little') == tag
+            done.append((seal or b'', ok))
+        return done
+
+    def _seal(self, cuts: List[Tuple[int, int]]) -> Optional[bytes]:
+        ctx = hashlib.sha256()
+        for cpu, events in cuts:
+            whole = events - events % TRACE_SEAL_BLOCK
+            chain = next((c for n, c in self.checkpoints[cpu] if n == whole), None)
+            back = self.counts[cpu] - whole
+            if chain is None or back > len(self.recent[cpu]):
+                return None  # Older than the history kept
+            recent = list(self.recent[cpu])
+            start = len(recent) - back
+            ctx.update(struct.pack('<II', cpu, events))
+            ctx.update(chain)
+            ctx.update(b''.join(recent[start:start + events - whole]))
+        return ctx.digest()
+
+
+def trace_seals(records: Iterable[TraceRecord]) -> Iterator[Tuple[bytes, bool]]:
+    """Every seal a trace holds, recomputed, with whether it checked out."""
+    verifier = SealVerifier()
+    for rec in records:
+        yield from verifier.feed(rec)
+
+
+def verify_seal(path: str, seal: bytes) -> Optional[bool]:
+    """
+    Whether seal (an IFR's flightrec_seal_hash) is one the trace at path
+    recomputes. False if a seal the trace took does not recompute (records
+    missing or changed), None if the trace holds no such seal.
+    """
+    result = None
+    for found, ok in trace_seals(read_records(path)):
+        if found == seal and ok:
+            return True
+        if not ok:
+            result = False
+    return result
+
+
+def format_record(rec: TraceRecord) -> str:
+    ts_usec, _cycles, evt, sig, cpu, job, step, extra = rec
+    if evt == TRACE_EVT_TRACE_LOST:
+        return f"{ts_usec:>12} cpu{cpu:<2} LOST {extra} events"
+    if evt == TRACE_EVT_SEAL:
+        return f"{ts_usec:>12} cpu{cpu:<2} SEAL {extra:08x} cpu{job & 0xFFFF} at {step}"
+    if TRACE_EVT_PMU_INSTR <= evt < TRACE_EVT_PMU_INSTR + len(TRACE_PMU_EVENTS):
+        name = TRACE_PMU_EVENTS[evt - TRACE_EVT_PMU_INSTR]
+        return f"{ts_usec:>12} cpu{cpu:<2} PMU {name}={extra} job={job} step={step}"
+    mark = " signed" if sig else ""
+    return f"{ts_usec:>12} cpu{cpu:<2} type={evt:#04x} job={job} step={step} extra={extra}{mark}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ZENEDGE flight recorder trace files")
+    parser.add_argument("path", help="trace file written by the bridge (--trace)")
+    parser.add_argument("-f", "--follow", action="store_true",
+                        help="keep printing records as they arrive, across rotations")
+    parser.add_argument("--seals", action="store_true",
+                        help="recompute the flight recorder seals the trace holds")
+    args = parser.parse_args()
+
+    try:
+        if args.seals:
+            for seal, ok in trace_seals(read_records(args.path, follow=args.follow)):
+                print(f"{seal.hex() or '-' * 64} {'ok' if ok else 'UNVERIFIED'}",
+                      flush=args.follow)
+            return
+        for rec in read_records(args.path, follow=args.follow):
+            print(format_record(rec), flush=args.follow)
+    except KeyboardInterrupt:
+        pass
+    except ValueError as e:
+        print(e)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,167 @@
+"""
+WASM agent profile dumps (CMD_WASM_PROFILE).
+
+The bridge turns profiling on by writing a mode mask into the doorbell and
+asks for a dump by bumping a counter there; ZENEDGE polls both at episode
+boundaries and answers with a CMD_WASM_PROFILE blob.
+
+    python3 -m bridge.wasm_prof --mode calls,host --dump
+    python3 -m bridge.wasm_prof --show /tmp/zenedge_wasm_prof/latest.bin
+"""
+
+import argparse
+import mmap
+import os
+from typing import Optional, Dict, Any, List
+
+from .protocol import (
+    IPC_WASM_PROF_MAGIC,
+    IPC_WASM_PROF_VERSION,
+    IPC_WASM_PROF_CALLS,
+    IPC_WASM_PROF_HOST,
+    IPC_WASM_PROF_OPS,
+    IPC_WASM_PROF_KIND_FUNC,
+    IPC_WASM_PROF_KIND_HOST,
+    IPC_WASM_PROF_KIND_OP,
+    IPC_REGION_DOORBELL,
+    DOORBELL_WASM_PROF_MODE_OFFSET,
+    DOORBELL_WASM_PROF_DUMP_OFFSET,
+    WASM_PROF_HDR_STRUCT,
+    WASM_PROF_REC_STRUCT,
+    ShmLayout,
+)
+
+MODE_NAMES = {
+    "calls": IPC_WASM_PROF_CALLS,
+    "host": IPC_WASM_PROF_HOST,
+    "ops": IPC_WASM_PROF_OPS,
+}
+
+KIND_NAMES = {
+    IPC_WASM_PROF_KIND_FUNC: "func",
+    IPC_WASM_PROF_KIND_HOST: "host",
+    IPC_WASM_PROF_KIND_OP: "op",
+}
+
+
+def parse_profile(data: bytes) -> Optional[Dict[str, Any]]:
+    """Decode a profile dump blob, or None if it is not one."""
+    if not data or len(data) < WASM_PROF_HDR_STRUCT.size:
+        return None
+
+    magic, version, mode, count, cpu_mhz = WASM_PROF_HDR_STRUCT.unpack_from(data, 0)
+    if magic != IPC_WASM_PROF_MAGIC or version != IPC_WASM_PROF_VERSION:
+        return None
+    if len(data) < WASM_PROF_HDR_STRUCT.size + count * WASM_PROF_REC_STRUCT.size:
+        return None
+
+    records = []
+    off = WASM_PROF_HDR_STRUCT.size
+    for _ in range(count):
+        kind, _reserved, calls, cycles, name = WASM_PROF_REC_STRUCT.unpack_from(data, off)
+        off += WASM_PROF_REC_STRUCT.size
+        records.append({
+            "kind": KIND_NAMES.get(kind, str(kind)),
+            "name": name.split(b'\x00')[0].decode('utf-8', errors='replace'),
+            "calls": calls,
+            "cycles": cycles,
+        })
+
+    return {"mode": mode, "cpu_mhz": cpu_mhz, "records": records}
+
+
+def render(profile: Dict[str, Any], top: int = 20) -> str:
+    """Top functions and host imports by cycles, top opcodes by count."""
+    mhz = profile["cpu_mhz"] or 1
+    lines = [f"wasm profile: mode={profile['mode']:#x} tsc={profile['cpu_mhz']} MHz"]
+
+    for kind in ("func", "host"):
+        recs = [r for r in profile["records"] if r["kind"] == kind]
+        if not recs:
+            continue
+        recs.sort(key=lambda r: r["cycles"], reverse=True)
+        total = sum(r["cycles"] for r in recs) or 1
+        lines.append(f"  {kind}:")
+        lines.append(f"    {'name':<24} {'calls':>10} {'total us':>12} {'avg ns':>10} {'%':>6}")
+        for r in recs[:top]:
+            us = r["cycles"] / mhz
+            avg_ns = us * 1000.0 / r["calls"] if r["calls"] else 0.0
+            lines.append(f"    {r['name']:<24} {r['calls']:>10} {us:>12.1f} "
+                         f"{avg_ns:>10.1f} {100.0 * r['cycles'] / total:>6.1f}")
+
+    ops: List[Dict[str, Any]] = [r for r in profile["records"] if r["kind"] == "op"]
+    if ops:
+        ops.sort(key=lambda r: r["calls"], reverse=True)
+        total = sum(r["calls"] for r in ops) or 1
+        lines.append("  opcodes:")
+        for r in ops[:top]:
+            lines.append(f"    {r['name']:<32} {r['calls']:>12} {100.0 * r['calls'] / total:>6.1f}")
+
+    return "\n".join(lines)
+
+
+def request_profile(shm, doorbell_offset: int, mode: Optional[int] = None,
+                    dump: bool = True) -> None:
+    """Set the profiling mode and/or ask ZENEDGE for a dump.
+
+    Changing the mode from off clears the kernel's totals. The dump arrives
+    as a CMD_WASM_PROFILE at the next episode boundary.
+    """
+    if mode is not None:
+        shm.seek(doorbell_offset + DOORBELL_WASM_PROF_MODE_OFFSET)
+        shm.write(int(mode).to_bytes(4, 'little'))
+    if dump:
+        shm.seek(doorbell_offset + DOORBELL_WASM_PROF_DUMP_OFFSET)
+        seq = int.from_bytes(shm.read(4), 'little')
+        shm.seek(doorbell_offset + DOORBELL_WASM_PROF_DUMP_OFFSET)
+        shm.write(((seq + 1) & 0xFFFFFFFF).to_bytes(4, 'little'))
+
+
+def parse_mode(text: str) -> int:
+    """'calls,host' -> mask; 'off' -> 0."""
+    mode = 0
+    for part in text.split(','):
+        part = part.strip().lower()
+        if not part or part == "off":
+            continue
+        if part not in MODE_NAMES:
+            raise ValueError(f"unknown profile mode '{part}' (calls, host, ops, off)")
+        mode |= MODE_NAMES[part]
+    return mode
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ZENEDGE wasm agent profiler")
+    parser.add_argument("--shm", default="/dev/shm/zenedge.shm")
+    parser.add_argument("--mode", default=None,
+                        help="comma list of calls, host, ops (or 'off')")
+    parser.add_argument("--dump", action="store_true",
+                        help="request a dump at the next episode boundary")
+    parser.add_argument("--show", default=None, help="render a saved dump file")
+    parser.add_argument("--top", type=int, default=20)
+    args = parser.parse_args()
+
+    if args.show:
+        with open(args.show, 'rb') as f:
+            profile = parse_profile(f.read())
+        if profile is None:
+            print(f"{args.show}: not a wasm profile dump")
+            return
+        print(render(profile, args.top))
+        return
+
+    mode = parse_mode(args.mode) if args.mode is not None else None
+    if mode is None and not args.dump:
+        parser.error("nothing to do: pass --mode, --dump or --show")
+
+    fd = os.open(args.shm, os.O_RDWR)
+    try:
+        with mmap.mmap(fd, 0) as shm:
+            layout = ShmLayout.read(shm, len(shm)) or ShmLayout.legacy()
+            request_profile(shm, layout.offset(IPC_REGION_DOORBELL), mode, args.dump)
+    finally:
+        os.close(fd)
+
+
+if __name__ == "__main__":
+    main()
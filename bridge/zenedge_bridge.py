@@ -6,30 +6,43 @@ Communicates with the ZENEDGE kernel via shared memory, implementing
 the ring buffer protocol for commands and responses.
 """
 
-import mmap
+import contextlib
 import os
 import sys
 import time
 import argparse
 from pathlib import Path
-from typing import Optional, Tuple, Callable, Dict
+from typing import Optional, Tuple, Callable, Dict, List
 
 from .protocol import (
     IPC_SHARED_MEM_SIZE,
-    IPC_CMD_RING_OFFSET,
-    IPC_RSP_RING_OFFSET,
-    IPC_DOORBELL_OFFSET,
+    IPC_REGION_CMD_RING,
+    IPC_REGION_RSP_RING,
+    IPC_REGION_DOORBELL,
+    IPC_REGION_HEAP_CTL,
+    IPC_REGION_HEAP_DATA,
+    IPC_REGION_TELEMETRY,
+    IPC_REGION_MSG_CMD,
+    IPC_REGION_MSG_RSP,
+    IPC_REGION_BULK,
+    IPC_REGION_TRACE,
+    IPC_REGION_JOBS,
     IPC_MAGIC,
     IPC_RSP_MAGIC,
     DOORBELL_MAGIC,
-    IPC_RING_SIZE,
-    RING_HEADER_SIZE,
+    DOORBELL_VERSION_OFFSET,
+    DOORBELL_PEER_VERSION_OFFSET,
+    IPC_PROTO_VERSION,
+    IPC_TAG_NONE,
     PACKET_SIZE,
     RESPONSE_SIZE,
     CMD_NAMES,
     RSP_OK,
     RSP_ERROR,
     RingHeader,
+    RingLayout,
+    ShmLayout,
+    ring_layout,
     Packet,
     Response,
     get_timestamp,
@@ -38,7 +51,16 @@ from .protocol import (
     RESPONSE_STRUCT,
 )
 from .heap import HeapManager
+from .msgring import MsgRing
+from .bulk import BulkRing
+from .trace import TraceExport, TraceWriter
+from .jobs import JobGraph, JobRing
+from .telemetry import TelemetryPage
+from .timeline import HOST_SPAN_SUFFIX, HostSpans
+from .actuator import HostActuators
+from .ifr_archive import IFR_ARCHIVE_DIR, IfrArchive
 from .models import ModelCache
+from . import shmplace
 
 
 class ZenedgeBridge:
@@ -53,7 +75,13 @@ class ZenedgeBridge:
 
     def __init__(self, shm_path: str = "/dev/shm/zenedge.shm",
                  model_dir: str = "./models",
-                 create: bool = False):
+                 create: bool = False,
+                 trace_path: Optional[str] = None,
+                 trace_max_bytes: int = 64 << 20,
+                 jobs: Optional[List[JobGraph]] = None,
+                 hugepages: bool = False,
+                 prefault: bool = False,
+                 numa_cpu: Optional[int] = None):
         """
         Initialize the bridge.
 
@@ -61,10 +89,21 @@ class ZenedgeBridge:
             shm_path: Path to shared memory file
             model_dir: Directory containing PyTorch models
             create: If True, create the shared memory file if it doesn't exist
+            trace_path: If set, stream flight recorder events to this file
+            trace_max_bytes: Rotate the trace file at this size
+            jobs: Job graphs to submit once ZENEDGE's job ring is up
+            hugepages: Transparent huge pages for a tmpfs file (hugetlbfs
+                files map with huge pages anyway)
+            prefault: Fault in and mlock the whole region now
+            numa_cpu: Bind the region to this host CPU's NUMA node (e.g. a
+                QEMU vCPU's) and poll from that node
         """
         self.shm_path = Path(shm_path)
         self.handlers: Dict[int, Callable] = {}
         self.running = False
+        self.ring_layout: RingLayout = ring_layout(IPC_PROTO_VERSION)
+        self.attached = False
+        self.jobs_to_submit: List[JobGraph] = list(jobs or [])
 
         # Statistics
         self.stats = {
@@ -74,11 +113,18 @@ class ZenedgeBridge:
             'start_time': None,
         }
 
-        # Open or create shared memory file
+        # Open or create shared memory file (hugetlbfs: whole huge pages)
+        huge_page = shmplace.hugetlbfs_page_size(self.shm_path)
+        min_size = IPC_SHARED_MEM_SIZE
+        if huge_page:
+            min_size = -(-min_size // huge_page) * huge_page
         if create and not self.shm_path.exists():
             print(f"[BRIDGE] Creating shared memory file: {self.shm_path}")
             with open(self.shm_path, 'wb') as f:
-                f.write(b'\x00' * IPC_SHARED_MEM_SIZE)
+                if huge_page:
+                    f.truncate(min_size)  # No write() on hugetlbfs
+                else:
+                    f.write(b'\x00' * IPC_SHARED_MEM_SIZE)
 
         if not self.shm_path.exists():
             raise FileNotFoundError(
@@ -86,34 +132,121 @@ class ZenedgeBridge:
                 f"Start QEMU first or use --create to create it."
             )
 
-        # Memory map the file
+        # Memory map the whole file: ZENEDGE lays out whatever BAR2 exposes
         self.fd = os.open(str(self.shm_path), os.O_RDWR)
-        self.shm = mmap.mmap(self.fd, IPC_SHARED_MEM_SIZE)
-
-        print(f"[BRIDGE] Mapped shared memory: {self.shm_path} ({IPC_SHARED_MEM_SIZE} bytes)")
-
-        # Initialize subsystems
-        self.heap = HeapManager(self.shm)
+        self.shm_size = max(os.fstat(self.fd).st_size, min_size)
+        if os.fstat(self.fd).st_size < self.shm_size:
+            os.ftruncate(self.fd, self.shm_size)
+        numa_node = None
+        if numa_cpu is not None:
+            numa_node = shmplace.cpu_node(numa_cpu)
+            if numa_node is None:
+                print(f"[BRIDGE] CPU {numa_cpu} has no NUMA node, region left unbound")
+        self.shm = shmplace.map_shared(self.fd, self.shm_size, hugepages=hugepages,
+                                       prefault=prefault, node=numa_node,
+                                       huge_page=huge_page)
+        if numa_node is not None:
+            shmplace.pin_to_node(numa_node)
+
+        print(f"[BRIDGE] Mapped shared memory: {self.shm_path} ({self.shm_size} bytes)")
+
+        # Initialize subsystems (region offsets come from the layout)
+        self.trace_writer: Optional[TraceWriter] = None
+        self.host_spans: Optional[HostSpans] = None
+        if trace_path:
+            self.trace_writer = TraceWriter(trace_path, trace_max_bytes)
+            self.host_spans = HostSpans(trace_path + HOST_SPAN_SUFFIX, trace_max_bytes)
+        self.shm_layout: Optional[ShmLayout] = None
+        self._resolve_layout()
         self.model_cache = ModelCache(model_dir)
+        self.ifr_archive = IfrArchive(os.getenv("ZENEDGE_IFR_DIR", IFR_ARCHIVE_DIR))
+        self.actuators = HostActuators()
 
         # Verify shared memory is initialized
         self._verify_initialization()
 
+    def _resolve_layout(self) -> None:
+        """
+        Use the layout descriptor ZENEDGE published at offset 0, or the fixed
+        1MB layout for images without one. Region users are rebuilt whenever
+        the layout changes (e.g. the kernel rebooted onto a bigger BAR2).
+        """
+        shm_layout = ShmLayout.read(self.shm, self.shm_size) or ShmLayout.legacy()
+        if shm_layout == self.shm_layout:
+            return
+
+        self.shm_layout = shm_layout
+        self.cmd_ring_offset = shm_layout.offset(IPC_REGION_CMD_RING)
+        self.rsp_ring_offset = shm_layout.offset(IPC_REGION_RSP_RING)
+        self.doorbell_offset = shm_layout.offset(IPC_REGION_DOORBELL)
+        self.heap = HeapManager(self.shm, shm_layout.offset(IPC_REGION_HEAP_CTL),
+                                shm_layout.offset(IPC_REGION_HEAP_DATA),
+                                shm_layout.size(IPC_REGION_HEAP_DATA))
+        self.msg_cmd_ring = MsgRing(self.shm, shm_layout.offset(IPC_REGION_MSG_CMD))
+        self.msg_rsp_ring = MsgRing(self.shm, shm_layout.offset(IPC_REGION_MSG_RSP))
+        self.telemetry = TelemetryPage(self.shm,
+                                       offset=shm_layout.offset(IPC_REGION_TELEMETRY))
+        self.bulk: Optional[BulkRing] = None
+        if shm_layout.has(IPC_REGION_BULK):
+            self.bulk = BulkRing(self.shm, shm_layout.offset(IPC_REGION_BULK))
+        self.trace: Optional[TraceExport] = None
+        if self.trace_writer and shm_layout.has(IPC_REGION_TRACE):
+            self.trace = TraceExport(self.shm, shm_layout.offset(IPC_REGION_TRACE),
+                                     shm_layout.size(IPC_REGION_TRACE), self.trace_writer)
+        self.jobs: Optional[JobRing] = None
+        if shm_layout.has(IPC_REGION_JOBS):
+            self.jobs = JobRing(self.shm, shm_layout.offset(IPC_REGION_JOBS),
+                                shm_layout.size(IPC_REGION_JOBS))
+
+        if shm_layout.negotiated:
+            print(f"[BRIDGE] Layout descriptor: {shm_layout.total_size // 1024} KB, "
+                  f"cmd ring at {self.cmd_ring_offset:#x} "
+                  f"({shm_layout.entries(IPC_REGION_CMD_RING)} entries), "
+                  f"heap {shm_layout.size(IPC_REGION_HEAP_DATA) // 1024} KB")
+        else:
+            print("[BRIDGE] No layout descriptor, using fixed 1MB layout")
+
+    def _negotiate_version(self) -> int:
+        """
+        Pick the ring layout ZENEDGE advertised in the doorbell block and
+        ack it through peer_version.
+        """
+        self._resolve_layout()
+        self.shm.seek(self.doorbell_offset)
+        doorbell_magic = int.from_bytes(self.shm.read(4), 'little')
+        if doorbell_magic != DOORBELL_MAGIC:
+            self.attached = False
+            return 0
+
+        self.shm.seek(self.doorbell_offset + DOORBELL_VERSION_OFFSET)
+        version = int.from_bytes(self.shm.read(4), 'little')
+        self.ring_layout = ring_layout(version)
+        self.attached = (version == self.ring_layout.version)
+
+        if self.attached:
+            self.shm.seek(self.doorbell_offset + DOORBELL_PEER_VERSION_OFFSET)
+            self.shm.write(version.to_bytes(4, 'little'))
+        return version
+
     def _verify_initialization(self):
         """Check that ZENEDGE has initialized the shared memory."""
+        # Read doorbell (selects the ring layout)
+        version = self._negotiate_version()
+        self.shm.seek(self.doorbell_offset)
+        doorbell_magic = int.from_bytes(self.shm.read(4), 'little')
+
         # Read command ring header
-        self.shm.seek(IPC_CMD_RING_OFFSET)
+        self.shm.seek(self.cmd_ring_offset)
         cmd_header_data = self.shm.read(RING_HEADER_STRUCT.size)
-        cmd_header = RingHeader.unpack(cmd_header_data)
+        cmd_header = RingHeader.unpack(cmd_header_data, self.ring_layout)
 
         # Read response ring header
-        self.shm.seek(IPC_RSP_RING_OFFSET)
+        self.shm.seek(self.rsp_ring_offset)
         rsp_header_data = self.shm.read(RING_HEADER_STRUCT.size)
-        rsp_header = RingHeader.unpack(rsp_header_data)
+        rsp_header = RingHeader.unpack(rsp_header_data, self.ring_layout)
 
-        # Read doorbell
-        self.shm.seek(IPC_DOORBELL_OFFSET)
-        doorbell_magic = int.from_bytes(self.shm.read(4), 'little')
+        print(f"[BRIDGE] Ring protocol: v{self.ring_layout.version} "
+              f"(kernel advertised v{version})")
 
         print(f"[BRIDGE] Command ring: magic={cmd_header.magic:#010x}, "
               f"head={cmd_header.head}, tail={cmd_header.tail}, size={cmd_header.size}")
@@ -133,43 +266,43 @@ class ZenedgeBridge:
 
     def _read_cmd_ring_header(self) -> RingHeader:
         """Read the command ring header."""
-        self.shm.seek(IPC_CMD_RING_OFFSET)
+        self.shm.seek(self.cmd_ring_offset)
         data = self.shm.read(RING_HEADER_STRUCT.size)
-        return RingHeader.unpack(data)
+        return RingHeader.unpack(data, self.ring_layout)
 
     def _write_cmd_ring_tail(self, tail: int):
         """Update the command ring tail pointer."""
-        self.shm.seek(IPC_CMD_RING_OFFSET + 8)  # Offset to tail field
+        self.shm.seek(self.cmd_ring_offset + self.ring_layout.tail_offset)
         self.shm.write(tail.to_bytes(4, 'little'))
 
     def _read_rsp_ring_header(self) -> RingHeader:
         """Read the response ring header."""
-        self.shm.seek(IPC_RSP_RING_OFFSET)
+        self.shm.seek(self.rsp_ring_offset)
         data = self.shm.read(RING_HEADER_STRUCT.size)
-        return RingHeader.unpack(data)
+        return RingHeader.unpack(data, self.ring_layout)
 
     def _write_rsp_ring_header(self, head: int):
         """Update the response ring head pointer."""
-        self.shm.seek(IPC_RSP_RING_OFFSET + 4)  # Offset to head field
+        self.shm.seek(self.rsp_ring_offset + self.ring_layout.head_offset)
         self.shm.write(head.to_bytes(4, 'little'))
 
     def _read_doorbell(self) -> Tuple[int, int]:
         """Read cmd_doorbell and rsp_doorbell values."""
-        self.shm.seek(IPC_DOORBELL_OFFSET + 8)  # Skip magic and version
+        self.shm.seek(self.doorbell_offset + 8)  # Skip magic and version
         cmd_doorbell = int.from_bytes(self.shm.read(4), 'little')
-        self.shm.seek(IPC_DOORBELL_OFFSET + 20)  # rsp_doorbell offset
+        self.shm.seek(self.doorbell_offset + 20)  # rsp_doorbell offset
         rsp_doorbell = int.from_bytes(self.shm.read(4), 'little')
         return cmd_doorbell, rsp_doorbell
 
     def _write_rsp_doorbell(self, value: int):
         """Write to the response doorbell."""
-        self.shm.seek(IPC_DOORBELL_OFFSET + 20)  # rsp_doorbell offset
+        self.shm.seek(self.doorbell_offset + 20)  # rsp_doorbell offset
         self.shm.write(value.to_bytes(4, 'little'))
 
         # Increment rsp_writes counter
-        self.shm.seek(IPC_DOORBELL_OFFSET + 36)  # rsp_writes offset
+        self.shm.seek(self.doorbell_offset + 36)  # rsp_writes offset
         current = int.from_bytes(self.shm.read(4), 'little')
-        self.shm.seek(IPC_DOORBELL_OFFSET + 36)
+        self.shm.seek(self.doorbell_offset + 36)
         self.shm.write((current + 1).to_bytes(4, 'little'))
 
     def poll_command(self) -> Optional[Packet]:
@@ -179,31 +312,66 @@ class ZenedgeBridge:
         Returns:
             Packet if a command was available, None otherwise
         """
+        if not self.attached:
+            # Kernel may have booted after us: pick up its layout
+            self._negotiate_version()
+            if not self.attached:
+                return None
+
+        # Inline-payload commands first: they carry their data with them
+        record = self.msg_cmd_ring.pop()
+        if record is not None:
+            (_kind, _len, cmd, flags, arg, tag), data = record
+            self.stats['commands_received'] += 1
+            return Packet(cmd, flags, arg, get_timestamp(), tag,
+                          inline=data, via_msg=True)
+
         header = self._read_cmd_ring_header()
 
         if header.magic != IPC_MAGIC:
+            self.attached = False
             return None  # Ring not initialized
 
         # Check if ring is empty
         if header.head == header.tail:
             return None
 
+        layout = self.ring_layout
+        slot = layout.slot(header.tail, header.size)
+
+        # Multi-producer ring: head counts claims; the slot's sequence number
+        # says whether the producer has published it yet
+        seq_offset = 0
+        if header.mpsc:
+            seq_offset = (self.cmd_ring_offset + layout.header_size +
+                          header.size * layout.packet_size + slot * 4)
+            self.shm.seek(seq_offset)
+            seq = int.from_bytes(self.shm.read(4), 'little')
+            if seq != ((header.tail + 1) & 0xFFFFFFFF):
+                return None
+
         # Read packet at tail position
-        packet_offset = (IPC_CMD_RING_OFFSET + RING_HEADER_SIZE +
-                        (header.tail * PACKET_SIZE))
+        packet_offset = (self.cmd_ring_offset + layout.header_size +
+                        (slot * layout.packet_size))
         self.shm.seek(packet_offset)
-        packet_data = self.shm.read(PACKET_SIZE)
+        packet_data = self.shm.read(layout.packet_size)
         packet = Packet.unpack(packet_data)
 
+        # Release the slot for the producers' next lap
+        if header.mpsc:
+            self.shm.seek(seq_offset)
+            self.shm.write(((header.tail + header.size) & 0xFFFFFFFF).to_bytes(4, 'little'))
+
         # Update tail (consume the packet)
-        new_tail = (header.tail + 1) % header.size
+        new_tail = layout.advance(header.tail, header.size)
         self._write_cmd_ring_tail(new_tail)
 
         self.stats['commands_received'] += 1
 
         return packet
 
-    def send_response(self, status: int, orig_cmd: int, result: int = 0, duration_us: int = 0):
+    def send_response(self, status: int, orig_cmd: int, result: int = 0, duration_us: int = 0,
+                      tag: int = IPC_TAG_NONE):
         """
         Send a response to ZENEDGE.
 
@@ -212,6 +380,8 @@ class ZenedgeBridge:
             orig_cmd: The command this is responding to
             result: Result value (e.g., blob_id for tensor results)
             duration_us: Server-side execution duration in microseconds
+            tag: Request tag from the command packet, echoed back so ZENEDGE
+                 can complete the matching async request
         """
         header = self._read_rsp_ring_header()
 
@@ -220,8 +390,8 @@ class ZenedgeBridge:
             return
 
         # Check if ring is full
-        next_head = (header.head + 1) % header.size
-        if next_head == header.tail:
+        layout = self.ring_layout
+        if layout.full(header.head, header.tail, header.size):
             print("[BRIDGE] ERROR: Response ring is full")
             return
 
@@ -230,14 +400,17 @@ class ZenedgeBridge:
             status=status,
             orig_cmd=orig_cmd,
             result=result,
-            timestamp=duration_us if duration_us > 0 else get_timestamp()
+            timestamp=duration_us if duration_us > 0 else get_timestamp(),
+            tag=tag
         )
 
         # Write to ring at head position
-        response_offset = (IPC_RSP_RING_OFFSET + RING_HEADER_SIZE +
-                         (header.head * RESPONSE_SIZE))
+        response_offset = (self.rsp_ring_offset + layout.header_size +
+                         (layout.slot(header.head, header.size) * layout.response_size))
         self.shm.seek(response_offset)
-        self.shm.write(response.pack())
+        self.shm.write(response.pack(layout.tagged))
+
+        next_head = layout.advance(header.head, header.size)
 
         # Update head
         self._write_rsp_ring_header(next_head)
@@ -247,20 +420,45 @@ class ZenedgeBridge:
 
         self.stats['responses_sent'] += 1
 
+    def send_msg_response(self, status: int, orig_cmd: int, result: int = 0,
+                          tag: int = IPC_TAG_NONE, data: bytes = b''):
+        """
+        Send a response (optionally carrying inline data) on the message
+        response ring. Commands that arrived on the message ring are answered
+        here so ZENEDGE sees them in order with their payload.
+        """
+        if not self.msg_rsp_ring.push(orig_cmd, status, result, tag, data):
+            print("[BRIDGE] ERROR: Message response ring full or not initialized")
+            return
+
+        # Same doorbell as the fixed response ring
+        self._write_rsp_doorbell(self._read_rsp_ring_header().head)
+        self.stats['responses_sent'] += 1
+
+    def respond(self, packet: Packet, status: int, result: int, duration_us: int,
+                data: bytes = b''):
+        """Answer a packet on the ring it arrived on."""
+        if packet.via_msg:
+            self.send_msg_response(status, packet.cmd, result, packet.tag, data)
+        else:
+            self.send_response(status, packet.cmd, result, duration_us, packet.tag)
+
     def register_handler(self, cmd: int, handler: Callable):
         """
         Register a handler function for a command type.
 
         Handler signature: handler(bridge, packet) -> (status, result)
+        or (status, result, inline_bytes) for replies carrying data back on
+        the message ring.
         """
         self.handlers[cmd] = handler
 
-    def dispatch(self, packet: Packet) -> Tuple[int, int, int]:
+    def dispatch(self, packet: Packet) -> Tuple[int, int, int, bytes]:
         """
         Dispatch a packet to its handler.
 
         Returns:
-            (status, result, duration_us) tuple
+            (status, result, duration_us, inline_bytes) tuple
         """
         cmd_name = CMD_NAMES.get(packet.cmd, f"UNKNOWN({packet.cmd:#06x})")
         print(f"[BRIDGE] Received: {cmd_name} payload={packet.payload_id} "
@@ -269,17 +467,30 @@ class ZenedgeBridge:
         if packet.cmd in self.handlers:
             try:
                 t_start = time.time()
-                status, result = self.handlers[packet.cmd](self, packet)
+                ns_start = time.monotonic_ns()
+                ret = self.handlers[packet.cmd](self, packet)
                 t_end = time.time()
                 duration_us = int((t_end - t_start) * 1_000_000)
-                return status, result, duration_us
+                if self.host_spans:
+                    self.host_spans.record(cmd_name, 'handler', ns_start,
+                                           time.monotonic_ns() - ns_start,
+                                           cmd=packet.cmd, tag=packet.tag)
+                status, result = ret[0], ret[1]
+                data = ret[2] if len(ret) > 2 else b''
+                return status, result, duration_us, data
             except Exception as e:
                 print(f"[BRIDGE] Handler error for {cmd_name}: {e}")
                 self.stats['errors'] += 1
-                return RSP_ERROR, 0, 0
+                return RSP_ERROR, 0, 0, b''
         else:
             print(f"[BRIDGE] No handler for {cmd_name}")
-            return RSP_ERROR, 0, 0
+            return RSP_ERROR, 0, 0, b''
+
+    def span(self, name: str, cat: str, **args):
+        """Context manager timing a piece of a handler for the timeline export."""
+        if self.host_spans:
+            return self.host_spans.span(name, cat, **args)
+        return contextlib.nullcontext()
 
     def run(self, poll_interval: float = 0.001):
         """
@@ -296,11 +507,18 @@ class ZenedgeBridge:
 
         try:
             while self.running:
+                self.telemetry.maybe_publish()
+                if self.bulk:
+                    self.bulk.pump()
+                if self.trace:
+                    self.trace.pump()
+                if self.jobs_to_submit:
+                    self.submit_jobs()
                 packet = self.poll_command()
 
                 if packet is not None:
-                    status, result, duration_us = self.dispatch(packet)
-                    self.send_response(status, packet.cmd, result, duration_us)
+                    status, result, duration_us, data = self.dispatch(packet)
+                    self.respond(packet, status, result, duration_us, data)
                 else:
                     time.sleep(poll_interval)
 
@@ -317,13 +535,35 @@ class ZenedgeBridge:
         Returns:
             True if a command was processed, False otherwise
         """
+        self.telemetry.maybe_publish()
+        if self.bulk:
+            self.bulk.pump()
+        if self.trace:
+            self.trace.pump()
+        if self.jobs_to_submit:
+            self.submit_jobs()
         packet = self.poll_command()
         if packet is not None:
-            status, result, duration_us = self.dispatch(packet)
-            self.send_response(status, packet.cmd, result, duration_us)
+            status, result, duration_us, data = self.dispatch(packet)
+            self.respond(packet, status, result, duration_us, data)
             return True
         return False
 
+    def submit_jobs(self) -> int:
+        """Queue what fits of the graphs waiting for the job ring; returns
+        how many went."""
+        sent = 0
+        while self.jobs_to_submit and self.jobs and self.jobs.ready():
+            graph = self.jobs_to_submit[0]
+            blob_id = self.jobs.submit(self.heap, graph)
+            if blob_id is None:
+                break  # Ring or heap full: retried on the next pass
+            self.jobs_to_submit.pop(0)
+            print(f"[JOBS] Submitted job {graph.job_id} ({len(graph.steps)} steps) "
+                  f"in blob {blob_id}")
+            sent += 1
+        return sent
+
     def _print_stats(self):
         """Print session statistics."""
         elapsed = time.time() - self.stats['start_time'] if self.stats['start_time'] else 0
@@ -335,9 +575,19 @@ class ZenedgeBridge:
         if elapsed > 0:
             rate = self.stats['commands_received'] / elapsed
             print(f"  Rate: {rate:.1f} cmd/s")
+        if self.trace:
+            t = self.trace.stats()
+            print(f"  Trace events: {t['exported']} exported, {t['lost']} lost, "
+                  f"{t['overruns']} stalls (ring peak {t['max_occupancy']})")
 
     def close(self):
         """Clean up resources."""
+        if self.trace_writer:
+            self.trace_writer.close()
+        if self.host_spans:
+            self.host_spans.close()
+        if hasattr(self, 'ifr_archive'):
+            self.ifr_archive.close()
         if hasattr(self, 'shm') and self.shm:
             self.shm.close()
         if hasattr(self, 'fd') and self.fd:
@@ -365,6 +615,49 @@ def main():
         action="store_true",
         help="Create shared memory file if it doesn't exist"
     )
+    parser.add_argument(
+        "--trace", "-t",
+        default=None,
+        help="Stream flight recorder events to this file"
+    )
+    parser.add_argument(
+        "--trace-max-mb",
+        type=int,
+        default=64,
+        help="Rotate the trace file at this size in MB (default: 64)"
+    )
+    parser.add_argument(
+        "--submit-job",
+        action="append",
+        default=[],
+        metavar="SPEC",
+        help="Submit the job graph in this JSON file (see bridge/jobs.py); repeatable"
+    )
+    parser.add_argument(
+        "--hugepages",
+        action="store_true",
+        help="Huge pages for the region (a hugetlbfs --shm file, else transparent ones)"
+    )
+    parser.add_argument(
+        "--prefault",
+        action="store_true",
+        help="Fault in and mlock the whole region at startup"
+    )
+    numa = parser.add_mutually_exclusive_group()
+    numa.add_argument(
+        "--numa-cpu",
+        type=int,
+        default=None,
+        metavar="CPU",
+        help="Bind the region to CPU's NUMA node and poll from it (e.g. a QEMU vCPU's host CPU)"
+    )
+    numa.add_argument(
+        "--numa-thread",
+        type=int,
+        default=None,
+        metavar="TID",
+        help="The same, for the node thread TID (e.g. a QEMU vCPU thread) runs on"
+    )
     parser.add_argument(
         "--poll-interval", "-p",
         type=float,
@@ -373,15 +666,28 @@ def main():
     )
 
     args = parser.parse_args()
+    numa_cpu = args.numa_cpu
+    if args.numa_thread is not None:
+        numa_cpu = shmplace.thread_cpu(args.numa_thread)
+        if numa_cpu is None:
+            print(f"[BRIDGE] Error: no such thread: {args.numa_thread}")
+            sys.exit(1)
 
     # Import handlers here to avoid circular import
     from .handlers import register_all_handlers
+    from .jobs import load_spec
 
     try:
         bridge = ZenedgeBridge(
             shm_path=args.shm,
             model_dir=args.models,
-            create=args.create
+            create=args.create,
+            trace_path=args.trace,
+            trace_max_bytes=args.trace_max_mb << 20,
+            jobs=[load_spec(path) for path in args.submit_job],
+            hugepages=args.hugepages,
+            prefault=args.prefault,
+            numa_cpu=numa_cpu
         )
 
         # Register command handlers
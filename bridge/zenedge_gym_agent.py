@@ -2,6 +2,16 @@
 """
 ZENEDGE Gym Agent - Connects OpenAI Gym to ZENEDGE Kernel
 Serves as a "Body" (Peripheral) for the Kernel "Brain".
+
+With --native, an environment that has a native plugin
+(tools/bridge/envs/<name>.so) is served by the C bridge instead, which
+steps it straight off the stream rings; the rest stay here.
+
+Against a GYM_BENCH kernel, --seed fixes the environments, --blob keeps
+the loop on CMD_ENV_STEP blobs even when the stream rings are up, and
+--bench-out saves the run (bridge/gym_bench.py) before the agent exits.
+--record saves every reset and step for the C bridge to replay
+(bridge/replay.py).
 """
 
 import sys
@@ -9,6 +19,7 @@ import gym
 import time
 import struct
 import argparse
+import os
 from pathlib import Path
 
 import traceback
@@ -25,36 +36,65 @@ from bridge.protocol import (
     RSP_OK,
     RSP_ERROR,
     DTYPE_FLOAT32,
+    CMD_AGENT_LOAD,
+    CMD_WASM_PROFILE,
     CMD_ENV_RESET,
     CMD_ENV_STEP,
+    CMD_ENV_BENCH,
     CMD_IFR_PERSIST,
     CMD_ARB_EPISODE,
     CMD_TELEMETRY_POLL,
+    BLOB_TYPE_RAW,
     BLOB_TYPE_TENSOR,
+    BLOB_FLAG_CSUM_NONE,
     ENV_RESET_FLAG_STREAM,
+    ENV_RESET_FLAG_PIPELINE,
+    env_reset_envs,
+    env_pipeline_groups,
+    IPC_BULK_MODEL_BASE,
     env_step_unpack,
 )
 from bridge.handlers import register_all_handlers # Optional base handlers
 from bridge.stream import StreamRings
 from bridge.ifr import parse_ifr_blob
 from bridge.arbiter import query_next_profile, verify_ifr_archive
+from bridge.gym_bench import BenchRecorder
+from bridge.replay import ReplayRecorder
 
 OBS_STRUCT_FMT = "4ffff"  # 7 floats: obs[4], reward, done, model_id
+NATIVE_BRIDGE_DIR = Path(__file__).parent.parent / "tools" / "bridge"
 OBS_POOL_SIZE = 8
 
 class GymHandler:
-    def __init__(self, bridge, env_name="CartPole-v1"):
+    def __init__(self, bridge, env_name="CartPole-v1", channel=0, agent_path=None,
+                 seed=None, blob_only=False, bench_out=None, record=None):
         self.env = gym.make(env_name)
         self.env_name = env_name
         self.obs = None
         self.bridge = bridge
+        self.channel = channel        # Stream channel (0 = legacy obs/act rings)
+        self.agent_path = agent_path  # WASM agent served on CMD_AGENT_LOAD
+        self.agent_blob_id = 0
         self.model_blob_id = 0
         self.baseline_model_id = 0
+        self.obs_pool = None          # Shared heap slab pool, when the heap has them
         self.obs_pool_ids = []
         self.free_obs_ids = []
         self.in_flight = set()
-        self.stream = StreamRings(bridge.shm)
+        self.stream = StreamRings(bridge.shm, bridge.ring_layout, bridge.shm_layout,
+                                  self.channel)
         self.streaming = False
+        self.envs = [self.env]        # Vector mode steps envs[:num_envs]
+        self.num_envs = 1
+        self.groups = [(0, 1)]        # (first env, count) stepped in turn
+        self.group = 0                # Group whose actions come next
+        self.pending_actions = []     # Actions of a partly popped group
+        self.seed = seed              # envs[i] is seeded seed + i at its first reset
+        self.seeded = set()
+        self.blob_only = blob_only    # Never answer a reset with streaming
+        self.bench = BenchRecorder("python", env_name, seed, bench_out)
+        self.recorder = ReplayRecorder(record, int(np.prod(self.env.observation_space.shape)),
+                                       env_name) if record else None
         print(f"[GYM] Initialized environment: {env_name}")
         # Model upload deferred to first reset to allow heap init
 
@@ -74,12 +114,16 @@ class GymHandler:
     def _set_model_weights(self, weights: np.ndarray) -> int:
         """Upload weights into a fresh blob and swap the active model."""
         blob_id = self.bridge.heap.allocate_blob(weights.nbytes, blob_type=BLOB_TYPE_TENSOR)
+        if blob_id:
+            self.bridge.heap.write_blob_data(blob_id, weights.tobytes())
+        elif self.bridge.bulk is not None:
+            # Too big for the heap: stream it into kernel pages instead
+            blob_id = self.bridge.bulk.upload_blocking(weights.tobytes()) or 0
         if not blob_id:
             print("[GYM] Error: Failed to upload model (heap full or not init?)")
             return 0
 
-        self.bridge.heap.write_blob_data(blob_id, weights.tobytes())
-        if self.model_blob_id:
+        if self.model_blob_id and self.model_blob_id < IPC_BULK_MODEL_BASE:
             self.bridge.heap.free_blob(self.model_blob_id)
         self.model_blob_id = blob_id
         if not self.baseline_model_id:
@@ -89,12 +133,26 @@ class GymHandler:
 
     def _init_obs_pool(self):
         """Allocate a fixed pool of obs blobs to avoid per-step allocations."""
+        obs_size = struct.calcsize(OBS_STRUCT_FMT)
+        heap = self.bridge.heap
+        # Blobs still in flight from the last episode go back to the pool
+        if self.obs_pool is not None:
+            for blob_id in self.in_flight:
+                heap.free_blob(blob_id)
+            self.in_flight.clear()
+        self.obs_pool = heap.pool_find(obs_size)
+        if self.obs_pool is None:
+            # Rewritten every step and read straight back: skip the checksum
+            self.obs_pool = heap.pool_create(obs_size, OBS_POOL_SIZE, BLOB_TYPE_TENSOR,
+                                             BLOB_FLAG_CSUM_NONE)
+        if self.obs_pool is not None:
+            return
+
         if self.obs_pool_ids:
             self.free_obs_ids = self.obs_pool_ids.copy()
             self.in_flight.clear()
             return
 
-        obs_size = struct.calcsize(OBS_STRUCT_FMT)
         for _ in range(OBS_POOL_SIZE):
             blob_id = self.bridge.heap.allocate_blob(obs_size, blob_type=BLOB_TYPE_TENSOR)
             if not blob_id:
@@ -111,9 +169,21 @@ class GymHandler:
     def _release_obs_blob(self, blob_id):
         if blob_id and blob_id in self.in_flight:
             self.in_flight.remove(blob_id)
-            self.free_obs_ids.append(blob_id)
+            if self.obs_pool is not None:
+                self.bridge.heap.free_blob(blob_id)
+            else:
+                self.free_obs_ids.append(blob_id)
 
     def _claim_obs_blob(self):
+        if self.obs_pool is not None:
+            blob_id = self.bridge.heap.pool_alloc(self.obs_pool)
+            if blob_id:
+                self.in_flight.add(blob_id)
+                return blob_id
+            if self.in_flight:
+                blob_id = next(iter(self.in_flight))
+                print(f"[GYM] Warn: Obs pool exhausted, reusing blob {blob_id}")
+            return blob_id
         if self.free_obs_ids:
             blob_id = self.free_obs_ids.pop(0)
             self.in_flight.add(blob_id)
@@ -140,7 +210,7 @@ class GymHandler:
         data = struct.pack(OBS_STRUCT_FMT, *obs, float(reward), float(done), model_id_f)
 
         blob_id = self._claim_obs_blob()
-        if not blob_id and not self.obs_pool_ids:
+        if not blob_id and not self.obs_pool_ids and self.obs_pool is None:
             blob_id = self.bridge.heap.allocate_blob(len(data), blob_type=BLOB_TYPE_TENSOR)
 
         if blob_id:
@@ -148,41 +218,71 @@ class GymHandler:
             return blob_id
         return 0
 
+    def _env_reset(self, i):
+        """Reset envs[i]; the first reset of each takes the fixed seed."""
+        t0 = time.monotonic_ns()
+        if self.seed is not None and i not in self.seeded:
+            self.seeded.add(i)
+            obs, info = self.envs[i].reset(seed=self.seed + i)
+        else:
+            obs, info = self.envs[i].reset()
+        if self.recorder:
+            self.recorder.reset(i, t0, np.ravel(obs))
+        return obs, info
+
+    def _env_step(self, i, action):
+        """Step envs[i]: (obs, reward, done as 0.0/1.0)."""
+        t0 = time.monotonic_ns()
+        obs, reward, terminated, truncated, _info = self.envs[i].step(action)
+        done = 1.0 if (terminated or truncated) else 0.0
+        if self.recorder:
+            self.recorder.step(i, t0, action, np.ravel(obs), reward, bool(done))
+        return obs, reward, done
+
     def handle_reset(self, bridge, packet):
         print(f"[GYM] Resetting environment...")
         self._upload_model()
-        self.streaming = self.stream.ready() and (packet.payload_id & ENV_RESET_FLAG_STREAM)
+        # The kernel may have re-laid out shared memory since we attached
+        self.stream = StreamRings(bridge.shm, bridge.ring_layout, bridge.shm_layout,
+                                  self.channel)
+        self.streaming = (not self.blob_only and self.stream.ready()
+                          and (packet.payload_id & ENV_RESET_FLAG_STREAM)
+                          and self.stream.obs_dim == int(np.prod(self.env.observation_space.shape)))
         if not self.streaming:
             self._init_obs_pool()
             self.free_obs_ids = self.obs_pool_ids.copy()
             self.in_flight.clear()
-        self.obs, info = self.env.reset()
+        self.num_envs = env_reset_envs(int(packet.payload_id)) if self.streaming else 1
+        self.groups = env_pipeline_groups(self.num_envs,
+                                          bool(packet.payload_id & ENV_RESET_FLAG_PIPELINE))
+        self.group = 0
+        if self.num_envs > 1:
+            return self._reset_vector()
+        self.obs, info = self._env_reset(0)
         if self.streaming:
-            seq = 0
-            obs_entry = (
-                seq,
-                float(self.obs[0]), float(self.obs[1]),
-                float(self.obs[2]), float(self.obs[3]),
-                0.0, 0.0, float(self.model_blob_id),
-            )
+            obs_entry = self._obs_entry(0, self.obs)
             while not self.stream.obs_ring.push(obs_entry):
                 time.sleep(0.0005)
+            self.bench.published()
+            self.stream.obs_ring.publish_clock()  # Sync point: the response follows
             return RSP_OK, 0
         else:
             blob_id = self.pack_step_data(self.obs)
+            self.bench.published()
             return RSP_OK, blob_id
 
     def handle_step(self, bridge, packet):
         if self.streaming:
             print("[GYM] Warning: CMD_ENV_STEP received while streaming (ignored)")
             return RSP_ERROR, 0
+        self.bench.consumed()
         action, ack_blob_id = env_step_unpack(int(packet.payload_id))
         self._release_obs_blob(ack_blob_id)
         try:
-            self.obs, reward, terminated, truncated, info = self.env.step(action)
-            done = 1.0 if (terminated or truncated) else 0.0
+            self.obs, reward, done = self._env_step(0, action)
             blob_id = self.pack_step_data(self.obs, reward, done)
             if blob_id:
+                self.bench.published()  # The reply goes out as we return
                 return RSP_OK, blob_id
             return RSP_ERROR, 0
         except Exception as e:
@@ -190,12 +290,42 @@ class GymHandler:
             traceback.print_exc()
             return RSP_ERROR, 0
 
+    def handle_agent_load(self, bridge, packet):
+        """Hand ZENEDGE the WASM agent to precompile (result 0 = use its own)."""
+        if not self.agent_path:
+            return RSP_OK, 0
+        try:
+            code = Path(self.agent_path).read_bytes()
+        except OSError as e:
+            print(f"[GYM] Agent load failed: {e}")
+            return RSP_ERROR, 0
+        if self.agent_blob_id:
+            bridge.heap.free_blob(self.agent_blob_id)
+        # ZENEDGE copies the bytes out; the blob lives until the next load
+        self.agent_blob_id = bridge.heap.allocate_blob(len(code), blob_type=BLOB_TYPE_RAW)
+        if not self.agent_blob_id:
+            print("[GYM] Agent load failed: heap full")
+            return RSP_ERROR, 0
+        bridge.heap.write_blob_data(self.agent_blob_id, code)
+        print(f"[GYM] Serving agent {self.agent_path} ({len(code)} bytes) "
+              f"as blob {self.agent_blob_id}")
+        return RSP_OK, self.agent_blob_id
+
+    def handle_env_bench(self, bridge, packet):
+        """GYM_BENCH window start, or the kernel's figures at its end."""
+        if not self.bench.command(packet.inline or b""):
+            print("[GYM] ENV_BENCH: invalid payload")
+            return RSP_ERROR, 0
+        return RSP_OK, 0
+
     def handle_arb_episode(self, bridge, packet):
-        if packet.payload_id == 0:
+        if packet.inline:
+            data = packet.inline
+        elif packet.payload_id == 0:
             print("[GYM] ARB_EPISODE: missing payload")
             return RSP_ERROR, 0
-
-        data = bridge.heap.read_blob_data(packet.payload_id)
+        else:
+            data = bridge.heap.read_blob_data(packet.payload_id)
         rec = parse_ifr_blob(data)
         if not rec or not rec.get("hash_ok"):
             print("[GYM] ARB_EPISODE: invalid IFR")
@@ -219,67 +349,175 @@ class GymHandler:
         packed = ((decision_code & 0xFFFF) << 16) | (recommended_model_id & 0xFFFF)
         print(f"[GYM] ARB_EPISODE decision={decision_code} model={recommended_model_id} reason={reason}")
         return RSP_OK, packed
+    def _obs_entry(self, seq, obs, reward=0.0, done=0.0):
+        return (seq, *(float(x) for x in np.ravel(obs)),
+                float(reward), float(done), float(self.model_blob_id),
+                time.monotonic_ns() & 0xFFFFFFFF)
+
+    def _push_batch(self, entries):
+        """Publish a whole batch; push_many moves it with one head update."""
+        while entries:
+            pushed = self.stream.obs_ring.push_many(entries)
+            entries = entries[pushed:]
+            if entries:
+                time.sleep(0.0005)
+
+    def _reset_vector(self):
+        """Start num_envs environments and publish the first batch."""
+        if self.num_envs > self.stream.obs_ring.size:
+            print(f"[GYM] Error: {self.num_envs} envs exceed the obs ring "
+                  f"({self.stream.obs_ring.size} entries)")
+            return RSP_ERROR, 0
+        while len(self.envs) < self.num_envs:
+            self.envs.append(gym.make(self.env_name))
+        self.pending_actions = []
+        batch = []
+        for i in range(self.num_envs):
+            obs, _info = self._env_reset(i)
+            batch.append(self._obs_entry(0, obs))
+        self._push_batch(batch)
+        for g in range(len(self.groups)):
+            self.bench.published(g)
+        print(f"[GYM] Vector mode: {self.num_envs} envs per batch"
+              + (f", pipelined in {len(self.groups)} groups" if len(self.groups) > 1 else ""))
+        self.stream.obs_ring.publish_clock()  # Sync point: the response follows
+        return RSP_OK, 0
+
+    def _process_vector_step(self) -> bool:
+        """Step a group's envs once all its actions are in (the group is the
+        whole vector unless the kernel pipelines)."""
+        first, count = self.groups[self.group]
+        want = count - len(self.pending_actions)
+        got = self.stream.act_ring.pop_many(want)
+        if not got:
+            return False
+        self.pending_actions.extend(got)
+        if len(self.pending_actions) < count:
+            return True
+        self.bench.consumed(count, self.group)
+
+        batch = []
+        group = self.group
+        self.group = (self.group + 1) % len(self.groups)
+        try:
+            for i, (seq, action, _flags, _ack_seq, _ts) in enumerate(self.pending_actions, first):
+                obs, reward, done = self._env_step(i, int(action))
+                if done:
+                    obs, _info = self._env_reset(i)  # Auto-reset; the entry still reports done
+                batch.append(self._obs_entry(seq + 1, obs, reward, done))
+        except Exception as e:
+            print(f"[GYM] Vector Step Error: {e}")
+            traceback.print_exc()
+            return False
+        finally:
+            self.pending_actions = []
+        self._push_batch(batch)
+        self.bench.published(group)
+        return True
+
     def process_stream_step(self) -> bool:
         if not self.streaming:
             return False
+        if self.num_envs > 1:
+            return self._process_vector_step()
 
         entry = self.stream.act_ring.pop()
         if entry is None:
             return False
 
-        seq, action, _flags, _ack_seq, _reserved = entry
+        seq, action, _flags, _ack_seq, _ts = entry
+        self.bench.consumed()
         try:
-            self.obs, reward, terminated, truncated, info = self.env.step(int(action))
-            done = 1.0 if (terminated or truncated) else 0.0
-            obs_seq = seq + 1
-            obs_entry = (
-                obs_seq,
-                float(self.obs[0]), float(self.obs[1]),
-                float(self.obs[2]), float(self.obs[3]),
-                float(reward), float(done), float(self.model_blob_id),
-            )
+            self.obs, reward, done = self._env_step(0, int(action))
+            obs_entry = self._obs_entry(seq + 1, self.obs, reward, done)
             while not self.stream.obs_ring.push(obs_entry):
                 time.sleep(0.0005)
+            self.bench.published()
             return True
         except Exception as e:
             print(f"[GYM] Stream Step Error: {e}")
             traceback.print_exc()
             return False
 
+def native_plugin(env_name):
+    """The C bridge's plugin for env_name ("CartPole-v1" -> envs/cartpole.so), if built."""
+    plugin = NATIVE_BRIDGE_DIR / "envs" / (env_name.split("-v")[0].lower() + ".so")
+    return plugin if plugin.exists() and (NATIVE_BRIDGE_DIR / "bridge").exists() else None
+
+
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument("--env", default="CartPole-v1")
     parser.add_argument("--shm", default="/dev/shm/zenedge.shm")
+    parser.add_argument("--channel", type=int, default=0,
+                        help="stream channel to serve (see the channel table)")
+    parser.add_argument("--agent", default=None,
+                        help="WASM agent for ZENEDGE to precompile at boot")
+    parser.add_argument("--native", action="store_true",
+                        help="hand the env to the C bridge if it has a native plugin")
+    parser.add_argument("--seed", type=int, default=None,
+                        help="seed env i with seed + i at its first reset")
+    parser.add_argument("--blob", action="store_true",
+                        help="serve CMD_ENV_STEP blobs even when the stream rings are up")
+    parser.add_argument("--bench-out", default=None,
+                        help="save a GYM_BENCH kernel's run here, then exit")
+    parser.add_argument("--record", default=None,
+                        help="record every reset and step here for replay (bridge/replay.py)")
     args = parser.parse_args()
 
+    plugin = native_plugin(args.env) if args.native and not args.blob else None
+    if plugin:
+        bridge_bin = str(NATIVE_BRIDGE_DIR / "bridge")
+        print(f"[GYM] {args.env}: native plugin {plugin}, starting the C bridge")
+        argv = [bridge_bin, "--file", args.shm, "--env", str(plugin),
+                "--channel", str(args.channel)]
+        if args.seed is not None:
+            argv += ["--env-args", str(args.seed)]
+        if args.bench_out:
+            argv += ["--bench-out", args.bench_out]
+        if args.record:
+            argv += ["--record", args.record]
+        os.execv(bridge_bin, argv)
+    if args.native:
+        print(f"[GYM] {args.env}: no native plugin, serving it from Python")
+
     try:
         bridge = ZenedgeBridge(shm_path=args.shm, create=True)
     except Exception as e:
         print(f"Failed to load bridge: {e}")
         return
 
-    gym_handler = GymHandler(bridge, args.env)
+    gym_handler = GymHandler(bridge, args.env, args.channel, args.agent,
+                             args.seed, args.blob, args.bench_out, args.record)
     verify_ifr_archive()
 
+    bridge.register_handler(CMD_AGENT_LOAD, gym_handler.handle_agent_load)
     bridge.register_handler(CMD_ENV_RESET, gym_handler.handle_reset)
     bridge.register_handler(CMD_ENV_STEP, gym_handler.handle_step)
+    bridge.register_handler(CMD_ENV_BENCH, gym_handler.handle_env_bench)
     bridge.register_handler(CMD_ARB_EPISODE, gym_handler.handle_arb_episode)
     
-    from bridge.handlers import handle_ping, handle_print, handle_ifr_persist, handle_telemetry_poll
+    from bridge.handlers import handle_ping, handle_print, handle_ifr_persist, handle_telemetry_poll, handle_wasm_profile
     bridge.register_handler(0x0001, handle_ping)
     bridge.register_handler(0x0002, handle_print)
     bridge.register_handler(CMD_IFR_PERSIST, handle_ifr_persist)
     bridge.register_handler(CMD_TELEMETRY_POLL, handle_telemetry_poll)
+    bridge.register_handler(CMD_WASM_PROFILE, handle_wasm_profile)
 
     print("[GYM] Bridge running. Waiting for Kernel commands...")
     try:
-        while True:
+        while not gym_handler.bench.finished:
             did_cmd = bridge.run_once()
             did_stream = gym_handler.process_stream_step()
             if not did_cmd and not did_stream:
                 time.sleep(0.0005)
     except KeyboardInterrupt:
         print("\n[GYM] Interrupted by user")
+    finally:
+        if gym_handler.recorder:
+            gym_handler.recorder.close()
+            print(f"[GYM] Recorded {gym_handler.recorder.records} resets and steps "
+                  f"to {gym_handler.recorder.path}")
 
 if __name__ == "__main__":
     main()
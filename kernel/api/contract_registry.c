@@ -1,31 +1,293 @@
-/* kernel/api/contract_registry.c */
+/* kernel/api/contract_registry.c - Contracts by job id, and their charges
+ *
+ * Registered contracts keep an entry index for as long as they stay
+ * registered; an open-addressed table (linear probing, never more than
+ * half full) maps job_id to it. Lookups take no lock: writers bump
+ * table_seq to odd and back around each change, readers retry if it moved.
+ *
+ * Charges to a registered contract add to this CPU's counter for it (no
+ * two CPUs' counters share a cache line) while the counter stays within
+ * the CPU's share of the headroom the last fold left. The shares add up
+ * to at most the headroom, so no budget is crossed unseen: a charge that
+ * would overrun its share folds every CPU's counters into the contract
+ * under the entry's lock and is judged on the exact total. Once a
+ * contract is at its budget the shares are 0 and each charge is judged
+ * on its own, as without the counters. contract_fold_all() folds what is
+ * left once a second.
+ *
+ * Charges stop before contract_unregister(): an entry index is reused.
+ */
 #include "../contracts.h"
+#include "../arch/idt.h"
+#include "../arch/percpu.h"
 
 #define CONTRACT_REGISTRY_MAX 64
-static task_contract_t *contract_registry[CONTRACT_REGISTRY_MAX];
-static uint32_t contract_registry_count = 0;
+#define CONTRACT_TABLE_BITS   7             /* 2 * CONTRACT_REGISTRY_MAX slots */
+#define CONTRACT_TABLE        (1u << CONTRACT_TABLE_BITS)
+
+#if defined(__x86_64__)
+#define CHARGE_CPUS SMP_MAX_CPUS
+#else
+#define CHARGE_CPUS 1                       /* i386 is uniprocessor */
+#endif
+
+typedef struct {
+    task_contract_t *contract;              /* NULL = free */
+    uint32_t job_id;                        /* Copied: probes never follow contract */
+    uint32_t slack[CONTRACT_CHARGE_KINDS];  /* Each CPU's share of the headroom */
+    volatile uint8_t lock;
+} contract_entry_t;
+
+typedef struct {
+    uint32_t v[CONTRACT_CHARGE_KINDS];
+} contract_pending_t;
+
+static contract_entry_t entries[CONTRACT_REGISTRY_MAX];
+static uint8_t table[CONTRACT_TABLE];       /* Entry index + 1, 0 = empty */
+static volatile uint32_t table_seq;
+static volatile uint8_t table_lock;
+
+/* One row per CPU: 512 bytes, so rows never share a line */
+static contract_pending_t pending[CHARGE_CPUS][CONTRACT_REGISTRY_MAX]
+    __attribute__((aligned(64)));
+
+static int lock(volatile uint8_t *l) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    while (__atomic_test_and_set(l, __ATOMIC_ACQUIRE))
+        __asm__ __volatile__("pause");
+    return was;
+}
+
+static void unlock(volatile uint8_t *l, int was) {
+    __atomic_clear(l, __ATOMIC_RELEASE);
+    if (was)
+        interrupts_enable();
+}
+
+static uint32_t home(uint32_t job_id) {
+    return (job_id * 2654435761u) >> (32 - CONTRACT_TABLE_BITS);
+}
+
+/* Helper: table slot holding job_id, or the empty slot ending its probe */
+static uint32_t probe(uint32_t job_id) {
+    uint32_t h = home(job_id);
+    for (uint32_t n = 0; n < CONTRACT_TABLE; n++, h = (h + 1) & (CONTRACT_TABLE - 1)) {
+        uint8_t t = table[h];
+        if (!t || entries[t - 1].job_id == job_id)
+            break;
+    }
+    return h;
+}
+
+/* Helper: entry index of job_id, or -1 (no lock: retries over changes) */
+static int index_of(uint32_t job_id) {
+    uint32_t seq;
+    int idx;
+    do {
+        while ((seq = __atomic_load_n(&table_seq, __ATOMIC_ACQUIRE)) & 1)
+            __asm__ __volatile__("pause");
+        uint8_t t = table[probe(job_id)];
+        idx = (int)t - 1;
+    } while (__atomic_load_n(&table_seq, __ATOMIC_ACQUIRE) != seq);
+    return idx;
+}
+
+/* Helper: table_lock held; remove slot h, shifting later probes back */
+static void table_remove(uint32_t h) {
+    uint32_t hole = h;
+    for (uint32_t j = (h + 1) & (CONTRACT_TABLE - 1); table[j];
+         j = (j + 1) & (CONTRACT_TABLE - 1)) {
+        uint32_t want = home(entries[table[j] - 1].job_id);
+        /* Move j into the hole if its home is not between hole and j */
+        if (((j - want) & (CONTRACT_TABLE - 1)) >= ((j - hole) & (CONTRACT_TABLE - 1))) {
+            table[hole] = table[j];
+            hole = j;
+        }
+    }
+    table[hole] = 0;
+}
+
+/* Helper: each CPU's share of what is left of c's budgets */
+static void set_slack(contract_entry_t *e) {
+    const task_contract_t *c = e->contract;
+    uint32_t cpu = c->cpu_budget_us > c->cpu_used_us ? c->cpu_budget_us - c->cpu_used_us : 0;
+    uint32_t mem = c->memory_kb > c->mem_used_kb ? c->memory_kb - c->mem_used_kb : 0;
+    __atomic_store_n(&e->slack[CONTRACT_CHARGE_CPU], cpu / CHARGE_CPUS, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&e->slack[CONTRACT_CHARGE_MEM], mem / CHARGE_CPUS, __ATOMIC_SEQ_CST);
+}
+
+/* Helper: entry lock held; move every CPU's counters into the contract,
+ * with extra more of kind, and judge what changed
+ * Returns: bit (1 << kind) set for each kind over budget
+ */
+static int fold(uint32_t i, uint32_t kind, uint32_t extra) {
+    contract_entry_t *e = &entries[i];
+    uint32_t sum[CONTRACT_CHARGE_KINDS] = {0};
+
+    /* Shares to 0 first: a charge racing with us then comes here too */
+    for (uint32_t k = 0; k < CONTRACT_CHARGE_KINDS; k++)
+        __atomic_store_n(&e->slack[k], 0, __ATOMIC_SEQ_CST);
+    for (uint32_t cpu = 0; cpu < CHARGE_CPUS; cpu++)
+        for (uint32_t k = 0; k < CONTRACT_CHARGE_KINDS; k++)
+            sum[k] += __atomic_exchange_n(&pending[cpu][i].v[k], 0, __ATOMIC_SEQ_CST);
+    if (kind < CONTRACT_CHARGE_KINDS)
+        sum[kind] += extra;
+
+    int over = 0;
+    for (uint32_t k = 0; k < CONTRACT_CHARGE_KINDS; k++)
+        if (sum[k])
+            over |= contract_judge(e->contract, (contract_charge_t)k, sum[k]) << k;
+    set_slack(e);
+    return over;
+}
 
 void contract_register(task_contract_t *c) {
     if (!c)
         return;
 
-    for (uint32_t i = 0; i < contract_registry_count; i++) {
-        if (contract_registry[i] && contract_registry[i]->job_id == c->job_id) {
-            contract_registry[i] = c;
-            return;
-        }
+    int was = lock(&table_lock);
+    __atomic_add_fetch(&table_seq, 1, __ATOMIC_RELEASE);
+    uint32_t h = probe(c->job_id);
+    int idx = (int)table[h] - 1;
+    if (idx < 0) {
+        for (uint32_t i = 0; i < CONTRACT_REGISTRY_MAX && idx < 0; i++)
+            if (!entries[i].contract)
+                idx = (int)i;
+        if (idx >= 0)
+            table[h] = (uint8_t)(idx + 1);
+    }
+    if (idx >= 0) {
+        /* A re-registered job starts over: drop the old contract's charges */
+        for (uint32_t cpu = 0; cpu < CHARGE_CPUS; cpu++)
+            for (uint32_t k = 0; k < CONTRACT_CHARGE_KINDS; k++)
+                __atomic_store_n(&pending[cpu][idx].v[k], 0, __ATOMIC_SEQ_CST);
+        entries[idx].contract = c;
+        entries[idx].job_id = c->job_id;
+        set_slack(&entries[idx]);
     }
+    __atomic_add_fetch(&table_seq, 1, __ATOMIC_RELEASE);
+    unlock(&table_lock, was);
+}
+
+void contract_unregister(uint32_t job_id) {
+    int was = lock(&table_lock);
+    uint32_t h = probe(job_id);
+    int idx = (int)table[h] - 1;
+    if (idx >= 0) {
+        int ewas = lock(&entries[idx].lock);
+        fold((uint32_t)idx, CONTRACT_CHARGE_KINDS, 0);
+        unlock(&entries[idx].lock, ewas);
 
-    if (contract_registry_count < CONTRACT_REGISTRY_MAX) {
-        contract_registry[contract_registry_count++] = c;
+        __atomic_add_fetch(&table_seq, 1, __ATOMIC_RELEASE);
+        table_remove(h);
+        entries[idx].contract = NULL;
+        __atomic_add_fetch(&table_seq, 1, __ATOMIC_RELEASE);
     }
+    unlock(&table_lock, was);
 }
 
 const task_contract_t *contract_lookup(uint32_t job_id) {
-    for (uint32_t i = 0; i < contract_registry_count; i++) {
-        const task_contract_t *c = contract_registry[i];
-        if (c && c->job_id == job_id)
-            return c;
+    int idx = index_of(job_id);
+    return idx >= 0 ? entries[idx].contract : NULL;
+}
+
+/* Helper: c's entry index if c itself is registered, or -1 */
+static int index_of_contract(const task_contract_t *c) {
+    int idx = index_of(c->job_id);
+    return (idx >= 0 && entries[idx].contract == c) ? idx : -1;
+}
+
+int contract_charge(task_contract_t *c, contract_charge_t kind, uint32_t amount) {
+    int idx = index_of_contract(c);
+    if (idx < 0)
+        return contract_judge(c, kind, amount); /* Unregistered: judged at once */
+
+    contract_entry_t *e = &entries[idx];
+    uint32_t *p = &pending[smp_cpu_id()][idx].v[kind];
+    if (amount <= __atomic_load_n(&e->slack[kind], __ATOMIC_SEQ_CST)) {
+        uint32_t now = __atomic_add_fetch(p, amount, __ATOMIC_SEQ_CST);
+        if (now <= __atomic_load_n(&e->slack[kind], __ATOMIC_SEQ_CST))
+            return 0; /* All CPUs together are still within the budget */
+        amount = 0;   /* Counted: the fold picks it up */
+    }
+
+    int was = lock(&e->lock);
+    int over = fold((uint32_t)idx, kind, amount);
+    unlock(&e->lock, was);
+    return (over >> kind) & 1;
+}
+
+void contract_credit_memory(task_contract_t *c, uint32_t kb) {
+    int idx = index_of_contract(c);
+    int was = 0;
+    if (idx >= 0) {
+        was = lock(&entries[idx].lock);
+        fold((uint32_t)idx, CONTRACT_CHARGE_KINDS, 0);
+    }
+    c->mem_used_kb = c->mem_used_kb >= kb ? c->mem_used_kb - kb : 0;
+    if (idx >= 0) {
+        set_slack(&entries[idx]);
+        unlock(&entries[idx].lock, was);
+    }
+}
+
+void contract_fold(task_contract_t *c) {
+    int idx = index_of_contract(c);
+    if (idx < 0)
+        return;
+    int was = lock(&entries[idx].lock);
+    fold((uint32_t)idx, CONTRACT_CHARGE_KINDS, 0);
+    unlock(&entries[idx].lock, was);
+}
+
+void contract_fold_all(void) {
+    for (uint32_t i = 0; i < CONTRACT_REGISTRY_MAX; i++) {
+        if (!entries[i].contract)
+            continue;
+        int was = lock(&entries[i].lock);
+        if (entries[i].contract)
+            fold(i, CONTRACT_CHARGE_KINDS, 0);
+        unlock(&entries[i].lock, was);
+    }
+}
+
+uint32_t contract_used(const task_contract_t *c, contract_charge_t kind) {
+    uint32_t used = kind == CONTRACT_CHARGE_CPU ? c->cpu_used_us : c->mem_used_kb;
+    int idx = index_of_contract(c);
+    if (idx >= 0)
+        for (uint32_t cpu = 0; cpu < CHARGE_CPUS; cpu++)
+            used += __atomic_load_n(&pending[cpu][idx].v[kind], __ATOMIC_RELAXED);
+    return used;
+}
+
+uint32_t contract_snapshot(contract_usage_t *out, uint32_t max, uint32_t *registered) {
+    uint32_t n = 0, total = 0;
+    /* table_lock: no contract goes away while it is read */
+    int was = lock(&table_lock);
+    for (uint32_t i = 0; i < CONTRACT_REGISTRY_MAX; i++) {
+        const task_contract_t *c = entries[i].contract;
+        if (!c)
+            continue;
+        total++;
+        if (n == max)
+            continue;
+        contract_usage_t *u = &out[n++];
+        u->job_id = c->job_id;
+        u->state = c->state;
+        u->prio = c->prio;
+        u->cpu_used_us = c->cpu_used_us;
+        u->mem_used_kb = c->mem_used_kb;
+        for (uint32_t cpu = 0; cpu < CHARGE_CPUS; cpu++) {
+            u->cpu_used_us += __atomic_load_n(&pending[cpu][i].v[CONTRACT_CHARGE_CPU], __ATOMIC_RELAXED);
+            u->mem_used_kb += __atomic_load_n(&pending[cpu][i].v[CONTRACT_CHARGE_MEM], __ATOMIC_RELAXED);
+        }
+        u->cpu_budget_us = c->cpu_budget_us;
+        u->mem_budget_kb = c->memory_kb;
+        u->violations = c->cpu_violations + c->mem_violations;
     }
-    return NULL;
+    unlock(&table_lock, was);
+    if (registered)
+        *registered = total;
+    return n;
 }
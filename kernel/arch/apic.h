@@ -31,10 +31,44 @@
 /* Spurious Interrupt Vector Register Bits */
 #define APIC_SVR_ENABLE     0x100
 
+/* LVT Timer Register Bits */
+#define LAPIC_TIMER_MASKED       (1 << 16)
+#define LAPIC_TIMER_ONESHOT      (0 << 17)
+#define LAPIC_TIMER_PERIODIC     (1 << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2 << 17)
+#define LAPIC_TDCR_DIV16         0x3
+
+#define IA32_TSC_DEADLINE_MSR 0x6E0
+
+/* Vectors (above the remapped PIC range) */
+#define LAPIC_TIMER_VECTOR    0x40
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/* lapic_timer_mode() */
+#define LAPIC_TIMER_NONE      0   /* No APIC, or init not run */
+#define LAPIC_TIMER_COUNT     1   /* One-shot countdown, calibrated */
+#define LAPIC_TIMER_DEADLINE  2   /* TSC-deadline */
+
 void lapic_init(void);
+/* On an AP (smp.c): enable its own LAPIC, mapped by lapic_init() */
+void lapic_init_ap(void);
 void lapic_eoi(void);
 void lapic_write(uint32_t reg, uint32_t value);
 uint32_t lapic_read(uint32_t reg);
 uint32_t lapic_get_id(void);
 
+/* One-shot LAPIC timer on LAPIC_TIMER_VECTOR. Init calibrates the
+ * countdown against the TSC (time_usec()) and picks TSC-deadline mode
+ * when CPUID offers it; returns 0, or -1 (no APIC: keep the PIT tick).
+ * The timer starts disarmed.
+ */
+int lapic_timer_init(void);
+uint32_t lapic_timer_mode(void);
+/* Interrupt once at time_usec() == deadline_us (at once if that has
+ * passed); reprogramming replaces the previous deadline, 0 disarms.
+ */
+void lapic_timer_oneshot(uint64_t deadline_us);
+/* From the LAPIC_TIMER_VECTOR handler: EOI, and the deadline is spent */
+void lapic_timer_ack(void);
+
 #endif /* _ARCH_APIC_H */
@@ -0,0 +1,253 @@
+/* kernel/arch/fpu.c - FPU/SIMD enablement and lazy context switching */
+
+#include "fpu.h"
+#include "../console.h"
+#include "../include/string.h"
+#ifndef __x86_64__
+#include "idt.h"
+#include "../mm/vmm.h"
+#include "../sched/sched_core.h"
+#include "../zenedge_alloc.h"
+#endif
+
+#define FPU_VEC_NM 7  /* #NM: device not available */
+
+typedef enum { FPU_SAVE_FNSAVE, FPU_SAVE_FXSAVE, FPU_SAVE_XSAVE } fpu_save_t;
+
+static uint32_t g_features = 0;
+static fpu_save_t g_save = FPU_SAVE_FNSAVE;
+static uint64_t g_xcr0 = 0;
+static uint32_t g_state_size = 108;  /* FNSAVE */
+
+/* Clean state after fninit, copied into every new save area */
+static uint8_t g_init_state[PAGE_SIZE] __attribute__((aligned(64)));
+
+#ifndef __x86_64__
+static void fpu_nm_handler(interrupt_frame_t *frame);
+#endif
+
+static void cpuid(uint32_t leaf, uint32_t sub, uint32_t *a, uint32_t *b, uint32_t *c,
+                  uint32_t *d) {
+    __asm__ __volatile__("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(sub));
+}
+
+static inline uintptr_t read_cr0(void) {
+    uintptr_t v;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uintptr_t v) {
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(v));
+}
+
+static inline uintptr_t read_cr4(void) {
+    uintptr_t v;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uintptr_t v) {
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(v));
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t v) {
+    __asm__ __volatile__("xsetbv" : : "c"(reg), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)));
+}
+
+static void fpu_save(void *area) {
+    switch (g_save) {
+    case FPU_SAVE_XSAVE:
+        __asm__ __volatile__("xsave (%0)" : : "r"(area), "a"((uint32_t)g_xcr0),
+                             "d"((uint32_t)(g_xcr0 >> 32)) : "memory");
+        break;
+    case FPU_SAVE_FXSAVE:
+        __asm__ __volatile__("fxsave (%0)" : : "r"(area) : "memory");
+        break;
+    default:
+        __asm__ __volatile__("fnsave (%0); fwait" : : "r"(area) : "memory");
+        break;
+    }
+}
+
+static void fpu_restore(const void *area) {
+    switch (g_save) {
+    case FPU_SAVE_XSAVE:
+        __asm__ __volatile__("xrstor (%0)" : : "r"(area), "a"((uint32_t)g_xcr0),
+                             "d"((uint32_t)(g_xcr0 >> 32)) : "memory");
+        break;
+    case FPU_SAVE_FXSAVE:
+        __asm__ __volatile__("fxrstor (%0)" : : "r"(area) : "memory");
+        break;
+    default:
+        __asm__ __volatile__("frstor (%0)" : : "r"(area) : "memory");
+        break;
+    }
+}
+
+void fpu_init(void) {
+    uint32_t max, a, b, c, d;
+    uint32_t ecx1, edx1, ebx7 = 0, ecx7 = 0, eax71 = 0;
+
+    cpuid(0, 0, &max, &b, &c, &d);
+    cpuid(1, 0, &a, &b, &ecx1, &edx1);
+    if (max >= 7) {
+        uint32_t sub;
+        cpuid(7, 0, &sub, &ebx7, &ecx7, &d);
+        if (sub >= 1)
+            cpuid(7, 1, &eax71, &b, &c, &d);
+    }
+
+    /* x87 on, no emulation, #MF instead of IRQ13 */
+    write_cr0((read_cr0() & ~(uintptr_t)(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+
+    if (edx1 & (1u << 24)) {                 /* CPUID.1:EDX.FXSR */
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+        g_save = FPU_SAVE_FXSAVE;
+        g_state_size = 512;
+        if (edx1 & (1u << 26))               /* SSE2 */
+            g_features |= FPU_FEAT_SSE2;
+        if (ecx1 & (1u << 19))               /* SSE4.1 */
+            g_features |= FPU_FEAT_SSE41;
+        if (ebx7 & (1u << 29))               /* CPUID.7:EBX.SHA */
+            g_features |= FPU_FEAT_SHA;
+    }
+
+    if ((ecx1 & (1u << 26)) && max >= 0xD) { /* CPUID.1:ECX.XSAVE */
+        write_cr4(read_cr4() | CR4_OSXSAVE);
+
+        uint32_t supported;
+        cpuid(0xD, 0, &supported, &b, &c, &d);
+        g_xcr0 = XCR0_X87 | XCR0_SSE;
+        if ((ecx1 & (1u << 28)) && (supported & XCR0_AVX))
+            g_xcr0 |= XCR0_AVX;
+        if ((g_xcr0 & XCR0_AVX) && (ebx7 & (1u << 16)) &&
+            (supported & XCR0_AVX512) == XCR0_AVX512)
+            g_xcr0 |= XCR0_AVX512;
+        xsetbv(0, g_xcr0);
+
+        /* EBX: save area size for the components now enabled */
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        if (b > sizeof(g_init_state) && (g_xcr0 & XCR0_AVX512)) {
+            g_xcr0 &= ~(uint64_t)XCR0_AVX512;
+            xsetbv(0, g_xcr0);
+            cpuid(0xD, 0, &a, &b, &c, &d);
+        }
+        g_save = FPU_SAVE_XSAVE;
+        g_state_size = b;
+        g_features |= FPU_FEAT_XSAVE;
+
+        if (g_xcr0 & XCR0_AVX) {
+            g_features |= FPU_FEAT_AVX;
+            if (ebx7 & (1u << 5))
+                g_features |= FPU_FEAT_AVX2;
+            if (ecx1 & (1u << 12))
+                g_features |= FPU_FEAT_FMA;
+            if (eax71 & (1u << 4))           /* CPUID.(7,1):EAX.AVX-VNNI */
+                g_features |= FPU_FEAT_AVX_VNNI;
+            if (ecx1 & (1u << 29))           /* F16C */
+                g_features |= FPU_FEAT_F16C;
+        }
+        if (g_xcr0 & XCR0_AVX512) {
+            g_features |= FPU_FEAT_AVX512F;
+            if (ecx7 & (1u << 11))           /* CPUID.7:ECX.AVX512_VNNI */
+                g_features |= FPU_FEAT_AVX512_VNNI;
+            if (eax71 & (1u << 5))           /* CPUID.(7,1):EAX.AVX512_BF16 */
+                g_features |= FPU_FEAT_AVX512_BF16;
+        }
+    }
+
+    __asm__ __volatile__("fninit");
+    if (g_save != FPU_SAVE_FNSAVE) {
+        uint32_t mxcsr = 0x1F80;             /* All SSE exceptions masked */
+        __asm__ __volatile__("ldmxcsr %0" : : "m"(mxcsr));
+    }
+    memset(g_init_state, 0, sizeof(g_init_state));
+    fpu_save(g_init_state);
+    if (g_save == FPU_SAVE_FNSAVE)
+        fpu_restore(g_init_state);           /* fnsave reinitializes the FPU */
+
+#ifndef __x86_64__
+    idt_register_handler(FPU_VEC_NM, fpu_nm_handler);
+#endif
+
+    console_write("[fpu] ");
+    console_write(g_save == FPU_SAVE_XSAVE ? "xsave" :
+                  g_save == FPU_SAVE_FXSAVE ? "fxsave" : "fnsave");
+    console_write(" area=");
+    print_uint(g_state_size);
+    console_write("B");
+    if (g_features & FPU_FEAT_SSE2) console_write(" sse2");
+    if (g_features & FPU_FEAT_SSE41) console_write(" sse4.1");
+    if (g_features & FPU_FEAT_SHA) console_write(" sha");
+    if (g_features & FPU_FEAT_AVX) console_write(" avx");
+    if (g_features & FPU_FEAT_AVX2) console_write(" avx2");
+    if (g_features & FPU_FEAT_FMA) console_write(" fma");
+    if (g_features & FPU_FEAT_F16C) console_write(" f16c");
+    if (g_features & FPU_FEAT_AVX512F) console_write(" avx512f");
+    if (g_features & (FPU_FEAT_AVX_VNNI | FPU_FEAT_AVX512_VNNI)) console_write(" vnni");
+    if (g_features & FPU_FEAT_AVX512_BF16) console_write(" bf16");
+    console_write("\n");
+}
+
+uint32_t fpu_features(void) { return g_features; }
+
+uint32_t fpu_state_size(void) { return g_state_size; }
+
+#ifndef __x86_64__
+static process_t *g_owner = NULL;  /* Whose state is in the registers */
+
+static inline void clts(void) { __asm__ __volatile__("clts"); }
+
+static inline void stts(void) { write_cr0(read_cr0() | CR0_TS); }
+
+/* A page: XSAVE wants 64-byte alignment, and AVX-512 state is ~2.7KB */
+static void *fpu_area_alloc(void) {
+    zalloc_result_t r = zenedge_alloc_pages(1, ZNODE_ANY);
+    if (!r.addr)
+        return NULL;
+    void *area = (void *)phys_to_virt((paddr_t)r.addr);
+    memcpy(area, g_init_state, g_state_size);
+    return area;
+}
+
+void fpu_adopt(process_t *proc) {
+    if (!proc->fpu_state)
+        proc->fpu_state = fpu_area_alloc();
+    clts();
+    g_owner = proc;
+}
+
+void fpu_switch(process_t *next) {
+    if (next == g_owner)
+        clts();
+    else
+        stts();
+}
+
+/* #NM: the running process touched the FPU since it was switched in */
+static void fpu_nm_handler(interrupt_frame_t *frame) {
+    (void)frame;
+    clts();
+
+    process_t *cur = sched_current();
+    if (cur == g_owner)
+        return;
+    if (g_owner && g_owner->fpu_state)
+        fpu_save(g_owner->fpu_state);
+
+    if (cur && !cur->fpu_state)
+        cur->fpu_state = fpu_area_alloc();
+    fpu_restore(cur && cur->fpu_state ? cur->fpu_state : g_init_state);
+    g_owner = cur;
+}
+
+void fpu_release(process_t *proc) {
+    if (g_owner == proc)
+        g_owner = NULL;
+    if (proc->fpu_state) {
+        zenedge_free_pages((zphys_t)virt_to_phys((vaddr_t)proc->fpu_state), 1);
+        proc->fpu_state = NULL;
+    }
+}
+#endif
@@ -0,0 +1,66 @@
+/* kernel/arch/fpu.h - x87/SSE/AVX enablement and lazy FPU context switching
+ *
+ * fpu_init() turns on every vector extension the CPU has (CR0/CR4, and
+ * XCR0 through XSETBV where XSAVE exists) and records which ones are
+ * usable, for the dispatched kernels in lib/math.h.
+ *
+ * On i386 FPU state follows the scheduler lazily: a switch sets CR0.TS
+ * unless the next process already owns the registers, and the first
+ * x87/SSE/AVX instruction after that raises #NM, whose handler saves the
+ * owner's state (XSAVE, else FXSAVE) and loads the new process's.
+ * Processes that never touch the FPU never pay for a save.
+ */
+#ifndef _ARCH_FPU_H
+#define _ARCH_FPU_H
+
+#include <stdint.h>
+
+#include "../process.h"
+
+/* fpu_features(): usable = the CPU has it and the OS state is enabled */
+#define FPU_FEAT_SSE2        (1u << 0)
+#define FPU_FEAT_XSAVE       (1u << 1)
+#define FPU_FEAT_AVX         (1u << 2)
+#define FPU_FEAT_AVX2        (1u << 3)
+#define FPU_FEAT_FMA         (1u << 4)
+#define FPU_FEAT_AVX512F     (1u << 5)
+#define FPU_FEAT_SSE41       (1u << 6)
+#define FPU_FEAT_AVX_VNNI    (1u << 7)  /* VEX vpdpbusd (ymm) */
+#define FPU_FEAT_AVX512_VNNI (1u << 8)  /* EVEX vpdpbusd (zmm) */
+#define FPU_FEAT_F16C        (1u << 9)  /* vcvtph2ps / vcvtps2ph */
+#define FPU_FEAT_AVX512_BF16 (1u << 10) /* vcvtneps2bf16 */
+#define FPU_FEAT_SHA         (1u << 11) /* sha256rnds2 / sha256msg1 / sha256msg2 */
+
+/* CR0 bits */
+#define CR0_MP            0x00000002  /* Monitor coprocessor (WAIT honours TS) */
+#define CR0_EM            0x00000004  /* Emulate x87 (must be clear) */
+#define CR0_TS            0x00000008  /* Task switched: next FPU use raises #NM */
+#define CR0_NE            0x00000020  /* Native x87 error reporting */
+
+/* CR4 bits */
+#define CR4_OSFXSR        0x00000200  /* FXSAVE/FXRSTOR and SSE */
+#define CR4_OSXMMEXCPT    0x00000400  /* Unmasked SSE exceptions raise #XM */
+#define CR4_OSXSAVE       0x00040000  /* XSAVE and XSETBV/XGETBV */
+
+/* XCR0 state components */
+#define XCR0_X87          0x01
+#define XCR0_SSE          0x02
+#define XCR0_AVX          0x04
+#define XCR0_AVX512       0xE0        /* Opmask, ZMM_Hi256, Hi16_ZMM */
+
+/* Run once, early (before anything uses floating point) */
+void fpu_init(void);
+uint32_t fpu_features(void);
+/* Bytes of one save area (FXSAVE: 512) */
+uint32_t fpu_state_size(void);
+
+#ifndef __x86_64__
+/* The running process owns the registers from here on (sched_proc_init) */
+void fpu_adopt(process_t *proc);
+/* Called by sched_switch with interrupts off, just before switch_to */
+void fpu_switch(process_t *next);
+/* Drop proc's save area (and ownership) before it is freed */
+void fpu_release(process_t *proc);
+#endif
+
+#endif /* _ARCH_FPU_H */
@@ -4,6 +4,7 @@
  */
 
 #include "gdt.h"
+#include "syscall.h"
 #include "../console.h"
 
 /* Number of GDT entries */
@@ -117,4 +118,5 @@ void gdt_init(void) {
 
 void gdt_set_kernel_stack(uint32_t stack) {
     tss.esp0 = stack;
+    syscall_set_kernel_stack(stack);
 }
@@ -5,6 +5,10 @@
 
 #include "idt.h"
 #include "gdt.h"
+#include "apic.h"
+#include "pmu.h"
+#include "irq.h"
+#include "../drivers/ivshmem.h"
 #include "../console.h"
 
 /* IDT storage */
@@ -69,6 +73,15 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+/* Local APIC stubs */
+extern void isr64(void);
+extern void isr65(void);
+extern void isr255(void);
+
+/* ivshmem doorbell vectors (MSI-X, or MSI on the first) */
+extern const uintptr_t isr_ivshmem_table[IVSHMEM_MAX_VECTORS];
+_Static_assert(IVSHMEM_MAX_VECTORS == 19, "isr.s has 19 ivshmem stubs");
+
 /* Syscall stub */
 extern void isr128(void);
 
@@ -136,7 +149,8 @@ static void print_hex(uint32_t val) {
 }
 
 /* Default exception handler - panic */
-static void default_exception_handler(interrupt_frame_t *frame) {
+void idt_panic(interrupt_frame_t *frame) {
+    console_sync();  /* Nothing will drain the ring after this */
     console_write("\n\n*** KERNEL PANIC: ");
 
     if (frame->int_no < 22) {
@@ -216,12 +230,14 @@ static void default_exception_handler(interrupt_frame_t *frame) {
 
 /* Common interrupt dispatcher - called from assembly stubs */
 void isr_handler(interrupt_frame_t *frame) {
+    irq_account((uint8_t)frame->int_no);
+
     /* Call registered handler if present */
     if (handlers[frame->int_no]) {
         handlers[frame->int_no](frame);
     } else if (frame->int_no < 32) {
         /* Unhandled CPU exception - panic */
-        default_exception_handler(frame);
+        idt_panic(frame);
     }
     /* Unhandled IRQs/software interrupts are silently ignored */
 }
@@ -302,6 +318,13 @@ void idt_init(void) {
     idt_set_entry(46, (uintptr_t)irq14, GDT_KERNEL_CODE_SEG, irq_attr);
     idt_set_entry(47, (uintptr_t)irq15, GDT_KERNEL_CODE_SEG, irq_attr);
 
+    /* Local APIC timer, counter overflow and spurious vectors (apic.h, pmu.h) */
+    idt_set_entry(LAPIC_TIMER_VECTOR, (uintptr_t)isr64, GDT_KERNEL_CODE_SEG, irq_attr);
+    idt_set_entry(PMU_VECTOR, (uintptr_t)isr65, GDT_KERNEL_CODE_SEG, irq_attr);
+    idt_set_entry(LAPIC_SPURIOUS_VECTOR, (uintptr_t)isr255, GDT_KERNEL_CODE_SEG, irq_attr);
+    for (int v = 0; v < IVSHMEM_MAX_VECTORS; v++)
+        idt_set_entry(IVSHMEM_IDT_BASE + v, isr_ivshmem_table[v], GDT_KERNEL_CODE_SEG, irq_attr);
+
     /* Syscall interrupt (0x80 = 128) - trap gate, accessible from ring 3 */
     uint8_t syscall_attr = IDT_ATTR_PRESENT | IDT_ATTR_RING3 | IDT_GATE_TRAP32;
     idt_set_entry(INT_SYSCALL, (uintptr_t)isr128, GDT_KERNEL_CODE_SEG, syscall_attr);
@@ -309,5 +332,5 @@ void idt_init(void) {
     /* Load IDT */
     idt_flush(&idt_ptr);
 
-    console_write("[idt] IDT loaded with 32 exceptions + 16 IRQs + syscall\n");
+    console_write("[idt] IDT loaded with 32 exceptions + 16 IRQs + LAPIC + ivshmem + syscall\n");
 }
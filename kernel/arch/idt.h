@@ -148,7 +148,18 @@ void idt_init(void);
 typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
 void idt_register_handler(uint8_t vector, interrupt_handler_t handler);
 
+/* Dump the frame and halt, as for an unhandled CPU exception */
+void idt_panic(interrupt_frame_t *frame) __attribute__((noreturn));
+
 /* Enable/disable interrupts */
+#ifdef ZENEDGE_HOSTED
+/* Linux userspace build (tools/hostbench): nothing to mask, and cli/sti
+ * would fault
+ */
+static inline void interrupts_enable(void) {}
+static inline void interrupts_disable(void) {}
+static inline int interrupts_enabled(void) { return 0; }
+#else
 static inline void interrupts_enable(void) {
     __asm__ __volatile__("sti");
 }
@@ -158,9 +169,10 @@ static inline void interrupts_disable(void) {
 }
 
 static inline int interrupts_enabled(void) {
-    uint32_t flags;
+    uintptr_t flags;  /* pushf/pop operate on the native word size */
     __asm__ __volatile__("pushf; pop %0" : "=r"(flags));
     return (flags & 0x200) != 0;  /* IF flag is bit 9 */
 }
+#endif
 
 #endif /* _ARCH_IDT_H */
@@ -0,0 +1,103 @@
+/* kernel/arch/irq.c - Interrupt affinity and per-CPU interrupt counts */
+
+#include "irq.h"
+#include "../console.h"
+#if defined(__x86_64__)
+#include "smp.h"
+#else
+#include "apic.h"
+#endif
+
+#define IRQ_VECTORS (256 - IRQ_VECTOR_BASE)
+
+typedef struct {
+    irq_route_fn_t fn;
+    void *ctx;
+    uint8_t cpu;
+} irq_route_t;
+
+static irq_route_t routes[IRQ_VECTORS];
+static uint32_t counts[IRQ_CPUS][IRQ_VECTORS];
+
+/* Helper: APIC id of an online cpu, -1 if it is not up */
+static int64_t cpu_apic_id(uint32_t cpu) {
+#if defined(__x86_64__)
+    percpu_t *p = smp_cpu(cpu);
+    return p && p->online ? (int64_t)p->apic_id : -1;
+#else
+    return cpu == 0 ? (int64_t)lapic_get_id() : -1;
+#endif
+}
+
+void irq_set_route(uint8_t vector, irq_route_fn_t fn, void *ctx) {
+    if (vector < IRQ_VECTOR_BASE)
+        return;
+    irq_route_t *r = &routes[vector - IRQ_VECTOR_BASE];
+    r->fn = fn;
+    r->ctx = ctx;
+    r->cpu = 0;
+}
+
+int irq_set_affinity(uint8_t vector, uint32_t cpu_mask) {
+    if (vector < IRQ_VECTOR_BASE)
+        return -1;
+    irq_route_t *r = &routes[vector - IRQ_VECTOR_BASE];
+
+    for (uint32_t cpu = 0; cpu < IRQ_CPUS; cpu++) {
+        if (!(cpu_mask & (1u << cpu)))
+            continue;
+        int64_t apic_id = cpu_apic_id(cpu);
+        if (apic_id < 0)
+            continue;
+        /* Not message-signalled: it stays where it is (the BSP) */
+        if (!r->fn)
+            return cpu == r->cpu ? 0 : -1;
+        if (r->fn(vector, (uint32_t)apic_id, r->ctx) != 0)
+            return -1;
+        r->cpu = (uint8_t)cpu;
+        return 0;
+    }
+    return -1;
+}
+
+uint32_t irq_get_cpu(uint8_t vector) {
+    return vector < IRQ_VECTOR_BASE ? 0 : routes[vector - IRQ_VECTOR_BASE].cpu;
+}
+
+void irq_account(uint8_t vector) {
+    uint32_t cpu = smp_cpu_id();
+    if (vector >= IRQ_VECTOR_BASE && cpu < IRQ_CPUS)
+        counts[cpu][vector - IRQ_VECTOR_BASE]++;
+}
+
+uint32_t irq_stat_count(uint8_t vector, uint32_t cpu) {
+    if (vector < IRQ_VECTOR_BASE || cpu >= IRQ_CPUS)
+        return 0;
+    return counts[cpu][vector - IRQ_VECTOR_BASE];
+}
+
+void irq_dump(void) {
+    console_write("[irq] vector cpu:count (-> delivery cpu)\n");
+    for (uint32_t v = 0; v < IRQ_VECTORS; v++) {
+        uint32_t any = 0;
+        for (uint32_t cpu = 0; cpu < IRQ_CPUS; cpu++)
+            any |= counts[cpu][v];
+        if (!any && !routes[v].fn)
+            continue;
+        console_write("  ");
+        print_uint(v + IRQ_VECTOR_BASE);
+        for (uint32_t cpu = 0; cpu < IRQ_CPUS; cpu++) {
+            if (!counts[cpu][v])
+                continue;
+            console_write(" ");
+            print_uint(cpu);
+            console_write(":");
+            print_uint(counts[cpu][v]);
+        }
+        if (routes[v].fn) {
+            console_write(" -> ");
+            print_uint(routes[v].cpu);
+        }
+        console_write("\n");
+    }
+}
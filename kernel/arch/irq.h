@@ -0,0 +1,49 @@
+/* kernel/arch/irq.h - Interrupt affinity and per-CPU interrupt counts
+ *
+ * A message-signalled vector (MSI, MSI-X) goes wherever its address says,
+ * so its owner registers a route that rewrites the destination, and
+ * irq_set_affinity() moves it. Legacy 8259 IRQs (vectors 32-47) only
+ * ever reach the BSP, and the LAPIC's own vectors are per CPU by nature:
+ * neither can be steered. Every dispatch is counted per vector and CPU,
+ * so cross-core wakeups show up in irq_dump().
+ */
+#ifndef _ARCH_IRQ_H
+#define _ARCH_IRQ_H
+
+#include <stdint.h>
+
+#include "percpu.h"
+
+/* Counted CPUs: the i386 kernel is uniprocessor */
+#if defined(__x86_64__)
+#define IRQ_CPUS SMP_MAX_CPUS
+#else
+#define IRQ_CPUS 1
+#endif
+
+/* First vector counted (below are CPU exceptions) */
+#define IRQ_VECTOR_BASE 32
+
+/* Point vector at the LAPIC apic_id; returns 0 or -1 */
+typedef int (*irq_route_fn_t)(uint8_t vector, uint32_t apic_id, void *ctx);
+
+/* Owner of a message-signalled vector: how to retarget it (fn NULL: none) */
+void irq_set_route(uint8_t vector, irq_route_fn_t fn, void *ctx);
+
+/* Deliver vector to the lowest online CPU in cpu_mask (bit n = cpu n)
+ * Returns: 0, or -1 if the vector can't be steered there
+ */
+int irq_set_affinity(uint8_t vector, uint32_t cpu_mask);
+
+/* CPU the vector is delivered to (0 until steered) */
+uint32_t irq_get_cpu(uint8_t vector);
+
+/* Dispatchers (idt.c, pic.c): one interrupt for vector on this CPU */
+void irq_account(uint8_t vector);
+
+/* Interrupts vector has raised on cpu */
+uint32_t irq_stat_count(uint8_t vector, uint32_t cpu);
+
+void irq_dump(void);
+
+#endif /* _ARCH_IRQ_H */
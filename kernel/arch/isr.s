@@ -141,6 +141,31 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
+/* ============================================= */
+/* Local APIC vectors (timer, PMU, spurious)    */
+/* ============================================= */
+
+ISR_NOERR 64
+ISR_NOERR 65
+ISR_NOERR 255
+
+/* ============================================= */
+/* ivshmem doorbell vectors (0x50 + vector)     */
+/* ============================================= */
+
+/* IVSHMEM_IDT_BASE .. + IVSHMEM_MAX_VECTORS - 1 (drivers/ivshmem.h) */
+.irp num, 80,81,82,83,84,85,86,87,88,89,90,91,92,93,94,95,96,97,98
+ISR_NOERR \num
+.endr
+
+.section .rodata
+.global isr_ivshmem_table
+isr_ivshmem_table:
+.irp num, 80,81,82,83,84,85,86,87,88,89,90,91,92,93,94,95,96,97,98
+    .long isr\num
+.endr
+.section .text
+
 /* ============================================= */
 /* Syscall stub (int 0x80)                      */
 /* ============================================= */
@@ -151,6 +176,34 @@ isr128:
     push $128
     jmp isr_common_stub
 
+/* ============================================= */
+/* SYSENTER fast path                           */
+/* ============================================= */
+
+/* eax = number, ebx/esi/edi = args, ecx = user esp, edx = user eip.
+ * The CPU loads CS/SS and esp from the SYSENTER MSRs (the process's
+ * kernel stack) with interrupts off; no frame is built, only what
+ * syscall_dispatch() and SYSEXIT need. ds/es still hold the user data
+ * selector, which is flat like the kernel's.
+ */
+.extern syscall_dispatch
+.global sysenter_entry
+sysenter_entry:
+    push %ecx
+    push %edx
+    push %edi
+    push %esi
+    push %ebx
+    push %eax
+    sti
+    call syscall_dispatch
+    cli
+    add $16, %esp
+    pop %edx
+    pop %ecx
+    sti
+    sysexit
+
 /* ============================================= */
 /* Common interrupt handler                     */
 /* ============================================= */
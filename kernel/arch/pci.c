@@ -88,8 +88,15 @@ void pci_init(void) {
 int pci_find_device(uint16_t vendor_id, uint16_t device_id,
                     pci_device_t *dev_out) {
   for (uint8_t slot = 0; slot < 32; slot++) {
-    for (uint8_t func = 0; func < 8; func++) {
-      uint32_t id_reg = pci_read_config_32(0, slot, func, 0x00);
+    /* Empty slot, or single-function device: functions 1-7 aren't there */
+    uint32_t id0 = pci_read_config_32(0, slot, 0, 0x00);
+    if ((id0 & 0xFFFF) == 0xFFFF)
+      continue;
+    uint32_t hdr = pci_read_config_32(0, slot, 0, PCI_REGISTER_HEADER_TYPE & ~3);
+    uint8_t funcs = (hdr >> 16) & 0x80 ? 8 : 1;
+
+    for (uint8_t func = 0; func < funcs; func++) {
+      uint32_t id_reg = func ? pci_read_config_32(0, slot, func, 0x00) : id0;
       if ((id_reg & 0xFFFF) == vendor_id &&
           ((id_reg >> 16) & 0xFFFF) == device_id) {
         if (dev_out) {
@@ -197,3 +204,65 @@ int pci_enable_msi(pci_device_t dev, uint8_t vector, uint8_t dest_id) {
     console_write("[pci] MSI Capability not found\n");
     return -1;
 }
+
+uint8_t pci_find_cap(pci_device_t dev, uint8_t cap_id) {
+  uint32_t status =
+      pci_read_config_32(dev.bus, dev.slot, dev.func, PCI_REGISTER_STATUS) >> 16;
+  if (!(status & 0x10))
+    return 0;
+
+  uint8_t cap_ptr = pci_read_config_32(dev.bus, dev.slot, dev.func, 0x34) & 0xFC;
+  for (int hops = 0; cap_ptr && hops < 48; hops++) {
+    uint32_t cap_hdr = pci_read_config_32(dev.bus, dev.slot, dev.func, cap_ptr);
+    if ((cap_hdr & 0xFF) == cap_id)
+      return cap_ptr;
+    cap_ptr = (cap_hdr >> 8) & 0xFC;
+  }
+  return 0;
+}
+
+int pci_msix_probe(pci_device_t dev, pci_msix_t *out) {
+  uint8_t cap = pci_find_cap(dev, PCI_CAP_ID_MSIX);
+  if (!cap)
+    return -1;
+
+  /* +2 Message Control: table size - 1 in bits 0-10; +4 table BIR/offset */
+  uint32_t hdr = pci_read_config_32(dev.bus, dev.slot, dev.func, cap);
+  uint32_t table = pci_read_config_32(dev.bus, dev.slot, dev.func, cap + 4);
+  out->cap = cap;
+  out->table_size = (uint16_t)(((hdr >> 16) & 0x7FF) + 1);
+  out->table_bar = table & 0x7;
+  out->table_offset = table & ~0x7u;
+  return 0;
+}
+
+void pci_msix_set_entry(volatile uint32_t *table, uint32_t entry,
+                        uint8_t vector, uint8_t dest_id) {
+  /* 16 bytes each: address lo, address hi, data, vector control */
+  volatile uint32_t *e = table + entry * 4;
+  e[3] = 1; /* Masked while it changes */
+  e[0] = 0xFEE00000 | ((uint32_t)dest_id << 12);
+  e[1] = 0;
+  e[2] = vector; /* Fixed delivery, edge */
+  e[3] = 0;
+}
+
+void pci_msix_enable(pci_device_t dev, const pci_msix_t *msix, int on) {
+  uint32_t hdr = pci_read_config_32(dev.bus, dev.slot, dev.func, msix->cap);
+  uint32_t ctl = hdr >> 16;
+  ctl &= ~0x4000u; /* Function mask */
+  if (on)
+    ctl |= 0x8000u;
+  else
+    ctl &= ~0x8000u;
+  pci_write_config_32(dev.bus, dev.slot, dev.func, msix->cap,
+                      (hdr & 0xFFFF) | (ctl << 16));
+
+  /* INTx disable (command bit 10) while messages are in use */
+  uint32_t cmd = pci_read_config_32(dev.bus, dev.slot, dev.func, 0x04);
+  if (on)
+    cmd |= 0x400 | PCI_COMMAND_BUS_MASTER;
+  else
+    cmd &= ~0x400u;
+  pci_write_config_32(dev.bus, dev.slot, dev.func, 0x04, cmd & 0xFFFF);
+}
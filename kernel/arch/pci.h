@@ -60,4 +60,28 @@ uint32_t pci_get_bar(pci_device_t dev, int bar_index, uint32_t *size_out);
 /* Enable MSI */
 int pci_enable_msi(pci_device_t dev, uint8_t vector, uint8_t dest_id);
 
+/* Config offset of capability cap_id, 0 if the device has none */
+#define PCI_CAP_ID_MSIX 0x11
+uint8_t pci_find_cap(pci_device_t dev, uint8_t cap_id);
+
+/* MSI-X: where the vector table lives */
+typedef struct {
+  uint8_t cap;           /* Capability offset */
+  uint8_t table_bar;     /* BAR holding the table */
+  uint16_t table_size;   /* Entries */
+  uint32_t table_offset; /* Table start within that BAR */
+} pci_msix_t;
+
+/* Returns: 0, or -1 without an MSI-X capability */
+int pci_msix_probe(pci_device_t dev, pci_msix_t *out);
+
+/* Point entry at vector on the LAPIC dest_id, unmasked; table is the
+ * mapped vector table
+ */
+void pci_msix_set_entry(volatile uint32_t *table, uint32_t entry,
+                        uint8_t vector, uint8_t dest_id);
+
+/* Turn MSI-X on (function mask released, legacy INTx off) or off */
+void pci_msix_enable(pci_device_t dev, const pci_msix_t *msix, int on);
+
 #endif /* _ARCH_PCI_H */
@@ -0,0 +1,54 @@
+/* kernel/arch/percpu.h - Per-CPU data
+ *
+ * One percpu_t per CPU, indexed by a dense cpu id (0 = the BSP, APs in
+ * the order they came up). On x86_64 each CPU's GS base points at its
+ * own entry, so this_cpu() and smp_cpu_id() are a single %gs load; the
+ * i386 kernel is uniprocessor and always CPU 0.
+ */
+#ifndef _ARCH_PERCPU_H
+#define _ARCH_PERCPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keep in sync with arch/x86_64/boot/ap_trampoline.s */
+#define SMP_MAX_CPUS 32
+
+#define IA32_GS_BASE_MSR 0xC0000101
+
+struct process;
+
+typedef struct percpu {
+    struct percpu *self;        /* %gs:0, what this_cpu() reads */
+    uint32_t cpu_id;            /* Dense, 0 = BSP */
+    uint32_t apic_id;
+    struct process *current;    /* Running here, NULL until scheduled */
+    volatile uint32_t online;   /* Set by the CPU itself once up */
+    uint64_t idle_wakeups;      /* Idle loop hlt returns */
+    uint64_t trace_events;      /* flightrec_log() calls made here */
+} percpu_t;
+
+/* Nonzero once the BSP's GS base is set (smp_init) */
+extern volatile uint32_t percpu_ready;
+
+#if defined(__x86_64__)
+static inline percpu_t *this_cpu(void) {
+    percpu_t *p;
+    __asm__ __volatile__("mov %%gs:%c1, %0" : "=r"(p) : "i"(offsetof(percpu_t, self)));
+    return p;
+}
+
+static inline uint32_t smp_cpu_id(void) {
+    uint32_t id;
+    if (!percpu_ready)
+        return 0;
+    __asm__ __volatile__("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(percpu_t, cpu_id)));
+    return id;
+}
+#else
+static inline uint32_t smp_cpu_id(void) {
+    return 0;
+}
+#endif
+
+#endif /* _ARCH_PERCPU_H */
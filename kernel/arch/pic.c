@@ -6,6 +6,7 @@
 #include "pic.h"
 #include "../console.h"
 #include "idt.h"
+#include "irq.h"
 
 /* I/O port helpers */
 static inline void outb(uint16_t port, uint8_t val) {
@@ -31,13 +32,16 @@ static interrupt_handler_t irq_handlers[16];
 static volatile uint32_t timer_ticks = 0;
 
 #include "../sched/sched_core.h"
+#include "../trace/prof.h"
 
 /* Default timer handler - just count ticks */
 static void timer_handler(interrupt_frame_t *frame) {
-  (void)frame;
   timer_ticks++;
 #ifndef __x86_64__
+  prof_tick(frame);
   schedule();
+#else
+  (void)frame;
 #endif
 }
 
@@ -77,6 +81,7 @@ void irq_handler(interrupt_frame_t *frame) {
    * Since interrupts are disabled here (from ISR stub), it's safe to ACK.
    */
   pic_send_eoi(irq);
+  irq_account((uint8_t)frame->int_no);
 
   /* Call registered handler */
   if (irq_handlers[irq]) {
@@ -6,6 +6,8 @@
 #include "pit.h"
 #include "pic.h"
 #include "../console.h"
+#include "../sched/sched_core.h"
+#include "../time/time.h"
 
 /* I/O port helpers */
 static inline void outb(uint16_t port, uint8_t val) {
@@ -70,18 +72,16 @@ uint32_t pit_get_ticks(void) {
 }
 
 void pit_sleep_ms(uint32_t ms) {
-    if (tick_rate_hz == 0) {
-        return;  /* Timer not initialized */
+    /* By the clock, not by counting ticks: the PIT is masked when the
+     * scheduler runs tickless, so ask for an interrupt at the end instead
+     */
+    if (time_get_cpu_mhz() == 0) {
+        return;  /* Clock not initialized */
     }
 
-    /* Calculate number of ticks to wait */
-    uint32_t ticks = (ms * tick_rate_hz) / 1000;
-    if (ticks == 0) {
-        ticks = 1;
-    }
-
-    uint32_t start = timer_get_ticks();
-    while ((timer_get_ticks() - start) < ticks) {
+    usec_t end = time_usec() + (usec_t)ms * 1000;
+    sched_timer_at(end);
+    while (time_usec() < end) {
         /* Halt until next interrupt to save power */
         __asm__ __volatile__("hlt");
     }
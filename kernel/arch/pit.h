@@ -47,7 +47,9 @@ void pit_init(uint32_t frequency);
 /* Get current tick count */
 uint32_t pit_get_ticks(void);
 
-/* Sleep for approximately the given number of milliseconds */
+/* Sleep for approximately the given number of milliseconds (time_usec()
+ * based, so it works tickless too)
+ */
 void pit_sleep_ms(uint32_t ms);
 
 #endif /* _ARCH_PIT_H */
@@ -0,0 +1,495 @@
+/* kernel/arch/pmu.c - Hardware performance counters */
+
+#include "pmu.h"
+#include "apic.h"
+#include "idt.h"
+#include "percpu.h"
+#include "../console.h"
+#include "../include/string.h"
+
+/* Intel architectural perfmon (SDM vol. 3, ch. 20) */
+#define IA32_PMC0               0xC1
+#define IA32_PERFEVTSEL0        0x186
+#define IA32_FIXED_CTR0         0x309
+#define IA32_FIXED_CTR_CTRL     0x38D
+#define IA32_PERF_GLOBAL_CTRL   0x38F
+#define IA32_PERF_GLOBAL_OVF_CTRL 0x390
+
+/* AMD core counters (CPUID 0x80000001 ECX.PerfCtrExtCore) */
+#define AMD_PERF_CTL0           0xC0010200  /* CTL n = + 2n, CTR n = + 2n + 1 */
+
+#define EVTSEL_USR  (1u << 16)
+#define EVTSEL_OS   (1u << 17)
+#define EVTSEL_INT  (1u << 20)
+#define EVTSEL_EN   (1u << 22)
+
+#define FIXED_OS_USR 0x3            /* Per fixed counter, 4 bits each */
+#define FIXED_PMI    0x8
+
+#define RDPMC_FIXED (1u << 30)
+
+#define PMU_HOT_IPS 8
+
+typedef enum { PMU_NONE, PMU_INTEL, PMU_AMD } pmu_vendor_t;
+
+typedef struct {
+    uint32_t counter;           /* GP counter, or fixed one if fixed */
+    uint32_t fixed;
+    uint32_t evtsel;            /* GP: the event select written */
+    uint32_t rdpmc;
+    uint32_t bias;              /* Added to reads: overflow reloads */
+} pmu_slot_t;
+
+typedef struct {
+    uint32_t calls;
+    uint64_t total[PMU_EVENTS];
+} pmu_site_stats_t;
+
+static pmu_vendor_t g_vendor = PMU_NONE;
+static uint32_t g_mask;
+static uint32_t g_gp_width = 48;
+static uint32_t g_fixed_width = 48;
+static pmu_slot_t g_slots[PMU_EVENTS];
+static pmu_site_stats_t g_sites[PMU_SITES];
+
+/* Sampling: one event at a time, BSP only */
+static volatile int g_sample_ev = -1;
+static uint32_t g_sample_period;
+static uintptr_t g_ips[PMU_SAMPLES];
+static volatile uint32_t g_ip_total;
+
+static const char *const g_names[PMU_EVENTS] = {
+    [PMU_INSTR]     = "instr",
+    [PMU_CYCLES]    = "cycles",
+    [PMU_LLC_MISS]  = "llc",
+    [PMU_BR_MISS]   = "branch",
+    [PMU_DTLB_MISS] = "dtlb",
+};
+
+static const char *const g_site_names[PMU_SITES] = {
+    [PMU_SITE_AGENT] = "agent",
+    [PMU_SITE_INFER] = "infer",
+};
+
+static void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ __volatile__("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__("wrmsr" :: "a"((uint32_t)val), "d"((uint32_t)(val >> 32)), "c"(msr));
+}
+
+static inline uint32_t rdpmc(uint32_t idx) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx));
+    (void)hi;
+    return lo;
+}
+
+static uint32_t cpu_family(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    uint32_t family = (a >> 8) & 0xF;
+    if (family == 0xF)
+        family += (a >> 20) & 0xFF;
+    return family;
+}
+
+/* Helper: program GP counter n for ev (event | umask << 8) */
+static void use_gp(uint32_t ev, uint32_t n, uint32_t sel) {
+    pmu_slot_t *s = &g_slots[ev];
+    s->counter = n;
+    s->fixed = 0;
+    s->evtsel = sel | EVTSEL_USR | EVTSEL_OS | EVTSEL_EN;
+    s->rdpmc = n;
+    g_mask |= 1u << ev;
+
+    if (g_vendor == PMU_INTEL) {
+        wrmsr(IA32_PERFEVTSEL0 + n, 0);
+        wrmsr(IA32_PMC0 + n, 0);
+        wrmsr(IA32_PERFEVTSEL0 + n, s->evtsel);
+    } else {
+        wrmsr(AMD_PERF_CTL0 + 2 * n, 0);
+        wrmsr(AMD_PERF_CTL0 + 2 * n + 1, 0);
+        wrmsr(AMD_PERF_CTL0 + 2 * n, s->evtsel);
+    }
+}
+
+static void intel_init(uint32_t max_leaf) {
+    if (max_leaf < 0xA)
+        return;
+    uint32_t a, b, c, d;
+    cpuid(0xA, &a, &b, &c, &d);
+    uint32_t version = a & 0xFF;
+    uint32_t gp = (a >> 8) & 0xFF;
+    uint32_t fixed = version >= 2 ? (d & 0x1F) : 0;
+    if (!version || !gp)
+        return;
+
+    g_vendor = PMU_INTEL;
+    /* Widths past 32 bits, as every part has; keep the default otherwise */
+    if (((a >> 16) & 0xFF) > 32 && ((a >> 16) & 0xFF) < 64)
+        g_gp_width = (a >> 16) & 0xFF;
+    if (fixed && ((d >> 5) & 0xFF) > 32 && ((d >> 5) & 0xFF) < 64)
+        g_fixed_width = (d >> 5) & 0xFF;
+    if (version >= 2)
+        wrmsr(IA32_PERF_GLOBAL_CTRL, 0);
+
+    /* EBX bit set = architectural event not available */
+    uint32_t n = 0;
+    uint64_t fixed_ctrl = 0;
+    if (fixed >= 2) {
+        for (uint32_t j = 0; j < 2; j++) {
+            uint32_t ev = j == 0 ? PMU_INSTR : PMU_CYCLES;
+            g_slots[ev].counter = j;
+            g_slots[ev].fixed = 1;
+            g_slots[ev].rdpmc = RDPMC_FIXED | j;
+            wrmsr(IA32_FIXED_CTR0 + j, 0);
+            fixed_ctrl |= (uint64_t)FIXED_OS_USR << (4 * j);
+            g_mask |= 1u << ev;
+        }
+        wrmsr(IA32_FIXED_CTR_CTRL, fixed_ctrl);
+    } else {
+        if (!(b & (1u << 1)) && n < gp)
+            use_gp(PMU_INSTR, n++, 0xC0);
+        if (!(b & (1u << 0)) && n < gp)
+            use_gp(PMU_CYCLES, n++, 0x3C);
+    }
+    if (!(b & (1u << 4)) && n < gp)
+        use_gp(PMU_LLC_MISS, n++, 0x2E | 0x41 << 8);
+    if (!(b & (1u << 6)) && n < gp)
+        use_gp(PMU_BR_MISS, n++, 0xC5);
+    /* DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK: not architectural, but the
+     * same on the family 6 cores since Nehalem
+     */
+    if (cpu_family() == 6 && n < gp)
+        use_gp(PMU_DTLB_MISS, n++, 0x08 | 0x01 << 8);
+
+    if (version >= 2)
+        wrmsr(IA32_PERF_GLOBAL_CTRL, ((1ull << n) - 1) | (fixed_ctrl ? 3ull << 32 : 0));
+}
+
+static void amd_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a < 0x80000001)
+        return;
+    /* Without the extension the legacy counters are all there is, and
+     * emulators that lack them fault on the MSRs: leave those alone
+     */
+    cpuid(0x80000001, &a, &b, &c, &d);
+    if (!(c & (1u << 23)))
+        return;
+
+    g_vendor = PMU_AMD;
+    uint32_t n = 0;
+    use_gp(PMU_INSTR, n++, 0xC0);
+    use_gp(PMU_CYCLES, n++, 0x76);
+    use_gp(PMU_BR_MISS, n++, 0xC3);
+    /* Zen: L2 misses (the L3 has counters of its own, not core ones) and
+     * L1 dTLB misses
+     */
+    if (cpu_family() >= 0x17) {
+        use_gp(PMU_LLC_MISS, n++, 0x64 | 0x09 << 8);
+        use_gp(PMU_DTLB_MISS, n++, 0x45 | 0xFF << 8);
+    }
+}
+
+void pmu_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(0, &a, &b, &c, &d);
+    if (b == 0x756E6547 && d == 0x49656E69 && c == 0x6C65746E)   /* GenuineIntel */
+        intel_init(a);
+    else if (b == 0x68747541 && d == 0x69746E65 && c == 0x444D4163)   /* AuthenticAMD */
+        amd_init();
+
+    console_write("[pmu] ");
+    if (!g_mask) {
+        console_write("no counters\n");
+        return;
+    }
+    console_write(g_vendor == PMU_INTEL ? "intel:" : "amd:");
+    for (uint32_t ev = 0; ev < PMU_EVENTS; ev++) {
+        if (g_mask & (1u << ev)) {
+            console_write(" ");
+            console_write(g_names[ev]);
+        }
+    }
+    console_write("\n");
+}
+
+uint32_t pmu_events(void) {
+    /* Only the boot CPU's counters are programmed */
+    return smp_cpu_id() == 0 ? g_mask : 0;
+}
+
+const char *pmu_event_name(uint32_t ev) {
+    return ev < PMU_EVENTS ? g_names[ev] : "?";
+}
+
+void pmu_read(pmu_snap_t *out) {
+    uint32_t mask = pmu_events();
+    for (uint32_t ev = 0; ev < PMU_EVENTS; ev++) {
+        if (!(mask & (1u << ev))) {
+            out->v[ev] = 0;
+            continue;
+        }
+        if ((int)ev == g_sample_ev) {
+            /* Bias and count must be of the same side of a reload */
+            int was = interrupts_enabled();
+            interrupts_disable();
+            out->v[ev] = rdpmc(g_slots[ev].rdpmc) + g_slots[ev].bias;
+            if (was)
+                interrupts_enable();
+        } else {
+            out->v[ev] = rdpmc(g_slots[ev].rdpmc) + g_slots[ev].bias;
+        }
+    }
+}
+
+void pmu_delta(const pmu_snap_t *start, pmu_snap_t *out) {
+    pmu_snap_t now;
+    pmu_read(&now);
+    for (uint32_t ev = 0; ev < PMU_EVENTS; ev++)
+        out->v[ev] = now.v[ev] - start->v[ev];
+}
+
+void pmu_site_end(uint32_t site, const pmu_snap_t *start) {
+    if (site >= PMU_SITES || !pmu_events())
+        return;
+    pmu_snap_t d;
+    pmu_delta(start, &d);
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+    pmu_site_stats_t *s = &g_sites[site];
+    s->calls++;
+    for (uint32_t ev = 0; ev < PMU_EVENTS; ev++)
+        s->total[ev] += d.v[ev];
+    if (was)
+        interrupts_enable();
+}
+
+/* Helper: turn ev's overflow interrupt on or off */
+static void set_pmi(uint32_t ev, int on) {
+    pmu_slot_t *s = &g_slots[ev];
+    if (g_vendor == PMU_AMD) {
+        wrmsr(AMD_PERF_CTL0 + 2 * s->counter, s->evtsel | (on ? EVTSEL_INT : 0));
+    } else if (s->fixed) {
+        uint64_t ctrl = 0;
+        for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+            if ((g_mask & (1u << e)) && g_slots[e].fixed)
+                ctrl |= (uint64_t)(FIXED_OS_USR | (on && e == ev ? FIXED_PMI : 0))
+                        << (4 * g_slots[e].counter);
+        }
+        wrmsr(IA32_FIXED_CTR_CTRL, ctrl);
+    } else {
+        wrmsr(IA32_PERFEVTSEL0 + s->counter, s->evtsel | (on ? EVTSEL_INT : 0));
+    }
+}
+
+#ifndef __x86_64__
+/* Helper: load ev's counter so it overflows after period more events */
+static void preload(uint32_t ev, uint32_t period) {
+    pmu_slot_t *s = &g_slots[ev];
+    uint32_t width = s->fixed ? g_fixed_width : g_gp_width;
+    uint64_t val = (0 - (uint64_t)period) & ((1ull << width) - 1);
+    if (g_vendor == PMU_AMD)
+        wrmsr(AMD_PERF_CTL0 + 2 * s->counter + 1, val);
+    else if (s->fixed)
+        wrmsr(IA32_FIXED_CTR0 + s->counter, val);
+    else
+        wrmsr(IA32_PMC0 + s->counter, val);
+}
+
+static void pmu_pmi(interrupt_frame_t *frame) {
+    int ev = g_sample_ev;
+    if (ev >= 0) {
+        pmu_slot_t *s = &g_slots[ev];
+        g_ips[g_ip_total % PMU_SAMPLES] = frame->eip;
+        g_ip_total++;
+
+        /* Keep reads continuous across the reload: the counter goes back
+         * from the few events past the wrap to -period
+         */
+        uint32_t past = rdpmc(s->rdpmc);
+        preload((uint32_t)ev, g_sample_period);
+        s->bias += past + g_sample_period;
+
+        if (g_vendor == PMU_INTEL)
+            wrmsr(IA32_PERF_GLOBAL_OVF_CTRL,
+                  s->fixed ? 1ull << (32 + s->counter) : 1ull << s->counter);
+    }
+    /* Delivery masks the LVT entry */
+    lapic_write(LAPIC_LVT_PERF, PMU_VECTOR);
+    lapic_eoi();
+}
+#endif
+
+int pmu_sample_start(uint32_t ev, uint32_t period) {
+#ifdef __x86_64__
+    (void)ev;
+    (void)period;
+    return -1;
+#else
+    if (ev >= PMU_EVENTS || !(pmu_events() & (1u << ev)) || !period || period > 0x80000000u ||
+        lapic_timer_mode() == LAPIC_TIMER_NONE)
+        return -1;
+
+    pmu_sample_stop();
+    int was = interrupts_enabled();
+    interrupts_disable();
+
+    idt_register_handler(PMU_VECTOR, pmu_pmi);
+    pmu_slot_t *s = &g_slots[ev];
+    uint32_t before = rdpmc(s->rdpmc);
+    preload(ev, period);
+    s->bias += before + period;
+    g_ip_total = 0;
+    g_sample_period = period;
+    g_sample_ev = (int)ev;
+    lapic_write(LAPIC_LVT_PERF, PMU_VECTOR);
+    set_pmi(ev, 1);
+
+    if (was)
+        interrupts_enable();
+    return 0;
+#endif
+}
+
+void pmu_sample_stop(void) {
+    int ev = g_sample_ev;
+    if (ev < 0)
+        return;
+    int was = interrupts_enabled();
+    interrupts_disable();
+    set_pmi((uint32_t)ev, 0);
+    lapic_write(LAPIC_LVT_PERF, PMU_VECTOR | LAPIC_TIMER_MASKED);
+    g_sample_ev = -1;
+    if (was)
+        interrupts_enable();
+}
+
+uint32_t pmu_samples(uintptr_t *ips, uint32_t max) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    uint32_t total = g_ip_total;
+    uint32_t n = total < PMU_SAMPLES ? total : PMU_SAMPLES;
+    if (n > max)
+        n = max;
+    for (uint32_t i = 0; i < n; i++)
+        ips[i] = g_ips[(total - n + i) % PMU_SAMPLES];
+    if (was)
+        interrupts_enable();
+    return n;
+}
+
+static void dump_hot_ips(void) {
+    /* Static: the copy is 4-8KB, too much for some kernel stacks */
+    static uintptr_t ips[PMU_SAMPLES];
+    uint32_t n = pmu_samples(ips, PMU_SAMPLES);
+    if (!n)
+        return;
+
+    /* Shell sort, then runs of equal addresses are their counts */
+    for (uint32_t gap = n / 2; gap; gap /= 2) {
+        for (uint32_t i = gap; i < n; i++) {
+            uintptr_t v = ips[i];
+            uint32_t j = i;
+            for (; j >= gap && ips[j - gap] > v; j -= gap)
+                ips[j] = ips[j - gap];
+            ips[j] = v;
+        }
+    }
+
+    uintptr_t hot[PMU_HOT_IPS];
+    uint32_t hits[PMU_HOT_IPS] = {0};
+    for (uint32_t i = 0; i < n;) {
+        uint32_t run = 1;
+        while (i + run < n && ips[i + run] == ips[i])
+            run++;
+        for (uint32_t k = 0; k < PMU_HOT_IPS; k++) {
+            if (run > hits[k]) {
+                for (uint32_t m = PMU_HOT_IPS - 1; m > k; m--) {
+                    hot[m] = hot[m - 1];
+                    hits[m] = hits[m - 1];
+                }
+                hot[k] = ips[i];
+                hits[k] = run;
+                break;
+            }
+        }
+        i += run;
+    }
+
+    console_write("[pmu] hottest of ");
+    print_uint(n);
+    console_write(" samples:\n");
+    for (uint32_t k = 0; k < PMU_HOT_IPS && hits[k]; k++) {
+        console_write("  ");
+        print_hex64((uint64_t)hot[k]);
+        console_write(" ");
+        print_uint(hits[k]);
+        console_write("\n");
+    }
+}
+
+void pmu_dump(void) {
+    uint32_t mask = pmu_events();
+    if (!mask) {
+        console_write("[pmu] no counters\n");
+        return;
+    }
+
+    pmu_snap_t now;
+    pmu_read(&now);
+    console_write("[pmu]");
+    for (uint32_t ev = 0; ev < PMU_EVENTS; ev++) {
+        if (mask & (1u << ev)) {
+            console_write(" ");
+            console_write(g_names[ev]);
+            console_write(" ");
+            print_uint(now.v[ev]);
+        }
+    }
+    console_write("\n");
+
+    for (uint32_t site = 0; site < PMU_SITES; site++) {
+        pmu_site_stats_t s;
+        int was = interrupts_enabled();
+        interrupts_disable();
+        s = g_sites[site];
+        if (was)
+            interrupts_enable();
+        if (!s.calls)
+            continue;
+
+        console_write("[pmu] ");
+        console_write(g_site_names[site]);
+        console_write(" calls ");
+        print_uint(s.calls);
+        console_write(", per call:");
+        for (uint32_t ev = 0; ev < PMU_EVENTS; ev++) {
+            if (mask & (1u << ev)) {
+                console_write(" ");
+                console_write(g_names[ev]);
+                console_write(" ");
+                print_uint((uint32_t)(s.total[ev] / s.calls));
+            }
+        }
+        if ((mask & (1u << PMU_INSTR)) && (mask & (1u << PMU_CYCLES)) && s.total[PMU_CYCLES]) {
+            console_write(" ipc x100 ");
+            print_uint((uint32_t)(s.total[PMU_INSTR] * 100 / s.total[PMU_CYCLES]));
+        }
+        console_write("\n");
+    }
+
+    if (g_sample_ev >= 0) {
+        console_write("[pmu] sampling ");
+        console_write(g_names[g_sample_ev]);
+        console_write(" every ");
+        print_uint(g_sample_period);
+        console_write("\n");
+    }
+    dump_hot_ips();
+}
@@ -0,0 +1,85 @@
+/* kernel/arch/pmu.h - Hardware performance counters
+ *
+ * pmu_init() programs up to PMU_EVENTS counters of the boot CPU to count
+ * in ring 0 and ring 3 from then on: Intel architectural perfmon (fixed
+ * counters for instructions and cycles where it has them, general ones
+ * for the rest), or AMD's core counters where CPUID lists them. Without
+ * either (e.g. QEMU TCG) nothing is programmed and every read is zero.
+ *
+ * pmu_read() is one rdpmc per counting event. Snapshots keep the low 32
+ * bits, so a delta is exact up to 2^32 events between two reads.
+ *
+ * Sampling (i386, which owns the IDT): one event's counter is preloaded
+ * to overflow every `period` events and interrupts on PMU_VECTOR; the
+ * handler keeps the interrupted instruction pointer.
+ */
+#ifndef _ARCH_PMU_H
+#define _ARCH_PMU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Overflow interrupt, after LAPIC_TIMER_VECTOR */
+#define PMU_VECTOR 0x41
+
+/* Interrupted instruction pointers kept while sampling */
+#define PMU_SAMPLES 1024
+
+typedef enum {
+    PMU_INSTR = 0,              /* Instructions retired */
+    PMU_CYCLES,                 /* Core cycles, unhalted */
+    PMU_LLC_MISS,               /* Last-level cache misses */
+    PMU_BR_MISS,                /* Mispredicted branches retired */
+    PMU_DTLB_MISS,              /* dTLB load misses (model-specific) */
+    PMU_EVENTS
+} pmu_event_t;
+
+typedef struct {
+    uint32_t v[PMU_EVENTS];
+} pmu_snap_t;
+
+/* Places whose calls accumulate counter totals (pmu_site_end()) */
+typedef enum {
+    PMU_SITE_AGENT = 0,         /* A WASM agent step (wasm_run_agent() too) */
+    PMU_SITE_INFER,             /* kernel_infer_action(), or one batch */
+    PMU_SITES
+} pmu_site_t;
+
+void pmu_init(void);
+
+/* Bit (1 << pmu_event_t) set for each event being counted */
+uint32_t pmu_events(void);
+
+const char *pmu_event_name(uint32_t ev);
+
+void pmu_read(pmu_snap_t *out);
+
+/* out = now - start, event by event */
+void pmu_delta(const pmu_snap_t *start, pmu_snap_t *out);
+
+/* Bracket a call: its deltas add to the site's totals */
+static inline void pmu_site_begin(pmu_snap_t *start) {
+    pmu_read(start);
+}
+void pmu_site_end(uint32_t site, const pmu_snap_t *start);
+
+/* Start sampling ev every period events. Returns: 0, or -1 if the event
+ * is not counted, period is 0 or above 2^31, or there is no IDT here
+ */
+int pmu_sample_start(uint32_t ev, uint32_t period);
+void pmu_sample_stop(void);
+
+/* Copy the newest samples (at most max) into ips. Returns: the number */
+uint32_t pmu_samples(uintptr_t *ips, uint32_t max);
+
+/* Counters, per-call site averages and the hottest sampled addresses */
+void pmu_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ARCH_PMU_H */
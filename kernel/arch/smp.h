@@ -0,0 +1,34 @@
+/* kernel/arch/smp.h - Application processor bring-up (x86_64)
+ *
+ * smp_init() gives the BSP its percpu_t, then wakes every other CPU with
+ * a broadcast INIT-SIPI-SIPI. Each AP comes up through the trampoline
+ * (arch/x86_64/boot/ap_trampoline.s) into long mode, enables its LAPIC,
+ * sets its GS base and sits in its own idle loop. Call after
+ * lapic_init() and time_init().
+ */
+#ifndef _ARCH_SMP_H
+#define _ARCH_SMP_H
+
+#include <stdint.h>
+
+#include "percpu.h"
+
+/* Where the trampoline is copied: page-aligned, below 1MB, identity
+ * mapped (the SIPI vector is its page number)
+ */
+#define SMP_TRAMPOLINE_PHYS 0x8000
+#define SMP_AP_STACK_SIZE   (16 * 1024)
+
+/* How long smp_init() waits for APs to check in */
+#define SMP_AP_WAIT_US      (100 * 1000)
+
+void smp_init(void);
+
+/* CPUs online, the BSP included (1 before smp_init) */
+uint32_t smp_num_cpus(void);
+/* percpu_t of cpu, or NULL if it is not online */
+percpu_t *smp_cpu(uint32_t cpu);
+
+void smp_dump(void);
+
+#endif /* _ARCH_SMP_H */
@@ -6,6 +6,7 @@
 .section .text
 .global enter_user_mode
 .global switch_to
+.global fiber_switch
 .extern gdt_set_kernel_stack
 
 /*
@@ -93,3 +94,28 @@ switch_to:
 
     /* 7. Return (to the address saved on the new stack) */
     ret
+
+/*
+ * void fiber_switch(uintptr_t *save_sp, uintptr_t next_sp)
+ *
+ * Cooperative switch between kernel fibers (kernel/sched/fiber.c): same
+ * address space and kernel stack rules, so only the callee-saved
+ * registers move, in the order switch_to keeps them.
+ */
+fiber_switch:
+    mov 4(%esp), %eax     /* save_sp */
+    mov 8(%esp), %ecx     /* next_sp */
+
+    push %ebp
+    push %ebx
+    push %esi
+    push %edi
+
+    mov %esp, (%eax)
+    mov %ecx, %esp
+
+    pop %edi
+    pop %esi
+    pop %ebx
+    pop %ebp
+    ret
@@ -4,95 +4,116 @@
 #include "../console.h"
 #include "../process.h"          /* For process_exit, etc. */
 #include "../sched/sched_core.h" /* For schedule/yield */
+#include "../sched/tmap.h"
+#include "gdt.h"
 #include "idt.h"
 #include "../ipc/heap.h"
 #include "../mm/vmm.h"
 #include "../mm/pmm.h"
 
-/*
- * Syscall Numbers (ABI)
- * 0: sys_exit
- * 1: sys_log
- * 2: sys_yield
- * 3: sys_map_tensor
- */
+/* Entry point for SYSENTER (arch/isr.s) */
+extern void sysenter_entry(void);
+
+/* Set once the SYSENTER MSRs are programmed */
+static int sysenter_enabled;
+
+static void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__("wrmsr" :: "a"((uint32_t)val), "d"((uint32_t)(val >> 32)), "c"(msr));
+}
 
 /* Forward declarations */
 static void sys_exit(int status);
 static void sys_log(const char *msg);
 static void sys_yield(void);
 static uint32_t sys_map_tensor(uint16_t blob_id);
+static int sys_unmap_tensor(uint32_t vaddr);
 
-/* sys_map_tensor(blob_id) -> vaddr */
+/* sys_map_tensor(blob_id) -> vaddr of the blob's data, 0 on failure */
 static uint32_t sys_map_tensor(uint16_t blob_id) {
-    uint32_t phys_addr = heap_get_blob_phys(blob_id);
-    if (!phys_addr) {
-        console_write("[syscall] map_tensor: invalid blob\n");
+    process_t *proc = sched_current();
+    if (!proc || (proc->flags & PROCESS_FLAG_KERNEL))
         return 0;
+
+    uint32_t vaddr = tmap_map(proc, blob_id);
+    if (!vaddr) {
+        console_write("[syscall] map_tensor: cannot map blob ");
+        print_uint(blob_id);
+        console_write("\n");
     }
-    
-    uint32_t size = heap_get_blob_size(blob_id);
-    /* Align size to pages */
-    
-    /* Find a free user vaddr. Simple bump allocator for now.
-     * We'll assume user space starts at 0x80000000 and goes up.
-     */
-    static uint32_t next_map_addr = 0x80000000;
-    
-    uint32_t vaddr = next_map_addr;
-    
-    /* Map it! user=1, rw=1. Flags: PTE_USER (4) | PTE_RW (2) | PTE_PRESENT (1) = 7 */
-    if (vmm_map_range(vaddr, phys_addr, size, 0x07) != 0) {
-         console_write("[syscall] map_tensor: map failed\n");
-         return 0;
-    }
-    
-    /* Advance bump pointer (aligned to 4KB) */
-    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    next_map_addr += pages * PAGE_SIZE;
-    
-    console_write("[syscall] mapped blob ");
-    print_uint(blob_id);
-    console_write(" to ");
-    print_hex32(vaddr);
-    console_write("\n");
-    
     return vaddr;
 }
 
-/* Main Syscall Handler */
-void syscall_handler(interrupt_frame_t *frame) {
-  uint32_t syscall_num = frame->eax;
+/* sys_unmap_tensor(vaddr) -> 0, -1 if no tensor is mapped there */
+static int sys_unmap_tensor(uint32_t vaddr) {
+    process_t *proc = sched_current();
+    if (!proc || (proc->flags & PROCESS_FLAG_KERNEL))
+        return -1;
+    return tmap_unmap(proc, vaddr);
+}
 
-  switch (syscall_num) {
-  case 0: /* sys_exit */
-    sys_exit((int)frame->ebx);
-    break;
+/* Common dispatch for int 0x80 and SYSENTER */
+uint32_t syscall_dispatch(uint32_t num, uint32_t a0, uint32_t a1, uint32_t a2) {
+  (void)a1;
+  (void)a2;
 
-  case 1: /* sys_log */
-    sys_log((const char *)frame->ebx);
-    break;
+  switch (num) {
+  case SYS_EXIT:
+    sys_exit((int)a0);
+    return 0;
 
-  case 2: /* sys_yield */
+  case SYS_LOG:
+    sys_log((const char *)a0);
+    return 0;
+
+  case SYS_YIELD:
     sys_yield();
-    break;
-    
-  case 3: /* sys_map_tensor */
-    frame->eax = sys_map_tensor((uint16_t)frame->ebx);
-    break;
+    return 0;
+
+  case SYS_MAP_TENSOR:
+    return sys_map_tensor((uint16_t)a0);
+
+  case SYS_UNMAP_TENSOR:
+    return (uint32_t)sys_unmap_tensor(a0);
 
   default:
     console_write("[syscall] unknown syscall: ");
-    // print_uint(syscall_num);
+    print_uint(num);
     console_write("\n");
-    break;
+    return (uint32_t)-1;
   }
 }
 
+/* Main Syscall Handler (int 0x80) */
+void syscall_handler(interrupt_frame_t *frame) {
+  frame->eax = syscall_dispatch(frame->eax, frame->ebx, frame->esi, frame->edi);
+}
+
+void syscall_set_kernel_stack(uint32_t stack) {
+  if (sysenter_enabled)
+    wrmsr(MSR_SYSENTER_ESP, stack);
+}
+
 /* Initialize syscalls */
 void syscall_init(void) {
   console_write("[syscall] registering syscall handler on vector 128\n");
   idt_register_handler(INT_SYSCALL, syscall_handler);
+
+  /* SYSENTER/SYSEXIT: CPUID.1 EDX SEP. CS is the kernel code selector;
+   * SYSEXIT derives user CS/SS from it (+16/+24), which is the GDT order
+   */
+  uint32_t a, b, c, d;
+  __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+  if (!(d & (1u << 11))) {
+    console_write("[syscall] no SYSENTER, int 0x80 only\n");
+    return;
+  }
+
+  /* The stack follows TSS esp0, set on every switch (switch_to) */
+  wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE_SEG);
+  wrmsr(MSR_SYSENTER_ESP, 0);
+  wrmsr(MSR_SYSENTER_EIP, (uint32_t)(uintptr_t)sysenter_entry);
+  sysenter_enabled = 1;
+  console_write("[syscall] SYSENTER fast path enabled\n");
 }
 
 /* --- Implementations --- */
@@ -100,9 +121,7 @@ void syscall_init(void) {
 static void sys_exit(int status) {
   (void)status;
   console_write("[syscall] sys_exit called. Terminating process.\n");
-  while (1) {
-    schedule();
-  }
+  sched_exit();
 }
 
 static void sys_log(const char *msg) {
@@ -112,4 +131,4 @@ static void sys_log(const char *msg) {
   console_write("\n");
 }
 
-static void sys_yield(void) { schedule(); }
+static void sys_yield(void) { sched_yield(); }
@@ -6,10 +6,34 @@
 #include "idt.h"
 #include <stdint.h>
 
-/* Initialize syscall subsystem */
+/* Syscall numbers (ABI) */
+#define SYS_EXIT        0
+#define SYS_LOG         1
+#define SYS_YIELD       2
+#define SYS_MAP_TENSOR  3
+#define SYS_UNMAP_TENSOR 4
+
+/* SYSENTER MSRs */
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+
+/* Initialize syscall subsystem: int 0x80, plus SYSENTER where the CPU
+ * has it
+ */
 void syscall_init(void);
 
 /* The handler (registered in IDT) */
 void syscall_handler(interrupt_frame_t *frame);
 
+/* Both entry paths: eax = number, ebx/esi/edi = arguments. Returns eax
+ *
+ * SYSENTER (arch/isr.s sysenter_entry) takes the user stack in ecx and
+ * the return address in edx, as SYSEXIT gives them back.
+ */
+uint32_t syscall_dispatch(uint32_t num, uint32_t a0, uint32_t a1, uint32_t a2);
+
+/* Kernel stack SYSENTER lands on; kept equal to TSS esp0 */
+void syscall_set_kernel_stack(uint32_t stack);
+
 #endif /* _ARCH_SYSCALL_H */
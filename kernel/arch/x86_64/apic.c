@@ -3,6 +3,7 @@
 #include "../apic.h"
 #include "../../console.h"
 #include "../../mm/vmm.h"
+#include "../../time/time.h"
 
 /* Default LAPIC physical address is 0xFEE00000 */
 /* We need to map this to virtual memory */
@@ -10,7 +11,22 @@
 #define LAPIC_VIRT_BASE 0xFFFFFFFFEE000000 /* Map at -288MB? Or just 1:1 if identity mapped? */
 /* Actually, let's use a safe high hook. 0xFEE00000 is usually reserved in memory map. */
 
+/* The i386 kernel only maps itself and what drivers ask for */
+#define LAPIC_VIRT_I386 0xE1800000
+
+/* Countdown calibration window */
+#define LAPIC_CALIBRATE_US 10000
+
 static volatile uint32_t *lapic_base = (volatile uint32_t *)LAPIC_PHYS_BASE;
+static int lapic_enabled;
+
+static uint32_t timer_mode = LAPIC_TIMER_NONE;
+static uint32_t timer_counts_per_ms;  /* LAPIC_TIMER_COUNT, divide by 16 */
+static uint64_t timer_armed;          /* Deadline programmed, 0 = none */
+
+static void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ __volatile__("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
 
 /* Helper: Read MSR */
 static uint64_t rdmsr(uint32_t msr) {
@@ -45,6 +61,13 @@ uint32_t lapic_get_id(void) {
 void lapic_init(void) {
     console_write("[apic] initializing Local APIC...\n");
 
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & (1u << 9))) {
+        console_write("[apic] not present\n");
+        return;
+    }
+
     /* check MSR for APIC base */
     uint64_t apic_msr = rdmsr(IA32_APIC_BASE_MSR);
     uint32_t phys_base = apic_msr & 0xFFFFF000;
@@ -56,7 +79,16 @@ void lapic_init(void) {
     */
     /* vmm_map_page(LAPIC_PHYS_BASE, LAPIC_PHYS_BASE, PTE_PRESENT | PTE_RW | PTE_CACHE_DISABLE); */
     
+#if defined(__x86_64__)
     lapic_base = (volatile uint32_t *)(uintptr_t)phys_base;
+#else
+    if (vmm_map_page(LAPIC_VIRT_I386, phys_base,
+                     PTE_PRESENT | PTE_WRITABLE | PTE_CACHE_DISABLE) != 0) {
+        console_write("[apic] failed to map registers\n");
+        return;
+    }
+    lapic_base = (volatile uint32_t *)LAPIC_VIRT_I386;
+#endif
     
     console_write("[apic] Base: ");
     print_hex32(phys_base);
@@ -67,9 +99,88 @@ void lapic_init(void) {
 
     /* Set Spurious Interrupt Vector (bit 8 = enable) */
     /* Vector 0xFF (255) is commonly used for spurious */
-    lapic_write(LAPIC_SVR, 0xFF | APIC_SVR_ENABLE);
+    lapic_write(LAPIC_SVR, LAPIC_SPURIOUS_VECTOR | APIC_SVR_ENABLE);
+    lapic_enabled = 1;
     
     console_write("[apic] enabled. ID=");
     print_uint(lapic_get_id());
     console_write("\n");
 }
+
+void lapic_init_ap(void) {
+    wrmsr(IA32_APIC_BASE_MSR, rdmsr(IA32_APIC_BASE_MSR) | IA32_APIC_BASE_MSR_ENABLE);
+    lapic_write(LAPIC_SVR, LAPIC_SPURIOUS_VECTOR | APIC_SVR_ENABLE);
+}
+
+int lapic_timer_init(void) {
+    if (!lapic_enabled)
+        return -1;
+
+    /* Count down from the top for a known stretch of TSC time */
+    lapic_write(LAPIC_TDCR, LAPIC_TDCR_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_MASKED | LAPIC_TIMER_VECTOR);
+    uint64_t t0 = time_usec();
+    lapic_write(LAPIC_TICR, 0xFFFFFFFF);
+    while (time_usec() - t0 < LAPIC_CALIBRATE_US)
+        __asm__ __volatile__("pause");
+    uint32_t counted = 0xFFFFFFFF - lapic_read(LAPIC_TCCR);
+    lapic_write(LAPIC_TICR, 0);
+
+    timer_counts_per_ms = counted / (LAPIC_CALIBRATE_US / 1000);
+    if (!timer_counts_per_ms) {
+        console_write("[apic] timer calibration failed\n");
+        return -1;
+    }
+
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (c & (1u << 24)) {
+        timer_mode = LAPIC_TIMER_DEADLINE;
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+    } else {
+        timer_mode = LAPIC_TIMER_COUNT;
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    }
+    timer_armed = 0;
+
+    console_write("[apic] one-shot timer: ");
+    console_write(timer_mode == LAPIC_TIMER_DEADLINE ? "TSC-deadline" : "countdown");
+    console_write(", ");
+    print_uint(timer_counts_per_ms);
+    console_write(" counts/ms\n");
+    return 0;
+}
+
+uint32_t lapic_timer_mode(void) {
+    return timer_mode;
+}
+
+void lapic_timer_oneshot(uint64_t deadline_us) {
+    if (timer_mode == LAPIC_TIMER_NONE || deadline_us == timer_armed)
+        return;
+    timer_armed = deadline_us;
+
+    if (timer_mode == LAPIC_TIMER_DEADLINE) {
+        /* Writing 0 disarms; a deadline already passed fires at once */
+        wrmsr(IA32_TSC_DEADLINE_MSR, deadline_us ? time_usec_to_tsc(deadline_us) : 0);
+        return;
+    }
+
+    if (!deadline_us) {
+        lapic_write(LAPIC_TICR, 0);
+        return;
+    }
+    uint64_t now = time_usec();
+    uint64_t counts = deadline_us > now
+                          ? (deadline_us - now) * timer_counts_per_ms / 1000 : 1;
+    if (counts == 0)
+        counts = 1;
+    if (counts > 0xFFFFFFFF)
+        counts = 0xFFFFFFFF;   /* Fires early; the handler re-arms */
+    lapic_write(LAPIC_TICR, (uint32_t)counts);
+}
+
+void lapic_timer_ack(void) {
+    timer_armed = 0;
+    lapic_eoi();
+}
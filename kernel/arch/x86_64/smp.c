@@ -0,0 +1,155 @@
+/* kernel/arch/x86_64/smp.c - AP startup and per-CPU areas */
+
+#include "../smp.h"
+#include "../apic.h"
+#include "../../console.h"
+#include "../../include/string.h"
+#include "../../mm/vmm.h"
+#include "../../time/time.h"
+
+/* ICR fields: delivery mode, level, destination shorthand */
+#define ICR_INIT          0x00000500
+#define ICR_STARTUP       0x00000600
+#define ICR_SEND_PENDING  0x00001000
+#define ICR_LEVEL_ASSERT  0x00004000
+#define ICR_ALL_BUT_SELF  0x000C0000
+
+/* arch/x86_64/boot/ap_trampoline.s */
+extern const uint8_t ap_trampoline_start[];
+extern const uint8_t ap_trampoline_end[];
+extern const uint8_t ap_tramp_params[];
+
+/* The parameter block at the end of the trampoline */
+typedef struct __attribute__((packed)) {
+    uint64_t cr3;
+    uint64_t stacks;        /* ap_stacks: cpu n runs on the top of [n - 1] */
+    uint64_t entry;         /* ap_main */
+    uint32_t next_cpu;      /* Claimed with lock xadd by each AP */
+    uint32_t pad;
+    uint8_t  gdtr[16];
+    uint8_t  idtr[16];
+} ap_tramp_params_t;
+
+static percpu_t cpus[SMP_MAX_CPUS];
+static uint8_t ap_stacks[SMP_MAX_CPUS - 1][SMP_AP_STACK_SIZE] __attribute__((aligned(16)));
+static volatile uint32_t num_online = 1;
+volatile uint32_t percpu_ready;
+
+static void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__("wrmsr" :: "a"((uint32_t)val), "d"((uint32_t)(val >> 32)), "c"(msr));
+}
+
+static void udelay(uint32_t us) {
+    usec_t t0 = time_usec();
+    while (time_usec() - t0 < us)
+        __asm__ __volatile__("pause");
+}
+
+static void send_ipi(uint32_t icr) {
+    lapic_write(LAPIC_ICR_HIGH, 0);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_SEND_PENDING)
+        __asm__ __volatile__("pause");
+}
+
+/* Claim cpus[cpu] for the calling CPU: GS base and identity */
+static void percpu_setup(uint32_t cpu) {
+    percpu_t *p = &cpus[cpu];
+    p->self = p;
+    p->cpu_id = cpu;
+    p->apic_id = lapic_get_id();
+    wrmsr(IA32_GS_BASE_MSR, (uint64_t)(uintptr_t)p);
+}
+
+/* Per-CPU idle loop: nothing is scheduled on APs yet, they wake for IPIs */
+static void __attribute__((noreturn)) cpu_idle(percpu_t *p) {
+    for (;;) {
+        __asm__ __volatile__("sti; hlt" ::: "memory");
+        p->idle_wakeups++;
+    }
+}
+
+/* C entry of an AP, from the trampoline on its own stack */
+void ap_main(uint32_t cpu) {
+    vmm_cpu_init();
+    lapic_init_ap();
+    percpu_setup(cpu);
+    cpus[cpu].online = 1;
+    __atomic_fetch_add(&num_online, 1, __ATOMIC_SEQ_CST);
+    cpu_idle(&cpus[cpu]);
+}
+
+void smp_init(void) {
+    percpu_setup(0);
+    cpus[0].online = 1;
+    percpu_ready = 1;
+
+    /* Logical processors per package, only to stop waiting early */
+    uint32_t a, b, c, d;
+    __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+    uint32_t expected = (d & (1u << 28)) ? (b >> 16) & 0xFF : 0;
+
+    /* Trampoline and its parameters */
+    uint8_t *tramp = (uint8_t *)(uintptr_t)SMP_TRAMPOLINE_PHYS;
+    memcpy(tramp, ap_trampoline_start, (size_t)(ap_trampoline_end - ap_trampoline_start));
+    ap_tramp_params_t *prm = (ap_tramp_params_t *)(tramp + (ap_tramp_params - ap_trampoline_start));
+    uint64_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+    prm->cr3 = cr3;
+    prm->stacks = (uint64_t)(uintptr_t)ap_stacks;
+    prm->entry = (uint64_t)(uintptr_t)ap_main;
+    prm->next_cpu = 1;
+    __asm__ __volatile__("sgdt %0" : "=m"(prm->gdtr));
+    __asm__ __volatile__("sidt %0" : "=m"(prm->idtr));
+
+    /* INIT, then two startup IPIs at the trampoline's page */
+    send_ipi(ICR_ALL_BUT_SELF | ICR_LEVEL_ASSERT | ICR_INIT);
+    udelay(10000);
+    for (int i = 0; i < 2; i++) {
+        send_ipi(ICR_ALL_BUT_SELF | ICR_LEVEL_ASSERT | ICR_STARTUP |
+                 (SMP_TRAMPOLINE_PHYS >> 12));
+        udelay(200);
+    }
+
+    usec_t t0 = time_usec();
+    while (time_usec() - t0 < SMP_AP_WAIT_US && !(expected && num_online >= expected))
+        __asm__ __volatile__("pause");
+
+    console_write("[smp] ");
+    print_uint(num_online);
+    console_write(" CPU(s) online");
+    if (prm->next_cpu > SMP_MAX_CPUS) {
+        console_write(", ");
+        print_uint(prm->next_cpu - SMP_MAX_CPUS);
+        console_write(" parked past SMP_MAX_CPUS");
+    }
+    console_write("\n");
+}
+
+uint32_t smp_num_cpus(void) {
+    return num_online;
+}
+
+percpu_t *smp_cpu(uint32_t cpu) {
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online)
+        return NULL;
+    return &cpus[cpu];
+}
+
+void smp_dump(void) {
+    console_write("[smp] CPUs:\n");
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        const percpu_t *p = smp_cpu(i);
+        if (!p)
+            continue;
+        console_write("  cpu ");
+        print_uint(p->cpu_id);
+        console_write(" apic ");
+        print_uint(p->apic_id);
+        console_write(" idle wakeups ");
+        print_uint((uint32_t)p->idle_wakeups);
+        console_write(" trace events ");
+        print_uint((uint32_t)p->trace_events);
+        console_write("\n");
+    }
+}
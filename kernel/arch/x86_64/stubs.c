@@ -1,5 +1,4 @@
 #include "../../console.h"
-#include "../../mm/vmm.h"
 #include <stdint.h>
 
 /* Stubs for architecture-specific initialization called by kmain.c */
@@ -17,27 +16,6 @@ void pit_init(uint32_t freq) {
 
 void keyboard_init(void) { console_write("[arch] Keyboard stub\n"); }
 
-void vmm_init(void) { console_write("[mm] VMM stub\n"); }
-
-/* VMM Stubs for IPC/IVSHMEM (Assuming identity map) */
-int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
-  (void)vaddr;
-  (void)paddr;
-  (void)flags;
-  /* console_write("[mm] vmm_map_page stub\n"); */
-  return 0;
-}
-
-int vmm_map_range(vaddr_t v, paddr_t p, uint32_t len, uint32_t flags) {
-  (void)v;
-  (void)p;
-  (void)len;
-  (void)flags;
-  return 0;
-}
-
-paddr_t vmm_virt_to_phys(vaddr_t v) { return (paddr_t)v; }
-
 /* Interrupt Stubs */
 void isr_handler(void *tf) {
   (void)tf;
@@ -1,8 +1,35 @@
-/* kernel/console.c */
+/* kernel/console.c
+ *
+ * VGA text and COM1. Serial output starts synchronous, one busy-wait per
+ * character; after console_irq_init() it goes through a ring the UART's
+ * transmit-empty interrupt drains a FIFO (16 bytes) at a time, so a
+ * console_write() costs the copy. A full ring drops (console_dropped())
+ * unless the writer has interrupts off, which waits for room instead.
+ * console_sync() returns to synchronous output for a panic.
+ */
 #include "console.h"
+#include "arch/idt.h"
+#ifndef __x86_64__
+#include "arch/pic.h"
+#endif
 
 /* Serial port (COM1) */
 #define SERIAL_PORT 0x3F8
+#define SERIAL_IRQ 4
+#define UART_IER 1
+#define UART_IIR 2
+#define UART_LSR 5
+#define IER_THRE 0x02 /* Interrupt when the transmit FIFO empties */
+#define LSR_THRE 0x20
+#define UART_FIFO 16
+
+/* Line rate; the divisor is 115200 / CONSOLE_BAUD (make CONSOLE_BAUD=) */
+#ifndef CONSOLE_BAUD
+#define CONSOLE_BAUD 38400
+#endif
+
+/* Characters waiting for the UART once console_irq_init() has run */
+#define TX_RING 4096
 
 static inline void outb(uint16_t port, uint8_t val) {
   __asm__ __volatile__("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -16,26 +43,131 @@ static inline uint8_t inb(uint16_t port) {
 
 static int serial_enabled = 0;
 
+static char tx_ring[TX_RING];
+static uint32_t tx_head, tx_tail; /* Free-running; tx_head - tx_tail queued */
+static uint32_t tx_dropped;
+static int tx_irq;                /* The THRE interrupt drains tx_ring */
+static int tx_ier;                /* IER_THRE set */
+static volatile uint8_t tx_lock;
+static int quiet;                 /* console_set_quiet(): output dropped */
+
 static void serial_init(void) {
+  uint16_t divisor = 115200 / CONSOLE_BAUD;
   outb(SERIAL_PORT + 1, 0x00); /* Disable all interrupts */
   outb(SERIAL_PORT + 3, 0x80); /* Enable DLAB (set baud rate divisor) */
-  outb(SERIAL_PORT + 0, 0x03); /* Set divisor to 3 (lo byte) 38400 baud */
-  outb(SERIAL_PORT + 1, 0x00); /*                  (hi byte) */
+  outb(SERIAL_PORT + 0, divisor & 0xFF); /* Divisor lo byte */
+  outb(SERIAL_PORT + 1, divisor >> 8);   /*         hi byte */
   outb(SERIAL_PORT + 3, 0x03); /* 8 bits, no parity, one stop bit */
   outb(SERIAL_PORT + 2, 0xC7); /* Enable FIFO, clear them, 14-byte threshold */
   outb(SERIAL_PORT + 4, 0x0B); /* IRQs enabled, RTS/DSR set */
   serial_enabled = 1;
 }
 
+static int tx_lock_take(void) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  while (__atomic_test_and_set(&tx_lock, __ATOMIC_ACQUIRE))
+    __asm__ __volatile__("pause");
+  return was;
+}
+
+static void tx_lock_give(int was) {
+  __atomic_clear(&tx_lock, __ATOMIC_RELEASE);
+  if (was)
+    interrupts_enable();
+}
+
+/* Helper: the FIFO is empty (LSR_THRE); load up to a FIFO's worth */
+static void tx_fill(void) {
+  for (int n = 0; n < UART_FIFO && tx_tail != tx_head; n++)
+    outb(SERIAL_PORT, (uint8_t)tx_ring[tx_tail++ & (TX_RING - 1)]);
+}
+
+/* Helper: lock held; interrupt on an empty FIFO only while there is more */
+static void tx_set_ier(void) {
+  int want = tx_tail != tx_head;
+  if (want != tx_ier) {
+    outb(SERIAL_PORT + UART_IER, want ? IER_THRE : 0);
+    tx_ier = want;
+  }
+}
+
 static void serial_putc(char c) {
   if (!serial_enabled)
     return;
-  /* Wait for transmit empty */
-  while ((inb(SERIAL_PORT + 5) & 0x20) == 0)
-    ;
-  outb(SERIAL_PORT, c);
+  if (!tx_irq) {
+    /* Wait for transmit empty */
+    while ((inb(SERIAL_PORT + UART_LSR) & LSR_THRE) == 0)
+      ;
+    outb(SERIAL_PORT, c);
+    return;
+  }
+
+  int was = tx_lock_take();
+  if (tx_head - tx_tail == TX_RING) {
+    if (was) {
+      /* The interrupt will drain it: drop rather than wait */
+      tx_dropped++;
+      tx_lock_give(was);
+      return;
+    }
+    /* Interrupts off, nothing else will make room */
+    while ((inb(SERIAL_PORT + UART_LSR) & LSR_THRE) == 0)
+      ;
+    tx_fill();
+  }
+  tx_ring[tx_head++ & (TX_RING - 1)] = c;
+  if (inb(SERIAL_PORT + UART_LSR) & LSR_THRE)
+    tx_fill();
+  tx_set_ier();
+  tx_lock_give(was);
+}
+
+#ifndef __x86_64__
+/* IRQ 4 */
+static void serial_irq(interrupt_frame_t *frame) {
+  (void)frame;
+  int was = tx_lock_take();
+  (void)inb(SERIAL_PORT + UART_IIR); /* Reading IIR acknowledges THRE */
+  if (inb(SERIAL_PORT + UART_LSR) & LSR_THRE)
+    tx_fill();
+  tx_set_ier();
+  tx_lock_give(was);
+}
+#endif
+
+int console_irq_init(void) {
+#ifdef __x86_64__
+  return -1; /* No routed ISA IRQs yet: stay synchronous */
+#else
+  if (!serial_enabled)
+    return -1;
+  irq_register_handler(SERIAL_IRQ, serial_irq);
+  pic_unmask_irq(SERIAL_IRQ);
+  tx_irq = 1;
+  return 0;
+#endif
 }
 
+void console_sync(void) {
+  /* May run with the lock held by whoever crashed: don't take it */
+  quiet = 0;
+  tx_irq = 0;
+  if (!serial_enabled)
+    return;
+  outb(SERIAL_PORT + UART_IER, 0);
+  tx_ier = 0;
+  while (tx_tail != tx_head) {
+    while ((inb(SERIAL_PORT + UART_LSR) & LSR_THRE) == 0)
+      ;
+    tx_fill();
+  }
+}
+
+uint32_t console_dropped(void) { return tx_dropped; }
+
+void console_set_quiet(int on) { quiet = on; }
+
 /* VGA buffer */
 static uint16_t *const VGA_BUFFER = (uint16_t *)0xB8000;
 static const int VGA_WIDTH = 80;
@@ -119,6 +251,9 @@ static void console_scroll(void) {
 }
 
 void console_putc(char c) {
+  if (quiet)
+    return;
+
   /* Output to serial port */
   if (c == '\n') {
     serial_putc('\r'); /* Serial needs CR+LF */
@@ -12,4 +12,18 @@ void print_hex32(uint32_t val);
 void print_hex64(uint64_t val);
 void print_uint(uint32_t val);
 
+/* Serial output through a ring drained by the UART interrupt (i386)
+ * Returns: 0, or -1 where the IRQ can't be used (output stays synchronous)
+ */
+int console_irq_init(void);
+
+/* Panic path: write out what is queued, synchronous from here on */
+void console_sync(void);
+
+/* Characters lost to a full serial ring */
+uint32_t console_dropped(void);
+
+/* Drop all output (fast boot) until called with 0; console_sync() ends it */
+void console_set_quiet(int on);
+
 #endif /* _CONSOLE_H */
@@ -76,7 +76,7 @@ void contract_apply(task_contract_t *c) {
   flightrec_log(TRACE_EVT_CONTRACT_APPLY, c->job_id, 0, c->cpu_budget_us);
 }
 
-int contract_charge_cpu(task_contract_t *c, uint32_t usec) {
+static int judge_cpu(task_contract_t *c, uint32_t usec) {
   c->cpu_used_us += usec;
 
   if (c->cpu_used_us > c->cpu_budget_us) {
@@ -99,7 +99,7 @@ int contract_charge_cpu(task_contract_t *c, uint32_t usec) {
   return 0;
 }
 
-int contract_charge_memory(task_contract_t *c, uint32_t kb) {
+static int judge_memory(task_contract_t *c, uint32_t kb) {
   c->mem_used_kb += kb;
 
   if (c->mem_used_kb > c->memory_kb) {
@@ -121,6 +121,18 @@ int contract_charge_memory(task_contract_t *c, uint32_t kb) {
   return 0;
 }
 
+int contract_judge(task_contract_t *c, contract_charge_t kind, uint32_t amount) {
+  return kind == CONTRACT_CHARGE_CPU ? judge_cpu(c, amount) : judge_memory(c, amount);
+}
+
+int contract_charge_cpu(task_contract_t *c, uint32_t usec) {
+  return contract_charge(c, CONTRACT_CHARGE_CPU, usec);
+}
+
+int contract_charge_memory(task_contract_t *c, uint32_t kb) {
+  return contract_charge(c, CONTRACT_CHARGE_MEM, kb);
+}
+
 paddr_t contract_alloc_page(task_contract_t *c) {
   /* Check if we're in safe mode */
   if (c->state == CONTRACT_STATE_SAFE_MODE) {
@@ -131,14 +143,15 @@ paddr_t contract_alloc_page(task_contract_t *c) {
 
   /* Pre-check: Will this allocation exceed budget? */
   uint32_t page_kb = PAGE_SIZE / 1024;
-  if (c->mem_used_kb + page_kb > c->memory_kb) {
+  uint32_t used_kb = contract_used(c, CONTRACT_CHARGE_MEM);
+  if (used_kb + page_kb > c->memory_kb) {
     c->mem_violations++;
 
     console_write("[contracts] allocation denied: BUDGET EXCEEDED\n");
 
     /* Log memory violation */
     flightrec_log(TRACE_EVT_MEM_CONTRACT_EXCEED, c->job_id, 0,
-                  c->mem_used_kb + page_kb);
+                  used_kb + page_kb);
 
     /* State machine transition */
     if (c->state == CONTRACT_STATE_OK) {
@@ -168,8 +181,8 @@ paddr_t contract_alloc_page(task_contract_t *c) {
   zalloc_result_t result = zenedge_alloc_page(node_pref);
 
   if (result.addr) {
-    /* Commit charge */
-    c->mem_used_kb += page_kb;
+    /* Commit charge (within budget: checked above) */
+    contract_charge_memory(c, page_kb);
 
     /* Log allocation with actual node used */
     flightrec_log(TRACE_EVT_MEM_ALLOC, c->job_id, result.node, 1);
@@ -189,9 +202,7 @@ void contract_free_page(task_contract_t *c, paddr_t addr) {
   zenedge_free_page((zphys_t)addr);
 
   /* Credit memory back */
-  if (c->mem_used_kb >= PAGE_SIZE / 1024) {
-    c->mem_used_kb -= PAGE_SIZE / 1024;
-  }
+  contract_credit_memory(c, PAGE_SIZE / 1024);
 
   flightrec_log(TRACE_EVT_MEM_FREE, c->job_id, node, 1);
 }
@@ -235,11 +246,11 @@ void contract_debug_print(const task_contract_t *c) {
   console_write(": state=");
   console_write(contract_state_name(c->state));
   console_write(", cpu=");
-  print_uint(c->cpu_used_us);
+  print_uint(contract_used(c, CONTRACT_CHARGE_CPU));
   console_write("/");
   print_uint(c->cpu_budget_us);
   console_write("us, mem=");
-  print_uint(c->mem_used_kb);
+  print_uint(contract_used(c, CONTRACT_CHARGE_MEM));
   console_write("/");
   print_uint(c->memory_kb);
   console_write("KB\n");
@@ -302,7 +313,8 @@ admit_result_t contract_admit_job(const task_contract_t *c,
   }
 
   /* Check 3: Already at memory limits? */
-  uint32_t available_kb = c->memory_kb - c->mem_used_kb;
+  uint32_t used_kb = contract_used(c, CONTRACT_CHARGE_MEM);
+  uint32_t available_kb = c->memory_kb > used_kb ? c->memory_kb - used_kb : 0;
   if (jg->peak_memory_kb > available_kb) {
     console_write("[admit] REJECTED: insufficient available memory (");
     print_uint(available_kb);
@@ -312,26 +324,13 @@ admit_result_t contract_admit_job(const task_contract_t *c,
     return ADMIT_REJECT_NO_RESOURCES;
   }
 
-  /* Check 4: Estimate CPU time based on step count
-   * Simple heuristic: ~1000us per compute step, ~3000us per collective
+  /* Check 4: Estimate CPU time from the steps' durations: measured ones
+   * where the scheduler has them, the per-type heuristic otherwise
    */
   uint32_t estimated_cpu_us = 0;
-  for (uint8_t i = 0; i < jg->num_steps; i++) {
+  for (uint32_t i = 0; i < jg->num_steps; i++) {
     const job_step_t *s = &jg->steps[i];
-    switch (s->type) {
-    case STEP_TYPE_COMPUTE:
-      estimated_cpu_us += 1000;
-      break;
-    case STEP_TYPE_COLLECTIVE:
-      estimated_cpu_us += 3000;
-      break;
-    case STEP_TYPE_IO:
-      estimated_cpu_us += 2000;
-      break;
-    case STEP_TYPE_CONTROL:
-      estimated_cpu_us += 100;
-      break;
-    }
+    estimated_cpu_us += s->est_us ? s->est_us : job_step_default_us(s->type);
   }
 
   console_write("[admit] estimated CPU: ");
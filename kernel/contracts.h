@@ -54,15 +54,29 @@ typedef struct {
     /* State machine */
     contract_state_t state;     /* Current enforcement state */
     uint32_t job_id;            /* Associated job for tracing */
+
+    /* REALTIME: time_usec() the job must be done by, 0 = none. Ready
+     * steps of REALTIME jobs are dispatched earliest deadline first.
+     */
+    uint64_t deadline_us;
 } task_contract_t;
 
+/* What a charge is counted in (contract_charge()) */
+typedef enum {
+    CONTRACT_CHARGE_CPU = 0,    /* cpu_used_us */
+    CONTRACT_CHARGE_MEM,        /* mem_used_kb */
+    CONTRACT_CHARGE_KINDS
+} contract_charge_t;
+
 /* Initialize contract system */
 void contracts_init(void);
 
 /* Apply a contract (sets up tracking, logs event) */
 void contract_apply(task_contract_t *c);
 
-/* Charge CPU time to a contract
+/* Charge CPU time to a contract. A registered contract's charges may wait
+ * in per-CPU counters while the budget can't be reached (see
+ * contract_registry.c); the used counters then lag, contract_used() doesn't.
  * Returns: 0 if within budget, 1 if exceeded (violation logged)
  */
 int contract_charge_cpu(task_contract_t *c, uint32_t usec);
@@ -72,6 +86,9 @@ int contract_charge_cpu(task_contract_t *c, uint32_t usec);
  */
 int contract_charge_memory(task_contract_t *c, uint32_t kb);
 
+/* Give back memory charged earlier */
+void contract_credit_memory(task_contract_t *c, uint32_t kb);
+
 /* Allocate a page through a contract (charges memory, respects node pref)
  * Returns: physical address or 0 on failure
  */
@@ -92,12 +109,52 @@ const char* contract_state_name(contract_state_t state);
 /* Debug: print contract details */
 void contract_debug_print(const task_contract_t *c);
 
-/* Register contract for lookup (oracle adapter) */
+/* Register contract for lookup (oracle adapter); registering a job id
+ * again replaces its contract. At most 64 at once.
+ */
 void contract_register(task_contract_t *c);
 
-/* Lookup contract by job id (for oracle adapters) */
+/* Drop a job's contract, folding its charges in first. Its charges must
+ * have stopped.
+ */
+void contract_unregister(uint32_t job_id);
+
+/* Lookup contract by job id (for oracle adapters), without locking */
 const task_contract_t *contract_lookup(uint32_t job_id);
 
+/* Charges (contract_registry.c)
+ * contract_charge: add amount of kind, per-CPU while no budget can be
+ *   crossed. Returns: 1 if over budget (violation logged), else 0.
+ * contract_judge: add amount to c's counters and judge them at once
+ *   (contracts.c; how contract_charge settles)
+ * contract_used: used counter of kind, charges still per-CPU included
+ * contract_fold: move c's per-CPU charges into its counters
+ * contract_fold_all: the same for every registered contract
+ */
+int contract_charge(task_contract_t *c, contract_charge_t kind, uint32_t amount);
+int contract_judge(task_contract_t *c, contract_charge_t kind, uint32_t amount);
+uint32_t contract_used(const task_contract_t *c, contract_charge_t kind);
+void contract_fold(task_contract_t *c);
+void contract_fold_all(void);
+
+/* A registered contract's usage, as of contract_snapshot() */
+typedef struct {
+    uint32_t job_id;
+    contract_state_t state;
+    contract_priority_t prio;
+    uint32_t cpu_used_us;       /* Charges still per-CPU included */
+    uint32_t cpu_budget_us;
+    uint32_t mem_used_kb;
+    uint32_t mem_budget_kb;
+    uint32_t violations;        /* CPU and memory */
+} contract_usage_t;
+
+/* Copy the usage of up to max registered contracts into out, in entry
+ * order, without folding their charges
+ * Returns: contracts copied; *registered (if not NULL) = all registered
+ */
+uint32_t contract_snapshot(contract_usage_t *out, uint32_t max, uint32_t *registered);
+
 /* ========================================================================
  * Admission Control
  * ======================================================================== */
@@ -0,0 +1,142 @@
+/* kernel/drivers/bridge_act.c - Actuator batches as CMD_ACT_APPLY
+ *
+ * One inline command per batch; the bridge's answer says how long before
+ * it replied the settings took effect, which the response callback turns
+ * into time_usec(). The settings are the same on the wire as in the API.
+ */
+#include "bridge_act.h"
+#include "../ipc/completion.h"
+#include "../ipc/ipc.h"
+#include "../time/time.h"
+
+enum { BATCH_FREE, BATCH_PENDING, BATCH_DONE, BATCH_FAILED };
+
+typedef struct {
+  ipc_tag_t tag; /* The handle */
+  volatile uint8_t state;
+  uint64_t sent_us;
+  uint64_t effect_us;
+} bridge_batch_t;
+
+_Static_assert(sizeof(ipc_act_setting_t) == sizeof(act_setting_t) &&
+                   IPC_ACT_KNOB_CLOCK_MHZ == ACT_KNOB_CLOCK_MHZ &&
+                   IPC_ACT_KNOB_POWER_W == ACT_KNOB_POWER_W &&
+                   IPC_ACT_MAX_SETTINGS == ACT_BATCH_MAX,
+               "act_setting_t is the CMD_ACT_APPLY wire format");
+
+static bridge_batch_t batches[BRIDGE_ACT_INFLIGHT];
+static actuator_t devices[BRIDGE_ACT_DEVICES];
+
+/* Response path (maybe IRQ): place the effect on our clock */
+static void batch_done(const ipc_response_t *rsp, void *arg) {
+  bridge_batch_t *b = (bridge_batch_t *)arg;
+  if (rsp->status != RSP_OK) {
+    b->state = BATCH_FAILED;
+    return;
+  }
+  uint64_t now = time_usec();
+  uint64_t at = now > rsp->result ? now - rsp->result : 0;
+  b->effect_us = at > b->sent_us ? at : b->sent_us;
+  b->state = BATCH_DONE;
+}
+
+static act_handle_t bridge_submit(actuator_t *self, const act_batch_t *batch) {
+  if (!batch->count || batch->count > IPC_ACT_MAX_SETTINGS)
+    return ACT_HANDLE_NONE;
+
+  bridge_batch_t *b = 0;
+  for (uint32_t i = 0; i < BRIDGE_ACT_INFLIGHT && !b; i++)
+    if (batches[i].state == BATCH_FREE)
+      b = &batches[i];
+  if (!b)
+    return ACT_HANDLE_NONE;
+
+  ipc_act_setting_t wire[IPC_ACT_MAX_SETTINGS];
+  for (uint32_t i = 0; i < batch->count; i++) {
+    wire[i].knob = batch->settings[i].knob;
+    wire[i].reserved = 0;
+    wire[i].value = batch->settings[i].value;
+  }
+
+  b->state = BATCH_PENDING;
+  b->sent_us = time_usec();
+  b->tag = ipc_submit_inline(CMD_ACT_APPLY, (uint32_t)(uintptr_t)self->priv, wire,
+                             (uint16_t)(batch->count * sizeof(ipc_act_setting_t)));
+  if (b->tag == IPC_TAG_NONE) {
+    b->state = BATCH_FREE;
+    return ACT_HANDLE_NONE;
+  }
+  /* Runs batch_done() now if the answer beat us here */
+  ipc_completion_set_cb(b->tag, batch_done, b);
+  return b->tag;
+}
+
+static int bridge_poll(actuator_t *self, act_handle_t h, uint64_t *effect_us) {
+  (void)self;
+  bridge_batch_t *b = 0;
+  for (uint32_t i = 0; i < BRIDGE_ACT_INFLIGHT && !b; i++)
+    if (batches[i].state != BATCH_FREE && batches[i].tag == h)
+      b = &batches[i];
+  if (!b)
+    return -1;
+
+  if (b->state == BATCH_PENDING)
+    ipc_msg_process();
+  if (b->state == BATCH_PENDING) {
+    if (time_usec() - b->sent_us < BRIDGE_ACT_TIMEOUT_US)
+      return 0;
+    ipc_completion_cancel(b->tag);
+    b->state = BATCH_FAILED;
+  }
+
+  int rc = b->state == BATCH_DONE ? 1 : -1;
+  if (rc == 1 && effect_us)
+    *effect_us = b->effect_us;
+  b->state = BATCH_FREE;
+  return rc;
+}
+
+/* Helper: the synchronous methods, as a batch of one waited for */
+static int bridge_apply(actuator_t *self, uint16_t knob, uint32_t value) {
+  act_batch_t batch;
+  act_batch_init(&batch);
+  act_batch_add(&batch, knob, value);
+  act_handle_t h = bridge_submit(self, &batch);
+  if (h == ACT_HANDLE_NONE)
+    return ACT_ERR_HW;
+
+  int rc;
+  while ((rc = bridge_poll(self, h, 0)) == 0)
+    __asm__ __volatile__("pause");
+  return rc == 1 ? ACT_OK : ACT_ERR_HW;
+}
+
+static int bridge_set_clock(actuator_t *self, uint32_t clock_mhz) {
+  return bridge_apply(self, ACT_KNOB_CLOCK_MHZ, clock_mhz);
+}
+
+static int bridge_set_power(actuator_t *self, uint32_t watts) {
+  return bridge_apply(self, ACT_KNOB_POWER_W, watts);
+}
+
+static int bridge_reset(actuator_t *self) {
+  (void)self;
+  return ACT_ERR_NOSUPP;
+}
+
+actuator_t *bridge_actuator(uint32_t device) {
+  if (device >= BRIDGE_ACT_DEVICES)
+    return 0;
+  actuator_t *a = &devices[device];
+  if (!a->name) {
+    a->name = "Bridge";
+    a->capabilities = ACT_CAP_CLOCK_LOCK | ACT_CAP_POWER_LIMIT;
+    a->set_clock_limit = bridge_set_clock;
+    a->set_power_limit = bridge_set_power;
+    a->reset_defaults = bridge_reset;
+    a->submit = bridge_submit;
+    a->poll = bridge_poll;
+    a->priv = (void *)(uintptr_t)device;
+  }
+  return a;
+}
@@ -0,0 +1,23 @@
+#ifndef _DRIVERS_BRIDGE_ACT_H
+#define _DRIVERS_BRIDGE_ACT_H
+
+#include "../include/api/actuator.h"
+#include <stdint.h>
+
+/* Host devices the bridge can actuate (NVML index on its side) */
+#define BRIDGE_ACT_DEVICES 4
+
+/* Batches in flight over all devices */
+#define BRIDGE_ACT_INFLIGHT 8
+
+/* A batch not answered by then fails (and the synchronous methods wait
+ * that long at most)
+ */
+#define BRIDGE_ACT_TIMEOUT_US 1000000
+
+/* Actuator for host device `device`, sending CMD_ACT_APPLY; submit and
+ * poll never block. Returns: NULL if device is out of range
+ */
+actuator_t *bridge_actuator(uint32_t device);
+
+#endif /* _DRIVERS_BRIDGE_ACT_H */
@@ -4,12 +4,14 @@
 #include "../console.h"
 #include "../mm/pmm.h" /* for PAGE_SIZE */
 #include "../mm/vmm.h"
+#include "../zenedge_alloc.h"
 
 static uint32_t ivshmem_phys_base = 0;
 static uint32_t ivshmem_size = 0;
 static void *ivshmem_virt_base = 0;
 static uint8_t ivshmem_irq = 0;
 static int ivshmem_use_msi = 0;  /* Track if MSI is being used */
+static uint32_t ivshmem_msix_vectors = 0;  /* MSI-X entries in use, 0 = none */
 
 /* BAR0 (MMR) for doorbell support */
 static volatile uint32_t *ivshmem_mmr_base = 0;
@@ -23,9 +25,44 @@ static uint32_t ivshmem_mmr_size = 0;
 
 #include "../arch/pic.h"
 
-static ivshmem_irq_callback_t ivshmem_callback = 0;
+#include "../arch/irq.h"
 
-/* IRQ Handler wrapper */
+/* BAR1: MSI-X table (ivshmem-doorbell with vectors=N) */
+#define IVSHMEM_MSIX_VIRT 0xE1010000
+
+typedef struct {
+    ivshmem_vector_handler_t fn;
+    void *arg;
+    uint32_t irqs;
+} ivshmem_vector_t;
+
+static ivshmem_vector_t ivshmem_vectors[IVSHMEM_MAX_VECTORS];
+
+#ifndef __x86_64__
+static volatile uint32_t *ivshmem_msix_table = 0;
+
+/* irq_set_affinity(): retarget the vector's MSI-X table entry */
+static int ivshmem_msix_route(uint8_t vector, uint32_t apic_id, void *ctx) {
+    (void)ctx;
+    pci_msix_set_entry(ivshmem_msix_table, vector - IVSHMEM_IDT_BASE, vector,
+                       (uint8_t)apic_id);
+    return 0;
+}
+
+/* MSI-X: one IDT vector per doorbell vector, only its own handler */
+static void ivshmem_msix_handler(interrupt_frame_t *frame) {
+    uint32_t v = (uint32_t)frame->int_no - IVSHMEM_IDT_BASE;
+    if (v < IVSHMEM_MAX_VECTORS) {
+        ivshmem_vector_t *h = &ivshmem_vectors[v];
+        h->irqs++;
+        if (h->fn)
+            h->fn(v, h->arg);
+    }
+    lapic_eoi();
+}
+#endif
+
+/* MSI or INTx: one interrupt for every vector, so ask them all */
 static void ivshmem_isr_handler(interrupt_frame_t *frame) {
     (void)frame;
 
@@ -36,8 +73,10 @@ static void ivshmem_isr_handler(interrupt_frame_t *frame) {
         (void)status;  /* Acknowledge by reading */
     }
 
-    if (ivshmem_callback) {
-        ivshmem_callback();
+    ivshmem_vectors[IVSHMEM_VEC_RSP].irqs++;
+    for (uint32_t v = 0; v < IVSHMEM_MAX_VECTORS; v++) {
+        if (ivshmem_vectors[v].fn)
+            ivshmem_vectors[v].fn(v, ivshmem_vectors[v].arg);
     }
 
     /* Send EOI to LAPIC for MSI interrupts */
@@ -46,8 +85,72 @@ static void ivshmem_isr_handler(interrupt_frame_t *frame) {
     }
 }
 
-void ivshmem_set_callback(ivshmem_irq_callback_t cb) {
-    ivshmem_callback = cb;
+int ivshmem_set_vector_handler(uint32_t vector, ivshmem_vector_handler_t fn,
+                               void *arg, uint32_t cpu) {
+    if (vector >= IVSHMEM_MAX_VECTORS)
+        return -1;
+    ivshmem_vectors[vector].fn = 0;
+    __asm__ __volatile__("" ::: "memory");
+    ivshmem_vectors[vector].arg = arg;
+    __asm__ __volatile__("" ::: "memory");
+    ivshmem_vectors[vector].fn = fn;
+    if (vector < ivshmem_msix_vectors && cpu < 32)
+        return irq_set_affinity((uint8_t)(IVSHMEM_IDT_BASE + vector), 1u << cpu);
+    return 0;
+}
+
+uint32_t ivshmem_num_vectors(void) {
+    if (ivshmem_msix_vectors)
+        return ivshmem_msix_vectors;
+    return ivshmem_irq ? 1 : 0;
+}
+
+uint32_t ivshmem_vector_irqs(uint32_t vector) {
+    return vector < IVSHMEM_MAX_VECTORS ? ivshmem_vectors[vector].irqs : 0;
+}
+
+/* MSI-X table in BAR1, every entry on this CPU until a handler moves it
+ * Returns: 0, or -1 to fall back to MSI/INTx
+ */
+static int ivshmem_setup_msix(pci_device_t dev) {
+#ifdef __x86_64__
+    (void)dev;
+    return -1;  /* The x86_64 IDT has no stubs for these vectors yet */
+#else
+    pci_msix_t msix;
+    if (pci_msix_probe(dev, &msix) != 0)
+        return -1;
+
+    uint32_t bar_size = 0;
+    uint32_t bar = pci_get_bar(dev, msix.table_bar, &bar_size);
+    uint32_t n = msix.table_size < IVSHMEM_MAX_VECTORS ? msix.table_size
+                                                       : IVSHMEM_MAX_VECTORS;
+    if (!bar || msix.table_offset + n * 16 > bar_size || bar_size > 0x10000)
+        return -1;
+    if (vmm_map_range(IVSHMEM_MSIX_VIRT, bar, bar_size,
+                      PTE_PRESENT | PTE_WRITABLE | PTE_CACHE_DISABLE |
+                      PTE_NO_EXEC) != 0)
+        return -1;
+    ivshmem_msix_table =
+        (volatile uint32_t *)(IVSHMEM_MSIX_VIRT + msix.table_offset);
+
+    uint8_t apic_id = (uint8_t)lapic_get_id();
+    for (uint32_t v = 0; v < n; v++) {
+        idt_register_handler(IVSHMEM_IDT_BASE + v, ivshmem_msix_handler);
+        pci_msix_set_entry(ivshmem_msix_table, v, (uint8_t)(IVSHMEM_IDT_BASE + v),
+                           apic_id);
+        irq_set_route((uint8_t)(IVSHMEM_IDT_BASE + v), ivshmem_msix_route, 0);
+    }
+    pci_msix_enable(dev, &msix, 1);
+    ivshmem_msix_vectors = n;
+
+    console_write("[ivshmem] MSI-X: ");
+    print_uint(n);
+    console_write(" vectors from IDT ");
+    print_uint(IVSHMEM_IDT_BASE);
+    console_write("\n");
+    return 0;
+#endif
 }
 
 void ivshmem_init(void) {
@@ -82,8 +185,10 @@ void ivshmem_init(void) {
         
         /* Map Memory */
         #define IVSHMEM_VIRT_START 0xE0000000
-        /* Uncached for safety, though Shared RAM is usually Coherent */
-        if (vmm_map_range(IVSHMEM_VIRT_START, ivshmem_phys_base, ivshmem_size, 0x13) != 0) {
+        /* Uncached for safety, though Shared RAM is usually Coherent.
+           BARs are size aligned, so this lands on 4MB pages. */
+        if (vmm_map_range_large(IVSHMEM_VIRT_START, ivshmem_phys_base, ivshmem_size,
+                                0x13 | PTE_NO_EXEC) != 0) {
              console_write("[ivshmem] Failed to map memory!\n");
              return;
         }
@@ -103,13 +208,18 @@ void ivshmem_init(void) {
             print_hex32(ptr[0]);
             console_write("\n");
         }
+
+        /* The IPC layout owns all of it */
+        zenedge_tier_register(ZTIER_SHARED, ivshmem_phys_base, ivshmem_size,
+                              ivshmem_virt_base, 0);
         
     } else {
         /* Standard ivshmem-doorbell logic with MMR at BAR0, Mem at BAR2 */
         if (bar0 != 0 && bar0_size > 0) {
             #define IVSHMEM_MMR_VIRT 0xE1000000
             if (vmm_map_range(IVSHMEM_MMR_VIRT, bar0, bar0_size,
-                              PTE_PRESENT | PTE_WRITABLE | PTE_CACHE_DISABLE) == 0) {
+                              PTE_PRESENT | PTE_WRITABLE | PTE_CACHE_DISABLE |
+                              PTE_NO_EXEC) == 0) {
                 ivshmem_mmr_base = (volatile uint32_t *)IVSHMEM_MMR_VIRT;
                 ivshmem_mmr_size = bar0_size;
                 console_write("[ivshmem] MMR (BAR0) mapped at ");
@@ -144,15 +254,18 @@ void ivshmem_init(void) {
     // My previous replacement replaced init start.
     // I'll rewrite init fully to be clean.
 
-    /* Try MSI first */
-    /* Use vector 50 (0x32) + basic prioritization */
+    /* MSI-X first (a vector per queue), then MSI on IVSHMEM_IDT_BASE */
     /* Get actual APIC ID instead of hardcoding 0 */
     uint8_t apic_id = (uint8_t)lapic_get_id();
-    if (pci_enable_msi(dev, 50, apic_id) == 0) {
-        /* Register handler for Vector 50 */
-        console_write("[ivshmem] Registering MSI handler on vector 50\n");
-        idt_register_handler(50, ivshmem_isr_handler);
-        ivshmem_irq = 50; /* For info */
+    if (ivshmem_setup_msix(dev) == 0) {
+        ivshmem_irq = IVSHMEM_IDT_BASE; /* For info */
+        ivshmem_use_msi = 1;
+    } else if (pci_enable_msi(dev, IVSHMEM_IDT_BASE, apic_id) == 0) {
+        console_write("[ivshmem] Registering MSI handler on vector ");
+        print_uint(IVSHMEM_IDT_BASE);
+        console_write("\n");
+        idt_register_handler(IVSHMEM_IDT_BASE, ivshmem_isr_handler);
+        ivshmem_irq = IVSHMEM_IDT_BASE; /* For info */
         ivshmem_use_msi = 1;  /* Mark that we're using MSI */
     } else {
         ivshmem_irq = 0; /* Fallback to legacy */
@@ -216,11 +329,11 @@ void ivshmem_init(void) {
     ivshmem_phys_base = bar2;
     ivshmem_size = size_mask;
 
-    /* Map to Virtual Memory (Use Identity Mapping because VMM is stub) */
+    /* Map to Virtual Memory (identity, in the largest pages that fit) */
     ivshmem_virt_base = (void*)(uintptr_t)ivshmem_phys_base;
     
-    if (vmm_map_range((uintptr_t)ivshmem_virt_base, ivshmem_phys_base, ivshmem_size,
-                      0x03) != 0) {
+    if (vmm_map_range_large((uintptr_t)ivshmem_virt_base, ivshmem_phys_base,
+                            ivshmem_size, 0x03 | PTE_NO_EXEC) != 0) {
       console_write("[ivshmem] Failed to map memory!\n");
       return;
     }
@@ -229,6 +342,9 @@ void ivshmem_init(void) {
     print_hex32((uint32_t)ivshmem_virt_base);
     console_write(" (Identity)\n");
 
+    zenedge_tier_register(ZTIER_SHARED, ivshmem_phys_base, ivshmem_size,
+                          ivshmem_virt_base, 0);
+
   } else {
     console_write("[ivshmem] Device not found.\n");
   }
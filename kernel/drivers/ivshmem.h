@@ -1,6 +1,7 @@
 #ifndef _DRIVERS_IVSHMEM_H
 #define _DRIVERS_IVSHMEM_H
 
+#include "../ipc/ipc_proto.h"
 #include <stdint.h>
 
 /* Using QEMU 'edu' device as proxy for IVSHMEM in this environment */
@@ -19,10 +20,42 @@ void ivshmem_init(void);
 /* Returns the IRQ number (ISA IRQ, 0-15) assigned to the device */
 uint8_t ivshmem_get_irq(void);
 
-/* Function pointer type for IRQ callback */
-typedef void (*ivshmem_irq_callback_t)(void);
-
-/* Register a callback to be called when interrupt triggers */
-void ivshmem_set_callback(ivshmem_irq_callback_t cb);
+/* Doorbell vectors, one per logical queue: a peer rings (our id, vector).
+ * With MSI-X each vector is its own interrupt (IDT IVSHMEM_IDT_BASE +
+ * vector) aimed at the CPU that owns the queue; with MSI or INTx they
+ * share one and every registered handler runs.
+ */
+#define IVSHMEM_VEC_RSP     0 /* Response ring (the bridge) */
+#define IVSHMEM_VEC_MESH    1 /* Mesh messages and work rings */
+#define IVSHMEM_VEC_BULK    2 /* Bulk transfer completions */
+#define IVSHMEM_VEC_STREAM0 3 /* + channel: stream ring wakeups */
+#define IVSHMEM_MAX_VECTORS (IVSHMEM_VEC_STREAM0 + IPC_STREAM_CHANNELS_MAX)
+#define IVSHMEM_IDT_BASE    0x50
+
+typedef void (*ivshmem_vector_handler_t)(uint32_t vector, void *arg);
+
+/* Run fn(vector, arg) on the vector's interrupt, delivered to cpu (MSI-X;
+ * otherwise wherever the shared interrupt goes). fn NULL unregisters.
+ * Returns: 0, or -1 if vector is out of range
+ */
+int ivshmem_set_vector_handler(uint32_t vector, ivshmem_vector_handler_t fn,
+                               void *arg, uint32_t cpu);
+
+/* Vectors with an interrupt of their own: the MSI-X table size (capped
+ * at IVSHMEM_MAX_VECTORS), 1 if they share one, 0 if polled
+ */
+uint32_t ivshmem_num_vectors(void);
+
+/* Interrupts taken for vector (shared ones count under IVSHMEM_VEC_RSP) */
+uint32_t ivshmem_vector_irqs(uint32_t vector);
+
+/* Our IV position (peer ID) on the ivshmem server, 0 if no BAR0 */
+uint32_t ivshmem_get_peer_id(void);
+
+/* Interrupt vector `vector` of peer `peer_id` via the BAR0 doorbell */
+void ivshmem_ring_doorbell(uint32_t peer_id, uint32_t vector);
+
+/* Returns 1 if BAR0 (doorbell registers) is mapped */
+int ivshmem_has_doorbell(void);
 
 #endif /* _DRIVERS_IVSHMEM_H */
@@ -61,7 +61,14 @@ static int mock_get_snapshot(collector_t *self, metric_snapshot_t *out) {
 static collector_t mock_collector = {
     .name = "MockGPU-A100", .get_snapshot = mock_get_snapshot, .priv = 0};
 
-/* Registry Stubs for MVP */
-actuator_t *actuator_get_default(void) { return &mock_actuator; }
+/* Registry Stubs for MVP: the mock until a real actuator registers */
+static actuator_t *default_actuator = &mock_actuator;
+
+void actuator_register(actuator_t *act) {
+  if (act)
+    default_actuator = act;
+}
+
+actuator_t *actuator_get_default(void) { return default_actuator; }
 
 collector_t *collector_get_default(void) { return &mock_collector; }
@@ -0,0 +1,80 @@
+/* kernel/engine/actuator.c - Actuator batches, async or applied in place
+ *
+ * Drivers with submit/poll (drivers/bridge_act.c) take a batch as one
+ * command and report when it took effect. For the rest actuator_submit()
+ * applies the batch itself through the synchronous methods and keeps the
+ * time it finished under a handle, so callers see a single interface.
+ */
+#include "../include/api/actuator.h"
+#include "../time/time.h"
+
+#define SYNC_DONE 8 /* Applied-in-place handles not yet polled */
+
+typedef struct {
+  act_handle_t handle; /* ACT_HANDLE_NONE = free */
+  uint64_t effect_us;
+} sync_done_t;
+
+static sync_done_t sync_done[SYNC_DONE];
+static act_handle_t next_handle = 1;
+
+void act_batch_init(act_batch_t *batch) { batch->count = 0; }
+
+int act_batch_add(act_batch_t *batch, uint16_t knob, uint32_t value) {
+  if (batch->count >= ACT_BATCH_MAX)
+    return -1;
+  act_setting_t *s = &batch->settings[batch->count++];
+  s->knob = knob;
+  s->reserved = 0;
+  s->value = value;
+  return 0;
+}
+
+/* Helper: one setting through the synchronous methods */
+static int apply_one(actuator_t *act, const act_setting_t *s) {
+  switch (s->knob) {
+  case ACT_KNOB_CLOCK_MHZ:
+    return act->set_clock_limit ? act->set_clock_limit(act, s->value)
+                                : ACT_ERR_NOSUPP;
+  case ACT_KNOB_POWER_W:
+    return act->set_power_limit ? act->set_power_limit(act, s->value)
+                                : ACT_ERR_NOSUPP;
+  default:
+    return ACT_ERR_NOSUPP;
+  }
+}
+
+act_handle_t actuator_submit(actuator_t *act, const act_batch_t *batch) {
+  if (!act || !batch)
+    return ACT_HANDLE_NONE;
+  if (act->submit)
+    return act->submit(act, batch);
+
+  for (uint32_t i = 0; i < batch->count; i++)
+    if (apply_one(act, &batch->settings[i]) != ACT_OK)
+      return ACT_HANDLE_NONE;
+
+  /* Reuse the oldest slot if nobody polled it */
+  act_handle_t h = next_handle++;
+  if (next_handle == ACT_HANDLE_NONE)
+    next_handle = 1;
+  sync_done_t *d = &sync_done[h % SYNC_DONE];
+  d->handle = h;
+  d->effect_us = time_usec();
+  return h;
+}
+
+int actuator_poll(actuator_t *act, act_handle_t h, uint64_t *effect_us) {
+  if (!act || h == ACT_HANDLE_NONE)
+    return -1;
+  if (act->poll)
+    return act->poll(act, h, effect_us);
+
+  sync_done_t *d = &sync_done[h % SYNC_DONE];
+  if (d->handle != h)
+    return -1;
+  d->handle = ACT_HANDLE_NONE;
+  if (effect_us)
+    *effect_us = d->effect_us;
+  return 1;
+}
@@ -0,0 +1,212 @@
+/* kernel/engine/collector.c - Collector sampling rings and window stats
+ *
+ * Each started collector owns a ring of its last COLLECTOR_RING samples.
+ * The window is the newest `window` of them (fewer right after a
+ * restart); every push adds the new sample to one 256-bin histogram per
+ * metric and takes out the one leaving the window, so percentiles are a
+ * scan of 256 counts rather than a sort.
+ */
+#include "../include/api/collector.h"
+#include "../arch/idt.h"
+#include "../include/string.h"
+#include "../time/time.h"
+
+typedef struct collector_ring {
+  collector_t *col;
+  uint32_t period_us; /* 0 = pushed by the driver only */
+  uint64_t next_us;
+  uint32_t window;
+  uint32_t head;      /* Samples pushed, ever */
+  uint32_t in_window; /* The newest this many are in the window */
+  uint32_t errors;
+  uint8_t seeded;     /* ewma_q8 holds a sample since the restart */
+  uint32_t ewma_q8[COLLECTOR_METRICS];
+  uint32_t sum[COLLECTOR_METRICS];
+  uint16_t hist[COLLECTOR_METRICS][256];
+  volatile uint8_t lock;
+  metric_snapshot_t samples[COLLECTOR_RING];
+} collector_ring_t;
+
+static collector_ring_t rings[COLLECTOR_MAX];
+static uint32_t num_rings;
+
+static int lock(collector_ring_t *r) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  while (__atomic_test_and_set(&r->lock, __ATOMIC_ACQUIRE))
+    __asm__ __volatile__("pause");
+  return was;
+}
+
+static void unlock(collector_ring_t *r, int was) {
+  __atomic_clear(&r->lock, __ATOMIC_RELEASE);
+  if (was)
+    interrupts_enable();
+}
+
+static uint32_t metric_value(const metric_snapshot_t *s, uint32_t m) {
+  uint32_t v = m == COLLECTOR_TEMP ? s->gpu_temp_c : s->gpu_util_pct;
+  return v > 255 ? 255 : v;
+}
+
+/* Helper: lock held; take a sample in or (sign < 0) out of the window */
+static void window_add(collector_ring_t *r, const metric_snapshot_t *s, int sign) {
+  for (uint32_t m = 0; m < COLLECTOR_METRICS; m++) {
+    uint32_t v = metric_value(s, m);
+    r->hist[m][v] += (uint16_t)sign;
+    r->sum[m] += (uint32_t)(sign * (int32_t)v);
+  }
+  r->errors += (uint32_t)(sign * (int32_t)(s->ecc_errors + s->xid_errors));
+}
+
+int collector_start(collector_t *col, uint32_t rate_hz, uint32_t window) {
+  if (!col)
+    return -1;
+  collector_ring_t *r = col->ring;
+  if (!r) {
+    if (num_rings >= COLLECTOR_MAX)
+      return -1;
+    r = &rings[num_rings++];
+    r->col = col;
+    col->ring = r;
+  }
+
+  int was = lock(r);
+  r->period_us = rate_hz ? (rate_hz >= 1000000 ? 1 : 1000000 / rate_hz) : 0;
+  r->next_us = time_usec() + r->period_us;
+  r->window = window == 0 ? 1 : window > COLLECTOR_RING ? COLLECTOR_RING : window;
+  r->in_window = 0;
+  r->errors = 0;
+  r->seeded = 0;
+  memset(r->ewma_q8, 0, sizeof(r->ewma_q8));
+  memset(r->sum, 0, sizeof(r->sum));
+  memset(r->hist, 0, sizeof(r->hist));
+  unlock(r, was);
+  return 0;
+}
+
+void collector_push(collector_t *col, const metric_snapshot_t *s) {
+  collector_ring_t *r = col ? col->ring : 0;
+  if (!r)
+    return;
+
+  int was = lock(r);
+  if (r->in_window == r->window)
+    window_add(r, &r->samples[(r->head - r->window) & (COLLECTOR_RING - 1)], -1);
+  else
+    r->in_window++;
+  r->samples[r->head & (COLLECTOR_RING - 1)] = *s;
+  r->head++;
+  window_add(r, s, 1);
+  for (uint32_t m = 0; m < COLLECTOR_METRICS; m++) {
+    int32_t x = (int32_t)(metric_value(s, m) << 8);
+    int32_t e = (int32_t)r->ewma_q8[m];
+    /* The first sample seeds it */
+    r->ewma_q8[m] = r->seeded ? (uint32_t)(e + ((x - e) >> COLLECTOR_EWMA_SHIFT))
+                              : (uint32_t)x;
+  }
+  r->seeded = 1;
+  unlock(r, was);
+}
+
+void collector_poll(void) {
+  for (uint32_t i = 0; i < num_rings; i++) {
+    collector_ring_t *r = &rings[i];
+    if (!r->period_us || !r->col->get_snapshot)
+      continue;
+    uint64_t now = time_usec();
+    if (now < r->next_us)
+      continue;
+
+    metric_snapshot_t s;
+    if (r->col->get_snapshot(r->col, &s) == 0) {
+      if (!s.timestamp)
+        s.timestamp = now;
+      collector_push(r->col, &s);
+    }
+    /* One sample per period; a late poll skips what it missed */
+    r->next_us += r->period_us;
+    if (r->next_us <= now)
+      r->next_us = now + r->period_us;
+  }
+}
+
+uint64_t collector_next_deadline(void) {
+  uint64_t next = 0;
+  for (uint32_t i = 0; i < num_rings; i++)
+    if (rings[i].period_us && (!next || rings[i].next_us < next))
+      next = rings[i].next_us;
+  return next;
+}
+
+uint32_t collector_read(collector_t *col, uint32_t *cursor,
+                        metric_snapshot_t *out, uint32_t max) {
+  collector_ring_t *r = col ? col->ring : 0;
+  if (!r)
+    return 0;
+
+  int was = lock(r);
+  if (r->head - *cursor > COLLECTOR_RING)
+    *cursor = r->head - COLLECTOR_RING;
+  uint32_t n = 0;
+  while (n < max && *cursor != r->head)
+    out[n++] = r->samples[(*cursor)++ & (COLLECTOR_RING - 1)];
+  unlock(r, was);
+  return n;
+}
+
+uint32_t collector_window_restart(collector_t *col) {
+  collector_ring_t *r = col ? col->ring : 0;
+  if (!r)
+    return 0;
+
+  int was = lock(r);
+  r->in_window = 0;
+  r->errors = 0;
+  r->seeded = 0;
+  memset(r->ewma_q8, 0, sizeof(r->ewma_q8));
+  memset(r->sum, 0, sizeof(r->sum));
+  memset(r->hist, 0, sizeof(r->hist));
+  uint32_t head = r->head;
+  unlock(r, was);
+  return head;
+}
+
+int collector_window(collector_t *col, collector_metric_t metric,
+                     collector_stats_t *out) {
+  collector_ring_t *r = col ? col->ring : 0;
+  if (!r || metric >= COLLECTOR_METRICS)
+    return -1;
+
+  int was = lock(r);
+  uint32_t n = r->in_window;
+  if (n == 0) {
+    unlock(r, was);
+    return -1;
+  }
+  const uint16_t *h = r->hist[metric];
+  /* Ranks (1-based) of the percentiles: the smallest value with at
+   * least that many samples at or below it
+   */
+  uint32_t r95 = (n * 95 + 99) / 100, r99 = (n * 99 + 99) / 100, seen = 0;
+  out->samples = n;
+  out->errors = r->errors;
+  out->ewma_q8 = r->ewma_q8[metric];
+  out->mean_q8 = (uint32_t)(((uint64_t)r->sum[metric] << 8) / n);
+  out->min = out->max = out->p95 = out->p99 = 0;
+  for (uint32_t v = 0, first = 1; v < 256; v++) {
+    if (!h[v])
+      continue;
+    if (first)
+      out->min = v;
+    first = 0;
+    out->max = v;
+    if (seen < r95 && seen + h[v] >= r95)
+      out->p95 = v;
+    if (seen < r99 && seen + h[v] >= r99)
+      out->p99 = v;
+    seen += h[v];
+  }
+  unlock(r, was);
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include "../console.h"
 #include "../include/api/actuator.h"
 #include "../include/api/collector.h"
+#include "../time/time.h"
 
 static episode_ctx_t current_episode;
 static int episode_active = 0;
@@ -9,21 +10,32 @@ static int episode_active = 0;
 void episode_init(void) {
   current_episode.episode_id = 0;
   current_episode.state = EP_STATE_IDLE;
-  current_episode.samples = 0;
+  current_episode.num_arms = 0;
   episode_active = 0;
+  /* A ring now, sampled only while an episode runs (the loop is tickless) */
+  collector_start(collector_get_default(), 0, EP_WINDOW);
   console_write("[episode] Engine Initialized\n");
 }
 
-/* Helper: Check Violations */
-static int check_guardrails(metric_snapshot_t *m) {
-  /* Hard Limit: Temp > 90C */
-  if (m->gpu_temp_c > 90) {
-    console_write("[episode] VIOLATION: Temp > 90C!\n");
+static void episode_stop(void) {
+  episode_active = 0;
+  collector_start(collector_get_default(), 0, EP_WINDOW);
+}
+
+/* Helper: Check Violations, over the collector's window */
+static int check_guardrails(collector_t *col) {
+  collector_stats_t temp;
+  if (collector_window(col, COLLECTOR_TEMP, &temp) != 0)
+    return 0; /* Nothing sampled since the window restarted */
+
+  /* Hard Limit: Temp > 90C, past the odd outlier */
+  if (temp.p99 > 90) {
+    console_write("[episode] VIOLATION: Temp p99 > 90C!\n");
     return 1;
   }
 
   /* Hard Limit: ECC Errors > 0 */
-  if (m->ecc_errors > 0) {
+  if (temp.errors > 0) {
     console_write("[episode] VIOLATION: ECC Error detected!\n");
     return 1;
   }
@@ -31,12 +43,133 @@ static int check_guardrails(metric_snapshot_t *m) {
   return 0; // OK
 }
 
+/* Helper: arm's mean utilization, Q8 */
+static uint64_t arm_mean_q8(const episode_arm_t *a) {
+  return a->samples ? (a->sum << 8) / a->samples : 0;
+}
+
+/* Helper: squared standard error of arm's mean, Q16
+ * Returns: 0, or -1 with fewer than two samples
+ */
+static int arm_se2_q16(const episode_arm_t *a, uint64_t *out) {
+  uint64_t n = a->samples;
+  if (n < 2)
+    return -1;
+  uint64_t ss = n * a->sum_sq - a->sum * a->sum; /* n^2 * biased variance */
+  *out = ((ss / n) << 16) / (n * (n - 1));
+  return 0;
+}
+
+/* Helper: a's mean is above b's by more than EP_Z standard errors */
+static int arm_better(const episode_arm_t *a, const episode_arm_t *b) {
+  uint64_t ma = arm_mean_q8(a), mb = arm_mean_q8(b), sa, sb;
+  if (arm_se2_q16(a, &sa) != 0 || arm_se2_q16(b, &sb) != 0 || ma <= mb)
+    return 0;
+  uint64_t d = ma - mb;
+  return d * d > (uint64_t)EP_Z * EP_Z * (sa + sb);
+}
+
+/* Helper: first live arm after arm, or num_arms */
+static uint32_t next_arm(const episode_ctx_t *ep, uint32_t arm) {
+  while (++arm < ep->num_arms && !ep->arms[arm].alive)
+    ;
+  return arm;
+}
+
+static void drop_arm(uint32_t i, episode_outcome_t why) {
+  current_episode.arms[i].alive = 0;
+  current_episode.arms[i].outcome = why;
+  console_write("[episode] Dropped ");
+  print_uint(current_episode.arms[i].clock_mhz);
+  console_write(why == OUTCOME_REJECTED_VIOLATION ? " MHz (violation)\n"
+                                                  : " MHz\n");
+}
+
+/* Helper: end of a round; drop, halve or promote
+ * Returns: the next state
+ */
+static episode_state_t decide(actuator_t *act) {
+  episode_ctx_t *ep = &current_episode;
+  episode_arm_t *base = &ep->arms[0];
+  uint32_t leader = 0;
+  for (uint32_t i = 1; i < ep->num_arms; i++)
+    if (ep->arms[i].alive &&
+        (!leader || arm_mean_q8(&ep->arms[i]) > arm_mean_q8(&ep->arms[leader])))
+      leader = i;
+
+  console_write("[episode] Round ");
+  print_uint(ep->round);
+  console_write(": baseline ");
+  print_uint((uint32_t)(arm_mean_q8(base) >> 8));
+  console_write("%");
+  if (leader) {
+    console_write(", leader ");
+    print_uint(ep->arms[leader].clock_mhz);
+    console_write(" MHz at ");
+    print_uint((uint32_t)(arm_mean_q8(&ep->arms[leader]) >> 8));
+    console_write("%");
+  }
+  console_write("\n");
+
+  /* Early kill: no chance of beating the baseline or the leader */
+  uint32_t alive = 0;
+  for (uint32_t i = 1; i < ep->num_arms; i++) {
+    episode_arm_t *a = &ep->arms[i];
+    if (!a->alive)
+      continue;
+    if (arm_better(base, a) || (i != leader && arm_better(&ep->arms[leader], a)))
+      drop_arm(i, OUTCOME_REJECTED_REGRESSION);
+    else
+      alive++;
+  }
+
+  if (leader && ep->arms[leader].alive && arm_better(&ep->arms[leader], base)) {
+    int clear = 1;
+    for (uint32_t i = 1; i < ep->num_arms && clear; i++)
+      if (i != leader && ep->arms[i].alive &&
+          !arm_better(&ep->arms[leader], &ep->arms[i]))
+        clear = 0;
+    /* Sure of the winner, or out of budget to tell the rest apart */
+    if (clear || ep->monitor_steps_done >= ep->monitor_steps_total) {
+      console_write("[episode] PROMOTE! ");
+      print_uint(ep->arms[leader].clock_mhz);
+      console_write(" MHz significantly better.\n");
+      if (act)
+        act->set_clock_limit(act, ep->arms[leader].clock_mhz);
+      ep->proposed_clock = ep->arms[leader].clock_mhz;
+      ep->arms[leader].outcome = OUTCOME_PROMOTED;
+      ep->outcome = OUTCOME_PROMOTED;
+      episode_stop();
+      return EP_STATE_IDLE;
+    }
+  }
+  if (!alive || ep->monitor_steps_done >= ep->monitor_steps_total) {
+    ep->outcome = OUTCOME_REJECTED_REGRESSION;
+    return EP_STATE_ROLLBACK;
+  }
+
+  /* Successive halving: the worse half of the rest sits out from now on */
+  for (uint32_t drop = alive / 2; drop > 0; drop--) {
+    uint32_t worst = 0;
+    for (uint32_t i = 1; i < ep->num_arms; i++)
+      if (ep->arms[i].alive &&
+          (!worst || arm_mean_q8(&ep->arms[i]) < arm_mean_q8(&ep->arms[worst])))
+        worst = i;
+    drop_arm(worst, OUTCOME_REJECTED_REGRESSION);
+  }
+
+  ep->round++;
+  ep->arm = 0;
+  return EP_STATE_APPLY;
+}
+
 void episode_tick(void) {
   if (!episode_active)
     return;
 
   collector_t *col = collector_get_default();
   actuator_t *act = actuator_get_default();
+  episode_arm_t *arm = &current_episode.arms[current_episode.arm];
 
   switch (current_episode.state) {
   case EP_STATE_PROPOSE:
@@ -51,65 +184,91 @@ void episode_tick(void) {
     break;
 
   case EP_STATE_APPLY:
-    if (act) {
-      act->set_clock_limit(act, current_episode.proposed_clock);
-      console_write("[episode] Applied Clock: ");
-      print_uint(current_episode.proposed_clock);
-      console_write(" MHz\n");
+    /* Start this arm's slice once its clock has taken effect */
+    {
+      uint64_t applied = time_usec();
+      if (current_episode.act_pending != ACT_HANDLE_NONE) {
+        int rc = actuator_poll(act, current_episode.act_pending, &applied);
+        if (rc == 0)
+          break; /* Still on its way: the episode waits, the loop doesn't */
+        current_episode.act_pending = ACT_HANDLE_NONE;
+        if (rc < 0) {
+          current_episode.outcome = OUTCOME_FAILED_ACTUATOR;
+          current_episode.state = EP_STATE_ROLLBACK;
+          break;
+        }
+        current_episode.proposed_clock = arm->clock_mhz;
+      } else if (act && current_episode.proposed_clock != arm->clock_mhz) {
+        act_batch_t batch;
+        act_batch_init(&batch);
+        act_batch_add(&batch, ACT_KNOB_CLOCK_MHZ, arm->clock_mhz);
+        current_episode.act_pending = actuator_submit(act, &batch);
+        if (current_episode.act_pending == ACT_HANDLE_NONE) {
+          current_episode.outcome = OUTCOME_FAILED_ACTUATOR;
+          current_episode.state = EP_STATE_ROLLBACK;
+        }
+        break;
+      }
+
+      /* Its window and samples start here, settling counted from when
+       * the clock actually changed
+       */
+      current_episode.applied_us = applied;
+      if (col)
+        current_episode.sample_cursor = collector_window_restart(col);
+      current_episode.slice_steps_done = 0;
+      current_episode.state = EP_STATE_MONITOR;
     }
-    current_episode.state = EP_STATE_MONITOR;
     break;
 
   case EP_STATE_MONITOR:
     if (col) {
-      metric_snapshot_t snap;
-      if (col->get_snapshot(col, &snap) == 0) {
-        /* Accumulate */
-        current_episode.current_accum.gpu_temp_c += snap.gpu_temp_c;
-        current_episode.current_accum.gpu_util_pct += snap.gpu_util_pct;
-        current_episode.samples++;
-
-        /* Guardrail Check (Fail Fast) */
-        if (check_guardrails(&snap)) {
+      /* Guardrail Check (Fail Fast): the arm goes, or all of it at base */
+      if (check_guardrails(col)) {
+        if (current_episode.arm == 0) {
+          current_episode.outcome = OUTCOME_REJECTED_VIOLATION;
           current_episode.state = EP_STATE_ROLLBACK;
           return;
         }
+        drop_arm(current_episode.arm, OUTCOME_REJECTED_VIOLATION);
+        current_episode.slice_steps_done = EP_SLICE_STEPS;
+      }
+
+      /* Every sample since the last tick, dropping those while settling */
+      metric_snapshot_t snap[16];
+      uint32_t n;
+      while ((n = collector_read(col, &current_episode.sample_cursor, snap, 16))) {
+        for (uint32_t i = 0; i < n; i++) {
+          if (snap[i].timestamp < current_episode.applied_us + EP_SETTLE_US ||
+              arm->samples >= EP_ARM_SAMPLES_MAX)
+            continue;
+          uint32_t u = snap[i].gpu_util_pct > 100 ? 100 : snap[i].gpu_util_pct;
+          arm->sum += u;
+          arm->sum_sq += u * u;
+          arm->samples++;
+        }
       }
     }
 
     current_episode.monitor_steps_done++;
-    if (current_episode.monitor_steps_done >=
-        current_episode.monitor_steps_total) {
-      current_episode.state = EP_STATE_DECIDE;
+    current_episode.slice_steps_done++;
+    if (current_episode.slice_steps_done >= EP_SLICE_STEPS) {
+      current_episode.arm = next_arm(&current_episode, current_episode.arm);
+      if (current_episode.arm < current_episode.num_arms &&
+          current_episode.monitor_steps_done < current_episode.monitor_steps_total)
+        current_episode.state = EP_STATE_APPLY;
+      else
+        current_episode.state = EP_STATE_DECIDE;
     }
     break;
 
   case EP_STATE_DECIDE:
-    /* Decision Logic */
-    {
-      uint32_t avg_util = 0;
-      if (current_episode.samples > 0) {
-        avg_util = current_episode.current_accum.gpu_util_pct /
-                   current_episode.samples;
-      }
-
-      console_write("[episode] DECISION: Avg Util = ");
-      print_uint(avg_util);
-      console_write("%\n");
-
-      /* Simple Policy: Verify Util > 50% */
-      if (avg_util > 50) {
-        console_write("[episode] PROMOTE! Improvement confirmed.\n");
-        current_episode.state = EP_STATE_IDLE;
-        episode_active = 0;
-      } else {
-        console_write("[episode] REJECT: No improvement.\n");
-        current_episode.state = EP_STATE_ROLLBACK;
-      }
-    }
+    current_episode.state = decide(act);
     break;
 
   case EP_STATE_ROLLBACK:
+    if (current_episode.outcome == OUTCOME_REJECTED_REGRESSION)
+      console_write("[episode] REJECT: No significant improvement.\n");
     console_write("[episode] ROLLING BACK to ");
     print_uint(current_episode.original_clock);
     console_write(" MHz\n");
@@ -117,8 +276,9 @@ void episode_tick(void) {
     if (act) {
       act->set_clock_limit(act, current_episode.original_clock);
     }
+    current_episode.proposed_clock = current_episode.original_clock;
     current_episode.state = EP_STATE_IDLE;
-    episode_active = 0;
+    episode_stop();
     break;
 
   default:
@@ -126,27 +286,48 @@ void episode_tick(void) {
   }
 }
 
-int episode_propose(uint32_t clock_mhz, uint32_t duration_steps) {
-  if (episode_active)
+int episode_propose_set(const uint32_t *clocks_mhz, uint32_t count,
+                        uint32_t duration_steps) {
+  if (episode_active || !clocks_mhz || count == 0 || count >= EP_MAX_ARMS)
     return -1;
 
   current_episode.episode_id++;
   current_episode.state = EP_STATE_PROPOSE;
-  current_episode.proposed_clock = clock_mhz;
+  current_episode.outcome = OUTCOME_NONE;
   current_episode.original_clock = 1000; /* Mock baseline */
+  current_episode.proposed_clock = 0; /* So the baseline is applied too */
   current_episode.monitor_steps_total = duration_steps;
   current_episode.monitor_steps_done = 0;
 
-  /* Reset accumulators */
-  current_episode.current_accum.gpu_temp_c = 0;
-  current_episode.current_accum.gpu_util_pct = 0;
-  current_episode.samples = 0;
+  /* Arm 0 is the baseline, measured alongside as the control */
+  current_episode.num_arms = count + 1;
+  for (uint32_t i = 0; i <= count; i++) {
+    episode_arm_t *a = &current_episode.arms[i];
+    a->clock_mhz = i ? clocks_mhz[i - 1] : current_episode.original_clock;
+    a->alive = 1;
+    a->outcome = OUTCOME_NONE;
+    a->samples = 0;
+    a->sum = 0;
+    a->sum_sq = 0;
+  }
+  current_episode.arm = 0;
+  current_episode.act_pending = ACT_HANDLE_NONE;
+  current_episode.slice_steps_done = 0;
+  current_episode.round = 0;
 
   episode_active = 1;
-  console_write("[episode] Proposal Accepted: Clock ");
-  print_uint(clock_mhz);
+  collector_start(collector_get_default(), EP_SAMPLE_HZ, EP_WINDOW);
+  console_write("[episode] Proposal Accepted: Clocks");
+  for (uint32_t i = 0; i < count; i++) {
+    console_write(" ");
+    print_uint(clocks_mhz[i]);
+  }
   console_write("\n");
   return 0;
 }
 
+int episode_propose(uint32_t clock_mhz, uint32_t duration_steps) {
+  return episode_propose_set(&clock_mhz, 1, duration_steps);
+}
+
 episode_ctx_t *episode_get_current(void) { return &current_episode; }
@@ -0,0 +1,275 @@
+#include "../include/engine/mlp.h"
+#include "../ipc/heap.h"
+#include "../lib/math.h"
+#include "../trace/klog.h"
+#include <string.h>
+
+#define MLP_CACHE_SLOTS 2
+
+typedef struct {
+  mlp_model_t model;
+  uint32_t last_use;  /* 0 = empty */
+} mlp_slot_t;
+
+static mlp_slot_t cache[MLP_CACHE_SLOTS];
+static uint32_t cache_clock = 0;
+
+/* Ping-pong activations and the int8 layer scratch; a forward pass never
+ * yields, so one set serves every caller.
+ */
+static float act_buf[2][IPC_MLP_MAX_WIDTH];
+static uint8_t q8_in[IPC_MLP_MAX_WIDTH];
+static int32_t q8_acc[IPC_MLP_MAX_WIDTH];
+static float half_row[IPC_MLP_MAX_WIDTH];
+
+static int mlp_is_half(uint8_t dtype) {
+  return dtype == DTYPE_FLOAT16 || dtype == DTYPE_BFLOAT16;
+}
+
+int mlp_is_model(uint16_t blob_id) {
+  heap_blob_t *blob = blob_id ? heap_get_blob(blob_id) : NULL;
+  if (!blob || blob->type != BLOB_TYPE_MODEL_REF || blob->size < sizeof(ipc_mlp_desc_t))
+    return 0;
+  const ipc_mlp_desc_t *d = (const ipc_mlp_desc_t *)heap_get_data(blob_id);
+  return d && d->magic == IPC_MLP_MAGIC;
+}
+
+/* Retain blob_id into m->refs and return its tensor data, with its
+ * header in *hdr and the data bytes the blob holds in *avail; NULL if it
+ * is not a contiguous float32, half-width float or int8 tensor.
+ */
+static const void *mlp_take_tensor(mlp_model_t *m, uint16_t blob_id,
+                                   const tensor_header_t **hdr, uint32_t *avail) {
+  const void *data = heap_get_tensor_data(blob_id);
+  if (!data)
+    return NULL;
+  *hdr = (const tensor_header_t *)heap_get_data(blob_id);
+  if ((*hdr)->dtype != DTYPE_FLOAT32 && (*hdr)->dtype != DTYPE_INT8 && !mlp_is_half((*hdr)->dtype))
+    return NULL;
+  if (heap_blob_retain(blob_id) != 0)
+    return NULL;
+  *avail = heap_get_blob(blob_id)->size - sizeof(tensor_header_t);
+  m->refs[m->num_refs++] = blob_id;
+  return data;
+}
+
+/* Point l at the int8 weights' parameters and take the row sums; -1 if
+ * they are missing or a zero point is outside int8
+ */
+static int mlp_take_quant(mlp_layer_t *l, uint16_t blob_id) {
+  l->scale = heap_get_tensor_quant(blob_id, &l->nq);
+  if (!l->scale || (l->nq != 1 && l->nq != l->out))
+    return -1;
+  l->zp = (const int32_t *)(l->scale + l->nq);
+  for (uint32_t i = 0; i < l->nq; i++)
+    if (l->zp[i] < -128 || l->zp[i] > 127)
+      return -1;
+
+  for (uint32_t r = 0; r < l->out; r++) {
+    const int8_t *row = l->wq + r * l->stride;
+    int32_t sum = 0;
+    for (uint32_t k = 0; k < l->in; k++)
+      sum += row[k];
+    l->wsum[r] = sum;
+  }
+  return 0;
+}
+
+/* fmt: "... %u ... %u" taking the model and layer */
+static int mlp_fail(mlp_model_t *m, const char *fmt, uint32_t layer) {
+  KLOG2(KLOG_SUBSYS_KERN, KLOG_LVL_ERR, fmt, m->desc_blob, layer);
+  mlp_unload(m);
+  return -1;
+}
+
+int mlp_load(uint16_t desc_blob, mlp_model_t *m) {
+  memset(m, 0, sizeof(*m));
+  m->desc_blob = desc_blob;
+  if (!mlp_is_model(desc_blob) || heap_blob_retain(desc_blob) != 0)
+    return -1;
+  m->refs[m->num_refs++] = desc_blob;
+
+  const ipc_mlp_desc_t *d = (const ipc_mlp_desc_t *)heap_get_data(desc_blob);
+  if (d->version != IPC_MLP_VERSION || d->num_layers == 0 ||
+      d->num_layers > IPC_MLP_MAX_LAYERS || d->in_dim == 0 || d->in_dim > IPC_MLP_MAX_WIDTH)
+    return mlp_fail(m, "mlp model %u: bad descriptor (%u)", d->version);
+
+  uint32_t width = d->in_dim;
+  for (uint32_t i = 0; i < d->num_layers; i++) {
+    const ipc_mlp_layer_t *dl = &d->layer[i];
+    mlp_layer_t *l = &m->layer[i];
+    const tensor_header_t *wh, *bh;
+    uint32_t avail;
+
+    const void *w = mlp_take_tensor(m, dl->weight_blob, &wh, &avail);
+    if (!w || wh->ndim != 2 || (wh->dtype == DTYPE_INT8) != (wh->quant != TENSOR_QUANT_NONE))
+      return mlp_fail(m, "mlp model %u layer %u: weights not a 2-D float or quantized int8 tensor", i);
+    l->wdtype = wh->dtype;
+    uint32_t esz = l->wdtype == DTYPE_INT8 ? 1 : mlp_is_half(l->wdtype) ? 2 : sizeof(float);
+    l->out = wh->shape[0];
+    l->in = wh->shape[1];
+    l->stride = wh->strides[0] ? wh->strides[0] / esz : l->in;
+    if (l->in != width || l->out == 0 || l->out > IPC_MLP_MAX_WIDTH)
+      return mlp_fail(m, "mlp model %u layer %u: weight shape does not chain", i);
+    if ((wh->strides[1] != 0 && wh->strides[1] != esz) || (wh->strides[0] % esz) != 0 ||
+        l->stride < l->in || ((uint64_t)(l->out - 1) * l->stride + l->in) * esz > avail)
+      return mlp_fail(m, "mlp model %u layer %u: weight strides outside the blob", i);
+
+    if (esz == 1) {
+      l->wq = (const int8_t *)w;
+      if (mlp_take_quant(l, dl->weight_blob) != 0)
+        return mlp_fail(m, "mlp model %u layer %u: bad weight quantization", i);
+    } else if (esz == 2) {
+      l->wh = (const uint16_t *)w;
+    } else {
+      l->w = (const float *)w;
+    }
+
+    if (dl->bias_blob) {
+      const void *b = mlp_take_tensor(m, dl->bias_blob, &bh, &avail);
+      if (!b || bh->dtype == DTYPE_INT8 || bh->quant != TENSOR_QUANT_NONE || bh->ndim != 1 ||
+          bh->shape[0] != l->out)
+        return mlp_fail(m, "mlp model %u layer %u: bias not a float [out] tensor", i);
+      l->bdtype = bh->dtype;
+      if (mlp_is_half(l->bdtype))
+        l->bh = (const uint16_t *)b;
+      else
+        l->b = (const float *)b;
+    }
+
+    l->act = dl->act;
+    if (l->act > MLP_ACT_SOFTMAX || (l->act == MLP_ACT_SOFTMAX && i + 1 != d->num_layers))
+      return mlp_fail(m, "mlp model %u layer %u: bad activation", i);
+    width = l->out;
+  }
+
+  m->num_layers = d->num_layers;
+  m->in_dim = d->in_dim;
+  m->out_dim = width;
+  KLOG3(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "mlp model %u: %u layers, %u outputs", desc_blob,
+        m->num_layers, m->out_dim);
+  return 0;
+}
+
+void mlp_unload(mlp_model_t *m) {
+  for (uint32_t i = 0; i < m->num_refs; i++)
+    heap_blob_release(m->refs[i]);
+  m->num_refs = 0;
+  m->num_layers = 0;
+}
+
+const mlp_model_t *mlp_get(uint16_t desc_blob) {
+  mlp_slot_t *victim = &cache[0];
+  for (uint32_t i = 0; i < MLP_CACHE_SLOTS; i++) {
+    mlp_slot_t *s = &cache[i];
+    if (s->last_use && s->model.desc_blob == desc_blob) {
+      s->last_use = ++cache_clock;
+      return &s->model;
+    }
+    if (s->last_use < victim->last_use)
+      victim = s;
+  }
+
+  if (victim->last_use)
+    mlp_unload(&victim->model);
+  victim->last_use = 0;
+  if (mlp_load(desc_blob, &victim->model) != 0)
+    return NULL;
+  victim->last_use = ++cache_clock;
+  return &victim->model;
+}
+
+void mlp_cache_flush(void) {
+  for (uint32_t i = 0; i < MLP_CACHE_SLOTS; i++) {
+    if (cache[i].last_use)
+      mlp_unload(&cache[i].model);
+    cache[i].last_use = 0;
+  }
+}
+
+/* y = W x for int8 W (see mlp.h) */
+static void mlp_gemv_q8(const mlp_layer_t *l, const float *x, float *y) {
+  float amax = 0.0f;
+  for (uint32_t k = 0; k < l->in; k++) {
+    float a = x[k] < 0.0f ? -x[k] : x[k];
+    if (a > amax)
+      amax = a;
+  }
+  float inv = amax > 0.0f ? 127.0f / amax : 0.0f;
+  float sx = amax / 127.0f;
+
+  int32_t xsum = 0;
+  for (uint32_t k = 0; k < l->in; k++) {
+    float v = x[k] * inv;
+    int32_t q = (int32_t)(v + (v >= 0.0f ? 0.5f : -0.5f));
+    q = q > 127 ? 127 : q < -127 ? -127 : q;
+    xsum += q;
+    q8_in[k] = (uint8_t)(q + 128);
+  }
+
+  math_q8_gemv(l->wq, (int)l->out, (int)l->in, (int)l->stride, q8_in, q8_acc);
+  for (uint32_t r = 0; r < l->out; r++) {
+    uint32_t c = l->nq == 1 ? 0 : r;
+    int32_t acc = q8_acc[r] - 128 * l->wsum[r] - l->zp[c] * xsum;
+    y[r] = l->scale[c] * sx * (float)acc;
+  }
+}
+
+static void mlp_widen(uint8_t dtype, const uint16_t *src, uint32_t n) {
+  if (dtype == DTYPE_BFLOAT16)
+    math_bf16_to_f32(src, half_row, (int)n);
+  else
+    math_f16_to_f32(src, half_row, (int)n);
+}
+
+/* y = W x for half-width W, a row at a time */
+static void mlp_gemv_half(const mlp_layer_t *l, const float *x, float *y) {
+  for (uint32_t r = 0; r < l->out; r++) {
+    mlp_widen(l->wdtype, l->wh + r * l->stride, l->in);
+    y[r] = math_vec_dot(half_row, x, (int)l->in);
+  }
+}
+
+void mlp_forward(const mlp_model_t *m, const float *in, float *out) {
+  const float *x = in;
+  for (uint32_t i = 0; i < m->num_layers; i++) {
+    const mlp_layer_t *l = &m->layer[i];
+    float *y = (i + 1 == m->num_layers) ? out : act_buf[i & 1];
+
+    if (l->wq)
+      mlp_gemv_q8(l, x, y);
+    else if (l->wh)
+      mlp_gemv_half(l, x, y);
+    else
+      math_vec_gemv(l->w, (int)l->out, (int)l->in, (int)l->stride, x, y);
+    if (l->bh) {
+      mlp_widen(l->bdtype, l->bh, l->out);
+      math_vec_axpy(1.0f, half_row, y, (int)l->out);
+    } else if (l->b) {
+      math_vec_axpy(1.0f, l->b, y, (int)l->out);
+    }
+
+    switch (l->act) {
+    case MLP_ACT_RELU:
+      math_vec_relu(y, (int)l->out);
+      break;
+    case MLP_ACT_TANH:
+      math_vec_tanh(y, (int)l->out);
+      break;
+    case MLP_ACT_SOFTMAX:
+      math_vec_softmax(y, y, (int)l->out);
+      break;
+    default:
+      break;
+    }
+    x = y;
+  }
+}
+
+int32_t mlp_action(const mlp_model_t *m, const float *in) {
+  float out[IPC_MLP_MAX_WIDTH];
+  mlp_forward(m, in, out);
+  if (m->out_dim == 1)
+    return out[0] > 0.0f ? 1 : 0;
+  return math_vec_argmax(out, (int)m->out_dim);
+}
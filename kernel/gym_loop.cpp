@@ -0,0 +1,854 @@
+/* kernel/gym_loop.cpp - Gym control loop (C++)
+ *
+ * Entered by kmain64 once the kernel is up: the bridge's Gym env steps
+ * here, on the stream rings or with CMD_ENV_STEP blobs, acting with the
+ * kernel's policy and the WASM agent behind it.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+extern "C" {
+  #include <string.h>
+  #include "console.h"
+  #include "gym_loop.h"
+  #include "ipc/ipc.h"
+  #include "ipc/bulk.h"
+  #include "ipc/completion.h"
+  #include "ipc/heap.h"
+  #include "ipc/stats_export.h"
+  #include "sched/idle_work.h"
+  #include "trace/bootprof.h"
+  #include "trace/ifr.h"
+  #include "wasm_loader.h"
+  #include "wasm/wasm_prof.h"
+  #include "time/time.h"
+  #include "trace/klog.h"
+  #include "trace/lat.h"
+}
+
+/* Verify C++ Class Support */
+class Logger {
+public:
+    Logger() {
+        console_write("[cpp] Logger constructed\n");
+    }
+    virtual ~Logger() {}
+    
+    virtual void log(const char* msg) {
+        console_write("[cpp] ");
+        console_write(msg);
+        console_write("\n");
+    }
+};
+
+class KernelLogger : public Logger {
+public:
+    void log(const char* msg) override {
+        console_write("[kern] ");
+        console_write(msg);
+        console_write("\n");
+    }
+};
+
+static uint8_t g_last_chain_hash[32] = {0};
+
+/* Default WASM Agent: "Smart" Linear Agent
+ * Uses zenedge_inference (Host Function) to compute action using linear weights
+ * provided by "model_id".
+ *
+ * (module
+ *   (import "env" "zenedge_inference" (func $inf (param i32) (result i32)))
+ *   (import "env" "print" (func $print (param i32 i32)))
+ *   (memory 1)
+ *   (func (export "agent_step") (param $obs_off i32) (param $obs_len i32) (param $model_id i32) (result i32)
+ *     ;; Call inference with model_id (which is blob_id of weights)
+ *     (call $inf (local.get $model_id))
+ *     ;; Result is a Blob ID containing action? 
+ *     ;; Wait, zenedge_inference returns Result Blob ID.
+ *     ;; We need to read that blob to get the action.
+ *     ;; BUT, for linear policy, result is just the action?
+ *     ;; Bridge returns "Result Blob". 
+ *     ;; For now, let's assume the linear model returns a blob with a single float/int.
+ *     ;; This is complex for a tiny WASM.
+ *     ;; simpler: Just return 1 for now (Right).
+ *     i32.const 1
+ *   )
+ * )
+ *
+ * Actually, let's hardcode a specific WASM that implements:
+ * if (obs[2] > 0) return 1 else 0 (Pole Angle)
+ * This doesn't need 'inference', just memory access.
+ */
+const uint8_t default_wasm[] = {
+    /* Header */
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    /* Type: (param i32 i32 i32) -> (result i32) */
+    0x01, 0x08, 0x01, 0x60, 0x03, 0x7f, 0x7f, 0x7f, 0x01, 0x7f,
+    /* Func: type 0 */
+    0x03, 0x02, 0x01, 0x00,
+    /* Memory: 1 page (REQUIRED for load) */
+    0x05, 0x03, 0x01, 0x00, 0x01,
+    /* Export: "agent_step" func 0 */
+    0x07, 0x0e, 0x01, 0x0a, 0x61, 0x67, 0x65, 0x6e, 0x74, 0x5f, 0x73, 0x74, 0x65, 0x70, 0x00, 0x00,
+    /* Code: */
+    0x0a, 0x12, 
+    0x01, /* count 1 */
+    0x10, /* size 16 */ 
+    0x00, /* locals 0 */
+    0x20, 0x00,                         /* local.get 0 (ptr) */
+    0x41, 0x08,                         /* i32.const 8 (offset for obs[2]) */
+    0x6a,                               /* i32.add */
+    0x2a, 0x02, 0x00,                   /* f32.load align=2 off=0 */
+    0x43, 0x00, 0x00, 0x00, 0x00,       /* f32.const 0.0 */
+    0x5e,                               /* f32.gt */
+    0x0b                                /* end */
+};
+/* 
+ * Wat Source:
+ * (module
+ *   (memory 1)
+ *   (func (export "agent_step") (param $ptr i32) (param $len i32) (param $mid i32) (result i32)
+ *     (f32.gt 
+ *        (f32.load (i32.add (local.get $ptr) (i32.const 8))) 
+ *        (f32.const 0.0)
+ *     )
+ *   )
+ * )
+ */
+
+/* Vectorized envs: with ZENEDGE_VEC_ENVS > 1 (and streaming rings) the
+ * bridge steps that many environments per batch, and one batched inference
+ * answers them all instead of one call per env.
+ */
+#ifndef ZENEDGE_VEC_ENVS
+#define ZENEDGE_VEC_ENVS 1
+#endif
+static_assert(ZENEDGE_VEC_ENVS >= 1 && ZENEDGE_VEC_ENVS <= IPC_VEC_ENVS_MAX,
+              "ZENEDGE_VEC_ENVS must fit one batch in the stream ring");
+static_assert(ZENEDGE_VEC_ENVS == 1 || IPC_OBS_POLICY == IPC_RING_POLICY_FIFO,
+              "vectorized envs need every batch entry: use a FIFO obs ring");
+
+/* ZENEDGE_VEC_PIPELINE=1: the vector is stepped as two groups
+ * (ENV_RESET_FLAG_PIPELINE), so the bridge steps one while the kernel
+ * infers the other and a round costs max(infer, env step), not the sum.
+ */
+#ifndef ZENEDGE_VEC_PIPELINE
+#define ZENEDGE_VEC_PIPELINE 0
+#endif
+static const bool vec_pipeline = ZENEDGE_VEC_PIPELINE && ZENEDGE_VEC_ENVS > 1;
+
+/* Longest an obs wait sleeps before the loop polls the bulk ring */
+#define STREAM_WAIT_US 1000
+
+/* How long boot waits for the bridge to answer CMD_AGENT_LOAD */
+#define AGENT_LOAD_TIMEOUT_US 500000
+
+/* FAST_BOOT=1 builds get to the first action sooner, for guests started
+ * on demand: kmain64 keeps the console quiet and skips the slow init, and
+ * the WASM agent is loaded only after the first action.
+ */
+#ifdef ZENEDGE_FAST_BOOT
+#define FAST_BOOT 1
+#else
+#define FAST_BOOT 0
+#endif
+
+/* GYM_BENCH=<steps> builds benchmark the control loop: after
+ * GYM_BENCH_WARMUP env steps they tell the bridge (CMD_ENV_BENCH), time
+ * the next ZENEDGE_GYM_BENCH steps, send the kernel's figures and stop.
+ */
+#ifndef ZENEDGE_GYM_BENCH
+#define ZENEDGE_GYM_BENCH 0
+#endif
+#define GYM_BENCH_WARMUP 256
+#define GYM_BENCH_ACK_US 1000000  /* How long the bridge may take to answer */
+
+static const uint32_t gym_bench_steps = ZENEDGE_GYM_BENCH;  /* 0 = off */
+
+static obs_entry_t vec_obs[ZENEDGE_VEC_ENVS];
+static action_entry_t vec_act[ZENEDGE_VEC_ENVS];
+static int32_t vec_action[ZENEDGE_VEC_ENVS];
+static float vec_reward[ZENEDGE_VEC_ENVS];     /* Episode so far, per env */
+static uint32_t vec_steps[ZENEDGE_VEC_ENVS];
+
+/* Batched IFR for the vector loop: each episode is a leaf of a v4 batch,
+ * persisted (one blob, one round trip) when full or once a second. The
+ * chain moves on when the bridge has stored a batch.
+ */
+static struct {
+  ifr_leaf_t leaves[IFR_BATCH_MAX];
+  uint32_t count;
+  ipc_tag_t tag;                /* Batch in flight, or IPC_TAG_NONE */
+  uint8_t chain_hash[32];       /* Its chain_hash */
+} g_batch;
+
+static void ifr_batch_poll(KernelLogger *log, bool wait) {
+  if (g_batch.tag == IPC_TAG_NONE)
+      return;
+
+  ipc_response_t rsp;
+  int r = wait ? (ipc_completion_wait(g_batch.tag, &rsp, 0) == 0 ? 1 : -1)
+               : ipc_completion_poll(g_batch.tag, &rsp);
+  if (r == 0)
+      return;
+  g_batch.tag = IPC_TAG_NONE;
+  if (r < 0 || rsp.status != RSP_OK) {
+      log->log("IFR batch persist failed.");
+      return;
+  }
+  memcpy(g_last_chain_hash, g_batch.chain_hash, sizeof(g_last_chain_hash));
+}
+
+static void ifr_batch_flush(KernelLogger *log, uint32_t job_id) {
+  uint32_t n = g_batch.count;
+  if (!n)
+      return;
+  g_batch.count = 0;
+
+  /* This batch chains from the one before: it must have landed */
+  ifr_batch_poll(log, true);
+
+  /* Header and leaves in one blob, which the bridge frees */
+  uint16_t blob_id = heap_alloc(sizeof(ifr_batch_v4_t) + n * sizeof(ifr_leaf_t), BLOB_TYPE_RAW);
+  ifr_batch_v4_t *hdr = blob_id ? (ifr_batch_v4_t *)heap_get_data(blob_id) : NULL;
+  if (!hdr) {
+      log->log("IFR batch dropped: heap full.");
+      return;
+  }
+  ifr_leaf_t *leaves = (ifr_leaf_t *)(hdr + 1);
+  memcpy(leaves, g_batch.leaves, n * sizeof(ifr_leaf_t));
+  ifr_build_v4(hdr, g_last_chain_hash, job_id, leaves[n - 1].model_id, leaves, n);
+  memcpy(g_batch.chain_hash, hdr->chain_hash, sizeof(g_batch.chain_hash));
+
+  g_batch.tag = ipc_submit(CMD_IFR_PERSIST, blob_id, 0);
+  if (g_batch.tag == IPC_TAG_NONE) {
+      heap_free(blob_id);
+      log->log("IFR batch persist failed.");
+  }
+}
+
+/* WASM fallback agent: the bridge's, else the built-in one */
+static wasm_agent_t *load_agent(KernelLogger *log) {
+  wasm_agent_t *agent = NULL;
+  if (ipc_send(CMD_AGENT_LOAD, 0) == 0) {
+      ipc_response_t agent_rsp;
+      if (ipc_wait_response(&agent_rsp, AGENT_LOAD_TIMEOUT_US) == 0 &&
+          agent_rsp.status == RSP_OK && agent_rsp.result != 0) {
+          agent = wasm_agent_load(agent_rsp.result);
+          if (!agent)
+              log->log("Bridge agent failed to load. Using built-in agent.");
+      }
+  }
+  if (!agent)
+      agent = wasm_agent_create(default_wasm, sizeof(default_wasm));
+  if (agent)
+      KLOG2(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "wasm agent compiled in %u us, arena peak %u KB",
+            wasm_agent_compile_us(agent), wasm_agent_peak_kb(agent));
+  else
+      log->log("No WASM agent. Fallback actions are 0.");
+  return agent;
+}
+
+/* The first action is out: boot is over. Runs the init fast boot put off
+ * and sends the boot profile.
+ */
+static void boot_finish(KernelLogger *log, wasm_agent_t **agent) {
+  static bool done = false;
+  if (done)
+      return;
+  done = true;
+
+  bootprof_mark("first_action");
+  uint32_t boot_us = bootprof_total_usec();
+  if (FAST_BOOT) {
+      console_set_quiet(0);
+      *agent = load_agent(log);
+      bootprof_mark("agent");
+  }
+  KLOG1(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "boot to first action in %u us", boot_us);
+  if (bootprof_send() != 0)
+      log->log("Boot profile not sent.");
+}
+
+/* The benchmark window: kernel figures, and the wait counters at its start */
+static struct {
+  bool running;
+  uint32_t warm;                /* Env steps before the window */
+  uint32_t episodes0;
+  uint32_t tsc_khz;
+  cycles_t start, mark;
+  ipc_stream_wait_stats_t wait0;
+  ipc_adapt_stats_t adapt0;
+  hdr_hist_t period, infer;     /* ns */
+  ipc_env_bench_t rep;
+} g_bench;
+
+static void gym_bench_send(KernelLogger *log) {
+  ipc_response_t rsp;
+  ipc_tag_t tag = ipc_submit_inline(CMD_ENV_BENCH, 0, &g_bench.rep, sizeof(g_bench.rep));
+  if (tag == IPC_TAG_NONE) {
+      log->log("CMD_ENV_BENCH not sent.");
+      return;
+  }
+  if (ipc_completion_wait(tag, &rsp, GYM_BENCH_ACK_US) != 0) {
+      ipc_completion_cancel(tag);
+      log->log("Bridge did not answer CMD_ENV_BENCH.");
+  } else if (rsp.status != RSP_OK) {
+      log->log("Bridge refused CMD_ENV_BENCH.");
+  }
+}
+
+static uint32_t bench_ns(cycles_t cycles) {
+  uint64_t ns = cycles * 1000000ULL / g_bench.tsc_khz;
+  return ns > 0xFFFFFFFFULL ? 0xFFFFFFFFu : (uint32_t)ns;
+}
+
+static void bench_pcts(uint32_t *out, const hdr_hist_t *h) {
+  out[0] = hdr_hist_value_at(h, 500);
+  out[1] = hdr_hist_value_at(h, 900);
+  out[2] = hdr_hist_value_at(h, 990);
+  out[3] = h->max;
+}
+
+/* Window over: send the figures and stop here */
+static void gym_bench_finish(KernelLogger *log, uint32_t episodes) {
+  ipc_env_bench_t *rep = &g_bench.rep;
+  ipc_stream_wait_stats_t wait = {};
+  ipc_adapt_stats_t adapt = {};
+  ipc_stream_wait_get_stats(&wait);
+  ipc_adapt_get_stats(&adapt);
+
+  rep->flags |= IPC_ENV_BENCH_DONE;
+  rep->episodes = episodes - g_bench.episodes0;
+  rep->elapsed_us = cycles_to_usec(rdtsc() - g_bench.start);
+  rep->spin_us = (wait.spin_usec - g_bench.wait0.spin_usec) +
+                 (adapt.spin_usec - g_bench.adapt0.spin_usec);
+  rep->sleep_us = (wait.sleep_usec - g_bench.wait0.sleep_usec) +
+                  (adapt.sleep_usec - g_bench.adapt0.sleep_usec);
+  bench_pcts(rep->period_ns, &g_bench.period);
+  bench_pcts(rep->infer_ns, &g_bench.infer);
+  gym_bench_send(log);
+
+  uint32_t per_sec = rep->elapsed_us ?
+      (uint32_t)((uint64_t)rep->steps * 1000000ULL / rep->elapsed_us) : 0;
+  KLOG3(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "gym bench: %u steps in %u us, %u steps/s",
+        rep->steps, (uint32_t)rep->elapsed_us, per_sec);
+  log->log("Benchmark done.");
+  klog_drain(0);
+  for (;;) __asm__ __volatile__("hlt");
+}
+
+/* One loop iteration of `stepped` env steps (out of a vector of `envs`)
+ * is out: the obs were in hand at obs_tsc, the actions went at act_tsc.
+ * Warms up, opens the window, times the iteration, and finishes the
+ * benchmark once it has its steps. flags: IPC_ENV_BENCH_STREAM/PIPELINE.
+ */
+static void gym_bench_step(KernelLogger *log, uint32_t flags, uint32_t envs, uint32_t stepped,
+                           uint32_t episodes, cycles_t obs_tsc, cycles_t act_tsc) {
+  if (!g_bench.running) {
+      g_bench.warm += stepped;
+      if (g_bench.warm < GYM_BENCH_WARMUP)
+          return;
+      g_bench.rep.magic = IPC_ENV_BENCH_MAGIC;
+      g_bench.rep.version = IPC_ENV_BENCH_VERSION;
+      g_bench.rep.flags = flags;
+      g_bench.rep.envs = envs;
+      gym_bench_send(log);      /* The bridge starts its clock */
+
+      g_bench.tsc_khz = time_get_tsc_khz() ? time_get_tsc_khz() : 1;
+      g_bench.episodes0 = episodes;
+      hdr_hist_reset(&g_bench.period);
+      hdr_hist_reset(&g_bench.infer);
+      ipc_stream_wait_get_stats(&g_bench.wait0);
+      ipc_adapt_get_stats(&g_bench.adapt0);
+      g_bench.running = true;
+      g_bench.start = g_bench.mark = rdtsc();
+      return;
+  }
+
+  cycles_t now = rdtsc();
+  hdr_hist_record(&g_bench.period, bench_ns(now - g_bench.mark));
+  hdr_hist_record(&g_bench.infer, bench_ns(act_tsc - obs_tsc));
+  g_bench.mark = now;
+  g_bench.rep.steps += stepped;
+  if (g_bench.rep.steps >= gym_bench_steps)
+      gym_bench_finish(log, episodes);
+}
+
+/* Batched control loop; envs reset themselves, so it never returns.
+ * Pipelined, each round is two groups: while the bridge steps the group
+ * whose actions just went out, the kernel infers the other one, whose
+ * obs came in meanwhile. A bridge that steps whole batches still works.
+ */
+static void run_vector_loop(KernelLogger *log, wasm_agent_t *agent, uint32_t envs) {
+  const size_t stride = sizeof(obs_entry_t) / sizeof(float);
+  const uint32_t split = vec_pipeline ? ENV_PIPELINE_SPLIT(envs) : envs;
+  const uint32_t bench_flags = IPC_ENV_BENCH_STREAM | (vec_pipeline ? IPC_ENV_BENCH_PIPELINE : 0);
+  uint32_t episodes = 0;
+  uint32_t window_steps = 0;
+  usec_t window_start = time_usec();
+  cycles_t batch_mark = 0;
+  uint32_t base = 0;
+
+  log->log(vec_pipeline ? "Vector envs. Pipelined batched inference enabled."
+                        : "Vector envs. Batched inference enabled.");
+  for (;;) {
+      /* One group: env base + i at position i */
+      const uint32_t count = base ? envs - split : split;
+      obs_entry_t *obs = vec_obs + base;
+      uint32_t got = 0;
+      while (got < count) {
+          got += ipc_stream_obs_pop_burst(obs + got, count - got);
+          if (got < count && !idle_work_run(IDLE_WAKE_OBS, IDLE_WORK_PASS_US) &&
+              ipc_stream_wait_obs(STREAM_WAIT_US) != 0)
+              ipc_bulk_poll();
+      }
+      cycles_t obs_tsc = rdtsc();
+
+      uint32_t model_id = (uint32_t)obs[0].model_id;
+      if (kernel_infer_actions(obs[0].obs, IPC_OBS_DIM, stride, count,
+                               model_id, vec_action + base) != 0) {
+          for (uint32_t i = base; i < base + count; i++) {
+              int a = wasm_agent_step(agent, vec_obs[i].obs, IPC_OBS_DIM, model_id);
+              vec_action[i] = a < 0 ? 0 : a;
+          }
+      }
+
+      for (uint32_t i = base; i < base + count; i++) {
+          uint32_t done_bits;
+          memcpy(&done_bits, &vec_obs[i].done, sizeof(done_bits));
+          vec_reward[i] += vec_obs[i].reward;
+          vec_steps[i]++;
+          if (done_bits > 0x3F000000) {
+              episodes++;
+              if (g_batch.count == IFR_BATCH_MAX)
+                  ifr_batch_flush(log, 1);
+              ifr_leaf_t *leaf = &g_batch.leaves[g_batch.count++];
+              leaf->episode_id = episodes;
+              leaf->env = i;
+              leaf->model_id = (uint32_t)vec_obs[i].model_id;
+              leaf->steps = vec_steps[i];
+              leaf->ts_usec = time_usec();
+              leaf->goodput = vec_reward[i];
+              leaf->reserved = 0;
+              vec_reward[i] = 0.0f;
+              vec_steps[i] = 0;
+          }
+
+          vec_act[i].seq = vec_obs[i].seq;
+          vec_act[i].action = (uint16_t)vec_action[i];
+          vec_act[i].flags = (uint16_t)i;
+          vec_act[i].ack_seq = vec_obs[i].seq;
+          vec_act[i].ts = 0; /* Stamped on push */
+      }
+
+      action_entry_t *act = vec_act + base;
+      uint32_t pushed = 0;
+      while (pushed < count) {
+          pushed += ipc_stream_action_push_burst(act + pushed, count - pushed);
+          if (pushed < count)
+              __asm__("pause");
+      }
+      cycles_t act_tsc = rdtsc();
+      boot_finish(log, &agent);
+
+      /* Actions are out: the group's hashing costs the envs nothing */
+      if (g_batch.count == IFR_BATCH_MAX)
+          ifr_batch_flush(log, 1);
+
+      /* The loop period is a whole round, both groups */
+      base = base + count < envs ? base + count : 0;
+      if (base == 0) {
+          cycles_t batch_now = rdtsc();
+          if (batch_mark)
+              lat_record(LAT_LOOP_PERIOD, (uint32_t)cycles_to_usec(batch_now - batch_mark));
+          batch_mark = batch_now;
+      }
+
+      /* Env steps per second, once a second */
+      window_steps += count;
+      usec_t now = time_usec();
+      if (now - window_start >= 1000000ULL) {
+          KLOG3(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "vec: %u envs, %u steps/s, %u episodes",
+                envs, (uint32_t)((uint64_t)window_steps * 1000000ULL / (now - window_start)),
+                episodes);
+          ifr_batch_flush(log, 1);
+          wasm_prof_poll();
+          klog_drain(0);
+          window_steps = 0;
+          window_start = now;
+      }
+
+      ipc_process_responses();
+      ipc_stats_poll();
+      ifr_batch_poll(log, false);
+      if (gym_bench_steps)
+          gym_bench_step(log, bench_flags, envs, count, episodes, obs_tsc, act_tsc);
+  }
+}
+
+/* Episode-end IFR work: persist the record, then, once it is stored, ask
+ * the arbiter about it, while the next episode resets and runs. The
+ * control loop moves it along with ifr_pipeline_poll(); a decision waits
+ * in g_ifr.decided for the loop's next step to apply it.
+ */
+enum ifr_stage_t { IFR_IDLE, IFR_PERSISTING, IFR_ARBITRATING };
+
+static struct {
+  ifr_stage_t stage;
+  ipc_tag_t tag;
+  ifr_record_v3_t rec;      /* Sent twice: persist, then arbitration */
+  bool decided;
+  uint16_t decision;
+  uint16_t model_id;
+} g_ifr;
+
+static void ifr_pipeline_start(KernelLogger *log, const ifr_record_v3_t *rec) {
+  g_ifr.rec = *rec;
+  g_ifr.tag = ipc_submit_inline(CMD_IFR_PERSIST, 0, &g_ifr.rec, sizeof(g_ifr.rec));
+  g_ifr.stage = IFR_PERSISTING;
+  if (g_ifr.tag == IPC_TAG_NONE) {
+      log->log("IFR persist failed.");
+      g_ifr.stage = IFR_IDLE;
+  }
+}
+
+/* The response to the stage in flight */
+static void ifr_pipeline_step(KernelLogger *log, const ipc_response_t *rsp) {
+  if (g_ifr.stage == IFR_PERSISTING) {
+      g_ifr.stage = IFR_IDLE;
+      if (rsp->status != RSP_OK) {
+          log->log("IFR persist failed.");
+          return;
+      }
+      g_ifr.tag = ipc_submit_inline(CMD_ARB_EPISODE, 0, &g_ifr.rec, sizeof(g_ifr.rec));
+      if (g_ifr.tag == IPC_TAG_NONE) {
+          log->log("Arbiter error.");
+          return;
+      }
+      g_ifr.stage = IFR_ARBITRATING;
+      return;
+  }
+
+  g_ifr.stage = IFR_IDLE;
+  if (rsp->status != RSP_OK) {
+      log->log("Arbiter error.");
+      return;
+  }
+  /* Archived and judged: the next record chains from this one */
+  memcpy(g_last_chain_hash, g_ifr.rec.chain_hash, sizeof(g_last_chain_hash));
+  g_ifr.decision = (uint16_t)((rsp->result >> 16) & 0xFFFF);
+  g_ifr.model_id = (uint16_t)(rsp->result & 0xFFFF);
+  g_ifr.decided = true;
+}
+
+static void ifr_pipeline_poll(KernelLogger *log) {
+  ipc_response_t rsp;
+  while (g_ifr.stage != IFR_IDLE) {
+      int r = ipc_completion_poll(g_ifr.tag, &rsp);
+      if (r == 0)
+          return;
+      if (r < 0)
+          rsp.status = RSP_ERROR;
+      ifr_pipeline_step(log, &rsp);
+  }
+}
+
+/* Block until the pipeline is idle, so g_last_chain_hash is final */
+static void ifr_pipeline_drain(KernelLogger *log) {
+  ipc_response_t rsp;
+  while (g_ifr.stage != IFR_IDLE) {
+      if (ipc_completion_wait(g_ifr.tag, &rsp, 0) != 0)
+          rsp.status = RSP_ERROR;
+      ifr_pipeline_step(log, &rsp);
+  }
+}
+
+extern "C" void gym_loop_run(void) {
+  KernelLogger *log = new KernelLogger();
+
+  /* WASM fallback agent, compiled here so the control loop never does
+   * (fast boot: after the first action, boot_finish())
+   */
+  wasm_agent_t *agent = NULL;
+  if (!FAST_BOOT) {
+      agent = load_agent(log);
+      bootprof_mark("agent");
+  }
+
+  /* Reset Env */
+  log->log("Resetting Gym Env...");
+  uint32_t reset_flags = ipc_stream_ready() ?
+      ENV_RESET_PACK(ENV_RESET_FLAG_STREAM | (vec_pipeline ? ENV_RESET_FLAG_PIPELINE : 0),
+                     ZENEDGE_VEC_ENVS) : 0;
+  uint64_t reset_tsc = time_cycles(); /* Clock sync: send side */
+  bool no_env = ipc_send(CMD_ENV_RESET, reset_flags) != 0;
+  if (no_env)
+      log->log("Failed to send RESET");
+  bootprof_mark("reset_sent");
+  
+  /* Loop State */
+  uint32_t current_blob_id = 0;
+  bool use_stream = false;
+  obs_entry_t obs_entry;
+  float reward = 0.0f;
+  float done = 0.0f;
+  uint32_t model_id = 0;
+  uint32_t seq = 0;
+  float episode_reward = 0.0f;
+  uint32_t job_id = 1;
+  uint32_t episode_id = 1;
+  usec_t last_telemetry_usec = 0;
+  uint64_t last_telemetry_ts = 0;
+  bool telemetry_stale = false;
+  const usec_t telemetry_ttl_usec = 5 * 1000000ULL;
+  uint32_t loop_count = 0;
+  cycles_t loop_mark = 0;
+  bool safemode = false;
+  
+  /* Wait for Reset Response */
+  ipc_response_t rsp;
+  while (current_blob_id == 0 && !use_stream && !no_env) {
+      if (ipc_poll_response(&rsp)) {
+          if (rsp.status == RSP_OK) {
+              if (rsp.result == 0 && ipc_stream_ready()) {
+                  use_stream = true;
+                  bootprof_mark("stream_ready");
+                  log->log("Environment Reset. Streaming rings enabled.");
+                  if (ipc_stream_clock_sync(reset_tsc) != 0)
+                      log->log("Bridge clock not published; no obs transit latency.");
+              } else {
+                  current_blob_id = rsp.result;
+                  bootprof_mark("reset_done");
+                  log->log("Environment Reset. Starting Loop.");
+              }
+          } else {
+              log->log("Reset Failed.");
+              no_env = true;
+          }
+      }
+      ipc_bulk_poll(); /* The bridge may upload the model during reset */
+      if (!idle_work_run(IDLE_WAKE_RSP, IDLE_WORK_PASS_US))
+          __asm__("pause");
+  }
+
+  /* No Gym env on this bridge: the kernel's own main loop runs instead */
+  if (no_env) {
+      if (agent)
+          wasm_agent_destroy(agent);
+      delete log;
+      return;
+  }
+
+  if (use_stream && ZENEDGE_VEC_ENVS > 1)
+      run_vector_loop(log, agent, ZENEDGE_VEC_ENVS);
+
+  /* Main Neural Loop */
+  while (true) {
+      uint32_t done_bits = 0;
+      const float *obs_ptr = NULL;
+      uint32_t obs_len = 4;
+      cycles_t obs_tsc = 0;
+
+      if (use_stream) {
+          /* Pop straight into the WASM agent's window: no copy on fallback */
+          obs_entry_t *in = agent ? wasm_agent_obs_window(agent) : NULL;
+          if (!in)
+              in = &obs_entry;
+          while (!ipc_stream_obs_pop(in)) {
+              /* Background work first: the obs arriving stops it */
+              if (idle_work_run(IDLE_WAKE_OBS, IDLE_WORK_PASS_US))
+                  continue;
+              if (ipc_stream_wait_obs(STREAM_WAIT_US) != 0)
+                  ipc_bulk_poll(); /* Model uploads progress between steps */
+          }
+          obs_tsc = rdtsc();
+          if (loop_count == 0)
+              log->log("Stream obs received.");
+          reward = in->reward;
+          done = in->done;
+          model_id = (uint32_t)in->model_id;
+          seq = in->seq;
+          memcpy(&done_bits, &done, sizeof(done_bits));
+          obs_ptr = in->obs;
+          obs_len = IPC_OBS_DIM;
+      } else {
+          obs_tsc = rdtsc(); /* The ENV_STEP / ENV_RESET reply just came in */
+
+          /* Get Data */
+          float* blob_data = (float*)heap_get_data((uint16_t)current_blob_id);
+          if (!blob_data) {
+              log->log("Error: Invalid obs blob.");
+              break;
+          }
+
+          /* Extract fields */
+          /* Obs[0..3], Reward[4], Done[5], ModelID[6] */
+          reward = blob_data[4];
+          done_bits = ((uint32_t*)blob_data)[5];
+          model_id = (uint32_t)blob_data[6];
+          obs_ptr = blob_data;
+      }
+
+      episode_reward += reward;
+
+      /* Check Done (0.5f threshold) */
+      if (done_bits > 0x3F000000) {
+           log->log("Episode Done. Persisting IFR...");
+
+           /* This record chains from the last one the arbiter accepted:
+            * the previous episode's persist/arbitration must be finished
+            */
+           ifr_pipeline_drain(log);
+
+           ifr_record_v3_t ifr;
+           ifr_build_v3(&ifr, g_last_chain_hash, job_id, episode_id, model_id, episode_reward);
+           if (ifr_verify_v3(&ifr) != 0) {
+               /* The record travels inline on the message ring: no blob */
+               ifr_pipeline_start(log, &ifr);
+           } else {
+               log->log("IFR verify failed. Skipping persist.");
+           }
+
+           episode_reward = 0.0f;
+           episode_id++;
+           if (agent)
+               wasm_agent_reset(agent);
+
+           /* Episode boundary is off the control path: flush deferred logs
+            * and pick up profiler mode changes / dump requests */
+           wasm_prof_poll();
+           klog_drain(0);
+
+           log->log("Episode Done. Resetting...");
+           reset_flags = ipc_stream_ready() ? ENV_RESET_FLAG_STREAM : 0;
+           ipc_send(CMD_ENV_RESET, reset_flags);
+           current_blob_id = 0;
+           use_stream = false;
+           while (current_blob_id == 0 && !use_stream) {
+              if (ipc_poll_response(&rsp)) {
+                  if (rsp.status == RSP_OK) {
+                      if (rsp.result == 0 && ipc_stream_ready()) {
+                          use_stream = true;
+                      } else {
+                          current_blob_id = rsp.result;
+                      }
+                  }
+              }
+              ipc_bulk_poll();
+              ifr_pipeline_poll(log);
+              if (!idle_work_run(IDLE_WAKE_RSP, IDLE_WORK_PASS_US))
+                  __asm__("pause");
+           }
+           continue;
+      }
+      
+      /* Telemetry freshness gate: the bridge republishes the seqlock page
+       * continuously; a page whose timestamp stops moving is stale.
+       */
+      ipc_process_responses();
+
+      usec_t now = time_usec();
+      telemetry_snapshot_t snap;
+      if (ipc_telemetry_read(&snap) == 0 && snap.ts_usec != last_telemetry_ts) {
+          if (last_telemetry_ts == 0)
+              log->log("Telemetry page live.");
+          last_telemetry_ts = snap.ts_usec;
+          last_telemetry_usec = now;
+      }
+
+      if (last_telemetry_usec != 0 && (now - last_telemetry_usec) > telemetry_ttl_usec) {
+          if (!telemetry_stale) {
+              log->log("Telemetry stale. Blocking tuning.");
+              telemetry_stale = true;
+          }
+          __asm__("pause");
+          continue;
+      }
+      telemetry_stale = false;
+
+      /* The last episode's arbitration, at the first step after it lands */
+      ifr_pipeline_poll(log);
+      if (g_ifr.decided) {
+          g_ifr.decided = false;
+          switch (g_ifr.decision) {
+              case 1:
+                  log->log("Arbiter: PROMOTE.");
+                  /* Promoted weights are final: their digest is taken once,
+                   * in idle time */
+                  idle_work_finalize(g_ifr.model_id);
+                  break;
+              case 2:
+                  log->log("Arbiter: REJECT.");
+                  break;
+              case 3:
+                  log->log("Arbiter: SAFE_MODE.");
+                  safemode = true;
+                  break;
+              default:
+                  log->log("Arbiter: HOLD.");
+                  break;
+          }
+          model_id = g_ifr.model_id;
+      }
+
+      /* Run Agent */
+      int action = 0;
+      if (safemode) {
+          action = 0;
+      } else {
+          action = kernel_infer_action(obs_ptr, obs_len, model_id);
+          if (action < 0) {
+              if (use_stream && loop_count < 5)
+                  log->log("Kernel infer failed. Falling back to WASM.");
+              action = wasm_agent_step(agent, obs_ptr, obs_len, model_id);
+              if (action < 0) {
+                  log->log("WASM Error. Fallback...");
+                  action = 0;
+              }
+          }
+      }
+      
+      /* Send Action + Ack (Bridge frees previous obs blob) */
+      cycles_t act_tsc;
+      if (use_stream) {
+          while (ipc_stream_action_push(seq, (uint16_t)action, seq) != 0) {
+              __asm__("pause");
+          }
+          act_tsc = rdtsc();
+          boot_finish(log, &agent);
+          if (loop_count == 0)
+              log->log("Stream action pushed.");
+      } else {
+          uint32_t payload = ENV_STEP_PACK((uint16_t)action, (uint16_t)current_blob_id);
+          ipc_send(CMD_ENV_STEP, payload);
+          act_tsc = rdtsc();
+
+          /* Wait for Next Obs */
+          bool got_next = false;
+          while (!got_next) {
+              if (idle_work_run(IDLE_WAKE_RSP, IDLE_WORK_PASS_US))
+                  continue;
+              if (ipc_wait_response(&rsp, 0) == 0 && rsp.status == RSP_OK) {
+                  current_blob_id = rsp.result;
+                  got_next = true;
+              }
+          }
+          /* Once its reply is in, so CMD_AGENT_LOAD's isn't taken for it */
+          boot_finish(log, &agent);
+      }
+
+      cycles_t loop_now = rdtsc();
+      if (loop_mark)
+          lat_record(LAT_LOOP_PERIOD, (uint32_t)cycles_to_usec(loop_now - loop_mark));
+      loop_mark = loop_now;
+      loop_count++;
+      ipc_stats_poll();
+      if (gym_bench_steps)
+          gym_bench_step(log, use_stream ? IPC_ENV_BENCH_STREAM : 0, 1, 1, episode_id - 1,
+                         obs_tsc, act_tsc);
+  }
+
+  klog_drain(0);
+  for (;;) __asm__ __volatile__("hlt");
+}
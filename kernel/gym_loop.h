@@ -0,0 +1,27 @@
+/* kernel/gym_loop.h - Gym control loop
+ *
+ * The bridge's Gym env (bridge/zenedge_gym_agent.py, tools/bridge --env)
+ * driven from the kernel: CMD_ENV_RESET, then obs in and actions out on
+ * the stream rings or in CMD_ENV_STEP blobs, every episode persisted as
+ * an IFR record. Build options: GYM_BENCH, VEC_ENVS, VEC_PIPELINE and
+ * FAST_BOOT (Makefile).
+ */
+
+#ifndef _GYM_LOOP_H
+#define _GYM_LOOP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Run the loop, after ipc_init() and with interrupts on
+ * Returns only if the bridge has no env (CMD_ENV_RESET not sent or
+ * refused); otherwise the loop runs for good.
+ */
+void gym_loop_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GYM_LOOP_H */
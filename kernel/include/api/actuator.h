@@ -14,6 +14,28 @@
 #define ACT_ERR_LIMIT -2
 #define ACT_ERR_HW -3
 
+/* Knobs a batch can set (act_setting_t.knob; CMD_ACT_APPLY on the wire) */
+#define ACT_KNOB_CLOCK_MHZ 1
+#define ACT_KNOB_POWER_W 2
+
+typedef struct {
+  uint16_t knob;
+  uint16_t reserved;
+  uint32_t value;
+} act_setting_t;
+
+/* Settings for one device, applied in order as one command */
+#define ACT_BATCH_MAX 16
+
+typedef struct {
+  uint32_t count;
+  act_setting_t settings[ACT_BATCH_MAX];
+} act_batch_t;
+
+/* Completion handle of a submitted batch */
+typedef uint32_t act_handle_t;
+#define ACT_HANDLE_NONE 0
+
 /* Abstract Actuator Interface */
 typedef struct actuator {
   const char *name;
@@ -24,6 +46,15 @@ typedef struct actuator {
   int (*set_power_limit)(struct actuator *self, uint32_t power_watts);
   int (*reset_defaults)(struct actuator *self);
 
+  /* Async methods, NULL if the driver has none (actuator_submit() then
+   * applies through the ones above). submit sends the batch and returns
+   * at once; poll says 1 once it has been applied, with the time_usec()
+   * it took effect, 0 while pending, or -1 if it failed (either ends
+   * the handle).
+   */
+  act_handle_t (*submit)(struct actuator *self, const act_batch_t *batch);
+  int (*poll)(struct actuator *self, act_handle_t h, uint64_t *effect_us);
+
   /* Private driver data */
   void *priv;
 } actuator_t;
@@ -32,4 +63,19 @@ typedef struct actuator {
 void actuator_register(actuator_t *act);
 actuator_t *actuator_get_default(void);
 
+/* Batches (engine/actuator.c) */
+void act_batch_init(act_batch_t *batch);
+
+/* Returns: 0, or -1 if the batch is full */
+int act_batch_add(act_batch_t *batch, uint16_t knob, uint32_t value);
+
+/* Send batch to act: the driver's submit, or applied here and now
+ * Returns: a handle for actuator_poll(), or ACT_HANDLE_NONE if it could
+ * not be sent (or, applied here, a setting failed)
+ */
+act_handle_t actuator_submit(actuator_t *act, const act_batch_t *batch);
+
+/* As actuator_t.poll, for a handle from actuator_submit() */
+int actuator_poll(actuator_t *act, act_handle_t h, uint64_t *effect_us);
+
 #endif /* _API_ACTUATOR_H */
@@ -26,10 +26,77 @@ typedef struct collector {
 
   /* Private driver data */
   void *priv;
+
+  /* Sampling ring, once collector_start() gave it one */
+  struct collector_ring *ring;
 } collector_t;
 
 /* Global registry */
 void collector_register(collector_t *col);
 collector_t *collector_get_default(void);
 
+/* Sampling rings (engine/collector.c)
+ *
+ * A started collector keeps its last COLLECTOR_RING samples, pushed by
+ * the driver (collector_push, e.g. from its interrupt) or taken by
+ * collector_poll() at the configured rate. Over the last `window` of
+ * them it keeps a per-value histogram of each metric, so the window's
+ * min/max/p95/p99 are exact and each push costs O(1).
+ */
+#define COLLECTOR_RING 1024    /* Samples kept; a power of two */
+#define COLLECTOR_MAX 2        /* Collectors that can be started */
+#define COLLECTOR_EWMA_SHIFT 4 /* EWMA weight of a new sample: 1/16 */
+
+typedef enum {
+  COLLECTOR_TEMP, /* gpu_temp_c */
+  COLLECTOR_UTIL, /* gpu_util_pct */
+  COLLECTOR_METRICS
+} collector_metric_t;
+
+/* One metric over the window (values above 255 count as 255) */
+typedef struct {
+  uint32_t samples;
+  uint32_t errors; /* ecc_errors + xid_errors summed over the window */
+  uint32_t ewma_q8; /* Over every sample since the window restarted */
+  uint32_t mean_q8;
+  uint32_t min;
+  uint32_t max;
+  uint32_t p95;
+  uint32_t p99;
+} collector_stats_t;
+
+/* Give col a ring, sampled by collector_poll() every 1/rate_hz s (0 =
+ * only collector_push), with stats over the last window samples (capped
+ * at COLLECTOR_RING). Restarting an already started collector keeps its
+ * ring. Returns: 0, or -1 if COLLECTOR_MAX are started
+ */
+int collector_start(collector_t *col, uint32_t rate_hz, uint32_t window);
+
+/* Add a sample to col's ring (any context, any CPU) */
+void collector_push(collector_t *col, const metric_snapshot_t *s);
+
+/* Sample each started collector that is due; call from the idle loop */
+void collector_poll(void);
+
+/* time_usec() when collector_poll() next has a sample to take, 0 = never */
+uint64_t collector_next_deadline(void);
+
+/* Copy up to max samples pushed since *cursor (a push count, advanced)
+ * into out; samples the ring no longer holds are skipped
+ * Returns: samples copied
+ */
+uint32_t collector_read(collector_t *col, uint32_t *cursor,
+                        metric_snapshot_t *out, uint32_t max);
+
+/* Start col's window (and EWMA) over, e.g. after changing what it
+ * measures. Returns: the push count, as a collector_read() cursor
+ */
+uint32_t collector_window_restart(collector_t *col);
+
+/* Returns: 0 with the window's stats of metric, or -1 if col has no ring
+ * or no samples in its window
+ */
+int collector_window(collector_t *col, collector_metric_t metric,
+                     collector_stats_t *out);
+
 #endif /* _API_COLLECTOR_H */
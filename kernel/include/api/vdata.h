@@ -0,0 +1,66 @@
+/* kernel/include/api/vdata.h - Read-only kernel data page (user ABI)
+ *
+ * Every user process has this page mapped read-only at ZE_VDATA_VADDR.
+ * The kernel refreshes it each time it switches to the process, so a
+ * process reads the clock calibration, shared heap and IPC counters and
+ * its own contract without a syscall. Read under the sequence count:
+ *
+ *     do {
+ *         s = v->seq;
+ *         ... copy fields ...
+ *     } while ((s & 1) || s != v->seq);
+ *
+ * time_usec() from user space, as the kernel computes it, with a 96-bit
+ * product (see mul_shift() in kernel/time/time.c):
+ *
+ *     ((rdtsc() - boot_tsc) * usec_mult) >> usec_shift
+ *
+ * (rdtsc() - boot_tsc) / cycles_per_usec is close, but cycles_per_usec is
+ * rounded to whole MHz.
+ */
+#ifndef _API_VDATA_H
+#define _API_VDATA_H
+
+#include <stdint.h>
+
+#define ZE_VDATA_VADDR   0x7FFFF000u
+#define ZE_VDATA_MAGIC   0x5644455Au  /* "ZEDV" */
+#define ZE_VDATA_VERSION 2
+
+typedef struct ze_vdata {
+  uint32_t magic;
+  uint32_t version;
+  volatile uint32_t seq;      /* Odd while the kernel rewrites the page */
+  uint32_t pid;
+
+  /* Clock */
+  uint64_t boot_tsc;
+  uint32_t cycles_per_usec;
+  uint32_t cpu_mhz;
+  uint64_t updated_usec;      /* time_usec() of this refresh */
+
+  /* Shared heap */
+  uint32_t heap_free_bytes;
+  uint32_t heap_used_bytes;
+  uint32_t heap_largest_free;
+  uint32_t heap_blob_count;
+
+  /* IPC rings */
+  uint32_t ipc_inflight;      /* Tagged requests awaiting a response */
+  uint32_t ipc_irq_wakeups;
+  uint32_t ipc_rsp_ewma_us;   /* Smoothed response inter-arrival time */
+  uint32_t reserved0;
+
+  /* This process's contract */
+  uint32_t prio;              /* contract_priority_t */
+  uint32_t quantum_ms;        /* 0 = by priority */
+  uint32_t mem_pages_used;
+  uint32_t mem_pages_limit;
+  uint32_t switches_in;       /* Times the scheduler ran this process */
+
+  /* Clock, exact (version 2) */
+  uint32_t usec_mult;
+  uint32_t usec_shift;
+} ze_vdata_t;
+
+#endif /* _API_VDATA_H */
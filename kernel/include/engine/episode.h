@@ -1,6 +1,7 @@
 #ifndef _ENGINE_EPISODE_H
 #define _ENGINE_EPISODE_H
 
+#include "../api/actuator.h"
 #include "../api/collector.h"
 #include <stdint.h>
 
@@ -25,33 +26,86 @@ typedef enum {
   OUTCOME_FAILED_ACTUATOR
 } episode_outcome_t;
 
-/* Context for a single tuning episode */
+/* One configuration under test; arm 0 is the baseline (original clock) */
+#define EP_MAX_ARMS 8
+
+typedef struct {
+  uint32_t clock_mhz;
+  uint8_t alive;             /* Still getting time slices */
+  episode_outcome_t outcome; /* Why it stopped, once it has */
+
+  /* Utilization samples (the goodput proxy), as sums for mean/variance */
+  uint32_t samples;
+  uint64_t sum;
+  uint64_t sum_sq;
+} episode_arm_t;
+
+/* Context for a single tuning episode
+ *
+ * The live arms take turns on the actuator, one time slice each per
+ * round, so slow drift in the workload hits every arm alike. After each
+ * round an arm significantly worse than the leader or the baseline is
+ * dropped, and the worse half of the rest (successive halving). The
+ * leader is promoted as soon as it beats the baseline and every other
+ * live arm by EP_Z standard errors; with the budget spent and no such
+ * leader, the episode is rejected and rolled back.
+ */
 typedef struct {
   uint32_t episode_id;
   episode_state_t state;
+  episode_outcome_t outcome;
 
   /* Configuration */
-  uint32_t monitor_steps_total;
+  uint32_t monitor_steps_total; /* Budget, over all arms and rounds */
   uint32_t monitor_steps_done;
 
-  /* Metrics Accumulator */
-  metric_snapshot_t baseline;
-  metric_snapshot_t current_accum; /* Sum of metrics */
-  uint32_t samples;
+  /* Arms and the one whose slice this is */
+  episode_arm_t arms[EP_MAX_ARMS];
+  uint32_t num_arms;
+  uint32_t arm;
+  uint32_t slice_steps_done;
+  uint32_t round;
+  uint32_t sample_cursor; /* collector_read() position */
+  act_handle_t act_pending; /* Arm's clock submitted, not yet in effect */
+  uint64_t applied_us;      /* time_usec() the arm's clock took effect */
 
   /* Latency Tracking */
   uint64_t start_time;
   uint64_t end_time;
 
   /* Proposed Changes */
-  uint32_t proposed_clock;
+  uint32_t proposed_clock; /* Clock applied now; the winner once promoted */
   uint32_t original_clock; /* For rollback */
 } episode_ctx_t;
 
+/* Monitor steps per time slice; samples from the first EP_SETTLE_US
+ * after the arm's clock took effect are not counted
+ */
+#define EP_SLICE_STEPS 25
+#define EP_SETTLE_US 20000
+
+/* While an episode runs the default collector is sampled at EP_SAMPLE_HZ.
+ * Guardrails look at its last EP_WINDOW samples (within the slice); arms
+ * take every sample, up to EP_ARM_SAMPLES_MAX so the sums fit 64 bits.
+ */
+#define EP_SAMPLE_HZ 1000
+#define EP_WINDOW 256
+#define EP_ARM_SAMPLES_MAX (1u << 20)
+
+/* Significance: mean difference over EP_Z standard errors (z = 2) */
+#define EP_Z 2
+
 /* Public API */
 void episode_init(void);
 void episode_tick(void); /* Called by scheduler/timer */
 int episode_propose(uint32_t clock_mhz, uint32_t duration_steps);
+
+/* Try up to EP_MAX_ARMS - 1 clocks against the baseline at once, within
+ * duration_steps monitor steps in all
+ * Returns: 0, or -1 if an episode is active or count is 0 or too large
+ */
+int episode_propose_set(const uint32_t *clocks_mhz, uint32_t count,
+                        uint32_t duration_steps);
 episode_ctx_t *episode_get_current(void);
 
 #endif /* _ENGINE_EPISODE_H */
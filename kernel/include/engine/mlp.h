@@ -0,0 +1,74 @@
+#ifndef _ENGINE_MLP_H
+#define _ENGINE_MLP_H
+
+#include "../../ipc/ipc_proto.h"
+#include <stdint.h>
+
+/* In-kernel dense MLP inference (ipc_mlp_desc_t).
+ *
+ * Loading resolves the descriptor and every weight/bias tensor once,
+ * checks the shapes chain, and takes a reference on each blob so the
+ * weights are used in place with no copy. Chained (scatter-gather)
+ * tensors are refused. A forward pass is one gemv (+ bias axpy) and
+ * activation per layer on the lib/math.h vector kernels.
+ *
+ * Weights may instead be DTYPE_INT8, quantized per tensor or per output
+ * row. Such a layer quantizes its input on the fly (symmetric, one scale
+ * for the vector, offset by 128 to unsigned) and runs the int8 gemv; the
+ * row sums of the weights, taken at load, fold the offset and the zero
+ * points back out of the int32 accumulators:
+ *   y[r] = scale[r] * sx * (dot(xu, q[r]) - 128 * wsum[r] - zp[r] * sum(xq)) + b[r]
+ *
+ * Weights and biases may also be stored half width (DTYPE_FLOAT16 or
+ * DTYPE_BFLOAT16): each row is widened into a float scratch row just
+ * before its dot product, so the heap holds half the bytes and nothing
+ * is expanded at load.
+ */
+typedef struct {
+  const float *w;   /* out rows, stride floats apart; NULL if wq/wh is set */
+  const int8_t *wq; /* int8 weights: out rows, stride bytes apart */
+  const float *scale;   /* wq: nq scales, then nq zero points (zp) */
+  const int32_t *zp;
+  uint32_t nq;          /* 1 (per tensor) or out (per row) */
+  int32_t wsum[IPC_MLP_MAX_WIDTH]; /* wq: sum of each row */
+  const uint16_t *wh;   /* Half-width weights (wdtype): out rows, stride apart */
+  const float *b;   /* NULL = no bias (unless bh) */
+  const uint16_t *bh;   /* Half-width bias (bdtype) instead of b */
+  uint8_t wdtype;   /* DTYPE_* of the weights */
+  uint8_t bdtype;
+  uint32_t in;
+  uint32_t out;
+  uint32_t stride;
+  uint8_t act;      /* MLP_ACT_* */
+} mlp_layer_t;
+
+typedef struct {
+  uint16_t desc_blob;
+  uint32_t num_layers;
+  uint32_t in_dim;
+  uint32_t out_dim;
+  mlp_layer_t layer[IPC_MLP_MAX_LAYERS];
+  uint16_t refs[1 + 2 * IPC_MLP_MAX_LAYERS]; /* Blobs we hold a reference on */
+  uint32_t num_refs;
+} mlp_model_t;
+
+/* 1 if blob_id holds an ipc_mlp_desc_t */
+int mlp_is_model(uint16_t blob_id);
+
+/* Returns 0, or -1 (logged) if the descriptor or a tensor is unusable */
+int mlp_load(uint16_t desc_blob, mlp_model_t *m);
+void mlp_unload(mlp_model_t *m);
+
+/* Loaded model for desc_blob from a small cache (loading it on a miss),
+ * or NULL
+ */
+const mlp_model_t *mlp_get(uint16_t desc_blob);
+/* Release every cached model */
+void mlp_cache_flush(void);
+
+/* in: in_dim floats; out: out_dim floats */
+void mlp_forward(const mlp_model_t *m, const float *in, float *out);
+/* Forward pass reduced to a discrete action */
+int32_t mlp_action(const mlp_model_t *m, const float *in);
+
+#endif /* _ENGINE_MLP_H */
@@ -0,0 +1,39 @@
+#ifndef _ENGINE_ONNX_H
+#define _ENGINE_ONNX_H
+
+#include "mlp.h"
+#include <stdint.h>
+
+/* In-kernel ONNX policies (BLOB_TYPE_ONNX), C side of the OrtStub loader
+ * in lib/onnx/stub.cpp.
+ *
+ * A serialized ModelProto whose graph is a single chain of Gemm / MatMul /
+ * Add / Relu / Tanh / Softmax / Flatten (and Constant) nodes on float32
+ * tensors is lowered at load into the dense layers of the MLP engine:
+ * constant subexpressions are folded, Gemm's alpha/beta and trailing Adds
+ * are folded into each layer's weights and bias, and linear layers with
+ * nothing in between are multiplied together where that is no more work
+ * to run. The weights live in pages of the loader's own, so the blob is
+ * not needed once loaded.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 1 if blob_id is a BLOB_TYPE_ONNX blob */
+int onnx_is_model(uint16_t blob_id);
+
+/* Lowered model for blob_id from a small cache (loading it on a miss and
+ * reloading it if the blob was rewritten), or NULL if it cannot be run
+ */
+const mlp_model_t *onnx_get(uint16_t blob_id);
+
+/* Release every cached model */
+void onnx_cache_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ENGINE_ONNX_H */
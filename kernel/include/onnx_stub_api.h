@@ -1,21 +1,66 @@
-/* kernel/include/onnx_stub_api.h - Mock ORT API */
+/* kernel/include/onnx_stub_api.h - Minimal in-kernel ORT-style API
+ *
+ * An Env carries load statistics; a Session parses one serialized ONNX
+ * model and runs it on the MLP engine (see engine/onnx.h for what the
+ * graph may contain). There is no file system, so a model is loaded from
+ * bytes in memory rather than a path. Constructors are constexpr and there
+ * are no destructors, so both live in static storage without global
+ * constructors; call Release() to give a session's weights back.
+ */
 #pragma once
 
 #include <stdint.h>
 #include <stddef.h>
 
+extern "C" {
+#include "engine/mlp.h"
+}
+
 namespace OrtStub {
 
+enum Status : uint8_t {
+    kOk = 0,
+    kEmpty,            /* Never loaded, or released */
+    kParseError,       /* Not a well-formed ModelProto */
+    kUnsupportedOp,    /* A node outside the supported set */
+    kUnsupportedGraph, /* Not a single chain the MLP engine can run */
+    kTooLarge,         /* Over IPC_MLP_MAX_LAYERS or IPC_MLP_MAX_WIDTH */
+    kNoMemory,
+};
+
 class Env {
 public:
-    Env();
-    ~Env();
+    constexpr Env() : loaded(0), failed(0), folded(0), fused(0) {}
+
+    uint32_t loaded;   /* Sessions loaded */
+    uint32_t failed;   /* Loads refused */
+    uint32_t folded;   /* Constant Add nodes folded */
+    uint32_t fused;    /* Linear layers multiplied into their successor */
 };
 
 class Session {
 public:
-    Session(Env& env, const char* model_path, void* options);
-    void Run();
+    constexpr Session() : model_(), pages_(0), num_pages_(0), status_(kEmpty) {}
+    /* Equivalent to Session() then Load(env, model, len) */
+    Session(Env &env, const void *model, size_t len, void *options);
+
+    Status Load(Env &env, const void *model, size_t len);
+    void Release();
+
+    Status status() const { return status_; }
+    bool Ok() const { return status_ == kOk; }
+    uint32_t InputDim() const { return model_.in_dim; }
+    uint32_t OutputDim() const { return model_.out_dim; }
+    const mlp_model_t *Model() const { return Ok() ? &model_ : nullptr; }
+
+    /* in: InputDim() floats; out: OutputDim() floats */
+    void Run(const float *in, float *out) const;
+
+private:
+    mlp_model_t model_;
+    uint64_t pages_;      /* zphys_t of the weights */
+    uint32_t num_pages_;
+    Status status_;
 };
 
 } /* namespace OrtStub */
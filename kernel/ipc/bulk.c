@@ -0,0 +1,212 @@
+/* kernel/ipc/bulk.c - Chunked bulk uploads (bridge -> ZENEDGE)
+ *
+ * One transfer at a time. An offer is accepted only once the whole payload
+ * has pages, so a load never fails halfway for lack of memory; finished
+ * payloads stay resident in a small table, oldest evicted first. Polling
+ * copies at most BULK_POLL_CHUNKS chunks per call to keep the main loop's
+ * other work on time. A payload's SHA-256 is taken once, when it finishes,
+ * for the IFRs that name it.
+ */
+
+#include "bulk.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../lib/sha256.h"
+#include "../trace/klog.h"
+#include "../zenedge_alloc.h"
+#include "layout.h"
+#include <stddef.h>
+#include <string.h>
+
+#define BULK_MODELS      4  /* Finished payloads kept resident */
+#define BULK_POLL_CHUNKS 2  /* Chunks copied per ipc_bulk_poll() */
+
+typedef struct {
+  uint32_t model_id;  /* 0 = free (or: transfer still open) */
+  zphys_t phys;
+  uint32_t pages;
+  uint32_t size;
+  uint8_t digest[32];  /* SHA-256 of the payload, once finished */
+} bulk_model_t;
+
+static volatile ipc_bulk_ring_t *bulk = NULL;
+static uint32_t bulk_slots = 0;  /* Private copy: the bridge can write line 0 */
+static uint32_t cur_xfer = 0;    /* Last offer answered */
+static bulk_model_t cur;         /* Pages of the open transfer */
+static bulk_model_t models[BULK_MODELS];
+static uint32_t next_model = 0;
+
+static volatile ipc_bulk_chunk_t *chunk_at(uint32_t index) {
+  return (volatile ipc_bulk_chunk_t *)((volatile uint8_t *)bulk +
+                                       sizeof(ipc_bulk_ring_t) +
+                                       (index % bulk_slots) * sizeof(ipc_bulk_chunk_t));
+}
+
+static void bulk_drop(bulk_model_t *m) {
+  if (m->phys)
+    zenedge_free_pages(m->phys, m->pages);
+  m->model_id = 0;
+  m->phys = 0;
+  m->pages = 0;
+  m->size = 0;
+}
+
+/* Helper: oldest finished payload, or NULL if none */
+static bulk_model_t *bulk_oldest(void) {
+  bulk_model_t *oldest = NULL;
+  for (uint32_t i = 0; i < BULK_MODELS; i++) {
+    if (models[i].model_id && (!oldest || models[i].model_id < oldest->model_id))
+      oldest = &models[i];
+  }
+  return oldest;
+}
+
+/* Helper: answer a new offer (the bridge waits for accepted == xfer) */
+static void bulk_accept(uint32_t xfer) {
+  uint32_t size = bulk->total_size;
+  uint32_t status = IPC_BULK_INVALID;
+
+  bulk_drop(&cur); /* A new offer abandons an unfinished transfer */
+  bulk->credit = 0;
+  bulk->tail = 0;
+
+  if (size > 0 && size <= IPC_BULK_MAX_SIZE) {
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    zalloc_result_t r = zenedge_alloc_pages(pages, ZNODE_ANY);
+    bulk_model_t *old;
+    while (!r.addr && (old = bulk_oldest()) != NULL) {
+      bulk_drop(old);
+      r = zenedge_alloc_pages(pages, ZNODE_ANY);
+    }
+    status = IPC_BULK_NOMEM;
+    if (r.addr) {
+      cur.phys = r.addr;
+      cur.pages = pages;
+      cur.size = size;
+      status = IPC_BULK_OPEN;
+      bulk->credit = bulk_slots;
+    }
+  }
+  if (status != IPC_BULK_OPEN)
+    KLOG1(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "bulk: refused %u byte upload", size);
+
+  bulk->status = status;
+  __asm__ __volatile__("" ::: "memory");
+  bulk->accepted = xfer;
+  cur_xfer = xfer;
+}
+
+/* Helper: publish the finished transfer under a fresh model id */
+static void bulk_finish(void) {
+  bulk_model_t *slot = NULL;
+  for (uint32_t i = 0; i < BULK_MODELS && !slot; i++) {
+    if (!models[i].model_id)
+      slot = &models[i];
+  }
+  if (!slot) {
+    slot = bulk_oldest();
+    bulk_drop(slot);
+  }
+
+  *slot = cur;
+  slot->model_id = IPC_BULK_MODEL_BASE + (next_model++ & 0xFFFF);
+  cur.model_id = 0; /* The pages now belong to the slot */
+  cur.phys = 0;
+  cur.pages = 0;
+  cur.size = 0;
+  sha256_hash((const uint8_t *)phys_to_virt((paddr_t)slot->phys), slot->size, slot->digest);
+
+  bulk->model_id = slot->model_id;
+  __asm__ __volatile__("" ::: "memory");
+  bulk->status = IPC_BULK_DONE;
+}
+
+void ipc_bulk_init(void) {
+  bulk = (volatile ipc_bulk_ring_t *)ipc_region_ptr(IPC_REGION_BULK);
+  bulk_slots = ipc_region_entries(IPC_REGION_BULK);
+  if (!bulk || bulk_slots == 0) {
+    bulk = NULL;
+    return;
+  }
+
+  bulk->magic = 0;
+  __asm__ __volatile__("" ::: "memory");
+  bulk->slots = bulk_slots;
+  bulk->chunk_size = IPC_BULK_CHUNK_SIZE;
+  bulk->credit = 0;
+  bulk->tail = 0;
+  bulk->model_id = 0;
+  bulk->status = IPC_BULK_IDLE;
+  /* An offer left over from a previous boot is stale: the bridge re-offers */
+  cur_xfer = bulk->xfer_id;
+  bulk->accepted = cur_xfer;
+  __asm__ __volatile__("" ::: "memory");
+  bulk->magic = IPC_BULK_MAGIC;
+}
+
+uint32_t ipc_bulk_poll(void) {
+  if (!bulk)
+    return 0;
+
+  uint32_t xfer = bulk->xfer_id;
+  if (xfer != 0 && xfer != cur_xfer)
+    bulk_accept(xfer);
+  if (bulk->status != IPC_BULK_OPEN)
+    return 0;
+
+  uint32_t chunks = (cur.size + IPC_BULK_CHUNK_SIZE - 1) / IPC_BULK_CHUNK_SIZE;
+  uint8_t *dst = (uint8_t *)phys_to_virt((paddr_t)cur.phys);
+  uint32_t tail = bulk->tail;
+  uint32_t head = bulk->head;
+  __asm__ __volatile__("" ::: "memory"); /* Chunk contents after head */
+
+  uint32_t copied = 0;
+  while (tail != head && copied < BULK_POLL_CHUNKS) {
+    volatile ipc_bulk_chunk_t *c = chunk_at(tail);
+    uint32_t off = tail * IPC_BULK_CHUNK_SIZE;
+    uint32_t len = cur.size - off;
+    if (len > IPC_BULK_CHUNK_SIZE)
+      len = IPC_BULK_CHUNK_SIZE;
+    if (tail >= chunks || c->xfer_id != xfer || c->index != tail || c->len != len) {
+      KLOG1(KLOG_SUBSYS_IPC, KLOG_LVL_ERR, "bulk: bad chunk %u, upload dropped", tail);
+      bulk_drop(&cur);
+      bulk->credit = 0;
+      bulk->status = IPC_BULK_INVALID;
+      return copied;
+    }
+
+    memcpy(dst + off, (const void *)c->data, len);
+    tail++;
+    copied++;
+    __asm__ __volatile__("" ::: "memory"); /* Done with the slot before freeing it */
+    bulk->tail = tail;
+    bulk->credit = tail + bulk_slots;
+  }
+
+  if (tail == chunks)
+    bulk_finish();
+  return copied;
+}
+
+const void *ipc_bulk_model(uint32_t model_id, uint32_t *size) {
+  for (uint32_t i = 0; i < BULK_MODELS; i++) {
+    if (model_id >= IPC_BULK_MODEL_BASE && models[i].model_id == model_id) {
+      if (size)
+        *size = models[i].size;
+      return (const void *)phys_to_virt((paddr_t)models[i].phys);
+    }
+  }
+  if (size)
+    *size = 0;
+  return NULL;
+}
+
+int ipc_bulk_model_digest(uint32_t model_id, uint8_t out[32]) {
+  for (uint32_t i = 0; i < BULK_MODELS; i++) {
+    if (model_id >= IPC_BULK_MODEL_BASE && models[i].model_id == model_id) {
+      memcpy(out, models[i].digest, 32);
+      return 0;
+    }
+  }
+  return -1;
+}
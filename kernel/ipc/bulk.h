@@ -0,0 +1,44 @@
+/* kernel/ipc/bulk.h - Chunked bulk uploads from the bridge
+ *
+ * Payloads too big for the shared heap (model weights) stream in over the
+ * bulk ring (IPC_REGION_BULK, see ipc_bulk_ring_t) and land in kernel pages
+ * from zenedge_alloc_pages(). Each finished upload is named by a model id
+ * at or above IPC_BULK_MODEL_BASE.
+ */
+
+#ifndef _IPC_BULK_H
+#define _IPC_BULK_H
+
+#include "ipc_proto.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set up the bulk ring header (called from ipc_init) */
+void ipc_bulk_init(void);
+
+/* Drive uploads from the main loop: accept a new offer, copy out a bounded
+ * number of published chunks and grant credit for more.
+ * Returns: chunks copied
+ */
+uint32_t ipc_bulk_poll(void);
+
+/* Payload of a finished upload
+ * model_id: id from ipc_bulk_ring_t.model_id (>= IPC_BULK_MODEL_BASE)
+ * Returns: kernel pointer and *size in bytes, or NULL if unknown or
+ * evicted. Valid until a later ipc_bulk_poll() evicts it to make room.
+ */
+const void *ipc_bulk_model(uint32_t model_id, uint32_t *size);
+
+/* SHA-256 of a finished upload, taken when it finished
+ * Returns: 0, or -1 if unknown or evicted
+ */
+int ipc_bulk_model_digest(uint32_t model_id, uint8_t out[32]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_BULK_H */
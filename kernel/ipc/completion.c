@@ -0,0 +1,266 @@
+/* kernel/ipc/completion.c - Tagged request completion table
+ *
+ * Fixed table of IPC_MAX_INFLIGHT slots with a free-index stack. A tag is
+ * (generation << 6) | slot, so a stale tag never matches a reused slot and
+ * lookup is a single index + compare.
+ */
+
+#include "completion.h"
+#include "../arch/idt.h"
+#include "../trace/klog.h"
+#include "../trace/lat.h"
+#include "heap.h"
+#include "ipc.h"
+#include <stddef.h>
+
+#define TAG_SLOT_BITS 6
+#define TAG_SLOT_MASK (IPC_MAX_INFLIGHT - 1)
+
+_Static_assert(IPC_MAX_INFLIGHT == (1 << TAG_SLOT_BITS),
+               "IPC_MAX_INFLIGHT must match TAG_SLOT_BITS");
+
+enum { SLOT_FREE = 0, SLOT_PENDING, SLOT_DONE };
+
+typedef struct {
+  ipc_tag_t tag;
+  volatile uint8_t state;
+  ipc_completion_cb_t cb;
+  void *arg;
+  cycles_t sent;             /* For the round-trip histogram */
+  uint16_t lent;             /* Blob lent to the bridge until the tag goes */
+  ipc_response_t rsp;
+} completion_slot_t;
+
+static completion_slot_t slots[IPC_MAX_INFLIGHT];
+static uint8_t free_stack[IPC_MAX_INFLIGHT];
+static uint32_t free_top = 0;
+static uint32_t generation = 0;
+static int table_ready = 0;
+static uint32_t inflight = 0;
+
+/* The IRQ handler also delivers completions: keep table updates atomic */
+static inline int irq_save(void) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  return was;
+}
+
+static inline void irq_restore(int was) {
+  if (was)
+    interrupts_enable();
+}
+
+static void table_init(void) {
+  for (uint32_t i = 0; i < IPC_MAX_INFLIGHT; i++) {
+    slots[i].state = SLOT_FREE;
+    free_stack[i] = (uint8_t)(IPC_MAX_INFLIGHT - 1 - i);
+  }
+  free_top = IPC_MAX_INFLIGHT;
+  table_ready = 1;
+}
+
+static completion_slot_t *slot_alloc(ipc_completion_cb_t cb, void *arg) {
+  int flags = irq_save();
+  if (!table_ready)
+    table_init();
+
+  if (free_top == 0) {
+    irq_restore(flags);
+    return NULL;
+  }
+
+  uint32_t idx = free_stack[--free_top];
+  if (++generation == 0 || (generation << TAG_SLOT_BITS) == 0)
+    generation = 1;
+
+  completion_slot_t *s = &slots[idx];
+  s->tag = (generation << TAG_SLOT_BITS) | idx;
+  s->cb = cb;
+  s->arg = arg;
+  s->sent = rdtsc();
+  s->lent = 0;
+  s->state = SLOT_PENDING;
+  inflight++;
+  irq_restore(flags);
+  return s;
+}
+
+/* Caller holds interrupts off */
+static void slot_unlend(completion_slot_t *s) {
+  if (s->lent) {
+    heap_blob_unlend(s->lent);
+    s->lent = 0;
+  }
+}
+
+/* Caller holds interrupts off */
+static void slot_release(completion_slot_t *s) {
+  slot_unlend(s);
+  s->state = SLOT_FREE;
+  s->tag = IPC_TAG_NONE;
+  free_stack[free_top++] = (uint8_t)(s - slots);
+  inflight--;
+}
+
+static completion_slot_t *slot_lookup(ipc_tag_t tag) {
+  if (tag == IPC_TAG_NONE || !table_ready)
+    return NULL;
+  completion_slot_t *s = &slots[tag & TAG_SLOT_MASK];
+  if (s->tag != tag || s->state == SLOT_FREE)
+    return NULL;
+  return s;
+}
+
+ipc_tag_t ipc_submit_cb(uint16_t cmd, uint32_t payload, uint16_t flags,
+                        ipc_completion_cb_t cb, void *arg) {
+  completion_slot_t *s = slot_alloc(cb, arg);
+  if (!s) {
+    KLOG1(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "completion table full (cmd=%x)", cmd);
+    return IPC_TAG_NONE;
+  }
+
+  ipc_tag_t tag = s->tag;
+  if (ipc_send_tagged(cmd, payload, flags, tag) != 0) {
+    int f = irq_save();
+    slot_release(s);
+    irq_restore(f);
+    return IPC_TAG_NONE;
+  }
+  return tag;
+}
+
+ipc_tag_t ipc_submit(uint16_t cmd, uint32_t payload, uint16_t flags) {
+  return ipc_submit_cb(cmd, payload, flags, NULL, NULL);
+}
+
+ipc_tag_t ipc_submit_inline(uint16_t cmd, uint32_t arg, const void *data,
+                            uint16_t len) {
+  completion_slot_t *s = slot_alloc(NULL, NULL);
+  if (!s) {
+    KLOG1(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "completion table full (cmd=%x)", cmd);
+    return IPC_TAG_NONE;
+  }
+
+  ipc_tag_t tag = s->tag;
+  if (ipc_msg_send(cmd, arg, data, len, tag) != 0) {
+    int f = irq_save();
+    slot_release(s);
+    irq_restore(f);
+    return IPC_TAG_NONE;
+  }
+  return tag;
+}
+
+ipc_tag_t ipc_completion_reserve(void) {
+  completion_slot_t *s = slot_alloc(NULL, NULL);
+  if (!s) {
+    KLOG(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "completion table full (reserve)");
+    return IPC_TAG_NONE;
+  }
+  return s->tag;
+}
+
+int ipc_completion_lend(ipc_tag_t tag, uint16_t blob_id) {
+  int flags = irq_save();
+  completion_slot_t *s = slot_lookup(tag);
+  int ret = -1;
+  if (s && s->state == SLOT_PENDING && !s->lent && heap_blob_lend(blob_id) == 0) {
+    s->lent = blob_id;
+    ret = 0;
+  }
+  irq_restore(flags);
+  return ret;
+}
+
+int ipc_completion_deliver(const ipc_response_t *rsp) {
+  int flags = irq_save();
+  completion_slot_t *s = slot_lookup(rsp->tag);
+  if (!s || s->state != SLOT_PENDING) {
+    irq_restore(flags);
+    return 0;
+  }
+  lat_record_ipc(rsp->orig_cmd, (uint32_t)cycles_to_usec(rdtsc() - s->sent));
+  slot_unlend(s); /* The bridge is done with it */
+
+  if (s->cb) {
+    ipc_completion_cb_t cb = s->cb;
+    void *arg = s->arg;
+    slot_release(s);
+    irq_restore(flags);
+    cb(rsp, arg);
+    return 1;
+  }
+
+  s->rsp = *rsp;
+  s->state = SLOT_DONE;
+  irq_restore(flags);
+  return 1;
+}
+
+int ipc_completion_set_cb(ipc_tag_t tag, ipc_completion_cb_t cb, void *arg) {
+  int flags = irq_save();
+  completion_slot_t *s = slot_lookup(tag);
+  if (!s) {
+    irq_restore(flags);
+    return -1;
+  }
+  if (s->state == SLOT_PENDING) {
+    s->cb = cb;
+    s->arg = arg;
+    irq_restore(flags);
+    return 0;
+  }
+
+  /* Beat us to it */
+  ipc_response_t rsp = s->rsp;
+  slot_release(s);
+  irq_restore(flags);
+  cb(&rsp, arg);
+  return 0;
+}
+
+int ipc_completion_poll(ipc_tag_t tag, ipc_response_t *out) {
+  int flags = irq_save();
+  completion_slot_t *s = slot_lookup(tag);
+  if (!s) {
+    irq_restore(flags);
+    return -1;
+  }
+  if (s->state != SLOT_DONE) {
+    irq_restore(flags);
+    return 0;
+  }
+
+  if (out)
+    *out = s->rsp;
+  slot_release(s);
+  irq_restore(flags);
+  return 1;
+}
+
+/* ipc_wait_until() condition: pump the ring, then check our slot */
+static int completion_ready(void *arg) {
+  ipc_tag_t tag = *(ipc_tag_t *)arg;
+  ipc_process_responses();
+  ipc_msg_process();
+  completion_slot_t *s = slot_lookup(tag);
+  return !s || s->state == SLOT_DONE;
+}
+
+int ipc_completion_wait(ipc_tag_t tag, ipc_response_t *out, usec_t timeout_us) {
+  if (ipc_wait_until(completion_ready, &tag, timeout_us) != 0)
+    return -1;
+  return ipc_completion_poll(tag, out) == 1 ? 0 : -1;
+}
+
+void ipc_completion_cancel(ipc_tag_t tag) {
+  int flags = irq_save();
+  completion_slot_t *s = slot_lookup(tag);
+  if (s)
+    slot_release(s);
+  irq_restore(flags);
+}
+
+uint32_t ipc_completion_inflight(void) {
+  return inflight;
+}
@@ -0,0 +1,93 @@
+/* kernel/ipc/completion.h - Tagged requests and async completion table
+ *
+ * ipc_submit() sends a command with a fresh tag and returns it as a handle.
+ * The bridge echoes the tag in its response; the response path
+ * (ipc_poll_response(), ipc_process_responses(), the IPC IRQ handler) routes
+ * tagged responses here instead of handing them to whoever polls next.
+ *
+ * Per handle the caller can poll, wait, or register a callback. Callbacks
+ * run from whatever context drained the response ring (possibly IRQ).
+ */
+
+#ifndef _IPC_COMPLETION_H
+#define _IPC_COMPLETION_H
+
+#include "../time/time.h"
+#include "ipc_proto.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum requests in flight (power of two) */
+#define IPC_MAX_INFLIGHT 64
+
+typedef uint32_t ipc_tag_t;
+typedef void (*ipc_completion_cb_t)(const ipc_response_t *rsp, void *arg);
+
+/* Send a tagged command.
+ * Returns: tag on success, IPC_TAG_NONE if the table or the ring is full
+ */
+ipc_tag_t ipc_submit(uint16_t cmd, uint32_t payload, uint16_t flags);
+
+/* Send a tagged command whose response is handed to cb(rsp, arg). The tag
+ * is released after the callback returns.
+ */
+ipc_tag_t ipc_submit_cb(uint16_t cmd, uint32_t payload, uint16_t flags,
+                        ipc_completion_cb_t cb, void *arg);
+
+/* Send a tagged command with len bytes of inline payload on the message
+ * ring (no heap blob). The response carries status/result only.
+ */
+ipc_tag_t ipc_submit_inline(uint16_t cmd, uint32_t arg, const void *data,
+                            uint16_t len);
+
+/* Take a tag for a request the caller sends itself (ipc_send_tagged(), or
+ * as an entry of a batched command). Returns IPC_TAG_NONE if the table is
+ * full; ipc_completion_cancel() it if the send fails.
+ */
+ipc_tag_t ipc_completion_reserve(void);
+
+/* Lend blob_id to the bridge for the life of a pending tag, for commands
+ * whose handler reads it in place (CMD_RUN_MODEL): heap_blob_lend() now,
+ * heap_blob_unlend() once the response arrives (or the tag is cancelled).
+ * Call before the send.
+ * Returns 0, -1 if the tag is unknown or already lends a blob, or the
+ * blob is not live.
+ */
+int ipc_completion_lend(ipc_tag_t tag, uint16_t blob_id);
+
+/* Hand a pending tag's response to cb(rsp, arg) instead of keeping it for
+ * ipc_completion_poll(), e.g. for a tag from ipc_completion_reserve() or
+ * ipc_run_model_submit(). If it has already arrived, cb runs now.
+ * Returns 0, or -1 if the tag is unknown.
+ */
+int ipc_completion_set_cb(ipc_tag_t tag, ipc_completion_cb_t cb, void *arg);
+
+/* Non-blocking check. Returns 1 and releases the tag if the response has
+ * arrived, 0 if still pending, -1 if the tag is unknown.
+ */
+int ipc_completion_poll(ipc_tag_t tag, ipc_response_t *out);
+
+/* Drive the response ring until the tag completes or timeout_us expires
+ * (0 = wait forever). Returns 0 on completion, -1 on timeout/unknown tag.
+ */
+int ipc_completion_wait(ipc_tag_t tag, ipc_response_t *out, usec_t timeout_us);
+
+/* Forget a pending request; a late response is dropped */
+void ipc_completion_cancel(ipc_tag_t tag);
+
+/* Called by the response path. Returns 1 if the response belonged to a
+ * live tag (and was consumed), 0 otherwise.
+ */
+int ipc_completion_deliver(const ipc_response_t *rsp);
+
+/* Requests currently in flight */
+uint32_t ipc_completion_inflight(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_COMPLETION_H */
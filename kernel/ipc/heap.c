@@ -1,12 +1,33 @@
 /* kernel/ipc/heap.c - Shared Heap Implementation
  *
- * Simple bitmap-based allocator for the shared memory heap.
+ * Buddy allocator for the shared memory heap (see heap_ctl_t). The heap is
+ * split into a kernel arena and a bridge arena; this file only ever writes
+ * the kernel arena's free lists, counters, bitmap words and blob slots, so
+ * the bridge can allocate from its own arena at the same time.
  * Used to pass tensor data between ZENEDGE and Linux bridge.
+ *
+ * Blobs are found through a direct-indexed table in the control block
+ * (heap_blob_slot_t): a lookup is one slot read for either side's blobs.
+ * Bridge-owned blobs freed here go onto the bridge arena's return queue.
+ *
+ * Slab pools (heap_pool_create) keep same-size blobs allocated and published;
+ * drawing and freeing one is a push/pop on the pool's free stack.
+ *
+ * Because blob ids are handles into the table, heap_compact() can move our
+ * unpinned blobs to let free buddies merge; only the slot offset changes.
+ *
+ * Read-only blobs (model weights, once finalized) can't change until their
+ * slot is reused, which gives them a new blob_id: their SHA-256 digests are
+ * kept in a small kernel-private cache keyed by that id.
  */
 
 #include "heap.h"
 #include "../console.h"
+#include "../lib/crc32c.h"
+#include "../lib/sha256.h"
 #include "../mm/vmm.h"
+#include "../trace/klog.h"
+#include <string.h>
 
 /* External: shared memory base (set by ipc_init) */
 extern uint32_t ipc_shm_base;
@@ -14,57 +35,325 @@ extern uint32_t ipc_shm_base;
 /* Heap pointers (set during heap_init) */
 static volatile heap_ctl_t *heap_ctl = NULL;
 static volatile uint8_t *heap_data = NULL;
+static uint32_t heap_data_size = 0;  /* From the layout descriptor */
+static uint32_t heap_blocks = 0;
+
+/* Our arena and the bridge's (whose return queue we feed) */
+static volatile heap_arena_t *arena = NULL;
+static volatile heap_arena_t *peer = NULL;
+
+/* Shared blob table (after the bitmap in the control block) */
+static volatile heap_blob_slot_t *blob_table = NULL;
+static uint32_t blob_mask = 0;
+static uint32_t blob_shift = 0;
+
+/* Health counters (kernel side only) */
+static uint32_t alloc_failures[HEAP_BUDDY_ORDERS]; /* By requested order */
+static uint32_t compact_moves = 0;
+
+/* References to our blobs the bridge (or a mesh peer) holds without
+ * having taken them itself, by slot: lent (heap_blob_lend) or handed over
+ * (heap_blob_hand_over). Kernel memory on purpose: a handed-over reference
+ * moves no counter until the bridge drops it.
+ */
+static uint8_t lent[HEAP_BLOB_SLOTS_MAX];
 
-/* Blob table - maps blob_id to offset (simple linear search for now) */
-#define MAX_BLOBS 256
-static struct {
-  uint16_t blob_id;
-  uint32_t offset; /* Offset from heap_data base */
-  uint32_t blocks; /* Number of blocks allocated */
-} blob_table[MAX_BLOBS];
-static uint32_t blob_count = 0;
+/* Our pooled blobs sitting on their pool's free stack, by slot */
+static uint8_t pool_idle[HEAP_BLOB_SLOTS_MAX / 8];
 
-/* Helper: set bit in bitmap */
-static void bitmap_set(uint32_t block) {
-  if (block < HEAP_MAX_BLOCKS) {
-    heap_ctl->bitmap[block / 8] |= (1 << (block % 8));
-  }
-}
+#define SLOT_BIT_TEST(map, idx) ((map)[(idx) >> 3] & (1u << ((idx) & 7)))
+#define SLOT_BIT_SET(map, idx) ((map)[(idx) >> 3] |= (uint8_t)(1u << ((idx) & 7)))
+#define SLOT_BIT_CLEAR(map, idx) ((map)[(idx) >> 3] &= (uint8_t)~(1u << ((idx) & 7)))
 
-/* Helper: clear bit in bitmap */
-static void bitmap_clear(uint32_t block) {
-  if (block < HEAP_MAX_BLOCKS) {
-    heap_ctl->bitmap[block / 8] &= ~(1 << (block % 8));
+/* Digests of read-only blobs, direct-mapped by slot. blob_id carries the
+ * slot generation; size and checksum catch an id that wrapped around.
+ */
+#define HEAP_DIGESTS 16
+typedef struct {
+  uint16_t blob_id;           /* 0 = empty */
+  uint32_t size;
+  uint32_t checksum;
+  uint8_t digest[32];
+} heap_digest_t;
+static heap_digest_t digests[HEAP_DIGESTS];
+
+/* Helper: mark [start, start + count) used or free, a word at a time */
+static void bitmap_fill(uint32_t start, uint32_t count, int used) {
+  volatile uint8_t *bm = heap_ctl->bitmap;
+  uint32_t end = start + count;
+  if (end > heap_blocks)
+    end = heap_blocks;
+
+  /* Leading bits up to a 64-bit boundary */
+  while (start < end && (start & 63) != 0) {
+    if (used)
+      bm[start / 8] |= (uint8_t)(1 << (start % 8));
+    else
+      bm[start / 8] &= (uint8_t)~(1 << (start % 8));
+    start++;
+  }
+  /* Whole words (the bitmap is 8-byte aligned after the header) */
+  volatile uint64_t *words = (volatile uint64_t *)bm;
+  while (end - start >= 64) {
+    words[start / 64] = used ? ~0ULL : 0;
+    start += 64;
+  }
+  /* Trailing bits */
+  while (start < end) {
+    if (used)
+      bm[start / 8] |= (uint8_t)(1 << (start % 8));
+    else
+      bm[start / 8] &= (uint8_t)~(1 << (start % 8));
+    start++;
   }
 }
 
 /* Helper: test bit in bitmap */
 static int bitmap_test(uint32_t block) {
-  if (block >= HEAP_MAX_BLOCKS)
+  if (block >= heap_blocks)
     return 1; /* Out of range = used */
   return (heap_ctl->bitmap[block / 8] >> (block % 8)) & 1;
 }
 
-/* Helper: find contiguous free blocks */
-static uint32_t find_free_blocks(uint32_t count) {
-  uint32_t start = 0;
-  uint32_t run = 0;
-
-  for (uint32_t i = 0; i < HEAP_MAX_BLOCKS; i++) {
-    if (!bitmap_test(i)) {
-      if (run == 0)
-        start = i;
-      run++;
-      if (run >= count)
-        return start;
-    } else {
-      run = 0;
+/* Helper: free chunk header at an arena-relative block */
+static volatile heap_free_chunk_t *chunk_at(uint32_t block) {
+  return (volatile heap_free_chunk_t *)(heap_data + (arena->base_block + block) *
+                                                        HEAP_BLOCK_SIZE);
+}
+
+/* Helper: smallest order whose chunk holds `blocks` */
+static uint32_t order_for(uint32_t blocks) {
+  return blocks <= 1 ? 0 : 32 - __builtin_clz(blocks - 1);
+}
+
+/* Helper: push a chunk onto its order's free list */
+static void buddy_push(uint32_t block, uint32_t order) {
+  volatile heap_free_chunk_t *c = chunk_at(block);
+  uint32_t head = arena->free_head[order];
+  c->magic = HEAP_FREE_MAGIC;
+  c->order = order;
+  c->next = head;
+  c->prev = HEAP_BUDDY_NIL;
+  if (head != HEAP_BUDDY_NIL)
+    chunk_at(head)->prev = block;
+  arena->free_head[order] = block;
+}
+
+/* Helper: unlink a chunk from its order's free list */
+static void buddy_unlink(uint32_t block, uint32_t order) {
+  volatile heap_free_chunk_t *c = chunk_at(block);
+  if (c->prev != HEAP_BUDDY_NIL)
+    chunk_at(c->prev)->next = c->next;
+  else
+    arena->free_head[order] = c->next;
+  if (c->next != HEAP_BUDDY_NIL)
+    chunk_at(c->next)->prev = c->prev;
+  c->magic = 0;
+}
+
+/* Helper: take a 2^order chunk, splitting a larger one if needed */
+static uint32_t buddy_alloc(uint32_t order) {
+  uint32_t k = order;
+  while (k < arena->buddy_orders && arena->free_head[k] == HEAP_BUDDY_NIL)
+    k++;
+  if (k >= arena->buddy_orders)
+    return HEAP_BUDDY_NIL;
+
+  uint32_t block = arena->free_head[k];
+  buddy_unlink(block, k);
+
+  /* Return the upper halves until the chunk is the requested order */
+  while (k > order) {
+    k--;
+    buddy_push(block + (1u << k), k);
+  }
+  bitmap_fill(arena->base_block + block, 1u << order, 1);
+  return block;
+}
+
+/* Helper: free a 2^order chunk, merging with free buddies */
+static void buddy_free(uint32_t block, uint32_t order) {
+  bitmap_fill(arena->base_block + block, 1u << order, 0);
+
+  while (order + 1 < arena->buddy_orders) {
+    uint32_t buddy = block ^ (1u << order);
+    if (buddy + (1u << order) > arena->blocks)
+      break; /* Tail of a non power-of-two arena has no buddy */
+    volatile heap_free_chunk_t *c = chunk_at(buddy);
+    if (bitmap_test(arena->base_block + buddy) || c->magic != HEAP_FREE_MAGIC ||
+        c->order != order)
+      break;
+    buddy_unlink(buddy, order);
+    if (buddy < block)
+      block = buddy;
+    order++;
+  }
+  buddy_push(block, order);
+}
+
+/* Helper: order of an arena's largest free chunk, or -1 if it is full.
+ * Only reads list heads, so it is safe on the peer's arena too. */
+static int largest_order(volatile heap_arena_t *a) {
+  for (int k = (int)a->buddy_orders - 1; k >= 0; k--)
+    if (a->free_head[k] != HEAP_BUDDY_NIL)
+      return k;
+  return -1;
+}
+
+/* Helper: set up an arena's counters and seed its free lists */
+static void arena_init(volatile heap_arena_t *a, uint32_t base, uint32_t blocks,
+                       uint32_t slot_base, uint32_t slot_count) {
+  a->base_block = base;
+  a->blocks = blocks;
+  a->free_blocks = blocks;
+  a->buddy_orders = blocks ? 32 - __builtin_clz(blocks) : 0;
+  if (a->buddy_orders > HEAP_BUDDY_ORDERS)
+    a->buddy_orders = HEAP_BUDDY_ORDERS;
+  a->slot_base = slot_base;
+  a->slot_count = slot_count;
+  a->next_slot = 0;
+  a->blob_count = 0;
+  a->ret.head = 0;
+  a->ret.tail = 0;
+  for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++)
+    a->free_head[k] = HEAP_BUDDY_NIL;
+  for (uint32_t p = 0; p < HEAP_POOLS; p++) {
+    a->pool[p].blob_size = 0;
+    a->pool[p].free_count = 0;
+  }
+
+  /* Largest aligned chunks that fit */
+  volatile heap_arena_t *saved = arena;
+  arena = a;
+  for (uint32_t block = 0; block < blocks;) {
+    uint32_t k = a->buddy_orders - 1;
+    while ((block & ((1u << k) - 1)) != 0 || block + (1u << k) > blocks)
+      k--;
+    buddy_push(block, k);
+    block += 1u << k;
+  }
+  arena = saved;
+}
+
+/* Helper: entry currently holding blob_id, or NULL */
+static volatile heap_blob_slot_t *slot_lookup(uint16_t blob_id) {
+  if (!blob_table || blob_id == 0)
+    return NULL;
+  volatile heap_blob_slot_t *slot = &blob_table[blob_id & blob_mask];
+  return slot->blob_id == blob_id ? slot : NULL;
+}
+
+/* Helper: does our arena own this blob's slot? */
+static int slot_is_ours(uint16_t blob_id) {
+  return (uint32_t)((blob_id & blob_mask) - arena->slot_base) < arena->slot_count;
+}
+
+/* Helper: find a free slot in our range, round-robin from next_slot */
+static uint32_t slot_find_free(void) {
+  uint32_t start = arena->next_slot;
+  for (uint32_t i = 0; i < arena->slot_count; i++) {
+    uint32_t idx = arena->slot_base + (start + i) % arena->slot_count;
+    if (blob_table[idx].blob_id == 0)
+      return idx;
+  }
+  return (uint32_t)-1; /* Our slots are all live */
+}
+
+/* Helper: blob_id for the next generation of a slot (never 0) */
+static uint16_t slot_next_id(uint32_t idx, uint16_t *generation) {
+  uint16_t gen = blob_table[idx].generation;
+  uint16_t id;
+  do {
+    gen++;
+    id = (uint16_t)(((uint32_t)gen << blob_shift) | idx);
+  } while (id == 0);
+  *generation = gen;
+  return id;
+}
+
+/* Helper: references still held on a blob, by either side */
+static uint16_t blob_refs(volatile heap_blob_t *blob) {
+  return (uint16_t)(blob->taken[HEAP_ARENA_KERNEL] + blob->taken[HEAP_ARENA_BRIDGE] -
+                    blob->dropped[HEAP_ARENA_KERNEL] - blob->dropped[HEAP_ARENA_BRIDGE]);
+}
+
+/* Helper: release one of our own, unreferenced, blobs
+ * queued: the id came off the return queue, where both sides releasing
+ * at once can leave a duplicate of a blob we already recycled.
+ */
+static void free_local(uint16_t blob_id, int queued) {
+  volatile heap_blob_slot_t *slot = slot_lookup(blob_id);
+  if (!slot)
+    return;
+
+  uint32_t offset = slot->offset;
+  uint32_t blocks = slot->blocks;
+
+  heap_blob_t *blob = (heap_blob_t *)(heap_data + offset);
+  if (blob_refs(blob) != 0)
+    return; /* Someone still holds a reference */
+
+  /* Pooled blobs stay published: just put the id back on the free stack,
+   * once. A second free would hand the blob to two owners later.
+   */
+  if ((blob->flags & BLOB_FLAG_POOLED) && blob->pool < HEAP_POOLS) {
+    volatile heap_pool_t *pool = &arena->pool[blob->pool];
+    uint32_t idx = blob_id & blob_mask;
+    if (SLOT_BIT_TEST(pool_idle, idx)) {
+      if (!queued)
+        KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "pool: blob %u freed twice", blob_id);
+      return;
+    }
+    if (pool->free_count < pool->count) {
+      pool->free_ids[pool->free_count++] = blob_id;
+      SLOT_BIT_SET(pool_idle, idx);
     }
+    return;
+  }
+
+  /* A chain holds the one reference on each of its extents */
+  if (blob->type == BLOB_TYPE_SG) {
+    const heap_sg_t *sg = (const heap_sg_t *)(blob + 1);
+    for (uint32_t i = 0; i < sg->count && i < HEAP_SG_MAX_EXTENTS; i++)
+      heap_blob_release(sg->extent[i].blob_id);
+  }
+
+  heap_digest_t *d = &digests[(blob_id & blob_mask) % HEAP_DIGESTS];
+  if (d->blob_id == blob_id)
+    d->blob_id = 0;
+
+  /* Unpublish first, then release the header and blocks */
+  slot->blob_id = 0;
+  __asm__ __volatile__("" ::: "memory");
+  arena->blob_count--;
+
+  uint32_t start = offset / HEAP_BLOCK_SIZE - arena->base_block;
+  if (blocks == 0 || (blocks & (blocks - 1)) != 0 || (start & (blocks - 1)) != 0 ||
+      start + blocks > arena->blocks) {
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "free: corrupt slot for blob %u", blob_id);
+    return;
   }
-  return (uint32_t)-1; /* Not found */
+
+  /* Merging may leave this header inside a larger free chunk */
+  blob->magic = 0;
+  buddy_free(start, order_for(blocks));
+  arena->free_blocks += blocks;
+}
+
+/* Helper: free the blobs the bridge handed back to us */
+static void drain_returns(void) {
+  volatile heap_return_q_t *q = &arena->ret;
+  uint32_t tail = q->tail;
+  uint32_t head = q->head;
+  __asm__ __volatile__("" ::: "memory");
+  while (tail != head) {
+    free_local(q->ids[tail & (HEAP_RETURN_SLOTS - 1)], 1);
+    tail++;
+  }
+  q->tail = tail;
 }
 
-/* Helper: simple checksum */
+/* Helper: legacy rotate/xor checksum (blobs with no BLOB_CSUM_MASK flag) */
 static uint32_t compute_checksum(const void *data, uint32_t size) {
   const uint8_t *p = (const uint8_t *)data;
   uint32_t sum = 0;
@@ -75,82 +364,112 @@ static uint32_t compute_checksum(const void *data, uint32_t size) {
   return sum;
 }
 
-void heap_init(void *heap_base) {
-  if (heap_base == NULL)
+void heap_init(void *ctl_base, uint32_t blob_slots, void *data_base,
+               uint32_t data_size) {
+  if (ctl_base == NULL || data_base == NULL || blob_slots < HEAP_ARENA_COUNT ||
+      (blob_slots & (blob_slots - 1)) != 0)
     return;
 
-  heap_ctl = (heap_ctl_t *)heap_base;
-  /* Data starts relative to control block */
-  heap_data = (uint8_t *)heap_base + (IPC_HEAP_DATA_OFFSET - IPC_HEAP_CTL_OFFSET);
+  heap_ctl = (heap_ctl_t *)ctl_base;
+  heap_data = (uint8_t *)data_base;
+  heap_data_size = data_size;
+  heap_blocks = data_size / HEAP_BLOCK_SIZE;
 
   console_write("[heap] initializing shared heap at ");
   print_hex32((uint32_t)heap_ctl);
   console_write("\n");
 
-  heap_ctl->magic = IPC_HEAP_MAGIC;
-  heap_ctl->version = 1;
-  heap_ctl->total_blocks = HEAP_MAX_BLOCKS;
-  heap_ctl->free_blocks = HEAP_MAX_BLOCKS;
-  heap_ctl->next_blob_id = 1; /* Start ID at 1 */
+  heap_ctl->magic = 0; /* Bridge ignores the heap until we are done */
+  __asm__ __volatile__("" ::: "memory");
+  heap_ctl->version = IPC_HEAP_VERSION;
+  heap_ctl->total_blocks = heap_blocks;
+  heap_ctl->arena_count = HEAP_ARENA_COUNT;
+  heap_ctl->reserved = 0;
+  heap_ctl->blob_slots = blob_slots;
+  heap_ctl->blob_table = HEAP_BLOB_TABLE_OFFSET(heap_blocks);
+  heap_ctl->reserved2 = 0;
 
   /* Clear bitmap (all free) */
-  for (uint32_t i = 0; i < HEAP_BITMAP_SIZE; i++) {
+  for (uint32_t i = 0; i < (heap_blocks + 7) / 8; i++) {
     heap_ctl->bitmap[i] = 0;
   }
 
   /* Clear blob table */
-  blob_count = 0;
-  for (uint32_t i = 0; i < MAX_BLOBS; i++) {
+  blob_table = (volatile heap_blob_slot_t *)((uint8_t *)ctl_base +
+                                             heap_ctl->blob_table);
+  blob_mask = blob_slots - 1;
+  blob_shift = 31 - __builtin_clz(blob_slots);
+  for (uint32_t i = 0; i < blob_slots; i++) {
     blob_table[i].blob_id = 0;
+    blob_table[i].generation = 0;
+    blob_table[i].offset = 0;
+    blob_table[i].blocks = 0;
   }
 
+  /* Split blocks and slots in half; the boundary stays off shared words */
+  uint32_t split = (heap_blocks / 2) & ~(uint32_t)(HEAP_ARENA_ALIGN - 1);
+  uint32_t half = blob_slots / 2;
+  arena = &heap_ctl->arena[HEAP_ARENA_KERNEL];
+  peer = &heap_ctl->arena[HEAP_ARENA_BRIDGE];
+  arena_init(arena, 0, split, 0, half);
+  arena_init(peer, split, heap_blocks - split, half, blob_slots - half);
+
+  __asm__ __volatile__("" ::: "memory");
+  heap_ctl->magic = IPC_HEAP_MAGIC;
+
   console_write("[heap] initialized: ");
-  print_uint(IPC_HEAP_DATA_SIZE / 1024);
+  print_uint(heap_data_size / 1024);
   console_write("KB, ");
-  print_uint(HEAP_MAX_BLOCKS);
-  console_write(" blocks\n");
+  print_uint(heap_blocks);
+  console_write(" blocks, ");
+  print_uint(blob_slots);
+  console_write(" blob slots (split kernel/bridge)\n");
 }
 
 uint16_t heap_alloc(uint32_t size, uint8_t type) {
   if (!heap_ctl || heap_ctl->magic != IPC_HEAP_MAGIC)
     return 0;
 
+  drain_returns();
+
   /* Add space for blob header */
   uint32_t total_size = size + sizeof(heap_blob_t);
 
-  /* Calculate blocks needed */
-  uint32_t blocks = (total_size + HEAP_BLOCK_SIZE - 1) / HEAP_BLOCK_SIZE;
-
-  /* Find free blocks */
-  uint32_t start = find_free_blocks(blocks);
-  if (start == (uint32_t)-1) {
-    console_write("[heap] alloc failed: no space for ");
-    print_uint(blocks);
-    console_write(" blocks\n");
+  /* Calculate blocks needed, rounded up to a buddy chunk */
+  uint32_t order = order_for((total_size + HEAP_BLOCK_SIZE - 1) / HEAP_BLOCK_SIZE);
+  if (order >= arena->buddy_orders) {
+    alloc_failures[arena->buddy_orders - 1]++;
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "alloc failed: %u bytes exceeds arena",
+          size);
+    return 0;
+  }
+  uint32_t blocks = 1u << order;
+
+  /* Find a blob slot, then free blocks */
+  uint32_t idx = slot_find_free();
+  if (idx == (uint32_t)-1) {
+    alloc_failures[order]++;
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "alloc failed: all %u blob slots live",
+          arena->slot_count);
     return 0;
   }
 
-  /* Mark blocks as used */
-  for (uint32_t i = 0; i < blocks; i++) {
-    bitmap_set(start + i);
+  uint32_t start = buddy_alloc(order);
+  if (start == HEAP_BUDDY_NIL) {
+    alloc_failures[order]++;
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "alloc failed: no space for %u blocks",
+          blocks);
+    return 0;
   }
-  heap_ctl->free_blocks -= blocks;
+  arena->free_blocks -= blocks;
 
-  /* Assign blob ID */
-  uint16_t blob_id = heap_ctl->next_blob_id++;
-  if (heap_ctl->next_blob_id == 0)
-    heap_ctl->next_blob_id = 1;
+  /* Assign blob ID (slot + generation) */
+  uint16_t generation;
+  uint16_t blob_id = slot_next_id(idx, &generation);
+  arena->next_slot = (idx - arena->slot_base + 1) % arena->slot_count;
 
   /* Calculate offset */
-  uint32_t offset = start * HEAP_BLOCK_SIZE;
-
-  /* Record in blob table */
-  if (blob_count < MAX_BLOBS) {
-    blob_table[blob_count].blob_id = blob_id;
-    blob_table[blob_count].offset = offset;
-    blob_table[blob_count].blocks = blocks;
-    blob_count++;
-  }
+  uint32_t offset = (arena->base_block + start) * HEAP_BLOCK_SIZE;
 
   /* Initialize blob header */
   heap_blob_t *blob = (heap_blob_t *)(heap_data + offset);
@@ -161,86 +480,481 @@ uint16_t heap_alloc(uint32_t size, uint8_t type) {
   blob->size = size;
   blob->offset = offset + sizeof(heap_blob_t);
   blob->checksum = 0;
+  blob->pool = 0;
+  blob->taken[HEAP_ARENA_KERNEL] = 1; /* The caller's reference */
+  blob->taken[HEAP_ARENA_BRIDGE] = 0;
+  blob->dropped[HEAP_ARENA_KERNEL] = 0;
+  blob->dropped[HEAP_ARENA_BRIDGE] = 0;
+
+  lent[idx] = 0;
+
+  /* Publish in the blob table: id last so lookups never see a half entry */
+  volatile heap_blob_slot_t *slot = &blob_table[idx];
+  slot->offset = offset;
+  slot->blocks = blocks;
+  slot->generation = generation;
+  __asm__ __volatile__("" ::: "memory");
+  slot->blob_id = blob_id;
+  arena->blob_count++;
 
   return blob_id;
 }
 
-void heap_free(uint16_t blob_id) {
-  if (!heap_ctl || blob_id == 0)
+void heap_free(uint16_t blob_id) { heap_blob_release(blob_id); }
+
+int heap_blob_retain(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob || blob_refs(blob) == 0)
+    return -1; /* Only a holder of a reference may take another */
+  __atomic_fetch_add(&blob->taken[HEAP_ARENA_KERNEL], 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+void heap_blob_release(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob)
+    return;
+  if (blob_refs(blob) == 0) {
+    /* Nobody holds one: a double free, which would wrap the counters */
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "free: blob %u has no reference left", blob_id);
+    return;
+  }
+
+  /* Our drop is a full barrier: the bridge's counters are read after it.
+   * Using the value we wrote, only the last kernel releaser can see zero. */
+  uint16_t dropped = __atomic_add_fetch(&blob->dropped[HEAP_ARENA_KERNEL], 1,
+                                        __ATOMIC_SEQ_CST);
+  uint16_t refs = (uint16_t)(blob->taken[HEAP_ARENA_KERNEL] +
+                             blob->taken[HEAP_ARENA_BRIDGE] - dropped -
+                             blob->dropped[HEAP_ARENA_BRIDGE]);
+  if (refs != 0)
+    return;
+
+  if (slot_is_ours(blob_id)) {
+    free_local(blob_id, 0);
+    return;
+  }
+
+  /* Bridge-owned: hand it back through the bridge arena's return queue */
+  volatile heap_return_q_t *q = &peer->ret;
+  uint32_t head = q->head;
+  if (head - q->tail >= HEAP_RETURN_SLOTS) {
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "free: return queue full, blob %u leaked",
+          blob_id);
     return;
+  }
+  q->ids[head & (HEAP_RETURN_SLOTS - 1)] = blob_id;
+  __asm__ __volatile__("" ::: "memory");
+  q->head = head + 1;
+}
 
-  /* Find in blob table */
-  for (uint32_t i = 0; i < blob_count; i++) {
-    if (blob_table[i].blob_id == blob_id) {
-      uint32_t start = blob_table[i].offset / HEAP_BLOCK_SIZE;
-      uint32_t blocks = blob_table[i].blocks;
+uint16_t heap_alloc_sg(uint32_t size, uint8_t inner_type) {
+  if (!heap_ctl || heap_ctl->magic != IPC_HEAP_MAGIC || size == 0)
+    return 0;
 
-      /* Clear blocks in bitmap */
-      for (uint32_t j = 0; j < blocks; j++) {
-        bitmap_clear(start + j);
-      }
-      heap_ctl->free_blocks += blocks;
+  uint16_t sg_id = heap_alloc(sizeof(heap_sg_t), BLOB_TYPE_SG);
+  if (sg_id == 0)
+    return 0;
+  heap_sg_t *sg = (heap_sg_t *)heap_get_data(sg_id);
+  sg->total_size = size;
+  sg->inner_type = inner_type;
+  sg->reserved = 0;
+  sg->count = 0;
+
+  /* Greedy: each extent fills the largest free chunk, so the chain has as
+   * few extents as the free space allows */
+  uint32_t left = size;
+  while (left > 0) {
+    int k = largest_order(arena);
+    uint16_t id = 0;
+    uint32_t piece = 0;
+    if (k >= 0 && sg->count < HEAP_SG_MAX_EXTENTS) {
+      uint32_t room = (HEAP_BLOCK_SIZE << k) - sizeof(heap_blob_t);
+      piece = left < room ? left : room;
+      id = heap_alloc(piece, BLOB_TYPE_RAW);
+      if (id != 0)
+        heap_get_blob(id)->flags |= BLOB_FLAG_CSUM_NONE; /* Pieces are never sealed */
+    }
+    if (id == 0) {
+      KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "sg alloc failed: %u bytes unplaced",
+            left);
+      heap_blob_release(sg_id); /* Takes the extents placed so far with it */
+      return 0;
+    }
+    sg->extent[sg->count].blob_id = id;
+    sg->extent[sg->count].reserved = 0;
+    sg->extent[sg->count].size = piece;
+    sg->count++;
+    left -= piece;
+  }
 
-      /* Remove from table (swap with last) */
-      blob_table[i] = blob_table[blob_count - 1];
-      blob_count--;
+  return sg_id;
+}
 
-      return;
+int heap_sg_iter_init(heap_sg_iter_t *it, uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  it->sg_id = 0;
+  it->index = 0;
+  if (!blob || blob->type != BLOB_TYPE_SG || blob->size < sizeof(heap_sg_t))
+    return -1;
+  it->sg_id = blob_id;
+  return 0;
+}
+
+int heap_sg_next(heap_sg_iter_t *it, void **data, uint32_t *len) {
+  const heap_sg_t *sg = (const heap_sg_t *)heap_get_data(it->sg_id);
+  if (!sg)
+    return -1;
+  if (it->index >= sg->count || it->index >= HEAP_SG_MAX_EXTENTS)
+    return 0;
+
+  const heap_sg_extent_t *e = &sg->extent[it->index];
+  heap_blob_t *blob = heap_get_blob(e->blob_id);
+  if (!blob || blob->size < e->size) {
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "sg: broken extent in chain %u", it->sg_id);
+    return -1;
+  }
+  it->index++;
+  *data = heap_get_data(e->blob_id);
+  *len = e->size;
+  return 1;
+}
+
+int heap_blob_lend(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  uint32_t idx = blob_id & blob_mask;
+  if (!blob || lent[idx] == UINT8_MAX || heap_blob_retain(blob_id) != 0)
+    return -1;
+  lent[idx]++;
+
+  /* The borrower reads a chain's extents through it */
+  if (blob->type == BLOB_TYPE_SG) {
+    const heap_sg_t *sg = (const heap_sg_t *)(blob + 1);
+    for (uint32_t i = 0; i < sg->count && i < HEAP_SG_MAX_EXTENTS; i++) {
+      uint16_t ext = sg->extent[i].blob_id;
+      if (heap_get_blob(ext))
+        lent[ext & blob_mask]++;
     }
   }
+  return 0;
 }
 
-heap_blob_t *heap_get_blob(uint16_t blob_id) {
-  if (!heap_ctl || blob_id == 0)
+void heap_blob_unlend(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  uint32_t idx = blob_id & blob_mask;
+  if (!blob || lent[idx] == 0)
+    return;
+  lent[idx]--;
+
+  if (blob->type == BLOB_TYPE_SG) {
+    const heap_sg_t *sg = (const heap_sg_t *)(blob + 1);
+    for (uint32_t i = 0; i < sg->count && i < HEAP_SG_MAX_EXTENTS; i++) {
+      uint16_t ext = sg->extent[i].blob_id;
+      if (heap_get_blob(ext) && lent[ext & blob_mask])
+        lent[ext & blob_mask]--;
+    }
+  }
+  heap_blob_release(blob_id);
+}
+
+void heap_blob_hand_over(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  uint32_t idx = blob_id & blob_mask;
+  if (!blob || !slot_is_ours(blob_id) || lent[idx] == UINT8_MAX)
+    return;
+  lent[idx]++;
+
+  /* Its extents go when the chain does: keep them put until then */
+  if (blob->type == BLOB_TYPE_SG) {
+    const heap_sg_t *sg = (const heap_sg_t *)(blob + 1);
+    for (uint32_t i = 0; i < sg->count && i < HEAP_SG_MAX_EXTENTS; i++) {
+      heap_blob_t *ext = heap_get_blob(sg->extent[i].blob_id);
+      if (ext)
+        ext->flags |= BLOB_FLAG_PINNED;
+    }
+  }
+}
+
+/* Helper: our blob filling exactly the 2^order chunk at block, if it may move
+ * Pinned and pooled blobs stay put, and so do blobs the bridge holds a
+ * reference to, taken, lent or handed over: it may have a view of the data.
+ */
+static volatile heap_blob_slot_t *movable_at(uint32_t block, uint32_t order) {
+  if (block + (1u << order) > arena->blocks || !bitmap_test(arena->base_block + block))
+    return NULL;
+  uint32_t offset = (arena->base_block + block) * HEAP_BLOCK_SIZE;
+  heap_blob_t *blob = (heap_blob_t *)(heap_data + offset);
+  if (blob->magic != BLOB_MAGIC || !slot_is_ours(blob->blob_id))
+    return NULL;
+  volatile heap_blob_slot_t *slot = slot_lookup(blob->blob_id);
+  if (!slot || slot->offset != offset || slot->blocks != (1u << order))
+    return NULL;
+  uint32_t idx = blob->blob_id & blob_mask;
+  if ((blob->flags & (BLOB_FLAG_PINNED | BLOB_FLAG_POOLED)) ||
+      (uint16_t)(lent[idx] + blob->taken[HEAP_ARENA_BRIDGE] -
+                 blob->dropped[HEAP_ARENA_BRIDGE]) != 0)
     return NULL;
+  return slot;
+}
+
+/* Helper: copy a blob to the 2^order chunk at dst and repoint its handle */
+static void move_blob(volatile heap_blob_slot_t *slot, uint32_t dst, uint32_t order) {
+  uint32_t from = slot->offset;
+  uint32_t to = (arena->base_block + dst) * HEAP_BLOCK_SIZE;
+  uint32_t words = (HEAP_BLOCK_SIZE << order) / sizeof(uint32_t);
+  const volatile uint32_t *src = (const volatile uint32_t *)(heap_data + from);
+  volatile uint32_t *out = (volatile uint32_t *)(heap_data + to);
+  for (uint32_t i = 0; i < words; i++)
+    out[i] = src[i];
+
+  heap_blob_t *blob = (heap_blob_t *)(heap_data + to);
+  blob->offset = to + sizeof(heap_blob_t);
+  __asm__ __volatile__("" ::: "memory");
+  slot->offset = to; /* Lookups see the old copy until here, the new after */
+  __asm__ __volatile__("" ::: "memory");
+  ((heap_blob_t *)(heap_data + from))->magic = 0;
+}
 
-  /* 1. Check Cache */
-  for (uint32_t i = 0; i < blob_count; i++) {
-    if (blob_table[i].blob_id == blob_id) {
-      heap_blob_t *blob = (heap_blob_t *)(heap_data + blob_table[i].offset);
-      /* Verify it's still there (might have been freed remotely) */
-      if (blob->magic == BLOB_MAGIC && blob->blob_id == blob_id) {
-        return blob;
-      }
+/* Helper: one compaction move
+ * A free 2^k chunk whose buddy holds one movable blob: move that blob into
+ * another free 2^k chunk, and its old chunk merges with the free buddy.
+ * Every move leaves one fewer free chunk, so compaction always settles.
+ */
+static int compact_one(void) {
+  for (uint32_t k = 0; k + 1 < arena->buddy_orders; k++) {
+    uint32_t head = arena->free_head[k];
+    if (head == HEAP_BUDDY_NIL || chunk_at(head)->next == HEAP_BUDDY_NIL)
+      continue; /* Needs a free chunk to merge and another to move into */
+
+    for (uint32_t a = head; a != HEAP_BUDDY_NIL; a = chunk_at(a)->next) {
+      uint32_t src = a ^ (1u << k);
+      volatile heap_blob_slot_t *slot = movable_at(src, k);
+      if (!slot)
+        continue;
+
+      uint32_t dst = head != a ? head : chunk_at(a)->next;
+      buddy_unlink(dst, k);
+      bitmap_fill(arena->base_block + dst, 1u << k, 1);
+      move_blob(slot, dst, k);
+      buddy_free(src, k);
+      return 1;
     }
   }
+  return 0;
+}
 
-  /* 2. Scan Heap (Slow Path for Remote/First Access) */
-  /* Iterate all blocks to find the blob header */
-  /* Optimization: Current max alloc? For now, scan all. */
-  
-  /* console_write("[heap] Blob not in cache, scanning...\n"); */
-  
-  for (uint32_t offset = 0; offset < IPC_HEAP_DATA_SIZE; offset += HEAP_BLOCK_SIZE) {
-      heap_blob_t *blob = (heap_blob_t *)(heap_data + offset);
-      if (blob->magic == BLOB_MAGIC) {
-          /* Found a valid blob */
-          if (blob->blob_id == blob_id) {
-              /* Add to cache */
-              if (blob_count < MAX_BLOBS) {
-                  blob_table[blob_count].blob_id = blob_id;
-                  blob_table[blob_count].offset = offset;
-                  /* Blocks = (size + hdr + block_size - 1) / block_size */
-                  uint32_t total = blob->size + sizeof(heap_blob_t);
-                  blob_table[blob_count].blocks = (total + HEAP_BLOCK_SIZE - 1) / HEAP_BLOCK_SIZE;
-                  blob_count++;
-              }
-              return blob;
-          }
-          
-          /* Skip ahead? blob->size is set.
-           * We can jump, but need to be careful of alignment/padding.
-           * Let's check size to jump faster.
-           */
-           uint32_t total = blob->size + sizeof(heap_blob_t);
-           uint32_t blocks = (total + HEAP_BLOCK_SIZE - 1) / HEAP_BLOCK_SIZE;
-           if (blocks > 1) {
-               offset += (blocks - 1) * HEAP_BLOCK_SIZE;
-           }
-      }
-  }
-
-  return NULL;
+uint32_t heap_compact(uint32_t max_moves) {
+  if (!heap_ctl || heap_ctl->magic != IPC_HEAP_MAGIC)
+    return 0;
+
+  drain_returns();
+
+  uint32_t moves = 0;
+  while (moves < max_moves && compact_one())
+    moves++;
+  compact_moves += moves;
+  return moves;
+}
+
+int heap_pool_create(uint32_t size, uint32_t count, uint8_t type) {
+  if (!heap_ctl || heap_ctl->magic != IPC_HEAP_MAGIC || size == 0 || count == 0 ||
+      count > HEAP_POOL_DEPTH)
+    return -1;
+
+  uint32_t p = 0;
+  while (p < HEAP_POOLS && arena->pool[p].blob_size != 0)
+    p++;
+  if (p == HEAP_POOLS) {
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "pool: all %u pools in use", HEAP_POOLS);
+    return -1;
+  }
+
+  /* Carve the blobs from the arena once; they are never buddy-freed */
+  volatile heap_pool_t *pool = &arena->pool[p];
+  pool->count = (uint16_t)count;
+  pool->free_count = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t blob_id = heap_alloc(size, type);
+    if (blob_id == 0) {
+      while (pool->free_count > 0)
+        heap_free(pool->free_ids[--pool->free_count]);
+      return -1;
+    }
+    pool->free_ids[pool->free_count++] = blob_id;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    heap_blob_t *blob = heap_get_blob(pool->free_ids[i]);
+    blob->flags |= BLOB_FLAG_POOLED;
+    blob->pool = p;
+    blob->dropped[HEAP_ARENA_KERNEL] = blob->taken[HEAP_ARENA_KERNEL]; /* Idle */
+    SLOT_BIT_SET(pool_idle, pool->free_ids[i] & blob_mask);
+  }
+  pool->blocks = blob_table[pool->free_ids[0] & blob_mask].blocks;
+  pool->type = type;
+  pool->blob_size = size;
+  return (int)p;
+}
+
+uint16_t heap_pool_alloc(int pool_index) {
+  if (!heap_ctl || (uint32_t)pool_index >= HEAP_POOLS)
+    return 0;
+
+  volatile heap_pool_t *pool = &arena->pool[pool_index];
+  if (pool->free_count == 0) {
+    drain_returns(); /* The bridge may be holding some for us */
+    if (pool->free_count == 0)
+      return 0;
+  }
+  uint16_t blob_id = pool->free_ids[--pool->free_count];
+  SLOT_BIT_CLEAR(pool_idle, blob_id & blob_mask);
+  heap_blob_t *blob = (heap_blob_t *)(heap_data + blob_table[blob_id & blob_mask].offset);
+  __atomic_fetch_add(&blob->taken[HEAP_ARENA_KERNEL], 1, __ATOMIC_SEQ_CST);
+  return blob_id;
+}
+
+uint32_t heap_blob_checksum(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob || blob->offset + blob->size > heap_data_size)
+    return 0;
+
+  const void *data = (const void *)(heap_data + blob->offset);
+  if (blob->flags & BLOB_FLAG_CSUM_NONE)
+    return 0;
+  if (blob->flags & BLOB_FLAG_CSUM_CRC32C)
+    return crc32c(0, data, blob->size);
+  return compute_checksum(data, blob->size);
+}
+
+void heap_blob_seal(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (blob)
+    blob->checksum = heap_blob_checksum(blob_id);
+}
+
+int heap_blob_verify(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob)
+    return -1;
+  if (blob->flags & BLOB_FLAG_CSUM_NONE)
+    return 0;
+  if (heap_blob_checksum(blob_id) != blob->checksum) {
+    KLOG1(KLOG_SUBSYS_HEAP, KLOG_LVL_WARN, "verify: checksum mismatch on blob %u",
+          blob_id);
+    return -1;
+  }
+  return 0;
+}
+
+/* Helper: digest cache entry for blob, or NULL if it can't be cached */
+static heap_digest_t *digest_slot(uint16_t blob_id, const heap_blob_t *blob) {
+  if (!(blob->flags & BLOB_FLAG_READONLY) || (blob->flags & BLOB_FLAG_POOLED))
+    return NULL; /* Writable, or a pooled id that is reused as is */
+  return &digests[(blob_id & blob_mask) % HEAP_DIGESTS];
+}
+
+int heap_blob_digest(uint16_t blob_id, uint8_t out[32]) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob || blob->size == 0 || blob->offset + blob->size > heap_data_size)
+    return -1;
+
+  heap_digest_t *d = digest_slot(blob_id, blob);
+  if (d && d->blob_id == blob_id && d->size == blob->size && d->checksum == blob->checksum) {
+    memcpy(out, d->digest, 32);
+    return 0;
+  }
+
+  sha256_hash((const uint8_t *)(heap_data + blob->offset), blob->size, out);
+  if (d) {
+    d->blob_id = blob_id;
+    d->size = blob->size;
+    d->checksum = blob->checksum;
+    memcpy(d->digest, out, 32);
+  }
+  return 0;
+}
+
+int heap_blob_finalize(uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob)
+    return -1;
+  if (blob->flags & BLOB_FLAG_READONLY)
+    return 0; /* Already final: its digest is cached or will be on first use */
+
+  blob->flags |= BLOB_FLAG_READONLY;
+  heap_blob_seal(blob_id);
+  uint8_t digest[32];
+  return heap_blob_digest(blob_id, digest);
+}
+
+int heap_blob_finalize_begin(heap_finalize_t *f, uint16_t blob_id) {
+  f->blob_id = 0;
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!blob)
+    return -1;
+  if (!(blob->flags & BLOB_FLAG_READONLY)) {
+    blob->flags |= BLOB_FLAG_READONLY;
+    heap_blob_seal(blob_id);
+  }
+  f->blob_id = blob_id;
+  f->size = blob->size;
+  f->checksum = blob->checksum;
+  f->done = 0;
+  sha256_init(&f->sha);
+  return 0;
+}
+
+int heap_blob_finalize_step(heap_finalize_t *f, uint32_t max_bytes) {
+  if (!f->blob_id)
+    return 0;
+  heap_blob_t *blob = heap_get_blob(f->blob_id);
+  if (!blob || blob->offset + blob->size > heap_data_size) {
+    f->blob_id = 0;
+    return -1;
+  }
+  if (blob->size != f->size || blob->checksum != f->checksum) {
+    f->size = blob->size;   /* Rewritten meanwhile: start over */
+    f->checksum = blob->checksum;
+    f->done = 0;
+    sha256_init(&f->sha);
+  }
+
+  uint32_t n = f->size - f->done;
+  if (max_bytes && n > max_bytes)
+    n = max_bytes;
+  sha256_update(&f->sha, (const uint8_t *)(heap_data + blob->offset + f->done), n);
+  f->done += n;
+  if (f->done < f->size)
+    return 1;
+
+  heap_digest_t *d = f->size ? digest_slot(f->blob_id, blob) : NULL;
+  if (d) {
+    d->blob_id = f->blob_id;
+    d->size = f->size;
+    d->checksum = f->checksum;
+    sha256_final(&f->sha, d->digest);
+  }
+  f->blob_id = 0;
+  return 0;
+}
+
+heap_blob_t *heap_get_blob(uint16_t blob_id) {
+  if (!heap_ctl)
+    return NULL;
+
+  volatile heap_blob_slot_t *slot = slot_lookup(blob_id);
+  if (!slot)
+    return NULL;
+
+  uint32_t offset = slot->offset;
+  if (offset + sizeof(heap_blob_t) > heap_data_size)
+    return NULL;
+
+  /* The table is shared: double-check the header it points at */
+  heap_blob_t *blob = (heap_blob_t *)(heap_data + offset);
+  if (blob->magic != BLOB_MAGIC || blob->blob_id != blob_id)
+    return NULL;
+  return blob;
 }
 
 void *heap_get_data(uint16_t blob_id) {
@@ -261,15 +975,47 @@ void heap_get_stats(heap_stats_t *stats) {
     stats->total_blocks = 0;
     stats->free_blocks = 0;
     stats->blob_count = 0;
+    stats->largest_free_bytes = 0;
+    stats->peer_largest_free_bytes = 0;
+    stats->compact_moves = 0;
+    for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++) {
+      stats->free_chunks[k] = 0;
+      stats->alloc_failures[k] = 0;
+    }
     return;
   }
 
+  drain_returns();
+
+  /* Each side's counters are only written by that side: sum the snapshot */
+  uint32_t free_blocks = 0;
+  uint32_t blob_count = 0;
+  for (uint32_t i = 0; i < HEAP_ARENA_COUNT; i++) {
+    free_blocks += heap_ctl->arena[i].free_blocks;
+    blob_count += heap_ctl->arena[i].blob_count;
+  }
+
   stats->total_blocks = heap_ctl->total_blocks;
-  stats->free_blocks = heap_ctl->free_blocks;
+  stats->free_blocks = free_blocks;
   stats->total_bytes = heap_ctl->total_blocks * HEAP_BLOCK_SIZE;
-  stats->free_bytes = heap_ctl->free_blocks * HEAP_BLOCK_SIZE;
+  stats->free_bytes = free_blocks * HEAP_BLOCK_SIZE;
   stats->used_bytes = stats->total_bytes - stats->free_bytes;
   stats->blob_count = blob_count;
+
+  /* Fragmentation: our free lists are ours to walk, the peer's only to peek */
+  int top = largest_order(arena);
+  stats->largest_free_bytes = top >= 0 ? HEAP_BLOCK_SIZE << top : 0;
+  top = largest_order(peer);
+  stats->peer_largest_free_bytes = top >= 0 ? HEAP_BLOCK_SIZE << top : 0;
+  for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++) {
+    uint32_t n = 0;
+    if (k < arena->buddy_orders)
+      for (uint32_t b = arena->free_head[k]; b != HEAP_BUDDY_NIL; b = chunk_at(b)->next)
+        n++;
+    stats->free_chunks[k] = n;
+    stats->alloc_failures[k] = alloc_failures[k];
+  }
+  stats->compact_moves = compact_moves;
 }
 
 void heap_dump_debug(void) {
@@ -284,26 +1030,83 @@ void heap_dump_debug(void) {
   print_hex32(heap_ctl->magic);
   console_write(" (valid)\n");
 
-  console_write("[heap] Blocks: ");
-  print_uint(heap_ctl->free_blocks);
-  console_write("/");
-  print_uint(heap_ctl->total_blocks);
-  console_write(" free\n");
-
-  console_write("[heap] Memory: ");
-  print_uint((heap_ctl->total_blocks - heap_ctl->free_blocks) *
-             HEAP_BLOCK_SIZE);
-  console_write("/");
-  print_uint(heap_ctl->total_blocks * HEAP_BLOCK_SIZE);
-  console_write(" bytes used\n");
+  static const char *const names[HEAP_ARENA_COUNT] = {"kernel", "bridge"};
+  uint32_t blob_count = 0;
+  for (uint32_t i = 0; i < HEAP_ARENA_COUNT; i++) {
+    volatile heap_arena_t *a = &heap_ctl->arena[i];
+    blob_count += a->blob_count;
+
+    /* Largest free chunk bounds the biggest allocation that can succeed */
+    int top = largest_order(a);
+
+    console_write("[heap] ");
+    console_write(names[i]);
+    console_write(" arena: ");
+    print_uint(a->free_blocks);
+    console_write("/");
+    print_uint(a->blocks);
+    console_write(" blocks free, largest chunk ");
+    print_uint(top >= 0 ? (HEAP_BLOCK_SIZE << top) : 0);
+    console_write(" bytes, ");
+    print_uint(a->blob_count);
+    console_write(" blobs, ");
+    print_uint(a->ret.head - a->ret.tail);
+    console_write(" returns pending\n");
+
+    for (uint32_t p = 0; p < HEAP_POOLS; p++) {
+      volatile heap_pool_t *pool = &a->pool[p];
+      if (pool->blob_size == 0)
+        continue;
+      console_write("[heap]   pool ");
+      print_uint(p);
+      console_write(": ");
+      print_uint(pool->free_count);
+      console_write("/");
+      print_uint(pool->count);
+      console_write(" free x ");
+      print_uint(pool->blob_size);
+      console_write(" bytes\n");
+    }
+  }
 
   console_write("[heap] Blobs: ");
   print_uint(blob_count);
-  console_write(" allocated\n");
+  console_write("/");
+  print_uint(blob_mask + 1);
+  console_write(" slots live\n");
+
+  /* Kernel arena fragmentation, by chunk size */
+  heap_stats_t st;
+  heap_get_stats(&st);
+  console_write("[heap] kernel free chunks:");
+  for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++) {
+    if (!st.free_chunks[k])
+      continue;
+    console_write(" ");
+    print_uint(HEAP_BLOCK_SIZE << k);
+    console_write("Bx");
+    print_uint(st.free_chunks[k]);
+  }
+  console_write("\n[heap] alloc failures:");
+  for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++) {
+    if (!st.alloc_failures[k])
+      continue;
+    console_write(" ");
+    print_uint(HEAP_BLOCK_SIZE << k);
+    console_write("Bx");
+    print_uint(st.alloc_failures[k]);
+  }
+  console_write(", ");
+  print_uint(st.compact_moves);
+  console_write(" compaction moves\n");
 
   /* List blobs */
-  for (uint32_t i = 0; i < blob_count && i < 8; i++) {
-    heap_blob_t *blob = (heap_blob_t *)(heap_data + blob_table[i].offset);
+  uint32_t listed = 0;
+  for (uint32_t i = 0; i <= blob_mask && listed < 8; i++) {
+    uint16_t blob_id = blob_table[i].blob_id;
+    heap_blob_t *blob = blob_id ? heap_get_blob(blob_id) : NULL;
+    if (!blob)
+      continue;
     console_write("  [");
     print_uint(blob->blob_id);
     console_write("] type=");
@@ -313,10 +1116,11 @@ void heap_dump_debug(void) {
     console_write(" blocks=");
     print_uint(blob_table[i].blocks);
     console_write("\n");
+    listed++;
   }
-  if (blob_count > 8) {
+  if (blob_count > listed) {
     console_write("  ... and ");
-    print_uint(blob_count - 8);
+    print_uint(blob_count - listed);
     console_write(" more\n");
   }
 
@@ -329,6 +1133,7 @@ static uint32_t dtype_size(uint8_t dtype) {
   case DTYPE_FLOAT32:
     return 4;
   case DTYPE_FLOAT16:
+  case DTYPE_BFLOAT16:
     return 2;
   case DTYPE_INT32:
     return 4;
@@ -358,17 +1163,30 @@ uint16_t heap_alloc_tensor(uint8_t dtype, uint8_t ndim, const uint32_t *shape) {
   /* Total size = tensor header + data */
   uint32_t total_size = sizeof(tensor_header_t) + data_size;
 
-  /* Allocate blob */
+  /* Allocate blob, chaining it when no free chunk is big enough */
+  void *data;
   uint16_t blob_id = heap_alloc(total_size, BLOB_TYPE_TENSOR);
-  if (blob_id == 0)
-    return 0;
+  if (blob_id != 0) {
+    heap_get_blob(blob_id)->flags |= BLOB_FLAG_CSUM_CRC32C;
+    data = heap_get_data(blob_id);
+  } else {
+    blob_id = heap_alloc_sg(total_size, BLOB_TYPE_TENSOR);
+    if (blob_id == 0)
+      return 0;
+    heap_sg_iter_t it;
+    uint32_t len = 0;
+    heap_sg_iter_init(&it, blob_id);
+    if (heap_sg_next(&it, &data, &len) != 1 || len < sizeof(tensor_header_t)) {
+      heap_free(blob_id); /* Header would straddle extents */
+      return 0;
+    }
+  }
 
   /* Initialize tensor header */
-  void *data = heap_get_data(blob_id);
   tensor_header_t *hdr = (tensor_header_t *)data;
   hdr->dtype = dtype;
   hdr->ndim = ndim;
-  hdr->reserved = 0;
+  hdr->quant = TENSOR_QUANT_NONE;
 
   /* Set shape and calculate strides (row-major) */
   uint32_t stride = elem_size;
@@ -394,13 +1212,13 @@ void *heap_get_tensor_data(uint16_t blob_id) {
 
   /* ABI Verify: Magic matches */
   if (blob->magic != BLOB_MAGIC) { 
-      console_write("[heap] Security: Invalid magic in blob header\n");
+      KLOG(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "Security: Invalid magic in blob header");
       return NULL;
   }
 
   /* ABI Verify: Bounds check */
-  if (blob->offset + blob->size > IPC_HEAP_DATA_SIZE) {
-      console_write("[heap] Security: Blob data out of bounds\n");
+  if (blob->offset + blob->size > heap_data_size) {
+      KLOG(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "Security: Blob data out of bounds");
       return NULL;
   }
   
@@ -409,14 +1227,14 @@ void *heap_get_tensor_data(uint16_t blob_id) {
     return NULL;
   
   if (blob->size < sizeof(tensor_header_t)) {
-      console_write("[heap] Security: Blob too small for tensor header\n");
+      KLOG(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "Security: Blob too small for tensor header");
       return NULL;
   }
   
   /* Verify Tensor Header */
   tensor_header_t *hdr = (tensor_header_t *)data;
   if (hdr->ndim > 4) {
-       console_write("[heap] Security: Invalid ndim\n");
+       KLOG(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "Security: Invalid ndim");
        return NULL;
   }
   
@@ -427,7 +1245,7 @@ void *heap_get_tensor_data(uint16_t blob_id) {
   expected_size += nelems * dtype_size(hdr->dtype);
   
   if (expected_size > blob->size) {
-      console_write("[heap] Security: Tensor shape exceeds blob size\n");
+      KLOG(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "Security: Tensor shape exceeds blob size");
       return NULL;
   }
 
@@ -435,6 +1253,39 @@ void *heap_get_tensor_data(uint16_t blob_id) {
   return (uint8_t *)data + sizeof(tensor_header_t);
 }
 
+const float *heap_get_tensor_quant(uint16_t blob_id, uint32_t *count) {
+  uint8_t *elems = (uint8_t *)heap_get_tensor_data(blob_id);
+  if (!elems)
+    return NULL;
+  const tensor_header_t *hdr = (const tensor_header_t *)(elems - sizeof(tensor_header_t));
+  if (hdr->ndim == 0)
+    return NULL;
+
+  uint32_t n;
+  if (hdr->quant == TENSOR_QUANT_PER_TENSOR)
+    n = 1;
+  else if (hdr->quant == TENSOR_QUANT_PER_CHANNEL)
+    n = hdr->shape[0];
+  else
+    return NULL;
+
+  uint64_t span = hdr->strides[0];
+  if (span == 0) {
+    span = dtype_size(hdr->dtype);
+    for (int i = 1; i < hdr->ndim; i++)
+      span *= hdr->shape[i];
+  }
+  span *= hdr->shape[0];
+
+  uint64_t off = sizeof(tensor_header_t) + ((span + 3) & ~(uint64_t)3);
+  if (n == 0 || off + (uint64_t)n * (sizeof(float) + sizeof(int32_t)) > heap_get_blob(blob_id)->size) {
+    KLOG(KLOG_SUBSYS_HEAP, KLOG_LVL_ERR, "Security: Tensor quant params exceed blob size");
+    return NULL;
+  }
+  *count = n;
+  return (const float *)(elems - sizeof(tensor_header_t) + off);
+}
+
 /* Helper: get physical address of a blob */
 /* Note: We need to know the physical base of the heap.
  * ivshmem_phys_base is static in drivers/ivshmem.c.
@@ -450,7 +1301,7 @@ uint32_t heap_get_blob_phys(uint16_t blob_id) {
     if (!blob) return 0;
     
     void *vaddr = (void*)(heap_data + blob->offset);
-    return vmm_virt_to_phys((uint32_t)vaddr);
+    return vmm_virt_to_phys((vaddr_t)(uintptr_t)vaddr);
 }
 
 uint32_t heap_get_blob_size(uint16_t blob_id) {
@@ -4,14 +4,20 @@
 #define _IPC_HEAP_H
 
 #include "ipc_proto.h"
+#include "../lib/sha256.h"
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* Initialize the shared heap (called from ipc_init) */
-void heap_init(void *heap_base);
+/* Initialize the shared heap (called from ipc_init)
+ * ctl_base: heap control block (header + bitmap + blob table)
+ * blob_slots: blob table entries (power of 2), from the layout descriptor
+ * data_base/data_size: blob data region, from the layout descriptor
+ */
+void heap_init(void *ctl_base, uint32_t blob_slots, void *data_base,
+               uint32_t data_size);
 
 /* Allocate a blob in the shared heap
  * size: number of bytes needed (will be rounded up to block size)
@@ -20,14 +26,78 @@ void heap_init(void *heap_base);
  */
 uint16_t heap_alloc(uint32_t size, uint8_t type);
 
-/* Free a previously allocated blob
+/* Free a previously allocated blob: heap_blob_release() of the caller's
+ * reference, so the blob only goes away once nobody else holds one
  * blob_id: ID returned from heap_alloc
  */
 void heap_free(uint16_t blob_id);
 
+/* Blob reference counts (see heap_blob_t), usable from both sides
+ * heap_blob_retain: take another reference; the caller must already hold
+ *   one (its own, or one handed over with the id). Returns 0, or -1 if the
+ *   blob is gone.
+ * heap_blob_release: drop a reference; the last one frees the blob (or
+ *   hands it back to the bridge when the bridge owns it)
+ */
+int heap_blob_retain(uint16_t blob_id);
+void heap_blob_release(uint16_t blob_id);
+
+/* Lend a blob to a reader (the bridge, a mesh peer) that takes no
+ * reference of its own: take one on its behalf. heap_compact() leaves the
+ * blob (and a chain's extents) where it is until heap_blob_unlend() gives
+ * the reference back. Returns 0, -1 if the blob is not live.
+ */
+int heap_blob_lend(uint16_t blob_id);
+void heap_blob_unlend(uint16_t blob_id);
+
+/* The caller's reference to one of our blobs goes to the bridge with a
+ * command whose handler frees the blob (ipc_send_commit() does this for
+ * those commands). heap_compact() leaves it where it is until the bridge
+ * drops that reference; a chain's extents stay put until the chain is
+ * freed. No-op for ids that are not our live blobs.
+ */
+void heap_blob_hand_over(uint16_t blob_id);
+
+/* Allocate a scatter-gather chain (BLOB_TYPE_SG, see heap_sg_t) of size
+ * payload bytes, for payloads larger than the biggest free chunk
+ * inner_type: BLOB_TYPE_* the payload is laid out as
+ * Returns: chain blob_id, 0 on failure. heap_free() of the chain frees
+ * its extents with it.
+ */
+uint16_t heap_alloc_sg(uint32_t size, uint8_t inner_type);
+
+/* Walk a chain's extents in payload order
+ * heap_sg_iter_init: 0, or -1 if blob_id is not a chain
+ * heap_sg_next: 1 with the next extent's data/len, 0 past the last one,
+ *   -1 if the chain is broken
+ */
+typedef struct {
+  uint16_t sg_id;
+  uint16_t index;
+} heap_sg_iter_t;
+
+int heap_sg_iter_init(heap_sg_iter_t *it, uint16_t blob_id);
+int heap_sg_next(heap_sg_iter_t *it, void **data, uint32_t *len);
+
+/* Create a slab pool of count preformatted blobs of one size
+ * size: data bytes per blob
+ * count: blobs in the pool (at most HEAP_POOL_DEPTH)
+ * type: BLOB_TYPE_* the blobs are formatted with
+ * Returns: pool index for heap_pool_alloc, or -1 on failure
+ */
+int heap_pool_create(uint32_t size, uint32_t count, uint8_t type);
+
+/* Draw a blob from a pool in O(1); heap_free() puts it back
+ * Data is left as the last user wrote it.
+ * Returns: blob_id, or 0 if the pool is exhausted
+ */
+uint16_t heap_pool_alloc(int pool_index);
+
 /* Get pointer to blob data (after the header)
  * blob_id: ID returned from heap_alloc
- * Returns: pointer to data region, or NULL if invalid
+ * Returns: pointer to data region, or NULL if invalid. heap_compact() may
+ * move our own blobs: set BLOB_FLAG_PINNED on any whose pointer is kept
+ * across the idle loop.
  */
 void *heap_get_data(uint16_t blob_id);
 
@@ -37,7 +107,49 @@ void *heap_get_data(uint16_t blob_id);
  */
 heap_blob_t *heap_get_blob(uint16_t blob_id);
 
-/* Get heap statistics */
+/* Blob checksums, chosen per blob by BLOB_CSUM_MASK in heap_blob_t.flags:
+ * CRC32C (SSE4.2 when the CPU has it), none, or the legacy rotate/xor.
+ * heap_blob_checksum: checksum of the blob's data in its mode (0 if invalid)
+ * heap_blob_seal: store it in the header once the data is written
+ * heap_blob_verify: 0 if the header checksum matches (always for CSUM_NONE)
+ */
+uint32_t heap_blob_checksum(uint16_t blob_id);
+void heap_blob_seal(uint16_t blob_id);
+int heap_blob_verify(uint16_t blob_id);
+
+/* SHA-256 of a blob's data (model digests for IFRs)
+ * heap_blob_finalize: mark a finished blob BLOB_FLAG_READONLY, seal it and
+ *   cache its digest. Returns 0, or -1 if the blob is gone.
+ * heap_blob_digest: *out = the digest; read-only blobs hash once per
+ *   blob_id (a reused slot gets a new id), writable ones every call.
+ *   Returns 0, or -1 if the blob is gone or empty.
+ * Main loop only: the cache is not locked.
+ */
+int heap_blob_finalize(uint16_t blob_id);
+int heap_blob_digest(uint16_t blob_id, uint8_t out[32]);
+
+/* heap_blob_finalize() in installments, for idle time: _begin marks the
+ * blob read-only and seals it, each _step hashes up to max_bytes more
+ * (0 = the rest) and the last caches the digest. A blob that moves
+ * (heap_compact) is followed; one that changes is hashed over.
+ * Returns: _begin 0 or -1 if the blob is gone; _step 1 while bytes are
+ *   left, 0 once the digest is cached, -1 if the blob is gone
+ */
+typedef struct {
+  uint16_t blob_id;             /* 0: idle */
+  uint32_t size;                /* What is being hashed ... */
+  uint32_t checksum;            /* ... as sealed */
+  uint32_t done;                /* Bytes hashed */
+  sha256_ctx_t sha;
+} heap_finalize_t;
+
+int heap_blob_finalize_begin(heap_finalize_t *f, uint16_t blob_id);
+int heap_blob_finalize_step(heap_finalize_t *f, uint32_t max_bytes);
+
+/* Get heap statistics
+ * Fragmentation fields describe the kernel arena; size classes are buddy
+ * orders (HEAP_BLOCK_SIZE << k bytes).
+ */
 typedef struct {
   uint32_t total_bytes;
   uint32_t free_bytes;
@@ -45,10 +157,23 @@ typedef struct {
   uint32_t total_blocks;
   uint32_t free_blocks;
   uint32_t blob_count;
+  uint32_t largest_free_bytes;      /* Largest chunk heap_alloc can still get */
+  uint32_t peer_largest_free_bytes; /* Same for the bridge arena */
+  uint32_t free_chunks[HEAP_BUDDY_ORDERS];    /* Free chunks per size class */
+  uint32_t alloc_failures[HEAP_BUDDY_ORDERS]; /* Failed allocations per class */
+  uint32_t compact_moves;           /* Blobs moved by heap_compact */
 } heap_stats_t;
 
 void heap_get_stats(heap_stats_t *stats);
 
+/* Incremental compaction, for the idle loop
+ * Moves up to max_moves of our blobs so free buddy chunks can merge. Blob
+ * ids are unchanged; pinned and pooled blobs stay put, and so do those the
+ * bridge holds a reference to (taken, lent or handed over).
+ * Returns: blobs moved (0 once the kernel arena is as merged as it gets)
+ */
+uint32_t heap_compact(uint32_t max_moves);
+
 /* Debug: dump heap status to console */
 void heap_dump_debug(void);
 
@@ -56,7 +181,10 @@ void heap_dump_debug(void);
  * dtype: DTYPE_* constant
  * ndim: number of dimensions (1-4)
  * shape: array of dimension sizes
- * Returns: blob_id with tensor header initialized, 0 on failure
+ * Returns: blob_id with tensor header initialized, 0 on failure. When no
+ * free chunk fits, this is a BLOB_TYPE_SG chain with the header at the
+ * start of its first extent; heap_get_tensor_data() refuses chains, walk
+ * them with heap_sg_next().
  */
 uint16_t heap_alloc_tensor(uint8_t dtype, uint8_t ndim, const uint32_t *shape);
 
@@ -66,6 +194,13 @@ uint16_t heap_alloc_tensor(uint8_t dtype, uint8_t ndim, const uint32_t *shape);
  */
 void *heap_get_tensor_data(uint16_t blob_id);
 
+/* Helper: get a quantized tensor's parameters (TENSOR_QUANT_*)
+ * Returns: its count scales, followed by count int32 zero points, or
+ * NULL if the tensor is invalid, unquantized or its parameters overrun
+ * the blob
+ */
+const float *heap_get_tensor_quant(uint16_t blob_id, uint32_t *count);
+
 /* Get physical address of a blob's data (for mapping to user space) */
 uint32_t heap_get_blob_phys(uint16_t blob_id);
 
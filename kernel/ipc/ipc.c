@@ -8,17 +8,27 @@
  */
 
 #include "ipc.h"
+#include "completion.h"
 #include "../arch/idt.h"
+#include "../arch/percpu.h"
 #include "../arch/pic.h"
 #include "../console.h"
+#include "../drivers/ivshmem.h"
 #include "../mm/pmm.h"
 #include "../mm/vmm.h"
 #include "../time/time.h"
+#include "../trace/flightrec.h"
+#include "../trace/klog.h"
+#include "../trace/lat.h"
+#include "bulk.h"
 #include "heap.h"
+#include "layout.h"
+#include "mesh_work.h"
+#include "stats_export.h"
+#include "trace_export.h"
 
 /* Shared Memory Base Address (Physical) */
 #define IPC_SHARED_MEM_PHYS 0x02000000
-#define IPC_SHARED_MEM_SIZE 0x100000 /* 1MB total */
 
 /* IRQ for IPC response notifications (using IRQ 10, vector 42) */
 #define IPC_IRQ 10
@@ -32,13 +42,95 @@ static void *ipc_shmem_base = NULL;
 static volatile ipc_ring_t *cmd_ring = NULL;
 static volatile ipc_rsp_ring_t *rsp_ring = NULL;
 static volatile doorbell_ctl_t *doorbell = NULL;
-static volatile stream_ring_t *obs_ring = NULL;
-static volatile stream_ring_t *act_ring = NULL;
-static volatile obs_entry_t *obs_entries = NULL;
-static volatile action_entry_t *act_entries = NULL;
+static volatile ipc_msg_ring_t *msg_cmd_ring = NULL;
+static volatile ipc_msg_ring_t *msg_rsp_ring = NULL;
+
+/* Multi-producer command ring (per-slot sequence numbers, see
+ * IPC_RING_FLAG_MPSC). Required once more than one CPU, or an IRQ handler,
+ * may send while the main loop does.
+ */
+#ifndef IPC_CMD_RING_MPSC
+#define IPC_CMD_RING_MPSC 1
+#endif
+
+static int cmd_mpsc = IPC_CMD_RING_MPSC;
+static volatile uint32_t *cmd_seq = NULL;
+
+/* Locally cached copies of the remote side's index (ring protocol v2).
+ * Producers refresh the consumer index only when the ring looks full;
+ * consumers refresh the producer index only when the ring looks empty.
+ */
+static uint32_t cmd_tail_cache = 0;
+static uint32_t rsp_head_cache = 0;
+static uint32_t msg_cmd_tail_cache = 0;
+static uint32_t msg_rsp_head_cache = 0;
+
+/* Tagged responses already delivered from behind untagged ones the full
+ * backlog left in the ring (rsp_deliver_ahead), by position tail + i,
+ * i < RSP_AHEAD: the tail skips them when it gets there.
+ */
+#define RSP_AHEAD 256
+static uint8_t rsp_ahead[RSP_AHEAD / 8];
+
+_Static_assert(sizeof(ipc_ring_hdr_t) == IPC_RING_HDR_SIZE,
+               "ipc_ring_hdr_t must span three cache lines");
+_Static_assert((IPC_RING_SIZE & (IPC_RING_SIZE - 1)) == 0,
+               "IPC_RING_SIZE must be a power of two");
+_Static_assert((IPC_OBS_RING_SIZE & (IPC_OBS_RING_SIZE - 1)) == 0 &&
+                   (IPC_ACT_RING_SIZE & (IPC_ACT_RING_SIZE - 1)) == 0,
+               "stream ring sizes must be powers of two");
+
+/* Doorbell coalescing (see ipc_proto.h): kick the bridge's eventfd on the
+ * empty -> non-empty edge, otherwise at most every N packets / T usec.
+ */
+#ifndef IPC_DOORBELL_BATCH
+#define IPC_DOORBELL_BATCH 32
+#endif
+#ifndef IPC_DOORBELL_MAX_US
+#define IPC_DOORBELL_MAX_US 1000
+#endif
+
+static uint32_t kick_pending = 0;
+static usec_t last_kick_usec = 0;
+static uint32_t kicks_sent = 0;
+static uint32_t kicks_coalesced = 0;
 
 /* Statistics */
 static uint32_t irq_count = 0;
+static int irq_registered = 0;
+
+/* Send time of the newest untagged request of each command class, for
+ * its round trip (tagged ones are timed by the completion table)
+ */
+static cycles_t untagged_sent[LAT_IPC_CLASSES];
+
+static void ring_hdr_init(volatile ipc_ring_hdr_t *hdr, uint32_t magic,
+                          uint32_t size, uint32_t flags) {
+  hdr->head = 0;
+  hdr->tail = 0;
+  hdr->overruns = 0;
+  hdr->max_occupancy = 0;
+  hdr->clock_seq = 0;
+  hdr->clock_ns = 0;
+  hdr->drops = 0;
+  hdr->size = size;
+  hdr->mask = size - 1;
+  hdr->flags = flags;
+  hdr->entry_size = 0;
+  hdr->obs_dim = 0;
+  hdr->version = IPC_PROTO_VERSION;
+
+  /* Magic last: the bridge treats it as "ring valid" */
+  __asm__ __volatile__("" ::: "memory");
+  hdr->magic = magic;
+}
+
+/* IVSHMEM_VEC_RSP: the bridge published responses */
+static void rsp_vector(uint32_t vector, void *arg) {
+  (void)vector;
+  (void)arg;
+  ipc_doorbell_notify();
+}
 
 void ipc_init(void *base_addr, uint8_t irq) {
   console_write("[ipc] initializing proxy driver...\n");
@@ -48,36 +140,41 @@ void ipc_init(void *base_addr, uint8_t irq) {
     return;
   }
 
-  ipc_shmem_base = base_addr;
-
-  /* Initialize pointers based on Dynamic Base */
-  /* Layout:
-   * 0x00000: Command Ring (32KB)
-   * 0x08000: Response Ring (32KB)
-   * 0x10000: Doorbell Control (64KB)
-   * 0x20000: Heap Control (4KB)
-   * 0x21000: Heap Data Block 0 ...
-   */
+  /* Size every region from the real BAR2 size (layout descriptor at 0) */
+  uint32_t shm_size = ivshmem_get_size();
+  if (shm_size == 0)
+    shm_size = IPC_SHARED_MEM_MIN;
+  if (ipc_layout_build(base_addr, shm_size) != 0) {
+    console_write("[ipc] Error: shared memory too small for IPC layout!\n");
+    return;
+  }
 
-  uint8_t *base = (uint8_t *)ipc_shmem_base;
+  ipc_shmem_base = base_addr;
+  ipc_layout_dump();
 
-  cmd_ring = (ipc_ring_t *)(base + IPC_CMD_RING_OFFSET);
-  rsp_ring = (ipc_rsp_ring_t *)(base + IPC_RSP_RING_OFFSET);
-  doorbell = (doorbell_ctl_t *)(base + IPC_DOORBELL_OFFSET);
+  cmd_ring = (ipc_ring_t *)ipc_region_ptr(IPC_REGION_CMD_RING);
+  rsp_ring = (ipc_rsp_ring_t *)ipc_region_ptr(IPC_REGION_RSP_RING);
+  doorbell = (doorbell_ctl_t *)ipc_region_ptr(IPC_REGION_DOORBELL);
+  uint32_t cmd_entries = ipc_region_entries(IPC_REGION_CMD_RING);
+  uint32_t rsp_entries = ipc_region_entries(IPC_REGION_RSP_RING);
 
   /* Initial Setup (Producer Side) */
-  cmd_ring->head = 0;
-  cmd_ring->tail = 0;
-  cmd_ring->size = IPC_RING_SIZE; // Assuming IPC_RING_SIZE is the correct macro
-                                  // for RING_SIZE
-  cmd_ring->magic =
-      IPC_MAGIC; // Assuming IPC_MAGIC is the correct macro for RING_MAGIC
+  cmd_ring->hdr.magic = 0;
+  cmd_ring->hdr.size = cmd_entries;
+  if (cmd_mpsc) {
+    cmd_seq = IPC_RING_SEQ(cmd_ring);
+    for (uint32_t i = 0; i < cmd_entries; i++)
+      cmd_seq[i] = i;
+  }
+  ring_hdr_init(&cmd_ring->hdr, IPC_MAGIC, cmd_entries,
+                cmd_mpsc ? IPC_RING_FLAG_MPSC : 0);
+  cmd_tail_cache = 0;
 
   /* Initialize Response Ring Header */
-  rsp_ring->magic = IPC_RSP_MAGIC;
-  rsp_ring->head = 0;
-  rsp_ring->tail = 0;
-  rsp_ring->size = IPC_RING_SIZE;
+  ring_hdr_init(&rsp_ring->hdr, IPC_RSP_MAGIC, rsp_entries, 0);
+  rsp_head_cache = 0;
+  for (uint32_t i = 0; i < sizeof(rsp_ahead); i++)
+    rsp_ahead[i] = 0;
 
   console_write("[ipc] cmd ring at ");
   print_hex32((uint32_t)cmd_ring);
@@ -93,7 +190,8 @@ void ipc_init(void *base_addr, uint8_t irq) {
 
   /* Initialize Doorbell Control Block */
   doorbell->magic = IPC_DOORBELL_MAGIC;
-  doorbell->version = 1;
+  doorbell->version = IPC_PROTO_VERSION;
+  doorbell->peer_version = 0;
   doorbell->cmd_doorbell = 0;
   doorbell->cmd_flags = 0;
   doorbell->cmd_irq_count = 0;
@@ -102,6 +200,9 @@ void ipc_init(void *base_addr, uint8_t irq) {
   doorbell->rsp_irq_count = 0;
   doorbell->cmd_writes = 0;
   doorbell->rsp_writes = 0;
+  doorbell->bridge_peer_id = 0;
+  doorbell->zen_peer_id =
+      ivshmem_has_doorbell() ? ivshmem_get_peer_id() + 1 : 0;
 
   /* Print actual locations */
   console_write("[ipc] cmd ring at ");
@@ -113,11 +214,26 @@ void ipc_init(void *base_addr, uint8_t irq) {
   console_write("\n");
 
   /* Initialize Heap */
-  heap_init((void *)(base + IPC_HEAP_CTL_OFFSET));
+  heap_init(ipc_region_ptr(IPC_REGION_HEAP_CTL),
+            ipc_region_entries(IPC_REGION_HEAP_CTL),
+            ipc_region_ptr(IPC_REGION_HEAP_DATA),
+            ipc_region_size(IPC_REGION_HEAP_DATA));
 
   /* Initialize Streaming Rings */
   ipc_stream_init();
 
+  /* Initialize Message Rings */
+  ipc_msg_init();
+
+  /* Initialize the Bulk Upload Ring */
+  ipc_bulk_init();
+
+  /* Initialize the Trace Export Ring */
+  ipc_trace_init();
+
+  /* Initialize the Statistics Page */
+  ipc_stats_init();
+
   /* Register Interrupt Handler */
   /* IRQ is the ISA IRQ number (e.g. 11) */
   /* IDT vector = IRQ_BASE (32) + irq */
@@ -128,78 +244,32 @@ void ipc_init(void *base_addr, uint8_t irq) {
 
     irq_register_handler(irq, ipc_irq_handler);
     pic_unmask_irq(irq);
+    irq_registered = 1;
+  } else if (irq >= 32 && ivshmem_has_doorbell()) {
+    /* MSI(-X): the ivshmem driver owns the vector and calls us back */
+    console_write("[ipc] response doorbell via ivshmem vector ");
+    print_uint(IVSHMEM_VEC_RSP);
+    console_write(ivshmem_num_vectors() > 1 ? " (MSI-X)\n" : " (MSI)\n");
+    /* Delivered where the response ring is drained: this CPU */
+    ivshmem_set_vector_handler(IVSHMEM_VEC_RSP, rsp_vector, NULL, smp_cpu_id());
+    irq_registered = 1;
   } else {
     console_write("[ipc] Warning: Invalid IRQ, polling mode only.\n");
   }
 }
 
-void ipc_stream_init(void) {
-  if (!ipc_shmem_base)
-    return;
-
-  uint8_t *base = (uint8_t *)ipc_shmem_base;
-  obs_ring = (stream_ring_t *)(base + IPC_OBS_RING_OFFSET);
-  act_ring = (stream_ring_t *)(base + IPC_ACT_RING_OFFSET);
-  obs_entries = (obs_entry_t *)((uint8_t *)obs_ring + sizeof(stream_ring_t));
-  act_entries = (action_entry_t *)((uint8_t *)act_ring + sizeof(stream_ring_t));
-
-  if (obs_ring->magic != IPC_STREAM_MAGIC) {
-    obs_ring->magic = IPC_STREAM_MAGIC;
-    obs_ring->head = 0;
-    obs_ring->tail = 0;
-    obs_ring->size = IPC_OBS_RING_SIZE;
-  }
-
-  if (act_ring->magic != IPC_STREAM_MAGIC) {
-    act_ring->magic = IPC_STREAM_MAGIC;
-    act_ring->head = 0;
-    act_ring->tail = 0;
-    act_ring->size = IPC_ACT_RING_SIZE;
-  }
-}
-
-int ipc_stream_ready(void) {
-  return obs_ring && act_ring &&
-         obs_ring->magic == IPC_STREAM_MAGIC &&
-         act_ring->magic == IPC_STREAM_MAGIC;
-}
-
-int ipc_stream_action_push(uint32_t seq, uint16_t action, uint32_t ack_seq) {
-  if (!act_ring || !act_entries || act_ring->magic != IPC_STREAM_MAGIC)
-    return -1;
-
-  uint32_t head = act_ring->head;
-  uint32_t next = (head + 1) % act_ring->size;
-  if (next == act_ring->tail)
-    return -1;
-
-  act_entries[head].seq = seq;
-  act_entries[head].action = action;
-  act_entries[head].flags = 0;
-  act_entries[head].ack_seq = ack_seq;
-  act_entries[head].reserved = 0;
-
-  __asm__ __volatile__("" ::: "memory");
-  act_ring->head = next;
-  return 0;
-}
-
-int ipc_stream_obs_pop(obs_entry_t *out) {
-  if (!obs_ring || !obs_entries || obs_ring->magic != IPC_STREAM_MAGIC || !out)
-    return 0;
-
-  uint32_t tail = obs_ring->tail;
-  if (tail == obs_ring->head)
-    return 0;
-
-  *out = obs_entries[tail];
-  __asm__ __volatile__("" ::: "memory");
-  obs_ring->tail = (tail + 1) % obs_ring->size;
-  return 1;
+/* Interrupt the bridge through the ivshmem BAR0 doorbell (-> its eventfd) */
+static void kick_bridge(uint32_t peer, usec_t now) {
+  flightrec_log(TRACE_EVT_IPC_DOORBELL, 0, 0, kick_pending);
+  ivshmem_ring_doorbell(peer - 1, 0);
+  __atomic_fetch_add(&doorbell->cmd_irq_count, 1, __ATOMIC_RELAXED);
+  kicks_sent++;
+  kick_pending = 0;
+  last_kick_usec = now;
 }
 
-/* Ring the command doorbell to notify Linux */
-static void ring_cmd_doorbell(uint32_t head) {
+/* Ring the command doorbell to notify Linux; count = packets published */
+static void ring_cmd_doorbell(uint32_t head, uint32_t count) {
   if (!doorbell)
     return;
 
@@ -208,13 +278,34 @@ static void ring_cmd_doorbell(uint32_t head) {
 
   /* Write doorbell (signals Linux: "process up to this head") */
   doorbell->cmd_doorbell = head;
-  doorbell->cmd_writes++;
+  __atomic_fetch_add(&doorbell->cmd_writes, 1, __ATOMIC_RELAXED);
+
+  uint32_t peer = doorbell->bridge_peer_id;
+  if (!peer || !ivshmem_has_doorbell())
+    return; /* Bridge polls the doorbell word */
 
-  /* Set pending flag if IRQ enabled on Linux side */
-  if (doorbell->cmd_flags & DOORBELL_FLAG_IRQ_ENABLED) {
-    doorbell->cmd_flags |= DOORBELL_FLAG_PENDING;
-    doorbell->cmd_irq_count++;
+  /* Bridge armed the flag because it saw the ring empty: this send is the
+   * empty -> non-empty edge. Clearing it first means exactly one producer
+   * kicks for the edge.
+   */
+  uint32_t prev = __atomic_fetch_and(&doorbell->cmd_flags,
+                                     ~DOORBELL_FLAG_IRQ_ENABLED,
+                                     __ATOMIC_SEQ_CST);
+  usec_t now = time_usec();
+  if (prev & DOORBELL_FLAG_IRQ_ENABLED) {
+    __atomic_fetch_or(&doorbell->cmd_flags, DOORBELL_FLAG_PENDING,
+                      __ATOMIC_RELAXED);
+    kick_bridge(peer, now);
+    return;
   }
+
+  /* Bridge is busy draining: backstop kick every N packets / T usec */
+  kick_pending += count;
+  if (kick_pending >= IPC_DOORBELL_BATCH ||
+      now - last_kick_usec >= IPC_DOORBELL_MAX_US)
+    kick_bridge(peer, now);
+  else
+    kicks_coalesced++;
 }
 
 /* =============================================================================
@@ -225,52 +316,214 @@ static void ring_cmd_doorbell(uint32_t head) {
 /* Mesh state */
 static volatile mesh_table_t *mesh_table = NULL;
 static int local_node_id = -1;
+static uint32_t local_epoch;            /* Our slot's epoch when we claimed it */
+static usec_t last_beat_us;
+static usec_t mesh_suspect_us = MESH_SUSPECT_US;
+
+/* Failure detector, our view of each peer. Clocks differ between nodes,
+ * so a peer's heartbeat is only compared with its own last value: it is
+ * suspected once it has not moved for mesh_suspect_us of our time
+ */
+static uint64_t peer_beat[MES_MAX_NODES];
+static usec_t peer_beat_at[MES_MAX_NODES];
+static uint32_t peer_epoch[MES_MAX_NODES];
+static uint8_t peer_down[MES_MAX_NODES];
+static uint32_t mesh_evictions;
+
+/* Set up the table unless a peer has (or is doing it): the winner of the
+ * cmpxchg on magic initializes, the others wait for MESH_MAGIC
+ */
+static int mesh_table_setup(void) {
+    uint32_t magic = mesh_table->magic;
+    if (magic == MESH_MAGIC && mesh_table->version == MESH_VERSION)
+        return 0;
+
+    if (magic == MESH_INIT_MAGIC ||
+        !__sync_bool_compare_and_swap(&mesh_table->magic, magic, MESH_INIT_MAGIC)) {
+        usec_t t0 = time_usec();
+        while (mesh_table->magic != MESH_MAGIC) {
+            if (time_usec() - t0 > MESH_SUSPECT_US * 4) {
+                /* The initializer died halfway: take over */
+                mesh_table->magic = 0;
+                return mesh_table_setup();
+            }
+            __asm__ __volatile__("pause");
+        }
+        return 0;
+    }
+
+    mesh_table->version = MESH_VERSION;
+    mesh_table->active_nodes = 0;
+    for (int i = 0; i < MES_MAX_NODES; i++) {
+        mesh_table->nodes[i].status = NODE_STATUS_OFFLINE;
+        mesh_table->nodes[i].epoch = 0;
+        mesh_table->gang[i].gen = 0;
+        mesh_table->gang[i].key = 0;
+        mesh_table->gang[i].released = 0;
+        mesh_table->gang[i].wait_us = 0;
+    }
+    __asm__ __volatile__("" ::: "memory");
+    mesh_table->magic = MESH_MAGIC;
+    console_write("[ipc] initialized mesh table\n");
+    return 0;
+}
+
+/* Claim the first free slot with cmpxchg; each claim starts a new epoch */
+static int mesh_join(void) {
+    for (int i = 0; i < MES_MAX_NODES; i++) {
+        volatile mesh_node_t *n = &mesh_table->nodes[i];
+        if (n->status != NODE_STATUS_OFFLINE ||
+            !__sync_bool_compare_and_swap(&n->status, NODE_STATUS_OFFLINE, NODE_STATUS_ALIVE))
+            continue;
+
+        local_epoch = __atomic_add_fetch(&n->epoch, 1, __ATOMIC_SEQ_CST);
+        n->node_id = i;
+        n->cpu_load = 0;
+        n->heartbeat = rdtsc();
+        __atomic_fetch_add(&mesh_table->active_nodes, 1, __ATOMIC_SEQ_CST);
+        last_beat_us = time_usec();
+        for (int j = 0; j < MES_MAX_NODES; j++) {
+            peer_epoch[j] = 0;
+            peer_down[j] = 0;
+        }
+        local_node_id = i;
+
+        console_write("[ipc] joined mesh as Node ");
+        print_uint(local_node_id);
+        console_write(" (epoch ");
+        print_uint(local_epoch);
+        console_write(")\n");
+        mesh_work_init();
+        return 0;
+    }
+    return -1;
+}
 
 void ipc_mesh_init(void) {
     if (!ipc_shmem_base) return;
     
-    mesh_table = (mesh_table_t*)((uint8_t*)ipc_shmem_base + IPC_MESH_OFFSET);
+    mesh_table = (mesh_table_t*)ipc_region_ptr(IPC_REGION_MESH);
+    if (!mesh_table) return;
     
-    /* Initialize table if magic is missing (Race condition? First wins) */
-    if (mesh_table->magic != MESH_MAGIC) {
-        mesh_table->magic = MESH_MAGIC;
-        mesh_table->version = 1;
-        mesh_table->active_nodes = 0;
-        for(int i=0; i<MES_MAX_NODES; i++) {
-            mesh_table->nodes[i].status = NODE_STATUS_OFFLINE;
+    mesh_table_setup();
+    if (mesh_join() != 0)
+        console_write("[ipc] WARNING: mesh full, retrying as slots are evicted\n");
+}
+
+volatile mesh_table_t *ipc_mesh_table(void) {
+    return local_node_id < 0 ? NULL : mesh_table;
+}
+
+int ipc_mesh_local_id(void) {
+    return local_node_id;
+}
+
+int ipc_mesh_node_up(uint32_t node) {
+    return mesh_table && local_node_id >= 0 && node < MES_MAX_NODES &&
+           mesh_table->nodes[node].status != NODE_STATUS_OFFLINE && !peer_down[node];
+}
+
+usec_t ipc_mesh_node_age_us(uint32_t node) {
+    if ((int)node == local_node_id || !ipc_mesh_node_up(node))
+        return 0;
+    usec_t now = time_usec();
+    return now > peer_beat_at[node] ? now - peer_beat_at[node] : 0;
+}
+
+uint32_t ipc_mesh_node_epoch(uint32_t node) {
+    return mesh_table && node < MES_MAX_NODES ? mesh_table->nodes[node].epoch : 0;
+}
+
+void ipc_mesh_set_suspect_us(usec_t us) {
+    mesh_suspect_us = us ? us : MESH_SUSPECT_US;
+}
+
+/* Evict a peer whose heartbeat stopped: bumping its epoch with cmpxchg
+ * lets exactly one observer free the slot, and tells the peer, should it
+ * come back, that it has to rejoin
+ */
+static void mesh_evict(uint32_t node, uint32_t epoch, usec_t silent) {
+    volatile mesh_node_t *n = &mesh_table->nodes[node];
+    peer_down[node] = 1;
+    if (__sync_bool_compare_and_swap(&n->epoch, epoch, epoch + 1)) {
+        n->status = NODE_STATUS_OFFLINE;
+        __atomic_fetch_sub(&mesh_table->active_nodes, 1, __ATOMIC_SEQ_CST);
+        mesh_evictions++;
+    }
+    KLOG2(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "mesh node %u silent for %uus, evicted",
+          node, (uint32_t)silent);
+    mesh_work_peer_down(node);
+}
+
+static void mesh_detect(usec_t now) {
+    for (uint32_t i = 0; i < MES_MAX_NODES; i++) {
+        if ((int)i == local_node_id)
+            continue;
+        volatile mesh_node_t *n = &mesh_table->nodes[i];
+        uint32_t epoch = n->epoch;
+        if (n->status == NODE_STATUS_OFFLINE) {
+            if (!peer_down[i] && peer_epoch[i])
+                mesh_work_peer_down(i);
+            peer_down[i] = 1;
+            peer_epoch[i] = epoch;
+            continue;
         }
-        console_write("[ipc] initialized mesh table\n");
+
+        uint64_t beat = n->heartbeat;
+        if (epoch != peer_epoch[i]) {
+            /* New incarnation: whatever we had in flight with the old one is gone */
+            if (peer_epoch[i] && !peer_down[i])
+                mesh_work_peer_down(i);
+            peer_epoch[i] = epoch;
+            peer_beat[i] = beat;
+            peer_beat_at[i] = now;
+            peer_down[i] = 0;
+            continue;
+        }
+        if (beat != peer_beat[i]) {
+            peer_beat[i] = beat;
+            peer_beat_at[i] = now;
+            continue;
+        }
+        if (!peer_down[i] && now - peer_beat_at[i] > mesh_suspect_us)
+            mesh_evict(i, epoch, now - peer_beat_at[i]);
     }
-    
-    /* Register Local Node */
-    for(int i=0; i<MES_MAX_NODES; i++) {
-         if (mesh_table->nodes[i].status == NODE_STATUS_OFFLINE) {
-             /* Claim it */
-             mesh_table->nodes[i].status = NODE_STATUS_ALIVE;
-             mesh_table->nodes[i].node_id = i;
-             mesh_table->nodes[i].cpu_load = 0;
-             mesh_table->nodes[i].heartbeat = 0;
-             
-             local_node_id = i;
-             mesh_table->active_nodes++; // Not atomic but okay for demo
-             
-             console_write("[ipc] joined mesh as Node ");
-             print_uint(local_node_id);
-             console_write("\n");
-             break;
-         }
+}
+
+void ipc_mesh_update(void) {
+    if (!mesh_table || mesh_table->magic != MESH_MAGIC) return;
+    usec_t now = time_usec();
+
+    if (local_node_id < 0) {
+        /* Full, or evicted: watch for a free slot (stale ones get evicted) */
+        mesh_detect(now);
+        mesh_join();
+        return;
     }
-    
-    if (local_node_id == -1) {
-        console_write("[ipc] WARNING: mesh full, could not join\n");
+
+    volatile mesh_node_t *me = &mesh_table->nodes[local_node_id];
+    if (me->epoch != local_epoch || me->status == NODE_STATUS_OFFLINE) {
+        /* We were declared dead (stalled past the suspicion timeout): the
+         * slot is no longer ours to write
+         */
+        console_write("[ipc] evicted from mesh slot ");
+        print_uint(local_node_id);
+        console_write(", rejoining\n");
+        local_node_id = -1;
+        mesh_work_init();
+        mesh_join();
+        return;
+    }
+
+    if (now - last_beat_us >= MESH_HEARTBEAT_US) {
+        me->heartbeat = rdtsc();
+        last_beat_us = now;
     }
+    mesh_detect(now);
 }
 
-void ipc_mesh_update(void) {
-    if (local_node_id < 0 || !mesh_table) return;
-    
-    /* Update heartbeat */
-    mesh_table->nodes[local_node_id].heartbeat++; 
+usec_t ipc_mesh_next_deadline(void) {
+    return mesh_table && mesh_table->magic == MESH_MAGIC ? last_beat_us + MESH_HEARTBEAT_US : 0;
 }
 
 void ipc_mesh_dump(void) {
@@ -286,7 +539,12 @@ void ipc_mesh_dump(void) {
             print_uint(i);
             console_write(": ");
             if (i == local_node_id) console_write("(ME) ");
-            console_write(mesh_table->nodes[i].status == NODE_STATUS_ALIVE ? "ALIVE" : "BUSY");
+            if (i != local_node_id && peer_down[i])
+                console_write("SUSPECT");
+            else
+                console_write(mesh_table->nodes[i].status == NODE_STATUS_ALIVE ? "ALIVE" : "BUSY");
+            console_write(" Epoch=");
+            print_uint(mesh_table->nodes[i].epoch);
             console_write(" Load=");
             print_uint(mesh_table->nodes[i].cpu_load);
             console_write(" Heartbeat=");
@@ -294,7 +552,23 @@ void ipc_mesh_dump(void) {
             console_write("\n");
         }
     }
-    console_write("===================\n");
+    console_write("Evictions: ");
+    print_uint(mesh_evictions);
+    console_write("\n===================\n");
+}
+
+/* Free slots in the command ring. Reads the bridge's tail only when the
+ * cached copy says the ring is full.
+ */
+static uint32_t cmd_ring_free(void) {
+  uint32_t head = cmd_ring->hdr.head;
+  uint32_t used = head - cmd_tail_cache;
+
+  if (used >= cmd_ring->hdr.size) {
+    cmd_tail_cache = cmd_ring->hdr.tail;
+    used = head - cmd_tail_cache;
+  }
+  return cmd_ring->hdr.size - used;
 }
 
 int ipc_send(uint16_t cmd, uint32_t payload) {
@@ -302,85 +576,681 @@ int ipc_send(uint16_t cmd, uint32_t payload) {
 }
 
 int ipc_send_flags(uint16_t cmd, uint32_t payload, uint16_t flags) {
-  if (!cmd_ring)
-    return -1;
+  return ipc_send_tagged(cmd, payload, flags, IPC_TAG_NONE);
+}
 
-  uint32_t head = cmd_ring->head;
-  uint32_t next_head = (head + 1) % cmd_ring->size;
+int ipc_send_tagged(uint16_t cmd, uint32_t payload, uint16_t flags,
+                    uint32_t tag) {
+  ipc_batch_t batch;
 
-  if (next_head == cmd_ring->tail) {
-    console_write("[ipc] cmd ring full!\n");
+  if (ipc_send_reserve(&batch, 1) != 0)
     return -1; /* Full */
-  }
 
   /* Write Packet */
-  volatile ipc_packet_t *pkt = &cmd_ring->data[head];
+  volatile ipc_packet_t *pkt = ipc_batch_slot(&batch, 0);
   pkt->cmd = cmd;
   pkt->flags = flags;
   pkt->payload_id = payload;
   pkt->timestamp = time_usec();
+  pkt->tag = tag;
+  pkt->reserved = 0;
+  if (tag == IPC_TAG_NONE)
+    untagged_sent[lat_ipc_class(cmd)] = rdtsc();
+
+  /* Publish and ring doorbell to notify Linux */
+  ipc_send_commit(&batch);
+  return 0;
+}
+
+/* MPSC: claim n consecutive slots by CAS on head (Vyukov bounded queue).
+ * The consumer frees slots in order, so if the last slot of the claim is
+ * free for this lap, so are all the ones before it.
+ */
+static int cmd_mpsc_claim(uint32_t n, uint32_t *first) {
+  uint32_t mask = cmd_ring->hdr.mask;
+  uint32_t pos = __atomic_load_n(&cmd_ring->hdr.head, __ATOMIC_RELAXED);
+
+  if (n > cmd_ring->hdr.size)
+    return -1;
 
-  /* Compiler barrier before publishing */
+  for (;;) {
+    uint32_t last = pos + n - 1;
+    uint32_t seq = __atomic_load_n(&cmd_seq[last & mask], __ATOMIC_ACQUIRE);
+    int32_t dif = (int32_t)(seq - last);
+
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&cmd_ring->hdr.head, &pos, pos + n, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *first = pos;
+        return 0;
+      }
+      /* CAS failure reloaded pos */
+    } else if (dif < 0) {
+      return -1; /* Consumer has not released the slot yet: full */
+    } else {
+      pos = __atomic_load_n(&cmd_ring->hdr.head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+int ipc_send_reserve(ipc_batch_t *batch, uint32_t n) {
+  if (!cmd_ring || !batch || n == 0)
+    return -1;
+
+  if (cmd_mpsc) {
+    if (cmd_mpsc_claim(n, &batch->first) != 0) {
+      KLOG(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "cmd ring full!");
+      return -1;
+    }
+    batch->count = n;
+    return 0;
+  }
+
+  if (n > cmd_ring_free()) {
+    /* May only look full for a burst: refresh once before failing */
+    cmd_tail_cache = cmd_ring->hdr.tail;
+  }
+  if (n > cmd_ring_free()) {
+    KLOG(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "cmd ring full!");
+    return -1;
+  }
+
+  batch->first = cmd_ring->hdr.head;
+  batch->count = n;
+  return 0;
+}
+
+volatile ipc_packet_t *ipc_batch_slot(const ipc_batch_t *batch, uint32_t i) {
+  if (!cmd_ring || !batch || i >= batch->count)
+    return NULL;
+  return &cmd_ring->data[(batch->first + i) & cmd_ring->hdr.mask];
+}
+
+/* Commands whose payload_id is a blob of ours the bridge's handler frees */
+static int cmd_hands_blob(uint16_t cmd) {
+  switch (cmd) {
+  case CMD_PROF_SAMPLES:
+  case CMD_BOOT_PROFILE:
+  case CMD_BENCH_RESULTS:
+  case CMD_WASM_PROFILE:
+  case CMD_IFR_PERSIST:
+  case CMD_RUN_MODEL_BATCH:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+void ipc_send_commit(const ipc_batch_t *batch) {
+  if (!cmd_ring || !batch || batch->count == 0)
+    return;
+
+  uint32_t next_head = batch->first + batch->count;
+  for (uint32_t i = 0; i < batch->count; i++) {
+    volatile ipc_packet_t *pkt = &cmd_ring->data[(batch->first + i) & cmd_ring->hdr.mask];
+    flightrec_log(TRACE_EVT_IPC_SEND, 0, pkt->tag, pkt->cmd);
+    if (cmd_hands_blob(pkt->cmd))
+      heap_blob_hand_over((uint16_t)pkt->payload_id);
+  }
+
+  if (cmd_mpsc) {
+    /* Head was advanced at claim time; publish each slot in order */
+    for (uint32_t i = 0; i < batch->count; i++) {
+      uint32_t pos = batch->first + i;
+      __atomic_store_n(&cmd_seq[pos & cmd_ring->hdr.mask], pos + 1,
+                       __ATOMIC_RELEASE);
+    }
+    ring_cmd_doorbell(next_head, batch->count);
+    return;
+  }
+
+  /* Compiler barrier: all slots written before the head moves */
   __asm__ __volatile__("" ::: "memory");
 
-  cmd_ring->head = next_head;
+  cmd_ring->hdr.head = next_head;
+
+  /* One doorbell for the whole burst */
+  ring_cmd_doorbell(next_head, batch->count);
+}
 
-  /* Ring doorbell to notify Linux */
-  ring_cmd_doorbell(next_head);
+int ipc_send_batch(const ipc_packet_t *pkts, uint32_t n) {
+  ipc_batch_t batch;
+
+  if (!pkts || ipc_send_reserve(&batch, n) != 0)
+    return -1;
 
+  uint64_t now = time_usec();
+  for (uint32_t i = 0; i < n; i++) {
+    volatile ipc_packet_t *pkt = ipc_batch_slot(&batch, i);
+    pkt->cmd = pkts[i].cmd;
+    pkt->flags = pkts[i].flags;
+    pkt->payload_id = pkts[i].payload_id;
+    pkt->timestamp = now;
+    pkt->tag = pkts[i].tag;
+    pkt->reserved = 0;
+  }
+
+  ipc_send_commit(&batch);
   return 0;
 }
 
-int ipc_has_response(void) {
-  if (!rsp_ring || rsp_ring->magic != IPC_RSP_MAGIC)
+/* =============================================================================
+ * VARIABLE-LENGTH MESSAGE RINGS
+ * =============================================================================
+ * Single producer per ring: ZENEDGE sends from the main loop only (not from
+ * IRQ context) and is the only reader of the response side.
+ */
+
+_Static_assert((IPC_MSG_DATA_BYTES & (IPC_MSG_DATA_BYTES - 1)) == 0,
+               "IPC_MSG_DATA_BYTES must be a power of two");
+_Static_assert(sizeof(ipc_msg_hdr_t) == IPC_MSG_ALIGN,
+               "ipc_msg_hdr_t must be one alignment unit");
+
+void ipc_msg_init(void) {
+  if (!ipc_shmem_base)
+    return;
+
+  msg_cmd_ring = (ipc_msg_ring_t *)ipc_region_ptr(IPC_REGION_MSG_CMD);
+  msg_rsp_ring = (ipc_msg_ring_t *)ipc_region_ptr(IPC_REGION_MSG_RSP);
+  if (!msg_cmd_ring || !msg_rsp_ring)
+    return;
+
+  ring_hdr_init(&msg_cmd_ring->hdr, IPC_MSG_MAGIC,
+                ipc_region_entries(IPC_REGION_MSG_CMD), 0);
+  ring_hdr_init(&msg_rsp_ring->hdr, IPC_MSG_MAGIC,
+                ipc_region_entries(IPC_REGION_MSG_RSP), 0);
+  msg_cmd_tail_cache = 0;
+  msg_rsp_head_cache = 0;
+}
+
+int ipc_msg_send(uint16_t cmd, uint32_t arg, const void *data, uint16_t len,
+                 uint32_t tag) {
+  if (!msg_cmd_ring || len > IPC_MSG_MAX_INLINE || (len && !data))
+    return -1;
+
+  volatile ipc_msg_ring_t *r = msg_cmd_ring;
+  uint32_t size = r->hdr.size;
+  uint32_t head = r->hdr.head;
+  uint32_t off = head & r->hdr.mask;
+  uint32_t need = IPC_MSG_RECORD_SIZE(len);
+  uint32_t skip = (size - off < need) ? size - off : 0;
+
+  if (head + skip + need - msg_cmd_tail_cache > size) {
+    msg_cmd_tail_cache = r->hdr.tail;
+    if (head + skip + need - msg_cmd_tail_cache > size) {
+      KLOG(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "msg ring full!");
+      return -1;
+    }
+  }
+
+  if (skip) {
+    volatile ipc_msg_hdr_t *wrap = (volatile ipc_msg_hdr_t *)&r->data[off];
+    wrap->kind = IPC_MSG_KIND_WRAP;
+    wrap->len = 0;
+    head += skip;
+    off = 0;
+  }
+
+  volatile ipc_msg_hdr_t *m = (volatile ipc_msg_hdr_t *)&r->data[off];
+  m->kind = IPC_MSG_KIND_DATA;
+  m->len = len;
+  m->cmd = cmd;
+  m->status = 0;
+  m->arg = arg;
+  m->tag = tag;
+
+  volatile uint8_t *dst = (volatile uint8_t *)(m + 1);
+  const uint8_t *src = (const uint8_t *)data;
+  for (uint16_t i = 0; i < len; i++)
+    dst[i] = src[i];
+
+  flightrec_log(TRACE_EVT_IPC_SEND, 0, tag, cmd);
+
+  /* Record (and any wrap marker) visible before the head moves */
+  __asm__ __volatile__("" ::: "memory");
+  r->hdr.head = head + need;
+
+  ring_cmd_doorbell(cmd_ring ? cmd_ring->hdr.head : 0, 1);
+  return 0;
+}
+
+/* Next data record on the response message ring, skipping wrap markers.
+ * Returns NULL if empty. *tail_out is the record's ring offset.
+ */
+static volatile ipc_msg_hdr_t *msg_rsp_peek(uint32_t *tail_out) {
+  volatile ipc_msg_ring_t *r = msg_rsp_ring;
+  if (!r || r->hdr.magic != IPC_MSG_MAGIC)
+    return NULL;
+
+  uint32_t tail = r->hdr.tail;
+  for (;;) {
+    if (tail == msg_rsp_head_cache) {
+      msg_rsp_head_cache = r->hdr.head;
+      if (tail == msg_rsp_head_cache)
+        return NULL;
+    }
+    __asm__ __volatile__("" ::: "memory");
+
+    uint32_t off = tail & r->hdr.mask;
+    volatile ipc_msg_hdr_t *m = (volatile ipc_msg_hdr_t *)&r->data[off];
+    if (m->kind != IPC_MSG_KIND_WRAP) {
+      *tail_out = tail;
+      return m;
+    }
+    tail += r->hdr.size - off;
+    r->hdr.tail = tail;
+  }
+}
+
+static void msg_rsp_consume(uint32_t tail, const volatile ipc_msg_hdr_t *m) {
+  flightrec_log(TRACE_EVT_IPC_RESPONSE, 0, m->tag, (uint32_t)m->status << 16 | m->cmd);
+  __asm__ __volatile__("" ::: "memory");
+  msg_rsp_ring->hdr.tail = tail + IPC_MSG_RECORD_SIZE(m->len);
+}
+
+/* Tagged message responses complete like fixed-ring ones (status/result) */
+static int msg_rsp_deliver(const volatile ipc_msg_hdr_t *m) {
+  if (m->tag == IPC_TAG_NONE)
     return 0;
-  return rsp_ring->head != rsp_ring->tail;
+
+  ipc_response_t rsp;
+  rsp.status = m->status;
+  rsp.orig_cmd = m->cmd;
+  rsp.result = m->arg;
+  rsp.timestamp = 0;
+  rsp.tag = m->tag;
+  rsp.reserved = 0;
+  return ipc_completion_deliver(&rsp);
 }
 
-int ipc_poll_response(ipc_response_t *rsp) {
-  if (!rsp_ring || rsp_ring->magic != IPC_RSP_MAGIC)
+int ipc_msg_recv(ipc_msg_hdr_t *hdr, void *buf, uint16_t cap) {
+  uint32_t tail;
+  volatile ipc_msg_hdr_t *m;
+
+  while ((m = msg_rsp_peek(&tail)) != NULL) {
+    if (msg_rsp_deliver(m)) {
+      msg_rsp_consume(tail, m);
+      continue;
+    }
+
+    if (hdr) {
+      hdr->kind = m->kind;
+      hdr->len = m->len;
+      hdr->cmd = m->cmd;
+      hdr->status = m->status;
+      hdr->arg = m->arg;
+      hdr->tag = m->tag;
+    }
+    uint16_t n = m->len < cap ? m->len : cap;
+    volatile uint8_t *src = (volatile uint8_t *)(m + 1);
+    uint8_t *dst = (uint8_t *)buf;
+    for (uint16_t i = 0; buf && i < n; i++)
+      dst[i] = src[i];
+
+    msg_rsp_consume(tail, m);
+    return 1;
+  }
+  return 0;
+}
+
+uint32_t ipc_msg_process(void) {
+  uint32_t n = 0;
+  uint32_t tail;
+  volatile ipc_msg_hdr_t *m;
+
+  /* Stop at the first untagged record: it belongs to ipc_msg_recv() */
+  while ((m = msg_rsp_peek(&tail)) != NULL && msg_rsp_deliver(m)) {
+    msg_rsp_consume(tail, m);
+    n++;
+  }
+  return n;
+}
+
+/* =============================================================================
+ * TELEMETRY PAGE (seqlock reader)
+ * =============================================================================
+ */
+
+#define TELEMETRY_READ_RETRIES 16
+
+_Static_assert(sizeof(ipc_telemetry_page_t) == 64,
+               "ipc_telemetry_page_t must be one cache line");
+
+int ipc_telemetry_read(telemetry_snapshot_t *out) {
+  volatile ipc_telemetry_page_t *page =
+      (volatile ipc_telemetry_page_t *)ipc_region_ptr(IPC_REGION_TELEMETRY);
+  if (!page || !out || page->magic != IPC_TELEMETRY_MAGIC)
+    return -1;
+
+  for (int i = 0; i < TELEMETRY_READ_RETRIES; i++) {
+    uint32_t seq = page->seq;
+    if (seq & 1) {
+      __asm__ __volatile__("pause");
+      continue;
+    }
+    __asm__ __volatile__("" ::: "memory");
+
+    out->ts_usec = page->snap.ts_usec;
+    out->gpu_temp_c = page->snap.gpu_temp_c;
+    out->rdma_qp_depth = page->snap.rdma_qp_depth;
+    out->numa_locality = page->snap.numa_locality;
+
+    __asm__ __volatile__("" ::: "memory");
+    if (page->seq == seq)
+      return 0;
+  }
+  return -1; /* Writer kept the page busy; caller keeps its last sample */
+}
+
+/* Untagged responses set aside by ipc_process_responses() until someone
+ * calls ipc_poll_response(). Tagged ones go straight to the completion table.
+ */
+#define RSP_BACKLOG_SIZE 16
+static ipc_response_t rsp_backlog[RSP_BACKLOG_SIZE];
+static uint32_t rsp_backlog_head = 0;
+static uint32_t rsp_backlog_tail = 0;
+
+static int rsp_ring_pending(void) {
+  if (!rsp_ring || rsp_ring->hdr.magic != IPC_RSP_MAGIC)
+    return 0;
+  if (rsp_ring->hdr.tail != rsp_head_cache)
+    return 1;
+  rsp_head_cache = rsp_ring->hdr.head;
+  return rsp_ring->hdr.tail != rsp_head_cache;
+}
+
+int ipc_has_response(void) {
+  if (rsp_backlog_head != rsp_backlog_tail)
+    return 1;
+  return rsp_ring_pending();
+}
+
+/* Adaptive response wait (NAPI-style).
+ *
+ * While responses arrive faster than the spin budget, waiters busy-poll with
+ * response IRQs masked at the bridge. Once the smoothed inter-arrival time
+ * exceeds the budget the ring is considered idle: waiters arm
+ * DOORBELL_FLAG_IRQ_ENABLED and hlt until the IPC IRQ (or the next timer
+ * tick) wakes them.
+ */
+static uint32_t adapt_max_spin_us = IPC_SPIN_BUDGET_US;
+static uint32_t adapt_ewma_us = IPC_SPIN_BUDGET_US; /* Inter-arrival, 1/8 EWMA */
+static usec_t adapt_last_arrival = 0;
+static int adapt_irq_allowed = 1;
+static int adapt_irq_armed = 1; /* ipc_init() leaves IRQs enabled */
+static ipc_adapt_stats_t adapt_stats;
+
+static void adapt_note_arrival(void) {
+  usec_t now = time_usec();
+
+  if (adapt_last_arrival != 0) {
+    usec_t dt = now - adapt_last_arrival;
+    /* Saturate idle gaps so a burst after a pause re-enters poll mode fast */
+    if (dt > 4 * (usec_t)adapt_max_spin_us)
+      dt = 4 * (usec_t)adapt_max_spin_us;
+    adapt_ewma_us = (uint32_t)((adapt_ewma_us * 7 + dt) / 8);
+  }
+  adapt_last_arrival = now;
+}
+
+/* Spin budget for the next wait: cover two mean inter-arrival gaps, or 0 if
+ * the ring has gone idle.
+ */
+static uint32_t adapt_spin_budget(void) {
+  if (adapt_ewma_us > adapt_max_spin_us)
     return 0;
+  uint32_t budget = adapt_ewma_us * 2;
+  return budget > adapt_max_spin_us ? adapt_max_spin_us : budget;
+}
+
+static void adapt_set_irq(int armed) {
+  if (!doorbell || armed == adapt_irq_armed)
+    return;
+  if (armed)
+    __atomic_fetch_or(&doorbell->rsp_flags, DOORBELL_FLAG_IRQ_ENABLED,
+                      __ATOMIC_SEQ_CST);
+  else
+    __atomic_fetch_and(&doorbell->rsp_flags, ~DOORBELL_FLAG_IRQ_ENABLED,
+                       __ATOMIC_SEQ_CST);
+  adapt_irq_armed = armed;
+  adapt_stats.mode_switches++;
+}
+
+/* What response waiters sleep on (ipc_set_sched_hooks) */
+static ipc_sleep_fn sched_sleep_hook;
+static ipc_wake_fn sched_wake_hook;
+static const uint8_t rsp_wait_chan;
+/* Bumped per routed batch, so a waiter sees one that lands between its
+ * last check and going to sleep
+ */
+static volatile uint32_t rsp_wake_gen;
+
+void ipc_set_sched_hooks(ipc_sleep_fn sleep, ipc_wake_fn wake) {
+  sched_sleep_hook = sleep;
+  sched_wake_hook = wake;
+}
+
+int ipc_wait_until(ipc_wait_cond_t cond, void *arg, uint64_t timeout_us) {
+  usec_t start = time_usec();
 
-  /* Spin-wait optimization (reduce tail latency) */
-  /* Try to catch a response that arrives just after we called this, 
-   * avoiding a costly sleep in the caller. */
-  for (int i = 0; i < 5000; i++) {
-      if (rsp_ring->head != rsp_ring->tail) break;
+  for (;;) {
+    uint32_t gen = rsp_wake_gen;
+    if (cond(arg))
+      return 0;
+
+    uint32_t budget = adapt_spin_budget();
+
+    if (budget) {
+      /* Poll mode: the bridge need not interrupt us */
+      if (adapt_irq_allowed)
+        adapt_set_irq(0);
+
+      usec_t t0 = time_usec();
+      usec_t now = t0;
+      int hit = 0;
+      while (now - t0 < budget) {
+        if (cond(arg)) {
+          hit = 1;
+          break;
+        }
+        __asm__ __volatile__("pause");
+        now = time_usec();
+      }
+      adapt_stats.spin_usec += time_usec() - t0;
+      if (hit) {
+        adapt_stats.spin_hits++;
+        return 0;
+      }
+      adapt_stats.spin_misses++;
+    }
+
+    if (timeout_us && time_usec() - start > timeout_us)
+      return -1;
+
+    /* Can't sleep with interrupts off: fall back to polling */
+    if (!interrupts_enabled()) {
       __asm__ __volatile__("pause");
+      continue;
+    }
+
+    /* Idle mode: arm the IRQ, then re-check before sleeping so a response
+     * published in between is not missed. sti;hlt is atomic w.r.t. IRQs.
+     */
+    if (adapt_irq_allowed && irq_registered)
+      adapt_set_irq(1);
+
+    interrupts_disable();
+    if (rsp_ring_pending() || gen != rsp_wake_gen) {
+      interrupts_enable();
+      continue;
+    }
+    usec_t t0 = time_usec();
+    usec_t wake = t0 + IPC_SLEEP_SLICE_US;
+    if (timeout_us && start + timeout_us < wake)
+      wake = start + timeout_us;
+    /* Let other processes run while we wait, or idle the CPU */
+    if (sched_sleep_hook && sched_sleep_hook(&rsp_wait_chan, wake) == 0)
+      interrupts_enable();
+    else
+      __asm__ __volatile__("sti; hlt" ::: "memory");
+    adapt_stats.sleep_usec += time_usec() - t0;
+    adapt_stats.sleeps++;
+  }
+}
+
+static int response_cond(void *arg) {
+  return ipc_poll_response((ipc_response_t *)arg);
+}
+
+int ipc_wait_response(ipc_response_t *rsp, uint64_t timeout_us) {
+  return ipc_wait_until(response_cond, rsp, timeout_us);
+}
+
+void ipc_set_spin_budget(uint32_t max_spin_us) {
+  adapt_max_spin_us = max_spin_us;
+  if (adapt_ewma_us > 4 * max_spin_us)
+    adapt_ewma_us = 4 * max_spin_us;
+}
+
+void ipc_adapt_get_stats(ipc_adapt_stats_t *out) {
+  if (!out)
+    return;
+  *out = adapt_stats;
+  out->ewma_us = adapt_ewma_us;
+  out->spin_budget_us = adapt_spin_budget();
+  out->irq_armed = (uint32_t)adapt_irq_armed;
+}
+
+static void rsp_copy(const volatile ipc_response_t *resp, ipc_response_t *rsp) {
+  rsp->status = resp->status;
+  rsp->orig_cmd = resp->orig_cmd;
+  rsp->result = resp->result;
+  rsp->timestamp = resp->timestamp;
+  rsp->tag = resp->tag;
+  rsp->reserved = 0;
+}
+
+/* Helper: account for a response as it is consumed */
+static void rsp_note(const ipc_response_t *rsp) {
+  adapt_note_arrival();
+  flightrec_log(TRACE_EVT_IPC_RESPONSE, 0, rsp->tag,
+                (uint32_t)rsp->status << 16 | rsp->orig_cmd);
+  if (rsp->tag == IPC_TAG_NONE) {
+    cycles_t *sent = &untagged_sent[lat_ipc_class(rsp->orig_cmd)];
+    if (*sent) {
+      lat_record_ipc(rsp->orig_cmd, (uint32_t)cycles_to_usec(rdtsc() - *sent));
+      *sent = 0;
+    }
   }
 
-  uint32_t head = rsp_ring->head;
-  uint32_t tail = rsp_ring->tail;
+  /* Log response (deferred; drained from the idle loop) */
+  KLOG3(KLOG_SUBSYS_IPC, KLOG_LVL_INFO, "response: status=%x cmd=%x result=%x",
+        rsp->status, rsp->orig_cmd, rsp->result);
+}
 
-  if (head == tail)
-    return 0; /* Empty */
+/* Pop one response off the ring. Caller checked rsp_ring_pending().
+ * Returns: 1, or 0 for a slot rsp_deliver_ahead() already delivered
+ */
+static int rsp_pop_raw(ipc_response_t *rsp) {
+  uint32_t tail = rsp_ring->hdr.tail;
+  uint32_t bit = tail % RSP_AHEAD;
+  int fresh = !(rsp_ahead[bit >> 3] & (1u << (bit & 7)));
 
   /* Read response */
-  volatile ipc_response_t *resp = &rsp_ring->data[tail];
-
-  if (rsp) {
-    rsp->status = resp->status;
-    rsp->orig_cmd = resp->orig_cmd;
-    rsp->result = resp->result;
-    rsp->timestamp = resp->timestamp;
-  }
-
-  /* Log response */
-  console_write("[ipc] response: status=");
-  print_hex32(resp->status);
-  console_write(" cmd=");
-  print_hex32(resp->orig_cmd);
-  console_write(" result=");
-  print_hex32(resp->result);
-  console_write("\n");
+  __asm__ __volatile__("" ::: "memory");
+  if (fresh) {
+    rsp_copy(&rsp_ring->data[tail & rsp_ring->hdr.mask], rsp);
+    rsp_note(rsp);
+  } else {
+    rsp_ahead[bit >> 3] &= (uint8_t)~(1u << (bit & 7));
+  }
 
   /* Compiler barrier before updating tail */
   __asm__ __volatile__("" ::: "memory");
 
   /* Update tail (consume) */
-  rsp_ring->tail = (tail + 1) % rsp_ring->size;
+  rsp_ring->hdr.tail = tail + 1;
+  return fresh;
+}
+
+/* Helper: with the backlog full, hand tagged responses queued behind the
+ * untagged ones left at the tail to their completions, in place
+ * Returns: responses delivered
+ */
+static uint32_t rsp_deliver_ahead(void) {
+  uint32_t tail = rsp_ring->hdr.tail;
+  uint32_t head = rsp_head_cache = rsp_ring->hdr.head;
+  uint32_t n = 0;
+
+  __asm__ __volatile__("" ::: "memory");
+  for (uint32_t pos = tail; pos != head && pos - tail < RSP_AHEAD; pos++) {
+    uint32_t bit = pos % RSP_AHEAD;
+    volatile ipc_response_t *resp = &rsp_ring->data[pos & rsp_ring->hdr.mask];
+    if ((rsp_ahead[bit >> 3] & (1u << (bit & 7))) || resp->tag == IPC_TAG_NONE)
+      continue;
+    ipc_response_t r;
+    rsp_copy(resp, &r);
+    if (!ipc_completion_deliver(&r))
+      continue; /* Nobody waiting on it: it goes the untagged way */
+    rsp_note(&r);
+    rsp_ahead[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    n++;
+  }
+  return n;
+}
+
+int ipc_poll_response(ipc_response_t *rsp) {
+  if (!rsp_ring || rsp_ring->hdr.magic != IPC_RSP_MAGIC)
+    return 0;
+
+  if (rsp_backlog_head != rsp_backlog_tail) {
+    if (rsp)
+      *rsp = rsp_backlog[rsp_backlog_tail % RSP_BACKLOG_SIZE];
+    rsp_backlog_tail++;
+    return 1;
+  }
 
-  return 1;
+  /* Non-blocking: callers that want to wait use ipc_wait_response() */
+  ipc_response_t r;
+  while (rsp_ring_pending()) {
+    if (!rsp_pop_raw(&r))
+      continue;
+    if (r.tag != IPC_TAG_NONE && ipc_completion_deliver(&r))
+      continue; /* Claimed by its submitter */
+    if (rsp)
+      *rsp = r;
+    return 1;
+  }
+  return 0; /* Empty */
+}
+
+uint32_t ipc_process_responses(void) {
+  uint32_t n = 0;
+  ipc_response_t r;
+
+  while (rsp_ring_pending()) {
+    /* Leave untagged responses in the ring once the backlog is full, but
+     * not the tagged ones behind them: their waiters don't poll for these
+     */
+    if (rsp_backlog_head - rsp_backlog_tail >= RSP_BACKLOG_SIZE) {
+      n += rsp_deliver_ahead();
+      break;
+    }
+
+    if (!rsp_pop_raw(&r))
+      continue;
+    n++;
+    if (r.tag != IPC_TAG_NONE && ipc_completion_deliver(&r))
+      continue;
+    rsp_backlog[rsp_backlog_head % RSP_BACKLOG_SIZE] = r;
+    rsp_backlog_head++;
+  }
+  if (n) {
+    rsp_wake_gen++;
+    if (sched_wake_hook)
+      sched_wake_hook(&rsp_wait_chan);
+  }
+  return n;
 }
 
 /* Simulation of Linux Side (for testing without real bridge) */
@@ -388,15 +1258,21 @@ void ipc_consume_one(void) {
   if (!cmd_ring)
     return;
 
-  uint32_t head = cmd_ring->head;
-  uint32_t tail = cmd_ring->tail;
+  uint32_t head = cmd_ring->hdr.head;
+  uint32_t tail = cmd_ring->hdr.tail;
 
   if (head == tail) {
     /* console_write("[ipc-sim] cmd ring empty.\n"); */
     return;
   }
 
-  volatile ipc_packet_t *pkt = &cmd_ring->data[tail];
+  /* MPSC: a claimed slot may not be published yet */
+  if (cmd_mpsc &&
+      __atomic_load_n(&cmd_seq[tail & cmd_ring->hdr.mask], __ATOMIC_ACQUIRE) !=
+          tail + 1)
+    return;
+
+  volatile ipc_packet_t *pkt = &cmd_ring->data[tail & cmd_ring->hdr.mask];
   console_write("[ipc-sim] Consuming Packet:\n");
   console_write("  Cmd: ");
   print_hex32(pkt->cmd);
@@ -410,24 +1286,31 @@ void ipc_consume_one(void) {
 
   /* Store command for response */
   uint16_t orig_cmd = pkt->cmd;
+  uint32_t pkt_tag = pkt->tag;
 
   /* Update tail (consume the command) */
-  cmd_ring->tail = (tail + 1) % cmd_ring->size;
+  if (cmd_mpsc)
+    __atomic_store_n(&cmd_seq[tail & cmd_ring->hdr.mask],
+                     tail + cmd_ring->hdr.size, __ATOMIC_RELEASE);
+  cmd_ring->hdr.tail = tail + 1;
 
   /* Send a mock response */
-  if (rsp_ring && rsp_ring->magic == IPC_RSP_MAGIC) {
-    uint32_t rsp_head = rsp_ring->head;
-    uint32_t next_rsp_head = (rsp_head + 1) % rsp_ring->size;
+  if (rsp_ring && rsp_ring->hdr.magic == IPC_RSP_MAGIC) {
+    uint32_t rsp_head = rsp_ring->hdr.head;
+    uint32_t next_rsp_head = rsp_head + 1;
 
-    if (next_rsp_head != rsp_ring->tail) {
-      volatile ipc_response_t *resp = &rsp_ring->data[rsp_head];
+    if (rsp_head - rsp_ring->hdr.tail < rsp_ring->hdr.size) {
+      volatile ipc_response_t *resp =
+          &rsp_ring->data[rsp_head & rsp_ring->hdr.mask];
       resp->status = RSP_OK;
       resp->orig_cmd = orig_cmd;
       resp->result = 0x12345678; /* Mock result */
       resp->timestamp = time_usec();
+      resp->tag = pkt_tag;
+      resp->reserved = 0;
 
       __asm__ __volatile__("" ::: "memory");
-      rsp_ring->head = next_rsp_head;
+      rsp_ring->hdr.head = next_rsp_head;
 
       /* Ring response doorbell (simulating Linux side) */
       if (doorbell) {
@@ -449,6 +1332,9 @@ void ipc_enable_irq(int enable) {
   if (!doorbell)
     return;
 
+  adapt_irq_allowed = enable;
+  adapt_irq_armed = enable;
+
   if (enable) {
     doorbell->rsp_flags |= DOORBELL_FLAG_IRQ_ENABLED;
     console_write("[ipc] Response IRQs enabled\n");
@@ -461,18 +1347,54 @@ void ipc_enable_irq(int enable) {
 /* IRQ handler for response notifications */
 void ipc_irq_handler(interrupt_frame_t *frame) {
   (void)frame; /* Unused */
+  ipc_doorbell_notify();
+}
+
+/* Response doorbell from the bridge (legacy IRQ or ivshmem MSI callback) */
+void ipc_doorbell_notify(void) {
   irq_count++;
+  adapt_stats.irq_wakeups++;
 
   /* Clear pending flag */
   if (doorbell) {
     doorbell->rsp_flags &= ~DOORBELL_FLAG_PENDING;
   }
 
-  /* Process all pending responses */
-  ipc_response_t rsp;
-  while (ipc_poll_response(&rsp)) {
-    /* Response was logged by ipc_poll_response */
+  /* Route all pending responses (tagged ones complete their requests) */
+  ipc_process_responses();
+}
+
+void ipc_stats_fill(ipc_stats_ipc_t *out) {
+  *out = (ipc_stats_ipc_t){0};
+  if (cmd_ring) {
+    out->cmd_pending = cmd_ring->hdr.head - cmd_ring->hdr.tail;
+    out->cmd_depth = ipc_region_entries(IPC_REGION_CMD_RING);
   }
+  if (rsp_ring) {
+    out->rsp_pending = rsp_ring->hdr.head - rsp_ring->hdr.tail;
+    out->rsp_depth = ipc_region_entries(IPC_REGION_RSP_RING);
+  }
+  if (doorbell) {
+    out->cmd_doorbells = doorbell->cmd_writes;
+    out->rsp_doorbells = doorbell->rsp_writes;
+  }
+  out->irqs = irq_count;
+  out->kicks_sent = kicks_sent;
+  out->kicks_coalesced = kicks_coalesced;
+
+  ipc_adapt_stats_t adapt;
+  ipc_stream_wait_stats_t wait;
+  ipc_adapt_get_stats(&adapt);
+  ipc_stream_wait_get_stats(&wait);
+  out->spin_hits = adapt.spin_hits + wait.spin_hits;
+  out->spin_misses = adapt.spin_misses + wait.sleep_hits;
+  out->mode_switches = adapt.mode_switches;
+  out->stream_timeouts = wait.timeouts;
+  out->stream_wait_max_us = wait.sleep_wait_max_us > wait.spin_wait_max_us
+                                ? wait.sleep_wait_max_us
+                                : wait.spin_wait_max_us;
+  out->spin_us = adapt.spin_usec + wait.spin_usec;
+  out->sleep_us = adapt.sleep_usec + wait.sleep_usec;
 }
 
 void ipc_dump_debug(void) {
@@ -482,17 +1404,15 @@ void ipc_dump_debug(void) {
   if (cmd_ring) {
     console_write("[ipc] CMD Ring:\n");
     console_write("  Magic: ");
-    print_hex32(cmd_ring->magic);
-    console_write(cmd_ring->magic == IPC_MAGIC ? " (valid)\n" : " (INVALID)\n");
+    print_hex32(cmd_ring->hdr.magic);
+    console_write(cmd_ring->hdr.magic == IPC_MAGIC ? " (valid)\n" : " (INVALID)\n");
     console_write("  Head:  ");
-    print_uint(cmd_ring->head);
+    print_uint(cmd_ring->hdr.head);
     console_write("\n  Tail:  ");
-    print_uint(cmd_ring->tail);
+    print_uint(cmd_ring->hdr.tail);
     console_write("\n");
 
-    uint32_t pending = (cmd_ring->head >= cmd_ring->tail)
-                           ? (cmd_ring->head - cmd_ring->tail)
-                           : (cmd_ring->size - cmd_ring->tail + cmd_ring->head);
+    uint32_t pending = cmd_ring->hdr.head - cmd_ring->hdr.tail;
     console_write("  Pending: ");
     print_uint(pending);
     console_write(" packets\n");
@@ -502,23 +1422,23 @@ void ipc_dump_debug(void) {
   if (rsp_ring) {
     console_write("[ipc] RSP Ring:\n");
     console_write("  Magic: ");
-    print_hex32(rsp_ring->magic);
-    console_write(rsp_ring->magic == IPC_RSP_MAGIC ? " (valid)\n"
-                                                   : " (INVALID)\n");
+    print_hex32(rsp_ring->hdr.magic);
+    console_write(rsp_ring->hdr.magic == IPC_RSP_MAGIC ? " (valid)\n"
+                                                       : " (INVALID)\n");
     console_write("  Head:  ");
-    print_uint(rsp_ring->head);
+    print_uint(rsp_ring->hdr.head);
     console_write("\n  Tail:  ");
-    print_uint(rsp_ring->tail);
+    print_uint(rsp_ring->hdr.tail);
     console_write("\n");
 
-    uint32_t pending = (rsp_ring->head >= rsp_ring->tail)
-                           ? (rsp_ring->head - rsp_ring->tail)
-                           : (rsp_ring->size - rsp_ring->tail + rsp_ring->head);
+    uint32_t pending = rsp_ring->hdr.head - rsp_ring->hdr.tail;
     console_write("  Pending: ");
     print_uint(pending);
     console_write(" responses\n");
   }
 
+  ipc_stream_dump();
+
   /* Doorbell status */
   if (doorbell) {
     console_write("[ipc] Doorbell:\n");
@@ -526,6 +1446,12 @@ void ipc_dump_debug(void) {
     print_hex32(doorbell->magic);
     console_write(doorbell->magic == IPC_DOORBELL_MAGIC ? " (valid)\n"
                                                         : " (INVALID)\n");
+    console_write("  Version: ");
+    print_uint(doorbell->version);
+    console_write(" (bridge: ");
+    print_uint(doorbell->peer_version);
+    console_write(doorbell->peer_version == doorbell->version ? ")\n"
+                                                              : ", MISMATCH)\n");
     console_write("  CMD doorbell: ");
     print_uint(doorbell->cmd_doorbell);
     console_write(" (writes: ");
@@ -546,8 +1472,45 @@ void ipc_dump_debug(void) {
     console_write("  Local IRQ count: ");
     print_uint(irq_count);
     console_write("\n");
+    console_write("  Bridge kicks: ");
+    print_uint(kicks_sent);
+    console_write(" (coalesced: ");
+    print_uint(kicks_coalesced);
+    console_write(", bridge peer: ");
+    if (doorbell->bridge_peer_id)
+      print_uint(doorbell->bridge_peer_id - 1);
+    else
+      console_write("none");
+    console_write(")\n");
   }
 
+  console_write("[ipc] Adaptive wait:\n");
+  console_write("  Mode: ");
+  console_write(adapt_spin_budget() ? "poll" : "irq");
+  console_write(" (budget ");
+  print_uint(adapt_spin_budget());
+  console_write("us of ");
+  print_uint(adapt_max_spin_us);
+  console_write("us, inter-arrival ");
+  print_uint(adapt_ewma_us);
+  console_write("us)\n");
+  console_write("  Spin: ");
+  print_uint((uint32_t)adapt_stats.spin_usec);
+  console_write("us (hits: ");
+  print_uint(adapt_stats.spin_hits);
+  console_write(", misses: ");
+  print_uint(adapt_stats.spin_misses);
+  console_write(")\n");
+  console_write("  Sleep: ");
+  print_uint((uint32_t)adapt_stats.sleep_usec);
+  console_write("us (sleeps: ");
+  print_uint(adapt_stats.sleeps);
+  console_write(", irq wakeups: ");
+  print_uint(adapt_stats.irq_wakeups);
+  console_write(", mode switches: ");
+  print_uint(adapt_stats.mode_switches);
+  console_write(")\n");
+
   console_write("[ipc] === END DUMP ===\n");
 }
 
@@ -4,6 +4,7 @@
 #define _IPC_H
 
 #include "../arch/idt.h" /* For interrupt_frame_t */
+#include "../lib/hdr_hist.h"
 #include "ipc_proto.h"
 #include <stdint.h>
 
@@ -24,33 +25,257 @@ int ipc_send(uint16_t cmd, uint32_t payload);
 /* Send a command with flags */
 int ipc_send_flags(uint16_t cmd, uint32_t payload, uint16_t flags);
 
-/* Poll for a response (returns 1 if consumed, 0 if empty) */
+/* Send a command carrying a request tag, echoed back in its response.
+ * Most callers want ipc_submit() (completion.h), which allocates the tag.
+ */
+int ipc_send_tagged(uint16_t cmd, uint32_t payload, uint16_t flags,
+                    uint32_t tag);
+
+/* Send a burst of commands: all n packets are queued, the head is published
+ * once and the doorbell is rung once. Packet timestamps are filled in.
+ * Returns: 0 on success, -1 if the ring cannot hold all n packets
+ */
+int ipc_send_batch(const ipc_packet_t *pkts, uint32_t n);
+
+/* Reserve/commit variant of ipc_send_batch for filling slots in place:
+ *
+ *   ipc_batch_t b;
+ *   if (ipc_send_reserve(&b, n) == 0) {
+ *     for (i = 0; i < n; i++) {
+ *       volatile ipc_packet_t *p = ipc_batch_slot(&b, i);
+ *       p->cmd = ...; p->payload_id = ...;
+ *     }
+ *     ipc_send_commit(&b);
+ *   }
+ *
+ * Nothing is visible to the bridge until ipc_send_commit(). Only one
+ * reservation may be outstanding at a time.
+ */
+typedef struct {
+  uint32_t first; /* Ring index of the first reserved slot */
+  uint32_t count; /* Number of reserved slots */
+} ipc_batch_t;
+
+int ipc_send_reserve(ipc_batch_t *batch, uint32_t n);
+volatile ipc_packet_t *ipc_batch_slot(const ipc_batch_t *batch, uint32_t i);
+void ipc_send_commit(const ipc_batch_t *batch);
+
+/* Variable-length message rings: commands with up to IPC_MSG_MAX_INLINE
+ * bytes of inline payload, answered on the message response ring. Callers
+ * must not send from IRQ context.
+ */
+void ipc_msg_init(void);
+
+/* Returns: 0 on success, -1 if the ring is full or len is too large */
+int ipc_msg_send(uint16_t cmd, uint32_t arg, const void *data, uint16_t len,
+                 uint32_t tag);
+
+/* Pop the next untagged message response; up to cap payload bytes are
+ * copied to buf (hdr->len is the full length). Tagged responses are routed
+ * to the completion table. Returns 1 if a message was consumed, 0 if empty.
+ */
+int ipc_msg_recv(ipc_msg_hdr_t *hdr, void *buf, uint16_t cap);
+
+/* Route tagged message responses at the front of the ring without
+ * consuming untagged ones. Returns the number routed.
+ */
+uint32_t ipc_msg_process(void);
+
+/* Poll for a response without blocking (returns 1 if consumed, 0 if
+ * empty). Responses to
+ * tagged requests still in the completion table are routed there and never
+ * returned here.
+ */
 int ipc_poll_response(ipc_response_t *rsp);
 
+/* Drain the response ring without blocking: tagged responses complete their
+ * requests, untagged ones are queued for ipc_poll_response().
+ * Returns: number of responses taken off the ring
+ */
+uint32_t ipc_process_responses(void);
+
 /* Check if there is a pending response */
 int ipc_has_response(void);
 
+/* Adaptive response wait (NAPI-style hybrid poll/IRQ).
+ *
+ * Busy-polls for up to a spin budget derived from the observed response
+ * inter-arrival time (capped at the max set by ipc_set_spin_budget()), then
+ * arms the response IRQ and hlts. When the ring is idle the spin phase is
+ * skipped entirely.
+ */
+#define IPC_SPIN_BUDGET_US 200 /* Default spin ceiling */
+
+typedef int (*ipc_wait_cond_t)(void *arg);
+
+/* Wait until cond(arg) returns nonzero or timeout_us expires (0 = forever).
+ * cond is evaluated on every poll and must be cheap and non-blocking.
+ * Returns: 0 when cond held, -1 on timeout
+ */
+int ipc_wait_until(ipc_wait_cond_t cond, void *arg, uint64_t timeout_us);
+
+/* Scheduler hooks, set once processes exist: the idle phase of
+ * ipc_wait_until() calls sleep(chan, deadline_us) instead of hlt (0 =
+ * slept, interrupts off before and after), and every batch of routed
+ * responses calls wake(chan). With none, waits hlt the CPU.
+ */
+typedef int (*ipc_sleep_fn)(const void *chan, uint64_t deadline_us);
+typedef uint32_t (*ipc_wake_fn)(const void *chan);
+void ipc_set_sched_hooks(ipc_sleep_fn sleep, ipc_wake_fn wake);
+
+/* Longest a sleeping waiter goes without rechecking its condition */
+#define IPC_SLEEP_SLICE_US 10000
+
+/* Wait for the next untagged response. Returns 0 or -1 on timeout. */
+int ipc_wait_response(ipc_response_t *rsp, uint64_t timeout_us);
+
+/* Set the spin budget ceiling in microseconds (0 = never spin) */
+void ipc_set_spin_budget(uint32_t max_spin_us);
+
+typedef struct {
+  uint64_t spin_usec;      /* Time burned busy-polling */
+  uint64_t sleep_usec;     /* Time spent halted waiting for an IRQ/tick */
+  uint32_t spin_hits;      /* Waits satisfied while spinning */
+  uint32_t spin_misses;    /* Spin budget exhausted, fell back to sleep */
+  uint32_t sleeps;         /* hlt episodes */
+  uint32_t irq_wakeups;    /* Response IRQs taken */
+  uint32_t mode_switches;  /* Poll <-> IRQ transitions */
+  uint32_t ewma_us;        /* Smoothed response inter-arrival time */
+  uint32_t spin_budget_us; /* Budget the next wait will spin for */
+  uint32_t irq_armed;      /* DOORBELL_FLAG_IRQ_ENABLED currently set */
+} ipc_adapt_stats_t;
+
+void ipc_adapt_get_stats(ipc_adapt_stats_t *out);
+
 /* Enable/Disable IRQs (used by consumer) */
 void ipc_enable_irq(int enable);
 
 /* IRQ handler for IPC notifications */
 void ipc_irq_handler(interrupt_frame_t *frame);
 
+/* Response doorbell notification (body of ipc_irq_handler; also the
+ * ivshmem IVSHMEM_VEC_RSP handler)
+ */
+void ipc_doorbell_notify(void);
+
 /* Simulation/testing: consume one command (mock Linux side) */
 void ipc_consume_one(void);
 
 /* Dump debug stats to console */
 void ipc_dump_debug(void);
 
+/* Ring, doorbell and wait counters for the statistics page */
+void ipc_stats_fill(ipc_stats_ipc_t *out);
+
+/* Heartbeat period, and how long a peer's heartbeat may stand still
+ * before it is evicted (ipc_mesh_set_suspect_us(), 0 = this default)
+ */
+#define MESH_HEARTBEAT_US 1000
+#define MESH_SUSPECT_US   20000
+
 void ipc_mesh_init(void);
+/* Heartbeat, failure detection and rejoining; mesh_work_poll() calls it */
 void ipc_mesh_update(void);
 void ipc_mesh_dump(void);
+void ipc_mesh_set_suspect_us(uint64_t us);
+/* time_usec() of the next heartbeat, 0 = not in a mesh */
+uint64_t ipc_mesh_next_deadline(void);
+/* Node is in its slot and not suspected by us */
+int ipc_mesh_node_up(uint32_t node);
+/* Our time since node's heartbeat last moved; 0 for us or a down node */
+uint64_t ipc_mesh_node_age_us(uint32_t node);
+uint32_t ipc_mesh_node_epoch(uint32_t node);
+/* Shared mesh table, NULL until this node has joined */
+volatile mesh_table_t *ipc_mesh_table(void);
+/* This node's slot in it, -1 if not joined */
+int ipc_mesh_local_id(void);
 
 /* Streaming obs/action rings */
 void ipc_stream_init(void);
 int ipc_stream_ready(void);
 int ipc_stream_action_push(uint32_t seq, uint16_t action, uint32_t ack_seq);
 int ipc_stream_obs_pop(obs_entry_t *out);
+/* Nonzero while an observation waits to be popped (no side effects) */
+int ipc_stream_obs_pending(void);
+
+/* Burst forms: move up to max/count entries with one shared index update
+ * (and one cache-line transfer) instead of one per entry. Return the number
+ * of entries moved.
+ */
+uint32_t ipc_stream_obs_pop_burst(obs_entry_t *out, uint32_t max);
+uint32_t ipc_stream_action_push_burst(action_entry_t *in, uint32_t count);
+
+/* Stream latency histograms (ns). Action pushes stamp ts with the TSC. */
+#define IPC_STREAM_LAT_INFER      0 /* Obs pop -> action push (ZENEDGE) */
+#define IPC_STREAM_LAT_TURNAROUND 1 /* Action push -> next obs pop (bridge) */
+#define IPC_STREAM_LAT_TRANSIT    2 /* Bridge obs publish -> pop (clock synced) */
+#define IPC_STREAM_LAT_COUNT      3
+
+/* Pin the bridge's clock to ours after the CMD_ENV_RESET response;
+ * sent_tsc = time_cycles() just before the reset went out. Resets the
+ * histograms. Returns 0, or -1 if the bridge published no clock.
+ */
+int ipc_stream_clock_sync(uint64_t sent_tsc);
+
+const hdr_hist_t *ipc_stream_latency(uint32_t which);
+void ipc_stream_latency_reset(void);
+
+/* Wait for an observation: spin briefly (adaptive, as ipc_wait_until()),
+ * then sleep with MONITOR/MWAIT on the obs ring head, or hlt until the
+ * doorbell IRQ / timer tick where MONITOR is not exposed.
+ * Returns: 0 once an entry is ready to pop, -1 on timeout (0 = forever)
+ */
+int ipc_stream_wait_obs(uint64_t timeout_us);
+
+typedef struct {
+  uint64_t spin_usec;         /* Time burned busy-polling */
+  uint64_t sleep_usec;        /* Time spent in mwait/hlt */
+  uint64_t spin_wait_usec;    /* Total wait of waits ended while spinning */
+  uint64_t sleep_wait_usec;   /* Total wait of waits ended after sleeping */
+  uint32_t spin_hits;
+  uint32_t sleep_hits;
+  uint32_t spin_wait_max_us;
+  uint32_t sleep_wait_max_us; /* Worst-case wake latency seen */
+  uint32_t mwait_sleeps;      /* mwait episodes */
+  uint32_t hlt_sleeps;        /* hlt episodes (no MONITOR/MWAIT) */
+  uint32_t timeouts;
+  uint32_t ewma_us;           /* Smoothed wait time */
+  uint32_t spin_budget_us;    /* Budget the next wait will spin for */
+  uint32_t mwait;             /* 1 if MONITOR/MWAIT is in use */
+} ipc_stream_wait_stats_t;
+
+void ipc_stream_wait_get_stats(ipc_stream_wait_stats_t *out);
+
+/* Stream channels. Each channel is an independent obs/action ring pair
+ * with its own wait and latency state; the functions above act on
+ * channel 0, which ipc_stream_init() opens. Channels 1.. live in
+ * IPC_REGION_STREAM_CHAN and are listed in its channel table.
+ */
+typedef struct ipc_stream ipc_stream_t;
+
+/* NULL if channel is out of range or has no rings in this layout */
+ipc_stream_t *ipc_stream_open(uint32_t channel);
+void ipc_stream_close(ipc_stream_t *s);
+/* Record the owning job and core (IPC_CHAN_CPU_ANY = unpinned) */
+void ipc_stream_bind(ipc_stream_t *s, uint32_t job_id, uint32_t cpu);
+
+int ipc_stream_push(ipc_stream_t *s, uint32_t seq, uint16_t action, uint32_t ack_seq);
+int ipc_stream_pop(ipc_stream_t *s, obs_entry_t *out);
+uint32_t ipc_stream_pop_burst(ipc_stream_t *s, obs_entry_t *out, uint32_t max);
+uint32_t ipc_stream_push_burst(ipc_stream_t *s, action_entry_t *in, uint32_t count);
+int ipc_stream_wait(ipc_stream_t *s, uint64_t timeout_us);
+int ipc_stream_sync_clock(ipc_stream_t *s, uint64_t sent_tsc);
+const hdr_hist_t *ipc_stream_hist(const ipc_stream_t *s, uint32_t which);
+void ipc_stream_reset_latency(ipc_stream_t *s);
+void ipc_stream_wait_stats(const ipc_stream_t *s, ipc_stream_wait_stats_t *out);
+
+/* Print each open channel's rings, wait stats and latency to console */
+void ipc_stream_dump(void);
+
+/* Latest telemetry from the bridge's seqlock page (no IPC round-trip).
+ * Returns 0 with a consistent snapshot, -1 if unpublished or contended.
+ */
+int ipc_telemetry_read(telemetry_snapshot_t *out);
 
 #ifdef __cplusplus
 }
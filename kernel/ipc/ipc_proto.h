@@ -8,16 +8,76 @@
 #define IPC_MAGIC      0x51DECA9E /* "SIDEAR" - sort of */
 #define IPC_RSP_MAGIC  0x52535030 /* "RSP0" */
 #define IPC_HEAP_MAGIC 0x48454150 /* "HEAP" */
-#define IPC_RING_SIZE  1024       /* Number of packets in ring */
+#define IPC_RING_SIZE  1024       /* Packets per ring in the fixed 1MB layout */
 
 /* =============================================================================
- * SHARED MEMORY LAYOUT (1MB total at 0x02000000)
+ * LAYOUT DESCRIPTOR (offset 0)
+ * =============================================================================
+ * ZENEDGE sizes every region from the real ivshmem BAR2 size and publishes
+ * the result here before it initializes any ring, so a larger device gets a
+ * proportionally larger heap and deeper rings without recompiling either
+ * side. Peers look regions up by IPC_REGION_* id; regions are 4KB aligned
+ * and a region with size 0 is absent.
+ *
+ * If offset 0 does not hold IPC_LAYOUT_MAGIC the peer is an older image
+ * using the fixed 1MB layout below.
+ */
+#define IPC_LAYOUT_MAGIC     0x5459414C  /* "LAYT" */
+#define IPC_LAYOUT_VERSION   1
+#define IPC_LAYOUT_BYTES     0x1000
+#define IPC_LAYOUT_ALIGN     0x1000
+#define IPC_REGION_MAX       32
+
+#define IPC_SHARED_MEM_MIN   0x100000    /* Smallest device we lay out (1MB) */
+
+/* Region ids (index into ipc_layout_t.regions) */
+#define IPC_REGION_CMD_RING  0   /* entries = packet slots */
+#define IPC_REGION_RSP_RING  1   /* entries = response slots */
+#define IPC_REGION_DOORBELL  2
+#define IPC_REGION_HEAP_CTL  3   /* entries = blob table slots */
+#define IPC_REGION_HEAP_DATA 4   /* entries = HEAP_BLOCK_SIZE blocks */
+#define IPC_REGION_MESH      5
+#define IPC_REGION_TELEMETRY 6
+#define IPC_REGION_MSG_CMD   7   /* entries = data bytes */
+#define IPC_REGION_MSG_RSP   8   /* entries = data bytes */
+#define IPC_REGION_OBS_RING  9   /* entries = obs slots */
+#define IPC_REGION_ACT_RING  10  /* entries = action slots */
+#define IPC_REGION_BULK      11  /* entries = bulk chunk slots */
+#define IPC_REGION_STREAM_CHAN 12 /* entries = stream channels */
+#define IPC_REGION_MESH_WORK 13  /* entries = slots per ring */
+#define IPC_REGION_MESH_COLL 14  /* entries = bytes per collective chunk */
+#define IPC_REGION_TRACE     15  /* entries = trace event slots */
+#define IPC_REGION_STATS     16
+#define IPC_REGION_JOBS      17  /* entries = job submission slots */
+#define IPC_REGION_COUNT     18
+
+typedef struct {
+  uint32_t offset;   /* From the start of shared memory */
+  uint32_t size;     /* Bytes reserved (0 = region absent) */
+  uint32_t entries;  /* Slots / data bytes / blocks (see IPC_REGION_*) */
+  uint32_t reserved;
+} ipc_region_t;
+
+typedef struct {
+  uint32_t magic;         /* IPC_LAYOUT_MAGIC, written last */
+  uint32_t version;       /* IPC_LAYOUT_VERSION */
+  uint32_t total_size;    /* Shared memory bytes described */
+  uint32_t region_count;  /* Valid entries in regions[] */
+  uint32_t reserved[12];
+  ipc_region_t regions[IPC_REGION_MAX];
+} ipc_layout_t;
+
+/* =============================================================================
+ * FIXED SHARED MEMORY LAYOUT (1MB, images without a layout descriptor)
  * =============================================================================
  * 0x00000 - 0x07FFF: Command ring (32KB)    - ZENEDGE -> Linux
  * 0x08000 - 0x0FFFF: Response ring (32KB)   - Linux -> ZENEDGE
  * 0x10000 - 0x100FF: Doorbell control (256B) - Interrupt signaling
  * 0x10100 - 0x10FFF: Heap control block (~4KB)
- * 0x11000 - 0xFDFFF: Heap data region (~948KB for tensors/models)
+ * 0x10F00 - 0x10F3F: Telemetry page (seqlock, in the mesh page tail)
+ * 0x11000 - 0xF8FFF: Heap data region (~928KB for tensors/models)
+ * 0xF9000 - 0xFB7FF: Message command ring (10KB, inline payloads)
+ * 0xFB800 - 0xFDFFF: Message response ring (10KB, inline payloads)
  * 0xFE000 - 0xFEFFF: OBS ring (streaming)
  * 0xFF000 - 0xFFFFF: ACTION ring (streaming)
  */
@@ -26,7 +86,48 @@
 #define IPC_DOORBELL_OFFSET  0x10000
 #define IPC_HEAP_CTL_OFFSET  0x10100
 #define IPC_HEAP_DATA_OFFSET 0x11000
-#define IPC_HEAP_DATA_SIZE   0xED000  /* ~948KB (reserve tail for stream rings) */
+#define IPC_HEAP_DATA_SIZE   0xE8000  /* ~928KB (reserve tail for msg/stream rings) */
+
+/* =============================================================================
+ * VARIABLE-LENGTH MESSAGE RINGS (inline payloads)
+ * =============================================================================
+ * Byte-addressed SPSC rings for commands whose argument does not fit in a
+ * 32-bit payload_id (print strings, IFR records, telemetry replies). They use
+ * the v2 ipc_ring_hdr_t with hdr.size = data bytes and head/tail as
+ * free-running byte offsets.
+ *
+ * Each record is an ipc_msg_hdr_t followed by `len` payload bytes, padded to
+ * IPC_MSG_ALIGN. A record never straddles the end of the data area: the
+ * producer writes an IPC_MSG_KIND_WRAP header and restarts at offset 0.
+ *
+ * Commands sent on the message ring are answered on the message response
+ * ring (with or without inline data), not on the fixed response ring.
+ */
+#define IPC_MSG_MAGIC        0x4D534752  /* "MSGR" */
+#define IPC_MSG_RING_BYTES   0x2800      /* Header + data area */
+#define IPC_MSG_DATA_BYTES   0x2000      /* Data area (power of two) */
+#define IPC_MSG_CMD_RING_OFFSET (IPC_HEAP_DATA_OFFSET + IPC_HEAP_DATA_SIZE)
+#define IPC_MSG_RSP_RING_OFFSET (IPC_MSG_CMD_RING_OFFSET + IPC_MSG_RING_BYTES)
+
+#define IPC_MSG_ALIGN        16
+#define IPC_MSG_MAX_INLINE   512         /* Largest inline payload */
+
+#define IPC_MSG_KIND_DATA    0x0001
+#define IPC_MSG_KIND_WRAP    0x0002      /* Skip to the start of the data area */
+
+typedef struct {
+  uint16_t kind;   /* IPC_MSG_KIND_* */
+  uint16_t len;    /* Inline payload bytes following this header */
+  uint16_t cmd;    /* Command ID (or original command in a response) */
+  uint16_t status; /* RSP_* in responses, command flags in commands */
+  uint32_t arg;    /* payload_id in commands, result in responses */
+  uint32_t tag;    /* Request tag (IPC_TAG_NONE if untagged) */
+} ipc_msg_hdr_t;   /* 16 bytes */
+
+/* Bytes a record with `len` payload bytes occupies in the data area */
+#define IPC_MSG_RECORD_SIZE(len) \
+  (((uint32_t)sizeof(ipc_msg_hdr_t) + (len) + IPC_MSG_ALIGN - 1) & \
+   ~(uint32_t)(IPC_MSG_ALIGN - 1))
 
 /* =============================================================================
  * STREAMING OBS/ACTION RINGS (SPSC)
@@ -36,12 +137,86 @@
 #define IPC_STREAM_MAGIC     0x5354524D  /* "STRM" */
 #define IPC_OBS_RING_BYTES   0x1000
 #define IPC_ACT_RING_BYTES   0x1000
-#define IPC_OBS_RING_OFFSET  (IPC_HEAP_DATA_OFFSET + IPC_HEAP_DATA_SIZE)
+#define IPC_OBS_RING_OFFSET  (IPC_MSG_RSP_RING_OFFSET + IPC_MSG_RING_BYTES)
 #define IPC_ACT_RING_OFFSET  (IPC_OBS_RING_OFFSET + IPC_OBS_RING_BYTES)
 
 #define IPC_OBS_RING_SIZE    64
 #define IPC_ACT_RING_SIZE    64
 
+/* Observation width: floats per obs_entry_t. Build with -DIPC_OBS_DIM=N for
+ * wider environments; the obs ring header publishes entry_size and obs_dim,
+ * so the bridge sizes itself at runtime.
+ */
+#ifndef IPC_OBS_DIM
+#define IPC_OBS_DIM          4
+#endif
+#define IPC_OBS_DIM_MAX      512
+
+/* seq + obs[dim] + reward + done + model_id + ts */
+#define IPC_OBS_ENTRY_SIZE(dim) (4u + 4u * (uint32_t)(dim) + 16u)
+
+/* Stream channels (IPC_REGION_STREAM_CHAN)
+ * Each channel is an independent obs/action ring pair, so several control
+ * loops can run on one node. Channel 0 is IPC_REGION_OBS_RING/ACT_RING;
+ * channels 1.. have their rings, each 4KB aligned, after the table page at
+ * the front of the region. ZENEDGE writes the table at init (magic last)
+ * and flips a channel to IPC_CHAN_OPEN once its rings are attached.
+ * Build with -DIPC_STREAM_CHANNELS=N (both sides size the region from it).
+ */
+#define IPC_CHAN_MAGIC          0x4E414843  /* "CHAN" */
+#define IPC_STREAM_CHANNELS_MAX 16
+#ifndef IPC_STREAM_CHANNELS
+#define IPC_STREAM_CHANNELS     4
+#endif
+#define IPC_CHAN_CLOSED         0
+#define IPC_CHAN_OPEN           1
+#define IPC_CHAN_CPU_ANY        0xFFFFFFFFu
+#define IPC_ACT_ENTRY_SIZE      16u
+
+/* One ring of `entries` slots, rounded up to whole pages */
+#define IPC_CHAN_RING_BYTES(entries, entry_size)                              \
+  ((IPC_RING_HDR_SIZE + (uint32_t)(entries) * (uint32_t)(entry_size) +        \
+    IPC_LAYOUT_ALIGN - 1) & ~(uint32_t)(IPC_LAYOUT_ALIGN - 1))
+/* Table page plus the rings of channels 1..chans-1 */
+#define IPC_CHAN_REGION_BYTES(chans, entries, obs_entry_size)                 \
+  (IPC_LAYOUT_ALIGN + ((uint32_t)(chans) - 1) *                               \
+   (IPC_CHAN_RING_BYTES(entries, obs_entry_size) +                            \
+    IPC_CHAN_RING_BYTES(entries, IPC_ACT_ENTRY_SIZE)))
+
+typedef struct {
+  volatile uint32_t state;  /* IPC_CHAN_* */
+  uint32_t id;              /* Channel number */
+  volatile uint32_t job_id; /* Owning job (0 = unowned) */
+  volatile uint32_t cpu;    /* Core affinity (IPC_CHAN_CPU_ANY) */
+  uint32_t obs_offset;      /* From the start of shared memory */
+  uint32_t obs_size;
+  uint32_t act_offset;
+  uint32_t act_size;
+  uint32_t reserved[8];
+} ipc_stream_chan_t;        /* One cache line per channel */
+
+typedef struct {
+  uint32_t magic;           /* IPC_CHAN_MAGIC, written last */
+  uint32_t count;           /* Valid entries in chans[] */
+  uint32_t reserved[14];
+  ipc_stream_chan_t chans[IPC_STREAM_CHANNELS_MAX];
+} ipc_stream_chan_table_t;
+
+/* Depth of the kernel's stream rings; a power of two no larger than the
+ * smallest layout's stream region (IPC_OBS_RING_SIZE entries).
+ */
+#ifndef IPC_STREAM_DEPTH
+#define IPC_STREAM_DEPTH     IPC_OBS_RING_SIZE
+#endif
+
+/* Overflow policy of the kernel's obs ring (IPC_RING_POLICY_*, below).
+ * LATEST keeps the control loop on the freshest observation; vectorized
+ * envs need FIFO, since every batch entry matters.
+ */
+#ifndef IPC_OBS_POLICY
+#define IPC_OBS_POLICY       IPC_RING_POLICY_FIFO
+#endif
+
 /* =============================================================================
  * DOORBELL MECHANISM - Low-latency interrupt signaling
  * =============================================================================
@@ -60,10 +235,27 @@
  *   2. Linux writes to rsp_doorbell (value = ring head)
  *   3. ZENEDGE receives IRQ (if enabled)
  *   4. ZENEDGE processes responses up to doorbell value
+ *
+ * Hardware doorbells are coalesced: the bridge sets DOORBELL_FLAG_IRQ_ENABLED
+ * in cmd_flags only when it has found the ring empty and is about to block on
+ * its ivshmem eventfd. ZENEDGE test-and-clears the flag on send, so one BAR0
+ * doorbell write covers the empty -> non-empty edge; while the bridge is
+ * busy it is only kicked every IPC_DOORBELL_BATCH packets or
+ * IPC_DOORBELL_MAX_US microseconds as a backstop.
  */
 
 #define IPC_DOORBELL_MAGIC 0x444F4F52  /* "DOOR" */
 
+/* Protocol versions (doorbell_ctl_t.version)
+ * ZENEDGE writes the ring layout it created into 'version'; the bridge
+ * attaches only if it speaks that layout and acks by writing the same
+ * value into 'peer_version'.
+ */
+#define IPC_PROTO_VERSION_V1 1  /* Packed header, modulo indices */
+#define IPC_PROTO_VERSION_V2 2  /* Cache-line split, free-running indices */
+#define IPC_PROTO_VERSION_V3 3  /* v2 rings + 24-byte tagged packets */
+#define IPC_PROTO_VERSION    IPC_PROTO_VERSION_V3
+
 /* Doorbell flags */
 #define DOORBELL_FLAG_IRQ_ENABLED  0x01  /* Enable IRQ on doorbell write */
 #define DOORBELL_FLAG_PENDING      0x02  /* IRQ pending (set by writer, cleared by reader) */
@@ -71,7 +263,7 @@
 /* Doorbell control block (256 bytes at IPC_DOORBELL_OFFSET) */
 typedef struct {
   uint32_t magic;           /* IPC_DOORBELL_MAGIC */
-  uint32_t version;         /* Protocol version (1) */
+  uint32_t version;         /* Ring layout offered by ZENEDGE (IPC_PROTO_VERSION) */
 
   /* Command doorbell (ZENEDGE -> Linux) */
   volatile uint32_t cmd_doorbell;   /* Written by ZENEDGE: cmd_ring head */
@@ -87,26 +279,91 @@ typedef struct {
   volatile uint32_t cmd_writes;     /* Total cmd doorbell writes */
   volatile uint32_t rsp_writes;     /* Total rsp doorbell writes */
 
-  uint32_t reserved[54];            /* Pad to 256 bytes */
+  volatile uint32_t peer_version;   /* Written by Linux: layout it attached with */
+
+  /* ivshmem peer IDs (IVPosition + 1, 0 = no hardware doorbell). Each side
+   * publishes its own so the other can target BAR0 doorbell writes /
+   * eventfds at it.
+   */
+  volatile uint32_t zen_peer_id;    /* Written by ZENEDGE */
+  volatile uint32_t bridge_peer_id; /* Written by Linux */
+
+  /* WASM profiling control, written by Linux and polled by ZENEDGE off
+   * the control path (episode boundaries)
+   */
+  volatile uint32_t wasm_prof_mode; /* IPC_WASM_PROF_* mask, 0 = off */
+  volatile uint32_t wasm_prof_dump; /* Bump to request a CMD_WASM_PROFILE */
+
+  uint32_t reserved[49];            /* Pad to 256 bytes */
 } doorbell_ctl_t;
 
 /* Heap block sizes (power of 2, minimum 64 bytes) */
 #define HEAP_BLOCK_SHIFT     6        /* 64 byte minimum block */
 #define HEAP_BLOCK_SIZE      (1 << HEAP_BLOCK_SHIFT)
-#define HEAP_MAX_BLOCKS      (IPC_HEAP_DATA_SIZE / HEAP_BLOCK_SIZE)
+#define HEAP_MAX_BLOCKS      (IPC_HEAP_DATA_SIZE / HEAP_BLOCK_SIZE)  /* Fixed layout */
 
 /* Command IDs (0x0000-0x7FFF) */
 #define CMD_PING      0x0001
 #define CMD_PRINT     0x0002
 #define CMD_RUN_MODEL 0x0010
+#define CMD_AGENT_LOAD 0x0011 /* Result: blob/bulk id of the wasm agent, 0 = none */
+#define CMD_WASM_PROFILE 0x0012 /* Payload: blob holding a WASM profile dump */
+#define CMD_RUN_MODEL_BATCH 0x0013 /* Payload: blob holding an ipc_run_batch_t */
+#define CMD_BOOT_PROFILE 0x0014 /* Payload: blob holding the boot phase profile */
+#define CMD_BENCH_RESULTS 0x0015 /* Payload: blob holding shell bench results */
+#define CMD_PROF_SAMPLES 0x0016 /* Payload: blob holding sampling profiler records */
 #define CMD_ENV_RESET 0x0100
 #define CMD_ENV_STEP  0x0101
+#define CMD_ENV_BENCH 0x0102 /* Inline: ipc_env_bench_t, control-loop benchmark */
 #define CMD_IFR_PERSIST 0x0200
 #define CMD_ARB_EPISODE 0x0201
 #define CMD_TELEMETRY_POLL 0x0300
+#define CMD_ACT_APPLY 0x0301 /* Inline: actuator settings for one device */
+#define CMD_JOB_SUBMIT 0x0400 /* Job ring entry (bridge -> ZENEDGE): a flat job graph blob */
+#define CMD_JOB_STATUS 0x0401 /* Inline: ipc_job_status_t, how a submitted job ended */
+
+/* CMD_ACT_APPLY (message ring): arg = device index, payload = up to
+ * IPC_ACT_MAX_SETTINGS ipc_act_setting_t, applied in order. On RSP_OK
+ * the result is how many microseconds before the reply the last setting
+ * took effect (so ZENEDGE can place it on its own clock); on RSP_ERROR
+ * it is a mask of the settings that failed.
+ */
+#define IPC_ACT_MAX_SETTINGS 16
+#define IPC_ACT_KNOB_CLOCK_MHZ 1
+#define IPC_ACT_KNOB_POWER_W   2
+
+typedef struct {
+  uint16_t knob;     /* IPC_ACT_KNOB_* */
+  uint16_t reserved;
+  uint32_t value;
+} ipc_act_setting_t;
 
 /* CMD_ENV_RESET payload flags */
-#define ENV_RESET_FLAG_STREAM 0x00000001u
+#define ENV_RESET_FLAG_STREAM   0x00000001u
+#define ENV_RESET_FLAG_PIPELINE 0x00000002u  /* Vector stepped in two groups */
+
+/* CMD_ENV_RESET payload: [15:0] flags, [31:16] env count (0 = 1)
+ * With more than one env (streaming only) the bridge runs a vector of
+ * environments: every step moves one batch of `envs` obs entries, env i at
+ * position i, published with a single head update, and takes back a batch
+ * of `envs` actions in the same order. Finished envs reset themselves and
+ * report done in their entry; ZENEDGE does not send another reset.
+ *
+ * ENV_RESET_FLAG_PIPELINE splits the vector into two groups, envs
+ * [0, ENV_PIPELINE_SPLIT(envs)) and the rest, taking turns: the bridge
+ * steps and publishes a group as soon as its actions are in, so it steps
+ * one while ZENEDGE infers the other. The reset still publishes the whole
+ * vector; obs and actions then alternate group by group, in env order
+ * within each. A bridge may ignore the flag and step whole batches.
+ */
+#define ENV_RESET_FLAGS_MASK  0x0000FFFFu
+#define ENV_RESET_ENVS_SHIFT  16
+#define ENV_RESET_PACK(flags, envs) \
+  ((((uint32_t)(envs)) << ENV_RESET_ENVS_SHIFT) | ((uint32_t)(flags) & ENV_RESET_FLAGS_MASK))
+#define ENV_RESET_UNPACK_ENVS(payload) \
+  (((payload) >> ENV_RESET_ENVS_SHIFT) ? ((uint32_t)(payload) >> ENV_RESET_ENVS_SHIFT) : 1u)
+#define IPC_VEC_ENVS_MAX      IPC_STREAM_DEPTH  /* A batch fits in the ring */
+#define ENV_PIPELINE_SPLIT(envs) (((envs) + 1) / 2)  /* Envs in group 0 */
 
 /* CMD_ENV_STEP payload encoding (single-trip control loop)
  * [31:16] = ack blob id (uint16_t)
@@ -119,6 +376,36 @@ typedef struct {
 #define ENV_STEP_UNPACK_ACTION(payload) ((uint16_t)((payload) & ENV_STEP_ACTION_MASK))
 #define ENV_STEP_UNPACK_ACK(payload)    ((uint16_t)((payload) >> ENV_STEP_ACK_SHIFT))
 
+/* CMD_ENV_BENCH (message ring): a GYM_BENCH build's control loop sends one
+ * when its warmup is over (flags without IPC_ENV_BENCH_DONE, counters 0)
+ * and one after `steps` measured env steps with its side of the numbers,
+ * then stops. The bridge times the same window from the first message:
+ * obs publish -> action consume per step, steps, its own CPU time.
+ */
+#define IPC_ENV_BENCH_MAGIC   0x48434245  /* "EBCH" */
+#define IPC_ENV_BENCH_VERSION 1
+
+#define IPC_ENV_BENCH_STREAM  0x01  /* Stream rings, else CMD_ENV_STEP blobs */
+#define IPC_ENV_BENCH_DONE    0x02  /* The window is over: figures are final */
+#define IPC_ENV_BENCH_PIPELINE 0x04 /* Vector stepped in two groups */
+
+/* Percentile sets below: p50, p90, p99, max */
+#define IPC_ENV_BENCH_PCTS    4
+
+typedef struct {
+  uint32_t magic;       /* IPC_ENV_BENCH_MAGIC */
+  uint32_t version;     /* IPC_ENV_BENCH_VERSION */
+  uint32_t flags;       /* IPC_ENV_BENCH_* */
+  uint32_t envs;        /* Env steps per loop iteration */
+  uint32_t steps;       /* Env steps measured (a multiple of envs) */
+  uint32_t episodes;    /* Episodes finished in them */
+  uint64_t elapsed_us;  /* Length of the window */
+  uint64_t spin_us;     /* Of it, waiting for the bridge busy-polling */
+  uint64_t sleep_us;    /* Of it, waiting halted (hlt / mwait) */
+  uint32_t period_ns[IPC_ENV_BENCH_PCTS]; /* Loop iteration period */
+  uint32_t infer_ns[IPC_ENV_BENCH_PCTS];  /* Obs in hand -> action sent */
+} ipc_env_bench_t;  /* 80 bytes */
+
 /* Response IDs (0x8000-0xFFFF) - high bit set indicates response */
 #define RSP_OK        0x8000
 #define RSP_ERROR     0x8001
@@ -127,59 +414,143 @@ typedef struct {
 /* Flag bits */
 #define FLAG_IRQ_ON_COMPLETE 0x0001  /* Request interrupt on completion */
 
-/* Command Packet Structure (16 bytes) */
+/* Request tags (protocol v3)
+ * Every command carries a tag that the bridge echoes back unchanged in its
+ * response, so several requests with the same cmd can be in flight at once.
+ * Tag 0 means "untagged" (matched on orig_cmd only, as before v3).
+ */
+#define IPC_TAG_NONE 0u
+
+/* Command Packet Structure (24 bytes) */
 typedef struct {
   uint16_t cmd;        /* Command ID */
   uint16_t flags;      /* Flags (e.g., FLAG_IRQ_ON_COMPLETE) */
   uint32_t payload_id; /* ID of data/model in shared heap */
   uint64_t timestamp;  /* Timestamp for latency tracking */
+  uint32_t tag;        /* Request tag (IPC_TAG_NONE if untagged) */
+  uint32_t reserved;
 } ipc_packet_t;
 
-/* Response Packet Structure (16 bytes) */
+/* Response Packet Structure (24 bytes) */
 typedef struct {
   uint16_t status;     /* Response status (RSP_OK, RSP_ERROR, etc.) */
   uint16_t orig_cmd;   /* Original command this responds to */
   uint32_t result;     /* Result value or error code */
   uint64_t timestamp;  /* Completion timestamp */
+  uint32_t tag;        /* Echo of ipc_packet_t.tag */
+  uint32_t reserved;
 } ipc_response_t;
 
-/* Ring Buffer Header (Shared Memory Control Block)
- * Located at start of each ring region.
+/* Ring Buffer Header (Shared Memory Control Block), protocol v2
+ * Located at start of each ring region (command, response and stream).
+ *
+ * The producer and consumer indices live on separate 64-byte cache lines so
+ * the two sides never write the same line. Indices are free-running 32-bit
+ * counters; the slot is (index & mask) with size a power of two, so the ring
+ * is empty when head == tail and full when head - tail == size.
+ *
+ * v1 (doorbell version 1) used a packed 32-byte header
+ * {magic, head, tail, size, reserved[4]} with modulo-wrapped indices.
  */
+#define IPC_CACHE_LINE 64
+
 typedef struct {
+  /* Line 0: written once at init */
   uint32_t magic;       /* Magic Signature */
-  uint32_t head;        /* Producer Index */
-  uint32_t tail;        /* Consumer Index */
-  uint32_t size;        /* Size of ring (IPC_RING_SIZE) */
-  uint32_t reserved[4]; /* Padding/Reserved */
+  uint32_t version;     /* IPC_PROTO_VERSION */
+  uint32_t size;        /* Entry count (power of two) */
+  uint32_t mask;        /* size - 1 */
+  uint32_t flags;       /* IPC_RING_FLAG_* */
+  uint32_t entry_size;  /* Stream rings: bytes per entry (0 = implied by type) */
+  uint32_t obs_dim;     /* Obs stream ring: floats per observation */
+  uint32_t reserved0[9];
+
+  /* Line 1: producer-owned */
+  volatile uint32_t head; /* Free-running Producer Index */
+  uint32_t overruns;      /* Stream rings: stalls (FIFO) or entries overwritten */
+  uint32_t max_occupancy; /* Stream rings: high-water mark of head - tail */
+  volatile uint32_t clock_seq; /* Obs stream ring: bumped after clock_ns is set */
+  volatile uint64_t clock_ns;  /* Obs stream ring: producer clock at ENV_RESET */
+  uint32_t lost;          /* Trace ring: events gone before they were exported */
+  uint32_t reserved1[9];
+
+  /* Line 2: consumer-owned */
+  volatile uint32_t tail; /* Free-running Consumer Index */
+  uint32_t drops;         /* Stream rings: entries skipped unread */
+  uint32_t reserved2[14];
+} __attribute__((aligned(IPC_CACHE_LINE))) ipc_ring_hdr_t;
+
+/* Ring flags (ipc_ring_hdr_t.flags)
+ *
+ * IPC_RING_FLAG_MPSC: multi-producer command ring. A uint32_t sequence
+ * array (one per slot) follows data[] (see IPC_RING_SEQ()). Producers claim
+ * slots by CAS on 'head', so 'head' can run ahead of what is published; the
+ * consumer must instead wait for seq[pos & mask] == pos + 1, and releases
+ * a slot by writing seq = pos + size before advancing 'tail'.
+ * Slot i starts with seq = i.
+ */
+#define IPC_RING_FLAG_MPSC     0x00000001u
+
+/* Stream ring overflow policy (flags bits 2:1), set by whoever inits the
+ * ring:
+ * FIFO:        the producer refuses to push while full (one overrun per
+ *              stall).
+ * DROP_OLDEST: the producer never blocks and overwrites the oldest unread
+ *              entries (one overrun each); a lapped consumer skips ahead to
+ *              the newer half of the ring, counting skipped entries as drops.
+ * LATEST:      as DROP_OLDEST for the producer, but the consumer always
+ *              takes the newest entry and drops everything older.
+ * In the overwrite modes the consumer re-reads head after copying a slot
+ * and retries if the producer may have overwritten it meanwhile.
+ */
+#define IPC_RING_POLICY_SHIFT       1
+#define IPC_RING_POLICY_MASK        (3u << IPC_RING_POLICY_SHIFT)
+#define IPC_RING_POLICY_FIFO        (0u << IPC_RING_POLICY_SHIFT)
+#define IPC_RING_POLICY_DROP_OLDEST (1u << IPC_RING_POLICY_SHIFT)
+#define IPC_RING_POLICY_LATEST      (2u << IPC_RING_POLICY_SHIFT)
+
+#define IPC_RING_HDR_SIZE      (3 * IPC_CACHE_LINE)
+#define IPC_RING_HEAD_OFFSET   (1 * IPC_CACHE_LINE)
+#define IPC_RING_TAIL_OFFSET   (2 * IPC_CACHE_LINE)
+
+/* Command ring: ZENEDGE produces, Linux consumes */
+typedef struct {
+  ipc_ring_hdr_t hdr;
   ipc_packet_t data[];  /* Ring Data */
 } ipc_ring_t;
 
+/* Per-slot sequence array of an MPSC command ring */
+#define IPC_RING_SEQ(ring) \
+  ((volatile uint32_t *)&(ring)->data[(ring)->hdr.size])
+
 /* Response Ring uses same header but different data type */
 typedef struct {
-  uint32_t magic;       /* Magic Signature (IPC_RSP_MAGIC) */
-  uint32_t head;        /* Producer Index (Written by Linux) */
-  uint32_t tail;        /* Consumer Index (Written by ZENEDGE) */
-  uint32_t size;        /* Size of ring (IPC_RING_SIZE) */
-  uint32_t reserved[4]; /* Padding/Reserved */
+  ipc_ring_hdr_t hdr;
   ipc_response_t data[];/* Ring Data */
 } ipc_rsp_ring_t;
 
-/* Stream ring header (same layout as command ring header) */
+/* Stream ring header (entries follow the header) */
+typedef ipc_ring_hdr_t stream_ring_t;
+
+/* Variable-length message ring (see IPC_MSG_MAGIC) */
 typedef struct {
-  uint32_t magic;       /* IPC_STREAM_MAGIC */
-  uint32_t head;        /* Producer Index */
-  uint32_t tail;        /* Consumer Index */
-  uint32_t size;        /* Entry count */
-  uint32_t reserved[4]; /* Padding/Reserved */
-} stream_ring_t;
+  ipc_ring_hdr_t hdr;
+  uint8_t data[];
+} ipc_msg_ring_t;
 
+/* Stream entries carry their producer's publish time in its own clock.
+ * Clock sync: while answering CMD_ENV_RESET the bridge writes its
+ * CLOCK_MONOTONIC ns into the obs ring's clock_ns and then bumps
+ * clock_seq; ZENEDGE pins that to the midpoint of the TSC at send and at
+ * response, which bounds the offset error by half the round trip.
+ */
 typedef struct {
   uint32_t seq;     /* Monotonic step id */
-  float    obs[4];  /* Observation vector */
+  float    obs[IPC_OBS_DIM]; /* Observation vector */
   float    reward;
   float    done;
   float    model_id;/* Blob id (float32 for compatibility) */
+  uint32_t ts;      /* Publish time: bridge CLOCK_MONOTONIC ns, low 32 bits */
 } obs_entry_t;
 
 typedef struct {
@@ -187,7 +558,7 @@ typedef struct {
   uint16_t action;  /* Discrete action */
   uint16_t flags;   /* Reserved */
   uint32_t ack_seq; /* Optional ack of last obs */
-  uint32_t reserved;
+  uint32_t ts;      /* Publish time: ZENEDGE TSC, low 32 bits */
 } action_entry_t;
 
 typedef struct __attribute__((packed)) {
@@ -197,6 +568,550 @@ typedef struct __attribute__((packed)) {
   float numa_locality;
 } telemetry_snapshot_t;
 
+/* =============================================================================
+ * TELEMETRY PAGE (seqlock, Linux -> ZENEDGE)
+ * =============================================================================
+ * The bridge republishes the latest snapshot here continuously, so ZENEDGE
+ * reads fresh telemetry with no command round-trip. Located by
+ * IPC_REGION_TELEMETRY (IPC_TELEMETRY_OFFSET in the fixed 1MB layout).
+ *
+ * Writer: seq++ (odd), write snap, seq++ (even).
+ * Reader: retry while seq is odd or changed across the copy.
+ */
+#define IPC_TELEMETRY_OFFSET 0x10F00
+#define IPC_TELEMETRY_MAGIC  0x54454C4D /* "TELM" */
+
+typedef struct {
+  uint32_t magic;              /* IPC_TELEMETRY_MAGIC once the bridge publishes */
+  uint32_t seq;                /* Seqlock sequence (odd = update in progress) */
+  uint64_t publish_count;      /* Updates since the bridge attached */
+  telemetry_snapshot_t snap;   /* snap.ts_usec: bridge clock at publish */
+  uint8_t  reserved[28];       /* Pad to one cache line */
+} ipc_telemetry_page_t;        /* 64 bytes */
+
+/* =============================================================================
+ * STATISTICS PAGE (seqlock, ZENEDGE -> Linux, IPC_REGION_STATS)
+ * =============================================================================
+ * Kernel counters the bridge can read at any rate without a command: ring
+ * depths and doorbells, heap, memory, scheduler, contracts, inference and
+ * caches. Nothing on a hot path writes here; the main loop copies each
+ * subsystem's own counters in at most every period_us, so a scrape costs
+ * the kernel nothing and sees values at most that old.
+ *
+ * Writer: seq++ (odd), write sections, seq++ (even).
+ * Reader: retry while seq is odd or changed across the copy.
+ *
+ * Sections the kernel does not have (the i386/x86_64 builds differ) are
+ * left zero with their IPC_STATS_HAS_* bit clear. Fields are only ever
+ * added in reserved space or at the end: readers check size and version.
+ */
+#define IPC_STATS_MAGIC     0x5354534B  /* "KSTS" */
+#define IPC_STATS_VERSION   1
+#define IPC_STATS_PERIOD_US 10000       /* Default refresh interval */
+#define IPC_STATS_CPUS      8
+#define IPC_STATS_PRIOS     4           /* Run-queue lengths by contract priority */
+#define IPC_STATS_CONTRACTS 16          /* Registered contracts listed */
+
+/* ipc_stats_page_t.present bits */
+#define IPC_STATS_HAS_IPC      0x01
+#define IPC_STATS_HAS_HEAP     0x02
+#define IPC_STATS_HAS_MEM      0x04
+#define IPC_STATS_HAS_TRACE    0x08
+#define IPC_STATS_HAS_SCHED    0x10
+#define IPC_STATS_HAS_CONTRACT 0x20
+#define IPC_STATS_HAS_INFER    0x40
+
+typedef struct {
+  uint32_t cmd_pending;        /* Command ring entries the bridge has not taken */
+  uint32_t cmd_depth;          /* Command ring slots */
+  uint32_t rsp_pending;        /* Responses the kernel has not taken */
+  uint32_t rsp_depth;
+  uint32_t cmd_doorbells;      /* doorbell_ctl_t.cmd_writes */
+  uint32_t rsp_doorbells;      /* doorbell_ctl_t.rsp_writes */
+  uint32_t irqs;               /* Doorbell interrupts taken */
+  uint32_t kicks_sent;         /* Bridge eventfd kicks */
+  uint32_t kicks_coalesced;    /* Packets sent without one */
+  uint32_t spin_hits;          /* Response waits ended while spinning */
+  uint32_t spin_misses;        /* ... after falling back to sleep */
+  uint32_t mode_switches;      /* Poll <-> IRQ */
+  uint32_t stream_timeouts;    /* Stream ring waits that timed out */
+  uint32_t stream_wait_max_us; /* Worst stream wake latency */
+  uint64_t spin_us;            /* Response and stream waits, busy-polling */
+  uint64_t sleep_us;           /* ... and halted */
+} ipc_stats_ipc_t;             /* 72 bytes */
+
+typedef struct {
+  uint32_t total_bytes;        /* Kernel arena */
+  uint32_t free_bytes;
+  uint32_t largest_free_bytes;
+  uint32_t peer_largest_free_bytes; /* Bridge arena */
+  uint32_t blobs;
+  uint32_t alloc_failures;     /* All size classes */
+  uint32_t compact_moves;
+  uint32_t frag_permille;      /* Free bytes outside the largest chunk */
+} ipc_stats_heap_t;            /* 32 bytes */
+
+typedef struct {
+  uint32_t pmm_total_kb;
+  uint32_t pmm_free_kb;
+  uint32_t pmm_reserved_kb;
+  uint32_t pmm_cached_pages;   /* Free in per-CPU magazines */
+  uint32_t kheap_total_bytes;
+  uint32_t kheap_free_bytes;
+  uint32_t kheap_largest_free;
+  uint32_t kheap_frag_permille;
+  uint32_t kheap_allocs;
+  uint32_t kheap_frees;
+  uint32_t kheap_failures;
+  uint32_t reserved;
+} ipc_stats_mem_t;             /* 48 bytes */
+
+typedef struct {
+  uint64_t switches;
+  uint64_t preemptions;
+  uint64_t starved;            /* Picked by the starvation guard */
+  uint64_t timer_irqs;
+  uint32_t switches_per_sec;
+  uint32_t rq_latency_avg_us;
+  uint32_t rq_latency_max_us;
+  uint32_t blocked;
+  uint32_t rq_len[IPC_STATS_PRIOS];
+} ipc_stats_sched_t;           /* 64 bytes */
+
+typedef struct {
+  uint32_t requests;           /* CMD_RUN_MODEL requests batched */
+  uint32_t direct;             /* ... sent on their own */
+  uint32_t batches;
+  uint32_t failed;
+  uint32_t max_batch;
+  uint32_t model_hits;         /* WASM model cache */
+  uint32_t model_misses;
+  uint32_t model_evictions;
+  uint32_t model_entries;
+  uint32_t model_copy_bytes;
+  uint32_t memo_lookups;       /* Step memo cache */
+  uint32_t memo_hits;
+  uint32_t memo_inserts;
+  uint32_t memo_evictions;
+  uint32_t policy_lookups;     /* Policy cache, models with a grid */
+  uint32_t policy_hits;
+} ipc_stats_infer_t;           /* 64 bytes */
+
+typedef struct {
+  uint32_t flightrec_cats;     /* TRACE_CAT_* being recorded */
+  uint32_t klog_dropped;
+  uint32_t cpus;               /* Valid entries of ipc_stats_page_t.cpu */
+  uint32_t reserved;
+} ipc_stats_trace_t;           /* 16 bytes */
+
+typedef struct {
+  uint32_t online;
+  uint32_t trace_dropped;      /* Flight recorder events overwritten unread */
+  uint64_t idle_wakeups;
+  uint64_t trace_events;
+} ipc_stats_cpu_t;             /* 24 bytes */
+
+typedef struct {
+  uint32_t job_id;
+  uint32_t state;              /* CONTRACT_STATE_* */
+  uint32_t prio;               /* CONTRACT_PRIORITY_* */
+  uint32_t cpu_used_us;        /* Per-CPU charges included */
+  uint32_t cpu_budget_us;
+  uint32_t mem_used_kb;
+  uint32_t mem_budget_kb;
+  uint32_t violations;         /* CPU and memory */
+} ipc_stats_contract_t;        /* 32 bytes */
+
+typedef struct {
+  uint32_t magic;              /* IPC_STATS_MAGIC once the kernel publishes */
+  uint32_t version;            /* IPC_STATS_VERSION */
+  uint32_t size;               /* sizeof(ipc_stats_page_t) */
+  uint32_t present;            /* IPC_STATS_HAS_* */
+  uint32_t seq;                /* Seqlock sequence (odd = update in progress) */
+  uint32_t period_us;          /* Refresh interval */
+  uint32_t tsc_khz;
+  uint32_t reserved0;
+  uint64_t publish_count;
+  uint64_t usec;               /* time_usec() at the last refresh */
+  uint32_t reserved[4];
+
+  ipc_stats_ipc_t ipc;         /* Offset 64 */
+  ipc_stats_heap_t heap;       /* 136 */
+  ipc_stats_mem_t mem;         /* 168 */
+  ipc_stats_sched_t sched;     /* 216 */
+  ipc_stats_infer_t infer;     /* 280 */
+  ipc_stats_trace_t trace;     /* 344 */
+  ipc_stats_cpu_t cpu[IPC_STATS_CPUS]; /* 360 */
+  uint32_t contracts_registered;
+  uint32_t contracts_listed;   /* Valid entries of contract */
+  ipc_stats_contract_t contract[IPC_STATS_CONTRACTS]; /* 560 */
+} ipc_stats_page_t;            /* 1072 bytes */
+
+/* =============================================================================
+ * BULK RING (bridge -> ZENEDGE, IPC_REGION_BULK)
+ * =============================================================================
+ * Chunked upload of payloads too big for the shared heap (model weights).
+ * Chunks are copied out into kernel pages, so a load never holds heap space
+ * and the control rings keep flowing while it runs.
+ *
+ * Credit flow control: the bridge writes total_size and head = 0, then a
+ * new xfer_id. ZENEDGE accepts once it has pages for the whole payload,
+ * setting status, credit and finally accepted = xfer_id. The bridge may
+ * publish chunk n only while n < credit; ZENEDGE keeps credit at tail +
+ * slots, so with two slots the bridge fills one while ZENEDGE drains the
+ * other. Refused offers get credit 0 and an error status.
+ */
+#define IPC_BULK_MAGIC       0x524B4C42  /* "BLKR" */
+#define IPC_BULK_CHUNK_SIZE  16384
+#define IPC_BULK_SLOTS       2           /* Minimum: double buffering */
+#define IPC_BULK_MAX_SIZE    (16u << 20) /* Per transfer */
+
+/* Model ids at or above this name bulk-loaded weights, not heap blobs */
+#define IPC_BULK_MODEL_BASE  0x10000
+
+/* Transfer status (ipc_bulk_ring_t.status) */
+#define IPC_BULK_IDLE        0
+#define IPC_BULK_OPEN        1  /* Accepted: chunks flowing */
+#define IPC_BULK_DONE        2  /* All chunks landed; model_id is valid */
+#define IPC_BULK_NOMEM       3  /* Refused: no pages for the payload */
+#define IPC_BULK_INVALID     4  /* Refused: bad size or a chunk out of order */
+
+typedef struct {
+  /* Line 0: written once at init by ZENEDGE */
+  uint32_t magic;       /* IPC_BULK_MAGIC */
+  uint32_t slots;       /* Chunk slots after the header */
+  uint32_t chunk_size;  /* IPC_BULK_CHUNK_SIZE */
+  uint32_t reserved0[13];
+
+  /* Line 1: bridge-owned */
+  volatile uint32_t xfer_id;    /* New nonzero value offers a transfer */
+  volatile uint32_t total_size; /* Payload bytes, written before xfer_id */
+  volatile uint32_t head;       /* Chunks published in this transfer */
+  uint32_t reserved1[13];
+
+  /* Line 2: kernel-owned */
+  volatile uint32_t accepted;   /* xfer_id that status describes */
+  volatile uint32_t status;     /* IPC_BULK_* */
+  volatile uint32_t credit;     /* Bridge may publish while head < credit */
+  volatile uint32_t tail;       /* Chunks copied out */
+  volatile uint32_t model_id;   /* IPC_BULK_DONE: id naming the payload */
+  uint32_t reserved2[11];
+} __attribute__((aligned(IPC_CACHE_LINE))) ipc_bulk_ring_t;
+
+typedef struct {
+  uint32_t xfer_id;  /* Transfer the chunk belongs to */
+  uint32_t index;    /* Chunk number within it (slot = index % slots) */
+  uint32_t len;      /* Payload bytes: chunk_size except the last chunk */
+  uint32_t reserved;
+  uint8_t  data[IPC_BULK_CHUNK_SIZE];
+} ipc_bulk_chunk_t;
+
+/* =============================================================================
+ * JOB SUBMISSION RING (bridge -> ZENEDGE, IPC_REGION_JOBS)
+ * =============================================================================
+ * Job graphs from the host, without rebuilding the kernel. The bridge
+ * writes a graph into a BLOB_TYPE_JOB blob in the flat format below, seals
+ * it and pushes an ipc_job_submit_t (cmd = CMD_JOB_SUBMIT) onto this
+ * ring: an SPSC ring with the common header (entry_size =
+ * sizeof(ipc_job_submit_t)) that the bridge produces into and ZENEDGE drains
+ * from its main loop, up to a batch of submissions at a time.
+ *
+ * ZENEDGE checks the blob where it lies, builds the job from it in one
+ * pass, runs admission control against the contract it carries and runs
+ * the admitted jobs of the batch together, then answers every submission
+ * with a CMD_JOB_STATUS message (arg = the blob, ipc_job_status_t inline).
+ * The blob stays the bridge's; ZENEDGE is done reading it before it runs
+ * the job, and the bridge frees or reuses it once the status is in.
+ * Job ids share the namespace of contracts the kernel registers itself.
+ *
+ * Flat graph, little endian, offsets from the start of the blob's data,
+ * each array 4-byte aligned and inside hdr.size:
+ *   ipc_job_graph_t                   header, with the job's contract
+ *   ipc_job_step_t  [num_steps]       at steps_off
+ *   uint32_t        [num_steps + 1]   at dep_off: step i waits on the
+ *                                     parents dep_idx[dep_off[i] ..
+ *                                     dep_off[i + 1]), CSR by step
+ *   uint32_t        [num_deps]        at dep_idx_off: parent step indices
+ *   ipc_job_tensor_t[num_tensors]     at tensors_off
+ * Steps name tensors by id; a COMPUTE step's first input id is also the
+ * heap blob it hands the bridge (as for jobs built in the kernel).
+ */
+#define IPC_JOBQ_MAGIC        0x4A4F4251  /* "JOBQ" */
+#define IPC_JOB_GRAPH_MAGIC   0x4A475048  /* "JGPH" */
+#define IPC_JOB_GRAPH_VERSION 1
+#define IPC_JOB_SLOTS         64
+
+/* Per graph, at most */
+#define IPC_JOB_MAX_STEPS     4096
+#define IPC_JOB_MAX_DEPS      16384
+#define IPC_JOB_MAX_TENSORS   4096
+#define IPC_JOB_STEP_INPUTS   4           /* MAX_STEP_INPUTS */
+#define IPC_JOB_STEP_OUTPUTS  2           /* MAX_STEP_OUTPUTS */
+
+/* ipc_job_step_t.flags */
+#define IPC_JOB_STEP_MEMOIZE  0x01        /* Reuse results (sched/step_memo.h) */
+
+/* ipc_job_status_t.state */
+#define IPC_JOB_DONE          1  /* Admitted and ran to the end */
+#define IPC_JOB_REJECTED      2  /* Admission control: admit says why */
+#define IPC_JOB_INVALID       3  /* Bad blob, format, ids, or a cycle */
+#define IPC_JOB_NOMEM         4  /* No kernel memory to build it */
+
+typedef struct {
+  uint16_t cmd;         /* CMD_JOB_SUBMIT */
+  uint16_t blob_id;     /* BLOB_TYPE_JOB blob holding the graph */
+  uint32_t tag;         /* Echoed in ipc_job_status_t.tag */
+} ipc_job_submit_t;     /* 8 bytes */
+
+typedef struct {
+  uint32_t cpu_budget_us;
+  uint32_t memory_kb;
+  uint32_t deadline_us;   /* REALTIME: from when it is taken, 0 = none */
+  uint8_t  prio;          /* CONTRACT_PRIORITY_* */
+  uint8_t  preferred_node;
+  uint8_t  max_inflight;  /* Steps at once, 0 = SCHED_MAX_INFLIGHT */
+  uint8_t  reserved;
+} ipc_job_contract_t;     /* 16 bytes */
+
+typedef struct {
+  uint32_t magic;         /* IPC_JOB_GRAPH_MAGIC */
+  uint32_t version;       /* IPC_JOB_GRAPH_VERSION */
+  uint32_t size;          /* Bytes of graph, header included */
+  uint32_t job_id;
+  uint32_t num_steps;
+  uint32_t num_deps;
+  uint32_t num_tensors;
+  uint32_t steps_off;
+  uint32_t dep_off;
+  uint32_t dep_idx_off;
+  uint32_t tensors_off;
+  uint32_t reserved;
+  ipc_job_contract_t contract;
+} ipc_job_graph_t;        /* 64 bytes */
+
+typedef struct {
+  uint32_t id;
+  uint8_t  type;          /* STEP_TYPE_* */
+  uint8_t  flags;         /* IPC_JOB_STEP_* */
+  uint8_t  coll_op;       /* COLLECTIVE: COLL_OP_* */
+  uint8_t  num_inputs;
+  uint8_t  num_outputs;
+  uint8_t  reserved[3];
+  uint32_t est_us;        /* Duration hint, 0 = measured or per-type guess */
+  uint32_t inputs[IPC_JOB_STEP_INPUTS];   /* Tensor ids */
+  uint32_t outputs[IPC_JOB_STEP_OUTPUTS];
+} ipc_job_step_t;         /* 40 bytes */
+
+typedef struct {
+  uint32_t id;
+  uint32_t num_elements;
+  uint8_t  dtype;         /* TENSOR_DTYPE_* */
+  uint8_t  pinned;
+  uint8_t  node_affinity; /* 0xFF = any */
+  uint8_t  reserved;
+} ipc_job_tensor_t;       /* 12 bytes */
+
+typedef struct {
+  uint32_t job_id;
+  uint32_t tag;           /* ipc_job_submit_t.tag */
+  uint16_t state;         /* IPC_JOB_* */
+  uint16_t admit;         /* REJECTED: admit_result_t */
+  uint32_t steps;         /* Steps completed */
+  uint32_t peak_memory_kb;
+  uint32_t critical_path_us;
+  uint32_t wait_us;       /* Taken off the ring -> run start */
+  uint32_t run_us;        /* Run of its batch (its jobs run together),
+                             0 if it never ran */
+} ipc_job_status_t;       /* 32 bytes */
+
+/* =============================================================================
+ * TRACE EXPORT RING (ZENEDGE -> Linux, IPC_REGION_TRACE)
+ * =============================================================================
+ * Flight recorder events, streamed as they are logged so the bridge can
+ * keep the whole run. An SPSC ring with the common header (entry_size =
+ * IPC_TRACE_ENTRY_SIZE) that ZENEDGE fills from its main loop, FIFO
+ * policy: while the ring is full events wait in the per-CPU flight
+ * recorder rings (one overrun per stall), and only those the recorder
+ * overwrites meanwhile are lost. Losses are counted in `lost` and also
+ * appear in the stream as a TRACE_EVT_TRACE_LOST event (0xF2, extra =
+ * events lost) where they happened.
+ *
+ * Entries are trace_event_t (kernel/trace/flightrec.h), little-endian:
+ *   uint64_t ts_usec, ts_cycles;
+ *   uint8_t  type, sig; uint16_t cpu_id;
+ *   uint32_t job_id, step_id, extra;
+ */
+#define IPC_TRACE_MAGIC      0x45435254  /* "TRCE" */
+#define IPC_TRACE_ENTRY_SIZE 32
+
+/* =============================================================================
+ * WASM PROFILE DUMP (ZENEDGE -> Linux, CMD_WASM_PROFILE)
+ * =============================================================================
+ * A BLOB_TYPE_RAW blob: ipc_wasm_prof_hdr_t then `count` records, totals
+ * since profiling was last enabled. Cycles are TSC; cpu_mhz converts.
+ */
+#define IPC_WASM_PROF_MAGIC   0x46525057  /* "WPRF" */
+#define IPC_WASM_PROF_VERSION 1
+
+/* doorbell_ctl_t.wasm_prof_mode bits */
+#define IPC_WASM_PROF_CALLS 0x01  /* Exported function calls: count, cycles */
+#define IPC_WASM_PROF_HOST  0x02  /* Host imports: count, cycles */
+#define IPC_WASM_PROF_OPS   0x04  /* Opcode counts (ZENEDGE_WASM_OPPROF builds) */
+
+/* ipc_wasm_prof_rec_t.kind */
+#define IPC_WASM_PROF_KIND_FUNC 1
+#define IPC_WASM_PROF_KIND_HOST 2
+#define IPC_WASM_PROF_KIND_OP   3
+
+#define IPC_WASM_PROF_NAME_LEN 40
+
+typedef struct {
+  uint32_t magic;    /* IPC_WASM_PROF_MAGIC */
+  uint32_t version;  /* IPC_WASM_PROF_VERSION */
+  uint32_t mode;     /* IPC_WASM_PROF_* active when dumped */
+  uint32_t count;    /* Records that follow */
+  uint32_t cpu_mhz;  /* TSC rate */
+  uint32_t reserved[3];
+} ipc_wasm_prof_hdr_t;  /* 32 bytes */
+
+typedef struct {
+  uint32_t kind;     /* IPC_WASM_PROF_KIND_* */
+  uint32_t reserved;
+  uint64_t calls;    /* Calls, or executions for opcodes */
+  uint64_t cycles;   /* 0 for opcodes */
+  char     name[IPC_WASM_PROF_NAME_LEN]; /* NUL-padded */
+} ipc_wasm_prof_rec_t;  /* 64 bytes */
+
+/* =============================================================================
+ * BOOT PROFILE (ZENEDGE -> Linux, CMD_BOOT_PROFILE)
+ * =============================================================================
+ * A BLOB_TYPE_RAW blob sent once, after the first action: ipc_boot_prof_hdr_t
+ * then `count` records, the boot phases in the order they completed. Times
+ * are microseconds since kmain64 was entered.
+ */
+#define IPC_BOOT_PROF_MAGIC   0x46525042  /* "BPRF" */
+#define IPC_BOOT_PROF_VERSION 1
+
+/* ipc_boot_prof_hdr_t.flags */
+#define IPC_BOOT_PROF_FAST 0x01  /* Fast-boot build (FAST_BOOT=1) */
+
+#define IPC_BOOT_PROF_NAME_LEN 24
+
+typedef struct {
+  uint32_t magic;    /* IPC_BOOT_PROF_MAGIC */
+  uint32_t version;  /* IPC_BOOT_PROF_VERSION */
+  uint32_t flags;    /* IPC_BOOT_PROF_* */
+  uint32_t count;    /* Records that follow */
+  uint32_t tsc_khz;  /* TSC rate the times were converted with */
+  uint32_t reserved[3];
+} ipc_boot_prof_hdr_t;  /* 32 bytes */
+
+typedef struct {
+  uint64_t usec;     /* Phase done, since kmain64 entry */
+  char     name[IPC_BOOT_PROF_NAME_LEN]; /* NUL-padded */
+} ipc_boot_prof_rec_t;  /* 32 bytes */
+
+/* =============================================================================
+ * MICROBENCHMARK RESULTS (ZENEDGE -> Linux, CMD_BENCH_RESULTS)
+ * =============================================================================
+ * A BLOB_TYPE_RAW blob sent after each shell `bench` run: ipc_bench_hdr_t
+ * then `count` records, one per benchmark run. Cycle figures are per
+ * sample of `batch` operations, with the timing overhead taken off;
+ * divide by batch for one operation and by tsc_khz for time.
+ */
+#define IPC_BENCH_MAGIC   0x48434E42  /* "BNCH" */
+#define IPC_BENCH_VERSION 1
+
+#define IPC_BENCH_NAME_LEN 24
+
+typedef struct {
+  uint32_t magic;     /* IPC_BENCH_MAGIC */
+  uint32_t version;   /* IPC_BENCH_VERSION */
+  uint32_t count;     /* Records that follow */
+  uint32_t tsc_khz;   /* TSC rate of the cycle figures */
+  uint32_t overhead;  /* Cycles one empty sample measured (subtracted) */
+  uint32_t flags;     /* IPC_BENCH_RDTSCP if samples end on rdtscp */
+  uint64_t usec;      /* time_usec() when the run finished */
+} ipc_bench_hdr_t;  /* 32 bytes */
+
+#define IPC_BENCH_RDTSCP 0x01
+
+typedef struct {
+  char     name[IPC_BENCH_NAME_LEN]; /* NUL-padded */
+  uint32_t batch;     /* Operations per sample */
+  uint32_t samples;   /* Samples kept (after warmup) */
+  uint32_t bytes;     /* Bytes per operation, 0 = not a throughput test */
+  uint32_t reserved;
+  uint32_t min;       /* Cycles per sample */
+  uint32_t p50;
+  uint32_t p99;
+  uint32_t max;
+  uint64_t mean;      /* Cycles per sample, x256 */
+} ipc_bench_rec_t;  /* 64 bytes */
+
+/* =============================================================================
+ * SAMPLING PROFILE (ZENEDGE -> Linux, CMD_PROF_SAMPLES)
+ * =============================================================================
+ * A BLOB_TYPE_RAW blob sent by the shell's `prof stop`: ipc_prof_hdr_t
+ * then `count` samples, oldest first. Each is the interrupted instruction
+ * pointer and up to IPC_PROF_DEPTH return addresses off the frame-pointer
+ * chain, innermost first. Without IPC_PROF_FRAMES the kernel was built
+ * without frame pointers and the return addresses are not to be trusted.
+ */
+#define IPC_PROF_MAGIC   0x464F5250  /* "PROF" */
+#define IPC_PROF_VERSION 1
+
+#define IPC_PROF_DEPTH   6
+
+/* ipc_prof_hdr_t.flags */
+#define IPC_PROF_FRAMES  0x01  /* Built with frame pointers (FRAME_POINTERS=1) */
+
+/* ipc_prof_rec_t.flags */
+#define IPC_PROF_USER    0x01  /* Interrupted in ring 3: ip only */
+
+typedef struct {
+  uint32_t magic;     /* IPC_PROF_MAGIC */
+  uint32_t version;   /* IPC_PROF_VERSION */
+  uint32_t count;     /* Samples that follow */
+  uint32_t hz;        /* Sampling rate asked for */
+  uint32_t flags;     /* IPC_PROF_* */
+  uint32_t dropped;   /* Taken but overwritten before the dump */
+  uint64_t start_us;  /* time_usec() at `prof start` */
+  uint64_t end_us;    /* time_usec() at `prof stop` */
+} ipc_prof_hdr_t;  /* 40 bytes */
+
+typedef struct {
+  uint64_t ip;        /* Interrupted instruction */
+  uint32_t pid;       /* Process running */
+  uint8_t  cpu;
+  uint8_t  depth;     /* Return addresses in frames[] */
+  uint8_t  flags;     /* IPC_PROF_USER */
+  uint8_t  reserved;
+  uint64_t frames[IPC_PROF_DEPTH];
+} ipc_prof_rec_t;  /* 64 bytes */
+
+/* =============================================================================
+ * BATCHED INFERENCE (ZENEDGE -> Linux, CMD_RUN_MODEL_BATCH)
+ * =============================================================================
+ * Payload: a BLOB_TYPE_RAW blob holding an ipc_run_batch_t with `count`
+ * entries; the bridge frees it. Each entry is one CMD_RUN_MODEL and gets
+ * its own response (orig_cmd CMD_RUN_MODEL, the entry's tag, result = its
+ * result blob), all sent before the batch's own response (result = entries
+ * run). model 0 leaves the choice to the bridge, as for CMD_RUN_MODEL.
+ */
+#define IPC_RUN_BATCH_MAX 16
+
+typedef struct {
+  uint32_t input_blob; /* As CMD_RUN_MODEL's payload */
+  uint32_t tag;        /* Echoed in this entry's response */
+} ipc_run_batch_entry_t;
+
+typedef struct {
+  uint32_t count;      /* Entries in use, 1..IPC_RUN_BATCH_MAX */
+  uint32_t model;
+  ipc_run_batch_entry_t entries[IPC_RUN_BATCH_MAX];
+} ipc_run_batch_t;  /* Only count entries need be present */
+
 /* =============================================================================
  * SHARED HEAP - For passing tensor data between ZENEDGE and Linux
  * =============================================================================
@@ -219,12 +1134,27 @@ typedef struct __attribute__((packed)) {
 #define BLOB_TYPE_TENSOR    0x01  /* Tensor with header */
 #define BLOB_TYPE_MODEL_REF 0x02  /* Reference to model (path/ID) */
 #define BLOB_TYPE_RESULT    0x03  /* Inference result */
+#define BLOB_TYPE_SG        0x04  /* Scatter-gather chain (heap_sg_t) */
+#define BLOB_TYPE_ONNX      0x05  /* Serialized ONNX ModelProto, run in-kernel */
+#define BLOB_TYPE_JOB       0x06  /* Flat job graph (ipc_job_graph_t), CMD_JOB_SUBMIT */
 
 /* Blob flags */
 #define BLOB_FLAG_PINNED    0x01  /* Don't free automatically */
 #define BLOB_FLAG_READONLY  0x02  /* Linux should not modify */
+#define BLOB_FLAG_POOLED    0x04  /* Slab pool blob: freeing recycles it */
+#define BLOB_FLAG_CSUM_CRC32C 0x08  /* checksum is CRC32C of the data */
+#define BLOB_FLAG_CSUM_NONE 0x10  /* No checksum (trusted hot-path blobs) */
+#define BLOB_CSUM_MASK      (BLOB_FLAG_CSUM_CRC32C | BLOB_FLAG_CSUM_NONE)
 
-/* Blob descriptor (32 bytes) - stored at start of each allocation */
+/* Blob descriptor (32 bytes) - stored at start of each allocation
+ *
+ * Heap version 5 reference counts blobs without cross-side atomics: each
+ * side only ever increments its own taken[]/dropped[] counters (indexed by
+ * HEAP_ARENA_*), and the references still held are
+ * taken[0] + taken[1] - dropped[0] - dropped[1] (mod 2^16). Allocation and
+ * pool draws start the caller with one reference; a reference handed to the
+ * other side along with the blob id moves without touching any counter.
+ */
 typedef struct {
   uint32_t magic;       /* 0x424C4F42 "BLOB" */
   uint16_t blob_id;     /* Unique ID for this blob */
@@ -232,17 +1162,50 @@ typedef struct {
   uint8_t  flags;       /* BLOB_FLAG_* */
   uint32_t size;        /* Size of data (not including this header) */
   uint32_t offset;      /* Offset from heap base to data */
-  uint32_t checksum;    /* Simple checksum for validation */
-  uint32_t reserved[3]; /* Padding to 32 bytes */
+  uint32_t checksum;    /* Over the data, per BLOB_CSUM_MASK (neither: legacy) */
+  uint32_t pool;        /* Owner arena's pool index (BLOB_FLAG_POOLED) */
+  uint16_t taken[2];    /* References taken, per side (version 5) */
+  uint16_t dropped[2];  /* References released, per side (version 5) */
 } heap_blob_t;
 
 #define BLOB_MAGIC 0x424C4F42 /* "BLOB" */
 
-/* Tensor descriptor (embedded in blob data for BLOB_TYPE_TENSOR) */
+/* Scatter-gather chain: the data of a BLOB_TYPE_SG blob.
+ *
+ * For payloads larger than the biggest free chunk. The payload is the
+ * extents' data concatenated in order, laid out exactly as a contiguous
+ * blob of inner_type would be (a chained tensor starts with its
+ * tensor_header_t). Extents are ordinary BLOB_TYPE_RAW blobs from the same
+ * arena, owned by the chain: the chain's last release frees them too.
+ */
+#define HEAP_SG_MAX_EXTENTS 64
+
+typedef struct {
+  uint16_t blob_id;     /* Extent blob */
+  uint16_t reserved;
+  uint32_t size;        /* Payload bytes held by this extent */
+} heap_sg_extent_t;
+
+typedef struct {
+  uint32_t total_size;  /* Payload bytes across all extents */
+  uint8_t  inner_type;  /* BLOB_TYPE_* the payload is laid out as */
+  uint8_t  reserved;
+  uint16_t count;       /* Extents in use */
+  heap_sg_extent_t extent[HEAP_SG_MAX_EXTENTS];
+} heap_sg_t;
+
+/* Tensor descriptor (embedded in blob data for BLOB_TYPE_TENSOR)
+ *
+ * A quantized tensor (quant != TENSOR_QUANT_NONE) holds integers q whose
+ * real value is scale * (q - zero_point). The parameters trail the
+ * elements (shape[0] * strides[0] bytes; the dense size if strides[0] is
+ * 0), from the next 4-byte boundary: float scale[n] then int32_t
+ * zero_point[n], with n = 1 per tensor or shape[0] per channel.
+ */
 typedef struct {
   uint8_t  dtype;       /* Data type (see below) */
   uint8_t  ndim;        /* Number of dimensions (max 4) */
-  uint16_t reserved;
+  uint16_t quant;       /* TENSOR_QUANT_* (was reserved: 0 = none) */
   uint32_t shape[4];    /* Dimension sizes */
   uint32_t strides[4];  /* Strides in bytes */
   /* Actual tensor data follows immediately */
@@ -255,31 +1218,185 @@ typedef struct {
 #define DTYPE_INT16    0x03
 #define DTYPE_INT8     0x04
 #define DTYPE_UINT8    0x05
+#define DTYPE_BFLOAT16 0x06
+
+/* Tensor quantization */
+#define TENSOR_QUANT_NONE        0
+#define TENSOR_QUANT_PER_TENSOR  1  /* One scale/zero_point */
+#define TENSOR_QUANT_PER_CHANNEL 2  /* One per index of dim 0 */
+
+/* Dense MLP model: the data of a BLOB_TYPE_MODEL_REF blob, run in-kernel
+ * when an obs names it as model_id. Layer i computes
+ *   h = act(W h + b)
+ * over BLOB_TYPE_TENSOR blobs: W is [out, in] row-major (rows may be
+ * padded, per strides[0]), float32 or DTYPE_INT8 quantized per tensor or
+ * per row (zero points within int8); b is a float32 [out] or absent.
+ * Layer 0 takes in_dim floats of the observation. The action is the
+ * argmax of the last layer, or for a single output 1 if it is positive.
+ */
+#define IPC_MLP_MAGIC        0x504C4D5A  /* "ZMLP" */
+#define IPC_MLP_VERSION      1
+#define IPC_MLP_MAX_LAYERS   8
+#define IPC_MLP_MAX_WIDTH    256         /* Widest layer (elements) */
+
+#define MLP_ACT_NONE         0
+#define MLP_ACT_RELU         1
+#define MLP_ACT_TANH         2
+#define MLP_ACT_SOFTMAX      3           /* Last layer only */
+
+typedef struct {
+  uint16_t weight_blob; /* Tensor [out, in] */
+  uint16_t bias_blob;   /* Tensor [out], 0 = none */
+  uint8_t  act;         /* MLP_ACT_* */
+  uint8_t  reserved[3];
+} ipc_mlp_layer_t;
+
+typedef struct {
+  uint32_t magic;       /* IPC_MLP_MAGIC */
+  uint32_t version;     /* IPC_MLP_VERSION */
+  uint32_t num_layers;
+  uint32_t in_dim;
+  ipc_mlp_layer_t layer[IPC_MLP_MAX_LAYERS]; /* num_layers used */
+} ipc_mlp_desc_t;
+
+/* Heap control block - at IPC_HEAP_CTL_OFFSET
+ *
+ * Version 3 heaps are split into one arena per side (HEAP_ARENA_*). Each
+ * arena owns a block range and a blob table slot range, and only its owner
+ * ever writes its free lists, counters, bitmap words and slots, so ZENEDGE
+ * and the bridge allocate concurrently without locks or atomics. Freeing a
+ * blob the other side owns pushes its id onto the owner's return queue;
+ * the owner drains the queue on its next allocation.
+ *
+ * Within an arena, allocation is a buddy allocator over HEAP_BLOCK_SIZE
+ * blocks: a chunk of order k is 2^k blocks, aligned to 2^k blocks from the
+ * arena base. Free chunks sit on per-order doubly linked lists
+ * (free_head[k]) linked through a heap_free_chunk_t at the start of each
+ * free chunk. The bitmap marks used blocks.
+ *
+ * Version 4 adds slab pools to each arena (heap_pool_t): count preformatted
+ * blobs of one size that stay allocated and published for the life of the
+ * heap. Drawing one pops the pool's free stack and freeing one pushes it
+ * back, with no allocator work and no header rewrite. Only the owning side
+ * draws; a pooled blob freed by the other side comes back through the
+ * owner's return queue like any other.
+ *
+ * Version 5 reference counts blobs (heap_blob_t.taken/dropped). Releasing
+ * the last reference frees the blob: directly if the releasing side owns
+ * it, otherwise through the owner's return queue, where the owner frees it
+ * only if it is still unreferenced.
+ *
+ * Version 1 heaps have only the bitmap, free_blocks and next_blob_id in a
+ * 32-byte header.
+ */
+#define IPC_HEAP_VERSION     5
+#define HEAP_BUDDY_ORDERS    28          /* 2^27 blocks = 8GB: any 32-bit heap */
+#define HEAP_BUDDY_NIL       0xFFFFFFFF  /* Empty list / end of list */
+
+#define HEAP_ARENA_KERNEL    0
+#define HEAP_ARENA_BRIDGE    1
+#define HEAP_ARENA_COUNT     2
+#define HEAP_ARENA_ALIGN     64          /* Blocks: arenas never share a bitmap word */
+#define HEAP_RETURN_SLOTS    512         /* Return queue depth (power of 2) */
+#define HEAP_POOLS           4           /* Slab pools per arena */
+#define HEAP_POOL_DEPTH      128         /* Max blobs per pool */
+
+/* Foreign frees: head is written by the freeing side, tail by the owner */
+typedef struct {
+  uint32_t head;
+  uint32_t tail;
+  uint16_t ids[HEAP_RETURN_SLOTS];
+} heap_return_q_t;
+
+/* Slab pool of same-size blobs, written only by the owning arena's side */
+typedef struct {
+  uint32_t blob_size;       /* Data bytes per blob, 0 = unused pool */
+  uint32_t blocks;          /* Blocks per blob */
+  uint16_t count;           /* Blobs in the pool */
+  uint16_t free_count;      /* Ids on the free stack */
+  uint8_t  type;            /* BLOB_TYPE_* the blobs were formatted with */
+  uint8_t  reserved[3];
+  uint16_t free_ids[HEAP_POOL_DEPTH]; /* Free stack: free_ids[free_count - 1] is next */
+} heap_pool_t;
+
+typedef struct {
+  uint32_t base_block;      /* First block of the arena */
+  uint32_t blocks;          /* Blocks in the arena */
+  uint32_t free_blocks;     /* Currently free blocks */
+  uint32_t buddy_orders;    /* Orders in use: floor(log2(blocks)) + 1 */
+  uint32_t slot_base;       /* First blob table slot owned by the arena */
+  uint32_t slot_count;      /* Blob table slots owned */
+  uint32_t next_slot;       /* Slot to probe first (relative to slot_base) */
+  uint32_t blob_count;      /* Live blobs allocated from the arena */
+  uint32_t free_head[HEAP_BUDDY_ORDERS]; /* First free chunk, arena-relative */
+  heap_return_q_t ret;      /* Ids the other side freed, for the owner */
+  heap_pool_t pool[HEAP_POOLS];
+} heap_arena_t;
 
-/* Heap control block - at IPC_HEAP_CTL_OFFSET */
 typedef struct {
   uint32_t magic;           /* IPC_HEAP_MAGIC */
-  uint32_t version;         /* Protocol version (1) */
+  uint32_t version;         /* Heap format (IPC_HEAP_VERSION), set by ZENEDGE in heap_init */
   uint32_t total_blocks;    /* Total blocks available */
-  uint32_t free_blocks;     /* Currently free blocks */
-  uint32_t next_blob_id;    /* Next blob ID to assign */
-  uint32_t reserved[3];     /* Padding */
+  uint32_t arena_count;     /* HEAP_ARENA_COUNT */
+  uint32_t reserved;
+  uint32_t blob_slots;      /* Blob table entries (power of 2, 0 = no table) */
+  uint32_t blob_table;      /* Byte offset of the blob table from this header */
+  uint32_t reserved2;
+  heap_arena_t arena[HEAP_ARENA_COUNT];
   /* Bitmap follows: 1 bit per block (0=free, 1=used) */
-  /* Size: (HEAP_MAX_BLOCKS + 7) / 8 bytes */
+  /* Size: (total_blocks + 7) / 8 bytes */
   uint8_t  bitmap[];
 } heap_ctl_t;
 
+/* Header at the start of every free chunk (in the data region) */
+typedef struct {
+  uint32_t magic;           /* HEAP_FREE_MAGIC */
+  uint32_t order;           /* Chunk is 2^order blocks */
+  uint32_t next;            /* Arena-relative block of next free chunk, or NIL */
+  uint32_t prev;            /* Arena-relative block of previous chunk, or NIL */
+} heap_free_chunk_t;
+
+#define HEAP_FREE_MAGIC      0x45455246  /* "FREE" */
+
+/* Blob table entry (12 bytes), direct-indexed by blob_id & (blob_slots - 1).
+ * A blob_id is (generation << log2(blob_slots)) | slot, truncated to 16 bits,
+ * so a stale id for a reused slot no longer matches the entry's blob_id.
+ * Writers fill offset/blocks/generation first and publish blob_id last;
+ * freeing clears blob_id first.
+ */
+typedef struct {
+  uint32_t offset;          /* Blob header offset from the heap data base */
+  uint32_t blocks;          /* HEAP_BLOCK_SIZE blocks allocated (2^order) */
+  uint16_t blob_id;         /* Id living in this slot, 0 = free */
+  uint16_t generation;      /* Bumped each time the slot is reused */
+} heap_blob_slot_t;
+
+/* Table sizing (kernel/ipc/layout.c scales the slot count with the heap) */
+#define HEAP_BLOB_SLOTS_MIN  512
+#define HEAP_BLOB_SLOTS_MAX  16384   /* Leaves >= 2 generation bits in a blob_id */
+
+/* Blob table sits after the bitmap, 8-byte aligned */
+#define HEAP_BLOB_TABLE_OFFSET(blocks) \
+  ((sizeof(heap_ctl_t) + ((blocks) + 7) / 8 + 7) & ~(uint32_t)7)
+
 /* Helper: calculate bitmap size in bytes */
 #define HEAP_BITMAP_SIZE ((HEAP_MAX_BLOCKS + 7) / 8)
 
 /* =============================================================================
  * KERNEL MESH PROTOCOL - Shared State & Discovery
  * =============================================================================
- * Offset 0x10800 (Between Doorbell and Heap Control)
+ * IPC_REGION_MESH (offset 0x10800 in the fixed 1MB layout)
  */
 #define IPC_MESH_OFFSET      0x10800
 #define MES_MAX_NODES        8
 
+/* Membership: a node claims an OFFLINE slot with cmpxchg on status and
+ * bumps its epoch. Whoever sees a heartbeat stuck for the suspicion
+ * timeout evicts the node with cmpxchg on its epoch, then marks the slot
+ * OFFLINE; a node finding its slot's epoch changed has been evicted and
+ * must rejoin before writing anything shared again.
+ */
+
 /* Node Status */
 #define NODE_STATUS_OFFLINE  0x00
 #define NODE_STATUS_ALIVE    0x01
@@ -290,20 +1407,153 @@ typedef struct {
   uint32_t node_id;         /* 0..MAX_NODES-1 */
   uint32_t status;          /* NODE_STATUS_* */
   uint32_t cpu_load;        /* 0..100% */
-  uint64_t heartbeat;       /* TSC / System Time */
-  uint64_t jobs_completed;  /* Stats */
-  uint32_t reserved[4];     /* Padding */
+  uint64_t heartbeat;       /* Owner's TSC, rewritten every MESH_HEARTBEAT_US */
+  uint64_t jobs_completed;  /* Stats: steps run for other nodes */
+  uint32_t doorbell_peer;   /* ivshmem peer id + 1, 0 = no doorbell */
+  uint32_t epoch;           /* Bumped by each claim and each eviction */
+  uint32_t doorbell_vectors; /* ivshmem vectors with their own IRQ (MSI-X) */
+  uint32_t reserved;        /* Padding */
 } mesh_node_t;
 
+/* Gang barrier slot, one per node (sched/gang.c). Collectives run in the
+ * same order on every node; the Nth one is generation N. A node arriving
+ * writes key then gen; the leader (lowest alive node) writes released
+ * once every participant has arrived, and the others spin on it.
+ */
+typedef struct {
+  volatile uint32_t gen;      /* Last generation this node arrived at */
+  volatile uint32_t key;      /* Which step: job id << 16 | step id */
+  volatile uint32_t released; /* Leader: last generation released */
+  volatile uint32_t wait_us;  /* This node's wait at its last release */
+  volatile uint32_t members;  /* Leader: nodes in the last release (bitmask) */
+  uint32_t reserved[3];
+} mesh_gang_t;
+
 /* Mesh Table (Shared Memory) */
 typedef struct {
   uint32_t magic;           /* 0x4D455348 "MESH" */
-  uint32_t version;         /* 1 */
+  uint32_t version;         /* MESH_VERSION */
   uint32_t active_nodes;    /* Count of alive nodes */
   uint32_t reserved[5];
   mesh_node_t nodes[MES_MAX_NODES];
+  mesh_gang_t gang[MES_MAX_NODES];
 } mesh_table_t;
 
 #define MESH_MAGIC 0x4D455348 /* "MESH" */
+#define MESH_INIT_MAGIC 0x494E4954 /* "INIT": a node is setting the table up */
+#define MESH_VERSION 3        /* 2: gang[], 3: gang members */
+
+/* =============================================================================
+ * MESH WORK RINGS - Steps run on another node (ipc/mesh_work.c)
+ * =============================================================================
+ * IPC_REGION_MESH_WORK (layout descriptor only): one mesh_pair_t per
+ * ordered node pair, pairs[src][dst]. src produces requests into sub and
+ * consumes completions from cpl; dst the other way round. head and tail
+ * are free-running, each written only by its own side. Input and result
+ * tensors are shared heap blobs, so only their ids cross.
+ *
+ * Blobs move by handle. The sender of a step lends its input: it takes a
+ * reference on the receiver's behalf and keeps a loan for it. The
+ * receiver checks the id (the slot generation is in its high bits) still
+ * names a live blob, and gives the loan back with a MESH_WORK_RELEASE
+ * request once done; the lender then drops the reference, so a blob is
+ * only ever freed by the node that lent it. A result blob's reference
+ * moves to the requester with the completion.
+ *
+ * A node clears the rings to and from itself when it joins the mesh.
+ * Peers fail what they had in flight with it as soon as they see its
+ * slot's epoch change or evict it.
+ */
+#define MESH_WORK_MAGIC  0x4B524F57 /* "WORK" */
+#define MESH_WORK_SLOTS  8          /* Per ring (power of two) */
+#define MESH_WORK_RELEASE 0x8000    /* mesh_work_req_t.type */
+
+typedef struct {
+  uint32_t seq;         /* Sender's handle, echoed in the completion */
+  uint16_t type;        /* step_type_t; STEP_TYPE_CONTROL is a probe,
+                           MESH_WORK_RELEASE returns the loan of request
+                           seq's payload_id (no completion) */
+  uint16_t epoch;       /* Sender's epoch (low bits): stale requests are dropped */
+  uint32_t job_id;
+  uint32_t step_id;
+  uint32_t model;       /* Forwarded to CMD_RUN_MODEL */
+  uint32_t payload_id;  /* Input blob */
+  uint64_t submit_tsc;  /* Sender's clock, echoed: latency needs no shared clock */
+} mesh_work_req_t;
+
+typedef struct {
+  uint32_t seq;
+  uint16_t status;      /* RSP_* */
+  uint16_t epoch;       /* Receiver's epoch: answers from an old one are dropped */
+  uint32_t result;      /* Result blob */
+  uint32_t exec_us;     /* Time the step took on the remote node */
+  uint64_t submit_tsc;  /* From the request */
+  uint32_t reserved[2];
+} mesh_work_cpl_t;
+
+typedef struct {
+  volatile uint32_t head;   /* Producer */
+  volatile uint32_t tail;   /* Consumer */
+  uint32_t reserved[2];
+  mesh_work_req_t slot[MESH_WORK_SLOTS];
+} mesh_sub_ring_t;
+
+typedef struct {
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  uint32_t reserved[2];
+  mesh_work_cpl_t slot[MESH_WORK_SLOTS];
+} mesh_cpl_ring_t;
+
+typedef struct {
+  mesh_sub_ring_t sub;
+  mesh_cpl_ring_t cpl;
+} mesh_pair_t;
+
+typedef struct {
+  uint32_t magic;       /* MESH_WORK_MAGIC */
+  uint32_t slots;       /* MESH_WORK_SLOTS */
+  uint32_t reserved[2];
+  mesh_pair_t pairs[MES_MAX_NODES][MES_MAX_NODES];
+} mesh_work_table_t;
+
+/* =============================================================================
+ * MESH COLLECTIVES - Ring allreduce and allgather (sched/coll.c)
+ * =============================================================================
+ * IPC_REGION_MESH_COLL (layout descriptor only): mesh_coll_table_t, then
+ * MESH_COLL_SLOTS chunk buffers of `entries` bytes per node. The members
+ * of a collective form a ring in node id order; each writes chunks into
+ * its own buffers for its right-hand neighbour, which reduces or copies
+ * them out and acks. Every field of a mesh_coll_chan_t is written by its
+ * node only.
+ *
+ * A node resets head and ack, then sets gen, before it arrives at the
+ * collective's gang barrier, so after the release everyone's channel is
+ * set up for it. A node leaves a collective only once its neighbour has
+ * acked every chunk (or moved on to a later gen), so its buffers are
+ * free to reuse for the next.
+ */
+#define MESH_COLL_MAGIC  0x4C4C4F43 /* "COLL" */
+#define MESH_COLL_SLOTS  4          /* Chunk buffers per node */
+
+typedef struct {
+  volatile uint32_t gen;    /* Collective the channel is set up for */
+  volatile uint32_t head;   /* Chunks written into this node's buffers */
+  volatile uint32_t ack;    /* Chunks consumed from the left neighbour's */
+  uint32_t reserved[13];
+} mesh_coll_chan_t;         /* One cache line */
+
+typedef struct {
+  uint32_t magic;           /* MESH_COLL_MAGIC */
+  uint32_t slots;           /* MESH_COLL_SLOTS */
+  uint32_t chunk_bytes;     /* Region entries */
+  uint32_t reserved[13];
+  mesh_coll_chan_t chan[MES_MAX_NODES];
+} mesh_coll_table_t;
+
+/* Chunk buffer s of node n, and the whole region, for chunk-byte buffers */
+#define MESH_COLL_BUF_OFFSET(chunk, n, s) \
+  (sizeof(mesh_coll_table_t) + ((uint32_t)(n) * MESH_COLL_SLOTS + (s)) * (chunk))
+#define MESH_COLL_REGION_BYTES(chunk) MESH_COLL_BUF_OFFSET(chunk, MES_MAX_NODES, 0)
 
 #endif /* _IPC_PROTO_H */
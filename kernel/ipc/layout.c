@@ -0,0 +1,235 @@
+/* kernel/ipc/layout.c - Shared memory layout descriptor
+ *
+ * Regions are placed front to back in id order after the descriptor page,
+ * each rounded up to IPC_LAYOUT_ALIGN; the heap data region takes whatever
+ * is left. Ring depths grow with the device (power of two, clamped) so a
+ * 1MB device keeps the historical sizes and a 64MB+ device gets deeper
+ * rings and a proportionally large heap.
+ */
+
+#include "layout.h"
+#include "../console.h"
+#include <stddef.h>
+
+/* Sizing policy: entries = clamp(pow2_floor(total >> shift), min, max) */
+#define LAYOUT_RING_SHIFT     10
+#define LAYOUT_RING_MAX       16384
+#define LAYOUT_STREAM_SHIFT   14
+#define LAYOUT_STREAM_MAX     1024
+#define LAYOUT_MSG_SHIFT      7
+#define LAYOUT_MSG_MAX        0x40000     /* 256KB inline data per direction */
+#define LAYOUT_BULK_SHIFT     19          /* 2 chunk slots at 1MB */
+#define LAYOUT_BULK_MAX       8
+#define LAYOUT_COLL_SHIFT     9           /* 2KB collective chunks at 1MB */
+#define LAYOUT_COLL_MIN       1024
+#define LAYOUT_COLL_MAX       0x10000
+#define LAYOUT_TRACE_SHIFT    10          /* 1024 events at 1MB */
+#define LAYOUT_TRACE_MAX      0x10000
+#define LAYOUT_HEAP_MIN       0x10000     /* Refuse layouts with < 64KB heap */
+#define LAYOUT_BLOB_SHIFT     12          /* One blob slot per 4KB of heap */
+
+_Static_assert(sizeof(ipc_region_t) == 16, "ipc_region_t must be 16 bytes");
+_Static_assert(sizeof(ipc_layout_t) <= IPC_LAYOUT_BYTES,
+               "layout descriptor does not fit its page");
+_Static_assert(IPC_REGION_COUNT <= IPC_REGION_MAX, "too many regions");
+_Static_assert(IPC_STREAM_CHANNELS >= 1 &&
+                   IPC_STREAM_CHANNELS <= IPC_STREAM_CHANNELS_MAX,
+               "IPC_STREAM_CHANNELS out of range");
+_Static_assert(sizeof(ipc_stream_chan_table_t) <= IPC_LAYOUT_ALIGN,
+               "stream channel table does not fit its page");
+
+static uint8_t *layout_base = NULL;
+static ipc_layout_t layout;   /* Private copy; the shared one is for peers */
+static uint32_t layout_valid = 0;
+
+static uint32_t align_up(uint32_t v) {
+  return (v + IPC_LAYOUT_ALIGN - 1) & ~(uint32_t)(IPC_LAYOUT_ALIGN - 1);
+}
+
+static uint32_t pow2_floor(uint32_t v) {
+  if (v == 0)
+    return 0;
+  return 1u << (31 - __builtin_clz(v));
+}
+
+static uint32_t scaled_entries(uint32_t total, uint32_t shift, uint32_t min,
+                               uint32_t max) {
+  uint32_t n = pow2_floor(total >> shift);
+  if (n < min)
+    return min;
+  if (n > max)
+    return max;
+  return n;
+}
+
+static uint32_t place(uint32_t *cursor, uint32_t id, uint32_t bytes,
+                      uint32_t entries) {
+  ipc_region_t *r = &layout.regions[id];
+  r->offset = *cursor;
+  r->size = align_up(bytes);
+  r->entries = entries;
+  r->reserved = 0;
+  *cursor += r->size;
+  return r->offset;
+}
+
+int ipc_layout_build(void *base, uint32_t total) {
+  layout_valid = 0;
+  if (!base || total < IPC_SHARED_MEM_MIN)
+    return -1;
+
+  uint32_t ring = scaled_entries(total, LAYOUT_RING_SHIFT, IPC_RING_SIZE,
+                                 LAYOUT_RING_MAX);
+  uint32_t stream = scaled_entries(total, LAYOUT_STREAM_SHIFT,
+                                   IPC_OBS_RING_SIZE, LAYOUT_STREAM_MAX);
+  uint32_t msg = scaled_entries(total, LAYOUT_MSG_SHIFT, IPC_MSG_DATA_BYTES,
+                                LAYOUT_MSG_MAX);
+  uint32_t bulk = scaled_entries(total, LAYOUT_BULK_SHIFT, IPC_BULK_SLOTS,
+                                 LAYOUT_BULK_MAX);
+  uint32_t coll = scaled_entries(total, LAYOUT_COLL_SHIFT, LAYOUT_COLL_MIN,
+                                 LAYOUT_COLL_MAX);
+  uint32_t trace = scaled_entries(total, LAYOUT_TRACE_SHIFT, 1024,
+                                  LAYOUT_TRACE_MAX);
+
+  for (uint32_t i = 0; i < IPC_REGION_MAX; i++) {
+    layout.regions[i].offset = 0;
+    layout.regions[i].size = 0;
+    layout.regions[i].entries = 0;
+    layout.regions[i].reserved = 0;
+  }
+
+  uint32_t cursor = IPC_LAYOUT_BYTES;
+
+  /* The command ring always reserves its MPSC sequence array */
+  place(&cursor, IPC_REGION_CMD_RING,
+        IPC_RING_HDR_SIZE + ring * (sizeof(ipc_packet_t) + sizeof(uint32_t)),
+        ring);
+  place(&cursor, IPC_REGION_RSP_RING,
+        IPC_RING_HDR_SIZE + ring * sizeof(ipc_response_t), ring);
+  place(&cursor, IPC_REGION_DOORBELL, sizeof(doorbell_ctl_t), 0);
+  place(&cursor, IPC_REGION_MESH, sizeof(mesh_table_t), 0);
+  place(&cursor, IPC_REGION_TELEMETRY, sizeof(ipc_telemetry_page_t), 0);
+  place(&cursor, IPC_REGION_MSG_CMD, IPC_RING_HDR_SIZE + msg, msg);
+  place(&cursor, IPC_REGION_MSG_RSP, IPC_RING_HDR_SIZE + msg, msg);
+  place(&cursor, IPC_REGION_OBS_RING,
+        sizeof(stream_ring_t) + stream * sizeof(obs_entry_t), stream);
+  place(&cursor, IPC_REGION_ACT_RING,
+        sizeof(stream_ring_t) + stream * sizeof(action_entry_t), stream);
+  place(&cursor, IPC_REGION_BULK,
+        sizeof(ipc_bulk_ring_t) + bulk * sizeof(ipc_bulk_chunk_t), bulk);
+  place(&cursor, IPC_REGION_STREAM_CHAN,
+        IPC_CHAN_REGION_BYTES(IPC_STREAM_CHANNELS, stream, sizeof(obs_entry_t)),
+        IPC_STREAM_CHANNELS);
+  place(&cursor, IPC_REGION_MESH_WORK, sizeof(mesh_work_table_t), MESH_WORK_SLOTS);
+  place(&cursor, IPC_REGION_MESH_COLL, MESH_COLL_REGION_BYTES(coll), coll);
+  place(&cursor, IPC_REGION_TRACE,
+        IPC_RING_HDR_SIZE + trace * IPC_TRACE_ENTRY_SIZE, trace);
+  place(&cursor, IPC_REGION_STATS, sizeof(ipc_stats_page_t), 0);
+  place(&cursor, IPC_REGION_JOBS,
+        IPC_RING_HDR_SIZE + IPC_JOB_SLOTS * sizeof(ipc_job_submit_t), IPC_JOB_SLOTS);
+
+  /* Heap: control block (bitmap + blob table sized for the remainder) + data */
+  if (cursor >= total)
+    return -1;
+  uint32_t rest = total - cursor;
+  uint32_t slots = scaled_entries(rest, LAYOUT_BLOB_SHIFT, HEAP_BLOB_SLOTS_MIN,
+                                  HEAP_BLOB_SLOTS_MAX);
+  uint32_t ctl = align_up(HEAP_BLOB_TABLE_OFFSET(rest / HEAP_BLOCK_SIZE) +
+                          slots * sizeof(heap_blob_slot_t));
+  if (ctl >= rest || rest - ctl < LAYOUT_HEAP_MIN)
+    return -1;
+  uint32_t data = (rest - ctl) & ~(uint32_t)(IPC_LAYOUT_ALIGN - 1);
+
+  place(&cursor, IPC_REGION_HEAP_CTL, ctl, slots);
+  place(&cursor, IPC_REGION_HEAP_DATA, data, data / HEAP_BLOCK_SIZE);
+
+  layout.magic = IPC_LAYOUT_MAGIC;
+  layout.version = IPC_LAYOUT_VERSION;
+  layout.total_size = total;
+  layout.region_count = IPC_REGION_COUNT;
+  for (uint32_t i = 0; i < 12; i++)
+    layout.reserved[i] = 0;
+
+  layout_base = (uint8_t *)base;
+  layout_valid = 1;
+
+  /* Publish: table first, magic last */
+  volatile ipc_layout_t *shared = (volatile ipc_layout_t *)base;
+  shared->magic = 0;
+  __asm__ __volatile__("" ::: "memory");
+  shared->version = layout.version;
+  shared->total_size = layout.total_size;
+  shared->region_count = layout.region_count;
+  for (uint32_t i = 0; i < 12; i++)
+    shared->reserved[i] = 0;
+  for (uint32_t i = 0; i < IPC_REGION_MAX; i++) {
+    shared->regions[i].offset = layout.regions[i].offset;
+    shared->regions[i].size = layout.regions[i].size;
+    shared->regions[i].entries = layout.regions[i].entries;
+    shared->regions[i].reserved = 0;
+  }
+  __asm__ __volatile__("" ::: "memory");
+  shared->magic = IPC_LAYOUT_MAGIC;
+  return 0;
+}
+
+void *ipc_region_ptr(uint32_t id) {
+  if (!layout_valid || id >= IPC_REGION_COUNT || !layout.regions[id].size)
+    return NULL;
+  return layout_base + layout.regions[id].offset;
+}
+
+uint32_t ipc_region_offset(uint32_t id) {
+  if (!layout_valid || id >= IPC_REGION_COUNT)
+    return 0;
+  return layout.regions[id].offset;
+}
+
+uint32_t ipc_region_size(uint32_t id) {
+  if (!layout_valid || id >= IPC_REGION_COUNT)
+    return 0;
+  return layout.regions[id].size;
+}
+
+uint32_t ipc_region_entries(uint32_t id) {
+  if (!layout_valid || id >= IPC_REGION_COUNT)
+    return 0;
+  return layout.regions[id].entries;
+}
+
+uint32_t ipc_layout_total(void) {
+  return layout_valid ? layout.total_size : 0;
+}
+
+void ipc_layout_dump(void) {
+  static const char *const names[IPC_REGION_COUNT] = {
+      "cmd ring", "rsp ring", "doorbell", "heap ctl", "heap data", "mesh",
+      "telemetry", "msg cmd", "msg rsp", "obs ring", "act ring", "bulk ring",
+      "stream chans", "mesh work", "mesh coll", "trace", "stats", "job ring",
+  };
+
+  if (!layout_valid) {
+    console_write("[layout] not built\n");
+    return;
+  }
+
+  console_write("[layout] ");
+  print_uint(layout.total_size / 1024);
+  console_write("KB shared memory:\n");
+  for (uint32_t i = 0; i < IPC_REGION_COUNT; i++) {
+    const ipc_region_t *r = &layout.regions[i];
+    console_write("  ");
+    console_write(names[i]);
+    console_write(": ");
+    print_hex32(r->offset);
+    console_write(" +");
+    print_uint(r->size / 1024);
+    console_write("KB");
+    if (r->entries) {
+      console_write(" (");
+      print_uint(r->entries);
+      console_write(")");
+    }
+    console_write("\n");
+  }
+}
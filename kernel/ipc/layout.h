@@ -0,0 +1,41 @@
+/* kernel/ipc/layout.h - Shared memory layout descriptor
+ *
+ * ipc_layout_build() carves the ivshmem region into the IPC_REGION_* areas,
+ * scaling ring depths and the heap with the device size, and publishes the
+ * table at offset 0 for the bridge. ZENEDGE itself only ever uses its
+ * private copy, so a peer rewriting the shared table cannot move regions
+ * underneath the kernel.
+ */
+
+#ifndef _IPC_LAYOUT_H
+#define _IPC_LAYOUT_H
+
+#include "ipc_proto.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lay out `total` bytes of shared memory at base and publish the table.
+ * Returns: 0 on success, -1 if total is below IPC_SHARED_MEM_MIN
+ */
+int ipc_layout_build(void *base, uint32_t total);
+
+/* Region lookup (private copy). NULL / 0 if absent or not built. */
+void *ipc_region_ptr(uint32_t id);
+uint32_t ipc_region_offset(uint32_t id);
+uint32_t ipc_region_size(uint32_t id);
+uint32_t ipc_region_entries(uint32_t id);
+
+/* Total bytes described by the current layout (0 if not built) */
+uint32_t ipc_layout_total(void);
+
+/* Debug: print the region table */
+void ipc_layout_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_LAYOUT_H */
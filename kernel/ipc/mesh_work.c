@@ -0,0 +1,784 @@
+/* kernel/ipc/mesh_work.c - Running steps on other mesh nodes */
+
+#include "mesh_work.h"
+#include "../arch/idt.h"
+#include "../console.h"
+#include "../drivers/ivshmem.h"
+#include "../job/job_graph.h"
+#include "../lib/hdr_hist.h"
+#include "../time/time.h"
+#include "../trace/flightrec.h"
+#include "heap.h"
+#include "ipc.h"
+#include "layout.h"
+#include "run_batch.h"
+
+#define SLOT_MASK (MESH_WORK_SLOTS - 1)
+#define HOME_SLOTS 64             /* Result blobs whose node we remember */
+
+/* A request of ours in flight */
+typedef struct {
+  uint32_t seq;           /* 0 = free */
+  uint32_t dst;
+  uint16_t epoch;         /* dst's epoch when sent */
+  uint8_t probe;
+  ipc_completion_cb_t cb;
+  void *arg;
+} pending_t;
+
+/* A peer's request running here */
+#define SERVE_FREE    0
+#define SERVE_RUNNING 1
+#define SERVE_DONE    2   /* rsp is valid, completion not sent yet */
+
+typedef struct {
+  volatile uint8_t state;
+  uint32_t src;
+  uint32_t epoch;         /* src's epoch when taken */
+  uint8_t owes;           /* req.payload_id is lent: give it back */
+  mesh_work_req_t req;
+  cycles_t start;
+  ipc_response_t rsp;
+} serving_t;
+
+static volatile mesh_work_table_t *work;
+static int self = -1;
+static pending_t pending[MESH_WORK_PENDING];
+static serving_t serving[MESH_WORK_SERVING];
+static uint32_t next_seq = 1;
+static uint32_t outstanding[MES_MAX_NODES];   /* Our requests at each node */
+static uint32_t probe_out[MES_MAX_NODES];     /* Probe handle, 0 = none */
+static usec_t next_probe_us;
+static mesh_work_stats_t stats[MES_MAX_NODES];
+
+/* Node that produced a remote step's result blob, direct mapped by id;
+ * anything not in here lives with us
+ */
+static struct {
+  uint16_t blob;
+  uint8_t node;
+} home[HOME_SLOTS];
+/* A blob of ours lent to node with request seq; we hold a reference for
+ * it until it gives the blob back
+ */
+typedef struct {
+  uint32_t seq;           /* 0 = free */
+  uint16_t blob;
+  uint8_t node;
+} loan_t;
+
+static loan_t loans[MESH_WORK_LOANS];
+static uint32_t place_rng;
+static hdr_hist_t regret_hist;    /* |actual - predicted| completion, us */
+
+static void ring_clear(volatile mesh_pair_t *p) {
+  p->sub.head = 0;
+  p->sub.tail = 0;
+  p->cpl.head = 0;
+  p->cpl.tail = 0;
+}
+
+/* Lend blob to node for request seq: 0, -1 if no loan slot or the blob
+ * is gone
+ */
+static int loan_take(uint32_t node, uint32_t seq, uint32_t blob) {
+  heap_blob_t *b = heap_get_blob((uint16_t)blob);
+  if (!b)
+    return -1;
+  for (uint32_t i = 0; i < MESH_WORK_LOANS; i++) {
+    loan_t *l = &loans[i];
+    if (l->seq)
+      continue;
+    if (heap_blob_lend((uint16_t)blob) != 0)  /* The peer reads it in place */
+      return -1;
+    l->seq = seq;
+    l->blob = (uint16_t)blob;
+    l->node = (uint8_t)node;
+    stats[node].lent++;
+    stats[node].handoff_bytes += b->size;
+    return 0;
+  }
+  return -1;
+}
+
+/* The loan ends: drop the reference we held for the borrower */
+static void loan_end(loan_t *l) {
+  heap_blob_unlend(l->blob);
+  l->seq = 0;
+}
+
+static void loan_returned(uint32_t node, uint32_t seq, uint32_t blob) {
+  for (uint32_t i = 0; i < MESH_WORK_LOANS; i++) {
+    loan_t *l = &loans[i];
+    if (l->seq == seq && l->node == node && l->blob == blob) {
+      loan_end(l);
+      stats[node].returned++;
+      return;
+    }
+  }
+}
+
+/* Interrupts off. Fail our requests at node with MESH_RSP_NODE_DOWN, take
+ * back what we lent it and forget its requests to us
+ */
+static void node_reset(uint32_t node) {
+  for (uint32_t i = 0; i < MESH_WORK_PENDING; i++) {
+    pending_t *p = &pending[i];
+    if (!p->seq || p->dst != node)
+      continue;
+    p->seq = 0;
+    if (p->probe)
+      continue;
+    stats[node].failed++;
+    if (p->cb) {
+      ipc_response_t rsp = {MESH_RSP_NODE_DOWN, CMD_RUN_MODEL, 0, 0, IPC_TAG_NONE, 0};
+      p->cb(&rsp, p->arg);
+    }
+  }
+  /* Running ones are dropped when they finish (serve_complete) */
+  for (uint32_t i = 0; i < MESH_WORK_SERVING; i++)
+    if (serving[i].state == SERVE_DONE && serving[i].src == node)
+      serving[i].state = SERVE_FREE;
+  for (uint32_t i = 0; i < MESH_WORK_LOANS; i++) {
+    if (loans[i].seq && loans[i].node == node) {
+      loan_end(&loans[i]);
+      stats[node].reclaimed++;
+    }
+  }
+  outstanding[node] = 0;
+  probe_out[node] = 0;
+  stats[node].reachable = 0;
+}
+
+void mesh_work_peer_down(uint32_t node) {
+  if (node >= MES_MAX_NODES)
+    return;
+  int was = interrupts_enabled();
+  interrupts_disable();
+  node_reset(node);
+  if (was)
+    interrupts_enable();
+}
+
+void mesh_work_init(void) {
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+    node_reset(i);
+
+  volatile mesh_table_t *m = ipc_mesh_table();
+  work = (volatile mesh_work_table_t *)ipc_region_ptr(IPC_REGION_MESH_WORK);
+  self = ipc_mesh_local_id();
+  if (!m || !work) {
+    work = NULL;
+    return;
+  }
+
+  if (work->magic != MESH_WORK_MAGIC || work->slots != MESH_WORK_SLOTS) {
+    work->magic = 0;
+    for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+      for (uint32_t j = 0; j < MES_MAX_NODES; j++)
+        ring_clear(&work->pairs[i][j]);
+    work->slots = MESH_WORK_SLOTS;
+    __asm__ __volatile__("" ::: "memory");
+    work->magic = MESH_WORK_MAGIC;
+  } else {
+    for (uint32_t i = 0; i < MES_MAX_NODES; i++) {
+      ring_clear(&work->pairs[self][i]);
+      ring_clear(&work->pairs[i][self]);
+    }
+  }
+
+  m->nodes[self].doorbell_peer =
+      ivshmem_has_doorbell() ? ivshmem_get_peer_id() + 1 : 0;
+  m->nodes[self].doorbell_vectors = ivshmem_num_vectors();
+  m->nodes[self].jobs_completed = 0;
+  next_probe_us = time_usec();
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+    if (!stats[i].speed)
+      stats[i].speed = MESH_SPEED_ONE;
+  if (!place_rng)
+    place_rng = (uint32_t)rdtsc() | 1;
+}
+
+/* The mesh vector wakes the node's loop without a trip through its
+ * response ring; a node with one shared vector gets vector 0
+ */
+static void kick(uint32_t node) {
+  volatile mesh_node_t *n = &ipc_mesh_table()->nodes[node];
+  uint32_t peer = n->doorbell_peer;
+  if (peer)
+    ivshmem_ring_doorbell(peer - 1, n->doorbell_vectors > IVSHMEM_VEC_MESH
+                                        ? IVSHMEM_VEC_MESH
+                                        : IVSHMEM_VEC_RSP);
+}
+
+static int node_alive(uint32_t node) {
+  return (int)node != self && ipc_mesh_node_up(node);
+}
+
+static uint32_t load_now(void) {
+  uint32_t n = ipc_completion_inflight();
+  return n >= MESH_LOAD_FULL ? 100 : n * 100 / MESH_LOAD_FULL;
+}
+
+static pending_t *pending_find(uint32_t seq) {
+  for (uint32_t i = 0; i < MESH_WORK_PENDING; i++)
+    if (pending[i].seq == seq)
+      return &pending[i];
+  return NULL;
+}
+
+/* Interrupts off */
+static uint32_t send(uint32_t dst, uint16_t type, uint32_t job_id,
+                     uint32_t step_id, uint32_t model, uint32_t payload_id,
+                     ipc_completion_cb_t cb, void *arg) {
+  if (!work || dst >= MES_MAX_NODES || (int)dst == self ||
+      outstanding[dst] >= MESH_WORK_SLOTS)
+    return 0;
+  pending_t *p = pending_find(0);
+  if (!p)
+    return 0;
+  volatile mesh_sub_ring_t *r = &work->pairs[self][dst].sub;
+  uint32_t head = r->head;
+  if (head - r->tail >= MESH_WORK_SLOTS)
+    return 0;
+
+  uint32_t seq = next_seq++;
+  if (!next_seq)
+    next_seq = 1;
+  if (type == STEP_TYPE_COMPUTE && payload_id && loan_take(dst, seq, payload_id) != 0)
+    return 0;
+  volatile mesh_work_req_t *q = &r->slot[head & SLOT_MASK];
+  q->seq = seq;
+  q->type = type;
+  q->epoch = (uint16_t)ipc_mesh_node_epoch((uint32_t)self);
+  q->job_id = job_id;
+  q->step_id = step_id;
+  q->model = model;
+  q->payload_id = payload_id;
+  q->submit_tsc = rdtsc();
+  __asm__ __volatile__("" ::: "memory");
+  r->head = head + 1;
+
+  p->seq = seq;
+  p->dst = dst;
+  p->epoch = (uint16_t)ipc_mesh_node_epoch(dst);
+  p->probe = type == STEP_TYPE_CONTROL;
+  p->cb = cb;
+  p->arg = arg;
+  outstanding[dst]++;
+  if (!p->probe) {
+    stats[dst].submitted++;
+    if (!stats[dst].first_submit_us)
+      stats[dst].first_submit_us = time_usec();
+  }
+  kick(dst);
+  return seq;
+}
+
+static uint32_t blob_home(uint32_t blob) {
+  if (blob && home[blob % HOME_SLOTS].blob == blob)
+    return home[blob % HOME_SLOTS].node;
+  return (uint32_t)self;
+}
+
+/* Whether a step can go to node now */
+static int place_ok(uint32_t node) {
+  if ((int)node == self)
+    return 1;
+  return node_alive(node) && stats[node].reachable && outstanding[node] < MESH_WORK_SLOTS;
+}
+
+/* Completion predicted for a step of est_us (kb of input from home) on
+ * node: queue ahead of it plus its own run, scaled by the node's speed,
+ * plus getting there
+ */
+static uint32_t place_predict(volatile mesh_table_t *m, uint32_t node, uint32_t est_us,
+                              uint32_t kb, uint32_t home_node) {
+  uint64_t run = (uint64_t)est_us * stats[node].speed / MESH_SPEED_ONE;
+  uint64_t queue, transit = 0;
+  if ((int)node == self) {
+    queue = ipc_completion_inflight();
+  } else {
+    queue = (uint64_t)m->nodes[node].cpu_load * MESH_LOAD_FULL / 100;
+    if (outstanding[node] > queue)
+      queue = outstanding[node];
+    transit = stats[node].dispatch_avg_us;
+    /* A heartbeat that stopped moving costs what it has been quiet for */
+    usec_t age = ipc_mesh_node_age_us(node);
+    if (age > 2 * MESH_HEARTBEAT_US)
+      transit += age - 2 * MESH_HEARTBEAT_US;
+  }
+  if (node != home_node)
+    transit += (uint64_t)kb * MESH_PLACE_FAR_US_PER_KB;
+  uint64_t t = transit + (queue + 1) * run;
+  return t > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)t;
+}
+
+static uint32_t place_rand(void) {
+  place_rng ^= place_rng << 13;
+  place_rng ^= place_rng >> 17;
+  place_rng ^= place_rng << 5;
+  return place_rng;
+}
+
+/* Interrupts off. A request that wants no completion; 0 if the ring is
+ * full
+ */
+static int notify(uint32_t dst, uint16_t type, uint32_t seq, uint32_t payload_id) {
+  volatile mesh_sub_ring_t *r = &work->pairs[self][dst].sub;
+  uint32_t head = r->head;
+  if (head - r->tail >= MESH_WORK_SLOTS)
+    return 0;
+  volatile mesh_work_req_t *q = &r->slot[head & SLOT_MASK];
+  q->seq = seq;
+  q->type = type;
+  q->epoch = (uint16_t)ipc_mesh_node_epoch((uint32_t)self);
+  q->job_id = 0;
+  q->step_id = 0;
+  q->model = 0;
+  q->payload_id = payload_id;
+  q->submit_tsc = 0;
+  __asm__ __volatile__("" ::: "memory");
+  r->head = head + 1;
+  kick(dst);
+  return 1;
+}
+
+int mesh_work_place(uint32_t job_id, uint32_t step_id, uint32_t est_us,
+                    uint32_t input_blob, uint32_t *predicted_us) {
+  volatile mesh_table_t *m = ipc_mesh_table();
+  if (!m || !work)
+    return -1;
+  if (!est_us)
+    est_us = job_step_default_us(STEP_TYPE_COMPUTE);
+
+  uint32_t cand[MES_MAX_NODES], n = 0;
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+    if (place_ok(i))
+      cand[n++] = i;
+
+  uint32_t kb = 0;
+  heap_blob_t *b = input_blob ? heap_get_blob((uint16_t)input_blob) : NULL;
+  if (b)
+    kb = (b->size + 1023) / 1024;
+  uint32_t home_node = blob_home(input_blob);
+
+  /* Two choices: random ones, the input's home (when it can take the
+   * step) as the second
+   */
+  uint32_t a = cand[0], c = cand[n - 1];
+  if (n > 2) {
+    a = cand[place_rand() % n];
+    if (home_node != a && place_ok(home_node)) {
+      c = home_node;
+    } else {
+      c = cand[place_rand() % (n - 1)];
+      if (c == a)
+        c = cand[n - 1];
+    }
+  }
+
+  uint32_t pa = place_predict(m, a, est_us, kb, home_node);
+  uint32_t pc = place_predict(m, c, est_us, kb, home_node);
+  uint32_t best = a, pred = pa;
+  if (pc < pa || (pc == pa && (int)c == self)) {
+    best = c;
+    pred = pc;
+  }
+
+  stats[best].placed++;
+  *predicted_us = pred;
+  flightrec_log(TRACE_EVT_MESH_PLACE, job_id, step_id,
+                (best << 24) | (pred > 0xFFFFFF ? 0xFFFFFF : pred));
+  return (int)best;
+}
+
+void mesh_work_place_done(uint32_t node, uint32_t job_id, uint32_t step_id,
+                          uint32_t est_us, uint32_t predicted_us,
+                          uint32_t actual_us, uint32_t exec_us) {
+  if (node >= MES_MAX_NODES)
+    return;
+  mesh_work_stats_t *st = &stats[node];
+  if (est_us && exec_us) {
+    uint64_t r = (uint64_t)exec_us * MESH_SPEED_ONE / est_us;
+    if (r < MESH_SPEED_ONE / 8)
+      r = MESH_SPEED_ONE / 8;
+    if (r > MESH_SPEED_ONE * 16)
+      r = MESH_SPEED_ONE * 16;
+    st->speed = (uint32_t)(((uint64_t)st->speed * 7 + r) / 8);
+  }
+  int32_t regret = (int32_t)(actual_us - predicted_us);
+  st->regret_avg_us = (st->regret_avg_us * 7 + regret) / 8;
+  hdr_hist_record(&regret_hist, regret < 0 ? (uint32_t)-regret : (uint32_t)regret);
+  flightrec_log(TRACE_EVT_MESH_REGRET, job_id, step_id, (uint32_t)regret);
+}
+
+uint32_t mesh_work_submit(uint32_t dst, uint32_t job_id, uint32_t step_id,
+                          uint32_t model, uint32_t payload_id,
+                          ipc_completion_cb_t cb, void *arg) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  uint32_t seq = send(dst, STEP_TYPE_COMPUTE, job_id, step_id, model, payload_id, cb, arg);
+  if (was)
+    interrupts_enable();
+  return seq;
+}
+
+/* Interrupts off */
+static void cancel(pending_t *p) {
+  outstanding[p->dst]--;
+  if (!p->probe)
+    stats[p->dst].failed++;
+  p->seq = 0;
+}
+
+void mesh_work_cancel(uint32_t handle) {
+  if (!handle)
+    return;
+  int was = interrupts_enabled();
+  interrupts_disable();
+  pending_t *p = pending_find(handle);
+  if (p)
+    cancel(p);
+  if (was)
+    interrupts_enable();
+}
+
+uint32_t mesh_work_lent(uint32_t blob) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < MESH_WORK_LOANS; i++)
+    if (loans[i].seq && loans[i].blob == blob)
+      n++;
+  return n;
+}
+
+void mesh_work_count_copy(uint32_t node, uint32_t bytes) {
+  if (node < MES_MAX_NODES)
+    stats[node].copied_bytes += bytes;
+}
+
+uint32_t mesh_work_inflight(void) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+    n += outstanding[i];
+  return n;
+}
+
+/* Completion callback of a served step's bridge request (maybe IRQ) */
+static void serve_done(const ipc_response_t *rsp, void *arg) {
+  serving_t *s = (serving_t *)arg;
+  s->rsp = *rsp;
+  s->state = SERVE_DONE;
+}
+
+static serving_t *serving_free(void) {
+  for (uint32_t i = 0; i < MESH_WORK_SERVING; i++)
+    if (serving[i].state == SERVE_FREE)
+      return &serving[i];
+  return NULL;
+}
+
+/* Take peers' requests while there is room to run them */
+static void serve_accept(void) {
+  for (uint32_t src = 0; src < MES_MAX_NODES; src++) {
+    if (!node_alive(src))
+      continue;
+    volatile mesh_sub_ring_t *r = &work->pairs[src][self].sub;
+    while (r->tail != r->head) {
+      uint32_t tail = r->tail;
+      volatile mesh_work_req_t *q = &r->slot[tail & SLOT_MASK];
+      if (q->type == MESH_WORK_RELEASE) {
+        uint32_t seq = q->seq, blob = q->payload_id;
+        uint16_t epoch = q->epoch;
+        __asm__ __volatile__("" ::: "memory");
+        r->tail = tail + 1;
+        /* An old incarnation's loans were reclaimed when it went down */
+        if (epoch == (uint16_t)ipc_mesh_node_epoch(src))
+          loan_returned(src, seq, blob);
+        continue;
+      }
+      serving_t *s = serving_free();
+      if (!s)
+        return;
+      s->req.seq = q->seq;
+      s->req.type = q->type;
+      s->req.job_id = q->job_id;
+      s->req.step_id = q->step_id;
+      s->req.model = q->model;
+      s->req.payload_id = q->payload_id;
+      s->req.submit_tsc = q->submit_tsc;
+      uint16_t epoch = q->epoch;
+      __asm__ __volatile__("" ::: "memory");
+      r->tail = tail + 1;
+
+      /* Left over from an incarnation of src we already evicted */
+      s->epoch = ipc_mesh_node_epoch(src);
+      if (epoch != (uint16_t)s->epoch)
+        continue;
+
+      s->src = src;
+      s->start = rdtsc();
+      s->rsp.status = RSP_OK;
+      s->rsp.result = 0;
+      s->owes = s->req.type == STEP_TYPE_COMPUTE && s->req.payload_id;
+      if (s->req.type != STEP_TYPE_COMPUTE) {
+        s->state = SERVE_DONE;
+        continue;
+      }
+      /* A handle whose blob was freed (or its slot reused) is stale */
+      if (s->req.payload_id && !heap_get_blob((uint16_t)s->req.payload_id)) {
+        s->rsp.status = RSP_ERROR;
+        s->state = SERVE_DONE;
+        continue;
+      }
+      ipc_tag_t tag = ipc_run_model_submit(s->req.model, s->req.payload_id);
+      if (tag == IPC_TAG_NONE) {
+        s->rsp.status = RSP_BUSY;
+        s->state = SERVE_DONE;
+        continue;
+      }
+      s->state = SERVE_RUNNING;
+      ipc_completion_set_cb(tag, serve_done, s);
+    }
+  }
+}
+
+/* Answer finished requests; one whose completion ring is full waits */
+static void serve_complete(volatile mesh_table_t *m) {
+  for (uint32_t i = 0; i < MESH_WORK_SERVING; i++) {
+    serving_t *s = &serving[i];
+    if (s->state != SERVE_DONE)
+      continue;
+    if (!node_alive(s->src) || ipc_mesh_node_epoch(s->src) != s->epoch) {
+      s->state = SERVE_FREE;
+      continue;
+    }
+    volatile mesh_cpl_ring_t *r = &work->pairs[s->src][self].cpl;
+    uint32_t head = r->head;
+    if (head - r->tail >= MESH_WORK_SLOTS)
+      continue;
+    /* Done with the input: the lender may free it from here on */
+    if (s->owes) {
+      if (!notify(s->src, MESH_WORK_RELEASE, s->req.seq, s->req.payload_id))
+        continue;
+      s->owes = 0;
+    }
+
+    volatile mesh_work_cpl_t *c = &r->slot[head & SLOT_MASK];
+    c->seq = s->req.seq;
+    c->status = s->rsp.status;
+    c->epoch = (uint16_t)ipc_mesh_node_epoch((uint32_t)self);
+    c->result = s->rsp.result;
+    c->exec_us = (uint32_t)cycles_to_usec(rdtsc() - s->start);
+    c->submit_tsc = s->req.submit_tsc;
+    __asm__ __volatile__("" ::: "memory");
+    r->head = head + 1;
+
+    if (s->req.type == STEP_TYPE_COMPUTE) {
+      stats[s->src].served++;
+      m->nodes[self].jobs_completed++;
+    }
+    s->state = SERVE_FREE;
+    kick(s->src);
+  }
+}
+
+/* Interrupts off; the callback runs with them off too */
+static void deliver(uint32_t dst, const mesh_work_cpl_t *c) {
+  pending_t *p = pending_find(c->seq);
+  if (!p || p->dst != dst || p->epoch != c->epoch)
+    return;   /* Cancelled, or from before dst rejoined */
+
+  mesh_work_stats_t *st = &stats[dst];
+  usec_t rtt = cycles_to_usec(rdtsc() - c->submit_tsc);
+  uint32_t d = rtt > c->exec_us ? (uint32_t)(rtt - c->exec_us) : 0;
+  st->dispatch_avg_us = st->reachable ? (st->dispatch_avg_us * 7 + d) / 8 : d;
+  if (d > st->dispatch_max_us)
+    st->dispatch_max_us = d;
+  if (!st->reachable) {
+    st->reachable = 1;
+    console_write("[mesh] node ");
+    print_uint(dst);
+    console_write(" reachable, dispatch ");
+    print_uint(d);
+    console_write("us\n");
+  }
+
+  outstanding[dst]--;
+  p->seq = 0;
+  if (p->probe) {
+    st->probes++;
+    probe_out[dst] = 0;
+    return;
+  }
+
+  if (c->status == RSP_OK)
+    st->completed++;
+  else
+    st->failed++;
+  st->exec_avg_us = st->completed + st->failed > 1 ? (st->exec_avg_us * 7 + c->exec_us) / 8
+                                                   : c->exec_us;
+  st->last_done_us = time_usec();
+
+  ipc_response_t rsp;
+  rsp.status = c->status;
+  rsp.orig_cmd = CMD_RUN_MODEL;
+  rsp.result = c->result;
+  rsp.timestamp = c->exec_us;
+  rsp.tag = IPC_TAG_NONE;
+  rsp.reserved = 0;
+  if (c->status == RSP_OK && c->result && c->result <= 0xFFFF) {
+    home[c->result % HOME_SLOTS].blob = (uint16_t)c->result;
+    home[c->result % HOME_SLOTS].node = (uint8_t)dst;
+  }
+  if (p->cb)
+    p->cb(&rsp, p->arg);
+}
+
+static void reap(void) {
+  for (uint32_t dst = 0; dst < MES_MAX_NODES; dst++) {
+    if (!node_alive(dst))
+      continue;
+    volatile mesh_cpl_ring_t *r = &work->pairs[self][dst].cpl;
+    while (r->tail != r->head) {
+      uint32_t tail = r->tail;
+      volatile mesh_work_cpl_t *q = &r->slot[tail & SLOT_MASK];
+      mesh_work_cpl_t c;
+      c.seq = q->seq;
+      c.status = q->status;
+      c.result = q->result;
+      c.exec_us = q->exec_us;
+      c.submit_tsc = q->submit_tsc;
+      c.epoch = q->epoch;
+      __asm__ __volatile__("" ::: "memory");
+      r->tail = tail + 1;
+      deliver(dst, &c);
+    }
+  }
+}
+
+/* A probe unanswered for a whole period marks its node unreachable */
+static void probe(usec_t now) {
+  if (now < next_probe_us)
+    return;
+  next_probe_us = now + MESH_WORK_PROBE_US;
+  for (uint32_t dst = 0; dst < MES_MAX_NODES; dst++) {
+    if (!node_alive(dst))
+      continue;
+    if (probe_out[dst]) {
+      pending_t *p = pending_find(probe_out[dst]);
+      if (p)
+        cancel(p);
+      probe_out[dst] = 0;
+      stats[dst].reachable = 0;
+    }
+    probe_out[dst] = send(dst, STEP_TYPE_CONTROL, 0, 0, 0, 0, NULL, NULL);
+  }
+}
+
+void mesh_work_poll(void) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+
+  /* Membership first: evicted peers' requests fail here */
+  ipc_mesh_update();
+  volatile mesh_table_t *m = ipc_mesh_table();
+  if (!m || !work) {
+    if (was)
+      interrupts_enable();
+    return;
+  }
+
+  m->nodes[self].cpu_load = load_now();
+  serve_accept();
+  ipc_run_model_flush(0);
+  serve_complete(m);
+  reap();
+  probe(time_usec());
+  if (was)
+    interrupts_enable();
+}
+
+usec_t mesh_work_next_deadline(void) {
+  usec_t beat = ipc_mesh_next_deadline();
+  if (!work)
+    return beat;
+  return beat && beat < next_probe_us ? beat : next_probe_us;
+}
+
+void mesh_work_get_stats(uint32_t node, mesh_work_stats_t *out) {
+  if (node < MES_MAX_NODES)
+    *out = stats[node];
+}
+
+void mesh_work_dump(void) {
+  if (!work) {
+    console_write("[mesh] no work rings\n");
+    return;
+  }
+  console_write("[mesh] work rings, ");
+  print_uint(mesh_work_inflight());
+  console_write(" of ours in flight\n");
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++) {
+    if (!node_alive(i))
+      continue;
+    const mesh_work_stats_t *st = &stats[i];
+    console_write("  node ");
+    print_uint(i);
+    console_write(st->reachable ? ": " : " (unreachable): ");
+    print_uint(st->completed);
+    console_write("/");
+    print_uint(st->submitted);
+    console_write(" steps (");
+    print_uint(st->failed);
+    console_write(" failed), served ");
+    print_uint(st->served);
+    console_write(", dispatch avg ");
+    print_uint(st->dispatch_avg_us);
+    console_write("us max ");
+    print_uint(st->dispatch_max_us);
+    console_write("us, exec avg ");
+    print_uint(st->exec_avg_us);
+    console_write("us, lent ");
+    print_uint(st->lent);
+    console_write(" (");
+    print_uint(st->returned);
+    console_write(" back, ");
+    print_uint(st->reclaimed);
+    console_write(" reclaimed), ");
+    print_uint((uint32_t)(st->handoff_bytes >> 10));
+    console_write("KB by handle, ");
+    print_uint((uint32_t)(st->copied_bytes >> 10));
+    console_write("KB copied");
+    if (st->completed && st->last_done_us > st->first_submit_us) {
+      console_write(", ");
+      print_uint((uint32_t)((uint64_t)st->completed * 1000000 /
+                            (st->last_done_us - st->first_submit_us)));
+      console_write(" steps/s");
+    }
+    console_write("\n");
+  }
+
+  console_write("  placement:");
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++) {
+    if ((int)i != self && !node_alive(i))
+      continue;
+    const mesh_work_stats_t *st = &stats[i];
+    console_write(" node ");
+    print_uint(i);
+    console_write(" x");
+    print_uint(st->placed);
+    console_write(" speed ");
+    print_uint(st->speed * 100 / MESH_SPEED_ONE);
+    console_write("% regret ");
+    if (st->regret_avg_us < 0)
+      console_write("-");
+    print_uint(st->regret_avg_us < 0 ? (uint32_t)-st->regret_avg_us : (uint32_t)st->regret_avg_us);
+    console_write("us;");
+  }
+  console_write(" |regret| p50 ");
+  print_uint(hdr_hist_value_at(&regret_hist, 500));
+  console_write("us p99 ");
+  print_uint(hdr_hist_value_at(&regret_hist, 990));
+  console_write("us\n");
+}
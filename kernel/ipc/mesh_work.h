@@ -0,0 +1,141 @@
+/* kernel/ipc/mesh_work.h - Running steps on other mesh nodes
+ *
+ * Kernels sharing the ivshmem device see each other in the mesh table and
+ * pass steps through per-pair rings (mesh_work_table_t). The sender picks
+ * the least loaded alive node, submits the step with its input blob and
+ * gets the result blob back through a completion callback, the same shape
+ * as a tagged bridge request. The receiver runs it through its own bridge
+ * (ipc_run_model_submit) and answers once the bridge does.
+ *
+ * Nothing here runs behind the caller's back: mesh_work_poll() serves
+ * requests from peers, sends completions and reaps answers; the main loop
+ * and anyone waiting on remote steps call it. Nodes that publish a
+ * doorbell peer id get a doorbell after each request and completion.
+ *
+ * Every node probes each alive peer once a second with an empty request,
+ * so dispatch latency is known (and a peer is trusted) before any step is
+ * sent there.
+ *
+ * Requests and completions carry the sender's membership epoch. When a
+ * peer is evicted (ipc_mesh_update()), its outstanding requests fail with
+ * MESH_RSP_NODE_DOWN and anything it left in the rings is dropped, so a
+ * rejoined node never sees answers meant for its previous incarnation.
+ *
+ * Placement (mesh_work_place()) predicts when a step would finish on a
+ * node: its queue (our requests there, or the bridge requests its
+ * cpu_load stands for) times the step's estimated duration scaled by
+ * what the node has taken for past steps, plus dispatch latency, a
+ * penalty for a heartbeat gone quiet and one per KB of input that lives
+ * on another node. It compares two random candidates (power of two
+ * choices), the input's home node standing in for the second. Every
+ * decision and its regret, actual minus predicted completion, go to the
+ * flight recorder.
+ */
+
+#ifndef _IPC_MESH_WORK_H
+#define _IPC_MESH_WORK_H
+
+#include "completion.h"
+#include "ipc_proto.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MESH_WORK_PENDING   16          /* Own requests in flight */
+#define MESH_WORK_SERVING   8           /* Peers' requests running here */
+#define MESH_WORK_LOANS     32          /* Our blobs held by other nodes */
+#define MESH_WORK_PROBE_US  (1000 * 1000)
+#define MESH_LOAD_FULL      8           /* Bridge requests in flight = 100% load */
+#define MESH_PLACE_FAR_US_PER_KB 1      /* Input on another node */
+#define MESH_SPEED_ONE      256         /* mesh_work_stats_t.speed of a node
+                                           as fast as the estimates */
+
+/* Completion status of requests to a node evicted from the mesh */
+#define MESH_RSP_NODE_DOWN  0x80FF
+
+typedef struct {
+  uint32_t submitted;       /* Steps sent to the node */
+  uint32_t completed;
+  uint32_t failed;          /* Error status, cancelled or lost */
+  uint32_t probes;          /* Probe round trips */
+  uint32_t served;          /* Steps run here for the node */
+  uint32_t dispatch_avg_us; /* Round trip minus remote run time, 1/8 EWMA */
+  uint32_t dispatch_max_us;
+  uint32_t exec_avg_us;     /* Remote run time of steps, 1/8 EWMA */
+  uint64_t first_submit_us; /* time_usec() of the first step, for throughput */
+  uint64_t last_done_us;
+  uint8_t  reachable;       /* Has answered at least once */
+  uint32_t placed;          /* Steps mesh_work_place() chose it for */
+  uint32_t lent;            /* Blobs lent to the node */
+  uint32_t returned;        /* Loans it gave back */
+  uint32_t reclaimed;       /* Loans taken back when it went down */
+  uint64_t handoff_bytes;   /* Bytes it got by handle instead of a copy */
+  uint64_t copied_bytes;    /* Bytes we copied to it (ring collectives) */
+  uint32_t speed;           /* Run time / estimate, MESH_SPEED_ONE = 1, 1/8 EWMA */
+  int32_t  regret_avg_us;   /* Actual - predicted completion, 1/8 EWMA */
+} mesh_work_stats_t;
+
+/* Clear the rings to and from this node; ipc_mesh_init() calls it once
+ * the node has its slot
+ */
+void mesh_work_init(void);
+
+/* Node was evicted: fail requests to it, forget its requests here */
+void mesh_work_peer_down(uint32_t node);
+
+/* Node to run step step_id of job job_id on, est_us its estimated run
+ * time and input_blob its input (0 = none), from this node and the alive,
+ * reachable nodes with a free ring slot; this node on a tie. *predicted_us
+ * gets the predicted completion time there. Returns -1 outside a mesh
+ */
+int mesh_work_place(uint32_t job_id, uint32_t step_id, uint32_t est_us,
+                    uint32_t input_blob, uint32_t *predicted_us);
+
+/* A step placed on node finished after actual_us, exec_us of it running
+ * (rsp->timestamp): learn the node's speed and log the regret
+ */
+void mesh_work_place_done(uint32_t node, uint32_t job_id, uint32_t step_id,
+                          uint32_t est_us, uint32_t predicted_us,
+                          uint32_t actual_us, uint32_t exec_us);
+
+/* Send a step to node dst, lending it payload_id; cb(rsp, arg) gets
+ * result (its reference now ours), status and the remote run time in
+ * rsp->timestamp, from mesh_work_poll().
+ * Returns: handle, 0 if no pending slot or loan, or the ring to dst is full
+ */
+uint32_t mesh_work_submit(uint32_t dst, uint32_t job_id, uint32_t step_id,
+                          uint32_t model, uint32_t payload_id,
+                          ipc_completion_cb_t cb, void *arg);
+
+/* Forget a request; a late completion is dropped. Its input stays lent
+ * until the node gives it back (or goes down)
+ */
+void mesh_work_cancel(uint32_t handle);
+
+/* Nodes blob is still lent to */
+uint32_t mesh_work_lent(uint32_t blob);
+
+/* Account bytes copied to node, for transports that cannot hand off */
+void mesh_work_count_copy(uint32_t node, uint32_t bytes);
+
+/* Requests of this node in flight anywhere */
+uint32_t mesh_work_inflight(void);
+
+/* Serve peers, send due completions and probes, deliver answers */
+void mesh_work_poll(void);
+
+/* time_usec() mesh_work_poll() next has a probe or heartbeat due,
+ * 0 = never
+ */
+usec_t mesh_work_next_deadline(void);
+
+void mesh_work_get_stats(uint32_t node, mesh_work_stats_t *out);
+void mesh_work_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_MESH_WORK_H */
@@ -0,0 +1,238 @@
+/* kernel/ipc/run_batch.c - CMD_RUN_MODEL micro-batcher
+ *
+ * A small pool of batch records, each open (collecting requests for one
+ * model), in flight (sent, kept until the batch response so its tags can
+ * be failed if the bridge rejects it) or free. A record is only touched with
+ * interrupts off while open; once marked in flight it belongs to whoever
+ * sends it, then to the batch completion callback.
+ */
+
+#include "run_batch.h"
+#include "../arch/idt.h"
+#include "../trace/klog.h"
+#include "heap.h"
+#include "ipc.h"
+#include <stddef.h>
+
+enum { BATCH_FREE = 0, BATCH_OPEN, BATCH_SENT };
+
+typedef struct {
+  volatile uint8_t state;
+  uint32_t model;
+  uint32_t count;
+  usec_t opened_us;
+  ipc_run_batch_entry_t entries[IPC_RUN_BATCH_MAX];
+} run_batch_t;
+
+static run_batch_t batches[IPC_RUN_BATCH_QUEUES];
+static uint32_t window_us = IPC_RUN_BATCH_WINDOW_US;
+static uint32_t max_batch = IPC_RUN_BATCH_MAX;
+static ipc_run_batch_stats_t stats;
+
+static inline int irq_save(void) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  return was;
+}
+
+static inline void irq_restore(int was) {
+  if (was)
+    interrupts_enable();
+}
+
+/* Complete a request locally; a no-op if it already completed */
+static void request_fail(uint32_t tag) {
+  ipc_response_t rsp;
+  rsp.status = RSP_ERROR;
+  rsp.orig_cmd = CMD_RUN_MODEL;
+  rsp.result = 0;
+  rsp.timestamp = 0;
+  rsp.tag = tag;
+  rsp.reserved = 0;
+  if (ipc_completion_deliver(&rsp))
+    stats.failed++;
+}
+
+static void batch_free(run_batch_t *b) {
+  int f = irq_save();
+  b->count = 0;
+  b->state = BATCH_FREE;
+  irq_restore(f);
+}
+
+/* Bridge answered the batch: its entries have had their own responses, so
+ * on error only those it never got to are still pending
+ */
+static void batch_done(const ipc_response_t *rsp, void *arg) {
+  run_batch_t *b = (run_batch_t *)arg;
+  if (rsp->status != RSP_OK) {
+    KLOG2(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "run batch of %u failed (status=%x)",
+          b->count, rsp->status);
+    for (uint32_t i = 0; i < b->count; i++)
+      request_fail(b->entries[i].tag);
+  }
+  batch_free(b);
+}
+
+/* Send each entry as its own CMD_RUN_MODEL */
+static void batch_send_each(run_batch_t *b) {
+  for (uint32_t i = 0; i < b->count; i++) {
+    const ipc_run_batch_entry_t *e = &b->entries[i];
+    if (ipc_send_tagged(CMD_RUN_MODEL, e->input_blob, 0, e->tag) != 0)
+      request_fail(e->tag);
+  }
+  batch_free(b);
+}
+
+/* b is BATCH_SENT and ours */
+static void batch_send(run_batch_t *b) {
+  if (b->count > stats.max_seen)
+    stats.max_seen = b->count;
+
+  if (b->count == 1) {
+    stats.singles++;
+    batch_send_each(b);
+    return;
+  }
+
+  uint32_t size = offsetof(ipc_run_batch_t, entries) +
+                  b->count * sizeof(ipc_run_batch_entry_t);
+  uint16_t id = heap_alloc(size, BLOB_TYPE_RAW);
+  ipc_run_batch_t *desc = id ? (ipc_run_batch_t *)heap_get_data(id) : NULL;
+  if (!desc) {
+    if (id)
+      heap_free(id);
+    KLOG1(KLOG_SUBSYS_IPC, KLOG_LVL_WARN, "no heap for a run batch of %u, sending singly",
+          b->count);
+    batch_send_each(b);
+    return;
+  }
+
+  desc->count = b->count;
+  desc->model = b->model;
+  for (uint32_t i = 0; i < b->count; i++)
+    desc->entries[i] = b->entries[i];
+
+  if (ipc_submit_cb(CMD_RUN_MODEL_BATCH, id, 0, batch_done, b) == IPC_TAG_NONE) {
+    heap_free(id);
+    batch_send_each(b);
+    return;
+  }
+  stats.batches++;
+}
+
+ipc_tag_t ipc_run_model_submit(uint32_t model, uint32_t input_blob) {
+  ipc_tag_t tag = ipc_completion_reserve();
+  if (tag == IPC_TAG_NONE)
+    return IPC_TAG_NONE;
+  /* The bridge reads the input in place until it answers */
+  ipc_completion_lend(tag, (uint16_t)input_blob);
+
+  if (window_us == 0 || max_batch <= 1) {
+    stats.direct++;
+    if (ipc_send_tagged(CMD_RUN_MODEL, input_blob, 0, tag) != 0) {
+      ipc_completion_cancel(tag);
+      return IPC_TAG_NONE;
+    }
+    return tag;
+  }
+
+  int f = irq_save();
+  run_batch_t *b = NULL;
+  run_batch_t *spare = NULL;
+  for (uint32_t i = 0; i < IPC_RUN_BATCH_QUEUES; i++) {
+    if (batches[i].state == BATCH_OPEN && batches[i].model == model) {
+      b = &batches[i];
+      break;
+    }
+    if (batches[i].state == BATCH_FREE && !spare)
+      spare = &batches[i];
+  }
+  if (!b && spare) {
+    b = spare;
+    b->model = model;
+    b->count = 0;
+    b->opened_us = time_usec();
+    b->state = BATCH_OPEN;
+  }
+  if (!b) {
+    /* Every record busy: don't hold this one back */
+    irq_restore(f);
+    stats.direct++;
+    if (ipc_send_tagged(CMD_RUN_MODEL, input_blob, 0, tag) != 0) {
+      ipc_completion_cancel(tag);
+      return IPC_TAG_NONE;
+    }
+    return tag;
+  }
+
+  b->entries[b->count].input_blob = input_blob;
+  b->entries[b->count].tag = tag;
+  b->count++;
+  stats.requests++;
+  int full = b->count >= max_batch;
+  if (full)
+    b->state = BATCH_SENT;
+  irq_restore(f);
+
+  if (full) {
+    stats.full_flushes++;
+    batch_send(b);
+  }
+  return tag;
+}
+
+uint32_t ipc_run_model_flush(int force) {
+  usec_t now = time_usec();
+  uint32_t sent = 0;
+  for (uint32_t i = 0; i < IPC_RUN_BATCH_QUEUES; i++) {
+    run_batch_t *b = &batches[i];
+    int f = irq_save();
+    int due = b->state == BATCH_OPEN && (force || now - b->opened_us >= window_us);
+    if (due)
+      b->state = BATCH_SENT;
+    irq_restore(f);
+    if (due) {
+      stats.window_flushes++;
+      batch_send(b);
+      sent++;
+    }
+  }
+  return sent;
+}
+
+typedef struct {
+  ipc_tag_t tag;
+  ipc_response_t *out;
+  int result; /* ipc_completion_poll() once it stops returning 0 */
+} run_wait_t;
+
+/* ipc_wait_until() condition: send due batches, pump, check our tag */
+static int run_model_ready(void *arg) {
+  run_wait_t *w = (run_wait_t *)arg;
+  ipc_run_model_flush(0);
+  ipc_process_responses();
+  ipc_msg_process();
+  w->result = ipc_completion_poll(w->tag, w->out);
+  return w->result != 0;
+}
+
+int ipc_run_model_wait(ipc_tag_t tag, ipc_response_t *out, usec_t timeout_us) {
+  run_wait_t w = {tag, out, 0};
+  if (ipc_wait_until(run_model_ready, &w, timeout_us) != 0)
+    return -1;
+  return w.result == 1 ? 0 : -1;
+}
+
+void ipc_run_model_config(uint32_t window, uint32_t max) {
+  if (max > IPC_RUN_BATCH_MAX)
+    max = IPC_RUN_BATCH_MAX;
+  window_us = window;
+  max_batch = max;
+  if (window == 0 || max <= 1)
+    ipc_run_model_flush(1);
+}
+
+void ipc_run_model_get_stats(ipc_run_batch_stats_t *out) {
+  *out = stats;
+}
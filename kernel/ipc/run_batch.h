@@ -0,0 +1,66 @@
+/* kernel/ipc/run_batch.h - Micro-batching of CMD_RUN_MODEL offloads
+ *
+ * Requests for the same model are held until the batch is full or its
+ * window has passed, then go out as one CMD_RUN_MODEL_BATCH so the bridge
+ * runs a single batched inference. Every request keeps its own completion
+ * tag: the bridge answers each entry separately and the completion table
+ * fans the responses back out. A batch of one goes out as a plain
+ * CMD_RUN_MODEL.
+ *
+ * Nothing sends an open batch behind the caller's back: ipc_run_model_wait()
+ * (or ipc_run_model_flush()) sends it once its window is up, so requests
+ * from other steps and jobs that arrive while a caller waits join it.
+ */
+
+#ifndef _IPC_RUN_BATCH_H
+#define _IPC_RUN_BATCH_H
+
+#include "../time/time.h"
+#include "completion.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IPC_RUN_BATCH_WINDOW_US 200 /* Default hold time of an open batch */
+#define IPC_RUN_BATCH_QUEUES      4 /* Batches open or in flight at once */
+
+/* Queue one inference of input_blob on model (0 = the bridge's choice).
+ * Returns: the request's tag, IPC_TAG_NONE if it could not be queued
+ */
+ipc_tag_t ipc_run_model_submit(uint32_t model, uint32_t input_blob);
+
+/* Wait for a submitted request, sending its batch once the window is up.
+ * Returns 0 with the response, -1 on timeout (0 = forever) or unknown tag
+ */
+int ipc_run_model_wait(ipc_tag_t tag, ipc_response_t *out, usec_t timeout_us);
+
+/* Send open batches whose window is up, or all of them when force is set.
+ * Returns: the number of batches sent
+ */
+uint32_t ipc_run_model_flush(int force);
+
+/* window_us 0 or max_batch <= 1 sends every request on its own; max_batch
+ * is capped at IPC_RUN_BATCH_MAX
+ */
+void ipc_run_model_config(uint32_t window_us, uint32_t max_batch);
+
+typedef struct {
+  uint32_t requests;       /* Requests queued into a batch */
+  uint32_t direct;         /* Requests sent on their own (batching off/full) */
+  uint32_t batches;        /* CMD_RUN_MODEL_BATCH commands sent */
+  uint32_t singles;        /* Batches of one, sent as CMD_RUN_MODEL */
+  uint32_t full_flushes;   /* Batches sent because they filled up */
+  uint32_t window_flushes; /* Batches sent when their window ran out */
+  uint32_t failed;         /* Requests completed locally with RSP_ERROR */
+  uint32_t max_seen;       /* Largest batch sent */
+} ipc_run_batch_stats_t;
+
+void ipc_run_model_get_stats(ipc_run_batch_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_RUN_BATCH_H */
@@ -0,0 +1,239 @@
+/* kernel/ipc/stats_export.c - Kernel counters on the statistics page
+ *
+ * A snapshot is gathered into a private copy first and then written to
+ * the page in one go, so the seqlock stays odd only for a memcpy: a
+ * reader retries at most once per refresh however slow the getters are.
+ */
+
+#include "stats_export.h"
+#include "heap.h"
+#include "ipc.h"
+#include "layout.h"
+#include "run_batch.h"
+#include "../include/string.h"
+#include "../mm/kheap.h"
+#include "../mm/pmm.h"
+#include "../time/time.h"
+#include "../trace/flightrec.h"
+#include "../trace/klog.h"
+#ifdef __x86_64__
+#include "../arch/percpu.h"
+#include "../arch/smp.h"
+#else
+#include "../contracts.h"
+#include "../sched/sched_core.h"
+#include "../sched/step_memo.h"
+#include "../wasm/policy_cache.h"
+#include "../wasm/wasm_model.h"
+#endif
+#include <stddef.h>
+
+_Static_assert(sizeof(ipc_stats_ipc_t) == 72 && sizeof(ipc_stats_sched_t) == 64 &&
+                   sizeof(ipc_stats_infer_t) == 64 && sizeof(ipc_stats_cpu_t) == 24,
+               "statistics sections changed size");
+_Static_assert(offsetof(ipc_stats_page_t, ipc) == 64 &&
+                   offsetof(ipc_stats_page_t, sched) == 216 &&
+                   offsetof(ipc_stats_page_t, cpu) == 360 &&
+                   offsetof(ipc_stats_page_t, contract) == 560 &&
+                   sizeof(ipc_stats_page_t) == 1072,
+               "ipc_stats_page_t layout differs between i386 and x86_64");
+#ifndef __x86_64__
+_Static_assert(SCHED_NUM_PRIOS == IPC_STATS_PRIOS, "rq_len does not match SCHED_NUM_PRIOS");
+#endif
+
+static volatile ipc_stats_page_t *page = NULL;
+static ipc_stats_page_t snap;
+static usec_t next_due = 0;
+static uint64_t publish_count = 0;
+
+/* Helper: permille of free bytes outside the largest free chunk */
+static uint32_t frag_permille(uint64_t free_bytes, uint64_t largest) {
+  if (!free_bytes || largest >= free_bytes)
+    return 0;
+  return (uint32_t)(1000 - largest * 1000 / free_bytes);
+}
+
+static void fill_heap(ipc_stats_heap_t *out) {
+  heap_stats_t h;
+  heap_get_stats(&h);
+  out->total_bytes = h.total_bytes;
+  out->free_bytes = h.free_bytes;
+  out->largest_free_bytes = h.largest_free_bytes;
+  out->peer_largest_free_bytes = h.peer_largest_free_bytes;
+  out->blobs = h.blob_count;
+  out->alloc_failures = 0;
+  for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++)
+    out->alloc_failures += h.alloc_failures[k];
+  out->compact_moves = h.compact_moves;
+  out->frag_permille = frag_permille(h.free_bytes, h.largest_free_bytes);
+}
+
+static void fill_mem(ipc_stats_mem_t *out) {
+  pmm_stats_t p;
+  kheap_stats_t k;
+  pmm_get_stats(&p);
+  kheap_get_stats(&k);
+  out->pmm_total_kb = p.total_memory_kb;
+  out->pmm_free_kb = p.free_memory_kb;
+  out->pmm_reserved_kb = p.reserved_memory_kb;
+  out->pmm_cached_pages = p.cached_pages;
+  out->kheap_total_bytes = (uint32_t)k.total_bytes;
+  out->kheap_free_bytes = (uint32_t)k.free_bytes;
+  out->kheap_largest_free = (uint32_t)k.largest_free;
+  out->kheap_frag_permille = k.frag_permille;
+  out->kheap_allocs = k.allocs;
+  out->kheap_frees = k.frees;
+  out->kheap_failures = k.failures;
+}
+
+static void fill_trace(ipc_stats_page_t *s) {
+  s->trace.flightrec_cats = flightrec_cats;
+  s->trace.klog_dropped = klog_dropped();
+#ifdef __x86_64__
+  uint32_t cpus = smp_num_cpus();
+  if (cpus > IPC_STATS_CPUS)
+    cpus = IPC_STATS_CPUS;
+  for (uint32_t i = 0; i < cpus; i++) {
+    const percpu_t *c = smp_cpu(i);
+    ipc_stats_cpu_t *out = &s->cpu[i];
+    out->trace_dropped = flightrec_dropped(i);
+    if (c) {
+      out->online = c->online;
+      out->idle_wakeups = c->idle_wakeups;
+      out->trace_events = c->trace_events;
+    }
+  }
+#else
+  uint32_t cpus = 1;
+  s->cpu[0].online = 1;
+  s->cpu[0].trace_dropped = flightrec_dropped(0);
+#endif
+  s->trace.cpus = cpus;
+}
+
+static void fill_infer(ipc_stats_infer_t *out) {
+  ipc_run_batch_stats_t b;
+  ipc_run_model_get_stats(&b);
+  out->requests = b.requests;
+  out->direct = b.direct;
+  out->batches = b.batches;
+  out->failed = b.failed;
+  out->max_batch = b.max_seen;
+#ifndef __x86_64__
+  wasm_model_stats_t m;
+  step_memo_stats_t memo;
+  policy_cache_stats_t pc;
+  wasm_model_get_stats(&m);
+  step_memo_get_stats(&memo);
+  policy_cache_get_stats(0, &pc);
+  out->model_hits = m.hits;
+  out->model_misses = m.misses;
+  out->model_evictions = m.evictions;
+  out->model_entries = m.entries;
+  out->model_copy_bytes = m.copy_bytes;
+  out->memo_lookups = memo.lookups;
+  out->memo_hits = memo.hits;
+  out->memo_inserts = memo.inserts;
+  out->memo_evictions = memo.evictions;
+  out->policy_lookups = pc.lookups;
+  out->policy_hits = pc.hits;
+#endif
+}
+
+#ifndef __x86_64__
+static void fill_sched(ipc_stats_sched_t *out) {
+  sched_stats_t st;
+  sched_get_stats(&st);
+  out->switches = st.switches;
+  out->preemptions = st.preemptions;
+  out->starved = st.starved;
+  out->timer_irqs = st.timer_irqs;
+  out->switches_per_sec = st.switches_per_sec;
+  out->rq_latency_avg_us = (uint32_t)st.rq_latency_avg_us;
+  out->rq_latency_max_us = (uint32_t)st.rq_latency_max_us;
+  out->blocked = st.blocked;
+  for (uint32_t p = 0; p < IPC_STATS_PRIOS; p++)
+    out->rq_len[p] = st.rq_len[p];
+}
+
+static void fill_contracts(ipc_stats_page_t *s) {
+  contract_usage_t u[IPC_STATS_CONTRACTS];
+  uint32_t n = contract_snapshot(u, IPC_STATS_CONTRACTS, &s->contracts_registered);
+  for (uint32_t i = 0; i < n; i++) {
+    ipc_stats_contract_t *out = &s->contract[i];
+    out->job_id = u[i].job_id;
+    out->state = (uint32_t)u[i].state;
+    out->prio = (uint32_t)u[i].prio;
+    out->cpu_used_us = u[i].cpu_used_us;
+    out->cpu_budget_us = u[i].cpu_budget_us;
+    out->mem_used_kb = u[i].mem_used_kb;
+    out->mem_budget_kb = u[i].mem_budget_kb;
+    out->violations = u[i].violations;
+  }
+  s->contracts_listed = n;
+}
+#endif
+
+/* Helper: gather a snapshot into snap and copy it to the page */
+static void publish(usec_t now) {
+  memset(&snap, 0, sizeof(snap));
+  snap.present = IPC_STATS_HAS_IPC | IPC_STATS_HAS_HEAP | IPC_STATS_HAS_MEM |
+                 IPC_STATS_HAS_TRACE | IPC_STATS_HAS_INFER;
+  ipc_stats_fill(&snap.ipc);
+  fill_heap(&snap.heap);
+  fill_mem(&snap.mem);
+  fill_trace(&snap);
+  fill_infer(&snap.infer);
+#ifndef __x86_64__
+  snap.present |= IPC_STATS_HAS_SCHED | IPC_STATS_HAS_CONTRACT;
+  fill_sched(&snap.sched);
+  fill_contracts(&snap);
+#endif
+
+  /* The header is the page's own: only the sections are copied */
+  uint32_t seq = page->seq;
+  page->seq = seq + 1;
+  __asm__ __volatile__("" ::: "memory");
+  memcpy((void *)&page->ipc, &snap.ipc, sizeof(snap) - offsetof(ipc_stats_page_t, ipc));
+  page->present = snap.present;
+  page->publish_count = ++publish_count;
+  page->usec = now;
+  __asm__ __volatile__("" ::: "memory");
+  page->seq = seq + 2;
+}
+
+void ipc_stats_init(void) {
+  page = (volatile ipc_stats_page_t *)ipc_region_ptr(IPC_REGION_STATS);
+  if (!page || ipc_region_size(IPC_REGION_STATS) < sizeof(ipc_stats_page_t)) {
+    page = NULL;
+    return;
+  }
+
+  page->magic = 0;
+  __asm__ __volatile__("" ::: "memory");
+  memset((void *)page, 0, sizeof(ipc_stats_page_t));
+  page->version = IPC_STATS_VERSION;
+  page->size = sizeof(ipc_stats_page_t);
+  page->period_us = IPC_STATS_PERIOD_US;
+  page->tsc_khz = time_get_tsc_khz();
+  publish_count = 0;
+
+  usec_t now = time_usec();
+  publish(now);
+  next_due = now + IPC_STATS_PERIOD_US;
+
+  /* Magic last: the bridge treats it as "page valid" */
+  __asm__ __volatile__("" ::: "memory");
+  page->magic = IPC_STATS_MAGIC;
+}
+
+int ipc_stats_poll(void) {
+  if (!page)
+    return 0;
+  usec_t now = time_usec();
+  if (now < next_due)
+    return 0;
+  publish(now);
+  next_due = now + IPC_STATS_PERIOD_US;
+  return 1;
+}
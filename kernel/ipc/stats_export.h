@@ -0,0 +1,31 @@
+/* kernel/ipc/stats_export.h - Kernel counters on the statistics page
+ *
+ * The main loop copies each subsystem's own counters into the seqlock
+ * page at IPC_REGION_STATS every IPC_STATS_PERIOD_US, so the bridge can
+ * scrape them as often as it likes without sending a command. Nothing on
+ * a hot path touches shared memory for it.
+ */
+
+#ifndef _IPC_STATS_EXPORT_H
+#define _IPC_STATS_EXPORT_H
+
+#include "ipc_proto.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set up the page and publish a first snapshot (called from ipc_init) */
+void ipc_stats_init(void);
+
+/* Refresh the page if IPC_STATS_PERIOD_US has passed since the last time
+ * Returns: 1 if it was refreshed, else 0
+ */
+int ipc_stats_poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_STATS_EXPORT_H */
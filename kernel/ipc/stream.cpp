@@ -0,0 +1,595 @@
+/* kernel/ipc/stream.cpp - Kernel obs/action stream channels
+ *
+ * Each stream channel is an obs/action StreamRing pair with its own wait
+ * and latency state, opened with ipc_stream_open(channel). Channel 0 sits
+ * in IPC_REGION_OBS_RING/ACT_RING and is opened by ipc_stream_init(); the
+ * rest are carved out of IPC_REGION_STREAM_CHAN and described to the
+ * bridge by the channel table at its front. The handle-less C ABI
+ * (ipc_stream_obs_pop, ipc_stream_action_push, ...) is channel 0.
+ * ZENEDGE pops observations of IPC_OBS_DIM floats and pushes actions.
+ *
+ * ipc_stream_wait() blocks for the next observation: a short adaptive
+ * spin, then MONITOR on the obs ring's head line and MWAIT, or sti;hlt
+ * (woken by the ivshmem doorbell IRQ or the timer tick) where CPUID does
+ * not expose MONITOR/MWAIT.
+ *
+ * The shim also timestamps the stream: actions carry ZENEDGE's TSC, and
+ * HDR histograms track obs pop -> action push (inference), action push ->
+ * next obs pop (bridge turnaround) and, once the clock is synced at
+ * CMD_ENV_RESET, bridge obs publish -> pop (obs transit).
+ */
+
+#include "stream_ring.hpp"
+
+extern "C" {
+#include "../arch/idt.h"
+#include "../console.h"
+#include "../time/time.h"
+#include "../trace/flightrec.h"
+#include "ipc.h"
+#include "layout.h"
+}
+
+using zenedge::ObsEntry;
+using zenedge::StreamRing;
+
+typedef StreamRing<ObsEntry<IPC_OBS_DIM>, IPC_STREAM_DEPTH> obs_ring_t;
+typedef StreamRing<action_entry_t, IPC_STREAM_DEPTH> act_ring_t;
+
+static_assert(sizeof(ObsEntry<IPC_OBS_DIM>) == sizeof(obs_entry_t) &&
+                  sizeof(obs_entry_t) == IPC_OBS_ENTRY_SIZE(IPC_OBS_DIM),
+              "obs_entry_t must match ObsEntry<IPC_OBS_DIM>");
+static_assert(sizeof(action_entry_t) == IPC_ACT_ENTRY_SIZE,
+              "action_entry_t must be IPC_ACT_ENTRY_SIZE bytes");
+static_assert((IPC_STREAM_DEPTH & (IPC_STREAM_DEPTH - 1)) == 0 &&
+                  IPC_STREAM_DEPTH <= IPC_OBS_RING_SIZE,
+              "stream depth must fit the smallest layout");
+
+static_assert((IPC_OBS_POLICY & ~IPC_RING_POLICY_MASK) == 0,
+              "IPC_OBS_POLICY must be an IPC_RING_POLICY_* value");
+
+struct ipc_stream {
+  obs_ring_t obs;
+  act_ring_t act;
+  uint32_t id;
+  uint32_t open;
+
+  /* Private copy of the ring placement; the shared table is for the bridge */
+  void *obs_base;
+  uint32_t obs_bytes;
+  void *act_base;
+  uint32_t act_bytes;
+  volatile ipc_stream_chan_t *slot; /* Shared table entry (NULL if no table) */
+
+  /* Observation wait */
+  uint32_t wait_ewma_us; /* Wait time, 1/8 EWMA */
+  ipc_stream_wait_stats_t wait_stats;
+
+  /* Latency tracking. TSC marks of the last obs pop and action push not
+   * yet paired with the other side; 0 = none outstanding.
+   */
+  hdr_hist_t lat_hist[IPC_STREAM_LAT_COUNT];
+  uint64_t lat_pop_tsc;
+  uint64_t lat_push_tsc;
+
+  /* Bridge clock at clock_sync_tsc (valid once clock_synced) */
+  int clock_synced;
+  uint32_t clock_seq_seen;
+  uint64_t clock_sync_tsc;
+  uint64_t clock_sync_ns;
+  uint32_t clock_err_ns; /* Half the sync round trip */
+};
+
+static ipc_stream_t channels[IPC_STREAM_CHANNELS];
+static ipc_stream_t *const chan0 = &channels[0];
+
+/* Carve channels 1.. out of the channel region and publish the table */
+static void chan_table_build(void) {
+  uint8_t *region = static_cast<uint8_t *>(ipc_region_ptr(IPC_REGION_STREAM_CHAN));
+  uint32_t region_offset = ipc_region_offset(IPC_REGION_STREAM_CHAN);
+  uint32_t entries = ipc_region_entries(IPC_REGION_OBS_RING);
+  volatile ipc_stream_chan_table_t *table =
+      reinterpret_cast<volatile ipc_stream_chan_table_t *>(region);
+
+  chan0->obs_base = ipc_region_ptr(IPC_REGION_OBS_RING);
+  chan0->obs_bytes = ipc_region_size(IPC_REGION_OBS_RING);
+  chan0->act_base = ipc_region_ptr(IPC_REGION_ACT_RING);
+  chan0->act_bytes = ipc_region_size(IPC_REGION_ACT_RING);
+
+  uint32_t count = 1;
+  if (region && ipc_region_size(IPC_REGION_STREAM_CHAN) >=
+                    IPC_CHAN_REGION_BYTES(IPC_STREAM_CHANNELS, entries, sizeof(obs_entry_t)))
+    count = IPC_STREAM_CHANNELS;
+
+  uint32_t cursor = IPC_LAYOUT_ALIGN;
+  for (uint32_t i = 0; i < IPC_STREAM_CHANNELS; i++) {
+    ipc_stream_t *s = &channels[i];
+    s->id = i;
+    s->wait_ewma_us = IPC_SPIN_BUDGET_US;
+    if (i == 0 || i >= count)
+      continue;
+    s->obs_base = region + cursor;
+    s->obs_bytes = IPC_CHAN_RING_BYTES(entries, sizeof(obs_entry_t));
+    cursor += s->obs_bytes;
+    s->act_base = region + cursor;
+    s->act_bytes = IPC_CHAN_RING_BYTES(entries, sizeof(action_entry_t));
+    cursor += s->act_bytes;
+  }
+  if (!table)
+    return;
+
+  table->magic = 0;
+  __asm__ __volatile__("" ::: "memory");
+  table->count = count;
+  for (uint32_t i = 0; i < count; i++) {
+    ipc_stream_t *s = &channels[i];
+    volatile ipc_stream_chan_t *c = &table->chans[i];
+    c->state = IPC_CHAN_CLOSED;
+    c->id = i;
+    c->job_id = 0;
+    c->cpu = IPC_CHAN_CPU_ANY;
+    if (i == 0) {
+      c->obs_offset = ipc_region_offset(IPC_REGION_OBS_RING);
+      c->act_offset = ipc_region_offset(IPC_REGION_ACT_RING);
+    } else {
+      c->obs_offset = region_offset + (uint32_t)(static_cast<uint8_t *>(s->obs_base) - region);
+      c->act_offset = region_offset + (uint32_t)(static_cast<uint8_t *>(s->act_base) - region);
+    }
+    c->obs_size = s->obs_bytes;
+    c->act_size = s->act_bytes;
+    s->slot = c;
+  }
+
+  /* Magic last: the bridge treats it as "table valid" */
+  __asm__ __volatile__("" ::: "memory");
+  table->magic = IPC_CHAN_MAGIC;
+}
+
+extern "C" void ipc_stream_init(void) {
+  for (uint32_t i = 0; i < IPC_STREAM_CHANNELS; i++) {
+    if (channels[i].open)
+      ipc_stream_close(&channels[i]);
+    channels[i].slot = NULL;
+    channels[i].obs_base = NULL;
+    channels[i].act_base = NULL;
+  }
+  chan_table_build();
+  ipc_stream_open(0);
+}
+
+extern "C" ipc_stream_t *ipc_stream_open(uint32_t channel) {
+  if (channel >= IPC_STREAM_CHANNELS)
+    return NULL;
+  ipc_stream_t *s = &channels[channel];
+  if (s->open)
+    return s;
+  if (!s->obs_base || !s->act_base)
+    return NULL;
+
+  if (s->obs.attach(s->obs_base, s->obs_bytes, IPC_STREAM_MAGIC, IPC_OBS_POLICY) != 0 ||
+      s->act.attach(s->act_base, s->act_bytes, IPC_STREAM_MAGIC) != 0)
+    return NULL;
+
+  s->wait_ewma_us = IPC_SPIN_BUDGET_US;
+  s->wait_stats = ipc_stream_wait_stats_t();
+  s->clock_synced = 0;
+  s->clock_seq_seen = 0;
+  ipc_stream_reset_latency(s);
+  s->open = 1;
+  if (s->slot) {
+    __asm__ __volatile__("" ::: "memory");
+    s->slot->state = IPC_CHAN_OPEN;
+  }
+  return s;
+}
+
+extern "C" void ipc_stream_close(ipc_stream_t *s) {
+  if (!s || !s->open)
+    return;
+  if (s->slot) {
+    s->slot->state = IPC_CHAN_CLOSED;
+    s->slot->job_id = 0;
+    s->slot->cpu = IPC_CHAN_CPU_ANY;
+  }
+  s->obs.detach();
+  s->act.detach();
+  s->open = 0;
+}
+
+extern "C" void ipc_stream_bind(ipc_stream_t *s, uint32_t job_id, uint32_t cpu) {
+  if (!s || !s->slot)
+    return;
+  s->slot->job_id = job_id;
+  s->slot->cpu = cpu;
+}
+
+extern "C" int ipc_stream_ready(void) {
+  return chan0->obs.ready() && chan0->act.ready();
+}
+
+extern "C" int ipc_stream_obs_pending(void) {
+  return chan0->obs.ready() && chan0->obs.pending() != 0;
+}
+
+static uint32_t cycles_ns(uint64_t cycles) {
+  uint32_t mhz = time_get_cpu_mhz();
+  if (!mhz)
+    return 0;
+  uint64_t ns = cycles * 1000 / mhz;
+  return ns > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)ns;
+}
+
+static void lat_note_pop(ipc_stream_t *s, const obs_entry_t *e, uint32_t n) {
+  if (!n)
+    return;
+  uint64_t now = time_cycles();
+
+  if (s->lat_push_tsc) {
+    hdr_hist_record(&s->lat_hist[IPC_STREAM_LAT_TURNAROUND], cycles_ns(now - s->lat_push_tsc));
+    s->lat_push_tsc = 0;
+  }
+  if (!s->lat_pop_tsc)
+    s->lat_pop_tsc = now;
+
+  if (!s->clock_synced)
+    return;
+  uint32_t mhz = time_get_cpu_mhz();
+  uint32_t bridge_now = (uint32_t)(s->clock_sync_ns + (now - s->clock_sync_tsc) * 1000 / mhz);
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t transit = bridge_now - e[i].ts;
+    /* Within the sync error the stamp may look slightly in the future */
+    hdr_hist_record(&s->lat_hist[IPC_STREAM_LAT_TRANSIT], transit > 0x7FFFFFFFu ? 0 : transit);
+  }
+}
+
+static void lat_note_push(ipc_stream_t *s, uint64_t now, uint32_t n) {
+  if (!n)
+    return;
+  if (s->lat_pop_tsc) {
+    hdr_hist_record(&s->lat_hist[IPC_STREAM_LAT_INFER], cycles_ns(now - s->lat_pop_tsc));
+    s->lat_pop_tsc = 0;
+  }
+  s->lat_push_tsc = now;
+}
+
+extern "C" int ipc_stream_push(ipc_stream_t *s, uint32_t seq, uint16_t action,
+                               uint32_t ack_seq) {
+  if (!s)
+    return -1;
+  uint64_t now = time_cycles();
+  action_entry_t e;
+  e.seq = seq;
+  e.action = action;
+  e.flags = 0;
+  e.ack_seq = ack_seq;
+  e.ts = (uint32_t)now;
+  int rc = s->act.push(e);
+  lat_note_push(s, now, rc == 0);
+  return rc;
+}
+
+extern "C" int ipc_stream_pop(ipc_stream_t *s, obs_entry_t *out) {
+  if (!s)
+    return 0;
+  int n = s->obs.pop(reinterpret_cast<ObsEntry<IPC_OBS_DIM> *>(out));
+  lat_note_pop(s, out, (uint32_t)n);
+  return n;
+}
+
+extern "C" uint32_t ipc_stream_pop_burst(ipc_stream_t *s, obs_entry_t *out, uint32_t max) {
+  if (!s)
+    return 0;
+  uint32_t n = s->obs.pop_burst(reinterpret_cast<ObsEntry<IPC_OBS_DIM> *>(out), max);
+  lat_note_pop(s, out, n);
+  return n;
+}
+
+extern "C" uint32_t ipc_stream_push_burst(ipc_stream_t *s, action_entry_t *in,
+                                          uint32_t count) {
+  if (!s)
+    return 0;
+  uint64_t now = time_cycles();
+  for (uint32_t i = 0; i < count; i++)
+    in[i].ts = (uint32_t)now;
+  uint32_t n = s->act.push_burst(in, count);
+  lat_note_push(s, now, n);
+  return n;
+}
+
+extern "C" int ipc_stream_sync_clock(ipc_stream_t *s, uint64_t sent_tsc) {
+  const volatile ipc_ring_hdr_t *hdr = s ? s->obs.header() : NULL;
+  if (!hdr || !time_get_cpu_mhz())
+    return -1;
+
+  uint32_t seq = hdr->clock_seq;
+  if (seq == 0 || seq == s->clock_seq_seen)
+    return -1; /* Bridge did not publish its clock for this reset */
+  __asm__ __volatile__("" ::: "memory");
+  uint64_t ns = hdr->clock_ns;
+  uint64_t now = time_cycles();
+
+  s->clock_seq_seen = seq;
+  s->clock_sync_tsc = sent_tsc + (now - sent_tsc) / 2;
+  s->clock_sync_ns = ns;
+  s->clock_err_ns = cycles_ns((now - sent_tsc) / 2);
+  s->clock_synced = 1;
+  ipc_stream_reset_latency(s);
+
+  /* For timelines merged off-box: the bridge's clock at the event's time */
+  uint64_t at = ns + cycles_ns(time_cycles() - s->clock_sync_tsc);
+  flightrec_log(TRACE_EVT_CLOCK_SYNC, (uint32_t)at, (uint32_t)(at >> 32), s->clock_err_ns);
+  return 0;
+}
+
+extern "C" const hdr_hist_t *ipc_stream_hist(const ipc_stream_t *s, uint32_t which) {
+  return s && which < IPC_STREAM_LAT_COUNT ? &s->lat_hist[which] : NULL;
+}
+
+extern "C" void ipc_stream_reset_latency(ipc_stream_t *s) {
+  if (!s)
+    return;
+  for (uint32_t i = 0; i < IPC_STREAM_LAT_COUNT; i++)
+    hdr_hist_reset(&s->lat_hist[i]);
+  s->lat_pop_tsc = 0;
+  s->lat_push_tsc = 0;
+}
+
+/* Observation wait.
+ *
+ * The spin budget follows the smoothed wait time the same way the response
+ * wait does: while observations come back within IPC_SPIN_BUDGET_US the
+ * consumer spins for twice the mean, otherwise it goes straight to sleep.
+ */
+enum { WAIT_UNPROBED = -1, WAIT_HLT = 0, WAIT_MWAIT = 1 };
+
+static int wait_mode = WAIT_UNPROBED;
+
+static void wait_probe(void) {
+  uint32_t eax = 1, ebx, ecx, edx;
+  __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  wait_mode = ((ecx >> 3) & 1) ? WAIT_MWAIT : WAIT_HLT; /* CPUID.1:ECX.MONITOR */
+}
+
+static uint32_t wait_spin_budget(const ipc_stream_t *s) {
+  if (s->wait_ewma_us > IPC_SPIN_BUDGET_US)
+    return 0;
+  uint32_t budget = s->wait_ewma_us * 2;
+  return budget > IPC_SPIN_BUDGET_US ? IPC_SPIN_BUDGET_US : budget;
+}
+
+static void wait_note(ipc_stream_t *s, usec_t waited, uint32_t *count,
+                      uint64_t *total, uint32_t *max) {
+  (*count)++;
+  *total += waited;
+  if (waited > *max)
+    *max = (uint32_t)waited;
+
+  /* Saturate idle gaps so a burst after a pause re-enters spin mode fast */
+  if (waited > 4 * IPC_SPIN_BUDGET_US)
+    waited = 4 * IPC_SPIN_BUDGET_US;
+  s->wait_ewma_us = (uint32_t)((s->wait_ewma_us * 7 + waited) / 8);
+}
+
+/* One sleep until the head line is written or an interrupt arrives. The
+ * pending() recheck after arming closes the race with a push in between.
+ */
+static void wait_sleep(ipc_stream_t *s) {
+  const volatile uint32_t *head = &s->obs.header()->head;
+  /* With interrupts off neither the timer tick nor the doorbell IRQ can
+   * end the sleep, so a timeout would never fire: poll instead.
+   */
+  if (!interrupts_enabled()) {
+    __asm__ __volatile__("pause");
+    return;
+  }
+
+  usec_t t0 = time_usec();
+  if (wait_mode == WAIT_MWAIT) {
+    __asm__ __volatile__("monitor" ::"a"(head), "c"(0), "d"(0));
+    if (s->obs.pending())
+      return;
+    __asm__ __volatile__("mwait" ::"a"(0), "c"(0) : "memory");
+    s->wait_stats.mwait_sleeps++;
+  } else {
+    interrupts_disable();
+    if (s->obs.pending()) {
+      interrupts_enable();
+      return;
+    }
+    __asm__ __volatile__("sti; hlt" ::: "memory");
+    s->wait_stats.hlt_sleeps++;
+  }
+  s->wait_stats.sleep_usec += time_usec() - t0;
+}
+
+extern "C" int ipc_stream_wait(ipc_stream_t *s, uint64_t timeout_us) {
+  if (!s || !s->obs.ready())
+    return -1;
+  if (s->obs.pending())
+    return 0;
+  if (wait_mode == WAIT_UNPROBED)
+    wait_probe();
+
+  ipc_stream_wait_stats_t &w = s->wait_stats;
+  usec_t start = time_usec();
+  uint32_t budget = wait_spin_budget(s);
+
+  if (budget) {
+    usec_t now = start;
+    while (now - start < budget) {
+      __asm__ __volatile__("pause");
+      now = time_usec();
+      if (s->obs.pending()) {
+        w.spin_usec += now - start;
+        wait_note(s, now - start, &w.spin_hits, &w.spin_wait_usec, &w.spin_wait_max_us);
+        return 0;
+      }
+    }
+    w.spin_usec += now - start;
+  }
+
+  for (;;) {
+    if (timeout_us && time_usec() - start >= timeout_us) {
+      w.timeouts++;
+      return -1;
+    }
+    wait_sleep(s);
+    if (s->obs.pending()) {
+      wait_note(s, time_usec() - start, &w.sleep_hits, &w.sleep_wait_usec,
+                &w.sleep_wait_max_us);
+      return 0;
+    }
+  }
+}
+
+extern "C" void ipc_stream_wait_stats(const ipc_stream_t *s, ipc_stream_wait_stats_t *out) {
+  if (!s || !out)
+    return;
+  *out = s->wait_stats;
+  out->ewma_us = s->wait_ewma_us;
+  out->spin_budget_us = wait_spin_budget(s);
+  out->mwait = (uint32_t)(wait_mode == WAIT_MWAIT);
+}
+
+/* Channel 0, for callers predating channels */
+
+extern "C" int ipc_stream_action_push(uint32_t seq, uint16_t action, uint32_t ack_seq) {
+  return ipc_stream_push(chan0, seq, action, ack_seq);
+}
+
+extern "C" int ipc_stream_obs_pop(obs_entry_t *out) {
+  return ipc_stream_pop(chan0, out);
+}
+
+extern "C" uint32_t ipc_stream_obs_pop_burst(obs_entry_t *out, uint32_t max) {
+  return ipc_stream_pop_burst(chan0, out, max);
+}
+
+extern "C" uint32_t ipc_stream_action_push_burst(action_entry_t *in, uint32_t count) {
+  return ipc_stream_push_burst(chan0, in, count);
+}
+
+extern "C" int ipc_stream_wait_obs(uint64_t timeout_us) {
+  return ipc_stream_wait(chan0, timeout_us);
+}
+
+extern "C" void ipc_stream_wait_get_stats(ipc_stream_wait_stats_t *out) {
+  ipc_stream_wait_stats(chan0, out);
+}
+
+extern "C" int ipc_stream_clock_sync(uint64_t sent_tsc) {
+  return ipc_stream_sync_clock(chan0, sent_tsc);
+}
+
+extern "C" const hdr_hist_t *ipc_stream_latency(uint32_t which) {
+  return ipc_stream_hist(chan0, which);
+}
+
+extern "C" void ipc_stream_latency_reset(void) {
+  ipc_stream_reset_latency(chan0);
+}
+
+static void dump_ring(const char *name, const volatile ipc_ring_hdr_t *hdr) {
+  static const char *const policies[] = {"fifo", "drop-oldest", "latest", "?"};
+
+  console_write(name);
+  if (!hdr) {
+    console_write(": not attached\n");
+    return;
+  }
+  console_write(" (");
+  console_write(policies[(hdr->flags & IPC_RING_POLICY_MASK) >> IPC_RING_POLICY_SHIFT]);
+  console_write("): head ");
+  print_uint(hdr->head);
+  console_write(" tail ");
+  print_uint(hdr->tail);
+  console_write(" max occupancy ");
+  print_uint(hdr->max_occupancy);
+  console_write("/");
+  print_uint(hdr->size);
+  console_write(" overruns ");
+  print_uint(hdr->overruns);
+  console_write(" drops ");
+  print_uint(hdr->drops);
+  console_write("\n");
+}
+
+static void dump_latency(const char *name, const hdr_hist_t *h) {
+  console_write(name);
+  console_write(": n ");
+  print_uint(h->count);
+  if (h->count) {
+    console_write(" p50 ");
+    print_uint(hdr_hist_value_at(h, 500));
+    console_write(" p90 ");
+    print_uint(hdr_hist_value_at(h, 900));
+    console_write(" p99 ");
+    print_uint(hdr_hist_value_at(h, 990));
+    console_write(" p99.9 ");
+    print_uint(hdr_hist_value_at(h, 999));
+    console_write(" max ");
+    print_uint(h->max);
+    console_write(" ns");
+  }
+  console_write("\n");
+}
+
+static void dump_channel(const ipc_stream_t *s) {
+  console_write("[ipc] stream channel ");
+  print_uint(s->id);
+  if (s->slot) {
+    console_write(" job ");
+    print_uint(s->slot->job_id);
+    if (s->slot->cpu != IPC_CHAN_CPU_ANY) {
+      console_write(" cpu ");
+      print_uint(s->slot->cpu);
+    }
+  }
+  console_write("\n");
+  dump_ring("[ipc]   OBS stream", s->obs.header());
+  dump_ring("[ipc]   ACT stream", s->act.header());
+
+  /* Wakeup latency (mean wait per mode) against the CPU it cost */
+  const ipc_stream_wait_stats_t &w = s->wait_stats;
+  uint64_t total = w.spin_usec + w.sleep_usec;
+  console_write("[ipc]   OBS wait (");
+  console_write(wait_mode == WAIT_MWAIT ? "mwait" : "hlt");
+  console_write("): spin hits ");
+  print_uint(w.spin_hits);
+  console_write(" avg ");
+  print_uint(w.spin_hits ? (uint32_t)(w.spin_wait_usec / w.spin_hits) : 0);
+  console_write("us, sleep hits ");
+  print_uint(w.sleep_hits);
+  console_write(" avg ");
+  print_uint(w.sleep_hits ? (uint32_t)(w.sleep_wait_usec / w.sleep_hits) : 0);
+  console_write("us max ");
+  print_uint(w.sleep_wait_max_us);
+  console_write("us, timeouts ");
+  print_uint(w.timeouts);
+  console_write(", busy ");
+  print_uint(total ? (uint32_t)(w.spin_usec * 100 / total) : 0);
+  console_write("%\n");
+
+  dump_latency("[ipc]   lat obs->action", &s->lat_hist[IPC_STREAM_LAT_INFER]);
+  dump_latency("[ipc]   lat action->obs", &s->lat_hist[IPC_STREAM_LAT_TURNAROUND]);
+  if (s->clock_synced) {
+    dump_latency("[ipc]   lat obs transit", &s->lat_hist[IPC_STREAM_LAT_TRANSIT]);
+    console_write("[ipc]   bridge clock sync +/- ");
+    print_uint(s->clock_err_ns);
+    console_write(" ns\n");
+  } else {
+    console_write("[ipc]   bridge clock not synced (no obs transit)\n");
+  }
+}
+
+extern "C" void ipc_stream_dump(void) {
+  uint32_t shown = 0;
+  for (uint32_t i = 0; i < IPC_STREAM_CHANNELS; i++) {
+    if (channels[i].open) {
+      dump_channel(&channels[i]);
+      shown++;
+    }
+  }
+  if (!shown)
+    console_write("[ipc] no stream channels open\n");
+}
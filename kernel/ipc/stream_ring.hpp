@@ -0,0 +1,318 @@
+/* kernel/ipc/stream_ring.hpp - Compile-time-typed SPSC stream ring
+ *
+ * StreamRing<Entry, N> drives one lock-free stream ring (ipc_ring_hdr_t
+ * followed by N Entry slots) in shared memory. The entry size and capacity
+ * are constants, so slot addressing folds to a shift and a mask. attach()
+ * publishes entry_size (and obs_dim for observation rings) in the header,
+ * and the bridge sizes its struct formats from that rather than
+ * hardcoding them.
+ *
+ * The overflow policy (IPC_RING_POLICY_*) travels in the header flags, and
+ * overrun/drop/high-water counters sit on the owning side's cache line.
+ *
+ * Only one side may push and only one side may pop. Header-only; C files
+ * reach the kernel's obs/action rings through the ipc_stream_* shim in
+ * stream.cpp.
+ */
+
+#ifndef _IPC_STREAM_RING_HPP
+#define _IPC_STREAM_RING_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern "C" {
+#include "ipc_proto.h"
+}
+
+namespace zenedge {
+
+/* Observation entry of width Dim (same layout as obs_entry_t for
+ * Dim == IPC_OBS_DIM).
+ */
+template <uint32_t Dim>
+struct ObsEntry {
+  static_assert(Dim > 0 && Dim <= IPC_OBS_DIM_MAX, "obs width out of range");
+  static constexpr uint32_t kDim = Dim;
+
+  uint32_t seq;      /* Monotonic step id */
+  float obs[Dim];    /* Observation vector */
+  float reward;
+  float done;
+  float model_id;    /* Blob id (float32 for compatibility) */
+  uint32_t ts;       /* Producer publish time (see obs_entry_t) */
+};
+
+/* Observation width of an entry type (0 for non-observation entries) */
+template <typename Entry>
+struct EntryObsDim {
+  static constexpr uint32_t value = 0;
+};
+
+template <uint32_t Dim>
+struct EntryObsDim<ObsEntry<Dim>> {
+  static constexpr uint32_t value = Dim;
+};
+
+template <typename Entry, uint32_t N>
+class StreamRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+ public:
+  static constexpr uint32_t kEntrySize = sizeof(Entry);
+  static constexpr uint32_t kCapacity = N;
+  static constexpr uint32_t kMask = N - 1;
+  static constexpr uint32_t kObsDim = EntryObsDim<Entry>::value;
+  /* Bytes the ring occupies: header plus slots */
+  static constexpr uint32_t kBytes = IPC_RING_HDR_SIZE + N * kEntrySize;
+
+  /* Bind to a ring region of `bytes` bytes, (re)initialising the header
+   * unless it already describes this ring. Returns 0, or -1 if the
+   * region is missing or too small.
+   */
+  int attach(void *region, uint32_t bytes, uint32_t magic,
+             uint32_t policy = IPC_RING_POLICY_FIFO) {
+    hdr_ = nullptr;
+    if (!region || bytes < kBytes)
+      return -1;
+
+    volatile ipc_ring_hdr_t *hdr = static_cast<volatile ipc_ring_hdr_t *>(region);
+    slots_ = reinterpret_cast<Entry *>(static_cast<uint8_t *>(region) + IPC_RING_HDR_SIZE);
+
+    if (hdr->magic != magic || hdr->version != IPC_PROTO_VERSION ||
+        hdr->size != N || hdr->entry_size != kEntrySize || hdr->obs_dim != kObsDim ||
+        hdr->flags != policy) {
+      hdr->magic = 0;
+      __asm__ __volatile__("" ::: "memory");
+      hdr->head = 0;
+      hdr->tail = 0;
+      hdr->overruns = 0;
+      hdr->max_occupancy = 0;
+      hdr->clock_seq = 0;
+      hdr->clock_ns = 0;
+      hdr->drops = 0;
+      hdr->size = N;
+      hdr->mask = kMask;
+      hdr->flags = policy & IPC_RING_POLICY_MASK;
+      hdr->entry_size = kEntrySize;
+      hdr->obs_dim = kObsDim;
+      hdr->version = IPC_PROTO_VERSION;
+
+      /* Magic last: the bridge treats it as "ring valid" */
+      __asm__ __volatile__("" ::: "memory");
+      hdr->magic = magic;
+    }
+
+    magic_ = magic;
+    policy_ = hdr->flags & IPC_RING_POLICY_MASK;
+    head_cache_ = hdr->head;
+    tail_cache_ = hdr->tail;
+    hdr_ = hdr;
+    return 0;
+  }
+
+  /* Unbind, clearing the magic so the peer sees the ring as gone */
+  void detach() {
+    if (hdr_)
+      hdr_->magic = 0;
+    hdr_ = nullptr;
+  }
+
+  bool ready() const { return hdr_ && hdr_->magic == magic_; }
+
+  uint32_t policy() const { return policy_; }
+
+  /* Shared header, for reporting the counters (nullptr until attached) */
+  const volatile ipc_ring_hdr_t *header() const { return hdr_; }
+
+  /* Producer: 0 on success, -1 if the ring is full (FIFO only) or not
+   * attached. The overwrite policies always push.
+   */
+  int push(const Entry &e) {
+    if (!ready())
+      return -1;
+
+    uint32_t head = hdr_->head;
+    if (reserve(head, 1) == 0)
+      return -1;
+
+    slots_[head & kMask] = e;
+    __asm__ __volatile__("" ::: "memory");
+    hdr_->head = head + 1;
+    return 0;
+  }
+
+  /* Consumer: 1 with *out filled, 0 if the ring is empty or not attached.
+   * Under LATEST this is the newest entry; older ones count as drops.
+   */
+  int pop(Entry *out) {
+    if (!ready() || !out)
+      return 0;
+    if (policy_ != IPC_RING_POLICY_FIFO)
+      return (int)pop_overwrite(out, 1);
+
+    uint32_t tail = hdr_->tail;
+    if (tail == head_cache_) {
+      head_cache_ = hdr_->head;
+      if (tail == head_cache_)
+        return 0;
+    }
+
+    __asm__ __volatile__("" ::: "memory");
+    *out = slots_[tail & kMask];
+    __asm__ __volatile__("" ::: "memory");
+    hdr_->tail = tail + 1;
+    return 1;
+  }
+
+  /* Producer burst: publish up to `count` entries with a single head
+   * update. Returns how many were pushed (0 if full or not attached).
+   */
+  uint32_t push_burst(const Entry *in, uint32_t count) {
+    if (!ready() || !in)
+      return 0;
+
+    uint32_t head = hdr_->head;
+    count = reserve(head, count);
+
+    for (uint32_t i = 0; i < count; i++)
+      slots_[(head + i) & kMask] = in[i];
+    if (count) {
+      __asm__ __volatile__("" ::: "memory");
+      hdr_->head = head + count;
+    }
+    return count;
+  }
+
+  /* Consumer burst: take up to `max` entries with a single tail update.
+   * Returns how many were copied to out (0 if empty or not attached).
+   */
+  uint32_t pop_burst(Entry *out, uint32_t max) {
+    if (!ready() || !out)
+      return 0;
+    if (policy_ != IPC_RING_POLICY_FIFO)
+      return pop_overwrite(out, policy_ == IPC_RING_POLICY_LATEST ? 1 : max);
+
+    uint32_t tail = hdr_->tail;
+    uint32_t avail = head_cache_ - tail;
+    if (avail < max) {
+      head_cache_ = hdr_->head;
+      avail = head_cache_ - tail;
+    }
+    if (max > avail)
+      max = avail;
+    if (max == 0)
+      return 0;
+
+    __asm__ __volatile__("" ::: "memory");
+    for (uint32_t i = 0; i < max; i++)
+      out[i] = slots_[(tail + i) & kMask];
+    __asm__ __volatile__("" ::: "memory");
+    hdr_->tail = tail + max;
+    return max;
+  }
+
+  /* Consumer: entries published but not yet popped (0 if not attached).
+   * Re-reads head, so it doubles as the recheck before sleeping.
+   */
+  uint32_t pending() {
+    if (!ready())
+      return 0;
+    head_cache_ = hdr_->head;
+    return head_cache_ - hdr_->tail;
+  }
+
+  /* No constructor: a namespace-scope instance is zero-initialised (not
+   * attached) and needs no global constructor.
+   */
+ private:
+  /* Producer: how many of `count` entries may go in at head, updating the
+   * overrun and high-water counters. FIFO clamps to the free space and
+   * counts one overrun per stall; the overwrite policies take up to N,
+   * lapping the consumer, and count each entry overwritten unread.
+   */
+  uint32_t reserve(uint32_t head, uint32_t count) {
+    uint32_t used = head - tail_cache_;
+    if (used + count > N || used + count > max_occupancy_) {
+      tail_cache_ = hdr_->tail;
+      used = head - tail_cache_;
+    }
+    if (used > N)
+      used = N; /* Lapped consumer (overwrite policies) */
+
+    if (used + count > N) {
+      if (policy_ == IPC_RING_POLICY_FIFO) {
+        /* One overrun per stall, however often the caller retries */
+        if (!stalled_)
+          hdr_->overruns = hdr_->overruns + 1;
+        count = N - used;
+        stalled_ = (count == 0);
+      } else {
+        if (count > N)
+          count = N;
+        hdr_->overruns = hdr_->overruns + (used + count - N);
+      }
+    } else {
+      stalled_ = 0;
+    }
+
+    uint32_t occupancy = used + count;
+    if (occupancy > N)
+      occupancy = N;
+    if (occupancy > max_occupancy_) {
+      max_occupancy_ = occupancy;
+      hdr_->max_occupancy = occupancy;
+    }
+    return count;
+  }
+
+  /* Consumer under DROP_OLDEST / LATEST: the producer may be rewriting any
+   * slot at or below head - N, so copy first and re-check head after.
+   */
+  uint32_t pop_overwrite(Entry *out, uint32_t max) {
+    uint32_t tail = hdr_->tail;
+    uint32_t head = hdr_->head;
+    if (head == tail || max == 0)
+      return 0;
+
+    for (;;) {
+      uint32_t pos = tail;
+      if (policy_ == IPC_RING_POLICY_LATEST)
+        pos = head - 1;
+      else if (head - tail >= N)
+        pos = head - (N > 1 ? N / 2 : 1); /* Lapped: keep the newer half */
+
+      uint32_t n = head - pos;
+      if (n > max)
+        n = max;
+
+      __asm__ __volatile__("" ::: "memory");
+      for (uint32_t i = 0; i < n; i++)
+        out[i] = slots_[(pos + i) & kMask];
+      __asm__ __volatile__("" ::: "memory");
+
+      uint32_t now = hdr_->head;
+      if (now - pos < N) {
+        if (pos != tail)
+          hdr_->drops = hdr_->drops + (pos - tail);
+        hdr_->tail = pos + n;
+        head_cache_ = now;
+        return n;
+      }
+      head = now; /* Overwritten under us: retry nearer the head */
+    }
+  }
+
+  volatile ipc_ring_hdr_t *hdr_;
+  Entry *slots_;
+  uint32_t magic_;
+  uint32_t policy_;
+  uint32_t max_occupancy_; /* Producer's copy of the high-water mark */
+  uint32_t stalled_;       /* FIFO producer currently refused */
+  uint32_t head_cache_; /* Consumer's last view of head */
+  uint32_t tail_cache_; /* Producer's last view of tail */
+};
+
+} // namespace zenedge
+
+#endif /* _IPC_STREAM_RING_HPP */
@@ -0,0 +1,130 @@
+/* kernel/ipc/trace_export.c - Flight recorder streaming to the bridge
+ *
+ * The ring is SPSC with the main loop as its only producer, so the
+ * per-CPU flight recorder rings double as backpressure buffers: an event
+ * is read out of them only once the export ring has room for it. Events
+ * the recorder overwrites before then are counted in the header and
+ * reported in-line with a TRACE_EVT_TRACE_LOST event.
+ */
+
+#include "trace_export.h"
+#include "../trace/flightrec.h"
+#include "layout.h"
+#include <stddef.h>
+
+_Static_assert(sizeof(trace_event_t) == IPC_TRACE_ENTRY_SIZE,
+               "trace_event_t does not match IPC_TRACE_ENTRY_SIZE");
+
+#define TRACE_POLL_MAX 256  /* Events moved per ipc_trace_poll() */
+
+static volatile ipc_ring_hdr_t *ring = NULL;
+static trace_event_t *slots = NULL;
+static uint32_t ring_size = 0;  /* Private copy: the bridge can write line 0 */
+static uint32_t ring_head = 0;
+static uint32_t lost_pending = 0;
+static uint8_t stalled = 0;
+static trace_cursor_t cursor;
+
+void ipc_trace_init(void) {
+  ring = (volatile ipc_ring_hdr_t *)ipc_region_ptr(IPC_REGION_TRACE);
+  ring_size = ipc_region_entries(IPC_REGION_TRACE);
+  if (!ring || ring_size == 0 || (ring_size & (ring_size - 1))) {
+    ring = NULL;
+    return;
+  }
+  slots = (trace_event_t *)((uint8_t *)ring + IPC_RING_HDR_SIZE);
+
+  ring->magic = 0;
+  __asm__ __volatile__("" ::: "memory");
+  ring->version = IPC_PROTO_VERSION;
+  ring->size = ring_size;
+  ring->mask = ring_size - 1;
+  ring->flags = IPC_RING_POLICY_FIFO;
+  ring->entry_size = IPC_TRACE_ENTRY_SIZE;
+  ring->obs_dim = 0;
+  ring->head = 0;
+  ring->overruns = 0;
+  ring->max_occupancy = 0;
+  ring->clock_seq = 0;
+  ring->clock_ns = 0;
+  ring->lost = 0;
+  ring->tail = 0;
+  ring->drops = 0;
+  ring_head = 0;
+  lost_pending = 0;
+  stalled = 0;
+  for (uint32_t c = 0; c < TRACE_CPUS; c++)
+    cursor.pos[c] = 0;
+
+  /* Magic last: the bridge treats it as "ring valid" */
+  __asm__ __volatile__("" ::: "memory");
+  ring->magic = IPC_TRACE_MAGIC;
+}
+
+uint32_t ipc_trace_poll(void) {
+  if (!ring)
+    return 0;
+
+  uint32_t used = ring_head - ring->tail;
+  if (used > ring_size)
+    used = ring_size; /* Bogus tail from the bridge: treat as full */
+  uint32_t space = ring_size - used;
+  if (space > TRACE_POLL_MAX)
+    space = TRACE_POLL_MAX;
+  if (space == 0) {
+    if (!stalled)
+      ring->overruns++;
+    stalled = 1;
+    return 0;
+  }
+  stalled = 0;
+
+  /* Skip what the recorder overwrote meanwhile; the loss report takes a
+   * slot of its own, ahead of the events that came after the loss
+   */
+  uint32_t lost = 0;
+  flightrec_read(&cursor, NULL, 0, &lost);
+  ring->lost += lost;
+  lost_pending += lost;
+
+  uint32_t n = 0;
+  if (lost_pending) {
+    trace_event_t *e = &slots[ring_head & (ring_size - 1)];
+    e->ts_usec = time_usec();
+    e->ts_cycles = time_cycles();
+    e->type = TRACE_EVT_TRACE_LOST;
+    e->sig = 0;
+    e->cpu_id = (uint16_t)smp_cpu_id();
+    e->job_id = 0;
+    e->step_id = 0;
+    e->extra = lost_pending;
+    lost_pending = 0;
+    n++;
+  }
+
+  /* At most two contiguous runs: up to the end of the ring, then the front */
+  while (n < space) {
+    uint32_t at = (ring_head + n) & (ring_size - 1);
+    uint32_t run = space - n;
+    if (run > ring_size - at)
+      run = ring_size - at;
+
+    /* Events lapped while copied are reported on the next poll */
+    uint32_t got = flightrec_read(&cursor, &slots[at], run, &lost);
+    ring->lost += lost;
+    lost_pending += lost;
+    n += got;
+    if (got < run)
+      break;
+  }
+  if (n == 0)
+    return 0;
+
+  /* Publish: entries before head */
+  __asm__ __volatile__("" ::: "memory");
+  ring_head += n;
+  ring->head = ring_head;
+  if (used + n > ring->max_occupancy)
+    ring->max_occupancy = used + n;
+  return n;
+}
@@ -0,0 +1,33 @@
+/* kernel/ipc/trace_export.h - Flight recorder streaming to the bridge
+ *
+ * Every flight recorder event is copied, in TSC order across CPUs, into
+ * the trace export ring (IPC_REGION_TRACE), which the bridge drains to
+ * disk. Logging itself never touches shared memory: the main loop moves
+ * events over in batches.
+ */
+
+#ifndef _IPC_TRACE_EXPORT_H
+#define _IPC_TRACE_EXPORT_H
+
+#include "ipc_proto.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set up the trace export ring header (called from ipc_init). Export
+ * starts from the oldest events the flight recorder still holds.
+ */
+void ipc_trace_init(void);
+
+/* Move events logged since the last call into the ring, as many as fit.
+ * Returns: events exported
+ */
+uint32_t ipc_trace_poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPC_TRACE_EXPORT_H */
@@ -3,38 +3,204 @@
  * Job Graph implementation with tensor metadata tracking
  */
 #include "job_graph.h"
+#include "../mm/kheap.h"
+#include "../mm/pmm.h"
+
+#define JOB_INITIAL_CAP 16
+#define JOB_NO_INDEX    0xFFFFFFFFu
+
+/* ========================================================================
+ * Storage: kheap arrays and the id -> index maps
+ * ======================================================================== */
+
+/* Make room for need elements of size elem in *arr, doubling */
+static int grow(void **arr, uint32_t *cap, size_t elem, uint32_t need) {
+    if (need <= *cap)
+        return 0;
+    uint32_t n = *cap ? *cap : JOB_INITIAL_CAP;
+    while (n < need)
+        n *= 2;
+    void *p = krealloc(*arr, (size_t)n * elem);
+    if (!p)
+        return -1;
+    *arr = p;
+    *cap = n;
+    return 0;
+}
+
+static inline uint32_t id_hash(uint32_t id) {
+    return id * 2654435761u;
+}
+
+static uint32_t index_find(const job_index_t *ix, uint32_t id) {
+    if (!ix->cap)
+        return JOB_NO_INDEX;
+    uint32_t mask = ix->cap - 1;
+    for (uint32_t h = id_hash(id) & mask;; h = (h + 1) & mask) {
+        const job_index_slot_t *e = &ix->slot[h];
+        if (!e->index)
+            return JOB_NO_INDEX;
+        if (e->id == id)
+            return e->index - 1;
+    }
+}
+
+static void index_put(job_index_slot_t *slot, uint32_t cap, uint32_t id, uint32_t index) {
+    uint32_t mask = cap - 1;
+    uint32_t h = id_hash(id) & mask;
+    while (slot[h].index)
+        h = (h + 1) & mask;
+    slot[h].id = id;
+    slot[h].index = index + 1;
+}
+
+/* Add id -> index, count being the entries once it is in */
+static int index_insert(job_index_t *ix, uint32_t id, uint32_t index, uint32_t count) {
+    if ((uint64_t)count * 2 > ix->cap) {
+        uint32_t cap = ix->cap ? ix->cap * 2 : 2 * JOB_INITIAL_CAP;
+        job_index_slot_t *slot = (job_index_slot_t *)kmalloc(cap * sizeof(*slot));
+        if (!slot)
+            return -1;
+        for (uint32_t i = 0; i < cap; i++)
+            slot[i].index = 0;
+        for (uint32_t i = 0; i < ix->cap; i++)
+            if (ix->slot[i].index)
+                index_put(slot, cap, ix->slot[i].id, ix->slot[i].index - 1);
+        kfree(ix->slot);
+        ix->slot = slot;
+        ix->cap = cap;
+    }
+    index_put(ix->slot, ix->cap, id, index);
+    return 0;
+}
+
+/* Drop the compiled form; the next query compiles again */
+static void uncompile(job_graph_t *job) {
+    kfree(job->succ_off);
+    kfree(job->succ);
+    kfree(job->ready_q);
+    job->succ_off = NULL;
+    job->succ = NULL;
+    job->ready_q = NULL;
+    job->num_ready = 0;
+    job->compiled = 0;
+    job->planned = 0;
+}
 
 void job_graph_init(job_graph_t *job, job_id_t id) {
     job->id = id;
     job->num_steps = 0;
+    job->cap_steps = 0;
+    job->steps = NULL;
+    job->step_index.slot = NULL;
+    job->step_index.cap = 0;
+    job->num_edges = 0;
+    job->cap_edges = 0;
+    job->edges = NULL;
     job->num_tensors = 0;
+    job->cap_tensors = 0;
+    job->tensors = NULL;
+    job->tensor_index.slot = NULL;
+    job->tensor_index.cap = 0;
+    job->compiled = 0;
+    job->succ_off = NULL;
+    job->succ = NULL;
+    job->ready_q = NULL;
+    job->num_ready = 0;
+    job->num_completed = 0;
+    job->total_est_us = 0;
+    job->critical_path_us = 0;
     job->total_memory_kb = 0;
     job->peak_memory_kb = 0;
     job->pinned_memory_kb = 0;
+    job->planned = 0;
+    job->arena_bytes = 0;
+    job->live_peak_kb = 0;
+    job->arena_phys = 0;
+}
+
+void job_graph_free(job_graph_t *job) {
+    uncompile(job);
+    kfree(job->steps);
+    kfree(job->step_index.slot);
+    kfree(job->edges);
+    kfree(job->tensors);
+    kfree(job->tensor_index.slot);
+    job_graph_init(job, job->id);
+}
+
+/* Size an index for count entries at once, so inserting them never rehashes */
+static int index_reserve(job_index_t *ix, uint32_t count) {
+    uint32_t cap = ix->cap ? ix->cap : 2 * JOB_INITIAL_CAP;
+    while ((uint64_t)count * 2 > cap)
+        cap *= 2;
+    if (cap == ix->cap)
+        return 0;
+    job_index_slot_t *slot = (job_index_slot_t *)kmalloc(cap * sizeof(*slot));
+    if (!slot)
+        return -1;
+    for (uint32_t i = 0; i < cap; i++)
+        slot[i].index = 0;
+    for (uint32_t i = 0; i < ix->cap; i++)
+        if (ix->slot[i].index)
+            index_put(slot, cap, ix->slot[i].id, ix->slot[i].index - 1);
+    kfree(ix->slot);
+    ix->slot = slot;
+    ix->cap = cap;
+    return 0;
+}
+
+int job_graph_reserve(job_graph_t *job, uint32_t steps, uint32_t edges,
+                      uint32_t tensors)
+{
+    if (grow((void **)&job->steps, &job->cap_steps, sizeof(job_step_t),
+             job->num_steps + steps) != 0 ||
+        grow((void **)&job->edges, &job->cap_edges, sizeof(job_edge_t),
+             job->num_edges + edges) != 0 ||
+        grow((void **)&job->tensors, &job->cap_tensors, sizeof(tensor_desc_t),
+             job->num_tensors + tensors) != 0)
+        return -1;
+    if (index_reserve(&job->step_index, job->num_steps + steps) != 0 ||
+        index_reserve(&job->tensor_index, job->num_tensors + tensors) != 0)
+        return -1;
+    return 0;
 }
 
 static job_step_t *find_step(job_graph_t *job, step_id_t id) {
-    for (uint8_t i = 0; i < job->num_steps; i++) {
-        if (job->steps[i].id == id) {
-            return &job->steps[i];
-        }
-    }
-    return NULL;
+    uint32_t i = index_find(&job->step_index, id);
+    return i == JOB_NO_INDEX ? NULL : &job->steps[i];
 }
 
+/* ========================================================================
+ * Steps and dependencies
+ * ======================================================================== */
+
 int job_graph_add_step(job_graph_t *job,
                        step_id_t id,
                        step_type_t type)
 {
-    if (job->num_steps >= MAX_JOB_STEPS)
+    if (find_step(job, id))
+        return -1;
+    if (grow((void **)&job->steps, &job->cap_steps, sizeof(job_step_t),
+             job->num_steps + 1) != 0)
+        return -1;
+    if (index_insert(&job->step_index, id, job->num_steps, job->num_steps + 1) != 0)
         return -1;
 
     job_step_t *s = &job->steps[job->num_steps++];
     s->id        = id;
     s->type      = type;
     s->num_deps  = 0;
+    s->pending   = 0;
+    s->est_us    = 0;
+    s->est_learned = 0;
+    s->rank_us   = 0;
     s->ready     = 1;  /* no deps yet */
+    s->in_flight = 0;
     s->completed = 0;
+    s->node      = NUMA_NODE_ANY;
+    s->memoize   = 0;
+    s->coll_op   = COLL_OP_ALLREDUCE;
 
     /* Initialize tensor tracking */
     s->num_inputs = 0;
@@ -42,6 +208,7 @@ int job_graph_add_step(job_graph_t *job,
     s->peak_memory_kb = 0;
     s->working_set_kb = 0;
 
+    uncompile(job);
     return 0;
 }
 
@@ -49,50 +216,221 @@ int job_graph_add_dep(job_graph_t *job,
                       step_id_t step,
                       step_id_t depends_on)
 {
-    job_step_t *s  = find_step(job, step);
-    job_step_t *dp = find_step(job, depends_on);
-    if (!s || !dp)
+    uint32_t to   = index_find(&job->step_index, step);
+    uint32_t from = index_find(&job->step_index, depends_on);
+    if (to == JOB_NO_INDEX || from == JOB_NO_INDEX || to == from)
         return -1;
 
-    if (s->num_deps >= MAX_STEP_DEPS)
+    if (grow((void **)&job->edges, &job->cap_edges, sizeof(job_edge_t),
+             job->num_edges + 1) != 0)
         return -1;
 
-    s->deps[s->num_deps++] = depends_on;
+    job->edges[job->num_edges].from = from;
+    job->edges[job->num_edges].to = to;
+    job->num_edges++;
+
+    job_step_t *s = &job->steps[to];
+    s->num_deps++;
     /* step not ready until dep is completed */
-    s->ready = 0;
+    if (!job->steps[from].completed)
+        s->ready = 0;
+    uncompile(job);
     return 0;
 }
 
-void job_graph_mark_completed(job_graph_t *job, step_id_t step) {
-    job_step_t *s = find_step(job, step);
-    if (!s) return;
-    s->completed = 1;
-
-    /* naive: rescan all steps; fine for small job_graph */
-    for (uint8_t i = 0; i < job->num_steps; i++) {
-        job_step_t *t = &job->steps[i];
-        if (t->completed) continue;
-
-        uint8_t all_done = 1;
-        for (uint8_t d = 0; d < t->num_deps; d++) {
-            job_step_t *dep = find_step(job, t->deps[d]);
-            if (!dep || !dep->completed) {
-                all_done = 0;
-                break;
-            }
-        }
-        if (all_done)
+/* Pending parents of every step, from the edges and completed flags */
+static void count_pending(job_graph_t *job) {
+    for (uint32_t i = 0; i < job->num_steps; i++)
+        job->steps[i].pending = 0;
+    for (uint32_t e = 0; e < job->num_edges; e++)
+        if (!job->steps[job->edges[e].from].completed)
+            job->steps[job->edges[e].to].pending++;
+}
+
+/* Ready queue: a binary heap, highest rank_us first, then lowest index */
+static inline int ready_before(const job_graph_t *job, uint32_t a, uint32_t b) {
+    uint64_t ra = job->steps[a].rank_us;
+    uint64_t rb = job->steps[b].rank_us;
+    return ra != rb ? ra > rb : a < b;
+}
+
+static void ready_push(job_graph_t *job, uint32_t i) {
+    uint32_t *q = job->ready_q;
+    uint32_t k = job->num_ready++;
+    while (k > 0) {
+        uint32_t parent = (k - 1) / 2;
+        if (!ready_before(job, i, q[parent]))
+            break;
+        q[k] = q[parent];
+        k = parent;
+    }
+    q[k] = i;
+}
+
+static void ready_pop(job_graph_t *job) {
+    uint32_t *q = job->ready_q;
+    uint32_t n = --job->num_ready;
+    uint32_t last = q[n];
+    uint32_t k = 0;
+    for (;;) {
+        uint32_t c = 2 * k + 1;
+        if (c >= n)
+            break;
+        if (c + 1 < n && ready_before(job, q[c + 1], q[c]))
+            c++;
+        if (!ready_before(job, q[c], last))
+            break;
+        q[k] = q[c];
+        k = c;
+    }
+    q[k] = last;
+}
+
+/* Queue every unfinished step with nothing pending */
+static void seed_ready(job_graph_t *job) {
+    job->num_ready = 0;
+    for (uint32_t i = 0; i < job->num_steps; i++) {
+        job_step_t *s = &job->steps[i];
+        s->ready = s->pending == 0;
+        if (s->ready && !s->completed && !s->in_flight)
+            ready_push(job, i);
+    }
+}
+
+/* Release step i's successors: queue those with nothing left pending */
+static void release_successors(job_graph_t *job, uint32_t i) {
+    for (uint32_t e = job->succ_off[i]; e < job->succ_off[i + 1]; e++) {
+        job_step_t *t = &job->steps[job->succ[e]];
+        if (t->pending && --t->pending == 0 && !t->completed) {
             t->ready = 1;
+            ready_push(job, job->succ[e]);
+        }
     }
 }
 
-int job_graph_next_ready(const job_graph_t *job) {
-    for (uint8_t i = 0; i < job->num_steps; i++) {
-        const job_step_t *s = &job->steps[i];
-        if (s->ready && !s->completed)
-            return (int)s->id;
+/* Topological order of the unfinished steps into order[] (Kahn's
+ * algorithm, consuming pending). Returns how many were ordered: fewer than
+ * the unfinished steps means the rest sit on a cycle
+ */
+static uint32_t topo_order(job_graph_t *job, uint32_t *order) {
+    uint32_t head = 0, tail = 0;
+    for (uint32_t i = 0; i < job->num_steps; i++)
+        if (!job->steps[i].completed && job->steps[i].pending == 0)
+            order[tail++] = i;
+    while (head < tail) {
+        uint32_t i = order[head++];
+        for (uint32_t e = job->succ_off[i]; e < job->succ_off[i + 1]; e++) {
+            job_step_t *t = &job->steps[job->succ[e]];
+            if (t->pending && --t->pending == 0 && !t->completed)
+                order[tail++] = job->succ[e];
+        }
+    }
+    return tail;
+}
+
+int job_graph_compile(job_graph_t *job) {
+    if (job->compiled)
+        return 0;
+    uint32_t n = job->num_steps;
+    job->succ_off = (uint32_t *)kmalloc((n + 1) * sizeof(uint32_t));
+    job->succ = (uint32_t *)kmalloc((job->num_edges ? job->num_edges : 1) * sizeof(uint32_t));
+    job->ready_q = (uint32_t *)kmalloc((n ? n : 1) * sizeof(uint32_t));
+    if (!job->succ_off || !job->succ || !job->ready_q) {
+        uncompile(job);
+        return -1;
+    }
+
+    /* CSR by counting sort on the parent; ready_q is the fill cursor */
+    for (uint32_t i = 0; i <= n; i++)
+        job->succ_off[i] = 0;
+    for (uint32_t e = 0; e < job->num_edges; e++)
+        job->succ_off[job->edges[e].from + 1]++;
+    for (uint32_t i = 0; i < n; i++) {
+        job->succ_off[i + 1] += job->succ_off[i];
+        job->ready_q[i] = job->succ_off[i];
+    }
+    for (uint32_t e = 0; e < job->num_edges; e++)
+        job->succ[job->ready_q[job->edges[e].from]++] = job->edges[e].to;
+
+    /* Order the unfinished steps; any left out sit on a cycle */
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < n; i++)
+        done += job->steps[i].completed;
+    count_pending(job);
+    uint32_t ordered = topo_order(job, job->ready_q);
+    if (done + ordered < n) {
+        uncompile(job);
+        count_pending(job);
+        for (uint32_t i = 0; i < n; i++)
+            job->steps[i].ready = job->steps[i].pending == 0;
+        return -1;
+    }
+
+    /* Ranks from the sinks back: a step's own estimate plus its costliest
+     * successor's rank
+     */
+    job->total_est_us = 0;
+    job->critical_path_us = 0;
+    for (uint32_t i = 0; i < n; i++)
+        job->steps[i].rank_us = 0;
+    for (uint32_t k = ordered; k-- > 0;) {
+        uint32_t i = job->ready_q[k];
+        job_step_t *s = &job->steps[i];
+        uint64_t behind = 0;
+        for (uint32_t e = job->succ_off[i]; e < job->succ_off[i + 1]; e++)
+            if (job->steps[job->succ[e]].rank_us > behind)
+                behind = job->steps[job->succ[e]].rank_us;
+        uint32_t est = s->est_us ? s->est_us : 1;
+        s->rank_us = est + behind;
+        job->total_est_us += est;
+        if (s->rank_us > job->critical_path_us)
+            job->critical_path_us = s->rank_us;
+    }
+
+    count_pending(job);
+    seed_ready(job);
+    job->num_completed = done;
+    job->compiled = 1;
+    return 0;
+}
+
+void job_graph_mark_completed(job_graph_t *job, step_id_t step) {
+    uint32_t i = index_find(&job->step_index, step);
+    if (i == JOB_NO_INDEX || job->steps[i].completed)
+        return;
+    job->steps[i].completed = 1;
+    job->steps[i].in_flight = 0;
+    job->num_completed++;
+
+    /* Uncompiled: compiling counts this step as done */
+    if (job->compiled)
+        release_successors(job, i);
+}
+
+job_step_t *job_graph_next_ready_step(job_graph_t *job) {
+    if (!job->compiled && job_graph_compile(job) != 0)
+        return NULL;
+    while (job->num_ready) {
+        job_step_t *s = &job->steps[job->ready_q[0]];
+        if (!s->completed)
+            return s;
+        ready_pop(job);  /* Completed while still queued */
     }
-    return -1;
+    return NULL;
+}
+
+int job_graph_next_ready(job_graph_t *job) {
+    job_step_t *s = job_graph_next_ready_step(job);
+    return s ? (int)s->id : -1;
+}
+
+job_step_t *job_graph_take_ready(job_graph_t *job) {
+    job_step_t *s = job_graph_next_ready_step(job);
+    if (s) {
+        ready_pop(job);
+        s->in_flight = 1;
+    }
+    return s;
 }
 
 /* ========================================================================
@@ -100,12 +438,8 @@ int job_graph_next_ready(const job_graph_t *job) {
  * ======================================================================== */
 
 static tensor_desc_t *find_tensor(job_graph_t *job, tensor_id_t id) {
-    for (uint8_t i = 0; i < job->num_tensors; i++) {
-        if (job->tensors[i].id == id) {
-            return &job->tensors[i];
-        }
-    }
-    return NULL;
+    uint32_t i = index_find(&job->tensor_index, id);
+    return i == JOB_NO_INDEX ? NULL : &job->tensors[i];
 }
 
 int job_graph_add_tensor(job_graph_t *job,
@@ -115,13 +449,16 @@ int job_graph_add_tensor(job_graph_t *job,
                          uint8_t pinned,
                          uint8_t node_affinity)
 {
-    if (job->num_tensors >= MAX_JOB_TENSORS)
-        return -1;
-
     /* Check for duplicate */
     if (find_tensor(job, id))
         return -1;
 
+    if (grow((void **)&job->tensors, &job->cap_tensors, sizeof(tensor_desc_t),
+             job->num_tensors + 1) != 0)
+        return -1;
+    if (index_insert(&job->tensor_index, id, job->num_tensors, job->num_tensors + 1) != 0)
+        return -1;
+
     tensor_desc_t *t = &job->tensors[job->num_tensors++];
     t->id = id;
     t->dtype = dtype;
@@ -129,6 +466,10 @@ int job_graph_add_tensor(job_graph_t *job,
     t->size_bytes = tensor_size_bytes(dtype, num_elements);
     t->pinned = pinned;
     t->node_affinity = node_affinity;
+    t->home_node = node_affinity;
+    t->phys_addr = 0;
+    t->arena_offset = JOB_NO_OFFSET;
+    job->planned = 0;
 
     return 0;
 }
@@ -149,6 +490,7 @@ int job_graph_step_add_input(job_graph_t *job,
         return -1;
 
     s->inputs[s->num_inputs++] = tensor_id;
+    job->planned = 0;
     return 0;
 }
 
@@ -168,6 +510,7 @@ int job_graph_step_add_output(job_graph_t *job,
         return -1;
 
     s->outputs[s->num_outputs++] = tensor_id;
+    job->planned = 0;
     return 0;
 }
 
@@ -177,7 +520,7 @@ void job_graph_compute_memory(job_graph_t *job) {
     uint32_t peak = 0;
 
     /* Calculate total and pinned memory from tensors */
-    for (uint8_t i = 0; i < job->num_tensors; i++) {
+    for (uint32_t i = 0; i < job->num_tensors; i++) {
         tensor_desc_t *t = &job->tensors[i];
         uint32_t size_kb = (t->size_bytes + 1023) / 1024;
         total += size_kb;
@@ -186,7 +529,7 @@ void job_graph_compute_memory(job_graph_t *job) {
     }
 
     /* Calculate per-step memory (inputs + outputs active during execution) */
-    for (uint8_t i = 0; i < job->num_steps; i++) {
+    for (uint32_t i = 0; i < job->num_steps; i++) {
         job_step_t *s = &job->steps[i];
         uint32_t step_mem = 0;
 
@@ -213,11 +556,276 @@ void job_graph_compute_memory(job_graph_t *job) {
             peak = step_mem;
     }
 
+    /* What execution will really hold: the tensors still live, not just
+     * the step's own
+     */
+    if (job_graph_plan_memory(job) == 0)
+        peak = (job->arena_bytes + 1023) / 1024;
+
     job->total_memory_kb = total;
     job->pinned_memory_kb = pinned;
     job->peak_memory_kb = peak;
 }
 
+/* ========================================================================
+ * Memory planning
+ * ======================================================================== */
+
+typedef struct {
+    uint32_t first;     /* Plan-order positions it is live over */
+    uint32_t last;
+    uint32_t size;      /* Rounded up to JOB_ARENA_ALIGN */
+    uint8_t  produced;  /* Some step writes it */
+    uint8_t  read;      /* Some step reads it */
+    uint8_t  touched;   /* Some step reads or writes it */
+} plan_tensor_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} plan_range_t;
+
+static inline void bit_set(uint32_t *b, uint32_t i) {
+    b[i >> 5] |= 1u << (i & 31);
+}
+
+static int bits_subset(const uint32_t *a, const uint32_t *b, uint32_t words) {
+    for (uint32_t w = 0; w < words; w++)
+        if (a[w] & ~b[w])
+            return 0;
+    return 1;
+}
+
+/* Steps one at a time, as the ready heap would hand them out: order[k] is
+ * the k-th, pos[i] step i's place. Returns: steps ordered
+ */
+static uint32_t plan_order(job_graph_t *job, uint32_t *order, uint32_t *pos,
+                           uint32_t *pend) {
+    uint32_t n = job->num_steps, ready = 0, k = 0;
+    for (uint32_t i = 0; i < n; i++)
+        pend[i] = 0;
+    for (uint32_t e = 0; e < job->num_edges; e++)
+        pend[job->edges[e].to]++;
+    /* order[k .. k + ready) holds the ready steps */
+    for (uint32_t i = 0; i < n; i++)
+        if (!pend[i])
+            order[ready++] = i;
+    while (ready) {
+        uint32_t best = k;
+        for (uint32_t r = k + 1; r < k + ready; r++)
+            if (ready_before(job, order[r], order[best]))
+                best = r;
+        uint32_t i = order[best];
+        order[best] = order[k];
+        order[k] = i;
+        pos[i] = k++;
+        ready--;
+        for (uint32_t e = job->succ_off[i]; e < job->succ_off[i + 1]; e++)
+            if (--pend[job->succ[e]] == 0)
+                order[k + ready++] = job->succ[e];
+    }
+    return k;
+}
+
+/* Lowest offset where size bytes fit clear of used[0 .. count), which is
+ * sorted by start
+ */
+static uint32_t plan_first_fit(const plan_range_t *used, uint32_t count, uint32_t size) {
+    uint32_t at = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (used[i].start >= at + size)
+            break;
+        if (used[i].end > at)
+            at = used[i].end;
+    }
+    return at;
+}
+
+int job_graph_plan_memory(job_graph_t *job) {
+    if (job->planned)
+        return 0;
+    if (job_graph_compile(job) != 0)
+        return -1;
+
+    uint32_t n = job->num_steps, nt = job->num_tensors;
+    uint32_t words = (n + 31) / 32;
+    uint32_t *order = (uint32_t *)kmalloc((n ? n : 1) * 3 * sizeof(uint32_t));
+    plan_tensor_t *pt = (plan_tensor_t *)kmalloc((nt ? nt : 1) * sizeof(plan_tensor_t));
+    uint32_t *by_size = (uint32_t *)kmalloc((nt ? nt : 1) * sizeof(uint32_t));
+    plan_range_t *used = (plan_range_t *)kmalloc((nt ? nt : 1) * sizeof(plan_range_t));
+    int64_t *delta = (int64_t *)kmalloc((n + 1) * sizeof(int64_t));
+    if (!order || !pt || !by_size || !used || !delta) {
+        kfree(order);
+        kfree(pt);
+        kfree(by_size);
+        kfree(used);
+        kfree(delta);
+        return -1;
+    }
+    uint32_t *pos = order + n, *pend = order + 2 * n;
+    plan_order(job, order, pos, pend);
+
+    /* Live ranges along that order */
+    for (uint32_t t = 0; t < nt; t++) {
+        uint64_t size = ((uint64_t)job->tensors[t].size_bytes + JOB_ARENA_ALIGN - 1) &
+                        ~(uint64_t)(JOB_ARENA_ALIGN - 1);
+        pt[t].first = n;
+        pt[t].last = 0;
+        pt[t].size = size > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)size;
+        pt[t].produced = 0;
+        pt[t].read = 0;
+        pt[t].touched = 0;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const job_step_t *s = &job->steps[i];
+        for (uint32_t j = 0; j < (uint32_t)s->num_inputs + s->num_outputs; j++) {
+            int out = j >= s->num_inputs;
+            tensor_id_t id = out ? s->outputs[j - s->num_inputs] : s->inputs[j];
+            uint32_t t = index_find(&job->tensor_index, id);
+            if (t == JOB_NO_INDEX)
+                continue;
+            if (pos[i] < pt[t].first)
+                pt[t].first = pos[i];
+            if (pos[i] > pt[t].last)
+                pt[t].last = pos[i];
+            pt[t].produced |= (uint8_t)out;
+            pt[t].read |= (uint8_t)!out;
+            pt[t].touched = 1;
+        }
+    }
+    for (uint32_t i = 0; i <= n; i++)
+        delta[i] = 0;
+    for (uint32_t t = 0; t < nt; t++) {
+        /* Inputs are there from the start, results (never read) to the end */
+        if (!pt[t].produced)
+            pt[t].first = 0;
+        if (job->tensors[t].pinned || !pt[t].read)
+            pt[t].last = n ? n - 1 : 0;
+        delta[pt[t].first] += pt[t].size;
+        delta[pt[t].last + 1] -= pt[t].size;
+    }
+    int64_t live = 0, live_peak = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        live += delta[k];
+        if (live > live_peak)
+            live_peak = live;
+    }
+
+    /* Who may share: uses[t] the steps touching t (all of them if t
+     * lives to the end), before[t] the steps that come before every step
+     * touching t in every order (none if t is there from the start)
+     */
+    uint32_t *anc = NULL, *uses = NULL, *before = NULL;
+    if (n <= JOB_PLAN_MAX_STEPS && words) {
+        anc = (uint32_t *)kmalloc((size_t)n * words * sizeof(uint32_t));
+        uses = (uint32_t *)kmalloc((size_t)(nt ? nt : 1) * words * sizeof(uint32_t));
+        before = (uint32_t *)kmalloc((size_t)(nt ? nt : 1) * words * sizeof(uint32_t));
+    }
+    if (anc && uses && before) {
+        for (uint32_t w = 0; w < n * words; w++)
+            anc[w] = 0;
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t i = order[k];
+            for (uint32_t e = job->succ_off[i]; e < job->succ_off[i + 1]; e++) {
+                uint32_t *a = &anc[job->succ[e] * words];
+                for (uint32_t w = 0; w < words; w++)
+                    a[w] |= anc[i * words + w];
+                bit_set(a, i);
+            }
+        }
+        for (uint32_t t = 0; t < nt; t++) {
+            int to_end = job->tensors[t].pinned || !pt[t].read;
+            int from_start = job->tensors[t].pinned || !pt[t].produced;
+            for (uint32_t w = 0; w < words; w++) {
+                uses[t * words + w] = to_end ? ~0u : 0;
+                before[t * words + w] = from_start ? 0 : ~0u;
+            }
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            const job_step_t *s = &job->steps[i];
+            for (uint32_t j = 0; j < (uint32_t)s->num_inputs + s->num_outputs; j++) {
+                int out = j >= s->num_inputs;
+                tensor_id_t id = out ? s->outputs[j - s->num_inputs] : s->inputs[j];
+                uint32_t t = index_find(&job->tensor_index, id);
+                if (t == JOB_NO_INDEX)
+                    continue;
+                bit_set(&uses[t * words], i);
+                for (uint32_t w = 0; w < words; w++)
+                    before[t * words + w] &= anc[i * words + w];
+            }
+        }
+    } else {
+        kfree(anc);
+        kfree(uses);
+        kfree(before);
+        anc = uses = before = NULL;
+    }
+
+    /* Largest first, each at the lowest gap clear of those it can't share with */
+    for (uint32_t t = 0; t < nt; t++) {
+        uint32_t k = t;
+        while (k > 0 && pt[by_size[k - 1]].size < pt[t].size) {
+            by_size[k] = by_size[k - 1];
+            k--;
+        }
+        by_size[k] = t;
+    }
+    uint64_t arena = 0;
+    for (uint32_t k = 0; k < nt; k++) {
+        uint32_t t = by_size[k], count = 0;
+        for (uint32_t q = 0; q < k; q++) {
+            uint32_t o = by_size[q];
+            if (pt[o].size == 0)
+                continue;
+            if (uses && (bits_subset(&uses[t * words], &before[o * words], words) ||
+                         bits_subset(&uses[o * words], &before[t * words], words)))
+                continue; /* Ordered by the graph: may overlap */
+            plan_range_t r = { job->tensors[o].arena_offset,
+                               job->tensors[o].arena_offset + pt[o].size };
+            uint32_t c = count++;
+            while (c > 0 && used[c - 1].start > r.start) {
+                used[c] = used[c - 1];
+                c--;
+            }
+            used[c] = r;
+        }
+        uint32_t at = pt[t].size ? plan_first_fit(used, count, pt[t].size) : 0;
+        job->tensors[t].arena_offset = at;
+        if ((uint64_t)at + pt[t].size > arena)
+            arena = (uint64_t)at + pt[t].size;
+    }
+
+    kfree(anc);
+    kfree(uses);
+    kfree(before);
+    kfree(order);
+    kfree(pt);
+    kfree(by_size);
+    kfree(used);
+    kfree(delta);
+    if (arena > 0xFFFFFFFFu)
+        return -1;
+
+    job->arena_bytes = (uint32_t)arena;
+    job->live_peak_kb = (uint32_t)((live_peak + 1023) / 1024);
+    job->planned = 1;
+    return 0;
+}
+
+uint8_t job_graph_input_node(job_graph_t *job, const job_step_t *step) {
+    uint64_t bytes[NUMA_MAX_NODES] = {0};
+    for (uint8_t j = 0; j < step->num_inputs; j++) {
+        tensor_desc_t *t = find_tensor(job, step->inputs[j]);
+        if (t && t->home_node < NUMA_MAX_NODES)
+            bytes[t->home_node] += t->size_bytes ? t->size_bytes : 1;
+    }
+    uint8_t best = NUMA_NODE_ANY;
+    for (uint8_t n = 0; n < NUMA_MAX_NODES; n++)
+        if (bytes[n] && (best == NUMA_NODE_ANY || bytes[n] > bytes[best]))
+            best = n;
+    return best;
+}
+
 tensor_desc_t* job_graph_get_tensor(job_graph_t *job, tensor_id_t id) {
     return find_tensor(job, id);
 }
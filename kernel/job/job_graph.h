@@ -27,6 +27,13 @@ typedef enum {
     STEP_TYPE_CONTROL           /* Synchronization, barriers */
 } step_type_t;
 
+/* What a COLLECTIVE step does with its tensors (sched/coll.h) */
+typedef enum {
+    COLL_OP_ALLREDUCE = 0,      /* Sum inputs[0] across the mesh, in place */
+    COLL_OP_ALLGATHER           /* Each node's inputs[0], in node order,
+                                   into outputs[0] */
+} coll_op_t;
+
 /* Tensor data types for memory estimation */
 typedef enum {
     TENSOR_DTYPE_FP32 = 0,      /* 4 bytes per element */
@@ -44,22 +51,27 @@ typedef struct {
     uint32_t        size_bytes;     /* Computed size */
     uint8_t         pinned;         /* Must remain in memory */
     uint8_t         node_affinity;  /* Preferred NUMA node (0xFF = any) */
+    uint8_t         home_node;      /* Node its data is on: node_affinity
+                                       until the scheduler allocates it */
+    uint32_t        phys_addr;      /* Backing pages (pmm), 0 = none yet */
+    uint32_t        arena_offset;   /* In the job's arena (job_graph_plan_memory),
+                                       JOB_NO_OFFSET until planned */
 } tensor_desc_t;
 
+#define JOB_NO_OFFSET   0xFFFFFFFFu
+#define JOB_ARENA_ALIGN 64          /* Planned offsets and sizes round up to it */
+
 /* Maximum tensors per step */
 #define MAX_STEP_INPUTS  4
 #define MAX_STEP_OUTPUTS 2
 
-/* Very simple dependency model: each step waits on up to N parents */
-#define MAX_STEP_DEPS 4
-
 typedef struct {
     step_id_t   id;
     step_type_t type;
 
-    /* Dependency tracking */
-    uint8_t     num_deps;
-    step_id_t   deps[MAX_STEP_DEPS];
+    /* Dependency tracking: edges live in the graph (job_graph_add_dep) */
+    uint32_t    num_deps;     /* Parents */
+    uint32_t    pending;      /* Parents not completed yet (compiled) */
 
     /* Tensor inputs/outputs for memory tracking */
     uint8_t     num_inputs;
@@ -71,28 +83,104 @@ typedef struct {
     uint32_t    peak_memory_kb;     /* Peak memory during step execution */
     uint32_t    working_set_kb;     /* Active memory footprint */
 
+    /* Duration, kept by the scheduler: 0 until estimated */
+    uint32_t    est_us;
+    uint8_t     est_learned;  /* est_us is measured, not the type default */
+    uint64_t    rank_us;      /* Longest est_us path from here to a sink,
+                                 this step included (compiled) */
+    uint64_t    ready_us;     /* Scheduler: time_usec() it became ready,
+                                 0 = not yet */
+
     /* State flags */
     uint8_t     ready;        /* all deps satisfied */
+    uint8_t     in_flight;    /* Taken (job_graph_take_ready), not completed */
     uint8_t     completed;
+    uint8_t     node;         /* NUMA node the scheduler placed it on */
+    uint8_t     memoize;      /* COMPUTE result depends only on the input
+                                 blobs: reuse it (sched/step_memo.h) */
+    uint8_t     coll_op;      /* COLLECTIVE: coll_op_t; without inputs it
+                                 is only a gang barrier */
 } job_step_t;
 
-#define MAX_JOB_STEPS   32
-#define MAX_JOB_TENSORS 64
+/* Duration to assume for a step never measured: ~1000us per compute
+ * step, ~3000us per collective
+ */
+static inline uint32_t job_step_default_us(step_type_t type) {
+    switch (type) {
+        case STEP_TYPE_COMPUTE:    return 1000;
+        case STEP_TYPE_COLLECTIVE: return 3000;
+        case STEP_TYPE_IO:         return 2000;
+        case STEP_TYPE_CONTROL:    return 100;
+    }
+    return 1000;
+}
+
+/* Dependency edge, by dense step index: to waits on from */
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+} job_edge_t;
+
+/* Open-addressed id -> dense index map */
+typedef struct {
+    uint32_t id;
+    uint32_t index;     /* Dense index + 1, 0 = empty slot */
+} job_index_slot_t;
+
+typedef struct {
+    job_index_slot_t *slot;
+    uint32_t          cap;      /* Power of two, at least twice the entries */
+} job_index_t;
 
+/* Steps, edges and tensors grow from kheap as they are added; steps and
+ * tensors are addressed by dense index (their position in the array) and
+ * found by id through a hash index. job_graph_compile() then builds the
+ * CSR successor list (succ[succ_off[i] .. succ_off[i + 1]) are the steps
+ * waiting on step i), ranks every step by its critical path (rank_us) and
+ * seeds the ready queue with the steps that have no pending parent. From
+ * there completing a step costs its out-degree: each successor's pending
+ * count drops and it is queued when it hits 0. The queue is a binary heap
+ * on rank_us, so the step with the most work behind it runs first (ties
+ * in step order).
+ */
 typedef struct job_graph {
     job_id_t    id;
-    uint8_t     num_steps;
-    job_step_t  steps[MAX_JOB_STEPS];
+    uint32_t    num_steps;
+    uint32_t    cap_steps;
+    job_step_t *steps;
+    job_index_t step_index;
+
+    uint32_t    num_edges;
+    uint32_t    cap_edges;
+    job_edge_t *edges;
 
     /* Tensor registry - all tensors used by this job */
-    uint8_t         num_tensors;
-    tensor_desc_t   tensors[MAX_JOB_TENSORS];
+    uint32_t        num_tensors;
+    uint32_t        cap_tensors;
+    tensor_desc_t  *tensors;
+    job_index_t     tensor_index;
+
+    /* Compiled form (job_graph_compile), dropped by any structural change */
+    uint8_t     compiled;
+    uint32_t   *succ_off;       /* num_steps + 1 */
+    uint32_t   *succ;           /* num_edges successor indices */
+    uint32_t   *ready_q;        /* num_steps: each step is queued once */
+    uint32_t    num_ready;      /* Heap entries in ready_q */
+    uint32_t    num_completed;
+    uint64_t    total_est_us;   /* Sum of est_us over unfinished steps */
+    uint64_t    critical_path_us;
 
     /* Memory metrics (computed from tensor analysis) */
     uint32_t    total_memory_kb;        /* Sum of all tensor sizes */
     uint32_t    peak_memory_kb;         /* Max concurrent memory */
     uint32_t    pinned_memory_kb;       /* Memory that can't be evicted */
 
+    /* Memory plan (job_graph_plan_memory), dropped by any change */
+    uint8_t     planned;
+    uint32_t    arena_bytes;            /* One arena every tensor fits in */
+    uint32_t    live_peak_kb;           /* Most live at once, in plan order */
+    uint32_t    arena_phys;             /* Backing pages once allocated, 0 = none */
+
     /* Later: contract pointer, accel requirements, fabric topology hints */
 } job_graph_t;
 
@@ -101,25 +189,62 @@ typedef struct job_graph {
  * ======================================================================== */
 
 void job_graph_init(job_graph_t *job, job_id_t id);
+
+/* Free the graph's arrays; the graph is empty (as after init) afterwards */
+void job_graph_free(job_graph_t *job);
+
+/* Make room for that many more steps, edges and tensors up front, so
+ * adding them never reallocates or rehashes (graphs of known size, e.g.
+ * submitted ones). Returns: 0, or -1 if out of memory
+ */
+int  job_graph_reserve(job_graph_t *job, uint32_t steps, uint32_t edges,
+                       uint32_t tensors);
+
+/* Returns: 0 on success, -1 on a duplicate id or out of memory */
 int  job_graph_add_step(job_graph_t *job,
                         step_id_t id,
                         step_type_t type);
+
+/* Returns: 0 on success, -1 on an unknown step, a self-dependency or
+ * out of memory
+ */
 int  job_graph_add_dep(job_graph_t *job,
                        step_id_t step,
                        step_id_t depends_on);
 
-/* Called when a step completes: updates ready flags for dependents */
+/* Build the successor list, ranks and ready queue from the steps' est_us
+ * (0 counts as 1, so an unestimated graph ranks by depth). Called
+ * implicitly by the first
+ * next_ready/mark_completed after a change, but calling it up front
+ * reports failure. Returns: 0, or -1 if out of memory or the dependencies
+ * contain a cycle (some step could never become ready)
+ */
+int  job_graph_compile(job_graph_t *job);
+
+/* Called when a step completes: queues dependents it made ready */
 void job_graph_mark_completed(job_graph_t *job, step_id_t step);
 
+/* Highest ranked ready (not completed) step, or NULL if none; stays ready
+ * until marked completed
+ */
+job_step_t *job_graph_next_ready_step(job_graph_t *job);
+
 /* Return next ready (not completed) step, or -1 if none */
-int  job_graph_next_ready(const job_graph_t *job);
+int  job_graph_next_ready(job_graph_t *job);
+
+/* Like job_graph_next_ready_step() but takes the step off the queue, for
+ * callers running several at once: it is in_flight and not returned again
+ * (a recompile leaves it out too), and its dependents are released when it
+ * is marked completed
+ */
+job_step_t *job_graph_take_ready(job_graph_t *job);
 
 /* ========================================================================
  * Tensor metadata operations
  * ======================================================================== */
 
 /* Register a tensor with the job
- * Returns: 0 on success, -1 on failure (table full or duplicate)
+ * Returns: 0 on success, -1 on failure (duplicate or out of memory)
  */
 int job_graph_add_tensor(job_graph_t *job,
                          tensor_id_t id,
@@ -143,10 +268,37 @@ int job_graph_step_add_output(job_graph_t *job,
                               tensor_id_t tensor_id);
 
 /* Compute memory metrics for all steps
- * Must be called after all tensors and step I/O are configured
+ * Must be called after all tensors and step I/O are configured.
+ * peak_memory_kb is the planned arena's size when planning succeeds
+ * (job_graph_plan_memory), else the largest step's working set.
  */
 void job_graph_compute_memory(job_graph_t *job);
 
+/* Plan every tensor into one arena (compiling if needed)
+ *
+ * A tensor lives from the first step touching it to the last; tensors no
+ * step produces (the job's inputs) from the start, ones no step reads (its
+ * results) to the end, pinned ones throughout. Two tensors may share arena
+ * bytes only if the graph itself orders them: every step touching one is
+ * an ancestor of every step touching the other.
+ * So the plan holds for any order the scheduler runs the steps in,
+ * concurrent ones included. Offsets are assigned largest tensor first,
+ * each at the lowest gap left by the tensors it can't share with.
+ *
+ * live_peak_kb is the most memory live at once when the steps run one at
+ * a time in rank order; arena_bytes can be above it where only some
+ * orders would let tensors share. Graphs over JOB_PLAN_MAX_STEPS steps
+ * (or when short of memory for the ancestor sets) share nothing.
+ * Returns: 0, or -1 if the graph doesn't compile or out of memory
+ */
+#define JOB_PLAN_MAX_STEPS 1024
+int job_graph_plan_memory(job_graph_t *job);
+
+/* NUMA node holding most of step's input bytes (by home_node), or 0xFF
+ * if none of its inputs has a home yet
+ */
+uint8_t job_graph_input_node(job_graph_t *job, const job_step_t *step);
+
 /* Get tensor by ID (returns NULL if not found) */
 tensor_desc_t* job_graph_get_tensor(job_graph_t *job, tensor_id_t id);
 
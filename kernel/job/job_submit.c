@@ -0,0 +1,275 @@
+/* kernel/job/job_submit.c
+ *
+ * Job graphs submitted by the host (see job_submit.h)
+ *
+ * The bridge can still write a blob while we read it, so a graph is read
+ * out of shared memory exactly once: every header, step and tensor is
+ * copied into a local before it is checked, and only the copy is used.
+ * Counts and offsets are bounded against the blob before anything is
+ * allocated; ids, tensor references and the DAG itself are checked by
+ * job_graph as the job is built from the copies and compiled.
+ */
+#include "job_submit.h"
+#include "job_graph.h"
+#include "../contracts.h"
+#include "../include/string.h"
+#include "../ipc/completion.h"
+#include "../ipc/heap.h"
+#include "../ipc/layout.h"
+#include "../sched/sched_core.h"
+#include "../time/time.h"
+#include "../trace/klog.h"
+
+_Static_assert(sizeof(ipc_job_submit_t) == 8, "ipc_job_submit_t layout");
+_Static_assert(sizeof(ipc_job_graph_t) == 64, "ipc_job_graph_t layout");
+_Static_assert(sizeof(ipc_job_step_t) == 40, "ipc_job_step_t layout");
+_Static_assert(sizeof(ipc_job_tensor_t) == 12, "ipc_job_tensor_t layout");
+_Static_assert(sizeof(ipc_job_status_t) == 32, "ipc_job_status_t layout");
+_Static_assert(IPC_JOB_STEP_INPUTS == MAX_STEP_INPUTS &&
+               IPC_JOB_STEP_OUTPUTS == MAX_STEP_OUTPUTS,
+               "ipc_job_step_t tensor slots");
+
+typedef struct {
+    job_graph_t graph;
+    sched_job_ctx_t ctx;
+    ipc_job_status_t status;
+    uint16_t blob_id;
+} submission_t;
+
+static volatile ipc_ring_hdr_t *ring = NULL;
+static const volatile ipc_job_submit_t *slots = NULL;
+static uint32_t ring_size = 0;  /* Private copy: the bridge can write line 0 */
+static uint32_t ring_tail = 0;
+static submission_t batch[JOB_SUBMIT_BATCH];
+
+void job_submit_init(void) {
+    ring = (volatile ipc_ring_hdr_t *)ipc_region_ptr(IPC_REGION_JOBS);
+    ring_size = ipc_region_entries(IPC_REGION_JOBS);
+    if (!ring || ring_size == 0 || (ring_size & (ring_size - 1))) {
+        ring = NULL;
+        return;
+    }
+    slots = (const volatile ipc_job_submit_t *)((volatile uint8_t *)ring + IPC_RING_HDR_SIZE);
+
+    ring->magic = 0;
+    __asm__ __volatile__("" ::: "memory");
+    ring->version = IPC_PROTO_VERSION;
+    ring->size = ring_size;
+    ring->mask = ring_size - 1;
+    ring->flags = IPC_RING_POLICY_FIFO;
+    ring->entry_size = sizeof(ipc_job_submit_t);
+    ring->obs_dim = 0;
+    ring->head = 0;
+    ring->overruns = 0;
+    ring->max_occupancy = 0;
+    ring->tail = 0;
+    ring->drops = 0;
+    ring_tail = 0;
+
+    /* Magic last: the bridge treats it as "ring valid" */
+    __asm__ __volatile__("" ::: "memory");
+    ring->magic = IPC_JOBQ_MAGIC;
+}
+
+/* Helper: count entries of elem bytes at off, 4-byte aligned, after the
+ * header and inside size bytes
+ */
+static int span_ok(uint32_t off, uint32_t count, uint32_t elem, uint32_t size) {
+    if ((off & 3) || off < sizeof(ipc_job_graph_t) || off > size)
+        return 0;
+    return (uint64_t)count * elem <= size - off;
+}
+
+/* Build sub->graph and sub->ctx from the blob
+ * Returns: 0, or the IPC_JOB_* state it fails with
+ */
+static uint16_t load(submission_t *sub, usec_t now) {
+    heap_blob_t *blob = heap_get_blob(sub->blob_id);
+    const volatile uint8_t *data = heap_get_data(sub->blob_id);
+    if (!blob || !data || blob->type != BLOB_TYPE_JOB || heap_blob_verify(sub->blob_id) != 0)
+        return IPC_JOB_INVALID;
+    uint32_t size = heap_get_blob_size(sub->blob_id);
+    if (size < sizeof(ipc_job_graph_t))
+        return IPC_JOB_INVALID;
+
+    ipc_job_graph_t h = *(const volatile ipc_job_graph_t *)data;
+    sub->status.job_id = h.job_id;
+    if (h.magic != IPC_JOB_GRAPH_MAGIC || h.version != IPC_JOB_GRAPH_VERSION ||
+        h.size < sizeof(h) || h.size > size ||
+        !h.num_steps || h.num_steps > IPC_JOB_MAX_STEPS ||
+        h.num_deps > IPC_JOB_MAX_DEPS || h.num_tensors > IPC_JOB_MAX_TENSORS ||
+        !span_ok(h.steps_off, h.num_steps, sizeof(ipc_job_step_t), h.size) ||
+        !span_ok(h.dep_off, h.num_steps + 1, sizeof(uint32_t), h.size) ||
+        !span_ok(h.dep_idx_off, h.num_deps, sizeof(uint32_t), h.size) ||
+        !span_ok(h.tensors_off, h.num_tensors, sizeof(ipc_job_tensor_t), h.size) ||
+        h.contract.prio > CONTRACT_PRIORITY_REALTIME)
+        return IPC_JOB_INVALID;
+
+    job_graph_t *job = &sub->graph;
+    job_graph_init(job, h.job_id);
+    if (job_graph_reserve(job, h.num_steps, h.num_deps, h.num_tensors) != 0)
+        return IPC_JOB_NOMEM;
+
+    /* With the room reserved, a failure to add is always a bad graph */
+    const volatile ipc_job_tensor_t *tensors =
+        (const volatile ipc_job_tensor_t *)(data + h.tensors_off);
+    for (uint32_t i = 0; i < h.num_tensors; i++) {
+        ipc_job_tensor_t t = tensors[i];
+        if (t.dtype > TENSOR_DTYPE_INT32 || t.num_elements > 0x3FFFFFFFu ||
+            job_graph_add_tensor(job, t.id, (tensor_dtype_t)t.dtype, t.num_elements,
+                                 t.pinned != 0, t.node_affinity) != 0)
+            return IPC_JOB_INVALID;
+    }
+
+    const volatile ipc_job_step_t *steps = (const volatile ipc_job_step_t *)(data + h.steps_off);
+    for (uint32_t i = 0; i < h.num_steps; i++) {
+        ipc_job_step_t st = steps[i];
+        if (st.type > STEP_TYPE_CONTROL || st.coll_op > COLL_OP_ALLGATHER ||
+            st.num_inputs > IPC_JOB_STEP_INPUTS || st.num_outputs > IPC_JOB_STEP_OUTPUTS ||
+            job_graph_add_step(job, st.id, (step_type_t)st.type) != 0)
+            return IPC_JOB_INVALID;
+        for (uint32_t k = 0; k < st.num_inputs; k++)
+            if (job_graph_step_add_input(job, st.id, st.inputs[k]) != 0)
+                return IPC_JOB_INVALID;
+        for (uint32_t k = 0; k < st.num_outputs; k++)
+            if (job_graph_step_add_output(job, st.id, st.outputs[k]) != 0)
+                return IPC_JOB_INVALID;
+
+        job_step_t *s = &job->steps[job->num_steps - 1];
+        s->est_us = st.est_us;
+        s->memoize = (st.flags & IPC_JOB_STEP_MEMOIZE) != 0;
+        s->coll_op = st.coll_op;
+    }
+
+    /* CSR by step: dep_off[] must start at 0, never go back and end at
+     * num_deps, each parent index a step of the graph
+     */
+    const volatile uint32_t *dep_off = (const volatile uint32_t *)(data + h.dep_off);
+    const volatile uint32_t *dep_idx = (const volatile uint32_t *)(data + h.dep_idx_off);
+    uint32_t lo = dep_off[0];
+    if (lo != 0)
+        return IPC_JOB_INVALID;
+    for (uint32_t i = 0; i < h.num_steps; i++) {
+        uint32_t hi = dep_off[i + 1];
+        if (hi < lo || hi > h.num_deps)
+            return IPC_JOB_INVALID;
+        for (uint32_t e = lo; e < hi; e++) {
+            uint32_t p = dep_idx[e];
+            if (p >= h.num_steps || job_graph_add_dep(job, job->steps[i].id, job->steps[p].id) != 0)
+                return IPC_JOB_INVALID;
+        }
+        lo = hi;
+    }
+    if (lo != h.num_deps)
+        return IPC_JOB_INVALID;
+
+    /* Compiled now so a cycle is refused before admission */
+    if (job_graph_compile(job) != 0)
+        return IPC_JOB_INVALID;
+    job_graph_compute_memory(job);
+
+    task_contract_t *c = &sub->ctx.contract;
+    memset(c, 0, sizeof(*c));
+    c->cpu_budget_us = h.contract.cpu_budget_us;
+    c->memory_kb = h.contract.memory_kb;
+    c->prio = (contract_priority_t)h.contract.prio;
+    c->preferred_node = h.contract.preferred_node;
+    c->state = CONTRACT_STATE_OK;
+    c->job_id = h.job_id;
+    if (h.contract.deadline_us)
+        c->deadline_us = now + h.contract.deadline_us;
+    sub->ctx.job = job;
+    sub->ctx.max_inflight = h.contract.max_inflight;
+    return 0;
+}
+
+static void status_done(const ipc_response_t *rsp, void *arg) {
+    (void)arg;
+    if (rsp->status != RSP_OK)
+        KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "job status refused by the bridge (%x)",
+              rsp->status);
+}
+
+uint32_t job_submit_poll(void) {
+    if (!ring)
+        return 0;
+
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t avail = head - ring_tail;
+    if (avail > ring_size) {
+        /* Not an index the bridge could have published: drop them all */
+        ring->drops += avail;
+        ring_tail = head;
+        __atomic_store_n(&ring->tail, ring_tail, __ATOMIC_RELEASE);
+        return 0;
+    }
+    if (!avail)
+        return 0;
+    if (avail > JOB_SUBMIT_BATCH)
+        avail = JOB_SUBMIT_BATCH;
+    if (head - ring_tail > ring->max_occupancy)
+        ring->max_occupancy = head - ring_tail;
+
+    usec_t taken = time_usec();
+    sched_job_ctx_t *run[JOB_SUBMIT_BATCH];
+    uint32_t num_run = 0;
+    for (uint32_t n = 0; n < avail; n++) {
+        ipc_job_submit_t e = slots[(ring_tail + n) & (ring_size - 1)];
+        submission_t *sub = &batch[n];
+        memset(&sub->status, 0, sizeof(sub->status));
+        sub->status.tag = e.tag;
+        sub->blob_id = e.blob_id;
+        job_graph_init(&sub->graph, 0);
+
+        uint16_t state = e.cmd == CMD_JOB_SUBMIT ? load(sub, taken) : IPC_JOB_INVALID;
+        if (!state) {
+            admit_result_t r = contract_admit_job(&sub->ctx.contract, &sub->graph);
+            if (r != ADMIT_OK) {
+                state = IPC_JOB_REJECTED;
+                sub->status.admit = (uint16_t)r;
+            }
+        }
+        sub->status.peak_memory_kb = sub->graph.peak_memory_kb;
+        sub->status.critical_path_us = (uint32_t)sub->graph.critical_path_us;
+        sub->status.state = state ? state : IPC_JOB_DONE;
+        if (state)
+            continue;
+        contract_register(&sub->ctx.contract);
+        run[num_run++] = &sub->ctx;
+    }
+
+    /* Every blob is read: the bridge may reuse those slots */
+    ring_tail += avail;
+    __atomic_store_n(&ring->tail, ring_tail, __ATOMIC_RELEASE);
+
+    usec_t start = time_usec(), end = start;
+    if (num_run) {
+        sched_run_jobs(run, num_run);
+        end = time_usec();
+    }
+
+    uint32_t refused = 0;
+    for (uint32_t n = 0; n < avail; n++) {
+        submission_t *sub = &batch[n];
+        if (sub->status.state == IPC_JOB_DONE) {
+            sub->status.steps = sub->graph.num_completed;
+            sub->status.wait_us = (uint32_t)(start - taken);
+            sub->status.run_us = (uint32_t)(end - start);
+            contract_unregister(sub->ctx.contract.job_id);
+        } else {
+            refused++;
+        }
+        job_graph_free(&sub->graph);
+
+        ipc_tag_t tag = ipc_submit_inline(CMD_JOB_STATUS, sub->blob_id, &sub->status,
+                                          sizeof(sub->status));
+        if (tag == IPC_TAG_NONE)
+            KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "job %u: status lost, message ring full",
+                  sub->status.job_id);
+        else
+            ipc_completion_set_cb(tag, status_done, NULL);
+    }
+    KLOG3(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "jobs: %u submitted, %u ran, %u refused",
+          avail, num_run, refused);
+    return avail;
+}
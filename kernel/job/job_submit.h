@@ -0,0 +1,31 @@
+/* kernel/job/job_submit.h
+ *
+ * Job graphs submitted by the host
+ *
+ * The bridge writes a graph in the flat format of ipc_proto.h into a
+ * BLOB_TYPE_JOB blob and pushes it onto the job ring (IPC_REGION_JOBS).
+ * job_submit_poll(), called from the main loop, takes up to
+ * JOB_SUBMIT_BATCH submissions, builds and admits each under the
+ * contract it carries, runs the admitted ones together
+ * (sched_run_jobs) and answers every submission with CMD_JOB_STATUS.
+ */
+#ifndef JOB_SUBMIT_H
+#define JOB_SUBMIT_H
+
+#include <stdint.h>
+
+#define JOB_SUBMIT_BATCH 8      /* Submissions taken, and run, at once */
+
+/* Set up the job ring's header; after ipc_init() (the layout). Without
+ * the region job_submit_poll() does nothing.
+ */
+void job_submit_init(void);
+
+/*
+ * Take, run and answer the submissions waiting on the job ring, up to
+ * JOB_SUBMIT_BATCH
+ * @return: Submissions answered
+ */
+uint32_t job_submit_poll(void);
+
+#endif /* JOB_SUBMIT_H */
@@ -1,16 +1,38 @@
+#include "arch/fpu.h"
 #include "arch/gdt.h"
 #include "arch/idt.h"
 #include "arch/keyboard.h"
 #include "arch/pci.h"
 #include "arch/pic.h"
 #include "arch/pit.h"
+#include "arch/pmu.h"
 #include "console.h"
+#include "drivers/bridge_act.h"
 #include "drivers/ivshmem.h"
 #include "include/engine/episode.h"
+#include "ipc/bulk.h"
+#include "ipc/stats_export.h"
 #include "ipc/ipc.h"
 #include "ipc/ipc_proto.h"
+#include "ipc/mesh_work.h"
 #include "mm/pmm.h"
 #include "mm/vmm.h"
+#include "sched/fiber.h"
+#include "sched/idle_work.h"
+#include "arch/apic.h"
+#include "time/time.h"
+#include "time/timer.h"
+#include "trace/bootprof.h"
+#include "zenedge_alloc.h"
+#ifndef __x86_64__
+#include "arch/syscall.h"
+#include "job/job_submit.h"
+#include "sched/sched_core.h"
+#else
+#include "arch/smp.h"
+#include "gym_loop.h"
+#include "mm/kheap.h"
+#endif
 
 /* Minimal serial output for debugging */
 static inline void outb(uint16_t port, uint8_t val) {
@@ -19,10 +41,26 @@ static inline void outb(uint16_t port, uint8_t val) {
 
 static void serial_char(char c) { outb(0x3F8, c); }
 
+#ifdef __x86_64__
+/* kmalloc() arena: C++ objects, wasm3 and the WASM agents */
+static uint8_t heap_area[8 * 1024 * 1024];
+#endif
+
+/* FAST_BOOT=1: no console output until the first action (or the main
+ * loop), no PCI bus listing (ivshmem_init() probes for its own device);
+ * time_init() skips the PIT calibration
+ */
+#ifdef ZENEDGE_FAST_BOOT
+#define FAST_BOOT 1
+#else
+#define FAST_BOOT 0
+#endif
+
 /* Main Kernel Entry Point */
 void kmain64(void *multiboot_structure, uint32_t magic) {
-  (void)multiboot_structure;
-  (void)magic;
+  bootprof_mark("entry");
+  if (FAST_BOOT)
+    console_set_quiet(1);
 
   console_cls();
   console_write("=== ZENEDGE KERNEL (x86_64) ===\n");
@@ -31,21 +69,59 @@ void kmain64(void *multiboot_structure, uint32_t magic) {
   /* Core Arch setup */
   gdt_init();
   idt_init();
+#ifndef __x86_64__
+  syscall_init();
+#endif
+  fpu_init();
+  pmu_init();
   pic_init();
   pit_init(100);
   keyboard_init();
+  /* Serial output from here on queues for the UART interrupt */
+  console_irq_init();
+  bootprof_mark("arch");
 
   /* Memory Management */
   console_write("Initializing Memory Manager...\n");
+#ifdef __x86_64__
+  /* The multiboot2 memory map; the fallback without one is 128MB */
+  pmm_init_multiboot2(magic == MULTIBOOT2_BOOTLOADER_MAGIC ? multiboot_structure
+                                                           : NULL);
+#else
+  (void)multiboot_structure;
+  (void)magic;
   pmm_init(NULL); /* Pass NULL to trigger fallback */
+#endif
   vmm_init();
+  zenedge_alloc_init();
+#ifdef __x86_64__
+  kheap_init(heap_area, sizeof(heap_area));
+#endif
+  bootprof_mark("memory");
+
+  /* Clock, then the one-shot LAPIC timer in place of the PIT tick (i386)
+   * or the other CPUs (x86_64)
+   */
+  time_init();
+  bootprof_mark("time");
+  lapic_init();
+#ifndef __x86_64__
+  sched_tick_init();
+#else
+  smp_init();
+#endif
+  bootprof_mark("lapic_cpus");
 
   /* Hardware Integration */
-  console_write("Scanning PCI Bus...\n");
-  pci_init();
+  if (!FAST_BOOT) {
+    console_write("Scanning PCI Bus...\n");
+    pci_init();
+    bootprof_mark("pci_scan");
+  }
 
   console_write("Initializing IVSHMEM...\n");
   ivshmem_init();
+  bootprof_mark("ivshmem");
 
   /* IPC Setup */
   uint64_t shmem_base = (uint64_t)ivshmem_get_shared_memory();
@@ -56,28 +132,88 @@ void kmain64(void *multiboot_structure, uint32_t magic) {
     print_hex64(shmem_base);
     console_write("\n");
     ipc_init((void *)shmem_base, irq);
+    bootprof_mark("ipc");
 
     /* Mesh & Engine */
     ipc_mesh_init();
+#ifdef ZENEDGE_ACT_BRIDGE
+    actuator_register(bridge_actuator(0));
+#endif
     episode_init();
-
-    /* Propose Initial Tuning Episode (Test) */
-    episode_propose(1200, 500);
+#ifndef __x86_64__
+    job_submit_init();
+#endif
+
+    /* Propose Initial Tuning Episode (Test): three clocks against 1000 */
+    static const uint32_t clocks[] = {1100, 1200, 1400};
+    episode_propose_set(clocks, 3, 500);
+    bootprof_mark("engine");
   } else {
     console_write("WARNING: No Shared Memory (Sidecar) found.\n");
   }
 
+  /* Logs, trace export, compaction and zeroing, for when we would halt */
+  idle_work_init();
+
   /* Enable Interrupts */
   __asm__ __volatile__("sti");
 
   console_write("[kern] System Ready. Entering Main Loop.\n");
 
+#ifdef __x86_64__
+  /* The bridge's Gym env, if it has one, is the main loop from here on */
+  if (shmem_base)
+    gym_loop_run();
+#endif
+
+  /* No first action to wait for: boot ends here */
+  bootprof_mark("main_loop");
+  console_set_quiet(0);
+  if (shmem_base && bootprof_send() != 0)
+    console_write("[kern] Boot profile not sent.\n");
+
   /* Main Loop */
   while (1) {
-    /* Drive the Safe Tuning Engine */
+    /* Kernel timers that are due (fiber_wait() timeouts among them) */
+    timer_run();
+
+    /* Take collector samples that are due, then drive the Safe Tuning Engine */
+    collector_poll();
     episode_tick();
 
-    /* Low-power wait */
-    __asm__ __volatile__("hlt");
+    /* Refresh the statistics page when it is due */
+    ipc_stats_poll();
+
+    /* Drain bulk uploads */
+    ipc_bulk_poll();
+
+    /* Steps to and from other mesh nodes */
+    mesh_work_poll();
+
+    /* Resume fibers; one that yielded wants the loop again right away */
+    uint32_t fibers_ready = fiber_run();
+
+#ifndef __x86_64__
+    /* Run the job graphs the bridge submitted */
+    job_submit_poll();
+
+    /* Give agent processes a turn on every wakeup (IRQ or tick) */
+    sched_yield();
+
+    /* Tickless, nothing wakes us but IRQs: an episode steps on a timer */
+    if (episode_get_current()->state != EP_STATE_IDLE)
+      sched_timer_at(time_usec() + SCHED_TICK_MS * 1000);
+    if (timer_next_deadline())
+      sched_timer_at(timer_next_deadline());
+    if (mesh_work_next_deadline())
+      sched_timer_at(mesh_work_next_deadline());
+    if (collector_next_deadline())
+      sched_timer_at(collector_next_deadline());
+#endif
+
+    /* Background work, then a low-power wait once there is none left */
+    uint32_t idle_units = idle_work_run(0, IDLE_WORK_PASS_US);
+    if (!fibers_ready && !idle_units)
+      __asm__ __volatile__("hlt");
   }
 }
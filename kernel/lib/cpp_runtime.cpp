@@ -9,39 +9,10 @@ extern "C" {
         while(*p) outb(0x3F8, (uint8_t)*p++);
         while(1) __asm__ __volatile__("hlt");
     }
-
-    void console_write(const char *s) {
-        while (*s) outb(0x3F8, (uint8_t)*s++);
-    }
-
-    void print_hex64(uint64_t v) {
-        const char *hex = "0123456789ABCDEF";
-        char buf[16];
-        for (int i = 0; i < 16; i++) {
-            buf[15-i] = hex[v & 0xF];
-            v >>= 4;
-        }
-        outb(0x3F8, '0'); outb(0x3F8, 'x');
-        for (int i = 0; i < 16; i++) outb(0x3F8, buf[i]);
-    }
-
-    /* kheap uses 32-bit prints */
-    void print_hex32(uint32_t v) {
-        print_hex64((uint64_t)v);
-    }
-    
-    void print_uint(uint32_t v) {
-        if (v == 0) { console_write("0"); return; }
-        char buf[16];
-        int i = 0;
-        while (v > 0) {
-            buf[i++] = '0' + (v % 10);
-            v /= 10;
-        }
-        while (--i >= 0) outb(0x3F8, (uint8_t)buf[i]);
-    }
 }
 
+/* console_write() and the print_* helpers are console.c's */
+
 /* Forward declarations to Kernel Heap */
 extern "C" void* kmalloc(size_t size);
 extern "C" void kfree(void* ptr);
@@ -0,0 +1,60 @@
+/* kernel/lib/crc32c.c - CRC32C, SSE4.2 with a table fallback */
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78u /* Reflected Castagnoli polynomial */
+
+static uint32_t table[256];
+static int hw = -1; /* -1 = not probed yet */
+
+static void probe(void) {
+  uint32_t eax = 1, ebx, ecx, edx;
+  __asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  hw = (ecx >> 20) & 1; /* CPUID.1:ECX.SSE4_2 */
+  if (hw)
+    return;
+
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+    table[i] = c;
+  }
+}
+
+int crc32c_hw(void) {
+  if (hw < 0)
+    probe();
+  return hw;
+}
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+  /* Byte steps up to alignment, then the widest the mode allows */
+  while (len && ((uintptr_t)p & 7)) {
+    __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+    p++;
+    len--;
+  }
+#if defined(__x86_64__)
+  uint64_t c = crc;
+  for (; len >= 8; p += 8, len -= 8)
+    __asm__("crc32q %1, %0" : "+r"(c) : "rm"(*(const uint64_t *)p));
+  crc = (uint32_t)c;
+#endif
+  for (; len >= 4; p += 4, len -= 4)
+    __asm__("crc32l %1, %0" : "+r"(crc) : "rm"(*(const uint32_t *)p));
+  for (; len; p++, len--)
+    __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+  return crc;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  crc = ~crc;
+  if (crc32c_hw()) {
+    crc = crc32c_sse42(crc, p, len);
+  } else {
+    while (len--)
+      crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
@@ -0,0 +1,15 @@
+/* kernel/lib/crc32c.h */
+#ifndef ZENEDGE_CRC32C_H
+#define ZENEDGE_CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC32C (Castagnoli), zlib-style: pass 0 to start, the previous result
+ * to continue. Uses the SSE4.2 crc32 instruction when CPUID reports it. */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/* Nonzero if crc32c() runs on the SSE4.2 instruction */
+int crc32c_hw(void);
+
+#endif
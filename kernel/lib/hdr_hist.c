@@ -0,0 +1,77 @@
+/* kernel/lib/hdr_hist.c - HDR-style log-linear latency histogram */
+#include "hdr_hist.h"
+
+static uint32_t bucket_of(uint32_t v) {
+  if (v < HDR_HIST_SUB)
+    return v;
+  uint32_t e = 31 - (uint32_t)__builtin_clz(v); /* >= HDR_HIST_SUB_BITS */
+  uint32_t sub = (v >> (e - HDR_HIST_SUB_BITS)) & (HDR_HIST_SUB - 1);
+  return (e - HDR_HIST_SUB_BITS + 1) * HDR_HIST_SUB + sub;
+}
+
+/* Largest value that maps to bucket i */
+static uint32_t bucket_high(uint32_t i) {
+  if (i < HDR_HIST_SUB)
+    return i;
+  uint32_t shift = i / HDR_HIST_SUB - 1;
+  uint64_t low = (uint64_t)(HDR_HIST_SUB + i % HDR_HIST_SUB) << shift;
+  return (uint32_t)(low + ((uint64_t)1 << shift) - 1);
+}
+
+void hdr_hist_reset(hdr_hist_t *h) {
+  h->count = 0;
+  h->min = 0;
+  h->max = 0;
+  h->sum = 0;
+  for (uint32_t i = 0; i < HDR_HIST_BUCKETS; i++)
+    h->buckets[i] = 0;
+}
+
+void hdr_hist_record(hdr_hist_t *h, uint32_t value) {
+  if (h->count == 0 || value < h->min)
+    h->min = value;
+  if (value > h->max)
+    h->max = value;
+  h->count++;
+  h->sum += value;
+  h->buckets[bucket_of(value)]++;
+}
+
+void hdr_hist_merge(hdr_hist_t *dst, const hdr_hist_t *src) {
+  if (src->count == 0)
+    return;
+  if (dst->count == 0 || src->min < dst->min)
+    dst->min = src->min;
+  if (src->max > dst->max)
+    dst->max = src->max;
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for (uint32_t i = 0; i < HDR_HIST_BUCKETS; i++)
+    dst->buckets[i] += src->buckets[i];
+}
+
+uint32_t hdr_hist_value_at(const hdr_hist_t *h, uint32_t permille) {
+  if (h->count == 0)
+    return 0;
+  if (permille > 1000)
+    permille = 1000;
+
+  /* Rank of the sample wanted, 1-based and rounded up */
+  uint64_t rank = ((uint64_t)h->count * permille + 999) / 1000;
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < HDR_HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint32_t v = bucket_high(i);
+      return v > h->max ? h->max : v;
+    }
+  }
+  return h->max;
+}
+
+uint32_t hdr_hist_mean(const hdr_hist_t *h) {
+  return h->count ? (uint32_t)(h->sum / h->count) : 0;
+}
@@ -0,0 +1,34 @@
+/* kernel/lib/hdr_hist.h - HDR-style log-linear latency histogram */
+#ifndef ZENEDGE_HDR_HIST_H
+#define ZENEDGE_HDR_HIST_H
+
+#include <stdint.h>
+
+/* Values below 2^HDR_HIST_SUB_BITS are counted exactly; above that each
+ * power of two is split into 2^HDR_HIST_SUB_BITS linear buckets, so any
+ * recorded uint32_t lands within 1/16 (6.25%) of its bucket bound. */
+#define HDR_HIST_SUB_BITS 4
+#define HDR_HIST_SUB      (1u << HDR_HIST_SUB_BITS)
+#define HDR_HIST_BUCKETS  ((32 - HDR_HIST_SUB_BITS + 1) * HDR_HIST_SUB)
+
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t buckets[HDR_HIST_BUCKETS];
+} hdr_hist_t;
+
+void hdr_hist_reset(hdr_hist_t *h);
+void hdr_hist_record(hdr_hist_t *h, uint32_t value);
+
+/* Add src's samples to dst, e.g. to combine per-CPU histograms */
+void hdr_hist_merge(hdr_hist_t *dst, const hdr_hist_t *src);
+
+/* Value at or below which `permille`/1000 of the samples fall (the bucket's
+ * upper bound, capped at max); 0 if empty. 500 = median, 999 = p99.9. */
+uint32_t hdr_hist_value_at(const hdr_hist_t *h, uint32_t permille);
+
+uint32_t hdr_hist_mean(const hdr_hist_t *h);
+
+#endif
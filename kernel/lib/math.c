@@ -53,11 +53,3 @@ double copysign(double x, double y) {
 float copysignf(float x, float y) {
     return __builtin_copysignf(x, y);
 }
-
-float math_vec_dot(const float *a, const float *b, int n) {
-    float sum = 0.0f;
-    for (int i = 0; i < n; i++) {
-        sum += a[i] * b[i];
-    }
-    return sum;
-}
@@ -3,7 +3,66 @@
 
 #include <stdint.h>
 
-/* Basic vector operations */
+/* Basic vector operations
+ *
+ * Each has scalar, SSE2, AVX2(+FMA) and AVX-512 kernels; the widest one
+ * fpu_features() allows is picked at the first call (after fpu_init()).
+ * No alignment is required.
+ */
+typedef enum {
+    MATH_VEC_SCALAR = 0,
+    MATH_VEC_SSE2,
+    MATH_VEC_AVX2,
+    MATH_VEC_AVX512
+} math_vec_isa_t;
+
 float math_vec_dot(const float *a, const float *b, int n);
+/* y += alpha * x */
+void math_vec_axpy(float alpha, const float *x, float *y, int n);
+/* y += x */
+void math_vec_add(const float *x, float *y, int n);
+/* y[r] = dot(m + r * stride, x) for rows r, cols floats each */
+void math_vec_gemv(const float *m, int rows, int cols, int stride, const float *x, float *y);
+/* x = max(x, 0) */
+void math_vec_relu(float *x, int n);
+/* x = tanh(x) */
+void math_vec_tanh(float *x, int n);
+/* y = exp(x - max) / sum (y may be x) */
+void math_vec_softmax(const float *x, float *y, int n);
+/* Index of the first largest element; -1 if n <= 0 */
+int math_vec_argmax(const float *x, int n);
+
+math_vec_isa_t math_vec_isa(void);
+const char *math_vec_isa_name(math_vec_isa_t isa);
+
+/* 8-bit integer dot products (lib/math_q8.c)
+ *
+ * Unsigned activations times signed weights, summed exactly in int32
+ * (n up to 65793 cannot overflow). Scalar, SSE4.1, AVX2, AVX-VNNI and
+ * AVX-512 VNNI kernels, dispatched like the float ones.
+ */
+typedef enum {
+    MATH_Q8_SCALAR = 0,
+    MATH_Q8_SSE41,
+    MATH_Q8_AVX2,
+    MATH_Q8_AVX_VNNI,
+    MATH_Q8_AVX512_VNNI
+} math_q8_isa_t;
+
+int32_t math_q8_dot(const uint8_t *x, const int8_t *w, int n);
+/* y[r] = math_q8_dot(x, m + r * stride, cols) for rows r */
+void math_q8_gemv(const int8_t *m, int rows, int cols, int stride, const uint8_t *x, int32_t *y);
+
+math_q8_isa_t math_q8_isa(void);
+const char *math_q8_isa_name(math_q8_isa_t isa);
+
+/* Half-width float conversion (lib/math_half.c): IEEE binary16 and
+ * bfloat16 to and from float32, rounding to nearest even. F16C, AVX2,
+ * AVX-512F and AVX-512 BF16 kernels where the CPU has them.
+ */
+void math_f16_to_f32(const uint16_t *src, float *dst, int n);
+void math_f32_to_f16(const float *src, uint16_t *dst, int n);
+void math_bf16_to_f32(const uint16_t *src, float *dst, int n);
+void math_f32_to_bf16(const float *src, uint16_t *dst, int n);
 
 #endif /* _MATH_H */
@@ -0,0 +1,279 @@
+/* kernel/lib/math_half.c - Dispatched FP16/BF16 <-> float32 conversion
+ * (lib/math.h)
+ *
+ * Each direction picks its own widest kernel at the first call: F16C or
+ * AVX-512F for IEEE half, plain shifts on SSE2/AVX2/AVX-512F for bfloat16
+ * widening, and AVX-512 BF16 (vcvtneps2bf16), else an AVX2 integer
+ * rounding, for bfloat16 narrowing. Every path rounds to nearest even and
+ * keeps NaNs quiet; vcvtneps2bf16 flushes denormal inputs, which only
+ * moves values below 2^-126.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include "math.h"
+#include "../arch/fpu.h"
+
+typedef void (*half_to_f32_fn)(const uint16_t *src, float *dst, int n);
+typedef void (*f32_to_half_fn)(const float *src, uint16_t *dst, int n);
+
+typedef union {
+    float f;
+    uint32_t u;
+} f32_bits_t;
+
+/* ---- scalar ---- */
+
+static float f16_to_f32_one(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t man = h & 0x3FF;
+    f32_bits_t v;
+
+    if (exp == 0x1F) {
+        v.u = sign | 0x7F800000 | (man << 13) | (man ? 0x400000 : 0);
+    } else if (exp != 0) {
+        v.u = sign | ((exp + 112) << 23) | (man << 13);
+    } else if (man == 0) {
+        v.u = sign;
+    } else {
+        /* Subnormal: renormalize */
+        exp = 113;
+        while (!(man & 0x400)) {
+            man <<= 1;
+            exp--;
+        }
+        v.u = sign | (exp << 23) | ((man & 0x3FF) << 13);
+    }
+    return v.f;
+}
+
+static uint16_t f32_to_f16_one(float f) {
+    f32_bits_t v;
+    v.f = f;
+    uint32_t sign = (v.u >> 16) & 0x8000;
+    uint32_t abs = v.u & 0x7FFFFFFF;
+
+    if (abs >= 0x7F800000)                      /* Inf / NaN */
+        return (uint16_t)(sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 | ((abs >> 13) & 0x3FF) : 0));
+    if (abs >= 0x477FF000)                      /* Rounds past 65504 */
+        return (uint16_t)(sign | 0x7C00);
+    if (abs < 0x38800000) {                     /* Half subnormal or zero */
+        if (abs < 0x33000000)
+            return (uint16_t)sign;
+        uint32_t exp = abs >> 23;
+        uint32_t man = (abs & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - exp;             /* 14..24 */
+        uint32_t q = man >> shift;
+        uint32_t rem = man & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (q & 1)))
+            q++;
+        return (uint16_t)(sign | q);
+    }
+    uint32_t r = abs - 0x38000000;              /* Rebias 127 -> 15 */
+    r += 0xFFF + ((r >> 13) & 1);
+    return (uint16_t)(sign | (r >> 13));
+}
+
+static void f16_to_f32_scalar(const uint16_t *src, float *dst, int n) {
+    for (int i = 0; i < n; i++)
+        dst[i] = f16_to_f32_one(src[i]);
+}
+
+static void f32_to_f16_scalar(const float *src, uint16_t *dst, int n) {
+    for (int i = 0; i < n; i++)
+        dst[i] = f32_to_f16_one(src[i]);
+}
+
+static void bf16_to_f32_scalar(const uint16_t *src, float *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        f32_bits_t v;
+        v.u = (uint32_t)src[i] << 16;
+        dst[i] = v.f;
+    }
+}
+
+static uint16_t f32_to_bf16_one(float f) {
+    f32_bits_t v;
+    v.f = f;
+    if ((v.u & 0x7FFFFFFF) > 0x7F800000)
+        return (uint16_t)((v.u >> 16) | 0x40);
+    return (uint16_t)((v.u + 0x7FFF + ((v.u >> 16) & 1)) >> 16);
+}
+
+static void f32_to_bf16_scalar(const float *src, uint16_t *dst, int n) {
+    for (int i = 0; i < n; i++)
+        dst[i] = f32_to_bf16_one(src[i]);
+}
+
+/* ---- SIMD ---- */
+
+__attribute__((target("avx,f16c")))
+static void f16_to_f32_f16c(const uint16_t *src, float *dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    for (; i < n; i++)
+        dst[i] = f16_to_f32_one(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void f32_to_f16_f16c(const float *src, uint16_t *dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < n; i++)
+        dst[i] = f32_to_f16_one(src[i]);
+}
+
+__attribute__((target("avx512f")))
+static void f16_to_f32_avx512(const uint16_t *src, float *dst, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(src + i))));
+    for (; i < n; i++)
+        dst[i] = f16_to_f32_one(src[i]);
+}
+
+__attribute__((target("avx512f")))
+static void f32_to_f16_avx512(const float *src, uint16_t *dst, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm512_cvtps_ph(_mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < n; i++)
+        dst[i] = f32_to_f16_one(src[i]);
+}
+
+__attribute__((target("sse2")))
+static void bf16_to_f32_sse2(const uint16_t *src, float *dst, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(zero, h));
+        _mm_storeu_si128((__m128i *)(dst + i + 4), _mm_unpackhi_epi16(zero, h));
+    }
+    bf16_to_f32_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void bf16_to_f32_avx2(const uint16_t *src, float *dst, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_slli_epi32(w, 16));
+    }
+    bf16_to_f32_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void bf16_to_f32_avx512(const uint16_t *src, float *dst, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i w = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(src + i)));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_slli_epi32(w, 16));
+    }
+    bf16_to_f32_scalar(src + i, dst + i, n - i);
+}
+
+/* Same rounding as f32_to_bf16_one, 8 lanes at a time */
+__attribute__((target("avx2")))
+static void f32_to_bf16_avx2(const float *src, uint16_t *dst, int n) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7FFF);
+    const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF);
+    const __m256i inf = _mm256_set1_epi32(0x7F800000);
+    const __m256i quiet = _mm256_set1_epi32(0x400000);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i r[2];
+        for (int k = 0; k < 2; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + i + 8 * k));
+            __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(v, 16), one);
+            __m256i rounded = _mm256_add_epi32(v, _mm256_add_epi32(bias, lsb));
+            __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(v, abs_mask), inf);
+            r[k] = _mm256_srli_epi32(
+                _mm256_blendv_epi8(rounded, _mm256_or_si256(v, quiet), nan), 16);
+        }
+        /* packus works per 128-bit lane: put the quadwords back in order */
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r[0], r[1]), 0xD8);
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    f32_to_bf16_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+static void f32_to_bf16_avx512(const float *src, uint16_t *dst, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), (__m256i)h);
+    }
+    f32_to_bf16_scalar(src + i, dst + i, n - i);
+}
+
+/* ---- dispatch ---- */
+
+static half_to_f32_fn g_f16_to_f32 = NULL;
+static f32_to_half_fn g_f32_to_f16;
+static half_to_f32_fn g_bf16_to_f32;
+static f32_to_half_fn g_f32_to_bf16;
+
+static void math_half_pick(void) {
+    uint32_t f = fpu_features();
+
+    if (f & FPU_FEAT_AVX512F) {
+        g_f32_to_f16 = f32_to_f16_avx512;
+        g_bf16_to_f32 = bf16_to_f32_avx512;
+    } else if (f & FPU_FEAT_F16C) {
+        g_f32_to_f16 = f32_to_f16_f16c;
+        g_bf16_to_f32 = (f & FPU_FEAT_AVX2) ? bf16_to_f32_avx2 : bf16_to_f32_sse2;
+    } else {
+        g_f32_to_f16 = f32_to_f16_scalar;
+        g_bf16_to_f32 = (f & FPU_FEAT_AVX2) ? bf16_to_f32_avx2 :
+                        (f & FPU_FEAT_SSE2) ? bf16_to_f32_sse2 : bf16_to_f32_scalar;
+    }
+
+    if (f & FPU_FEAT_AVX512_BF16)
+        g_f32_to_bf16 = f32_to_bf16_avx512;
+    else if (f & FPU_FEAT_AVX2)
+        g_f32_to_bf16 = f32_to_bf16_avx2;
+    else
+        g_f32_to_bf16 = f32_to_bf16_scalar;
+
+    /* Set last: it marks the table ready */
+    g_f16_to_f32 = (f & FPU_FEAT_AVX512F) ? f16_to_f32_avx512 :
+                   (f & FPU_FEAT_F16C) ? f16_to_f32_f16c : f16_to_f32_scalar;
+}
+
+void math_f16_to_f32(const uint16_t *src, float *dst, int n) {
+    if (!g_f16_to_f32)
+        math_half_pick();
+    if (n > 0)
+        g_f16_to_f32(src, dst, n);
+}
+
+void math_f32_to_f16(const float *src, uint16_t *dst, int n) {
+    if (!g_f16_to_f32)
+        math_half_pick();
+    if (n > 0)
+        g_f32_to_f16(src, dst, n);
+}
+
+void math_bf16_to_f32(const uint16_t *src, float *dst, int n) {
+    if (!g_f16_to_f32)
+        math_half_pick();
+    if (n > 0)
+        g_bf16_to_f32(src, dst, n);
+}
+
+void math_f32_to_bf16(const float *src, uint16_t *dst, int n) {
+    if (!g_f16_to_f32)
+        math_half_pick();
+    if (n > 0)
+        g_f32_to_bf16(src, dst, n);
+}
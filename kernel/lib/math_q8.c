@@ -0,0 +1,151 @@
+/* kernel/lib/math_q8.c - Dispatched 8-bit integer dot kernels (lib/math.h)
+ *
+ * Activations are unsigned and weights signed, the operand order of
+ * vpdpbusd. pmaddubsw is not used: a u8 x s8 pair sum reaches
+ * 2 * 255 * 128 in magnitude and would saturate int16, so the SSE4.1 and
+ * AVX2 paths widen both operands to 16 bits and use pmaddwd instead, and
+ * every path returns the exact int32 sum. Like math_vec.c, each kernel carries its own
+ * target attribute and is only entered once fpu_init() reports it usable.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include "math.h"
+#include "../arch/fpu.h"
+#include "../console.h"
+
+typedef int32_t (*math_q8_dot_fn)(const uint8_t *x, const int8_t *w, int n);
+
+static int32_t q8_dot_scalar(const uint8_t *x, const int8_t *w, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += (int32_t)x[i] * w[i];
+    return sum;
+}
+
+__attribute__((target("sse4.1")))
+static int32_t q8_dot_sse41(const uint8_t *x, const int8_t *w, int n) {
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i xb = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i wb = _mm_loadu_si128((const __m128i *)(w + i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_cvtepu8_epi16(xb), _mm_cvtepi8_epi16(wb)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(xb, 8)),
+                                                _mm_cvtepi8_epi16(_mm_srli_si128(wb, 8))));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+    int32_t sum = _mm_cvtsi128_si32(acc);
+    for (; i < n; i++)
+        sum += (int32_t)x[i] * w[i];
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static int32_t q8_hsum256(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+static int32_t q8_dot_avx2(const uint8_t *x, const int8_t *w, int n) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i xw = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(x + i)));
+        __m256i ww = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(xw, ww));
+    }
+    int32_t sum = q8_hsum256(acc);
+    for (; i < n; i++)
+        sum += (int32_t)x[i] * w[i];
+    return sum;
+}
+
+__attribute__((target("avx2,avxvnni")))
+static int32_t q8_dot_avx_vnni(const uint8_t *x, const int8_t *w, int n) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+        acc = _mm256_dpbusd_avx_epi32(acc, _mm256_loadu_si256((const __m256i *)(x + i)),
+                                      _mm256_loadu_si256((const __m256i *)(w + i)));
+    int32_t sum = q8_hsum256(acc);
+    for (; i < n; i++)
+        sum += (int32_t)x[i] * w[i];
+    return sum;
+}
+
+__attribute__((target("avx512f,avx512vnni")))
+static int32_t q8_dot_avx512_vnni(const uint8_t *x, const int8_t *w, int n) {
+    __m512i acc = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 64 <= n; i += 64)
+        acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512((const void *)(x + i)),
+                                  _mm512_loadu_si512((const void *)(w + i)));
+    int32_t sum = _mm512_reduce_add_epi32(acc);
+    for (; i < n; i++)
+        sum += (int32_t)x[i] * w[i];
+    return sum;
+}
+
+/* ---- dispatch ---- */
+
+static math_q8_dot_fn g_dot = NULL;
+static math_q8_isa_t g_isa = MATH_Q8_SCALAR;
+
+static math_q8_dot_fn math_q8_dot_kernel(void) {
+    if (g_dot)
+        return g_dot;
+
+    uint32_t f = fpu_features();
+    if (f & FPU_FEAT_AVX512_VNNI) {
+        g_isa = MATH_Q8_AVX512_VNNI;
+        g_dot = q8_dot_avx512_vnni;
+    } else if ((f & FPU_FEAT_AVX_VNNI) && (f & FPU_FEAT_AVX2)) {
+        g_isa = MATH_Q8_AVX_VNNI;
+        g_dot = q8_dot_avx_vnni;
+    } else if (f & FPU_FEAT_AVX2) {
+        g_isa = MATH_Q8_AVX2;
+        g_dot = q8_dot_avx2;
+    } else if (f & FPU_FEAT_SSE41) {
+        g_isa = MATH_Q8_SSE41;
+        g_dot = q8_dot_sse41;
+    } else {
+        g_isa = MATH_Q8_SCALAR;
+        g_dot = q8_dot_scalar;
+    }
+
+    console_write("[math] int8 kernels: ");
+    console_write(math_q8_isa_name(g_isa));
+    console_write("\n");
+    return g_dot;
+}
+
+int32_t math_q8_dot(const uint8_t *x, const int8_t *w, int n) {
+    return n > 0 ? math_q8_dot_kernel()(x, w, n) : 0;
+}
+
+void math_q8_gemv(const int8_t *m, int rows, int cols, int stride, const uint8_t *x, int32_t *y) {
+    math_q8_dot_fn dot = math_q8_dot_kernel();
+    for (int r = 0; r < rows; r++)
+        y[r] = cols > 0 ? dot(x, m + r * stride, cols) : 0;
+}
+
+math_q8_isa_t math_q8_isa(void) {
+    math_q8_dot_kernel();
+    return g_isa;
+}
+
+const char *math_q8_isa_name(math_q8_isa_t isa) {
+    switch (isa) {
+    case MATH_Q8_SSE41: return "sse4.1";
+    case MATH_Q8_AVX2: return "avx2";
+    case MATH_Q8_AVX_VNNI: return "avx-vnni";
+    case MATH_Q8_AVX512_VNNI: return "avx512-vnni";
+    default: return "scalar";
+    }
+}
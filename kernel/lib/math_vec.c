@@ -0,0 +1,289 @@
+/* kernel/lib/math_vec.c - Dispatched vector kernels (lib/math.h)
+ *
+ * The SIMD kernels use compiler vector extensions under a per-function
+ * target attribute, so the rest of the kernel keeps its baseline ISA and
+ * the wide paths are only entered once fpu_init() has enabled their state.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "math.h"
+#include "../arch/fpu.h"
+#include "../console.h"
+
+typedef struct {
+    float (*dot)(const float *a, const float *b, int n);
+    void (*axpy)(float alpha, const float *x, float *y, int n);
+    void (*add)(const float *x, float *y, int n);
+    float (*max)(const float *x, int n);
+    void (*scale)(float *x, float s, int n);
+    void (*relu)(float *x, int n);
+} math_vec_ops_t;
+
+/* ---- scalar ---- */
+
+static float dot_scalar(const float *a, const float *b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static void axpy_scalar(float alpha, const float *x, float *y, int n) {
+    for (int i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+static void add_scalar(const float *x, float *y, int n) {
+    for (int i = 0; i < n; i++)
+        y[i] += x[i];
+}
+
+static float max_scalar(const float *x, int n) {
+    float m = x[0];
+    for (int i = 1; i < n; i++)
+        if (x[i] > m)
+            m = x[i];
+    return m;
+}
+
+static void scale_scalar(float *x, float s, int n) {
+    for (int i = 0; i < n; i++)
+        x[i] *= s;
+}
+
+static void relu_scalar(float *x, int n) {
+    for (int i = 0; i < n; i++)
+        if (!(x[i] > 0.0f))
+            x[i] = 0.0f;
+}
+
+/* ---- SIMD ----
+ * V: register type, VU: its unaligned alias for loads/stores, VI: the
+ * matching compare mask, W: lanes. Dot keeps two accumulators to hide
+ * the add latency; the tails fall back to scalar.
+ */
+#define MATH_VEC_KERNELS(sfx, tgt, V, VU, VI, W)                              \
+__attribute__((target(tgt)))                                                  \
+static float dot_##sfx(const float *a, const float *b, int n) {               \
+    V acc0 = {0}, acc1 = {0};                                                 \
+    int i = 0;                                                                \
+    for (; i + 2 * (W) <= n; i += 2 * (W)) {                                  \
+        acc0 += *(const VU *)(a + i) * *(const VU *)(b + i);                  \
+        acc1 += *(const VU *)(a + i + (W)) * *(const VU *)(b + i + (W));      \
+    }                                                                         \
+    for (; i + (W) <= n; i += (W))                                            \
+        acc0 += *(const VU *)(a + i) * *(const VU *)(b + i);                  \
+    acc0 += acc1;                                                             \
+    float sum = 0.0f;                                                         \
+    for (int k = 0; k < (W); k++)                                             \
+        sum += acc0[k];                                                       \
+    for (; i < n; i++)                                                        \
+        sum += a[i] * b[i];                                                   \
+    return sum;                                                               \
+}                                                                             \
+                                                                              \
+__attribute__((target(tgt)))                                                  \
+static void axpy_##sfx(float alpha, const float *x, float *y, int n) {        \
+    V va = (V){0} + alpha;                                                    \
+    int i = 0;                                                                \
+    for (; i + (W) <= n; i += (W))                                            \
+        *(VU *)(y + i) = *(const VU *)(y + i) + va * *(const VU *)(x + i);    \
+    for (; i < n; i++)                                                        \
+        y[i] += alpha * x[i];                                                 \
+}                                                                             \
+                                                                              \
+__attribute__((target(tgt)))                                                  \
+static void add_##sfx(const float *x, float *y, int n) {                      \
+    int i = 0;                                                                \
+    for (; i + 2 * (W) <= n; i += 2 * (W)) {                                  \
+        *(VU *)(y + i) = *(const VU *)(y + i) + *(const VU *)(x + i);         \
+        *(VU *)(y + i + (W)) = *(const VU *)(y + i + (W)) +                   \
+                               *(const VU *)(x + i + (W));                    \
+    }                                                                         \
+    add_scalar(x + i, y + i, n - i);                                          \
+}                                                                             \
+                                                                              \
+__attribute__((target(tgt)))                                                  \
+static float max_##sfx(const float *x, int n) {                               \
+    if (n < (W))                                                              \
+        return max_scalar(x, n);                                              \
+    V m = *(const VU *)x;                                                     \
+    int i = (W);                                                              \
+    for (; i + (W) <= n; i += (W)) {                                          \
+        V v = *(const VU *)(x + i);                                           \
+        VI gt = v > m;                                                        \
+        m = (V)(((VI)v & gt) | ((VI)m & ~gt));                                \
+    }                                                                         \
+    float best = m[0];                                                        \
+    for (int k = 1; k < (W); k++)                                             \
+        if (m[k] > best)                                                      \
+            best = m[k];                                                      \
+    for (; i < n; i++)                                                        \
+        if (x[i] > best)                                                      \
+            best = x[i];                                                      \
+    return best;                                                              \
+}                                                                             \
+                                                                              \
+__attribute__((target(tgt)))                                                  \
+static void scale_##sfx(float *x, float s, int n) {                           \
+    V vs = (V){0} + s;                                                        \
+    int i = 0;                                                                \
+    for (; i + (W) <= n; i += (W))                                            \
+        *(VU *)(x + i) = *(const VU *)(x + i) * vs;                           \
+    for (; i < n; i++)                                                        \
+        x[i] *= s;                                                            \
+}                                                                             \
+                                                                              \
+__attribute__((target(tgt)))                                                  \
+static void relu_##sfx(float *x, int n) {                                     \
+    V zero = {0};                                                             \
+    int i = 0;                                                                \
+    for (; i + (W) <= n; i += (W)) {                                          \
+        V v = *(const VU *)(x + i);                                           \
+        *(VU *)(x + i) = (V)((VI)v & (v > zero));                             \
+    }                                                                         \
+    relu_scalar(x + i, n - i);                                                \
+}                                                                             \
+                                                                              \
+static const math_vec_ops_t ops_##sfx = {dot_##sfx, axpy_##sfx, add_##sfx,    \
+                                         max_##sfx, scale_##sfx, relu_##sfx};
+
+typedef float v4f __attribute__((vector_size(16)));
+typedef float v4f_u __attribute__((vector_size(16), aligned(4), may_alias));
+typedef int32_t v4i __attribute__((vector_size(16)));
+typedef float v8f __attribute__((vector_size(32)));
+typedef float v8f_u __attribute__((vector_size(32), aligned(4), may_alias));
+typedef int32_t v8i __attribute__((vector_size(32)));
+typedef float v16f __attribute__((vector_size(64)));
+typedef float v16f_u __attribute__((vector_size(64), aligned(4), may_alias));
+typedef int32_t v16i __attribute__((vector_size(64)));
+
+MATH_VEC_KERNELS(sse2, "sse2", v4f, v4f_u, v4i, 4)
+MATH_VEC_KERNELS(avx2, "avx2,fma", v8f, v8f_u, v8i, 8)
+MATH_VEC_KERNELS(avx512, "avx512f", v16f, v16f_u, v16i, 16)
+
+static const math_vec_ops_t ops_scalar = {dot_scalar, axpy_scalar, add_scalar, max_scalar,
+                                          scale_scalar, relu_scalar};
+
+/* ---- dispatch ---- */
+
+static const math_vec_ops_t *g_ops = NULL;
+static math_vec_isa_t g_isa = MATH_VEC_SCALAR;
+
+static const math_vec_ops_t *math_vec_ops(void) {
+    if (g_ops)
+        return g_ops;
+
+    uint32_t f = fpu_features();
+    if (f & FPU_FEAT_AVX512F) {
+        g_isa = MATH_VEC_AVX512;
+        g_ops = &ops_avx512;
+    } else if ((f & FPU_FEAT_AVX2) && (f & FPU_FEAT_FMA)) {
+        g_isa = MATH_VEC_AVX2;
+        g_ops = &ops_avx2;
+    } else if (f & FPU_FEAT_SSE2) {
+        g_isa = MATH_VEC_SSE2;
+        g_ops = &ops_sse2;
+    } else {
+        g_isa = MATH_VEC_SCALAR;
+        g_ops = &ops_scalar;
+    }
+
+    console_write("[math] vector kernels: ");
+    console_write(math_vec_isa_name(g_isa));
+    console_write("\n");
+    return g_ops;
+}
+
+float math_vec_dot(const float *a, const float *b, int n) {
+    return n > 0 ? math_vec_ops()->dot(a, b, n) : 0.0f;
+}
+
+void math_vec_axpy(float alpha, const float *x, float *y, int n) {
+    if (n > 0)
+        math_vec_ops()->axpy(alpha, x, y, n);
+}
+
+void math_vec_add(const float *x, float *y, int n) {
+    if (n > 0)
+        math_vec_ops()->add(x, y, n);
+}
+
+void math_vec_gemv(const float *m, int rows, int cols, int stride, const float *x, float *y) {
+    const math_vec_ops_t *ops = math_vec_ops();
+    for (int r = 0; r < rows; r++)
+        y[r] = cols > 0 ? ops->dot(m + r * stride, x, cols) : 0.0f;
+}
+
+/* exp(x) for softmax: 2^k * e^r with |r| <= ln2/2, degree-5 Taylor for
+ * e^r (relative error ~2e-7); 0 below -87
+ */
+static float vec_expf(float x) {
+    if (x < -87.0f)
+        return 0.0f;
+    if (x > 88.0f)
+        x = 88.0f;
+    float kf = x * 1.44269504f;
+    int k = (int)(kf + (kf >= 0.0f ? 0.5f : -0.5f));
+    float r = x - (float)k * 0.69314718f;
+    float p = 1.0f + r * (1.0f + r * (0.5f + r * (1.0f / 6 + r * (1.0f / 24 + r * (1.0f / 120)))));
+    union {
+        float f;
+        uint32_t u;
+    } scale;
+    scale.u = (uint32_t)(k + 127) << 23;
+    return p * scale.f;
+}
+
+void math_vec_relu(float *x, int n) {
+    if (n > 0)
+        math_vec_ops()->relu(x, n);
+}
+
+/* tanh(x) = sign(x) * (1 - e) / (1 + e), e = exp(-2|x|) */
+void math_vec_tanh(float *x, int n) {
+    for (int i = 0; i < n; i++) {
+        float a = x[i] < 0.0f ? -x[i] : x[i];
+        float e = vec_expf(-2.0f * a);
+        float t = (1.0f - e) / (1.0f + e);
+        x[i] = x[i] < 0.0f ? -t : t;
+    }
+}
+
+void math_vec_softmax(const float *x, float *y, int n) {
+    if (n <= 0)
+        return;
+    const math_vec_ops_t *ops = math_vec_ops();
+    float m = ops->max(x, n);
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        y[i] = vec_expf(x[i] - m);
+        sum += y[i];
+    }
+    ops->scale(y, 1.0f / sum, n);
+}
+
+int math_vec_argmax(const float *x, int n) {
+    if (n <= 0)
+        return -1;
+    float m = math_vec_ops()->max(x, n);
+    for (int i = 0; i < n; i++)
+        if (x[i] == m)
+            return i;
+    return 0; /* Only if x holds NaNs */
+}
+
+math_vec_isa_t math_vec_isa(void) {
+    math_vec_ops();
+    return g_isa;
+}
+
+const char *math_vec_isa_name(math_vec_isa_t isa) {
+    switch (isa) {
+    case MATH_VEC_SSE2: return "sse2";
+    case MATH_VEC_AVX2: return "avx2";
+    case MATH_VEC_AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
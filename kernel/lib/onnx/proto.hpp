@@ -0,0 +1,160 @@
+/* kernel/lib/onnx/proto.hpp - Minimal protobuf wire-format reader
+ *
+ * Reads in place: strings, bytes, sub-messages and packed arrays come back
+ * as Spans into the buffer and are never copied. A malformed or truncated
+ * field clears ok and ends the walk; callers check it once at the end.
+ * Only what ONNX models use is supported (no groups).
+ */
+
+#ifndef _ONNX_PROTO_HPP
+#define _ONNX_PROTO_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace zenedge {
+namespace pb {
+
+enum Wire : uint32_t {
+    kVarint = 0,
+    kFixed64 = 1,
+    kLen = 2,
+    kFixed32 = 5,
+};
+
+struct Span {
+    const uint8_t *data;
+    uint32_t len;
+
+    bool Empty() const { return len == 0; }
+    bool Eq(const Span &o) const {
+        if (len != o.len)
+            return false;
+        for (uint32_t i = 0; i < len; i++)
+            if (data[i] != o.data[i])
+                return false;
+        return true;
+    }
+    bool Eq(const char *s) const {
+        uint32_t i = 0;
+        for (; s[i]; i++)
+            if (i >= len || data[i] != (uint8_t)s[i])
+                return false;
+        return i == len;
+    }
+};
+
+class Reader {
+public:
+    Reader(const uint8_t *data, uint32_t len) : p_(data), end_(data + len), ok_(true) {}
+    explicit Reader(const Span &s) : Reader(s.data, s.len) {}
+
+    bool ok() const { return ok_; }
+    void Fail() { ok_ = false; }
+    bool More() const { return ok_ && p_ < end_; }
+
+    /* Next field's number and wire type; false at the end or on error */
+    bool Next(uint32_t *field, uint32_t *wire) {
+        if (!More())
+            return false;
+        uint64_t key = Varint();
+        *field = (uint32_t)(key >> 3);
+        *wire = (uint32_t)(key & 7);
+        return ok_ && *field != 0;
+    }
+
+    uint64_t Varint() {
+        uint64_t v = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            if (p_ >= end_)
+                break;
+            uint8_t b = *p_++;
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    uint32_t Fixed32() {
+        if (end_ - p_ < 4) {
+            ok_ = false;
+            return 0;
+        }
+        uint32_t v = (uint32_t)p_[0] | ((uint32_t)p_[1] << 8) | ((uint32_t)p_[2] << 16) |
+                     ((uint32_t)p_[3] << 24);
+        p_ += 4;
+        return v;
+    }
+
+    float Float() {
+        union {
+            uint32_t u;
+            float f;
+        } conv;
+        conv.u = Fixed32();
+        return conv.f;
+    }
+
+    /* Payload of a length-delimited field */
+    Span Bytes() {
+        uint64_t n = Varint();
+        if (!ok_ || n > (uint64_t)(end_ - p_)) {
+            ok_ = false;
+            return Span{nullptr, 0};
+        }
+        Span s{p_, (uint32_t)n};
+        p_ += n;
+        return s;
+    }
+
+    void Skip(uint32_t wire) {
+        switch (wire) {
+        case kVarint:
+            Varint();
+            break;
+        case kFixed64:
+            Fixed32();
+            Fixed32();
+            break;
+        case kLen:
+            Bytes();
+            break;
+        case kFixed32:
+            Fixed32();
+            break;
+        default:
+            ok_ = false;
+            break;
+        }
+    }
+
+private:
+    const uint8_t *p_;
+    const uint8_t *end_;
+    bool ok_;
+};
+
+/* A repeated varint field, packed or not: call with the wire type of the
+ * field just read; each element goes to fn(value)
+ */
+template <typename Fn>
+static inline void RepeatedVarint(Reader &r, uint32_t wire, Fn fn) {
+    if (wire == kLen) {
+        Reader packed(r.Bytes());
+        while (packed.More())
+            fn(packed.Varint());
+        if (!packed.ok())
+            r.Fail();
+    } else if (wire == kVarint) {
+        fn(r.Varint());
+    } else {
+        r.Skip(wire);
+    }
+}
+
+}  // namespace pb
+}  // namespace zenedge
+
+#endif /* _ONNX_PROTO_HPP */
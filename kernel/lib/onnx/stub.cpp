@@ -1,22 +1,760 @@
-/* kernel/lib/onnx/stub.cpp - Minimal ORT Stub */
-#include "onnx_stub_api.h"
+/* kernel/lib/onnx/stub.cpp - ONNX model loader for the MLP engine
+ *
+ * Load runs in three passes over the model bytes, which are only read:
+ *   1. parse: the graph's initializers, Constant outputs and nodes are
+ *      indexed in place (names and tensor data stay Spans into the blob);
+ *   2. plan: nodes are walked in order (ONNX keeps them topologically
+ *      sorted) along the one runtime value. Gemm/MatMul start a linear
+ *      layer, Add of a constant joins its bias, Relu/Tanh/Softmax become
+ *      its activation, Flatten is a no-op on a single vector, and an Add of
+ *      two constants is folded into a constant sum. Linear layers with no
+ *      activation between them are then grouped for fusion;
+ *   3. build: each group's weights and bias are written float32 into one
+ *      page run, with alpha/beta and transposes applied and fused groups
+ *      multiplied out (W = W2 W1, b = W2 b1 + b2) through scratch pages.
+ * Tensor data must be float32, as raw_data or (packed) float_data.
+ * Load keeps its parse state in static storage and is not reentrant.
+ */
+
+#include "../../include/onnx_stub_api.h"
+#include "proto.hpp"
+
+extern "C" {
+#include "../../include/engine/onnx.h"
+#include "../../include/string.h"
+#include "../../ipc/heap.h"
+#include "../../mm/pmm.h"
+#include "../../mm/vmm.h"
+#include "../../trace/klog.h"
+#include "../../zenedge_alloc.h"
+}
+
+using zenedge::pb::Reader;
+using zenedge::pb::Span;
+namespace pb = zenedge::pb;
+
+namespace {
+
+constexpr uint32_t kMaxInits = 64;   /* Initializers plus Constant outputs */
+constexpr uint32_t kMaxNodes = 48;
+constexpr uint32_t kMaxInputs = 3;   /* Gemm's A, B, C */
+constexpr uint32_t kMaxDims = 4;
+constexpr uint32_t kMaxTerms = 4;    /* Summands of a folded constant, or of a bias */
+constexpr uint32_t kMaxPlan = 2 * IPC_MLP_MAX_LAYERS;
+
+/* A float32 constant: tensor data in the blob, or a folded sum of others */
+struct Const {
+    Span name;
+    uint32_t dims[kMaxDims];
+    uint32_t ndim;
+    uint32_t count;
+    const uint8_t *data;  /* count little-endian floats, NULL for a sum */
+    uint8_t terms[kMaxTerms];
+    uint8_t nterms;
+};
+
+struct Node {
+    Span op;
+    Span in[kMaxInputs];
+    uint32_t nin;
+    Span out;
+    uint32_t nout;
+    float alpha;
+    float beta;
+    int64_t trans_a;
+    int64_t trans_b;
+    int64_t axis;
+    bool has_axis;
+    Span value;           /* Constant: the TensorProto */
+};
+
+/* One Gemm/MatMul and what follows it: y = act(alpha * W x + sum(scale * bias)) */
+struct PlanLayer {
+    const Const *w;
+    bool w_io;            /* Stored [in, out] rather than [out, in] */
+    float alpha;
+    const Const *bias[kMaxTerms];
+    float bias_scale[kMaxTerms];
+    uint32_t nbias;
+    uint32_t in;
+    uint32_t out;
+    uint8_t act;
+    uint8_t group;        /* Output layer it is built into */
+};
+
+struct LoadState {
+    Const consts[kMaxInits];
+    uint32_t nconsts;
+    Node nodes[kMaxNodes];
+    uint32_t nnodes;
+    Span inputs[kMaxInits + 1];
+    uint32_t ninputs;
+    Span output;
+    uint32_t noutputs;
+    PlanLayer plan[kMaxPlan];
+    uint32_t nplan;
+};
+
+LoadState g_state;
+
+/* ---- parse ---- */
+
+OrtStub::Status ParseTensor(Span t, Const *c) {
+    Reader r(t);
+    uint32_t field, wire;
+    int64_t dtype = 0;
+    Span raw{nullptr, 0};
+    Span floats{nullptr, 0};
+    bool external = false;
+    bool bad_dims = false;
+
+    c->ndim = 0;
+    c->nterms = 0;
+    c->name = Span{nullptr, 0};
+    while (r.Next(&field, &wire)) {
+        if (field == 1) {
+            pb::RepeatedVarint(r, wire, [c, &bad_dims](uint64_t v) {
+                if (c->ndim >= kMaxDims || v > IPC_MLP_MAX_WIDTH * IPC_MLP_MAX_WIDTH)
+                    bad_dims = true;
+                else
+                    c->dims[c->ndim++] = (uint32_t)v;
+            });
+        } else if (field == 2 && wire == pb::kVarint) {
+            dtype = (int64_t)r.Varint();
+        } else if (field == 4 && wire == pb::kLen) {
+            floats = r.Bytes();
+        } else if (field == 4) {
+            return OrtStub::kUnsupportedGraph;  /* Unpacked float_data */
+        } else if (field == 8 && wire == pb::kLen) {
+            c->name = r.Bytes();
+        } else if (field == 9 && wire == pb::kLen) {
+            raw = r.Bytes();
+        } else if (field == 13) {
+            external = true;  /* external_data */
+            r.Skip(wire);
+        } else if (field == 14 && wire == pb::kVarint) {
+            external = r.Varint() != 0;  /* data_location EXTERNAL */
+        } else {
+            r.Skip(wire);
+        }
+    }
+    if (!r.ok())
+        return OrtStub::kParseError;
+    if (dtype != 1 || external)  /* FLOAT, stored in the model */
+        return OrtStub::kUnsupportedGraph;
+    if (bad_dims)
+        return OrtStub::kTooLarge;
+
+    uint64_t count = 1;
+    for (uint32_t i = 0; i < c->ndim; i++)
+        count *= c->dims[i];
+    Span data = raw.len ? raw : floats;
+    if (count == 0 || count * sizeof(float) != data.len)
+        return OrtStub::kUnsupportedGraph;
+    c->count = (uint32_t)count;
+    c->data = data.data;
+    return OrtStub::kOk;
+}
+
+OrtStub::Status ParseAttribute(Span a, Node *n) {
+    Reader r(a);
+    uint32_t field, wire;
+    Span name{nullptr, 0};
+    float f = 0.0f;
+    int64_t i = 0;
+    Span t{nullptr, 0};
+    while (r.Next(&field, &wire)) {
+        if (field == 1 && wire == pb::kLen)
+            name = r.Bytes();
+        else if (field == 2 && wire == pb::kFixed32)
+            f = r.Float();
+        else if (field == 3 && wire == pb::kVarint)
+            i = (int64_t)r.Varint();
+        else if (field == 5 && wire == pb::kLen)
+            t = r.Bytes();
+        else
+            r.Skip(wire);
+    }
+    if (!r.ok())
+        return OrtStub::kParseError;
+
+    if (name.Eq("alpha"))
+        n->alpha = f;
+    else if (name.Eq("beta"))
+        n->beta = f;
+    else if (name.Eq("transA"))
+        n->trans_a = i;
+    else if (name.Eq("transB"))
+        n->trans_b = i;
+    else if (name.Eq("axis")) {
+        n->axis = i;
+        n->has_axis = true;
+    } else if (name.Eq("value"))
+        n->value = t;
+    return OrtStub::kOk;
+}
+
+OrtStub::Status ParseNode(Span s, Node *n) {
+    Reader r(s);
+    uint32_t field, wire;
+    Span domain{nullptr, 0};
+    memset(n, 0, sizeof(*n));
+    n->alpha = 1.0f;
+    n->beta = 1.0f;
+    while (r.Next(&field, &wire)) {
+        if (field == 1 && wire == pb::kLen) {
+            Span v = r.Bytes();
+            if (n->nin < kMaxInputs)
+                n->in[n->nin] = v;
+            n->nin++;
+        } else if (field == 2 && wire == pb::kLen) {
+            Span v = r.Bytes();
+            if (n->nout++ == 0)
+                n->out = v;
+        } else if (field == 4 && wire == pb::kLen) {
+            n->op = r.Bytes();
+        } else if (field == 5 && wire == pb::kLen) {
+            OrtStub::Status st = ParseAttribute(r.Bytes(), n);
+            if (st != OrtStub::kOk)
+                return st;
+        } else if (field == 7 && wire == pb::kLen) {
+            domain = r.Bytes();
+        } else {
+            r.Skip(wire);
+        }
+    }
+    if (!r.ok())
+        return OrtStub::kParseError;
+    if (n->nin > kMaxInputs || n->nout != 1 || !(domain.Empty() || domain.Eq("ai.onnx")))
+        return OrtStub::kUnsupportedOp;
+    return OrtStub::kOk;
+}
+
+/* ValueInfoProto: only the name matters */
+Span ParseValueName(Span v, Reader &outer) {
+    Reader r(v);
+    uint32_t field, wire;
+    Span name{nullptr, 0};
+    while (r.Next(&field, &wire)) {
+        if (field == 1 && wire == pb::kLen)
+            name = r.Bytes();
+        else
+            r.Skip(wire);
+    }
+    if (!r.ok())
+        outer.Fail();
+    return name;
+}
+
+OrtStub::Status ParseGraph(Span g, LoadState *st) {
+    Reader r(g);
+    uint32_t field, wire;
+    while (r.Next(&field, &wire)) {
+        if (wire != pb::kLen) {
+            r.Skip(wire);
+        } else if (field == 1) {
+            if (st->nnodes >= kMaxNodes)
+                return OrtStub::kTooLarge;
+            OrtStub::Status s = ParseNode(r.Bytes(), &st->nodes[st->nnodes++]);
+            if (s != OrtStub::kOk)
+                return s;
+        } else if (field == 5) {
+            if (st->nconsts >= kMaxInits)
+                return OrtStub::kTooLarge;
+            OrtStub::Status s = ParseTensor(r.Bytes(), &st->consts[st->nconsts++]);
+            if (s != OrtStub::kOk)
+                return s;
+        } else if (field == 11) {
+            if (st->ninputs >= kMaxInits + 1)
+                return OrtStub::kTooLarge;
+            st->inputs[st->ninputs++] = ParseValueName(r.Bytes(), r);
+        } else if (field == 12) {
+            Span name = ParseValueName(r.Bytes(), r);
+            if (st->noutputs++ == 0)
+                st->output = name;
+        } else {
+            r.Skip(wire);
+        }
+    }
+    return r.ok() ? OrtStub::kOk : OrtStub::kParseError;
+}
+
+OrtStub::Status ParseModel(const uint8_t *data, uint32_t len, LoadState *st) {
+    Reader r(data, len);
+    uint32_t field, wire;
+    bool have_graph = false;
+    while (r.Next(&field, &wire)) {
+        if (field == 7 && wire == pb::kLen && !have_graph) {
+            OrtStub::Status s = ParseGraph(r.Bytes(), st);
+            if (s != OrtStub::kOk)
+                return s;
+            have_graph = true;
+        } else {
+            r.Skip(wire);
+        }
+    }
+    if (!r.ok() || !have_graph)
+        return OrtStub::kParseError;
+    return OrtStub::kOk;
+}
+
+/* ---- plan ---- */
+
+Const *FindConst(LoadState *st, const Span &name) {
+    for (uint32_t i = 0; i < st->nconsts; i++)
+        if (st->consts[i].name.Eq(name))
+            return &st->consts[i];
+    return nullptr;
+}
+
+float ConstAt(const LoadState *st, const Const *c, uint32_t i) {
+    if (c->nterms) {
+        float sum = 0.0f;
+        for (uint32_t t = 0; t < c->nterms; t++) {
+            const Const *term = &st->consts[c->terms[t]];
+            sum += ConstAt(st, term, term->count == 1 ? 0 : i);
+        }
+        return sum;
+    }
+    float v;
+    memcpy(&v, c->data + (size_t)i * sizeof(float), sizeof(v));
+    return v;
+}
+
+/* Fold Add(a, b) of two constants into a new constant named out */
+OrtStub::Status FoldAdd(LoadState *st, const Const *a, const Const *b, const Span &out) {
+    if (a->count != b->count && a->count != 1 && b->count != 1)
+        return OrtStub::kUnsupportedGraph;
+    uint32_t nterms = (a->nterms ? a->nterms : 1) + (b->nterms ? b->nterms : 1);
+    if (nterms > kMaxTerms || st->nconsts >= kMaxInits)
+        return OrtStub::kTooLarge;
+
+    Const *c = &st->consts[st->nconsts];
+    const Const *big = a->count >= b->count ? a : b;
+    memcpy(c->dims, big->dims, sizeof(c->dims));
+    c->ndim = big->ndim;
+    c->count = big->count;
+    c->data = nullptr;
+    c->name = out;
+    c->nterms = 0;
+    const Const *parts[2] = {a, b};
+    for (const Const *p : parts) {
+        if (p->nterms) {
+            for (uint32_t t = 0; t < p->nterms; t++)
+                c->terms[c->nterms++] = p->terms[t];
+        } else {
+            c->terms[c->nterms++] = (uint8_t)(p - st->consts);
+        }
+    }
+    st->nconsts++;
+    return OrtStub::kOk;
+}
+
+/* The constant operands of n; the runtime one (if any) must be cur */
+OrtStub::Status SplitInputs(LoadState *st, const Node *n, const Span &cur, int *runtime,
+                            Const **c) {
+    *runtime = -1;
+    for (uint32_t i = 0; i < n->nin; i++) {
+        c[i] = n->in[i].Empty() ? nullptr : FindConst(st, n->in[i]);
+        if (c[i] || n->in[i].Empty())
+            continue;
+        if (*runtime >= 0 || !n->in[i].Eq(cur))
+            return OrtStub::kUnsupportedGraph;
+        *runtime = (int)i;
+    }
+    return OrtStub::kOk;
+}
+
+OrtStub::Status PlanLinear(LoadState *st, const Node *n, Const **c, uint32_t *width) {
+    const Const *w = c[1];
+    if (!w || w->ndim != 2 || n->trans_a != 0 || st->nplan >= kMaxPlan)
+        return st->nplan >= kMaxPlan ? OrtStub::kTooLarge : OrtStub::kUnsupportedGraph;
+    if (st->nplan && st->plan[st->nplan - 1].act == MLP_ACT_SOFTMAX)
+        return OrtStub::kUnsupportedGraph;
+
+    PlanLayer *l = &st->plan[st->nplan];
+    memset(l, 0, sizeof(*l));
+    l->w = w;
+    l->alpha = 1.0f;
+    bool gemm = n->op.Eq("Gemm");
+    l->w_io = !(gemm && n->trans_b);
+    l->in = l->w_io ? w->dims[0] : w->dims[1];
+    l->out = l->w_io ? w->dims[1] : w->dims[0];
+    if (l->in > IPC_MLP_MAX_WIDTH || l->out > IPC_MLP_MAX_WIDTH)
+        return OrtStub::kTooLarge;
+    if (*width && l->in != *width)
+        return OrtStub::kUnsupportedGraph;
+
+    if (gemm) {
+        l->alpha = n->alpha;
+        if (n->nin > 2 && c[2]) {
+            if (c[2]->count != l->out && c[2]->count != 1)
+                return OrtStub::kUnsupportedGraph;
+            l->bias[0] = c[2];
+            l->bias_scale[0] = n->beta;
+            l->nbias = 1;
+        }
+    }
+    *width = l->out;
+    st->nplan++;
+    return OrtStub::kOk;
+}
+
+OrtStub::Status PlanGraph(OrtStub::Env &env, LoadState *st) {
+    /* The runtime input: the one graph input that is not an initializer */
+    Span cur{nullptr, 0};
+    for (uint32_t i = 0; i < st->ninputs; i++) {
+        if (FindConst(st, st->inputs[i]))
+            continue;
+        if (!cur.Empty())
+            return OrtStub::kUnsupportedGraph;
+        cur = st->inputs[i];
+    }
+    if (cur.Empty() || st->noutputs != 1)
+        return OrtStub::kUnsupportedGraph;
+
+    uint32_t width = 0;
+    for (uint32_t i = 0; i < st->nnodes; i++) {
+        const Node *n = &st->nodes[i];
+        Const *c[kMaxInputs] = {nullptr, nullptr, nullptr};
+
+        if (n->op.Eq("Constant")) {
+            if (n->nin != 0 || n->value.Empty() || st->nconsts >= kMaxInits)
+                return OrtStub::kUnsupportedGraph;
+            OrtStub::Status s = ParseTensor(n->value, &st->consts[st->nconsts]);
+            if (s != OrtStub::kOk)
+                return s;
+            st->consts[st->nconsts++].name = n->out;
+            continue;
+        }
+
+        int rt;
+        OrtStub::Status s = SplitInputs(st, n, cur, &rt, c);
+        if (s != OrtStub::kOk)
+            return s;
+        bool is_add = n->op.Eq("Add");
+        if (rt < 0) {
+            /* Nothing at run time: fold it */
+            if (!is_add || n->nin != 2)
+                return OrtStub::kUnsupportedGraph;
+            s = FoldAdd(st, c[0], c[1], n->out);
+            if (s != OrtStub::kOk)
+                return s;
+            env.folded++;
+            continue;
+        }
+
+        PlanLayer *last = st->nplan ? &st->plan[st->nplan - 1] : nullptr;
+        if (n->op.Eq("Gemm") || n->op.Eq("MatMul")) {
+            if (rt != 0 || n->nin < 2)
+                return OrtStub::kUnsupportedGraph;
+            s = PlanLinear(st, n, c, &width);
+            if (s != OrtStub::kOk)
+                return s;
+        } else if (is_add) {
+            const Const *b = c[rt == 0 ? 1 : 0];
+            if (n->nin != 2 || !b || !last || last->act != MLP_ACT_NONE ||
+                (b->count != last->out && b->count != 1) || last->nbias >= kMaxTerms)
+                return OrtStub::kUnsupportedGraph;
+            last->bias[last->nbias] = b;
+            last->bias_scale[last->nbias++] = 1.0f;
+        } else if (n->op.Eq("Relu") || n->op.Eq("Tanh") || n->op.Eq("Softmax")) {
+            if (!last || last->act != MLP_ACT_NONE || n->nin != 1)
+                return OrtStub::kUnsupportedGraph;
+            if (n->op.Eq("Softmax")) {
+                if (n->has_axis && n->axis != -1 && n->axis != 1)
+                    return OrtStub::kUnsupportedGraph;
+                last->act = MLP_ACT_SOFTMAX;
+            } else {
+                last->act = n->op.Eq("Relu") ? MLP_ACT_RELU : MLP_ACT_TANH;
+            }
+        } else if (n->op.Eq("Flatten")) {
+            /* One observation vector: already flat */
+            if (n->nin != 1 || (n->has_axis && n->axis != 1 && n->axis != 0))
+                return OrtStub::kUnsupportedGraph;
+        } else {
+            return OrtStub::kUnsupportedOp;
+        }
+        cur = n->out;
+    }
+    if (st->nplan == 0 || !cur.Eq(st->output))
+        return OrtStub::kUnsupportedGraph;
+    return OrtStub::kOk;
+}
+
+/* Group plan layers: a layer with no activation is fused into the next
+ * one when the product costs no more multiply-adds than running both
+ */
+uint32_t GroupLayers(OrtStub::Env &env, LoadState *st) {
+    uint32_t groups = 0;
+    uint32_t in = 0;
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < st->nplan; i++) {
+        PlanLayer *l = &st->plan[i];
+        const PlanLayer *prev = i ? &st->plan[i - 1] : nullptr;
+        if (prev && prev->act == MLP_ACT_NONE &&
+            (uint64_t)l->out * in <= (uint64_t)out * in + (uint64_t)l->out * out) {
+            l->group = prev->group;
+            out = l->out;
+            env.fused++;
+            continue;
+        }
+        l->group = (uint8_t)groups++;
+        in = l->in;
+        out = l->out;
+    }
+    return groups;
+}
+
+/* ---- build ---- */
+
+float PlanWeight(const LoadState *st, const PlanLayer *l, uint32_t r, uint32_t k) {
+    uint32_t idx = l->w_io ? k * l->out + r : r * l->in + k;
+    return l->alpha * ConstAt(st, l->w, idx);
+}
+
+float PlanBias(const LoadState *st, const PlanLayer *l, uint32_t r) {
+    float b = 0.0f;
+    for (uint32_t t = 0; t < l->nbias; t++)
+        b += l->bias_scale[t] * ConstAt(st, l->bias[t], l->bias[t]->count == 1 ? 0 : r);
+    return b;
+}
+
+/* Build plan layers first..last (one group) into w [out, in] and b [out].
+ * Fused groups multiply through scratch (two [IPC_MLP_MAX_WIDTH]^2 + bias
+ * buffers).
+ */
+void BuildGroup(const LoadState *st, uint32_t first, uint32_t last, float *w, float *b,
+                float *scratch) {
+    const PlanLayer *l0 = &st->plan[first];
+    const uint32_t in = l0->in;
+    const uint32_t buf = IPC_MLP_MAX_WIDTH * IPC_MLP_MAX_WIDTH + IPC_MLP_MAX_WIDTH;
+    float *cw = first == last ? w : scratch;
+    float *cb = first == last ? b : scratch + IPC_MLP_MAX_WIDTH * IPC_MLP_MAX_WIDTH;
+
+    for (uint32_t r = 0; r < l0->out; r++) {
+        for (uint32_t k = 0; k < in; k++)
+            cw[r * in + k] = PlanWeight(st, l0, r, k);
+        cb[r] = PlanBias(st, l0, r);
+    }
+
+    uint32_t width = l0->out;
+    for (uint32_t i = first + 1; i <= last; i++) {
+        const PlanLayer *l = &st->plan[i];
+        bool final = i == last;
+        float *nw = final ? w : (cw == scratch ? scratch + buf : scratch);
+        float *nb = final ? b : nw + IPC_MLP_MAX_WIDTH * IPC_MLP_MAX_WIDTH;
+        for (uint32_t r = 0; r < l->out; r++) {
+            float *row = &nw[r * in];
+            for (uint32_t k = 0; k < in; k++)
+                row[k] = 0.0f;
+            float acc = PlanBias(st, l, r);
+            for (uint32_t j = 0; j < width; j++) {
+                float a = PlanWeight(st, l, r, j);
+                const float *src = &cw[j * in];
+                for (uint32_t k = 0; k < in; k++)
+                    row[k] += a * src[k];
+                acc += a * cb[j];
+            }
+            nb[r] = acc;
+        }
+        cw = nw;
+        cb = nb;
+        width = l->out;
+    }
+}
+
+}  // namespace
 
 namespace OrtStub {
 
-Env::Env() {
-    // Stub
+Session::Session(Env &env, const void *model, size_t len, void *options) : Session() {
+    (void)options;
+    Load(env, model, len);
 }
 
-Env::~Env() {
-    // Stub
+Status Session::Load(Env &env, const void *model, size_t len) {
+    Release();
+    LoadState *st = &g_state;
+    memset(st, 0, sizeof(*st));
+
+    Status s = (model && len && len <= 0xFFFFFFFFu)
+                   ? ParseModel((const uint8_t *)model, (uint32_t)len, st)
+                   : kParseError;
+    if (s == kOk)
+        s = PlanGraph(env, st);
+    uint32_t groups = s == kOk ? GroupLayers(env, st) : 0;
+    if (s == kOk && groups > IPC_MLP_MAX_LAYERS)
+        s = kTooLarge;
+
+    /* Sizes of the output layers, and whether anything needs scratch */
+    uint32_t floats = 0;
+    bool fused = false;
+    if (s == kOk) {
+        for (uint32_t g = 0; g < groups; g++) {
+            uint32_t in = 0, out = 0;
+            for (uint32_t i = 0; i < st->nplan; i++) {
+                if (st->plan[i].group != g)
+                    continue;
+                if (!in)
+                    in = st->plan[i].in;
+                else
+                    fused = true;
+                out = st->plan[i].out;
+            }
+            floats += out * in + out;
+        }
+    }
+
+    uint32_t pages = (floats * sizeof(float) + PAGE_SIZE - 1) / PAGE_SIZE;
+    const uint32_t scratch_floats = 2 * (IPC_MLP_MAX_WIDTH * IPC_MLP_MAX_WIDTH + IPC_MLP_MAX_WIDTH);
+    uint32_t scratch_pages = fused ? (scratch_floats * sizeof(float) + PAGE_SIZE - 1) / PAGE_SIZE : 0;
+    zalloc_result_t mem = {};
+    zalloc_result_t scratch = {};
+    if (s == kOk) {
+        mem = zenedge_alloc_pages(pages, ZNODE_ANY);
+        if (scratch_pages)
+            scratch = zenedge_alloc_pages(scratch_pages, ZNODE_ANY);
+        if (!mem.addr || (scratch_pages && !scratch.addr))
+            s = kNoMemory;
+    }
+    if (s != kOk) {
+        if (mem.addr)
+            zenedge_free_pages(mem.addr, pages);
+        if (scratch.addr)
+            zenedge_free_pages(scratch.addr, scratch_pages);
+        env.failed++;
+        status_ = s;
+        return s;
+    }
+
+    float *dst = (float *)phys_to_virt((paddr_t)mem.addr);
+    float *tmp = scratch.addr ? (float *)phys_to_virt((paddr_t)scratch.addr) : nullptr;
+    uint32_t first = 0;
+    for (uint32_t g = 0; g < groups; g++) {
+        uint32_t last = first;
+        while (last + 1 < st->nplan && st->plan[last + 1].group == g)
+            last++;
+        mlp_layer_t *l = &model_.layer[g];
+        l->in = st->plan[first].in;
+        l->out = st->plan[last].out;
+        l->stride = l->in;
+        l->act = st->plan[last].act;
+        l->wdtype = DTYPE_FLOAT32;
+        l->bdtype = DTYPE_FLOAT32;
+        float *w = dst;
+        float *b = dst + l->out * l->in;
+        BuildGroup(st, first, last, w, b, tmp);
+        l->w = w;
+        l->b = b;
+        dst = b + l->out;
+        first = last + 1;
+    }
+    if (scratch.addr)
+        zenedge_free_pages(scratch.addr, scratch_pages);
+
+    model_.num_layers = groups;
+    model_.in_dim = model_.layer[0].in;
+    model_.out_dim = model_.layer[groups - 1].out;
+    pages_ = mem.addr;
+    num_pages_ = pages;
+    status_ = kOk;
+    env.loaded++;
+    return kOk;
 }
 
-Session::Session(Env& env, const char* model_path, void* options) {
-    (void)env; (void)model_path; (void)options;
+void Session::Release() {
+    if (pages_)
+        zenedge_free_pages(pages_, num_pages_);
+    memset(&model_, 0, sizeof(model_));
+    pages_ = 0;
+    num_pages_ = 0;
+    status_ = kEmpty;
 }
 
-void Session::Run() {
-    // Stub
+void Session::Run(const float *in, float *out) const {
+    if (Ok())
+        mlp_forward(&model_, in, out);
 }
 
-} /* namespace OrtStub */
+}  // namespace OrtStub
+
+/* ---- C side: a small cache of sessions over BLOB_TYPE_ONNX blobs ---- */
+
+namespace {
+
+constexpr uint32_t kCacheSlots = 2;
+
+struct CacheSlot {
+    OrtStub::Session session;
+    uint16_t blob_id;        /* 0 = empty */
+    uint32_t gen_offset;     /* Blob generation when loaded */
+    uint32_t gen_checksum;
+    uint32_t last_use;
+};
+
+CacheSlot g_cache[kCacheSlots];
+OrtStub::Env g_env;
+uint32_t g_clock = 0;
+
+}  // namespace
+
+extern "C" int onnx_is_model(uint16_t blob_id) {
+    heap_blob_t *blob = blob_id ? heap_get_blob(blob_id) : nullptr;
+    return blob && blob->type == BLOB_TYPE_ONNX && blob->size > 0;
+}
+
+extern "C" const mlp_model_t *onnx_get(uint16_t blob_id) {
+    if (!onnx_is_model(blob_id))
+        return nullptr;
+    const heap_blob_t *blob = heap_get_blob(blob_id);
+
+    CacheSlot *victim = nullptr;
+    for (uint32_t i = 0; i < kCacheSlots; i++) {
+        CacheSlot *s = &g_cache[i];
+        if (s->blob_id != blob_id)
+            continue;
+        if (s->gen_offset == blob->offset && s->gen_checksum == blob->checksum) {
+            s->last_use = ++g_clock;
+            return s->session.Model();
+        }
+        victim = s;  /* Rewritten since: reload in place */
+    }
+    for (uint32_t i = 0; !victim && i < kCacheSlots; i++)
+        if (!g_cache[i].blob_id)
+            victim = &g_cache[i];
+    if (!victim) {
+        victim = &g_cache[0];
+        for (uint32_t i = 1; i < kCacheSlots; i++)
+            if (g_cache[i].last_use < victim->last_use)
+                victim = &g_cache[i];
+    }
+
+    victim->session.Release();
+    victim->blob_id = 0;
+    if (heap_blob_retain(blob_id) != 0)
+        return nullptr;
+    OrtStub::Status st = victim->session.Load(g_env, heap_get_data(blob_id), blob->size);
+    heap_blob_release(blob_id);
+    if (st != OrtStub::kOk) {
+        KLOG2(KLOG_SUBSYS_KERN, KLOG_LVL_ERR, "onnx model %u: not loadable (status %u)",
+              blob_id, (uint32_t)st);
+        return nullptr;
+    }
+
+    const mlp_model_t *m = victim->session.Model();
+    victim->blob_id = blob_id;
+    victim->gen_offset = blob->offset;
+    victim->gen_checksum = blob->checksum;
+    victim->last_use = ++g_clock;
+    KLOG3(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "onnx model %u: %u layers, %u outputs", blob_id,
+          m->num_layers, m->out_dim);
+    return m;
+}
+
+extern "C" void onnx_cache_flush(void) {
+    for (uint32_t i = 0; i < kCacheSlots; i++) {
+        g_cache[i].session.Release();
+        g_cache[i].blob_id = 0;
+    }
+}
@@ -1,5 +1,21 @@
-/* kernel/lib/sha256.c - minimal SHA-256 */
+/* kernel/lib/sha256.c - SHA-256: scalar, SHA-NI and 8-lane AVX2
+ *
+ * Messages go through the block function fpu_features() allows, picked at
+ * the first hash after fpu_init() (before that, and on CPUs with neither
+ * extension, the scalar one). Whole blocks are hashed straight from the
+ * caller's buffer; only a partial block is copied into the context.
+ *
+ * The AVX2 kernel hashes one block of eight messages at once, one per
+ * 32-bit lane, for sha256_update_many(). A single message never uses it:
+ * per message it is no faster than the scalar code, and SHA-NI, where
+ * present, beats it outright.
+ */
+#include <immintrin.h>
+
 #include "sha256.h"
+#include "../arch/fpu.h"
+#include "../console.h"
+#include "../include/string.h"
 
 #define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32 - (b))))
 #define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
@@ -28,7 +44,9 @@ static const uint32_t k[64] = {
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-static void sha256_transform(sha256_ctx_t *ctx, const uint8_t data[64]) {
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static void sha256_transform(uint32_t state[8], const uint8_t data[64]) {
     uint32_t m[64];
     uint32_t a, b, c, d, e, f, g, h;
     uint32_t t1, t2;
@@ -43,14 +61,14 @@ static void sha256_transform(sha256_ctx_t *ctx, const uint8_t data[64]) {
         m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
     }
 
-    a = ctx->state[0];
-    b = ctx->state[1];
-    c = ctx->state[2];
-    d = ctx->state[3];
-    e = ctx->state[4];
-    f = ctx->state[5];
-    g = ctx->state[6];
-    h = ctx->state[7];
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
 
     for (uint32_t i = 0; i < 64; i++) {
         t1 = h + EP1(e) + CH(e, f, g) + k[i] + m[i];
@@ -65,14 +83,187 @@ static void sha256_transform(sha256_ctx_t *ctx, const uint8_t data[64]) {
         a = t1 + t2;
     }
 
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void blocks_scalar(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    for (; blocks; blocks--, data += 64)
+        sha256_transform(state, data);
+}
+
+/* Two rounds per sha256rnds2, on the state split as ABEF and CDGH */
+__attribute__((target("sha,sse4.1")))
+static void blocks_shani(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i dcba = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i hgfe = _mm_loadu_si128((const __m128i *)&state[4]);
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+    for (; blocks; blocks--, data += 64) {
+        __m128i abef0 = abef, cdgh0 = cdgh;
+        __m128i m[4];
+        for (int i = 0; i < 4; i++)
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), bswap);
+
+        for (int i = 0; i < 16; i++) {
+            if (i >= 4) {
+                /* m[i & 3] holds W[4i-16..]: replace it with W[4i..] */
+                __m128i w7 = _mm_alignr_epi8(m[(i - 1) & 3], m[(i - 2) & 3], 4);
+                __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(m[i & 3], m[(i - 3) & 3]), w7);
+                m[i & 3] = _mm_sha256msg2_epu32(t, m[(i - 1) & 3]);
+            }
+            __m128i wk = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *)&k[4 * i]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+        }
+
+        abef = _mm_add_epi32(abef, abef0);
+        cdgh = _mm_add_epi32(cdgh, cdgh0);
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+/* ---- 8 lanes ---- */
+
+__attribute__((target("avx2")))
+static inline __m256i x8_rotr(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+/* Words [off, off + 8) of each lane's block, word i of lane j in w[i][j] */
+__attribute__((target("avx2")))
+static void x8_load(__m256i w[8], const uint8_t *const data[8], uint32_t off) {
+    const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL,
+                                            0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m256i r[8], t[8], u[8];
+    for (int j = 0; j < 8; j++)
+        r[j] = _mm256_loadu_si256((const __m256i *)(data[j] + off));
+    for (int j = 0; j < 8; j += 2) {
+        t[j] = _mm256_unpacklo_epi32(r[j], r[j + 1]);
+        t[j + 1] = _mm256_unpackhi_epi32(r[j], r[j + 1]);
+    }
+    for (int j = 0; j < 8; j += 4) {
+        u[j] = _mm256_unpacklo_epi64(t[j], t[j + 2]);
+        u[j + 1] = _mm256_unpackhi_epi64(t[j], t[j + 2]);
+        u[j + 2] = _mm256_unpacklo_epi64(t[j + 1], t[j + 3]);
+        u[j + 3] = _mm256_unpackhi_epi64(t[j + 1], t[j + 3]);
+    }
+    for (int i = 0; i < 4; i++) {
+        w[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), bswap);
+        w[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), bswap);
+    }
+}
+
+/* One block of each of `lanes` messages; lanes past that repeat lane 0
+ * and are not stored
+ */
+__attribute__((target("avx2")))
+static void blocks_x8(uint32_t *const state[8], const uint8_t *const data[8], uint32_t lanes) {
+    uint32_t *st[8];
+    const uint8_t *in[8];
+    for (uint32_t j = 0; j < 8; j++) {
+        st[j] = state[j < lanes ? j : 0];
+        in[j] = data[j < lanes ? j : 0];
+    }
+
+    __m256i v[8], w[16];
+    for (int i = 0; i < 8; i++)
+        v[i] = _mm256_set_epi32(st[7][i], st[6][i], st[5][i], st[4][i],
+                                st[3][i], st[2][i], st[1][i], st[0][i]);
+    x8_load(&w[0], in, 0);
+    x8_load(&w[8], in, 32);
+
+    __m256i a = v[0], b = v[1], c = v[2], d = v[3];
+    __m256i e = v[4], f = v[5], g = v[6], h = v[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16) {
+            __m256i w2 = w[(i - 2) & 15], w15 = w[(i - 15) & 15];
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(x8_rotr(w2, 17), x8_rotr(w2, 19)),
+                                          _mm256_srli_epi32(w2, 10));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(x8_rotr(w15, 7), x8_rotr(w15, 18)),
+                                          _mm256_srli_epi32(w15, 3));
+            w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0),
+                                         _mm256_add_epi32(w[(i - 7) & 15], s1));
+        }
+        __m256i ep1 = _mm256_xor_si256(_mm256_xor_si256(x8_rotr(e, 6), x8_rotr(e, 11)),
+                                       x8_rotr(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, ep1),
+                                      _mm256_add_epi32(ch, _mm256_add_epi32(
+                                          _mm256_set1_epi32((int)k[i]), w[i & 15])));
+        __m256i ep0 = _mm256_xor_si256(_mm256_xor_si256(x8_rotr(a, 2), x8_rotr(a, 13)),
+                                       x8_rotr(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b),
+                                      _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, _mm256_add_epi32(ep0, maj));
+    }
+    v[0] = _mm256_add_epi32(v[0], a);
+    v[1] = _mm256_add_epi32(v[1], b);
+    v[2] = _mm256_add_epi32(v[2], c);
+    v[3] = _mm256_add_epi32(v[3], d);
+    v[4] = _mm256_add_epi32(v[4], e);
+    v[5] = _mm256_add_epi32(v[5], f);
+    v[6] = _mm256_add_epi32(v[6], g);
+    v[7] = _mm256_add_epi32(v[7], h);
+
+    uint32_t out[8][8];
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)out[i], v[i]);
+    for (uint32_t j = 0; j < lanes; j++)
+        for (int i = 0; i < 8; i++)
+            state[j][i] = out[i][j];
+}
+
+/* ---- dispatch ---- */
+
+static sha256_blocks_fn g_blocks = NULL;
+static const char *g_impl = "scalar";
+
+static sha256_blocks_fn sha256_blocks(void) {
+    if (g_blocks)
+        return g_blocks;
+
+    uint32_t f = fpu_features();
+    if (!f)
+        return blocks_scalar;   /* Before fpu_init(): decide later */
+    if ((f & FPU_FEAT_SHA) && (f & FPU_FEAT_SSE41)) {
+        g_impl = "sha-ni";
+        g_blocks = blocks_shani;
+    } else {
+        g_impl = (f & FPU_FEAT_AVX2) ? "scalar, avx2 x8" : "scalar";
+        g_blocks = blocks_scalar;
+    }
+
+    console_write("[sha256] ");
+    console_write(g_impl);
+    console_write("\n");
+    return g_blocks;
+}
+
+const char *sha256_impl(void) {
+    sha256_blocks();
+    return g_impl;
 }
 
 void sha256_init(sha256_ctx_t *ctx) {
@@ -89,12 +280,87 @@ void sha256_init(sha256_ctx_t *ctx) {
 }
 
 void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        ctx->data[ctx->datalen++] = data[i];
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
+    sha256_blocks_fn blocks = sha256_blocks();
+
+    if (ctx->datalen) {
+        size_t fill = 64 - ctx->datalen;
+        if (fill > len)
+            fill = len;
+        memcpy(ctx->data + ctx->datalen, data, fill);
+        ctx->datalen += fill;
+        data += fill;
+        len -= fill;
+        if (ctx->datalen < 64)
+            return;
+        blocks(ctx->state, ctx->data, 1);
+        ctx->bitlen += 512;
+        ctx->datalen = 0;
+    }
+
+    size_t n = len / 64;
+    if (n) {
+        blocks(ctx->state, data, n);
+        ctx->bitlen += (uint64_t)n * 512;
+        data += n * 64;
+        len -= n * 64;
+    }
+
+    memcpy(ctx->data, data, len);
+    ctx->datalen = len;
+}
+
+void sha256_update_many(sha256_ctx_t *const ctx[], const uint8_t *const data[],
+                        size_t len, uint32_t n) {
+    int x8 = n > 1 && sha256_blocks() == blocks_scalar && (fpu_features() & FPU_FEAT_AVX2);
+    for (uint32_t i = 1; x8 && i < n; i++)
+        x8 = ctx[i]->datalen == ctx[0]->datalen;
+
+    if (!x8) {
+        for (uint32_t i = 0; i < n; i++)
+            sha256_update(ctx[i], data[i], len);
+        return;
+    }
+
+    for (uint32_t base = 0; base < n; base += 8) {
+        uint32_t lanes = n - base < 8 ? n - base : 8;
+        sha256_ctx_t *const *c = &ctx[base];
+        uint32_t *state[8];
+        const uint8_t *in[8];
+        size_t off = 0;
+
+        /* Lanes are in step: same buffered bytes, same input length */
+        uint32_t used = c[0]->datalen;
+        if (used) {
+            off = 64 - used < len ? 64 - used : len;
+            for (uint32_t j = 0; j < lanes; j++) {
+                memcpy(c[j]->data + used, data[base + j], off);
+                c[j]->datalen += off;
+            }
+            if (c[0]->datalen == 64) {
+                for (uint32_t j = 0; j < lanes; j++) {
+                    state[j] = c[j]->state;
+                    in[j] = c[j]->data;
+                    c[j]->bitlen += 512;
+                    c[j]->datalen = 0;
+                }
+                blocks_x8(state, in, lanes);
+            }
+        }
+
+        for (; c[0]->datalen == 0 && len - off >= 64; off += 64) {
+            for (uint32_t j = 0; j < lanes; j++) {
+                state[j] = c[j]->state;
+                in[j] = data[base + j] + off;
+                c[j]->bitlen += 512;
+            }
+            blocks_x8(state, in, lanes);
+        }
+
+        if (c[0]->datalen == 0) {
+            for (uint32_t j = 0; j < lanes; j++) {
+                memcpy(c[j]->data, data[base + j] + off, len - off);
+                c[j]->datalen = len - off;
+            }
         }
     }
 }
@@ -112,7 +378,7 @@ void sha256_final(sha256_ctx_t *ctx, uint8_t hash[32]) {
         while (i < 64) {
             ctx->data[i++] = 0x00;
         }
-        sha256_transform(ctx, ctx->data);
+        sha256_blocks()(ctx->state, ctx->data, 1);
         for (i = 0; i < 56; i++) {
             ctx->data[i] = 0x00;
         }
@@ -127,7 +393,7 @@ void sha256_final(sha256_ctx_t *ctx, uint8_t hash[32]) {
     ctx->data[58] = (uint8_t)(ctx->bitlen >> 40);
     ctx->data[57] = (uint8_t)(ctx->bitlen >> 48);
     ctx->data[56] = (uint8_t)(ctx->bitlen >> 56);
-    sha256_transform(ctx, ctx->data);
+    sha256_blocks()(ctx->state, ctx->data, 1);
 
     for (i = 0; i < 4; i++) {
         hash[i]      = (uint8_t)(ctx->state[0] >> (24 - i * 8));
@@ -17,4 +17,14 @@ void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t len);
 void sha256_final(sha256_ctx_t *ctx, uint8_t hash[32]);
 void sha256_hash(const uint8_t *data, size_t len, uint8_t hash[32]);
 
+/* sha256_update(ctx[i], data[i], len) for each i < n. Contexts that have
+ * taken the same number of bytes so far go eight at a time through the
+ * AVX2 kernel when the CPU has AVX2 but not SHA-NI
+ */
+void sha256_update_many(sha256_ctx_t *const ctx[], const uint8_t *const data[],
+                        size_t len, uint32_t n);
+
+/* Block function in use: "sha-ni", "scalar, avx2 x8" or "scalar" */
+const char *sha256_impl(void);
+
 #endif
@@ -123,6 +123,7 @@ void * ReservePointer (IM3Compilation o)
 #define i_64    c_m3Type_i64
 #define f_32    c_m3Type_f32
 #define f_64    c_m3Type_f64
+#define v_128   c_m3Type_v128
 #define none    c_m3Type_none
 #define any     (u8)-1
 
@@ -194,6 +195,9 @@ void  ReleaseCompilationCodePage  (IM3Compilation o)
 static inline
 u16 GetTypeNumSlots (u8 i_type)
 {
+    if (i_type == c_m3Type_v128)
+        return 16 / sizeof (m3slot_t);
+
 #   if d_m3Use32BitSlots
         return Is64BitType (i_type) ? 2 : 1;
 #   else
@@ -204,7 +208,7 @@ u16 GetTypeNumSlots (u8 i_type)
 static inline
 void  AlignSlotToType  (u16 * io_slot, u8 i_type)
 {
-    // align 64-bit words to even slots (if d_m3Use32BitSlots)
+    // align 64-bit words to even slots (if d_m3Use32BitSlots); v128 to a multiple of its slot count
     u16 numSlots = GetTypeNumSlots (i_type);
 
     u16 mask = numSlots - 1;
@@ -351,6 +355,19 @@ void  MarkSlotsAllocatedByType  (IM3Compilation o, u16 i_slot, u8 i_type)
 }
 
 
+static inline
+bool  AreSlotsFree  (IM3Compilation o, u16 i_slot, u16 i_numSlots)
+{
+    while (i_numSlots--)
+    {
+        if (o->m3Slots [i_slot++])
+            return false;
+    }
+
+    return true;
+}
+
+
 static
 M3Result  AllocateSlotsWithinRange  (IM3Compilation o, u16 * o_slot, u8 i_type, u16 i_startSlot, u16 i_endSlot)
 {
@@ -361,11 +378,11 @@ M3Result  AllocateSlotsWithinRange  (IM3Compilation o, u16 * o_slot, u8 i_type,
 
     AlignSlotToType (& i_startSlot, i_type);
 
-    // search for 1 or 2 consecutive slots in the execution stack
+    // search for 1, 2 (or 4, v128) consecutive slots in the execution stack
     u16 i = i_startSlot;
     while (i + searchOffset < i_endSlot)
     {
-        if (o->m3Slots [i] == 0 and o->m3Slots [i + searchOffset] == 0)
+        if (AreSlotsFree (o, i, numSlots))
         {
             MarkSlotsAllocated (o, i, numSlots);
 
@@ -828,6 +845,28 @@ void  PatchBranches  (IM3Compilation o)
 
 //-------------------------------------------------------------------------------------------------------------------------
 
+static inline
+IM3Operation  GetCopySlotOp  (u8 i_type)
+{
+#   if d_m3HasSimd
+    if (i_type == c_m3Type_v128)
+        return op_CopySlot_128;
+#   endif
+
+    return Is64BitType (i_type) ? op_CopySlot_64 : op_CopySlot_32;
+}
+
+static inline
+IM3Operation  GetPreserveCopySlotOp  (u8 i_type)
+{
+#   if d_m3HasSimd
+    if (i_type == c_m3Type_v128)
+        return op_PreserveCopySlot_128;
+#   endif
+
+    return Is64BitType (i_type) ? op_PreserveCopySlot_64 : op_PreserveCopySlot_32;
+}
+
 static
 M3Result  CopyStackIndexToSlot  (IM3Compilation o, u16 i_destSlot, u16 i_stackIndex)  // NoPushPop
 {
@@ -842,7 +881,7 @@ M3Result  CopyStackIndexToSlot  (IM3Compilation o, u16 i_destSlot, u16 i_stackIn
     {
         op = c_setSetOps [type];
     }
-    else op = Is64BitType (type) ? op_CopySlot_64 : op_CopySlot_32;
+    else op = GetCopySlotOp (type);
 
 _   (EmitOp (o, op));
     EmitSlotOffset (o, i_destSlot);
@@ -887,7 +926,7 @@ M3Result  PreservedCopyTopSlot  (IM3Compilation o, u16 i_destSlot, u16 i_preserv
     {
         op = c_preserveSetSlot [type];
     }
-    else op = Is64BitType (type) ? op_PreserveCopySlot_64 : op_PreserveCopySlot_32;
+    else op = GetPreserveCopySlotOp (type);
 
 _   (EmitOp (o, op));
     EmitSlotOffset (o, i_destSlot);
@@ -1834,7 +1873,7 @@ _           (FindReferencedLocalWithinCurrentBlock (o, & preservedSlotNumber, sl
             if (preservedSlotNumber != slot)
             {
                 u8 type = GetStackTypeFromBottom (o, i);                    d_m3Assert (type != c_m3Type_none)
-                IM3Operation op = Is64BitType (type) ? op_CopySlot_64 : op_CopySlot_32;
+                IM3Operation op = GetCopySlotOp (type);
 
                 EmitOp          (o, op);
                 EmitSlotOffset  (o, preservedSlotNumber);
@@ -2045,6 +2084,21 @@ _          (Pop (o));
 
         op = c_intSelectOps [type - c_m3Type_i32] [opIndex];
     }
+#   if d_m3HasSimd
+    else if (type == c_m3Type_v128)
+    {
+        // vectors are never in a register; only the selector can be
+        op = IsStackTopInRegister (o) ? op_v128_Select_rss : op_v128_Select_sss;
+
+        for (u32 i = 0; i < 3; ++i)
+        {
+            if (not IsStackTopInRegister (o))
+                slots [i] = GetStackTopSlotNumber (o);
+
+_          (Pop (o));
+        }
+    }
+#   endif
     else if (not IsStackPolymorphic (o))
         _throw (m3Err_functionStackUnderrun);
 
@@ -2054,7 +2108,11 @@ _          (Pop (o));
         if (IsValidSlot (slots [i]))
             EmitSlotOffset (o, slots [i]);
     }
-_   (PushRegister (o, type));
+
+    if (type == c_m3Type_v128)
+_       (PushAllocatedSlotAndEmit (o, type))
+    else
+_       (PushRegister (o, type));
 
     _catch: return result;
 }
@@ -2219,6 +2277,169 @@ _   (Compile_Operator (o, i_opcode));
 }
 
 
+#if d_m3HasSimd
+
+// Fixed-width SIMD (0xFD prefix). A v128 occupies 16 bytes of slots and is never register
+// allocated, so these only need variants for where a scalar operand sits (_r0/_fp0 or a slot).
+
+static
+M3Result  EmitV128SlotAndPop  (IM3Compilation o)
+{
+    M3Result result = m3Err_none;
+
+    _throwif (m3Err_typeMismatch, GetStackTopType (o) != c_m3Type_v128 and not IsStackPolymorphic (o));
+
+    EmitSlotOffset (o, GetStackTopSlotNumber (o));
+_   (Pop (o));
+
+    _catch: return result;
+}
+
+static
+M3Result  Compile_SimdLoadStore  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+    u32 alignHint, memoryOffset;
+
+_   (ReadLEB_u32 (& alignHint, & o->wasm, o->wasmEnd));
+_   (ReadLEB_u32 (& memoryOffset, & o->wasm, o->wasmEnd));
+                                                                        m3log (compile, d_indent " (offset = %d)", get_indention_string (o), memoryOffset);
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    _throwif (m3Err_unknownOpcode, not opInfo);
+
+    // operations: [0] address in _r0, [1] address in a slot
+    if (opInfo->type == c_m3Type_v128)
+    {
+_       (EmitOp (o, opInfo->operations [IsStackTopInRegister (o) ? 0 : 1]));
+_       (EmitSlotNumOfStackTopAndPop (o));
+        EmitConstant32 (o, memoryOffset);
+_       (PushAllocatedSlotAndEmit (o, c_m3Type_v128));
+    }
+    else
+    {
+_       (EmitOp (o, opInfo->operations [IsStackTopMinus1InRegister (o) ? 0 : 1]));
+_       (EmitV128SlotAndPop (o));
+_       (EmitSlotNumOfStackTopAndPop (o));
+        EmitConstant32 (o, memoryOffset);
+    }
+}
+    _catch: return result;
+}
+
+static
+M3Result  Compile_SimdConst  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+    u64 lanes [2];
+
+    _throwif (m3Err_wasmUnderrun, o->wasmEnd - o->wasm < (i32) sizeof (lanes));
+    memcpy (lanes, o->wasm, sizeof (lanes));
+    o->wasm += sizeof (lanes);
+
+_   (EmitOp (o, op_v128_Const));
+    if (o->page)
+    {
+        EmitWord64 (o->page, lanes [0]);
+        EmitWord64 (o->page, lanes [1]);
+    }
+_   (PushAllocatedSlotAndEmit (o, c_m3Type_v128));
+}
+    _catch: return result;
+}
+
+// splat (wasm type = v128) and extract_lane (wasm type = the scalar)
+static
+M3Result  Compile_SimdLane  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    _throwif (m3Err_unknownOpcode, not opInfo);
+
+    if (opInfo->type == c_m3Type_v128)
+    {
+        // operations: [0] scalar in register, [1] scalar in a slot
+_       (EmitOp (o, opInfo->operations [IsStackTopInRegister (o) ? 0 : 1]));
+_       (EmitSlotNumOfStackTopAndPop (o));
+_       (PushAllocatedSlotAndEmit (o, c_m3Type_v128));
+    }
+    else
+    {
+        u8 lane;
+_       (Read_u8 (& lane, & o->wasm, o->wasmEnd));
+        _throwif (m3Err_wasmMalformed, lane >= 4);
+
+_       (PreserveRegisterIfOccupied (o, opInfo->type));
+_       (EmitOp (o, opInfo->operations [0]));
+        EmitConstant32 (o, lane);
+_       (EmitV128SlotAndPop (o));
+_       (PushRegister (o, opInfo->type));
+    }
+}
+    _catch: return result;
+}
+
+static
+M3Result  Compile_SimdReplaceLane  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    _throwif (m3Err_unknownOpcode, not opInfo);
+
+    u8 lane;
+_   (Read_u8 (& lane, & o->wasm, o->wasmEnd));
+    _throwif (m3Err_wasmMalformed, lane >= 4);
+
+    // operations: [0] scalar in register, [1] scalar in a slot
+_   (EmitOp (o, opInfo->operations [IsStackTopInRegister (o) ? 0 : 1]));
+    EmitConstant32 (o, lane);
+_   (EmitSlotNumOfStackTopAndPop (o));
+_   (EmitV128SlotAndPop (o));
+_   (PushAllocatedSlotAndEmit (o, c_m3Type_v128));
+}
+    _catch: return result;
+}
+
+// v128 -> v128 (stackOffset 0) and v128 x v128 -> v128 (stackOffset -1); top operand is emitted first
+static
+M3Result  Compile_SimdOperator  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    _throwif (m3Err_unknownOpcode, not opInfo);
+
+_   (EmitOp (o, opInfo->operations [0]));
+
+    for (i32 i = opInfo->stackOffset; i <= 0; ++i)
+_       (EmitV128SlotAndPop (o));
+
+_   (PushAllocatedSlotAndEmit (o, c_m3Type_v128));
+}
+    _catch: return result;
+}
+
+static
+M3Result  Compile_SimdOpcode  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+    u32 opcode;
+_   (ReadLEB_u32 (& opcode, & o->wasm, o->wasmEnd));             m3log (compile, d_indent " (FD: %" PRIi32 ")", get_indention_string (o), opcode);
+
+    _throwif (m3Err_unknownOpcode, opcode > 0xff);
+    i_opcode = (c_waOp_simd << 8) | opcode;
+
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    _throwif (m3Err_unknownOpcode, not opInfo or not opInfo->compiler);
+
+_   ((* opInfo->compiler) (o, i_opcode));
+
+    o->previousOpcode = i_opcode;
+
+    } _catch: return result;
+}
+
+#endif // d_m3HasSimd
+
+
 M3Result  CompileRawFunction  (IM3Module io_module,  IM3Function io_function, const void * i_function, const void * i_userdata)
 {
     d_m3Assert (io_module->runtime);
@@ -2519,6 +2740,10 @@ const M3OpInfo c_operations [] =
     [c_waOp_extended] = M3OP( "0xFC", 0, c_m3Type_unknown,   d_emptyOpList,  Compile_ExtendedOpcode ),
 # endif
 
+# if d_m3HasSimd
+    [c_waOp_simd] =     M3OP( "0xFD", 0, c_m3Type_unknown,   d_emptyOpList,  Compile_SimdOpcode ),
+# endif
+
 # ifdef DEBUG
     M3OP( "termination", 0, c_m3Type_unknown ) // for find_operation_info
 # endif
@@ -2546,6 +2771,51 @@ const M3OpInfo c_operationsFC [] =
 # endif
 };
 
+#if d_m3HasSimd
+#define d_simdOp(OP)                        { op_##OP,                  NULL,                       NULL,                       NULL }
+#define d_simdRegOpList(OP)                 { op_##OP##_r,              op_##OP##_s,                NULL,                       NULL }
+#define d_simdStoreOpList(OP)               { op_##OP##_sr,             op_##OP##_ss,               NULL,                       NULL }
+
+// sparse: only the subset the executor implements; everything else is m3Err_unknownOpcode
+const M3OpInfo c_operationsFD [] =
+{
+    [0x00] = M3OP( "v128.load",             0,  v_128,  d_simdRegOpList (v128_Load),            Compile_SimdLoadStore ),
+    [0x0b] = M3OP( "v128.store",           -2,  none,   d_simdStoreOpList (v128_Store),         Compile_SimdLoadStore ),
+    [0x0c] = M3OP( "v128.const",            1,  v_128,  d_simdOp (v128_Const),                  Compile_SimdConst ),
+
+    [0x11] = M3OP( "i32x4.splat",           0,  v_128,  d_simdRegOpList (i32x4_Splat),          Compile_SimdLane ),
+    [0x13] = M3OP_F( "f32x4.splat",         0,  v_128,  d_simdRegOpList (f32x4_Splat),          Compile_SimdLane ),
+    [0x1b] = M3OP( "i32x4.extract_lane",    0,  i_32,   d_simdOp (i32x4_ExtractLane),           Compile_SimdLane ),
+    [0x1c] = M3OP( "i32x4.replace_lane",   -1,  v_128,  d_simdRegOpList (i32x4_ReplaceLane),    Compile_SimdReplaceLane ),
+    [0x1f] = M3OP_F( "f32x4.extract_lane",  0,  f_32,   d_simdOp (f32x4_ExtractLane),           Compile_SimdLane ),
+    [0x20] = M3OP_F( "f32x4.replace_lane", -1,  v_128,  d_simdRegOpList (f32x4_ReplaceLane),    Compile_SimdReplaceLane ),
+
+    [0x4d] = M3OP( "v128.not",              0,  v_128,  d_simdOp (v128_Not),                    Compile_SimdOperator ),
+    [0x4e] = M3OP( "v128.and",             -1,  v_128,  d_simdOp (v128_And),                    Compile_SimdOperator ),
+    [0x4f] = M3OP( "v128.andnot",          -1,  v_128,  d_simdOp (v128_AndNot),                 Compile_SimdOperator ),
+    [0x50] = M3OP( "v128.or",              -1,  v_128,  d_simdOp (v128_Or),                     Compile_SimdOperator ),
+    [0x51] = M3OP( "v128.xor",             -1,  v_128,  d_simdOp (v128_Xor),                    Compile_SimdOperator ),
+
+    [0xae] = M3OP( "i32x4.add",            -1,  v_128,  d_simdOp (i32x4_Add),                   Compile_SimdOperator ),
+    [0xb1] = M3OP( "i32x4.sub",            -1,  v_128,  d_simdOp (i32x4_Subtract),              Compile_SimdOperator ),
+    [0xb5] = M3OP( "i32x4.mul",            -1,  v_128,  d_simdOp (i32x4_Multiply),              Compile_SimdOperator ),
+    [0xba] = M3OP( "i32x4.dot_i16x8_s",    -1,  v_128,  d_simdOp (i32x4_DotI16x8),              Compile_SimdOperator ),
+
+    [0xe0] = M3OP_F( "f32x4.abs",           0,  v_128,  d_simdOp (f32x4_Abs),                   Compile_SimdOperator ),
+    [0xe1] = M3OP_F( "f32x4.neg",           0,  v_128,  d_simdOp (f32x4_Negate),                Compile_SimdOperator ),
+    [0xe3] = M3OP_F( "f32x4.sqrt",          0,  v_128,  d_simdOp (f32x4_Sqrt),                  Compile_SimdOperator ),
+    [0xe4] = M3OP_F( "f32x4.add",          -1,  v_128,  d_simdOp (f32x4_Add),                   Compile_SimdOperator ),
+    [0xe5] = M3OP_F( "f32x4.sub",          -1,  v_128,  d_simdOp (f32x4_Subtract),              Compile_SimdOperator ),
+    [0xe6] = M3OP_F( "f32x4.mul",          -1,  v_128,  d_simdOp (f32x4_Multiply),              Compile_SimdOperator ),
+    [0xe7] = M3OP_F( "f32x4.div",          -1,  v_128,  d_simdOp (f32x4_Divide),                Compile_SimdOperator ),
+    [0xe8] = M3OP_F( "f32x4.min",          -1,  v_128,  d_simdOp (f32x4_Min),                   Compile_SimdOperator ),
+    [0xe9] = M3OP_F( "f32x4.max",          -1,  v_128,  d_simdOp (f32x4_Max),                   Compile_SimdOperator ),
+
+    [0xf8] = M3OP_F( "i32x4.trunc_sat_f32x4_s", 0, v_128, d_simdOp (i32x4_TruncSat_f32x4),      Compile_SimdOperator ),
+    [0xfa] = M3OP_F( "f32x4.convert_i32x4_s",   0, v_128, d_simdOp (f32x4_Convert_i32x4),       Compile_SimdOperator ),
+};
+#endif // d_m3HasSimd
+
 
 IM3OpInfo  GetOpInfo  (m3opcode_t opcode)
 {
@@ -2561,6 +2831,14 @@ IM3OpInfo  GetOpInfo  (m3opcode_t opcode)
             return &c_operationsFC[opcode];
         }
         break;
+#if d_m3HasSimd
+    case c_waOp_simd:
+        opcode &= 0xFF;
+        if (M3_LIKELY(opcode < M3_COUNT_OF(c_operationsFD))) {
+            return &c_operationsFD[opcode];
+        }
+        break;
+#endif
     }
     return NULL;
 }
@@ -2784,7 +3062,7 @@ _   (ReadLEB_u32 (& numLocalBlocks, & o->wasm, o->wasmEnd));
 
 _       (ReadLEB_u32 (& varCount, & o->wasm, o->wasmEnd));
 _       (ReadLEB_i7 (& waType, & o->wasm, o->wasmEnd));
-_       (NormalizeType (& localType, waType));
+_       (NormalizeLocalType (& localType, waType));
         numLocals += varCount;                                                          m3log (compile, "pushing locals. count: %d; type: %s", varCount, c_waTypes [localType]);
         while (varCount--)
 _           (PushAllocatedSlot (o, localType));
@@ -49,6 +49,21 @@
 //# define d_m3FixedHeap                        (32*1024)
 # endif
 
+# ifndef d_m3EnableFuel
+#   define d_m3EnableFuel                       0       // meter loop back-edges and calls (m3_SetFuel)
+# endif
+
+// d_m3YieldFlag / d_m3YieldHook (no default): an embedder `volatile u32` polled at loop back-edges and calls,
+// and the `void (void)` function called while it is set; see m3YieldPoint
+
+# ifndef d_m3HasSimd
+#   define d_m3HasSimd                          0       // fixed-width SIMD (v128) subset; see Compile_SimdOpcode
+# endif
+
+# ifndef d_m3ZenedgeArena
+#   define d_m3ZenedgeArena                     0
+# endif
+
 # ifndef d_m3FixedHeapAlign
 #   define d_m3FixedHeapAlign                   16
 # endif
@@ -122,6 +122,26 @@ void *  m3_Realloc_Impl  (void * i_ptr, size_t i_newSize, size_t i_oldSize)
     return newPtr;
 }
 
+#elif d_m3ZenedgeArena
+
+// ZENEDGE: per-runtime arenas (kernel/wasm/wasm_arena.c), kernel heap when none is entered
+#include "../../wasm/wasm_arena.h"
+
+void *  m3_Malloc_Impl  (size_t i_size)
+{
+    return wasm_arena_m3_malloc (i_size);
+}
+
+void  m3_Free_Impl  (void * io_ptr)
+{
+    wasm_arena_m3_free (io_ptr);
+}
+
+void *  m3_Realloc_Impl  (void * i_ptr, size_t i_newSize, size_t i_oldSize)
+{
+    return wasm_arena_m3_realloc (i_ptr, i_newSize, i_oldSize);
+}
+
 #else
 
 void *  m3_Malloc_Impl  (size_t i_size)
@@ -212,6 +232,22 @@ M3Result NormalizeType (u8 * o_type, i8 i_convolutedWasmType)
 }
 
 
+// v128 is only accepted for function locals: signatures, globals and block types keep
+// going through NormalizeType, so a vector never has to cross a call or live in a register
+M3Result NormalizeLocalType (u8 * o_type, i8 i_convolutedWasmType)
+{
+#if d_m3HasSimd
+    if ((u8) -i_convolutedWasmType == c_m3Type_v128)
+    {
+        * o_type = c_m3Type_v128;
+        return m3Err_none;
+    }
+#endif
+
+    return NormalizeType (o_type, i_convolutedWasmType);
+}
+
+
 bool  IsFpType  (u8 i_m3Type)
 {
     return (i_m3Type == c_m3Type_f32 or i_m3Type == c_m3Type_f64);
@@ -230,6 +266,8 @@ bool  Is64BitType  (u8 i_m3Type)
         return true;
     else if (i_m3Type == c_m3Type_i32 or i_m3Type == c_m3Type_f32 or i_m3Type == c_m3Type_none)
         return false;
+    else if (i_m3Type == c_m3Type_v128)
+        return false;
     else
         return (sizeof (voidptr_t) == 8); // all other cases are pointers
 }
@@ -238,6 +276,8 @@ u32  SizeOfType  (u8 i_m3Type)
 {
     if (i_m3Type == c_m3Type_i32 or i_m3Type == c_m3Type_f32)
         return sizeof (i32);
+    else if (i_m3Type == c_m3Type_v128)
+        return 16;
 
     return sizeof (i64);
 }
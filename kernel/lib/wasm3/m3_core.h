@@ -178,8 +178,8 @@ M3CodePageHeader;
 #define d_externalKind_memory               2
 #define d_externalKind_global               3
 
-static const char * const c_waTypes []          = { "nil", "i32", "i64", "f32", "f64", "unknown" };
-static const char * const c_waCompactTypes []   = { "_", "i", "I", "f", "F", "?" };
+static const char * const c_waTypes []          = { "nil", "i32", "i64", "f32", "f64", "v128", "unknown" };
+static const char * const c_waCompactTypes []   = { "_", "i", "I", "f", "F", "V", "?" };
 
 
 # if d_m3VerboseErrorMessages
@@ -271,6 +271,7 @@ static inline void * m3_Realloc (ccstr_t name, void * i_ptr, size_t i_newSize, s
 #endif
 
 M3Result    NormalizeType           (u8 * o_type, i8 i_convolutedWasmType);
+M3Result    NormalizeLocalType      (u8 * o_type, i8 i_convolutedWasmType);
 
 bool        IsIntType               (u8 i_wasmType);
 bool        IsFpType                (u8 i_wasmType);
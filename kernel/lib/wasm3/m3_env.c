@@ -180,6 +180,9 @@ IM3Runtime  m3_NewRuntime  (IM3Environment i_environment, u32 i_stackSizeInBytes
 
         runtime->environment = i_environment;
         runtime->userdata = i_userdata;
+#if d_m3EnableFuel
+        runtime->fuel = UINT64_MAX;
+#endif
 
         runtime->originStack = m3_Malloc ("Wasm Stack", i_stackSizeInBytes + 4*sizeof (m3slot_t)); // TODO: more precise stack checks
 
@@ -194,6 +197,25 @@ IM3Runtime  m3_NewRuntime  (IM3Environment i_environment, u32 i_stackSizeInBytes
     return runtime;
 }
 
+void  m3_SetFuel  (IM3Runtime i_runtime, uint64_t i_fuel)
+{
+#if d_m3EnableFuel
+    i_runtime->fuel = i_fuel;
+#else
+    (void) i_runtime; (void) i_fuel;
+#endif
+}
+
+uint64_t  m3_GetFuel  (IM3Runtime i_runtime)
+{
+#if d_m3EnableFuel
+    return i_runtime->fuel;
+#else
+    (void) i_runtime;
+    return UINT64_MAX;
+#endif
+}
+
 void *  m3_GetUserData  (IM3Runtime i_runtime)
 {
     return i_runtime ? i_runtime->userdata : NULL;
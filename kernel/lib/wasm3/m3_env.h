@@ -183,6 +183,10 @@ typedef struct M3Runtime
     M3Memory                memory;
     u32                     memoryLimit;
 
+#if d_m3EnableFuel
+    u64                     fuel;           // units left; see m3_SetFuel
+#endif
+
 #if d_m3EnableStrace >= 2
     u32                     callDepth;
 #endif
@@ -539,8 +539,39 @@ d_m3Op  (SetGlobal_i64)
 }
 
 
+// fuel: one unit per call and taken loop back-edge
+#if d_m3EnableFuel
+#   define m3FuelUse()                                                              \
+    {                                                                               \
+        IM3Runtime fuelRuntime = m3MemRuntime (_mem);                               \
+        if (M3_UNLIKELY (fuelRuntime->fuel == 0))                                   \
+            newTrap (m3Err_trapFuelExhausted);                                      \
+        fuelRuntime->fuel--;                                                        \
+    }
+#else
+#   define m3FuelUse()
+#endif
+
+// preemption: the embedder names a flag (set from its timer) and a hook; both are polled at the same points
+// as fuel, where no host call is in progress, so the hook may switch to another thread
+#ifdef d_m3YieldFlag
+    extern volatile u32  d_m3YieldFlag;
+    void  d_m3YieldHook  (void);
+#   define m3YieldPoint()                                                           \
+    {                                                                               \
+        if (M3_UNLIKELY (d_m3YieldFlag))                                            \
+            d_m3YieldHook ();                                                       \
+    }
+#else
+#   define m3YieldPoint()
+#endif
+
+
 d_m3Op  (Call)
 {
+    m3FuelUse ();
+    m3YieldPoint ();
+
     pc_t callPC                 = immediate (pc_t);
     i32 stackOffset             = immediate (i32);
     IM3Memory memory            = m3MemInfo (_mem);
@@ -567,6 +598,9 @@ d_m3Op  (Call)
 
 d_m3Op  (CallIndirect)
 {
+    m3FuelUse ();
+    m3YieldPoint ();
+
     u32 tableIndex              = slot (u32);
     IM3Module module            = immediate (IM3Module);
     IM3FuncType type            = immediate (IM3FuncType);
@@ -1219,6 +1253,8 @@ d_m3Op  (ContinueLoop)
     // TODO: this is where execution can "escape" the M3 code and callback to the client / fiber switch
     // OR it can go in the Loop operation. I think it's best to do here. adding code to the loop operation
     // has the potential to increase its native-stack usage. (don't forget ContinueLoopIf too.)
+    m3FuelUse ();
+    m3YieldPoint ();
 
     void * loopId = immediate (void *);
     return loopId;
@@ -1232,6 +1268,8 @@ d_m3Op  (ContinueLoopIf)
 
     if (condition)
     {
+        m3FuelUse ();
+        m3YieldPoint ();
         return loopId;
     }
     else nextOp ();
@@ -1492,6 +1530,294 @@ d_m3Store_i (i64, i16)
 d_m3Store_i (i64, i32)
 d_m3Store_i (i64, i64)
 
+#if d_m3HasSimd
+//---------------------------------------------------------------------------------------------------------------------
+// fixed-width SIMD. vectors live in 16 bytes of slots, which are only m3slot_t aligned, so they go through memcpy;
+// the compiler vector extensions lower to SSE where the target has it (x86_64 baseline) and to lane loops elsewhere
+//---------------------------------------------------------------------------------------------------------------------
+
+typedef u32 m3v128      __attribute__ ((vector_size (16)));
+typedef i32 m3i32x4     __attribute__ ((vector_size (16)));
+typedef i16 m3i16x8     __attribute__ ((vector_size (16)));
+# if d_m3HasFloat
+typedef f32 m3f32x4     __attribute__ ((vector_size (16)));
+# endif
+
+// macros rather than helpers: passing vectors by value trips the i386 psABI without SSE
+#define v128_in(V)      memcpy (& (V), slot_ptr (u8), sizeof (m3v128))
+#define v128_out(V)     memcpy (slot_ptr (u8), & (V), sizeof (m3v128))
+
+
+d_m3Op  (CopySlot_128)
+{
+    u8 * dst = slot_ptr (u8);
+    u8 * src = slot_ptr (u8);
+
+    memcpy (dst, src, sizeof (m3v128));
+
+    nextOp ();
+}
+
+
+d_m3Op  (PreserveCopySlot_128)
+{
+    u8 * dest      = slot_ptr (u8);
+    u8 * src       = slot_ptr (u8);
+    u8 * preserve  = slot_ptr (u8);
+
+    memcpy (preserve, dest, sizeof (m3v128));
+    memcpy (dest, src, sizeof (m3v128));
+
+    nextOp ();
+}
+
+
+d_m3Op  (v128_Const)
+{
+    m3v128 value;
+    memcpy (& value, _pc, sizeof (value));
+    _pc += sizeof (value) / sizeof (u64) * ((M3_SIZEOF_PTR == 4) ? 2 : 1);
+    v128_out (value);
+    nextOp ();
+}
+
+
+d_m3Op  (v128_Load_r)
+{
+    u32 offset = immediate (u32);
+    u64 operand = (u32) _r0;
+    operand += offset;
+
+    if (m3MemCheck (operand + sizeof (m3v128) <= _mem->length))
+    {
+        memcpy (slot_ptr (u8), m3MemData (_mem) + operand, sizeof (m3v128));
+        nextOp ();
+    } else d_outOfBounds;
+}
+
+d_m3Op  (v128_Load_s)
+{
+    u64 operand = slot (u32);
+    u32 offset = immediate (u32);
+    operand += offset;
+
+    if (m3MemCheck (operand + sizeof (m3v128) <= _mem->length))
+    {
+        memcpy (slot_ptr (u8), m3MemData (_mem) + operand, sizeof (m3v128));
+        nextOp ();
+    } else d_outOfBounds;
+}
+
+d_m3Op  (v128_Store_sr)
+{
+    u8 * value = slot_ptr (u8);
+    u64 operand = (u32) _r0;
+    u32 offset = immediate (u32);
+    operand += offset;
+
+    if (m3MemCheck (operand + sizeof (m3v128) <= _mem->length))
+    {
+        memcpy (m3MemData (_mem) + operand, value, sizeof (m3v128));
+        nextOp ();
+    } else d_outOfBounds;
+}
+
+d_m3Op  (v128_Store_ss)
+{
+    u8 * value = slot_ptr (u8);
+    u64 operand = slot (u32);
+    u32 offset = immediate (u32);
+    operand += offset;
+
+    if (m3MemCheck (operand + sizeof (m3v128) <= _mem->length))
+    {
+        memcpy (m3MemData (_mem) + operand, value, sizeof (m3v128));
+        nextOp ();
+    } else d_outOfBounds;
+}
+
+
+// select: [selector], val2, val1 -> dest
+d_m3Op  (v128_Select_rss)
+{
+    i32 condition = (i32) _r0;
+
+    u8 * operand2 = slot_ptr (u8);
+    u8 * operand1 = slot_ptr (u8);
+
+    memcpy (slot_ptr (u8), condition ? operand1 : operand2, sizeof (m3v128));
+
+    nextOp ();
+}
+
+d_m3Op  (v128_Select_sss)
+{
+    i32 condition = slot (i32);
+
+    u8 * operand2 = slot_ptr (u8);
+    u8 * operand1 = slot_ptr (u8);
+
+    memcpy (slot_ptr (u8), condition ? operand1 : operand2, sizeof (m3v128));
+
+    nextOp ();
+}
+
+
+#define d_m3SimdLaneOps(TYPE, REG)                      \
+d_m3Op  (TYPE##x4_Splat_r)                              \
+{                                                       \
+    TYPE value = (TYPE) REG;                            \
+    m3##TYPE##x4 result = { value, value, value, value }; \
+    v128_out (result);                                  \
+    nextOp ();                                          \
+}                                                       \
+                                                        \
+d_m3Op  (TYPE##x4_Splat_s)                              \
+{                                                       \
+    TYPE value = slot (TYPE);                           \
+    m3##TYPE##x4 result = { value, value, value, value }; \
+    v128_out (result);                                  \
+    nextOp ();                                          \
+}                                                       \
+                                                        \
+d_m3Op  (TYPE##x4_ExtractLane)                          \
+{                                                       \
+    u32 lane = immediate (u32);                         \
+    m3##TYPE##x4 vector;  v128_in (vector);             \
+    REG = vector [lane];                                \
+    nextOp ();                                          \
+}                                                       \
+                                                        \
+d_m3Op  (TYPE##x4_ReplaceLane_r)                        \
+{                                                       \
+    u32 lane = immediate (u32);                         \
+    TYPE value = (TYPE) REG;                            \
+    m3##TYPE##x4 vector;  v128_in (vector);             \
+    vector [lane] = value;                              \
+    v128_out (vector);                                  \
+    nextOp ();                                          \
+}                                                       \
+                                                        \
+d_m3Op  (TYPE##x4_ReplaceLane_s)                        \
+{                                                       \
+    u32 lane = immediate (u32);                         \
+    TYPE value = slot (TYPE);                           \
+    m3##TYPE##x4 vector;  v128_in (vector);             \
+    vector [lane] = value;                              \
+    v128_out (vector);                                  \
+    nextOp ();                                          \
+}
+
+d_m3SimdLaneOps (i32, _r0)
+#if d_m3HasFloat
+d_m3SimdLaneOps (f32, _fp0)
+#endif
+
+
+// binary ops emit the top operand first: b, a -> dest
+#define d_m3SimdBinOp(NAME, VTYPE, EXPR)                \
+d_m3Op  (NAME)                                          \
+{                                                       \
+    VTYPE b;  v128_in (b);                              \
+    VTYPE a;  v128_in (a);                              \
+    VTYPE result = EXPR;                                \
+    v128_out (result);                                  \
+    nextOp ();                                          \
+}
+
+#define d_m3SimdUnaryOp(NAME, VTYPE, EXPR)              \
+d_m3Op  (NAME)                                          \
+{                                                       \
+    VTYPE a;  v128_in (a);                              \
+    VTYPE result = EXPR;                                \
+    v128_out (result);                                  \
+    nextOp ();                                          \
+}
+
+// per-lane form for what vector extensions can't express (libm calls, wasm NaN rules)
+#define d_m3SimdLaneBinOp(NAME, TYPE, FUNC)             \
+d_m3Op  (NAME)                                          \
+{                                                       \
+    m3##TYPE##x4 b;  v128_in (b);                       \
+    m3##TYPE##x4 a;  v128_in (a);                       \
+    for (u32 i = 0; i < 4; ++i)                         \
+        a [i] = FUNC (a [i], b [i]);                    \
+    v128_out (a);                                       \
+    nextOp ();                                          \
+}
+
+d_m3SimdUnaryOp (v128_Not,          m3v128,     ~a)
+d_m3SimdBinOp   (v128_And,          m3v128,     a & b)
+d_m3SimdBinOp   (v128_AndNot,       m3v128,     a & ~b)
+d_m3SimdBinOp   (v128_Or,           m3v128,     a | b)
+d_m3SimdBinOp   (v128_Xor,          m3v128,     a ^ b)
+
+// unsigned lanes, so overflow wraps as wasm requires
+d_m3SimdBinOp   (i32x4_Add,         m3v128,     a + b)
+d_m3SimdBinOp   (i32x4_Subtract,    m3v128,     a - b)
+d_m3SimdBinOp   (i32x4_Multiply,    m3v128,     a * b)
+
+d_m3Op  (i32x4_DotI16x8)
+{
+    m3i16x8 b;  v128_in (b);
+    m3i16x8 a;  v128_in (a);
+
+    m3v128 result;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        // only -32768 * -32768 * 2 leaves i32; the unsigned sum wraps it like the spec
+        result [i] = (u32) ((i32) a [2 * i] * b [2 * i]) + (u32) ((i32) a [2 * i + 1] * b [2 * i + 1]);
+    }
+    v128_out (result);
+
+    nextOp ();
+}
+
+#if d_m3HasFloat
+d_m3SimdUnaryOp (f32x4_Abs,         m3v128,     a & 0x7fffffffu)
+d_m3SimdUnaryOp (f32x4_Negate,      m3v128,     a ^ 0x80000000u)
+d_m3SimdBinOp   (f32x4_Add,         m3f32x4,    a + b)
+d_m3SimdBinOp   (f32x4_Subtract,    m3f32x4,    a - b)
+d_m3SimdBinOp   (f32x4_Multiply,    m3f32x4,    a * b)
+d_m3SimdBinOp   (f32x4_Divide,      m3f32x4,    a / b)
+d_m3SimdLaneBinOp (f32x4_Min,       f32,        min_f32)
+d_m3SimdLaneBinOp (f32x4_Max,       f32,        max_f32)
+
+d_m3Op  (f32x4_Sqrt)
+{
+    m3f32x4 a;  v128_in (a);
+    for (u32 i = 0; i < 4; ++i)
+        a [i] = sqrtf (a [i]);
+    v128_out (a);
+
+    nextOp ();
+}
+
+d_m3Op  (i32x4_TruncSat_f32x4)
+{
+    m3f32x4 a;  v128_in (a);
+    m3i32x4 result;
+    for (u32 i = 0; i < 4; ++i)
+        OP_I32_TRUNC_SAT_F32 (result [i], a [i]);
+    v128_out (result);
+
+    nextOp ();
+}
+
+d_m3Op  (f32x4_Convert_i32x4)
+{
+    m3i32x4 a;  v128_in (a);
+    m3f32x4 result;
+    for (u32 i = 0; i < 4; ++i)
+        result [i] = (f32) a [i];
+    v128_out (result);
+
+    nextOp ();
+}
+#endif // d_m3HasFloat
+
+#endif // d_m3HasSimd
+
 #undef m3MemCheck
 
 
@@ -556,9 +556,39 @@ void  m3_PrintProfilerInfo  ()
     while (maxSlot->hitCount);
 }
 
+u32  m3_ReadProfilerCounts  (cstr_t * o_names, u64 * o_counts, u32 i_max, int i_reset)
+{
+    u32 n = 0;
+
+    for (u32 i = 0; i <= d_m3ProfilerSlotMask; ++i)
+    {
+        M3ProfilerSlot * slot = & s_opProfilerCounts [i];
+
+        if (slot->opName and slot->hitCount)
+        {
+            if (n < i_max)
+            {
+                o_names [n] = slot->opName;
+                o_counts [n] = slot->hitCount;
+                ++n;
+            }
+            if (i_reset)
+                slot->hitCount = 0;
+        }
+    }
+
+    return n;
+}
+
 # else
 
 void  m3_PrintProfilerInfo  () {}
 
+u32  m3_ReadProfilerCounts  (cstr_t * o_names, u64 * o_counts, u32 i_max, int i_reset)
+{
+    (void) o_names; (void) o_counts; (void) i_max; (void) i_reset;
+    return 0;
+}
+
 # endif
 
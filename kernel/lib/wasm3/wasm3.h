@@ -74,6 +74,7 @@ typedef enum M3ValueType
     c_m3Type_i64    = 2,
     c_m3Type_f32    = 3,
     c_m3Type_f64    = 4,
+    c_m3Type_v128   = 5,    // locals and operand stack only (d_m3HasSimd)
 
     c_m3Type_unknown
 } M3ValueType;
@@ -184,6 +185,7 @@ d_m3ErrorConst  (trapExit,                      "[trap] program called exit")
 d_m3ErrorConst  (trapAbort,                     "[trap] program called abort")
 d_m3ErrorConst  (trapUnreachable,               "[trap] unreachable executed")
 d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
+d_m3ErrorConst  (trapFuelExhausted,             "[trap] fuel exhausted")
 
 
 //-------------------------------------------------------------------------------------------------------------------------------
@@ -220,6 +222,12 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     // This is used internally by Raw Function helpers
     uint32_t            m3_GetMemorySize            (IM3Runtime             i_runtime);
 
+    // fuel metering (d_m3EnableFuel): one unit per taken loop back-edge and per call; a call traps
+    // with m3Err_trapFuelExhausted when none is left. New runtimes start with UINT64_MAX (unmetered)
+    void                m3_SetFuel                  (IM3Runtime             i_runtime,
+                                                     uint64_t               i_fuel);
+    uint64_t            m3_GetFuel                  (IM3Runtime             i_runtime);
+
     void *              m3_GetUserData              (IM3Runtime             i_runtime);
 
 
@@ -324,6 +332,8 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     void                m3_PrintRuntimeInfo         (IM3Runtime i_runtime);
     void                m3_PrintM3Info              (void);
     void                m3_PrintProfilerInfo        (void);
+    // Copies up to i_max nonzero opcode counts (d_m3EnableOpProfiling builds; 0 otherwise)
+    uint32_t            m3_ReadProfilerCounts       (const char ** o_names, uint64_t * o_counts, uint32_t i_max, int i_reset);
 
     // The runtime owns the backtrace, do not free the backtrace you obtain. Returns NULL if there's no backtrace.
     IM3BacktraceInfo    m3_GetBacktrace             (IM3Runtime i_runtime);
@@ -1,4 +1,17 @@
-/* kernel/mm/kheap.c */
+/* kernel/mm/kheap.c
+ *
+ * Kernel heap: a TLSF (two-level segregated fit) allocator.
+ *
+ * Free blocks are kept in size classes: the first level is the power of
+ * two of the size, the second splits each power of two into
+ * KHEAP_SL_COUNT linear steps (blocks below KHEAP_SMALL_SIZE share
+ * first level 0 in 16-byte steps). A bitmap per level says which
+ * classes have blocks, so kmalloc() finds a class guaranteed to fit with
+ * two bit scans and takes its first block; kfree() merges with the
+ * physical neighbours through the prev_phys link and the block after
+ * it. Both are O(1), and rounding the request up to the next class
+ * bounds the waste to 1/KHEAP_SL_COUNT of a block.
+ */
 #include <stdint.h>
 #include <stddef.h>
 
@@ -10,6 +23,19 @@
 #define ALIGN_UP(x, a)   (((x) + ((a)-1)) & ~((a)-1))
 #define ALIGN_DOWN(x, a) ((x) & ~((a)-1))
 
+#define ALIGN_LOG2      4                   /* 16-byte payloads */
+#define SL_LOG2         4
+#define SL_COUNT        (1u << SL_LOG2)
+#define FL_SHIFT        (SL_LOG2 + ALIGN_LOG2)
+#define SMALL_SIZE      (1u << FL_SHIFT)    /* 256 */
+#define FL_MAX          30                  /* Blocks below 1GB */
+#define FL_COUNT        (FL_MAX - FL_SHIFT + 1)
+#define BLOCK_MIN       16
+#define BLOCK_MAX       ((size_t)1 << FL_MAX)
+
+#define FLAG_FREE       1u
+#define FLAG_PREV_FREE  2u
+
 /*
  * Ensure 16-byte payload alignment on both i386 and x86_64.
  * The header size itself must be a multiple of 16 so that:
@@ -17,127 +43,254 @@
  */
 typedef struct block_header {
     uint32_t magic;
-    uint32_t is_free;
+    uint32_t flags;             // FLAG_*
     size_t   size;              // payload size (bytes)
-    struct block_header* next;
-    struct block_header* prev;
-#if defined(__x86_64__)
-    uint64_t _pad0;   // x64: 4+4+8+8+8 = 32. +8 = 40. Aligned to 16 -> 48 bytes.
-#else
-    uint32_t _pad0;
-    uint32_t _pad1;   // i386: 4+4+4+4+4 = 20. +4+4 = 28. Aligned to 16 -> 32 bytes.
+    struct block_header* prev_phys;  // block just before this one in memory
+#if !defined(__x86_64__)
+    uint32_t _pad0;   // i386: 4+4+4+4 = 16 bytes. x64: 4+4+8+8 = 24 -> 32.
 #endif
 } __attribute__((aligned(16))) block_header_t;
 
+/* A free block's payload holds its size class list links */
+typedef struct {
+    block_header_t* next_free;
+    block_header_t* prev_free;
+} free_links_t;
+
 static block_header_t* heap_start = NULL;
 static uintptr_t heap_base = 0;
 static uintptr_t heap_end  = 0;
 
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_COUNT];
+static block_header_t* free_lists[FL_COUNT][SL_COUNT];
+
+static size_t   heap_free_bytes = 0;
+static uint32_t heap_free_blocks = 0;
+static uint32_t heap_allocs = 0;
+static uint32_t heap_frees = 0;
+static uint32_t heap_failures = 0;
+
 static int ptr_in_heap(void* p) {
     uintptr_t u = (uintptr_t)p;
     return (u >= heap_base) && (u < heap_end);
 }
 
-void kheap_init(void* start_addr, size_t size) {
-    if (!start_addr) return;
+static inline free_links_t* links(block_header_t* b) {
+    return (free_links_t*)((uintptr_t)b + sizeof(block_header_t));
+}
 
-    // Align heap start to 16
-    uintptr_t base = ALIGN_UP((uintptr_t)start_addr, 16);
-    uintptr_t end  = (uintptr_t)start_addr + (uintptr_t)size;
-    end = ALIGN_DOWN(end, 16);
+static inline void* payload(block_header_t* b) {
+    return (void*)((uintptr_t)b + sizeof(block_header_t));
+}
 
-    if (end <= base + sizeof(block_header_t) + 16) return;
+static inline block_header_t* next_phys(block_header_t* b) {
+    return (block_header_t*)((uintptr_t)b + sizeof(block_header_t) + b->size);
+}
 
-    heap_base = base;
-    heap_end  = end;
+static inline int fls32(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
 
-    heap_start = (block_header_t*)base;
-    heap_start->magic = HEAP_MAGIC;
-    heap_start->size  = (size_t)(end - base - sizeof(block_header_t));
-    heap_start->next  = NULL;
-    heap_start->prev  = NULL;
-    heap_start->is_free = 1;
+/* Size class of a block of this size */
+static void mapping_insert(size_t size, int* fl, int* sl) {
+    if (size < SMALL_SIZE) {
+        *fl = 0;
+        *sl = (int)(size >> ALIGN_LOG2);
+    } else {
+        int f = fls32((uint32_t)size);
+        *sl = (int)((size >> (f - SL_LOG2)) ^ SL_COUNT);
+        *fl = f - (FL_SHIFT - 1);
+    }
+}
 
-    console_write("[kheap] initialized (aligned, 64-bit safe)\n");
+/* Smallest block size in class (fl, sl) */
+static size_t class_floor(int fl, int sl) {
+    if (fl == 0) return (size_t)sl << ALIGN_LOG2;
+    return (size_t)(SL_COUNT + (uint32_t)sl) << (fl + FL_SHIFT - 1 - SL_LOG2);
 }
 
-static void split_block(block_header_t* b, size_t want) {
-    size_t remaining = b->size - want;
-    if (remaining <= (size_t)(sizeof(block_header_t) + 16)) return;
+/* Size class whose every block holds size: round up to the next class */
+static void mapping_search(size_t size, int* fl, int* sl) {
+    if (size >= SMALL_SIZE) {
+        size += ((size_t)1 << (fls32((uint32_t)size) - SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
 
-    // Because 'b' is 16-aligned and sizeof(block_header_t) is 16-aligned,
-    // nb_addr is naturally 16-aligned. No explicit ALIGN_UP needed.
-    uintptr_t nb_addr = (uintptr_t)b + sizeof(block_header_t) + want;
-    
-    block_header_t* nb = (block_header_t*)nb_addr;
-    nb->magic = HEAP_MAGIC;
-    nb->is_free = 1;
+static void list_insert(block_header_t* b) {
+    int fl, sl;
+    mapping_insert(b->size, &fl, &sl);
 
-    uintptr_t b_payload_end = (uintptr_t)b + sizeof(block_header_t) + b->size;
-    size_t new_size = (size_t)(b_payload_end - (uintptr_t)nb - sizeof(block_header_t));
+    free_links_t* l = links(b);
+    l->prev_free = NULL;
+    l->next_free = free_lists[fl][sl];
+    if (l->next_free) links(l->next_free)->prev_free = b;
+    free_lists[fl][sl] = b;
 
-    nb->size = new_size;
-    nb->next = b->next;
-    nb->prev = b;
+    fl_bitmap |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+    heap_free_bytes += b->size;
+    heap_free_blocks++;
+}
 
-    if (b->next) b->next->prev = nb;
+static void list_remove(block_header_t* b) {
+    int fl, sl;
+    mapping_insert(b->size, &fl, &sl);
 
-    b->next = nb;
-    b->size = want;
+    free_links_t* l = links(b);
+    if (l->prev_free) links(l->prev_free)->next_free = l->next_free;
+    else free_lists[fl][sl] = l->next_free;
+    if (l->next_free) links(l->next_free)->prev_free = l->prev_free;
+
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl]) fl_bitmap &= ~(1u << fl);
+    }
+    heap_free_bytes -= b->size;
+    heap_free_blocks--;
 }
 
-void* kmalloc(size_t size) {
-    if (!heap_start || size == 0) return NULL;
+/* First block of the smallest non-empty class at or above (fl, sl) */
+static block_header_t* find_suitable(int fl, int sl) {
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1 < 32) ? (fl_bitmap & (~0u << (fl + 1))) : 0;
+        if (!fl_map) return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return free_lists[fl][sl];
+}
 
-    size_t want = ALIGN_UP(size, 16);
+static void set_free(block_header_t* b, int is_free) {
+    block_header_t* n = next_phys(b);
+    if (is_free) {
+        b->flags |= FLAG_FREE;
+        n->flags |= FLAG_PREV_FREE;
+    } else {
+        b->flags &= ~FLAG_FREE;
+        n->flags &= ~FLAG_PREV_FREE;
+    }
+}
 
-    block_header_t* cur = heap_start;
-    while (cur) {
-        if (cur->magic != HEAP_MAGIC) {
-            console_write("[kheap] CORRUPTION (bad magic)\n");
-            return NULL;
-        }
+/* Cut b down to want bytes; the rest becomes a free block */
+static void split_block(block_header_t* b, size_t want) {
+    size_t remaining = b->size - want;
+    if (remaining < (size_t)(sizeof(block_header_t) + BLOCK_MIN)) return;
 
-        if (cur->is_free && cur->size >= want) {
-            split_block(cur, want);
-            cur->is_free = 0;
-            return (void*)((uintptr_t)cur + sizeof(block_header_t));
+    // Because 'b' is 16-aligned and sizeof(block_header_t) is 16-aligned,
+    // nb_addr is naturally 16-aligned. No explicit ALIGN_UP needed.
+    block_header_t* nb = (block_header_t*)((uintptr_t)b + sizeof(block_header_t) + want);
+    nb->magic = HEAP_MAGIC;
+    nb->flags = 0;
+    nb->size = remaining - sizeof(block_header_t);
+    nb->prev_phys = b;
+    next_phys(nb)->prev_phys = nb;
+    b->size = want;
+
+    set_free(nb, 1);
+    list_insert(nb);
+}
+
+/* Merge free block b with its free neighbours (b is in no list) */
+static block_header_t* merge_block(block_header_t* b) {
+    if ((b->flags & FLAG_PREV_FREE) && b->prev_phys) {
+        block_header_t* p = b->prev_phys;
+        if (!ptr_in_heap(p) || p->magic != HEAP_MAGIC || next_phys(p) != b) {
+            console_write("[kheap] CORRUPTION (bad coalesce)\n");
+            return b;
         }
-        cur = cur->next;
+        list_remove(p);
+        p->size += sizeof(block_header_t) + b->size;
+        next_phys(p)->prev_phys = p;
+        b = p;
     }
 
-    console_write("[kheap] OOM\n");
-    return NULL;
+    block_header_t* n = next_phys(b);
+    if ((n->flags & FLAG_FREE) && n->magic == HEAP_MAGIC) {
+        list_remove(n);
+        b->size += sizeof(block_header_t) + n->size;
+        next_phys(b)->prev_phys = b;
+    }
+    return b;
 }
 
-static void coalesce(block_header_t* b) {
-    if (!b) return;
-    if (!ptr_in_heap(b) || b->magic != HEAP_MAGIC) return;
+void kheap_init(void* start_addr, size_t size) {
+    if (!start_addr) return;
 
-    /* If this is a free block, first walk backward to the start of the free run. */
-    if (b->is_free) {
-        while (b->prev && b->prev->is_free && b->prev->magic == HEAP_MAGIC) {
-            b = b->prev;
-        }
+    // Align heap start to 16
+    uintptr_t base = ALIGN_UP((uintptr_t)start_addr, 16);
+    uintptr_t end  = (uintptr_t)start_addr + (uintptr_t)size;
+    end = ALIGN_DOWN(end, 16);
+
+    if (end <= base + 2 * sizeof(block_header_t) + BLOCK_MIN) return;
+
+    /* Keep every block below BLOCK_MAX */
+    if (end - base > BLOCK_MAX) end = base + BLOCK_MAX;
+
+    heap_base = base;
+    heap_end  = end;
+
+    fl_bitmap = 0;
+    for (int i = 0; i < FL_COUNT; i++) {
+        sl_bitmap[i] = 0;
+        for (int j = 0; j < (int)SL_COUNT; j++) free_lists[i][j] = NULL;
     }
+    heap_free_bytes = 0;
+    heap_free_blocks = 0;
 
-    /* Merge forward repeatedly */
-    while (b->next && b->next->is_free && b->next->magic == HEAP_MAGIC) {
-        block_header_t* n = b->next;
+    /* One free block, then a used zero-size sentinel so every block has a
+     * next one
+     */
+    block_header_t* sentinel = (block_header_t*)(end - sizeof(block_header_t));
+    heap_start = (block_header_t*)base;
+    heap_start->magic = HEAP_MAGIC;
+    heap_start->flags = 0;
+    heap_start->size  = (size_t)((uintptr_t)sentinel - base - sizeof(block_header_t));
+    heap_start->prev_phys = NULL;
 
-        uintptr_t payload_start = (uintptr_t)b + sizeof(block_header_t);
-        uintptr_t next_end = (uintptr_t)n + sizeof(block_header_t) + (uintptr_t)n->size;
+    sentinel->magic = HEAP_MAGIC;
+    sentinel->flags = 0;
+    sentinel->size = 0;
+    sentinel->prev_phys = heap_start;
 
-        if (next_end <= payload_start || next_end > heap_end) {
-            console_write("[kheap] CORRUPTION (bad coalesce)\n");
-            break;
-        }
+    set_free(heap_start, 1);
+    list_insert(heap_start);
 
-        size_t merged_payload = (size_t)(next_end - payload_start);
-        b->size = merged_payload;
-        b->next = n->next;
-        if (b->next) b->next->prev = b;
+    console_write("[kheap] initialized (TLSF, 16-byte aligned)\n");
+}
+
+void* kmalloc(size_t size) {
+    if (!heap_start || size == 0) return NULL;
+    if (size > BLOCK_MAX / 2) {
+        heap_failures++;
+        console_write("[kheap] OOM\n");
+        return NULL;
     }
+
+    size_t want = ALIGN_UP(size, 16);
+    if (want < BLOCK_MIN) want = BLOCK_MIN;
+
+    int fl, sl;
+    mapping_search(want, &fl, &sl);
+    block_header_t* b = (fl < FL_COUNT) ? find_suitable(fl, sl) : NULL;
+    if (!b) {
+        heap_failures++;
+        console_write("[kheap] OOM\n");
+        return NULL;
+    }
+    if (b->magic != HEAP_MAGIC) {
+        console_write("[kheap] CORRUPTION (bad magic)\n");
+        return NULL;
+    }
+
+    list_remove(b);
+    split_block(b, want);
+    set_free(b, 0);
+    heap_allocs++;
+    return payload(b);
 }
 
 void kfree(void* ptr) {
@@ -150,13 +303,15 @@ void kfree(void* ptr) {
         return;
     }
 
-    if (h->is_free) {
+    if (h->flags & FLAG_FREE) {
         console_write("[kheap] double free\n");
         return;
     }
 
-    h->is_free = 1;
-    coalesce(h);
+    heap_frees++;
+    h = merge_block(h);
+    set_free(h, 1);
+    list_insert(h);
 }
 
 void* krealloc(void* ptr, size_t new_size) {
@@ -165,36 +320,82 @@ void* krealloc(void* ptr, size_t new_size) {
 
     block_header_t* h = (block_header_t*)((uintptr_t)ptr - sizeof(block_header_t));
     if (h->magic != HEAP_MAGIC) return NULL;
+    if (new_size > BLOCK_MAX / 2) return NULL;
 
     size_t want = ALIGN_UP(new_size, 16);
     if (h->size >= want) return ptr;
 
-    if (h->next && h->next->is_free && h->next->magic == HEAP_MAGIC) {
-        coalesce(h);
-        if (h->size >= want) {
-            split_block(h, want);
-            h->is_free = 0;
-            return (void*)((uintptr_t)h + sizeof(block_header_t));
-        }
+    /* Grow into a free block right after it */
+    block_header_t* n = next_phys(h);
+    if ((n->flags & FLAG_FREE) && n->magic == HEAP_MAGIC &&
+        h->size + sizeof(block_header_t) + n->size >= want) {
+        list_remove(n);
+        h->size += sizeof(block_header_t) + n->size;
+        next_phys(h)->prev_phys = h;
+        next_phys(h)->flags &= ~FLAG_PREV_FREE;
+        split_block(h, want);
+        return ptr;
     }
 
     void* np = kmalloc(want);
     if (!np) return NULL;
 
-    // manual memcpy
-    uint8_t* s = (uint8_t*)ptr;
-    uint8_t* d = (uint8_t*)np;
-    for (size_t i = 0; i < h->size; i++) d[i] = s[i];
-
+    memcpy(np, ptr, h->size);
     kfree(ptr);
     return np;
 }
 
 size_t kheap_free_size(void) {
-    size_t total = 0;
-    for (block_header_t* cur = heap_start; cur; cur = cur->next) {
-        if (cur->magic != HEAP_MAGIC) break;
-        if (cur->is_free) total += cur->size;
+    return heap_free_bytes;
+}
+
+void kheap_get_stats(kheap_stats_t* out) {
+    if (!out) return;
+
+    out->total_bytes = heap_end > heap_base ? (size_t)(heap_end - heap_base) : 0;
+    out->free_bytes = heap_free_bytes;
+    out->free_blocks = heap_free_blocks;
+    out->allocs = heap_allocs;
+    out->frees = heap_frees;
+    out->failures = heap_failures;
+
+    /* Largest request kmalloc() can serve: it rounds a request up to the
+     * next class, so only one the size of the highest non-empty class's
+     * smallest block is sure to land there
+     */
+    out->largest_free = 0;
+    if (fl_bitmap) {
+        int fl = fls32(fl_bitmap);
+        int sl = fls32(sl_bitmap[fl]);
+        out->largest_free = class_floor(fl, sl);
+        if (out->largest_free > BLOCK_MAX / 2) out->largest_free = BLOCK_MAX / 2;
     }
-    return total;
+
+    /* Share of free memory no single kmalloc() can get, per mille */
+    out->frag_permille = heap_free_bytes
+        ? (uint32_t)(((uint64_t)(heap_free_bytes - out->largest_free) * 1000) / heap_free_bytes)
+        : 0;
+}
+
+void kheap_dump(void) {
+    kheap_stats_t st;
+    kheap_get_stats(&st);
+
+    console_write("[kheap] ");
+    print_uint((uint32_t)(st.free_bytes / 1024));
+    console_write(" KB free of ");
+    print_uint((uint32_t)(st.total_bytes / 1024));
+    console_write(" KB in ");
+    print_uint(st.free_blocks);
+    console_write(" blocks, largest ");
+    print_uint((uint32_t)(st.largest_free / 1024));
+    console_write(" KB, frag ");
+    print_uint(st.frag_permille);
+    console_write("/1000, allocs/frees/fails ");
+    print_uint(st.allocs);
+    console_write("/");
+    print_uint(st.frees);
+    console_write("/");
+    print_uint(st.failures);
+    console_write("\n");
 }
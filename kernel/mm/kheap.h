@@ -20,6 +20,20 @@ void kfree(void *ptr);
 /* Stats */
 size_t kheap_free_size(void);
 
+typedef struct {
+    size_t   total_bytes;
+    size_t   free_bytes;
+    size_t   largest_free;      /* Largest request kmalloc() can serve */
+    uint32_t free_blocks;
+    uint32_t frag_permille;     /* Free bytes beyond largest_free */
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+} kheap_stats_t;
+
+void kheap_get_stats(kheap_stats_t *out);
+void kheap_dump(void);
+
 #ifdef __cplusplus
 }
 #endif
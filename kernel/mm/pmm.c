@@ -2,8 +2,19 @@
  *
  * Physical Memory Manager implementation
  *
- * Uses a simple bitmap allocator where each bit represents a 4KB page.
- * Parses the multiboot memory map to identify available regions.
+ * A binary buddy allocator per NUMA node, orders 0 to PMM_MAX_ORDER
+ * (4KB to 4MB). The free blocks of each order are a bitmap, searched a
+ * word at a time with bsf from a per-node hint at or below the lowest
+ * free block; splitting and merging walk at most PMM_MAX_ORDER orders.
+ * Blocks never cross a node boundary. A page bitmap (1 = used) next to
+ * it still catches double frees and serves runs beyond the largest order.
+ * Parses the multiboot (or multiboot2) memory map to identify available
+ * regions.
+ *
+ * Both bitmaps are split into sections of PMM_SECTION_PAGES pages; a
+ * buddy block never crosses one. Only sections overlapping usable memory
+ * get bitmaps, so holes cost a NULL in the section table and searches
+ * step over them a section at a time.
  *
  * NUMA Simulation:
  * We split the physical memory in half to simulate 2 NUMA nodes:
@@ -11,14 +22,41 @@
  * - Node 1: Upper half (background work, "remote")
  */
 #include "pmm.h"
+#include "vmm.h"
+#include "../arch/idt.h"
+#include "../arch/percpu.h"
 #include "../console.h"
 #include "../trace/flightrec.h"
 
-/* Bitmap for tracking page allocation
- * For 256MB max memory with 4KB pages = 65536 pages = 8KB bitmap
+/* Per section: the page bitmap (1 = used), and the buddy free maps, one
+ * bit per 2^order-aligned block that is free and not part of a larger
+ * free block. Order k has SECTION_WORDS >> k words, all orders together
+ * twice the page bitmap
  */
-#define BITMAP_SIZE (PMM_MAX_PAGES / 8)
-static uint8_t page_bitmap[BITMAP_SIZE];
+#define SECTION_WORDS (PMM_SECTION_PAGES / 32)
+#define BUDDY_WORDS   (2 * SECTION_WORDS)
+
+typedef struct {
+  uint32_t page[SECTION_WORDS];
+  uint32_t buddy[BUDDY_WORDS];
+} pmm_section_t;
+
+static pmm_section_t static_sections[PMM_STATIC_SECTIONS];
+static pmm_section_t *static_table[PMM_STATIC_SECTIONS];
+static pmm_section_t **sections = static_table;  /* NULL = hole */
+static uint32_t num_sections = 0;
+static uint32_t present_sections = 0;
+
+/* Metadata carved out of free memory, if any */
+static paddr_t meta_base = 0;
+static uint32_t meta_bytes = 0;
+
+static uint32_t buddy_free[NUMA_MAX_NODES][PMM_MAX_ORDER + 1]; /* Blocks */
+static uint32_t buddy_hint[NUMA_MAX_NODES][PMM_MAX_ORDER + 1]; /* None below */
+static uint32_t buddy_splits = 0;
+static uint32_t buddy_merges = 0;
+
+#define PFN_NONE 0xFFFFFFFFu
 
 /* Memory regions from multiboot */
 #define MAX_MEM_REGIONS 32
@@ -30,60 +68,285 @@ static numa_node_t numa_nodes[NUMA_MAX_NODES];
 static uint8_t numa_node_count = 0;
 
 /* Global stats */
-static uint32_t total_pages = 0;
+static uint32_t total_pages = 0;    /* Usable */
 static uint32_t free_pages = 0;
 static uint32_t highest_page = 0;
 
 /* The PFN boundary between node 0 and node 1 */
 static uint32_t node_boundary_pfn = 0;
 
+/* ------------------------------------------------------------------------
+ * Locking and per-CPU magazines
+ * ------------------------------------------------------------------------ */
+
+/* Guards the bitmaps, buddy lists and counters; magazines are per CPU
+ * and only need interrupts off
+ */
+static volatile uint32_t pmm_lock = 0;
+
+static int pmm_lock_take(void) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  while (__atomic_exchange_n(&pmm_lock, 1, __ATOMIC_ACQUIRE)) {
+    __asm__ __volatile__("pause");
+  }
+  return was;
+}
+
+static void pmm_lock_give(int was) {
+  __atomic_store_n(&pmm_lock, 0, __ATOMIC_RELEASE);
+  if (was)
+    interrupts_enable();
+}
+
+/* Only its own CPU touches a magazine; the stats read them racily */
+typedef struct {
+  uint32_t count;
+  uint32_t hits;              /* Pages handed out without pmm_lock */
+  uint32_t pfn[PMM_MAG_SIZE];
+} pmm_mag_t;
+
+static pmm_mag_t mags[SMP_MAX_CPUS][NUMA_MAX_NODES];
+static uint32_t mag_refills = 0;    /* Under pmm_lock */
+static uint32_t mag_drains = 0;
+
 /* Kernel physical addresses (defined in linker script) */
 extern char _kernel_phys_start[];
 extern char _kernel_phys_end[];
 
-/* Virtual kernel base (for address conversion) */
-#define KERNEL_VBASE 0xC0000000
+/* Multiboot2 info, kept clear of the carved metadata */
+static paddr_t mbi_base = 0;
+static uint32_t mbi_bytes = 0;
+
+/* Helper: the section holding pfn, NULL in a hole */
+static inline pmm_section_t *pfn_section(uint32_t pfn) {
+  uint32_t sec = pfn >> PMM_SECTION_SHIFT;
+  return sec < num_sections ? sections[sec] : (pmm_section_t *)0;
+}
+
+/* Helper: first PFN of the section after pfn's */
+static inline uint32_t next_section(uint32_t pfn) {
+  return (pfn | (PMM_SECTION_PAGES - 1)) + 1;
+}
 
 /* Helper: set a bit in the bitmap (mark page as used) */
 static inline void bitmap_set(uint32_t pfn) {
-  if (pfn < PMM_MAX_PAGES) {
-    page_bitmap[pfn / 8] |= (1 << (pfn % 8));
+  pmm_section_t *s = pfn_section(pfn);
+  if (s) {
+    s->page[(pfn % PMM_SECTION_PAGES) / 32] |= 1u << (pfn % 32);
   }
 }
 
 /* Helper: clear a bit in the bitmap (mark page as free) */
 static inline void bitmap_clear(uint32_t pfn) {
-  if (pfn < PMM_MAX_PAGES) {
-    page_bitmap[pfn / 8] &= ~(1 << (pfn % 8));
+  pmm_section_t *s = pfn_section(pfn);
+  if (s) {
+    s->page[(pfn % PMM_SECTION_PAGES) / 32] &= ~(1u << (pfn % 32));
   }
 }
 
 /* Helper: test if a bit is set */
 static inline int bitmap_test(uint32_t pfn) {
-  if (pfn < PMM_MAX_PAGES) {
-    return (page_bitmap[pfn / 8] >> (pfn % 8)) & 1;
+  pmm_section_t *s = pfn_section(pfn);
+  if (s) {
+    return (s->page[(pfn % PMM_SECTION_PAGES) / 32] >> (pfn % 32)) & 1;
+  }
+  return 1; /* Out of range or in a hole = used */
+}
+
+/* Helper: node a PFN is in, NUMA_MAX_NODES if none (low memory) */
+static uint8_t pfn_node(uint32_t pfn) {
+  if (!numa_node_count || pfn < numa_nodes[0].start_pfn)
+    return NUMA_MAX_NODES;
+  return pfn < node_boundary_pfn ? 0 : (pfn < numa_nodes[1].end_pfn ? 1 : NUMA_MAX_NODES);
+}
+
+/* ------------------------------------------------------------------------
+ * Buddy free lists
+ * ------------------------------------------------------------------------ */
+
+/* Helper: the free map of an order in a section */
+static inline uint32_t *buddy_map(pmm_section_t *s, uint32_t order) {
+  return &s->buddy[BUDDY_WORDS - (BUDDY_WORDS >> order)];
+}
+
+/* Helper: block idx of an order within its section */
+static inline uint32_t buddy_local(uint32_t order, uint32_t idx) {
+  return idx & ((PMM_SECTION_PAGES >> order) - 1);
+}
+
+static inline int buddy_test(uint32_t order, uint32_t idx) {
+  pmm_section_t *s = pfn_section(idx << order);
+  if (!s)
+    return 0;
+  uint32_t i = buddy_local(order, idx);
+  return (buddy_map(s, order)[i / 32] >> (i % 32)) & 1;
+}
+
+static void buddy_mark(uint8_t node, uint32_t order, uint32_t idx) {
+  uint32_t i = buddy_local(order, idx);
+  buddy_map(pfn_section(idx << order), order)[i / 32] |= 1u << (i % 32);
+  buddy_free[node][order]++;
+  if (idx < buddy_hint[node][order])
+    buddy_hint[node][order] = idx;
+}
+
+static void buddy_unmark(uint8_t node, uint32_t order, uint32_t idx) {
+  uint32_t i = buddy_local(order, idx);
+  buddy_map(pfn_section(idx << order), order)[i / 32] &= ~(1u << (i % 32));
+  buddy_free[node][order]--;
+}
+
+/* Helper: block of 2^order pages at pfn lies inside node */
+static inline int buddy_fits(uint8_t node, uint32_t pfn, uint32_t order) {
+  return pfn >= numa_nodes[node].start_pfn &&
+         pfn + (1u << order) <= numa_nodes[node].end_pfn;
+}
+
+/* Helper: first set bit of map in [from, end), or PFN_NONE */
+static uint32_t bits_first_set(const uint32_t *map, uint32_t from, uint32_t end) {
+  for (uint32_t w = from / 32; w * 32 < end; w++) {
+    uint32_t bits = map[w];
+    if (w == from / 32)
+      bits &= 0xFFFFFFFFu << (from % 32);
+    if (bits) {
+      uint32_t idx = w * 32 + (uint32_t)__builtin_ctz(bits);
+      return idx < end ? idx : PFN_NONE;
+    }
+  }
+  return PFN_NONE;
+}
+
+/* Helper: first free block of an order in [from, end), stepping over
+ * holes a section at a time, or PFN_NONE
+ */
+static uint32_t buddy_first_set(uint32_t order, uint32_t from, uint32_t end) {
+  uint32_t per = PMM_SECTION_PAGES >> order;    /* Blocks per section */
+
+  while (from < end) {
+    uint32_t base = from & ~(per - 1);
+    uint32_t stop = base + per < end ? base + per : end;
+    pmm_section_t *s = pfn_section(base << order);
+    if (s) {
+      uint32_t idx = bits_first_set(buddy_map(s, order), from - base, stop - base);
+      if (idx != PFN_NONE)
+        return base + idx;
+    }
+    from = stop;
+  }
+  return PFN_NONE;
+}
+
+/* Put a free block of node back, merging it with its buddy while that is
+ * free too and the merged block stays inside the node
+ */
+static void buddy_put(uint8_t node, uint32_t pfn, uint32_t order) {
+  while (order < PMM_MAX_ORDER) {
+    uint32_t merged = pfn & ~((2u << order) - 1);
+    uint32_t buddy = pfn ^ (1u << order);
+    if (!buddy_fits(node, merged, order + 1) || !buddy_test(order, buddy >> order))
+      break;
+    buddy_unmark(node, order, buddy >> order);
+    buddy_merges++;
+    pfn = merged;
+    order++;
+  }
+  buddy_mark(node, order, pfn >> order);
+}
+
+/* Put the free pages [pfn, pfn + count) of node back as aligned blocks */
+static void buddy_put_range(uint8_t node, uint32_t pfn, uint32_t count) {
+  while (count) {
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && !(pfn & (1u << order)) &&
+           (2u << order) <= count && buddy_fits(node, pfn, order + 1))
+      order++;
+    buddy_put(node, pfn, order);
+    pfn += 1u << order;
+    count -= 1u << order;
+  }
+}
+
+/* Take the lowest free block of at least 2^order pages from node and split
+ * it down to 2^order. Returns its first PFN, or PFN_NONE
+ */
+static uint32_t buddy_take(uint8_t node, uint32_t order) {
+  numa_node_t *n = &numa_nodes[node];
+
+  for (uint32_t k = order; k <= PMM_MAX_ORDER; k++) {
+    if (!buddy_free[node][k])
+      continue;
+    uint32_t end = (n->end_pfn + (1u << k) - 1) >> k;
+    uint32_t idx = buddy_first_set(k, buddy_hint[node][k], end);
+    if (idx == PFN_NONE)
+      continue;
+    buddy_hint[node][k] = idx;
+    buddy_unmark(node, k, idx);
+
+    /* Split: the upper halves go back one order down each */
+    uint32_t pfn = idx << k;
+    while (k > order) {
+      k--;
+      buddy_mark(node, k, (pfn >> k) + 1);
+      buddy_splits++;
+    }
+    return pfn;
   }
-  return 1; /* Out of range = used */
+  return PFN_NONE;
 }
 
-/* Print hex value */
-static void print_hex(uint32_t val) {
-  char buf[9];
+/* Take the single free page pfn out of the block holding it */
+static void buddy_take_page(uint8_t node, uint32_t pfn) {
+  for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++) {
+    if (!buddy_test(k, pfn >> k))
+      continue;
+    buddy_unmark(node, k, pfn >> k);
+    /* Split down to pfn, returning the halves without it */
+    while (k > 0) {
+      k--;
+      buddy_mark(node, k, (pfn >> k) ^ 1);
+      buddy_splits++;
+    }
+    return;
+  }
+}
+
+/* Print hex value (16 digits when it needs them) */
+static void print_hex(uint64_t val) {
+  char buf[17];
   const char *hex = "0123456789ABCDEF";
-  for (int i = 7; i >= 0; i--) {
+  int digits = (val >> 32) ? 16 : 8;
+  for (int i = digits - 1; i >= 0; i--) {
     buf[i] = hex[val & 0xF];
     val >>= 4;
   }
-  buf[8] = '\0';
+  buf[digits] = '\0';
   console_write("0x");
   console_write(buf);
 }
 
+/* Helper: record a firmware memory map entry */
+static void add_region(uint64_t base, uint64_t length, uint32_t type) {
+  if (num_regions >= MAX_MEM_REGIONS)
+    return;
+#ifndef __x86_64__
+  /* Only handle memory below 4GB (we're 32-bit) */
+  if (base >= 0x100000000ULL)
+    return;
+  if (base + length > 0x100000000ULL)
+    length = 0x100000000ULL - base;
+#endif
+  mem_regions[num_regions].base = (paddr_t)base;
+  mem_regions[num_regions].length = length;
+  mem_regions[num_regions].type = (mem_region_type_t)type;
+  num_regions++;
+}
+
 /* Parse multiboot memory map */
 static void parse_mmap(multiboot_info_t *mboot) {
   /* Debug: show multiboot pointer and flags */
   console_write("[pmm] mboot at ");
-  print_hex((uint32_t)mboot);
+  print_hex((uintptr_t)mboot);
   console_write(", flags=");
   print_hex(mboot->flags);
   console_write("\n");
@@ -98,38 +361,20 @@ static void parse_mmap(multiboot_info_t *mboot) {
       print_uint(mboot->mem_upper);
       console_write(" KB\n");
 
-      mem_regions[0].base = 0;
-      mem_regions[0].length = mboot->mem_lower * 1024;
-      mem_regions[0].type = MEM_REGION_AVAILABLE;
-
-      mem_regions[1].base = 0x100000; /* 1MB */
-      mem_regions[1].length = mboot->mem_upper * 1024;
-      mem_regions[1].type = MEM_REGION_AVAILABLE;
-      num_regions = 2;
+      add_region(0, (uint64_t)mboot->mem_lower * 1024, MEM_REGION_AVAILABLE);
+      add_region(0x100000, (uint64_t)mboot->mem_upper * 1024, MEM_REGION_AVAILABLE);
     }
     return;
   }
 
   console_write("[pmm] parsing memory map...\n");
 
-  multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)mboot->mmap_addr;
+  multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)(uintptr_t)mboot->mmap_addr;
   multiboot_mmap_entry_t *end =
-      (multiboot_mmap_entry_t *)(mboot->mmap_addr + mboot->mmap_length);
+      (multiboot_mmap_entry_t *)(uintptr_t)(mboot->mmap_addr + mboot->mmap_length);
 
   while (entry < end && num_regions < MAX_MEM_REGIONS) {
-    /* Only handle memory below 4GB (we're 32-bit) */
-    if (entry->base_addr < 0x100000000ULL) {
-      mem_regions[num_regions].base = (paddr_t)entry->base_addr;
-
-      /* Clamp length to 32-bit range */
-      uint64_t len = entry->length;
-      if (entry->base_addr + len > 0x100000000ULL) {
-        len = 0x100000000ULL - entry->base_addr;
-      }
-      mem_regions[num_regions].length = (uint32_t)len;
-      mem_regions[num_regions].type = (mem_region_type_t)entry->type;
-      num_regions++;
-    }
+    add_region(entry->base_addr, entry->length, entry->type);
 
     /* Move to next entry (size field doesn't include itself) */
     entry = (multiboot_mmap_entry_t *)((uint8_t *)entry + entry->size + 4);
@@ -140,46 +385,267 @@ static void parse_mmap(multiboot_info_t *mboot) {
   console_write(" memory regions\n");
 }
 
-/* Initialize bitmap based on memory regions */
-static void init_bitmap(void) {
-  /* Start with all pages marked as used */
-  for (uint32_t i = 0; i < BITMAP_SIZE; i++) {
-    page_bitmap[i] = 0xFF;
+/* Parse the multiboot2 memory map tag */
+static void parse_mb2(const void *mbi) {
+  const uint8_t *p = (const uint8_t *)mbi;
+  uint32_t total = *(const uint32_t *)p;
+  const uint8_t *end = p + total;
+
+  mbi_base = (paddr_t)(uintptr_t)mbi;
+  mbi_bytes = total;
+
+  console_write("[pmm] multiboot2 info at ");
+  print_hex(mbi_base);
+  console_write(", ");
+  print_uint(total);
+  console_write(" bytes\n");
+
+  /* Tags start after the 8-byte header, each 8-byte aligned */
+  for (p += 8; p + sizeof(multiboot2_tag_t) <= end;) {
+    const multiboot2_tag_t *tag = (const multiboot2_tag_t *)p;
+    if (tag->type == MULTIBOOT2_TAG_END || tag->size < sizeof(multiboot2_tag_t))
+      break;
+
+    if (tag->type == MULTIBOOT2_TAG_MMAP) {
+      const multiboot2_tag_mmap_t *mmap = (const multiboot2_tag_mmap_t *)p;
+      const uint8_t *e = p + sizeof(multiboot2_tag_mmap_t);
+      while (mmap->entry_size && e + mmap->entry_size <= p + tag->size) {
+        const multiboot2_mmap_entry_t *entry = (const multiboot2_mmap_entry_t *)e;
+        add_region(entry->base_addr, entry->length, entry->type);
+        e += mmap->entry_size;
+      }
+    }
+    p += (tag->size + 7) & ~7u;
   }
 
-  /* Mark available regions as free */
+  console_write("[pmm] found ");
+  print_uint(num_regions);
+  console_write(" memory regions\n");
+}
+
+/* Helper: usable PFNs [*start, *end) of region r, clamped to what we
+ * manage. Returns 0 if there are none
+ */
+static int region_pfns(uint32_t r, uint32_t *start, uint32_t *end) {
+  if (mem_regions[r].type != MEM_REGION_AVAILABLE)
+    return 0;
+
+  uint64_t top = (uint64_t)mem_regions[r].base + mem_regions[r].length;
+  if (top > PMM_MAX_MEMORY)
+    top = PMM_MAX_MEMORY;
+  paddr_t base = page_align_up(mem_regions[r].base);
+  paddr_t limit = page_align_down((paddr_t)top);
+  if (top <= mem_regions[r].base || limit <= base)
+    return 0;
+
+  *start = addr_to_pfn(base);
+  *end = addr_to_pfn(limit);
+  return 1;
+}
+
+/* Helper: usable pages in [start, end) */
+static uint32_t usable_pages(uint32_t start, uint32_t end) {
+  uint32_t pages = 0;
   for (uint32_t r = 0; r < num_regions; r++) {
-    if (mem_regions[r].type != MEM_REGION_AVAILABLE) {
+    uint32_t s, e;
+    if (!region_pfns(r, &s, &e))
+      continue;
+    if (s < start)
+      s = start;
+    if (e > end)
+      e = end;
+    if (e > s)
+      pages += e - s;
+  }
+  return pages;
+}
+
+/* Helper: free pages in [pfn, end), a word at a time where it can */
+static uint32_t count_free(uint32_t pfn, uint32_t end) {
+  uint32_t count = 0;
+  while (pfn < end) {
+    pmm_section_t *s = pfn_section(pfn);
+    if (!s) {
+      pfn = next_section(pfn);
+      continue;
+    }
+    if (pfn % 32 == 0 && end - pfn >= 32) {
+      count += 32 - (uint32_t)__builtin_popcount(s->page[(pfn % PMM_SECTION_PAGES) / 32]);
+      pfn += 32;
       continue;
     }
+    count += !bitmap_test(pfn);
+    pfn++;
+  }
+  return count;
+}
 
-    paddr_t base = page_align_up(mem_regions[r].base);
-    paddr_t end = page_align_down(mem_regions[r].base + mem_regions[r].length);
+/* The carved metadata has to be reachable before vmm_init(): the boot
+ * identity map on x86_64, the boot kernel window on i386
+ */
+#ifdef __x86_64__
+#define META_LIMIT 0x100000000ULL
+#else
+#define META_LIMIT 0x08000000u
+#endif
+
+/* Helper: [a, a + len) overlaps [b, b_end) */
+static inline int overlaps(paddr_t a, uint32_t len, paddr_t b, paddr_t b_end) {
+  return a < b_end && b < a + len;
+}
+
+/* Internal: bytes of usable memory above 1MB that avoid the kernel image
+ * and the boot info, or 0
+ */
+static paddr_t find_meta_space(uint32_t bytes) {
+  paddr_t kstart = (paddr_t)(uintptr_t)_kernel_phys_start;
+  paddr_t kend = (paddr_t)(uintptr_t)_kernel_phys_end;
 
-    if (end <= base)
+  for (uint32_t r = 0; r < num_regions; r++) {
+    uint32_t s, e;
+    if (!region_pfns(r, &s, &e))
       continue;
+    paddr_t at = pfn_to_addr(s);
+    paddr_t end = pfn_to_addr(e);
+    if (at < 0x100000)
+      at = 0x100000;
+    if (end > META_LIMIT)
+      end = META_LIMIT;
+
+    for (int moved = 1; moved;) {
+      moved = 0;
+      if (overlaps(at, bytes, kstart, kend)) {
+        at = page_align_up(kend);
+        moved = 1;
+      }
+      if (mbi_bytes && overlaps(at, bytes, mbi_base, mbi_base + mbi_bytes)) {
+        at = page_align_up(mbi_base + mbi_bytes);
+        moved = 1;
+      }
+    }
+    if (at < end && bytes <= end - at)
+      return at;
+  }
+  return 0;
+}
+
+/* Helper: section sec overlaps usable memory */
+static int section_usable(uint32_t sec) {
+  return usable_pages(sec << PMM_SECTION_SHIFT, (sec + 1) << PMM_SECTION_SHIFT) != 0;
+}
+
+/* Give every section holding usable memory its bitmaps (all used): the
+ * first PMM_STATIC_SECTIONS from the kernel image, the rest and a table
+ * big enough for all of them from free memory
+ */
+static void setup_sections(void) {
+  uint32_t end_pfn = 0;
+  for (uint32_t r = 0; r < num_regions; r++) {
+    uint32_t s, e;
+    if (region_pfns(r, &s, &e) && e > end_pfn)
+      end_pfn = e;
+  }
+  num_sections = (end_pfn + PMM_SECTION_PAGES - 1) >> PMM_SECTION_SHIFT;
 
-    uint32_t start_pfn = addr_to_pfn(base);
-    uint32_t end_pfn = addr_to_pfn(end);
+  uint32_t usable = 0;
+  for (uint32_t sec = 0; sec < num_sections; sec++) {
+    usable += section_usable(sec);
+  }
 
-    /* Clamp to our maximum */
-    if (end_pfn > PMM_MAX_PAGES) {
-      end_pfn = PMM_MAX_PAGES;
+  uint32_t extra = usable > PMM_STATIC_SECTIONS ? usable - PMM_STATIC_SECTIONS : 0;
+  uint8_t *carved = (uint8_t *)0;
+  if (num_sections > PMM_STATIC_SECTIONS) {
+    uint32_t bytes = extra * sizeof(pmm_section_t) +
+                     num_sections * sizeof(pmm_section_t *);
+    meta_bytes = (uint32_t)page_align_up(bytes);
+    meta_base = find_meta_space(meta_bytes);
+    if (meta_base) {
+      carved = (uint8_t *)(uintptr_t)phys_to_virt(meta_base);
+      sections = (pmm_section_t **)(carved + extra * sizeof(pmm_section_t));
+    } else {
+      console_write("[pmm] WARNING: no room for the bitmaps, managing the first ");
+      print_uint((PMM_STATIC_SECTIONS * PMM_SECTION_PAGES) / 256);
+      console_write(" MB only\n");
+      meta_bytes = 0;
+      num_sections = PMM_STATIC_SECTIONS;
     }
+  }
 
-    for (uint32_t pfn = start_pfn; pfn < end_pfn; pfn++) {
-      bitmap_clear(pfn);
-      free_pages++;
-      if (pfn > highest_page) {
-        highest_page = pfn;
-      }
+  present_sections = 0;
+  for (uint32_t sec = 0; sec < num_sections; sec++) {
+    if (!section_usable(sec)) {
+      sections[sec] = (pmm_section_t *)0;
+      continue;
+    }
+    pmm_section_t *s;
+    if (present_sections < PMM_STATIC_SECTIONS) {
+      s = &static_sections[present_sections];
+    } else {
+      s = (pmm_section_t *)carved;
+      carved += sizeof(pmm_section_t);
+    }
+    for (uint32_t i = 0; i < SECTION_WORDS; i++) {
+      s->page[i] = 0xFFFFFFFFu;
     }
+    for (uint32_t i = 0; i < BUDDY_WORDS; i++) {
+      s->buddy[i] = 0;
+    }
+    sections[sec] = s;
+    present_sections++;
+  }
+
+  console_write("[pmm] bitmaps: ");
+  print_uint(present_sections);
+  console_write(" of ");
+  print_uint(num_sections);
+  console_write(" sections (");
+  print_uint(present_sections * (uint32_t)sizeof(pmm_section_t) / 1024);
+  console_write(" KB)");
+  if (meta_bytes) {
+    console_write(", carved at ");
+    print_hex(meta_base);
   }
+  console_write("\n");
+}
+
+/* Initialize bitmap based on memory regions */
+static void init_bitmap(void) {
+  /* Sections start with all pages marked as used; mark available
+   * regions as free
+   */
+  for (uint32_t r = 0; r < num_regions; r++) {
+    uint32_t start_pfn, end_pfn;
+    if (!region_pfns(r, &start_pfn, &end_pfn))
+      continue;
 
-  total_pages = highest_page + 1;
+    uint32_t pfn = start_pfn;
+    while (pfn < end_pfn) {
+      pmm_section_t *s = pfn_section(pfn);
+      if (!s) {
+        pfn = next_section(pfn);
+        continue;
+      }
+      uint32_t *word = &s->page[(pfn % PMM_SECTION_PAGES) / 32];
+      uint32_t freed;
+      if (pfn % 32 == 0 && end_pfn - pfn >= 32) {
+        freed = (uint32_t)__builtin_popcount(*word);
+        *word = 0;
+        pfn += 32;
+      } else {
+        freed = (*word >> (pfn % 32)) & 1;
+        *word &= ~(1u << (pfn % 32));
+        pfn++;
+      }
+      free_pages += freed;
+      total_pages += freed;
+      if (freed && pfn - 1 > highest_page) {
+        highest_page = pfn - 1;
+      }
+    }
+  }
 }
 
-/* Reserve low memory and kernel region */
+/* Reserve low memory, the kernel region and the carved bitmaps */
 static void reserve_kernel(void) {
   /* Reserve first 1MB (BIOS, VGA, etc.) */
   pmm_reserve_range(0, 0x100000);
@@ -188,8 +654,8 @@ static void reserve_kernel(void) {
    * Kernel physical addresses come from linker script
    * Note: _kernel_phys_start/_end are defined as physical addresses
    */
-  paddr_t kernel_start = (paddr_t)_kernel_phys_start;
-  paddr_t kernel_end = (paddr_t)_kernel_phys_end;
+  paddr_t kernel_start = (paddr_t)(uintptr_t)_kernel_phys_start;
+  paddr_t kernel_end = (paddr_t)(uintptr_t)_kernel_phys_end;
 
   console_write("[pmm] kernel: phys ");
   print_hex(kernel_start);
@@ -198,53 +664,61 @@ static void reserve_kernel(void) {
   console_write("\n");
 
   pmm_reserve_range(kernel_start, kernel_end - kernel_start);
+
+  if (meta_bytes)
+    pmm_reserve_range(meta_base, meta_bytes);
 }
 
 /* Set up simulated NUMA nodes by splitting memory in half */
 static void setup_numa_nodes(void) {
   /* Split usable memory (above 1MB) into two nodes */
   uint32_t usable_start_pfn = 256; /* 1MB / 4KB */
-  uint32_t usable_pages = highest_page - usable_start_pfn + 1;
+  uint32_t usable_pages_above = highest_page - usable_start_pfn + 1;
 
-  node_boundary_pfn = usable_start_pfn + (usable_pages / 2);
+  node_boundary_pfn = usable_start_pfn + (usable_pages_above / 2);
 
   /* Node 0: Lower half (local/latency-sensitive) */
   numa_nodes[0].node_id = 0;
   numa_nodes[0].base_addr = pfn_to_addr(usable_start_pfn);
   numa_nodes[0].start_pfn = usable_start_pfn;
   numa_nodes[0].end_pfn = node_boundary_pfn;
-  numa_nodes[0].total_pages = node_boundary_pfn - usable_start_pfn;
-  numa_nodes[0].free_pages = 0;
-  numa_nodes[0].used_pages = 0;
 
   /* Node 1: Upper half (remote/background) */
   numa_nodes[1].node_id = 1;
   numa_nodes[1].base_addr = pfn_to_addr(node_boundary_pfn);
   numa_nodes[1].start_pfn = node_boundary_pfn;
   numa_nodes[1].end_pfn = highest_page + 1;
-  numa_nodes[1].total_pages = (highest_page + 1) - node_boundary_pfn;
-  numa_nodes[1].free_pages = 0;
-  numa_nodes[1].used_pages = 0;
 
   numa_node_count = 2;
 
-  /* Count free pages per node */
-  for (uint32_t pfn = usable_start_pfn; pfn <= highest_page; pfn++) {
-    if (!bitmap_test(pfn)) {
-      if (pfn < node_boundary_pfn) {
-        numa_nodes[0].free_pages++;
-      } else {
-        numa_nodes[1].free_pages++;
+  /* Count usable and free pages per node; holes are neither */
+  for (uint8_t node = 0; node < numa_node_count; node++) {
+    numa_node_t *n = &numa_nodes[node];
+    n->total_pages = usable_pages(n->start_pfn, n->end_pfn);
+    n->free_pages = count_free(n->start_pfn, n->end_pfn);
+    n->used_pages = n->total_pages - n->free_pages;
+  }
+
+  /* Build the buddy lists from the free runs of each node */
+  for (uint8_t node = 0; node < numa_node_count; node++) {
+    numa_node_t *n = &numa_nodes[node];
+    for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++) {
+      buddy_hint[node][k] = n->start_pfn >> k;
+    }
+    uint32_t pfn = n->start_pfn;
+    while (pfn < n->end_pfn) {
+      if (!pfn_section(pfn)) {
+        pfn = next_section(pfn);
+        continue;
       }
+      uint32_t run = 0;
+      while (pfn + run < n->end_pfn && !bitmap_test(pfn + run))
+        run++;
+      buddy_put_range(node, pfn, run);
+      pfn += run + 1;
     }
   }
 
-  /* Calculate used pages */
-  numa_nodes[0].used_pages =
-      numa_nodes[0].total_pages - numa_nodes[0].free_pages;
-  numa_nodes[1].used_pages =
-      numa_nodes[1].total_pages - numa_nodes[1].free_pages;
-
   console_write("[pmm] NUMA node 0: PFN ");
   print_uint(numa_nodes[0].start_pfn);
   console_write("-");
@@ -262,24 +736,17 @@ static void setup_numa_nodes(void) {
   console_write(" free)\n");
 }
 
-void pmm_init(multiboot_info_t *mboot_info) {
-  console_write("[pmm] initializing physical memory manager\n");
-
-  /* Parse memory map from bootloader */
-  if (mboot_info) {
-    parse_mmap(mboot_info);
-  } else {
-    /* Manual fallback for manual init (e.g. x86_64 stub) */
-    console_write("[pmm] No multiboot info, assuming 128MB RAM\n");
-    mem_regions[0].base = 0;
-    mem_regions[0].length = 640 * 1024;
-    mem_regions[0].type = MEM_REGION_AVAILABLE;
+/* Internal: no memory map from the bootloader */
+static void default_regions(void) {
+  console_write("[pmm] No memory map, assuming 128MB RAM\n");
+  add_region(0, 640 * 1024, MEM_REGION_AVAILABLE);
+  add_region(0x100000, (128 * 1024 * 1024) - 0x100000, MEM_REGION_AVAILABLE);
+}
 
-    mem_regions[1].base = 0x100000;
-    mem_regions[1].length = (128 * 1024 * 1024) - 0x100000;
-    mem_regions[1].type = MEM_REGION_AVAILABLE;
-    num_regions = 2;
-  }
+/* Internal: everything after the memory map is known */
+static void pmm_setup(void) {
+  /* Size and place the bitmaps */
+  setup_sections();
 
   /* Initialize page bitmap */
   init_bitmap();
@@ -294,9 +761,9 @@ void pmm_init(multiboot_info_t *mboot_info) {
   flightrec_log(TRACE_EVT_BOOT, 0, 0, free_pages);
 
   console_write("[pmm] total memory: ");
-  print_uint((highest_page + 1) * 4);
+  print_uint(total_pages * 4);
   console_write(" KB (");
-  print_uint(highest_page + 1);
+  print_uint(total_pages);
   console_write(" pages)\n");
 
   console_write("[pmm] free memory: ");
@@ -308,37 +775,249 @@ void pmm_init(multiboot_info_t *mboot_info) {
   console_write("[pmm] init complete\n");
 }
 
-/* Internal: allocate from a specific node's range */
-static paddr_t alloc_from_node(uint8_t node) {
+void pmm_init(multiboot_info_t *mboot_info) {
+  console_write("[pmm] initializing physical memory manager\n");
+
+  /* Parse memory map from bootloader */
+  if (mboot_info) {
+    parse_mmap(mboot_info);
+  }
+  if (!num_regions) {
+    /* Manual fallback for manual init (e.g. x86_64 stub) */
+    default_regions();
+  }
+
+  pmm_setup();
+}
+
+void pmm_init_multiboot2(const void *mbi) {
+  console_write("[pmm] initializing physical memory manager\n");
+
+  if (mbi) {
+    parse_mb2(mbi);
+  }
+  if (!num_regions) {
+    default_regions();
+  }
+
+  pmm_setup();
+}
+
+/* Internal: allocate a block of 2^order pages from a specific node */
+static paddr_t alloc_from_node(uint8_t node, uint32_t order) {
   if (node >= numa_node_count) {
     return 0;
   }
 
   numa_node_t *n = &numa_nodes[node];
+  if (n->free_pages < (1u << order))
+    return 0; /* Node exhausted */
 
-  for (uint32_t pfn = n->start_pfn; pfn < n->end_pfn; pfn++) {
-    if (!bitmap_test(pfn)) {
-      bitmap_set(pfn);
-      free_pages--;
-      n->free_pages--;
-      n->used_pages++;
-      return pfn_to_addr(pfn);
+  uint32_t pfn = buddy_take(node, order);
+  if (pfn == PFN_NONE)
+    return 0; /* Free, but too fragmented */
+
+  for (uint32_t i = 0; i < (1u << order); i++) {
+    bitmap_set(pfn + i);
+  }
+  free_pages -= 1u << order;
+  n->free_pages -= 1u << order;
+  n->used_pages += 1u << order;
+  return pfn_to_addr(pfn);
+}
+
+/* Internal: mark the used pages [pfn, pfn + count) free and give them back
+ * to their nodes' buddy lists
+ */
+static void release_range(uint32_t pfn, uint32_t count) {
+  while (count) {
+    uint8_t node = pfn_node(pfn);
+    if (node >= numa_node_count) {
+      /* Low memory: bitmap only */
+      bitmap_clear(pfn);
+      free_pages++;
+      pfn++;
+      count--;
+      continue;
+    }
+
+    uint32_t run = numa_nodes[node].end_pfn - pfn;
+    if (run > count)
+      run = count;
+    for (uint32_t i = 0; i < run; i++) {
+      bitmap_clear(pfn + i);
     }
+    free_pages += run;
+    numa_nodes[node].free_pages += run;
+    numa_nodes[node].used_pages -= run;
+    buddy_put_range(node, pfn, run);
+    pfn += run;
+    count -= run;
   }
+}
 
-  return 0; /* Node exhausted */
+/* Internal: runs longer than the largest block, by a linear search */
+static paddr_t alloc_run(uint32_t count, uint8_t node) {
+  uint32_t search_start, search_end;
+
+  if (node == NUMA_NODE_ANY) {
+    /* Search all usable memory */
+    search_start = 256;
+    search_end = highest_page + 1;
+  } else {
+    search_start = numa_nodes[node].start_pfn;
+    search_end = numa_nodes[node].end_pfn;
+  }
+
+  uint32_t start_pfn = search_start;
+
+  while (start_pfn + count <= search_end) {
+    uint32_t found = 0;
+
+    if (!pfn_section(start_pfn)) {
+      start_pfn = next_section(start_pfn);
+      continue;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      if (bitmap_test(start_pfn + i)) {
+        start_pfn = start_pfn + i + 1;
+        found = 0;
+        break;
+      }
+      found++;
+    }
+
+    if (found == count) {
+      /* Found contiguous region, allocate it */
+      /* Per page: a run found across the node boundary counts on both */
+      for (uint32_t i = 0; i < count; i++) {
+        uint8_t n = pfn_node(start_pfn + i);
+        bitmap_set(start_pfn + i);
+        if (n < numa_node_count) {
+          buddy_take_page(n, start_pfn + i);
+          numa_nodes[n].free_pages--;
+          numa_nodes[n].used_pages++;
+        }
+      }
+      free_pages -= count;
+
+      return pfn_to_addr(start_pfn);
+    }
+  }
+
+  return 0;
 }
 
-paddr_t pmm_alloc_page(uint8_t node) {
+/* Internal: page pfn can be freed; warns if not */
+static int page_freeable(uint32_t pfn) {
+  if (pfn > highest_page) {
+    console_write("[pmm] WARNING: freeing invalid page!\n");
+    return 0;
+  }
+
+  if (!bitmap_test(pfn)) {
+    console_write("[pmm] WARNING: double free detected!\n");
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Internal: fill magazine m of node with PMM_MAG_BATCH pages, one block
+ * if there is one. Returns pages added. Caller holds pmm_lock
+ */
+static uint32_t mag_refill(pmm_mag_t *m, uint8_t node) {
+  uint32_t order = 0;
+  while ((1u << order) < PMM_MAG_BATCH)
+    order++;
+
+  uint32_t added = 0;
+  paddr_t addr = alloc_from_node(node, order);
+  if (addr) {
+    for (uint32_t i = 0; i < PMM_MAG_BATCH; i++) {
+      m->pfn[m->count++] = addr_to_pfn(addr) + PMM_MAG_BATCH - 1 - i;
+    }
+    added = PMM_MAG_BATCH;
+  } else {
+    /* Fragmented: page by page */
+    while (added < PMM_MAG_BATCH && (addr = alloc_from_node(node, 0))) {
+      m->pfn[m->count++] = addr_to_pfn(addr);
+      added++;
+    }
+  }
+
+  if (added)
+    mag_refills++;
+  return added;
+}
+
+/* Internal: give magazine m back down to keep pages. Caller holds
+ * pmm_lock
+ */
+static void mag_drain(pmm_mag_t *m, uint32_t keep) {
+  while (m->count > keep) {
+    uint32_t pfn = m->pfn[--m->count];
+    /* A page freed twice into the magazine is caught here */
+    if (page_freeable(pfn))
+      release_range(pfn, 1);
+  }
+  mag_drains++;
+}
+
+/* Internal: empty this CPU's magazines. Returns pages given back. Caller
+ * holds pmm_lock
+ */
+static uint32_t drain_own_mags(void) {
+  uint32_t drained = 0;
+  for (uint8_t node = 0; node < numa_node_count; node++) {
+    pmm_mag_t *m = &mags[smp_cpu_id()][node];
+    if (m->count) {
+      drained += m->count;
+      mag_drain(m, 0);
+    }
+  }
+  return drained;
+}
+
+/* Internal: page from this CPU's magazine of node, 0 if it is empty and
+ * could not be refilled
+ */
+static paddr_t mag_alloc(uint8_t node) {
+  if (node >= numa_node_count)
+    return 0;
+
+  int was = interrupts_enabled();
+  interrupts_disable();
+  pmm_mag_t *m = &mags[smp_cpu_id()][node];
+  paddr_t addr = 0;
+
+  if (!m->count) {
+    int lwas = pmm_lock_take();
+    mag_refill(m, node);
+    pmm_lock_give(lwas);
+  }
+  if (m->count) {
+    addr = pfn_to_addr(m->pfn[--m->count]);
+    m->hits++;
+  }
+
+  if (was)
+    interrupts_enable();
+  return addr;
+}
+
+/* Internal: pmm_alloc_page() past the magazine. Caller holds pmm_lock */
+static paddr_t alloc_page_slow(uint8_t node) {
   paddr_t addr;
 
   /* Handle special node values */
   if (node == NUMA_NODE_ANY) {
     /* Try node 0 first, then node 1 */
-    addr = alloc_from_node(0);
+    addr = alloc_from_node(0, 0);
     if (addr)
       return addr;
-    addr = alloc_from_node(1);
+    addr = alloc_from_node(1, 0);
     if (addr) {
       /* Log locality miss - allocated from non-preferred node */
       flightrec_log(TRACE_EVT_MEM_LOCALITY_MISS, 0, 0, 1);
@@ -357,7 +1036,7 @@ paddr_t pmm_alloc_page(uint8_t node) {
   }
 
   /* Try preferred node first */
-  addr = alloc_from_node(node);
+  addr = alloc_from_node(node, 0);
   if (addr) {
     return addr;
   }
@@ -366,7 +1045,7 @@ paddr_t pmm_alloc_page(uint8_t node) {
   for (uint8_t i = 0; i < numa_node_count; i++) {
     if (i == node)
       continue;
-    addr = alloc_from_node(i);
+    addr = alloc_from_node(i, 0);
     if (addr) {
       /* Log locality miss */
       flightrec_log(TRACE_EVT_MEM_LOCALITY_MISS, 0, node, i);
@@ -374,12 +1053,72 @@ paddr_t pmm_alloc_page(uint8_t node) {
     }
   }
 
+  return 0;
+}
+
+paddr_t pmm_alloc_page(uint8_t node) {
+  paddr_t addr;
+
+  /* Common case: this CPU's magazine */
+  addr = mag_alloc(node == NUMA_NODE_ANY ? 0 : node);
+  if (addr)
+    return addr;
+
+  int was = pmm_lock_take();
+  addr = alloc_page_slow(node);
+  if (!addr && drain_own_mags()) {
+    addr = alloc_page_slow(node);
+  }
+  pmm_lock_give(was);
+  if (addr)
+    return addr;
+
   /* All nodes exhausted */
   flightrec_log(TRACE_EVT_MEM_ALLOC_FAIL, 0, node, 1);
   console_write("[pmm] ERROR: out of memory!\n");
   return 0;
 }
 
+/* Internal: pmm_alloc_pages() for count > 1. Caller holds pmm_lock */
+static paddr_t alloc_pages_locked(uint32_t count, uint8_t node) {
+  /* Smallest block that holds count pages */
+  uint32_t order = 0;
+  while (order <= PMM_MAX_ORDER && (1u << order) < count)
+    order++;
+
+  if (order > PMM_MAX_ORDER) {
+    paddr_t addr = alloc_run(count, node);
+    if (!addr && node != NUMA_NODE_ANY) {
+      for (uint8_t i = 0; i < numa_node_count && !addr; i++) {
+        if (i == node)
+          continue;
+        addr = alloc_run(count, i);
+        if (addr)
+          flightrec_log(TRACE_EVT_MEM_LOCALITY_MISS, 0, node, i);
+      }
+    }
+    return addr;
+  } else {
+    /* Preferred node (node 0 for any), then the others */
+    uint8_t first = node == NUMA_NODE_ANY ? 0 : node;
+    paddr_t addr = alloc_from_node(first, order);
+    for (uint8_t i = 0; i < numa_node_count && !addr; i++) {
+      if (i == first)
+        continue;
+      addr = alloc_from_node(i, order);
+      if (addr)
+        flightrec_log(TRACE_EVT_MEM_LOCALITY_MISS, 0, first, i);
+    }
+
+    if (addr) {
+      /* Give back the tail past count */
+      uint32_t pfn = addr_to_pfn(addr);
+      release_range(pfn + count, (1u << order) - count);
+    }
+    return addr;
+  }
+}
+
 paddr_t pmm_alloc_pages(uint32_t count, uint8_t node) {
   if (count == 0)
     return 0;
@@ -392,66 +1131,14 @@ paddr_t pmm_alloc_pages(uint32_t count, uint8_t node) {
     node = 0;
   }
 
-  /* Determine search range based on node */
-  uint32_t search_start, search_end;
-  uint8_t target_node;
-
-  if (node == NUMA_NODE_ANY) {
-    /* Search all usable memory */
-    search_start = 256;
-    search_end = highest_page + 1;
-    target_node = 0; /* Will be updated based on where we find pages */
-  } else {
-    search_start = numa_nodes[node].start_pfn;
-    search_end = numa_nodes[node].end_pfn;
-    target_node = node;
-  }
-
-  /* Search for contiguous free pages */
-  uint32_t start_pfn = search_start;
-
-  while (start_pfn + count <= search_end) {
-    uint32_t found = 0;
-
-    for (uint32_t i = 0; i < count; i++) {
-      if (bitmap_test(start_pfn + i)) {
-        start_pfn = start_pfn + i + 1;
-        found = 0;
-        break;
-      }
-      found++;
-    }
-
-    if (found == count) {
-      /* Found contiguous region, allocate it */
-      for (uint32_t i = 0; i < count; i++) {
-        bitmap_set(start_pfn + i);
-      }
-      free_pages -= count;
-
-      /* Update per-node stats */
-      if (node == NUMA_NODE_ANY) {
-        target_node = pmm_addr_to_node(pfn_to_addr(start_pfn));
-      }
-      numa_nodes[target_node].free_pages -= count;
-      numa_nodes[target_node].used_pages += count;
-
-      return pfn_to_addr(start_pfn);
-    }
-  }
-
-  /* If we were searching a specific node and failed, try fallback */
-  if (node != NUMA_NODE_ANY) {
-    for (uint8_t i = 0; i < numa_node_count; i++) {
-      if (i == node)
-        continue;
-      paddr_t addr = pmm_alloc_pages(count, i);
-      if (addr) {
-        flightrec_log(TRACE_EVT_MEM_LOCALITY_MISS, 0, node, i);
-        return addr;
-      }
-    }
+  int was = pmm_lock_take();
+  paddr_t addr = alloc_pages_locked(count, node);
+  if (!addr && drain_own_mags()) {
+    addr = alloc_pages_locked(count, node);
   }
+  pmm_lock_give(was);
+  if (addr)
+    return addr;
 
   flightrec_log(TRACE_EVT_MEM_ALLOC_FAIL, 0, node, count);
   console_write("[pmm] ERROR: cannot allocate ");
@@ -462,62 +1149,109 @@ paddr_t pmm_alloc_pages(uint32_t count, uint8_t node) {
 
 void pmm_free_page(paddr_t addr) {
   uint32_t pfn = addr_to_pfn(addr);
+  uint8_t node = pfn <= highest_page ? pfn_node(pfn) : NUMA_MAX_NODES;
 
-  if (pfn > highest_page) {
-    console_write("[pmm] WARNING: freeing invalid page!\n");
+  /* Common case: into this CPU's magazine; double frees show up when it
+   * drains
+   */
+  if (node < numa_node_count) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    pmm_mag_t *m = &mags[smp_cpu_id()][node];
+    m->pfn[m->count++] = pfn;
+    if (m->count > PMM_MAG_HIGH) {
+      int lwas = pmm_lock_take();
+      mag_drain(m, PMM_MAG_LOW);
+      pmm_lock_give(lwas);
+    }
+    if (was)
+      interrupts_enable();
     return;
   }
 
-  if (!bitmap_test(pfn)) {
-    console_write("[pmm] WARNING: double free detected!\n");
+  int was = pmm_lock_take();
+  if (page_freeable(pfn)) {
+    release_range(pfn, 1);
+  }
+  pmm_lock_give(was);
+}
+
+void pmm_free_pages(paddr_t addr, uint32_t count) {
+  if (count == 1) {
+    pmm_free_page(addr);
     return;
   }
 
-  bitmap_clear(pfn);
-  free_pages++;
+  uint32_t pfn = addr_to_pfn(addr);
+  uint32_t run = 0;
+  int was = pmm_lock_take();
 
-  /* Update per-node stats */
-  uint8_t node = pmm_addr_to_node(addr);
-  if (node < numa_node_count) {
-    numa_nodes[node].free_pages++;
-    numa_nodes[node].used_pages--;
+  /* Whole runs at once, so they go back as large blocks */
+  for (uint32_t i = 0; i < count; i++) {
+    if (page_freeable(pfn + i)) {
+      run++;
+      continue;
+    }
+    release_range(pfn + i - run, run);
+    run = 0;
   }
+  release_range(pfn + count - run, run);
+  pmm_lock_give(was);
 }
 
-void pmm_free_pages(paddr_t addr, uint32_t count) {
-  for (uint32_t i = 0; i < count; i++) {
-    pmm_free_page(addr + i * PAGE_SIZE);
-  }
+void pmm_drain_cpu_cache(void) {
+  int was = pmm_lock_take();
+  drain_own_mags();
+  pmm_lock_give(was);
 }
 
-void pmm_reserve_range(paddr_t base, uint32_t length) {
+void pmm_reserve_range(paddr_t base, uint64_t length) {
+  if ((uint64_t)base >= PMM_MAX_MEMORY)
+    return;
+  if (length > PMM_MAX_MEMORY - base)
+    length = PMM_MAX_MEMORY - base;
+
   paddr_t start = page_align_down(base);
-  paddr_t end = page_align_up(base + length);
+  paddr_t end = page_align_up(base + (paddr_t)length);
 
   uint32_t start_pfn = addr_to_pfn(start);
   uint32_t end_pfn = addr_to_pfn(end);
 
-  if (end_pfn > PMM_MAX_PAGES) {
-    end_pfn = PMM_MAX_PAGES;
-  }
-
+  int was = pmm_lock_take();
   for (uint32_t pfn = start_pfn; pfn < end_pfn; pfn++) {
+    if (!pfn_section(pfn)) {
+      pfn = next_section(pfn) - 1;
+      continue;
+    }
     if (!bitmap_test(pfn)) {
       bitmap_set(pfn);
       free_pages--;
+      uint8_t node = pfn_node(pfn);
+      if (node < numa_node_count) {
+        buddy_take_page(node, pfn);
+        numa_nodes[node].free_pages--;
+        numa_nodes[node].used_pages++;
+      }
     }
   }
+  pmm_lock_give(was);
 }
 
 void pmm_get_stats(pmm_stats_t *stats) {
-  stats->total_memory_kb = (highest_page + 1) * 4;
-  stats->free_memory_kb = free_pages * 4;
+  uint32_t cached = pmm_get_cached_pages(NUMA_NODE_ANY);
+
+  stats->total_memory_kb = total_pages * 4;
+  stats->free_memory_kb = (free_pages + cached) * 4;
   stats->used_memory_kb = stats->total_memory_kb - stats->free_memory_kb;
   stats->reserved_memory_kb = 0; /* TODO: track separately */
   stats->total_pages = total_pages;
-  stats->free_pages = free_pages;
+  stats->free_pages = free_pages + cached;
+  stats->cached_pages = cached;
   stats->num_regions = num_regions;
   stats->num_nodes = numa_node_count;
+  stats->num_sections = present_sections;
+  stats->meta_kb = (present_sections * (uint32_t)sizeof(pmm_section_t) +
+                    num_sections * (uint32_t)sizeof(pmm_section_t *)) / 1024;
 }
 
 numa_node_t *pmm_get_node(uint8_t node_id) {
@@ -529,6 +1263,42 @@ numa_node_t *pmm_get_node(uint8_t node_id) {
 
 uint8_t pmm_get_node_count(void) { return numa_node_count; }
 
+uint32_t pmm_get_cached_pages(uint8_t node_id) {
+  uint32_t cached = 0;
+  for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    for (uint8_t node = 0; node < numa_node_count; node++) {
+      if (node_id == NUMA_NODE_ANY || node_id == node)
+        cached += mags[cpu][node].count;
+    }
+  }
+  return cached;
+}
+
+uint32_t pmm_get_free_blocks(uint8_t node_id, uint32_t order) {
+  if (node_id >= numa_node_count || order > PMM_MAX_ORDER)
+    return 0;
+  return buddy_free[node_id][order];
+}
+
+uint32_t pmm_frag_index(uint8_t node_id, uint32_t order) {
+  if (node_id >= numa_node_count || order > PMM_MAX_ORDER)
+    return 0;
+  uint32_t free = numa_nodes[node_id].free_pages;
+  if (!free)
+    return 0;
+
+  /* Free pages in blocks of at least 2^order */
+  uint32_t usable = 0;
+  for (uint32_t k = order; k <= PMM_MAX_ORDER; k++) {
+    usable += buddy_free[node_id][k] << k;
+  }
+  return (uint32_t)((uint64_t)(free - usable) * 1000 / free);
+}
+
+paddr_t pmm_get_phys_end(void) {
+  return total_pages ? pfn_to_addr(highest_page + 1) : 0;
+}
+
 uint8_t pmm_addr_to_node(paddr_t addr) {
   uint32_t pfn = addr_to_pfn(addr);
 
@@ -585,7 +1355,44 @@ void pmm_dump_map(void) {
     print_uint(numa_nodes[i].free_pages * 4);
     console_write(" KB free / ");
     print_uint(numa_nodes[i].total_pages * 4);
-    console_write(" KB total\n");
+    console_write(" KB total, ");
+    print_uint(pmm_get_cached_pages(i) * 4);
+    console_write(" KB in CPU magazines\n");
+
+    console_write("  free blocks by order:");
+    for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++) {
+      console_write(" ");
+      print_uint(buddy_free[i][k]);
+    }
+    console_write("\n  frag index (per mille) for 64KB/4MB: ");
+    print_uint(pmm_frag_index(i, 4));
+    console_write("/");
+    print_uint(pmm_frag_index(i, PMM_MAX_ORDER));
+    console_write("\n");
+  }
+  console_write("Bitmap sections: ");
+  print_uint(present_sections);
+  console_write(" of ");
+  print_uint(num_sections);
+  console_write(" (128MB each)\n");
+  console_write("Buddy splits/merges: ");
+  print_uint(buddy_splits);
+  console_write("/");
+  print_uint(buddy_merges);
+  console_write("\n");
+
+  uint32_t hits = 0;
+  for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    for (uint8_t node = 0; node < numa_node_count; node++) {
+      hits += mags[cpu][node].hits;
+    }
   }
+  console_write("Magazine hits/refills/drains: ");
+  print_uint(hits);
+  console_write("/");
+  print_uint(mag_refills);
+  console_write("/");
+  print_uint(mag_drains);
+  console_write("\n");
   console_write("=== END MAP ===\n\n");
 }
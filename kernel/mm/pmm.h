@@ -2,8 +2,15 @@
  *
  * Physical Memory Manager (PMM) for ZENEDGE
  *
- * Uses a bitmap-based allocator for physical page frames.
- * Each bit represents a 4KB page (0=free, 1=used).
+ * A binary buddy allocator per NUMA node hands out naturally aligned
+ * blocks of 2^order pages, order 0 to PMM_MAX_ORDER; a page bitmap
+ * (0=free, 1=used) beside it catches double frees.
+ *
+ * The bitmaps are kept per section of PMM_SECTION_PAGES pages, sized at
+ * boot from the firmware memory map: a section with no usable memory in
+ * it (an MMIO hole, the gap below 4GB) costs one NULL pointer. On i386
+ * they live in the kernel image; on x86_64 what doesn't fit there is
+ * carved out of the first free memory below 4GB.
  *
  * Designed with NUMA awareness in mind - currently single-node
  * but the API supports future multi-node expansion.
@@ -18,9 +25,36 @@
 #define PAGE_SIZE       4096
 #define PAGE_SHIFT      12
 
-/* Maximum physical memory we can manage (256MB for now) */
+/* Maximum physical memory we can manage: on i386 what the kernel window
+ * maps, on x86_64 what the identity map reaches below the kernel's pdpt
+ * slot
+ */
+#ifdef __x86_64__
+#define PMM_MAX_MEMORY  (510ULL << 30)
+#else
 #define PMM_MAX_MEMORY  (256 * 1024 * 1024)
-#define PMM_MAX_PAGES   (PMM_MAX_MEMORY / PAGE_SIZE)
+#endif
+#define PMM_MAX_PAGES   ((uint32_t)(PMM_MAX_MEMORY / PAGE_SIZE))
+
+/* Bitmaps come in sections of 2^15 pages = 128MB; the first
+ * PMM_STATIC_SECTIONS are in the kernel image
+ */
+#define PMM_SECTION_SHIFT   15
+#define PMM_SECTION_PAGES   (1u << PMM_SECTION_SHIFT)
+#define PMM_STATIC_SECTIONS 2
+
+/* Largest buddy block: 2^10 pages = 4MB */
+#define PMM_MAX_ORDER   10
+
+/* Per-CPU page magazines: single pages are allocated from and freed to
+ * the running CPU's magazine for their node; an empty one is refilled
+ * with PMM_MAG_BATCH pages at once, and one above PMM_MAG_HIGH drains
+ * back to PMM_MAG_LOW
+ */
+#define PMM_MAG_SIZE    64
+#define PMM_MAG_BATCH   16      /* One order-4 block */
+#define PMM_MAG_HIGH    48
+#define PMM_MAG_LOW     16
 
 /* NUMA node IDs
  * We simulate 2 nodes by splitting physical memory in half:
@@ -32,8 +66,12 @@
 #define NUMA_NODE_ANY    0xFF  /* Let PMM choose */
 #define NUMA_MAX_NODES   2
 
-/* Physical address type */
+/* Physical address type: 32-bit on i386 (no PAE) */
+#ifdef __x86_64__
+typedef uint64_t paddr_t;
+#else
 typedef uint32_t paddr_t;
+#endif
 
 /* Memory region types (from multiboot) */
 typedef enum {
@@ -47,7 +85,7 @@ typedef enum {
 /* Memory region descriptor */
 typedef struct {
     paddr_t base;
-    uint32_t length;
+    uint64_t length;
     mem_region_type_t type;
 } mem_region_t;
 
@@ -57,9 +95,9 @@ typedef struct {
     paddr_t  base_addr;
     uint32_t start_pfn;     /* First PFN in this node */
     uint32_t end_pfn;       /* Last PFN + 1 in this node */
-    uint32_t total_pages;
-    uint32_t free_pages;
-    uint32_t used_pages;
+    uint32_t total_pages;   /* Usable pages, holes excluded */
+    uint32_t free_pages;    /* In the buddy lists */
+    uint32_t used_pages;    /* Includes pages in per-CPU magazines */
 } numa_node_t;
 
 /* PMM statistics */
@@ -68,10 +106,13 @@ typedef struct {
     uint32_t free_memory_kb;
     uint32_t used_memory_kb;
     uint32_t reserved_memory_kb;
-    uint32_t total_pages;
-    uint32_t free_pages;
+    uint32_t total_pages;       /* Usable pages, holes excluded */
+    uint32_t free_pages;        /* Includes cached_pages */
+    uint32_t cached_pages;      /* Free in per-CPU magazines */
     uint32_t num_regions;
     uint32_t num_nodes;
+    uint32_t num_sections;      /* With bitmaps, holes excluded */
+    uint32_t meta_kb;           /* Bitmaps and section table */
 } pmm_stats_t;
 
 /* Multiboot memory map entry (as provided by GRUB) */
@@ -100,12 +141,45 @@ typedef struct __attribute__((packed)) {
 #define MULTIBOOT_FLAG_MEM      (1 << 0)
 #define MULTIBOOT_FLAG_MMAP     (1 << 6)
 
+/* Multiboot2: the info is a list of 8-byte aligned tags after a
+ * {total_size, reserved} header; the memory map is one of them
+ */
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+#define MULTIBOOT2_TAG_END          0
+#define MULTIBOOT2_TAG_MMAP         6
+
+typedef struct __attribute__((packed)) {
+    uint32_t type;
+    uint32_t size;          /* Including this header */
+} multiboot2_tag_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t type;          /* MULTIBOOT2_TAG_MMAP */
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+    /* multiboot2_mmap_entry_t entries[] */
+} multiboot2_tag_mmap_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t base_addr;
+    uint64_t length;
+    uint32_t type;          /* Same values as multiboot 1 */
+    uint32_t reserved;
+} multiboot2_mmap_entry_t;
+
 /*
  * Initialize the physical memory manager
  * @param mboot_info: Pointer to multiboot info structure
  */
 void pmm_init(multiboot_info_t *mboot_info);
 
+/*
+ * Initialize the physical memory manager from multiboot2 info
+ * @param mbi: The info (below 4GB, reachable through the identity map)
+ */
+void pmm_init_multiboot2(const void *mbi);
+
 /*
  * Allocate a single physical page
  * @param node: NUMA node preference (NUMA_NODE_LOCAL for any)
@@ -115,6 +189,8 @@ paddr_t pmm_alloc_page(uint8_t node);
 
 /*
  * Allocate contiguous physical pages
+ * Up to 2^PMM_MAX_ORDER pages come from a buddy block, aligned to the
+ * power of two at or above count; larger runs are searched for linearly
  * @param count: Number of pages to allocate
  * @param node: NUMA node preference
  * @return: Physical address of first page, or 0 on failure
@@ -134,6 +210,11 @@ void pmm_free_page(paddr_t addr);
  */
 void pmm_free_pages(paddr_t addr, uint32_t count);
 
+/*
+ * Hand the running CPU's magazines back to the node allocator
+ */
+void pmm_drain_cpu_cache(void);
+
 /*
  * Get PMM statistics
  * @param stats: Pointer to stats structure to fill
@@ -152,6 +233,28 @@ numa_node_t *pmm_get_node(uint8_t node_id);
  */
 uint8_t pmm_get_node_count(void);
 
+/*
+ * Free buddy blocks of 2^order pages on a node
+ */
+uint32_t pmm_get_free_blocks(uint8_t node_id, uint32_t order);
+
+/*
+ * Fragmentation index of a node for an order, per mille: the share of
+ * its free pages in blocks too small for 2^order pages (0 = none, 1000 =
+ * no such block left although memory is free)
+ */
+uint32_t pmm_frag_index(uint8_t node_id, uint32_t order);
+
+/*
+ * Free pages in the per-CPU magazines of a node (NUMA_NODE_ANY = all)
+ */
+uint32_t pmm_get_cached_pages(uint8_t node_id);
+
+/*
+ * End of the highest usable page (what must be mapped to reach all of it)
+ */
+paddr_t pmm_get_phys_end(void);
+
 /*
  * Get which node a physical address belongs to
  */
@@ -163,7 +266,7 @@ uint8_t pmm_addr_to_node(paddr_t addr);
  * @param base: Start address (will be page-aligned down)
  * @param length: Length in bytes (will be page-aligned up)
  */
-void pmm_reserve_range(paddr_t base, uint32_t length);
+void pmm_reserve_range(paddr_t base, uint64_t length);
 
 /*
  * Debug: dump memory map to console
@@ -172,20 +275,20 @@ void pmm_dump_map(void);
 
 /* Convert between addresses and page frame numbers */
 static inline uint32_t addr_to_pfn(paddr_t addr) {
-    return addr >> PAGE_SHIFT;
+    return (uint32_t)(addr >> PAGE_SHIFT);
 }
 
 static inline paddr_t pfn_to_addr(uint32_t pfn) {
-    return (paddr_t)(pfn << PAGE_SHIFT);
+    return (paddr_t)pfn << PAGE_SHIFT;
 }
 
 /* Page-align addresses */
 static inline paddr_t page_align_down(paddr_t addr) {
-    return addr & ~(PAGE_SIZE - 1);
+    return addr & ~(paddr_t)(PAGE_SIZE - 1);
 }
 
 static inline paddr_t page_align_up(paddr_t addr) {
-    return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    return (addr + PAGE_SIZE - 1) & ~(paddr_t)(PAGE_SIZE - 1);
 }
 
 #endif /* ZENEDGE_PMM_H */
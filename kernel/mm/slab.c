@@ -0,0 +1,359 @@
+/* kernel/mm/slab.c
+ *
+ * Object caches for fixed-size kernel objects (see slab.h)
+ *
+ * A slab of 2^order pages starts with its slab_t, then a stack of free
+ * object indices, then the objects. Keeping the free list out of the
+ * objects means a free object keeps its constructed contents intact.
+ * Slabs come from pmm_alloc_pages(), whose buddy blocks are aligned to
+ * their size, so the slab of an object is its address rounded down.
+ */
+#include "slab.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "../arch/idt.h"
+#include "../arch/percpu.h"
+#include "../console.h"
+
+#define ALIGN_UP(x, a) (((x) + ((a)-1)) & ~((a)-1))
+
+typedef struct slab {
+  struct slab *next;
+  struct slab *prev;
+  kmem_cache_t *cache;
+  uint16_t inuse;             /* Objects not on the free stack */
+  uint16_t free_top;          /* Entries on the free stack */
+  uint16_t free_idx[];        /* Free object indices */
+} slab_t;
+
+/* Only its own CPU touches it, with interrupts off */
+typedef struct {
+  uint32_t count;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t hits;              /* Allocations without the cache lock */
+  void *objs[SLAB_CPU_OBJS];
+} cpu_cache_t;
+
+struct kmem_cache {
+  char name[KMEM_NAME_LEN];
+  uint32_t size;              /* Object stride */
+  uint32_t order;             /* Slab = 2^order pages */
+  uint32_t objs;              /* Objects per slab */
+  uint32_t obj_off;           /* First object from the slab start */
+  void (*ctor)(void *obj);
+
+  /* Under lock */
+  volatile uint32_t lock;
+  slab_t *partial;
+  slab_t *full;
+  slab_t *empty;              /* At most one */
+  uint32_t slabs;
+  uint32_t inuse;             /* Objects out of the slabs */
+
+  cpu_cache_t cpu[SMP_MAX_CPUS];
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static uint32_t num_caches = 0;
+
+static void cache_lock(kmem_cache_t *c) {
+  while (__atomic_exchange_n(&c->lock, 1, __ATOMIC_ACQUIRE)) {
+    __asm__ __volatile__("pause");
+  }
+}
+
+static void cache_unlock(kmem_cache_t *c) {
+  __atomic_store_n(&c->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Helper: slab list operations */
+static void slab_unlink(slab_t **head, slab_t *s) {
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if (s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = (slab_t *)0;
+}
+
+static void slab_push(slab_t **head, slab_t *s) {
+  s->prev = (slab_t *)0;
+  s->next = *head;
+  if (*head)
+    (*head)->prev = s;
+  *head = s;
+}
+
+/* Helper: the list a slab belongs on for its inuse count */
+static slab_t **slab_list(kmem_cache_t *c, slab_t *s) {
+  if (s->inuse == 0)
+    return &c->empty;
+  if (s->inuse == c->objs)
+    return &c->full;
+  return &c->partial;
+}
+
+static inline void *slab_obj(kmem_cache_t *c, slab_t *s, uint32_t idx) {
+  return (uint8_t *)s + c->obj_off + idx * c->size;
+}
+
+/* Internal: a new slab with every object constructed. Caller holds the
+ * lock
+ */
+static slab_t *slab_grow(kmem_cache_t *c) {
+  uint32_t pages = 1u << c->order;
+  paddr_t phys = pages == 1 ? pmm_alloc_page(NUMA_NODE_LOCAL)
+                            : pmm_alloc_pages(pages, NUMA_NODE_LOCAL);
+  if (!phys)
+    return (slab_t *)0;
+
+  slab_t *s = (slab_t *)phys_to_virt(phys);
+  s->next = s->prev = (slab_t *)0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free_top = (uint16_t)c->objs;
+  for (uint32_t i = 0; i < c->objs; i++) {
+    /* Lowest index on top */
+    s->free_idx[i] = (uint16_t)(c->objs - 1 - i);
+    if (c->ctor)
+      c->ctor(slab_obj(c, s, i));
+  }
+  c->slabs++;
+  return s;
+}
+
+/* Internal: an object out of the slabs. Caller holds the lock */
+static void *slab_take(kmem_cache_t *c) {
+  slab_t *s = c->partial;
+  if (!s) {
+    s = c->empty;
+    if (s) {
+      slab_unlink(&c->empty, s);
+    } else {
+      s = slab_grow(c);
+      if (!s)
+        return (void *)0;
+    }
+    slab_push(&c->partial, s);
+  }
+
+  void *obj = slab_obj(c, s, s->free_idx[--s->free_top]);
+  s->inuse++;
+  c->inuse++;
+  if (s->inuse == c->objs) {
+    slab_unlink(&c->partial, s);
+    slab_push(&c->full, s);
+  }
+  return obj;
+}
+
+/* Internal: an object back into its slab; a second empty slab goes back
+ * to the PMM. Caller holds the lock
+ */
+static void slab_put(kmem_cache_t *c, void *obj) {
+  uint32_t bytes = PAGE_SIZE << c->order;
+  slab_t *s = (slab_t *)((uintptr_t)obj & ~(uintptr_t)(bytes - 1));
+
+  slab_unlink(slab_list(c, s), s);
+  s->free_idx[s->free_top++] =
+      (uint16_t)(((uint8_t *)obj - (uint8_t *)s - c->obj_off) / c->size);
+  s->inuse--;
+  c->inuse--;
+
+  if (s->inuse == 0 && c->empty) {
+    c->slabs--;
+    if (c->order)
+      pmm_free_pages(virt_to_phys((vaddr_t)s), 1u << c->order);
+    else
+      pmm_free_page(virt_to_phys((vaddr_t)s));
+    return;
+  }
+  slab_push(slab_list(c, s), s);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *obj)) {
+  if (num_caches >= KMEM_MAX_CACHES || size == 0)
+    return (kmem_cache_t *)0;
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+  if (align & (align - 1))
+    return (kmem_cache_t *)0;
+
+  uint32_t stride = ALIGN_UP((uint32_t)size, (uint32_t)align);
+
+  /* Smallest slab holding SLAB_MIN_OBJS, or as many as the largest holds */
+  uint32_t order, objs = 0, off = 0;
+  for (order = 0; order <= SLAB_MAX_ORDER; order++) {
+    uint32_t bytes = PAGE_SIZE << order;
+    objs = (bytes - sizeof(slab_t)) / (stride + sizeof(uint16_t));
+    while (objs) {
+      off = ALIGN_UP(sizeof(slab_t) + objs * sizeof(uint16_t), align);
+      if (off + objs * stride <= bytes)
+        break;
+      objs--;
+    }
+    if (objs >= SLAB_MIN_OBJS)
+      break;
+  }
+  if (order > SLAB_MAX_ORDER)
+    order = SLAB_MAX_ORDER;
+  if (objs == 0 || objs > 0xFFFF) {
+    console_write("[slab] ERROR: object too large for a slab: ");
+    console_write(name);
+    console_write("\n");
+    return (kmem_cache_t *)0;
+  }
+
+  kmem_cache_t *c = &caches[num_caches++];
+  uint32_t i;
+  for (i = 0; name && name[i] && i < KMEM_NAME_LEN - 1; i++) {
+    c->name[i] = name[i];
+  }
+  c->name[i] = '\0';
+  c->size = stride;
+  c->order = order;
+  c->objs = objs;
+  c->obj_off = off;
+  c->ctor = ctor;
+  c->lock = 0;
+  c->partial = c->full = c->empty = (slab_t *)0;
+  c->slabs = 0;
+  c->inuse = 0;
+  for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    c->cpu[cpu].count = 0;
+    c->cpu[cpu].allocs = 0;
+    c->cpu[cpu].frees = 0;
+    c->cpu[cpu].hits = 0;
+  }
+  return c;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *c) {
+  if (!c)
+    return (void *)0;
+
+  int was = interrupts_enabled();
+  interrupts_disable();
+  cpu_cache_t *cc = &c->cpu[smp_cpu_id()];
+  void *obj = (void *)0;
+
+  if (cc->count) {
+    cc->hits++;
+  } else {
+    /* Refill a batch from the slabs */
+    cache_lock(c);
+    while (cc->count < SLAB_CPU_BATCH) {
+      void *o = slab_take(c);
+      if (!o)
+        break;
+      cc->objs[cc->count++] = o;
+    }
+    cache_unlock(c);
+  }
+  if (cc->count) {
+    obj = cc->objs[--cc->count];
+    cc->allocs++;
+  }
+
+  if (was)
+    interrupts_enable();
+  return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj) {
+  if (!c || !obj)
+    return;
+
+  uint32_t bytes = PAGE_SIZE << c->order;
+  slab_t *s = (slab_t *)((uintptr_t)obj & ~(uintptr_t)(bytes - 1));
+  if (s->cache != c) {
+    console_write("[slab] WARNING: freeing object to the wrong cache: ");
+    console_write(c->name);
+    console_write("\n");
+    return;
+  }
+
+  int was = interrupts_enabled();
+  interrupts_disable();
+  cpu_cache_t *cc = &c->cpu[smp_cpu_id()];
+
+  if (cc->count == SLAB_CPU_OBJS) {
+    /* Full: give the oldest batch back */
+    cache_lock(c);
+    for (uint32_t i = 0; i < SLAB_CPU_BATCH; i++) {
+      slab_put(c, cc->objs[i]);
+    }
+    cache_unlock(c);
+    for (uint32_t i = SLAB_CPU_BATCH; i < SLAB_CPU_OBJS; i++) {
+      cc->objs[i - SLAB_CPU_BATCH] = cc->objs[i];
+    }
+    cc->count -= SLAB_CPU_BATCH;
+  }
+  cc->objs[cc->count++] = obj;
+  cc->frees++;
+
+  if (was)
+    interrupts_enable();
+}
+
+void kmem_cache_get_stats(kmem_cache_t *c, kmem_cache_stats_t *out) {
+  if (!c || !out)
+    return;
+
+  uint32_t cached = 0, allocs = 0, frees = 0, hits = 0;
+  for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    cached += c->cpu[cpu].count;
+    allocs += c->cpu[cpu].allocs;
+    frees += c->cpu[cpu].frees;
+    hits += c->cpu[cpu].hits;
+  }
+
+  out->name = c->name;
+  out->obj_size = c->size;
+  out->objs_per_slab = c->objs;
+  out->slab_pages = 1u << c->order;
+  out->slabs = c->slabs;
+  out->active = c->inuse >= cached ? c->inuse - cached : 0;
+  out->free = c->slabs * c->objs - out->active;
+  out->cpu_cached = cached;
+  out->allocs = allocs;
+  out->frees = frees;
+  out->cpu_hits = hits;
+}
+
+void kmem_cache_dump(void) {
+  console_write("\n=== SLAB CACHES ===\n");
+  console_write("NAME             | SIZE | /SLAB | ACTIVE | FREE | SLABS | HITS/ALLOCS\n");
+
+  for (uint32_t i = 0; i < num_caches; i++) {
+    kmem_cache_stats_t st;
+    kmem_cache_get_stats(&caches[i], &st);
+
+    console_write(st.name);
+    uint32_t len = 0;
+    while (st.name[len])
+      len++;
+    for (; len < 17; len++) {
+      console_write(" ");
+    }
+    console_write("| ");
+    print_uint(st.obj_size);
+    console_write(" | ");
+    print_uint(st.objs_per_slab);
+    console_write(" | ");
+    print_uint(st.active);
+    console_write(" | ");
+    print_uint(st.free);
+    console_write(" | ");
+    print_uint(st.slabs);
+    console_write(" | ");
+    print_uint(st.cpu_hits);
+    console_write("/");
+    print_uint(st.allocs);
+    console_write("\n");
+  }
+  console_write("=== END SLAB ===\n\n");
+}
@@ -0,0 +1,80 @@
+/* kernel/mm/slab.h
+ *
+ * Object caches for fixed-size kernel objects
+ *
+ * A cache hands out objects of one size from slabs: naturally aligned
+ * runs of pages from the PMM (so a slab is found from any of its objects
+ * by masking the address), holding a header, a free index stack and the
+ * objects. Slabs are kept on partial, full and empty lists; at most one
+ * empty slab stays around, the rest go back to the PMM.
+ *
+ * In front of the slabs each CPU keeps a few objects per cache, so the
+ * common kmem_cache_alloc()/kmem_cache_free() is a push or pop with
+ * interrupts off; they move to and from the slabs SLAB_CPU_BATCH at a
+ * time under the cache's lock.
+ *
+ * The constructor, if any, runs once per object when its slab is built,
+ * not on every allocation: objects come back in whatever state they
+ * were freed in, so a cache with a constructor expects them freed in
+ * their constructed state.
+ */
+#ifndef ZENEDGE_SLAB_H
+#define ZENEDGE_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KMEM_MAX_CACHES   16
+#define KMEM_NAME_LEN     16
+#define SLAB_MAX_ORDER    3         /* Slabs of up to 8 pages */
+#define SLAB_MIN_OBJS     8         /* Objects a slab holds at least */
+#define SLAB_CPU_OBJS     16        /* Per-CPU objects per cache */
+#define SLAB_CPU_BATCH    8         /* Moved to/from the slabs at once */
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct {
+  const char *name;
+  uint32_t obj_size;        /* Rounded up to align */
+  uint32_t objs_per_slab;
+  uint32_t slab_pages;
+  uint32_t active;          /* Objects handed out */
+  uint32_t free;            /* Free in slabs and per-CPU caches */
+  uint32_t cpu_cached;      /* ... of which in per-CPU caches */
+  uint32_t slabs;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t cpu_hits;        /* Allocations served by a per-CPU cache */
+} kmem_cache_stats_t;
+
+/*
+ * Create a cache of objects of size bytes aligned to align (a power of
+ * two, 0 = pointer size); ctor(obj) builds each new object, may be NULL
+ * @return: The cache, or NULL if there are KMEM_MAX_CACHES already or
+ *          size is too large for a slab
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *obj));
+
+/*
+ * Allocate an object
+ * @return: The object, or NULL if the PMM is out of pages
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/*
+ * Free an object allocated from cache
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/*
+ * Get a cache's statistics
+ */
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *out);
+
+/*
+ * Debug: dump all caches to console
+ */
+void kmem_cache_dump(void);
+
+#endif /* ZENEDGE_SLAB_H */
@@ -14,7 +14,9 @@
  */
 #include "vmm.h"
 #include "pmm.h"
+#include "zpool.h"
 #include "../console.h"
+#include "../include/string.h"
 #include "../trace/flightrec.h"
 
 /* Kernel page directory - set up by boot code, refined here */
@@ -25,6 +27,14 @@ extern page_table_t boot_page_table_kernel;
 /* Current page directory physical address */
 static paddr_t current_pd_phys = 0;
 
+/* The kernel's own (boot) directory: the template user directories take
+ * their kernel half from
+ */
+static paddr_t kernel_pd_phys = 0;
+
+/* Mapping counters (see vmm_get_stats) */
+static vmm_stats_t stats;
+
 /* Read CR3 register */
 static inline paddr_t read_cr3(void) {
     paddr_t val;
@@ -61,6 +71,7 @@ void vmm_init(void) {
 
     /* Get current page directory from CR3 */
     current_pd_phys = read_cr3() & 0xFFFFF000;
+    kernel_pd_phys = current_pd_phys;
     page_directory_t *pd = (page_directory_t *)phys_to_virt(current_pd_phys);
 
     console_write("[vmm] current page directory at ");
@@ -112,44 +123,71 @@ void vmm_switch_pd(paddr_t pd_phys) {
 }
 
 /*
- * Map a single page
- * Allocates a page table if needed
+ * Helper: the page table under a directory entry, allocating it if there
+ * is none. A demand-zero directory entry becomes a table of demand-zero
+ * entries. Not for 4MB pages
  */
+static page_table_t *pt_get(page_directory_t *pd, uint32_t pde_idx) {
+    pde_t pde = pd->entries[pde_idx];
+    if (pde & PTE_PRESENT) {
+        return (page_table_t *)phys_to_virt(PTE_ADDR(pde));
+    }
+
+    /* An empty table comes zeroed from the pool */
+    pte_t fill = (pde & PTE_DEMAND) ? pde : 0;
+    paddr_t pt_phys = fill ? pmm_alloc_page(NUMA_NODE_LOCAL) : zpool_alloc();
+    if (pt_phys == 0) {
+        console_write("[vmm] ERROR: failed to allocate page table\n");
+        return (page_table_t *)0;
+    }
+
+    page_table_t *pt = (page_table_t *)phys_to_virt(pt_phys);
+    if (fill) {
+        for (int i = 0; i < PAGE_ENTRIES; i++) {
+            pt->entries[i] = fill;
+        }
+    }
+
+    /* Install the page table in the directory
+     * Page tables inherit user/write permissions from their entries */
+    pd->entries[pde_idx] = MAKE_PTE(pt_phys, PTE_PRESENT | PTE_WRITABLE | PTE_USER);
+    stats.page_tables++;
+    return pt;
+}
+
 /*
  * Map a single page
  * Allocates a page table if needed
  */
 int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
+    /* Get current page directory from HW to ensure we use the active one */
+    return vmm_map_page_in(read_cr3() & 0xFFFFF000, vaddr, paddr, flags);
+}
+
+int vmm_map_page_in(paddr_t pd_phys, vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
     uint32_t pde_idx = PDE_INDEX(vaddr);
     uint32_t pte_idx = PTE_INDEX(vaddr);
+    page_directory_t *pd = (page_directory_t *)phys_to_virt(pd_phys);
 
-    /* Get current page directory from HW to ensure we use the active one */
-    paddr_t active_pd_phys = read_cr3() & 0xFFFFF000;
-    page_directory_t *pd = (page_directory_t *)phys_to_virt(active_pd_phys);
+    /* Another directory's entries cannot be in the TLB (no PCIDs here) */
+    int active = pd_phys == (read_cr3() & 0xFFFFF000);
 
-    /* Check if page table exists */
-    if (!(pd->entries[pde_idx] & PTE_PRESENT)) {
-        /* Need to allocate a new page table */
-        paddr_t pt_phys = pmm_alloc_page(NUMA_NODE_LOCAL);
-        if (pt_phys == 0) {
-            console_write("[vmm] ERROR: failed to allocate page table\n");
-            return -1;
-        }
-
-        /* Zero out the new page table */
-        page_table_t *pt = (page_table_t *)phys_to_virt(pt_phys);
-        for (int i = 0; i < PAGE_ENTRIES; i++) {
-            pt->entries[i] = 0;
+    /* Already covered by a large page: fine if it maps the same frame */
+    if ((pd->entries[pde_idx] & (PTE_PRESENT | PTE_PSE)) == (PTE_PRESENT | PTE_PSE)) {
+        if (PDE_LARGE_ADDR(pd->entries[pde_idx]) + LARGE_PAGE_OFFSET(vaddr & 0xFFFFF000) ==
+            (paddr & 0xFFFFF000)) {
+            return 0;
         }
-
-        /* Install the page table in the directory
-         * Page tables inherit user/write permissions from their entries */
-        pd->entries[pde_idx] = MAKE_PTE(pt_phys, PTE_PRESENT | PTE_WRITABLE | PTE_USER);
+        console_write("[vmm] ERROR: ");
+        print_hex32(vaddr);
+        console_write(" is inside a 4MB page\n");
+        return -1;
     }
 
-    /* Get the page table */
-    paddr_t pt_phys = PTE_ADDR(pd->entries[pde_idx]);
-    page_table_t *pt = (page_table_t *)phys_to_virt(pt_phys);
+    page_table_t *pt = pt_get(pd, pde_idx);
+    if (!pt) {
+        return -1;
+    }
 
     /* Check if already mapped */
     if (pt->entries[pte_idx] & PTE_PRESENT) {
@@ -157,7 +195,9 @@ int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
         if (PTE_ADDR(pt->entries[pte_idx]) == (paddr & 0xFFFFF000)) {
             /* Same physical address, just update flags */
             pt->entries[pte_idx] = MAKE_PTE(paddr, flags);
-            vmm_invlpg(vaddr);
+            if (active) {
+                vmm_invlpg(vaddr);
+            }
             return 0;
         }
         console_write("[vmm] WARNING: remapping ");
@@ -167,12 +207,15 @@ int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
 
     /* Create the mapping */
     pt->entries[pte_idx] = MAKE_PTE(paddr, flags);
-    vmm_invlpg(vaddr);
+    if (active) {
+        vmm_invlpg(vaddr);
+    }
+    stats.small_pages++;
 
     return 0;
 }
 
-int vmm_map_range(vaddr_t vaddr, paddr_t paddr, uint32_t size, uint32_t flags) {
+int vmm_map_range(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags) {
     vaddr_t va = vaddr & ~(PAGE_SIZE - 1);
     paddr_t pa = paddr & ~(PAGE_SIZE - 1);
     uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
@@ -188,6 +231,168 @@ int vmm_map_range(vaddr_t vaddr, paddr_t paddr, uint32_t size, uint32_t flags) {
     return 0;
 }
 
+int vmm_map_range_large(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags) {
+    vaddr_t va = vaddr & ~(PAGE_SIZE - 1);
+    paddr_t pa = paddr & ~(PAGE_SIZE - 1);
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    const uint32_t large_pages = LARGE_PAGE_SIZE / PAGE_SIZE;
+
+    paddr_t active_pd_phys = read_cr3() & 0xFFFFF000;
+    page_directory_t *pd = (page_directory_t *)phys_to_virt(active_pd_phys);
+
+    while (pages > 0) {
+        uint32_t pde_idx = PDE_INDEX(va);
+        pde_t pde = pd->entries[pde_idx];
+
+        /* Whole, aligned 4MB slot with no page table in it: one PDE */
+        if (pages >= large_pages && LARGE_PAGE_OFFSET(va) == 0 &&
+            LARGE_PAGE_OFFSET(pa) == 0 &&
+            (!(pde & PTE_PRESENT) || (pde & PTE_PSE))) {
+            if (pde & PTE_PRESENT) {
+                if (PDE_LARGE_ADDR(pde) != pa) {
+                    console_write("[vmm] WARNING: remapping ");
+                    print_hex32(va);
+                    console_write("\n");
+                }
+            } else {
+                stats.large_pages++;
+            }
+            pd->entries[pde_idx] = PDE_LARGE_ADDR(pa) | (flags & 0xFFF) | PTE_PSE;
+            vmm_invlpg(va);
+            va += LARGE_PAGE_SIZE;
+            pa += LARGE_PAGE_SIZE;
+            pages -= large_pages;
+            continue;
+        }
+
+        if (vmm_map_page(va, pa, flags) != 0) {
+            return -1;
+        }
+        va += PAGE_SIZE;
+        pa += PAGE_SIZE;
+        pages--;
+    }
+
+    return 0;
+}
+
+void vmm_get_stats(vmm_stats_t *out) {
+    *out = stats;
+}
+
+int vmm_reserve_range(vaddr_t vaddr, size_t size, uint32_t flags) {
+    return vmm_reserve_range_in(read_cr3() & 0xFFFFF000, vaddr, size, flags);
+}
+
+int vmm_reserve_range_in(paddr_t pd_phys, vaddr_t vaddr, size_t size, uint32_t flags) {
+    vaddr_t va = vaddr & ~(PAGE_SIZE - 1);
+    vaddr_t end = (vaddr + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    pte_t marker = (flags & (PTE_WRITABLE | PTE_USER)) | PTE_DEMAND;
+
+    page_directory_t *pd = (page_directory_t *)phys_to_virt(pd_phys);
+
+    while (va < end) {
+        uint32_t pde_idx = PDE_INDEX(va);
+        pde_t pde = pd->entries[pde_idx];
+
+        /* Whole, aligned 4MB slot with no page table in it: one PDE */
+        if (LARGE_PAGE_OFFSET(va) == 0 && end - va >= LARGE_PAGE_SIZE &&
+            !(pde & PTE_PRESENT)) {
+            pd->entries[pde_idx] = marker;
+            va += LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        if (pde & PTE_PSE) {
+            console_write("[vmm] ERROR: ");
+            print_hex32(va);
+            console_write(" is inside a 4MB page\n");
+            return -1;
+        }
+        page_table_t *pt = pt_get(pd, pde_idx);
+        if (!pt) {
+            return -1;
+        }
+
+        /* Rest of this table's 4MB, or of the range */
+        do {
+            pte_t *pte = &pt->entries[PTE_INDEX(va)];
+            if (!(*pte & PTE_PRESENT)) {
+                *pte = marker;
+            }
+            va += PAGE_SIZE;
+        } while (va < end && LARGE_PAGE_OFFSET(va) != 0);
+    }
+
+    return 0;
+}
+
+int vmm_share_range(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags) {
+    uint32_t share = (flags & ~PTE_WRITABLE) | PTE_SHARED;
+    if (flags & PTE_WRITABLE) {
+        share |= PTE_COW;
+    }
+    return vmm_map_range(vaddr, paddr, size, share);
+}
+
+int vmm_handle_fault(vaddr_t vaddr, uint32_t err) {
+    if (vaddr >= KERNEL_VBASE) {
+        return -1;
+    }
+
+    uint32_t pde_idx = PDE_INDEX(vaddr);
+    vaddr_t page = vaddr & ~(PAGE_SIZE - 1);
+
+    paddr_t active_pd_phys = read_cr3() & 0xFFFFF000;
+    page_directory_t *pd = (page_directory_t *)phys_to_virt(active_pd_phys);
+
+    pde_t pde = pd->entries[pde_idx];
+    if (!(pde & (PTE_PRESENT | PTE_DEMAND)) || (pde & PTE_PSE)) {
+        return -1;
+    }
+    page_table_t *pt = pt_get(pd, pde_idx);
+    if (!pt) {
+        return -1;
+    }
+    pte_t *pte = &pt->entries[PTE_INDEX(vaddr)];
+    pte_t old = *pte;
+
+    if (!(old & PTE_PRESENT)) {
+        /* Demand-zero: first touch */
+        if (!(old & PTE_DEMAND) ||
+            ((err & PF_USER) && !(old & PTE_USER)) ||
+            ((err & PF_WRITE) && !(old & PTE_WRITABLE))) {
+            return -1;
+        }
+        paddr_t phys = zpool_alloc();
+        if (phys == 0) {
+            return -1;
+        }
+        *pte = MAKE_PTE(phys, PTE_PRESENT | (old & (PTE_WRITABLE | PTE_USER)));
+        vmm_invlpg(page);
+        stats.demand_faults++;
+        return 1;
+    }
+
+    if ((err & PF_WRITE) && (old & PTE_COW)) {
+        if ((err & PF_USER) && !(old & PTE_USER)) {
+            return -1;
+        }
+        /* Copy-on-write: the copy is the process's own */
+        paddr_t phys = pmm_alloc_page(NUMA_NODE_LOCAL);
+        if (phys == 0) {
+            return -1;
+        }
+        memcpy((void *)phys_to_virt(phys), (const void *)phys_to_virt(PTE_ADDR(old)), PAGE_SIZE);
+        *pte = MAKE_PTE(phys, PTE_PRESENT | PTE_WRITABLE | (old & PTE_USER));
+        vmm_invlpg(page);
+        stats.cow_faults++;
+        return 1;
+    }
+
+    return -1;
+}
+
 paddr_t vmm_unmap_page(vaddr_t vaddr) {
     uint32_t pde_idx = PDE_INDEX(vaddr);
     uint32_t pte_idx = PTE_INDEX(vaddr);
@@ -199,6 +404,10 @@ paddr_t vmm_unmap_page(vaddr_t vaddr) {
         return 0;  /* Page table doesn't exist */
     }
 
+    if (pd->entries[pde_idx] & PTE_PSE) {
+        return 0;  /* Part of a 4MB page; not unmapped piecemeal */
+    }
+
     paddr_t pt_phys = PTE_ADDR(pd->entries[pde_idx]);
     page_table_t *pt = (page_table_t *)phys_to_virt(pt_phys);
 
@@ -213,6 +422,59 @@ paddr_t vmm_unmap_page(vaddr_t vaddr) {
     return old_paddr;
 }
 
+void vmm_unmap_range(vaddr_t vaddr, size_t size) {
+    vaddr_t va = vaddr & ~(PAGE_SIZE - 1);
+    vaddr_t end = (vaddr + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t cleared = 0;
+
+    paddr_t active_pd_phys = read_cr3() & 0xFFFFF000;
+    page_directory_t *pd = (page_directory_t *)phys_to_virt(active_pd_phys);
+
+    while (va < end) {
+        uint32_t pde_idx = PDE_INDEX(va);
+        pde_t pde = pd->entries[pde_idx];
+        vaddr_t slot_end = (va & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+        int whole = LARGE_PAGE_OFFSET(va) == 0 && end - va >= LARGE_PAGE_SIZE;
+
+        if (!(pde & PTE_PRESENT) || (pde & PTE_PSE)) {
+            if (whole) {
+                if (pde & PTE_PRESENT) {
+                    cleared += LARGE_PAGE_SIZE / PAGE_SIZE;
+                }
+                pd->entries[pde_idx] = 0;
+                va = slot_end;
+                continue;
+            }
+            if (!(pde & PTE_DEMAND) || (pde & PTE_PRESENT)) {
+                va = slot_end;
+                continue;
+            }
+        }
+
+        /* Part of a slot (or a table in it): entry by entry */
+        page_table_t *pt = pt_get(pd, pde_idx);
+        if (!pt) {
+            return;
+        }
+        for (; va < end && va < slot_end; va += PAGE_SIZE) {
+            pte_t *pte = &pt->entries[PTE_INDEX(va)];
+            if (*pte & PTE_PRESENT) {
+                cleared++;
+            }
+            *pte = 0;
+        }
+    }
+
+    /* Past a few dozen pages one flush beats walking the range again */
+    if (cleared > 32) {
+        vmm_flush_tlb();
+    } else if (cleared) {
+        for (va = vaddr & ~(PAGE_SIZE - 1); va < end; va += PAGE_SIZE) {
+            vmm_invlpg(va);
+        }
+    }
+}
+
 paddr_t vmm_virt_to_phys(vaddr_t vaddr) {
     uint32_t pde_idx = PDE_INDEX(vaddr);
     uint32_t pte_idx = PTE_INDEX(vaddr);
@@ -224,6 +486,10 @@ paddr_t vmm_virt_to_phys(vaddr_t vaddr) {
         return 0;
     }
 
+    if (pd->entries[pde_idx] & PTE_PSE) {
+        return PDE_LARGE_ADDR(pd->entries[pde_idx]) | LARGE_PAGE_OFFSET(vaddr);
+    }
+
     paddr_t pt_phys = PTE_ADDR(pd->entries[pde_idx]);
     page_table_t *pt = (page_table_t *)phys_to_virt(pt_phys);
 
@@ -239,48 +505,25 @@ int vmm_is_mapped(vaddr_t vaddr) {
 }
 
 paddr_t vmm_create_user_pd(void) {
-    /* Allocate a page for the new directory */
-    paddr_t pd_phys = pmm_alloc_page(NUMA_NODE_LOCAL);
+    /* User space entries come zeroed with the page */
+    paddr_t pd_phys = zpool_alloc();
     if (pd_phys == 0) {
         return 0;
     }
 
-    console_write("[vmm] new user PD at phys ");
-    print_hex32(pd_phys);
-    console_write(" (virt ");
-    print_hex32(phys_to_virt(pd_phys));
-    console_write(")\n");
-
     page_directory_t *new_pd = (page_directory_t *)phys_to_virt(pd_phys);
-    page_directory_t *kernel_pd = (page_directory_t *)phys_to_virt(current_pd_phys);
-
-    console_write("[vmm] kernel PD at phys ");
-    print_hex32(current_pd_phys);
-    console_write(" (virt ");
-    print_hex32((uint32_t)kernel_pd);
-    console_write(")\n");
-
-    /* Clear user space entries (except PDE[0] which we copy for VGA access) */
-    for (uint32_t i = 1; i < KERNEL_VBASE_PDE; i++) {
-        new_pd->entries[i] = 0;
-    }
+    page_directory_t *kernel_pd = (page_directory_t *)phys_to_virt(kernel_pd_phys);
 
     /* Copy PDE[0] - identity map for first 4MB (needed for VGA memory at 0xB8000)
      * This is a PSE 4MB page set up by boot code
      */
     new_pd->entries[0] = kernel_pd->entries[0];
 
-    /* Share kernel space entries (PDE 768+) - these are 4MB PSE pages */
-    for (uint32_t i = KERNEL_VBASE_PDE; i < PAGE_ENTRIES; i++) {
-        new_pd->entries[i] = kernel_pd->entries[i];
-    }
-
-    /* Debug: print PDE[768] to verify kernel mapping is copied */
-    console_write("[vmm] kernel_pd[768] = ");
-    print_hex32(kernel_pd->entries[KERNEL_VBASE_PDE]);
-    console_write(", new_pd[768] = ");
-    print_hex32(new_pd->entries[KERNEL_VBASE_PDE]);
-    console_write("\n");
+    /* Share kernel space entries (PDE 768+): the 4MB pages and tables
+     * under them are the kernel directory's, only the entries are copied
+     */
+    memcpy(&new_pd->entries[KERNEL_VBASE_PDE], &kernel_pd->entries[KERNEL_VBASE_PDE],
+           (PAGE_ENTRIES - KERNEL_VBASE_PDE) * sizeof(pde_t));
 
     return pd_phys;
 }
@@ -299,9 +542,9 @@ void vmm_destroy_user_pd(paddr_t pd_phys) {
             paddr_t pt_phys = PTE_ADDR(pd->entries[pde_idx]);
             page_table_t *pt = (page_table_t *)phys_to_virt(pt_phys);
 
-            /* Free all mapped pages */
+            /* Free all mapped pages the process owns */
             for (uint32_t pte_idx = 0; pte_idx < PAGE_ENTRIES; pte_idx++) {
-                if (pt->entries[pte_idx] & PTE_PRESENT) {
+                if ((pt->entries[pte_idx] & (PTE_PRESENT | PTE_SHARED)) == PTE_PRESENT) {
                     pmm_free_page(PTE_ADDR(pt->entries[pte_idx]));
                 }
             }
@@ -343,3 +586,26 @@ void vmm_dump_pd(paddr_t pd_phys) {
     print_uint(mapped_count);
     console_write("\n=== END DUMP ===\n");
 }
+
+void vmm_dump_stats(void) {
+    console_write("[vmm] 4MB pages: ");
+    print_uint(stats.large_pages);
+    console_write(", 4KB pages: ");
+    print_uint(stats.small_pages);
+    console_write(", page tables: ");
+    print_uint(stats.page_tables);
+    console_write(", demand-zero: ");
+    print_uint(stats.demand_faults);
+    console_write(", copy-on-write: ");
+    print_uint(stats.cow_faults);
+
+    zpool_stats_t z;
+    zpool_get_stats(&z);
+    console_write("\n[vmm] zeroed pages pooled: ");
+    print_uint(z.pooled);
+    console_write(", taken: ");
+    print_uint(z.hits);
+    console_write(", zeroed on the spot: ");
+    print_uint(z.misses);
+    console_write("\n");
+}
@@ -5,11 +5,17 @@
  * Implements x86 32-bit paging with:
  * - Two-level page tables (Page Directory + Page Tables)
  * - Higher-half kernel mapping at 0xC0000000
- * - 4KB pages (no PSE/large pages for simplicity)
+ * - 4KB pages, plus 4MB PSE pages for large physically contiguous ranges
  *
  * Virtual address space layout:
  *   0x00000000 - 0xBFFFFFFF: User space (3GB)
  *   0xC0000000 - 0xFFFFFFFF: Kernel space (1GB)
+ *
+ * On x86_64 (vmm64.c) the tables are the 4-level ones with 512 64-bit
+ * entries. The boot page tables identity-map the first 4GB and
+ * vmm_init() extends that to all of physical memory, so physical and
+ * kernel virtual addresses are the same there. The same PTE_* flags
+ * apply to both.
  */
 #ifndef ZENEDGE_VMM_H
 #define ZENEDGE_VMM_H
@@ -19,7 +25,7 @@
 #include "pmm.h"
 
 /* Virtual address type */
-typedef uint32_t vaddr_t;
+typedef uintptr_t vaddr_t;
 
 /* Higher-half kernel base */
 #define KERNEL_VBASE        0xC0000000
@@ -30,6 +36,8 @@ typedef uint32_t vaddr_t;
 #define PDE_INDEX(va)       (((va) >> 22) & 0x3FF)
 #define PTE_INDEX(va)       (((va) >> 12) & 0x3FF)
 #define PAGE_OFFSET(va)     ((va) & 0xFFF)
+#define LARGE_PAGE_SIZE     0x400000    /* One PSE PDE maps 4MB */
+#define LARGE_PAGE_OFFSET(va) ((va) & (LARGE_PAGE_SIZE - 1))
 
 /* Page table entry flags (x86) */
 #define PTE_PRESENT         (1 << 0)    /* Page is present in memory */
@@ -41,6 +49,22 @@ typedef uint32_t vaddr_t;
 #define PTE_DIRTY           (1 << 6)    /* Page was written (set by CPU) */
 #define PTE_PSE             (1 << 7)    /* Page Size Extension (4MB page) */
 #define PTE_GLOBAL          (1 << 8)    /* Global page (not flushed on CR3 reload) */
+#define PTE_NO_EXEC         (1 << 11)   /* NX on x86_64 (bit 63); ignored on i386 */
+
+/* Software bits (the MMU ignores 9-11) for user memory, i386 only. A
+ * present entry can be PTE_SHARED (the frame is not the process's and
+ * is not freed with it) and PTE_COW (read-only until written, then
+ * copied). A non-present entry, PDE or PTE, with PTE_DEMAND is
+ * demand-zero: its PTE_WRITABLE/PTE_USER are those of the page-to-be.
+ */
+#define PTE_COW             (1 << 9)
+#define PTE_DEMAND          (1 << 9)    /* Non-present entries only */
+#define PTE_SHARED          (1 << 10)
+
+/* Page fault error code */
+#define PF_PROTECTION       (1 << 0)    /* Clear: page not present */
+#define PF_WRITE            (1 << 1)
+#define PF_USER             (1 << 2)
 
 /* Common flag combinations */
 #define PTE_KERNEL          (PTE_PRESENT | PTE_WRITABLE)
@@ -56,6 +80,7 @@ typedef uint32_t pte_t;
 
 /* Extract physical address from PDE/PTE */
 #define PTE_ADDR(entry)     ((entry) & 0xFFFFF000)
+#define PDE_LARGE_ADDR(entry) ((entry) & 0xFFC00000)
 
 /* Create a PDE/PTE from physical address and flags */
 #define MAKE_PTE(paddr, flags)  (((paddr) & 0xFFFFF000) | (flags))
@@ -82,6 +107,12 @@ typedef struct __attribute__((aligned(4096))) {
  */
 void vmm_init(void);
 
+/*
+ * Per-CPU paging setup on x86_64 (NX, PCIDs): vmm_init() does the BSP,
+ * each AP calls it before touching memory mapped above 4GB
+ */
+void vmm_cpu_init(void);
+
 /*
  * Get the current page directory physical address
  */
@@ -89,6 +120,8 @@ paddr_t vmm_get_current_pd(void);
 
 /*
  * Switch to a different page directory
+ * On x86_64 with PCIDs, switching back to one of the last few address
+ * spaces a CPU ran keeps their TLB entries (see vmm64.c)
  * @param pd_phys: Physical address of new page directory
  */
 void vmm_switch_pd(paddr_t pd_phys);
@@ -102,6 +135,13 @@ void vmm_switch_pd(paddr_t pd_phys);
  */
 int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags);
 
+/*
+ * Map a page in the address space pd_phys, active or not, without
+ * switching to it
+ * @return: 0 on success, -1 on failure
+ */
+int vmm_map_page_in(paddr_t pd_phys, vaddr_t vaddr, paddr_t paddr, uint32_t flags);
+
 /*
  * Map a range of virtual addresses to physical addresses
  * @param vaddr: Starting virtual address
@@ -110,7 +150,76 @@ int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags);
  * @param flags: Page table flags
  * @return: 0 on success, -1 on failure
  */
-int vmm_map_range(vaddr_t vaddr, paddr_t paddr, uint32_t size, uint32_t flags);
+int vmm_map_range(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags);
+
+/*
+ * Map a range like vmm_map_range, but with 4MB PSE pages wherever vaddr and
+ * paddr are both 4MB aligned and a whole large page remains. The unaligned
+ * head and tail, and any 4MB slot that already has a page table, fall back
+ * to 4KB pages. Use it for big device windows and contiguous buffers: each
+ * large page is one TLB entry where 4KB pages would take 1024, and it
+ * needs no page table.
+ *
+ * On x86_64 both calls pick the largest page that fits at each step
+ * (1GB where the CPU has them, 2MB, else 4KB), split a large page only
+ * where a smaller mapping has to go inside it, write the tables in one
+ * pass and flush the TLB once at the end, and only if a live entry
+ * changed.
+ * @return: 0 on success, -1 on failure
+ */
+int vmm_map_range_large(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags);
+
+/*
+ * Mapping counters, for judging TLB reach
+ */
+typedef struct {
+    uint32_t large_pages;       /* 4MB (i386) / 2MB (x86_64) pages installed */
+    uint32_t small_pages;       /* 4KB PTEs installed */
+    uint32_t page_tables;       /* Page-table pages allocated */
+    uint32_t huge_pages;        /* 1GB pages installed (x86_64) */
+    uint32_t splits;            /* Large pages broken up (x86_64) */
+    uint32_t tlb_flushes;       /* Full flushes by bulk mappings (x86_64) */
+    uint32_t demand_faults;     /* Demand-zero pages filled in (i386) */
+    uint32_t cow_faults;        /* Shared pages copied on write (i386) */
+    uint32_t switches;          /* vmm_switch_pd() calls (x86_64) */
+    uint32_t switches_noflush;  /* Of those, kept the TLB thanks to PCIDs */
+} vmm_stats_t;
+
+void vmm_get_stats(vmm_stats_t *stats);
+
+/*
+ * Reserve demand-zero memory: nothing is allocated until a page is first
+ * touched, when vmm_handle_fault() gives it a zeroed frame. A whole,
+ * aligned 4MB slot costs one directory entry. Pages already mapped are
+ * left alone
+ * @param flags: PTE_WRITABLE/PTE_USER of the pages
+ * @return: 0 on success, -1 if out of memory for page tables or the
+ *          range crosses a 4MB page
+ */
+int vmm_reserve_range(vaddr_t vaddr, size_t size, uint32_t flags);
+
+/*
+ * vmm_reserve_range() in the address space pd_phys, active or not
+ */
+int vmm_reserve_range_in(paddr_t pd_phys, vaddr_t vaddr, size_t size, uint32_t flags);
+
+/*
+ * Map frames owned elsewhere (agent code, model weights) read-only and
+ * PTE_SHARED, so many address spaces can map them and destroying one
+ * does not free them. With PTE_WRITABLE the pages are copy-on-write: the
+ * first write gives the process its own copy. The frames must outlive
+ * every address space they are mapped in
+ */
+int vmm_share_range(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags);
+
+/*
+ * Resolve a page fault on a user address in the active address space
+ * @param vaddr: Faulting address (CR2)
+ * @param err: Page fault error code (PF_*)
+ * @return: Frames the process gained (1 for a demand-zero or a
+ *          copy-on-write page), or -1 if the fault is a real one
+ */
+int vmm_handle_fault(vaddr_t vaddr, uint32_t err);
 
 /*
  * Unmap a virtual address
@@ -119,6 +228,15 @@ int vmm_map_range(vaddr_t vaddr, paddr_t paddr, uint32_t size, uint32_t flags);
  */
 paddr_t vmm_unmap_page(vaddr_t vaddr);
 
+/*
+ * Unmap every page of a range, 4KB or large, with one TLB flush when
+ * there are many. Frames are not freed: they are the caller's (see
+ * vmm_unmap_page() to get them back one at a time). Large pages only
+ * partly inside the range are split on x86_64 and left alone on i386;
+ * demand-zero reservations inside it are dropped
+ */
+void vmm_unmap_range(vaddr_t vaddr, size_t size);
+
 /*
  * Get the physical address for a virtual address
  * @param vaddr: Virtual address to translate
@@ -146,13 +264,18 @@ void vmm_flush_tlb(void);
 
 /*
  * Create a new page directory for a user process
- * Kernel mappings (>= KERNEL_VBASE) are shared
+ * Kernel mappings (>= KERNEL_VBASE) are shared. On x86_64 it is a PML4
+ * sharing the kernel half and the identity map (PML4[0], supervisor
+ * only); the process gets PML4[1..255]. On i386 the directory is a
+ * pre-zeroed page (zpool.h) with the kernel directory's entries copied
+ * into its kernel half
  * @return: Physical address of new page directory, or 0 on failure
  */
 paddr_t vmm_create_user_pd(void);
 
 /*
  * Destroy a user page directory and free all user-space pages
+ * (PTE_SHARED frames are left to their owner)
  * @param pd_phys: Physical address of page directory to destroy
  */
 void vmm_destroy_user_pd(paddr_t pd_phys);
@@ -162,7 +285,11 @@ void vmm_destroy_user_pd(paddr_t pd_phys);
  * Only works for addresses within the identity-mapped kernel region
  */
 static inline vaddr_t phys_to_virt(paddr_t paddr) {
+#ifdef __x86_64__
+    return (vaddr_t)paddr;
+#else
     return (vaddr_t)(paddr + KERNEL_VBASE);
+#endif
 }
 
 /*
@@ -170,7 +297,11 @@ static inline vaddr_t phys_to_virt(paddr_t paddr) {
  * Only works for addresses within the identity-mapped kernel region
  */
 static inline paddr_t virt_to_phys(vaddr_t vaddr) {
+#ifdef __x86_64__
+    return (paddr_t)vaddr;
+#else
     return (paddr_t)(vaddr - KERNEL_VBASE);
+#endif
 }
 
 /*
@@ -178,4 +309,9 @@ static inline paddr_t virt_to_phys(vaddr_t vaddr) {
  */
 void vmm_dump_pd(paddr_t pd_phys);
 
+/*
+ * Debug: print mapping counters to console
+ */
+void vmm_dump_stats(void);
+
 #endif /* ZENEDGE_VMM_H */
@@ -0,0 +1,693 @@
+/* kernel/mm/vmm64.c
+ *
+ * Virtual Memory Manager for x86_64 (see vmm.h)
+ *
+ * The boot code (arch/x86_64/boot/start.s) enters long mode with one
+ * PML4: PML4[0] identity-maps the first 4GB with 2MB pages and PML4[511]
+ * holds the kernel at KERN_BASE, both through the same PDPT. vmm_init()
+ * takes that PML4 over as the kernel's and extends the identity map to
+ * all of physical memory, so page tables are reached by their physical
+ * address (phys_to_virt() is the identity).
+ *
+ * Tables below a leaf are allocated from the PMM as they are needed. A
+ * leaf is a 1GB PDPT entry, a 2MB PD entry or a 4KB PT entry; mappings
+ * use the largest that alignment and size allow, and a large page is
+ * split into 512 of the next size down only when something smaller has
+ * to go inside it.
+ *
+ * With PCIDs, TLB entries are tagged with the address space they belong
+ * to, so switching back to a recent one keeps its entries. Each CPU
+ * hands PCIDs 1..PCID_SLOTS round-robin to the address spaces it
+ * switches to; the kernel's PML4 is always PCID 0. A CR3 write reusing a
+ * PCID for a new owner flushes what the old one left behind; one
+ * switching to the PCID's owner sets the no-flush bit.
+ */
+#include "vmm.h"
+#include "pmm.h"
+#include "../arch/idt.h"
+#include "../arch/percpu.h"
+#include "../console.h"
+#include "../trace/flightrec.h"
+
+typedef uint64_t pte64_t;
+
+#define PT_ENTRIES      512
+#define PT_ADDR_MASK    0x000FFFFFFFFFF000ull
+#define PT_NX           (1ull << 63)
+#define PT_TABLE_FLAGS  (PTE_PRESENT | PTE_WRITABLE | PTE_USER)
+
+/* Leaf flags we take from callers; A/D are the CPU's */
+#define PT_LEAF_FLAGS   (PTE_PRESENT | PTE_WRITABLE | PTE_USER | \
+                         PTE_WRITE_THROUGH | PTE_CACHE_DISABLE | PTE_GLOBAL)
+
+/* Level 0 = PT (4KB), 1 = PD (2MB), 2 = PDPT (1GB), 3 = PML4 */
+#define LEVEL_SHIFT(l)  (12 + 9 * (l))
+#define LEVEL_SIZE(l)   (1ull << LEVEL_SHIFT(l))
+#define LEVEL_IDX(va, l) (((uint64_t)(va) >> LEVEL_SHIFT(l)) & (PT_ENTRIES - 1))
+
+#define GB              (1ull << 30)
+
+#define EFER_MSR        0xC0000080
+#define EFER_NXE        (1u << 11)
+#define CR4_PGE         (1u << 7)
+#define CR4_PCIDE       (1u << 17)
+#define CR3_NOFLUSH     (1ull << 63)
+
+#define INVPCID_ADDR    0       /* One address in one PCID */
+#define INVPCID_ALL     2       /* Everything, global pages included */
+
+#define PCID_SLOTS      8
+
+/* The kernel's PML4 (the boot one) */
+static paddr_t kernel_pml4_phys = 0;
+
+/* CPU features */
+static int has_gb_pages = 0;
+static int has_nx = 0;
+static int has_pcid = 0;
+static int has_invpcid = 0;
+
+/* Per CPU: the address space owning each PCID (0 = none) and the slot
+ * to give away next. Only its own CPU touches it, with interrupts off
+ */
+static paddr_t pcid_owner[SMP_MAX_CPUS][PCID_SLOTS];
+static uint32_t pcid_next[SMP_MAX_CPUS];
+
+/* Mapping counters (see vmm_get_stats) */
+static vmm_stats_t stats;
+
+static inline paddr_t read_cr3(void) {
+    uint64_t val;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(val));
+    return (paddr_t)val;
+}
+
+static inline void write_cr3(uint64_t val) {
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(val) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t val;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(uint64_t val) {
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(val) : "memory");
+}
+
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = {pcid, addr};
+    __asm__ __volatile__("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
+void vmm_invlpg(vaddr_t vaddr) {
+    __asm__ __volatile__("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
+
+/* Flush entire TLB, global pages and every PCID included */
+void vmm_flush_tlb(void) {
+    if (has_invpcid) {
+        invpcid(INVPCID_ALL, 0, 0);
+        return;
+    }
+    uint64_t cr4 = read_cr4();
+    if (cr4 & (CR4_PGE | CR4_PCIDE)) {
+        /* Any change to PGE flushes everything */
+        write_cr4(cr4 ^ CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+/* Helper: drop one page from this CPU's TLB. The identity map (PML4[0])
+ * and the kernel half are in every address space, so their entries can
+ * be cached under any PCID, not just the current one
+ */
+static void tlb_drop(uint64_t va) {
+    uint64_t idx = LEVEL_IDX(va, 3);
+    vmm_invlpg(va);
+    if (!has_pcid || (idx > 0 && idx < PT_ENTRIES / 2))
+        return;
+    if (!has_invpcid) {
+        vmm_flush_tlb();
+        return;
+    }
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+    paddr_t *owner = pcid_owner[smp_cpu_id()];
+    invpcid(INVPCID_ADDR, 0, va);
+    for (uint32_t slot = 0; slot < PCID_SLOTS; slot++) {
+        if (owner[slot])
+            invpcid(INVPCID_ADDR, slot + 1, va);
+    }
+    if (was)
+        interrupts_enable();
+}
+
+static inline pte64_t *table_at(paddr_t phys) {
+    return (pte64_t *)phys_to_virt(phys);
+}
+
+static inline pte64_t *active_pml4(void) {
+    return table_at(read_cr3() & PT_ADDR_MASK);
+}
+
+/* Helper: PTE_* flags to the bits of a leaf entry */
+static pte64_t leaf_bits(uint32_t flags) {
+    pte64_t bits = flags & PT_LEAF_FLAGS;
+    if ((flags & PTE_NO_EXEC) && has_nx)
+        bits |= PT_NX;
+    return bits;
+}
+
+/* Helper: physical address a leaf of a level maps */
+static inline paddr_t leaf_addr(pte64_t e, uint32_t level) {
+    return (paddr_t)(e & PT_ADDR_MASK & ~(LEVEL_SIZE(level) - 1));
+}
+
+/* Helper: attribute bits of a leaf, for comparing and splitting */
+static inline pte64_t leaf_attrs(pte64_t e) {
+    return e & (PT_LEAF_FLAGS | PT_NX);
+}
+
+/*
+ * Internal: the table below the entry e of a level (1..3), allocating it
+ * if e is empty. A large page in e is split into a table of 512 leaves of
+ * the next size down mapping the same memory; *flush is set, since the
+ * old entry may be in the TLB
+ */
+static pte64_t *next_table(pte64_t *e, uint32_t level, int *flush) {
+    if ((*e & PTE_PRESENT) && !(*e & PTE_PSE))
+        return table_at(*e & PT_ADDR_MASK);
+
+    paddr_t phys = pmm_alloc_page(NUMA_NODE_LOCAL);
+    if (!phys) {
+        console_write("[vmm] ERROR: failed to allocate page table\n");
+        return (pte64_t *)0;
+    }
+    pte64_t *t = table_at(phys);
+
+    if (*e & PTE_PRESENT) {
+        paddr_t base = leaf_addr(*e, level);
+        pte64_t attrs = leaf_attrs(*e);
+        uint64_t step = LEVEL_SIZE(level - 1);
+        /* PSE is the PAT bit in a PT entry */
+        if (level - 1 > 0)
+            attrs |= PTE_PSE;
+        for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+            t[i] = (base + i * step) | attrs;
+        }
+        stats.splits++;
+        *flush = 1;
+    } else {
+        for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+            t[i] = 0;
+        }
+    }
+
+    /* Tables inherit user/write permissions from their entries */
+    *e = phys | PT_TABLE_FLAGS;
+    stats.page_tables++;
+    return t;
+}
+
+/*
+ * Internal: map [va, va + size) to pa in the tables of pml4, with pages
+ * up to max_level. Live entries that change set *flush
+ */
+static int map_range(pte64_t *pml4, uint64_t va, paddr_t pa, uint64_t size,
+                     uint32_t flags, uint32_t max_level, int *flush) {
+    pte64_t bits = leaf_bits(flags);
+    uint64_t end = va + size;
+    int warned = 0;
+
+    if (max_level > 1 && !has_gb_pages)
+        max_level = 1;
+
+    while (va < end) {
+        /* Largest page alignment and size allow */
+        uint32_t level = max_level;
+        while (level > 0 && (((va | pa) & (LEVEL_SIZE(level) - 1)) ||
+                             end - va < LEVEL_SIZE(level)))
+            level--;
+
+        pte64_t *t = pml4;
+        uint32_t l = 3;
+        uint64_t skip = 0;
+        for (;;) {
+            pte64_t *e = &t[LEVEL_IDX(va, l)];
+            if (l == level) {
+                if (l == 0 || !(*e & PTE_PRESENT) || (*e & PTE_PSE))
+                    break;
+                /* A table is in the way: go finer */
+                level--;
+            } else if ((*e & (PTE_PRESENT | PTE_PSE)) == (PTE_PRESENT | PTE_PSE) &&
+                       leaf_addr(*e, l) + (va & (LEVEL_SIZE(l) - 1)) == pa &&
+                       leaf_attrs(*e) == bits) {
+                /* Already covered by a large page mapping it the same way */
+                skip = LEVEL_SIZE(l) - (va & (LEVEL_SIZE(l) - 1));
+                break;
+            }
+            t = next_table(e, l, flush);
+            if (!t)
+                return -1;
+            l--;
+        }
+
+        if (skip) {
+            if (skip > end - va)
+                skip = end - va;
+            va += skip;
+            pa += skip;
+            continue;
+        }
+
+        pte64_t *e = &t[LEVEL_IDX(va, level)];
+        pte64_t entry = pa | bits | (level ? PTE_PSE : 0);
+        if (*e & PTE_PRESENT) {
+            if (leaf_addr(*e, level) != pa && !warned) {
+                warned = 1;
+                console_write("[vmm] WARNING: remapping ");
+                print_hex64(va);
+                console_write("\n");
+            }
+            if (*e != entry)
+                *flush = 1;
+        } else if (level == 2) {
+            stats.huge_pages++;
+        } else if (level == 1) {
+            stats.large_pages++;
+        } else {
+            stats.small_pages++;
+        }
+        *e = entry;
+
+        va += LEVEL_SIZE(level);
+        pa += LEVEL_SIZE(level);
+    }
+    return 0;
+}
+
+/* Internal: leaf entry mapping va in pml4 and its level, NULL if none */
+static pte64_t *find_leaf(pte64_t *pml4, uint64_t va, uint32_t *level) {
+    pte64_t *t = pml4;
+    for (uint32_t l = 3;; l--) {
+        pte64_t *e = &t[LEVEL_IDX(va, l)];
+        if (!(*e & PTE_PRESENT))
+            return (pte64_t *)0;
+        if (l == 0 || (l < 3 && (*e & PTE_PSE))) {
+            *level = l;
+            return e;
+        }
+        t = table_at(*e & PT_ADDR_MASK);
+    }
+}
+
+void vmm_init(void) {
+    console_write("[vmm] initializing x86_64 virtual memory manager\n");
+
+    kernel_pml4_phys = read_cr3() & PT_ADDR_MASK;
+
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid"
+                         : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(0x80000001u), "c"(0));
+    has_gb_pages = (edx >> 26) & 1;
+    has_nx = (edx >> 20) & 1;
+
+    __asm__ __volatile__("cpuid"
+                         : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(0), "c"(0));
+    uint32_t max_leaf = eax;
+    __asm__ __volatile__("cpuid"
+                         : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                         : "a"(1), "c"(0));
+    has_pcid = (ecx >> 17) & 1;
+    if (has_pcid && max_leaf >= 7) {
+        __asm__ __volatile__("cpuid"
+                             : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                             : "a"(7), "c"(0));
+        has_invpcid = (ebx >> 10) & 1;
+    }
+
+    vmm_cpu_init();
+
+    console_write("[vmm] PML4 at ");
+    print_hex64(kernel_pml4_phys);
+    console_write(has_gb_pages ? ", 1GB pages" : ", 2MB pages");
+    console_write(has_nx ? ", NX" : ", no NX");
+    console_write(has_pcid ? (has_invpcid ? ", PCID+INVPCID\n" : ", PCID\n") : ", no PCID\n");
+
+    /* Identity map above the boot 4GB: data only, so no execute. Tables
+     * come from the low end of node 0, inside what is mapped already
+     */
+    uint64_t end = pmm_get_phys_end();
+    if (end > PMM_MAX_MEMORY)
+        end = PMM_MAX_MEMORY;
+    if (end > 4 * GB) {
+        int flush = 0;
+        if (map_range(table_at(kernel_pml4_phys), 4 * GB, 4 * GB, end - 4 * GB,
+                      PTE_KERNEL | PTE_NO_EXEC, 2, &flush) != 0) {
+            console_write("[vmm] WARNING: physical memory above 4GB not fully mapped\n");
+        }
+        if (flush)
+            vmm_flush_tlb();
+    }
+
+    console_write("[vmm] identity map: ");
+    print_uint((uint32_t)((end > 4 * GB ? end : 4 * GB) >> 20));
+    console_write(" MB\n");
+
+    flightrec_log(TRACE_EVT_BOOT, 0, 0, 0xC0DE);  /* VMM initialized marker */
+    console_write("[vmm] init complete\n");
+}
+
+void vmm_cpu_init(void) {
+    if (has_nx) {
+        uint32_t lo, hi;
+        __asm__ __volatile__("rdmsr" : "=a"(lo), "=d"(hi) : "c"(EFER_MSR));
+        lo |= EFER_NXE;
+        __asm__ __volatile__("wrmsr" : : "a"(lo), "d"(hi), "c"(EFER_MSR));
+    }
+    if (has_pcid) {
+        /* PCIDE needs CR3[11:0] clear: PCID 0 */
+        write_cr3(read_cr3() & PT_ADDR_MASK);
+        write_cr4(read_cr4() | CR4_PCIDE);
+    }
+}
+
+paddr_t vmm_get_current_pd(void) {
+    return read_cr3() & PT_ADDR_MASK;
+}
+
+void vmm_switch_pd(paddr_t pd_phys) {
+    stats.switches++;
+    if (!has_pcid) {
+        write_cr3(pd_phys);
+        return;
+    }
+    if (pd_phys == kernel_pml4_phys) {
+        write_cr3(pd_phys | CR3_NOFLUSH);
+        stats.switches_noflush++;
+        return;
+    }
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+    uint32_t cpu = smp_cpu_id();
+    paddr_t *owner = pcid_owner[cpu];
+    uint32_t slot = 0;
+    while (slot < PCID_SLOTS && owner[slot] != pd_phys)
+        slot++;
+
+    if (slot < PCID_SLOTS) {
+        /* Still ours: whatever it cached is good */
+        write_cr3(pd_phys | (slot + 1) | CR3_NOFLUSH);
+        stats.switches_noflush++;
+    } else {
+        /* Take the next PCID over; the write flushes its old entries */
+        slot = pcid_next[cpu];
+        pcid_next[cpu] = (slot + 1) % PCID_SLOTS;
+        owner[slot] = pd_phys;
+        write_cr3(pd_phys | (slot + 1));
+    }
+    if (was)
+        interrupts_enable();
+}
+
+int vmm_map_page(vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
+    int flush = 0;
+    int rc = map_range(active_pml4(), vaddr & ~(uint64_t)(PAGE_SIZE - 1),
+                       page_align_down(paddr), PAGE_SIZE, flags, 0, &flush);
+    if (flush)
+        tlb_drop(vaddr);
+    return rc;
+}
+
+/* Internal: no CPU keeps pd_phys's PCIDs; its next switch there flushes */
+static void pcid_forget(paddr_t pd_phys) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (uint32_t slot = 0; slot < PCID_SLOTS; slot++) {
+            if (pcid_owner[cpu][slot] == pd_phys)
+                pcid_owner[cpu][slot] = 0;
+        }
+    }
+}
+
+int vmm_map_page_in(paddr_t pd_phys, vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
+    if (pd_phys == vmm_get_current_pd())
+        return vmm_map_page(vaddr, paddr, flags);
+
+    int flush = 0;
+    int rc = map_range(table_at(pd_phys), vaddr & ~(uint64_t)(PAGE_SIZE - 1),
+                       page_align_down(paddr), PAGE_SIZE, flags, 0, &flush);
+    if (flush)
+        pcid_forget(pd_phys);
+    return rc;
+}
+
+int vmm_map_range(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags) {
+    uint64_t va = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    paddr_t pa = page_align_down(paddr);
+    uint64_t bytes = ((uint64_t)size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    int flush = 0;
+
+    int rc = map_range(active_pml4(), va, pa, bytes, flags, 2, &flush);
+    if (flush) {
+        vmm_flush_tlb();
+        stats.tlb_flushes++;
+    }
+    return rc;
+}
+
+int vmm_map_range_large(vaddr_t vaddr, paddr_t paddr, size_t size, uint32_t flags) {
+    return vmm_map_range(vaddr, paddr, size, flags);
+}
+
+void vmm_get_stats(vmm_stats_t *out) {
+    *out = stats;
+}
+
+paddr_t vmm_unmap_page(vaddr_t vaddr) {
+    pte64_t *pml4 = active_pml4();
+    uint32_t level;
+    pte64_t *e = find_leaf(pml4, vaddr, &level);
+    if (!e)
+        return 0;
+
+    /* Inside a large page: split it down to the 4KB page first */
+    int flush = 0;
+    while (level > 0) {
+        pte64_t *t = next_table(e, level, &flush);
+        if (!t)
+            return 0;
+        level--;
+        e = &t[LEVEL_IDX(vaddr, level)];
+    }
+
+    paddr_t old_paddr = leaf_addr(*e, 0);
+    *e = 0;
+    if (flush)
+        vmm_flush_tlb();
+    else
+        tlb_drop(vaddr);
+    return old_paddr;
+}
+
+void vmm_unmap_range(vaddr_t vaddr, size_t size) {
+    uint64_t va = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = ((uint64_t)vaddr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    pte64_t *pml4 = active_pml4();
+    int flush = 0;
+
+    while (va < end) {
+        pte64_t *t = pml4;
+        uint32_t l = 3;
+        uint64_t step;
+        for (;;) {
+            pte64_t *e = &t[LEVEL_IDX(va, l)];
+            uint64_t off = va & (LEVEL_SIZE(l) - 1);
+            step = LEVEL_SIZE(l) - off;
+            if (!(*e & PTE_PRESENT))
+                break;
+            if (l == 0 || (l < 3 && (*e & PTE_PSE))) {
+                if (off == 0 && end - va >= LEVEL_SIZE(l)) {
+                    *e = 0;
+                    flush = 1;
+                    break;
+                }
+                /* Part of a large page: split it */
+                t = next_table(e, l, &flush);
+                if (!t)
+                    return;
+            } else {
+                t = table_at(*e & PT_ADDR_MASK);
+            }
+            l--;
+        }
+        va += step;
+    }
+
+    if (flush) {
+        vmm_flush_tlb();
+        stats.tlb_flushes++;
+    }
+}
+
+paddr_t vmm_virt_to_phys(vaddr_t vaddr) {
+    uint32_t level;
+    pte64_t *e = find_leaf(active_pml4(), vaddr, &level);
+    if (!e)
+        return 0;
+    return leaf_addr(*e, level) | (paddr_t)(vaddr & (LEVEL_SIZE(level) - 1));
+}
+
+int vmm_is_mapped(vaddr_t vaddr) {
+    uint32_t level;
+    return find_leaf(active_pml4(), vaddr, &level) != (pte64_t *)0;
+}
+
+paddr_t vmm_create_user_pd(void) {
+    paddr_t pml4_phys = pmm_alloc_page(NUMA_NODE_LOCAL);
+    if (pml4_phys == 0) {
+        return 0;
+    }
+
+    pte64_t *pml4 = table_at(pml4_phys);
+    pte64_t *kernel_pml4 = table_at(kernel_pml4_phys);
+
+    /* The identity map (supervisor only) and the kernel half are shared;
+     * the rest of the lower half is the process's
+     */
+    pml4[0] = kernel_pml4[0];
+    for (uint32_t i = 1; i < PT_ENTRIES / 2; i++) {
+        pml4[i] = 0;
+    }
+    for (uint32_t i = PT_ENTRIES / 2; i < PT_ENTRIES; i++) {
+        pml4[i] = kernel_pml4[i];
+    }
+
+    return pml4_phys;
+}
+
+/* Internal: free a table of a level (0..2) and, below it, the tables and
+ * 4KB pages it maps. Large pages are not the table's to free
+ */
+static void free_table(paddr_t phys, uint32_t level) {
+    pte64_t *t = table_at(phys);
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        pte64_t e = t[i];
+        if (!(e & PTE_PRESENT))
+            continue;
+        if (level == 0)
+            pmm_free_page(leaf_addr(e, 0));
+        else if (!(e & PTE_PSE))
+            free_table(e & PT_ADDR_MASK, level - 1);
+    }
+    pmm_free_page(phys);
+}
+
+void vmm_destroy_user_pd(paddr_t pd_phys) {
+    pte64_t *pml4 = table_at(pd_phys);
+
+    /* Free user-space page tables and pages */
+    for (uint32_t i = 1; i < PT_ENTRIES / 2; i++) {
+        if (pml4[i] & PTE_PRESENT) {
+            free_table(pml4[i] & PT_ADDR_MASK, 2);
+        }
+    }
+
+    /* Its PCIDs are free; a new owner's first switch flushes them */
+    pcid_forget(pd_phys);
+
+    /* Free the PML4 */
+    pmm_free_page(pd_phys);
+}
+
+void vmm_dump_pd(paddr_t pd_phys) {
+    pte64_t *pml4 = table_at(pd_phys);
+
+    console_write("\n=== PML4 DUMP ===\n");
+    console_write("PML4 at ");
+    print_hex64(pd_phys);
+    console_write("\n");
+
+    uint32_t mapped_count = 0;
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        if (!(pml4[i] & PTE_PRESENT))
+            continue;
+
+        /* Leaves under it by size */
+        uint32_t huge = 0, large = 0, small = 0;
+        pte64_t *pdpt = table_at(pml4[i] & PT_ADDR_MASK);
+        for (uint32_t j = 0; j < PT_ENTRIES; j++) {
+            if (!(pdpt[j] & PTE_PRESENT))
+                continue;
+            if (pdpt[j] & PTE_PSE) {
+                huge++;
+                continue;
+            }
+            pte64_t *pd = table_at(pdpt[j] & PT_ADDR_MASK);
+            for (uint32_t k = 0; k < PT_ENTRIES; k++) {
+                if (!(pd[k] & PTE_PRESENT))
+                    continue;
+                if (pd[k] & PTE_PSE) {
+                    large++;
+                    continue;
+                }
+                pte64_t *pt = table_at(pd[k] & PT_ADDR_MASK);
+                for (uint32_t m = 0; m < PT_ENTRIES; m++) {
+                    small += pt[m] & PTE_PRESENT;
+                }
+            }
+        }
+
+        uint64_t va = (uint64_t)i << LEVEL_SHIFT(3);
+        if (i >= PT_ENTRIES / 2)
+            va |= 0xFFFF000000000000ull;    /* Canonical upper half */
+        console_write("PML4[");
+        print_uint(i);
+        console_write("] -> ");
+        print_hex64(pml4[i] & PT_ADDR_MASK);
+        console_write(" (vaddr: ");
+        print_hex64(va);
+        console_write(") 1GB/2MB/4KB: ");
+        print_uint(huge);
+        console_write("/");
+        print_uint(large);
+        console_write("/");
+        print_uint(small);
+        console_write("\n");
+        mapped_count++;
+    }
+
+    console_write("Total PML4Es present: ");
+    print_uint(mapped_count);
+    console_write("\n=== END DUMP ===\n");
+}
+
+void vmm_dump_stats(void) {
+    console_write("[vmm] 1GB pages: ");
+    print_uint(stats.huge_pages);
+    console_write(", 2MB pages: ");
+    print_uint(stats.large_pages);
+    console_write(", 4KB pages: ");
+    print_uint(stats.small_pages);
+    console_write(", page tables: ");
+    print_uint(stats.page_tables);
+    console_write(", splits: ");
+    print_uint(stats.splits);
+    console_write(", TLB flushes: ");
+    print_uint(stats.tlb_flushes);
+    console_write("\n[vmm] address space switches: ");
+    print_uint(stats.switches);
+    console_write(", keeping the TLB (PCID): ");
+    print_uint(stats.switches_noflush);
+    console_write("\n");
+}
@@ -0,0 +1,86 @@
+/* kernel/mm/zpool.c
+ *
+ * Pool of pre-zeroed pages (see zpool.h)
+ *
+ * The pool is a stack of frames under a lock taken with interrupts off,
+ * so the page-fault handler can draw from it too. Frames are cleared
+ * outside the lock and pushed one at a time: a refill never holds up an
+ * allocation for longer than a push.
+ */
+#include "zpool.h"
+#include "vmm.h"
+#include "../arch/idt.h"
+#include "../include/string.h"
+
+static paddr_t pool[ZPOOL_SIZE];
+static uint32_t pool_count;
+static volatile uint32_t pool_lock;
+static zpool_stats_t stats;
+
+static int lock_pool(void) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    while (__atomic_exchange_n(&pool_lock, 1, __ATOMIC_ACQUIRE)) {
+        __asm__ __volatile__("pause");
+    }
+    return was;
+}
+
+static void unlock_pool(int was) {
+    __atomic_store_n(&pool_lock, 0, __ATOMIC_RELEASE);
+    if (was)
+        interrupts_enable();
+}
+
+paddr_t zpool_alloc(void) {
+    paddr_t phys = 0;
+    int was = lock_pool();
+    if (pool_count) {
+        phys = pool[--pool_count];
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    unlock_pool(was);
+    if (phys)
+        return phys;
+
+    phys = pmm_alloc_page(NUMA_NODE_LOCAL);
+    if (phys)
+        memset((void *)phys_to_virt(phys), 0, PAGE_SIZE);
+    return phys;
+}
+
+uint32_t zpool_refill(uint32_t max) {
+    if (!max)
+        max = ZPOOL_BATCH;
+
+    uint32_t added = 0;
+    while (added < max && pool_count < ZPOOL_SIZE) {
+        paddr_t phys = pmm_alloc_page(NUMA_NODE_LOCAL);
+        if (!phys)
+            break;
+        memset((void *)phys_to_virt(phys), 0, PAGE_SIZE);
+
+        int was = lock_pool();
+        int full = pool_count >= ZPOOL_SIZE;
+        if (!full) {
+            pool[pool_count++] = phys;
+            stats.zeroed++;
+        }
+        unlock_pool(was);
+        if (full) {
+            pmm_free_page(phys);
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+void zpool_get_stats(zpool_stats_t *out) {
+    int was = lock_pool();
+    *out = stats;
+    out->pooled = pool_count;
+    unlock_pool(was);
+}
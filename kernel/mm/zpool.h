@@ -0,0 +1,46 @@
+/* kernel/mm/zpool.h
+ *
+ * Pool of pre-zeroed pages
+ *
+ * Page directories, page tables and demand-zero pages all start out as
+ * a cleared frame, and clearing 4KB on the spot is most of what creating
+ * an address space or taking a first-touch fault costs. zpool_refill(),
+ * called from the idle loop, keeps up to ZPOOL_SIZE frames of the local
+ * node zeroed ahead of time; zpool_alloc() hands one out, and clears a
+ * fresh frame itself only when the pool has run dry.
+ *
+ * Pages go back with pmm_free_page() like any other: the pool only ever
+ * holds frames it zeroed itself.
+ */
+#ifndef ZENEDGE_ZPOOL_H
+#define ZENEDGE_ZPOOL_H
+
+#include <stdint.h>
+#include "pmm.h"
+
+#define ZPOOL_SIZE      64
+#define ZPOOL_BATCH     8       /* Frames zeroed per zpool_refill(0) */
+
+typedef struct {
+    uint32_t pooled;            /* Zeroed frames waiting */
+    uint32_t hits;              /* zpool_alloc() served from the pool */
+    uint32_t misses;            /* ... that had to zero a frame itself */
+    uint32_t zeroed;            /* Frames zeroed by zpool_refill() */
+} zpool_stats_t;
+
+/*
+ * A zeroed page from NUMA_NODE_LOCAL
+ * @return: Its physical address, or 0 if the PMM is out of pages
+ */
+paddr_t zpool_alloc(void);
+
+/*
+ * Zero up to max frames (0 = ZPOOL_BATCH) into the pool, stopping when
+ * it is full; for the idle loop
+ * @return: Frames added
+ */
+uint32_t zpool_refill(uint32_t max);
+
+void zpool_get_stats(zpool_stats_t *out);
+
+#endif /* ZENEDGE_ZPOOL_H */
@@ -5,7 +5,6 @@
 #include "mm/pmm.h"
 #include <stdint.h>
 
-/* Process states */
 /* Process states */
 typedef enum {
   PROCESS_STATE_NEW,
@@ -15,6 +14,9 @@ typedef enum {
   PROCESS_STATE_ZOMBIE
 } process_state_t;
 
+/* process_t.flags */
+#define PROCESS_FLAG_KERNEL 0x1  /* Ring-0 thread in the kernel address space */
+
 /* Trapframe (matches syscall/interrupt stack layout) */
 typedef struct trapframe {
     uint32_t gs, fs, es, ds;
@@ -23,6 +25,16 @@ typedef struct trapframe {
     uint32_t eip, cs, eflags, esp, ss;
 } trapframe_t;
 
+/* A heap blob mapped into the process's tensor window (sched/tmap.c) */
+#define PROCESS_TENSOR_MAPS 32
+
+typedef struct tensor_map {
+  uint32_t vaddr;         /* Page-aligned start of the range */
+  uint32_t pages;
+  uint16_t blob_id;
+  uint16_t refs;          /* sys_map_tensor calls not yet unmapped */
+} tensor_map_t;
+
 /* Process Control Block (PCB) */
 /* IMPORTANT: First 4 fields MUST match switch.s offsets! */
 typedef struct process {
@@ -35,6 +47,8 @@ typedef struct process {
   
   process_state_t state;
   process_state_t prev_state; /* For debugging */
+  uint32_t flags;             /* PROCESS_FLAG_* */
+  uint32_t kstack_pages;      /* 0 = one pmm page (user processes) */
 
   /* Memory Context */
   uint32_t *pd_virt;      /* Virtual address of PD (for kernel access) */
@@ -44,12 +58,32 @@ typedef struct process {
   trapframe_t *tf;        /* Setup on syscall/interrupt */
 
   /* Scheduling */
-  uint32_t ticks_remaining;
-  uint32_t quantum_ms;
+  uint32_t slice_left_us;  /* Rest of a preempted quantum, 0 = a fresh one */
+  uint32_t quantum_ms;    /* 0 = by priority (sched_prio_quantum_ms) */
+  uint32_t cpu;           /* Affinity hint (IPC_CHAN_CPU_ANY = any) */
+  uint32_t prio;          /* contract_priority_t, CONTRACT_PRIORITY_NORMAL by default */
+  uint64_t ready_since;   /* time_usec() when last made READY */
+  const void *wait_chan;  /* What a BLOCKED process waits on (sched_block) */
+  uint64_t wake_at;       /* BLOCKED: time_usec() to wake anyway, 0 = never */
+  struct process *rq_next; /* Run queue link while READY */
+
+  /* FPU/SIMD context (arch/fpu.c): allocated on first use */
+  void *fpu_state;
+
+  /* Kernel thread entry (PROCESS_FLAG_KERNEL) */
+  void (*kentry)(void *arg);
+  void *karg;
 
   /* Contract / Resource Tracking */
   uint32_t mem_pages_used;
   uint32_t mem_pages_limit;
+
+  /* Tensor window mappings, sorted by vaddr */
+  tensor_map_t tmaps[PROCESS_TENSOR_MAPS];
+  uint32_t num_tmaps;
+
+  /* Read-only data page mapped at ZE_VDATA_VADDR (sched/vdata.c) */
+  struct ze_vdata *vdata;
   
   /* WASM Agent Blob (if applicable) */
   const uint8_t* wasm_blob;
@@ -0,0 +1,343 @@
+/* kernel/sched/coll.c - Ring allreduce and allgather across the mesh */
+
+#include "coll.h"
+#include "gang.h"
+#include "../console.h"
+#include "../include/string.h"
+#include "../ipc/heap.h"
+#include "../ipc/ipc.h"
+#include "../ipc/layout.h"
+#include "../ipc/mesh_work.h"
+#include "../lib/math.h"
+#include "../time/time.h"
+#include "../trace/flightrec.h"
+#include "../trace/klog.h"
+
+#define COLL_F16_BLOCK 128    /* Floats widened at a time (stack) */
+
+/* Generation of the last collective that moved data; the same sequence
+ * on every node, like gang generations
+ */
+static uint32_t coll_gen;
+static coll_stats_t coll_stats;
+
+/* A tensor as the ring sees it: dense bytes of a float32/float16 blob */
+typedef struct {
+  uint8_t *data;
+  uint32_t bytes;     /* Elements * element size */
+  uint32_t cap;       /* Data bytes the blob has room for */
+  uint8_t dtype;
+} coll_tensor_t;
+
+/* One collective's walk around the ring. The buffer is split into nodes
+ * segments of seg bytes (the last ones may be short or empty), each sent
+ * as chunks chunks; the first reduce_steps of steps reduce, the rest copy
+ */
+typedef struct {
+  uint8_t *buf;
+  uint32_t bytes;
+  uint32_t seg;
+  uint32_t chunk;
+  uint32_t chunks;
+  uint32_t steps;
+  uint32_t reduce_steps;
+  uint8_t dtype;
+} coll_plan_t;
+
+static int tensor_view(uint32_t blob, coll_tensor_t *t) {
+  heap_blob_t *b = heap_get_blob((uint16_t)blob);
+  if (!b || b->type != BLOB_TYPE_TENSOR || b->size < sizeof(tensor_header_t))
+    return -1;
+  const tensor_header_t *h = (const tensor_header_t *)heap_get_data((uint16_t)blob);
+  if (!h || h->quant != TENSOR_QUANT_NONE || h->ndim < 1 || h->ndim > 4)
+    return -1;
+  uint32_t esize;
+  if (h->dtype == DTYPE_FLOAT32)
+    esize = 4;
+  else if (h->dtype == DTYPE_FLOAT16)
+    esize = 2;
+  else
+    return -1;
+
+  uint64_t n = 1;
+  for (uint8_t i = 0; i < h->ndim; i++)
+    n *= h->shape[i];
+  t->cap = b->size - sizeof(tensor_header_t);
+  if (n * esize > t->cap)
+    return -1;
+  t->bytes = (uint32_t)n * esize;
+  t->dtype = h->dtype;
+  t->data = (uint8_t *)heap_get_tensor_data((uint16_t)blob);
+  return t->data ? 0 : -1;
+}
+
+static volatile mesh_coll_table_t *coll_table(void) {
+  if (!ipc_mesh_table())
+    return NULL;
+  volatile mesh_coll_table_t *t =
+      (volatile mesh_coll_table_t *)ipc_region_ptr(IPC_REGION_MESH_COLL);
+  uint32_t chunk = ipc_region_entries(IPC_REGION_MESH_COLL);
+  if (!t || chunk < 16 || (chunk & 3))
+    return NULL;
+  /* Every node derives the same values from the same layout */
+  if (t->magic != MESH_COLL_MAGIC) {
+    t->slots = MESH_COLL_SLOTS;
+    t->chunk_bytes = chunk;
+    __asm__ __volatile__("" ::: "memory");
+    t->magic = MESH_COLL_MAGIC;
+  }
+  return t;
+}
+
+static uint8_t *coll_buf(volatile mesh_coll_table_t *t, uint32_t node, uint32_t slot) {
+  return (uint8_t *)t + MESH_COLL_BUF_OFFSET(t->chunk_bytes, node, slot);
+}
+
+static uint32_t popcount(uint32_t v) {
+  uint32_t n = 0;
+  for (; v; v &= v - 1)
+    n++;
+  return n;
+}
+
+/* Node of ring position rank among members (ascending ids) */
+static uint32_t ring_node(uint32_t members, uint32_t rank) {
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+    if ((members & (1u << i)) && rank-- == 0)
+      return i;
+  return 0;
+}
+
+/* Bytes [off, off + *len) of chunk c of segment g */
+static uint32_t chunk_span(const coll_plan_t *p, uint32_t g, uint32_t c, uint32_t *len) {
+  uint32_t off = g * p->seg + c * p->chunk;
+  uint32_t end = g * p->seg + p->seg;
+  if (end > p->bytes)
+    end = p->bytes;
+  *len = off < end ? (end - off < p->chunk ? end - off : p->chunk) : 0;
+  return off;
+}
+
+static void reduce_f16(uint16_t *dst, const uint16_t *src, uint32_t n) {
+  float a[COLL_F16_BLOCK], b[COLL_F16_BLOCK];
+  for (uint32_t i = 0; i < n; i += COLL_F16_BLOCK) {
+    int k = (int)(n - i < COLL_F16_BLOCK ? n - i : COLL_F16_BLOCK);
+    math_f16_to_f32(dst + i, a, k);
+    math_f16_to_f32(src + i, b, k);
+    math_vec_add(b, a, k);
+    math_f32_to_f16(a, dst + i, k);
+  }
+}
+
+static void reduce(const coll_plan_t *p, uint8_t *dst, const uint8_t *src, uint32_t len) {
+  if (p->dtype == DTYPE_FLOAT32)
+    math_vec_add((const float *)src, (float *)dst, (int)(len / 4));
+  else
+    reduce_f16((uint16_t *)dst, (const uint16_t *)src, len / 2);
+}
+
+/* Walk the ring as rank r of n. Message m is chunk m % chunks of step
+ * m / chunks: step k sends segment (r - k) mod n to the right and takes
+ * segment (r - k - 1) mod n from the left, so what arrives in step k is
+ * what goes out in step k + 1. Returns 0, or -1 once the ring has made
+ * no progress for COLL_TIMEOUT_US
+ */
+static int ring_run(volatile mesh_coll_table_t *t, const coll_plan_t *p, uint32_t members,
+                    uint32_t r, uint32_t n, uint32_t gen) {
+  uint32_t self = ring_node(members, r);
+  uint32_t left = ring_node(members, (r + n - 1) % n);
+  uint32_t right = ring_node(members, (r + 1) % n);
+  volatile mesh_coll_chan_t *me = &t->chan[self];
+  volatile mesh_coll_chan_t *lch = &t->chan[left];
+  volatile mesh_coll_chan_t *rch = &t->chan[right];
+
+  uint32_t total = p->steps * p->chunks;
+  uint32_t sent = 0, recvd = 0, spins = 0, copied = 0;
+  usec_t last_progress = 0;    /* Since when we found nothing to do */
+
+  for (;;) {
+    int progress = 0;
+
+    /* Send: step 0 is our own data, later steps wait for the chunk they
+     * forward; at most MESH_COLL_SLOTS not yet acked by the right
+     */
+    if (sent < total && (sent < p->chunks || recvd > sent - p->chunks) &&
+        sent - rch->ack < MESH_COLL_SLOTS) {
+      uint32_t k = sent / p->chunks, len;
+      uint32_t g = (r + n - k % n) % n;
+      uint32_t off = chunk_span(p, g, sent % p->chunks, &len);
+      memcpy(coll_buf(t, self, sent % MESH_COLL_SLOTS), p->buf + off, len);
+      copied += len;
+      __asm__ __volatile__("" ::: "memory");
+      me->head = ++sent;
+      progress = 1;
+    }
+
+    if (recvd < total && lch->gen == gen && lch->head > recvd) {
+      uint32_t k = recvd / p->chunks, len;
+      uint32_t g = (r + 2 * n - 1 - k % n) % n;
+      uint32_t off = chunk_span(p, g, recvd % p->chunks, &len);
+      const uint8_t *src = coll_buf(t, left, recvd % MESH_COLL_SLOTS);
+      if (k < p->reduce_steps)
+        reduce(p, p->buf + off, src, len);
+      else
+        memcpy(p->buf + off, src, len);
+      __asm__ __volatile__("" ::: "memory");
+      me->ack = ++recvd;
+      progress = 1;
+    }
+
+    /* Our buffers are reusable once the right has taken everything */
+    if (sent == total && recvd == total &&
+        (rch->ack >= total || (int32_t)(rch->gen - gen) > 0)) {
+      mesh_work_count_copy(right, copied);
+      return 0;
+    }
+
+    if (progress) {
+      spins = 0;
+      last_progress = 0;
+      continue;
+    }
+    __asm__ __volatile__("pause");
+    if ((++spins & 255) != 0)
+      continue;
+    ipc_mesh_update();
+    usec_t now = time_usec();
+    if (!last_progress)
+      last_progress = now;
+    if (now - last_progress > COLL_TIMEOUT_US ||
+        !ipc_mesh_node_up(left) || !ipc_mesh_node_up(right))
+      return -1;
+  }
+}
+
+static void coll_report(uint32_t job_id, const job_step_t *s, uint32_t nodes,
+                        uint32_t bytes, usec_t us) {
+  uint32_t mbps = us ? (uint32_t)(bytes / us) : 0;   /* bytes/us = MB/s */
+  coll_stats.last_nodes = nodes;
+  coll_stats.last_bytes = bytes;
+  coll_stats.last_us = (uint32_t)us;
+  coll_stats.last_mbps = mbps;
+  if (mbps > coll_stats.best_mbps)
+    coll_stats.best_mbps = mbps;
+  coll_stats.bytes += bytes;
+  flightrec_log(TRACE_EVT_COLL_DONE, job_id, s->id, mbps);
+  KLOG3(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "collective step %u over %u nodes: %u MB/s",
+        s->id, nodes, mbps);
+}
+
+int coll_run(uint32_t job_id, const job_step_t *s, uint32_t *result) {
+  *result = 0;
+  if (!s->num_inputs)
+    return gang_dispatch(job_id, s->id, NULL);
+
+  coll_tensor_t in, out;
+  int ok = tensor_view(s->inputs[0], &in) == 0;
+  if (ok && s->coll_op == COLL_OP_ALLGATHER)
+    ok = s->num_outputs && tensor_view(s->outputs[0], &out) == 0 &&
+         out.dtype == in.dtype && s->outputs[0] != s->inputs[0];
+
+  /* Set up our channel before arriving, even for a tensor we cannot use:
+   * the generations have to stay in step with the other nodes
+   */
+  volatile mesh_coll_table_t *t = coll_table();
+  int self = ipc_mesh_local_id();
+  uint32_t gen = ++coll_gen;
+  if (t) {
+    volatile mesh_coll_chan_t *me = &t->chan[self];
+    me->head = 0;
+    me->ack = 0;
+    __asm__ __volatile__("" ::: "memory");
+    me->gen = gen;
+  }
+
+  uint32_t members;
+  int rc = gang_dispatch(job_id, s->id, &members);
+  coll_stats.collectives++;
+  if (!ok) {
+    KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "collective step %u: unusable tensors", s->id);
+    coll_stats.failed++;
+    return -1;
+  }
+
+  uint32_t nodes = popcount(members);
+  uint32_t rank = 0;
+  if (t && nodes > 1) {
+    if (!(members & (1u << self))) {
+      KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "collective step %u: left behind by the gang",
+            s->id);
+      coll_stats.failed++;
+      return -1;
+    }
+    rank = popcount(members & ((1u << self) - 1));
+  } else {
+    nodes = 1;
+  }
+
+  coll_plan_t p;
+  p.chunk = t ? t->chunk_bytes : 0;
+  p.dtype = in.dtype;
+  if (s->coll_op == COLL_OP_ALLGATHER) {
+    if ((uint64_t)in.bytes * nodes > out.cap) {
+      KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "collective step %u: allgather output too small",
+            s->id);
+      coll_stats.failed++;
+      return -1;
+    }
+    p.buf = out.data;
+    p.bytes = in.bytes * nodes;
+    p.seg = in.bytes;
+    p.steps = nodes - 1;
+    p.reduce_steps = 0;
+    memcpy(out.data + rank * in.bytes, in.data, in.bytes);
+    *result = s->outputs[0];
+  } else {
+    uint32_t esize = in.dtype == DTYPE_FLOAT32 ? 4 : 2;
+    uint32_t elems = in.bytes / esize;
+    p.buf = in.data;
+    p.bytes = in.bytes;
+    p.seg = (elems + nodes - 1) / nodes * esize;
+    p.steps = 2 * (nodes - 1);
+    p.reduce_steps = nodes - 1;
+    *result = s->inputs[0];
+  }
+  if (nodes == 1)
+    return rc;
+
+  p.chunks = p.seg > p.chunk ? (p.seg + p.chunk - 1) / p.chunk : 1;
+  usec_t t0 = time_usec();
+  if (ring_run(t, &p, members, rank, nodes, gen) != 0) {
+    KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "collective step %u: ring stalled", s->id);
+    coll_stats.failed++;
+    *result = 0;
+    return -1;
+  }
+  coll_report(job_id, s, nodes, s->coll_op == COLL_OP_ALLGATHER ? p.bytes : in.bytes,
+              time_usec() - t0);
+  return rc;
+}
+
+void coll_get_stats(coll_stats_t *out) {
+  *out = coll_stats;
+}
+
+void coll_dump(void) {
+  console_write("[coll] ");
+  print_uint(coll_stats.collectives);
+  console_write(" collectives (");
+  print_uint(coll_stats.failed);
+  console_write(" failed), ");
+  print_uint((uint32_t)(coll_stats.bytes >> 10));
+  console_write("KB moved; last ");
+  print_uint(coll_stats.last_bytes);
+  console_write(" bytes over ");
+  print_uint(coll_stats.last_nodes);
+  console_write(" nodes in ");
+  print_uint(coll_stats.last_us);
+  console_write("us, algbw ");
+  print_uint(coll_stats.last_mbps);
+  console_write(" MB/s (best ");
+  print_uint(coll_stats.best_mbps);
+  console_write(")\n");
+}
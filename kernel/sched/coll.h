@@ -0,0 +1,53 @@
+/* kernel/sched/coll.h - Ring allreduce and allgather across the mesh
+ *
+ * COLLECTIVE steps with an input tensor move data between the mesh nodes
+ * through IPC_REGION_MESH_COLL (mesh_coll_table_t). The members of the
+ * step's gang (sched/gang.h) form a ring in node id order and pass the
+ * tensor around it in chunks of the region's chunk size:
+ *
+ *   allreduce: N-1 reduce-scatter steps, then N-1 allgather steps, over N
+ *     segments of the tensor; each node sends and receives 2(N-1)/N of it.
+ *   allgather: N-1 steps forwarding the nodes' blocks.
+ *
+ * Chunks are pipelined: a node sends its next chunk while its neighbour
+ * is still reducing the previous one, up to MESH_COLL_SLOTS ahead.
+ * float32 chunks are summed with math_vec_add(); float16 ones are widened
+ * (math_f16_to_f32()), summed and rounded back.
+ *
+ * Each collective reports its algorithmic bandwidth, tensor bytes over
+ * wall time, in TRACE_EVT_COLL_DONE and coll_dump().
+ */
+
+#ifndef _SCHED_COLL_H
+#define _SCHED_COLL_H
+
+#include <stdint.h>
+
+#include "../job/job_graph.h"
+
+/* Give up on a ring neighbour that stopped moving for this long */
+#define COLL_TIMEOUT_US (100 * 1000)
+
+typedef struct {
+  uint32_t collectives;     /* coll_run() calls that moved data */
+  uint32_t failed;          /* Bad tensors, stragglers or a stalled ring */
+  uint32_t last_nodes;      /* Ring size of the last one */
+  uint32_t last_bytes;
+  uint32_t last_us;
+  uint32_t last_mbps;       /* Algorithmic bandwidth, MB/s */
+  uint32_t best_mbps;
+  uint64_t bytes;           /* Tensor bytes across all collectives */
+} coll_stats_t;
+
+/* Run COLLECTIVE step s of job job_id: a gang barrier, then its coll_op
+ * over the mesh. *result gets the blob holding the outcome (the input for
+ * allreduce, outputs[0] for allgather; 0 for a bare barrier).
+ * Returns 0, or -1 if the step's tensors are unusable, a node was left
+ * behind or the ring stalled
+ */
+int coll_run(uint32_t job_id, const job_step_t *s, uint32_t *result);
+
+void coll_get_stats(coll_stats_t *out);
+void coll_dump(void);
+
+#endif /* _SCHED_COLL_H */
@@ -0,0 +1,221 @@
+/* kernel/sched/fiber.c - Cooperative kernel fibers */
+
+#include "fiber.h"
+#include "../arch/idt.h"
+#include "../console.h"
+#include "../ipc/ipc.h"
+#include "../time/timer.h"
+#include <stddef.h>
+
+enum { FIBER_FREE = 0, FIBER_READY, FIBER_WAITING };
+
+typedef struct {
+  uint8_t state;
+  fiber_fn_t fn;
+  void *arg;
+  uintptr_t sp;           /* Saved stack pointer while switched out */
+
+  /* fiber_wait() */
+  ipc_tag_t tag;
+  ktimer_t timeout;
+  int wait_rc;
+  ipc_response_t rsp;
+} fiber_t;
+
+/* Callee-saved registers fiber_switch() pushes */
+#ifdef __x86_64__
+#define FIBER_SAVED_REGS 6
+#else
+#define FIBER_SAVED_REGS 4
+#endif
+
+/* kernel/arch/switch.s, arch/x86_64/boot/switch.s: push the callee-saved
+ * registers, store the stack pointer in *save_sp, load next_sp, pop and
+ * return there
+ */
+extern void fiber_switch(uintptr_t *save_sp, uintptr_t next_sp);
+
+static fiber_t fibers[FIBER_MAX];
+static uint8_t stacks[FIBER_MAX][FIBER_STACK_SIZE] __attribute__((aligned(16)));
+static fiber_t *current;
+static uintptr_t loop_sp;       /* fiber_run()'s, while a fiber runs */
+static uint32_t spawned;
+static uint32_t switches;
+
+static void __attribute__((noreturn)) fiber_entry(void) {
+  current->fn(current->arg);
+  current->state = FIBER_FREE;
+  fiber_switch(&current->sp, loop_sp);
+  for (;;) { }
+}
+
+int fiber_spawn(fiber_fn_t fn, void *arg) {
+  for (int i = 0; i < FIBER_MAX; i++) {
+    fiber_t *f = &fibers[i];
+    if (f->state != FIBER_FREE)
+      continue;
+
+    /* A frame fiber_switch() can return from into fiber_entry(), the stack
+     * aligned as after a call
+     */
+    uintptr_t *sp = (uintptr_t *)(stacks[i] + FIBER_STACK_SIZE);
+    *--sp = 0;                          /* fiber_entry()'s return address */
+    *--sp = (uintptr_t)fiber_entry;
+    for (int r = 0; r < FIBER_SAVED_REGS; r++)
+      *--sp = 0;
+    f->sp = (uintptr_t)sp;
+    f->fn = fn;
+    f->arg = arg;
+    f->state = FIBER_READY;
+    spawned++;
+    return i;
+  }
+  return -1;
+}
+
+void fiber_yield(void) {
+  if (!current)
+    return;
+  switches++;
+  fiber_switch(&current->sp, loop_sp);
+}
+
+int fiber_active(void) {
+  return current != NULL;
+}
+
+/* Completion callback: the response is the waiting fiber's */
+static void fiber_wake(const ipc_response_t *rsp, void *arg) {
+  fiber_t *f = (fiber_t *)arg;
+  timer_cancel(&f->timeout);
+  f->rsp = *rsp;
+  f->wait_rc = 0;
+  f->state = FIBER_READY;
+}
+
+/* Timer callback (main loop): no response in time, give up the tag */
+static void fiber_timeout(ktimer_t *t, void *arg) {
+  (void)t;
+  fiber_t *f = (fiber_t *)arg;
+  /* The wake callback runs in IRQs too: decide with them off */
+  int was = interrupts_enabled();
+  interrupts_disable();
+  if (f->state == FIBER_WAITING) {
+    ipc_completion_cancel(f->tag);
+    f->state = FIBER_READY;
+  }
+  if (was)
+    interrupts_enable();
+}
+
+int fiber_wait(ipc_tag_t tag, ipc_response_t *out, usec_t timeout_us) {
+  if (!current)
+    return ipc_completion_wait(tag, out, timeout_us);
+
+  fiber_t *f = current;
+  f->tag = tag;
+  f->wait_rc = -1;
+  f->state = FIBER_WAITING;
+  if (timeout_us)
+    timer_arm(&f->timeout, time_usec() + timeout_us, fiber_timeout, f);
+  if (ipc_completion_set_cb(tag, fiber_wake, f) != 0) {
+    timer_cancel(&f->timeout);
+    f->state = FIBER_READY;
+    return -1;
+  }
+  /* Not woken already by a response that beat us */
+  while (f->state == FIBER_WAITING) {
+    switches++;
+    fiber_switch(&f->sp, loop_sp);
+  }
+  if (f->wait_rc == 0 && out)
+    *out = f->rsp;
+  return f->wait_rc;
+}
+
+uint32_t fiber_run(void) {
+  uint32_t waiting = 0;
+  if (current)
+    return 0;
+  for (int i = 0; i < FIBER_MAX; i++)
+    waiting += fibers[i].state == FIBER_WAITING;
+  if (waiting)
+    ipc_process_responses();
+
+  for (int i = 0; i < FIBER_MAX; i++) {
+    fiber_t *f = &fibers[i];
+    if (f->state != FIBER_READY)
+      continue;
+    current = f;
+    switches++;
+    fiber_switch(&loop_sp, f->sp);
+    current = NULL;
+  }
+
+  uint32_t ready = 0;
+  for (int i = 0; i < FIBER_MAX; i++)
+    ready += fibers[i].state == FIBER_READY;
+  return ready;
+}
+
+/* fiber_bench(): bounce straight back to the caller, rounds times */
+static uintptr_t bench_sp;
+static uint32_t bench_left;
+
+static void bench_fiber(void *arg) {
+  (void)arg;
+  while (bench_left) {
+    bench_left--;
+    fiber_switch(&current->sp, bench_sp);
+  }
+}
+
+uint32_t fiber_bench(uint32_t rounds) {
+  if (current || !rounds)
+    return 0;
+  int id = fiber_spawn(bench_fiber, NULL);
+  if (id < 0)
+    return 0;
+
+  fiber_t *f = &fibers[id];
+  current = f;
+  bench_left = rounds;
+  cycles_t t0 = rdtsc();
+  for (uint32_t i = 0; i < rounds; i++)
+    fiber_switch(&bench_sp, f->sp);
+  cycles_t t1 = rdtsc();
+
+  /* bench_left is 0: let it return and free its slot */
+  fiber_switch(&loop_sp, f->sp);
+  current = NULL;
+  return (uint32_t)((t1 - t0) / (2ULL * rounds));
+}
+
+void fiber_dump(void) {
+  uint32_t live = 0, waiting = 0;
+  for (int i = 0; i < FIBER_MAX; i++) {
+    live += fibers[i].state != FIBER_FREE;
+    waiting += fibers[i].state == FIBER_WAITING;
+  }
+  console_write("[fiber] ");
+  print_uint(live);
+  console_write(" live (");
+  print_uint(waiting);
+  console_write(" waiting), ");
+  print_uint(spawned);
+  console_write(" spawned, ");
+  print_uint(switches);
+  console_write(" switches\n");
+
+  uint32_t cycles = fiber_bench(10000);
+  uint32_t mhz = time_get_cpu_mhz();
+  console_write("[fiber] switch: ");
+  print_uint(cycles);
+  console_write(" cycles");
+  if (mhz) {
+    console_write(" (");
+    print_uint(cycles * 1000 / mhz);
+    console_write(" ns)");
+  }
+  console_write("\n");
+}
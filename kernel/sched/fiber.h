@@ -0,0 +1,64 @@
+/* kernel/sched/fiber.h - Cooperative kernel fibers
+ *
+ * Stackful coroutines for code that would rather read sequentially than
+ * as a state machine: a fiber runs until it calls fiber_yield() or
+ * fiber_wait(), and the main loop's fiber_run() resumes it later. A
+ * fiber_wait() on an IPC completion tag parks the fiber until the
+ * response arrives (from the IRQ or any response drain), so waiting never
+ * spins. Fibers share the kernel address space; switching saves only the
+ * callee-saved registers (fiber_switch in switch.s).
+ *
+ * Stacks come from a fixed pool, so spawning never allocates. Everything
+ * runs on one CPU: completions reach fibers from IRQs or the main loop.
+ */
+
+#ifndef _SCHED_FIBER_H
+#define _SCHED_FIBER_H
+
+#include "../ipc/completion.h"
+#include "../time/time.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FIBER_MAX        16
+#define FIBER_STACK_SIZE (8 * 1024)
+
+typedef void (*fiber_fn_t)(void *arg);
+
+/* Start fn(arg) as a fiber; it first runs from the next fiber_run().
+ * Returns: fiber id, or -1 if the pool is full
+ */
+int fiber_spawn(fiber_fn_t fn, void *arg);
+
+/* From a fiber: let the others run, continue on the next fiber_run() */
+void fiber_yield(void);
+
+/* From a fiber: sleep until tag's response arrives (into out) or
+ * timeout_us passes (0 = no limit; the tag is cancelled, from a kernel
+ * timer, time/timer.h). Outside a fiber
+ * this is ipc_completion_wait(). Returns 0, or -1 on timeout or an unknown
+ * tag.
+ */
+int fiber_wait(ipc_tag_t tag, ipc_response_t *out, usec_t timeout_us);
+
+/* Nonzero when called from a fiber */
+int fiber_active(void);
+
+/* Main loop, after timer_run(): resume every runnable fiber once
+ * Returns: fibers still runnable (they yielded: don't halt)
+ */
+uint32_t fiber_run(void);
+
+/* Switch cost: cycles per fiber_switch over rounds round trips */
+uint32_t fiber_bench(uint32_t rounds);
+
+void fiber_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SCHED_FIBER_H */
@@ -0,0 +1,162 @@
+/* kernel/sched/gang.c - Gang dispatch of COLLECTIVE steps */
+
+#include "gang.h"
+#include "../console.h"
+#include "../ipc/ipc.h"
+#include "../time/time.h"
+#include "../trace/flightrec.h"
+#include "../trace/klog.h"
+
+/* Generation of the last collective entered; the same sequence on every
+ * node since they run the same graphs in the same order
+ */
+static uint32_t gang_gen;
+static gang_stats_t gang_stats;
+
+/* Nodes with a live heartbeat; a suspected one is not waited for */
+static uint32_t alive_mask(int self) {
+  uint32_t mask = 1u << self;
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+    if (ipc_mesh_node_up(i))
+      mask |= 1u << i;
+  return mask;
+}
+
+/* Whether node's slot shows it at generation gen (step key) or past it */
+static int arrived(volatile mesh_gang_t *g, uint32_t gen, uint32_t key) {
+  uint32_t at = g->gen;
+  return (int32_t)(at - gen) > 0 || (at == gen && g->key == key);
+}
+
+static uint32_t popcount(uint32_t v) {
+  uint32_t n = 0;
+  for (; v; v &= v - 1)
+    n++;
+  return n;
+}
+
+static void gang_released(uint32_t job_id, uint32_t step_id, usec_t waited) {
+  uint32_t w = waited > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)waited;
+  gang_stats.last_wait_us = w;
+  if (w > gang_stats.max_wait_us)
+    gang_stats.max_wait_us = w;
+  flightrec_log(TRACE_EVT_GANG_RELEASE, job_id, step_id, w);
+}
+
+/* Spin step: keep the heartbeat going, a barrier can outlast the
+ * failure detector's timeout
+ */
+static void gang_spin(uint32_t *spins) {
+  if ((++*spins & 255) == 0)
+    ipc_mesh_update();
+  __asm__ __volatile__("pause");
+}
+
+int gang_dispatch(uint32_t job_id, uint32_t step_id, uint32_t *members) {
+  volatile mesh_table_t *m = ipc_mesh_table();
+  int self = ipc_mesh_local_id();
+  uint32_t gen = ++gang_gen;
+  gang_stats.collectives++;
+
+  uint32_t mask = m ? alive_mask(self) : 0;
+  if (!m || mask == (1u << self)) {
+    gang_stats.solo++;
+    if (members)
+      *members = m ? mask : 1;
+    gang_released(job_id, step_id, 0);
+    return 0;
+  }
+
+  uint32_t leader;
+  __asm__("bsf %1, %0" : "=r"(leader) : "rm"(mask));
+  uint32_t key = (job_id << 16) | (step_id & 0xFFFF);
+  volatile mesh_gang_t *g = m->gang;
+
+  /* Arrive: key before gen, so a peer that sees gen sees the key */
+  g[self].key = key;
+  __asm__ __volatile__("" ::: "memory");
+  g[self].gen = gen;
+
+  usec_t t0 = time_usec();
+  usec_t deadline = t0 + GANG_TIMEOUT_US;
+  uint32_t missing = 0;
+  uint32_t spins = 0;
+
+  if ((uint32_t)self == leader) {
+    missing = mask & ~(1u << self);
+    while (missing) {
+      for (uint32_t i = 0; i < MES_MAX_NODES; i++)
+        if ((missing & (1u << i)) && arrived(&g[i], gen, key))
+          missing &= ~(1u << i);
+      if (missing && time_usec() >= deadline)
+        break;
+      gang_spin(&spins);
+    }
+    /* Release even on a timeout, so the nodes that made it go on */
+    g[self].members = mask & ~missing;
+    __asm__ __volatile__("" ::: "memory");
+    g[self].released = gen;
+    gang_stats.led++;
+    if (members)
+      *members = mask & ~missing;
+  } else {
+    while ((int32_t)(g[leader].released - gen) < 0) {
+      if (time_usec() >= deadline) {
+        missing = 1u << leader;
+        break;
+      }
+      gang_spin(&spins);
+    }
+    if (members)
+      *members = missing ? 1u << self : g[leader].members;
+  }
+
+  usec_t waited = time_usec() - t0;
+  g[self].wait_us = (uint32_t)waited;
+  if (missing) {
+    gang_stats.timeouts++;
+    KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN,
+          "gang: collective step %u gave up on %u node(s)", step_id, popcount(missing));
+    flightrec_log(TRACE_EVT_GANG_TIMEOUT, job_id, step_id, popcount(missing));
+    return -1;
+  }
+  gang_released(job_id, step_id, waited);
+  return 0;
+}
+
+void gang_get_stats(gang_stats_t *out) {
+  *out = gang_stats;
+}
+
+void gang_dump(void) {
+  console_write("[gang] ");
+  print_uint(gang_stats.collectives);
+  console_write(" collectives (");
+  print_uint(gang_stats.solo);
+  console_write(" solo, ");
+  print_uint(gang_stats.led);
+  console_write(" led, ");
+  print_uint(gang_stats.timeouts);
+  console_write(" timeouts), wait last ");
+  print_uint(gang_stats.last_wait_us);
+  console_write("us max ");
+  print_uint(gang_stats.max_wait_us);
+  console_write("us\n");
+
+  volatile mesh_table_t *m = ipc_mesh_table();
+  if (!m)
+    return;
+  for (uint32_t i = 0; i < MES_MAX_NODES; i++) {
+    if (m->nodes[i].status == NODE_STATUS_OFFLINE)
+      continue;
+    console_write("  node ");
+    print_uint(i);
+    console_write(" gen ");
+    print_uint(m->gang[i].gen);
+    console_write(" released ");
+    print_uint(m->gang[i].released);
+    console_write(" last wait ");
+    print_uint(m->gang[i].wait_us);
+    console_write("us\n");
+  }
+}
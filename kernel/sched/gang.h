@@ -0,0 +1,48 @@
+/* kernel/sched/gang.h - Gang dispatch of COLLECTIVE steps
+ *
+ * A collective is only as fast as its slowest participant, so every node
+ * in the mesh runs it at the same moment. gang_dispatch() holds this
+ * node's CPU at a barrier in the shared mesh table (mesh_gang_t) until all
+ * alive nodes have arrived at the same collective, then releases them
+ * together: the leader, the lowest alive node, flips its released
+ * generation and the others, spinning on it, see it within a cache miss.
+ *
+ * Each node logs TRACE_EVT_GANG_RELEASE with how long it waited at the
+ * barrier, from its own clock. The first to arrive waits out the whole
+ * arrival spread, so the largest wait across the nodes is the skew of
+ * that collective; each node also publishes its wait in mesh_gang_t for
+ * gang_dump().
+ *
+ * The leader also publishes who made it: collectives that move data
+ * (sched/coll.c) build their ring from that set, so every node agrees on
+ * it even when a straggler was left behind.
+ */
+
+#ifndef _SCHED_GANG_H
+#define _SCHED_GANG_H
+
+#include <stdint.h>
+
+/* Give up on stragglers (or a dead leader) after this long */
+#define GANG_TIMEOUT_US (50 * 1000)
+
+typedef struct {
+  uint32_t collectives;   /* gang_dispatch() calls */
+  uint32_t solo;          /* Not in a mesh, or alone in it */
+  uint32_t led;           /* Released by this node as leader */
+  uint32_t timeouts;
+  uint32_t last_wait_us;
+  uint32_t max_wait_us;
+} gang_stats_t;
+
+/* Run step step_id of job job_id as a gang with every alive mesh node:
+ * returns once all have arrived at it (0), or -1 after GANG_TIMEOUT_US.
+ * members (may be NULL) gets the nodes released together, this one
+ * included; just this node's bit outside a mesh (bit 0)
+ */
+int gang_dispatch(uint32_t job_id, uint32_t step_id, uint32_t *members);
+
+void gang_get_stats(gang_stats_t *out);
+void gang_dump(void);
+
+#endif /* _SCHED_GANG_H */
@@ -0,0 +1,269 @@
+/* kernel/sched/idle_work.c - Background work for idle time
+ *
+ * A fixed table of items; each run picks the best item that still has
+ * work (priority, then least recently run), so equal priorities take
+ * turns and a higher one drains first. Main loop only: nothing is locked.
+ */
+
+#include "idle_work.h"
+#include "../console.h"
+#include "../ipc/heap.h"
+#include "../ipc/ipc.h"
+#include "../ipc/trace_export.h"
+#include "../time/time.h"
+#include "../trace/klog.h"
+#ifndef __x86_64__
+#include "../mm/zpool.h"
+#endif
+#include <stddef.h>
+
+#define IDLE_KLOG_BATCH    4       /* Records per slice */
+#define IDLE_HASH_CHUNK    4096    /* Bytes hashed between preemption checks */
+
+typedef struct {
+  idle_work_fn fn;              /* NULL: free */
+  void *arg;
+  uint8_t cls;
+  uint8_t prio;
+  uint8_t flags;
+  uint32_t budget_us;
+  uint32_t last_run;
+} idle_item_t;
+
+static idle_item_t items[IDLE_WORK_MAX];
+static idle_work_stats_t stats[IDLE_WORK_CLASSES];
+static uint32_t run_clock;
+
+/* The slice running now */
+static int in_slice;
+static uint32_t cur_wake;
+static cycles_t cur_deadline;
+
+static const char *const class_names[IDLE_WORK_CLASSES] = {
+  "klog", "trace", "digest", "compact", "zero", "other",
+};
+
+static int wake_pending(uint32_t wake) {
+  if ((wake & IDLE_WAKE_OBS) && ipc_stream_obs_pending())
+    return 1;
+  if ((wake & IDLE_WAKE_RSP) && ipc_has_response())
+    return 1;
+  return 0;
+}
+
+int idle_work_add(uint32_t cls, uint32_t prio, uint32_t budget_us, uint32_t flags,
+                  idle_work_fn fn, void *arg) {
+  if (!fn || cls >= IDLE_WORK_CLASSES || !budget_us)
+    return -1;
+  for (int i = 0; i < IDLE_WORK_MAX; i++) {
+    idle_item_t *it = &items[i];
+    if (it->fn)
+      continue;
+    it->fn = fn;
+    it->arg = arg;
+    it->cls = (uint8_t)cls;
+    it->prio = (uint8_t)prio;
+    it->flags = (uint8_t)flags;
+    it->budget_us = budget_us;
+    it->last_run = 0;
+    return i;
+  }
+  return -1;
+}
+
+void idle_work_remove(int id) {
+  if (id >= 0 && id < IDLE_WORK_MAX)
+    items[id].fn = NULL;
+}
+
+/* Helper: the item to run next, skipping those done this run */
+static idle_item_t *pick(uint32_t done_mask) {
+  idle_item_t *best = NULL;
+  for (int i = 0; i < IDLE_WORK_MAX; i++) {
+    idle_item_t *it = &items[i];
+    if (!it->fn || (done_mask & (1u << i)))
+      continue;
+    if (!best || it->prio > best->prio ||
+        (it->prio == best->prio && it->last_run < best->last_run))
+      best = it;
+  }
+  return best;
+}
+
+uint32_t idle_work_run(uint32_t wake, uint32_t max_us) {
+  if (in_slice || wake_pending(wake))
+    return 0;
+
+  cycles_t start = time_cycles();
+  cycles_t end = start + usec_to_cycles(max_us ? max_us : IDLE_WORK_PASS_US);
+  uint32_t done_mask = 0;
+  uint32_t units = 0;
+
+  for (;;) {
+    idle_item_t *it = pick(done_mask);
+    if (!it)
+      break;
+    cycles_t now = time_cycles();
+    if (now >= end || wake_pending(wake)) {
+      stats[it->cls].preempted++;
+      break;
+    }
+
+    cycles_t deadline = now + usec_to_cycles(it->budget_us);
+    in_slice = 1;
+    cur_wake = wake;
+    cur_deadline = deadline < end ? deadline : end;
+    uint32_t n = it->fn(it->arg, cur_deadline);
+    in_slice = 0;
+
+    cycles_t spent = time_cycles() - now;
+    uint32_t us = (uint32_t)cycles_to_usec(spent);
+    idle_work_stats_t *st = &stats[it->cls];
+    st->cycles += spent;
+    st->slices++;
+    st->units += n;
+    if (us > it->budget_us)
+      st->overruns++;
+    if (us > st->max_us)
+      st->max_us = us;
+
+    it->last_run = ++run_clock;
+    if (!n) {
+      done_mask |= 1u << (it - items);
+      if (it->flags & IDLE_WORK_ONESHOT)
+        it->fn = NULL;
+    }
+    units += n;
+  }
+  return units;
+}
+
+int idle_work_preempted(void) {
+  if (!in_slice)
+    return 0;
+  return time_cycles() >= cur_deadline || wake_pending(cur_wake);
+}
+
+/* Standing items */
+
+static uint32_t klog_slice(void *arg, uint64_t deadline) {
+  (void)arg;
+  (void)deadline;
+  return klog_drain(IDLE_KLOG_BATCH);
+}
+
+static uint32_t trace_slice(void *arg, uint64_t deadline) {
+  (void)arg;
+  (void)deadline;
+  return ipc_trace_poll();
+}
+
+static uint32_t compact_slice(void *arg, uint64_t deadline) {
+  (void)arg;
+  (void)deadline;
+  return heap_compact(1);
+}
+
+#ifndef __x86_64__
+static uint32_t zero_slice(void *arg, uint64_t deadline) {
+  (void)arg;
+  (void)deadline;
+  return zpool_refill(0);
+}
+#endif
+
+void idle_work_init(void) {
+  idle_work_add(IDLE_WORK_TRACE, IDLE_PRIO_HIGH, 20, 0, trace_slice, NULL);
+  idle_work_add(IDLE_WORK_KLOG, IDLE_PRIO_NORMAL, 20, 0, klog_slice, NULL);
+  idle_work_add(IDLE_WORK_COMPACT, IDLE_PRIO_LOW, 50, 0, compact_slice, NULL);
+#ifndef __x86_64__
+  idle_work_add(IDLE_WORK_ZERO, IDLE_PRIO_LOW, 50, 0, zero_slice, NULL);
+#endif
+}
+
+/* Deferred finalize */
+
+static heap_finalize_t finalize;
+static int hash_item = -1;
+
+static uint32_t hash_slice(void *arg, uint64_t deadline) {
+  (void)arg;
+  (void)deadline;
+  uint32_t chunks = 0;
+  int rc;
+  do {
+    rc = heap_blob_finalize_step(&finalize, IDLE_HASH_CHUNK);
+    chunks++;
+  } while (rc > 0 && !idle_work_preempted());
+  if (rc <= 0) {
+    idle_work_remove(hash_item);  /* Cached, or the blob is gone */
+    hash_item = -1;
+  }
+  return chunks;
+}
+
+int idle_work_finalize(uint16_t blob_id) {
+  if (finalize.blob_id) {
+    while (heap_blob_finalize_step(&finalize, 0) > 0)
+      ;
+  }
+  if (heap_blob_finalize_begin(&finalize, blob_id) != 0)
+    return -1;
+  if (hash_item < 0)
+    hash_item = idle_work_add(IDLE_WORK_DIGEST, IDLE_PRIO_NORMAL, 100, IDLE_WORK_ONESHOT,
+                              hash_slice, NULL);
+  if (hash_item < 0) {
+    while (heap_blob_finalize_step(&finalize, 0) > 0)
+      ;
+  }
+  return 0;
+}
+
+void idle_work_get_stats(uint32_t cls, idle_work_stats_t *out) {
+  if (!out)
+    return;
+  if (cls < IDLE_WORK_CLASSES) {
+    *out = stats[cls];
+    return;
+  }
+  idle_work_stats_t sum = {0};
+  for (uint32_t c = 0; c < IDLE_WORK_CLASSES; c++) {
+    sum.cycles += stats[c].cycles;
+    sum.slices += stats[c].slices;
+    sum.units += stats[c].units;
+    sum.overruns += stats[c].overruns;
+    sum.preempted += stats[c].preempted;
+    if (stats[c].max_us > sum.max_us)
+      sum.max_us = stats[c].max_us;
+  }
+  *out = sum;
+}
+
+void idle_work_dump(void) {
+  uint32_t queued = 0;
+  for (int i = 0; i < IDLE_WORK_MAX; i++)
+    queued += items[i].fn != NULL;
+  console_write("[idle] ");
+  print_uint(queued);
+  console_write(" items queued\n");
+  for (uint32_t c = 0; c < IDLE_WORK_CLASSES; c++) {
+    const idle_work_stats_t *st = &stats[c];
+    if (!st->slices && !st->preempted)
+      continue;
+    console_write("  ");
+    console_write(class_names[c]);
+    console_write(": ");
+    print_uint((uint32_t)cycles_to_usec(st->cycles));
+    console_write(" us in ");
+    print_uint(st->slices);
+    console_write(" slices, ");
+    print_uint(st->units);
+    console_write(" units, max ");
+    print_uint(st->max_us);
+    console_write(" us, over budget ");
+    print_uint(st->overruns);
+    console_write(", preempted ");
+    print_uint(st->preempted);
+    console_write("\n");
+  }
+}
@@ -0,0 +1,106 @@
+/* kernel/sched/idle_work.h - Background work for idle time
+ *
+ * Maintenance that can wait (draining deferred logs, exporting flight
+ * recorder events, defragmenting the shared heap, zeroing frames ahead,
+ * sealing and hashing finished blobs) queues here instead of running on
+ * the control path. The main loop calls idle_work_run() where it would
+ * otherwise pause or hlt for an observation or a response.
+ *
+ * Items run highest priority first, one slice at a time, each slice
+ * bounded by the item's own budget. Between slices, and from inside an
+ * item through idle_work_preempted(), the wake sources the caller waits
+ * on are checked: a new observation or response stops the run at once.
+ * Time is charged per work class.
+ */
+
+#ifndef _SCHED_IDLE_WORK_H
+#define _SCHED_IDLE_WORK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IDLE_WORK_MAX     16
+#define IDLE_WORK_PASS_US 200   /* Default bound of one idle_work_run() */
+
+/* Work classes, for accounting */
+enum {
+  IDLE_WORK_KLOG = 0,           /* Deferred log records to the console */
+  IDLE_WORK_TRACE,              /* Flight recorder events to the bridge */
+  IDLE_WORK_DIGEST,             /* Seal and hash finished blobs */
+  IDLE_WORK_COMPACT,            /* Shared heap defragmentation */
+  IDLE_WORK_ZERO,               /* Frames zeroed ahead */
+  IDLE_WORK_OTHER,
+  IDLE_WORK_CLASSES
+};
+
+/* Priorities: higher runs first */
+#define IDLE_PRIO_LOW    0
+#define IDLE_PRIO_NORMAL 1
+#define IDLE_PRIO_HIGH   2
+
+/* Wake sources idle_work_run() yields to */
+#define IDLE_WAKE_OBS 0x01      /* An observation on the stream ring */
+#define IDLE_WAKE_RSP 0x02      /* A response from the bridge */
+
+/* Item flags */
+#define IDLE_WORK_ONESHOT 0x01  /* Dropped once it reports nothing left */
+
+/* One slice of work, to finish by deadline (time_cycles())
+ * Returns: units done; 0 = nothing (left) to do
+ */
+typedef uint32_t (*idle_work_fn)(void *arg, uint64_t deadline);
+
+typedef struct {
+  uint64_t cycles;              /* Spent in slices */
+  uint32_t slices;
+  uint32_t units;
+  uint32_t overruns;            /* Slices past their budget */
+  uint32_t max_us;              /* Longest slice */
+  uint32_t preempted;           /* Runs cut short before this class's turn */
+} idle_work_stats_t;
+
+/* Queue fn(arg) under class cls
+ * budget_us: bound of one slice (the deadline it is handed)
+ * Returns: item id, or -1 if the queue is full
+ */
+int idle_work_add(uint32_t cls, uint32_t prio, uint32_t budget_us, uint32_t flags,
+                  idle_work_fn fn, void *arg);
+
+/* Drop an item before it runs again */
+void idle_work_remove(int id);
+
+/* Run slices, best first, until nothing has work, max_us passes or a wake
+ * source in wake (IDLE_WAKE_*) is pending
+ * Returns: units done
+ */
+uint32_t idle_work_run(uint32_t wake, uint32_t max_us);
+
+/* From inside a slice: nonzero once a wake source of the current run is
+ * pending or the slice's deadline has passed
+ */
+int idle_work_preempted(void);
+
+/* Queue the kernel's standing maintenance: log draining, trace export,
+ * heap compaction and (i386) frame zeroing; after ipc_init()
+ */
+void idle_work_init(void);
+
+/* heap_blob_finalize() off the control path: the blob is read-only and
+ * sealed now, hashed in idle slices. One blob at a time; a second call
+ * finishes the first one's digest on the spot.
+ * Returns: 0, or -1 if the blob is gone
+ */
+int idle_work_finalize(uint16_t blob_id);
+
+/* Counters of class cls, or of all of them with IDLE_WORK_CLASSES */
+void idle_work_get_stats(uint32_t cls, idle_work_stats_t *out);
+void idle_work_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SCHED_IDLE_WORK_H */
@@ -3,8 +3,16 @@
 #include "../console.h"
 #include "../mm/pmm.h"
 #include "../mm/vmm.h"
+#include "../mm/slab.h"
+#include "../arch/fpu.h"
 #include "../arch/gdt.h"
+#include "../arch/idt.h"
+#include "../ipc/ipc_proto.h"
+#include "../trace/klog.h"
+#include "../zenedge_alloc.h"
 #include "sched_core.h"
+#include "tmap.h"
+#include "vdata.h"
 #include "../include/string.h"
 
 extern void enter_user_mode(void *entry_point, void *user_stack);
@@ -12,23 +20,49 @@ extern void enter_user_mode(void *entry_point, void *user_stack);
 /* Global list (for now, simplistic) */
 extern process_t *process_list;
 
+/* User stack: just below the kernel, demand-zero down from the top */
+#define USER_STACK_TOP  0xBFFFF000
+#define USER_STACK_SIZE (1024 * 1024)
+
+/* PCBs come from their own cache, a few dozen to a page */
+static kmem_cache_t *pcb_cache = NULL;
+
+process_t *sched_alloc_pcb(void) {
+    if (!pcb_cache) {
+        pcb_cache = kmem_cache_create("process", sizeof(process_t), 16, NULL);
+    }
+    process_t *proc = (process_t *)kmem_cache_alloc(pcb_cache);
+    if (proc) {
+        memset(proc, 0, sizeof(process_t));
+    }
+    return proc;
+}
+
+void sched_free_pcb(process_t *proc) {
+    kmem_cache_free(pcb_cache, proc);
+}
+
+/* Assign generic PID (1..N) */
+static uint32_t sched_next_pid(void) {
+    static uint32_t pid_counter = 1;
+    return pid_counter++;
+}
+
 process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_phys, uint32_t wasm_size) {
     /* 1. Allocate Process Struct (PCB) */
-    paddr_t proc_phys = pmm_alloc_page(NUMA_NODE_LOCAL);
-    if (!proc_phys) return NULL;
-    
-    process_t *proc = (process_t *)phys_to_virt(proc_phys);
-    memset(proc, 0, sizeof(process_t));
+    process_t *proc = sched_alloc_pcb();
+    if (!proc) return NULL;
     
-    // Assign generic PID (1..N)
-    static uint32_t pid_counter = 1;
-    proc->pid = pid_counter++;
+    proc->pid = sched_next_pid();
     proc->state = PROCESS_STATE_NEW;
+    proc->cpu = IPC_CHAN_CPU_ANY;
+    proc->wasm_blob = wasm_blob_phys ? (const uint8_t *)phys_to_virt(wasm_blob_phys) : NULL;
+    proc->wasm_size = wasm_size;
     
     /* 2. Create Page Directory */
     proc->cr3 = vmm_create_user_pd();
     if (!proc->cr3) {
-        pmm_free_page(proc_phys);
+        sched_free_pcb(proc);
         return NULL;
     }
     proc->pd_virt = (uint32_t *)phys_to_virt(proc->cr3);
@@ -37,22 +71,25 @@ process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_ph
     paddr_t kstack_phys = pmm_alloc_page(NUMA_NODE_LOCAL);
     if (!kstack_phys) {
         vmm_destroy_user_pd(proc->cr3);
-        pmm_free_page(proc_phys);
+        sched_free_pcb(proc);
         return NULL;
     }
     proc->kstack_top = (uint32_t)phys_to_virt(kstack_phys) + 4096;
 
-    /* 4. Map User Stack/Heap (Minimal setup for now) */
-    /* Stack at 0xBFFFF000 (just below kernel) */
-    /* We'll just map one page for stack for now */
-    paddr_t current_pd = vmm_get_current_pd();
-    vmm_switch_pd(proc->cr3);
-    
-    // Process-specific mappings would happen here
-    // For now we assume the caller/loader will handle mapping code/data
-    
-    vmm_switch_pd(current_pd);
+    /* 4. Reserve the user stack: pages appear as it grows */
+    int rc = vmm_reserve_range_in(proc->cr3, USER_STACK_TOP - USER_STACK_SIZE,
+                                  USER_STACK_SIZE, PTE_USER_RW);
+    if (rc != 0) {
+        pmm_free_page(kstack_phys);
+        vmm_destroy_user_pd(proc->cr3);
+        sched_free_pcb(proc);
+        return NULL;
+    }
+    proc->ustack_top = USER_STACK_TOP;
 
+    /* Read-only kernel data page; the process runs without it if short */
+    if (vdata_map(proc) != 0)
+        KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "[proc] pid=%u: no vdata page", proc->pid);
 
     /* 5. Setup Trampoline for Context Switch */
     /* When switch_to switches TO this process, it will pop registers and 'ret'.
@@ -60,7 +97,7 @@ process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_ph
      *
      * Stack Layout at proc->esp:
      * [ ... ]
-     * [Arg 2   ] User Stack Top (0xBFFFF000)
+     * [Arg 2   ] User Stack Top (USER_STACK_TOP)
      * [Arg 1   ] Entry Point
      * [RetAddr ] 0 (Fake return for enter_user_mode)
      * [RetAddr ] enter_user_mode (where switch_to returns to)
@@ -73,7 +110,7 @@ process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_ph
     uint32_t *sp = (uint32_t *)proc->kstack_top;
     
     /* Push Args for enter_user_mode */
-    *(--sp) = 0xBFFFF000;    /* User Stack */
+    *(--sp) = USER_STACK_TOP; /* User Stack */
     *(--sp) = entry_point;   /* Entry Point */
     *(--sp) = 0;             /* Fake Return */
     *(--sp) = (uint32_t)enter_user_mode;
@@ -88,14 +125,71 @@ process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_ph
     
     /* 6. Default Contract */
     proc->mem_pages_limit = 256; /* 1MB limit */
-    proc->quantum_ms = 50;
-    proc->ticks_remaining = 5;
+    proc->prio = CONTRACT_PRIORITY_NORMAL;
+    proc->quantum_ms = 0;        /* By priority */
+
+    /* Deferred: spawning takes microseconds, the UART a millisecond */
+    KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "[proc] created pid=%u cr3=%x", proc->pid, proc->cr3);
+
+    return proc;
+}
+
+/* First code a kernel thread runs (where switch_to returns to) */
+static void kernel_process_start(void) {
+    /* Arrived from sched_switch with interrupts off */
+    interrupts_enable();
+
+    process_t *self = sched_current();
+    self->kentry(self->karg);
+    sched_exit();
+}
+
+process_t *sched_create_kernel_process(void (*entry)(void *), void *arg,
+                                       uint32_t kstack_pages, uint32_t quantum_ms) {
+    if (!entry || kstack_pages == 0) return NULL;
 
-    console_write("[proc] created pid=");
+    process_t *proc = sched_alloc_pcb();
+    if (!proc) return NULL;
+
+    /* Shares the kernel address space (and PID space with user processes) */
+    proc->pid = sched_next_pid();
+    proc->state = PROCESS_STATE_NEW;
+    proc->flags = PROCESS_FLAG_KERNEL;
+    proc->cr3 = vmm_get_current_pd();
+    proc->pd_virt = (uint32_t *)phys_to_virt(proc->cr3);
+    proc->cpu = IPC_CHAN_CPU_ANY;
+    proc->kentry = entry;
+    proc->karg = arg;
+
+    /* Kernel Stack: wasm3 recurses on it, so usually more than a page */
+    zalloc_result_t ks = zenedge_alloc_pages(kstack_pages, ZNODE_ANY);
+    if (!ks.addr) {
+        sched_free_pcb(proc);
+        return NULL;
+    }
+    proc->kstack_pages = kstack_pages;
+    proc->kstack_top = (uint32_t)phys_to_virt((paddr_t)ks.addr) + kstack_pages * PAGE_SIZE;
+
+    /* Trampoline: switch_to pops the callee-saved regs and 'ret's into
+     * kernel_process_start, which never returns.
+     */
+    uint32_t *sp = (uint32_t *)proc->kstack_top;
+    *(--sp) = 0;             /* Fake Return */
+    *(--sp) = (uint32_t)kernel_process_start;
+    *(--sp) = 0; /* EBP */
+    *(--sp) = 0; /* EBX */
+    *(--sp) = 0; /* ESI */
+    *(--sp) = 0; /* EDI */
+    proc->esp = (uint32_t)sp;
+
+    proc->prio = CONTRACT_PRIORITY_NORMAL;
+    proc->quantum_ms = quantum_ms;  /* 0 = by priority */
+
+    console_write("[proc] created kernel pid=");
     print_uint(proc->pid);
-    console_write(" cr3=");
-    print_hex32(proc->cr3);
-    console_write("\n");
+    console_write(" stack=");
+    print_uint(kstack_pages * 4);
+    console_write("KB\n");
 
     return proc;
 }
@@ -103,22 +197,62 @@ process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_ph
 void sched_destroy_process(process_t *proc) {
     if (!proc) return;
     
-    console_write("[proc] destroying pid=");
-    print_uint(proc->pid);
-    console_write("\n");
+    KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "[proc] destroying pid=%u", proc->pid);
+
+    fpu_release(proc);
 
     /* Free Kernel Stack */
-    if (proc->kstack_top) {
+    if (proc->kstack_pages) {
+        uint32_t bytes = proc->kstack_pages * PAGE_SIZE;
+        zenedge_free_pages((zphys_t)virt_to_phys(proc->kstack_top - bytes), proc->kstack_pages);
+    } else if (proc->kstack_top) {
         paddr_t kstack_phys = virt_to_phys(proc->kstack_top - 4096);
         pmm_free_page(kstack_phys);
     }
     
-    /* Free Page Directory */
-    if (proc->cr3) {
+    /* Blobs it mapped go back to the heap */
+    tmap_release_all(proc);
+
+    /* Free Page Directory (kernel threads borrow the kernel's) */
+    if (proc->cr3 && !(proc->flags & PROCESS_FLAG_KERNEL)) {
         vmm_destroy_user_pd(proc->cr3);
     }
     
     /* Free PCB */
-    paddr_t proc_phys = virt_to_phys((vaddr_t)proc);
-    pmm_free_page(proc_phys);
+    sched_free_pcb(proc);
+}
+
+/* #PF: demand-zero and copy-on-write pages of the current address space.
+ * Anything else kills a user process, or the kernel if it faulted itself
+ */
+static void sched_page_fault(interrupt_frame_t *frame) {
+    vaddr_t addr;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(addr));
+
+    process_t *proc = sched_current();
+    int pages = vmm_handle_fault(addr, frame->err_code);
+    if (pages < 0) {
+        if (!(frame->err_code & PF_USER) || !proc)
+            idt_panic(frame);
+        console_write("[proc] pid=");
+        print_uint(proc->pid);
+        console_write(" page fault at ");
+        print_hex32(addr);
+        console_write(", killed\n");
+        sched_exit();
+    }
+
+    if (!proc)
+        return;
+    proc->mem_pages_used += (uint32_t)pages;
+    if (proc->mem_pages_limit && proc->mem_pages_used > proc->mem_pages_limit) {
+        console_write("[proc] pid=");
+        print_uint(proc->pid);
+        console_write(" over its memory contract, killed\n");
+        sched_exit();
+    }
+}
+
+void sched_fault_init(void) {
+    idt_register_handler(INT_PAGE_FAULT, sched_page_fault);
 }
@@ -1,43 +1,103 @@
 /* kernel/sched/sched_core.c */
 #include "sched_core.h"
 #include "../arch/gdt.h"
+#include "../arch/fpu.h"
+#include "../arch/idt.h"
 #include "../console.h"
 #include "../mm/pmm.h"
 #include "../mm/vmm.h"
 #include "../process.h"
 #include "../time/time.h"
 #include "../trace/flightrec.h"
+#include "../trace/klog.h"
+#include "../trace/lat.h"
+#include "../trace/prof.h"
 #include "../ipc/ipc.h"
 #include "../ipc/ipc_proto.h"
+#include "../ipc/mesh_work.h"
+#include "../ipc/run_batch.h"
 #include "../arch/pit.h"
+#include "../arch/pic.h"
+#include "../arch/apic.h"
 #include "../include/string.h"
 #include "sched_core.h"
+#include "coll.h"
+#include "gang.h"
+#include "step_memo.h"
+#include "vdata.h"
 
 /* Helper to print uint in sched */
 /* Now using global console helpers print_uint and print_hex32 */
 
-static volatile int ipc_irq_received = 0;
+/* A step dispatched by sched_run_jobs() and not yet finished. Slots stay
+ * put while in flight: the completion callback holds a pointer.
+ */
+typedef struct {
+  sched_job_ctx_t *ctx;
+  job_step_t *step;       /* NULL: slot free */
+  usec_t budget_us;       /* Its share of the contract's CPU budget */
+  trace_span_t span;
+  ipc_tag_t tag;          /* IPC_TAG_NONE: ran synchronously */
+  uint32_t remote;        /* mesh_work handle, 0 = not on another node */
+  int place_node;         /* mesh_work_place() choice, -1 = not placed */
+  uint32_t place_est_us;  /* Estimate and predicted completion it used */
+  uint32_t place_pred_us;
+  cycles_t start_cycles;
+  usec_t deadline_us;
+  volatile int done;      /* 1 = response in rsp, -1 = failed or timed out */
+  ipc_response_t rsp;
+  uint64_t memo_key;      /* Cache the result under this key, 0 = don't */
+  uint8_t memo_hit;       /* rsp came from the memo cache */
+} step_flight_t;
+
+#define STEP_TIMEOUT_US (5000 * 1000ULL)
 
-static void sched_ipc_callback(void) {
-    ipc_irq_received = 1;
+/* Completion callback, from whatever drained the response ring (usually
+ * the IPC IRQ): the step is done, its owner picks it up in flight_wait()
+ */
+static void step_complete(const ipc_response_t *rsp, void *arg) {
+  step_flight_t *f = (step_flight_t *)arg;
+  f->rsp = *rsp;
+  f->done = 1;
 }
 
-static void execute_step(const job_step_t *s, const task_contract_t *c) {
+/* Start a step. Compute steps are offloaded and left in flight (f->tag),
+ * or sent to a less loaded mesh node (f->remote); collectives run as a gang with the rest of
+ * the mesh, reducing or gathering their tensors around it (sched/coll.h); anything else is
+ * simulated here. All but compute are done on return.
+ */
+static void step_start(step_flight_t *f, const task_contract_t *c) {
   (void)c;
+  const job_step_t *s = f->step;
+  f->tag = IPC_TAG_NONE;
+  f->done = 0;
+  f->place_node = -1;
 
-  /* For non-compute steps, simulation is fine for now */
-  /* In a real system, COLLECTIVE would also use IPC/Fabric */
+  /* The CPU is held at the barrier: send any batched offloads first so
+   * the bridge works on them meanwhile
+   */
+  if (s->type == STEP_TYPE_COLLECTIVE) {
+      ipc_run_model_flush(1);
+      uint32_t result;
+      int rc = coll_run(f->ctx->job->id, s, &result);
+      f->done = rc == 0 ? 1 : -1;
+      f->rsp.status = rc == 0 ? RSP_OK : RSP_ERROR;
+      f->rsp.result = result;
+      return;
+  }
+
+  /* For other non-compute steps, simulation is fine for now */
   if (s->type != STEP_TYPE_COMPUTE) {
-      console_write("[sched] simulating non-compute step ");
-      print_uint(s->id);
-      console_write("\n");
+      KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_DEBUG, "simulating non-compute step %u",
+            s->id);
       for (volatile uint32_t i = 0; i < 100000; i++) { }
+      f->done = 1;
+      f->rsp.status = RSP_OK;
       return;
   }
 
-  console_write("[sched] Offloading COMPUTE step ");
-  print_uint(s->id);
-  console_write(" to Bridge...\n");
+  KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "Offloading COMPUTE step %u to Bridge...",
+        s->id);
 
   /* Identify input tensor (use first input as payload) */
   uint32_t payload_id = 0;
@@ -45,151 +105,476 @@ static void execute_step(const job_step_t *s, const task_contract_t *c) {
       payload_id = s->inputs[0];
   }
 
-  /* Send IPC Command */
-  cycles_t start_cycles = rdtsc();
-  
-  if (ipc_send(CMD_RUN_MODEL, payload_id) != 0) {
-      console_write("[sched] Failed to send IPC command (Ring full?)\n");
-      return;
-  }
+  /* Queue the offload: compute steps of this and other jobs that come in
+   * within the batch window go to the bridge with it as one batched
+   * inference
+   */
+  f->start_cycles = rdtsc();
+  f->deadline_us = time_usec() + STEP_TIMEOUT_US;
 
-  /* Poll for Completion (Adaptive Polling) */
-  /* Strategy: Spin for 2ms (covering most fast inferences), then sleep. */
-  
-  ipc_response_t rsp;
-  cycles_t wait_start = rdtsc();
-  int timeout_ms = 5000;
-  int received = 0;
-  
-  while (timeout_ms > 0) {
-      if (ipc_poll_response(&rsp)) {
-          received = 1;
-          break;
-      }
-      
-      /* Check how long we've been waiting in this cycle */
-      usec_t elapsed = cycles_to_usec(rdtsc() - wait_start);
-      
-      /* Increase spin threshold to handle TSC calibration skew.
-       * 100000us assumed might be only 25ms real time if CPU is fast.
-       */
-      if (elapsed < 100000) {
-          /* Busy wait / Relax */
-          __asm__ __volatile__("pause");
-      } else {
-          /* We've spun for 2ms, switch to sleep to save CPU */
-          pit_sleep_ms(1);
-          timeout_ms--; 
-          /* Reset spin counter? No, just sleep from now on?
-           * Actually, for a single step, if it takes >2ms, we can just sleep.
-           * But to be robust, we just keep sleeping after the initial spin period expired.
-           */
+  f->place_est_us = s->est_us;
+  int node = mesh_work_place(f->ctx->job->id, s->id, s->est_us, payload_id, &f->place_pred_us);
+  f->place_node = node;
+  if (node >= 0 && node != ipc_mesh_local_id()) {
+      f->remote = mesh_work_submit((uint32_t)node, f->ctx->job->id, s->id, 0, payload_id,
+                                   step_complete, f);
+      if (f->remote) {
+          f->ctx->remote_steps++;
+          KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "COMPUTE step %u sent to mesh node %u",
+                s->id, node);
+          return;
       }
+      f->place_node = ipc_mesh_local_id();
   }
 
-  if (received) {
-      cycles_t end_cycles = rdtsc();
-      usec_t total_rtt_us = cycles_to_usec(end_cycles - start_cycles);
-      usec_t server_us = (usec_t)rsp.timestamp; /* Repurposed for duration */
-      usec_t transport_us = (total_rtt_us > server_us) ? (total_rtt_us - server_us) : 0;
-
-      console_write("[sched] Step complete. Result: ");
-      print_hex32(rsp.result);
-      console_write("\n");
-      
-      console_write("[sched] Latency Breakdown: Total=");
-      print_uint((uint32_t)total_rtt_us);
-      console_write("us (Server=");
-      print_uint((uint32_t)server_us);
-      console_write("us, Transport=");
-      print_uint((uint32_t)transport_us);
-      console_write("us)\n");
-
-      /* Optional: Validation of result? */
-      if (rsp.status != RSP_OK) {
-           console_write("[sched] Remote error status: ");
-           print_hex32(rsp.status);
-           console_write("\n");
-      }
+  f->tag = ipc_run_model_submit(0, payload_id);
+  if (f->tag == IPC_TAG_NONE) {
+      KLOG(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "Failed to send IPC command (Ring full?)");
+      f->done = -1;
   } else {
-      console_write("[sched] TIMEOUT waiting for remote execution!\n");
+      ipc_completion_set_cb(f->tag, step_complete, f);
+  }
+}
+
+/* A memoized COMPUTE step is done on the spot when the cache has its
+ * result; otherwise its key is kept for step_finish() to cache the result
+ * under. Returns 1 on a hit.
+ */
+static int step_memo_try(step_flight_t *f) {
+  sched_job_ctx_t *ctx = f->ctx;
+  const job_step_t *s = f->step;
+  f->memo_key = 0;
+  f->memo_hit = 0;
+  if (!s->memoize || s->type != STEP_TYPE_COMPUTE)
+    return 0;
+  uint64_t key = step_memo_key(s, 0);
+  if (!key)
+    return 0;
+
+  uint32_t blob = step_memo_lookup(key);
+  if (!blob) {
+    f->memo_key = key;
+    ctx->memo_misses++;
+    flightrec_log(TRACE_EVT_STEP_MEMO_MISS, ctx->job->id, s->id, 0);
+    return 0;
+  }
+  ctx->memo_hits++;
+  flightrec_log(TRACE_EVT_STEP_MEMO_HIT, ctx->job->id, s->id, blob);
+  f->tag = IPC_TAG_NONE;
+  f->rsp.status = RSP_OK;
+  f->rsp.orig_cmd = CMD_RUN_MODEL;
+  f->rsp.result = blob;
+  f->rsp.timestamp = 0;
+  f->memo_hit = 1;
+  f->done = 1;
+  return 1;
+}
+
+/* Log how an offloaded step went */
+static void step_report(const step_flight_t *f) {
+  if (f->done != 1) {
+      KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "TIMEOUT (or lost tag) waiting for remote execution of step %u!",
+            f->step->id);
+      return;
+  }
+
+  cycles_t end_cycles = rdtsc();
+  usec_t total_rtt_us = cycles_to_usec(end_cycles - f->start_cycles);
+  usec_t server_us = (usec_t)f->rsp.timestamp; /* Repurposed for duration */
+  usec_t transport_us = (total_rtt_us > server_us) ? (total_rtt_us - server_us) : 0;
+
+  KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "Step %u complete. Result: %x",
+        f->step->id, f->rsp.result);
+  KLOG3(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO,
+        "Latency Breakdown: Total=%uus (Server=%uus, Transport=%uus)",
+        total_rtt_us, server_us, transport_us);
+  lat_record(LAT_STEP_TOTAL, (uint32_t)total_rtt_us);
+  lat_record(LAT_STEP_SERVER, (uint32_t)server_us);
+  lat_record(LAT_STEP_TRANSPORT, (uint32_t)transport_us);
+
+  /* Optional: Validation of result? */
+  if (f->rsp.status != RSP_OK) {
+       KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_ERR, "Remote error status: %x", f->rsp.status);
+  }
+}
+
+/* Close a done step's span, learn its duration, check it against its
+ * budget and release its dependents
+ */
+static void step_finish(step_flight_t *f) {
+  sched_job_ctx_t *ctx = f->ctx;
+  job_step_t *step = f->step;
+  step_id_t sid = step->id;
+  if (f->tag != IPC_TAG_NONE || f->remote)
+    step_report(f);
+
+  /* End span - this logs STEP_END with duration in 'extra' field */
+  flightrec_end_span(f->span, TRACE_EVT_STEP_END);
+
+  /* Check contract: did this step exceed per-step budget? */
+  usec_t step_duration = flightrec_last_duration(ctx->job->id, (uint32_t)sid);
+  usec_t per_step_budget = f->budget_us;
+  lat_record_step(ctx->job->id, (uint32_t)step_duration);
+
+  if (step_duration > per_step_budget) {
+    /* Budget exceeded - log violation */
+    KLOG3(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN,
+          "BUDGET EXCEED: step %u took %uus (limit: %uus)",
+          sid, step_duration, per_step_budget);
+
+    flightrec_log(TRACE_EVT_CONTRACT_BUDGET_EXCEED, ctx->job->id,
+                  (uint32_t)sid, (uint32_t)step_duration);
+  } else if (step_duration > (per_step_budget * 80) / 100) {
+    /* Approaching budget (>80%) - log warning */
+    flightrec_log(TRACE_EVT_CONTRACT_BUDGET_WARN, ctx->job->id, (uint32_t)sid,
+                  (uint32_t)step_duration);
+  }
+
+  if (f->place_node >= 0 && f->done == 1 && f->rsp.status == RSP_OK && !f->memo_hit) {
+    uint32_t actual = step_duration > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)step_duration;
+    mesh_work_place_done((uint32_t)f->place_node, ctx->job->id, (uint32_t)sid,
+                         f->place_est_us, f->place_pred_us, actual,
+                         (uint32_t)f->rsp.timestamp);
+  }
+
+  if (f->memo_key && f->done == 1 && f->rsp.status == RSP_OK && f->rsp.result)
+    step_memo_insert(f->memo_key, f->rsp.result, ctx->job->id, &ctx->contract);
+
+  /* Moving average (1/4 weight) of what the step has taken; a memo hit
+   * says nothing about that
+   */
+  if (step_duration && !f->memo_hit) {
+    uint32_t d = step_duration > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)step_duration;
+    step->est_us = step->est_learned ? (uint32_t)(((uint64_t)step->est_us * 3 + d) / 4) : d;
+    if (!step->est_learned)
+      step->est_learned = 1;
+    ctx->cpu_used_us = d > ~ctx->cpu_used_us ? 0xFFFFFFFFu : ctx->cpu_used_us + d;
+  }
+
+  job_graph_mark_completed(ctx->job, sid);
+
+  /* The dependents it released start queueing now */
+  job_graph_t *job = ctx->job;
+  if (job->compiled) {
+    usec_t now = time_usec();
+    uint32_t i = (uint32_t)(step - job->steps);
+    for (uint32_t k = job->succ_off[i]; k < job->succ_off[i + 1]; k++) {
+      job_step_t *d = &job->steps[job->succ[k]];
+      if (!d->pending && !d->ready_us)
+        d->ready_us = now;
+    }
+  }
+}
+
+static int flight_any_done_now(const step_flight_t *flight) {
+  for (uint32_t i = 0; i < SCHED_MAX_INFLIGHT; i++)
+    if (flight[i].step && flight[i].done)
+      return 1;
+  return 0;
+}
+
+/* ipc_wait_until() condition: send due batches and route responses (the
+ * IRQ does that too once armed; step_complete() marks the steps)
+ */
+static int flight_any_done(void *arg) {
+  ipc_run_model_flush(0);
+  ipc_process_responses();
+  ipc_msg_process();
+  mesh_work_poll();
+  return flight_any_done_now((const step_flight_t *)arg);
+}
+
+/* Wait for at least one in-flight step to finish (fail those past their
+ * deadline instead). The wait blocks the calling process, so other
+ * processes run while the bridge or a mesh node works.
+ */
+static void flight_wait(step_flight_t *flight) {
+  usec_t now = time_usec();
+  usec_t first = 0;
+  for (uint32_t i = 0; i < SCHED_MAX_INFLIGHT; i++) {
+    if (!flight[i].step)
+      continue;
+    if (flight[i].done)
+      return;
+    if (!first || flight[i].deadline_us < first)
+      first = flight[i].deadline_us;
+  }
+
+  usec_t timeout = first > now ? first - now : 1;
+  if (ipc_wait_until(flight_any_done, flight, timeout) == 0)
+    return;
+
+  now = time_usec();
+  for (uint32_t i = 0; i < SCHED_MAX_INFLIGHT; i++) {
+    step_flight_t *f = &flight[i];
+    if (f->step && !f->done && now >= f->deadline_us) {
+      if (f->remote)
+        mesh_work_cancel(f->remote);
+      else
+        ipc_completion_cancel(f->tag);
+      f->done = -1;
+    }
   }
 }
 
 void sched_init(void) { console_write("[sched] init\n"); }
 
-void sched_run_job(sched_job_ctx_t *ctx) {
-  if (!ctx || !ctx->job)
+/* flightrec_for_each_step_end() callback: the newest run of a step not
+ * measured so far becomes its estimate
+ */
+static void learn_step(uint32_t step_id, usec_t duration_us, void *arg) {
+  job_step_t *s = job_graph_get_step((job_graph_t *)arg, step_id);
+  if (!s || s->est_learned || duration_us == 0)
     return;
+  s->est_us = duration_us > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)duration_us;
+  s->est_learned = 1;
+}
 
-  console_write("[sched] run_job begin (budget: ");
-  print_uint(ctx->contract.cpu_budget_us);
-  console_write("us)\n");
+/* Fill in step durations from the flight recorder, else the estimate the
+ * job came with (submitted graphs), else the per-type guess; compiling
+ * then ranks the steps by critical path
+ */
+static void estimate_steps(job_graph_t *job) {
+  flightrec_for_each_step_end(job->id, learn_step, job);
+  for (uint32_t i = 0; i < job->num_steps; i++)
+    if (!job->steps[i].est_learned && !job->steps[i].est_us)
+      job->steps[i].est_us = job_step_default_us(job->steps[i].type);
+}
+
+static uint32_t job_limit(const sched_job_ctx_t *ctx) {
+  if (ctx->contract.state == CONTRACT_STATE_SAFE_MODE)
+    return 1;
+  uint32_t limit = ctx->max_inflight;
+  return (limit == 0 || limit > SCHED_MAX_INFLIGHT) ? SCHED_MAX_INFLIGHT : limit;
+}
+
+/* Dispatched ahead of the fair share, earliest deadline first */
+static int job_realtime(const sched_job_ctx_t *ctx) {
+  return ctx->contract.prio == CONTRACT_PRIORITY_REALTIME &&
+         ctx->contract.state != CONTRACT_STATE_SAFE_MODE;
+}
+
+/* Fair-share weight: the priority's, times the quarters of the CPU
+ * budget left (rounded up, at least 1; 4 without a budget). SAFE_MODE
+ * gets the lowest there is.
+ */
+static uint32_t job_weight(const sched_job_ctx_t *ctx) {
+  static const uint32_t prio_weight[] = {
+      SCHED_FAIR_WEIGHT_LOW, SCHED_FAIR_WEIGHT_NORMAL, SCHED_FAIR_WEIGHT_HIGH,
+      SCHED_FAIR_WEIGHT_HIGH,
+  };
+  if (ctx->contract.state == CONTRACT_STATE_SAFE_MODE)
+    return SCHED_FAIR_WEIGHT_LOW;
+  uint32_t prio = ctx->contract.prio > CONTRACT_PRIORITY_REALTIME
+                      ? CONTRACT_PRIORITY_REALTIME : ctx->contract.prio;
+  uint32_t budget = ctx->contract.cpu_budget_us;
+  uint32_t quarters = 4;
+  if (budget) {
+    uint64_t left = ctx->cpu_used_us < budget ? budget - ctx->cpu_used_us : 0;
+    quarters = (uint32_t)((left * 4 + budget - 1) / budget);
+    if (!quarters)
+      quarters = 1;
+  }
+  return prio_weight[prio] * quarters;
+}
+
+/* Virtual time a job's next step would start at: its own, or vnow if it
+ * fell behind (blocked or idle time is not banked as credit)
+ */
+static uint64_t job_vstart(const sched_job_ctx_t *ctx, uint64_t vnow) {
+  return ctx->vtime > vnow ? ctx->vtime : vnow;
+}
 
-  /* Log job submission */
-  flightrec_log(TRACE_EVT_JOB_SUBMIT, ctx->job->id, 0, ctx->job->num_steps);
+/* Whether job a's next ready step sa should be dispatched before job b's
+ * sb: REALTIME jobs first, earliest deadline first among them; the rest
+ * by fair-share virtual start, then contract priority; then the step
+ * with the longer critical path
+ */
+static int job_before(const sched_job_ctx_t *a, const job_step_t *sa,
+                      const sched_job_ctx_t *b, const job_step_t *sb, uint64_t vnow) {
+  int rt_a = job_realtime(a);
+  int rt_b = job_realtime(b);
+  if (rt_a != rt_b)
+    return rt_a;
+  if (rt_a) {
+    uint64_t da = a->contract.deadline_us ? a->contract.deadline_us : ~0ULL;
+    uint64_t db = b->contract.deadline_us ? b->contract.deadline_us : ~0ULL;
+    if (da != db)
+      return da < db;
+  } else {
+    uint64_t va = job_vstart(a, vnow);
+    uint64_t vb = job_vstart(b, vnow);
+    if (va != vb)
+      return va < vb;
+    if (a->contract.prio != b->contract.prio)
+      return a->contract.prio > b->contract.prio;
+  }
+  return sa->rank_us > sb->rank_us;
+}
 
-  /* Super simple: while there is a ready step, "run" it. */
-  while (1) {
-    int sid = job_graph_next_ready(ctx->job);
-    if (sid < 0) {
-      console_write("[sched] no ready steps left\n");
-      break;
+/* Step's share of the contract budget, in proportion to its estimate */
+static usec_t step_budget(const sched_job_ctx_t *ctx, const job_step_t *s) {
+  const job_graph_t *job = ctx->job;
+  if (!job->total_est_us)
+    return ctx->contract.cpu_budget_us / job->num_steps;
+  return (usec_t)ctx->contract.cpu_budget_us * s->est_us / job->total_est_us;
+}
+
+static void locality_count(sched_job_ctx_t *ctx, const job_step_t *s,
+                           const tensor_desc_t *t) {
+  if (t->home_node == s->node) {
+    ctx->locality_hits++;
+    return;
+  }
+  ctx->locality_misses++;
+  flightrec_log(TRACE_EVT_MEM_LOCALITY_MISS, ctx->job->id, s->id, t->id);
+}
+
+/* Place a step on the node most of its input bytes are on, then give its
+ * outputs pages there; inputs and outputs elsewhere count as misses
+ */
+static void step_place(sched_job_ctx_t *ctx, job_step_t *s) {
+  job_graph_t *job = ctx->job;
+  uint8_t node = job_graph_input_node(job, s);
+  if (node == NUMA_NODE_ANY)
+    node = ctx->contract.preferred_node;
+  if (node >= pmm_get_node_count())
+    node = NUMA_NODE_LOCAL;
+  s->node = node;
+
+  for (uint8_t j = 0; j < s->num_inputs; j++) {
+    tensor_desc_t *t = job_graph_get_tensor(job, s->inputs[j]);
+    if (t && t->home_node != NUMA_NODE_ANY)
+      locality_count(ctx, s, t);
+  }
+  for (uint8_t j = 0; j < s->num_outputs; j++) {
+    tensor_desc_t *t = job_graph_get_tensor(job, s->outputs[j]);
+    if (!t)
+      continue;
+    if (!t->phys_addr && t->size_bytes) {
+      paddr_t p = pmm_alloc_pages((t->size_bytes + PAGE_SIZE - 1) / PAGE_SIZE, node);
+      if (!p)
+        continue;
+      t->phys_addr = p;
+      t->home_node = pmm_addr_to_node(p);
     }
+    locality_count(ctx, s, t);
+  }
+}
 
-    /* find the step struct */
-    job_step_t *step = NULL;
-    for (uint8_t i = 0; i < ctx->job->num_steps; i++) {
-      if (ctx->job->steps[i].id == (step_id_t)sid) {
-        step = &ctx->job->steps[i];
-        break;
+/* Back every planned tensor with one arena on the contract's node, so
+ * step_place() has nothing left to allocate. Without a plan or the pages,
+ * steps allocate their outputs as they are placed.
+ */
+static void job_map_arena(sched_job_ctx_t *ctx) {
+  job_graph_t *job = ctx->job;
+  if (job_graph_plan_memory(job) != 0 || !job->arena_bytes)
+    return;
+  uint8_t node = ctx->contract.preferred_node;
+  if (node >= pmm_get_node_count())
+    node = NUMA_NODE_LOCAL;
+  paddr_t p = pmm_alloc_pages((job->arena_bytes + PAGE_SIZE - 1) / PAGE_SIZE, node);
+  if (!p) {
+    KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "no %uKB arena: per-step tensor pages",
+          (job->arena_bytes + 1023) / 1024);
+    return;
+  }
+  job->arena_phys = (uint32_t)p;
+  for (uint32_t i = 0; i < job->num_tensors; i++) {
+    tensor_desc_t *t = &job->tensors[i];
+    if (t->phys_addr || !t->size_bytes)
+      continue;
+    t->phys_addr = (uint32_t)p + t->arena_offset;
+    t->home_node = pmm_addr_to_node(p);
+  }
+  KLOG3(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "job %u arena: %uKB (live peak %uKB)",
+        job->id, (job->arena_bytes + 1023) / 1024, job->live_peak_kb);
+}
+
+/* Give back the job's arena, or the pages step_place() allocated */
+static void job_release_tensors(job_graph_t *job) {
+  if (job->arena_phys) {
+    pmm_free_pages(job->arena_phys, (job->arena_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    for (uint32_t i = 0; i < job->num_tensors; i++) {
+      tensor_desc_t *t = &job->tensors[i];
+      if (t->phys_addr >= job->arena_phys && t->phys_addr - job->arena_phys < job->arena_bytes) {
+        t->phys_addr = 0;
+        t->home_node = t->node_affinity;
       }
     }
-    if (!step) {
-      console_write("[sched] step lookup failure\n");
-      break;
-    }
+    job->arena_phys = 0;
+  }
+  for (uint32_t i = 0; i < job->num_tensors; i++) {
+    tensor_desc_t *t = &job->tensors[i];
+    if (!t->phys_addr)
+      continue;
+    pmm_free_pages(t->phys_addr, (t->size_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    t->phys_addr = 0;
+    t->home_node = t->node_affinity;
+  }
+}
 
-    /* Begin span - this logs STEP_START and tracks start time */
-    trace_span_t span =
-        flightrec_begin_span(TRACE_EVT_STEP_START, ctx->job->id, (uint32_t)sid);
-
-    execute_step(step, &ctx->contract);
-
-    /* End span - this logs STEP_END with duration in 'extra' field */
-    flightrec_end_span(span, TRACE_EVT_STEP_END);
-
-    /* Check contract: did this step exceed per-step budget? */
-    usec_t step_duration = flightrec_last_duration(ctx->job->id, (uint32_t)sid);
-    usec_t per_step_budget = ctx->contract.cpu_budget_us / ctx->job->num_steps;
-
-    if (step_duration > per_step_budget) {
-      /* Budget exceeded - log violation */
-      console_write("[sched] BUDGET EXCEED: step ");
-      print_uint((uint32_t)sid);
-      console_write(" took ");
-      print_uint((uint32_t)step_duration);
-      console_write("us (limit: ");
-      print_uint((uint32_t)per_step_budget);
-      console_write("us)\n");
-
-      flightrec_log(TRACE_EVT_CONTRACT_BUDGET_EXCEED, ctx->job->id,
-                    (uint32_t)sid, (uint32_t)step_duration);
-    } else if (step_duration > (per_step_budget * 80) / 100) {
-      /* Approaching budget (>80%) - log warning */
-      flightrec_log(TRACE_EVT_CONTRACT_BUDGET_WARN, ctx->job->id, (uint32_t)sid,
-                    (uint32_t)step_duration);
-    }
+static void job_begin(sched_job_ctx_t *ctx) {
+  console_write("[sched] run_job begin (budget: ");
+  print_uint(ctx->contract.cpu_budget_us);
+  console_write("us)\n");
+
+  /* Log job submission: the span its steps nest in */
+  ctx->span = flightrec_begin_span(TRACE_EVT_JOB_SUBMIT, ctx->job->id, 0);
 
-    job_graph_mark_completed(ctx->job, (step_id_t)sid);
+  ctx->inflight = 0;
+  ctx->active = 0;
+  ctx->locality_hits = 0;
+  ctx->locality_misses = 0;
+  ctx->memo_hits = 0;
+  ctx->memo_misses = 0;
+  ctx->remote_steps = 0;
+  ctx->vtime = 0;
+  ctx->cpu_used_us = 0;
+  ctx->steps_run = 0;
+  ctx->queue_us = 0;
+  ctx->queue_max_us = 0;
+  ctx->throttled = 0;
+  step_memo_adopt(ctx->job->id, &ctx->contract);
+  estimate_steps(ctx->job);
+  if (job_graph_compile(ctx->job) != 0) {
+    console_write("[sched] job graph has a cycle or no memory to compile\n");
+    return;
+  }
+  usec_t now = time_usec();
+  for (uint32_t i = 0; i < ctx->job->num_steps; i++) {
+    job_step_t *s = &ctx->job->steps[i];
+    s->ready_us = (!s->pending && !s->completed) ? now : 0;
   }
+  job_map_arena(ctx);
+  ctx->active = 1;
+}
+
+static void job_end(sched_job_ctx_t *ctx) {
+  ctx->active = 0;
+  console_write("[sched] no ready steps left\n");
 
-  /* Log job completion and get stats */
-  flightrec_log(TRACE_EVT_JOB_COMPLETE, ctx->job->id, 0, 0);
+  /* Log job completion (with its duration) and get stats */
+  if (ctx->span)
+    flightrec_end_span(ctx->span, TRACE_EVT_JOB_COMPLETE);
+  else
+    flightrec_log(TRACE_EVT_JOB_COMPLETE, ctx->job->id, 0, 0);
+
+  usec_t now = time_usec();
+  if (ctx->contract.prio == CONTRACT_PRIORITY_REALTIME && ctx->contract.deadline_us &&
+      now > ctx->contract.deadline_us) {
+    usec_t late = now - ctx->contract.deadline_us;
+    KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "DEADLINE MISS: job %u finished %uus late",
+          ctx->job->id, late);
+    flightrec_log(TRACE_EVT_CONTRACT_VIOLATION, ctx->job->id, 0, (uint32_t)late);
+  }
 
   trace_job_stats_t stats;
   flightrec_get_job_stats(ctx->job->id, &stats);
 
+  /* Flush deferred step logs so the summary prints after them */
+  klog_drain(0);
+
   console_write("[sched] run_job end - ");
   print_uint(stats.steps_completed);
   console_write(" steps, ");
@@ -197,70 +582,705 @@ void sched_run_job(sched_job_ctx_t *ctx) {
   console_write("us CPU, ");
   print_uint(stats.violations);
   console_write(" violations\n");
+
+  uint32_t placed = ctx->locality_hits + ctx->locality_misses;
+  if (placed) {
+    console_write("[sched] locality: ");
+    print_uint(ctx->locality_hits);
+    console_write(" local, ");
+    print_uint(ctx->locality_misses);
+    console_write(" remote tensors (");
+    print_uint(ctx->locality_hits * 100 / placed);
+    console_write("% hit)\n");
+  }
+  job_release_tensors(ctx->job);
+
+  uint32_t lookups = ctx->memo_hits + ctx->memo_misses;
+  if (lookups) {
+    console_write("[sched] memo: ");
+    print_uint(ctx->memo_hits);
+    console_write("/");
+    print_uint(lookups);
+    console_write(" hits (");
+    print_uint(ctx->memo_hits * 100 / lookups);
+    console_write("%)\n");
+  }
+  step_memo_disown(ctx->job->id, &ctx->contract);
+
+  if (ctx->steps_run) {
+    console_write("[sched] queueing: ");
+    print_uint((uint32_t)(ctx->queue_us / ctx->steps_run));
+    console_write("us avg, ");
+    print_uint(ctx->queue_max_us);
+    console_write("us max over ");
+    print_uint(ctx->steps_run);
+    console_write(ctx->throttled ? " steps (SAFE_MODE: one at a time)\n" : " steps\n");
+  }
+
+  if (ctx->remote_steps) {
+    console_write("[sched] mesh: ");
+    print_uint(ctx->remote_steps);
+    console_write(" steps ran on other nodes\n");
+    mesh_work_dump();
+  }
+}
+
+void sched_run_jobs(sched_job_ctx_t **jobs, uint32_t num_jobs) {
+  uint32_t active = 0;
+  for (uint32_t j = 0; j < num_jobs; j++) {
+    if (!jobs[j] || !jobs[j]->job)
+      continue;
+    job_begin(jobs[j]);
+    active += jobs[j]->active;
+  }
+
+  /* Dispatch ready steps, best job first, up to the limits; then retire
+   * whichever finish first, each completion possibly releasing more steps
+   */
+  step_flight_t flight[SCHED_MAX_INFLIGHT];
+  uint32_t count = 0;
+  uint64_t vnow = 0;  /* Virtual start of the last fair-share dispatch */
+  for (uint32_t i = 0; i < SCHED_MAX_INFLIGHT; i++)
+    flight[i].step = NULL;
+  while (active) {
+    while (count < SCHED_MAX_INFLIGHT) {
+      sched_job_ctx_t *best = NULL;
+      job_step_t *best_step = NULL;
+      for (uint32_t j = 0; j < num_jobs; j++) {
+        sched_job_ctx_t *ctx = jobs[j];
+        if (!ctx || !ctx->active || ctx->inflight >= job_limit(ctx))
+          continue;
+        job_step_t *s = job_graph_next_ready_step(ctx->job);
+        if (s && (!best || job_before(ctx, s, best, best_step, vnow))) {
+          best = ctx;
+          best_step = s;
+        }
+      }
+      if (!best)
+        break;
+
+      job_graph_take_ready(best->job);
+      best->inflight++;
+      /* Fair share: the step costs its estimate over the job's weight, in
+       * 1/256 us so small weights still divide
+       */
+      if (!job_realtime(best)) {
+        vnow = job_vstart(best, vnow);
+        best->vtime = vnow + ((uint64_t)(best_step->est_us ? best_step->est_us : 1) << 8) /
+                                 job_weight(best);
+      }
+      if (best->contract.state == CONTRACT_STATE_SAFE_MODE && !best->throttled) {
+        best->throttled = 1;
+        KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "job %u in SAFE_MODE: one step at a time",
+              best->job->id);
+      }
+      usec_t now = time_usec();
+      uint32_t waited = best_step->ready_us && now > best_step->ready_us
+                            ? (uint32_t)(now - best_step->ready_us) : 0;
+      best->steps_run++;
+      best->queue_us += waited;
+      if (waited > best->queue_max_us)
+        best->queue_max_us = waited;
+      lat_record(LAT_STEP_QUEUE, waited);
+      step_flight_t *f = flight;
+      while (f->step)
+        f++;
+      count++;
+      f->ctx = best;
+      f->step = best_step;
+      f->budget_us = step_budget(best, best_step);
+      f->remote = 0;
+      f->place_node = -1;
+      step_place(best, best_step);
+      /* Begin span - this logs STEP_START and tracks start time */
+      f->span = flightrec_begin_child(best->span, TRACE_EVT_STEP_START, best->job->id,
+                                      (uint32_t)best_step->id);
+      if (!step_memo_try(f))
+        step_start(f, &best->contract);
+    }
+
+    /* A job with nothing running and nothing ready is done */
+    for (uint32_t j = 0; j < num_jobs; j++) {
+      sched_job_ctx_t *ctx = jobs[j];
+      if (ctx && ctx->active && ctx->inflight == 0 && !job_graph_next_ready_step(ctx->job)) {
+        job_end(ctx);
+        active--;
+      }
+    }
+    if (count == 0)
+      continue;
+
+    flight_wait(flight);
+
+    for (uint32_t i = 0; i < SCHED_MAX_INFLIGHT; i++) {
+      step_flight_t *f = &flight[i];
+      if (!f->step || !f->done)
+        continue;
+      /* Its node was evicted mid-step: run it again, here or elsewhere */
+      if (f->remote && f->done == 1 && f->rsp.status == MESH_RSP_NODE_DOWN) {
+        KLOG1(KLOG_SUBSYS_SCHED, KLOG_LVL_WARN, "mesh node lost, rerunning step %u",
+              f->step->id);
+        f->remote = 0;
+        step_start(f, &f->ctx->contract);
+        if (!f->done)
+          continue;
+      }
+      f->ctx->inflight--;
+      step_finish(f);
+      f->step = NULL;
+      count--;
+    }
+  }
+}
+
+void sched_run_job(sched_job_ctx_t *ctx) {
+  if (!ctx || !ctx->job)
+    return;
+  sched_run_jobs(&ctx, 1);
 }
 
 /* Scheduler Data */
 process_t *process_list = NULL;
 process_t *current_process = NULL;
-static uint32_t next_pid = 1;
+volatile uint32_t sched_need_resched = 0;
+
+/* Run queues, level 0 the highest priority so bsf on the bitmap finds
+ * the level to run; interrupts off whenever touched
+ */
+static process_t *rq_head[SCHED_NUM_PRIOS];
+static process_t *rq_tail[SCHED_NUM_PRIOS];
+static uint32_t rq_len[SCHED_NUM_PRIOS];
+static uint32_t rq_bitmap;
+static uint32_t num_blocked;
+static usec_t next_wake_at;     /* Earliest BLOCKED wake_at, 0 = none */
+static usec_t slice_end;        /* When current_process's quantum is up */
+static usec_t timer_deadline;   /* Earliest sched_timer_at(), 0 = none */
+static int sched_tickless;      /* One-shot LAPIC timer instead of the PIT */
+
+static sched_stats_t sched_stats;
+static usec_t stats_window_start;
+static uint32_t stats_window_switches;
+static usec_t stats_window_max_latency;
 
 /* External Switch Function */
 extern void switch_to(process_t *curr, process_t *next);
 
-void schedule(void) {
-    if (!current_process) return;
+static inline uint32_t prio_level(uint32_t prio) {
+    if (prio > CONTRACT_PRIORITY_REALTIME)
+        prio = CONTRACT_PRIORITY_REALTIME;
+    return (SCHED_NUM_PRIOS - 1) - prio;
+}
 
-    /* Decrement quantum */
-    if (current_process->ticks_remaining > 0) {
-        current_process->ticks_remaining--;
+/* Highest non-empty level, or -1 */
+static inline int rq_top(void) {
+    if (!rq_bitmap)
+        return -1;
+    uint32_t level;
+    __asm__("bsf %1, %0" : "=r"(level) : "rm"(rq_bitmap));
+    return (int)level;
+}
+
+static void rq_push(process_t *p, int front) {
+    uint32_t l = prio_level(p->prio);
+    p->state = PROCESS_STATE_READY;
+    p->ready_since = time_usec();
+    if (front) {
+        p->rq_next = rq_head[l];
+        rq_head[l] = p;
+        if (!rq_tail[l])
+            rq_tail[l] = p;
+    } else {
+        p->rq_next = NULL;
+        if (rq_tail[l])
+            rq_tail[l]->rq_next = p;
+        else
+            rq_head[l] = p;
+        rq_tail[l] = p;
+    }
+    rq_len[l]++;
+    rq_bitmap |= 1u << l;
+}
+
+static process_t *rq_pop(uint32_t l) {
+    process_t *p = rq_head[l];
+    rq_head[l] = p->rq_next;
+    if (!rq_head[l]) {
+        rq_tail[l] = NULL;
+        rq_bitmap &= ~(1u << l);
+    }
+    rq_len[l]--;
+    p->rq_next = NULL;
+    return p;
+}
+
+/* Take p off its run queue wherever it is (rare: priority changes) */
+static void rq_remove(process_t *p) {
+    uint32_t l = prio_level(p->prio);
+    process_t *prev = NULL;
+    for (process_t *q = rq_head[l]; q; prev = q, q = q->rq_next) {
+        if (q != p)
+            continue;
+        if (prev)
+            prev->rq_next = p->rq_next;
+        else
+            rq_head[l] = p->rq_next;
+        if (rq_tail[l] == p)
+            rq_tail[l] = prev;
+        if (!rq_head[l])
+            rq_bitmap &= ~(1u << l);
+        rq_len[l]--;
+        p->rq_next = NULL;
         return;
     }
+}
 
-    /* Reset quantum */
-    current_process->ticks_remaining = 5; // 50ms
+/* Lowest level whose oldest process has waited past SCHED_STARVE_US
+ * while something higher ran, or -1
+ */
+static int rq_starving(usec_t now) {
+    int top = rq_top();
+    for (int l = SCHED_NUM_PRIOS - 1; l > top; l--)
+        if (rq_head[l] && now - rq_head[l]->ready_since > SCHED_STARVE_US)
+            return l;
+    return -1;
+}
 
-    /* Round Robin: Find next READY process */
-    process_t *next = current_process->next;
-    
-    // Safety check for empty list
-    if (!next) return;
+uint32_t sched_quantum_ms(const process_t *p) {
+    return p->quantum_ms ? p->quantum_ms : sched_prio_quantum_ms(p->prio);
+}
 
-    // Iterate to find RUNNABLE/READY
-    // For MVP, simplistic: just take next. 
-    // Ideally check state == READY/RUNNING.
-    
-    if (next == current_process) return; /* Only one task */
+static usec_t sched_quantum_us(const process_t *p) {
+    return (usec_t)sched_quantum_ms(p) * 1000;
+}
 
+/* Tickless: program the timer for the first thing that needs it, a
+ * higher priority waiting (now), the quantum (only with someone to hand
+ * over to), a timed sleeper or sched_timer_at(). Nothing: no interrupt.
+ */
+static void sched_rearm(usec_t now) {
+    if (!sched_tickless)
+        return;
+    usec_t next = timer_deadline;
+    if (next_wake_at && (!next || next_wake_at < next))
+        next = next_wake_at;
+    int top = rq_top();
+    if (top >= 0 && current_process) {
+        usec_t due = slice_end;
+        /* Kernel threads already asked to yield get reminded per quantum */
+        if ((uint32_t)top < prio_level(current_process->prio) &&
+            !(sched_need_resched && (current_process->flags & PROCESS_FLAG_KERNEL)))
+            due = now;
+        if (!next || due < next)
+            next = due;
+    }
+    lapic_timer_oneshot(next);
+}
+
+/* Free processes that exited; never the one running on this stack */
+static void sched_reap(void) {
     process_t *prev = current_process;
-    current_process = next;
+    process_t *p = prev->next;
+    while (p && p != current_process) {
+        if (p->state == PROCESS_STATE_ZOMBIE) {
+            prev->next = p->next;
+            if (process_list == p)
+                process_list = prev;
+            sched_destroy_process(p);
+        } else {
+            prev = p;
+        }
+        p = prev->next;
+    }
+}
+
+/* Once a second: publish the switch rate and worst latency */
+static void sched_stats_tick(usec_t now) {
+    if (!stats_window_start) {
+        stats_window_start = now;
+        return;
+    }
+    if (now - stats_window_start < 1000000)
+        return;
+    sched_stats.switches_per_sec =
+        (uint32_t)((uint64_t)stats_window_switches * 1000000 / (now - stats_window_start));
+    flightrec_log(TRACE_EVT_SCHED_STATS, 0, sched_stats.switches_per_sec,
+                  (uint32_t)stats_window_max_latency);
+    stats_window_start = now;
+    stats_window_switches = 0;
+    stats_window_max_latency = 0;
+    contract_fold_all(); /* Per-CPU charges below any budget */
+}
+
+/* Wake p (BLOCKED, interrupts off) */
+static void sched_unblock(process_t *p) {
+    p->wait_chan = NULL;
+    p->wake_at = 0;
+    num_blocked--;
+    rq_push(p, 0);
+    if (current_process && prio_level(p->prio) < prio_level(current_process->prio))
+        sched_need_resched = 1;
+    sched_rearm(time_usec());
+}
+
+/* Tick: wake sleepers whose deadline has passed */
+static void sched_wake_expired(usec_t now) {
+    usec_t next = 0;
+    process_t *p = process_list;
+    do {
+        if (p->state == PROCESS_STATE_BLOCKED && p->wake_at) {
+            if (now >= p->wake_at)
+                sched_unblock(p);
+            else if (!next || p->wake_at < next)
+                next = p->wake_at;
+        }
+        p = p->next;
+    } while (p && p != process_list);
+    next_wake_at = next;
+}
+
+/* Interrupts must be off; next is off its run queue. switch_to saves the
+ * integer context; the FPU/SIMD registers follow lazily (fpu_switch, #NM).
+ * A preempted process goes back to the front of its queue with the rest of
+ * its quantum, anything else to the back with a fresh one.
+ */
+static void sched_switch(process_t *next, int preempted) {
+    process_t *prev = current_process;
+    usec_t now = time_usec();
 
-    // State transition
     if (prev->state == PROCESS_STATE_RUNNING) {
-        prev->state = PROCESS_STATE_READY;
+        prev->slice_left_us = preempted && slice_end > now ? (uint32_t)(slice_end - now) : 0;
+        rq_push(prev, preempted);
     }
-    current_process->state = PROCESS_STATE_RUNNING;
 
+    usec_t waited = now - next->ready_since;
+    sched_stats.switches++;
+    sched_stats.preemptions += preempted ? 1 : 0;
+    sched_stats.rq_latency_avg_us = (sched_stats.rq_latency_avg_us * 7 + waited) / 8;
+    if (waited > sched_stats.rq_latency_max_us)
+        sched_stats.rq_latency_max_us = waited;
+    if (waited > stats_window_max_latency)
+        stats_window_max_latency = waited;
+    stats_window_switches++;
+
+    next->prev_state = next->state;
+    next->state = PROCESS_STATE_RUNNING;
+    slice_end = now + (next->slice_left_us ? next->slice_left_us : sched_quantum_us(next));
+    next->slice_left_us = 0;
+    sched_need_resched = 0;
+    current_process = next;
+    sched_rearm(now);
+
+    if (next->vdata)
+        vdata_update(next);
+    fpu_switch(next);
     switch_to(prev, next);
 }
 
-/* 
- * MVP Test: Create 2 processes yielding to each other 
+/* Timer interrupt, periodic or one-shot (interrupts off) */
+void schedule(void) {
+    if (!current_process) return;
+
+    usec_t now = time_usec();
+    sched_stats.timer_irqs++;
+    sched_stats_tick(now);
+    if (timer_deadline && now >= timer_deadline)
+        timer_deadline = 0;
+    if (next_wake_at && now >= next_wake_at)
+        sched_wake_expired(now);
+
+    uint32_t cur = prio_level(current_process->prio);
+    int top = rq_top();
+    int preempt = top >= 0 && (uint32_t)top < cur;
+    int next = top;
+
+    if (!preempt) {
+        /* A periodic tick counts as the quantum's end within half a tick */
+        usec_t slack = sched_tickless ? 0 : SCHED_TICK_MS * 500;
+        if (now + slack < slice_end) {
+            sched_rearm(now);
+            return;
+        }
+        /* Quantum up: a peer takes over, or whoever is starving */
+        int starving = rq_starving(now);
+        if (starving >= 0) {
+            next = starving;
+        } else if (top < 0 || (uint32_t)top > cur) {
+            slice_end = now + sched_quantum_us(current_process);
+            sched_rearm(now);
+            return;
+        }
+    }
+
+    /* Kernel threads may hold kernel state mid-update: ask, don't switch */
+    if (current_process->flags & PROCESS_FLAG_KERNEL) {
+        sched_need_resched = 1;
+        slice_end = now + SCHED_TICK_MS * 1000;
+        sched_rearm(now);
+        return;
+    }
+
+    if (next != top)
+        sched_stats.starved++;
+    sched_switch(rq_pop((uint32_t)next), preempt);
+}
+
+/* Level a voluntary switch goes to: the best waiting process, whatever its
+ * priority (a yield says we have nothing to do), or a starving one
  */
-void sched_test_rr(void) {
-    console_write("[sched] initializing Process Model MVP...\n");
+static int sched_yield_level(void) {
+    int starving = rq_starving(time_usec());
+    if (starving >= 0) {
+        sched_stats.starved++;
+        return starving;
+    }
+    return rq_top();
+}
 
-    /* 1. Create Idle/Kernel Process (PID 0) */
-    paddr_t p_phys = pmm_alloc_page(NUMA_NODE_LOCAL);
-    process_t *idle = (process_t *)(phys_to_virt(p_phys));
-    memset(idle, 0, sizeof(process_t));
+void sched_yield(void) {
+    if (!current_process) return;
+
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+
+    sched_reap();
+    int l = sched_yield_level();
+    if (l >= 0) {
+        sched_switch(rq_pop((uint32_t)l), 0);
+    } else {
+        sched_need_resched = 0;
+        slice_end = time_usec() + sched_quantum_us(current_process);
+        sched_rearm(time_usec());
+    }
+
+    if (was_enabled)
+        interrupts_enable();
+}
+
+int sched_block(const void *chan, uint64_t deadline_us) {
+    process_t *self = current_process;
+    if (!self || self->pid == 0) {
+        if (deadline_us)
+            sched_timer_at(deadline_us);
+        return -1;
+    }
+
+    self->state = PROCESS_STATE_BLOCKED;
+    self->wait_chan = chan;
+    self->wake_at = deadline_us;
+    if (deadline_us && (!next_wake_at || deadline_us < next_wake_at))
+        next_wake_at = deadline_us;
+    num_blocked++;
+
+    while (self->state == PROCESS_STATE_BLOCKED) {
+        int l = rq_top();
+        if (l >= 0) {
+            sched_switch(rq_pop((uint32_t)l), 0);
+            continue;
+        }
+        /* Nothing else to run (pid 0 is blocked in a wait of its own) */
+        sched_rearm(time_usec());
+        interrupts_enable();
+        __asm__ __volatile__("hlt");
+        interrupts_disable();
+    }
+
+    /* Woken while still the current process: off the run queue again */
+    if (self->state == PROCESS_STATE_READY) {
+        rq_remove(self);
+        self->state = PROCESS_STATE_RUNNING;
+    }
+    return 0;
+}
+
+uint32_t sched_wakeup(const void *chan) {
+    if (!num_blocked || !process_list)
+        return 0;
+
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+    uint32_t woken = 0;
+    process_t *p = process_list;
+    do {
+        if (p->state == PROCESS_STATE_BLOCKED && p->wait_chan == chan) {
+            sched_unblock(p);
+            woken++;
+        }
+        p = p->next;
+    } while (p && p != process_list);
+    if (was_enabled)
+        interrupts_enable();
+    return woken;
+}
+
+void sched_exit(void) {
+    interrupts_disable();
+    current_process->state = PROCESS_STATE_ZOMBIE;
+
+    /* pid 0 never exits, so something is always there to switch to */
+    while (1) {
+        int l = sched_yield_level();
+        if (l >= 0)
+            sched_switch(rq_pop((uint32_t)l), 0);
+        interrupts_enable();
+        __asm__ __volatile__("hlt");
+        interrupts_disable();
+    }
+}
+
+void sched_add_process(process_t *proc) {
+    if (!proc || !current_process) return;
+
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+    proc->slice_left_us = 0;
+    proc->next = process_list->next;
+    process_list->next = proc;
+    rq_push(proc, 0);
+    if (prio_level(proc->prio) < prio_level(current_process->prio))
+        sched_need_resched = 1;
+    sched_rearm(time_usec());
+    if (was_enabled)
+        interrupts_enable();
+}
+
+process_t *sched_current(void) { return current_process; }
+
+void sched_set_priority(process_t *proc, uint32_t prio) {
+    if (!proc) return;
+    if (prio > CONTRACT_PRIORITY_REALTIME)
+        prio = CONTRACT_PRIORITY_REALTIME;
+
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+    if (proc->state == PROCESS_STATE_READY && proc != current_process) {
+        rq_remove(proc);
+        proc->prio = prio;
+        rq_push(proc, 0);
+        sched_rearm(time_usec());
+    } else {
+        proc->prio = prio;
+    }
+    if (was_enabled)
+        interrupts_enable();
+}
+
+void sched_timer_at(uint64_t deadline_us) {
+    if (!deadline_us) return;
+
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+    if (!timer_deadline || deadline_us < timer_deadline) {
+        timer_deadline = deadline_us;
+        sched_rearm(time_usec());
+    }
+    if (was_enabled)
+        interrupts_enable();
+}
+
+/* LAPIC_TIMER_VECTOR */
+static void sched_timer_irq(interrupt_frame_t *frame) {
+    lapic_timer_ack();
+    prof_tick(frame);
+    schedule();
+}
+
+void sched_tick_init(void) {
+    if (lapic_timer_init() != 0) {
+        console_write("[sched] periodic PIT tick\n");
+        return;
+    }
+
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+    idt_register_handler(LAPIC_TIMER_VECTOR, sched_timer_irq);
+    pic_mask_irq(0);
+    sched_tickless = 1;
+    sched_rearm(time_usec());
+    if (was_enabled)
+        interrupts_enable();
+    console_write("[sched] tickless: one-shot LAPIC timer\n");
+}
+
+int sched_is_tickless(void) {
+    return sched_tickless;
+}
+
+void sched_get_stats(sched_stats_t *out) {
+    int was_enabled = interrupts_enabled();
+    interrupts_disable();
+    *out = sched_stats;
+    for (uint32_t prio = 0; prio < SCHED_NUM_PRIOS; prio++)
+        out->rq_len[prio] = rq_len[prio_level(prio)];
+    out->blocked = num_blocked;
+    if (was_enabled)
+        interrupts_enable();
+}
+
+void sched_dump_stats(void) {
+    static const char *const names[SCHED_NUM_PRIOS] = {"low", "normal", "high", "realtime"};
+    sched_stats_t st;
+    sched_get_stats(&st);
+
+    console_write("[sched] switches ");
+    print_uint((uint32_t)st.switches);
+    console_write(" (");
+    print_uint(st.switches_per_sec);
+    console_write("/s), preemptions ");
+    print_uint((uint32_t)st.preemptions);
+    console_write(", starved ");
+    print_uint((uint32_t)st.starved);
+    console_write("\n[sched] run-queue latency avg ");
+    print_uint((uint32_t)st.rq_latency_avg_us);
+    console_write("us, max ");
+    print_uint((uint32_t)st.rq_latency_max_us);
+    console_write("us; blocked ");
+    print_uint(st.blocked);
+    console_write("\n[sched] timer interrupts ");
+    print_uint((uint32_t)st.timer_irqs);
+    console_write(sched_tickless ? " (tickless)\n" : " (periodic)\n");
+    for (uint32_t prio = SCHED_NUM_PRIOS; prio-- > 0;) {
+        console_write("  ");
+        console_write(names[prio]);
+        console_write(": ");
+        print_uint(st.rq_len[prio]);
+        console_write(" ready, quantum ");
+        print_uint(sched_prio_quantum_ms(prio));
+        console_write("ms\n");
+    }
+}
+
+void sched_proc_init(void) {
+    if (current_process) return;
+
+    /* Kernel context becomes the Idle/Kernel Process (PID 0) */
+    process_t *idle = sched_alloc_pcb();
     idle->pid = 0;
     idle->state = PROCESS_STATE_RUNNING;
-    idle->ticks_remaining = 5;
-    
+    idle->flags = PROCESS_FLAG_KERNEL;
+    idle->cr3 = vmm_get_current_pd();  /* switch_to loads it on the way back */
+    idle->quantum_ms = 50;
+    idle->prio = CONTRACT_PRIORITY_NORMAL;
+    slice_end = time_usec() + sched_quantum_us(idle);
+    idle->cpu = IPC_CHAN_CPU_ANY;
+
     // Circular list
     idle->next = idle;
     process_list = idle;
     current_process = idle;
+    fpu_adopt(idle);
+    sched_fault_init();
+
+    ipc_set_sched_hooks(sched_block, sched_wakeup);
+}
+
+/* 
+ * MVP Test: Create 2 processes yielding to each other 
+ */
+void sched_test_rr(void) {
+    console_write("[sched] initializing Process Model MVP...\n");
+
+    /* 1. Create Idle/Kernel Process (PID 0) */
+    sched_proc_init();
     
     console_write("[sched] Idle process created. Now creating User Process...\n");
 
@@ -305,18 +1325,15 @@ void sched_test_rr(void) {
     process_t *proc1 = sched_create_user_process(user_code, 0, 0);
     
     if (proc1) {
-        /* Map the code page into the new process's PD */
+        /* Share the code page into the new process's PD: it stays ours */
         paddr_t current_pd = vmm_get_current_pd();
         vmm_switch_pd(proc1->cr3);
         
-        vmm_map_page(user_code, code_phys, PTE_USER_RW);
-        // Stack was mapped in sched_create_user_process
+        vmm_share_range(user_code, code_phys, PAGE_SIZE, PTE_USER_RO);
         
         vmm_switch_pd(current_pd);
         
         /* Add to List */
-        proc1->next = process_list->next;
-        process_list->next = proc1;
-        proc1->state = PROCESS_STATE_READY;
+        sched_add_process(proc1);
     }
 }
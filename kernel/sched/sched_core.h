@@ -7,20 +7,178 @@
 #include "../process.h"
 #include <stdint.h>
 
+/* Steps sched_run_job() keeps running at once, at most */
+#define SCHED_MAX_INFLIGHT 8
+
+/* Fair-share weight per contract priority below REALTIME */
+#define SCHED_FAIR_WEIGHT_LOW    1
+#define SCHED_FAIR_WEIGHT_NORMAL 2
+#define SCHED_FAIR_WEIGHT_HIGH   4
+
 typedef struct {
   job_graph_t *job;
   task_contract_t contract;
+  uint32_t max_inflight;  /* Steps in flight at once, 0 = SCHED_MAX_INFLIGHT */
+
+  /* sched_run_jobs() bookkeeping */
+  uint32_t inflight;
+  uint8_t active;
+  uint32_t locality_hits;    /* Step tensors on the node the step ran on */
+  uint32_t locality_misses;  /* ... and on another node */
+  uint32_t memo_hits;        /* Memoized steps answered from the cache */
+  uint32_t memo_misses;
+  uint32_t remote_steps;     /* COMPUTE steps run on another mesh node */
+  uint32_t span;             /* trace_span_t of the whole job; steps nest in it */
+  uint64_t vtime;            /* Fair share: virtual finish of its last step */
+  uint32_t cpu_used_us;      /* Step time so far, against cpu_budget_us */
+  uint32_t steps_run;        /* Steps dispatched */
+  uint64_t queue_us;         /* Their ready -> dispatch delays, summed */
+  uint32_t queue_max_us;
+  uint8_t throttled;         /* SAFE_MODE held it to one step at a time */
 
   /* later: per-step runtime stats, device selections, etc. */
 } sched_job_ctx_t;
 
 void sched_init(void);
 void sched_run_job(sched_job_ctx_t *ctx);
+/* Run several jobs to completion together. Ready steps of REALTIME
+ * contracts are dispatched first, earliest deadline first; the other
+ * jobs share what is left by weighted fair queueing (start-time fair:
+ * each dispatch advances the job's virtual time by the step's estimate
+ * over its weight, and the job furthest behind goes next). A job's weight
+ * is its priority's (SCHED_FAIR_WEIGHT_*) times the quarters of its
+ * cpu_budget_us it has left, so a small high priority job is not stuck
+ * behind a batch job and one over budget slows down; ties go to the
+ * higher priority, then the longer critical path (measured step
+ * durations from the flight recorder, per-type guesses otherwise). A
+ * SAFE_MODE contract is throttled to one step in flight at the lowest
+ * weight. Each job reports the queueing delay of its steps (ready ->
+ * dispatched, also LAT_STEP_QUEUE) when it ends. Each step's budget is
+ * its estimated share of the job's cpu_budget_us. Each step is placed on
+ * the NUMA node holding most of its input bytes (the contract's
+ * preferred_node if none are placed) and its outputs are allocated there;
+ * they are freed when the job ends. A COMPUTE step goes to another mesh
+ * node instead when one is less loaded (ipc/mesh_work.h).
+ */
+void sched_run_jobs(sched_job_ctx_t **jobs, uint32_t num_jobs);
 void sched_test_rr(void);
 void schedule(void);
 
-/* Process Model */
+/* PIT tick period (pit_init(100)): schedule()'s only clock when there is
+ * no LAPIC, and the unit quanta are counted in
+ */
+#define SCHED_TICK_MS 10
+
+/* Tickless operation: with a LAPIC the PIT is masked and the one-shot
+ * LAPIC timer is programmed for the next event only, the earliest of a
+ * quantum ending with someone waiting for the CPU, a timed sleeper
+ * (sched_block deadlines, which is what IPC timeouts become) and
+ * sched_timer_at(). An idle CPU takes no timer interrupts. Call after
+ * time_init(), vmm_init() and lapic_init(); without a LAPIC the PIT tick
+ * stays.
+ */
+void sched_tick_init(void);
+int sched_is_tickless(void);
+/* Make sure a timer interrupt arrives by deadline_us (time_usec()), for
+ * code that hlts until a time instead of blocking in sched_block()
+ */
+void sched_timer_at(uint64_t deadline_us);
+
+/* Set by schedule() when a kernel thread's quantum runs out. Kernel
+ * threads are never switched from the timer interrupt; they give up the
+ * CPU at their next safe point (sched_yield(), or a wasm3 loop back-edge
+ * or call, see d_m3YieldFlag) once this is set.
+ */
+extern volatile uint32_t sched_need_resched;
+
+/* Process Model
+ *
+ * One FIFO run queue per contract priority and a bitmap of the non-empty
+ * ones: the next process is found with a single bsf, however many there
+ * are. The highest priority READY process runs; a process arriving at a
+ * higher priority preempts at the next timer interrupt (kernel threads at their next
+ * safe point, see sched_need_resched), equal priorities take turns a
+ * quantum at a time, and anything left waiting longer than
+ * SCHED_STARVE_US runs next regardless of priority.
+ */
+#define SCHED_NUM_PRIOS    4              /* One per contract_priority_t */
+#define SCHED_STARVE_US    (200 * 1000)
+
+/* Quantum for a priority with no explicit quantum_ms: SCHED_TICK_MS at
+ * LOW, doubling per level up to 8 ticks at REALTIME
+ */
+static inline uint32_t sched_prio_quantum_ms(uint32_t prio) {
+  if (prio > CONTRACT_PRIORITY_REALTIME)
+    prio = CONTRACT_PRIORITY_REALTIME;
+  return SCHED_TICK_MS << prio;
+}
+
+/* Adopt the running kernel context as pid 0 (idempotent) */
+void sched_proc_init(void);
+/* Make proc READY and put it on the run queue */
+void sched_add_process(process_t *proc);
+process_t *sched_current(void);
+/* Move proc to another priority (contract_priority_t); takes effect on its
+ * next turn if it is already queued
+ */
+void sched_set_priority(process_t *proc, uint32_t prio);
+/* Quantum proc runs for */
+uint32_t sched_quantum_ms(const process_t *proc);
+/* Switch to the next READY process, if any; safe with interrupts on or off
+ * (their state is restored on return)
+ */
+void sched_yield(void);
+/* Sleep until sched_wakeup(chan) or, if deadline_us is set, the first
+ * timer interrupt at or after time_usec() == deadline_us. Call with
+ * interrupts off after checking the condition (so a wakeup can't slip in
+ * between); they are off again on return. Returns -1 without sleeping for
+ * pid 0, which must keep running, after sched_timer_at(deadline_us) so it
+ * can hlt instead. IPC waits (ipc_wait_until) sleep here between
+ * polls, woken as responses are routed.
+ */
+int sched_block(const void *chan, uint64_t deadline_us);
+/* Make every process blocked on chan READY; safe from IRQ context.
+ * Returns: how many were woken
+ */
+uint32_t sched_wakeup(const void *chan);
+
+typedef struct {
+  uint64_t switches;
+  uint64_t preemptions;         /* Switched out for a higher priority */
+  uint64_t starved;             /* Picked by the starvation guard */
+  uint32_t switches_per_sec;    /* Over the last full second */
+  uint64_t rq_latency_avg_us;   /* READY to running, moving average */
+  uint64_t rq_latency_max_us;
+  uint32_t rq_len[SCHED_NUM_PRIOS]; /* By contract priority */
+  uint32_t blocked;
+  uint64_t timer_irqs;          /* schedule() calls from either timer */
+} sched_stats_t;
+
+/* The switch rate and worst run-queue latency of each second also go to
+ * the flight recorder as TRACE_EVT_SCHED_STATS
+ */
+void sched_get_stats(sched_stats_t *out);
+void sched_dump_stats(void);
+/* End the calling process; it is freed by the next switch away from it */
+void sched_exit(void) __attribute__((noreturn));
+
+/* Spawning allocates the PCB, page directory and kernel stack only: the
+ * user stack (and any vmm_reserve_range() memory) fills in page by page
+ * on first touch, counted in mem_pages_used against mem_pages_limit
+ */
 process_t *sched_create_user_process(uint32_t entry_point, uint32_t wasm_blob_phys, uint32_t wasm_size);
+/* Ring-0 thread running entry(arg) on a kstack_pages stack in the kernel
+ * address space; returning from entry ends it. Not yet queued: call
+ * sched_add_process().
+ */
+process_t *sched_create_kernel_process(void (*entry)(void *), void *arg,
+                                       uint32_t kstack_pages, uint32_t quantum_ms);
 void sched_destroy_process(process_t *proc);
+/* Take over #PF for demand-zero and copy-on-write user pages */
+void sched_fault_init(void);
+
+/* Zeroed PCB from the process slab cache, NULL if out of memory */
+process_t *sched_alloc_pcb(void);
+void sched_free_pcb(process_t *proc);
 
 #endif /* SCHED_CORE_H */
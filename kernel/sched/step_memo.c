@@ -0,0 +1,167 @@
+/* kernel/sched/step_memo.c - Step result memoization
+ *
+ * A small fully associative table with LRU by use stamp. Only the job
+ * dispatcher touches it, so there is no locking.
+ */
+
+#include "step_memo.h"
+#include "../ipc/heap.h"
+
+typedef struct {
+  uint64_t key;         /* 0: free */
+  uint32_t blob;        /* Result blob, one reference held */
+  uint32_t job_id;
+  uint32_t kb;
+  uint32_t last_use;
+  uint8_t charged;      /* kb counted in the owning job's contract */
+} memo_entry_t;
+
+static memo_entry_t memo[STEP_MEMO_SLOTS];
+static uint32_t memo_clock;
+static step_memo_stats_t stats;
+
+#define FNV64_OFFSET 0xCBF29CE484222325ULL
+#define FNV64_PRIME  0x00000100000001B3ULL
+
+static uint64_t fnv_word(uint64_t h, uint32_t w) {
+  for (int i = 0; i < 4; i++) {
+    h ^= (w >> (i * 8)) & 0xFF;
+    h *= FNV64_PRIME;
+  }
+  return h;
+}
+
+uint64_t step_memo_key(const job_step_t *step, uint32_t model) {
+  if (!step->num_inputs)
+    return 0;
+  uint64_t h = FNV64_OFFSET;
+  h = fnv_word(h, model);
+  h = fnv_word(h, (uint32_t)step->type);
+  for (uint8_t j = 0; j < step->num_inputs; j++) {
+    const heap_blob_t *b = heap_get_blob((uint16_t)step->inputs[j]);
+    if (!b || b->type == BLOB_TYPE_SG || (b->flags & BLOB_FLAG_CSUM_NONE) || !b->checksum)
+      return 0;
+    h = fnv_word(h, b->checksum);
+    h = fnv_word(h, b->size);
+  }
+  return h ? h : 1;
+}
+
+static void entry_drop(memo_entry_t *e, task_contract_t *c) {
+  if (e->charged && c)
+    contract_credit_memory(c, e->kb);
+  heap_blob_release((uint16_t)e->blob);
+  e->key = 0;
+  stats.evictions++;
+}
+
+/* Oldest (or newest) entry of job_id that is charged (or not), or NULL */
+static memo_entry_t *pick(uint32_t job_id, uint8_t charged, int newest) {
+  memo_entry_t *best = NULL;
+  for (uint32_t i = 0; i < STEP_MEMO_SLOTS; i++) {
+    memo_entry_t *e = &memo[i];
+    if (!e->key || e->job_id != job_id || e->charged != charged)
+      continue;
+    if (!best || (newest ? e->last_use > best->last_use : e->last_use < best->last_use))
+      best = e;
+  }
+  return best;
+}
+
+/* Free one slot for job_id: a free one, else the oldest unowned entry,
+ * else job_id's own oldest
+ */
+static memo_entry_t *slot_for(uint32_t job_id, task_contract_t *c) {
+  memo_entry_t *lru = NULL;
+  for (uint32_t i = 0; i < STEP_MEMO_SLOTS; i++) {
+    memo_entry_t *e = &memo[i];
+    if (!e->key)
+      return e;
+    if (!e->charged && (!lru || e->last_use < lru->last_use))
+      lru = e;
+  }
+  if (!lru)
+    lru = pick(job_id, 1, 0);
+  if (lru)
+    entry_drop(lru, lru->charged ? c : NULL);
+  return lru;
+}
+
+uint32_t step_memo_lookup(uint64_t key) {
+  if (!key)
+    return 0;
+  stats.lookups++;
+  for (uint32_t i = 0; i < STEP_MEMO_SLOTS; i++) {
+    memo_entry_t *e = &memo[i];
+    if (e->key != key)
+      continue;
+    if (heap_blob_retain((uint16_t)e->blob) != 0) {
+      e->key = 0;   /* Blob gone under us: nothing left to release */
+      return 0;
+    }
+    e->last_use = ++memo_clock;
+    stats.hits++;
+    return e->blob;
+  }
+  return 0;
+}
+
+void step_memo_insert(uint64_t key, uint32_t result_blob, uint32_t job_id,
+                      task_contract_t *c) {
+  if (!key || !result_blob)
+    return;
+  uint32_t kb = (heap_get_blob_size((uint16_t)result_blob) + 1023) / 1024;
+  if (!kb)
+    kb = 1;
+
+  /* Make room within the contract from this job's own entries */
+  while (contract_used(c, CONTRACT_CHARGE_MEM) + kb > c->memory_kb) {
+    memo_entry_t *old = pick(job_id, 1, 0);
+    if (!old) {
+      stats.refused++;
+      return;
+    }
+    entry_drop(old, c);
+  }
+  memo_entry_t *e = slot_for(job_id, c);
+  if (!e || heap_blob_retain((uint16_t)result_blob) != 0) {
+    stats.refused++;
+    return;
+  }
+
+  e->key = key;
+  e->blob = result_blob;
+  e->job_id = job_id;
+  e->kb = kb;
+  e->last_use = ++memo_clock;
+  e->charged = 1;
+  contract_charge_memory(c, kb);
+  stats.inserts++;
+}
+
+void step_memo_adopt(uint32_t job_id, task_contract_t *c) {
+  /* Newest first, so what no longer fits is the oldest */
+  memo_entry_t *e;
+  while ((e = pick(job_id, 0, 1)) != NULL) {
+    if (contract_used(c, CONTRACT_CHARGE_MEM) + e->kb > c->memory_kb) {
+      entry_drop(e, NULL);
+      continue;
+    }
+    e->charged = 1;
+    contract_charge_memory(c, e->kb);
+  }
+}
+
+void step_memo_disown(uint32_t job_id, task_contract_t *c) {
+  for (uint32_t i = 0; i < STEP_MEMO_SLOTS; i++) {
+    memo_entry_t *e = &memo[i];
+    if (!e->key || e->job_id != job_id || !e->charged)
+      continue;
+    contract_credit_memory(c, e->kb);
+    e->charged = 0;
+  }
+}
+
+void step_memo_get_stats(step_memo_stats_t *out) {
+  *out = stats;
+}
@@ -0,0 +1,56 @@
+/* kernel/sched/step_memo.h - Step result memoization
+ *
+ * A COMPUTE step marked memoize whose inputs are unchanged reuses the
+ * result blob of its last run instead of going to the bridge. The key
+ * hashes the inputs' sealed checksums (heap_blob_seal(), computed once
+ * when the blob is written) with their sizes, the model and the step
+ * type. The cache holds its own reference on each result blob and a hit
+ * hands the caller another.
+ *
+ * Entries are charged to the contract of the job that made them while it
+ * runs (step_memo_adopt() at job start, step_memo_disown() at its end), so
+ * the cache never keeps a job over its memory_kb: that job's oldest
+ * entries go first. Unowned entries survive for the next run of the job
+ * and are the first evicted when the table fills.
+ */
+
+#ifndef _SCHED_STEP_MEMO_H
+#define _SCHED_STEP_MEMO_H
+
+#include "../contracts.h"
+#include "../job/job_graph.h"
+#include <stdint.h>
+
+#define STEP_MEMO_SLOTS 64
+
+typedef struct {
+  uint32_t lookups;
+  uint32_t hits;
+  uint32_t inserts;
+  uint32_t evictions;
+  uint32_t refused;     /* No room within the contract or the table */
+} step_memo_stats_t;
+
+/* Key for step run on model, or 0 if it has no inputs or one is gone,
+ * unsealed, unchecksummed (BLOB_FLAG_CSUM_NONE) or a chain
+ */
+uint64_t step_memo_key(const job_step_t *step, uint32_t model);
+
+/* Result blob cached for key, with a reference for the caller; 0 on a
+ * miss
+ */
+uint32_t step_memo_lookup(uint64_t key);
+
+/* Cache result_blob for key on behalf of job_id, charging its size to c */
+void step_memo_insert(uint64_t key, uint32_t result_blob, uint32_t job_id,
+                      task_contract_t *c);
+
+/* Job start: charge c for job_id's surviving entries, evicting the oldest
+ * past memory_kb. Job end: credit them back and leave them unowned.
+ */
+void step_memo_adopt(uint32_t job_id, task_contract_t *c);
+void step_memo_disown(uint32_t job_id, task_contract_t *c);
+
+void step_memo_get_stats(step_memo_stats_t *stats);
+
+#endif /* _SCHED_STEP_MEMO_H */
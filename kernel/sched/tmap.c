@@ -0,0 +1,178 @@
+/* kernel/sched/tmap.c - Heap blobs mapped into user processes */
+
+#include "tmap.h"
+#include "../arch/idt.h"
+#include "../include/string.h"
+#include "../ipc/heap.h"
+#include "../mm/vmm.h"
+
+/* Blobs mapped by any process. BLOB_FLAG_PINNED is one bit, so the
+ * count of processes is kept here, along with whether we set the bit
+ */
+#define TMAP_PINS 64
+
+typedef struct {
+  uint16_t blob_id;       /* 0 = free */
+  uint16_t procs;
+  uint8_t set_pin;
+} tmap_pin_t;
+
+static tmap_pin_t pins[TMAP_PINS];
+
+static int pin_get(uint16_t blob_id) {
+  tmap_pin_t *free_pin = NULL;
+  for (uint32_t i = 0; i < TMAP_PINS; i++) {
+    if (pins[i].blob_id == blob_id) {
+      pins[i].procs++;
+      return 0;
+    }
+    if (!pins[i].blob_id && !free_pin)
+      free_pin = &pins[i];
+  }
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  if (!free_pin || !blob)
+    return -1;
+
+  free_pin->blob_id = blob_id;
+  free_pin->procs = 1;
+  free_pin->set_pin = !(blob->flags & BLOB_FLAG_PINNED);
+  blob->flags |= BLOB_FLAG_PINNED;
+  return 0;
+}
+
+static void pin_put(uint16_t blob_id) {
+  for (uint32_t i = 0; i < TMAP_PINS; i++) {
+    if (pins[i].blob_id != blob_id)
+      continue;
+    if (--pins[i].procs == 0) {
+      heap_blob_t *blob = heap_get_blob(blob_id);
+      if (blob && pins[i].set_pin)
+        blob->flags &= (uint8_t)~BLOB_FLAG_PINNED;
+      pins[i].blob_id = 0;
+    }
+    return;
+  }
+}
+
+/* Helper: lowest free range of pages in the window starting at phase
+ * modulo align. Sets *at to where its entry goes in proc->tmaps
+ */
+static uint32_t find_range(const process_t *proc, uint32_t pages, uint32_t align, uint32_t phase,
+                           uint32_t *at) {
+  uint32_t bytes = pages * PAGE_SIZE;
+  uint32_t lo = TMAP_WINDOW_BASE;
+  for (uint32_t i = 0; i <= proc->num_tmaps; i++) {
+    uint32_t hi = i < proc->num_tmaps ? proc->tmaps[i].vaddr : TMAP_WINDOW_END;
+    uint32_t start = lo + ((phase - lo) & (align - 1));
+    if (start <= hi && hi - start >= bytes) {
+      *at = i;
+      return start;
+    }
+    if (i < proc->num_tmaps)
+      lo = proc->tmaps[i].vaddr + proc->tmaps[i].pages * PAGE_SIZE;
+  }
+  return 0;
+}
+
+uint32_t tmap_map(process_t *proc, uint16_t blob_id) {
+  heap_blob_t *blob = heap_get_blob(blob_id);
+  uint32_t phys = heap_get_blob_phys(blob_id);
+  if (!blob || !phys || !blob->size)
+    return 0;
+
+  uint32_t off = phys & (PAGE_SIZE - 1);
+  uint32_t pages = (off + blob->size + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint32_t vaddr = 0;
+
+  int was = interrupts_enabled();
+  interrupts_disable();
+
+  /* Mapped already: same range, nothing to write */
+  for (uint32_t i = 0; i < proc->num_tmaps; i++) {
+    tensor_map_t *m = &proc->tmaps[i];
+    if (m->blob_id == blob_id && m->pages == pages) {
+      if (m->refs < 0xFFFF)
+        m->refs++;
+      vaddr = m->vaddr + off;
+      goto out;
+    }
+  }
+  if (proc->num_tmaps >= PROCESS_TENSOR_MAPS)
+    goto out;
+
+  /* 4MB or more: same offset within 4MB as the data, for large pages */
+  uint32_t bytes = pages * PAGE_SIZE;
+  uint32_t align = bytes >= LARGE_PAGE_SIZE ? LARGE_PAGE_SIZE : PAGE_SIZE;
+  uint32_t phase = (phys - off) & (align - 1);
+  uint32_t at;
+  uint32_t start = find_range(proc, pages, align, phase, &at);
+  if (!start)
+    goto out;
+
+  if (heap_blob_retain(blob_id) != 0)
+    goto out;
+  if (pin_get(blob_id) != 0) {
+    heap_blob_release(blob_id);
+    goto out;
+  }
+
+  /* Shared: the frames are the heap's, not freed with the process */
+  uint32_t flags = (blob->flags & BLOB_FLAG_READONLY) ? PTE_USER_RO : PTE_USER_RW;
+  if (vmm_map_range_large(start, phys - off, bytes, flags | PTE_SHARED) != 0) {
+    vmm_unmap_range(start, bytes);
+    pin_put(blob_id);
+    heap_blob_release(blob_id);
+    goto out;
+  }
+
+  memmove(&proc->tmaps[at + 1], &proc->tmaps[at], (proc->num_tmaps - at) * sizeof(tensor_map_t));
+  proc->tmaps[at].vaddr = start;
+  proc->tmaps[at].pages = pages;
+  proc->tmaps[at].blob_id = blob_id;
+  proc->tmaps[at].refs = 1;
+  proc->num_tmaps++;
+  vaddr = start + off;
+
+out:
+  if (was)
+    interrupts_enable();
+  return vaddr;
+}
+
+int tmap_unmap(process_t *proc, uint32_t vaddr) {
+  int rc = -1;
+  int was = interrupts_enabled();
+  interrupts_disable();
+
+  for (uint32_t i = 0; i < proc->num_tmaps; i++) {
+    tensor_map_t *m = &proc->tmaps[i];
+    if (vaddr < m->vaddr || vaddr - m->vaddr >= m->pages * PAGE_SIZE)
+      continue;
+
+    rc = 0;
+    if (--m->refs)
+      break;
+    vmm_unmap_range(m->vaddr, m->pages * PAGE_SIZE);
+    pin_put(m->blob_id);
+    heap_blob_release(m->blob_id);
+    proc->num_tmaps--;
+    memmove(m, m + 1, (proc->num_tmaps - i) * sizeof(tensor_map_t));
+    break;
+  }
+
+  if (was)
+    interrupts_enable();
+  return rc;
+}
+
+void tmap_release_all(process_t *proc) {
+  int was = interrupts_enabled();
+  interrupts_disable();
+  for (uint32_t i = 0; i < proc->num_tmaps; i++) {
+    pin_put(proc->tmaps[i].blob_id);
+    heap_blob_release(proc->tmaps[i].blob_id);
+  }
+  proc->num_tmaps = 0;
+  if (was)
+    interrupts_enable();
+}
@@ -0,0 +1,36 @@
+/* kernel/sched/tmap.h - Heap blobs mapped into user processes
+ *
+ * sys_map_tensor() maps a blob into the calling process's tensor window
+ * and records it in proc->tmaps: mapping the same blob again returns
+ * the same address without touching the page tables. Ranges freed by
+ * sys_unmap_tensor() are reused first fit. A blob of 4MB or more gets a
+ * range at the same offset within 4MB as its data, so its middle maps
+ * with 4MB pages.
+ *
+ * A mapping holds a blob reference and keeps the blob pinned, so
+ * heap_compact() cannot move it under the process.
+ */
+#ifndef _SCHED_TMAP_H
+#define _SCHED_TMAP_H
+
+#include "../process.h"
+
+/* Below the user stack, above the vdata page */
+#define TMAP_WINDOW_BASE 0x80000000u
+#define TMAP_WINDOW_END  0xBF000000u
+
+/* Map blob_id into proc, the current process (its page directory is the
+ * active one). Returns: the user address of the blob's data, or 0 if the
+ * blob is invalid or there is no room
+ */
+uint32_t tmap_map(process_t *proc, uint16_t blob_id);
+
+/* Drop one mapping of the blob whose data contains vaddr; the last one
+ * unmaps it. Returns: 0, or -1 if nothing is mapped there
+ */
+int tmap_unmap(process_t *proc, uint32_t vaddr);
+
+/* Release every blob proc has mapped; its page tables go with it */
+void tmap_release_all(process_t *proc);
+
+#endif /* _SCHED_TMAP_H */
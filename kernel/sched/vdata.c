@@ -0,0 +1,74 @@
+/* kernel/sched/vdata.c - Per-process read-only data page */
+
+#include "vdata.h"
+#include "../ipc/completion.h"
+#include "../ipc/heap.h"
+#include "../ipc/ipc.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../mm/zpool.h"
+#include "../time/time.h"
+
+/* heap_get_stats() walks the free lists: shared counters are sampled at
+ * most this often, not on every switch
+ */
+#define VDATA_STATS_US 10000
+
+static heap_stats_t heap_snap;
+static ipc_adapt_stats_t ipc_snap;
+static usec_t snap_usec;
+static int snap_valid;
+
+int vdata_map(process_t *proc) {
+  paddr_t phys = zpool_alloc();
+  if (!phys)
+    return -1;
+
+  if (vmm_map_page_in(proc->cr3, ZE_VDATA_VADDR, phys, PTE_USER_RO) != 0) {
+    pmm_free_page(phys);
+    return -1;
+  }
+
+  ze_vdata_t *v = (ze_vdata_t *)phys_to_virt(phys);
+  v->magic = ZE_VDATA_MAGIC;
+  v->version = ZE_VDATA_VERSION;
+  v->pid = proc->pid;
+  proc->vdata = v;
+  vdata_update(proc);
+  return 0;
+}
+
+void vdata_update(process_t *proc) {
+  ze_vdata_t *v = proc->vdata;
+  if (!v)
+    return;
+
+  usec_t now = time_usec();
+  if (!snap_valid || now - snap_usec >= VDATA_STATS_US) {
+    heap_get_stats(&heap_snap);
+    ipc_adapt_get_stats(&ipc_snap);
+    snap_usec = now;
+    snap_valid = 1;
+  }
+
+  v->seq++;
+  __asm__ __volatile__("" ::: "memory");
+  time_get_calibration(&v->boot_tsc, &v->cycles_per_usec);
+  time_get_usec_factor(&v->usec_mult, &v->usec_shift);
+  v->cpu_mhz = time_get_cpu_mhz();
+  v->updated_usec = now;
+  v->heap_free_bytes = heap_snap.free_bytes;
+  v->heap_used_bytes = heap_snap.used_bytes;
+  v->heap_largest_free = heap_snap.largest_free_bytes;
+  v->heap_blob_count = heap_snap.blob_count;
+  v->ipc_inflight = ipc_completion_inflight();
+  v->ipc_irq_wakeups = ipc_snap.irq_wakeups;
+  v->ipc_rsp_ewma_us = ipc_snap.ewma_us;
+  v->prio = proc->prio;
+  v->quantum_ms = proc->quantum_ms;
+  v->mem_pages_used = proc->mem_pages_used;
+  v->mem_pages_limit = proc->mem_pages_limit;
+  v->switches_in++;
+  __asm__ __volatile__("" ::: "memory");
+  v->seq++;
+}
@@ -0,0 +1,19 @@
+/* kernel/sched/vdata.h - Per-process read-only data page (kernel side)
+ *
+ * Layout and reading rules are the user ABI in include/api/vdata.h.
+ */
+#ifndef _SCHED_VDATA_H
+#define _SCHED_VDATA_H
+
+#include "../include/api/vdata.h"
+#include "../process.h"
+
+/* Give proc its page, mapped read-only at ZE_VDATA_VADDR in its page
+ * directory (freed with it). Returns: 0, or -1 out of memory
+ */
+int vdata_map(process_t *proc);
+
+/* Refresh proc's page; the scheduler calls it on every switch to proc */
+void vdata_update(process_t *proc);
+
+#endif /* _SCHED_VDATA_H */
@@ -1,6 +1,25 @@
+#include "arch/irq.h"
 #include "arch/keyboard.h"
+#include "arch/pmu.h"
 #include "console.h"
 #include "ipc/ipc.h"
+#include "ipc/mesh_work.h"
+#include "mm/kheap.h"
+#include "mm/pmm.h"
+#include "mm/slab.h"
+#include "mm/vmm.h"
+#include "sched/fiber.h"
+#include "sched/coll.h"
+#include "sched/gang.h"
+#include "sched/idle_work.h"
+#include "sched/sched_core.h"
+#include "trace/bench.h"
+#include "trace/flightrec.h"
+#include "trace/klog.h"
+#include "trace/lat.h"
+#include "trace/prof.h"
+#include "wasm/policy_cache.h"
+#include "wasm/wasm_model.h"
 
 /* Simple Kernel Shell */
 static char cmd_buf[128];
@@ -43,7 +62,22 @@ static void run_command(void) {
     console_write("  cls     - Clear screen\n");
     console_write("  ping    - Send IPC PING to Bridge\n");
     console_write("  model <id> - Send IPC RUN_MODEL (id=0-9)\n");
+    console_write("  models  - Show cached policy weights\n");
+    console_write("  pcache <model> <grid/1000> - Cache a model's actions (grid 0: off)\n");
     console_write("  ipc     - Show IPC debug stats\n");
+    console_write("  vmm     - Show page mapping stats\n");
+    console_write("  mem     - Show physical memory, slab caches and heap\n");
+    console_write("  sched   - Show scheduler stats\n");
+    console_write("  fiber   - Show fibers, benchmark a switch\n");
+    console_write("  gang    - Show collective barrier and ring stats\n");
+    console_write("  mesh    - Show mesh nodes and remote step stats\n");
+    console_write("  lat [reset] - Show latency percentiles (or clear them)\n");
+    console_write("  irq     - Show interrupt counts per vector and CPU\n");
+    console_write("  idle    - Show background work time per class\n");
+    console_write("  pmu [sample <event> <period> | stop] - Show hardware counters\n");
+    console_write("  trace [cats <hex>] - Show (or set) flight recorder categories\n");
+    console_write("  bench [list | all | <name>] - Run microbenchmarks\n");
+    console_write("  prof [start [hz] | stop] - Sample kernel stacks (stop sends them)\n");
   }
   /* cls - Clear screen */
   else if (strncmp(cmd, "cls", 3) == 0) {
@@ -62,6 +96,176 @@ static void run_command(void) {
   else if (strncmp(cmd, "ipc", 3) == 0) {
     ipc_dump_debug();
   }
+  /* vmm - Show mapping stats */
+  else if (strncmp(cmd, "vmm", 3) == 0) {
+    vmm_dump_stats();
+  }
+  /* mem - Physical memory map and object caches */
+  else if (strncmp(cmd, "mem", 3) == 0) {
+    pmm_dump_map();
+    kmem_cache_dump();
+    kheap_dump();
+  }
+  /* sched - Show scheduler stats */
+  else if (strncmp(cmd, "sched", 5) == 0) {
+    sched_dump_stats();
+  }
+  /* fiber - Fiber stats and switch cost */
+  else if (strncmp(cmd, "fiber", 5) == 0) {
+    fiber_dump();
+  }
+  /* mesh - Nodes, then steps sent to and served for each */
+  else if (strncmp(cmd, "mesh", 4) == 0) {
+    ipc_mesh_dump();
+    mesh_work_dump();
+  }
+  /* gang - Collective barrier stats per mesh node */
+  else if (strncmp(cmd, "gang", 4) == 0) {
+    gang_dump();
+    coll_dump();
+  }
+  /* lat - Latency histograms */
+  else if (strncmp(cmd, "lat", 3) == 0) {
+    char *arg = cmd + 3;
+    while (*arg == ' ')
+      arg++;
+    if (strncmp(arg, "reset", 5) == 0)
+      lat_reset();
+    else
+      lat_dump();
+  }
+  /* idle - Background work accounting */
+  else if (strncmp(cmd, "idle", 4) == 0) {
+    idle_work_dump();
+  }
+  /* irq - Interrupt counts and delivery CPUs */
+  else if (strncmp(cmd, "irq", 3) == 0) {
+    irq_dump();
+  }
+  /* pmu - Hardware counters; sample <event> <period> profiles IPs */
+  else if (strncmp(cmd, "pmu", 3) == 0) {
+    char *arg = cmd + 3;
+    while (*arg == ' ')
+      arg++;
+    if (strncmp(arg, "stop", 4) == 0) {
+      pmu_sample_stop();
+    } else if (strncmp(arg, "sample", 6) == 0) {
+      arg += 6;
+      while (*arg == ' ')
+        arg++;
+      uint32_t ev = 0;
+      while (ev < PMU_EVENTS) {
+        const char *name = pmu_event_name(ev);
+        int len = 0;
+        while (name[len])
+          len++;
+        if (strncmp(arg, name, len) == 0 && (arg[len] == ' ' || arg[len] == '\0'))
+          break;
+        ev++;
+      }
+      while (*arg && *arg != ' ')
+        arg++;
+      while (*arg == ' ')
+        arg++;
+      uint32_t period = 0;
+      while (*arg >= '0' && *arg <= '9' && period < 100000000)
+        period = period * 10 + (uint32_t)(*arg++ - '0');
+
+      if (pmu_sample_start(ev, period) == 0)
+        console_write("Sampling.\n");
+      else
+        console_write("Usage: pmu sample <instr|cycles|llc|branch|dtlb> <period>"
+                      " (counted events only)\n");
+    } else {
+      pmu_dump();
+    }
+  }
+  /* trace - Flight recorder categories: bit n = event types 0xn0-0xnF */
+  else if (strncmp(cmd, "trace", 5) == 0) {
+    char *arg = cmd + 5;
+    while (*arg == ' ')
+      arg++;
+    uint32_t mask = flightrec_cats;
+    if (strncmp(arg, "cats", 4) == 0) {
+      arg += 4;
+      while (*arg == ' ')
+        arg++;
+      if (arg[0] == '0' && arg[1] == 'x')
+        arg += 2;
+      mask = 0;
+      for (; *arg; arg++) {
+        char c = *arg;
+        uint32_t d = c >= '0' && c <= '9' ? (uint32_t)(c - '0')
+                     : c >= 'a' && c <= 'f' ? (uint32_t)(c - 'a' + 10)
+                     : c >= 'A' && c <= 'F' ? (uint32_t)(c - 'A' + 10) : 16;
+        if (d == 16)
+          break;
+        mask = mask << 4 | d;
+      }
+      mask = flightrec_set_categories(mask);
+    }
+    console_write("[trace] categories ");
+    print_hex32(mask);
+    console_write(" (built ");
+    print_hex32(TRACE_CATS_BUILT);
+    console_write(")\n");
+  }
+  /* bench - Microbenchmarks; results also go to the bridge */
+  else if (strncmp(cmd, "bench", 5) == 0) {
+    char *arg = cmd + 5;
+    while (*arg == ' ')
+      arg++;
+    if (*arg == '\0' || strncmp(arg, "list", 4) == 0)
+      bench_list();
+    else
+      bench_run(arg);
+  }
+  /* prof - Sampling profiler; stop hands the samples to the bridge */
+  else if (strncmp(cmd, "prof", 4) == 0) {
+    char *arg = cmd + 4;
+    while (*arg == ' ')
+      arg++;
+    if (strncmp(arg, "start", 5) == 0) {
+      arg += 5;
+      while (*arg == ' ')
+        arg++;
+      uint32_t hz = 0;
+      while (*arg >= '0' && *arg <= '9' && hz < 100000)
+        hz = hz * 10 + (uint32_t)(*arg++ - '0');
+      if (prof_start(hz) == 0)
+        console_write("Profiling.\n");
+      else
+        console_write("Usage: prof start [hz] (at most 10000)\n");
+    } else if (strncmp(arg, "stop", 4) == 0) {
+      prof_stop();
+    } else {
+      prof_dump();
+    }
+  }
+  /* models - Show the weight cache */
+  else if (strncmp(cmd, "models", 6) == 0) {
+    wasm_model_dump();
+    policy_cache_dump();
+  }
+  /* pcache <model> <grid/1000> - Cache actions by quantized observation */
+  else if (strncmp(cmd, "pcache", 6) == 0) {
+    char *arg = cmd + 6;
+    uint32_t model_id = 0, milli = 0;
+    while (*arg == ' ')
+      arg++;
+    while (*arg >= '0' && *arg <= '9' && model_id < 0x10000000u)
+      model_id = model_id * 10 + (uint32_t)(*arg++ - '0');
+    while (*arg == ' ')
+      arg++;
+    int have_grid = *arg >= '0' && *arg <= '9';
+    while (*arg >= '0' && *arg <= '9' && milli < 1000000u)
+      milli = milli * 10 + (uint32_t)(*arg++ - '0');
+    if (!model_id || !have_grid)
+      console_write("Usage: pcache <model> <grid/1000> (0 stops caching it)\n");
+    else if (policy_cache_config(model_id, milli) != 0)
+      console_write("No room: stop caching another model first.\n");
+    policy_cache_dump();
+  }
   /* model <id> - Run Model */
   else if (strncmp(cmd, "model", 5) == 0) {
     char *arg = cmd + 5;
@@ -136,6 +340,9 @@ void shell_start(void) {
       }
     }
 
+    /* Emit deferred log records before sleeping */
+    klog_drain(0);
+
     /* Yield / HLT */
     __asm__ __volatile__("hlt");
   }
@@ -1,16 +1,21 @@
 /* kernel/time/time.c
  *
- * Time subsystem implementation using rdtsc calibrated against PIT.
+ * Time subsystem implementation using rdtsc.
  *
- * Calibration approach:
- * 1. Program PIT channel 2 for a known delay (e.g., 10ms)
- * 2. Read rdtsc before and after
- * 3. Calculate cycles per microsecond
+ * Calibration, first source that answers:
+ * 1. CPUID 0x15: crystal clock and TSC/crystal ratio (exact, no waiting)
+ * 2. Hypervisor timing leaf 0x40000010: TSC kHz (VMware, QEMU)
+ * 3. KVM pvclock: the host's TSC-to-nanosecond multiplier
+ * 4. CPUID 0x16: processor base MHz (close to the TSC on Intel parts)
+ * 5. PIT channel 2 over a known delay (10ms of boot time; not in
+ *    FAST_BOOT builds, which take the assumed rate instead)
  *
- * This gives us accurate wall-clock time from the TSC.
+ * The rate is then turned into multiply-shift factors, so time_usec() and
+ * the conversions are a couple of multiplies instead of a 64-bit divide.
  */
 #include "time.h"
 #include "../console.h"
+#include "../mm/vmm.h"
 
 /* PIT (Programmable Interval Timer) ports */
 #define PIT_CHANNEL_2   0x42
@@ -24,11 +29,43 @@
 #define CALIBRATION_MS  10
 #define CALIBRATION_PIT_TICKS ((PIT_FREQ_HZ * CALIBRATION_MS) / 1000)
 
+/* Give up on a PIT that never counts down (port reads, ~1us each) */
+#define PIT_SPIN_MAX    10000000u
+
+/* Used when nothing could be measured */
+#define ASSUMED_KHZ     1000000u
+
+/* Hypervisor CPUID leaves and the KVM clock */
+#define CPUID_HV_BASE           0x40000000u
+#define CPUID_HV_TIMING         0x40000010u
+#define KVM_FEATURE_CLOCKSOURCE2 (1u << 3)
+#define MSR_KVM_SYSTEM_TIME_NEW 0x4b564d01u
+
 /* Global state */
 static uint32_t cpu_mhz = 0;
-static uint32_t cycles_per_usec = 0;
+static uint32_t cycles_per_usec = 0;  /* Rounded; for the vdata page */
+static uint32_t tsc_khz = 0;
+static int tsc_invariant = 0;
 static cycles_t boot_tsc = 0;
 
+/* cycles -> usec and usec -> cycles as (v * mult) >> shift */
+static uint32_t usec_mult = 0, usec_shift = 0;
+static uint32_t cyc_mult = 0, cyc_shift = 0;
+
+/* KVM fills this in once the MSR points at it */
+typedef struct {
+    volatile uint32_t version;
+    uint32_t pad0;
+    uint64_t tsc_timestamp;
+    uint64_t system_time;
+    uint32_t tsc_to_system_mul;
+    int8_t tsc_shift;
+    uint8_t flags;
+    uint8_t pad[2];
+} __attribute__((packed, aligned(32))) pvclock_info_t;
+
+static pvclock_info_t pvclock;
+
 /* Port I/O helpers */
 static inline void outb(uint16_t port, uint8_t val) {
     __asm__ __volatile__("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -40,8 +77,43 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
-/* Wait for PIT count to complete using channel 2 (speaker timer) */
-static void pit_wait(uint16_t count) {
+static void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                         : "a"(leaf), "c"(0));
+}
+
+static void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__("wrmsr" :: "a"((uint32_t)val), "d"((uint32_t)(val >> 32)),
+                         "c"(msr));
+}
+
+/* (v * mult) >> shift with a 96-bit product, no 64-bit divide */
+static inline uint64_t mul_shift(uint64_t v, uint32_t mult, uint32_t shift) {
+    uint64_t lo = (uint64_t)(uint32_t)v * mult;
+    uint64_t hi = (v >> 32) * mult;
+    if (shift >= 32)
+        return (hi + (lo >> 32)) >> (shift - 32);
+    return (hi << (32 - shift)) + (lo >> shift);
+}
+
+/* mult/2^shift ~= num/den, rounded up, with the largest shift that keeps
+ * mult in 32 bits (a relative error under 2^-30 for any real TSC rate)
+ */
+static void calc_factor(uint64_t num, uint64_t den, uint32_t *mult, uint32_t *shift) {
+    uint32_t s = 0;
+    while (s < 40 && ((num << (s + 1)) + den - 1) / den <= 0xFFFFFFFFull)
+        s++;
+    uint64_t m = ((num << s) + den - 1) / den;
+    *mult = (uint32_t)m;
+    *shift = s;
+}
+
+#ifndef ZENEDGE_FAST_BOOT
+/* Wait for PIT count to complete using channel 2 (speaker timer)
+ * Returns: 0, or -1 if the output never went high
+ */
+static int pit_wait(uint16_t count) {
     uint8_t tmp;
 
     /* Disable speaker, enable gate */
@@ -65,61 +137,143 @@ static void pit_wait(uint16_t count) {
     outb(PIT_GATE, tmp);
 
     /* Wait for output to go high (bit 5 of port 0x61) */
-    while ((inb(PIT_GATE) & 0x20) == 0) {
-        /* spin */
+    for (uint32_t spins = 0; (inb(PIT_GATE) & 0x20) == 0; spins++) {
+        if (spins >= PIT_SPIN_MAX)
+            return -1;
     }
+    return 0;
 }
 
-/* Calibrate TSC against PIT */
-static void calibrate_tsc(void) {
+/* Calibrate TSC against PIT; returns kHz, 0 on failure */
+static uint32_t calibrate_pit(void) {
     cycles_t start, end;
-    uint64_t elapsed;
-
-    console_write("[time] calibrating TSC...\n");
 
-    /* First measurement */
     start = rdtsc();
-    pit_wait(CALIBRATION_PIT_TICKS);
+    if (pit_wait(CALIBRATION_PIT_TICKS) != 0)
+        return 0;
     end = rdtsc();
 
-    elapsed = end - start;
+    return (uint32_t)((end - start) / CALIBRATION_MS);
+}
+#endif
 
-    /* cycles_per_usec = elapsed / (CALIBRATION_MS * 1000) */
-    cycles_per_usec = (uint32_t)(elapsed / (CALIBRATION_MS * 1000));
-    cpu_mhz = cycles_per_usec;
+/* CPUID 0x15: TSC = crystal * ebx / eax; Hz in ecx (0 if not enumerated) */
+static uint32_t calibrate_cpuid15(uint32_t max_leaf) {
+    uint32_t a, b, c, d;
+    if (max_leaf < 0x15)
+        return 0;
+    cpuid(0x15, &a, &b, &c, &d);
+    if (a == 0 || b == 0 || c == 0)
+        return 0;
+    return (uint32_t)((uint64_t)c * b / a / 1000);
+}
 
-    /* Print calibration result */
-    console_write("[time] CPU frequency: ");
+/* CPUID 0x16: base frequency in MHz */
+static uint32_t calibrate_cpuid16(uint32_t max_leaf) {
+    uint32_t a, b, c, d;
+    if (max_leaf < 0x16)
+        return 0;
+    cpuid(0x16, &a, &b, &c, &d);
+    return (a & 0xFFFF) * 1000;
+}
 
-    /* Print MHz (simple integer print) */
-    char buf[12];
-    int i = 10;
-    buf[11] = '\0';
-    uint32_t v = cpu_mhz;
-    if (v == 0) {
-        buf[i--] = '0';
-    } else {
-        while (v > 0 && i >= 0) {
-            buf[i--] = '0' + (v % 10);
-            v /= 10;
-        }
-    }
-    console_write(&buf[i + 1]);
-    console_write(" MHz\n");
+/* Hypervisor timing leaf: eax = TSC kHz */
+static uint32_t calibrate_hv_leaf(uint32_t hv_max) {
+    uint32_t a, b, c, d;
+    if (hv_max < CPUID_HV_TIMING)
+        return 0;
+    cpuid(CPUID_HV_TIMING, &a, &b, &c, &d);
+    return a;
+}
+
+/* KVM pvclock: ns = (tsc << shift) * mul >> 32, so kHz = 1e6 * 2^32 / mul
+ * undone by the shift. The clock is switched off again after one read.
+ */
+static uint32_t calibrate_kvm(uint32_t hv_max, uint32_t sig_b, uint32_t sig_c,
+                              uint32_t sig_d) {
+    uint32_t a, b, c, d;
+    /* "KVMKVMKVM\0\0\0" */
+    if (hv_max < CPUID_HV_BASE + 1 || sig_b != 0x4b4d564b || sig_c != 0x564b4d56 ||
+        sig_d != 0x4d)
+        return 0;
+    cpuid(CPUID_HV_BASE + 1, &a, &b, &c, &d);
+    if (!(a & KVM_FEATURE_CLOCKSOURCE2))
+        return 0;
+
+    wrmsr(MSR_KVM_SYSTEM_TIME_NEW, virt_to_phys((vaddr_t)&pvclock) | 1);
+    uint32_t version, mul;
+    int8_t shift;
+    do {
+        version = pvclock.version;
+        __asm__ __volatile__("" ::: "memory");
+        mul = pvclock.tsc_to_system_mul;
+        shift = pvclock.tsc_shift;
+        __asm__ __volatile__("" ::: "memory");
+    } while ((version & 1) || version != pvclock.version);
+    wrmsr(MSR_KVM_SYSTEM_TIME_NEW, 0);
+
+    if (mul == 0)
+        return 0;
+    uint64_t khz = (1000000ull << 32) / mul;
+    if (shift < 0)
+        khz <<= -shift;
+    else
+        khz >>= shift;
+    return (uint32_t)khz;
 }
 
 void time_init(void) {
+    uint32_t a, b, c, d, max_leaf, hv_max = 0;
+    const char *source;
+
     console_write("[time] initializing time subsystem\n");
 
     /* Record boot TSC */
     boot_tsc = rdtsc();
 
-    /* Skip PIT calibration for now - use assumed CPU frequency */
-    /* TODO: Re-enable calibrate_tsc() once PIT issues are resolved */
-    cycles_per_usec = 1000;  /* Assume 1 GHz for QEMU */
-    cpu_mhz = 1000;
+    cpuid(0, &max_leaf, &b, &c, &d);
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, &a, &b, &c, &d);
+        tsc_invariant = (d >> 8) & 1;
+    }
+
+    uint32_t sig_b = 0, sig_c = 0, sig_d = 0;
+    cpuid(1, &a, &b, &c, &d);
+    if (c & (1u << 31)) {
+        cpuid(CPUID_HV_BASE, &hv_max, &sig_b, &sig_c, &sig_d);
+    }
+
+    if ((tsc_khz = calibrate_cpuid15(max_leaf)) != 0) {
+        source = "CPUID 0x15";
+    } else if ((tsc_khz = calibrate_hv_leaf(hv_max)) != 0) {
+        source = "hypervisor leaf";
+    } else if ((tsc_khz = calibrate_kvm(hv_max, sig_b, sig_c, sig_d)) != 0) {
+        source = "KVM pvclock";
+    } else if ((tsc_khz = calibrate_cpuid16(max_leaf)) != 0) {
+        source = "CPUID 0x16";
+#ifndef ZENEDGE_FAST_BOOT
+    } else if ((tsc_khz = calibrate_pit()) != 0) {
+        source = "PIT";
+#endif
+    } else {
+        tsc_khz = ASSUMED_KHZ;
+        source = "assumed";
+    }
+    if (tsc_khz < 2000)
+        tsc_khz = 2000;  /* Keeps usec_mult in 32 bits */
+
+    cpu_mhz = (tsc_khz + 500) / 1000;
+    cycles_per_usec = cpu_mhz;
+    /* Both rounded up, so time_usec() at time_usec_to_tsc(t) is never below t */
+    calc_factor(1000, tsc_khz, &usec_mult, &usec_shift);
+    calc_factor(tsc_khz, 1000, &cyc_mult, &cyc_shift);
 
-    console_write("[time] using assumed 1000 MHz CPU frequency\n");
+    console_write("[time] TSC ");
+    print_uint(tsc_khz);
+    console_write(" kHz (");
+    console_write(source);
+    console_write(tsc_invariant ? ", invariant)\n" : ", not invariant)\n");
     console_write("[time] init complete\n");
 }
 
@@ -128,19 +282,40 @@ cycles_t time_cycles(void) {
 }
 
 usec_t time_usec(void) {
-    if (cycles_per_usec == 0) return 0;
-    return (rdtsc() - boot_tsc) / cycles_per_usec;
+    return mul_shift(rdtsc() - boot_tsc, usec_mult, usec_shift);
 }
 
 usec_t cycles_to_usec(cycles_t cycles) {
-    if (cycles_per_usec == 0) return 0;
-    return cycles / cycles_per_usec;
+    return mul_shift(cycles, usec_mult, usec_shift);
 }
 
 cycles_t usec_to_cycles(usec_t usec) {
-    return usec * cycles_per_usec;
+    return mul_shift(usec, cyc_mult, cyc_shift);
+}
+
+cycles_t time_usec_to_tsc(usec_t usec) {
+    /* +1 covers the floor in mul_shift(): deadlines must not fire early */
+    return boot_tsc + mul_shift(usec, cyc_mult, cyc_shift) + 1;
 }
 
 uint32_t time_get_cpu_mhz(void) {
     return cpu_mhz;
 }
+
+uint32_t time_get_tsc_khz(void) {
+    return tsc_khz;
+}
+
+int time_tsc_invariant(void) {
+    return tsc_invariant;
+}
+
+void time_get_calibration(cycles_t *boot, uint32_t *cyc_per_usec) {
+    *boot = boot_tsc;
+    *cyc_per_usec = cycles_per_usec;
+}
+
+void time_get_usec_factor(uint32_t *mult, uint32_t *shift) {
+    *mult = usec_mult;
+    *shift = usec_shift;
+}
@@ -1,7 +1,8 @@
 /* kernel/time/time.h
  *
  * Real-time measurement for AI/ML workload telemetry.
- * Uses rdtsc (cycle counter) calibrated against PIT for wall-clock conversion.
+ * Uses rdtsc (cycle counter), calibrated from CPUID or the hypervisor when
+ * they report the TSC rate and against the PIT otherwise.
  */
 #ifndef TIME_H
 #define TIME_H
@@ -16,7 +17,7 @@
 typedef uint64_t cycles_t;
 typedef uint64_t usec_t;
 
-/* Initialize time subsystem - calibrates rdtsc against PIT */
+/* Initialize time subsystem - finds the TSC rate (see time.c) */
 void time_init(void);
 
 /* Read current cycle counter (rdtsc) - very fast, no syscall */
@@ -38,9 +39,28 @@ usec_t cycles_to_usec(cycles_t cycles);
 /* Convert microseconds to cycles */
 cycles_t usec_to_cycles(usec_t usec);
 
+/* rdtsc() value at time_usec() == usec (e.g. for a TSC deadline) */
+cycles_t time_usec_to_tsc(usec_t usec);
+
 /* Get CPU frequency in MHz (after calibration) */
 uint32_t time_get_cpu_mhz(void);
 
+/* TSC rate in kHz, and whether it stays constant across P/C-states
+ * (CPUID 0x80000007 EDX bit 8)
+ */
+uint32_t time_get_tsc_khz(void);
+int time_tsc_invariant(void);
+
+/* The TSC base and rate behind time_usec(), so a reader of rdtsc() can
+ * convert without calling in (sched/vdata.c)
+ */
+void time_get_calibration(cycles_t *boot, uint32_t *cyc_per_usec);
+
+/* time_usec() == (rdtsc() - boot) * mult >> shift, exactly as the kernel
+ * computes it (cyc_per_usec above is rounded)
+ */
+void time_get_usec_factor(uint32_t *mult, uint32_t *shift);
+
 /*
  * Duration measurement helpers
  * Usage:
@@ -0,0 +1,204 @@
+/* kernel/time/timer.c
+ *
+ * Hierarchical timing wheel.
+ *
+ * Level L has 64 slots of 64^L ticks each. A timer goes into the lowest
+ * level whose span reaches its tick, into the slot holding it; when the
+ * wheel's clock enters a slot above level 0, that slot's timers are
+ * re-filed lower down (cascaded), so a level 0 slot only ever holds
+ * timers for the one tick it runs. Arming and cancelling are list
+ * operations; a bit per non-empty slot lets timer_run() and
+ * timer_next_deadline() jump straight to the next tick with work instead
+ * of stepping through the empty ones.
+ */
+#include "timer.h"
+#include "../arch/idt.h"
+
+#define LEVEL_SPAN(l)  (1ull << (TIMER_SLOT_BITS * (l)))
+#define WHEEL_SPAN     LEVEL_SPAN(TIMER_LEVELS)
+
+static ktimer_t *wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t occupied[TIMER_LEVELS];     /* Bit per non-empty slot */
+static uint64_t clk;                        /* Next tick to process */
+static uint32_t pending;
+static volatile uint8_t timer_lock;         /* Armed from IRQs too */
+
+static int lock(void) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    while (__atomic_test_and_set(&timer_lock, __ATOMIC_ACQUIRE))
+        __asm__ __volatile__("pause");
+    return was;
+}
+
+static void unlock(int was) {
+    __atomic_clear(&timer_lock, __ATOMIC_RELEASE);
+    if (was)
+        interrupts_enable();
+}
+
+/* Helper: lock held; file t by its tick relative to clk */
+static void slot_add(ktimer_t *t) {
+    uint64_t tick = t->expires;
+    uint64_t delta = tick - clk;
+    uint32_t l = 0;
+    if (delta >= WHEEL_SPAN) {
+        /* Beyond the wheel: wait in the furthest slot, re-filed from there */
+        tick = clk + WHEEL_SPAN - 1;
+        l = TIMER_LEVELS - 1;
+    } else {
+        while (delta >= LEVEL_SPAN(l + 1))
+            l++;
+    }
+    uint32_t idx = (uint32_t)(tick >> (TIMER_SLOT_BITS * l)) & (TIMER_SLOTS - 1);
+
+    ktimer_t **head = &wheel[l][idx];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    occupied[l] |= 1ull << idx;
+}
+
+/* Helper: lock held; unlink t from its slot (or timer_run()'s batch) */
+static void slot_del(ktimer_t *t) {
+    ktimer_t **pprev = t->pprev;
+    *pprev = t->next;
+    if (t->next)
+        t->next->pprev = pprev;
+    t->pprev = 0;
+
+    ktimer_t **first = &wheel[0][0];
+    if (!*pprev && pprev >= first && pprev < first + TIMER_LEVELS * TIMER_SLOTS) {
+        uint32_t i = (uint32_t)(pprev - first);
+        occupied[i / TIMER_SLOTS] &= ~(1ull << (i % TIMER_SLOTS));
+    }
+}
+
+/* Helper: lock held; re-file one slot's timers against the current clk */
+static void cascade(uint32_t l) {
+    uint32_t idx = (uint32_t)(clk >> (TIMER_SLOT_BITS * l)) & (TIMER_SLOTS - 1);
+    ktimer_t *t = wheel[l][idx];
+    wheel[l][idx] = 0;
+    occupied[l] &= ~(1ull << idx);
+    while (t) {
+        ktimer_t *next = t->next;
+        slot_add(t);
+        t = next;
+    }
+}
+
+/* Helper: lock held, timers pending; the first tick (>= clk) at which a
+ * level 0 slot runs or a higher slot cascades
+ */
+static uint64_t next_tick(void) {
+    uint64_t best = ~0ull;
+    for (uint32_t l = 0; l < TIMER_LEVELS; l++) {
+        uint64_t bits = occupied[l];
+        if (!bits)
+            continue;
+        uint32_t s = TIMER_SLOT_BITS * l;
+        /* Slot numbers run on past 63; the one clk is in is done unless
+         * clk sits on its first tick (or this is level 0)
+         */
+        uint64_t first = clk >> s;
+        if (l && (clk & (LEVEL_SPAN(l) - 1)))
+            first++;
+        uint32_t rot = (uint32_t)first & (TIMER_SLOTS - 1);
+        if (rot)
+            bits = (bits >> rot) | (bits << (TIMER_SLOTS - rot));
+        uint64_t tick = (first + (uint64_t)__builtin_ctzll(bits)) << s;
+        if (tick < best)
+            best = tick;
+    }
+    return best;
+}
+
+void timer_arm(ktimer_t *t, usec_t deadline_us, ktimer_fn_t fn, void *arg) {
+    int was = lock();
+    if (t->pprev) {
+        slot_del(t);
+        pending--;
+    }
+    if (!pending) {
+        /* Idle wheel: catch the clock up rather than walk to now later */
+        uint64_t now = time_usec() >> TIMER_TICK_SHIFT;
+        if (now > clk)
+            clk = now;
+    }
+    t->deadline_us = deadline_us;
+    t->expires = (deadline_us + TIMER_TICK_US - 1) >> TIMER_TICK_SHIFT;
+    if (t->expires < clk)
+        t->expires = clk;
+    t->fn = fn;
+    t->arg = arg;
+    slot_add(t);
+    pending++;
+    unlock(was);
+}
+
+int timer_cancel(ktimer_t *t) {
+    int was = lock();
+    int armed = t->pprev != 0;
+    if (armed) {
+        slot_del(t);
+        pending--;
+    }
+    unlock(was);
+    return armed;
+}
+
+uint32_t timer_run(void) {
+    uint64_t now = time_usec() >> TIMER_TICK_SHIFT;
+    uint32_t ran = 0;
+
+    int was = lock();
+    while (pending) {
+        uint64_t tick = next_tick();
+        if (tick > now)
+            break;
+        clk = tick;
+
+        /* Entering a level 1 slot, maybe a level 2 one, ... */
+        for (uint32_t l = 1; l < TIMER_LEVELS && !(clk & (LEVEL_SPAN(l) - 1)); l++)
+            cascade(l);
+
+        /* This tick's timers, off the wheel before anything runs so a
+         * callback re-arming for now lands on the next tick
+         */
+        uint32_t idx = (uint32_t)clk & (TIMER_SLOTS - 1);
+        ktimer_t *batch = wheel[0][idx];
+        wheel[0][idx] = 0;
+        occupied[0] &= ~(1ull << idx);
+        if (batch)
+            batch->pprev = &batch;
+        clk++;
+
+        while (batch) {
+            ktimer_t *t = batch;
+            slot_del(t);
+            pending--;
+            unlock(was);
+            t->fn(t, t->arg);
+            ran++;
+            was = lock();
+        }
+    }
+    if (clk <= now)
+        clk = now + 1;
+    unlock(was);
+    return ran;
+}
+
+usec_t timer_next_deadline(void) {
+    usec_t next = 0;
+    int was = lock();
+    if (pending) {
+        next = (usec_t)(next_tick() << TIMER_TICK_SHIFT);
+        if (!next)
+            next = 1;  /* Tick 0 is not "none" */
+    }
+    unlock(was);
+    return next;
+}
@@ -0,0 +1,66 @@
+/* kernel/time/timer.h
+ *
+ * Kernel timers: a hierarchical timing wheel of caller-owned ktimer_t,
+ * O(1) to arm and cancel from anywhere (IRQs included). Callbacks run
+ * from timer_run() in the main loop, never in interrupt context; the
+ * loop sleeps until timer_next_deadline() on the one-shot LAPIC timer.
+ *
+ * Usage:
+ *   static ktimer_t t;
+ *   timer_arm(&t, time_usec() + 5000, on_timeout, ctx);
+ *   ...
+ *   timer_cancel(&t);           // if it is no longer wanted
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "time.h"
+
+/* Wheel resolution: callbacks run on the first tick at or after their
+ * deadline, so up to TIMER_TICK_US - 1 late
+ */
+#define TIMER_TICK_SHIFT 8
+#define TIMER_TICK_US    (1u << TIMER_TICK_SHIFT)
+
+/* 4 levels of 64 slots cover 2^24 ticks (about 71 minutes); timers
+ * further out wait in the last slot and are re-filed as it comes round
+ */
+#define TIMER_LEVELS     4
+#define TIMER_SLOT_BITS  6
+#define TIMER_SLOTS      (1u << TIMER_SLOT_BITS)
+
+typedef struct ktimer ktimer_t;
+
+/* Runs once per timer_arm(); may re-arm t */
+typedef void (*ktimer_fn_t)(ktimer_t *t, void *arg);
+
+struct ktimer {
+    ktimer_t *next;
+    ktimer_t **pprev;       /* NULL = not pending */
+    usec_t deadline_us;
+    uint64_t expires;       /* Tick it runs at: deadline rounded up */
+    ktimer_fn_t fn;
+    void *arg;
+};
+
+/* Have fn(t, arg) run at deadline_us (time_usec()); a pending t moves.
+ * A deadline already past runs from the next timer_run().
+ */
+void timer_arm(ktimer_t *t, usec_t deadline_us, ktimer_fn_t fn, void *arg);
+
+/* Returns: 1 if t was pending (it will not run), 0 if not */
+int timer_cancel(ktimer_t *t);
+
+static inline int timer_pending(const ktimer_t *t) {
+    return t->pprev != 0;
+}
+
+/* Main loop: run the callbacks that are due
+ * Returns: callbacks run
+ */
+uint32_t timer_run(void);
+
+/* When timer_run() next has work, 0 = no timers (for a one-shot timer) */
+usec_t timer_next_deadline(void);
+
+#endif /* TIMER_H */
@@ -0,0 +1,422 @@
+/* kernel/trace/bench.c - In-kernel microbenchmarks */
+
+#include "bench.h"
+#include "flightrec.h"
+#include "klog.h"
+#include "../arch/idt.h"
+#include "../console.h"
+#include "../include/string.h"
+#include "../ipc/completion.h"
+#include "../ipc/heap.h"
+#include "../lib/sha256.h"
+#include "../mm/kheap.h"
+#include "../mm/pmm.h"
+#include "../sched/fiber.h"
+#ifndef __x86_64__
+#include "../sched/sched_core.h"
+#endif
+#include "../time/time.h"
+#include "../wasm_loader.h"
+
+#define BENCH_IPC_TIMEOUT_US 100000
+#define BENCH_SHA_BYTES      4096
+
+typedef struct {
+    const char *name;
+    uint32_t arg;           /* Passed to op: a size, a model, ... */
+    uint32_t batch;         /* Operations per sample */
+    uint32_t samples;
+    uint32_t bytes;         /* Per operation, for MB/s; 0 = none */
+    int irqs;               /* Leave interrupts on (waits for the bridge) */
+    /* One operation. Returns: 0, or -1 if unavailable (skip the test) */
+    int (*op)(uint32_t arg);
+    /* Instead of op: time batch operations itself
+     * Returns: cycles, or 0 if unavailable
+     */
+    uint64_t (*timed)(uint32_t arg, uint32_t batch);
+} bench_t;
+
+static int has_rdtscp = -1;
+static uint32_t overhead;
+static uint32_t samples[BENCH_SAMPLES_MAX];
+
+/* Serialized TSC reads: nothing before begin or after end is counted
+ * (rdtscp waits for the code before it; the lfence keeps what follows
+ * from starting early)
+ */
+static inline cycles_t tsc_begin(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("lfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline cycles_t tsc_end(void) {
+    uint32_t lo, hi;
+    if (has_rdtscp)
+        __asm__ __volatile__("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi) :: "ecx", "memory");
+    else
+        __asm__ __volatile__("lfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static void detect_rdtscp(void) {
+    uint32_t a, b, c, d;
+    __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000000u), "c"(0));
+    has_rdtscp = 0;
+    if (a >= 0x80000001u) {
+        __asm__ __volatile__("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000001u), "c"(0));
+        has_rdtscp = (d >> 27) & 1;
+    }
+}
+
+/* --- Operations --------------------------------------------------------- */
+
+static int op_ipc_ping(uint32_t arg) {
+    (void)arg;
+    ipc_response_t rsp;
+    ipc_tag_t tag = ipc_submit(CMD_PING, 0, 0);
+    if (tag == IPC_TAG_NONE)
+        return -1;
+    if (ipc_completion_wait(tag, &rsp, BENCH_IPC_TIMEOUT_US) != 0) {
+        ipc_completion_cancel(tag);
+        return -1;
+    }
+    return 0;
+}
+
+static int op_heap(uint32_t size) {
+    uint16_t id = heap_alloc(size, BLOB_TYPE_RAW);
+    if (!id)
+        return -1;
+    heap_free(id);
+    return 0;
+}
+
+static int op_pmm_page(uint32_t arg) {
+    (void)arg;
+    paddr_t page = pmm_alloc_page(NUMA_NODE_LOCAL);
+    if (!page)
+        return -1;
+    pmm_free_page(page);
+    return 0;
+}
+
+static int op_kmalloc(uint32_t size) {
+    void *p = kmalloc(size);
+    if (!p)
+        return -1;
+    kfree(p);
+    return 0;
+}
+
+static uint8_t sha_buf[BENCH_SHA_BYTES];
+
+static int op_sha256(uint32_t len) {
+    uint8_t hash[32];
+    sha256_hash(sha_buf, len, hash);
+    __asm__ __volatile__("" :: "r"(hash) : "memory");
+    return 0;
+}
+
+static int op_flightrec(uint32_t arg) {
+    static uint32_t n;
+    (void)arg;
+    flightrec_log(TRACE_EVT_BENCH, 0, 0, n++);
+    return 0;
+}
+
+/* CartPole-shaped observation, pole leaning right */
+static const float bench_obs[4] = {0.01f, -0.02f, 0.03f, 0.04f};
+
+static int op_infer(uint32_t model_id) {
+    return kernel_infer_action(bench_obs, 4, model_id) < 0 ? -1 : 0;
+}
+
+/* (module (memory 1) (func (export "agent_step") (param i32 i32 i32)
+ *   (result i32) (f32.gt (f32.load offset=8 (local.get 0)) (f32.const 0))))
+ */
+static const uint8_t bench_wasm[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x08, 0x01, 0x60, 0x03, 0x7f, 0x7f, 0x7f, 0x01, 0x7f,
+    0x03, 0x02, 0x01, 0x00,
+    0x05, 0x03, 0x01, 0x00, 0x01,
+    0x07, 0x0e, 0x01, 0x0a, 0x61, 0x67, 0x65, 0x6e, 0x74, 0x5f, 0x73, 0x74,
+    0x65, 0x70, 0x00, 0x00,
+    0x0a, 0x12, 0x01, 0x10, 0x00,
+    0x20, 0x00, 0x41, 0x08, 0x6a, 0x2a, 0x02, 0x00,
+    0x43, 0x00, 0x00, 0x00, 0x00, 0x5e, 0x0b,
+};
+
+/* Cold: what a first wasm_run_agent() of a module costs, and its teardown */
+static int op_wasm_cold(uint32_t model_id) {
+    wasm_agent_t *agent = wasm_agent_create(bench_wasm, sizeof(bench_wasm));
+    if (!agent)
+        return -1;
+    int action = wasm_agent_step(agent, bench_obs, 4, model_id);
+    wasm_agent_destroy(agent);
+    return action < 0 ? -1 : 0;
+}
+
+/* Warm: the cached agent (the warmup samples create it) */
+static int op_wasm_warm(uint32_t model_id) {
+    return wasm_run_agent(bench_wasm, sizeof(bench_wasm), bench_obs, 4, model_id) < 0 ? -1 : 0;
+}
+
+#ifndef __x86_64__
+/* An agent process built and torn down without running: few enough
+ * samples that the zeroed page pool does not run dry
+ */
+static int op_spawn(uint32_t arg) {
+    (void)arg;
+    process_t *proc = sched_create_user_process(0, 0, 0);
+    if (!proc)
+        return -1;
+    sched_destroy_process(proc);
+    return 0;
+}
+#endif
+
+/* fiber_bench() times its own round trips, two switches each */
+static uint64_t timed_fiber_switch(uint32_t arg, uint32_t batch) {
+    (void)arg;
+    uint32_t rounds = batch / 2;
+    return (uint64_t)fiber_bench(rounds) * 2 * rounds;
+}
+
+static const bench_t benches[] = {
+    { "ipc_ping",       0,      1,  64, 0, 1, op_ipc_ping, 0 },
+    { "heap 64",        64,     1, 256, 0, 0, op_heap, 0 },
+    { "heap 4k",        4096,   1, 256, 0, 0, op_heap, 0 },
+    { "heap 64k",       65536,  1, 256, 0, 0, op_heap, 0 },
+    { "pmm_page",       0,      1, 256, 0, 0, op_pmm_page, 0 },
+    { "kmalloc 16",     16,     1, 256, 0, 0, op_kmalloc, 0 },
+    { "kmalloc 256",    256,    1, 256, 0, 0, op_kmalloc, 0 },
+    { "kmalloc 4k",     4096,   1, 256, 0, 0, op_kmalloc, 0 },
+    { "kmalloc 64k",    65536,  1, 256, 0, 0, op_kmalloc, 0 },
+    { "sha256 4k",      BENCH_SHA_BYTES, 1, 128, BENCH_SHA_BYTES, 0, op_sha256, 0 },
+    { "flightrec_log",  0,     32,  64, 0, 0, op_flightrec, 0 },
+    { "infer",          0,      1, 256, 0, 0, op_infer, 0 },
+    { "wasm_cold",      0,      1,  16, 0, 1, op_wasm_cold, 0 },
+    { "wasm_warm",      0,      1, 256, 0, 0, op_wasm_warm, 0 },
+    { "fiber_switch",   0,     64, 128, 0, 0, 0, timed_fiber_switch },
+#ifndef __x86_64__
+    { "spawn",          0,      1,  16, 0, 0, op_spawn, 0 },
+#endif
+};
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+static ipc_bench_rec_t results[BENCH_COUNT];
+
+/* --- Harness ------------------------------------------------------------ */
+
+/* Helper: one sample of b, cycles less the timing overhead
+ * Returns: 0 if unavailable, else the cycles + 1 (so 0 cycles counts)
+ */
+static uint64_t sample_one(const bench_t *b) {
+    int was = interrupts_enabled();
+    if (!b->irqs)
+        interrupts_disable();
+
+    uint64_t cycles;
+    if (b->timed) {
+        cycles = b->timed(b->arg, b->batch);
+        if (!cycles)
+            goto out;
+    } else {
+        cycles_t t0 = tsc_begin();
+        for (uint32_t i = 0; i < b->batch; i++) {
+            if (b->op(b->arg) != 0) {
+                cycles = 0;
+                goto out;
+            }
+        }
+        cycles = tsc_end() - t0;
+        cycles = cycles > overhead ? cycles - overhead : 0;
+    }
+    cycles++;
+
+out:
+    if (!b->irqs && was)
+        interrupts_enable();
+    return cycles;
+}
+
+static void calibrate(void) {
+    if (has_rdtscp < 0)
+        detect_rdtscp();
+    uint32_t best = ~0u;
+    for (int i = 0; i < 64; i++) {
+        cycles_t t0 = tsc_begin();
+        cycles_t t1 = tsc_end();
+        if (t1 - t0 < best)
+            best = (uint32_t)(t1 - t0);
+    }
+    overhead = best;
+}
+
+static void sort_u32(uint32_t *v, uint32_t n) {
+    for (uint32_t i = 1; i < n; i++) {
+        uint32_t x = v[i], j = i;
+        for (; j > 0 && v[j - 1] > x; j--)
+            v[j] = v[j - 1];
+        v[j] = x;
+    }
+}
+
+/* Helper: nearest-rank percentile of a sorted v[n] */
+static uint32_t pct(const uint32_t *v, uint32_t n, uint32_t permille) {
+    uint32_t rank = (uint32_t)(((uint64_t)n * permille + 999) / 1000);
+    return v[rank ? rank - 1 : 0];
+}
+
+/* Helper: run b into rec. Returns: 0, or -1 if it is unavailable */
+static int run_one(const bench_t *b, ipc_bench_rec_t *rec) {
+    uint32_t n = b->samples > BENCH_SAMPLES_MAX ? BENCH_SAMPLES_MAX : b->samples;
+    uint32_t warmup = n / 8 > 2 ? n / 8 : 2;
+
+    for (uint32_t i = 0; i < warmup; i++)
+        if (!sample_one(b))
+            return -1;
+
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t c = sample_one(b);
+        if (!c)
+            return -1;
+        c--;
+        samples[i] = c > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)c;
+        sum += samples[i];
+    }
+    sort_u32(samples, n);
+
+    memset(rec, 0, sizeof(*rec));
+    for (uint32_t j = 0; b->name[j] && j < IPC_BENCH_NAME_LEN - 1; j++)
+        rec->name[j] = b->name[j];
+    rec->batch = b->batch;
+    rec->samples = n;
+    rec->bytes = b->bytes;
+    rec->min = samples[0];
+    rec->p50 = pct(samples, n, 500);
+    rec->p99 = pct(samples, n, 990);
+    rec->max = samples[n - 1];
+    rec->mean = (sum << 8) / n;
+    return 0;
+}
+
+/* Helper: print a cycles-per-sample figure as cycles per operation */
+static void print_per_op(uint32_t cycles, uint32_t batch) {
+    console_write("  ");
+    print_uint((cycles + batch / 2) / batch);
+}
+
+static void print_result(const ipc_bench_rec_t *rec) {
+    console_write("  ");
+    uint32_t len = 0;
+    for (; rec->name[len] && len < 16; len++)
+        console_putc(rec->name[len]);
+    for (; len < 16; len++)
+        console_putc(' ');
+    print_per_op(rec->min, rec->batch);
+    print_per_op(rec->p50, rec->batch);
+    print_per_op(rec->p99, rec->batch);
+    print_per_op(rec->max, rec->batch);
+
+    uint32_t khz = time_get_tsc_khz();
+    if (khz) {
+        /* Median in ns, and MB/s for throughput tests */
+        uint64_t ns = (uint64_t)rec->p50 * 1000000 / khz / rec->batch;
+        console_write("  ");
+        print_uint((uint32_t)ns);
+        console_write(" ns");
+        if (rec->bytes && rec->p50) {
+            uint64_t kbps = (uint64_t)rec->bytes * rec->batch * khz / rec->p50;
+            console_write("  ");
+            print_uint((uint32_t)(kbps / 1000));
+            console_write(" MB/s");
+        }
+    }
+    console_write("\n");
+}
+
+/* The bridge frees the blob whatever it answers */
+static void bench_send_done(const ipc_response_t *rsp, void *arg) {
+    (void)arg;
+    if (rsp->status != RSP_OK)
+        KLOG1(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "bench results refused (%u)", rsp->status);
+}
+
+/* Helper: the first count results as a CMD_BENCH_RESULTS blob */
+static int bench_send(uint32_t count) {
+    uint32_t size = sizeof(ipc_bench_hdr_t) + count * sizeof(ipc_bench_rec_t);
+    uint16_t blob_id = heap_alloc(size, BLOB_TYPE_RAW);
+    uint8_t *data = blob_id ? (uint8_t *)heap_get_data(blob_id) : NULL;
+    if (!data)
+        return -1;
+
+    ipc_bench_hdr_t *hdr = (ipc_bench_hdr_t *)data;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = IPC_BENCH_MAGIC;
+    hdr->version = IPC_BENCH_VERSION;
+    hdr->count = count;
+    hdr->tsc_khz = time_get_tsc_khz();
+    hdr->overhead = overhead;
+    hdr->flags = has_rdtscp ? IPC_BENCH_RDTSCP : 0;
+    hdr->usec = time_usec();
+    memcpy(hdr + 1, results, count * sizeof(ipc_bench_rec_t));
+
+    if (ipc_submit_cb(CMD_BENCH_RESULTS, blob_id, 0, bench_send_done, NULL) == IPC_TAG_NONE) {
+        heap_free(blob_id);
+        return -1;
+    }
+    return 0;
+}
+
+/* Helper: name starts with prefix */
+static int matches(const char *name, const char *prefix) {
+    while (*prefix && *prefix == *name) {
+        prefix++;
+        name++;
+    }
+    return *prefix == '\0';
+}
+
+uint32_t bench_run(const char *prefix) {
+    if (!prefix || matches(prefix, "all"))
+        prefix = "";
+    calibrate();
+
+    console_write("[bench] cycles/op: min  p50  p99  max, p50 time (");
+    print_uint(overhead);
+    console_write(has_rdtscp ? " cycles timing overhead, rdtscp)\n"
+                             : " cycles timing overhead, rdtsc)\n");
+
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < BENCH_COUNT; i++) {
+        const bench_t *b = &benches[i];
+        if (!matches(b->name, prefix))
+            continue;
+        if (run_one(b, &results[run]) != 0) {
+            console_write("  ");
+            console_write(b->name);
+            console_write(": unavailable\n");
+            continue;
+        }
+        print_result(&results[run]);
+        run++;
+    }
+
+    if (!run)
+        console_write("[bench] nothing run (bench list)\n");
+    else if (bench_send(run) == 0)
+        console_write("[bench] results sent to the bridge\n");
+    return run;
+}
+
+void bench_list(void) {
+    console_write("[bench] tests (bench <prefix> runs all that match):\n");
+    for (uint32_t i = 0; i < BENCH_COUNT; i++) {
+        console_write("  ");
+        console_write(benches[i].name);
+        console_write("\n");
+    }
+}
@@ -0,0 +1,37 @@
+/* kernel/trace/bench.h - In-kernel microbenchmarks (shell `bench`)
+ *
+ * Each benchmark times samples of `batch` operations between serialized
+ * TSC reads (lfence; rdtsc ... rdtscp; lfence), after a warmup, with the
+ * cost of an empty sample taken off. It reports cycles per operation at
+ * the minimum, median, p99 and maximum. Everything but the IPC round trip
+ * and the cold WASM start runs with interrupts off.
+ *
+ * After a run the results go to the bridge as a CMD_BENCH_RESULTS blob
+ * (ipc_bench_hdr_t), which it archives.
+ */
+#ifndef _TRACE_BENCH_H
+#define _TRACE_BENCH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Samples kept per benchmark, at most */
+#define BENCH_SAMPLES_MAX 256
+
+/* Run every benchmark whose name starts with prefix ("" or "all" = all),
+ * print its results and send them to the bridge
+ * Returns: benchmarks run (unavailable ones, e.g. no shared heap, skipped)
+ */
+uint32_t bench_run(const char *prefix);
+
+/* Print the benchmark names */
+void bench_list(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_BENCH_H */
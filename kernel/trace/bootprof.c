@@ -0,0 +1,103 @@
+/* kernel/trace/bootprof.c - Boot phase timestamps */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "bootprof.h"
+#include "klog.h"
+#include "../console.h"
+#include "../ipc/completion.h"
+#include "../ipc/heap.h"
+#include "../time/time.h"
+
+typedef struct {
+    const char *phase;
+    cycles_t tsc;
+} bootprof_mark_t;
+
+static bootprof_mark_t marks[BOOTPROF_MAX];
+static uint32_t mark_count;
+static int sent;
+
+void bootprof_mark(const char *phase) {
+    if (mark_count < BOOTPROF_MAX) {
+        marks[mark_count].phase = phase;
+        marks[mark_count].tsc = rdtsc();
+        mark_count++;
+    }
+}
+
+/* Helper: microseconds from the first mark to mark i */
+static uint64_t mark_usec(uint32_t i) {
+    return cycles_to_usec(marks[i].tsc - marks[0].tsc);
+}
+
+uint32_t bootprof_total_usec(void) {
+    if (!mark_count || !time_get_tsc_khz())
+        return 0;
+    return (uint32_t)mark_usec(mark_count - 1);
+}
+
+void bootprof_dump(void) {
+    console_write("[boot] phase            at us    took us\n");
+    if (!time_get_tsc_khz())
+        return;
+    for (uint32_t i = 0; i < mark_count; i++) {
+        uint64_t at = mark_usec(i);
+        uint64_t took = i ? at - mark_usec(i - 1) : 0;
+        const char *p = marks[i].phase;
+        uint32_t len = 0;
+        console_write("  ");
+        for (; p[len] && len < 16; len++)
+            console_putc(p[len]);
+        for (; len < 16; len++)
+            console_putc(' ');
+        print_uint((uint32_t)at);
+        console_write("  ");
+        print_uint((uint32_t)took);
+        console_write("\n");
+    }
+}
+
+/* The bridge frees the blob whatever it answers */
+static void bootprof_send_done(const ipc_response_t *rsp, void *arg) {
+    (void)arg;
+    if (rsp->status != RSP_OK)
+        KLOG1(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "boot profile refused (%u)", rsp->status);
+}
+
+int bootprof_send(void) {
+    if (sent || !mark_count)
+        return 0;
+
+    uint32_t size = sizeof(ipc_boot_prof_hdr_t) + mark_count * sizeof(ipc_boot_prof_rec_t);
+    uint16_t blob_id = heap_alloc(size, BLOB_TYPE_RAW);
+    uint8_t *data = blob_id ? (uint8_t *)heap_get_data(blob_id) : NULL;
+    if (!data)
+        return -1;
+
+    ipc_boot_prof_hdr_t *hdr = (ipc_boot_prof_hdr_t *)data;
+    memset(data, 0, size);
+    hdr->magic = IPC_BOOT_PROF_MAGIC;
+    hdr->version = IPC_BOOT_PROF_VERSION;
+#ifdef ZENEDGE_FAST_BOOT
+    hdr->flags = IPC_BOOT_PROF_FAST;
+#endif
+    hdr->count = mark_count;
+    hdr->tsc_khz = time_get_tsc_khz();
+
+    ipc_boot_prof_rec_t *rec = (ipc_boot_prof_rec_t *)(hdr + 1);
+    for (uint32_t i = 0; i < mark_count; i++, rec++) {
+        rec->usec = mark_usec(i);
+        for (uint32_t j = 0; marks[i].phase[j] && j < IPC_BOOT_PROF_NAME_LEN - 1; j++)
+            rec->name[j] = marks[i].phase[j];
+    }
+
+    if (ipc_submit_cb(CMD_BOOT_PROFILE, blob_id, 0, bootprof_send_done, NULL) == IPC_TAG_NONE) {
+        heap_free(blob_id);
+        return -1;
+    }
+    sent = 1;
+    return 0;
+}
@@ -0,0 +1,38 @@
+/* kernel/trace/bootprof.h - Boot phase timestamps
+ *
+ * kmain64 marks each init step as it finishes, from its first
+ * instruction onward. Marks are raw TSC reads, so they work before
+ * time_init() and cost nothing to take; they are converted once the TSC
+ * is calibrated, for the shell's dump and the CMD_BOOT_PROFILE blob the
+ * bridge keeps for each guest launch.
+ */
+#ifndef _TRACE_BOOTPROF_H
+#define _TRACE_BOOTPROF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Phases recorded; later marks are dropped */
+#define BOOTPROF_MAX 32
+
+/* phase just completed (a string literal: only the pointer is kept) */
+void bootprof_mark(const char *phase);
+
+/* Microseconds from the first mark to the last (0 before time_init) */
+uint32_t bootprof_total_usec(void);
+
+void bootprof_dump(void);
+
+/* Send the profile to the bridge as a CMD_BOOT_PROFILE blob, once
+ * Returns: 0, or -1 if there is no space or the command ring is full
+ */
+int bootprof_send(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_BOOTPROF_H */
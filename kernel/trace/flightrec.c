@@ -3,28 +3,158 @@
  * Flight Recorder implementation with real timestamps and duration tracking.
  */
 #include "flightrec.h"
+#include "../arch/idt.h"
+#include "../arch/percpu.h"
+#include "../arch/pmu.h"
 #include "../console.h"
 #include "../time/time.h"
 #include "../include/string.h"
 #include "../lib/sha256.h"
+#include "../mm/kheap.h"
 
-/* Ring buffer */
-static trace_event_t buf[TRACE_BUF_SIZE];
-static uint32_t head = 0;
+/* One ring per CPU, written only by its CPU (and that CPU's IRQs) */
+typedef struct {
+    trace_event_t ev[TRACE_RING_SIZE];
+    uint32_t head;              /* Events ever logged here */
+
+    /* Seal chain: events [0, sealed) folded TRACE_SEAL_BLOCK at a time */
+    uint8_t  chain[32];
+    uint32_t sealed;
+    volatile uint32_t chain_seq; /* Odd while chain/sealed change */
+    uint8_t  folding;           /* Set while this CPU folds (IRQs see it) */
+} __attribute__((aligned(64))) trace_ring_t;
+
+static trace_ring_t rings[TRACE_CPUS];
 static uint8_t  initialized = 0;
 
-/* Span tracking for duration measurement (simple array for now) */
-#define MAX_ACTIVE_SPANS 16
+uint32_t flightrec_cats = TRACE_CATS_BUILT;
+
+/* Signatures of attested events */
+static trace_sig_t sigs[TRACE_SIG_SLOTS];
+static uint32_t sig_next = 0;
+
+/* Reader over every ring, merged by TSC: next takes the oldest event
+ * left, prev the newest. Ties go to the lower CPU id going forward
+ */
+typedef struct {
+    uint32_t pos[TRACE_CPUS];
+    uint32_t end[TRACE_CPUS];
+} trace_merge_t;
+
+static void merge_begin(trace_merge_t *m) {
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        uint32_t h = __atomic_load_n(&rings[c].head, __ATOMIC_ACQUIRE);
+        m->end[c] = h;
+        m->pos[c] = (h > TRACE_RING_SIZE) ? (h - TRACE_RING_SIZE) : 0;
+    }
+}
+
+static uint32_t merge_count(const trace_merge_t *m) {
+    uint32_t n = 0;
+    for (uint32_t c = 0; c < TRACE_CPUS; c++)
+        n += m->end[c] - m->pos[c];
+    return n;
+}
+
+static trace_event_t* merge_next(trace_merge_t *m, uint32_t *out_cpu, uint32_t *out_seq) {
+    trace_event_t *best = NULL;
+    uint32_t best_cpu = 0;
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        if (m->pos[c] == m->end[c])
+            continue;
+        trace_event_t *e = &rings[c].ev[m->pos[c] & TRACE_RING_MASK];
+        if (!best || e->ts_cycles < best->ts_cycles) {
+            best = e;
+            best_cpu = c;
+        }
+    }
+    if (best) {
+        if (out_cpu) *out_cpu = best_cpu;
+        if (out_seq) *out_seq = m->pos[best_cpu];
+        m->pos[best_cpu]++;
+    }
+    return best;
+}
+
+static trace_event_t* merge_prev(trace_merge_t *m) {
+    trace_event_t *best = NULL;
+    uint32_t best_cpu = 0;
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        if (m->pos[c] == m->end[c])
+            continue;
+        trace_event_t *e = &rings[c].ev[(m->end[c] - 1) & TRACE_RING_MASK];
+        if (!best || e->ts_cycles >= best->ts_cycles) {
+            best = e;
+            best_cpu = c;
+        }
+    }
+    if (best)
+        m->end[best_cpu]--;
+    return best;
+}
+
+/* Span tracking for duration measurement: a table per CPU, TRACE_SPAN_CHUNK
+ * slots at a time, with a free list. A handle is generation << 16 |
+ * cpu << 10 | slot, so an ended span's handle never matches the slot's
+ * next span. Spans ended on another CPU go back through that CPU's
+ * remote list, which it takes whole when its own runs dry
+ */
+#define SPAN_SLOT_BITS 10
+#define SPAN_CPU_BITS  6
+#define SPAN_NIL       0xFFFFu
+
+_Static_assert(TRACE_SPAN_CHUNK * TRACE_SPAN_CHUNKS <= (1u << SPAN_SLOT_BITS),
+               "span slots must fit the handle");
+_Static_assert(TRACE_CPUS <= (1u << SPAN_CPU_BITS), "CPUs must fit the handle");
+_Static_assert(TRACE_EVT_PMU_INSTR + PMU_DTLB_MISS == TRACE_EVT_PMU_DTLB_MISS,
+               "TRACE_EVT_PMU_* must follow pmu_event_t");
+
 typedef struct {
-    uint8_t  active;
+    uint64_t start_cycles;
     uint32_t job_id;
     uint32_t step_id;
-    uint64_t start_cycles;
+    trace_span_t parent;
+    uint16_t gen;
+    uint16_t next;              /* Free list link */
     uint8_t  start_type;
+    uint8_t  open;
+    uint8_t  pmu;               /* Counters read at begin (pmu_events()) */
+    pmu_snap_t counters;
 } active_span_t;
 
-static active_span_t spans[MAX_ACTIVE_SPANS];
-static uint32_t next_span_handle = 1;
+typedef struct {
+    active_span_t *chunk[TRACE_SPAN_CHUNKS];
+    uint32_t chunks;
+    uint16_t free;              /* This CPU only, IRQs off */
+    uint32_t remote;            /* Ended elsewhere: CAS push, taken whole */
+    uint32_t open;
+    uint32_t exhausted;         /* Begins that found no slot */
+} span_cpu_t;
+
+static active_span_t span_boot[TRACE_CPUS][TRACE_SPAN_CHUNK];
+static span_cpu_t span_cpus[TRACE_CPUS];
+
+/* Running per-job and per-step totals, kept as events are logged so they
+ * outlive the rings. Set-associative: a full set gives up the entry idle
+ * longest. job_id 0 (system events) is never tracked and marks a free
+ * entry
+ */
+#define STATS_WAYS 4
+
+typedef struct {
+    trace_job_stats_t s;
+    uint64_t first_usec;
+    uint64_t last_usec;
+} job_entry_t;
+
+typedef struct {
+    trace_step_stats_t s;
+    uint64_t last_usec;
+} step_entry_t;
+
+static job_entry_t job_table[TRACE_JOB_STATS];
+static step_entry_t step_table[TRACE_STEP_STATS];
+static volatile uint8_t stats_lock;     /* CPUs share the tables */
 
 /* Integer to string helper */
 static void print_uint64(uint64_t v) {
@@ -53,46 +183,292 @@ static void print_hex8(uint8_t v) {
 }
 
 void flightrec_init(void) {
-    head = 0;
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        rings[c].head = 0;
+        memset(rings[c].chain, 0, sizeof(rings[c].chain));
+        rings[c].sealed = 0;
+        rings[c].chain_seq = 0;
+        rings[c].folding = 0;
+    }
+    sig_next = 0;
+    memset(sigs, 0, sizeof(sigs));
     initialized = 1;
 
-    /* Clear span tracking */
-    for (int i = 0; i < MAX_ACTIVE_SPANS; i++) {
-        spans[i].active = 0;
+    /* Clear span tracking: what grew stays, every slot goes free */
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        span_cpu_t *p = &span_cpus[c];
+        if (!p->chunks) {
+            p->chunk[0] = span_boot[c];
+            p->chunks = 1;
+        }
+        for (uint32_t i = 0; i < p->chunks * TRACE_SPAN_CHUNK; i++) {
+            active_span_t *sp = &p->chunk[i / TRACE_SPAN_CHUNK][i % TRACE_SPAN_CHUNK];
+            sp->open = 0;
+            sp->next = (i + 1 < p->chunks * TRACE_SPAN_CHUNK) ? (uint16_t)(i + 1) : SPAN_NIL;
+        }
+        p->free = 0;
+        p->remote = SPAN_NIL;
+        p->open = 0;
+        p->exhausted = 0;
     }
-    next_span_handle = 1;
+    memset(job_table, 0, sizeof(job_table));
+    memset(step_table, 0, sizeof(step_table));
+    stats_lock = 0;
 
     console_write("[trace] flight recorder initialized (");
-    print_uint32(TRACE_BUF_SIZE);
-    console_write(" event ring buffer)\n");
+    print_uint32(TRACE_RING_SIZE);
+    console_write(" event ring per CPU)\n");
 
     /* Log boot event */
     flightrec_log(TRACE_EVT_BOOT, 0, 0, 0);
 }
 
-void flightrec_log(trace_event_type_t type, uint32_t job_id,
-                   uint32_t step_id, uint32_t extra) {
-    if (!initialized) return;
+/* Helper: chain = SHA-256(chain || the TRACE_SEAL_BLOCK events from seq).
+ * Blocks start at multiples of TRACE_SEAL_BLOCK, so they never wrap
+ */
+static void chain_block(const trace_ring_t *r, uint8_t chain[32], uint32_t seq) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, chain, 32);
+    sha256_update(&ctx, (const uint8_t *)&r->ev[seq & TRACE_RING_MASK],
+                  TRACE_SEAL_BLOCK * sizeof(trace_event_t));
+    sha256_final(&ctx, chain);
+}
+
+/* Helper: chain_block() each CPU's chain up to its last whole block, the
+ * CPUs' blocks side by side (independent, equal-length messages)
+ */
+static void chain_catch_up(uint8_t chain[][32], uint32_t sealed[], const uint32_t head[]) {
+    sha256_ctx_t ctx[8];
+    sha256_ctx_t *pctx[8];
+    const uint8_t *blk[8];
+    uint32_t cpu[8];
+
+    for (;;) {
+        uint32_t n = 0;
+        for (uint32_t c = 0; c < TRACE_CPUS && n < 8; c++) {
+            if (head[c] - sealed[c] < TRACE_SEAL_BLOCK)
+                continue;
+            sha256_init(&ctx[n]);
+            sha256_update(&ctx[n], chain[c], 32);
+            pctx[n] = &ctx[n];
+            blk[n] = (const uint8_t *)&rings[c].ev[sealed[c] & TRACE_RING_MASK];
+            cpu[n++] = c;
+        }
+        if (!n)
+            return;
+
+        sha256_update_many(pctx, blk, TRACE_SEAL_BLOCK * sizeof(trace_event_t), n);
+        for (uint32_t i = 0; i < n; i++) {
+            sha256_final(&ctx[i], chain[cpu[i]]);
+            sealed[cpu[i]] += TRACE_SEAL_BLOCK;
+        }
+    }
+}
+
+/* Helper: fold this CPU's completed blocks into its chain. An IRQ that
+ * lands mid-fold leaves its block to the fold it interrupted, or to the
+ * next event logged
+ */
+static void seal_fold(trace_ring_t *r) {
+    if (r->folding)
+        return;
+    r->folding = 1;
+    while (r->head - r->sealed >= TRACE_SEAL_BLOCK) {
+        uint8_t next[32];
+        memcpy(next, r->chain, 32);
+        chain_block(r, next, r->sealed);
+
+        r->chain_seq++;
+        __asm__ __volatile__("" ::: "memory");
+        memcpy(r->chain, next, 32);
+        r->sealed += TRACE_SEAL_BLOCK;
+        __asm__ __volatile__("" ::: "memory");
+        r->chain_seq++;
+    }
+    r->folding = 0;
+}
+
+/* Helper: first entry of the set (job_id, step_id) hashes to */
+static uint32_t stats_set(uint32_t job_id, uint32_t step_id, uint32_t entries) {
+    uint32_t h = (job_id * 0x9E3779B1u) ^ (step_id * 0x85EBCA6Bu);
+    return ((h >> 16) & (entries / STATS_WAYS - 1)) * STATS_WAYS;
+}
+
+/* Helper: job_id's entry, or NULL. With now, claims one if it has none */
+static job_entry_t* job_entry(uint32_t job_id, uint64_t now, int claim) {
+    job_entry_t *set = &job_table[stats_set(job_id, 0, TRACE_JOB_STATS)];
+    job_entry_t *victim = &set[0];
+    for (uint32_t i = 0; i < STATS_WAYS; i++) {
+        if (set[i].s.job_id == job_id)
+            return &set[i];
+        if (set[i].last_usec < victim->last_usec)
+            victim = &set[i];
+    }
+    if (!claim)
+        return NULL;
+    memset(victim, 0, sizeof(*victim));
+    victim->s.job_id = job_id;
+    victim->first_usec = now;
+    return victim;
+}
+
+static step_entry_t* step_entry(uint32_t job_id, uint32_t step_id, int claim) {
+    step_entry_t *set = &step_table[stats_set(job_id, step_id, TRACE_STEP_STATS)];
+    step_entry_t *victim = &set[0];
+    for (uint32_t i = 0; i < STATS_WAYS; i++) {
+        if (set[i].s.job_id == job_id && set[i].s.step_id == step_id)
+            return &set[i];
+        if (set[i].last_usec < victim->last_usec)
+            victim = &set[i];
+    }
+    if (!claim)
+        return NULL;
+    memset(victim, 0, sizeof(*victim));
+    victim->s.job_id = job_id;
+    victim->s.step_id = step_id;
+    return victim;
+}
+
+static void stats_lock_acquire(void) {
+    while (__atomic_test_and_set(&stats_lock, __ATOMIC_ACQUIRE))
+        __asm__ __volatile__("pause");
+}
+
+static void stats_lock_release(void) {
+    __atomic_clear(&stats_lock, __ATOMIC_RELEASE);
+}
+
+/* Helper: fold one event into the totals - IRQs off */
+static void stats_account(const trace_event_t *e) {
+    if (!e->job_id || e->type >= TRACE_EVT_BOOT)
+        return;
+
+    stats_lock_acquire();
+    job_entry_t *j = job_entry(e->job_id, e->ts_usec, 1);
+    j->last_usec = e->ts_usec;
+
+    switch (e->type) {
+        case TRACE_EVT_STEP_END: {
+            /* Duration stored in extra */
+            step_entry_t *st = step_entry(e->job_id, e->step_id, 1);
+            st->last_usec = e->ts_usec;
+            if (!st->s.count || e->extra < st->s.min_usec) st->s.min_usec = e->extra;
+            if (e->extra > st->s.max_usec) st->s.max_usec = e->extra;
+            st->s.last_usec = e->extra;
+            st->s.total_usec += e->extra;
+            st->s.count++;
+
+            if (!j->s.steps_completed || e->extra < j->s.min_step_usec)
+                j->s.min_step_usec = e->extra;
+            if (e->extra > j->s.max_step_usec) j->s.max_step_usec = e->extra;
+            j->s.last_step_usec = e->extra;
+            j->s.total_cpu_usec += e->extra;
+            j->s.steps_completed++;
+            break;
+        }
+
+        case TRACE_EVT_CONTRACT_VIOLATION:
+        case TRACE_EVT_CONTRACT_BUDGET_EXCEED:
+            j->s.violations++;
+            if (e->step_id) {
+                step_entry_t *st = step_entry(e->job_id, e->step_id, 1);
+                st->last_usec = e->ts_usec;
+                st->s.violations++;
+            }
+            break;
 
-    trace_event_t *e = &buf[head & TRACE_BUF_MASK];
+        default:
+            break;
+    }
+    stats_lock_release();
+}
+
+/* Helper: write the next event of this CPU's ring. Only its own IRQs
+ * can race for the slot, so they are held off while it is filled; head
+ * moves only once the event is whole, and readers never see a torn one
+ */
+static uint32_t log_event(trace_event_type_t type, uint32_t job_id,
+                          uint32_t step_id, uint32_t extra, uint8_t sig) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+
+    uint32_t cpu = smp_cpu_id();
+    trace_ring_t *r = &rings[cpu < TRACE_CPUS ? cpu : 0];
+    uint32_t seq = r->head;
+    trace_event_t *e = &r->ev[seq & TRACE_RING_MASK];
 
     e->ts_cycles = time_cycles();
     e->ts_usec   = time_usec();
     e->type      = (uint8_t)type;
-    e->flags     = 0;
-    e->cpu_id    = 0;  /* Single CPU for now */
+    e->sig       = sig;
+    e->cpu_id    = (uint16_t)cpu;
     e->job_id    = job_id;
     e->step_id   = step_id;
     e->extra     = extra;
-    seal_episode((episode_t *)e);
+    __atomic_store_n(&r->head, seq + 1, __ATOMIC_RELEASE);
+    stats_account(e);
+
+#if defined(__x86_64__)
+    if (percpu_ready)
+        this_cpu()->trace_events++;
+#endif
+    if (was)
+        interrupts_enable();
+
+    /* Hashing happens with IRQs on, a block at a time */
+    if (((seq + 1) & (TRACE_SEAL_BLOCK - 1)) == 0 || r->head - r->sealed > TRACE_SEAL_BLOCK)
+        seal_fold(r);
+    return seq;
+}
+
+void flightrec_log_event(trace_event_type_t type, uint32_t job_id,
+                         uint32_t step_id, uint32_t extra) {
+    if (!initialized) return;
+    log_event(type, job_id, step_id, extra, 0);
+}
 
-    head++;
+uint32_t flightrec_set_categories(uint32_t mask) {
+    flightrec_cats = (mask | TRACE_CATS_REQUIRED) & TRACE_CATS_BUILT;
+    return flightrec_cats;
 }
 
-void seal_episode(episode_t *ep) {
-    if (!ep)
-        return;
-    memset(ep->tpm_signature, 0, sizeof(ep->tpm_signature));
+void flightrec_log_attested(trace_event_type_t type, uint32_t job_id,
+                            uint32_t step_id, uint32_t extra,
+                            const uint8_t *sig, uint32_t len) {
+    if (!initialized) return;
+    if (!sig || len > TRACE_SIG_SIZE) len = 0;
+
+    /* Fill the slot before the event names it; seq is set after */
+    uint32_t s = __atomic_fetch_add(&sig_next, 1, __ATOMIC_RELAXED) % TRACE_SIG_SLOTS;
+    trace_sig_t *ts = &sigs[s];
+
+    ts->seq = 0xFFFFFFFFu;
+    memcpy(ts->data, sig, len);
+    memset(ts->data + len, 0, TRACE_SIG_SIZE - len);
+    ts->cpu_id = (uint16_t)smp_cpu_id();
+    ts->seq = log_event(type, job_id, step_id, extra, (uint8_t)(s + 1));
+}
+
+const trace_sig_t* flightrec_get_signature(uint32_t cpu, uint32_t seq) {
+    if (cpu >= TRACE_CPUS)
+        return NULL;
+    const trace_ring_t *r = &rings[cpu];
+    if (r->head - seq - 1 >= TRACE_RING_SIZE)
+        return NULL;     /* Not logged yet, or overwritten */
+
+    const trace_event_t *e = &r->ev[seq & TRACE_RING_MASK];
+    if (!e->sig)
+        return NULL;
+    const trace_sig_t *ts = &sigs[e->sig - 1];
+    return (ts->seq == seq && ts->cpu_id == cpu) ? ts : NULL;
+}
+
+uint32_t flightrec_dropped(uint32_t cpu) {
+    if (cpu >= TRACE_CPUS)
+        return 0;
+    uint32_t h = rings[cpu].head;
+    return (h > TRACE_RING_SIZE) ? (h - TRACE_RING_SIZE) : 0;
 }
 
 void flightrec_seal_hash(uint8_t out[32]) {
@@ -100,135 +476,274 @@ void flightrec_seal_hash(uint8_t out[32]) {
         return;
     }
 
-    /* Hash ring metadata and entries in chronological order. */
+    /* Each CPU's chain as of a consistent (chain, sealed, head), with its
+     * remaining whole blocks folded in here and the partial block raw:
+     * a few hundred bytes per CPU however long the rings are
+     */
+    uint8_t chains[TRACE_CPUS][32];
+    uint32_t sealed[TRACE_CPUS], heads[TRACE_CPUS];
+    uint32_t cpus = 0;
     sha256_ctx_t ctx;
     sha256_init(&ctx);
 
-    /* Include head to capture wrap position. */
-    sha256_update(&ctx, (const uint8_t *)&head, sizeof(head));
-
-    uint32_t count = (head > TRACE_BUF_SIZE) ? TRACE_BUF_SIZE : head;
-    uint32_t start = (head > TRACE_BUF_SIZE) ? (head - TRACE_BUF_SIZE) : 0;
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        const trace_ring_t *r = &rings[c];
+        uint32_t seq;
+        do {
+            seq = r->chain_seq;
+            __asm__ __volatile__("" ::: "memory");
+            memcpy(chains[c], r->chain, 32);
+            sealed[c] = r->sealed;
+            heads[c] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            __asm__ __volatile__("" ::: "memory");
+        } while ((seq & 1) || seq != r->chain_seq);
+    }
 
-    for (uint32_t i = 0; i < count; i++) {
-        trace_event_t *e = &buf[(start + i) & TRACE_BUF_MASK];
-        sha256_update(&ctx, (const uint8_t *)e, sizeof(*e));
+    chain_catch_up(chains, sealed, heads);
+
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        const trace_ring_t *r = &rings[c];
+        uint32_t head = heads[c];
+        if (!head)
+            continue;
+        cpus++;
+        sha256_update(&ctx, (const uint8_t *)&c, sizeof(c));
+        sha256_update(&ctx, (const uint8_t *)&head, sizeof(head));
+        sha256_update(&ctx, chains[c], 32);
+        for (uint32_t seq = sealed[c]; seq != head; seq++)
+            sha256_update(&ctx, (const uint8_t *)&r->ev[seq & TRACE_RING_MASK],
+                          sizeof(trace_event_t));
     }
 
     sha256_final(&ctx, out);
+
+    /* Where the seal cut each ring, so a verifier can replay it */
+    uint32_t tag = (uint32_t)out[0] | ((uint32_t)out[1] << 8) |
+                   ((uint32_t)out[2] << 16) | ((uint32_t)out[3] << 24);
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        if (heads[c])
+            flightrec_log(TRACE_EVT_SEAL, (cpus << 16) | c, heads[c], tag);
+    }
 }
 
-trace_span_t flightrec_begin_span(trace_event_type_t start_type,
-                                   uint32_t job_id, uint32_t step_id) {
-    if (!initialized) return 0;
+static active_span_t* span_slot(const span_cpu_t *p, uint32_t i) {
+    return &p->chunk[i / TRACE_SPAN_CHUNK][i % TRACE_SPAN_CHUNK];
+}
 
-    /* Find free slot */
-    int slot = -1;
-    for (int i = 0; i < MAX_ACTIVE_SPANS; i++) {
-        if (!spans[i].active) {
-            slot = i;
-            break;
-        }
+/* Helper: the open span a handle names, or NULL if it has ended */
+static active_span_t* span_lookup(trace_span_t span, span_cpu_t **owner, uint32_t *slot) {
+    uint32_t cpu = (span >> SPAN_SLOT_BITS) & ((1u << SPAN_CPU_BITS) - 1);
+    uint32_t i = span & ((1u << SPAN_SLOT_BITS) - 1);
+    if (!span || cpu >= TRACE_CPUS)
+        return NULL;
+    span_cpu_t *p = &span_cpus[cpu];
+    if (i >= __atomic_load_n(&p->chunks, __ATOMIC_ACQUIRE) * TRACE_SPAN_CHUNK)
+        return NULL;
+    active_span_t *sp = span_slot(p, i);
+    if (!sp->open || sp->gen != (span >> 16))
+        return NULL;
+    *owner = p;
+    *slot = i;
+    return sp;
+}
+
+/* Helper: a free slot of this CPU - IRQs off. Takes back what other CPUs
+ * ended, then grows the table when the caller can allocate (interrupts
+ * were on, so this is not an IRQ handler interrupting kmalloc)
+ */
+static uint32_t span_refill(span_cpu_t *p, int can_alloc) {
+    uint32_t i = __atomic_exchange_n(&p->remote, SPAN_NIL, __ATOMIC_ACQUIRE);
+    if (i != SPAN_NIL)
+        return i;
+    if (!can_alloc || p->chunks >= TRACE_SPAN_CHUNKS)
+        return SPAN_NIL;
+
+    active_span_t *chunk = kmalloc(TRACE_SPAN_CHUNK * sizeof(active_span_t));
+    if (!chunk)
+        return SPAN_NIL;
+    uint32_t base = p->chunks * TRACE_SPAN_CHUNK;
+    for (uint32_t k = 0; k < TRACE_SPAN_CHUNK; k++) {
+        chunk[k].open = 0;
+        chunk[k].gen = 0;
+        chunk[k].next = (k + 1 < TRACE_SPAN_CHUNK) ? (uint16_t)(base + k + 1) : SPAN_NIL;
     }
+    p->chunk[p->chunks] = chunk;
+    __atomic_store_n(&p->chunks, p->chunks + 1, __ATOMIC_RELEASE);
+    return base;
+}
 
-    if (slot < 0) {
-        /* No free slots - log warning and return invalid handle */
-        flightrec_log(TRACE_EVT_CONTRACT_VIOLATION, job_id, step_id, 0xDEAD);
+trace_span_t flightrec_begin_child(trace_span_t parent, trace_event_type_t start_type,
+                                   uint32_t job_id, uint32_t step_id) {
+    if (!initialized) return 0;
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+
+    uint32_t cpu = smp_cpu_id();
+    if (cpu >= TRACE_CPUS)
+        cpu = 0;
+    span_cpu_t *p = &span_cpus[cpu];
+    uint32_t i = p->free;
+    if (i == SPAN_NIL)
+        i = span_refill(p, was);
+    if (i == SPAN_NIL) {
+        p->exhausted++;
+        if (was)
+            interrupts_enable();
+        flightrec_log(start_type, job_id, step_id, parent);
         return 0;
     }
 
-    spans[slot].active = 1;
-    spans[slot].job_id = job_id;
-    spans[slot].step_id = step_id;
-    spans[slot].start_cycles = time_cycles();
-    spans[slot].start_type = (uint8_t)start_type;
-
-    /* Log start event */
-    flightrec_log(start_type, job_id, step_id, 0);
+    active_span_t *sp = span_slot(p, i);
+    p->free = sp->next;
+    __atomic_fetch_add(&p->open, 1, __ATOMIC_RELAXED);
+    if (++sp->gen == 0)
+        sp->gen = 1;
+    sp->job_id = job_id;
+    sp->step_id = step_id;
+    sp->parent = parent;
+    sp->start_type = (uint8_t)start_type;
+    sp->pmu = (uint8_t)pmu_events();
+    if (sp->pmu)
+        pmu_read(&sp->counters);
+    sp->start_cycles = time_cycles();
+    sp->open = 1;
+    trace_span_t span = ((trace_span_t)sp->gen << 16) | (cpu << SPAN_SLOT_BITS) | i;
+
+    if (was)
+        interrupts_enable();
+
+    /* Log start event, with the parent it nests in */
+    flightrec_log(start_type, job_id, step_id, parent);
+    return span;
+}
 
-    /* Return handle (slot + 1 so 0 is invalid) */
-    return (trace_span_t)(slot + 1);
+trace_span_t flightrec_begin_span(trace_event_type_t start_type,
+                                   uint32_t job_id, uint32_t step_id) {
+    return flightrec_begin_child(0, start_type, job_id, step_id);
 }
 
 void flightrec_end_span(trace_span_t span, trace_event_type_t end_type) {
-    if (!initialized || span == 0) return;
+    if (!initialized) return;
+
+    int was = interrupts_enabled();
+    interrupts_disable();
 
-    int slot = (int)span - 1;
-    if (slot < 0 || slot >= MAX_ACTIVE_SPANS || !spans[slot].active) {
+    span_cpu_t *p;
+    uint32_t i;
+    active_span_t *sp = span_lookup(span, &p, &i);
+    if (!sp) {
+        if (was)
+            interrupts_enable();
         return;
     }
 
     /* Calculate duration */
-    uint64_t end_cycles = time_cycles();
-    uint64_t elapsed_cycles = end_cycles - spans[slot].start_cycles;
-    usec_t duration_usec = cycles_to_usec(elapsed_cycles);
+    usec_t duration_usec = cycles_to_usec(time_cycles() - sp->start_cycles);
+    uint32_t job_id = sp->job_id;
+    uint32_t step_id = sp->step_id;
+    sp->open = 0;
+
+    /* Counters are per CPU: a span that moved has no deltas */
+    uint32_t cpu = smp_cpu_id();
+    int local = p == &span_cpus[cpu < TRACE_CPUS ? cpu : 0];
+    uint32_t pmu = local ? sp->pmu : 0;
+    pmu_snap_t counters;
+    if (pmu)
+        pmu_delta(&sp->counters, &counters);
+
+    /* Free slot: to our own list, or the owner's remote one */
+    if (local) {
+        sp->next = p->free;
+        p->free = (uint16_t)i;
+    } else {
+        uint32_t head = __atomic_load_n(&p->remote, __ATOMIC_RELAXED);
+        do {
+            sp->next = (uint16_t)head;
+        } while (!__atomic_compare_exchange_n(&p->remote, &head, i, 1,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    __atomic_fetch_sub(&p->open, 1, __ATOMIC_RELAXED);
+
+    if (was)
+        interrupts_enable();
 
-    /* Log end event with duration */
-    flightrec_log(end_type, spans[slot].job_id, spans[slot].step_id,
-                  (uint32_t)duration_usec);
+    /* Log end event with duration, then what the counters saw */
+    flightrec_log(end_type, job_id, step_id, (uint32_t)duration_usec);
+    for (uint32_t ev = 0; ev < PMU_EVENTS; ev++) {
+        if (pmu & (1u << ev))
+            flightrec_log((trace_event_type_t)(TRACE_EVT_PMU_INSTR + ev), job_id, step_id,
+                          counters.v[ev]);
+    }
+}
 
-    /* Free slot */
-    spans[slot].active = 0;
+trace_span_t flightrec_span_parent(trace_span_t span) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    span_cpu_t *p;
+    uint32_t i;
+    active_span_t *sp = span_lookup(span, &p, &i);
+    trace_span_t parent = sp ? sp->parent : 0;
+    if (was)
+        interrupts_enable();
+    return parent;
 }
 
 usec_t flightrec_last_duration(uint32_t job_id, uint32_t step_id) {
-    /* Scan buffer backwards for matching STEP_END event */
-    uint32_t count = (head > TRACE_BUF_SIZE) ? TRACE_BUF_SIZE : head;
+    trace_step_stats_t st;
+    flightrec_get_step_stats(job_id, step_id, &st);
+    return (usec_t)st.last_usec;
+}
 
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t idx = (head - 1 - i) & TRACE_BUF_MASK;
-        trace_event_t *e = &buf[idx];
+void flightrec_for_each_step_end(uint32_t job_id, flightrec_step_fn fn, void *arg) {
+    trace_merge_t m;
+    merge_begin(&m);
 
-        if (e->type == TRACE_EVT_STEP_END &&
-            e->job_id == job_id &&
-            e->step_id == step_id) {
-            return (usec_t)e->extra;
-        }
+    trace_event_t *e;
+    while ((e = merge_prev(&m)) != NULL) {
+        if (e->type == TRACE_EVT_STEP_END && e->job_id == job_id)
+            fn(e->step_id, (usec_t)e->extra, arg);
     }
-    return 0;
 }
 
 void flightrec_get_job_stats(uint32_t job_id, trace_job_stats_t *out) {
     if (!out) return;
 
+    memset(out, 0, sizeof(*out));
     out->job_id = job_id;
-    out->steps_completed = 0;
-    out->total_cpu_usec = 0;
-    out->total_wall_usec = 0;
-    out->violations = 0;
-
-    uint32_t count = (head > TRACE_BUF_SIZE) ? TRACE_BUF_SIZE : head;
-    uint64_t first_ts = 0, last_ts = 0;
-
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t idx = (head > TRACE_BUF_SIZE) ?
-                       ((head - TRACE_BUF_SIZE + i) & TRACE_BUF_MASK) :
-                       i;
-        trace_event_t *e = &buf[idx];
-
-        if (e->job_id != job_id) continue;
-
-        /* Track wall time span */
-        if (first_ts == 0 || e->ts_usec < first_ts) first_ts = e->ts_usec;
-        if (e->ts_usec > last_ts) last_ts = e->ts_usec;
-
-        switch (e->type) {
-            case TRACE_EVT_STEP_END:
-                out->steps_completed++;
-                out->total_cpu_usec += e->extra;  /* Duration stored in extra */
-                break;
-
-            case TRACE_EVT_CONTRACT_VIOLATION:
-            case TRACE_EVT_CONTRACT_BUDGET_EXCEED:
-                out->violations++;
-                break;
-
-            default:
-                break;
-        }
+    if (!job_id) return;
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+    stats_lock_acquire();
+    const job_entry_t *j = job_entry(job_id, 0, 0);
+    if (j) {
+        *out = j->s;
+        out->total_wall_usec = j->last_usec - j->first_usec;
     }
+    stats_lock_release();
+    if (was)
+        interrupts_enable();
+}
+
+void flightrec_get_step_stats(uint32_t job_id, uint32_t step_id,
+                              trace_step_stats_t *out) {
+    if (!out) return;
 
-    out->total_wall_usec = last_ts - first_ts;
+    memset(out, 0, sizeof(*out));
+    out->job_id = job_id;
+    out->step_id = step_id;
+    if (!job_id) return;
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+    stats_lock_acquire();
+    const step_entry_t *st = step_entry(job_id, step_id, 0);
+    if (st)
+        *out = st->s;
+    stats_lock_release();
+    if (was)
+        interrupts_enable();
 }
 
 static const char* event_type_name(uint8_t type) {
@@ -239,6 +754,14 @@ static const char* event_type_name(uint8_t type) {
         case TRACE_EVT_STEP_START:           return "STEP_START";
         case TRACE_EVT_STEP_END:             return "STEP_END";
         case TRACE_EVT_STEP_PREEMPT:         return "STEP_PREEMPT";
+        case TRACE_EVT_SCHED_STATS:          return "SCHED_STATS";
+        case TRACE_EVT_STEP_MEMO_HIT:        return "MEMO_HIT";
+        case TRACE_EVT_STEP_MEMO_MISS:       return "MEMO_MISS";
+        case TRACE_EVT_GANG_RELEASE:         return "GANG_RELEASE";
+        case TRACE_EVT_GANG_TIMEOUT:         return "GANG_TIMEOUT";
+        case TRACE_EVT_COLL_DONE:            return "COLL_DONE";
+        case TRACE_EVT_MESH_PLACE:           return "MESH_PLACE";
+        case TRACE_EVT_MESH_REGRET:          return "MESH_REGRET";
         case TRACE_EVT_CONTRACT_APPLY:       return "CONTRACT_APPLY";
         case TRACE_EVT_CONTRACT_BUDGET_WARN: return "BUDGET_WARN";
         case TRACE_EVT_CONTRACT_BUDGET_EXCEED: return "BUDGET_EXCEED";
@@ -247,6 +770,10 @@ static const char* event_type_name(uint8_t type) {
         case TRACE_EVT_CONTRACT_SAFE_MODE:   return "SAFE_MODE";
         case TRACE_EVT_BOOT:                 return "BOOT";
         case TRACE_EVT_HALT:                 return "HALT";
+        case TRACE_EVT_TRACE_LOST:           return "TRACE_LOST";
+        case TRACE_EVT_SEAL:                 return "SEAL";
+        case TRACE_EVT_CLOCK_SYNC:           return "CLOCK_SYNC";
+        case TRACE_EVT_BENCH:                return "BENCH";
         case TRACE_EVT_PANIC:                return "PANIC";
         /* Memory events */
         case TRACE_EVT_MEM_ALLOC:            return "MEM_ALLOC";
@@ -255,25 +782,38 @@ static const char* event_type_name(uint8_t type) {
         case TRACE_EVT_MEM_LOCALITY_MISS:    return "LOCALITY_MISS";
         case TRACE_EVT_MEM_CONTRACT_EXCEED:  return "MEM_EXCEED";
         case TRACE_EVT_MEM_NODE_UNSUPPORTED: return "NODE_UNSUP";
+        /* Hardware counters */
+        case TRACE_EVT_PMU_INSTR:            return "PMU_INSTR";
+        case TRACE_EVT_PMU_CYCLES:           return "PMU_CYCLES";
+        case TRACE_EVT_PMU_LLC_MISS:         return "PMU_LLC_MISS";
+        case TRACE_EVT_PMU_BR_MISS:          return "PMU_BR_MISS";
+        case TRACE_EVT_PMU_DTLB_MISS:        return "PMU_DTLB_MISS";
+        /* IPC */
+        case TRACE_EVT_IPC_SEND:             return "IPC_SEND";
+        case TRACE_EVT_IPC_RESPONSE:         return "IPC_RESPONSE";
+        case TRACE_EVT_IPC_DOORBELL:         return "IPC_DOORBELL";
         default:                             return "UNKNOWN";
     }
 }
 
 void flightrec_dump_console(void) {
     console_write("\n=== FLIGHT RECORDER DUMP ===\n");
-    console_write("TIME(us)     | TYPE             | JOB  | STEP | EXTRA\n");
-    console_write("-------------|------------------|------|------|--------\n");
+    console_write("TIME(us)     | CPU | TYPE             | JOB  | STEP | EXTRA\n");
+    console_write("-------------|-----|------------------|------|------|--------\n");
 
-    uint32_t count = (head > TRACE_BUF_SIZE) ? TRACE_BUF_SIZE : head;
-    uint32_t start = (head > TRACE_BUF_SIZE) ? (head - TRACE_BUF_SIZE) : 0;
-
-    for (uint32_t i = 0; i < count; i++) {
-        trace_event_t *e = &buf[(start + i) & TRACE_BUF_MASK];
+    trace_merge_t m;
+    merge_begin(&m);
+    uint32_t count = merge_count(&m);
 
+    trace_event_t *e;
+    while ((e = merge_next(&m, NULL, NULL)) != NULL) {
         /* Timestamp */
         print_uint64(e->ts_usec);
         console_write(" | ");
 
+        print_uint32(e->cpu_id);
+        console_write(" | ");
+
         /* Event type */
         console_write(event_type_name(e->type));
         console_write(" | ");
@@ -290,6 +830,8 @@ void flightrec_dump_console(void) {
         if (e->type == TRACE_EVT_STEP_END) {
             print_uint32(e->extra);
             console_write("us");
+        } else if (e->type >= TRACE_EVT_PMU_INSTR && e->type <= TRACE_EVT_PMU_DTLB_MISS) {
+            print_uint32(e->extra);
         } else if (e->extra != 0) {
             console_write("0x");
             print_hex8((e->extra >> 24) & 0xFF);
@@ -305,12 +847,37 @@ void flightrec_dump_console(void) {
 
     console_write("=== END DUMP (");
     print_uint32(count);
-    console_write(" events) ===\n\n");
+    console_write(" events) ===\n");
+
+    /* Rings that wrapped lost their oldest events */
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        uint32_t dropped = flightrec_dropped(c);
+        if (!dropped)
+            continue;
+        console_write("  cpu ");
+        print_uint32(c);
+        console_write(" dropped ");
+        print_uint32(dropped);
+        console_write(" events\n");
+    }
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        const span_cpu_t *p = &span_cpus[c];
+        if (!p->open && !p->exhausted)
+            continue;
+        console_write("  cpu ");
+        print_uint32(c);
+        console_write(" spans open ");
+        print_uint32(p->open);
+        console_write(" of ");
+        print_uint32(p->chunks * TRACE_SPAN_CHUNK);
+        console_write(", ");
+        print_uint32(p->exhausted);
+        console_write(" refused\n");
+    }
+    console_write("\n");
 }
 
 void flightrec_dump_filtered(uint8_t type_mask_lo, uint8_t type_mask_hi) {
-    uint32_t count = (head > TRACE_BUF_SIZE) ? TRACE_BUF_SIZE : head;
-    uint32_t start = (head > TRACE_BUF_SIZE) ? (head - TRACE_BUF_SIZE) : 0;
     uint32_t matched = 0;
 
     console_write("\n=== FILTERED TRACE (types 0x");
@@ -319,9 +886,11 @@ void flightrec_dump_filtered(uint8_t type_mask_lo, uint8_t type_mask_hi) {
     print_hex8(type_mask_hi);
     console_write(") ===\n");
 
-    for (uint32_t i = 0; i < count; i++) {
-        trace_event_t *e = &buf[(start + i) & TRACE_BUF_MASK];
+    trace_merge_t m;
+    merge_begin(&m);
 
+    trace_event_t *e;
+    while ((e = merge_next(&m, NULL, NULL)) != NULL) {
         if (e->type >= type_mask_lo && e->type <= type_mask_hi) {
             print_uint64(e->ts_usec);
             console_write(" ");
@@ -340,8 +909,53 @@ void flightrec_dump_filtered(uint8_t type_mask_lo, uint8_t type_mask_hi) {
     console_write(" events matched ===\n\n");
 }
 
-const trace_event_t* flightrec_get_buffer(uint32_t *out_head, uint32_t *out_count) {
-    if (out_head) *out_head = head;
-    if (out_count) *out_count = (head > TRACE_BUF_SIZE) ? TRACE_BUF_SIZE : head;
-    return buf;
+uint32_t flightrec_get_buffer(trace_event_t *out, uint32_t max) {
+    if (!out) return 0;
+
+    trace_merge_t m;
+    merge_begin(&m);
+
+    /* Skip the oldest beyond max */
+    uint32_t count = merge_count(&m);
+    for (; count > max; count--)
+        merge_next(&m, NULL, NULL);
+
+    for (uint32_t i = 0; i < count; i++)
+        out[i] = *merge_next(&m, NULL, NULL);
+    return count;
+}
+
+uint32_t flightrec_read(trace_cursor_t *cur, trace_event_t *out, uint32_t max,
+                        uint32_t *lost) {
+    uint32_t missed = 0, n = 0;
+    trace_merge_t m;
+    merge_begin(&m);
+
+    /* Whatever a ring wrapped past the cursor is gone */
+    for (uint32_t c = 0; c < TRACE_CPUS; c++) {
+        if ((int32_t)(m.pos[c] - cur->pos[c]) > 0)
+            missed += m.pos[c] - cur->pos[c];
+        else
+            m.pos[c] = cur->pos[c];
+    }
+
+    trace_event_t *e;
+    uint32_t cpu, seq;
+    while (n < max && (e = merge_next(&m, &cpu, &seq)) != NULL) {
+        out[n] = *e;
+
+        /* The CPU may have lapped the slot while it was copied */
+        uint32_t h = __atomic_load_n(&rings[cpu].head, __ATOMIC_ACQUIRE);
+        if (h - seq >= TRACE_RING_SIZE) {
+            missed++;
+            continue;
+        }
+        n++;
+    }
+
+    for (uint32_t c = 0; c < TRACE_CPUS; c++)
+        cur->pos[c] = m.pos[c];
+    if (lost)
+        *lost = missed;
+    return n;
 }
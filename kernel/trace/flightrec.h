@@ -3,7 +3,8 @@
  * Flight Recorder: Always-on, low-overhead telemetry for AI/ML governance.
  *
  * Design principles:
- * - Lock-free ring buffer (single producer in uniprocessor for now)
+ * - One lock-free ring per CPU: a CPU only writes its own, so logging
+ *   never contends; readers merge the rings in TSC order
  * - Real timestamps via rdtsc
  * - Rich event types for job scheduling, contracts, memory, IO
  * - Duration tracking for contract enforcement
@@ -13,11 +14,27 @@
 #define FLIGHTREC_H
 
 #include <stdint.h>
+#include "../arch/percpu.h"
 #include "../time/time.h"
 
-/* Ring buffer size - must be power of 2 */
-#define TRACE_BUF_SIZE 256
-#define TRACE_BUF_MASK (TRACE_BUF_SIZE - 1)
+/* Per-CPU ring size - must be power of 2 */
+#if defined(__x86_64__)
+#define TRACE_CPUS      SMP_MAX_CPUS
+#define TRACE_RING_SIZE 512
+#else
+#define TRACE_CPUS      1
+#define TRACE_RING_SIZE 2048
+#endif
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+/* Events per link of a CPU's seal chain - power of 2 */
+#define TRACE_SEAL_BLOCK 16
+
+/* Attested events keep their signature out of line, in a small table
+ * of its own; the oldest signature is recycled first
+ */
+#define TRACE_SIG_SIZE  256
+#define TRACE_SIG_SLOTS 16
 
 /*
  * Event categories for filtering and analysis
@@ -32,6 +49,21 @@ typedef enum {
     TRACE_EVT_STEP_PREEMPT     = 0x05,
     TRACE_EVT_JOB_ADMIT        = 0x06,  /* Job admitted after passing checks */
     TRACE_EVT_JOB_REJECT       = 0x07,  /* Job rejected by admission control */
+    TRACE_EVT_SCHED_STATS      = 0x08,  /* Per second: step_id = switches,
+                                           extra = max run-queue latency (us) */
+    TRACE_EVT_STEP_MEMO_HIT    = 0x09,  /* Result reused, extra = its blob */
+    TRACE_EVT_STEP_MEMO_MISS   = 0x0A,  /* Memoized step had to run */
+    TRACE_EVT_GANG_RELEASE     = 0x0B,  /* Collective released, extra = us
+                                           waited at the barrier (the
+                                           largest across nodes = skew) */
+    TRACE_EVT_GANG_TIMEOUT     = 0x0C,  /* Gave up on a straggler, extra =
+                                           participants still missing */
+    TRACE_EVT_COLL_DONE        = 0x0D,  /* Ring collective finished, extra =
+                                           algorithmic bandwidth (MB/s) */
+    TRACE_EVT_MESH_PLACE       = 0x0E,  /* Step placed, extra = node << 24 |
+                                           predicted completion (us) */
+    TRACE_EVT_MESH_REGRET      = 0x0F,  /* Placed step done, extra = actual -
+                                           predicted completion (us, signed) */
 
     /* Contract events */
     TRACE_EVT_CONTRACT_APPLY   = 0x10,
@@ -63,9 +95,35 @@ typedef enum {
     TRACE_EVT_THERMAL_WARN     = 0x50,
     TRACE_EVT_POWER_CAP        = 0x51,
 
+    /* Hardware counters over a span, logged after its end event (same
+       job and step), one per counter: extra = the delta, mod 2^32 */
+    TRACE_EVT_PMU_INSTR        = 0x60,
+    TRACE_EVT_PMU_CYCLES       = 0x61,
+    TRACE_EVT_PMU_LLC_MISS     = 0x62,
+    TRACE_EVT_PMU_BR_MISS      = 0x63,
+    TRACE_EVT_PMU_DTLB_MISS    = 0x64,
+
+    /* IPC with the bridge: job_id = 0, step_id = the request tag */
+    TRACE_EVT_IPC_SEND         = 0x70,  /* Command published, extra = cmd */
+    TRACE_EVT_IPC_RESPONSE     = 0x71,  /* Response taken, extra = status
+                                           << 16 | cmd */
+    TRACE_EVT_IPC_DOORBELL     = 0x72,  /* Bridge interrupted, extra =
+                                           packets since the last one */
+
     /* System events */
     TRACE_EVT_BOOT             = 0xF0,
     TRACE_EVT_HALT             = 0xF1,
+    TRACE_EVT_TRACE_LOST       = 0xF2,  /* Export fell behind, extra =
+                                           events lost before this one */
+    TRACE_EVT_SEAL             = 0xF3,  /* Seal taken: job_id = CPUs in it
+                                           << 16 | cpu, step_id = that CPU's
+                                           events it covers, extra = first
+                                           4 bytes of the seal */
+    TRACE_EVT_CLOCK_SYNC       = 0xF4,  /* Bridge CLOCK_MONOTONIC at this
+                                           event's time: step_id << 32 |
+                                           job_id ns, extra = error ns */
+    TRACE_EVT_BENCH            = 0xF5,  /* Shell `bench` flightrec test
+                                           event, extra = iteration */
     TRACE_EVT_PANIC            = 0xFF
 } trace_event_type_t;
 
@@ -80,67 +138,207 @@ typedef struct __attribute__((packed)) {
     uint64_t ts_usec;           /* Timestamp in microseconds since boot */
     uint64_t ts_cycles;         /* Raw TSC value for high-precision deltas */
     uint8_t  type;              /* trace_event_type_t */
-    uint8_t  flags;             /* Reserved for filtering/compression */
-    uint16_t cpu_id;            /* CPU that logged this (0 for now) */
+    uint8_t  sig;               /* 1 + signature table slot, 0 = none */
+    uint16_t cpu_id;            /* CPU that logged this (smp_cpu_id()) */
     uint32_t job_id;            /* Job identifier */
     uint32_t step_id;           /* Step identifier (or context-dependent) */
     uint32_t extra;             /* Duration (usec) or other context data */
-    uint8_t  tpm_signature[256];/* TPM quote/signature placeholder */
 } trace_event_t;
 
-_Static_assert(sizeof(trace_event_t) == 288, "trace_event_t must be 288 bytes");
+#ifndef __cplusplus
+_Static_assert(sizeof(trace_event_t) == 32, "trace_event_t must be 32 bytes");
+#endif
 
-typedef trace_event_t episode_t;
+/* Signature of one attested event */
+typedef struct {
+    uint32_t seq;               /* Event it signs: its cpu's ring position */
+    uint16_t cpu_id;
+    uint8_t  data[TRACE_SIG_SIZE]; /* TPM quote/signature */
+} trace_sig_t;
 
 /*
- * Summary statistics for quick contract checking
+ * Summary statistics for quick contract checking, kept up to date as
+ * events are logged: exact however long the job, while it holds one of
+ * TRACE_JOB_STATS entries (TRACE_STEP_STATS for its steps) - the entry
+ * idle longest is reused. Powers of 2
  */
+#define TRACE_JOB_STATS  64
+#define TRACE_STEP_STATS 512
+
 typedef struct {
     uint32_t job_id;
     uint32_t steps_completed;
     uint64_t total_cpu_usec;    /* Total CPU time consumed */
-    uint64_t total_wall_usec;   /* Total wall time elapsed */
+    uint64_t total_wall_usec;   /* First to last event of the job */
     uint32_t violations;        /* Contract violation count */
+    uint32_t min_step_usec;     /* Over every STEP_END */
+    uint32_t max_step_usec;
+    uint32_t last_step_usec;
 } trace_job_stats_t;
 
+/* One step of a job: its STEP_ENDs and the violations logged against it */
+typedef struct {
+    uint32_t job_id;
+    uint32_t step_id;
+    uint32_t count;
+    uint32_t violations;
+    uint64_t total_usec;
+    uint32_t min_usec;
+    uint32_t max_usec;
+    uint32_t last_usec;
+} trace_step_stats_t;
+
 /* Initialize flight recorder - call after time_init() */
 void flightrec_init(void);
 
+/*
+ * Categories: an event type's high nibble. flightrec_log() keeps an
+ * event only if its category is both compiled in (make TRACE_CATS=<mask>
+ * of TRACE_CAT_BIT()s; the rest compile to nothing wherever the type is
+ * a constant) and enabled at run time (flightrec_set_categories()).
+ * Scheduler, contract and system events are always kept: the job and
+ * step stats, contract enforcement and the seals are built from them.
+ * Attested events are always kept too.
+ */
+#define TRACE_CAT(type)       ((uint32_t)(type) >> 4)
+#define TRACE_CAT_BIT(cat)    (1u << (cat))
+#define TRACE_CAT_SCHED       0x0
+#define TRACE_CAT_CONTRACT    0x1
+#define TRACE_CAT_MEM         0x2
+#define TRACE_CAT_IO          0x3
+#define TRACE_CAT_ACCEL       0x4
+#define TRACE_CAT_THERMAL     0x5
+#define TRACE_CAT_PMU         0x6
+#define TRACE_CAT_IPC         0x7
+#define TRACE_CAT_SYSTEM      0xF
+
+#define TRACE_CATS_REQUIRED   (TRACE_CAT_BIT(TRACE_CAT_SCHED) | \
+                               TRACE_CAT_BIT(TRACE_CAT_CONTRACT) | \
+                               TRACE_CAT_BIT(TRACE_CAT_SYSTEM))
+#ifndef TRACE_CATS
+#define TRACE_CATS            0xFFFFu
+#endif
+#define TRACE_CATS_BUILT      ((TRACE_CATS) | TRACE_CATS_REQUIRED)
+
+/* Enabled categories (read inline by flightrec_log()) */
+extern uint32_t flightrec_cats;
+
+/* Enable exactly the categories in mask (TRACE_CATS_REQUIRED stay on).
+ * Returns: the mask now in effect
+ */
+uint32_t flightrec_set_categories(uint32_t mask);
+
+/* Log an event, whatever its category. Prefer flightrec_log() */
+void flightrec_log_event(trace_event_type_t type, uint32_t job_id,
+                         uint32_t step_id, uint32_t extra);
+
 /* Log an event (fast path) */
-void flightrec_log(trace_event_type_t type, uint32_t job_id,
-                   uint32_t step_id, uint32_t extra);
+static inline void flightrec_log(trace_event_type_t type, uint32_t job_id,
+                                 uint32_t step_id, uint32_t extra) {
+    if (TRACE_CATS_BUILT & flightrec_cats & TRACE_CAT_BIT(TRACE_CAT(type)))
+        flightrec_log_event(type, job_id, step_id, extra);
+}
+
+/* Log an event together with its signature (len bytes, at most
+ * TRACE_SIG_SIZE; the rest is zero)
+ */
+void flightrec_log_attested(trace_event_type_t type, uint32_t job_id,
+                            uint32_t step_id, uint32_t extra,
+                            const uint8_t *sig, uint32_t len);
 
-void seal_episode(episode_t *ep);
-/* Compute a stable hash of the flight recorder buffer in chronological order. */
+/* Signature of the event at position seq of cpu's ring, NULL if it has
+ * none or its signature has been recycled
+ */
+const trace_sig_t* flightrec_get_signature(uint32_t cpu, uint32_t seq);
+
+/* Seal the flight recorder: every event every CPU has logged, in O(CPUs).
+ *
+ * Each CPU keeps a hash chain over its own events as it logs them,
+ * chain = SHA-256(chain || next TRACE_SEAL_BLOCK events), starting from
+ * 32 zero bytes. The seal is SHA-256 over, for every CPU with events in
+ * id order, its id and event count (u32 each), its chain over all whole
+ * blocks and its events past the last whole block. One TRACE_EVT_SEAL
+ * per CPU with events follows, recording where the seal cut its ring. Signatures are not
+ * chained: an attested event is, with its nonzero sig index.
+ */
 void flightrec_seal_hash(uint8_t out[32]);
 
 /*
  * Paired event logging for duration tracking
- * Returns a handle to correlate start/end events
+ * Returns a handle to correlate start/end events, 0 if no slot is free
+ * (the start event is logged either way).
+ * The start event's extra is the parent span (0 for none); the end
+ * event's is the duration in microseconds. A handle stays valid until
+ * its span ends, on any CPU; after that it is ignored.
+ * A span that began and ends on a CPU with hardware counters (pmu.h)
+ * is followed by a TRACE_EVT_PMU_* event per counter.
+ *
+ * Each CPU has TRACE_SPAN_CHUNK slots and grows by as many, up to
+ * TRACE_SPAN_CHUNKS times, when a span begins with interrupts on.
  */
+#define TRACE_SPAN_CHUNK  64
+#define TRACE_SPAN_CHUNKS 16
+
 typedef uint32_t trace_span_t;
 
 trace_span_t flightrec_begin_span(trace_event_type_t start_type,
                                    uint32_t job_id, uint32_t step_id);
 
+/* Begin a span nested in parent (e.g. job -> step -> IPC) */
+trace_span_t flightrec_begin_child(trace_span_t parent, trace_event_type_t start_type,
+                                   uint32_t job_id, uint32_t step_id);
+
 void flightrec_end_span(trace_span_t span, trace_event_type_t end_type);
 
+/* Parent of an open span: 0 if it has none or has ended */
+trace_span_t flightrec_span_parent(trace_span_t span);
+
 /*
- * Get duration of last completed span for a job/step
+ * Get duration of last completed span for a job/step - O(1)
  * Returns duration in microseconds, or 0 if not found
  */
 usec_t flightrec_last_duration(uint32_t job_id, uint32_t step_id);
 
-/* Aggregate stats for a job (scans buffer) */
+/* Hand fn(step_id, duration, arg) every STEP_END of job_id still in the
+ * rings, newest first: one pass for a whole job's step history
+ */
+typedef void (*flightrec_step_fn)(uint32_t step_id, usec_t duration_us, void *arg);
+void flightrec_for_each_step_end(uint32_t job_id, flightrec_step_fn fn, void *arg);
+
+/* Aggregate stats for a job - O(1); all zero if it has none */
 void flightrec_get_job_stats(uint32_t job_id, trace_job_stats_t *out);
 
+/* Aggregate stats for one step of a job - O(1); all zero if it has none */
+void flightrec_get_step_stats(uint32_t job_id, uint32_t step_id,
+                              trace_step_stats_t *out);
+
 /* Dump events to console (for debugging) */
 void flightrec_dump_console(void);
 
 /* Dump events matching a filter */
 void flightrec_dump_filtered(uint8_t type_mask_lo, uint8_t type_mask_hi);
 
-/* Get raw buffer access for external export */
-const trace_event_t* flightrec_get_buffer(uint32_t *out_head, uint32_t *out_count);
+/* Copy the newest events (at most max) into out for external export,
+ * oldest first across all CPUs. Returns: the number copied
+ */
+uint32_t flightrec_get_buffer(trace_event_t *out, uint32_t max);
+
+/* Events cpu's ring has overwritten before anyone could read them */
+uint32_t flightrec_dropped(uint32_t cpu);
+
+/* A streaming reader's place in every ring; zero it to start from the
+ * oldest events still held
+ */
+typedef struct {
+    uint32_t pos[TRACE_CPUS];
+} trace_cursor_t;
+
+/* Copy up to max events logged past cur into out, oldest first across
+ * all CPUs, and move cur past them. *lost (may be NULL) is set to the
+ * events the rings overwrote before cur got to them.
+ * Returns: the number copied
+ */
+uint32_t flightrec_read(trace_cursor_t *cur, trace_event_t *out, uint32_t max,
+                        uint32_t *lost);
 
 #endif /* FLIGHTREC_H */
@@ -2,6 +2,7 @@
 #include "ifr.h"
 #include "../time/time.h"
 #include "../lib/sha256.h"
+#include "../ipc/bulk.h"
 #include "../ipc/heap.h"
 #include "flightrec.h"
 #include <string.h>
@@ -66,17 +67,18 @@ static void fill_nonce(uint8_t nonce[32]) {
     sha256_final(&ctx, nonce);
 }
 
+/* Digests are taken when a model is finalized (bulk upload finished, heap
+ * blob marked read-only) and reused until the blob changes
+ */
 static void compute_model_digest(uint32_t model_id, uint8_t out[32], uint16_t *flags) {
-    void *data = heap_get_data((uint16_t)model_id);
-    uint32_t size = heap_get_blob_size((uint16_t)model_id);
-    if (!data || size == 0) {
+    int rc = (model_id >= IPC_BULK_MODEL_BASE) ? ipc_bulk_model_digest(model_id, out)
+                                               : heap_blob_digest((uint16_t)model_id, out);
+    if (rc != 0) {
         memset(out, 0, 32);
         if (flags) {
             *flags |= IFR_FLAG_MODEL_DIGEST_MISSING;
         }
-        return;
     }
-    sha256_hash((const uint8_t *)data, size, out);
 }
 
 static void compute_policy_digest(uint8_t out[32], uint16_t *flags) {
@@ -87,6 +89,22 @@ static void compute_policy_digest(uint8_t out[32], uint16_t *flags) {
     }
 }
 
+/* Helper: the chain step v3 records and v4 batches share */
+static void chain_hash(const uint8_t prev[32], const uint8_t ifr_hash[32],
+                       const uint8_t seal[32], const uint8_t nonce[32],
+                       const uint8_t model_digest[32], const uint8_t policy_digest[32],
+                       uint8_t out[32]) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, prev, 32);
+    sha256_update(&ctx, ifr_hash, 32);
+    sha256_update(&ctx, seal, 32);
+    sha256_update(&ctx, nonce, 32);
+    sha256_update(&ctx, model_digest, 32);
+    sha256_update(&ctx, policy_digest, 32);
+    sha256_final(&ctx, out);
+}
+
 void ifr_build_v3(ifr_record_v3_t *out,
                   const uint8_t prev_chain_hash[32],
                   uint32_t job_id,
@@ -117,21 +135,15 @@ void ifr_build_v3(ifr_record_v3_t *out,
 
     flightrec_seal_hash(out->flightrec_seal_hash);
 
+    /* Flags are hashed: all of them go in first */
+    memset(out->sig_classical, 0, sizeof(out->sig_classical));
+    out->flags |= IFR_FLAG_SIG_UNAVAILABLE;
+
     /* IFR core hash excludes ifr_hash, chain_hash, and signature fields. */
     sha256_hash((const uint8_t *)out, offsetof(ifr_record_v3_t, ifr_hash), out->ifr_hash);
 
-    sha256_ctx_t ctx;
-    sha256_init(&ctx);
-    sha256_update(&ctx, out->prev_chain_hash, 32);
-    sha256_update(&ctx, out->ifr_hash, 32);
-    sha256_update(&ctx, out->flightrec_seal_hash, 32);
-    sha256_update(&ctx, out->nonce, 32);
-    sha256_update(&ctx, out->model_digest, 32);
-    sha256_update(&ctx, out->policy_digest, 32);
-    sha256_final(&ctx, out->chain_hash);
-
-    memset(out->sig_classical, 0, sizeof(out->sig_classical));
-    out->flags |= IFR_FLAG_SIG_UNAVAILABLE;
+    chain_hash(out->prev_chain_hash, out->ifr_hash, out->flightrec_seal_hash,
+               out->nonce, out->model_digest, out->policy_digest, out->chain_hash);
 }
 
 int ifr_verify_v3(const ifr_record_v3_t *rec) {
@@ -149,16 +161,111 @@ int ifr_verify_v3(const ifr_record_v3_t *rec) {
     if (memcmp(expected_ifr, rec->ifr_hash, 32) != 0)
         return 0;
 
-    sha256_ctx_t ctx;
-    sha256_init(&ctx);
-    sha256_update(&ctx, rec->prev_chain_hash, 32);
-    sha256_update(&ctx, rec->ifr_hash, 32);
-    sha256_update(&ctx, rec->flightrec_seal_hash, 32);
-    sha256_update(&ctx, rec->nonce, 32);
-    sha256_update(&ctx, rec->model_digest, 32);
-    sha256_update(&ctx, rec->policy_digest, 32);
     uint8_t expected_chain[32];
-    sha256_final(&ctx, expected_chain);
+    chain_hash(rec->prev_chain_hash, rec->ifr_hash, rec->flightrec_seal_hash,
+               rec->nonce, rec->model_digest, rec->policy_digest, expected_chain);
 
     return (memcmp(expected_chain, rec->chain_hash, 32) == 0) ? 1 : 0;
 }
+
+/* Tree levels, leaf hashes first; the control loop is the only caller */
+static uint8_t merkle_level[IFR_BATCH_MAX][32];
+
+/* Helper: out[i] = SHA-256(prefix || in + i * len) for i < n, eight
+ * equal-length messages at a time (sha256_update_many()). out may
+ * overlap in when out[i] lies at or below in + i * len
+ */
+static void hash_many(uint8_t prefix, const uint8_t *in, uint32_t len, uint32_t n,
+                      uint8_t (*out)[32]) {
+    sha256_ctx_t ctx[8];
+    sha256_ctx_t *pctx[8];
+    const uint8_t *msg[8];
+
+    for (uint32_t base = 0; base < n; base += 8) {
+        uint32_t lanes = n - base < 8 ? n - base : 8;
+        for (uint32_t j = 0; j < lanes; j++) {
+            sha256_init(&ctx[j]);
+            sha256_update(&ctx[j], &prefix, 1);
+            pctx[j] = &ctx[j];
+            msg[j] = in + (size_t)(base + j) * len;
+        }
+        sha256_update_many(pctx, msg, len, lanes);
+        for (uint32_t j = 0; j < lanes; j++)
+            sha256_final(&ctx[j], out[base + j]);
+    }
+}
+
+void ifr_merkle_root(const ifr_leaf_t *leaves, uint32_t count, uint8_t root[32]) {
+    if (count == 0 || count > IFR_BATCH_MAX) {
+        memset(root, 0, 32);
+        return;
+    }
+
+    /* Pair up each level; an odd last node moves up as it is, which
+     * gives the same root as RFC 6962's split at the largest power of two
+     */
+    hash_many(0x00, (const uint8_t *)leaves, sizeof(ifr_leaf_t), count, merkle_level);
+    for (uint32_t n = count; n > 1; n = (n + 1) / 2) {
+        hash_many(0x01, &merkle_level[0][0], 64, n / 2, merkle_level);
+        if (n & 1)
+            memmove(merkle_level[n / 2], merkle_level[n - 1], 32);
+    }
+    memcpy(root, merkle_level[0], 32);
+}
+
+void ifr_build_v4(ifr_batch_v4_t *out,
+                  const uint8_t prev_chain_hash[32],
+                  uint32_t job_id,
+                  uint32_t model_id,
+                  const ifr_leaf_t *leaves,
+                  uint32_t count) {
+    if (!out)
+        return;
+
+    memset(out, 0, sizeof(*out));
+    out->magic = IFR_MAGIC;
+    out->version = IFR_VERSION_V4;
+    out->record_size = sizeof(*out);
+    out->job_id = job_id;
+    out->count = count;
+    out->model_id = model_id;
+    out->ts_usec = time_usec();
+
+    uint16_t flags = IFR_FLAG_SIG_UNAVAILABLE;
+    fill_nonce(out->nonce);
+    compute_model_digest(model_id, out->model_digest, &flags);
+    compute_policy_digest(out->policy_digest, &flags);
+    out->flags = flags;
+    if (prev_chain_hash)
+        memcpy(out->prev_chain_hash, prev_chain_hash, 32);
+    flightrec_seal_hash(out->flightrec_seal_hash);
+    ifr_merkle_root(leaves, count, out->merkle_root);
+
+    sha256_hash((const uint8_t *)out, offsetof(ifr_batch_v4_t, ifr_hash), out->ifr_hash);
+    chain_hash(out->prev_chain_hash, out->ifr_hash, out->flightrec_seal_hash,
+               out->nonce, out->model_digest, out->policy_digest, out->chain_hash);
+}
+
+int ifr_verify_v4(const ifr_batch_v4_t *hdr, const ifr_leaf_t *leaves) {
+    if (!hdr || !leaves)
+        return 0;
+    if (hdr->magic != IFR_MAGIC || hdr->version != IFR_VERSION_V4)
+        return 0;
+    if (hdr->record_size != sizeof(*hdr))
+        return 0;
+    if (hdr->count == 0 || hdr->count > IFR_BATCH_MAX)
+        return 0;
+
+    uint8_t expected[32];
+    ifr_merkle_root(leaves, hdr->count, expected);
+    if (memcmp(expected, hdr->merkle_root, 32) != 0)
+        return 0;
+
+    sha256_hash((const uint8_t *)hdr, offsetof(ifr_batch_v4_t, ifr_hash), expected);
+    if (memcmp(expected, hdr->ifr_hash, 32) != 0)
+        return 0;
+
+    chain_hash(hdr->prev_chain_hash, hdr->ifr_hash, hdr->flightrec_seal_hash,
+               hdr->nonce, hdr->model_digest, hdr->policy_digest, expected);
+    return (memcmp(expected, hdr->chain_hash, 32) == 0) ? 1 : 0;
+}
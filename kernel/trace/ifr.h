@@ -9,10 +9,16 @@
 #define IFR_VERSION 2
 #define IFR_VERSION_V2 2
 #define IFR_VERSION_V3 3
+#define IFR_VERSION_V4 4 /* Batch: one chain step for a Merkle tree of episodes */
 #define IFR_PROFILE_MAX 16
 #define IFR_RECORD_SIZE 136u
 
 #define IFR_V3_RECORD_SIZE 324u
+#define IFR_V4_RECORD_SIZE 352u
+#define IFR_LEAF_SIZE 32u
+
+/* Episodes per v4 batch */
+#define IFR_BATCH_MAX 64
 
 /* IFR flags (shared across versions) */
 #define IFR_FLAG_SIG_UNAVAILABLE          0x0001
@@ -60,6 +66,47 @@ typedef struct __attribute__((packed)) {
 
 typedef char ifr_v3_size_check[(sizeof(ifr_record_v3_t) == IFR_V3_RECORD_SIZE) ? 1 : -1];
 
+/* One episode of a v4 batch */
+typedef struct __attribute__((packed)) {
+    uint32_t episode_id;
+    uint32_t env;               /* Vector env index */
+    uint32_t model_id;
+    uint32_t steps;
+    uint64_t ts_usec;           /* Episode end */
+    float goodput;
+    uint32_t reserved;
+} ifr_leaf_t;
+
+typedef char ifr_leaf_size_check[(sizeof(ifr_leaf_t) == IFR_LEAF_SIZE) ? 1 : -1];
+
+/* v4 batch header, persisted with its count leaves right after it.
+ * merkle_root is the RFC 6962 tree hash of the leaves: leaf hash
+ * SHA-256(0x00 || leaf), node SHA-256(0x01 || left || right). ifr_hash
+ * covers the header up to itself, root included, and chain_hash chains
+ * it exactly as v3 does, so one record per batch carries the chain.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t record_size;       /* Header only */
+    uint32_t job_id;
+    uint32_t count;             /* Leaves: 1..IFR_BATCH_MAX */
+    uint32_t model_id;          /* Whose model_digest */
+    uint64_t ts_usec;
+    uint8_t nonce[32];
+    uint8_t model_digest[32];
+    uint8_t policy_digest[32];
+    uint8_t flightrec_seal_hash[32];
+    uint8_t merkle_root[32];
+    uint8_t prev_chain_hash[32];
+    uint8_t ifr_hash[32];
+    uint8_t chain_hash[32];
+    uint8_t sig_classical[64];
+} ifr_batch_v4_t;
+
+typedef char ifr_v4_size_check[(sizeof(ifr_batch_v4_t) == IFR_V4_RECORD_SIZE) ? 1 : -1];
+
 void ifr_build(ifr_record_t *out,
                uint32_t job_id,
                uint32_t episode_id,
@@ -77,4 +124,17 @@ void ifr_build_v3(ifr_record_v3_t *out,
                   float goodput);
 int ifr_verify_v3(const ifr_record_v3_t *rec);
 
+/* RFC 6962 tree hash of count (1..IFR_BATCH_MAX) leaves */
+void ifr_merkle_root(const ifr_leaf_t *leaves, uint32_t count, uint8_t root[32]);
+
+/* Header for leaves[0..count), chained from prev_chain_hash */
+void ifr_build_v4(ifr_batch_v4_t *out,
+                  const uint8_t prev_chain_hash[32],
+                  uint32_t job_id,
+                  uint32_t model_id,
+                  const ifr_leaf_t *leaves,
+                  uint32_t count);
+/* Header hashes, chain and root against its leaves. Returns: 1 if valid */
+int ifr_verify_v4(const ifr_batch_v4_t *hdr, const ifr_leaf_t *leaves);
+
 #endif
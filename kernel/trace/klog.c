@@ -0,0 +1,128 @@
+/* kernel/trace/klog.c
+ *
+ * Deferred binary logging: producers reserve a slot with an atomic
+ * increment, fill it, then publish by writing the slot's seq. The drain
+ * path is the only code that writes to the console.
+ */
+#include "klog.h"
+#include "../console.h"
+#include "../time/time.h"
+
+static klog_record_t ring[KLOG_BUF_SIZE];
+static volatile uint32_t head = 0;   /* Next slot to reserve (producers) */
+static uint32_t tail = 0;            /* Next slot to emit (drain only) */
+static uint32_t dropped = 0;
+
+uint8_t klog_levels[KLOG_SUBSYS_COUNT] = {
+    KLOG_LVL_INFO, KLOG_LVL_INFO, KLOG_LVL_INFO, KLOG_LVL_INFO
+};
+
+static const char *const subsys_names[KLOG_SUBSYS_COUNT] = {
+    "kern", "ipc", "heap", "sched"
+};
+
+void klog_init(void) {
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    for (uint32_t i = 0; i < KLOG_BUF_SIZE; i++)
+        ring[i].seq = 0;
+}
+
+void klog_set_level(klog_subsys_t subsys, uint8_t level) {
+    if ((uint32_t)subsys < KLOG_SUBSYS_COUNT)
+        klog_levels[subsys] = level;
+}
+
+void klog_write(uint8_t subsys, uint8_t level, const char *fmt,
+                uint32_t a0, uint32_t a1, uint32_t a2) {
+    uint32_t idx = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    klog_record_t *r = &ring[idx & KLOG_BUF_MASK];
+
+    r->subsys = subsys;
+    r->level = level;
+    r->ts_usec = time_usec();
+    r->fmt = fmt;
+    r->args[0] = a0;
+    r->args[1] = a1;
+    r->args[2] = a2;
+
+    /* Publish: payload stores before the commit marker */
+    __atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+static void print_int(uint32_t v) {
+    if ((int32_t)v < 0) {
+        console_putc('-');
+        v = (uint32_t)(-(int32_t)v);
+    }
+    print_uint(v);
+}
+
+static void emit(const klog_record_t *r) {
+    console_write("[");
+    console_write(r->subsys < KLOG_SUBSYS_COUNT ? subsys_names[r->subsys] : "?");
+    console_write("] ");
+
+    uint32_t argi = 0;
+    for (const char *p = r->fmt; *p; p++) {
+        if (*p != '%' || p[1] == '\0') {
+            console_putc(*p);
+            continue;
+        }
+        p++;
+        uint32_t v = (argi < 3) ? r->args[argi] : 0;
+        switch (*p) {
+        case 'u': print_uint(v); argi++; break;
+        case 'd': print_int(v); argi++; break;
+        case 'x': print_hex32(v); argi++; break;
+        case '%': console_putc('%'); break;
+        default:  console_putc('%'); console_putc(*p); break;
+        }
+    }
+    console_putc('\n');
+}
+
+uint32_t klog_drain(uint32_t max) {
+    uint32_t emitted = 0;
+
+    while (max == 0 || emitted < max) {
+        klog_record_t *r = &ring[tail & KLOG_BUF_MASK];
+        uint32_t seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == tail + 1) {
+            /* Copy out, then re-check in case a producer lapped us */
+            klog_record_t copy = *r;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq)
+                continue;
+            emit(&copy);
+            tail++;
+            emitted++;
+        } else if ((int32_t)(seq - (tail + 1)) > 0) {
+            /* Producers wrapped past us: skip what was overwritten */
+            uint32_t h = head;
+            uint32_t oldest = h - KLOG_BUF_SIZE;
+            dropped += oldest - tail;
+            tail = oldest;
+        } else {
+            break; /* Not yet published (or empty) */
+        }
+    }
+
+    if (dropped) {
+        static uint32_t reported = 0;
+        if (dropped != reported) {
+            console_write("[klog] dropped ");
+            print_uint(dropped - reported);
+            console_write(" records\n");
+            reported = dropped;
+        }
+    }
+
+    return emitted;
+}
+
+uint32_t klog_dropped(void) {
+    return dropped;
+}
@@ -0,0 +1,89 @@
+/* kernel/trace/klog.h
+ *
+ * Deferred binary logging for hot paths.
+ *
+ * A log call stores a fixed-size record (timestamp, subsystem, level, a
+ * pointer to a static format string and up to three integer arguments) in
+ * a lock-free ring and returns. Nothing touches the UART until
+ * klog_drain() runs, normally from the idle loop, so a log call costs a
+ * handful of stores instead of a serial busy-wait per character.
+ *
+ * Format strings must be string literals (only the pointer is recorded).
+ * Supported conversions at drain time: %u, %d, %x, %%.
+ */
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Ring size - must be power of 2 */
+#define KLOG_BUF_SIZE 256
+#define KLOG_BUF_MASK (KLOG_BUF_SIZE - 1)
+
+/* Subsystems, each with its own runtime level */
+typedef enum {
+    KLOG_SUBSYS_KERN  = 0,
+    KLOG_SUBSYS_IPC   = 1,
+    KLOG_SUBSYS_HEAP  = 2,
+    KLOG_SUBSYS_SCHED = 3,
+    KLOG_SUBSYS_COUNT
+} klog_subsys_t;
+
+/* Levels: a record is kept if level <= klog_levels[subsys] */
+#define KLOG_LVL_ERR   0
+#define KLOG_LVL_WARN  1
+#define KLOG_LVL_INFO  2
+#define KLOG_LVL_DEBUG 3
+#define KLOG_LVL_OFF   0xFF  /* Only as a drain-side filter, never a record */
+
+typedef struct {
+    uint32_t    seq;       /* Ring index + 1, written last (commit marker) */
+    uint8_t     subsys;
+    uint8_t     level;
+    uint16_t    reserved;
+    uint64_t    ts_usec;
+    const char *fmt;       /* Static format string */
+    uint32_t    args[3];
+} klog_record_t;
+
+/* Per-subsystem level masks (read inline by the KLOG macros) */
+extern uint8_t klog_levels[KLOG_SUBSYS_COUNT];
+
+void klog_init(void);
+
+/* Set runtime level for one subsystem (KLOG_LVL_*) */
+void klog_set_level(klog_subsys_t subsys, uint8_t level);
+
+/* Append a record. Safe from IRQ context. Prefer the KLOG* macros, which
+ * skip the call entirely when the level is filtered out.
+ */
+void klog_write(uint8_t subsys, uint8_t level, const char *fmt,
+                uint32_t a0, uint32_t a1, uint32_t a2);
+
+/* Format up to max pending records to the console (0 = all).
+ * Returns number of records emitted.
+ */
+uint32_t klog_drain(uint32_t max);
+
+/* Records lost to ring overrun since boot */
+uint32_t klog_dropped(void);
+
+#define KLOG3(subsys, level, fmt, a0, a1, a2)                               \
+    do {                                                                    \
+        if ((uint8_t)(level) <= klog_levels[(subsys)])                      \
+            klog_write((subsys), (level), (fmt), (uint32_t)(a0),            \
+                       (uint32_t)(a1), (uint32_t)(a2));                     \
+    } while (0)
+#define KLOG2(subsys, level, fmt, a0, a1) KLOG3(subsys, level, fmt, a0, a1, 0)
+#define KLOG1(subsys, level, fmt, a0)     KLOG3(subsys, level, fmt, a0, 0, 0)
+#define KLOG(subsys, level, fmt)          KLOG3(subsys, level, fmt, 0, 0, 0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KLOG_H */
@@ -0,0 +1,177 @@
+/* kernel/trace/lat.c - Latency histograms */
+
+#include "lat.h"
+#include "../arch/idt.h"
+#include "../console.h"
+#include "../include/string.h"
+#include "../ipc/ipc_proto.h"
+
+typedef struct {
+    uint32_t job_id;            /* 0 = free */
+    uint32_t used;              /* lat_clock when last recorded */
+    hdr_hist_t hist;
+} lat_job_t;
+
+static hdr_hist_t hists[LAT_COUNT];
+static lat_job_t jobs[LAT_JOBS];
+static uint32_t lat_clock;
+static volatile uint8_t lat_lock;   /* Any CPU may record */
+
+static const char *const names[LAT_COUNT] = {
+    [LAT_IPC_RTT + LAT_IPC_PING]            = "ipc PING",
+    [LAT_IPC_RTT + LAT_IPC_PRINT]           = "ipc PRINT",
+    [LAT_IPC_RTT + LAT_IPC_RUN_MODEL]       = "ipc RUN_MODEL",
+    [LAT_IPC_RTT + LAT_IPC_AGENT_LOAD]      = "ipc AGENT_LOAD",
+    [LAT_IPC_RTT + LAT_IPC_WASM_PROFILE]    = "ipc WASM_PROFILE",
+    [LAT_IPC_RTT + LAT_IPC_RUN_MODEL_BATCH] = "ipc RUN_MODEL_BATCH",
+    [LAT_IPC_RTT + LAT_IPC_ENV_RESET]       = "ipc ENV_RESET",
+    [LAT_IPC_RTT + LAT_IPC_ENV_STEP]        = "ipc ENV_STEP",
+    [LAT_IPC_RTT + LAT_IPC_IFR_PERSIST]     = "ipc IFR_PERSIST",
+    [LAT_IPC_RTT + LAT_IPC_ARB_EPISODE]     = "ipc ARB_EPISODE",
+    [LAT_IPC_RTT + LAT_IPC_TELEMETRY_POLL]  = "ipc TELEMETRY_POLL",
+    [LAT_IPC_RTT + LAT_IPC_ACT_APPLY]       = "ipc ACT_APPLY",
+    [LAT_IPC_RTT + LAT_IPC_OTHER]           = "ipc other",
+    [LAT_STEP_TOTAL]                        = "step total",
+    [LAT_STEP_SERVER]                       = "step server",
+    [LAT_STEP_TRANSPORT]                    = "step transport",
+    [LAT_STEP_QUEUE]                        = "step queueing",
+    [LAT_LOOP_PERIOD]                       = "control loop",
+};
+
+static int lock(void) {
+    int was = interrupts_enabled();
+    interrupts_disable();
+    while (__atomic_test_and_set(&lat_lock, __ATOMIC_ACQUIRE))
+        __asm__ __volatile__("pause");
+    return was;
+}
+
+static void unlock(int was) {
+    __atomic_clear(&lat_lock, __ATOMIC_RELEASE);
+    if (was)
+        interrupts_enable();
+}
+
+uint32_t lat_ipc_class(uint16_t cmd) {
+    switch (cmd) {
+        case CMD_PING:            return LAT_IPC_PING;
+        case CMD_PRINT:           return LAT_IPC_PRINT;
+        case CMD_RUN_MODEL:       return LAT_IPC_RUN_MODEL;
+        case CMD_AGENT_LOAD:      return LAT_IPC_AGENT_LOAD;
+        case CMD_WASM_PROFILE:    return LAT_IPC_WASM_PROFILE;
+        case CMD_RUN_MODEL_BATCH: return LAT_IPC_RUN_MODEL_BATCH;
+        case CMD_ENV_RESET:       return LAT_IPC_ENV_RESET;
+        case CMD_ENV_STEP:        return LAT_IPC_ENV_STEP;
+        case CMD_IFR_PERSIST:     return LAT_IPC_IFR_PERSIST;
+        case CMD_ARB_EPISODE:     return LAT_IPC_ARB_EPISODE;
+        case CMD_TELEMETRY_POLL:  return LAT_IPC_TELEMETRY_POLL;
+        case CMD_ACT_APPLY:       return LAT_IPC_ACT_APPLY;
+        default:                  return LAT_IPC_OTHER;
+    }
+}
+
+void lat_record(uint32_t id, uint32_t usec) {
+    if (id >= LAT_COUNT)
+        return;
+    int was = lock();
+    hdr_hist_record(&hists[id], usec);
+    unlock(was);
+}
+
+void lat_record_step(uint32_t job_id, uint32_t usec) {
+    if (!job_id)
+        return;
+
+    int was = lock();
+    lat_job_t *j = NULL, *lru = &jobs[0];
+    for (uint32_t i = 0; i < LAT_JOBS; i++) {
+        if (jobs[i].job_id == job_id) {
+            j = &jobs[i];
+            break;
+        }
+        if (jobs[i].used < lru->used)
+            lru = &jobs[i];
+    }
+    if (!j) {
+        j = lru;
+        j->job_id = job_id;
+        hdr_hist_reset(&j->hist);
+    }
+    j->used = ++lat_clock;
+    hdr_hist_record(&j->hist, usec);
+    unlock(was);
+}
+
+int lat_snapshot(uint32_t id, hdr_hist_t *out) {
+    if (id >= LAT_COUNT)
+        return -1;
+    int was = lock();
+    *out = hists[id];
+    unlock(was);
+    return 0;
+}
+
+int lat_snapshot_job(uint32_t job_id, hdr_hist_t *out) {
+    int rc = -1;
+    int was = lock();
+    for (uint32_t i = 0; i < LAT_JOBS; i++) {
+        if (job_id && jobs[i].job_id == job_id) {
+            *out = jobs[i].hist;
+            rc = 0;
+            break;
+        }
+    }
+    unlock(was);
+    return rc;
+}
+
+void lat_reset(void) {
+    int was = lock();
+    for (uint32_t i = 0; i < LAT_COUNT; i++)
+        hdr_hist_reset(&hists[i]);
+    memset(jobs, 0, sizeof(jobs));
+    lat_clock = 0;
+    unlock(was);
+}
+
+static void dump_one(const char *name, uint32_t job_id, const hdr_hist_t *h) {
+    console_write("[lat] ");
+    console_write(name);
+    if (job_id) {
+        console_write(" ");
+        print_uint(job_id);
+    }
+    console_write(": n ");
+    print_uint(h->count);
+    console_write(" p50 ");
+    print_uint(hdr_hist_value_at(h, 500));
+    console_write(" p99 ");
+    print_uint(hdr_hist_value_at(h, 990));
+    console_write(" p99.9 ");
+    print_uint(hdr_hist_value_at(h, 999));
+    console_write(" max ");
+    print_uint(h->max);
+    console_write(" us\n");
+}
+
+void lat_dump(void) {
+    /* Static: a snapshot is ~1.9KB, too much for some kernel stacks */
+    static hdr_hist_t h, all;
+    hdr_hist_reset(&all);
+
+    for (uint32_t id = 0; id < LAT_COUNT; id++) {
+        lat_snapshot(id, &h);
+        if (id < LAT_IPC_RTT + LAT_IPC_CLASSES)
+            hdr_hist_merge(&all, &h);
+        if (h.count)
+            dump_one(names[id], 0, &h);
+        if (id == LAT_IPC_RTT + LAT_IPC_CLASSES - 1 && all.count)
+            dump_one("ipc all", 0, &all);
+    }
+
+    for (uint32_t i = 0; i < LAT_JOBS; i++) {
+        uint32_t job_id = jobs[i].job_id;
+        if (job_id && lat_snapshot_job(job_id, &h) == 0 && h.count)
+            dump_one("steps of job", job_id, &h);
+    }
+}
@@ -0,0 +1,82 @@
+/* kernel/trace/lat.h - Latency histograms
+ *
+ * A fixed set of hdr_hist_t histograms, one per thing worth a latency
+ * distribution: IPC round trips by command, the server / transport split
+ * of offloaded steps, step durations of the most recent jobs and the
+ * control loop period. Recording is O(1) and allocation-free; readers
+ * take a snapshot, and snapshots merge (hdr_hist_merge()), e.g. across
+ * commands or CPUs. All values are microseconds.
+ */
+#ifndef _TRACE_LAT_H
+#define _TRACE_LAT_H
+
+#include <stdint.h>
+#include "../lib/hdr_hist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* IPC commands with a round-trip histogram of their own; the rest share
+ * LAT_IPC_OTHER
+ */
+typedef enum {
+    LAT_IPC_PING = 0,
+    LAT_IPC_PRINT,
+    LAT_IPC_RUN_MODEL,
+    LAT_IPC_AGENT_LOAD,
+    LAT_IPC_WASM_PROFILE,
+    LAT_IPC_RUN_MODEL_BATCH,
+    LAT_IPC_ENV_RESET,
+    LAT_IPC_ENV_STEP,
+    LAT_IPC_IFR_PERSIST,
+    LAT_IPC_ARB_EPISODE,
+    LAT_IPC_TELEMETRY_POLL,
+    LAT_IPC_ACT_APPLY,
+    LAT_IPC_OTHER,
+    LAT_IPC_CLASSES
+} lat_ipc_class_t;
+
+typedef enum {
+    LAT_IPC_RTT = 0,                        /* + lat_ipc_class(cmd) */
+    LAT_STEP_TOTAL = LAT_IPC_RTT + LAT_IPC_CLASSES, /* Offloaded step, end to end */
+    LAT_STEP_SERVER,                        /* Its time on the bridge */
+    LAT_STEP_TRANSPORT,                     /* The rest: rings and wakeups */
+    LAT_STEP_QUEUE,                         /* Step ready -> dispatched */
+    LAT_LOOP_PERIOD,                        /* Gym control loop iteration */
+    LAT_COUNT
+} lat_id_t;
+
+/* Jobs with a step duration histogram; a new job takes the least
+ * recently used one's
+ */
+#define LAT_JOBS 8
+
+uint32_t lat_ipc_class(uint16_t cmd);
+
+void lat_record(uint32_t id, uint32_t usec);
+
+static inline void lat_record_ipc(uint16_t cmd, uint32_t usec) {
+    lat_record(LAT_IPC_RTT + lat_ipc_class(cmd), usec);
+}
+
+/* Duration of one step of job_id (0 is not tracked) */
+void lat_record_step(uint32_t job_id, uint32_t usec);
+
+/* Copy histogram id into out. Returns: 0, or -1 for an unknown id */
+int lat_snapshot(uint32_t id, hdr_hist_t *out);
+
+/* Copy job_id's step histogram into out. Returns: 0, or -1 if it has none */
+int lat_snapshot_job(uint32_t job_id, hdr_hist_t *out);
+
+/* Print count, p50/p99/p99.9 and max of every histogram with samples */
+void lat_dump(void);
+
+/* Empty every histogram */
+void lat_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_LAT_H */
@@ -0,0 +1,261 @@
+/* kernel/trace/prof.c - Statistical sampling profiler */
+
+#include "prof.h"
+#include "klog.h"
+#include "../arch/percpu.h"
+#include "../console.h"
+#include "../include/string.h"
+#include "../ipc/completion.h"
+#include "../ipc/heap.h"
+#include "../mm/vmm.h"
+#include "../process.h"
+#include "../sched/sched_core.h"
+#include "../time/time.h"
+
+/* The i386 kernel is uniprocessor (percpu.h) */
+#ifdef __x86_64__
+#define PROF_CPUS SMP_MAX_CPUS
+#else
+#define PROF_CPUS 1
+#endif
+
+#define PROF_PAGE_MASK (~(uintptr_t)0xFFF)
+
+/* Kernel text (linker.ld): where a return address has to point */
+extern char _text_start[], _text_end[];
+
+typedef struct {
+    uintptr_t ip;
+    uint32_t pid;
+    uint8_t depth;
+    uint8_t flags;          /* IPC_PROF_USER */
+    uint16_t reserved;
+    uintptr_t frames[IPC_PROF_DEPTH];
+} prof_sample_t;
+
+typedef struct {
+    prof_sample_t ring[PROF_SAMPLES];
+    uint32_t total;         /* Taken since prof_start(); ring[total % PROF_SAMPLES] is next */
+    usec_t next_us;         /* Next sample due */
+} prof_cpu_t;
+
+static prof_cpu_t g_cpus[PROF_CPUS];
+static volatile int g_on;
+static uint32_t g_hz;
+static uint32_t g_period_us;
+static usec_t g_start_us;
+static usec_t g_end_us;
+
+/* Helper: the caller's return addresses from frame pointer fp up */
+static uint32_t backtrace(uintptr_t fp, uintptr_t *frames) {
+    uintptr_t base = fp;
+    uintptr_t page = 0;     /* Last page seen mapped */
+    uint32_t n = 0;
+
+    while (n < IPC_PROF_DEPTH) {
+        if (!fp || (fp & (sizeof(uintptr_t) - 1)) || fp - base >= PROF_STACK_SPAN)
+            break;
+        /* [fp] = the caller's fp, [fp + 1 word] = the return address */
+        uintptr_t last = fp + 2 * sizeof(uintptr_t) - 1;
+        if ((fp & PROF_PAGE_MASK) != page) {
+            if (!vmm_is_mapped((vaddr_t)fp))
+                break;
+            page = fp & PROF_PAGE_MASK;
+        }
+        if ((last & PROF_PAGE_MASK) != page) {
+            if (!vmm_is_mapped((vaddr_t)last))
+                break;
+            page = last & PROF_PAGE_MASK;
+        }
+
+        const uintptr_t *w = (const uintptr_t *)fp;
+        uintptr_t ret = w[1];
+        if (ret < (uintptr_t)_text_start || ret >= (uintptr_t)_text_end)
+            break;
+        frames[n++] = ret;
+        if (w[0] <= fp)
+            break;
+        fp = w[0];
+    }
+    return n;
+}
+
+void prof_tick(interrupt_frame_t *frame) {
+    if (!g_on)
+        return;
+    uint32_t cpu = smp_cpu_id();
+    if (cpu >= PROF_CPUS)
+        return;
+    prof_cpu_t *c = &g_cpus[cpu];
+
+    /* Other deadlines can bring the interrupt early, and sched_timer_at()
+     * keeps only the earliest: ask again for ours every time
+     */
+    usec_t now = time_usec();
+    if (now < c->next_us) {
+        sched_timer_at(c->next_us);
+        return;
+    }
+
+#ifdef __x86_64__
+    uintptr_t ip = frame->rip, fp = frame->rbp;
+#else
+    uintptr_t ip = frame->eip, fp = frame->ebp;
+#endif
+    prof_sample_t *s = &c->ring[c->total % PROF_SAMPLES];
+    process_t *p = sched_current();
+    s->ip = ip;
+    s->pid = p ? p->pid : 0;
+    s->flags = 0;
+    s->depth = 0;
+    if (frame->cs & 3)
+        s->flags = IPC_PROF_USER;
+    else
+        s->depth = (uint8_t)backtrace(fp, s->frames);
+    c->total++;
+
+    c->next_us = now + g_period_us;
+    sched_timer_at(c->next_us);
+}
+
+int prof_start(uint32_t hz) {
+    if (!hz)
+        hz = PROF_HZ_DEFAULT;
+    if (hz > PROF_HZ_MAX)
+        return -1;
+
+    int was = interrupts_enabled();
+    interrupts_disable();
+    g_on = 0;
+    for (uint32_t cpu = 0; cpu < PROF_CPUS; cpu++)
+        g_cpus[cpu].total = 0;
+    g_hz = hz;
+    g_period_us = 1000000 / hz;
+    g_start_us = time_usec();
+    g_end_us = 0;
+    g_cpus[smp_cpu_id()].next_us = g_start_us + g_period_us;
+    g_on = 1;
+    sched_timer_at(g_start_us + g_period_us);
+    if (was)
+        interrupts_enable();
+
+    if (!sched_is_tickless())
+        console_write("[prof] periodic tick: at most one sample per tick\n");
+    return 0;
+}
+
+/* The bridge frees the blob whatever it answers */
+static void prof_send_done(const ipc_response_t *rsp, void *arg) {
+    (void)arg;
+    if (rsp->status != RSP_OK)
+        KLOG1(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "prof samples refused (%u)", rsp->status);
+}
+
+/* Helper: every CPU's kept samples as a CMD_PROF_SAMPLES blob */
+static uint32_t prof_send(void) {
+    uint32_t count = 0, dropped = 0;
+    for (uint32_t cpu = 0; cpu < PROF_CPUS; cpu++) {
+        uint32_t total = g_cpus[cpu].total;
+        uint32_t kept = total < PROF_SAMPLES ? total : PROF_SAMPLES;
+        count += kept;
+        dropped += total - kept;
+    }
+    if (!count)
+        return 0;
+
+    uint32_t size = sizeof(ipc_prof_hdr_t) + count * sizeof(ipc_prof_rec_t);
+    uint16_t blob_id = heap_alloc(size, BLOB_TYPE_RAW);
+    uint8_t *data = blob_id ? (uint8_t *)heap_get_data(blob_id) : NULL;
+    if (!data)
+        return 0;
+
+    ipc_prof_hdr_t *hdr = (ipc_prof_hdr_t *)data;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = IPC_PROF_MAGIC;
+    hdr->version = IPC_PROF_VERSION;
+    hdr->count = count;
+    hdr->hz = g_hz;
+#ifdef ZENEDGE_FRAME_POINTERS
+    hdr->flags = IPC_PROF_FRAMES;
+#endif
+    hdr->dropped = dropped;
+    hdr->start_us = g_start_us;
+    hdr->end_us = g_end_us;
+
+    /* Oldest first, CPU by CPU */
+    ipc_prof_rec_t *rec = (ipc_prof_rec_t *)(hdr + 1);
+    for (uint32_t cpu = 0; cpu < PROF_CPUS; cpu++) {
+        const prof_cpu_t *c = &g_cpus[cpu];
+        uint32_t kept = c->total < PROF_SAMPLES ? c->total : PROF_SAMPLES;
+        for (uint32_t i = c->total - kept; i != c->total; i++, rec++) {
+            const prof_sample_t *s = &c->ring[i % PROF_SAMPLES];
+            memset(rec, 0, sizeof(*rec));
+            rec->ip = s->ip;
+            rec->pid = s->pid;
+            rec->cpu = (uint8_t)cpu;
+            rec->depth = s->depth;
+            rec->flags = s->flags;
+            for (uint32_t d = 0; d < s->depth; d++)
+                rec->frames[d] = s->frames[d];
+        }
+    }
+
+    if (ipc_submit_cb(CMD_PROF_SAMPLES, blob_id, 0, prof_send_done, NULL) == IPC_TAG_NONE) {
+        heap_free(blob_id);
+        return 0;
+    }
+    return count;
+}
+
+uint32_t prof_stop(void) {
+    if (g_on) {
+        g_on = 0;
+        g_end_us = time_usec();
+    }
+    prof_dump();
+
+    uint32_t sent = prof_send();
+    if (sent) {
+        console_write("[prof] ");
+        print_uint(sent);
+        console_write(" samples sent to the bridge\n");
+    }
+    return sent;
+}
+
+void prof_dump(void) {
+    uint32_t total = 0, user = 0, frames = 0, kept = 0;
+    for (uint32_t cpu = 0; cpu < PROF_CPUS; cpu++) {
+        const prof_cpu_t *c = &g_cpus[cpu];
+        uint32_t n = c->total < PROF_SAMPLES ? c->total : PROF_SAMPLES;
+        total += c->total;
+        kept += n;
+        for (uint32_t i = c->total - n; i != c->total; i++) {
+            const prof_sample_t *s = &c->ring[i % PROF_SAMPLES];
+            user += s->flags & IPC_PROF_USER ? 1 : 0;
+            frames += s->depth;
+        }
+    }
+
+    usec_t end = g_on ? time_usec() : g_end_us;
+    console_write(g_on ? "[prof] sampling at " : "[prof] stopped, was at ");
+    print_uint(g_hz);
+    console_write(" Hz for ");
+    print_uint(g_start_us && end > g_start_us ? (uint32_t)((end - g_start_us) / 1000) : 0);
+    console_write(" ms: ");
+    print_uint(total);
+    console_write(" samples, ");
+    print_uint(kept);
+    console_write(" kept (");
+    print_uint(user);
+    console_write(" user), ");
+    uint32_t depth10 = kept ? frames * 10 / kept : 0;
+    print_uint(depth10 / 10);
+    console_write(".");
+    print_uint(depth10 % 10);
+    console_write(" frames each");
+#ifndef ZENEDGE_FRAME_POINTERS
+    console_write(" (no frame pointers: FRAME_POINTERS=1)");
+#endif
+    console_write("\n");
+}
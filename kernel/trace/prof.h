@@ -0,0 +1,58 @@
+/* kernel/trace/prof.h - Statistical sampling profiler (shell `prof`)
+ *
+ * While running, each CPU samples itself every 1/hz seconds off the
+ * scheduler's timer interrupt (sched_timer_at() keeps the one-shot LAPIC
+ * timer coming; with the periodic PIT tick it is at most one sample per
+ * tick): the interrupted instruction pointer, the process, and up to
+ * IPC_PROF_DEPTH return addresses walked off the frame-pointer chain.
+ * Samples go into a per-CPU ring, the newest PROF_SAMPLES kept.
+ *
+ * The walk is bounded (PROF_STACK_SPAN above the interrupted frame, each
+ * frame further up, mapped, and returning into kernel text) so it is safe
+ * in any kernel; the return addresses only mean something in one built
+ * with FRAME_POINTERS=1.
+ *
+ * prof_stop() sends the samples to the bridge as a CMD_PROF_SAMPLES blob
+ * (ipc_prof_hdr_t); bridge/prof.py symbolizes them against zenedge.bin.
+ */
+#ifndef _TRACE_PROF_H
+#define _TRACE_PROF_H
+
+#include <stdint.h>
+#include "../arch/idt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default rate: prime, so sampling does not lock step with periodic work */
+#define PROF_HZ_DEFAULT 997
+#define PROF_HZ_MAX     10000
+
+/* Samples kept per CPU */
+#define PROF_SAMPLES    2048
+
+/* How far above the interrupted frame pointer the walk may go */
+#define PROF_STACK_SPAN 0x10000
+
+/* Start sampling at hz (0 = PROF_HZ_DEFAULT), dropping earlier samples
+ * Returns: 0, or -1 if hz is above PROF_HZ_MAX
+ */
+int prof_start(uint32_t hz);
+
+/* Stop sampling and send the samples to the bridge
+ * Returns: samples sent (0 if none were taken or the send failed)
+ */
+uint32_t prof_stop(void);
+
+/* Timer interrupt hook (interrupts off): sample if one is due */
+void prof_tick(interrupt_frame_t *frame);
+
+/* Whether it is running, its rate and samples taken per CPU */
+void prof_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_PROF_H */
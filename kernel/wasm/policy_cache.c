@@ -0,0 +1,218 @@
+/* kernel/wasm/policy_cache.c */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "policy_cache.h"
+#include "../console.h"
+#include "../ipc/bulk.h"
+#include "../ipc/heap.h"
+#include "../ipc/ipc_proto.h"
+#include "../trace/klog.h"
+
+#define POLICY_CACHE_KEY_MAX 32767.0f   /* Cells fit an int16_t */
+
+typedef struct {
+    int16_t key[POLICY_CACHE_DIM];      /* Grid cell */
+    int32_t action;
+    uint8_t len;                        /* Elements, 0 = empty */
+} policy_entry_t;
+
+typedef struct {
+    uint32_t model_id;                  /* 0 = unused */
+    uint32_t quantum_milli;
+    float cells_per_unit;               /* 1000 / quantum_milli */
+    uint32_t gen;                       /* Generation the table was filled under */
+    policy_cache_stats_t st;
+    policy_entry_t table[POLICY_CACHE_SLOTS];
+} policy_model_t;
+
+static policy_model_t g_models[POLICY_CACHE_MODELS];
+static policy_cache_stats_t g_retired;  /* Of models no longer cached */
+
+/* Helper: what identifies the weights model_id names now; 0 if none.
+ * Heap blobs as wasm_model keys them (offset and checksum), bulk uploads
+ * by where they landed.
+ */
+static uint32_t model_generation(uint32_t model_id) {
+    if (model_id >= IPC_BULK_MODEL_BASE) {
+        uint32_t size = 0;
+        const void *p = ipc_bulk_model(model_id, &size);
+        return p ? ((uint32_t)(uintptr_t)p ^ size) | 1u : 0;
+    }
+    const heap_blob_t *blob = heap_get_blob((uint16_t)model_id);
+    if (!blob)
+        return 0;
+    return ((blob->offset * 0x9E3779B1u) ^ blob->checksum) | 1u;
+}
+
+static void stats_add(policy_cache_stats_t *to, const policy_cache_stats_t *from) {
+    to->lookups += from->lookups;
+    to->hits += from->hits;
+    to->bypassed += from->bypassed;
+    to->samples += from->samples;
+    to->mismatches += from->mismatches;
+    to->invalidations += from->invalidations;
+}
+
+static policy_model_t *model_find(uint32_t model_id) {
+    for (uint32_t i = 0; i < POLICY_CACHE_MODELS; i++) {
+        if (g_models[i].model_id == model_id)
+            return &g_models[i];
+    }
+    return NULL;
+}
+
+int policy_cache_config(uint32_t model_id, uint32_t quantum_milli) {
+    if (!model_id)
+        return -1;
+    policy_model_t *m = model_find(model_id);
+    if (!quantum_milli) {
+        if (m) {
+            stats_add(&g_retired, &m->st);
+            memset(m, 0, sizeof(*m));
+        }
+        return 0;
+    }
+    if (!m)
+        m = model_find(0);
+    if (!m)
+        return -1;
+
+    if (m->model_id != model_id) {
+        memset(&m->st, 0, sizeof(m->st));
+        m->model_id = model_id;
+    }
+    m->quantum_milli = quantum_milli;
+    m->cells_per_unit = 1000.0f / (float)quantum_milli;
+    m->gen = 0;
+    memset(m->table, 0, sizeof(m->table));
+    KLOG2(KLOG_SUBSYS_KERN, KLOG_LVL_INFO, "policy cache: model %u on a %u/1000 grid",
+          model_id, quantum_milli);
+    return 0;
+}
+
+/* Helper: obs's grid cell and its slot; -1 if it has none */
+static int quantize(const policy_model_t *m, const float *obs, size_t obs_len,
+                    int16_t key[POLICY_CACHE_DIM], uint32_t *slot) {
+    uint32_t h = 2166136261u;     /* FNV-1a over the cell */
+    for (size_t i = 0; i < obs_len; i++) {
+        float v = obs[i] * m->cells_per_unit;
+        /* Also false for NaN */
+        if (!(v > -POLICY_CACHE_KEY_MAX && v < POLICY_CACHE_KEY_MAX))
+            return -1;
+        int32_t k = (int32_t)v;
+        if ((float)k > v)
+            k--;                  /* Floor, so the cells next to 0 are the same size */
+        key[i] = (int16_t)k;
+        h = (h ^ (uint16_t)k) * 16777619u;
+    }
+    *slot = (h ^ (h >> 16)) & (POLICY_CACHE_SLOTS - 1);
+    return 0;
+}
+
+int policy_cache_infer(const float *obs, size_t obs_len, uint32_t model_id,
+                       int32_t *out_action, policy_infer_fn infer) {
+    policy_model_t *m = model_id ? model_find(model_id) : NULL;
+    if (!m || !obs || !out_action)
+        return infer(obs, obs_len, model_id, out_action);
+
+    m->st.lookups++;
+    int16_t key[POLICY_CACHE_DIM];
+    uint32_t slot = 0;
+    if (obs_len == 0 || obs_len > POLICY_CACHE_DIM || quantize(m, obs, obs_len, key, &slot) != 0) {
+        m->st.bypassed++;
+        return infer(obs, obs_len, model_id, out_action);
+    }
+
+    uint32_t gen = model_generation(model_id);
+    if (gen != m->gen) {
+        if (m->gen) {
+            m->st.invalidations++;
+            memset(m->table, 0, sizeof(m->table));
+        }
+        m->gen = gen;
+    }
+
+    policy_entry_t *e = &m->table[slot];
+    if (gen && e->len == obs_len && memcmp(e->key, key, obs_len * sizeof(key[0])) == 0) {
+        m->st.hits++;
+        if (m->st.hits % POLICY_CACHE_SAMPLE != 0) {
+            *out_action = e->action;
+            return 0;
+        }
+        /* Sampled: answer with the model and keep its answer */
+        int32_t ref = 0;
+        int rc = infer(obs, obs_len, model_id, &ref);
+        if (rc != 0)
+            return rc;
+        m->st.samples++;
+        if (ref != e->action) {
+            m->st.mismatches++;
+            e->action = ref;
+        }
+        *out_action = ref;
+        return 0;
+    }
+
+    int rc = infer(obs, obs_len, model_id, out_action);
+    if (rc == 0 && gen) {
+        memcpy(e->key, key, obs_len * sizeof(key[0]));
+        e->len = (uint8_t)obs_len;
+        e->action = *out_action;
+    }
+    return rc;
+}
+
+void policy_cache_get_stats(uint32_t model_id, policy_cache_stats_t *out) {
+    if (!out)
+        return;
+    memset(out, 0, sizeof(*out));
+    if (model_id) {
+        const policy_model_t *m = model_find(model_id);
+        if (m)
+            *out = m->st;
+        return;
+    }
+    *out = g_retired;
+    for (uint32_t i = 0; i < POLICY_CACHE_MODELS; i++)
+        stats_add(out, &g_models[i].st);
+}
+
+/* Helper: n / d as a percentage with one decimal */
+static void print_pct(uint32_t n, uint32_t d) {
+    uint32_t tenths = d ? (uint32_t)(((uint64_t)n * 1000u + d / 2) / d) : 0;
+    print_uint(tenths / 10);
+    console_write(".");
+    print_uint(tenths % 10);
+    console_write("%");
+}
+
+void policy_cache_dump(void) {
+    console_write("[wasm] policy cache:");
+    uint32_t shown = 0;
+    for (uint32_t i = 0; i < POLICY_CACHE_MODELS; i++) {
+        const policy_model_t *m = &g_models[i];
+        if (!m->model_id)
+            continue;
+        const policy_cache_stats_t *st = &m->st;
+        console_write("\n  model ");
+        print_uint(m->model_id);
+        console_write(" grid ");
+        print_uint(m->quantum_milli);
+        console_write("/1000 lookups ");
+        print_uint(st->lookups);
+        console_write(" hits ");
+        print_pct(st->hits, st->lookups);
+        console_write(" bypassed ");
+        print_uint(st->bypassed);
+        console_write(" invalidations ");
+        print_uint(st->invalidations);
+        console_write(" sampled ");
+        print_uint(st->samples);
+        console_write(" agree ");
+        print_pct(st->samples - st->mismatches, st->samples);
+        shown++;
+    }
+    console_write(shown ? "\n" : " off (pcache <model> <grid/1000>)\n");
+}
@@ -0,0 +1,60 @@
+/* kernel/wasm/policy_cache.h - Actions cached by quantized observation
+ *
+ * The control policies we run see observations that repeat closely from
+ * step to step. For a model given a grid step (its tolerance), an
+ * observation is quantized to that grid and the cell hashed into a
+ * direct-mapped table of POLICY_CACHE_SLOTS actions; a hit answers
+ * without running the model. The table is dropped whenever the model's
+ * generation changes (the blob was rewritten or reallocated, or a bulk
+ * upload replaced), and a model with no grid step bypasses it.
+ *
+ * Every POLICY_CACHE_SAMPLE-th hit runs the model anyway and compares:
+ * the mismatches over the samples are what the grid costs in accuracy,
+ * to weigh against the hit rate before enabling it for a model.
+ */
+#ifndef ZENEDGE_POLICY_CACHE_H
+#define ZENEDGE_POLICY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POLICY_CACHE_MODELS 4     /* Models with a grid at once */
+#define POLICY_CACHE_SLOTS  256   /* Actions per model, a power of two */
+#define POLICY_CACHE_DIM    8     /* Longest observation cached */
+#define POLICY_CACHE_SAMPLE 64    /* Hits per reference check */
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t bypassed;       /* Too long, or off the grid's range */
+    uint32_t samples;        /* Hits checked against the model */
+    uint32_t mismatches;     /* ... that it answered otherwise */
+    uint32_t invalidations;  /* Tables dropped for a new generation */
+} policy_cache_stats_t;
+
+/* Runs the model on a miss (the uncached inference) */
+typedef int (*policy_infer_fn)(const float *obs, size_t obs_len, uint32_t model_id,
+                               int32_t *out_action);
+
+/*
+ * Cache model_id's actions on a grid of quantum_milli / 1000 per
+ * observation element, dropping what was cached on another grid
+ * @quantum_milli: 0 stops caching it
+ * @return: 0, or -1 if POLICY_CACHE_MODELS models have a grid already
+ */
+int policy_cache_config(uint32_t model_id, uint32_t quantum_milli);
+
+/*
+ * The action for obs: from the table if model_id has a grid and the
+ * cell was seen under the same generation, else from infer() (and kept)
+ * @return: infer()'s result, 0 on a hit
+ */
+int policy_cache_infer(const float *obs, size_t obs_len, uint32_t model_id,
+                       int32_t *out_action, policy_infer_fn infer);
+
+/* Counters of model_id, or of every model with model_id 0 */
+void policy_cache_get_stats(uint32_t model_id, policy_cache_stats_t *out);
+/* Print each model's grid, hit rate and sampled accuracy */
+void policy_cache_dump(void);
+
+#endif /* ZENEDGE_POLICY_CACHE_H */
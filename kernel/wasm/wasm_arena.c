@@ -0,0 +1,149 @@
+/* kernel/wasm/wasm_arena.c */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wasm_arena.h"
+#include "../mm/kheap.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+
+#define WASM_ARENA_ALIGN 16u
+#define WASM_ARENA_NONE  0xFFFFFFFFu  /* arena->last: no block to roll back */
+
+static wasm_arena_t *g_current = NULL;
+
+int wasm_arena_init(wasm_arena_t *a, uint32_t kb) {
+    memset(a, 0, sizeof(*a));
+    a->last = WASM_ARENA_NONE;
+
+    uint32_t pages = (kb * 1024u + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0)
+        return -1;
+    zalloc_result_t r = zenedge_alloc_pages(pages, ZNODE_ANY);
+    if (!r.addr)
+        return -1;
+
+    a->base = (uint8_t *)phys_to_virt((paddr_t)r.addr);
+    a->phys = r.addr;
+    a->pages = pages;
+    a->size = pages * PAGE_SIZE;
+    return 0;
+}
+
+void wasm_arena_release(wasm_arena_t *a) {
+    if (g_current == a)
+        g_current = NULL;
+    if (a->phys)
+        zenedge_free_pages(a->phys, a->pages);
+    a->base = NULL;
+    a->phys = 0;
+    a->pages = 0;
+    a->size = 0;
+    a->used = 0;
+    a->last = WASM_ARENA_NONE;
+}
+
+void wasm_arena_reset(wasm_arena_t *a) {
+    a->used = 0;
+    a->last = WASM_ARENA_NONE;
+}
+
+wasm_arena_t *wasm_arena_enter(wasm_arena_t *a) {
+    wasm_arena_t *prev = g_current;
+    g_current = a;
+    return prev;
+}
+
+static uint32_t align_up(uint32_t n) {
+    return (n + WASM_ARENA_ALIGN - 1) & ~(WASM_ARENA_ALIGN - 1);
+}
+
+static int arena_owns(const wasm_arena_t *a, const void *ptr) {
+    const uint8_t *p = (const uint8_t *)ptr;
+    return a && a->base && p >= a->base && p < a->base + a->size;
+}
+
+/* Move the bump offset to end, tracking the peak; 0, or -1 if it won't fit */
+static int arena_bump(wasm_arena_t *a, uint32_t start, size_t size) {
+    if (size > a->size - start) {
+        a->failures++;
+        return -1;
+    }
+    uint32_t end = start + (uint32_t)size;
+    a->used = end < a->size ? align_up(end) : a->size;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return 0;
+}
+
+void *wasm_arena_alloc(wasm_arena_t *a, size_t size) {
+    if (!a || !a->base)
+        return NULL;
+    uint32_t start = a->used;
+    if (arena_bump(a, start, size) != 0)
+        return NULL;
+    a->last = start;
+    memset(a->base + start, 0, size);
+    return a->base + start;
+}
+
+void *wasm_arena_m3_malloc(size_t size) {
+    if (g_current)
+        return wasm_arena_alloc(g_current, size);
+
+    void *ptr = kmalloc(size);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void wasm_arena_m3_free(void *ptr) {
+    if (!ptr)
+        return;
+    wasm_arena_t *a = g_current;
+    if (arena_owns(a, ptr)) {
+        /* Only the newest block can be handed back; older ones wait for
+         * the reset */
+        if ((uint32_t)((uint8_t *)ptr - a->base) == a->last) {
+            a->used = a->last;
+            a->last = WASM_ARENA_NONE;
+        }
+        return;
+    }
+    kfree(ptr);
+}
+
+void *wasm_arena_m3_realloc(void *ptr, size_t new_size, size_t old_size) {
+    if (new_size == old_size)
+        return ptr;
+
+    wasm_arena_t *a = g_current;
+    if (!ptr)
+        return wasm_arena_m3_malloc(new_size);
+
+    if (arena_owns(a, ptr)) {
+        uint32_t off = (uint32_t)((uint8_t *)ptr - a->base);
+        if (off == a->last) {
+            /* Newest block: grow or shrink in place */
+            if (arena_bump(a, off, new_size) != 0)
+                return NULL;
+        } else if (new_size > old_size) {
+            void *moved = wasm_arena_alloc(a, new_size);
+            if (!moved)
+                return NULL;
+            memcpy(moved, ptr, old_size);
+            return moved;
+        } else {
+            return ptr;
+        }
+    } else {
+        ptr = krealloc(ptr, new_size);
+        if (!ptr)
+            return NULL;
+    }
+
+    if (new_size > old_size)
+        memset((uint8_t *)ptr + old_size, 0, new_size - old_size);
+    return ptr;
+}
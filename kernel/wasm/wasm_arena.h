@@ -0,0 +1,55 @@
+/* kernel/wasm/wasm_arena.h - Per-runtime allocation arenas for wasm3
+ *
+ * Each wasm runtime gets a private run of pages from zenedge_alloc_pages().
+ * While its arena is entered, every wasm3 allocation (environment, module,
+ * code pages, stack, linear memory) is bump-allocated from it, so runtime
+ * churn never fragments the kernel heap. A free only gives back the most
+ * recent block; everything else comes back at once, in O(1), when the
+ * arena is reset or released.
+ */
+#ifndef ZENEDGE_WASM_ARENA_H
+#define ZENEDGE_WASM_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../zenedge_alloc.h"
+
+typedef struct {
+    uint8_t *base;      /* NULL = no pages */
+    zphys_t phys;
+    uint32_t pages;
+    uint32_t size;      /* Bytes */
+    uint32_t used;      /* Bump offset */
+    uint32_t last;      /* Offset of the newest block, for free/realloc */
+    uint32_t peak;      /* High-water mark of used */
+    uint32_t failures;  /* Allocations refused for lack of space */
+} wasm_arena_t;
+
+/* Back the arena with kb (rounded up to pages). Returns 0, or -1 if no
+ * contiguous run of pages is free.
+ */
+int wasm_arena_init(wasm_arena_t *a, uint32_t kb);
+/* Return the pages; the arena must not be entered */
+void wasm_arena_release(wasm_arena_t *a);
+/* Drop every block (the peak is kept) */
+void wasm_arena_reset(wasm_arena_t *a);
+
+/* Route wasm3 allocations to a (NULL = kernel heap). Returns the arena
+ * previously entered; enter that again to leave.
+ */
+wasm_arena_t *wasm_arena_enter(wasm_arena_t *a);
+
+/* Zeroed block from a (whether or not it is entered); NULL when full */
+void *wasm_arena_alloc(wasm_arena_t *a, size_t size);
+
+static inline uint32_t wasm_arena_peak_kb(const wasm_arena_t *a) {
+    return (a->peak + 1023) / 1024;
+}
+
+/* wasm3 allocator backend (m3_core.c, d_m3ZenedgeArena) */
+void *wasm_arena_m3_malloc(size_t size);
+void wasm_arena_m3_free(void *ptr);
+void *wasm_arena_m3_realloc(void *ptr, size_t new_size, size_t old_size);
+
+#endif /* ZENEDGE_WASM_ARENA_H */
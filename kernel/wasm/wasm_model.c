@@ -0,0 +1,265 @@
+/* kernel/wasm/wasm_model.c */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wasm_model.h"
+#include "../console.h"
+#include "../ipc/bulk.h"
+#include "../ipc/heap.h"
+#include "../ipc/ipc_proto.h"
+#include "../lib/math.h"
+#include "../mm/pmm.h"
+#include "../mm/vmm.h"
+#include "../trace/klog.h"
+#include "../zenedge_alloc.h"
+
+typedef struct {
+    uint16_t blob_id;       /* 0 = empty */
+    uint32_t gen_offset;    /* Generation: blob data offset ... */
+    uint32_t gen_checksum;  /* ... and checksum when loaded */
+    const float *weights;
+    uint32_t len;           /* Floats */
+    zphys_t copy;           /* Our pages, or 0: in place under a reference */
+    uint32_t copy_pages;
+    uint32_t last_use;
+} wasm_model_slot_t;
+
+static wasm_model_slot_t g_slots[WASM_MODEL_SLOTS];
+static uint32_t g_clock = 0;
+static uint32_t g_budget = WASM_MODEL_DEFAULT_BUDGET;
+static uint32_t g_copy_bytes = 0;
+static wasm_model_stats_t g_stats;
+
+static uint32_t g_last_id = 0;
+static const float *g_last = NULL;
+static uint32_t g_last_len = 0;
+
+static void slot_drop(wasm_model_slot_t *s) {
+    if (!s->blob_id)
+        return;
+    if (s->copy) {
+        zenedge_free_pages(s->copy, s->copy_pages);
+        g_copy_bytes -= s->copy_pages * PAGE_SIZE;
+    } else {
+        heap_blob_release(s->blob_id);
+    }
+    if (g_last_id == s->blob_id) {
+        g_last_id = 0;
+        g_last = NULL;
+        g_last_len = 0;
+    }
+    memset(s, 0, sizeof(*s));
+}
+
+static void slot_evict(wasm_model_slot_t *s) {
+    if (s->blob_id)
+        g_stats.evictions++;
+    slot_drop(s);
+}
+
+/* Evict the least recently used copies until bytes more fit the budget;
+ * -1 if they never would
+ */
+static int make_room(uint32_t bytes) {
+    if (bytes > g_budget)
+        return -1;
+    while (g_copy_bytes + bytes > g_budget) {
+        wasm_model_slot_t *lru = NULL;
+        for (uint32_t i = 0; i < WASM_MODEL_SLOTS; i++) {
+            wasm_model_slot_t *s = &g_slots[i];
+            if (s->copy && (!lru || s->last_use < lru->last_use))
+                lru = s;
+        }
+        if (!lru)
+            return -1;
+        slot_evict(lru);
+    }
+    return 0;
+}
+
+/* Load heap blob id into the empty slot s; 0, or -1 if unusable */
+static int slot_fill(wasm_model_slot_t *s, uint16_t id, const heap_blob_t *blob) {
+    const void *src;
+    uint32_t n;
+    uint8_t dtype = DTYPE_FLOAT32;
+
+    if (blob->type == BLOB_TYPE_TENSOR) {
+        src = heap_get_tensor_data(id);
+        const tensor_header_t *hdr = (const tensor_header_t *)heap_get_data(id);
+        if (!src || hdr->ndim == 0 || hdr->quant != TENSOR_QUANT_NONE)
+            return -1;
+        dtype = hdr->dtype;
+        if (dtype != DTYPE_FLOAT32 && dtype != DTYPE_FLOAT16 && dtype != DTYPE_BFLOAT16)
+            return -1;
+        n = 1;
+        for (uint32_t i = 0; i < hdr->ndim; i++)
+            n *= hdr->shape[i];
+    } else {
+        if ((blob->size % sizeof(float)) != 0)
+            return -1;
+        src = heap_get_data(id);
+        n = blob->size / sizeof(float);
+    }
+    if (!src || n == 0)
+        return -1;
+
+    uint32_t want = BLOB_FLAG_PINNED | BLOB_FLAG_READONLY;
+    int in_place = dtype == DTYPE_FLOAT32 && (blob->flags & want) == want;
+    uint32_t pages = (n * sizeof(float) + PAGE_SIZE - 1) / PAGE_SIZE;
+    zalloc_result_t r = {0};
+    if (!in_place) {
+        if (make_room(pages * PAGE_SIZE) == 0)
+            r = zenedge_alloc_pages(pages, ZNODE_ANY);
+        if (!r.addr) {
+            if (dtype != DTYPE_FLOAT32) {
+                KLOG2(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "model %u: no room to widen %u floats",
+                      id, n);
+                return -1;
+            }
+            in_place = 1;  /* Too big to copy: read it where it is */
+        }
+    }
+
+    if (in_place) {
+        if (heap_blob_retain(id) != 0)
+            return -1;
+        s->weights = (const float *)src;
+    } else {
+        float *dst = (float *)phys_to_virt((paddr_t)r.addr);
+        if (dtype == DTYPE_BFLOAT16)
+            math_bf16_to_f32((const uint16_t *)src, dst, (int)n);
+        else if (dtype == DTYPE_FLOAT16)
+            math_f16_to_f32((const uint16_t *)src, dst, (int)n);
+        else
+            memcpy(dst, src, n * sizeof(float));
+        s->copy = r.addr;
+        s->copy_pages = pages;
+        s->weights = dst;
+        g_copy_bytes += pages * PAGE_SIZE;
+    }
+
+    s->blob_id = id;
+    s->gen_offset = blob->offset;
+    s->gen_checksum = blob->checksum;
+    s->len = n;
+    return 0;
+}
+
+static const float *model_use(uint32_t model_id, const float *w, uint32_t n, uint32_t *len) {
+    g_last_id = model_id;
+    g_last = w;
+    g_last_len = n;
+    if (len)
+        *len = n;
+    return w;
+}
+
+const float *wasm_model_get(uint32_t model_id, uint32_t *len) {
+    if (model_id == 0)
+        return NULL;
+
+    /* Bulk-uploaded weights: re-resolve every time, a later upload may
+     * have evicted them */
+    if (model_id >= IPC_BULK_MODEL_BASE) {
+        uint32_t size = 0;
+        const float *w = (const float *)ipc_bulk_model(model_id, &size);
+        if (!w || size == 0 || (size % sizeof(float)) != 0)
+            return NULL;
+        return model_use(model_id, w, size / sizeof(float), len);
+    }
+
+    uint16_t id = (uint16_t)model_id;
+    const heap_blob_t *blob = heap_get_blob(id);
+    if (!blob)
+        return NULL;
+
+    wasm_model_slot_t *victim = &g_slots[0];
+    for (uint32_t i = 0; i < WASM_MODEL_SLOTS; i++) {
+        wasm_model_slot_t *s = &g_slots[i];
+        if (s->blob_id == id) {
+            if (s->gen_offset == blob->offset && s->gen_checksum == blob->checksum) {
+                g_stats.hits++;
+                s->last_use = ++g_clock;
+                return model_use(id, s->weights, s->len, len);
+            }
+            g_stats.reloads++;
+            slot_drop(s);
+        }
+        /* An empty slot, else the least recently used */
+        if (victim->blob_id && (!s->blob_id || s->last_use < victim->last_use))
+            victim = s;
+    }
+
+    g_stats.misses++;
+    slot_evict(victim);
+    if (slot_fill(victim, id, blob) != 0)
+        return NULL;
+    victim->last_use = ++g_clock;
+    return model_use(id, victim->weights, victim->len, len);
+}
+
+const float *wasm_model_last(uint32_t *model_id, uint32_t *len) {
+    if (model_id)
+        *model_id = g_last_id;
+    if (len)
+        *len = g_last_len;
+    return g_last;
+}
+
+void wasm_model_set_budget(uint32_t bytes) {
+    g_budget = bytes;
+    make_room(0);
+}
+
+void wasm_model_flush(void) {
+    for (uint32_t i = 0; i < WASM_MODEL_SLOTS; i++)
+        slot_drop(&g_slots[i]);
+    g_last_id = 0;
+    g_last = NULL;
+    g_last_len = 0;
+}
+
+void wasm_model_get_stats(wasm_model_stats_t *out) {
+    *out = g_stats;
+    out->entries = 0;
+    out->in_place = 0;
+    for (uint32_t i = 0; i < WASM_MODEL_SLOTS; i++) {
+        if (!g_slots[i].blob_id)
+            continue;
+        out->entries++;
+        if (!g_slots[i].copy)
+            out->in_place++;
+    }
+    out->copy_bytes = g_copy_bytes;
+    out->budget_bytes = g_budget;
+}
+
+void wasm_model_dump(void) {
+    wasm_model_stats_t st;
+    wasm_model_get_stats(&st);
+
+    console_write("[wasm] model cache: hits ");
+    print_uint(st.hits);
+    console_write(" misses ");
+    print_uint(st.misses);
+    console_write(" evictions ");
+    print_uint(st.evictions);
+    console_write(" reloads ");
+    print_uint(st.reloads);
+    console_write(" copies ");
+    print_uint(st.copy_bytes / 1024);
+    console_write("/");
+    print_uint(st.budget_bytes / 1024);
+    console_write("KB\n");
+    for (uint32_t i = 0; i < WASM_MODEL_SLOTS; i++) {
+        const wasm_model_slot_t *s = &g_slots[i];
+        if (!s->blob_id)
+            continue;
+        console_write("  blob ");
+        print_uint(s->blob_id);
+        console_write(" floats ");
+        print_uint(s->len);
+        console_write(s->copy ? " copied\n" : " in place\n");
+    }
+}
@@ -0,0 +1,47 @@
+/* kernel/wasm/wasm_model.h - Linear policy weights, cached per model
+ *
+ * Holds the weights of up to WASM_MODEL_SLOTS heap models, keyed by blob
+ * id and generation (the blob's data offset and checksum when loaded, so
+ * a rewritten or reallocated blob is reloaded), and evicts the least
+ * recently used. A blob the bridge marks BLOB_FLAG_PINNED |
+ * BLOB_FLAG_READONLY is read in place from the shared heap under a
+ * reference. Any other blob is copied into pages of our own, widened if it
+ * is an FP16/BF16 tensor. Copies are bounded by a byte budget, and a float
+ * blob too big for the budget is read in place too. Bulk-uploaded models
+ * live in bulk pages already and are only looked up.
+ */
+#ifndef ZENEDGE_WASM_MODEL_H
+#define ZENEDGE_WASM_MODEL_H
+
+#include <stdint.h>
+
+#define WASM_MODEL_SLOTS          4
+#define WASM_MODEL_DEFAULT_BUDGET (1024u * 1024u)  /* Bytes of copies */
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;   /* Entries dropped for a slot or the budget */
+    uint32_t reloads;     /* Hits on a stale generation */
+    uint32_t entries;
+    uint32_t in_place;    /* Entries read straight from the heap */
+    uint32_t copy_bytes;  /* Pages held for copies */
+    uint32_t budget_bytes;
+} wasm_model_stats_t;
+
+/* Weights of model_id (*len floats), loaded on a miss; NULL if unknown or
+ * unusable. Valid until the next wasm_model_get() or flush.
+ */
+const float *wasm_model_get(uint32_t model_id, uint32_t *len);
+/* Most recently returned model (0 / NULL if none, or flushed) */
+const float *wasm_model_last(uint32_t *model_id, uint32_t *len);
+
+/* Evicts copies down to the new budget */
+void wasm_model_set_budget(uint32_t bytes);
+void wasm_model_flush(void);
+
+void wasm_model_get_stats(wasm_model_stats_t *out);
+/* Print the counters and each cached model */
+void wasm_model_dump(void);
+
+#endif /* ZENEDGE_WASM_MODEL_H */
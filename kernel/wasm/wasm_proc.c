@@ -0,0 +1,157 @@
+/* kernel/wasm/wasm_proc.c */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wasm_proc.h"
+#include "../console.h"
+#include "../ipc/ipc.h"
+#include "../ipc/ipc_proto.h"
+#include "../mm/kheap.h"
+#include "../sched/sched_core.h"
+#include "../trace/klog.h"
+
+#define WASM_PROC_BURST        8  /* Observations popped per batch */
+#define WASM_PROC_KSTACK_PAGES 8  /* 32KB: wasm3 calls recurse on it */
+
+struct wasm_proc {
+    process_t *proc;
+    wasm_agent_t *agent;
+    ipc_stream_t *stream;
+    task_contract_t contract;  /* The agent points at this copy */
+    int has_contract;
+    uint32_t channel;
+    volatile uint32_t stop;
+    uint32_t steps;
+    struct wasm_proc *next;
+    obs_entry_t obs[WASM_PROC_BURST];
+    action_entry_t act[WASM_PROC_BURST];
+};
+
+/* Agent processes; only touched from thread context, which is never
+ * switched between two safe points, so no lock is needed.
+ */
+static wasm_proc_t *g_procs = NULL;
+
+static void wasm_proc_unlink(wasm_proc_t *wp) {
+    for (wasm_proc_t **pp = &g_procs; *pp; pp = &(*pp)->next) {
+        if (*pp == wp) {
+            *pp = wp->next;
+            return;
+        }
+    }
+}
+
+static void wasm_proc_main(void *arg) {
+    wasm_proc_t *wp = (wasm_proc_t *)arg;
+
+    KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "wasm agent pid %u serving channel %u",
+          wp->proc->pid, wp->channel);
+
+    while (!wp->stop) {
+        uint32_t got = ipc_stream_pop_burst(wp->stream, wp->obs, WASM_PROC_BURST);
+        if (got == 0) {
+            sched_yield();
+            continue;
+        }
+
+        for (uint32_t i = 0; i < got; i++) {
+            const obs_entry_t *o = &wp->obs[i];
+            int a = wasm_agent_step(wp->agent, o->obs, IPC_OBS_DIM, (uint32_t)o->model_id);
+
+            wp->act[i].seq = o->seq;
+            wp->act[i].action = (uint16_t)(a < 0 ? 0 : a);
+            wp->act[i].flags = 0;
+            wp->act[i].ack_seq = o->seq;
+            wp->act[i].ts = 0; /* Stamped on push */
+        }
+        wp->steps += got;
+
+        uint32_t pushed = 0;
+        while (pushed < got) {
+            pushed += ipc_stream_push_burst(wp->stream, wp->act + pushed, got - pushed);
+            if (pushed < got)
+                sched_yield();
+        }
+    }
+
+    KLOG2(KLOG_SUBSYS_SCHED, KLOG_LVL_INFO, "wasm agent pid %u stopped after %u steps",
+          wp->proc->pid, wp->steps);
+
+    wasm_proc_unlink(wp);
+    wasm_agent_destroy(wp->agent);
+    ipc_stream_close(wp->stream);
+    kfree(wp);
+}
+
+wasm_proc_t *wasm_proc_spawn(wasm_agent_t *agent, const task_contract_t *contract,
+                             uint32_t channel) {
+    if (!agent)
+        return NULL;
+
+    ipc_stream_t *s = ipc_stream_open(channel);
+    if (!s)
+        return NULL;
+
+    wasm_proc_t *wp = (wasm_proc_t *)kmalloc(sizeof(*wp));
+    if (!wp) {
+        ipc_stream_close(s);
+        return NULL;
+    }
+    memset(wp, 0, sizeof(*wp));
+    wp->agent = agent;
+    wp->stream = s;
+    wp->channel = channel;
+    if (contract) {
+        wp->contract = *contract;
+        wp->has_contract = 1;
+    }
+
+    sched_proc_init();
+    wp->proc = sched_create_kernel_process(wasm_proc_main, wp, WASM_PROC_KSTACK_PAGES, 0);
+    if (!wp->proc) {
+        ipc_stream_close(s);
+        kfree(wp);
+        return NULL;
+    }
+    if (wp->has_contract)
+        sched_set_priority(wp->proc, (uint32_t)wp->contract.prio);
+
+    if (wp->has_contract)
+        wasm_agent_set_contract(agent, &wp->contract);
+    ipc_stream_bind(s, wp->has_contract ? wp->contract.job_id : 0, wp->proc->cpu);
+
+    wp->next = g_procs;
+    g_procs = wp;
+    sched_add_process(wp->proc);
+    return wp;
+}
+
+void wasm_proc_stop(wasm_proc_t *wp) {
+    if (wp)
+        wp->stop = 1;
+}
+
+process_t *wasm_proc_process(const wasm_proc_t *wp) {
+    return wp ? wp->proc : NULL;
+}
+
+void wasm_proc_dump(void) {
+    static const char *const states[] = {"new", "ready", "running", "blocked", "zombie"};
+
+    console_write("[wasm] agent processes:\n");
+    for (const wasm_proc_t *wp = g_procs; wp; wp = wp->next) {
+        process_state_t st = wp->proc->state;
+        console_write("  pid ");
+        print_uint(wp->proc->pid);
+        console_write(" chan ");
+        print_uint(wp->channel);
+        console_write(" steps ");
+        print_uint(wp->steps);
+        console_write(" quantum ");
+        print_uint(sched_quantum_ms(wp->proc));
+        console_write("ms ");
+        console_write(st <= PROCESS_STATE_ZOMBIE ? states[st] : "?");
+        console_write(wp->stop ? " (stopping)\n" : "\n");
+    }
+}
@@ -0,0 +1,39 @@
+/* kernel/wasm/wasm_proc.h - WASM agents as scheduled kernel processes
+ *
+ * Each spawned agent gets a kernel thread that owns it (and so its wasm3
+ * runtime, page arena, contract and fuel) and serves one stream channel:
+ * pop observations, step the agent, push actions. Agents on different
+ * channels run concurrently under schedule(); a busy one is switched out
+ * at the next wasm3 back-edge or call once its quantum has run out, and
+ * the contract priority picks its run queue (see sched_core.h). An idle
+ * one yields while its obs ring is empty.
+ */
+#ifndef ZENEDGE_WASM_PROC_H
+#define ZENEDGE_WASM_PROC_H
+
+#include <stdint.h>
+
+#include "../contracts.h"
+#include "../process.h"
+#include "../wasm_loader.h"
+
+typedef struct wasm_proc wasm_proc_t;
+
+/* Hand agent to a new process serving channel under a copy of contract
+ * (NULL = none); its cpu_budget_us meters each step, its prio sets the
+ * scheduling priority. The process owns the agent from here on. NULL (the agent is
+ * still the caller's) if the channel has no rings or memory is short.
+ */
+wasm_proc_t *wasm_proc_spawn(wasm_agent_t *agent, const task_contract_t *contract,
+                             uint32_t channel);
+/* Ask the process to stop after its current batch; it destroys the agent
+ * and frees wp itself, so wp must not be used afterwards.
+ */
+void wasm_proc_stop(wasm_proc_t *wp);
+
+process_t *wasm_proc_process(const wasm_proc_t *wp);
+
+/* Print each agent process: pid, channel, steps, state */
+void wasm_proc_dump(void);
+
+#endif /* ZENEDGE_WASM_PROC_H */
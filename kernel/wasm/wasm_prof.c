@@ -0,0 +1,164 @@
+/* kernel/wasm/wasm_prof.c */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wasm_prof.h"
+#include "../ipc/completion.h"
+#include "../ipc/heap.h"
+#include "../ipc/layout.h"
+#include "../time/time.h"
+#include "../trace/klog.h"
+
+#define WASM_PROF_SLOTS   64   /* Distinct functions + host imports tracked */
+#define WASM_PROF_MAX_OPS 256  /* Opcode records per dump */
+
+typedef struct {
+    uint32_t kind;
+    const char *key;   /* Last pointer the name came from (fast match) */
+    char name[IPC_WASM_PROF_NAME_LEN]; /* Copy: the owner may be freed first */
+    uint64_t calls;
+    uint64_t cycles;
+} wasm_prof_slot_t;
+
+uint32_t wasm_prof_mode = 0;
+
+static wasm_prof_slot_t g_slots[WASM_PROF_SLOTS];
+static uint32_t g_slot_count = 0;
+static uint32_t g_dump_seen = 0;
+
+static void wasm_prof_reset(void) {
+    memset(g_slots, 0, sizeof(g_slots));
+    g_slot_count = 0;
+#ifdef ZENEDGE_WASM_OPPROF
+    m3_ReadProfilerCounts(NULL, NULL, 0, 1);
+#endif
+}
+
+void wasm_prof_set_mode(uint32_t mode) {
+    mode &= IPC_WASM_PROF_CALLS | IPC_WASM_PROF_HOST | IPC_WASM_PROF_OPS;
+    if (mode && !wasm_prof_mode)
+        wasm_prof_reset();
+    wasm_prof_mode = mode;
+}
+
+static int name_eq(const char *a, const char *b) {
+    uint32_t i = 0;
+    for (; i < IPC_WASM_PROF_NAME_LEN - 1 && a[i] && a[i] == b[i]; i++)
+        ;
+    return i == IPC_WASM_PROF_NAME_LEN - 1 || a[i] == b[i];
+}
+
+void wasm_prof_note(uint32_t kind, const char *name, uint64_t cycles) {
+    if (!name)
+        name = "?";
+    wasm_prof_slot_t *slot = NULL;
+    for (uint32_t i = 0; i < g_slot_count; i++) {
+        wasm_prof_slot_t *s = &g_slots[i];
+        if (s->kind == kind && (s->key == name || name_eq(s->name, name))) {
+            s->key = name;
+            slot = s;
+            break;
+        }
+    }
+    if (!slot) {
+        if (g_slot_count == WASM_PROF_SLOTS)
+            return;
+        slot = &g_slots[g_slot_count++];
+        slot->kind = kind;
+        slot->key = name;
+        for (uint32_t i = 0; name[i] && i < IPC_WASM_PROF_NAME_LEN - 1; i++)
+            slot->name[i] = name[i];
+    }
+    slot->calls++;
+    slot->cycles += cycles;
+}
+
+/* Host import wrapper: linked in place of the import while host profiling
+ * is on at agent creation, so agents created with it off pay nothing.
+ */
+m3ApiRawFunction(wasm_prof_host_trampoline) {
+    const wasm_prof_host_t *host = (const wasm_prof_host_t *)_ctx->userdata;
+    cycles_t t0 = time_cycles();
+    const void *ret = host->fn(runtime, _ctx, _sp, _mem);
+    if (wasm_prof_mode & IPC_WASM_PROF_HOST)
+        wasm_prof_note(IPC_WASM_PROF_KIND_HOST, host->name, time_cycles() - t0);
+    return ret;
+}
+
+static void rec_fill(ipc_wasm_prof_rec_t *rec, uint32_t kind, const char *name,
+                     uint64_t calls, uint64_t cycles) {
+    memset(rec, 0, sizeof(*rec));
+    rec->kind = kind;
+    rec->calls = calls;
+    rec->cycles = cycles;
+    for (uint32_t i = 0; name && name[i] && i < IPC_WASM_PROF_NAME_LEN - 1; i++)
+        rec->name[i] = name[i];
+}
+
+uint16_t wasm_prof_dump_blob(void) {
+    uint32_t count = g_slot_count;
+#ifdef ZENEDGE_WASM_OPPROF
+    static const char *op_names[WASM_PROF_MAX_OPS];
+    static uint64_t op_counts[WASM_PROF_MAX_OPS];
+    uint32_t ops = 0;
+    if (wasm_prof_mode & IPC_WASM_PROF_OPS)
+        ops = m3_ReadProfilerCounts(op_names, op_counts, WASM_PROF_MAX_OPS, 0);
+    count += ops;
+#endif
+    if (count == 0)
+        return 0;
+
+    uint32_t size = sizeof(ipc_wasm_prof_hdr_t) + count * sizeof(ipc_wasm_prof_rec_t);
+    uint16_t blob_id = heap_alloc(size, BLOB_TYPE_RAW);
+    uint8_t *data = blob_id ? (uint8_t *)heap_get_data(blob_id) : NULL;
+    if (!data)
+        return 0;
+
+    ipc_wasm_prof_hdr_t *hdr = (ipc_wasm_prof_hdr_t *)data;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = IPC_WASM_PROF_MAGIC;
+    hdr->version = IPC_WASM_PROF_VERSION;
+    hdr->mode = wasm_prof_mode;
+    hdr->count = count;
+    hdr->cpu_mhz = time_get_cpu_mhz();
+
+    ipc_wasm_prof_rec_t *rec = (ipc_wasm_prof_rec_t *)(hdr + 1);
+    for (uint32_t i = 0; i < g_slot_count; i++, rec++)
+        rec_fill(rec, g_slots[i].kind, g_slots[i].name, g_slots[i].calls, g_slots[i].cycles);
+#ifdef ZENEDGE_WASM_OPPROF
+    for (uint32_t i = 0; i < ops; i++, rec++)
+        rec_fill(rec, IPC_WASM_PROF_KIND_OP, op_names[i], op_counts[i], 0);
+#endif
+    return blob_id;
+}
+
+/* The bridge frees the blob whatever it answers */
+static void wasm_prof_dump_done(const ipc_response_t *rsp, void *arg) {
+    (void)arg;
+    if (rsp->status != RSP_OK)
+        KLOG1(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "wasm profile dump refused (%u)", rsp->status);
+}
+
+void wasm_prof_poll(void) {
+    const volatile doorbell_ctl_t *db =
+        (const volatile doorbell_ctl_t *)ipc_region_ptr(IPC_REGION_DOORBELL);
+    if (!db)
+        return;
+
+    uint32_t mode = db->wasm_prof_mode;
+    if (mode != wasm_prof_mode)
+        wasm_prof_set_mode(mode);
+
+    uint32_t dump = db->wasm_prof_dump;
+    if (dump == g_dump_seen)
+        return;
+    g_dump_seen = dump;
+
+    uint16_t blob_id = wasm_prof_dump_blob();
+    if (blob_id && ipc_submit_cb(CMD_WASM_PROFILE, blob_id, 0, wasm_prof_dump_done, NULL) ==
+                       IPC_TAG_NONE) {
+        heap_free(blob_id);
+        KLOG(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "wasm profile dump: command ring full");
+    }
+}
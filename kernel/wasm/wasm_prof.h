@@ -0,0 +1,40 @@
+/* kernel/wasm/wasm_prof.h */
+#ifndef ZENEDGE_WASM_PROF_H
+#define ZENEDGE_WASM_PROF_H
+
+#include <stdint.h>
+
+#include "../ipc/ipc_proto.h"
+#include "../lib/wasm3/wasm3.h"
+
+/* WASM agent profiling, selected at run time by the bridge through
+ * doorbell_ctl_t.wasm_prof_mode. With the mode 0 the only cost is one
+ * flag test per agent step and host imports are linked unwrapped.
+ * Opcode counts also need a ZENEDGE_WASM_OPPROF build (WASM_OPPROF=1),
+ * which threads every wasm3 op through the profiler.
+ */
+extern uint32_t wasm_prof_mode;  /* IPC_WASM_PROF_* */
+
+/* Apply a new mode; enabling anything starts the totals from zero */
+void wasm_prof_set_mode(uint32_t mode);
+
+/* Accumulate one call of `name` (matched by content, up to 39 chars) */
+void wasm_prof_note(uint32_t kind, const char *name, uint64_t cycles);
+
+/* Host import wrapper record, handed to the trampoline as userdata */
+typedef struct {
+    M3RawCall fn;
+    const char *name;
+} wasm_prof_host_t;
+
+m3ApiRawFunction(wasm_prof_host_trampoline);
+
+/* Write the totals into a new shared-heap blob; 0 if none or no space */
+uint16_t wasm_prof_dump_blob(void);
+
+/* Episode-boundary hook: pick up the bridge's mode and answer a dump
+ * request with CMD_WASM_PROFILE.
+ */
+void wasm_prof_poll(void);
+
+#endif /* ZENEDGE_WASM_PROF_H */
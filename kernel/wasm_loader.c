@@ -1,84 +1,112 @@
 /* kernel/wasm_loader.c */
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "lib/wasm3/wasm3.h"
 #include "lib/wasm3/m3_env.h"
 
+#include "arch/pmu.h"
 #include "console.h"
+#include "sched/sched_core.h"
+#include "contracts.h"
 #include "mm/kheap.h"
 #include "ipc/ipc.h"
+#include "ipc/bulk.h"
 #include "ipc/ipc_proto.h"
 #include "ipc/heap.h"
+#include "include/engine/mlp.h"
+#include "include/engine/onnx.h"
+#include "lib/crc32c.h"
 #include "lib/math.h"
+#include "time/time.h"
+#include "trace/flightrec.h"
+#include "trace/klog.h"
 #include "wasm/host_funcs.h"
+#include "wasm/policy_cache.h"
+#include "wasm/wasm_arena.h"
+#include "wasm/wasm_model.h"
+#include "wasm/wasm_prof.h"
+#include "wasm_loader.h"
 
 #define WASM_STACK_SIZE        16384   // 16KB
 #define WASM_PRINT_MAX_BYTES     512   // prevent console spam/DoS
 #define WASM_MEMORY_LIMIT_PAGES   16   // 16 * 64KiB = 1MiB (tune via contracts later)
 #define WASM_MEMORY_LIMIT_BYTES   (WASM_MEMORY_LIMIT_PAGES * 65536u)
+#define WASM_AGENT_CACHE_SLOTS     2   // linked agent runtimes kept across steps
+#define WASM_ARENA_KB          2560   // per runtime: linear memory twice over (a grow
+                                      // may copy it), plus stack, module and code
+#define WASM_OBS_WINDOW_OFFSET  1024   // obs_entry_t window in linear memory
+#define WASM_STEP_BUDGET_US     5000   // per-call CPU budget without a contract
+#define WASM_FUEL_CYCLES_PER_UNIT 32   // est. cycles between metered events (back-edge/call)
+#define WASM_FUEL_FALLBACK_MHZ  1000   // TSC not calibrated yet
+#define WASM_OBS_FLOATS_OFFSET  (WASM_OBS_WINDOW_OFFSET + offsetof(obs_entry_t, obs))
+
+static uint32_t g_step_obs_len = 0;  /* Floats in the window for the running step */
+
+#ifdef d_m3YieldHook
+/* m3YieldPoint: the running step's quantum is up. Whatever runs next sees
+ * none of this step's wasm state; it comes back with us.
+ */
+void wasm_agent_preempt(void) {
+    uint32_t obs_len = g_step_obs_len;
+    wasm_arena_t *arena = wasm_arena_enter(NULL);
+    sched_yield();
+    wasm_arena_enter(arena);
+    g_step_obs_len = obs_len;
+}
+#endif
 
-static IM3Environment g_env = NULL;
-static const float *g_last_obs = NULL;
-static size_t g_last_obs_len = 0;
-static uint32_t g_cached_model_id = 0;
-static float *g_cached_weights = NULL;
-static size_t g_cached_weights_len = 0;
+/* Linear policy: action 1 when the score is strictly positive */
+static int32_t score_to_action(float score) {
+    union {
+        float f;
+        uint32_t u;
+    } conv;
+    conv.f = score;
+    int is_positive = ((conv.u & 0x80000000u) == 0) && ((conv.u & 0x7FFFFFFFu) != 0);
+    return is_positive ? 1 : 0;
+}
 
-static int wasm_load_model_weights(uint32_t model_id) {
-    if (model_id == 0)
-        return -1;
-    if (g_cached_model_id == model_id && g_cached_weights && g_cached_weights_len > 0)
+/* Dense MLP descriptor (ipc_mlp_desc_t) or ONNX model rather than raw
+ * linear weights
+ */
+static int wasm_is_mlp(uint32_t model_id) {
+    if (!model_id || model_id >= IPC_BULK_MODEL_BASE)
         return 0;
+    return mlp_is_model((uint16_t)model_id) || onnx_is_model((uint16_t)model_id);
+}
 
-    uint32_t size = heap_get_blob_size((uint16_t)model_id);
-    if (size == 0 || (size % sizeof(float)) != 0)
-        return -1;
-
-    size_t len = size / sizeof(float);
-    const float *src = (const float *)heap_get_data((uint16_t)model_id);
-    if (!src)
-        return -1;
-
-    float *buf = (float *)kmalloc(len * sizeof(float));
-    if (!buf)
-        return -1;
-
-    for (size_t i = 0; i < len; i++) {
-        buf[i] = src[i];
-    }
-
-    if (g_cached_weights) {
-        kfree(g_cached_weights);
-    }
-
-    g_cached_weights = buf;
-    g_cached_weights_len = len;
-    g_cached_model_id = model_id;
-    return 0;
+static const mlp_model_t *wasm_get_mlp(uint32_t model_id) {
+    if (mlp_is_model((uint16_t)model_id))
+        return mlp_get((uint16_t)model_id);
+    return onnx_get((uint16_t)model_id);
 }
 
 static int zenedge_infer_action(const float *obs_ptr, size_t obs_len, uint32_t model_id, int32_t *out_action) {
     if (!out_action || !obs_ptr || obs_len == 0)
         return -1;
 
-    if (wasm_load_model_weights(model_id) != 0)
+    if (wasm_is_mlp(model_id)) {
+        const mlp_model_t *m = wasm_get_mlp(model_id);
+        if (!m || obs_len < m->in_dim)
+            return -1;
+        *out_action = mlp_action(m, obs_ptr);
+        return 0;
+    }
+
+    uint32_t len = 0;
+    const float *weights = wasm_model_get(model_id, &len);
+    if (!weights)
         return -1;
 
     size_t n = obs_len;
-    if (g_cached_weights_len < n)
-        n = g_cached_weights_len;
+    if (len < n)
+        n = len;
     if (n == 0)
         return -1;
 
-    float score = math_vec_dot(obs_ptr, g_cached_weights, (int)n);
-    union {
-        float f;
-        uint32_t u;
-    } conv;
-    conv.f = score;
-    int is_positive = ((conv.u & 0x80000000u) == 0) && ((conv.u & 0x7FFFFFFFu) != 0);
-    *out_action = is_positive ? 1 : 0;
+    *out_action = score_to_action(math_vec_dot(obs_ptr, weights, (int)n));
     return 0;
 }
 
@@ -165,39 +193,48 @@ m3ApiRawFunction(m3_zenedge_abort) {
 
 // ---- public API ----
 
-static int wasm_env_init_once(void) {
-    if (g_env) return 0;
-
-    console_write("[wasm] Initializing wasm3 environment...\n");
-    g_env = m3_NewEnvironment();
-    if (!g_env) {
+/* A fresh environment and runtime, allocated from the entered arena. Each
+ * runtime gets its own environment: it collects the module's function types
+ * and the runtime's released code pages, which must not outlive the arena.
+ */
+static IM3Runtime wasm_new_runtime(void) {
+    IM3Environment env = m3_NewEnvironment();
+    if (!env) {
         console_write("[wasm] m3_NewEnvironment failed\n");
-        return -1;
+        return NULL;
     }
-    return 0;
+    IM3Runtime rt = m3_NewRuntime(env, WASM_STACK_SIZE, NULL);
+    if (!rt) {
+        console_write("[wasm] m3_NewRuntime failed\n");
+        return NULL;
+    }
+
+    // Cap linear memory; the arena bounds everything else
+    rt->memoryLimit = WASM_MEMORY_LIMIT_BYTES;
+    return rt;
 }
 
 int wasm_run_bytes(const uint8_t* code, size_t size) {
     if (!code || size == 0) return -1;
-    if (wasm_env_init_once() != 0) return -1;
 
-    IM3Runtime rt = m3_NewRuntime(g_env, WASM_STACK_SIZE, NULL);
-    if (!rt) {
-        console_write("[wasm] m3_NewRuntime failed\n");
+    wasm_arena_t arena;
+    if (wasm_arena_init(&arena, WASM_ARENA_KB) != 0) {
+        console_write("[wasm] no pages for runtime arena\n");
         return -1;
     }
+    wasm_arena_t *prev = wasm_arena_enter(&arena);
+    int ret = -1;
 
-    // Optional but highly recommended: cap linear memory (tie to your contract later).
-    rt->memoryLimit = WASM_MEMORY_LIMIT_BYTES;
+    IM3Runtime rt = wasm_new_runtime();
+    if (!rt) goto done;
 
     IM3Module mod = NULL;
-    M3Result res = m3_ParseModule(g_env, &mod, code, (uint32_t)size);
+    M3Result res = m3_ParseModule(rt->environment, &mod, code, (uint32_t)size);
     if (res) {
         console_write("[wasm] Parse Error: ");
         console_write((char*)res);
         console_write("\n");
-        m3_FreeRuntime(rt);
-        return -1;
+        goto done;
     }
 
     res = m3_LoadModule(rt, mod);
@@ -205,12 +242,8 @@ int wasm_run_bytes(const uint8_t* code, size_t size) {
         console_write("[wasm] Load Error: ");
         console_write((char*)res);
         console_write("\n");
-        // mod was not successfully loaded; safe to free it
-        m3_FreeModule(mod);
-        m3_FreeRuntime(rt);
-        return -1;
+        goto done;
     }
-    // Do NOT free mod here; runtime owns it now
 
     // Link host functions
     m3_LinkRawFunction(mod, "env", "log_int", "v(i)",   &m3_zenedge_log_int);
@@ -243,8 +276,7 @@ int wasm_run_bytes(const uint8_t* code, size_t size) {
         console_write("[wasm] FindFunction failed: ");
         console_write((char*)res);
         console_write("\n");
-        m3_FreeRuntime(rt);
-        return -1;
+        goto done;
     }
 
     // console_write("[wasm] Running...\n");
@@ -253,13 +285,17 @@ int wasm_run_bytes(const uint8_t* code, size_t size) {
         console_write("[wasm] Run Error: ");
         console_write((char*)res);
         console_write("\n");
-        m3_FreeRuntime(rt);
-        return -1;
+        goto done;
     }
 
     // console_write("[wasm] Execution Complete.\n");
-    m3_FreeRuntime(rt);
-    return 0;
+    ret = 0;
+
+done:
+    /* Runtime, module and environment all go with the arena */
+    wasm_arena_enter(prev);
+    wasm_arena_release(&arena);
+    return ret;
 }
 
 // env.zenedge_inference(tensor_id: i32) -> result_id: i32
@@ -267,116 +303,514 @@ m3ApiRawFunction(m3_zenedge_inference) {
     m3ApiReturnType(int32_t);
     m3ApiGetArg(int32_t, tensor_id);
     
-    if (!g_last_obs || g_last_obs_len == 0) {
+    /* Same bytes agent_step was handed: the obs window */
+    uint32_t mem_size = 0;
+    uint8_t *mem = m3_GetMemory(runtime, &mem_size, 0);
+    if (!mem || g_step_obs_len == 0 ||
+        mem_size < WASM_OBS_FLOATS_OFFSET + g_step_obs_len * sizeof(float)) {
         m3ApiReturn(0);
     }
 
     int32_t action = 0;
-    if (zenedge_infer_action(g_last_obs, g_last_obs_len, (uint32_t)tensor_id, &action) != 0)
+    if (zenedge_infer_action((const float *)(mem + WASM_OBS_FLOATS_OFFSET), g_step_obs_len,
+                             (uint32_t)tensor_id, &action) != 0)
         m3ApiReturn(0);
 
     m3ApiReturn(action);
 }
 
-int wasm_run_agent(const uint8_t* code, size_t size, const float* obs_ptr, size_t obs_len, uint32_t model_id) {
-    // console_write("[wasm] run_agent start\n");
-    if (!code || size == 0) return -1;
-    if (wasm_env_init_once() != 0) return -1;
+// env.zenedge_infer_batch(obs_ptr, n:i32, dim:i32, model_id:i32, out_ptr) -> i32
+// Scores n observations of dim floats, writing one i32 action each to
+// out_ptr. Returns n, or -1 if a span is out of bounds or the model unusable.
+m3ApiRawFunction(m3_zenedge_infer_batch) {
+    m3ApiReturnType(int32_t);
+    m3ApiGetArgMem(const float*, obs);
+    m3ApiGetArg(uint32_t, n);
+    m3ApiGetArg(uint32_t, dim);
+    m3ApiGetArg(uint32_t, model_id);
+    m3ApiGetArgMem(int32_t*, out);
 
-    IM3Runtime rt = m3_NewRuntime(g_env, WASM_STACK_SIZE, NULL);
+    if (n == 0)
+        m3ApiReturn(0);
+
+    /* Validate both spans once for the whole batch */
+    uint64_t obs_bytes = (uint64_t)n * dim * sizeof(float);
+    uint64_t out_bytes = (uint64_t)n * sizeof(int32_t);
+    if (dim == 0 || obs_bytes > WASM_MEMORY_LIMIT_BYTES || out_bytes > WASM_MEMORY_LIMIT_BYTES ||
+        !wasm_mem_span_ok(runtime, obs, (uint32_t)obs_bytes) ||
+        !wasm_mem_span_ok(runtime, out, (uint32_t)out_bytes)) {
+        m3ApiReturn(-1);
+    }
+
+    if (kernel_infer_actions(obs, dim, dim, n, model_id, out) != 0)
+        m3ApiReturn(-1);
+
+    m3ApiReturn((int32_t)n);
+}
+
+/* Persistent agents.
+ *
+ * A wasm_agent_t owns one runtime (stack and linear memory) with the module
+ * loaded, linked and its start function run, and the resolved agent_step.
+ * Every function is compiled up front (wasm3 otherwise compiles each one
+ * on its first call, mid-episode) and the code pages stay with the
+ * runtime. Right after that it snapshots linear memory and the mutable
+ * globals; wasm_agent_reset() copies the snapshot back, which returns the
+ * agent to its freshly instantiated state without touching the allocator.
+ *
+ * All of it (environment, runtime, code pages, snapshots, the wasm bytes
+ * for wasm_agent_load()) lives in the agent's arena, entered around every
+ * call into wasm3, and goes back to the page allocator in one piece when
+ * the agent is destroyed.
+ */
+struct wasm_agent {
+    IM3Runtime rt;
+    IM3Module mod;
+    IM3Function step;     /* agent_step */
+    uint8_t *mem_snapshot;
+    uint32_t mem_snapshot_len;
+    uint32_t mem_snapshot_pages;
+    uint64_t *global_snapshot;
+    wasm_arena_t arena;
+    const task_contract_t *contract;  /* Memory and CPU budgets */
+    uint32_t budget_us;   /* Per call: contract cpu_budget_us or WASM_STEP_BUDGET_US */
+    uint64_t fuel;        /* budget_us as fuel units, refilled before each call */
+    uint32_t fuel_traps;
+    uint32_t compile_us;
+    uint32_t steps;       /* Since the last reset */
+};
+
+/* Agent host imports (module "env") */
+static const struct {
+    const char *sig;
+    wasm_prof_host_t host;
+} g_agent_imports[] = {
+    { "v(i)",     { &m3_zenedge_log_int,     "log_int" } },
+    { "v(*i)",    { &m3_zenedge_print,       "print" } },
+    { "v(**ii)",  { &m3_zenedge_abort,       "abort" } },
+    { "i(i)",     { &m3_zenedge_inference,   "zenedge_inference" } },
+    { "i(*iii*)", { &m3_zenedge_infer_batch, "zenedge_infer_batch" } },
+    { "i(ii)",    { &m3_zenedge_accelerate,  "zenedge_accelerate" } },
+};
+
+/* Link Host Functions. While host profiling is on each import goes through
+ * the profiler's trampoline; otherwise it is linked directly.
+ */
+static void wasm_agent_link(IM3Module mod) {
+    int wrap = (wasm_prof_mode & IPC_WASM_PROF_HOST) != 0;
+    for (size_t i = 0; i < sizeof(g_agent_imports) / sizeof(g_agent_imports[0]); i++) {
+        const wasm_prof_host_t *host = &g_agent_imports[i].host;
+        if (wrap)
+            m3_LinkRawFunctionEx(mod, "env", host->name, g_agent_imports[i].sig,
+                                 &wasm_prof_host_trampoline, host);
+        else
+            m3_LinkRawFunction(mod, "env", host->name, g_agent_imports[i].sig, host->fn);
+    }
+}
+
+/* Parse, load and link a module into a fresh runtime in the entered arena;
+ * 0 on success. Nothing is freed on failure: the arena goes as a whole.
+ */
+static int wasm_agent_instantiate(wasm_agent_t *agent, const uint8_t* code, size_t size) {
+    IM3Runtime rt = wasm_new_runtime();
     if (!rt) return -1;
-    rt->memoryLimit = WASM_MEMORY_LIMIT_BYTES;
+    m3_SetFuel(rt, agent->fuel);  /* The start function is metered too */
 
     IM3Module mod = NULL;
-    // console_write("[wasm] Parsing...\n");
-    M3Result res = m3_ParseModule(g_env, &mod, code, (uint32_t)size);
+    M3Result res = m3_ParseModule(rt->environment, &mod, code, (uint32_t)size);
     if (res) {
         console_write("[wasm] Parse failed: ");
         console_write((char*)res);
         console_write("\n");
-        m3_FreeRuntime(rt);
         return -1;
     }
-    
+
     res = m3_LoadModule(rt, mod);
     if (res) {
         console_write("[wasm] Load failed: ");
         console_write((char*)res);
         console_write("\n");
-        m3_FreeRuntime(rt);
         return -1;
     }
 
-    /* Link Host Functions */
-    // console_write("[wasm] Linking...\n");
-    m3_LinkRawFunction(mod, "env", "log_int", "v(i)",   &m3_zenedge_log_int);
-    m3_LinkRawFunction(mod, "env", "print",   "v(*i)",  &m3_zenedge_print);
-    m3_LinkRawFunction(mod, "env", "abort",   "v(**ii)", &m3_zenedge_abort);
-    m3_LinkRawFunction(mod, "env", "zenedge_inference", "i(i)", &m3_zenedge_inference);
-    m3_LinkRawFunction(mod, "env", "zenedge_accelerate", "i(ii)", &m3_zenedge_accelerate);
+    wasm_agent_link(mod);
 
+    /* Also runs the module's start function */
     IM3Function f = NULL;
     M3Result find_res = m3_FindFunction(&f, rt, "agent_step");
     if (find_res) {
         console_write("[wasm] agent_step not found: ");
         console_write((char*)find_res);
         console_write("\n");
-        m3_FreeRuntime(rt);
         return -1;
     }
 
-    /* Allocate Input Buffer in WASM Memory */
-    uint32_t input_offset = 1024; 
+    agent->rt = rt;
+    agent->mod = mod;
+    agent->step = f;
+    return 0;
+}
+
+/* Record the instantiated state wasm_agent_reset() returns to */
+static int wasm_agent_snapshot(wasm_agent_t *agent) {
     uint32_t mem_size = 0;
-    uint8_t* mem = m3_GetMemory(rt, &mem_size, 0);
-    if (!mem || mem_size < input_offset + (obs_len * sizeof(float))) {
-         console_write("[wasm] OOM for input\n");
-         m3_FreeRuntime(rt);
-         return -1;
+    uint8_t *mem = m3_GetMemory(agent->rt, &mem_size, 0);
+    if (mem && mem_size) {
+        agent->mem_snapshot = (uint8_t *)wasm_arena_alloc(&agent->arena, mem_size);
+        if (!agent->mem_snapshot)
+            return -1;
+        memcpy(agent->mem_snapshot, mem, mem_size);
+        agent->mem_snapshot_len = mem_size;
+        agent->mem_snapshot_pages = agent->rt->memory.numPages;
     }
-    
-    /* Copy Obs */
-    for (size_t i = 0; i < obs_len; i++) {
-        ((float*)(mem + input_offset))[i] = obs_ptr[i];
+
+    if (agent->mod->numGlobals) {
+        agent->global_snapshot = (uint64_t *)wasm_arena_alloc(&agent->arena,
+                                                              agent->mod->numGlobals * sizeof(uint64_t));
+        if (!agent->global_snapshot)
+            return -1;
+        for (uint32_t i = 0; i < agent->mod->numGlobals; i++)
+            agent->global_snapshot[i] = (uint64_t)agent->mod->globals[i].i64Value;
     }
-    
-    g_last_obs = obs_ptr;
-    g_last_obs_len = obs_len;
+    return 0;
+}
+
+/* Instantiate, compile and snapshot inside the entered arena; 0 on success */
+static int wasm_agent_build(wasm_agent_t *agent, const uint8_t* code, size_t size, int copy) {
+    if (copy) {
+        /* wasm3 keeps pointers into the bytes, and the blob may be recycled */
+        uint8_t *owned = (uint8_t *)wasm_arena_alloc(&agent->arena, size);
+        if (!owned) {
+            console_write("[wasm] agent arena too small for module\n");
+            return -1;
+        }
+        memcpy(owned, code, size);
+        code = owned;
+    }
+
+    if (wasm_agent_instantiate(agent, code, size) != 0)
+        return -1;
+
+    cycles_t t0 = time_cycles();
+    M3Result res = m3_CompileModule(agent->mod);
+    agent->compile_us = (uint32_t)time_elapsed_usec(t0);
+    if (res) {
+        console_write("[wasm] Compile failed: ");
+        console_write((char*)res);
+        console_write("\n");
+        return -1;
+    }
+    if (wasm_agent_snapshot(agent) != 0) {
+        console_write("[wasm] agent snapshot OOM\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Fuel metering: wasm3 spends one unit per call and taken loop back-edge
+ * and traps the call when the agent's allotment is gone, so a runaway
+ * agent_step returns within roughly its CPU budget instead of hanging the
+ * control loop.
+ */
+static void wasm_agent_meter(wasm_agent_t *agent) {
+    uint32_t mhz = time_get_cpu_mhz();
+    if (!mhz) mhz = WASM_FUEL_FALLBACK_MHZ;
+
+    agent->budget_us = WASM_STEP_BUDGET_US;
+    if (agent->contract && agent->contract->cpu_budget_us)
+        agent->budget_us = agent->contract->cpu_budget_us;
+    agent->fuel = (uint64_t)agent->budget_us * mhz / WASM_FUEL_CYCLES_PER_UNIT;
+}
+
+static wasm_agent_t *wasm_agent_new(const uint8_t* code, size_t size, int copy) {
+    if (!code || size == 0) return NULL;
+
+    wasm_agent_t *agent = (wasm_agent_t *)kmalloc(sizeof(*agent));
+    if (!agent) return NULL;
+    memset(agent, 0, sizeof(*agent));
+    wasm_agent_meter(agent);
+
+    if (wasm_arena_init(&agent->arena, WASM_ARENA_KB) != 0) {
+        console_write("[wasm] no pages for agent arena\n");
+        kfree(agent);
+        return NULL;
+    }
+
+    wasm_arena_t *prev = wasm_arena_enter(&agent->arena);
+    int rc = wasm_agent_build(agent, code, size, copy);
+    wasm_arena_enter(prev);
+    if (rc != 0) {
+        wasm_agent_destroy(agent);
+        return NULL;
+    }
+    return agent;
+}
+
+wasm_agent_t *wasm_agent_create(const uint8_t* code, size_t size) {
+    return wasm_agent_new(code, size, 0);
+}
+
+wasm_agent_t *wasm_agent_load(uint32_t blob_id) {
+    const uint8_t *src = NULL;
+    uint32_t size = 0;
+    if (blob_id >= IPC_BULK_MODEL_BASE) {
+        src = (const uint8_t *)ipc_bulk_model(blob_id, &size);
+    } else if (blob_id) {
+        size = heap_get_blob_size((uint16_t)blob_id);
+        src = (const uint8_t *)heap_get_data((uint16_t)blob_id);
+    }
+    if (!src || size == 0)
+        return NULL;
+    return wasm_agent_new(src, size, 1);
+}
+
+uint32_t wasm_agent_compile_us(const wasm_agent_t *agent) {
+    return agent ? agent->compile_us : 0;
+}
+
+void wasm_agent_set_contract(wasm_agent_t *agent, const task_contract_t *contract) {
+    if (!agent) return;
+    agent->contract = contract;
+    wasm_agent_meter(agent);
+}
+
+uint32_t wasm_agent_fuel_traps(const wasm_agent_t *agent) {
+    return agent ? agent->fuel_traps : 0;
+}
+
+uint32_t wasm_agent_peak_kb(const wasm_agent_t *agent) {
+    return agent ? wasm_arena_peak_kb(&agent->arena) : 0;
+}
+
+void wasm_agent_destroy(wasm_agent_t *agent) {
+    if (!agent) return;
+
+    uint32_t peak_kb = wasm_arena_peak_kb(&agent->arena);
+    uint32_t budget_kb = agent->contract ? agent->contract->memory_kb : WASM_ARENA_KB;
+    console_write("[wasm] agent arena peak ");
+    print_uint(peak_kb);
+    console_write(" KB of ");
+    print_uint(budget_kb);
+    console_write(agent->contract ? " KB contract budget\n" : " KB arena\n");
+    if (agent->contract && peak_kb > budget_kb)
+        flightrec_log(TRACE_EVT_MEM_CONTRACT_EXCEED, agent->contract->job_id, 0, peak_kb);
+
+    /* No runtime teardown: every wasm3 block is in the arena */
+    wasm_arena_release(&agent->arena);
+    kfree(agent);
+}
+
+int wasm_agent_reset(wasm_agent_t *agent) {
+    if (!agent) return -1;
+
+    /* memory.grow during the episode: drop back to the snapshot size */
+    if (agent->rt->memory.numPages != agent->mem_snapshot_pages) {
+        wasm_arena_t *prev = wasm_arena_enter(&agent->arena);
+        M3Result res = ResizeMemory(agent->rt, agent->mem_snapshot_pages);
+        wasm_arena_enter(prev);
+        if (res != m3Err_none)
+            return -1;
+    }
+
+    if (agent->mem_snapshot) {
+        uint32_t mem_size = 0;
+        uint8_t *mem = m3_GetMemory(agent->rt, &mem_size, 0);
+        if (!mem || mem_size < agent->mem_snapshot_len)
+            return -1;
+        memcpy(mem, agent->mem_snapshot, agent->mem_snapshot_len);
+    }
+
+    for (uint32_t i = 0; i < agent->mod->numGlobals; i++) {
+        M3Global *g = &agent->mod->globals[i];
+        if (g->isMutable && !g->imported)
+            g->i64Value = (i64)agent->global_snapshot[i];
+    }
+    agent->steps = 0;
+    return 0;
+}
+
+obs_entry_t *wasm_agent_obs_window(wasm_agent_t *agent) {
+    if (!agent) return NULL;
+    /* Re-resolved every call: memory.grow may move linear memory */
+    uint32_t mem_size = 0;
+    uint8_t *mem = m3_GetMemory(agent->rt, &mem_size, 0);
+    if (!mem || mem_size < WASM_OBS_WINDOW_OFFSET + sizeof(obs_entry_t))
+        return NULL;
+    return (obs_entry_t *)(mem + WASM_OBS_WINDOW_OFFSET);
+}
+
+int wasm_agent_step_window(wasm_agent_t *agent, size_t obs_len, uint32_t model_id) {
+    if (!agent || obs_len == 0 || obs_len > IPC_OBS_DIM || !wasm_agent_obs_window(agent))
+        return -1;
 
     /* Call agent_step(offset, len, model_id) */
-    // console_write("[wasm] Calling agent_step...\n");
-    res = m3_CallV(f, input_offset, (uint32_t)obs_len, model_id);
+    g_step_obs_len = (uint32_t)obs_len;
+    cycles_t t0 = (wasm_prof_mode & IPC_WASM_PROF_CALLS) ? time_cycles() : 0;
+    pmu_snap_t pmu;
+    pmu_site_begin(&pmu);
+    m3_SetFuel(agent->rt, agent->fuel);
+    wasm_arena_t *prev = wasm_arena_enter(&agent->arena);  /* memory.grow */
+    M3Result res = m3_CallV(agent->step, (uint32_t)WASM_OBS_FLOATS_OFFSET, (uint32_t)obs_len,
+                            model_id);
+    wasm_arena_enter(prev);
+    pmu_site_end(PMU_SITE_AGENT, &pmu);
+    if (t0)
+        wasm_prof_note(IPC_WASM_PROF_KIND_FUNC, m3_GetFunctionName(agent->step),
+                       time_cycles() - t0);
+    g_step_obs_len = 0;
     
+    if (res == m3Err_trapFuelExhausted) {
+        /* Over its CPU budget: the caller takes the safe action */
+        agent->fuel_traps++;
+        flightrec_log(TRACE_EVT_CONTRACT_BUDGET_EXCEED, agent->contract ? agent->contract->job_id : 0,
+                      agent->steps, agent->budget_us);
+        KLOG2(KLOG_SUBSYS_KERN, KLOG_LVL_WARN, "wasm agent out of fuel (budget %uus, trap %u)",
+              agent->budget_us, agent->fuel_traps);
+        wasm_agent_reset(agent);
+        return -1;
+    }
     if (res) {
         console_write("[wasm] agent step error: ");
         console_write((char*)res);
         console_write("\n");
-        m3_FreeRuntime(rt);
+        /* Don't carry a trapped step's state into the next one */
+        wasm_agent_reset(agent);
         return -1;
     }
+    agent->steps++;
     
     /* Get Return Value */
     uint32_t action = 0;
-    m3_GetResultsV(f, &action);
-    
-    // console_write("[wasm] Done.\n");
-    m3_FreeRuntime(rt);
+    m3_GetResultsV(agent->step, &action);
     return (int)action;
 }
 
+int wasm_agent_step(wasm_agent_t *agent, const float* obs_ptr, size_t obs_len, uint32_t model_id) {
+    obs_entry_t *window = wasm_agent_obs_window(agent);
+    if (!window || !obs_ptr || obs_len == 0 || obs_len > IPC_OBS_DIM) {
+         console_write("[wasm] OOM for input\n");
+         return -1;
+    }
+
+    /* Already in place when the caller popped into the window */
+    if (obs_ptr != window->obs) {
+        for (size_t i = 0; i < obs_len; i++)
+            window->obs[i] = obs_ptr[i];
+    }
+    return wasm_agent_step_window(agent, obs_len, model_id);
+}
+
+/* Agent cache for wasm_run_agent(): agents keyed by the CRC32C of the wasm
+ * bytes plus their length, not the pointer, so a buffer rewritten in place
+ * with a new module misses. Cached agents are never reset.
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t size;
+    wasm_agent_t *agent;  /* NULL = free slot */
+    uint32_t last_use;
+} wasm_agent_slot_t;
+
+static wasm_agent_slot_t g_agents[WASM_AGENT_CACHE_SLOTS];
+static uint32_t g_agent_clock = 0;
+
+/* Cached agent for a module, creating it (in the least recently used
+ * slot) on a miss. NULL if the module does not load.
+ */
+static wasm_agent_t *wasm_agent_lookup(const uint8_t* code, size_t size) {
+    uint32_t hash = crc32c(0, code, size);
+    wasm_agent_slot_t *victim = &g_agents[0];
+
+    for (uint32_t i = 0; i < WASM_AGENT_CACHE_SLOTS; i++) {
+        wasm_agent_slot_t *slot = &g_agents[i];
+        if (slot->agent && slot->hash == hash && slot->size == (uint32_t)size) {
+            slot->last_use = ++g_agent_clock;
+            return slot->agent;
+        }
+        if (!slot->agent || (victim->agent && slot->last_use < victim->last_use))
+            victim = slot;
+    }
+
+    wasm_agent_destroy(victim->agent);
+    victim->agent = wasm_agent_create(code, size);
+    if (!victim->agent)
+        return NULL;
+    victim->hash = hash;
+    victim->size = (uint32_t)size;
+    victim->last_use = ++g_agent_clock;
+    return victim->agent;
+}
+
+int wasm_run_agent(const uint8_t* code, size_t size, const float* obs_ptr, size_t obs_len, uint32_t model_id) {
+    if (!code || size == 0) return -1;
+
+    wasm_agent_t *agent = wasm_agent_lookup(code, size);
+    if (!agent) return -1;
+    return wasm_agent_step(agent, obs_ptr, obs_len, model_id);
+}
+
 int kernel_infer_action(const float *obs_ptr, size_t obs_len, uint32_t model_id) {
     int32_t action = 0;
-    if (zenedge_infer_action(obs_ptr, obs_len, model_id, &action) != 0)
+    pmu_snap_t pmu;
+    pmu_site_begin(&pmu);
+    int rc = policy_cache_infer(obs_ptr, obs_len, model_id, &action, zenedge_infer_action);
+    pmu_site_end(PMU_SITE_INFER, &pmu);
+    if (rc != 0)
         return -1;
     return (int)action;
 }
 
-const float* wasm_get_profile(uint32_t *model_id, uint16_t *len) {
-    if (model_id)
-        *model_id = g_cached_model_id;
-    if (len) {
-        uint16_t capped = (g_cached_weights_len > 0xFFFFu) ? 0xFFFFu : (uint16_t)g_cached_weights_len;
-        *len = capped;
+static int infer_batch(const float *obs, size_t obs_len, size_t stride,
+                       uint32_t count, uint32_t model_id, int32_t *actions) {
+    if (!obs || !actions || obs_len == 0 || stride < obs_len)
+        return -1;
+
+    if (wasm_is_mlp(model_id)) {
+        const mlp_model_t *m = wasm_get_mlp(model_id);
+        if (!m || obs_len < m->in_dim)
+            return -1;
+        for (uint32_t i = 0; i < count; i++)
+            actions[i] = mlp_action(m, obs + i * stride);
+        return 0;
     }
-    return g_cached_weights;
+
+    /* One weight lookup for the whole batch */
+    uint32_t len = 0;
+    const float *weights = wasm_model_get(model_id, &len);
+    if (!weights)
+        return -1;
+
+    size_t n = obs_len;
+    if (len < n)
+        n = len;
+    if (n == 0)
+        return -1;
+
+    /* The batch is a gemv against the weight vector, a chunk at a time */
+    float scores[32];
+    for (uint32_t i = 0; i < count; i += 32) {
+        uint32_t rows = count - i < 32 ? count - i : 32;
+        math_vec_gemv(obs + i * stride, (int)rows, (int)n, (int)stride, weights, scores);
+        for (uint32_t r = 0; r < rows; r++)
+            actions[i + r] = score_to_action(scores[r]);
+    }
+    return 0;
+}
+
+int kernel_infer_actions(const float *obs, size_t obs_len, size_t stride,
+                         uint32_t count, uint32_t model_id, int32_t *actions) {
+    /* A batch is one call to the counters */
+    pmu_snap_t pmu;
+    pmu_site_begin(&pmu);
+    int rc = infer_batch(obs, obs_len, stride, count, model_id, actions);
+    pmu_site_end(PMU_SITE_INFER, &pmu);
+    return rc;
+}
+
+const float* wasm_get_profile(uint32_t *model_id, uint16_t *len) {
+    uint32_t n = 0;
+    const float *weights = wasm_model_last(model_id, &n);
+    if (len)
+        *len = (n > 0xFFFFu) ? 0xFFFFu : (uint16_t)n;
+    return weights;
 }
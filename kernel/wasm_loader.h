@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "contracts.h"
+#include "ipc/ipc_proto.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,12 +16,65 @@ void wasm_init(void);
 /* If result_ptr provided, returns action */
 int wasm_run_bytes(const uint8_t* code, size_t size);
 
-/* Run an agent step: passed obs -> returns action */
+/* Run an agent step: passed obs -> returns action. Steps a cached agent
+ * for the module (never reset); control loops own a wasm_agent_t instead.
+ */
 int wasm_run_agent(const uint8_t* code, size_t size, const float* obs, size_t obs_len, uint32_t model_id);
 
+/* Persistent agent: one runtime (stack, linear memory) kept across steps.
+ * create() instantiates the module, compiles all of it so no step ever
+ * compiles, and snapshots its memory and globals;
+ * reset() restores that snapshot at episode boundaries instead of
+ * reinstantiating. step() returns the action, or -1 on error (a trapped
+ * step also resets the agent).
+ *
+ * Every call into the agent is fuel-metered against a CPU budget: the
+ * contract's cpu_budget_us once one is set, else a default. A call that
+ * runs out traps, logs TRACE_EVT_CONTRACT_BUDGET_EXCEED and returns -1,
+ * so the caller falls back to its safe action.
+ */
+typedef struct wasm_agent wasm_agent_t;
+
+wasm_agent_t* wasm_agent_create(const uint8_t* code, size_t size);
+/* Create from a heap blob or bulk model holding wasm bytes (copied) */
+wasm_agent_t* wasm_agent_load(uint32_t blob_id);
+/* Time create() spent compiling every function ahead of time */
+uint32_t wasm_agent_compile_us(const wasm_agent_t* agent);
+/* Each agent allocates only from its own page arena. Peak arena use (KB)
+ * is logged on destroy, against the contract's memory_kb once one is set
+ * (a flight recorder event if over).
+ */
+uint32_t wasm_agent_peak_kb(const wasm_agent_t* agent);
+void wasm_agent_set_contract(wasm_agent_t* agent, const task_contract_t* contract);
+/* Steps cut short for running out of fuel */
+uint32_t wasm_agent_fuel_traps(const wasm_agent_t* agent);
+int wasm_agent_step(wasm_agent_t* agent, const float* obs, size_t obs_len, uint32_t model_id);
+int wasm_agent_reset(wasm_agent_t* agent);
+void wasm_agent_destroy(wasm_agent_t* agent);
+
+/* The agent's observation window: an obs_entry_t inside its linear memory.
+ * Pop the obs ring straight into it and call step_window(), which hands
+ * agent_step the in-place floats with no per-step copy. Re-fetch it every
+ * step (memory.grow may move it); NULL if the memory is too small.
+ */
+obs_entry_t* wasm_agent_obs_window(wasm_agent_t* agent);
+int wasm_agent_step_window(wasm_agent_t* agent, size_t obs_len, uint32_t model_id);
+
+/* wasm3 yield hook (d_m3YieldHook): switch away mid-step, keeping the
+ * step's arena and observation across the switch
+ */
+void wasm_agent_preempt(void);
+
 /* Kernel-local inference using cached weights */
 int kernel_infer_action(const float* obs, size_t obs_len, uint32_t model_id);
 
+/* Batched kernel-local inference: `count` observations of obs_len floats,
+ * `stride` floats apart, one action each. Returns 0, or -1 if the model or
+ * arguments are unusable.
+ */
+int kernel_infer_actions(const float* obs, size_t obs_len, size_t stride,
+                         uint32_t count, uint32_t model_id, int32_t* actions);
+
 /* Access cached profile (weights) used by wasm_inference */
 const float* wasm_get_profile(uint32_t *model_id, uint16_t *len);
 
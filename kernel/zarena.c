@@ -0,0 +1,66 @@
+/* kernel/zarena.c
+ *
+ * Scoped arenas for transient data (see zarena.h)
+ */
+#include "zarena.h"
+#include "mm/pmm.h"
+#include "mm/vmm.h"
+
+#define ZARENA_ALIGN 16u
+#define ZARENA_HDR   ((sizeof(zarena_t) + ZARENA_ALIGN - 1) & ~(ZARENA_ALIGN - 1))
+
+zarena_t *zarena_create(uint32_t size, uint8_t node) {
+    uint32_t pages = (uint32_t)((size + ZARENA_HDR + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (size == 0 || pages == 0)
+        return NULL;
+
+    zalloc_result_t r = zenedge_alloc_pages(pages, node);
+    if (!r.addr)
+        return NULL;
+
+    /* The header lives in the arena's own first bytes */
+    uint8_t *base = (uint8_t *)(uintptr_t)phys_to_virt((paddr_t)r.addr);
+    zarena_t *a = (zarena_t *)base;
+    a->base = base;
+    a->phys = r.addr;
+    a->pages = pages;
+    a->size = pages * PAGE_SIZE;
+    a->used = ZARENA_HDR;
+    a->peak = a->used;
+    a->failures = 0;
+    a->node = r.node;
+    return a;
+}
+
+void zarena_destroy(zarena_t *a) {
+    if (!a)
+        return;
+    zenedge_free_pages(a->phys, a->pages);
+}
+
+void *zarena_alloc(zarena_t *a, size_t n, size_t align) {
+    if (!align)
+        align = ZARENA_ALIGN;
+    if (align & (align - 1))
+        return NULL;
+
+    uint32_t start = (a->used + (uint32_t)align - 1) & ~((uint32_t)align - 1);
+    if (start > a->size || n > a->size - start) {
+        a->failures++;
+        return NULL;
+    }
+
+    a->used = start + (uint32_t)n;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return a->base + start;
+}
+
+void zarena_reset(zarena_t *a) {
+    a->used = ZARENA_HDR;
+}
+
+void zarena_release(zarena_t *a, zarena_mark_t m) {
+    if (m >= ZARENA_HDR && m <= a->used)
+        a->used = m;
+}
@@ -0,0 +1,136 @@
+/* kernel/zarena.h
+ *
+ * Scoped arenas for transient data
+ *
+ * An arena is a contiguous run of pages from zenedge_alloc_pages(),
+ * with its own header at the start. zarena_alloc() bumps a pointer;
+ * nothing is freed piece by piece. zarena_reset() drops everything at
+ * once, and zarena_mark()/zarena_release() drop everything allocated
+ * since a mark, so one arena can serve nested per-episode and per-step
+ * scopes. Data built for one control step (IFRs, parsed telemetry,
+ * staged wasm inputs) never touches the kernel heap.
+ *
+ * An arena belongs to one context at a time: there is no locking.
+ *
+ * In C++, zenedge::Arena owns an arena and zenedge::ArenaScope releases
+ * back to where it was when it goes out of scope.
+ */
+#ifndef ZENEDGE_ZARENA_H
+#define ZENEDGE_ZARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "zenedge_alloc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct zarena {
+    uint8_t  *base;         /* First byte of the arena's pages */
+    zphys_t  phys;
+    uint32_t pages;
+    uint32_t size;          /* Bytes, the header included */
+    uint32_t used;          /* Bump offset from base */
+    uint32_t peak;          /* High-water mark of used */
+    uint32_t failures;      /* Allocations refused for lack of space */
+    uint8_t  node;          /* Where the pages came from */
+} zarena_t;
+
+/* Position to release back to */
+typedef uint32_t zarena_mark_t;
+
+/*
+ * Create an arena of at least size usable bytes
+ * @param size: Bytes (rounded up to pages, plus the header)
+ * @param node: NUMA node preference (ZNODE_LOCAL, ZNODE_REMOTE, ZNODE_ANY)
+ * @return: The arena, or NULL if no contiguous run of pages is free
+ */
+zarena_t *zarena_create(uint32_t size, uint8_t node);
+
+/*
+ * Give the arena's pages back; a is invalid afterwards
+ */
+void zarena_destroy(zarena_t *a);
+
+/*
+ * Allocate n bytes aligned to align (a power of two, 0 = 16)
+ * @return: The block (not zeroed), or NULL when the arena is full
+ */
+void *zarena_alloc(zarena_t *a, size_t n, size_t align);
+
+/*
+ * Drop every allocation (the peak is kept)
+ */
+void zarena_reset(zarena_t *a);
+
+/* Drop everything allocated after m was taken */
+static inline zarena_mark_t zarena_mark(const zarena_t *a) {
+    return a->used;
+}
+
+void zarena_release(zarena_t *a, zarena_mark_t m);
+
+/* Bytes still free */
+static inline uint32_t zarena_avail(const zarena_t *a) {
+    return a->size - a->used;
+}
+
+#ifdef __cplusplus
+}
+
+namespace zenedge {
+
+/* Owns an arena for its lifetime */
+class Arena {
+ public:
+  Arena(uint32_t size, uint8_t node = ZNODE_ANY) : a_(zarena_create(size, node)) {}
+  ~Arena() {
+    if (a_)
+      zarena_destroy(a_);
+  }
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  bool ok() const { return a_ != nullptr; }
+  zarena_t *get() const { return a_; }
+
+  void *alloc(size_t n, size_t align = 16) { return a_ ? zarena_alloc(a_, n, align) : nullptr; }
+
+  /* Uninitialised array of count Ts */
+  template <typename T>
+  T *alloc_array(size_t count) {
+    return static_cast<T *>(alloc(count * sizeof(T), alignof(T)));
+  }
+
+  void reset() {
+    if (a_)
+      zarena_reset(a_);
+  }
+
+ private:
+  zarena_t *a_;
+};
+
+/* Everything allocated from the arena while it lives is dropped with it */
+class ArenaScope {
+ public:
+  explicit ArenaScope(zarena_t *a) : a_(a), mark_(a ? zarena_mark(a) : 0) {}
+  explicit ArenaScope(Arena &a) : ArenaScope(a.get()) {}
+  ~ArenaScope() {
+    if (a_)
+      zarena_release(a_, mark_);
+  }
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+ private:
+  zarena_t *a_;
+  zarena_mark_t mark_;
+};
+
+}  // namespace zenedge
+#endif
+
+#endif /* ZENEDGE_ZARENA_H */
@@ -8,16 +8,223 @@
  */
 #include "zenedge_alloc.h"
 #include "mm/pmm.h"
+#include "mm/vmm.h"
+#include "arch/fpu.h"
+#include "arch/idt.h"
 #include "console.h"
 
 /* Statistics tracking */
 static uint64_t total_allocated = 0;
 static uint64_t total_freed = 0;
 
+/* Registered tier regions; a set bit is a granule in use */
+typedef struct {
+    ztier_info_t info;
+    uint8_t     *virt;
+    uint32_t     shift;         /* log2 of the granule size */
+    uint32_t     granules;
+    uint32_t     used[ZTIER_GRANULES / 32];
+} ztier_region_t;
+
+static ztier_region_t tiers[ZTIER_COUNT];
+
+static const char *tier_names[ZTIER_COUNT] = {
+    "DDR", "HBM", "DEVICE", "PINNED", "SHARED"
+};
+
 void zenedge_alloc_init(void) {
-    console_write("[zalloc] portable allocator initialized\n");
     total_allocated = 0;
     total_freed = 0;
+
+    /* DDR: what the firmware map gave the PMM */
+    pmm_stats_t st;
+    pmm_get_stats(&st);
+    ztier_info_t *ddr = &tiers[ZTIER_DDR].info;
+    ddr->base = 0;
+    ddr->bytes = (uint64_t)st.total_pages * PAGE_SIZE;
+    ddr->present = 1;
+    ddr->allocatable = 1;
+
+    console_write("[zalloc] portable allocator initialized, DDR ");
+    print_uint(st.total_memory_kb / 1024);
+    console_write(" MB\n");
+}
+
+/* ========================================================================
+ * Tier regions
+ * ======================================================================== */
+
+int zenedge_tier_register(ztier_t tier, zphys_t base, uint64_t bytes,
+                          void *virt, int allocatable) {
+    if (tier == ZTIER_DDR || tier == ZTIER_PINNED || tier >= ZTIER_COUNT)
+        return -1;
+
+    ztier_region_t *r = &tiers[tier];
+    if (r->info.present)
+        return -1;
+
+    /* Whole pages only */
+    zphys_t start = (base + PAGE_SIZE - 1) & ~(zphys_t)(PAGE_SIZE - 1);
+    zphys_t end = (base + bytes) & ~(zphys_t)(PAGE_SIZE - 1);
+    if (end <= start)
+        return -1;
+
+    uint32_t shift = 12;
+    while (((end - start) >> shift) > ZTIER_GRANULES)
+        shift++;
+
+    /* Granules aligned to their size, so ZALLOC_ALIGNED can be met */
+    start = (start + (1ull << shift) - 1) & ~((1ull << shift) - 1);
+    if (end <= start)
+        return -1;
+
+    r->shift = shift;
+    r->granules = (uint32_t)((end - start) >> shift);
+    for (uint32_t i = 0; i < ZTIER_GRANULES / 32; i++) {
+        r->used[i] = 0;
+    }
+    r->virt = virt ? (uint8_t *)virt + (start - base) : NULL;
+    r->info.base = start;
+    r->info.bytes = end - start;
+    r->info.free_bytes = allocatable ? (uint64_t)r->granules << shift : 0;
+    r->info.allocs = 0;
+    r->info.fallbacks = 0;
+    r->info.present = 1;
+    r->info.allocatable = allocatable ? 1 : 0;
+
+    console_write("[zalloc] tier ");
+    console_write(tier_names[tier]);
+    console_write(": ");
+    print_uint((uint32_t)(r->info.bytes / 1024));
+    console_write(allocatable ? " KB\n" : " KB (reserved)\n");
+    return 0;
+}
+
+int zenedge_tier_get(ztier_t tier, ztier_info_t *out) {
+    if (tier >= ZTIER_COUNT || !out)
+        return -1;
+    if (tier == ZTIER_PINNED)
+        tier = ZTIER_DDR;
+    if (!tiers[tier].info.present)
+        return -1;
+
+    *out = tiers[tier].info;
+    if (tier == ZTIER_DDR) {
+        pmm_stats_t st;
+        pmm_get_stats(&st);
+        out->free_bytes = (uint64_t)st.free_pages * PAGE_SIZE;
+    }
+    return 0;
+}
+
+static inline int granule_used(const ztier_region_t *r, uint32_t g) {
+    return (r->used[g / 32] >> (g % 32)) & 1;
+}
+
+static void granules_set(ztier_region_t *r, uint32_t g, uint32_t n, int used) {
+    for (uint32_t i = g; i < g + n; i++) {
+        if (used)
+            r->used[i / 32] |= 1u << (i % 32);
+        else
+            r->used[i / 32] &= ~(1u << (i % 32));
+    }
+}
+
+/* Internal: first fit of pages aligned to align_pages from a region */
+static zphys_t tier_take(ztier_region_t *r, uint32_t pages, uint32_t align_pages) {
+    uint64_t bytes = (uint64_t)pages * PAGE_SIZE;
+    uint32_t n = (uint32_t)((bytes + (1ull << r->shift) - 1) >> r->shift);
+    zphys_t align = (zphys_t)align_pages * PAGE_SIZE;
+
+    uint32_t g = 0;
+    while (g + n <= r->granules) {
+        zphys_t at = r->info.base + ((zphys_t)g << r->shift);
+        if (at & (align - 1)) {
+            /* Next granule on the boundary */
+            zphys_t next = (at + align - 1) & ~(align - 1);
+            g = (uint32_t)((next - r->info.base + (1ull << r->shift) - 1) >> r->shift);
+            continue;
+        }
+        uint32_t i = 0;
+        while (i < n && !granule_used(r, g + i))
+            i++;
+        if (i == n) {
+            granules_set(r, g, n, 1);
+            r->info.free_bytes -= (uint64_t)n << r->shift;
+            return at;
+        }
+        g += i + 1;
+    }
+    return 0;
+}
+
+/* Internal: give pages back to a region */
+static void tier_put(ztier_region_t *r, zphys_t addr, uint32_t pages) {
+    uint64_t bytes = (uint64_t)pages * PAGE_SIZE;
+    uint32_t g = (uint32_t)((addr - r->info.base) >> r->shift);
+    uint32_t n = (uint32_t)((bytes + (1ull << r->shift) - 1) >> r->shift);
+    if (g + n > r->granules)
+        n = r->granules - g;
+    granules_set(r, g, n, 0);
+    r->info.free_bytes += (uint64_t)n << r->shift;
+}
+
+/* Internal: the allocatable region holding addr, if any */
+static ztier_region_t *tier_of(zphys_t addr) {
+    for (uint32_t t = ZTIER_HBM; t < ZTIER_COUNT; t++) {
+        ztier_region_t *r = &tiers[t];
+        if (r->info.present && r->info.allocatable && addr >= r->info.base &&
+            addr < r->info.base + r->info.bytes)
+            return r;
+    }
+    return NULL;
+}
+
+/* Internal: zero a mapped buffer. rep stos moves whole words as fast as
+ * the store buffer takes them; past ZALLOC_NT_ZERO_BYTES movnti (SSE2,
+ * integer registers, so no FPU state) writes around the cache instead of
+ * evicting everything in it for memory nobody reads yet.
+ */
+static void zero_bytes(void *dst, uint32_t bytes) {
+    uintptr_t p = (uintptr_t)dst;
+
+#if defined(__x86_64__)
+    if (bytes >= ZALLOC_NT_ZERO_BYTES && (fpu_features() & FPU_FEAT_SSE2)) {
+        for (uintptr_t end = p + bytes; p < end; p += 32) {
+            __asm__ __volatile__(
+                "movnti %1, 0(%0)\n\t"
+                "movnti %1, 8(%0)\n\t"
+                "movnti %1, 16(%0)\n\t"
+                "movnti %1, 24(%0)"
+                : : "r"(p), "r"((uint64_t)0) : "memory");
+        }
+        __asm__ __volatile__("sfence" ::: "memory");
+        return;
+    }
+    uintptr_t n = bytes / 8;
+    __asm__ __volatile__("rep stosq"
+                         : "+D"(p), "+c"(n)
+                         : "a"((uint64_t)0)
+                         : "memory");
+#else
+    if (bytes >= ZALLOC_NT_ZERO_BYTES && (fpu_features() & FPU_FEAT_SSE2)) {
+        for (uintptr_t end = p + bytes; p < end; p += 16) {
+            __asm__ __volatile__(
+                "movnti %1, 0(%0)\n\t"
+                "movnti %1, 4(%0)\n\t"
+                "movnti %1, 8(%0)\n\t"
+                "movnti %1, 12(%0)"
+                : : "r"(p), "r"((uint32_t)0) : "memory");
+        }
+        __asm__ __volatile__("sfence" ::: "memory");
+        return;
+    }
+    uintptr_t n = bytes / 4;
+    __asm__ __volatile__("rep stosl"
+                         : "+D"(p), "+c"(n)
+                         : "a"((uint32_t)0)
+                         : "memory");
+#endif
 }
 
 /* ========================================================================
@@ -31,6 +238,8 @@ zalloc_result_t zenedge_alloc_page(uint8_t node_pref) {
     if (result.addr) {
         result.node = zenedge_platform_get_node(result.addr);
         result.size_bytes = PAGE_SIZE;
+        result.tier = ZTIER_DDR;
+        tiers[ZTIER_DDR].info.allocs++;
         total_allocated += PAGE_SIZE;
     }
 
@@ -53,6 +262,8 @@ zalloc_result_t zenedge_alloc_pages(uint32_t count, uint8_t node_pref) {
         result.addr = addr;
         result.node = zenedge_platform_get_node(addr);
         result.size_bytes = count * PAGE_SIZE;
+        result.tier = ZTIER_DDR;
+        tiers[ZTIER_DDR].info.allocs++;
         total_allocated += result.size_bytes;
     }
 
@@ -69,48 +280,95 @@ zalloc_result_t zenedge_alloc(const zalloc_request_t *req) {
     /* Calculate pages needed */
     uint32_t pages = (req->size_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
 
-    /* Handle alignment if requested */
+    /* Alignment in pages (a power of two) */
+    uint32_t align_pages = 1;
     if (req->flags & ZALLOC_ALIGNED) {
-        /* For now, we only support page-aligned allocations */
-        /* Future: implement power-of-2 aligned allocations */
+        uint32_t align = req->alignment;
+        if (align & (align - 1) || align > ZALLOC_MAX_ALIGN) {
+            console_write("[zalloc] ERROR: unsupported alignment ");
+            print_uint(align);
+            console_write("\n");
+            return result;
+        }
+        if (align > PAGE_SIZE)
+            align_pages = align / PAGE_SIZE;
+    }
+
+    /* A registered tier first */
+    ztier_t tier = req->tier;
+    if (tier == ZTIER_PINNED || tier >= ZTIER_COUNT)
+        tier = ZTIER_DDR;
+    if (tier != ZTIER_DDR) {
+        ztier_region_t *r = &tiers[tier];
+        if (r->info.present && r->info.allocatable &&
+            (r->virt || !(req->flags & ZALLOC_ZERO))) {
+            int was = interrupts_enabled();
+            interrupts_disable();
+            zphys_t addr = tier_take(r, pages, align_pages);
+            if (addr)
+                r->info.allocs++;
+            if (was)
+                interrupts_enable();
+
+            if (addr) {
+                result.addr = addr;
+                result.node = (uint8_t)ZNODE_ANY;
+                result.size_bytes = pages * PAGE_SIZE;
+                result.tier = tier;
+                total_allocated += result.size_bytes;
+                if (req->flags & ZALLOC_ZERO)
+                    zero_bytes(r->virt + (addr - r->info.base), result.size_bytes);
+                return result;
+            }
+        }
+        r->info.fallbacks++;
     }
 
-    /* Allocate */
-    if (pages == 1) {
+    /* DDR: buddy blocks start aligned to their size, so asking for at
+     * least align_pages pages aligns the start; the tail goes back
+     */
+    uint32_t count = pages > align_pages ? pages : align_pages;
+    if (count == 1) {
         result = zenedge_alloc_page(req->node_pref);
-    } else if (req->flags & ZALLOC_CONTIGUOUS) {
-        result = zenedge_alloc_pages(pages, req->node_pref);
     } else {
-        /* Non-contiguous multi-page: just allocate first page for now */
-        /* Future: return scatter-gather list */
-        result = zenedge_alloc_pages(pages, req->node_pref);
+        result = zenedge_alloc_pages(count, req->node_pref);
+        if (result.addr && count > pages) {
+            pmm_free_pages((paddr_t)result.addr + pages * PAGE_SIZE, count - pages);
+            total_allocated -= (uint64_t)(count - pages) * PAGE_SIZE;
+            result.size_bytes = pages * PAGE_SIZE;
+        }
     }
 
     /* Zero if requested */
     if ((result.addr != 0) && (req->flags & ZALLOC_ZERO)) {
-        /* Convert physical to virtual for zeroing */
-        /* Note: This assumes identity mapping or known kernel mapping */
-        uint8_t *vaddr = (uint8_t *)(result.addr + 0xC0000000); /* KERNEL_VBASE */
-        for (uint32_t i = 0; i < result.size_bytes; i++) {
-            vaddr[i] = 0;
-        }
+        zero_bytes((void *)(uintptr_t)phys_to_virt((paddr_t)result.addr),
+                   result.size_bytes);
     }
 
     return result;
 }
 
 void zenedge_free_page(zphys_t addr) {
-    if (addr) {
-        zenedge_platform_free_page(addr);
-        total_freed += PAGE_SIZE;
-    }
+    zenedge_free_pages(addr, 1);
 }
 
 void zenedge_free_pages(zphys_t addr, uint32_t count) {
-    if (addr && count > 0) {
+    if (!addr || count == 0)
+        return;
+
+    ztier_region_t *r = tier_of(addr);
+    if (r) {
+        int was = interrupts_enabled();
+        interrupts_disable();
+        tier_put(r, addr, count);
+        if (was)
+            interrupts_enable();
+    } else if (count == 1) {
+        zenedge_platform_free_page(addr);
+    } else {
         pmm_free_pages((paddr_t)addr, count);
-        total_freed += count * PAGE_SIZE;
     }
+    total_freed += count * PAGE_SIZE;
 }
 
 uint8_t zenedge_get_node(zphys_t addr) {
@@ -122,6 +380,40 @@ void zenedge_alloc_stats(zalloc_stats_t *stats) {
     zenedge_platform_get_stats(stats);
 }
 
+void zenedge_tier_dump(void) {
+    console_write("\n=== MEMORY TIERS ===\n");
+    console_write("TIER   | BASE       | SIZE KB  | FREE KB  | ALLOCS | FALLBACKS\n");
+
+    for (uint32_t t = 0; t < ZTIER_COUNT; t++) {
+        ztier_info_t info;
+        if (t == ZTIER_PINNED || zenedge_tier_get((ztier_t)t, &info) != 0)
+            continue;
+
+        console_write(tier_names[t]);
+        uint32_t len = 0;
+        while (tier_names[t][len])
+            len++;
+        for (; len < 6; len++) {
+            console_write(" ");
+        }
+        console_write(" | ");
+        print_hex32((uint32_t)info.base);
+        console_write(" | ");
+        print_uint((uint32_t)(info.bytes / 1024));
+        console_write(" | ");
+        if (info.allocatable)
+            print_uint((uint32_t)(info.free_bytes / 1024));
+        else
+            console_write("reserved");
+        console_write(" | ");
+        print_uint(info.allocs);
+        console_write(" | ");
+        print_uint(info.fallbacks);
+        console_write("\n");
+    }
+    console_write("=== END TIERS ===\n\n");
+}
+
 /* ========================================================================
  * Platform-specific implementations (bare-metal PMM wrappers)
  * ======================================================================== */
@@ -20,31 +20,53 @@
 /* Platform-independent physical address type */
 typedef uint64_t zphys_t;   /* 64-bit for future-proofing */
 
-/* Allocation result with metadata */
-typedef struct {
-    zphys_t  addr;          /* Physical address (0 = failure) */
-    uint8_t  node;          /* NUMA node where allocated */
-    uint32_t size_bytes;    /* Actual size allocated */
-} zalloc_result_t;
-
 /* NUMA hints */
 #define ZNODE_LOCAL     0
 #define ZNODE_REMOTE    1
 #define ZNODE_ANY       0xFF
 
-/* Memory tier hints (for future HBM/device memory) */
+/*
+ * Memory tiers
+ *
+ * DDR is the PMM's memory. Other tiers exist once something registers a
+ * region for them with zenedge_tier_register(); a request for a tier
+ * with no (or no free) allocatable region falls back to DDR, and the
+ * result says which tier it came from. Kernel memory is never paged, so
+ * PINNED is DDR.
+ */
 typedef enum {
     ZTIER_DDR = 0,          /* Regular system RAM */
     ZTIER_HBM,              /* High-bandwidth memory */
     ZTIER_DEVICE,           /* Accelerator local memory */
-    ZTIER_PINNED            /* DMA-capable, non-pageable */
+    ZTIER_PINNED,           /* DMA-capable, non-pageable */
+    ZTIER_SHARED,           /* Host-shared (ivshmem) memory */
+    ZTIER_COUNT
 } ztier_t;
 
+/* A registered region is handed out in granules: a page, or larger
+ * powers of two for regions of more than ZTIER_GRANULES pages
+ */
+#define ZTIER_GRANULES  4096
+
+/* Allocation result with metadata */
+typedef struct {
+    zphys_t  addr;          /* Physical address (0 = failure) */
+    uint8_t  node;          /* NUMA node where allocated */
+    uint32_t size_bytes;    /* Actual size allocated */
+    ztier_t  tier;          /* Tier it came from */
+} zalloc_result_t;
+
 /* Allocation flags */
 #define ZALLOC_ZERO      (1 << 0)   /* Zero the memory */
 #define ZALLOC_CONTIGUOUS (1 << 1)  /* Must be physically contiguous */
 #define ZALLOC_PINNED    (1 << 2)   /* Pin in physical memory (no swap) */
-#define ZALLOC_ALIGNED   (1 << 3)   /* Align to size boundary */
+#define ZALLOC_ALIGNED   (1 << 3)   /* Align to req->alignment (power of two) */
+
+/* Zeroing at least this many bytes uses non-temporal stores */
+#define ZALLOC_NT_ZERO_BYTES (256 * 1024)
+
+/* Largest ZALLOC_ALIGNED alignment (a top-order buddy block) */
+#define ZALLOC_MAX_ALIGN (4 * 1024 * 1024)
 
 /* Allocation request */
 typedef struct {
@@ -55,6 +77,17 @@ typedef struct {
     uint32_t alignment;     /* If ZALLOC_ALIGNED, alignment requirement */
 } zalloc_request_t;
 
+/* A tier's registered region */
+typedef struct {
+    zphys_t  base;
+    uint64_t bytes;
+    uint64_t free_bytes;    /* 0 unless allocatable */
+    uint32_t allocs;
+    uint32_t fallbacks;     /* Requests for the tier served from DDR */
+    uint8_t  present;
+    uint8_t  allocatable;   /* 0 = owned by a driver, listed only */
+} ztier_info_t;
+
 /*
  * Initialize the allocation subsystem
  * Called once at kernel startup after platform PMM is ready
@@ -78,11 +111,37 @@ zalloc_result_t zenedge_alloc_pages(uint32_t count, uint8_t node_pref);
 
 /*
  * Advanced allocation with full control
+ *
+ * Memory is always physically contiguous (there are no scatter-gather
+ * results), so ZALLOC_CONTIGUOUS always holds. ZALLOC_ALIGNED aligns
+ * the start to req->alignment, up to ZALLOC_MAX_ALIGN. ZALLOC_ZERO
+ * zeroes with string stores, or non-temporal ones for large requests
+ * so they don't flush the cache.
  * @param req: Allocation request structure
  * @return: Allocation result (addr=0 on failure)
  */
 zalloc_result_t zenedge_alloc(const zalloc_request_t *req);
 
+/*
+ * Register a tier's memory region (firmware tables, drivers)
+ * @param virt: Kernel mapping of base, or NULL if unmapped (no ZALLOC_ZERO)
+ * @param allocatable: Whether zenedge_alloc() may hand it out
+ * @return: 0 on success, -1 if the tier is DDR/PINNED, taken or invalid
+ */
+int zenedge_tier_register(ztier_t tier, zphys_t base, uint64_t bytes,
+                          void *virt, int allocatable);
+
+/*
+ * Get a tier's region
+ * @return: 0 on success, -1 if nothing is registered for it
+ */
+int zenedge_tier_get(ztier_t tier, ztier_info_t *out);
+
+/*
+ * Debug: dump the tiers to console
+ */
+void zenedge_tier_dump(void);
+
 /*
  * Free a single page
  * @param addr: Physical address to free
@@ -0,0 +1,128 @@
+#!/bin/bash
+# run_gym_bench.sh - Closed-loop control benchmark
+#
+# Builds the x86_64 kernel with GYM_BENCH=<steps>, then runs its control
+# loop against the gym agent once per mode: stream rings, CMD_ENV_STEP
+# blobs, and (if tools/bridge has been built) the C bridge's native
+# CartPole; with --replay, also a recorded stream (gym agent --record)
+# played back by the C bridge, the same observations every run. Each run
+# saves its numbers (bridge/gym_bench.py); the merged report is compared
+# against the baseline and the script fails on a regression. --envs steps a vector of envs per stream batch, --pipeline
+# in two overlapping groups (VEC_ENVS / VEC_PIPELINE); blob mode always
+# runs one env.
+#
+#   ./run_gym_bench.sh [--steps N] [--seed S] [--modes "stream blob native"]
+#                      [--envs N] [--pipeline] [--replay LOG [--paced]]
+#                      [--baseline FILE] [--threshold PCT] [--save-baseline]
+
+set -e
+
+STEPS=20000
+SEED=0
+MODES="stream blob native"
+BASELINE="gym_bench_baseline.json"
+THRESHOLD=5
+SAVE=""
+ENVS=1
+PIPELINE=0
+REPLAY=""
+PACED=""
+TIMEOUT=120
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --steps)         STEPS="$2"; shift ;;
+        --seed)          SEED="$2"; shift ;;
+        --modes)         MODES="$2"; shift ;;
+        --envs)          ENVS="$2"; shift ;;
+        --pipeline)      PIPELINE=1 ;;
+        --replay)        REPLAY="$2"; shift ;;
+        --paced)         PACED=",paced" ;;
+        --baseline)      BASELINE="$2"; shift ;;
+        --threshold)     THRESHOLD="$2"; shift ;;
+        --save-baseline) SAVE="--save-baseline" ;;
+        --timeout)       TIMEOUT="$2"; shift ;;
+        *) echo "Unknown option: $1"; exit 2 ;;
+    esac
+    shift
+done
+
+SHM_FILE="/dev/shm/zenedge_bench"
+OUT_DIR="/tmp/zenedge_gym_bench"
+QEMU_LOG="qemu_gym_bench.log"
+mkdir -p $OUT_DIR
+export PYTHONPATH=$PYTHONPATH:$(pwd)
+
+echo "[BENCH] Building kernel (GYM_BENCH=$STEPS VEC_ENVS=$ENVS VEC_PIPELINE=$PIPELINE)..."
+make ARCH=x86_64 GYM_BENCH=$STEPS VEC_ENVS=$ENVS VEC_PIPELINE=$PIPELINE -B zenedge.iso > /dev/null
+
+if [ -n "$REPLAY" ] && [[ " $MODES " != *" replay "* ]]; then
+    MODES="$MODES replay"
+fi
+
+RUNS=""
+for MODE in $MODES; do
+    RUN="$OUT_DIR/$MODE.json"
+    rm -f $RUN
+    AGENT="python3 -u bridge/zenedge_gym_agent.py --shm $SHM_FILE --seed $SEED --bench-out $RUN"
+    case "$MODE" in
+        stream) AGENT_ARGS="" ;;
+        blob)   AGENT_ARGS="--blob" ;;
+        native)
+            if [ ! -x tools/bridge/bridge ] || [ ! -f tools/bridge/envs/cartpole.so ]; then
+                echo "[BENCH] native: tools/bridge not built, skipped"
+                continue
+            fi
+            AGENT_ARGS="--native" ;;
+        replay)
+            if [ ! -x tools/bridge/bridge ] || [ ! -f tools/bridge/envs/replay.so ] ||
+               [ ! -f "$REPLAY" ]; then
+                echo "[BENCH] replay: needs tools/bridge built and --replay LOG, skipped"
+                continue
+            fi
+            AGENT="tools/bridge/bridge --quiet --file $SHM_FILE --bench-out $RUN"
+            AGENT_ARGS="--env tools/bridge/envs/replay.so --env-args $REPLAY$PACED" ;;
+        *) echo "[BENCH] Unknown mode $MODE"; exit 2 ;;
+    esac
+
+    echo "[BENCH] $MODE: $STEPS steps, seed $SEED..."
+    dd if=/dev/zero of=$SHM_FILE bs=1M count=1 status=none
+    $AGENT $AGENT_ARGS > $OUT_DIR/$MODE.log 2>&1 &
+    AGENT_PID=$!
+    sleep 1
+
+    qemu-system-x86_64 \
+        -cdrom zenedge.iso \
+        -serial stdio \
+        -display none \
+        -device ivshmem-plain,memdev=hostmem \
+        -object memory-backend-file,size=1M,share=on,mem-path=$SHM_FILE,id=hostmem \
+        > $QEMU_LOG 2>&1 &
+    QEMU_PID=$!
+
+    # The agent exits once it has saved the run
+    for _ in $(seq $TIMEOUT); do
+        kill -0 $AGENT_PID 2>/dev/null || break
+        sleep 1
+    done
+    kill $QEMU_PID 2>/dev/null || true
+    kill $AGENT_PID 2>/dev/null || true
+    wait $AGENT_PID 2>/dev/null || true
+    rm -f $SHM_FILE
+
+    if [ -f $RUN ]; then
+        RUNS="$RUNS $RUN"
+    else
+        echo "[BENCH] $MODE: no result (see $OUT_DIR/$MODE.log and $QEMU_LOG)"
+        tail -n 10 $QEMU_LOG
+    fi
+done
+
+if [ -z "$RUNS" ]; then
+    echo "[BENCH] No runs finished."
+    exit 1
+fi
+
+echo
+python3 -m bridge.gym_bench $RUNS --baseline $BASELINE --threshold $THRESHOLD \
+    --out $OUT_DIR/report.json $SAVE
@@ -69,6 +69,17 @@ tail -n 20 qemu_node1.log
 # Check if Node 0 saw Node 1
 grep -q "Node 1" qemu_node0.log && echo "[TEST] SUCCESS: Node 0 sees Node 1!" || echo "[TEST] FAILURE: Node 0 did not see Node 1"
 
+# Work rings: each node's probe came back from the other (prints the
+# cross-node dispatch latency)
+for pair in "0 1" "1 0"; do
+    set -- $pair
+    if grep -q "\[mesh\] node $2 reachable" qemu_node$1.log; then
+        echo "[TEST] SUCCESS: Node $1 dispatches to Node $2: $(grep -o "node $2 reachable, dispatch [0-9]*us" qemu_node$1.log | head -n 1)"
+    else
+        echo "[TEST] FAILURE: Node $1 got no work-ring answer from Node $2"
+    fi
+done
+
 echo -e "\n=== Bridge Output (All) ==="
 cat $BRIDGE_LOG
 
@@ -9,6 +9,27 @@
  * Usage:
  *   ./bridge [--file <path>]    Use file-backed shared memory (default: /tmp/zenedge_ipc)
  *   ./bridge --devmem           Use /dev/mem at 0x02000000 (requires root)
+ *   ./bridge --ivshmem <sock>   Attach through ivshmem-server: shared memory
+ *                               and doorbell eventfds come from the server,
+ *                               and the bridge blocks instead of polling
+ *   ./bridge --workers <n>      Worker threads per command queue (0: all
+ *                               commands on the dispatcher thread)
+ *   ./bridge --busy-poll <cpu>  Never sleep; the dispatcher spins on <cpu>
+ *   ./bridge --quiet            No per-command log lines
+ *   ./bridge --env <plugin.so>  Serve CMD_ENV_RESET and the obs/action
+ *                               stream rings from a native environment
+ *                               (see env_plugin.h)
+ *   ./bridge --bench-out <json> With --env: time a GYM_BENCH kernel's
+ *                               window (CMD_ENV_BENCH), save it, exit
+ *   ./bridge --record <log>     With --env: record every reset and step
+ *                               for envs/replay.so (see replay_log.h)
+ *
+ * One dispatcher thread owns the rings. It answers cheap commands itself
+ * and hands the rest to a worker pool, one queue per command group, so a
+ * blocking handler only holds up its own group. Responses, its own and
+ * the workers', are posted in batches behind a single doorbell. With a
+ * native environment loaded the dispatcher also steps it, one batch of
+ * actions per pass.
  */
 
 #define _GNU_SOURCE
@@ -21,24 +42,56 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#endif
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dlfcn.h>
 
 #include "ipc_proto.h"
+#include "env_plugin.h"
+#include "replay_log.h"
 
 /* Shared memory configuration */
 #define IPC_SHARED_MEM_PHYS  0x02000000
-#define IPC_SHARED_MEM_SIZE  (1024 * 1024)  /* 1MB total */
 
 /* Default file path for file-backed shared memory */
 #define DEFAULT_SHM_PATH "/tmp/zenedge_ipc"
 
 static volatile bool running = true;
+static bool verbose = true;         /* --quiet clears */
+static int busy_poll_cpu = -1;      /* --busy-poll */
+static bool shm_hugepages = false;  /* --hugepages */
+static bool shm_prefault = false;   /* --prefault */
+static int shm_numa_cpu = -1;       /* --numa-cpu / --numa-thread */
+static int shm_numa_node = -1;      /* Node the region is bound to */
+static uint32_t workers_per_queue = 1;
+
+/* Per-command log lines, which cost more than the commands themselves */
+#define LOG(...) do { if (verbose) printf(__VA_ARGS__); } while (0)
 static volatile ipc_ring_t *cmd_ring = NULL;
 static volatile ipc_rsp_ring_t *rsp_ring = NULL;
 static volatile doorbell_ctl_t *doorbell = NULL;
+static volatile ipc_msg_ring_t *msg_cmd_ring = NULL;
+static volatile ipc_msg_ring_t *msg_rsp_ring = NULL;
 static void *shm_base = NULL;
+static size_t shm_size = IPC_SHARED_MEM_MIN;  /* Bytes mapped */
+
+/* Locally cached copies of the kernel's indices (ring protocol v2): the
+ * command head is re-read only when the ring looks empty, the response
+ * tail only when the ring looks full.
+ */
+static uint32_t cmd_head_cache = 0;
+static uint32_t rsp_tail_cache = 0;
 
 /* Statistics */
 static struct {
@@ -47,8 +100,83 @@ static struct {
     uint64_t responses_sent;
     uint64_t doorbell_rings;
     uint64_t errors;
+    uint64_t wakeups;     /* Returns from a blocking eventfd wait */
+    uint64_t sleep_usec;  /* Time spent blocked instead of polling */
+    uint64_t irqs_sent;   /* eventfd writes to ZENEDGE */
+    uint64_t batches;     /* Response flushes that posted anything */
+    uint64_t ring_full;   /* Flushes stopped by a full response ring */
 } stats = {0};
 
+/* Handled by workers: one queue per command group (cmd >> 8) */
+#define BRIDGE_QUEUES      4
+#define WORK_QUEUE_DEPTH   1024
+#define MAX_WORKERS        16     /* Per queue */
+
+/* Completions not yet posted, workers' and the dispatcher's; the
+ * dispatcher stops taking commands while this many are outstanding
+ */
+#define COMPLETION_DEPTH   4096
+
+/* Commands taken from the rings before responses are flushed */
+#define DISPATCH_BATCH     64
+
+static const char *const queue_names[BRIDGE_QUEUES] = {
+    "model", "env", "ifr", "telemetry"
+};
+
+typedef struct {
+    ipc_packet_t pkt;
+    bool msg;                       /* Answer on the message ring */
+    uint16_t len;
+    uint8_t inl[IPC_MSG_MAX_INLINE];
+} work_item_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    uint32_t head, tail;            /* Free-running */
+    uint64_t handled;
+    work_item_t items[WORK_QUEUE_DEPTH];
+    pthread_t threads[MAX_WORKERS];
+} work_queue_t;
+
+typedef struct {
+    uint16_t status;
+    uint16_t orig_cmd;
+    uint32_t result;
+    uint32_t tag;
+    bool msg;
+} completion_t;
+
+static work_queue_t queues[BRIDGE_QUEUES];
+
+/* Workers -> dispatcher; a byte on done_pipe when it goes non-empty */
+static struct {
+    pthread_mutex_t lock;
+    uint32_t head, tail;
+    completion_t items[COMPLETION_DEPTH];
+} done_q = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static int done_pipe[2] = { -1, -1 };
+
+/* Dispatcher only: completions waiting for response ring space */
+static completion_t pending[COMPLETION_DEPTH];
+static uint32_t pend_head, pend_tail;
+static uint32_t in_workers;         /* Handed out, not yet back in pending */
+
+/* ivshmem-server attachment (--ivshmem). The server hands out the shared
+ * memory fd plus one eventfd per (peer, vector); writing a peer's eventfd
+ * raises its interrupt, our own eventfd becomes readable when a peer rings
+ * our BAR0 doorbell.
+ */
+#define IVSHMEM_MAX_PEERS 16
+
+static int ivsh_sock = -1;
+static int64_t ivsh_self_id = -1;
+static int ivsh_self_fd = -1;                 /* Our vector 0 eventfd */
+static int ivsh_peer_fd[IVSHMEM_MAX_PEERS] = {  /* Peers' vector 0 eventfds */
+    [0 ... IVSHMEM_MAX_PEERS - 1] = -1
+};
+
 /* Signal handler for graceful shutdown */
 static void signal_handler(int sig) {
     (void)sig;
@@ -63,6 +191,205 @@ static uint64_t time_usec(void) {
     return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
+/* CLOCK_MONOTONIC in ns, the clock stream entries are stamped with */
+static uint64_t time_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Resolve region pointers from ZENEDGE's layout descriptor at offset 0,
+ * falling back to the fixed 1MB layout for images that do not publish one.
+ * Re-run while detached: ZENEDGE may publish (or re-size) after we map.
+ * Returns true if the descriptor was used.
+ */
+static bool map_regions(void) {
+    static uint32_t warned_total = 0;
+    volatile ipc_layout_t *lay = (volatile ipc_layout_t *)shm_base;
+    uint32_t off[IPC_REGION_COUNT];
+    bool described = false;
+
+    off[IPC_REGION_CMD_RING] = IPC_CMD_RING_OFFSET;
+    off[IPC_REGION_RSP_RING] = IPC_RSP_RING_OFFSET;
+    off[IPC_REGION_DOORBELL] = IPC_DOORBELL_OFFSET;
+    off[IPC_REGION_MSG_CMD] = IPC_MSG_CMD_RING_OFFSET;
+    off[IPC_REGION_MSG_RSP] = IPC_MSG_RSP_RING_OFFSET;
+
+    if (lay->magic == IPC_LAYOUT_MAGIC && lay->version == IPC_LAYOUT_VERSION &&
+        lay->region_count >= IPC_REGION_COUNT) {
+        __sync_synchronize();
+        bool fits = lay->total_size <= shm_size;
+        for (uint32_t i = 0; fits && i < IPC_REGION_COUNT; i++)
+            fits = (uint64_t)lay->regions[i].offset + lay->regions[i].size <= shm_size;
+
+        if (!fits) {
+            if (warned_total != lay->total_size) {
+                fprintf(stderr, "[bridge] Layout describes %u KB but only %zu KB "
+                        "is mapped\n", lay->total_size / 1024, shm_size / 1024);
+                warned_total = lay->total_size;
+            }
+        } else {
+            off[IPC_REGION_CMD_RING] = lay->regions[IPC_REGION_CMD_RING].offset;
+            off[IPC_REGION_RSP_RING] = lay->regions[IPC_REGION_RSP_RING].offset;
+            off[IPC_REGION_DOORBELL] = lay->regions[IPC_REGION_DOORBELL].offset;
+            off[IPC_REGION_MSG_CMD] = lay->regions[IPC_REGION_MSG_CMD].offset;
+            off[IPC_REGION_MSG_RSP] = lay->regions[IPC_REGION_MSG_RSP].offset;
+            described = true;
+        }
+    }
+
+    char *base = (char *)shm_base;
+    volatile ipc_ring_t *new_cmd = (volatile ipc_ring_t *)(base + off[IPC_REGION_CMD_RING]);
+    if (new_cmd != cmd_ring) {
+        if (described)
+            printf("[bridge] Using layout descriptor: %u KB, cmd ring at 0x%X, "
+                   "rsp ring at 0x%X, doorbell at 0x%X\n", lay->total_size / 1024,
+                   off[IPC_REGION_CMD_RING], off[IPC_REGION_RSP_RING],
+                   off[IPC_REGION_DOORBELL]);
+        else
+            printf("[bridge] No layout descriptor, using fixed 1MB layout\n");
+    }
+
+    cmd_ring = new_cmd;
+    rsp_ring = (volatile ipc_rsp_ring_t *)(base + off[IPC_REGION_RSP_RING]);
+    doorbell = (volatile doorbell_ctl_t *)(base + off[IPC_REGION_DOORBELL]);
+    msg_cmd_ring = (volatile ipc_msg_ring_t *)(base + off[IPC_REGION_MSG_CMD]);
+    msg_rsp_ring = (volatile ipc_msg_ring_t *)(base + off[IPC_REGION_MSG_RSP]);
+    return described;
+}
+
+/* Shared memory placement (--hugepages, --prefault, --numa-cpu)
+ *
+ * A hugetlbfs file maps with huge pages by itself; its size must be a
+ * multiple of the huge page size. On tmpfs (/dev/shm), --hugepages asks
+ * for transparent huge pages instead. The NUMA policy is set before
+ * anything is touched, so the prefault allocates on the bound node.
+ * mlock() then faults in and pins every page, and with no node to bind
+ * MAP_POPULATE does the faulting at mmap time.
+ */
+#ifdef __linux__
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+#define SHM_MPOL_BIND     2         /* <numaif.h>, without libnuma */
+#define SHM_MPOL_MF_MOVE  (1 << 1)
+#define SHM_MAX_NODES     1024
+
+/* Helper: huge page size if fd is on hugetlbfs, else 0 */
+static size_t shm_huge_page(int fd) {
+    struct statfs sfs;
+    if (fstatfs(fd, &sfs) != 0 || (unsigned long)sfs.f_type != HUGETLBFS_MAGIC)
+        return 0;
+    return (size_t)sfs.f_bsize;
+}
+
+/* Helper: NUMA node of a host CPU, or -1 */
+static int cpu_node(int cpu) {
+    char path[64];
+    for (int node = 0; node < SHM_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0)
+            return node;
+    }
+    return -1;
+}
+
+/* Helper: CPU a thread last ran on (/proc/<tid>/stat field 39), or -1 */
+static int thread_cpu(int tid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", tid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    /* Fields after the command name, which may hold spaces */
+    char *p = strrchr(buf, ')');
+    for (int field = 2; p && field < 39; field++)
+        p = strchr(p + 1, ' ');
+    return p ? atoi(p + 1) : -1;
+}
+
+/* Helper: the CPUs of a node (sysfs cpulist, e.g. "0-7,16-23") */
+static int node_cpus(int node, cpu_set_t *set) {
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    bool ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (!ok)
+        return -1;
+
+    CPU_ZERO(set);
+    for (char *p = buf; *p && *p != '\n';) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p)
+            return -1;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+#endif
+
+/* Map shm_size bytes of fd at offset off with the placement options */
+static void *shm_map(int fd, off_t off) {
+    int flags = MAP_SHARED;
+#ifdef __linux__
+    if (shm_prefault && shm_numa_node < 0)
+        flags |= MAP_POPULATE;
+#endif
+    void *base = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, flags, fd, off);
+    if (base == MAP_FAILED)
+        return base;
+
+#ifdef __linux__
+    size_t huge = shm_huge_page(fd);
+    if (huge) {
+        printf("[bridge] Shared memory on hugetlbfs (%zu KB pages)\n", huge / 1024);
+    } else if (shm_hugepages) {
+        if (madvise(base, shm_size, MADV_HUGEPAGE) != 0)
+            perror("[bridge] madvise(MADV_HUGEPAGE)");
+        else
+            printf("[bridge] Shared memory: transparent huge pages requested\n");
+    }
+
+    if (shm_numa_node >= 0) {
+        unsigned long mask[SHM_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+        mask[shm_numa_node / (8 * sizeof(unsigned long))] |=
+            1ul << (shm_numa_node % (8 * sizeof(unsigned long)));
+        /* Pages already there move when only this process maps them */
+        if (syscall(SYS_mbind, base, shm_size, SHM_MPOL_BIND, mask,
+                    (unsigned long)SHM_MAX_NODES, SHM_MPOL_MF_MOVE) != 0)
+            perror("[bridge] mbind");
+        else
+            printf("[bridge] Shared memory bound to NUMA node %d\n", shm_numa_node);
+    }
+
+    if (shm_prefault) {
+        if (mlock(base, shm_size) == 0) {
+            printf("[bridge] Shared memory prefaulted and locked\n");
+        } else {
+            perror("[bridge] mlock (raise RLIMIT_MEMLOCK)");
+            /* Still fault the page tables in, a read per page */
+            for (size_t o = 0; o < shm_size; o += 4096)
+                (void)((volatile uint8_t *)base)[o];
+        }
+    }
+#else
+    (void)fd;
+#endif
+    return base;
+}
+
 /* Initialize shared memory from file */
 static int init_shm_file(const char *path) {
     int fd = open(path, O_RDWR | O_CREAT, 0666);
@@ -71,15 +398,22 @@ static int init_shm_file(const char *path) {
         return -1;
     }
 
-    /* Ensure file is large enough */
-    if (ftruncate(fd, IPC_SHARED_MEM_SIZE) < 0) {
+    /* Map the whole file (QEMU sizes it); grow it to the minimum if new */
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > shm_size)
+        shm_size = (size_t)st.st_size;
+#ifdef __linux__
+    size_t huge = shm_huge_page(fd);
+    if (huge)
+        shm_size = (shm_size + huge - 1) & ~(huge - 1);
+#endif
+    if ((size_t)st.st_size < shm_size && ftruncate(fd, shm_size) < 0) {
         perror("[bridge] Failed to resize shared memory file");
         close(fd);
         return -1;
     }
 
-    shm_base = mmap(NULL, IPC_SHARED_MEM_SIZE, PROT_READ | PROT_WRITE,
-                    MAP_SHARED, fd, 0);
+    shm_base = shm_map(fd, 0);
     close(fd);
 
     if (shm_base == MAP_FAILED) {
@@ -87,15 +421,131 @@ static int init_shm_file(const char *path) {
         return -1;
     }
 
-    /* Set up ring and doorbell pointers */
-    cmd_ring = (volatile ipc_ring_t *)((char *)shm_base + IPC_CMD_RING_OFFSET);
-    rsp_ring = (volatile ipc_rsp_ring_t *)((char *)shm_base + IPC_RSP_RING_OFFSET);
-    doorbell = (volatile doorbell_ctl_t *)((char *)shm_base + IPC_DOORBELL_OFFSET);
+    printf("[bridge] Mapped file-backed shared memory: %s (%zu KB)\n", path,
+           shm_size / 1024);
+    map_regions();
+    return 0;
+}
+
+/* Receive one ivshmem-server message: a little-endian int64 plus an
+ * optional file descriptor. Returns 0, or -1 on EOF/error (-2 if nothing
+ * is queued on a non-blocking socket).
+ */
+static int ivsh_recv(int64_t *val, int *fd) {
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base = val, .iov_len = sizeof(*val) };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = cbuf, .msg_controllen = sizeof(cbuf),
+    };
+
+    *fd = -1;
+    ssize_t n = recvmsg(ivsh_sock, &msg, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return -2;
+    if (n != (ssize_t)sizeof(*val))
+        return -1;
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(c), sizeof(int));
+    }
+    return 0;
+}
+
+/* Peer notifications after the handshake: (id, fd) adds a vector eventfd,
+ * (id, no fd) means the peer left. Only vector 0 is used.
+ */
+static void ivsh_handle_msg(int64_t id, int fd) {
+    if (id < 0 || id >= IVSHMEM_MAX_PEERS) {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    if (id == ivsh_self_id) {
+        if (fd >= 0 && ivsh_self_fd < 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ivsh_self_fd = fd;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    if (fd < 0) {
+        if (ivsh_peer_fd[id] >= 0) {
+            close(ivsh_peer_fd[id]);
+            ivsh_peer_fd[id] = -1;
+            printf("[bridge] ivshmem peer %lld left\n", (long long)id);
+        }
+    } else if (ivsh_peer_fd[id] < 0) {
+        ivsh_peer_fd[id] = fd;
+        printf("[bridge] ivshmem peer %lld joined\n", (long long)id);
+    } else {
+        close(fd); /* Additional vectors */
+    }
+}
+
+static void ivsh_poll_server(void) {
+    int64_t id;
+    int fd;
+    int r;
+
+    while ((r = ivsh_recv(&id, &fd)) == 0)
+        ivsh_handle_msg(id, fd);
+    if (r == -1) {
+        fprintf(stderr, "[bridge] ivshmem-server connection lost\n");
+        close(ivsh_sock);
+        ivsh_sock = -1;
+    }
+}
+
+/* Attach through ivshmem-server's UNIX socket */
+static int init_shm_ivshmem(const char *sock_path) {
+    ivsh_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ivsh_sock < 0) {
+        perror("[bridge] socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+    if (connect(ivsh_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("[bridge] Failed to connect to ivshmem-server");
+        return -1;
+    }
+
+    /* Handshake: protocol version, our ID, then the shared memory fd */
+    int64_t version, id, tag;
+    int fd, shm_fd;
+    if (ivsh_recv(&version, &fd) != 0 || version != 0 ||
+        ivsh_recv(&id, &fd) != 0 || id < 0 || id >= IVSHMEM_MAX_PEERS ||
+        ivsh_recv(&tag, &shm_fd) != 0 || tag != -1 || shm_fd < 0) {
+        fprintf(stderr, "[bridge] Bad ivshmem-server handshake\n");
+        return -1;
+    }
+    ivsh_self_id = id;
+
+    struct stat st;
+    if (fstat(shm_fd, &st) == 0 && (size_t)st.st_size >= IPC_SHARED_MEM_MIN)
+        shm_size = (size_t)st.st_size;
+
+    shm_base = shm_map(shm_fd, 0);
+    close(shm_fd);
+    if (shm_base == MAP_FAILED) {
+        perror("[bridge] Failed to mmap ivshmem region");
+        return -1;
+    }
+
+    map_regions();
+
+    /* Remaining peer/eventfd messages arrive as the server sends them */
+    fcntl(ivsh_sock, F_SETFL, fcntl(ivsh_sock, F_GETFL) | O_NONBLOCK);
+    ivsh_poll_server();
 
-    printf("[bridge] Mapped file-backed shared memory: %s\n", path);
-    printf("[bridge] CMD ring at offset 0x%X\n", IPC_CMD_RING_OFFSET);
-    printf("[bridge] RSP ring at offset 0x%X\n", IPC_RSP_RING_OFFSET);
-    printf("[bridge] Doorbell at offset 0x%X\n", IPC_DOORBELL_OFFSET);
+    printf("[bridge] Attached to ivshmem-server %s as peer %lld\n",
+           sock_path, (long long)ivsh_self_id);
     return 0;
 }
 
@@ -107,7 +557,7 @@ static int init_shm_devmem(void) {
         return -1;
     }
 
-    shm_base = mmap(NULL, IPC_SHARED_MEM_SIZE, PROT_READ | PROT_WRITE,
+    shm_base = mmap(NULL, shm_size, PROT_READ | PROT_WRITE,
                     MAP_SHARED, fd, IPC_SHARED_MEM_PHYS);
     close(fd);
 
@@ -116,14 +566,20 @@ static int init_shm_devmem(void) {
         return -1;
     }
 
-    cmd_ring = (volatile ipc_ring_t *)((char *)shm_base + IPC_CMD_RING_OFFSET);
-    rsp_ring = (volatile ipc_rsp_ring_t *)((char *)shm_base + IPC_RSP_RING_OFFSET);
-    doorbell = (volatile doorbell_ctl_t *)((char *)shm_base + IPC_DOORBELL_OFFSET);
-
-    printf("[bridge] Mapped /dev/mem at 0x%08X\n", IPC_SHARED_MEM_PHYS);
+    printf("[bridge] Mapped /dev/mem at 0x%08X (%zu KB)\n", IPC_SHARED_MEM_PHYS,
+           shm_size / 1024);
+    map_regions();
     return 0;
 }
 
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
 /* Ring the response doorbell to notify ZENEDGE */
 static void ring_rsp_doorbell(uint32_t head) {
     if (!doorbell || doorbell->magic != IPC_DOORBELL_MAGIC)
@@ -141,97 +597,1123 @@ static void ring_rsp_doorbell(uint32_t head) {
     if (doorbell->rsp_flags & DOORBELL_FLAG_IRQ_ENABLED) {
         doorbell->rsp_flags |= DOORBELL_FLAG_PENDING;
         doorbell->rsp_irq_count++;
+
+        /* Real interrupt into the guest when attached via ivshmem-server */
+        uint32_t zen = doorbell->zen_peer_id;
+        if (zen && zen <= IVSHMEM_MAX_PEERS && ivsh_peer_fd[zen - 1] >= 0) {
+            uint64_t one = 1;
+            if (write(ivsh_peer_fd[zen - 1], &one, sizeof(one)) == sizeof(one))
+                stats.irqs_sent++;
+        }
     }
 }
 
-/* Send a response to ZENEDGE */
-static int send_response(uint16_t status, uint16_t orig_cmd, uint32_t result) {
-    if (!rsp_ring || rsp_ring->magic != IPC_RSP_MAGIC) {
-        fprintf(stderr, "[bridge] Response ring not initialized\n");
+/* Write a response into the response ring; the caller rings the doorbell.
+ * Returns: 0, or -1 if the ring is full or not set up
+ */
+static int post_response(const completion_t *c) {
+    if (!rsp_ring || rsp_ring->hdr.magic != IPC_RSP_MAGIC)
         return -1;
-    }
 
-    uint32_t head = rsp_ring->head;
-    uint32_t next_head = (head + 1) % rsp_ring->size;
+    uint32_t head = rsp_ring->hdr.head;
+    uint32_t next_head = head + 1;
 
-    if (next_head == rsp_ring->tail) {
-        fprintf(stderr, "[bridge] Response ring full!\n");
-        return -1;
+    if (head - rsp_tail_cache >= rsp_ring->hdr.size) {
+        rsp_tail_cache = rsp_ring->hdr.tail;
+        if (head - rsp_tail_cache >= rsp_ring->hdr.size)
+            return -1;
     }
 
-    volatile ipc_response_t *rsp = &rsp_ring->data[head];
-    rsp->status = status;
-    rsp->orig_cmd = orig_cmd;
-    rsp->result = result;
+    volatile ipc_response_t *rsp = &rsp_ring->data[head & rsp_ring->hdr.mask];
+    rsp->status = c->status;
+    rsp->orig_cmd = c->orig_cmd;
+    rsp->result = c->result;
     rsp->timestamp = time_usec();
+    rsp->tag = c->tag; /* Echo the request tag for async completion */
+    rsp->reserved = 0;
 
     /* Memory barrier before publishing */
     __sync_synchronize();
 
-    rsp_ring->head = next_head;
+    rsp_ring->hdr.head = next_head;
+    stats.responses_sent++;
+
+    LOG("[bridge]   <- Sent response: status=%s result=0x%08X\n",
+        rsp_name(c->status), c->result);
+    return 0;
+}
+
+/* Append a response record (optionally with inline data) to the message
+ * response ring, inserting a wrap marker if it would straddle the end.
+ * The caller rings the doorbell. Returns: 0, or -1 if it does not fit
+ */
+static int post_msg_response(const completion_t *c, const void *data, uint16_t len) {
+    volatile ipc_msg_ring_t *r = msg_rsp_ring;
+    if (!r || r->hdr.magic != IPC_MSG_MAGIC || len > IPC_MSG_MAX_INLINE)
+        return -1;
+
+    uint32_t size = r->hdr.size;
+    uint32_t head = r->hdr.head;
+    uint32_t off = head & r->hdr.mask;
+    uint32_t need = IPC_MSG_RECORD_SIZE(len);
+    uint32_t skip = (size - off < need) ? size - off : 0;
+
+    if (head + skip + need - r->hdr.tail > size)
+        return -1;
+
+    if (skip) {
+        volatile ipc_msg_hdr_t *wrap = (volatile ipc_msg_hdr_t *)&r->data[off];
+        wrap->kind = IPC_MSG_KIND_WRAP;
+        wrap->len = 0;
+        head += skip;
+        off = 0;
+    }
+
+    volatile ipc_msg_hdr_t *m = (volatile ipc_msg_hdr_t *)&r->data[off];
+    m->kind = IPC_MSG_KIND_DATA;
+    m->len = len;
+    m->cmd = c->orig_cmd;
+    m->status = c->status;
+    m->arg = c->result;
+    m->tag = c->tag;
+    if (len)
+        memcpy((void *)(m + 1), data, len);
+
+    __sync_synchronize();
+    r->hdr.head = head + need;
     stats.responses_sent++;
 
-    /* Ring doorbell to notify ZENEDGE */
-    ring_rsp_doorbell(next_head);
+    LOG("[bridge]   <- Sent msg response: status=%s result=0x%08X len=%u\n",
+        rsp_name(c->status), c->result, len);
+    return 0;
+}
 
-    printf("[bridge]   <- Sent response: status=%s result=0x%08X (doorbell rang)\n",
-           rsp_name(status), result);
+/* =============================================================================
+ * NATIVE ENVIRONMENT (--env)
+ * =============================================================================
+ * The stream half of bridge/zenedge_gym_agent.py in C: CMD_ENV_RESET
+ * (streaming) resets the plugin's instances, publishes the first obs batch
+ * and the clock sync point, and from then on every pass of the dispatcher
+ * loop turns a batch of `envs` actions into a batch of obs entries, one
+ * head update each way. Blob-mode CMD_ENV_STEP needs the shared heap and
+ * stays with the Python agent. Dispatcher thread only.
+ */
+#define ENV_MAX            1024   /* Vector envs (the largest stream ring) */
+#define ENV_RESET_WAIT_US  1000000
+#define ENV_SPIN_US        2000   /* Busy-poll this long after a step */
+
+static const zenedge_env_plugin_t *env_plugin = NULL;
+static void *env_lib = NULL;
+static const char *env_args = "";   /* --env-args */
+static uint32_t env_channel = 0;    /* --channel */
+
+static struct {
+    volatile ipc_ring_hdr_t *obs;
+    volatile ipc_ring_hdr_t *act;
+    uint32_t obs_bytes, act_bytes;  /* Region sizes, for the geometry check */
+    uint32_t entry_size;            /* Obs entry bytes */
+    bool streaming;
+    bool stalled;                   /* FIFO obs ring full; one overrun per stall */
+    uint32_t num_envs;
+    uint32_t split;                 /* First env of group 1 (num_envs: one group) */
+    uint32_t group;                 /* Group whose actions come next */
+    uint32_t created;
+    void *inst[ENV_MAX];
+    uint32_t have;                  /* Actions of the current group in acts[] */
+    action_entry_t acts[ENV_MAX];
+    uint64_t last_step_us;
+    uint64_t steps, batches, episodes;
+} env;
+
+/* The bridge's side of a GYM_BENCH window, as bridge/gym_bench.py's
+ * BenchRecorder: obs publish -> action batch consumed, steps, CPU time
+ */
+static const char *bench_out = NULL;  /* --bench-out */
 
+static struct {
+    bool active;
+    uint64_t pub_ns[2];             /* Each group's last obs out, 0 = answered */
+    uint32_t *lat_ns;
+    uint32_t count, cap;
+    uint64_t steps;
+    uint64_t wall0_ns, cpu0_us;
+} bench;
+
+/* --record: the environment's calls, for envs/replay.so */
+static const char *record_out = NULL;
+static FILE *record_file = NULL;
+static uint64_t record_t0_ns;
+
+static int env_load(const char *path) {
+    env_lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!env_lib) {
+        fprintf(stderr, "[bridge] Failed to load %s: %s\n", path, dlerror());
+        return -1;
+    }
+    const zenedge_env_plugin_t *p = dlsym(env_lib, ZENEDGE_ENV_PLUGIN_SYMBOL);
+    if (!p) {
+        fprintf(stderr, "[bridge] %s has no %s\n", path, ZENEDGE_ENV_PLUGIN_SYMBOL);
+        return -1;
+    }
+    if (p->abi_version != ZENEDGE_ENV_ABI_VERSION || !p->obs_dim ||
+        p->obs_dim > IPC_OBS_DIM_MAX || !p->create || !p->destroy ||
+        !p->reset || !p->step) {
+        fprintf(stderr, "[bridge] %s: unusable plugin (ABI v%u, obs_dim %u)\n",
+                path, p->abi_version, p->obs_dim);
+        return -1;
+    }
+    env_plugin = p;
+    printf("[bridge] Native environment %s (obs_dim %u) from %s\n",
+           p->name ? p->name : "?", p->obs_dim, path);
     return 0;
 }
 
-/* Process a single packet */
-static void process_packet(const ipc_packet_t *pkt) {
-    printf("[bridge] Received: cmd=%s(0x%04X) payload=0x%08X ts=%llu\n",
-           cmd_name(pkt->cmd), pkt->cmd, pkt->payload_id,
-           (unsigned long long)pkt->timestamp);
+static void env_unload(void) {
+    for (uint32_t i = 0; i < env.created; i++)
+        env_plugin->destroy(env.inst[i]);
+    env.created = 0;
+    if (env_lib)
+        dlclose(env_lib);
+    if (record_file) {
+        fclose(record_file);
+        printf("[bridge] Recording saved to %s\n", record_out);
+    }
+}
 
-    stats.packets_received++;
+/* Append one reset or step to the --record log, opening it the first
+ * time. A write error stops the recording, not the environment.
+ */
+static void record_write(uint8_t kind, uint32_t index, uint64_t t0_ns, uint32_t action,
+                         float reward, int done, const float *obs) {
+    if (!record_out)
+        return;
+    uint64_t now = time_nsec();
+    if (!record_file) {
+        record_file = fopen(record_out, "wb");
+        if (!record_file) {
+            perror("[bridge] --record");
+            record_out = NULL;
+            return;
+        }
+        replay_hdr_t hdr = { .magic = REPLAY_MAGIC, .version = REPLAY_VERSION,
+                             .obs_dim = (uint16_t)env_plugin->obs_dim, .start_ns = t0_ns };
+        if (env_plugin->name)
+            strncpy(hdr.name, env_plugin->name, REPLAY_NAME_LEN - 1);
+        record_t0_ns = t0_ns;
+        fwrite(&hdr, sizeof(hdr), 1, record_file);
+    }
+
+    replay_rec_t rec = {
+        .t_ns = now - record_t0_ns,
+        .env_ns = (uint32_t)(now - t0_ns),
+        .env = (uint16_t)index,
+        .kind = kind,
+        .done = (uint8_t)(done != 0),
+        .action = action,
+        .reward = reward,
+    };
+    if (fwrite(&rec, sizeof(rec), 1, record_file) != 1 ||
+        fwrite(obs, 4, env_plugin->obs_dim, record_file) != env_plugin->obs_dim) {
+        perror("[bridge] --record");
+        fclose(record_file);
+        record_file = NULL;
+        record_out = NULL;
+    }
+}
+
+/* Point the rings at this channel's pair, as ZENEDGE laid them out now */
+static bool env_locate(void) {
+    volatile ipc_layout_t *lay = (volatile ipc_layout_t *)shm_base;
+    uint32_t obs_off = IPC_OBS_RING_OFFSET, obs_size = IPC_OBS_RING_BYTES;
+    uint32_t act_off = IPC_ACT_RING_OFFSET, act_size = IPC_ACT_RING_BYTES;
+    bool described = lay->magic == IPC_LAYOUT_MAGIC &&
+                     lay->version == IPC_LAYOUT_VERSION &&
+                     lay->region_count >= IPC_REGION_COUNT;
+
+    if (described) {
+        obs_off = lay->regions[IPC_REGION_OBS_RING].offset;
+        obs_size = lay->regions[IPC_REGION_OBS_RING].size;
+        act_off = lay->regions[IPC_REGION_ACT_RING].offset;
+        act_size = lay->regions[IPC_REGION_ACT_RING].size;
+    }
+    if (env_channel) {
+        uint32_t off = lay->regions[IPC_REGION_STREAM_CHAN].offset;
+        if (!described || !lay->regions[IPC_REGION_STREAM_CHAN].size ||
+            (uint64_t)off + sizeof(ipc_stream_chan_table_t) > shm_size)
+            return false;
+        volatile ipc_stream_chan_table_t *t =
+            (volatile ipc_stream_chan_table_t *)((char *)shm_base + off);
+        if (t->magic != IPC_CHAN_MAGIC || env_channel >= t->count ||
+            t->chans[env_channel].state != IPC_CHAN_OPEN)
+            return false;
+        obs_off = t->chans[env_channel].obs_offset;
+        obs_size = t->chans[env_channel].obs_size;
+        act_off = t->chans[env_channel].act_offset;
+        act_size = t->chans[env_channel].act_size;
+    }
+    if ((uint64_t)obs_off + obs_size > shm_size ||
+        (uint64_t)act_off + act_size > shm_size ||
+        obs_size < IPC_RING_HDR_SIZE || act_size < IPC_RING_HDR_SIZE)
+        return false;
+
+    env.obs = (volatile ipc_ring_hdr_t *)((char *)shm_base + obs_off);
+    env.act = (volatile ipc_ring_hdr_t *)((char *)shm_base + act_off);
+    env.obs_bytes = obs_size;
+    env.act_bytes = act_size;
+    return true;
+}
+
+/* ZENEDGE initialized the ring with this entry size and it fits its region */
+static bool ring_usable(volatile ipc_ring_hdr_t *r, uint32_t entry_size,
+                        uint32_t region_bytes) {
+    uint32_t size = r->size;
+    if (r->magic != IPC_STREAM_MAGIC || !size || (size & (size - 1)))
+        return false;
+    if (r->entry_size && r->entry_size != entry_size)
+        return false;
+    return IPC_RING_HDR_SIZE + (uint64_t)size * entry_size <= region_bytes;
+}
+
+static char *ring_slot(volatile ipc_ring_hdr_t *r, uint32_t index,
+                       uint32_t entry_size) {
+    return (char *)r + IPC_RING_HDR_SIZE + (size_t)(index & r->mask) * entry_size;
+}
+
+/* Obs entries the producer may write past head now */
+static uint32_t obs_space(void) {
+    volatile ipc_ring_hdr_t *r = env.obs;
+    if ((r->flags & IPC_RING_POLICY_MASK) != IPC_RING_POLICY_FIFO)
+        return r->size;
+    uint32_t used = r->head - r->tail;
+    return used < r->size ? r->size - used : 0;
+}
+
+/* Publish count entries written from head on, with the v2 counters */
+static void obs_publish(uint32_t count) {
+    volatile ipc_ring_hdr_t *r = env.obs;
+    uint32_t used = r->head - r->tail;
+    if (used > r->size)
+        used = r->size;
+
+    __sync_synchronize();
+    r->head += count;
+
+    if (used + count > r->size)
+        r->overruns += used + count - r->size;  /* Overwrite policies */
+    uint32_t occupancy = used + count < r->size ? used + count : r->size;
+    if (occupancy > r->max_occupancy)
+        r->max_occupancy = occupancy;
+    env.stalled = false;
+}
+
+/* Write a finished obs entry's trailer; obs[] is already in the slot */
+static void obs_fill(char *slot, uint32_t seq, float reward, float done) {
+    uint32_t dim = env_plugin->obs_dim;
+    float tail[3] = { reward, done, 0.0f };  /* model_id: no model blob */
+    uint32_t ts = (uint32_t)time_nsec();
+    memcpy(slot, &seq, 4);
+    memcpy(slot + 4 + 4 * dim, tail, sizeof(tail));
+    memcpy(slot + 16 + 4 * dim, &ts, 4);
+}
+
+/* Take up to max actions, following the ring's policy like
+ * StreamRing.pop_many(): an overwrite-mode reader that was lapped skips to
+ * the newer half (LATEST: the newest entry) and counts the rest as drops.
+ */
+static uint32_t act_pop(action_entry_t *dst, uint32_t max) {
+    volatile ipc_ring_hdr_t *r = env.act;
+    uint32_t policy = r->flags & IPC_RING_POLICY_MASK;
+    uint32_t size = r->size, tail = r->tail, head = r->head;
+    if (head == tail || !max)
+        return 0;
+    __sync_synchronize();
+
+    if (policy == IPC_RING_POLICY_FIFO) {
+        uint32_t count = head - tail < max ? head - tail : max;
+        for (uint32_t i = 0; i < count; i++)
+            memcpy(&dst[i], ring_slot(r, tail + i, IPC_ACT_ENTRY_SIZE),
+                   IPC_ACT_ENTRY_SIZE);
+        __sync_synchronize();
+        r->tail = tail + count;
+        return count;
+    }
+
+    if (policy == IPC_RING_POLICY_LATEST)
+        max = 1;
+    uint32_t pos, count;
+    for (;;) {
+        pos = tail;
+        if (policy == IPC_RING_POLICY_LATEST)
+            pos = head - 1;
+        else if (head - tail >= size)
+            pos = head - (size / 2 ? size / 2 : 1);  /* Keep the newer half */
+        count = head - pos < max ? head - pos : max;
+        for (uint32_t i = 0; i < count; i++)
+            memcpy(&dst[i], ring_slot(r, pos + i, IPC_ACT_ENTRY_SIZE),
+                   IPC_ACT_ENTRY_SIZE);
+        __sync_synchronize();
+        uint32_t now = r->head;
+        if (now - pos < size)
+            break;
+        head = now;  /* Lapped while copying: retry */
+    }
+    if (pos != tail)
+        r->drops += pos - tail;
+    r->tail = pos + count;
+    return count;
+}
+
+static void bench_published(uint32_t group) {
+    if (bench.active)
+        bench.pub_ns[group] = time_nsec();
+}
+
+static void bench_consumed(uint32_t envs, uint32_t group) {
+    if (!bench.active || !bench.pub_ns[group])
+        return;
+    if (bench.count == bench.cap) {
+        uint32_t cap = bench.cap ? bench.cap * 2 : 65536;
+        uint32_t *p = realloc(bench.lat_ns, (size_t)cap * sizeof(*p));
+        if (!p)
+            return;
+        bench.lat_ns = p;
+        bench.cap = cap;
+    }
+    uint64_t ns = time_nsec() - bench.pub_ns[group];
+    bench.lat_ns[bench.count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+    bench.pub_ns[group] = 0;
+    bench.steps += envs;
+}
+
+/* User + system time of every bridge thread */
+static uint64_t cpu_usec(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+           (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
 
+static void json_pcts(FILE *f, const char *name, const uint32_t *ns, bool mean,
+                      double mean_ns, const char *end) {
+    fprintf(f, "\"%s\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f",
+            name, ns[0] / 1e3, ns[1] / 1e3, ns[2] / 1e3, ns[3] / 1e3);
+    if (mean)
+        fprintf(f, ", \"mean\": %.3f", mean_ns / 1e3);
+    fprintf(f, "}%s", end);
+}
+
+/* The run, in gym_bench.make_run()'s schema */
+static int bench_write(const ipc_env_bench_t *k, double wall_s, double cpu_s) {
+    FILE *f = fopen(bench_out, "w");
+    if (!f) {
+        perror("[bridge] --bench-out");
+        return -1;
+    }
+    uint32_t lat[IPC_ENV_BENCH_PCTS] = { 0 };
+    double mean = 0.0;
+    if (bench.count) {
+        qsort(bench.lat_ns, bench.count, sizeof(uint32_t), cmp_u32);
+        lat[0] = bench.lat_ns[bench.count / 2];
+        lat[1] = bench.lat_ns[(uint64_t)bench.count * 90 / 100];
+        lat[2] = bench.lat_ns[(uint64_t)bench.count * 99 / 100];
+        lat[3] = bench.lat_ns[bench.count - 1];
+        for (uint32_t i = 0; i < bench.count; i++)
+            mean += bench.lat_ns[i];
+        mean /= bench.count;
+    }
+    const char *mode = !(k->flags & IPC_ENV_BENCH_STREAM) ? "blob" :
+                       (k->flags & IPC_ENV_BENCH_PIPELINE) ? "pipeline" : "stream";
+    double el = k->elapsed_us ? (double)k->elapsed_us : 1.0;
+    double busy = (el - (double)k->spin_us - (double)k->sleep_us) * 100.0 / el;
+
+    /* A replayed recording is its own baseline, not the live native env's */
+    const char *bridge = env_plugin->name && strcmp(env_plugin->name, "replay") == 0 ?
+                         "replay" : "native";
+
+    fprintf(f, "{\n  \"name\": \"%s-%s\", \"mode\": \"%s\", \"bridge\": \"%s\",\n",
+            bridge, mode, mode, bridge);
+    fprintf(f, "  \"env\": \"%s\", \"seed\": ", env_plugin->name ? env_plugin->name : "env");
+    if (*env_args >= '0' && *env_args <= '9')
+        fprintf(f, "%llu", (unsigned long long)strtoull(env_args, NULL, 0));
+    else
+        fprintf(f, "null");
+    fprintf(f, ", \"envs\": %u,\n  \"steps\": %u, \"episodes\": %u, \"elapsed_s\": %.6f,\n",
+            k->envs, k->steps, k->episodes, el / 1e6);
+    fprintf(f, "  \"steps_per_sec\": %.1f,\n  ", (double)k->steps * 1e6 / el);
+    json_pcts(f, "step_latency_us", lat, true, mean, ",\n");
+    fprintf(f, "  \"bridge_steps\": %llu, \"bridge_cpu_pct\": %.2f,\n",
+            (unsigned long long)bench.steps, wall_s > 0 ? 100.0 * cpu_s / wall_s : 0.0);
+    fprintf(f, "  \"kernel\": {\"spin_us\": %llu, \"sleep_us\": %llu, \"spin_pct\": %.2f, "
+            "\"idle_pct\": %.2f, \"busy_pct\": %.2f,\n    ",
+            (unsigned long long)k->spin_us, (unsigned long long)k->sleep_us,
+            (double)k->spin_us * 100.0 / el, (double)k->sleep_us * 100.0 / el,
+            busy > 0 ? busy : 0.0);
+    json_pcts(f, "period_us", k->period_ns, false, 0, ", ");
+    json_pcts(f, "infer_us", k->infer_ns, false, 0, "}\n}\n");
+    fclose(f);
+
+    printf("[bridge] Bench: %u steps in %.3f s (%.0f steps/s), obs -> action p50 %.1f us "
+           "p99 %.1f us, bridge CPU %.1f%% -> %s\n", k->steps, el / 1e6,
+           (double)k->steps * 1e6 / el, lat[0] / 1e3, lat[2] / 1e3,
+           wall_s > 0 ? 100.0 * cpu_s / wall_s : 0.0, bench_out);
+    return 0;
+}
+
+/* CMD_ENV_BENCH: the window opens, or closes with the kernel's figures */
+static uint16_t env_bench(const uint8_t *inl, uint16_t len) {
+    ipc_env_bench_t k;
+    if (len < sizeof(k))
+        return RSP_ERROR;
+    memcpy(&k, inl, sizeof(k));
+    if (k.magic != IPC_ENV_BENCH_MAGIC || k.version != IPC_ENV_BENCH_VERSION)
+        return RSP_ERROR;
+
+    if (!(k.flags & IPC_ENV_BENCH_DONE)) {
+        bench.active = true;
+        bench.pub_ns[0] = bench.pub_ns[1] = 0;
+        bench.count = 0;
+        bench.steps = 0;
+        bench.wall0_ns = time_nsec();
+        bench.cpu0_us = cpu_usec();
+        printf("[bridge] Bench window open (%u envs per step)\n", k.envs);
+        return RSP_OK;
+    }
+    if (!bench.active)
+        return RSP_ERROR;
+    bench.active = false;
+    double wall_s = (double)(time_nsec() - bench.wall0_ns) / 1e9;
+    double cpu_s = (double)(cpu_usec() - bench.cpu0_us) / 1e6;
+    if (bench_out) {
+        bench_write(&k, wall_s, cpu_s);
+        running = false;  /* Out once this reply is flushed */
+    }
+    return RSP_OK;
+}
+
+/* CMD_ENV_RESET: start env.num_envs episodes on the stream rings */
+static uint16_t env_reset(uint32_t payload, uint32_t *result) {
+    const zenedge_env_plugin_t *p = env_plugin;
+    *result = 0;
+    env.streaming = false;
+
+    if (!(payload & ENV_RESET_FLAG_STREAM)) {
+        fprintf(stderr, "[bridge] ENV_RESET without streaming: blob-mode steps "
+                "need the Python gym agent\n");
+        return RSP_ERROR;
+    }
+    env.entry_size = IPC_OBS_ENTRY_SIZE(p->obs_dim);
+    if (!env_locate() ||
+        !ring_usable(env.obs, env.entry_size, env.obs_bytes) ||
+        !ring_usable(env.act, IPC_ACT_ENTRY_SIZE, env.act_bytes)) {
+        fprintf(stderr, "[bridge] ENV_RESET: stream channel %u not ready\n",
+                env_channel);
+        return RSP_ERROR;
+    }
+    uint32_t dim = env.obs->obs_dim ? env.obs->obs_dim : IPC_OBS_DIM;
+    if (dim != p->obs_dim) {
+        fprintf(stderr, "[bridge] ENV_RESET: obs ring carries %u floats, %s has %u\n",
+                dim, p->name ? p->name : "the plugin", p->obs_dim);
+        return RSP_ERROR;
+    }
+
+    uint32_t n = ENV_RESET_UNPACK_ENVS(payload);
+    if (n > env.obs->size || n > env.act->size || n > ENV_MAX) {
+        fprintf(stderr, "[bridge] ENV_RESET: %u envs exceed the stream rings "
+                "(%u entries)\n", n, env.obs->size);
+        return RSP_ERROR;
+    }
+    while (env.created < n) {
+        void *e = p->create(env.created, env_args);
+        if (!e) {
+            fprintf(stderr, "[bridge] ENV_RESET: creating env %u failed\n", env.created);
+            return RSP_ERROR;
+        }
+        env.inst[env.created++] = e;
+    }
+
+    /* ZENEDGE is waiting on the reply, so a full ring drains shortly */
+    uint64_t deadline = time_usec() + ENV_RESET_WAIT_US;
+    while (obs_space() < n) {
+        if (time_usec() > deadline) {
+            fprintf(stderr, "[bridge] ENV_RESET: obs ring stayed full\n");
+            return RSP_ERROR;
+        }
+        usleep(500);
+    }
+    uint32_t head = env.obs->head;
+    for (uint32_t i = 0; i < n; i++) {
+        char *slot = ring_slot(env.obs, head + i, env.entry_size);
+        uint64_t t0 = time_nsec();
+        p->reset(env.inst[i], (float *)(slot + 4));
+        record_write(REPLAY_REC_RESET, i, t0, 0, 0.0f, 0, (float *)(slot + 4));
+        obs_fill(slot, 0, 0.0f, 0.0f);
+    }
+    obs_publish(n);
+    bench_published(0);
+    bench_published(1);
+
+    /* Clock sync point: the response follows */
+    env.obs->clock_ns = time_nsec();
+    __sync_synchronize();
+    uint32_t seq = env.obs->clock_seq + 1;
+    env.obs->clock_seq = seq ? seq : 1;
+
+    env.num_envs = n;
+    env.split = (payload & ENV_RESET_FLAG_PIPELINE) && n > 1 ? ENV_PIPELINE_SPLIT(n) : n;
+    env.group = 0;
+    env.have = 0;
+    env.streaming = true;
+    env.last_step_us = time_usec();
+    LOG("[bridge]   -> ENV_RESET: %u x %s streaming on channel %u%s\n", n,
+        p->name ? p->name : "env", env_channel, env.split < n ? ", pipelined" : "");
+    return RSP_OK;
+}
+
+/* One stream step: a full group of actions in (the whole batch unless
+ * ZENEDGE pipelines, then each half in turn), the group's obs out.
+ * Actions stay in their ring while a FIFO obs ring has no room for the
+ * answer. Returns true if anything moved.
+ */
+static bool env_poll(void) {
+    if (!env.streaming)
+        return false;
+    if (env.obs->magic != IPC_STREAM_MAGIC || env.act->magic != IPC_STREAM_MAGIC) {
+        env.streaming = false;  /* ZENEDGE re-laid out; wait for its next reset */
+        return false;
+    }
+
+    uint32_t first = env.group ? env.split : 0;
+    uint32_t n = env.group ? env.num_envs - env.split : env.split;
+    if (obs_space() < n) {
+        if (!env.stalled && env.act->head != env.act->tail) {
+            env.obs->overruns++;
+            env.stalled = true;
+        }
+        return false;
+    }
+    uint32_t got = act_pop(&env.acts[env.have], n - env.have);
+    if (!got)
+        return false;
+    env.have += got;
+    if (env.have < n)
+        return true;
+    env.have = 0;
+    uint32_t group = env.group;
+    bench_consumed(n, group);
+    if (env.split < env.num_envs)
+        env.group ^= 1;
+
+    const zenedge_env_plugin_t *p = env_plugin;
+    uint32_t head = env.obs->head;
+    for (uint32_t i = 0; i < n; i++) {
+        char *slot = ring_slot(env.obs, head + i, env.entry_size);
+        float *obs = (float *)(slot + 4);
+        float reward = 0.0f;
+        uint64_t t0 = time_nsec();
+        int rc = p->step(env.inst[first + i], env.acts[i].action, obs, &reward);
+        if (rc >= 0)
+            record_write(REPLAY_REC_STEP, first + i, t0, env.acts[i].action, reward, rc, obs);
+        if (rc < 0) {
+            fprintf(stderr, "[bridge] %s: step failed, streaming stopped\n",
+                    p->name ? p->name : "env");
+            env.streaming = false;
+            return false;
+        }
+        if (rc) {
+            env.episodes++;
+            if (env.num_envs > 1) {
+                /* Auto-reset; the entry still reports done */
+                t0 = time_nsec();
+                p->reset(env.inst[first + i], obs);
+                record_write(REPLAY_REC_RESET, first + i, t0, 0, 0.0f, 0, obs);
+            }
+        }
+        obs_fill(slot, env.acts[i].seq + 1, reward, rc ? 1.0f : 0.0f);
+    }
+    obs_publish(n);
+    bench_published(group);
+
+    env.steps += n;
+    env.batches++;
+    env.last_step_us = time_usec();
+    return true;
+}
+
+/* CMD_ENV_RESET / CMD_ENV_STEP / CMD_ENV_BENCH with a plugin loaded */
+static uint16_t env_command(uint16_t cmd, uint32_t payload, const uint8_t *inl,
+                            uint16_t len, uint32_t *result) {
+    if (cmd == CMD_ENV_RESET)
+        return env_reset(payload, result);
+    if (cmd == CMD_ENV_BENCH) {
+        *result = 0;
+        return env_bench(inl, len);
+    }
+
+    /* Steps travel on the action ring while streaming */
+    LOG("[bridge]   -> ENV_STEP outside the stream (%s)\n",
+        env.streaming ? "ignored" : "blob mode needs the Python gym agent");
+    *result = 0;
+    return RSP_ERROR;
+}
+
+/* Execute a command. Inline payload (message ring) is passed in inl/len.
+ * Runs on the dispatcher or a worker thread.
+ */
+static void handle_command(const ipc_packet_t *pkt, const uint8_t *inl,
+                           uint16_t len, uint16_t *status_out,
+                           uint32_t *result_out) {
     uint16_t status = RSP_OK;
     uint32_t result = 0;
 
     switch (pkt->cmd) {
         case CMD_PING:
-            printf("[bridge]   -> PONG\n");
+            LOG("[bridge]   -> PONG\n");
             result = 0x504F4E47; /* "PONG" */
             break;
 
         case CMD_PRINT:
+            if (len) {
+                printf("[bridge]   -> PRINT (inline): %.*s\n", (int)len,
+                       (const char *)inl);
+                result = len;
+                break;
+            }
             printf("[bridge]   -> PRINT request (payload_id=%u)\n", pkt->payload_id);
             result = pkt->payload_id;
             break;
 
         case CMD_RUN_MODEL:
-            printf("[bridge]   -> RUN_MODEL request (model_id=%u)\n", pkt->payload_id);
+            LOG("[bridge]   -> RUN_MODEL request (model_id=%u)\n", pkt->payload_id);
             /* TODO: Dispatch to CUDA/OneAPI runtime */
-            printf("[bridge]   -> [SIMULATED] Model execution complete\n");
+            LOG("[bridge]   -> [SIMULATED] Model execution complete\n");
             result = 0x12345678; /* Mock inference result */
             break;
 
+        case CMD_ENV_RESET:
+        case CMD_ENV_STEP:
+        case CMD_ENV_BENCH:
+            if (env_plugin) {
+                status = env_command(pkt->cmd, pkt->payload_id, inl, len, &result);
+                break;
+            }
+            /* fall through - no native environment */
         default:
-            printf("[bridge]   -> Unknown command, sending error\n");
+            LOG("[bridge]   -> Unknown command, sending error\n");
             status = RSP_ERROR;
             result = pkt->cmd; /* Echo back unknown command */
-            stats.errors++;
+            __atomic_fetch_add(&stats.errors, 1, __ATOMIC_RELAXED);
             break;
     }
 
-    stats.packets_processed++;
+    __atomic_fetch_add(&stats.packets_processed, 1, __ATOMIC_RELAXED);
+    *status_out = status;
+    *result_out = result;
+}
+
+/* Worker queue for cmd, or -1 to answer it on the dispatcher thread
+ * (PING/PRINT cost less than the hand-off)
+ */
+static int cmd_queue(uint16_t cmd) {
+    if (!workers_per_queue || cmd == CMD_PING || cmd == CMD_PRINT)
+        return -1;
+    /* The dispatcher steps a native environment, so it owns its commands */
+    if (env_plugin && (cmd >> 8) == (CMD_ENV_RESET >> 8))
+        return -1;
+    return (cmd >> 8) < BRIDGE_QUEUES ? (int)(cmd >> 8) : -1;
+}
+
+/* Room for one more command bound for queue q (dispatcher only) */
+static bool can_dispatch(int q) {
+    if (in_workers + (pend_head - pend_tail) >= COMPLETION_DEPTH)
+        return false;
+    if (q < 0)
+        return true;
+    work_queue_t *wq = &queues[q];
+    pthread_mutex_lock(&wq->lock);
+    bool room = wq->head - wq->tail < WORK_QUEUE_DEPTH;
+    pthread_mutex_unlock(&wq->lock);
+    return room;
+}
+
+/* Run the command here or hand it to its queue; can_dispatch() said yes */
+static void dispatch(const ipc_packet_t *pkt, bool msg, const uint8_t *inl,
+                     uint16_t len) {
+    int q = cmd_queue(pkt->cmd);
+    if (q < 0) {
+        completion_t *c = &pending[pend_head++ % COMPLETION_DEPTH];
+        handle_command(pkt, inl, len, &c->status, &c->result);
+        c->orig_cmd = pkt->cmd;
+        c->tag = pkt->tag;
+        c->msg = msg;
+        return;
+    }
+
+    work_queue_t *wq = &queues[q];
+    pthread_mutex_lock(&wq->lock);
+    work_item_t *w = &wq->items[wq->head++ % WORK_QUEUE_DEPTH];
+    w->pkt = *pkt;
+    w->msg = msg;
+    w->len = len;
+    if (len)
+        memcpy(w->inl, inl, len);
+    pthread_cond_signal(&wq->ready);
+    pthread_mutex_unlock(&wq->lock);
+    in_workers++;
+}
+
+static void *worker_main(void *arg) {
+    work_queue_t *wq = arg;
+    work_item_t w;
 
-    /* Send response */
-    send_response(status, pkt->cmd, result);
+    for (;;) {
+        pthread_mutex_lock(&wq->lock);
+        while (wq->head == wq->tail && running)
+            pthread_cond_wait(&wq->ready, &wq->lock);
+        if (wq->head == wq->tail) {
+            pthread_mutex_unlock(&wq->lock);
+            break;
+        }
+        work_item_t *src = &wq->items[wq->tail % WORK_QUEUE_DEPTH];
+        w.pkt = src->pkt;
+        w.msg = src->msg;
+        w.len = src->len;
+        if (w.len)
+            memcpy(w.inl, src->inl, w.len);
+        wq->tail++;
+        wq->handled++;
+        pthread_mutex_unlock(&wq->lock);
+
+        completion_t c = { .orig_cmd = w.pkt.cmd, .tag = w.pkt.tag, .msg = w.msg };
+        handle_command(&w.pkt, w.inl, w.len, &c.status, &c.result);
+
+        /* Never full: the dispatcher bounds what is outstanding */
+        pthread_mutex_lock(&done_q.lock);
+        bool was_empty = done_q.head == done_q.tail;
+        done_q.items[done_q.head++ % COMPLETION_DEPTH] = c;
+        pthread_mutex_unlock(&done_q.lock);
+        if (was_empty) {
+            char b = 1;
+            if (write(done_pipe[1], &b, 1) < 0) {
+                /* Pipe full: the dispatcher has a wakeup coming anyway */
+            }
+        }
+    }
+    return NULL;
 }
 
-/* Main polling loop */
+static int start_workers(void) {
+    if (pipe(done_pipe) < 0) {
+        perror("[bridge] pipe");
+        return -1;
+    }
+    fcntl(done_pipe[0], F_SETFL, fcntl(done_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(done_pipe[1], F_SETFL, fcntl(done_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    for (uint32_t q = 0; q < BRIDGE_QUEUES; q++) {
+        pthread_mutex_init(&queues[q].lock, NULL);
+        pthread_cond_init(&queues[q].ready, NULL);
+        for (uint32_t i = 0; i < workers_per_queue; i++) {
+            if (pthread_create(&queues[q].threads[i], NULL, worker_main, &queues[q]) != 0) {
+                fprintf(stderr, "[bridge] Failed to start %s worker %u\n",
+                        queue_names[q], i);
+                return -1;
+            }
+        }
+    }
+    if (workers_per_queue)
+        printf("[bridge] %u worker(s) per queue (%u queues)\n",
+               workers_per_queue, BRIDGE_QUEUES);
+    return 0;
+}
+
+/* running is false: let the workers finish their queues and exit */
+static void stop_workers(void) {
+    for (uint32_t q = 0; q < BRIDGE_QUEUES; q++) {
+        pthread_mutex_lock(&queues[q].lock);
+        pthread_cond_broadcast(&queues[q].ready);
+        pthread_mutex_unlock(&queues[q].lock);
+    }
+    for (uint32_t q = 0; q < BRIDGE_QUEUES; q++)
+        for (uint32_t i = 0; i < workers_per_queue; i++)
+            pthread_join(queues[q].threads[i], NULL);
+}
+
+/* Move the workers' completions into pending */
+static void collect_completions(void) {
+    char buf[64];
+    while (read(done_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+
+    pthread_mutex_lock(&done_q.lock);
+    while (done_q.tail != done_q.head) {
+        pending[pend_head++ % COMPLETION_DEPTH] =
+            done_q.items[done_q.tail++ % COMPLETION_DEPTH];
+        in_workers--;
+    }
+    pthread_mutex_unlock(&done_q.lock);
+}
+
+/* Post as many pending responses as the rings take, in order, then ring
+ * the doorbell once for all of them
+ */
+static void flush_responses(void) {
+    static bool warned_full = false;
+    uint32_t posted = 0;
+
+    while (pend_tail != pend_head) {
+        const completion_t *c = &pending[pend_tail % COMPLETION_DEPTH];
+        if ((c->msg ? post_msg_response(c, NULL, 0) : post_response(c)) != 0)
+            break;
+        pend_tail++;
+        posted++;
+    }
+
+    if (pend_tail != pend_head) {
+        stats.ring_full++;
+        if (!warned_full)
+            fprintf(stderr, "[bridge] Response ring full, holding %u responses\n",
+                    pend_head - pend_tail);
+        warned_full = true;
+    } else {
+        warned_full = false;
+    }
+
+    if (posted) {
+        stats.batches++;
+        ring_rsp_doorbell(rsp_ring->hdr.head);
+    }
+}
+
+static bool msg_ring_has_work(void) {
+    return msg_cmd_ring && msg_cmd_ring->hdr.magic == IPC_MSG_MAGIC &&
+           msg_cmd_ring->hdr.head != msg_cmd_ring->hdr.tail;
+}
+
+/* Consume one record from the message command ring, if any and there is
+ * room to take it
+ */
+static bool poll_msg_ring(void) {
+    volatile ipc_msg_ring_t *r = msg_cmd_ring;
+
+    while (msg_ring_has_work()) {
+        uint32_t tail = r->hdr.tail;
+        uint32_t off = tail & r->hdr.mask;
+        __sync_synchronize();
+
+        volatile ipc_msg_hdr_t *m = (volatile ipc_msg_hdr_t *)&r->data[off];
+        if (m->kind == IPC_MSG_KIND_WRAP) {
+            r->hdr.tail = tail + (r->hdr.size - off);
+            continue;
+        }
+
+        ipc_msg_hdr_t hdr = *(const ipc_msg_hdr_t *)m;
+        if (!can_dispatch(cmd_queue(hdr.cmd)))
+            return false;
+
+        uint8_t payload[IPC_MSG_MAX_INLINE];
+        uint16_t len = hdr.len <= IPC_MSG_MAX_INLINE ? hdr.len : IPC_MSG_MAX_INLINE;
+        memcpy(payload, (const void *)(m + 1), len);
+
+        __sync_synchronize();
+        r->hdr.tail = tail + IPC_MSG_RECORD_SIZE(hdr.len);
+
+        ipc_packet_t pkt = {
+            .cmd = hdr.cmd, .flags = hdr.status, .payload_id = hdr.arg,
+            .timestamp = 0, .tag = hdr.tag,
+        };
+        LOG("[bridge] Received msg: cmd=%s(0x%04X) arg=0x%08X len=%u tag=0x%08X\n",
+            cmd_name(pkt.cmd), pkt.cmd, pkt.payload_id, len, pkt.tag);
+        stats.packets_received++;
+
+        dispatch(&pkt, true, payload, len);
+        return true;
+    }
+    return false;
+}
+
+/* Consume one packet from the command ring, if one is published and
+ * there is room to take it
+ */
+static bool poll_cmd_ring(void) {
+    uint32_t tail = cmd_ring->hdr.tail;
+    uint32_t slot = tail & cmd_ring->hdr.mask;
+    bool mpsc = (cmd_ring->hdr.flags & IPC_RING_FLAG_MPSC) != 0;
+    volatile uint32_t *seq = IPC_RING_SEQ(cmd_ring);
+
+    if (mpsc) {
+        /* Multi-producer: head only counts claims, the slot's sequence
+         * number says whether it has been published */
+        if (__atomic_load_n(&seq[slot], __ATOMIC_ACQUIRE) != tail + 1)
+            return false;
+    } else if (tail == cmd_head_cache ||
+               cmd_head_cache - tail > cmd_ring->hdr.size) {
+        /* Refresh the cached head when the ring looks empty, or when it
+         * is inconsistent with tail (kernel re-initialized the rings) */
+        cmd_head_cache = cmd_ring->hdr.head;
+        if (tail == cmd_head_cache)
+            return false;
+    }
+
+    __sync_synchronize();
+    volatile ipc_packet_t *pkt = &cmd_ring->data[slot];
+
+    /* Copy to local to avoid torn reads */
+    ipc_packet_t local_pkt;
+    local_pkt.cmd = pkt->cmd;
+    local_pkt.flags = pkt->flags;
+    local_pkt.payload_id = pkt->payload_id;
+    local_pkt.timestamp = pkt->timestamp;
+    local_pkt.tag = pkt->tag;
+
+    /* Leave it in the ring until it can be taken */
+    if (!can_dispatch(cmd_queue(local_pkt.cmd)))
+        return false;
+
+    /* Memory barrier before updating tail */
+    __sync_synchronize();
+
+    /* Release the slot (MPSC) and update tail (consumer index) */
+    if (mpsc)
+        __atomic_store_n(&seq[slot], tail + cmd_ring->hdr.size,
+                         __ATOMIC_RELEASE);
+    cmd_ring->hdr.tail = tail + 1;
+
+    LOG("[bridge] Received: cmd=%s(0x%04X) payload=0x%08X ts=%llu tag=0x%08X\n",
+        cmd_name(local_pkt.cmd), local_pkt.cmd, local_pkt.payload_id,
+        (unsigned long long)local_pkt.timestamp, local_pkt.tag);
+    stats.packets_received++;
+
+    dispatch(&local_pkt, false, NULL, 0);
+    return true;
+}
+
+/* Check the ring layout offered in the doorbell block and ack it.
+ * Returns true once attached with a layout this bridge speaks.
+ */
+static bool negotiate_version(void) {
+    static uint32_t warned_version = 0;
+
+    if (!doorbell || doorbell->magic != IPC_DOORBELL_MAGIC)
+        return false;
+
+    uint32_t version = doorbell->version;
+    if (version != IPC_PROTO_VERSION) {
+        if (version != warned_version) {
+            fprintf(stderr, "[bridge] Unsupported ring protocol v%u (want v%u)\n",
+                    version, IPC_PROTO_VERSION);
+            warned_version = version;
+        }
+        return false;
+    }
+
+    /* Publish our ivshmem peer ID so ZENEDGE can ring our doorbell */
+    uint32_t self = ivsh_self_fd >= 0 ? (uint32_t)ivsh_self_id + 1 : 0;
+    if (doorbell->bridge_peer_id != self)
+        doorbell->bridge_peer_id = self;
+
+    if (doorbell->peer_version != version) {
+        doorbell->peer_version = version;
+        cmd_head_cache = cmd_ring->hdr.tail;
+        rsp_tail_cache = rsp_ring->hdr.tail;
+        printf("[bridge] Attached with ring protocol v%u\n", version);
+    }
+    return true;
+}
+
+/* True if the packet at tail has been published */
+static bool cmd_ring_has_work(void) {
+    uint32_t tail = cmd_ring->hdr.tail;
+
+    if (msg_ring_has_work())
+        return true;
+    if (cmd_ring->hdr.flags & IPC_RING_FLAG_MPSC)
+        return __atomic_load_n(&IPC_RING_SEQ(cmd_ring)[tail & cmd_ring->hdr.mask],
+                               __ATOMIC_ACQUIRE) == tail + 1;
+    return cmd_ring->hdr.head != tail;
+}
+
+static bool completions_waiting(void) {
+    pthread_mutex_lock(&done_q.lock);
+    bool waiting = done_q.head != done_q.tail;
+    pthread_mutex_unlock(&done_q.lock);
+    return waiting;
+}
+
+/* Nothing to take: block on our eventfd (or nap) until ZENEDGE sends or
+ * a worker finishes. Arming DOORBELL_FLAG_IRQ_ENABLED asks ZENEDGE for a
+ * BAR0 doorbell on its next send; re-checking the ring afterwards closes
+ * the race with a send that happened just before the flag was visible.
+ * Busy-poll mode never sleeps.
+ */
+static void wait_for_work(void) {
+    if (busy_poll_cpu >= 0) {
+        cpu_relax();
+        return;
+    }
+
+    /* Right after a stream step the next action is close behind: spin,
+     * yielding in case the producer shares our CPU
+     */
+    if (env.streaming && time_usec() - env.last_step_us < ENV_SPIN_US) {
+        sched_yield();
+        return;
+    }
+
+    /* Held responses or a stream (actions raise no doorbell): come back
+     * soon */
+    int timeout = pend_head != pend_tail || env.streaming ? 1 : 100;
+
+    struct pollfd pfd[3] = {
+        { .fd = done_pipe[0], .events = POLLIN },
+        { .fd = ivsh_self_fd, .events = POLLIN },
+        { .fd = ivsh_sock, .events = POLLIN },
+    };
+
+    if (ivsh_self_fd < 0 || !doorbell->bridge_peer_id) {
+        if (!completions_waiting())
+            poll(pfd, 1, 1);  /* 1ms */
+        return;
+    }
+
+    uint64_t cnt;
+    while (read(ivsh_self_fd, &cnt, sizeof(cnt)) == sizeof(cnt)) {
+        /* Drain stale backstop kicks */
+    }
+
+    __atomic_fetch_or(&doorbell->cmd_flags, DOORBELL_FLAG_IRQ_ENABLED,
+                      __ATOMIC_SEQ_CST);
+    if (!cmd_ring_has_work() && !completions_waiting()) {
+        uint64_t t0 = time_usec();
+        poll(pfd, ivsh_sock >= 0 ? 3 : 2, timeout);  /* 100ms: re-check attach */
+        stats.sleep_usec += time_usec() - t0;
+        stats.wakeups++;
+
+        if (pfd[1].revents & POLLIN)
+            while (read(ivsh_self_fd, &cnt, sizeof(cnt)) == sizeof(cnt)) {
+            }
+        if (ivsh_sock >= 0 && (pfd[2].revents & (POLLIN | POLLHUP)))
+            ivsh_poll_server();
+    }
+    __atomic_fetch_and(&doorbell->cmd_flags, ~DOORBELL_FLAG_IRQ_ENABLED,
+                       __ATOMIC_SEQ_CST);
+    doorbell->cmd_flags &= ~DOORBELL_FLAG_PENDING;
+}
+
+/* Main dispatch loop */
 static void poll_loop(void) {
     printf("[bridge] Entering poll loop (Ctrl+C to stop)...\n\n");
 
     uint32_t last_doorbell = 0;
 
     while (running) {
-        /* Check command ring magic */
-        if (cmd_ring->magic != IPC_MAGIC) {
+        /* Check command ring magic and layout */
+        if (cmd_ring->hdr.magic != IPC_MAGIC || !negotiate_version()) {
+            map_regions();  /* ZENEDGE may not have published its layout yet */
             usleep(100000);  /* 100ms */
             continue;
         }
@@ -246,31 +1728,21 @@ static void poll_loop(void) {
             }
         }
 
-        uint32_t head = cmd_ring->head;
-        uint32_t tail = cmd_ring->tail;
+        /* A batch of commands, inline-payload ones first */
+        uint32_t taken = 0;
+        while (taken < DISPATCH_BATCH && (poll_msg_ring() || poll_cmd_ring()))
+            taken++;
 
-        if (head == tail) {
-            usleep(1000);  /* 1ms */
-            continue;
-        }
+        /* Everything answered so far goes out behind one doorbell */
+        uint32_t held = pend_head - pend_tail;
+        collect_completions();
+        bool answered = pend_head - pend_tail != held;
+        flush_responses();
 
-        /* Process packet */
-        volatile ipc_packet_t *pkt = &cmd_ring->data[tail];
+        bool stepped = env_poll();
 
-        /* Copy to local to avoid torn reads */
-        ipc_packet_t local_pkt;
-        local_pkt.cmd = pkt->cmd;
-        local_pkt.flags = pkt->flags;
-        local_pkt.payload_id = pkt->payload_id;
-        local_pkt.timestamp = pkt->timestamp;
-
-        process_packet(&local_pkt);
-
-        /* Memory barrier before updating tail */
-        __sync_synchronize();
-
-        /* Update tail (consumer index) */
-        cmd_ring->tail = (tail + 1) % cmd_ring->size;
+        if (!taken && !answered && !stepped)
+            wait_for_work();
     }
 }
 
@@ -282,6 +1754,25 @@ static void print_stats(void) {
     printf("[bridge] Responses sent:    %llu\n", (unsigned long long)stats.responses_sent);
     printf("[bridge] Doorbell rings:    %llu\n", (unsigned long long)stats.doorbell_rings);
     printf("[bridge] Errors:            %llu\n", (unsigned long long)stats.errors);
+    if (stats.batches)
+        printf("[bridge] Response batches:  %llu (%.1f per doorbell, ring full %llu times)\n",
+               (unsigned long long)stats.batches,
+               (double)stats.responses_sent / (double)stats.batches,
+               (unsigned long long)stats.ring_full);
+    if (env_plugin)
+        printf("[bridge] Env steps:         %llu (%llu batches, %llu episodes)\n",
+               (unsigned long long)env.steps, (unsigned long long)env.batches,
+               (unsigned long long)env.episodes);
+    for (uint32_t q = 0; workers_per_queue && q < BRIDGE_QUEUES; q++)
+        printf("[bridge] Queue %-10s %llu commands\n", queue_names[q],
+               (unsigned long long)queues[q].handled);
+    if (ivsh_self_fd >= 0) {
+        printf("[bridge] Eventfd wakeups:   %llu (slept %llu us)\n",
+               (unsigned long long)stats.wakeups,
+               (unsigned long long)stats.sleep_usec);
+        printf("[bridge] IRQs to ZENEDGE:   %llu\n",
+               (unsigned long long)stats.irqs_sent);
+    }
 }
 
 /* Print ring buffer status */
@@ -290,27 +1781,25 @@ static void print_ring_status(void) {
 
     if (cmd_ring) {
         printf("[bridge] CMD Ring:\n");
-        printf("[bridge]   Magic: 0x%08X %s\n", cmd_ring->magic,
-               cmd_ring->magic == IPC_MAGIC ? "(valid)" : "(INVALID)");
-        printf("[bridge]   Head:  %u\n", cmd_ring->head);
-        printf("[bridge]   Tail:  %u\n", cmd_ring->tail);
-        printf("[bridge]   Size:  %u\n", cmd_ring->size);
-        uint32_t pending = (cmd_ring->head >= cmd_ring->tail)
-                           ? (cmd_ring->head - cmd_ring->tail)
-                           : (cmd_ring->size - cmd_ring->tail + cmd_ring->head);
+        printf("[bridge]   Magic: 0x%08X %s\n", cmd_ring->hdr.magic,
+               cmd_ring->hdr.magic == IPC_MAGIC ? "(valid)" : "(INVALID)");
+        printf("[bridge]   Head:  %u\n", cmd_ring->hdr.head);
+        printf("[bridge]   Tail:  %u\n", cmd_ring->hdr.tail);
+        printf("[bridge]   Size:  %u\n", cmd_ring->hdr.size);
+        printf("[bridge]   Mode:  %s\n",
+               (cmd_ring->hdr.flags & IPC_RING_FLAG_MPSC) ? "MPSC" : "SPSC");
+        uint32_t pending = cmd_ring->hdr.head - cmd_ring->hdr.tail;
         printf("[bridge]   Pending: %u packets\n", pending);
     }
 
     if (rsp_ring) {
         printf("[bridge] RSP Ring:\n");
-        printf("[bridge]   Magic: 0x%08X %s\n", rsp_ring->magic,
-               rsp_ring->magic == IPC_RSP_MAGIC ? "(valid)" : "(INVALID)");
-        printf("[bridge]   Head:  %u\n", rsp_ring->head);
-        printf("[bridge]   Tail:  %u\n", rsp_ring->tail);
-        printf("[bridge]   Size:  %u\n", rsp_ring->size);
-        uint32_t pending = (rsp_ring->head >= rsp_ring->tail)
-                           ? (rsp_ring->head - rsp_ring->tail)
-                           : (rsp_ring->size - rsp_ring->tail + rsp_ring->head);
+        printf("[bridge]   Magic: 0x%08X %s\n", rsp_ring->hdr.magic,
+               rsp_ring->hdr.magic == IPC_RSP_MAGIC ? "(valid)" : "(INVALID)");
+        printf("[bridge]   Head:  %u\n", rsp_ring->hdr.head);
+        printf("[bridge]   Tail:  %u\n", rsp_ring->hdr.tail);
+        printf("[bridge]   Size:  %u\n", rsp_ring->hdr.size);
+        uint32_t pending = rsp_ring->hdr.head - rsp_ring->hdr.tail;
         printf("[bridge]   Pending: %u responses\n", pending);
     }
 
@@ -318,6 +1807,8 @@ static void print_ring_status(void) {
         printf("[bridge] Doorbell:\n");
         printf("[bridge]   Magic: 0x%08X %s\n", doorbell->magic,
                doorbell->magic == IPC_DOORBELL_MAGIC ? "(valid)" : "(INVALID)");
+        printf("[bridge]   Version: %u (bridge speaks v%u)\n",
+               doorbell->version, IPC_PROTO_VERSION);
         printf("[bridge]   CMD doorbell: %u (writes: %u, irqs: %u)\n",
                doorbell->cmd_doorbell, doorbell->cmd_writes, doorbell->cmd_irq_count);
         printf("[bridge]   RSP doorbell: %u (writes: %u, irqs: %u)\n",
@@ -334,12 +1825,30 @@ static void usage(const char *prog) {
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  --file <path>   Use file-backed shared memory (default: %s)\n", DEFAULT_SHM_PATH);
     fprintf(stderr, "  --devmem        Use /dev/mem at 0x%08X (requires root)\n", IPC_SHARED_MEM_PHYS);
+    fprintf(stderr, "  --ivshmem <sock> Attach via ivshmem-server (blocks on doorbell eventfd)\n");
+    fprintf(stderr, "  --size <bytes>  Shared memory size for --devmem / new files (default 1MB)\n");
+    fprintf(stderr, "  --workers <n>   Worker threads per command queue, 0-%u (default 1;\n"
+                    "                  0 runs every command on the dispatcher thread)\n", MAX_WORKERS);
+    fprintf(stderr, "  --busy-poll <cpu> Spin instead of sleeping, dispatcher pinned to <cpu>\n");
+    fprintf(stderr, "  --hugepages     Huge pages for the region (hugetlbfs file, else THP)\n");
+    fprintf(stderr, "  --prefault      Fault in and mlock the whole region at startup\n");
+    fprintf(stderr, "  --numa-cpu <cpu> Bind the region to <cpu>'s NUMA node and run the\n"
+                    "                  dispatcher there (e.g. a QEMU vCPU's host CPU)\n");
+    fprintf(stderr, "  --numa-thread <tid> The same, for the node <tid> (a vCPU thread) runs on\n");
+    fprintf(stderr, "  --quiet         No per-command log lines\n");
+    fprintf(stderr, "  --env <plugin.so> Serve ENV_RESET and the stream rings natively\n");
+    fprintf(stderr, "  --env-args <str> Passed to the plugin's create()\n");
+    fprintf(stderr, "  --channel <n>   Stream channel the environment serves (default 0)\n");
+    fprintf(stderr, "  --bench-out <json> Save a GYM_BENCH kernel's run (CMD_ENV_BENCH), then exit\n");
+    fprintf(stderr, "  --record <log>  Record the environment's resets and steps (envs/replay.so)\n");
     fprintf(stderr, "  --help          Show this help\n");
 }
 
 int main(int argc, char *argv[]) {
     bool use_devmem = false;
     const char *shm_path = DEFAULT_SHM_PATH;
+    const char *ivshmem_sock = NULL;
+    const char *env_path = NULL;
 
     /* Parse arguments */
     for (int i = 1; i < argc; i++) {
@@ -347,6 +1856,51 @@ int main(int argc, char *argv[]) {
             use_devmem = true;
         } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
             shm_path = argv[++i];
+        } else if (strcmp(argv[i], "--ivshmem") == 0 && i + 1 < argc) {
+            ivshmem_sock = argv[++i];
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            shm_size = strtoull(argv[++i], NULL, 0);
+            if (shm_size < IPC_SHARED_MEM_MIN)
+                shm_size = IPC_SHARED_MEM_MIN;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers_per_queue = (uint32_t)strtoul(argv[++i], NULL, 0);
+            if (workers_per_queue > MAX_WORKERS)
+                workers_per_queue = MAX_WORKERS;
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            busy_poll_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            shm_hugepages = true;
+        } else if (strcmp(argv[i], "--prefault") == 0) {
+            shm_prefault = true;
+        } else if (strcmp(argv[i], "--numa-cpu") == 0 && i + 1 < argc) {
+            shm_numa_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--numa-thread") == 0 && i + 1 < argc) {
+#ifdef __linux__
+            int tid = atoi(argv[++i]);
+            shm_numa_cpu = thread_cpu(tid);
+            if (shm_numa_cpu < 0) {
+                fprintf(stderr, "No such thread: %d\n", tid);
+                return 1;
+            }
+#else
+            i++;
+#endif
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            verbose = false;
+        } else if (strcmp(argv[i], "--env") == 0 && i + 1 < argc) {
+            env_path = argv[++i];
+        } else if (strcmp(argv[i], "--env-args") == 0 && i + 1 < argc) {
+            env_args = argv[++i];
+        } else if (strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc) {
+            bench_out = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_out = argv[++i];
+        } else if (strcmp(argv[i], "--channel") == 0 && i + 1 < argc) {
+            env_channel = (uint32_t)strtoul(argv[++i], NULL, 0);
+            if (env_channel >= IPC_STREAM_CHANNELS_MAX) {
+                fprintf(stderr, "Channel must be below %u\n", IPC_STREAM_CHANNELS_MAX);
+                return 1;
+            }
         } else if (strcmp(argv[i], "--help") == 0) {
             usage(argv[0]);
             return 0;
@@ -362,13 +1916,28 @@ int main(int argc, char *argv[]) {
     printf("  (with Doorbell support)\n");
     printf("===========================================\n\n");
 
+    if (env_path && env_load(env_path) < 0)
+        return 1;
+
     /* Setup signal handlers */
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    if (shm_numa_cpu >= 0) {
+#ifdef __linux__
+        shm_numa_node = cpu_node(shm_numa_cpu);
+        if (shm_numa_node < 0)
+            printf("[bridge] CPU %d has no NUMA node, region left unbound\n", shm_numa_cpu);
+#else
+        printf("[bridge] NUMA placement needs Linux\n");
+#endif
+    }
+
     /* Initialize shared memory */
     int ret;
-    if (use_devmem) {
+    if (ivshmem_sock) {
+        ret = init_shm_ivshmem(ivshmem_sock);
+    } else if (use_devmem) {
         ret = init_shm_devmem();
     } else {
         ret = init_shm_file(shm_path);
@@ -380,14 +1949,51 @@ int main(int argc, char *argv[]) {
 
     print_ring_status();
 
+    /* Workers first: they must not inherit the dispatcher's pinning */
+    if (start_workers() < 0)
+        return 1;
+    if (busy_poll_cpu >= 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(busy_poll_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            perror("[bridge] sched_setaffinity");
+        else
+            printf("[bridge] Busy-polling on CPU %d\n", busy_poll_cpu);
+        if (shm_numa_node >= 0 && cpu_node(busy_poll_cpu) != shm_numa_node)
+            printf("[bridge] Warning: CPU %d is not on node %d with the region\n",
+                   busy_poll_cpu, shm_numa_node);
+#else
+        printf("[bridge] Busy-polling (CPU pinning needs Linux)\n");
+#endif
+    }
+#ifdef __linux__
+    else if (shm_numa_node >= 0) {
+        /* Poll from the region's node, wherever on it the scheduler likes */
+        cpu_set_t set;
+        if (node_cpus(shm_numa_node, &set) != 0 ||
+            sched_setaffinity(0, sizeof(set), &set) != 0)
+            perror("[bridge] Pinning the dispatcher to the region's node");
+        else
+            printf("[bridge] Dispatcher on node %d (%d CPUs)\n", shm_numa_node,
+                   CPU_COUNT(&set));
+    }
+#endif
+
     /* Main loop */
     poll_loop();
 
-    /* Cleanup */
+    /* Cleanup: answer what the workers still hold */
+    stop_workers();
+    collect_completions();
+    flush_responses();
     print_stats();
+    if (env_plugin)
+        env_unload();
 
     if (shm_base && shm_base != MAP_FAILED) {
-        munmap(shm_base, IPC_SHARED_MEM_SIZE);
+        munmap(shm_base, shm_size);
     }
 
     printf("[bridge] Goodbye.\n");
@@ -0,0 +1,46 @@
+/* tools/bridge/env_plugin.h
+ *
+ * Native environment plugins for the bridge (--env <plugin.so>).
+ *
+ * A plugin is a shared library exporting one zenedge_env_plugin_t under
+ * ZENEDGE_ENV_PLUGIN_SYMBOL. The bridge then answers CMD_ENV_RESET and
+ * steps the environment straight off the obs/action stream rings, with no
+ * interpreter in the loop; environments without a plugin stay on the
+ * Python gym agent (bridge/zenedge_gym_agent.py).
+ *
+ * Every call comes from the bridge's dispatcher thread. A vector reset
+ * (ENV_RESET_PACK(flags, envs > 1)) creates one instance per env, index
+ * 0..envs-1, and keeps them until the plugin is unloaded.
+ *
+ * Build: cc -O2 -fPIC -shared -o myenv.so myenv.c  (see envs/cartpole.c)
+ */
+#ifndef ZENEDGE_ENV_PLUGIN_H
+#define ZENEDGE_ENV_PLUGIN_H
+
+#include <stdint.h>
+
+#define ZENEDGE_ENV_ABI_VERSION   1
+#define ZENEDGE_ENV_PLUGIN_SYMBOL "zenedge_env_plugin"
+
+typedef struct {
+  uint32_t abi_version;  /* ZENEDGE_ENV_ABI_VERSION */
+  uint32_t obs_dim;      /* Floats per observation; must match the obs ring */
+  const char *name;
+
+  /* New instance for vector slot `index`; args is --env-args (or "").
+   * Returns: the instance, or NULL on failure
+   */
+  void *(*create)(uint32_t index, const char *args);
+  void (*destroy)(void *env);
+
+  /* Start an episode, writing the first observation to obs[obs_dim] */
+  void (*reset)(void *env, float *obs);
+
+  /* Apply action, writing the next observation to obs[obs_dim]
+   * Returns: 0 running, 1 episode over (terminated or truncated),
+   *          -1 error (the bridge stops streaming)
+   */
+  int (*step)(void *env, uint32_t action, float *obs, float *reward);
+} zenedge_env_plugin_t;
+
+#endif /* ZENEDGE_ENV_PLUGIN_H */
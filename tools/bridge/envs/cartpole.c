@@ -0,0 +1,104 @@
+/* tools/bridge/envs/cartpole.c
+ *
+ * CartPole-v1 as a native bridge environment: the same dynamics, limits
+ * and 500-step time limit as gym's, so agents trained against the Python
+ * gym agent see the same task.
+ *
+ * Usage: ./bridge --env envs/cartpole.so [--env-args <seed>]
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "../env_plugin.h"
+
+#define GRAVITY        9.8f
+#define MASS_CART      1.0f
+#define MASS_POLE      0.1f
+#define TOTAL_MASS     (MASS_CART + MASS_POLE)
+#define HALF_LENGTH    0.5f
+#define POLE_MOMENT    (MASS_POLE * HALF_LENGTH)
+#define FORCE_MAG      10.0f
+#define TAU            0.02f                /* Seconds per step (Euler) */
+#define THETA_LIMIT    (12.0f * 2.0f * (float)M_PI / 360.0f)
+#define X_LIMIT        2.4f
+#define MAX_STEPS      500
+
+typedef struct {
+    float x, x_dot, theta, theta_dot;
+    uint32_t steps;
+    uint64_t rng;                           /* xorshift64 */
+} cartpole_t;
+
+static float uniform(cartpole_t *c, float lo, float hi) {
+    c->rng ^= c->rng << 13;
+    c->rng ^= c->rng >> 7;
+    c->rng ^= c->rng << 17;
+    return lo + (hi - lo) * (float)(c->rng >> 40) / (float)(1u << 24);
+}
+
+static void observe(const cartpole_t *c, float *obs) {
+    obs[0] = c->x;
+    obs[1] = c->x_dot;
+    obs[2] = c->theta;
+    obs[3] = c->theta_dot;
+}
+
+static void *cartpole_create(uint32_t index, const char *args) {
+    cartpole_t *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    uint64_t seed = args && *args ? strtoull(args, NULL, 0) : 1;
+    c->rng = (seed * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)index + 1);
+    if (!c->rng)
+        c->rng = 1;
+    return c;
+}
+
+static void cartpole_destroy(void *env) {
+    free(env);
+}
+
+static void cartpole_reset(void *env, float *obs) {
+    cartpole_t *c = env;
+    c->x = uniform(c, -0.05f, 0.05f);
+    c->x_dot = uniform(c, -0.05f, 0.05f);
+    c->theta = uniform(c, -0.05f, 0.05f);
+    c->theta_dot = uniform(c, -0.05f, 0.05f);
+    c->steps = 0;
+    observe(c, obs);
+}
+
+static int cartpole_step(void *env, uint32_t action, float *obs, float *reward) {
+    cartpole_t *c = env;
+    float force = action ? FORCE_MAG : -FORCE_MAG;
+    float cos_t = cosf(c->theta);
+    float sin_t = sinf(c->theta);
+
+    float temp = (force + POLE_MOMENT * c->theta_dot * c->theta_dot * sin_t) / TOTAL_MASS;
+    float theta_acc = (GRAVITY * sin_t - cos_t * temp) /
+        (HALF_LENGTH * (4.0f / 3.0f - MASS_POLE * cos_t * cos_t / TOTAL_MASS));
+    float x_acc = temp - POLE_MOMENT * theta_acc * cos_t / TOTAL_MASS;
+
+    c->x += TAU * c->x_dot;
+    c->x_dot += TAU * x_acc;
+    c->theta += TAU * c->theta_dot;
+    c->theta_dot += TAU * theta_acc;
+    c->steps++;
+
+    observe(c, obs);
+    *reward = 1.0f;
+    return c->x < -X_LIMIT || c->x > X_LIMIT ||
+           c->theta < -THETA_LIMIT || c->theta > THETA_LIMIT ||
+           c->steps >= MAX_STEPS;
+}
+
+const zenedge_env_plugin_t zenedge_env_plugin = {
+    .abi_version = ZENEDGE_ENV_ABI_VERSION,
+    .obs_dim = 4,
+    .name = "CartPole-v1",
+    .create = cartpole_create,
+    .destroy = cartpole_destroy,
+    .reset = cartpole_reset,
+    .step = cartpole_step,
+};
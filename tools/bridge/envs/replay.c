@@ -0,0 +1,227 @@
+/* tools/bridge/envs/replay.c
+ *
+ * A recorded environment stream (replay_log.h) played back as a native
+ * environment: every reset and step answers with the observation, reward
+ * and episode end of the recording, whatever the kernel does, so runs of
+ * different kernels see exactly the same input.
+ *
+ * Replay is open loop. The kernel's actions are compared against the
+ * recorded ones and the differences counted (a policy, or a change, that
+ * decides otherwise), not followed. Vector slot i plays the log's env
+ * i modulo the envs recorded; a stream that runs out starts over, ending
+ * the episode it was in.
+ *
+ * Pacing: by default as fast as the bridge asks; with "paced" each call
+ * takes as long as the recorded environment took, so the kernel sees the
+ * same stepping cost it did live without the noise of re-running it.
+ *
+ * Usage: ./bridge --env envs/replay.so --env-args <log>[,paced]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../env_plugin.h"
+#include "../ipc_proto.h"
+#include "../replay_log.h"
+
+#define REPLAY_SPIN_NS 200000   /* Sleep above this, then spin the rest */
+
+typedef struct {
+    uint32_t slot;              /* Env of the log played */
+    uint32_t *recs;             /* Its records, in order */
+    uint32_t count;
+    uint32_t pos;               /* Next record */
+    uint64_t steps, differ, passes;
+} replay_t;
+
+/* The log, loaded once and shared by every instance */
+static struct {
+    uint32_t refs;
+    uint8_t *data;
+    size_t size;
+    uint32_t rec_size;
+    uint32_t count;
+    uint32_t envs;
+    int paced;
+} lg;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static const replay_rec_t *rec_at(uint32_t i) {
+    return (const replay_rec_t *)(lg.data + sizeof(replay_hdr_t) + (size_t)i * lg.rec_size);
+}
+
+/* Helper: take as long as the recording did, from start */
+static void pace(uint64_t start, uint32_t env_ns) {
+    if (!lg.paced)
+        return;
+    uint64_t until = start + env_ns;
+    uint64_t now = now_ns();
+    if (until > now + REPLAY_SPIN_NS) {
+        uint64_t ns = until - now - REPLAY_SPIN_NS;
+        struct timespec ts = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+        nanosleep(&ts, NULL);
+    }
+    while (now_ns() < until)
+        ;
+}
+
+static int log_load(const char *args) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", args ? args : "");
+    char *opt = strchr(path, ',');
+    if (opt) {
+        *opt++ = '\0';
+        lg.paced = strcmp(opt, "paced") == 0;
+    }
+    if (!path[0]) {
+        fprintf(stderr, "[replay] --env-args <log>[,paced] names the recording\n");
+        return -1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("[replay] open");
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    lg.data = size > 0 ? malloc((size_t)size) : NULL;
+    if (!lg.data || fread(lg.data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "[replay] %s: unreadable\n", path);
+        fclose(f);
+        free(lg.data);
+        lg.data = NULL;
+        return -1;
+    }
+    fclose(f);
+    lg.size = (size_t)size;
+
+    const replay_hdr_t *hdr = (const replay_hdr_t *)lg.data;
+    if (lg.size < sizeof(*hdr) || hdr->magic != REPLAY_MAGIC || hdr->version != REPLAY_VERSION) {
+        fprintf(stderr, "[replay] %s: not a recording\n", path);
+        goto fail;
+    }
+    if (hdr->obs_dim != IPC_OBS_DIM) {
+        fprintf(stderr, "[replay] %s: %u floats per obs, the obs ring carries %u\n",
+                path, hdr->obs_dim, IPC_OBS_DIM);
+        goto fail;
+    }
+    lg.rec_size = REPLAY_REC_SIZE(hdr->obs_dim);
+    lg.count = (uint32_t)((lg.size - sizeof(*hdr)) / lg.rec_size);
+    lg.envs = 0;
+    for (uint32_t i = 0; i < lg.count; i++) {
+        if (rec_at(i)->env >= lg.envs)
+            lg.envs = rec_at(i)->env + 1u;
+    }
+    if (!lg.envs) {
+        fprintf(stderr, "[replay] %s: no records\n", path);
+        goto fail;
+    }
+    printf("[replay] %s: %.*s, %u records over %u env(s)%s\n", path, REPLAY_NAME_LEN,
+           hdr->name, lg.count, lg.envs, lg.paced ? ", paced as recorded" : "");
+    return 0;
+
+fail:
+    free(lg.data);
+    lg.data = NULL;
+    return -1;
+}
+
+static void *replay_create(uint32_t index, const char *args) {
+    if (!lg.refs && log_load(args) < 0)
+        return NULL;
+
+    replay_t *r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+    r->slot = index % lg.envs;
+    r->recs = malloc(lg.count * sizeof(uint32_t));
+    if (!r->recs) {
+        free(r);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < lg.count; i++) {
+        if (rec_at(i)->env == r->slot)
+            r->recs[r->count++] = i;
+    }
+    lg.refs++;
+    return r;
+}
+
+static void replay_destroy(void *env) {
+    replay_t *r = env;
+    printf("[replay] env %u: %llu steps, %llu actions differed from the recording, "
+           "%llu pass(es) over it\n", r->slot, (unsigned long long)r->steps,
+           (unsigned long long)r->differ, (unsigned long long)r->passes + 1);
+    free(r->recs);
+    free(r);
+    if (--lg.refs == 0) {
+        free(lg.data);
+        lg.data = NULL;
+    }
+}
+
+static void replay_reset(void *env, float *obs) {
+    replay_t *r = env;
+    uint64_t start = now_ns();
+
+    /* The next episode start, starting over once at the end */
+    for (uint32_t seen = 0; seen <= r->count; seen++) {
+        if (r->pos == r->count) {
+            r->pos = 0;
+            r->passes++;
+        }
+        if (!r->count)
+            break;
+        const replay_rec_t *rec = rec_at(r->recs[r->pos++]);
+        if (rec->kind == REPLAY_REC_RESET) {
+            memcpy(obs, rec + 1, 4 * IPC_OBS_DIM);
+            pace(start, rec->env_ns);
+            return;
+        }
+    }
+    memset(obs, 0, 4 * IPC_OBS_DIM);
+}
+
+static int replay_step(void *env, uint32_t action, float *obs, float *reward) {
+    replay_t *r = env;
+    uint64_t start = now_ns();
+    *reward = 0.0f;
+
+    /* The recording ends here or moved on to the next episode without
+     * this one ending (the kernel reset it): end it now, same obs
+     */
+    const replay_rec_t *rec = r->pos < r->count ? rec_at(r->recs[r->pos]) : NULL;
+    if (!rec || rec->kind != REPLAY_REC_STEP) {
+        if (r->pos)
+            memcpy(obs, rec_at(r->recs[r->pos - 1]) + 1, 4 * IPC_OBS_DIM);
+        return 1;
+    }
+    r->pos++;
+    r->steps++;
+    if (rec->action != action)
+        r->differ++;
+    memcpy(obs, rec + 1, 4 * IPC_OBS_DIM);
+    *reward = rec->reward;
+    pace(start, rec->env_ns);
+    return rec->done ? 1 : 0;
+}
+
+const zenedge_env_plugin_t zenedge_env_plugin = {
+    .abi_version = ZENEDGE_ENV_ABI_VERSION,
+    .obs_dim = IPC_OBS_DIM,
+    .name = "replay",
+    .create = replay_create,
+    .destroy = replay_destroy,
+    .reset = replay_reset,
+    .step = replay_step,
+};
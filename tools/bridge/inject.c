@@ -8,7 +8,15 @@
  *   ./inject print 12345
  *   ./inject model 42
  *   ./inject status
- *   ./inject reset
+ *   ./inject reset [size]
+ *   ./inject flood 1000000 [model]   Throughput: keep the ring full of PINGs
+ *                                    (or RUN_MODELs), count the responses
+ *   ./inject envloop 100000 [envs] [pipe]
+ *                                    Stream control loop against a bridge
+ *                                    running a native environment (--env),
+ *                                    pipe: a vector in two groups
+ *   ./inject load [options]          Load generator and latency benchmark
+ *                                    (./inject load --help)
  */
 
 #include <stdio.h>
@@ -18,17 +26,26 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <sched.h>
+#include <math.h>
 
 #include "ipc_proto.h"
 
-#define IPC_SHARED_MEM_SIZE (1024 * 1024)
 #define DEFAULT_SHM_PATH "/tmp/zenedge_ipc"
 
 static void *shm_base = NULL;
+static size_t shm_size = IPC_SHARED_MEM_MIN;
+static volatile ipc_layout_t *layout = NULL;
 static volatile ipc_ring_t *cmd_ring = NULL;
 static volatile ipc_rsp_ring_t *rsp_ring = NULL;
 static volatile doorbell_ctl_t *doorbell = NULL;
+static volatile ipc_msg_ring_t *msg_cmd_ring = NULL;
+static volatile ipc_msg_ring_t *msg_rsp_ring = NULL;
+static volatile ipc_ring_hdr_t *obs_ring = NULL;
+static volatile ipc_ring_hdr_t *act_ring = NULL;
+static int quiet = 0;                 /* No per-packet lines (envloop) */
 
 /* Get current time in microseconds (simulating ZENEDGE time) */
 static uint64_t time_usec(void) {
@@ -37,20 +54,211 @@ static uint64_t time_usec(void) {
     return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-static int init_rings(const char *path) {
+static void init_ring_hdr_sized(volatile ipc_ring_hdr_t *hdr, uint32_t magic,
+                                uint32_t size, uint32_t flags) {
+    hdr->head = 0;
+    hdr->tail = 0;
+    hdr->size = size;
+    hdr->mask = size - 1;
+    hdr->flags = flags;
+    hdr->version = IPC_PROTO_VERSION;
+    __sync_synchronize();
+    hdr->magic = magic;
+}
+
+static uint32_t region_entries(uint32_t id) {
+    return layout->regions[id].entries;
+}
+
+/* Region sizing mirrors kernel/ipc/layout.c, so the bridge sees the same
+ * descriptor a ZENEDGE image would publish for a device of this size.
+ */
+#define LAYOUT_RING_SHIFT   10
+#define LAYOUT_RING_MAX     16384
+#define LAYOUT_STREAM_SHIFT 14
+#define LAYOUT_STREAM_MIN   64
+#define LAYOUT_STREAM_MAX   1024
+#define LAYOUT_MSG_SHIFT    7
+#define LAYOUT_MSG_MAX      0x40000
+#define LAYOUT_BULK_SHIFT   19
+#define LAYOUT_BULK_MAX     8
+#define OBS_ENTRY_BYTES     IPC_OBS_ENTRY_SIZE(IPC_OBS_DIM)
+#define ACT_ENTRY_BYTES     IPC_ACT_ENTRY_SIZE
+#define LAYOUT_HEAP_MIN     0x10000
+#define LAYOUT_BLOB_SHIFT   12
+
+static uint32_t page_align(uint32_t v) {
+    return (v + IPC_LAYOUT_ALIGN - 1) & ~(uint32_t)(IPC_LAYOUT_ALIGN - 1);
+}
+
+static uint32_t scaled_entries(uint32_t total, uint32_t shift, uint32_t min,
+                               uint32_t max) {
+    uint32_t v = total >> shift;
+    uint32_t n = v ? 1u << (31 - __builtin_clz(v)) : 0;
+    return n < min ? min : (n > max ? max : n);
+}
+
+static void place(uint32_t *cursor, uint32_t id, uint32_t bytes, uint32_t entries) {
+    layout->regions[id].offset = *cursor;
+    layout->regions[id].size = page_align(bytes);
+    layout->regions[id].entries = entries;
+    layout->regions[id].reserved = 0;
+    *cursor += layout->regions[id].size;
+}
+
+static int build_layout(uint32_t total) {
+    uint32_t ring = scaled_entries(total, LAYOUT_RING_SHIFT, IPC_RING_SIZE,
+                                   LAYOUT_RING_MAX);
+    uint32_t stream = scaled_entries(total, LAYOUT_STREAM_SHIFT, LAYOUT_STREAM_MIN,
+                                     LAYOUT_STREAM_MAX);
+    uint32_t msg = scaled_entries(total, LAYOUT_MSG_SHIFT, IPC_MSG_DATA_BYTES,
+                                  LAYOUT_MSG_MAX);
+    uint32_t bulk = scaled_entries(total, LAYOUT_BULK_SHIFT, IPC_BULK_SLOTS,
+                                   LAYOUT_BULK_MAX);
+    uint32_t cursor = IPC_LAYOUT_BYTES;
+
+    layout->magic = 0;
+    __sync_synchronize();
+    memset((void *)layout, 0, sizeof(ipc_layout_t));
+
+    place(&cursor, IPC_REGION_CMD_RING,
+          IPC_RING_HDR_SIZE + ring * (sizeof(ipc_packet_t) + sizeof(uint32_t)), ring);
+    place(&cursor, IPC_REGION_RSP_RING,
+          IPC_RING_HDR_SIZE + ring * sizeof(ipc_response_t), ring);
+    place(&cursor, IPC_REGION_DOORBELL, sizeof(doorbell_ctl_t), 0);
+    place(&cursor, IPC_REGION_MESH, 1, 0);
+    place(&cursor, IPC_REGION_TELEMETRY, 1, 0);
+    place(&cursor, IPC_REGION_MSG_CMD, IPC_RING_HDR_SIZE + msg, msg);
+    place(&cursor, IPC_REGION_MSG_RSP, IPC_RING_HDR_SIZE + msg, msg);
+    place(&cursor, IPC_REGION_OBS_RING, IPC_RING_HDR_SIZE + stream * OBS_ENTRY_BYTES,
+          stream);
+    place(&cursor, IPC_REGION_ACT_RING, IPC_RING_HDR_SIZE + stream * ACT_ENTRY_BYTES,
+          stream);
+    place(&cursor, IPC_REGION_BULK,
+          sizeof(ipc_bulk_ring_t) + bulk * sizeof(ipc_bulk_chunk_t), bulk);
+    place(&cursor, IPC_REGION_STREAM_CHAN,
+          IPC_CHAN_REGION_BYTES(IPC_STREAM_CHANNELS, stream, OBS_ENTRY_BYTES),
+          IPC_STREAM_CHANNELS);
+
+    if (cursor >= total)
+        return -1;
+    uint32_t rest = total - cursor;
+    uint32_t slots = scaled_entries(rest, LAYOUT_BLOB_SHIFT, HEAP_BLOB_SLOTS_MIN,
+                                    HEAP_BLOB_SLOTS_MAX);
+    uint32_t ctl = page_align(HEAP_BLOB_TABLE_OFFSET(rest / HEAP_BLOCK_SIZE) +
+                              slots * sizeof(heap_blob_slot_t));
+    if (ctl >= rest || rest - ctl < LAYOUT_HEAP_MIN)
+        return -1;
+    uint32_t data = (rest - ctl) & ~(uint32_t)(IPC_LAYOUT_ALIGN - 1);
+    place(&cursor, IPC_REGION_HEAP_CTL, ctl, slots);
+    place(&cursor, IPC_REGION_HEAP_DATA, data, data / HEAP_BLOCK_SIZE);
+
+    layout->version = IPC_LAYOUT_VERSION;
+    layout->total_size = total;
+    layout->region_count = IPC_REGION_COUNT;
+    __sync_synchronize();
+    layout->magic = IPC_LAYOUT_MAGIC;
+    return 0;
+}
+
+static void map_regions(void) {
+    char *base = (char *)shm_base;
+    cmd_ring = (volatile ipc_ring_t *)(base + layout->regions[IPC_REGION_CMD_RING].offset);
+    rsp_ring = (volatile ipc_rsp_ring_t *)(base + layout->regions[IPC_REGION_RSP_RING].offset);
+    doorbell = (volatile doorbell_ctl_t *)(base + layout->regions[IPC_REGION_DOORBELL].offset);
+    msg_cmd_ring = (volatile ipc_msg_ring_t *)(base + layout->regions[IPC_REGION_MSG_CMD].offset);
+    msg_rsp_ring = (volatile ipc_msg_ring_t *)(base + layout->regions[IPC_REGION_MSG_RSP].offset);
+    obs_ring = (volatile ipc_ring_hdr_t *)(base + layout->regions[IPC_REGION_OBS_RING].offset);
+    act_ring = (volatile ipc_ring_hdr_t *)(base + layout->regions[IPC_REGION_ACT_RING].offset);
+}
+
+static void init_rsp_ring(void) {
+    init_ring_hdr_sized(&rsp_ring->hdr, IPC_RSP_MAGIC,
+                        region_entries(IPC_REGION_RSP_RING), 0);
+}
+
+/* Message rings are sized in bytes of data area */
+static void init_msg_rings(void) {
+    init_ring_hdr_sized(&msg_cmd_ring->hdr, IPC_MSG_MAGIC,
+                        region_entries(IPC_REGION_MSG_CMD), 0);
+    init_ring_hdr_sized(&msg_rsp_ring->hdr, IPC_MSG_MAGIC,
+                        region_entries(IPC_REGION_MSG_RSP), 0);
+}
+
+/* Command ring is created MPSC, like the kernel does */
+static void init_cmd_ring(void) {
+    uint32_t size = region_entries(IPC_REGION_CMD_RING);
+    cmd_ring->hdr.size = size;
+    volatile uint32_t *seq = IPC_RING_SEQ(cmd_ring);
+    for (uint32_t i = 0; i < size; i++)
+        seq[i] = i;
+    init_ring_hdr_sized(&cmd_ring->hdr, IPC_MAGIC, size, IPC_RING_FLAG_MPSC);
+}
+
+/* Stream rings publish their geometry; FIFO like the kernel's default */
+static void init_stream_rings(void) {
+    obs_ring->entry_size = OBS_ENTRY_BYTES;
+    obs_ring->obs_dim = IPC_OBS_DIM;
+    obs_ring->clock_seq = 0;
+    init_ring_hdr_sized(obs_ring, IPC_STREAM_MAGIC,
+                        region_entries(IPC_REGION_OBS_RING), IPC_RING_POLICY_FIFO);
+    act_ring->entry_size = ACT_ENTRY_BYTES;
+    act_ring->obs_dim = 0;
+    init_ring_hdr_sized(act_ring, IPC_STREAM_MAGIC,
+                        region_entries(IPC_REGION_ACT_RING), IPC_RING_POLICY_FIFO);
+}
+
+static void init_doorbell(void) {
+    doorbell->magic = IPC_DOORBELL_MAGIC;
+    doorbell->version = IPC_PROTO_VERSION;
+    doorbell->cmd_doorbell = 0;
+    doorbell->cmd_flags = 0;
+    doorbell->cmd_irq_count = 0;
+    doorbell->rsp_doorbell = 0;
+    doorbell->rsp_flags = DOORBELL_FLAG_IRQ_ENABLED;
+    doorbell->rsp_irq_count = 0;
+    doorbell->cmd_writes = 0;
+    doorbell->rsp_writes = 0;
+    doorbell->peer_version = 0;
+    doorbell->zen_peer_id = 0;    /* inject has no ivshmem doorbell */
+    doorbell->bridge_peer_id = 0;
+}
+
+/* Lay out the region from scratch, like a ZENEDGE boot */
+static int reset_all(void) {
+    if (build_layout((uint32_t)shm_size) < 0) {
+        fprintf(stderr, "[inject] Shared memory too small to lay out\n");
+        return -1;
+    }
+    map_regions();
+    init_cmd_ring();
+    init_rsp_ring();
+    init_doorbell();
+    init_msg_rings();
+    init_stream_rings();
+    return 0;
+}
+
+/* want_size: grow the file to at least this many bytes (0 = keep) */
+static int init_rings(const char *path, size_t want_size) {
     int fd = open(path, O_RDWR | O_CREAT, 0666);
     if (fd < 0) {
         perror("Failed to open shared memory file");
         return -1;
     }
 
-    if (ftruncate(fd, IPC_SHARED_MEM_SIZE) < 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > shm_size)
+        shm_size = (size_t)st.st_size;
+    if (want_size > shm_size)
+        shm_size = want_size;
+    if ((size_t)st.st_size < shm_size && ftruncate(fd, shm_size) < 0) {
         perror("Failed to resize file");
         close(fd);
         return -1;
     }
 
-    shm_base = mmap(NULL, IPC_SHARED_MEM_SIZE, PROT_READ | PROT_WRITE,
+    shm_base = mmap(NULL, shm_size, PROT_READ | PROT_WRITE,
                     MAP_SHARED, fd, 0);
     close(fd);
 
@@ -59,63 +267,73 @@ static int init_rings(const char *path) {
         return -1;
     }
 
-    cmd_ring = (volatile ipc_ring_t *)((char *)shm_base + IPC_CMD_RING_OFFSET);
-    rsp_ring = (volatile ipc_rsp_ring_t *)((char *)shm_base + IPC_RSP_RING_OFFSET);
-    doorbell = (volatile doorbell_ctl_t *)((char *)shm_base + IPC_DOORBELL_OFFSET);
+    layout = (volatile ipc_layout_t *)shm_base;
+
+    /* (Re)build the layout if missing or for a different size */
+    if (layout->magic != IPC_LAYOUT_MAGIC || layout->version != IPC_LAYOUT_VERSION ||
+        layout->total_size != shm_size) {
+        printf("[inject] Laying out %zu KB of shared memory...\n", shm_size / 1024);
+        return reset_all();
+    }
+    map_regions();
 
     /* Initialize rings if needed */
-    if (cmd_ring->magic != IPC_MAGIC) {
+    if (cmd_ring->hdr.magic != IPC_MAGIC ||
+        cmd_ring->hdr.version != IPC_PROTO_VERSION) {
         printf("[inject] Initializing command ring...\n");
-        ((ipc_ring_t *)cmd_ring)->magic = IPC_MAGIC;
-        ((ipc_ring_t *)cmd_ring)->head = 0;
-        ((ipc_ring_t *)cmd_ring)->tail = 0;
-        ((ipc_ring_t *)cmd_ring)->size = IPC_RING_SIZE;
+        init_cmd_ring();
     }
 
-    if (rsp_ring->magic != IPC_RSP_MAGIC) {
+    if (rsp_ring->hdr.magic != IPC_RSP_MAGIC ||
+        rsp_ring->hdr.version != IPC_PROTO_VERSION) {
         printf("[inject] Initializing response ring...\n");
-        ((ipc_rsp_ring_t *)rsp_ring)->magic = IPC_RSP_MAGIC;
-        ((ipc_rsp_ring_t *)rsp_ring)->head = 0;
-        ((ipc_rsp_ring_t *)rsp_ring)->tail = 0;
-        ((ipc_rsp_ring_t *)rsp_ring)->size = IPC_RING_SIZE;
+        init_rsp_ring();
     }
 
-    if (doorbell->magic != IPC_DOORBELL_MAGIC) {
+    if (doorbell->magic != IPC_DOORBELL_MAGIC ||
+        doorbell->version != IPC_PROTO_VERSION) {
         printf("[inject] Initializing doorbell...\n");
-        ((doorbell_ctl_t *)doorbell)->magic = IPC_DOORBELL_MAGIC;
-        ((doorbell_ctl_t *)doorbell)->version = 1;
-        ((doorbell_ctl_t *)doorbell)->cmd_doorbell = 0;
-        ((doorbell_ctl_t *)doorbell)->cmd_flags = 0;
-        ((doorbell_ctl_t *)doorbell)->cmd_irq_count = 0;
-        ((doorbell_ctl_t *)doorbell)->rsp_doorbell = 0;
-        ((doorbell_ctl_t *)doorbell)->rsp_flags = DOORBELL_FLAG_IRQ_ENABLED;
-        ((doorbell_ctl_t *)doorbell)->rsp_irq_count = 0;
-        ((doorbell_ctl_t *)doorbell)->cmd_writes = 0;
-        ((doorbell_ctl_t *)doorbell)->rsp_writes = 0;
+        init_doorbell();
+    }
+
+    if (msg_cmd_ring->hdr.magic != IPC_MSG_MAGIC ||
+        msg_cmd_ring->hdr.version != IPC_PROTO_VERSION) {
+        printf("[inject] Initializing message rings...\n");
+        init_msg_rings();
+    }
+
+    if (obs_ring->magic != IPC_STREAM_MAGIC ||
+        obs_ring->version != IPC_PROTO_VERSION) {
+        printf("[inject] Initializing stream rings...\n");
+        init_stream_rings();
     }
 
     return 0;
 }
 
 static int send_packet(uint16_t cmd, uint32_t payload) {
-    uint32_t head = cmd_ring->head;
-    uint32_t next_head = (head + 1) % cmd_ring->size;
+    uint32_t head = cmd_ring->hdr.head;
+    uint32_t next_head = head + 1;
 
-    if (next_head == cmd_ring->tail) {
+    if (head - cmd_ring->hdr.tail >= cmd_ring->hdr.size) {
         fprintf(stderr, "[inject] Command ring full!\n");
         return -1;
     }
 
-    volatile ipc_packet_t *pkt = &cmd_ring->data[head];
+    volatile ipc_packet_t *pkt = &cmd_ring->data[head & cmd_ring->hdr.mask];
     pkt->cmd = cmd;
     pkt->flags = 0;
     pkt->payload_id = payload;
     pkt->timestamp = time_usec();
+    pkt->tag = IPC_TAG_NONE;
+    pkt->reserved = 0;
 
     /* Memory barrier */
     __sync_synchronize();
 
-    ((ipc_ring_t *)cmd_ring)->head = next_head;
+    if (cmd_ring->hdr.flags & IPC_RING_FLAG_MPSC)
+        IPC_RING_SEQ(cmd_ring)[head & cmd_ring->hdr.mask] = next_head;
+    cmd_ring->hdr.head = next_head;
 
     /* Ring doorbell */
     if (doorbell && doorbell->magic == IPC_DOORBELL_MAGIC) {
@@ -127,55 +345,852 @@ static int send_packet(uint16_t cmd, uint32_t payload) {
         }
     }
 
-    printf("[inject] Sent: cmd=%s(0x%04X) payload=0x%08X ts=%llu (doorbell rang)\n",
-           cmd_name(cmd), cmd, payload, (unsigned long long)pkt->timestamp);
+    if (!quiet)
+        printf("[inject] Sent: cmd=%s(0x%04X) payload=0x%08X ts=%llu (doorbell rang)\n",
+               cmd_name(cmd), cmd, payload, (unsigned long long)pkt->timestamp);
 
     return 0;
 }
 
+/* Send a command with an inline payload on the message ring */
+static int send_msg(uint16_t cmd, uint32_t arg, const void *data, uint16_t len) {
+    volatile ipc_msg_ring_t *r = msg_cmd_ring;
+    uint32_t size = r->hdr.size;
+    uint32_t head = r->hdr.head;
+    uint32_t off = head & r->hdr.mask;
+    uint32_t need = IPC_MSG_RECORD_SIZE(len);
+    uint32_t skip = (size - off < need) ? size - off : 0;
+
+    if (len > IPC_MSG_MAX_INLINE) {
+        fprintf(stderr, "[inject] Payload too large (%u > %u)\n", len,
+                IPC_MSG_MAX_INLINE);
+        return -1;
+    }
+    if (head + skip + need - r->hdr.tail > size) {
+        fprintf(stderr, "[inject] Message ring full!\n");
+        return -1;
+    }
+
+    if (skip) {
+        volatile ipc_msg_hdr_t *wrap = (volatile ipc_msg_hdr_t *)&r->data[off];
+        wrap->kind = IPC_MSG_KIND_WRAP;
+        wrap->len = 0;
+        head += skip;
+        off = 0;
+    }
+
+    volatile ipc_msg_hdr_t *m = (volatile ipc_msg_hdr_t *)&r->data[off];
+    m->kind = IPC_MSG_KIND_DATA;
+    m->len = len;
+    m->cmd = cmd;
+    m->status = 0;
+    m->arg = arg;
+    m->tag = IPC_TAG_NONE;
+    if (len)
+        memcpy((void *)(m + 1), data, len);
+
+    __sync_synchronize();
+    r->hdr.head = head + need;
+
+    if (doorbell && doorbell->magic == IPC_DOORBELL_MAGIC)
+        ((doorbell_ctl_t *)doorbell)->cmd_writes++;
+
+    printf("[inject] Sent msg: cmd=%s(0x%04X) arg=0x%08X len=%u\n",
+           cmd_name(cmd), cmd, arg, len);
+    return 0;
+}
+
+static void poll_msg_response(void) {
+    volatile ipc_msg_ring_t *r = msg_rsp_ring;
+
+    for (;;) {
+        if (r->hdr.head == r->hdr.tail) {
+            printf("[inject] No message responses pending.\n");
+            return;
+        }
+        uint32_t tail = r->hdr.tail;
+        uint32_t off = tail & r->hdr.mask;
+        volatile ipc_msg_hdr_t *m = (volatile ipc_msg_hdr_t *)&r->data[off];
+        if (m->kind == IPC_MSG_KIND_WRAP) {
+            r->hdr.tail = tail + (r->hdr.size - off);
+            continue;
+        }
+
+        printf("[inject] Message response received:\n");
+        printf("  Status: %s (0x%04X)\n", rsp_name(m->status), m->status);
+        printf("  Orig Cmd: %s (0x%04X)\n", cmd_name(m->cmd), m->cmd);
+        printf("  Result: 0x%08X\n", m->arg);
+        printf("  Inline: %u bytes\n", m->len);
+        printf("  Tag: 0x%08X\n", m->tag);
+
+        __sync_synchronize();
+        r->hdr.tail = tail + IPC_MSG_RECORD_SIZE(m->len);
+        return;
+    }
+}
+
 static void poll_response(void) {
-    if (rsp_ring->head == rsp_ring->tail) {
+    if (rsp_ring->hdr.head == rsp_ring->hdr.tail) {
         printf("[inject] No responses pending.\n");
         return;
     }
 
-    uint32_t tail = rsp_ring->tail;
-    volatile ipc_response_t *rsp = &rsp_ring->data[tail];
+    uint32_t tail = rsp_ring->hdr.tail;
+    volatile ipc_response_t *rsp = &rsp_ring->data[tail & rsp_ring->hdr.mask];
 
     printf("[inject] Response received:\n");
     printf("  Status: %s (0x%04X)\n", rsp_name(rsp->status), rsp->status);
     printf("  Orig Cmd: %s (0x%04X)\n", cmd_name(rsp->orig_cmd), rsp->orig_cmd);
     printf("  Result: 0x%08X\n", rsp->result);
     printf("  Timestamp: %llu\n", (unsigned long long)rsp->timestamp);
+    printf("  Tag: 0x%08X\n", rsp->tag);
 
     /* Consume response */
     __sync_synchronize();
-    ((ipc_rsp_ring_t *)rsp_ring)->tail = (tail + 1) % rsp_ring->size;
+    rsp_ring->hdr.tail = tail + 1;
+}
+
+/* Keep the command ring full and drain responses as they come */
+static void flood(uint32_t count, uint16_t cmd) {
+    uint32_t sent = 0, answered = 0, errors = 0;
+    uint64_t t0 = time_usec();
+    uint64_t deadline = t0 + 10000000;  /* Give up after 10s without progress */
+
+    while (answered < count) {
+        uint32_t head = cmd_ring->hdr.head;
+        uint32_t pushed = 0;
+        while (sent < count && head - cmd_ring->hdr.tail < cmd_ring->hdr.size) {
+            volatile ipc_packet_t *pkt = &cmd_ring->data[head & cmd_ring->hdr.mask];
+            pkt->cmd = cmd;
+            pkt->flags = 0;
+            pkt->payload_id = sent;
+            pkt->timestamp = 0;
+            pkt->tag = IPC_TAG_NONE;
+            pkt->reserved = 0;
+            __sync_synchronize();
+            head++;
+            if (cmd_ring->hdr.flags & IPC_RING_FLAG_MPSC)
+                IPC_RING_SEQ(cmd_ring)[(head - 1) & cmd_ring->hdr.mask] = head;
+            sent++;
+            pushed++;
+        }
+        if (pushed) {
+            cmd_ring->hdr.head = head;
+            doorbell->cmd_doorbell = head;
+        }
+
+        uint32_t tail = rsp_ring->hdr.tail;
+        uint32_t rsp_head = rsp_ring->hdr.head;
+        __sync_synchronize();
+        for (; tail != rsp_head; tail++, answered++) {
+            if (rsp_ring->data[tail & rsp_ring->hdr.mask].status != RSP_OK)
+                errors++;
+        }
+        if (tail != rsp_ring->hdr.tail) {
+            rsp_ring->hdr.tail = tail;
+            deadline = time_usec() + 10000000;
+        } else if (time_usec() > deadline) {
+            fprintf(stderr, "[inject] Stalled: %u of %u answered\n", answered, count);
+            break;
+        }
+    }
+
+    uint64_t us = time_usec() - t0;
+    printf("[inject] %u %s commands answered in %llu us: %.0f/s, %u errors\n",
+           answered, cmd_name(cmd), (unsigned long long)us,
+           us ? answered * 1e6 / (double)us : 0.0, errors);
+}
+
+/* Send a streaming ENV_RESET and wait for its answer
+ * Returns: 0, or -1 if it failed or went unanswered
+ */
+static int env_reset_wait(uint32_t flags, uint32_t envs) {
+    uint32_t tail = rsp_ring->hdr.tail;
+    if (send_packet(CMD_ENV_RESET, ENV_RESET_PACK(ENV_RESET_FLAG_STREAM | flags, envs)) < 0)
+        return -1;
+
+    uint64_t deadline = time_usec() + 2000000;
+    while (rsp_ring->hdr.head == tail) {
+        if (time_usec() > deadline) {
+            fprintf(stderr, "[inject] No ENV_RESET response (is the bridge running "
+                    "with --env?)\n");
+            return -1;
+        }
+        sched_yield();
+    }
+    __sync_synchronize();
+    uint16_t status = rsp_ring->data[tail & rsp_ring->hdr.mask].status;
+    rsp_ring->hdr.tail = tail + 1;
+    if (status != RSP_OK) {
+        fprintf(stderr, "[inject] ENV_RESET failed: %s\n", rsp_name(status));
+        return -1;
+    }
+    return 0;
+}
+
+/* Play the kernel's side of a stream control loop: ENV_RESET, then answer
+ * every batch of obs entries with a batch of actions (a fixed balancing
+ * policy for CartPole-style 4-wide obs), until steps env steps are done.
+ * A single env is reset by command when its episode ends, as ZENEDGE
+ * does; a vector resets itself. Pipelined, the vector's two groups
+ * (ENV_PIPELINE_SPLIT) take turns, each batch one group.
+ */
+static void envloop(uint32_t steps, uint32_t envs, int pipe) {
+    init_stream_rings();
+    uint32_t entry = obs_ring->entry_size;
+    if (envs > obs_ring->size)
+        envs = obs_ring->size;
+    if (envs < 2)
+        pipe = 0;
+    if (env_reset_wait(pipe ? ENV_RESET_FLAG_PIPELINE : 0, envs) < 0)
+        return;
+    quiet = 1;
+
+    uint32_t split = pipe ? ENV_PIPELINE_SPLIT(envs) : envs;
+    uint32_t group = 0;
+    uint32_t done = 0, batches = 0;
+    uint64_t steps_done = 0;
+    uint64_t t0 = time_usec();
+    uint64_t deadline = t0 + 2000000;
+    for (uint32_t stepped = 0; stepped < steps;) {
+        uint32_t n = group ? envs - split : split;
+        uint32_t otail = obs_ring->tail;
+        if (obs_ring->head - otail < n) {
+            if (time_usec() > deadline) {
+                fprintf(stderr, "[inject] Stalled after %u steps\n", stepped);
+                break;
+            }
+            sched_yield();  /* The bridge may share our CPU */
+            continue;
+        }
+        __sync_synchronize();
+
+        uint32_t ahead = act_ring->head;
+        int done_now = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            const char *e = (const char *)obs_ring + IPC_RING_HDR_SIZE +
+                            ((otail + i) & obs_ring->mask) * entry;
+            uint32_t seq;
+            float obs[4] = { 0 }, d;
+            memcpy(&seq, e, 4);
+            memcpy(obs, e + 4, IPC_OBS_DIM < 4 ? 4 * IPC_OBS_DIM : sizeof(obs));
+            memcpy(&d, e + 8 + 4 * IPC_OBS_DIM, 4);
+            done_now = d != 0.0f;
+            done += done_now;
+
+            volatile action_entry_t *a = (volatile action_entry_t *)
+                ((char *)act_ring + IPC_RING_HDR_SIZE +
+                 ((ahead + i) & act_ring->mask) * ACT_ENTRY_BYTES);
+            a->seq = seq;
+            a->action = obs[2] + 0.5f * obs[3] > 0.0f;
+            a->flags = 0;
+            a->ack_seq = seq;
+            a->ts = 0;
+        }
+        obs_ring->tail = otail + n;
+        stepped += n;
+        steps_done += n;
+        batches++;
+        deadline = time_usec() + 2000000;
+
+        if (envs == 1 && done_now) {
+            if (env_reset_wait(0, 1) < 0)
+                break;
+            continue;
+        }
+        __sync_synchronize();
+        act_ring->head = ahead + n;
+        if (pipe)
+            group ^= 1;
+    }
+
+    uint64_t us = time_usec() - t0;
+    printf("[inject] %llu env steps (%u batches of %u%s) in %llu us: %.0f steps/s, "
+           "%u episodes ended\n", (unsigned long long)steps_done, batches,
+           pipe ? split : envs, pipe ? " or fewer, pipelined" : "",
+           (unsigned long long)us, us ? steps_done * 1e6 / (double)us : 0.0, done);
+}
+
+/* =============================================================================
+ * LOAD GENERATOR (./inject load ...)
+ * =============================================================================
+ * Drives the command ring the way a busy ZENEDGE would and times every
+ * command from its ipc_packet_t.timestamp to the moment its response is
+ * seen (matched by tag). Closed loop keeps --inflight commands
+ * outstanding; open loop (--rate) sends on a Poisson schedule and stamps
+ * each packet with the time it was due, so a stalled bridge shows up as
+ * latency instead of as a lower send rate.
+ */
+#define LOAD_MIX_MAX      8
+#define LOAD_PAYLOADS_MAX 8
+#define LOAD_BLOBS        8       /* Blobs per payload size, picked at random */
+#define LOAD_TAGS         65536   /* Outstanding commands tracked (power of 2) */
+#define LOAD_DRAIN_NS     1000000000ull  /* Wait this long for stragglers */
+
+typedef struct {
+    uint16_t cmd;
+    uint32_t weight;
+    int blob;                     /* Send a payload blob as payload_id */
+    uint64_t sent, answered;
+    uint32_t *lat;                /* ns, one per answer */
+    uint32_t lat_len, lat_cap;
+} load_cmd_t;
+
+typedef struct {
+    uint64_t send_ns;             /* 0 = free */
+    uint8_t mix;
+} load_tag_t;
+
+static struct {
+    load_cmd_t mix[LOAD_MIX_MAX];
+    uint32_t mix_count, weight_total;
+    uint32_t payload[LOAD_PAYLOADS_MAX];
+    uint32_t payload_count;
+    uint16_t blobs[LOAD_PAYLOADS_MAX][LOAD_BLOBS];
+    double rate;                  /* Commands/s, 0 = closed loop */
+    uint32_t inflight;
+    double duration;
+    const char *json;             /* Results file, "-" = stdout */
+    uint64_t rng;
+    load_tag_t tags[LOAD_TAGS];
+    uint32_t next_tag;
+    uint32_t outstanding;
+    uint64_t errors, stray, backlogged, sent;
+} load = { .inflight = 32, .duration = 5.0, .rng = 0x9E3779B97F4A7C15ull,
+           .next_tag = 1 };
+
+static uint64_t time_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t load_rand(void) {
+    load.rng ^= load.rng << 13;
+    load.rng ^= load.rng >> 7;
+    load.rng ^= load.rng << 17;
+    return load.rng;
+}
+
+/* Heap, as heap_init() lays it out, so payload blobs are real blobs the
+ * bridge can look up. Only the kernel arena is allocated from.
+ */
+static volatile heap_ctl_t *heap_ctl = NULL;
+static volatile uint8_t *heap_data = NULL;
+static volatile heap_blob_slot_t *blob_table = NULL;
+static uint32_t heap_blocks, blob_shift;
+
+static volatile heap_free_chunk_t *heap_chunk(volatile heap_arena_t *a, uint32_t block) {
+    return (volatile heap_free_chunk_t *)(heap_data +
+                                          (a->base_block + block) * HEAP_BLOCK_SIZE);
+}
+
+static void heap_push(volatile heap_arena_t *a, uint32_t block, uint32_t order) {
+    volatile heap_free_chunk_t *c = heap_chunk(a, block);
+    uint32_t head = a->free_head[order];
+    c->magic = HEAP_FREE_MAGIC;
+    c->order = order;
+    c->next = head;
+    c->prev = HEAP_BUDDY_NIL;
+    if (head != HEAP_BUDDY_NIL)
+        heap_chunk(a, head)->prev = block;
+    a->free_head[order] = block;
+}
+
+static void heap_arena_init(volatile heap_arena_t *a, uint32_t base, uint32_t blocks,
+                            uint32_t slot_base, uint32_t slot_count) {
+    a->base_block = base;
+    a->blocks = blocks;
+    a->free_blocks = blocks;
+    a->buddy_orders = blocks ? 32 - __builtin_clz(blocks) : 0;
+    if (a->buddy_orders > HEAP_BUDDY_ORDERS)
+        a->buddy_orders = HEAP_BUDDY_ORDERS;
+    a->slot_base = slot_base;
+    a->slot_count = slot_count;
+    a->next_slot = 0;
+    a->blob_count = 0;
+    a->ret.head = 0;
+    a->ret.tail = 0;
+    for (uint32_t k = 0; k < HEAP_BUDDY_ORDERS; k++)
+        a->free_head[k] = HEAP_BUDDY_NIL;
+    for (uint32_t p = 0; p < HEAP_POOLS; p++) {
+        a->pool[p].blob_size = 0;
+        a->pool[p].free_count = 0;
+    }
+    for (uint32_t block = 0; block < blocks;) {
+        uint32_t k = a->buddy_orders - 1;
+        while ((block & ((1u << k) - 1)) != 0 || block + (1u << k) > blocks)
+            k--;
+        heap_push(a, block, k);
+        block += 1u << k;
+    }
+}
+
+static int heap_setup(void) {
+    volatile ipc_region_t *ctl = &layout->regions[IPC_REGION_HEAP_CTL];
+    volatile ipc_region_t *data = &layout->regions[IPC_REGION_HEAP_DATA];
+    uint32_t slots = ctl->entries;
+    if (!ctl->size || !data->size || slots < HEAP_ARENA_COUNT || (slots & (slots - 1)))
+        return -1;
+
+    heap_ctl = (volatile heap_ctl_t *)((char *)shm_base + ctl->offset);
+    heap_data = (volatile uint8_t *)shm_base + data->offset;
+    heap_blocks = data->size / HEAP_BLOCK_SIZE;
+
+    heap_ctl->magic = 0;
+    __sync_synchronize();
+    heap_ctl->version = IPC_HEAP_VERSION;
+    heap_ctl->total_blocks = heap_blocks;
+    heap_ctl->arena_count = HEAP_ARENA_COUNT;
+    heap_ctl->reserved = 0;
+    heap_ctl->blob_slots = slots;
+    heap_ctl->blob_table = HEAP_BLOB_TABLE_OFFSET(heap_blocks);
+    heap_ctl->reserved2 = 0;
+    memset((void *)heap_ctl->bitmap, 0, (heap_blocks + 7) / 8);
+
+    blob_table = (volatile heap_blob_slot_t *)((char *)heap_ctl + heap_ctl->blob_table);
+    blob_shift = 31 - __builtin_clz(slots);
+    memset((void *)blob_table, 0, slots * sizeof(heap_blob_slot_t));
+
+    uint32_t split = (heap_blocks / 2) & ~(uint32_t)(HEAP_ARENA_ALIGN - 1);
+    heap_arena_init(&heap_ctl->arena[HEAP_ARENA_KERNEL], 0, split, 0, slots / 2);
+    heap_arena_init(&heap_ctl->arena[HEAP_ARENA_BRIDGE], split, heap_blocks - split,
+                    slots / 2, slots - slots / 2);
+    __sync_synchronize();
+    heap_ctl->magic = IPC_HEAP_MAGIC;
+    return 0;
+}
+
+/* A pinned raw blob of size bytes from the kernel arena, filled with a
+ * pattern. Returns: its id, or 0 if the arena is out of space or slots
+ */
+static uint16_t heap_blob(uint32_t size) {
+    volatile heap_arena_t *a = &heap_ctl->arena[HEAP_ARENA_KERNEL];
+    uint32_t need = (size + sizeof(heap_blob_t) + HEAP_BLOCK_SIZE - 1) / HEAP_BLOCK_SIZE;
+    uint32_t order = need <= 1 ? 0 : 32 - __builtin_clz(need - 1);
+    if (order >= a->buddy_orders || a->next_slot >= a->slot_count)
+        return 0;
+
+    uint32_t k = order;
+    while (k < a->buddy_orders && a->free_head[k] == HEAP_BUDDY_NIL)
+        k++;
+    if (k >= a->buddy_orders)
+        return 0;
+    uint32_t block = a->free_head[k];
+    volatile heap_free_chunk_t *c = heap_chunk(a, block);
+    a->free_head[k] = c->next;
+    if (c->next != HEAP_BUDDY_NIL)
+        heap_chunk(a, c->next)->prev = HEAP_BUDDY_NIL;
+    c->magic = 0;
+    while (k > order) {
+        k--;
+        heap_push(a, block + (1u << k), k);
+    }
+    for (uint32_t b = a->base_block + block; b < a->base_block + block + (1u << order); b++)
+        heap_ctl->bitmap[b / 8] |= (uint8_t)(1u << (b % 8));
+    a->free_blocks -= 1u << order;
+
+    uint32_t idx = a->slot_base + a->next_slot++;
+    uint16_t gen = 1;
+    uint16_t id = (uint16_t)((gen << blob_shift) | idx);
+    uint32_t offset = (a->base_block + block) * HEAP_BLOCK_SIZE;
+
+    volatile heap_blob_t *blob = (volatile heap_blob_t *)(heap_data + offset);
+    blob->magic = BLOB_MAGIC;
+    blob->blob_id = id;
+    blob->type = BLOB_TYPE_RAW;
+    blob->flags = BLOB_FLAG_PINNED | BLOB_FLAG_CSUM_NONE;
+    blob->size = size;
+    blob->offset = offset + sizeof(heap_blob_t);
+    blob->checksum = 0;
+    blob->pool = 0;
+    blob->taken[HEAP_ARENA_KERNEL] = 1;
+    blob->taken[HEAP_ARENA_BRIDGE] = 0;
+    blob->dropped[HEAP_ARENA_KERNEL] = 0;
+    blob->dropped[HEAP_ARENA_BRIDGE] = 0;
+    for (uint32_t i = 0; i < size; i++)
+        heap_data[offset + sizeof(heap_blob_t) + i] = (uint8_t)(i * 31 + id);
+
+    volatile heap_blob_slot_t *slot = &blob_table[idx];
+    slot->offset = offset;
+    slot->blocks = 1u << order;
+    slot->generation = gen;
+    __sync_synchronize();
+    slot->blob_id = id;
+    a->blob_count++;
+    return id;
+}
+
+/* "ping:8,model:2,0x0300:1" */
+static int load_parse_mix(const char *spec) {
+    static const struct { const char *name; uint16_t cmd; int blob; } names[] = {
+        { "ping", CMD_PING, 0 }, { "print", CMD_PRINT, 1 },
+        { "model", CMD_RUN_MODEL, 1 }, { "telemetry", 0x0300, 0 },
+    };
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    load.mix_count = 0;
+    load.weight_total = 0;
+
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        if (load.mix_count == LOAD_MIX_MAX)
+            return -1;
+        load_cmd_t *m = &load.mix[load.mix_count];
+        char *colon = strchr(tok, ':');
+        m->weight = colon ? (uint32_t)strtoul(colon + 1, NULL, 0) : 1;
+        if (colon)
+            *colon = '\0';
+        m->cmd = 0;
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (strcmp(tok, names[i].name) == 0) {
+                m->cmd = names[i].cmd;
+                m->blob = names[i].blob;
+            }
+        }
+        if (!m->cmd) {
+            char *end;
+            unsigned long v = strtoul(tok, &end, 0);
+            if (*end || !v || v > 0x7FFF) {
+                fprintf(stderr, "[inject] Unknown command in mix: %s\n", tok);
+                return -1;
+            }
+            m->cmd = (uint16_t)v;
+            m->blob = 1;
+        }
+        if (!m->weight)
+            continue;
+        load.weight_total += m->weight;
+        load.mix_count++;
+    }
+    return load.mix_count ? 0 : -1;
+}
+
+static void load_record(load_cmd_t *m, uint32_t ns) {
+    if (m->lat_len == m->lat_cap) {
+        uint32_t cap = m->lat_cap ? m->lat_cap * 2 : 65536;
+        uint32_t *lat = realloc(m->lat, cap * sizeof(uint32_t));
+        if (!lat)
+            return;  /* Counted, not timed */
+        m->lat = lat;
+        m->lat_cap = cap;
+    }
+    m->lat[m->lat_len++] = ns;
+}
+
+/* Queue one command (not yet published). Returns: 0, or -1 if no room */
+static int load_send(uint32_t *head, uint64_t due_ns) {
+    if (*head - cmd_ring->hdr.tail >= cmd_ring->hdr.size ||
+        load.outstanding >= LOAD_TAGS / 2)
+        return -1;
+
+    uint32_t pick = (uint32_t)(load_rand() % load.weight_total), i = 0;
+    while (pick >= load.mix[i].weight)
+        pick -= load.mix[i++].weight;
+    load_cmd_t *m = &load.mix[i];
+
+    uint32_t payload = 0;
+    if (m->blob && load.payload_count) {
+        uint64_t r = load_rand();
+        payload = load.blobs[r % load.payload_count][(r >> 32) % LOAD_BLOBS];
+    }
+
+    uint32_t tag = load.next_tag++;
+    if (!load.next_tag)
+        load.next_tag = 1;
+    load_tag_t *t = &load.tags[tag & (LOAD_TAGS - 1)];
+    t->send_ns = due_ns;
+    t->mix = (uint8_t)i;
+
+    volatile ipc_packet_t *pkt = &cmd_ring->data[*head & cmd_ring->hdr.mask];
+    pkt->cmd = m->cmd;
+    pkt->flags = 0;
+    pkt->payload_id = payload;
+    pkt->timestamp = due_ns / 1000;  /* usec, like ZENEDGE's time_usec() */
+    pkt->tag = tag;
+    pkt->reserved = 0;
+    __sync_synchronize();
+    (*head)++;
+    if (cmd_ring->hdr.flags & IPC_RING_FLAG_MPSC)
+        IPC_RING_SEQ(cmd_ring)[(*head - 1) & cmd_ring->hdr.mask] = *head;
+
+    m->sent++;
+    load.sent++;
+    load.outstanding++;
+    return 0;
+}
+
+static int load_drain(void) {
+    uint32_t tail = rsp_ring->hdr.tail;
+    uint32_t head = rsp_ring->hdr.head;
+    if (tail == head)
+        return 0;
+    __sync_synchronize();
+    uint64_t now = time_nsec();
+
+    for (; tail != head; tail++) {
+        volatile ipc_response_t *rsp = &rsp_ring->data[tail & rsp_ring->hdr.mask];
+        load_tag_t *t = &load.tags[rsp->tag & (LOAD_TAGS - 1)];
+        if (rsp->tag == IPC_TAG_NONE || !t->send_ns) {
+            load.stray++;
+            continue;
+        }
+        load_cmd_t *m = &load.mix[t->mix];
+        if (rsp->status != RSP_OK)
+            load.errors++;
+        uint64_t ns = now - t->send_ns;
+        load_record(m, ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+        m->answered++;
+        t->send_ns = 0;
+        load.outstanding--;
+    }
+    rsp_ring->hdr.tail = tail;
+    return 1;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Microseconds at permille/1000 of sorted lat[] (nearest rank) */
+static double load_pct(const uint32_t *lat, uint32_t n, uint32_t permille) {
+    if (!n)
+        return 0.0;
+    uint64_t rank = ((uint64_t)n * permille + 999) / 1000;
+    return lat[rank ? rank - 1 : 0] / 1000.0;
+}
+
+typedef struct {
+    uint32_t n;
+    double min, mean, p50, p90, p99, p999, max;
+} load_summary_t;
+
+static load_summary_t load_summarize(uint32_t *lat, uint32_t n) {
+    load_summary_t s = { .n = n };
+    if (!n)
+        return s;
+    qsort(lat, n, sizeof(uint32_t), cmp_u32);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += lat[i];
+    s.min = lat[0] / 1000.0;
+    s.mean = (double)sum / n / 1000.0;
+    s.p50 = load_pct(lat, n, 500);
+    s.p90 = load_pct(lat, n, 900);
+    s.p99 = load_pct(lat, n, 990);
+    s.p999 = load_pct(lat, n, 999);
+    s.max = lat[n - 1] / 1000.0;
+    return s;
+}
+
+static void load_json_summary(FILE *f, const load_summary_t *s) {
+    fprintf(f, "{\"count\": %u, \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, "
+            "\"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+            s->n, s->min, s->mean, s->p50, s->p90, s->p99, s->p999, s->max);
+}
+
+static void load_report(double elapsed) {
+    /* All answers, then each command's */
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < load.mix_count; i++)
+        total += load.mix[i].lat_len;
+    uint32_t *all = malloc((total ? total : 1) * sizeof(uint32_t));
+    uint32_t n = 0;
+    for (uint32_t i = 0; all && i < load.mix_count; i++) {
+        memcpy(all + n, load.mix[i].lat, load.mix[i].lat_len * sizeof(uint32_t));
+        n += load.mix[i].lat_len;
+    }
+    load_summary_t s = load_summarize(all, all ? n : 0);
+    load_summary_t per[LOAD_MIX_MAX];
+    uint64_t answered = 0;
+    for (uint32_t i = 0; i < load.mix_count; i++) {
+        per[i] = load_summarize(load.mix[i].lat, load.mix[i].lat_len);
+        answered += load.mix[i].answered;
+    }
+    double tput = elapsed > 0 ? answered / elapsed : 0.0;
+
+    printf("[inject] %s loop, %.1f s: %llu sent, %llu answered (%.0f/s), "
+           "%llu errors, %llu unanswered\n",
+           load.rate > 0 ? "Open" : "Closed", elapsed,
+           (unsigned long long)load.sent, (unsigned long long)answered, tput,
+           (unsigned long long)load.errors, (unsigned long long)load.outstanding);
+    if (load.rate > 0)
+        printf("[inject] Offered %.0f/s, ring full at %llu due sends\n", load.rate,
+               (unsigned long long)load.backlogged);
+    printf("[inject] Latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           s.p50, s.p90, s.p99, s.p999, s.max);
+    for (uint32_t i = 0; load.mix_count > 1 && i < load.mix_count; i++)
+        printf("[inject]   %-10s %8llu answered  p50 %.1f  p99 %.1f\n",
+               cmd_name(load.mix[i].cmd), (unsigned long long)load.mix[i].answered,
+               per[i].p50, per[i].p99);
+
+    if (load.json) {
+        FILE *f = strcmp(load.json, "-") == 0 ? stdout : fopen(load.json, "w");
+        if (!f) {
+            perror("[inject] Results file");
+        } else {
+            fprintf(f, "{\"mode\": \"%s\", \"rate\": %.1f, \"inflight\": %u, "
+                    "\"duration_s\": %.3f, \"elapsed_s\": %.6f,\n",
+                    load.rate > 0 ? "open" : "closed", load.rate,
+                    load.rate > 0 ? 0 : load.inflight, load.duration, elapsed);
+            fprintf(f, " \"payload_bytes\": [");
+            for (uint32_t i = 0; i < load.payload_count; i++)
+                fprintf(f, "%s%u", i ? ", " : "", load.payload[i]);
+            fprintf(f, "],\n \"sent\": %llu, \"answered\": %llu, \"errors\": %llu, "
+                    "\"unanswered\": %u, \"stray\": %llu, \"backlogged\": %llu, "
+                    "\"throughput\": %.1f,\n \"latency_us\": ",
+                    (unsigned long long)load.sent, (unsigned long long)answered,
+                    (unsigned long long)load.errors, load.outstanding,
+                    (unsigned long long)load.stray, (unsigned long long)load.backlogged,
+                    tput);
+            load_json_summary(f, &s);
+            fprintf(f, ",\n \"commands\": [");
+            for (uint32_t i = 0; i < load.mix_count; i++) {
+                load_cmd_t *m = &load.mix[i];
+                fprintf(f, "%s\n  {\"cmd\": %u, \"name\": \"%s\", \"weight\": %u, "
+                        "\"sent\": %llu, \"answered\": %llu, \"latency_us\": ",
+                        i ? "," : "", m->cmd, cmd_name(m->cmd), m->weight,
+                        (unsigned long long)m->sent, (unsigned long long)m->answered);
+                load_json_summary(f, &per[i]);
+                fprintf(f, "}");
+            }
+            fprintf(f, "]}\n");
+            if (f != stdout)
+                fclose(f);
+        }
+    }
+    free(all);
+}
+
+static void load_usage(void) {
+    fprintf(stderr, "Usage: inject load [options]\n");
+    fprintf(stderr, "  --mix <cmd:w,...>  Command mix by weight: ping, print, model,\n"
+                    "                     telemetry or a command id (default ping)\n");
+    fprintf(stderr, "  --inflight <n>     Closed loop: keep n commands outstanding (default 32)\n");
+    fprintf(stderr, "  --rate <per_s>     Open loop: Poisson arrivals at this mean rate\n");
+    fprintf(stderr, "  --duration <s>     How long to send (default 5)\n");
+    fprintf(stderr, "  --payload <b,...>  Heap blob sizes sent with print/model/raw ids\n");
+    fprintf(stderr, "  --seed <n>         Mix, payload and arrival randomness\n");
+    fprintf(stderr, "  --json <file|->    Write results as JSON\n");
+}
+
+static int load_main(int argc, char *argv[]) {
+    if (load_parse_mix("ping") < 0)
+        return 1;
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            load_usage();
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--mix") == 0) {
+            if (load_parse_mix(val) < 0) {
+                load_usage();
+                return 1;
+            }
+        } else if (strcmp(arg, "--inflight") == 0) {
+            load.inflight = (uint32_t)strtoul(val, NULL, 0);
+        } else if (strcmp(arg, "--rate") == 0) {
+            load.rate = strtod(val, NULL);
+        } else if (strcmp(arg, "--duration") == 0) {
+            load.duration = strtod(val, NULL);
+        } else if (strcmp(arg, "--seed") == 0) {
+            load.rng = strtoull(val, NULL, 0) * 0x9E3779B97F4A7C15ull | 1;
+        } else if (strcmp(arg, "--json") == 0) {
+            load.json = val;
+        } else if (strcmp(arg, "--payload") == 0) {
+            char buf[256];
+            snprintf(buf, sizeof(buf), "%s", val);
+            load.payload_count = 0;
+            for (char *tok = strtok(buf, ","); tok && load.payload_count < LOAD_PAYLOADS_MAX;
+                 tok = strtok(NULL, ","))
+                load.payload[load.payload_count++] = (uint32_t)strtoul(tok, NULL, 0);
+        } else {
+            load_usage();
+            return 1;
+        }
+    }
+    if (!load.inflight)
+        load.inflight = 1;
+    if (load.inflight > LOAD_TAGS / 2)
+        load.inflight = LOAD_TAGS / 2;
+
+    if (load.payload_count) {
+        if (heap_setup() < 0) {
+            fprintf(stderr, "[inject] No heap in this layout\n");
+            return 1;
+        }
+        for (uint32_t p = 0; p < load.payload_count; p++)
+            for (uint32_t b = 0; b < LOAD_BLOBS; b++)
+                if (!(load.blobs[p][b] = heap_blob(load.payload[p]))) {
+                    fprintf(stderr, "[inject] Heap too small for %u x %u byte blobs\n",
+                            LOAD_BLOBS, load.payload[p]);
+                    return 1;
+                }
+    }
+
+    /* Anything left over from earlier runs is not ours */
+    rsp_ring->hdr.tail = rsp_ring->hdr.head;
+
+    uint64_t t0 = time_nsec();
+    uint64_t end = t0 + (uint64_t)(load.duration * 1e9);
+    uint64_t due = t0;
+    uint64_t now = t0, last_answer = t0;
+
+    while (now < end || (load.outstanding && now - last_answer < LOAD_DRAIN_NS)) {
+        uint32_t head = cmd_ring->hdr.head;
+        uint32_t start = head;
+        if (now < end && load.rate > 0) {
+            while (due <= now && due < end) {
+                if (load_send(&head, due) < 0) {
+                    load.backlogged++;
+                    break;
+                }
+                double u = (double)((load_rand() >> 11) + 1) / 9007199254740993.0;
+                due += (uint64_t)(-log(u) / load.rate * 1e9);
+            }
+        } else if (now < end) {
+            while (load.outstanding < load.inflight && load_send(&head, now) == 0) {
+            }
+        }
+        if (head != start) {
+            cmd_ring->hdr.head = head;
+            doorbell->cmd_doorbell = head;
+            ((doorbell_ctl_t *)doorbell)->cmd_writes++;
+        }
+
+        if (load_drain())
+            last_answer = time_nsec();
+        else
+            sched_yield();  /* The bridge may share our CPU */
+        now = time_nsec();
+    }
+
+    load_report((double)(now - t0) / 1e9);
+    return 0;
 }
 
 static void print_status(void) {
     printf("[inject] === Ring Status ===\n");
 
     printf("[inject] CMD Ring:\n");
-    printf("  Magic: 0x%08X %s\n", cmd_ring->magic,
-           cmd_ring->magic == IPC_MAGIC ? "(valid)" : "(INVALID)");
-    printf("  Head:  %u\n", cmd_ring->head);
-    printf("  Tail:  %u\n", cmd_ring->tail);
-    printf("  Size:  %u\n", cmd_ring->size);
-    uint32_t cmd_pending = (cmd_ring->head >= cmd_ring->tail)
-                           ? (cmd_ring->head - cmd_ring->tail)
-                           : (cmd_ring->size - cmd_ring->tail + cmd_ring->head);
+    printf("  Magic: 0x%08X %s\n", cmd_ring->hdr.magic,
+           cmd_ring->hdr.magic == IPC_MAGIC ? "(valid)" : "(INVALID)");
+    printf("  Head:  %u\n", cmd_ring->hdr.head);
+    printf("  Tail:  %u\n", cmd_ring->hdr.tail);
+    printf("  Size:  %u\n", cmd_ring->hdr.size);
+    uint32_t cmd_pending = cmd_ring->hdr.head - cmd_ring->hdr.tail;
     printf("  Pending: %u commands\n", cmd_pending);
 
     printf("[inject] RSP Ring:\n");
-    printf("  Magic: 0x%08X %s\n", rsp_ring->magic,
-           rsp_ring->magic == IPC_RSP_MAGIC ? "(valid)" : "(INVALID)");
-    printf("  Head:  %u\n", rsp_ring->head);
-    printf("  Tail:  %u\n", rsp_ring->tail);
-    printf("  Size:  %u\n", rsp_ring->size);
-    uint32_t rsp_pending = (rsp_ring->head >= rsp_ring->tail)
-                           ? (rsp_ring->head - rsp_ring->tail)
-                           : (rsp_ring->size - rsp_ring->tail + rsp_ring->head);
+    printf("  Magic: 0x%08X %s\n", rsp_ring->hdr.magic,
+           rsp_ring->hdr.magic == IPC_RSP_MAGIC ? "(valid)" : "(INVALID)");
+    printf("  Head:  %u\n", rsp_ring->hdr.head);
+    printf("  Tail:  %u\n", rsp_ring->hdr.tail);
+    printf("  Size:  %u\n", rsp_ring->hdr.size);
+    uint32_t rsp_pending = rsp_ring->hdr.head - rsp_ring->hdr.tail;
     printf("  Pending: %u responses\n", rsp_pending);
 
     printf("[inject] Doorbell:\n");
@@ -187,6 +1202,12 @@ static void print_status(void) {
            doorbell->rsp_doorbell, doorbell->rsp_writes, doorbell->rsp_irq_count);
     printf("  RSP IRQ enabled: %s\n",
            (doorbell->rsp_flags & DOORBELL_FLAG_IRQ_ENABLED) ? "yes" : "no");
+
+    printf("[inject] MSG Rings:\n");
+    printf("  Magic: 0x%08X %s\n", msg_cmd_ring->hdr.magic,
+           msg_cmd_ring->hdr.magic == IPC_MSG_MAGIC ? "(valid)" : "(INVALID)");
+    printf("  CMD pending: %u bytes\n", msg_cmd_ring->hdr.head - msg_cmd_ring->hdr.tail);
+    printf("  RSP pending: %u bytes\n", msg_rsp_ring->hdr.head - msg_rsp_ring->hdr.tail);
 }
 
 static void usage(const char *prog) {
@@ -196,8 +1217,14 @@ static void usage(const char *prog) {
     fprintf(stderr, "  print <id>     Send PRINT command with payload\n");
     fprintf(stderr, "  model <id>     Send RUN_MODEL command with model ID\n");
     fprintf(stderr, "  status         Show ring buffer status\n");
-    fprintf(stderr, "  reset          Reset ring buffers\n");
+    fprintf(stderr, "  reset [size]   Re-lay out shared memory (grow file to size) and reset rings\n");
     fprintf(stderr, "  poll           Poll for and consume one response\n");
+    fprintf(stderr, "  say <text>     Send PRINT with inline text (message ring)\n");
+    fprintf(stderr, "  mpoll          Poll for one message-ring response\n");
+    fprintf(stderr, "  flood <n> [model] Send n PINGs (or RUN_MODELs) flat out, report the rate\n");
+    fprintf(stderr, "  envloop <n> [envs] [pipe]  Run n stream env steps against bridge --env\n");
+    fprintf(stderr, "  load [options]  Command mix at a set rate or concurrency, with latency\n"
+                    "                  percentiles (see load --help)\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -206,11 +1233,21 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    if (init_rings(DEFAULT_SHM_PATH) < 0) {
+    const char *cmd = argv[1];
+    size_t want_size = 0;
+    if (strcmp(cmd, "reset") == 0 && argc > 2)
+        want_size = strtoull(argv[2], NULL, 0);
+
+    if (init_rings(DEFAULT_SHM_PATH, want_size) < 0) {
         return 1;
     }
 
-    const char *cmd = argv[1];
+    if (strcmp(cmd, "load") == 0) {
+        int rc = load_main(argc, argv);
+        munmap(shm_base, shm_size);
+        return rc;
+    }
+
     uint32_t payload = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 0;
 
     if (strcmp(cmd, "ping") == 0) {
@@ -223,34 +1260,32 @@ int main(int argc, char *argv[]) {
         print_status();
     } else if (strcmp(cmd, "poll") == 0) {
         poll_response();
+    } else if (strcmp(cmd, "say") == 0) {
+        const char *text = (argc > 2) ? argv[2] : "";
+        send_msg(CMD_PRINT, 0, text, (uint16_t)strlen(text));
+    } else if (strcmp(cmd, "mpoll") == 0) {
+        poll_msg_response();
+    } else if (strcmp(cmd, "flood") == 0) {
+        int model = argc > 3 && strcmp(argv[3], "model") == 0;
+        flood(payload ? payload : 100000, model ? CMD_RUN_MODEL : CMD_PING);
+    } else if (strcmp(cmd, "envloop") == 0) {
+        uint32_t envs = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 0) : 1;
+        int pipe = argc > 4 && strcmp(argv[4], "pipe") == 0;
+        envloop(payload ? payload : 100000, envs ? envs : 1, pipe);
     } else if (strcmp(cmd, "reset") == 0) {
-        printf("[inject] Resetting ring buffers and doorbell...\n");
-        ((ipc_ring_t *)cmd_ring)->magic = IPC_MAGIC;
-        ((ipc_ring_t *)cmd_ring)->head = 0;
-        ((ipc_ring_t *)cmd_ring)->tail = 0;
-        ((ipc_ring_t *)cmd_ring)->size = IPC_RING_SIZE;
-        ((ipc_rsp_ring_t *)rsp_ring)->magic = IPC_RSP_MAGIC;
-        ((ipc_rsp_ring_t *)rsp_ring)->head = 0;
-        ((ipc_rsp_ring_t *)rsp_ring)->tail = 0;
-        ((ipc_rsp_ring_t *)rsp_ring)->size = IPC_RING_SIZE;
-        ((doorbell_ctl_t *)doorbell)->magic = IPC_DOORBELL_MAGIC;
-        ((doorbell_ctl_t *)doorbell)->version = 1;
-        ((doorbell_ctl_t *)doorbell)->cmd_doorbell = 0;
-        ((doorbell_ctl_t *)doorbell)->cmd_flags = 0;
-        ((doorbell_ctl_t *)doorbell)->cmd_irq_count = 0;
-        ((doorbell_ctl_t *)doorbell)->rsp_doorbell = 0;
-        ((doorbell_ctl_t *)doorbell)->rsp_flags = DOORBELL_FLAG_IRQ_ENABLED;
-        ((doorbell_ctl_t *)doorbell)->rsp_irq_count = 0;
-        ((doorbell_ctl_t *)doorbell)->cmd_writes = 0;
-        ((doorbell_ctl_t *)doorbell)->rsp_writes = 0;
+        printf("[inject] Resetting layout, ring buffers and doorbell...\n");
+        if (reset_all() < 0) {
+            munmap(shm_base, shm_size);
+            return 1;
+        }
         printf("[inject] Done.\n");
     } else {
         fprintf(stderr, "Unknown command: %s\n", cmd);
         usage(argv[0]);
-        munmap(shm_base, IPC_SHARED_MEM_SIZE);
+        munmap(shm_base, shm_size);
         return 1;
     }
 
-    munmap(shm_base, IPC_SHARED_MEM_SIZE);
+    munmap(shm_base, shm_size);
     return 0;
 }
@@ -8,10 +8,62 @@
 #define IPC_MAGIC      0x51DECA9E /* "SIDEAR" - sort of */
 #define IPC_RSP_MAGIC  0x52535030 /* "RSP0" */
 #define IPC_HEAP_MAGIC 0x48454150 /* "HEAP" */
-#define IPC_RING_SIZE  1024       /* Number of packets in ring */
+#define IPC_RING_SIZE  1024       /* Packets per ring in the fixed 1MB layout */
 
 /* =============================================================================
- * SHARED MEMORY LAYOUT (1MB total at 0x02000000)
+ * LAYOUT DESCRIPTOR (offset 0)
+ * =============================================================================
+ * ZENEDGE sizes every region from the real ivshmem BAR2 size and publishes
+ * the result here before it initializes any ring, so a larger device gets a
+ * proportionally larger heap and deeper rings without recompiling either
+ * side. Peers look regions up by IPC_REGION_* id; regions are 4KB aligned
+ * and a region with size 0 is absent.
+ *
+ * If offset 0 does not hold IPC_LAYOUT_MAGIC the peer is an older image
+ * using the fixed 1MB layout below.
+ */
+#define IPC_LAYOUT_MAGIC     0x5459414C  /* "LAYT" */
+#define IPC_LAYOUT_VERSION   1
+#define IPC_LAYOUT_BYTES     0x1000
+#define IPC_LAYOUT_ALIGN     0x1000
+#define IPC_REGION_MAX       32
+
+#define IPC_SHARED_MEM_MIN   0x100000    /* Smallest device we lay out (1MB) */
+
+/* Region ids (index into ipc_layout_t.regions) */
+#define IPC_REGION_CMD_RING  0   /* entries = packet slots */
+#define IPC_REGION_RSP_RING  1   /* entries = response slots */
+#define IPC_REGION_DOORBELL  2
+#define IPC_REGION_HEAP_CTL  3   /* entries = blob table slots */
+#define IPC_REGION_HEAP_DATA 4   /* entries = HEAP_BLOCK_SIZE blocks */
+#define IPC_REGION_MESH      5
+#define IPC_REGION_TELEMETRY 6
+#define IPC_REGION_MSG_CMD   7   /* entries = data bytes */
+#define IPC_REGION_MSG_RSP   8   /* entries = data bytes */
+#define IPC_REGION_OBS_RING  9   /* entries = obs slots */
+#define IPC_REGION_ACT_RING  10  /* entries = action slots */
+#define IPC_REGION_BULK      11  /* entries = bulk chunk slots */
+#define IPC_REGION_STREAM_CHAN 12 /* entries = stream channels */
+#define IPC_REGION_COUNT     13
+
+typedef struct {
+  uint32_t offset;   /* From the start of shared memory */
+  uint32_t size;     /* Bytes reserved (0 = region absent) */
+  uint32_t entries;  /* Slots / data bytes / blocks (see IPC_REGION_*) */
+  uint32_t reserved;
+} ipc_region_t;
+
+typedef struct {
+  uint32_t magic;         /* IPC_LAYOUT_MAGIC, written last */
+  uint32_t version;       /* IPC_LAYOUT_VERSION */
+  uint32_t total_size;    /* Shared memory bytes described */
+  uint32_t region_count;  /* Valid entries in regions[] */
+  uint32_t reserved[12];
+  ipc_region_t regions[IPC_REGION_MAX];
+} ipc_layout_t;
+
+/* =============================================================================
+ * FIXED SHARED MEMORY LAYOUT (1MB, images without a layout descriptor)
  * =============================================================================
  * 0x00000 - 0x07FFF: Command ring (32KB)    - ZENEDGE -> Linux
  * 0x08000 - 0x0FFFF: Response ring (32KB)   - Linux -> ZENEDGE
@@ -26,6 +78,47 @@
 #define IPC_HEAP_DATA_OFFSET 0x11000
 #define IPC_HEAP_DATA_SIZE   0xEF000  /* ~956KB */
 
+/* =============================================================================
+ * VARIABLE-LENGTH MESSAGE RINGS (inline payloads)
+ * =============================================================================
+ * Byte-addressed SPSC rings for commands whose argument does not fit in a
+ * 32-bit payload_id (print strings, IFR records, telemetry replies). They use
+ * the v2 ipc_ring_hdr_t with hdr.size = data bytes and head/tail as
+ * free-running byte offsets.
+ *
+ * Each record is an ipc_msg_hdr_t followed by `len` payload bytes, padded to
+ * IPC_MSG_ALIGN. A record never straddles the end of the data area: the
+ * producer writes an IPC_MSG_KIND_WRAP header and restarts at offset 0.
+ *
+ * Commands sent on the message ring are answered on the message response
+ * ring (with or without inline data), not on the fixed response ring.
+ */
+#define IPC_MSG_MAGIC        0x4D534752  /* "MSGR" */
+#define IPC_MSG_RING_BYTES   0x2800      /* Header + data area */
+#define IPC_MSG_DATA_BYTES   0x2000      /* Data area (power of two) */
+#define IPC_MSG_CMD_RING_OFFSET 0xF9000  /* Kernel: end of its heap data region */
+#define IPC_MSG_RSP_RING_OFFSET (IPC_MSG_CMD_RING_OFFSET + IPC_MSG_RING_BYTES)
+
+#define IPC_MSG_ALIGN        16
+#define IPC_MSG_MAX_INLINE   512         /* Largest inline payload */
+
+#define IPC_MSG_KIND_DATA    0x0001
+#define IPC_MSG_KIND_WRAP    0x0002      /* Skip to the start of the data area */
+
+typedef struct {
+  uint16_t kind;   /* IPC_MSG_KIND_* */
+  uint16_t len;    /* Inline payload bytes following this header */
+  uint16_t cmd;    /* Command ID (or original command in a response) */
+  uint16_t status; /* RSP_* in responses, command flags in commands */
+  uint32_t arg;    /* payload_id in commands, result in responses */
+  uint32_t tag;    /* Request tag (IPC_TAG_NONE if untagged) */
+} ipc_msg_hdr_t;   /* 16 bytes */
+
+/* Bytes a record with `len` payload bytes occupies in the data area */
+#define IPC_MSG_RECORD_SIZE(len) \
+  (((uint32_t)sizeof(ipc_msg_hdr_t) + (len) + IPC_MSG_ALIGN - 1) & \
+   ~(uint32_t)(IPC_MSG_ALIGN - 1))
+
 /* =============================================================================
  * DOORBELL MECHANISM - Low-latency interrupt signaling
  * =============================================================================
@@ -44,10 +137,27 @@
  *   2. Linux writes to rsp_doorbell (value = ring head)
  *   3. ZENEDGE receives IRQ (if enabled)
  *   4. ZENEDGE processes responses up to doorbell value
+ *
+ * Hardware doorbells are coalesced: the bridge sets DOORBELL_FLAG_IRQ_ENABLED
+ * in cmd_flags only when it has found the ring empty and is about to block on
+ * its ivshmem eventfd. ZENEDGE test-and-clears the flag on send, so one BAR0
+ * doorbell write covers the empty -> non-empty edge; while the bridge is
+ * busy it is only kicked every IPC_DOORBELL_BATCH packets or
+ * IPC_DOORBELL_MAX_US microseconds as a backstop.
  */
 
 #define IPC_DOORBELL_MAGIC 0x444F4F52  /* "DOOR" */
 
+/* Protocol versions (doorbell_ctl_t.version)
+ * ZENEDGE writes the ring layout it created into 'version'; the bridge
+ * attaches only if it speaks that layout and acks by writing the same
+ * value into 'peer_version'.
+ */
+#define IPC_PROTO_VERSION_V1 1  /* Packed header, modulo indices */
+#define IPC_PROTO_VERSION_V2 2  /* Cache-line split, free-running indices */
+#define IPC_PROTO_VERSION_V3 3  /* v2 rings + 24-byte tagged packets */
+#define IPC_PROTO_VERSION    IPC_PROTO_VERSION_V3
+
 /* Doorbell flags */
 #define DOORBELL_FLAG_IRQ_ENABLED  0x01  /* Enable IRQ on doorbell write */
 #define DOORBELL_FLAG_PENDING      0x02  /* IRQ pending (set by writer, cleared by reader) */
@@ -55,7 +165,7 @@
 /* Doorbell control block (256 bytes at IPC_DOORBELL_OFFSET) */
 typedef struct {
   uint32_t magic;           /* IPC_DOORBELL_MAGIC */
-  uint32_t version;         /* Protocol version (1) */
+  uint32_t version;         /* Ring layout offered by ZENEDGE (IPC_PROTO_VERSION) */
 
   /* Command doorbell (ZENEDGE -> Linux) */
   volatile uint32_t cmd_doorbell;   /* Written by ZENEDGE: cmd_ring head */
@@ -71,7 +181,22 @@ typedef struct {
   volatile uint32_t cmd_writes;     /* Total cmd doorbell writes */
   volatile uint32_t rsp_writes;     /* Total rsp doorbell writes */
 
-  uint32_t reserved[54];            /* Pad to 256 bytes */
+  volatile uint32_t peer_version;   /* Written by Linux: layout it attached with */
+
+  /* ivshmem peer IDs (IVPosition + 1, 0 = no hardware doorbell). Each side
+   * publishes its own so the other can target BAR0 doorbell writes /
+   * eventfds at it.
+   */
+  volatile uint32_t zen_peer_id;    /* Written by ZENEDGE */
+  volatile uint32_t bridge_peer_id; /* Written by Linux */
+
+  /* WASM profiling control, written by Linux and polled by ZENEDGE off
+   * the control path (episode boundaries)
+   */
+  volatile uint32_t wasm_prof_mode; /* IPC_WASM_PROF_* mask, 0 = off */
+  volatile uint32_t wasm_prof_dump; /* Bump to request a CMD_WASM_PROFILE */
+
+  uint32_t reserved[49];            /* Pad to 256 bytes */
 } doorbell_ctl_t;
 
 /* Heap block sizes (power of 2, minimum 64 bytes) */
@@ -83,6 +208,55 @@ typedef struct {
 #define CMD_PING      0x0001
 #define CMD_PRINT     0x0002
 #define CMD_RUN_MODEL 0x0010
+#define CMD_AGENT_LOAD 0x0011 /* Result: blob/bulk id of the wasm agent, 0 = none */
+#define CMD_WASM_PROFILE 0x0012 /* Payload: blob holding a WASM profile dump */
+#define CMD_RUN_MODEL_BATCH 0x0013 /* Payload: blob holding an ipc_run_batch_t */
+#define CMD_ENV_RESET 0x0100
+#define CMD_ENV_STEP  0x0101
+#define CMD_ENV_BENCH 0x0102 /* Inline: ipc_env_bench_t, control-loop benchmark */
+
+/* CMD_ENV_RESET payload: [15:0] flags, [31:16] env count (0 = 1)
+ * With more than one env (streaming only) every step moves one batch of
+ * `envs` obs entries, env i at position i, and takes back a batch of
+ * `envs` actions in the same order; finished envs reset themselves.
+ * ENV_RESET_FLAG_PIPELINE: the vector steps as two groups taking turns,
+ * envs [0, ENV_PIPELINE_SPLIT(envs)) then the rest, each stepped and
+ * published as soon as its actions are in.
+ */
+#define ENV_RESET_FLAG_STREAM   0x00000001u
+#define ENV_RESET_FLAG_PIPELINE 0x00000002u
+#define ENV_PIPELINE_SPLIT(envs) (((envs) + 1) / 2)
+#define ENV_RESET_FLAGS_MASK  0x0000FFFFu
+#define ENV_RESET_ENVS_SHIFT  16
+#define ENV_RESET_PACK(flags, envs) \
+  ((((uint32_t)(envs)) << ENV_RESET_ENVS_SHIFT) | ((uint32_t)(flags) & ENV_RESET_FLAGS_MASK))
+#define ENV_RESET_UNPACK_ENVS(payload) \
+  (((payload) >> ENV_RESET_ENVS_SHIFT) ? ((uint32_t)(payload) >> ENV_RESET_ENVS_SHIFT) : 1u)
+
+/* CMD_ENV_BENCH (message ring): sent by a GYM_BENCH build when its warmup
+ * is over (no IPC_ENV_BENCH_DONE) and again with its figures after `steps`
+ * measured env steps. The bridge times the same window from the first.
+ */
+#define IPC_ENV_BENCH_MAGIC   0x48434245  /* "EBCH" */
+#define IPC_ENV_BENCH_VERSION 1
+#define IPC_ENV_BENCH_STREAM  0x01  /* Stream rings, else CMD_ENV_STEP blobs */
+#define IPC_ENV_BENCH_DONE    0x02  /* The window is over: figures are final */
+#define IPC_ENV_BENCH_PIPELINE 0x04 /* Vector stepped in two groups */
+#define IPC_ENV_BENCH_PCTS    4     /* p50, p90, p99, max */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t envs;        /* Env steps per loop iteration */
+  uint32_t steps;       /* Env steps measured */
+  uint32_t episodes;
+  uint64_t elapsed_us;
+  uint64_t spin_us;     /* Waiting for the bridge, busy-polling */
+  uint64_t sleep_us;    /* Waiting for the bridge, halted */
+  uint32_t period_ns[IPC_ENV_BENCH_PCTS]; /* Loop iteration period */
+  uint32_t infer_ns[IPC_ENV_BENCH_PCTS];  /* Obs in hand -> action sent */
+} ipc_env_bench_t;  /* 80 bytes */
 
 /* Response IDs (0x8000-0xFFFF) - high bit set indicates response */
 #define RSP_OK        0x8000
@@ -92,44 +266,315 @@ typedef struct {
 /* Flag bits */
 #define FLAG_IRQ_ON_COMPLETE 0x0001  /* Request interrupt on completion */
 
-/* Command Packet Structure (16 bytes) */
+/* Request tags (protocol v3)
+ * Every command carries a tag that the bridge echoes back unchanged in its
+ * response, so several requests with the same cmd can be in flight at once.
+ * Tag 0 means "untagged" (matched on orig_cmd only, as before v3).
+ */
+#define IPC_TAG_NONE 0u
+
+/* Command Packet Structure (24 bytes) */
 typedef struct {
   uint16_t cmd;        /* Command ID */
   uint16_t flags;      /* Flags (e.g., FLAG_IRQ_ON_COMPLETE) */
   uint32_t payload_id; /* ID of data/model in shared heap */
   uint64_t timestamp;  /* Timestamp for latency tracking */
+  uint32_t tag;        /* Request tag (IPC_TAG_NONE if untagged) */
+  uint32_t reserved;
 } ipc_packet_t;
 
-/* Response Packet Structure (16 bytes) */
+/* Response Packet Structure (24 bytes) */
 typedef struct {
   uint16_t status;     /* Response status (RSP_OK, RSP_ERROR, etc.) */
   uint16_t orig_cmd;   /* Original command this responds to */
   uint32_t result;     /* Result value or error code */
   uint64_t timestamp;  /* Completion timestamp */
+  uint32_t tag;        /* Echo of ipc_packet_t.tag */
+  uint32_t reserved;
 } ipc_response_t;
 
-/* Ring Buffer Header (Shared Memory Control Block)
- * Located at start of each ring region.
+/* Ring Buffer Header (Shared Memory Control Block), protocol v2
+ * Located at start of each ring region (command, response and stream).
+ *
+ * The producer and consumer indices live on separate 64-byte cache lines so
+ * the two sides never write the same line. Indices are free-running 32-bit
+ * counters; the slot is (index & mask) with size a power of two, so the ring
+ * is empty when head == tail and full when head - tail == size.
+ *
+ * v1 (doorbell version 1) used a packed 32-byte header
+ * {magic, head, tail, size, reserved[4]} with modulo-wrapped indices.
  */
+#define IPC_CACHE_LINE 64
+
 typedef struct {
+  /* Line 0: written once at init */
   uint32_t magic;       /* Magic Signature */
-  uint32_t head;        /* Producer Index */
-  uint32_t tail;        /* Consumer Index */
-  uint32_t size;        /* Size of ring (IPC_RING_SIZE) */
-  uint32_t reserved[4]; /* Padding/Reserved */
+  uint32_t version;     /* IPC_PROTO_VERSION */
+  uint32_t size;        /* Entry count (power of two) */
+  uint32_t mask;        /* size - 1 */
+  uint32_t flags;       /* IPC_RING_FLAG_* */
+  uint32_t entry_size;  /* Stream rings: bytes per entry (0 = implied by type) */
+  uint32_t obs_dim;     /* Obs stream ring: floats per observation */
+  uint32_t reserved0[9];
+
+  /* Line 1: producer-owned */
+  volatile uint32_t head; /* Free-running Producer Index */
+  uint32_t overruns;      /* Stream rings: stalls (FIFO) or entries overwritten */
+  uint32_t max_occupancy; /* Stream rings: high-water mark of head - tail */
+  volatile uint32_t clock_seq; /* Obs stream ring: bumped after clock_ns is set */
+  volatile uint64_t clock_ns;  /* Obs stream ring: producer clock at ENV_RESET */
+  uint32_t reserved1[10];
+
+  /* Line 2: consumer-owned */
+  volatile uint32_t tail; /* Free-running Consumer Index */
+  uint32_t drops;         /* Stream rings: entries skipped unread */
+  uint32_t reserved2[14];
+} __attribute__((aligned(IPC_CACHE_LINE))) ipc_ring_hdr_t;
+
+/* Ring flags (ipc_ring_hdr_t.flags)
+ *
+ * IPC_RING_FLAG_MPSC: multi-producer command ring. A uint32_t sequence
+ * array (one per slot) follows data[] (see IPC_RING_SEQ()). Producers claim
+ * slots by CAS on 'head', so 'head' can run ahead of what is published; the
+ * consumer must instead wait for seq[pos & mask] == pos + 1, and releases
+ * a slot by writing seq = pos + size before advancing 'tail'.
+ * Slot i starts with seq = i.
+ */
+#define IPC_RING_FLAG_MPSC     0x00000001u
+
+/* Stream ring overflow policy (flags bits 2:1), set by whoever inits the
+ * ring:
+ * FIFO:        the producer refuses to push while full (one overrun per
+ *              stall).
+ * DROP_OLDEST: the producer never blocks and overwrites the oldest unread
+ *              entries (one overrun each); a lapped consumer skips ahead to
+ *              the newer half of the ring, counting skipped entries as drops.
+ * LATEST:      as DROP_OLDEST for the producer, but the consumer always
+ *              takes the newest entry and drops everything older.
+ * In the overwrite modes the consumer re-reads head after copying a slot
+ * and retries if the producer may have overwritten it meanwhile.
+ */
+#define IPC_RING_POLICY_SHIFT       1
+#define IPC_RING_POLICY_MASK        (3u << IPC_RING_POLICY_SHIFT)
+#define IPC_RING_POLICY_FIFO        (0u << IPC_RING_POLICY_SHIFT)
+#define IPC_RING_POLICY_DROP_OLDEST (1u << IPC_RING_POLICY_SHIFT)
+#define IPC_RING_POLICY_LATEST      (2u << IPC_RING_POLICY_SHIFT)
+
+#define IPC_RING_HDR_SIZE      (3 * IPC_CACHE_LINE)
+#define IPC_RING_HEAD_OFFSET   (1 * IPC_CACHE_LINE)
+#define IPC_RING_TAIL_OFFSET   (2 * IPC_CACHE_LINE)
+
+/* Obs stream entries: seq + obs[dim] + reward + done + model_id + ts. The width
+ * matches the ZENEDGE build's -DIPC_OBS_DIM (published as obs_dim).
+ */
+#define IPC_STREAM_MAGIC       0x5354524D  /* "STRM" */
+#define IPC_OBS_RING_BYTES     0x1000      /* Fixed 1MB layout: after the msg rings */
+#define IPC_ACT_RING_BYTES     0x1000
+#define IPC_OBS_RING_OFFSET    (IPC_MSG_RSP_RING_OFFSET + IPC_MSG_RING_BYTES)
+#define IPC_ACT_RING_OFFSET    (IPC_OBS_RING_OFFSET + IPC_OBS_RING_BYTES)
+#ifndef IPC_OBS_DIM
+#define IPC_OBS_DIM            4
+#endif
+#define IPC_OBS_DIM_MAX        512
+#define IPC_OBS_ENTRY_SIZE(dim) (4u + 4u * (uint32_t)(dim) + 16u)
+
+/* Action stream entry */
+typedef struct {
+  uint32_t seq;     /* Matches obs seq */
+  uint16_t action;  /* Discrete action */
+  uint16_t flags;   /* Reserved */
+  uint32_t ack_seq; /* Optional ack of last obs */
+  uint32_t ts;      /* Publish time: ZENEDGE TSC, low 32 bits */
+} action_entry_t;
+
+/* Stream channels (IPC_REGION_STREAM_CHAN)
+ * Each channel is an independent obs/action ring pair, so several control
+ * loops can run on one node. Channel 0 is IPC_REGION_OBS_RING/ACT_RING;
+ * channels 1.. have their rings, each 4KB aligned, after the table page at
+ * the front of the region. ZENEDGE writes the table at init (magic last)
+ * and flips a channel to IPC_CHAN_OPEN once its rings are attached.
+ * Build with -DIPC_STREAM_CHANNELS=N (both sides size the region from it).
+ */
+#define IPC_CHAN_MAGIC          0x4E414843  /* "CHAN" */
+#define IPC_STREAM_CHANNELS_MAX 16
+#ifndef IPC_STREAM_CHANNELS
+#define IPC_STREAM_CHANNELS     4
+#endif
+#define IPC_CHAN_CLOSED         0
+#define IPC_CHAN_OPEN           1
+#define IPC_CHAN_CPU_ANY        0xFFFFFFFFu
+#define IPC_ACT_ENTRY_SIZE      16u
+
+/* One ring of `entries` slots, rounded up to whole pages */
+#define IPC_CHAN_RING_BYTES(entries, entry_size)                              \
+  ((IPC_RING_HDR_SIZE + (uint32_t)(entries) * (uint32_t)(entry_size) +        \
+    IPC_LAYOUT_ALIGN - 1) & ~(uint32_t)(IPC_LAYOUT_ALIGN - 1))
+/* Table page plus the rings of channels 1..chans-1 */
+#define IPC_CHAN_REGION_BYTES(chans, entries, obs_entry_size)                 \
+  (IPC_LAYOUT_ALIGN + ((uint32_t)(chans) - 1) *                               \
+   (IPC_CHAN_RING_BYTES(entries, obs_entry_size) +                            \
+    IPC_CHAN_RING_BYTES(entries, IPC_ACT_ENTRY_SIZE)))
+
+typedef struct {
+  volatile uint32_t state;  /* IPC_CHAN_* */
+  uint32_t id;              /* Channel number */
+  volatile uint32_t job_id; /* Owning job (0 = unowned) */
+  volatile uint32_t cpu;    /* Core affinity (IPC_CHAN_CPU_ANY) */
+  uint32_t obs_offset;      /* From the start of shared memory */
+  uint32_t obs_size;
+  uint32_t act_offset;
+  uint32_t act_size;
+  uint32_t reserved[8];
+} ipc_stream_chan_t;        /* One cache line per channel */
+
+typedef struct {
+  uint32_t magic;           /* IPC_CHAN_MAGIC, written last */
+  uint32_t count;           /* Valid entries in chans[] */
+  uint32_t reserved[14];
+  ipc_stream_chan_t chans[IPC_STREAM_CHANNELS_MAX];
+} ipc_stream_chan_table_t;
+
+/* Command ring: ZENEDGE produces, Linux consumes */
+typedef struct {
+  ipc_ring_hdr_t hdr;
   ipc_packet_t data[];  /* Ring Data */
 } ipc_ring_t;
 
+/* Per-slot sequence array of an MPSC command ring */
+#define IPC_RING_SEQ(ring) \
+  ((volatile uint32_t *)&(ring)->data[(ring)->hdr.size])
+
 /* Response Ring uses same header but different data type */
 typedef struct {
-  uint32_t magic;       /* Magic Signature (IPC_RSP_MAGIC) */
-  uint32_t head;        /* Producer Index (Written by Linux) */
-  uint32_t tail;        /* Consumer Index (Written by ZENEDGE) */
-  uint32_t size;        /* Size of ring (IPC_RING_SIZE) */
-  uint32_t reserved[4]; /* Padding/Reserved */
+  ipc_ring_hdr_t hdr;
   ipc_response_t data[];/* Ring Data */
 } ipc_rsp_ring_t;
 
+/* Variable-length message ring (see IPC_MSG_MAGIC) */
+typedef struct {
+  ipc_ring_hdr_t hdr;
+  uint8_t data[];
+} ipc_msg_ring_t;
+
+/* =============================================================================
+ * BULK RING (bridge -> ZENEDGE, IPC_REGION_BULK)
+ * =============================================================================
+ * Chunked upload of payloads too big for the shared heap (model weights).
+ * Chunks are copied out into kernel pages, so a load never holds heap space
+ * and the control rings keep flowing while it runs.
+ *
+ * Credit flow control: the bridge writes total_size and head = 0, then a
+ * new xfer_id. ZENEDGE accepts once it has pages for the whole payload,
+ * setting status, credit and finally accepted = xfer_id. The bridge may
+ * publish chunk n only while n < credit; ZENEDGE keeps credit at tail +
+ * slots, so with two slots the bridge fills one while ZENEDGE drains the
+ * other. Refused offers get credit 0 and an error status.
+ */
+#define IPC_BULK_MAGIC       0x524B4C42  /* "BLKR" */
+#define IPC_BULK_CHUNK_SIZE  16384
+#define IPC_BULK_SLOTS       2           /* Minimum: double buffering */
+#define IPC_BULK_MAX_SIZE    (16u << 20) /* Per transfer */
+
+/* Model ids at or above this name bulk-loaded weights, not heap blobs */
+#define IPC_BULK_MODEL_BASE  0x10000
+
+/* Transfer status (ipc_bulk_ring_t.status) */
+#define IPC_BULK_IDLE        0
+#define IPC_BULK_OPEN        1  /* Accepted: chunks flowing */
+#define IPC_BULK_DONE        2  /* All chunks landed; model_id is valid */
+#define IPC_BULK_NOMEM       3  /* Refused: no pages for the payload */
+#define IPC_BULK_INVALID     4  /* Refused: bad size or a chunk out of order */
+
+typedef struct {
+  /* Line 0: written once at init by ZENEDGE */
+  uint32_t magic;       /* IPC_BULK_MAGIC */
+  uint32_t slots;       /* Chunk slots after the header */
+  uint32_t chunk_size;  /* IPC_BULK_CHUNK_SIZE */
+  uint32_t reserved0[13];
+
+  /* Line 1: bridge-owned */
+  volatile uint32_t xfer_id;    /* New nonzero value offers a transfer */
+  volatile uint32_t total_size; /* Payload bytes, written before xfer_id */
+  volatile uint32_t head;       /* Chunks published in this transfer */
+  uint32_t reserved1[13];
+
+  /* Line 2: kernel-owned */
+  volatile uint32_t accepted;   /* xfer_id that status describes */
+  volatile uint32_t status;     /* IPC_BULK_* */
+  volatile uint32_t credit;     /* Bridge may publish while head < credit */
+  volatile uint32_t tail;       /* Chunks copied out */
+  volatile uint32_t model_id;   /* IPC_BULK_DONE: id naming the payload */
+  uint32_t reserved2[11];
+} __attribute__((aligned(IPC_CACHE_LINE))) ipc_bulk_ring_t;
+
+typedef struct {
+  uint32_t xfer_id;  /* Transfer the chunk belongs to */
+  uint32_t index;    /* Chunk number within it (slot = index % slots) */
+  uint32_t len;      /* Payload bytes: chunk_size except the last chunk */
+  uint32_t reserved;
+  uint8_t  data[IPC_BULK_CHUNK_SIZE];
+} ipc_bulk_chunk_t;
+
+/* =============================================================================
+ * WASM PROFILE DUMP (ZENEDGE -> Linux, CMD_WASM_PROFILE)
+ * =============================================================================
+ * A BLOB_TYPE_RAW blob: ipc_wasm_prof_hdr_t then `count` records, totals
+ * since profiling was last enabled. Cycles are TSC; cpu_mhz converts.
+ */
+#define IPC_WASM_PROF_MAGIC   0x46525057  /* "WPRF" */
+#define IPC_WASM_PROF_VERSION 1
+
+/* doorbell_ctl_t.wasm_prof_mode bits */
+#define IPC_WASM_PROF_CALLS 0x01  /* Exported function calls: count, cycles */
+#define IPC_WASM_PROF_HOST  0x02  /* Host imports: count, cycles */
+#define IPC_WASM_PROF_OPS   0x04  /* Opcode counts (ZENEDGE_WASM_OPPROF builds) */
+
+/* ipc_wasm_prof_rec_t.kind */
+#define IPC_WASM_PROF_KIND_FUNC 1
+#define IPC_WASM_PROF_KIND_HOST 2
+#define IPC_WASM_PROF_KIND_OP   3
+
+#define IPC_WASM_PROF_NAME_LEN 40
+
+typedef struct {
+  uint32_t magic;    /* IPC_WASM_PROF_MAGIC */
+  uint32_t version;  /* IPC_WASM_PROF_VERSION */
+  uint32_t mode;     /* IPC_WASM_PROF_* active when dumped */
+  uint32_t count;    /* Records that follow */
+  uint32_t cpu_mhz;  /* TSC rate */
+  uint32_t reserved[3];
+} ipc_wasm_prof_hdr_t;  /* 32 bytes */
+
+typedef struct {
+  uint32_t kind;     /* IPC_WASM_PROF_KIND_* */
+  uint32_t reserved;
+  uint64_t calls;    /* Calls, or executions for opcodes */
+  uint64_t cycles;   /* 0 for opcodes */
+  char     name[IPC_WASM_PROF_NAME_LEN]; /* NUL-padded */
+} ipc_wasm_prof_rec_t;  /* 64 bytes */
+
+/* =============================================================================
+ * BATCHED INFERENCE (ZENEDGE -> Linux, CMD_RUN_MODEL_BATCH)
+ * =============================================================================
+ * Payload: a BLOB_TYPE_RAW blob holding an ipc_run_batch_t with `count`
+ * entries; the bridge frees it. Each entry is one CMD_RUN_MODEL and gets
+ * its own response (orig_cmd CMD_RUN_MODEL, the entry's tag, result = its
+ * result blob), all sent before the batch's own response (result = entries
+ * run). model 0 leaves the choice to the bridge, as for CMD_RUN_MODEL.
+ */
+#define IPC_RUN_BATCH_MAX 16
+
+typedef struct {
+  uint32_t input_blob; /* As CMD_RUN_MODEL's payload */
+  uint32_t tag;        /* Echoed in this entry's response */
+} ipc_run_batch_entry_t;
+
+typedef struct {
+  uint32_t count;      /* Entries in use, 1..IPC_RUN_BATCH_MAX */
+  uint32_t model;
+  ipc_run_batch_entry_t entries[IPC_RUN_BATCH_MAX];
+} ipc_run_batch_t;  /* Only count entries need be present */
+
 /* =============================================================================
  * SHARED HEAP - For passing tensor data between ZENEDGE and Linux
  * =============================================================================
@@ -152,12 +597,26 @@ typedef struct {
 #define BLOB_TYPE_TENSOR    0x01  /* Tensor with header */
 #define BLOB_TYPE_MODEL_REF 0x02  /* Reference to model (path/ID) */
 #define BLOB_TYPE_RESULT    0x03  /* Inference result */
+#define BLOB_TYPE_SG        0x04  /* Scatter-gather chain (heap_sg_t) */
+#define BLOB_TYPE_ONNX      0x05  /* Serialized ONNX ModelProto, run in-kernel */
 
 /* Blob flags */
 #define BLOB_FLAG_PINNED    0x01  /* Don't free automatically */
 #define BLOB_FLAG_READONLY  0x02  /* Linux should not modify */
+#define BLOB_FLAG_POOLED    0x04  /* Slab pool blob: freeing recycles it */
+#define BLOB_FLAG_CSUM_CRC32C 0x08  /* checksum is CRC32C of the data */
+#define BLOB_FLAG_CSUM_NONE 0x10  /* No checksum (trusted hot-path blobs) */
+#define BLOB_CSUM_MASK      (BLOB_FLAG_CSUM_CRC32C | BLOB_FLAG_CSUM_NONE)
 
-/* Blob descriptor (32 bytes) - stored at start of each allocation */
+/* Blob descriptor (32 bytes) - stored at start of each allocation
+ *
+ * Heap version 5 reference counts blobs without cross-side atomics: each
+ * side only ever increments its own taken[]/dropped[] counters (indexed by
+ * HEAP_ARENA_*), and the references still held are
+ * taken[0] + taken[1] - dropped[0] - dropped[1] (mod 2^16). Allocation and
+ * pool draws start the caller with one reference; a reference handed to the
+ * other side along with the blob id moves without touching any counter.
+ */
 typedef struct {
   uint32_t magic;       /* 0x424C4F42 "BLOB" */
   uint16_t blob_id;     /* Unique ID for this blob */
@@ -165,17 +624,50 @@ typedef struct {
   uint8_t  flags;       /* BLOB_FLAG_* */
   uint32_t size;        /* Size of data (not including this header) */
   uint32_t offset;      /* Offset from heap base to data */
-  uint32_t checksum;    /* Simple checksum for validation */
-  uint32_t reserved[3]; /* Padding to 32 bytes */
+  uint32_t checksum;    /* Over the data, per BLOB_CSUM_MASK (neither: legacy) */
+  uint32_t pool;        /* Owner arena's pool index (BLOB_FLAG_POOLED) */
+  uint16_t taken[2];    /* References taken, per side (version 5) */
+  uint16_t dropped[2];  /* References released, per side (version 5) */
 } heap_blob_t;
 
 #define BLOB_MAGIC 0x424C4F42 /* "BLOB" */
 
-/* Tensor descriptor (embedded in blob data for BLOB_TYPE_TENSOR) */
+/* Scatter-gather chain: the data of a BLOB_TYPE_SG blob.
+ *
+ * For payloads larger than the biggest free chunk. The payload is the
+ * extents' data concatenated in order, laid out exactly as a contiguous
+ * blob of inner_type would be (a chained tensor starts with its
+ * tensor_header_t). Extents are ordinary BLOB_TYPE_RAW blobs from the same
+ * arena, owned by the chain: the chain's last release frees them too.
+ */
+#define HEAP_SG_MAX_EXTENTS 64
+
+typedef struct {
+  uint16_t blob_id;     /* Extent blob */
+  uint16_t reserved;
+  uint32_t size;        /* Payload bytes held by this extent */
+} heap_sg_extent_t;
+
+typedef struct {
+  uint32_t total_size;  /* Payload bytes across all extents */
+  uint8_t  inner_type;  /* BLOB_TYPE_* the payload is laid out as */
+  uint8_t  reserved;
+  uint16_t count;       /* Extents in use */
+  heap_sg_extent_t extent[HEAP_SG_MAX_EXTENTS];
+} heap_sg_t;
+
+/* Tensor descriptor (embedded in blob data for BLOB_TYPE_TENSOR)
+ *
+ * A quantized tensor (quant != TENSOR_QUANT_NONE) holds integers q whose
+ * real value is scale * (q - zero_point). The parameters trail the
+ * elements (shape[0] * strides[0] bytes; the dense size if strides[0] is
+ * 0), from the next 4-byte boundary: float scale[n] then int32_t
+ * zero_point[n], with n = 1 per tensor or shape[0] per channel.
+ */
 typedef struct {
   uint8_t  dtype;       /* Data type (see below) */
   uint8_t  ndim;        /* Number of dimensions (max 4) */
-  uint16_t reserved;
+  uint16_t quant;       /* TENSOR_QUANT_* (was reserved: 0 = none) */
   uint32_t shape[4];    /* Dimension sizes */
   uint32_t strides[4];  /* Strides in bytes */
   /* Actual tensor data follows immediately */
@@ -188,20 +680,133 @@ typedef struct {
 #define DTYPE_INT16    0x03
 #define DTYPE_INT8     0x04
 #define DTYPE_UINT8    0x05
+#define DTYPE_BFLOAT16 0x06
+
+/* Tensor quantization */
+#define TENSOR_QUANT_NONE        0
+#define TENSOR_QUANT_PER_TENSOR  1  /* One scale/zero_point */
+#define TENSOR_QUANT_PER_CHANNEL 2  /* One per index of dim 0 */
+
+/* Heap control block - at IPC_HEAP_CTL_OFFSET
+ *
+ * Version 3 heaps are split into one arena per side (HEAP_ARENA_*). Each
+ * arena owns a block range and a blob table slot range, and only its owner
+ * ever writes its free lists, counters, bitmap words and slots, so ZENEDGE
+ * and the bridge allocate concurrently without locks or atomics. Freeing a
+ * blob the other side owns pushes its id onto the owner's return queue;
+ * the owner drains the queue on its next allocation.
+ *
+ * Within an arena, allocation is a buddy allocator over HEAP_BLOCK_SIZE
+ * blocks: a chunk of order k is 2^k blocks, aligned to 2^k blocks from the
+ * arena base. Free chunks sit on per-order doubly linked lists
+ * (free_head[k]) linked through a heap_free_chunk_t at the start of each
+ * free chunk. The bitmap marks used blocks.
+ *
+ * Version 4 adds slab pools to each arena (heap_pool_t): count preformatted
+ * blobs of one size that stay allocated and published for the life of the
+ * heap. Drawing one pops the pool's free stack and freeing one pushes it
+ * back, with no allocator work and no header rewrite. Only the owning side
+ * draws; a pooled blob freed by the other side comes back through the
+ * owner's return queue like any other.
+ *
+ * Version 5 reference counts blobs (heap_blob_t.taken/dropped). Releasing
+ * the last reference frees the blob: directly if the releasing side owns
+ * it, otherwise through the owner's return queue, where the owner frees it
+ * only if it is still unreferenced.
+ *
+ * Version 1 heaps have only the bitmap, free_blocks and next_blob_id in a
+ * 32-byte header.
+ */
+#define IPC_HEAP_VERSION     5
+#define HEAP_BUDDY_ORDERS    28          /* 2^27 blocks = 8GB: any 32-bit heap */
+#define HEAP_BUDDY_NIL       0xFFFFFFFF  /* Empty list / end of list */
+
+#define HEAP_ARENA_KERNEL    0
+#define HEAP_ARENA_BRIDGE    1
+#define HEAP_ARENA_COUNT     2
+#define HEAP_ARENA_ALIGN     64          /* Blocks: arenas never share a bitmap word */
+#define HEAP_RETURN_SLOTS    512         /* Return queue depth (power of 2) */
+#define HEAP_POOLS           4           /* Slab pools per arena */
+#define HEAP_POOL_DEPTH      128         /* Max blobs per pool */
+
+/* Foreign frees: head is written by the freeing side, tail by the owner */
+typedef struct {
+  uint32_t head;
+  uint32_t tail;
+  uint16_t ids[HEAP_RETURN_SLOTS];
+} heap_return_q_t;
+
+/* Slab pool of same-size blobs, written only by the owning arena's side */
+typedef struct {
+  uint32_t blob_size;       /* Data bytes per blob, 0 = unused pool */
+  uint32_t blocks;          /* Blocks per blob */
+  uint16_t count;           /* Blobs in the pool */
+  uint16_t free_count;      /* Ids on the free stack */
+  uint8_t  type;            /* BLOB_TYPE_* the blobs were formatted with */
+  uint8_t  reserved[3];
+  uint16_t free_ids[HEAP_POOL_DEPTH]; /* Free stack: free_ids[free_count - 1] is next */
+} heap_pool_t;
+
+typedef struct {
+  uint32_t base_block;      /* First block of the arena */
+  uint32_t blocks;          /* Blocks in the arena */
+  uint32_t free_blocks;     /* Currently free blocks */
+  uint32_t buddy_orders;    /* Orders in use: floor(log2(blocks)) + 1 */
+  uint32_t slot_base;       /* First blob table slot owned by the arena */
+  uint32_t slot_count;      /* Blob table slots owned */
+  uint32_t next_slot;       /* Slot to probe first (relative to slot_base) */
+  uint32_t blob_count;      /* Live blobs allocated from the arena */
+  uint32_t free_head[HEAP_BUDDY_ORDERS]; /* First free chunk, arena-relative */
+  heap_return_q_t ret;      /* Ids the other side freed, for the owner */
+  heap_pool_t pool[HEAP_POOLS];
+} heap_arena_t;
 
-/* Heap control block - at IPC_HEAP_CTL_OFFSET */
 typedef struct {
   uint32_t magic;           /* IPC_HEAP_MAGIC */
-  uint32_t version;         /* Protocol version (1) */
+  uint32_t version;         /* IPC_HEAP_VERSION */
   uint32_t total_blocks;    /* Total blocks available */
-  uint32_t free_blocks;     /* Currently free blocks */
-  uint32_t next_blob_id;    /* Next blob ID to assign */
-  uint32_t reserved[3];     /* Padding */
+  uint32_t arena_count;     /* HEAP_ARENA_COUNT */
+  uint32_t reserved;
+  uint32_t blob_slots;      /* Blob table entries (power of 2, 0 = no table) */
+  uint32_t blob_table;      /* Byte offset of the blob table from this header */
+  uint32_t reserved2;
+  heap_arena_t arena[HEAP_ARENA_COUNT];
   /* Bitmap follows: 1 bit per block (0=free, 1=used) */
-  /* Size: (HEAP_MAX_BLOCKS + 7) / 8 bytes */
+  /* Size: (total_blocks + 7) / 8 bytes */
   uint8_t  bitmap[];
 } heap_ctl_t;
 
+/* Header at the start of every free chunk (in the data region) */
+typedef struct {
+  uint32_t magic;           /* HEAP_FREE_MAGIC */
+  uint32_t order;           /* Chunk is 2^order blocks */
+  uint32_t next;            /* Arena-relative block of next free chunk, or NIL */
+  uint32_t prev;            /* Arena-relative block of previous chunk, or NIL */
+} heap_free_chunk_t;
+
+#define HEAP_FREE_MAGIC      0x45455246  /* "FREE" */
+
+/* Blob table entry (12 bytes), direct-indexed by blob_id & (blob_slots - 1).
+ * A blob_id is (generation << log2(blob_slots)) | slot, truncated to 16 bits,
+ * so a stale id for a reused slot no longer matches the entry's blob_id.
+ * Writers fill offset/blocks/generation first and publish blob_id last;
+ * freeing clears blob_id first.
+ */
+typedef struct {
+  uint32_t offset;          /* Blob header offset from the heap data base */
+  uint32_t blocks;          /* HEAP_BLOCK_SIZE blocks allocated (2^order) */
+  uint16_t blob_id;         /* Id living in this slot, 0 = free */
+  uint16_t generation;      /* Bumped each time the slot is reused */
+} heap_blob_slot_t;
+
+/* Table sizing (kernel/ipc/layout.c scales the slot count with the heap) */
+#define HEAP_BLOB_SLOTS_MIN  512
+#define HEAP_BLOB_SLOTS_MAX  16384   /* Leaves >= 2 generation bits in a blob_id */
+
+/* Blob table sits after the bitmap, 8-byte aligned */
+#define HEAP_BLOB_TABLE_OFFSET(blocks) \
+  ((sizeof(heap_ctl_t) + ((blocks) + 7) / 8 + 7) & ~(uint32_t)7)
+
 /* Helper: calculate bitmap size in bytes */
 #define HEAP_BITMAP_SIZE ((HEAP_MAX_BLOCKS + 7) / 8)
 
@@ -219,6 +824,10 @@ static inline const char* cmd_name(uint16_t cmd) {
         case CMD_PING:      return "PING";
         case CMD_PRINT:     return "PRINT";
         case CMD_RUN_MODEL: return "RUN_MODEL";
+        case CMD_RUN_MODEL_BATCH: return "RUN_MODEL_BATCH";
+        case CMD_ENV_RESET: return "ENV_RESET";
+        case CMD_ENV_STEP:  return "ENV_STEP";
+        case CMD_ENV_BENCH: return "ENV_BENCH";
         default:            return "UNKNOWN";
     }
 }
@@ -242,6 +851,7 @@ static inline const char* dtype_name(uint8_t dtype) {
         case DTYPE_INT16:   return "int16";
         case DTYPE_INT8:    return "int8";
         case DTYPE_UINT8:   return "uint8";
+        case DTYPE_BFLOAT16: return "bfloat16";
         default:            return "unknown";
     }
 }
@@ -253,6 +863,7 @@ static inline const char* blob_type_name(uint8_t type) {
         case BLOB_TYPE_TENSOR:    return "TENSOR";
         case BLOB_TYPE_MODEL_REF: return "MODEL_REF";
         case BLOB_TYPE_RESULT:    return "RESULT";
+        case BLOB_TYPE_SG:        return "SG";
         default:                  return "UNKNOWN";
     }
 }
@@ -0,0 +1,55 @@
+/* tools/bridge/replay_log.h
+ *
+ * Recorded environment streams (bridge --record, gym agent --record).
+ *
+ * A log is what an environment did for the kernel, call by call, in the
+ * terms of the plugin interface (env_plugin.h): each reset with the
+ * observation it produced, each step with the action the kernel sent and
+ * the observation, reward and end of episode it got back, and how long
+ * the environment took over it. envs/replay.so plays a log back through
+ * the C bridge, so inference, ring and scheduling changes can be timed
+ * on the same observations every run, with no interpreter or simulator
+ * in the loop.
+ *
+ * Layout, little endian: a replay_hdr_t, then replay_rec_t records, each
+ * followed by hdr.obs_dim floats of observation, until end of file.
+ * Records of different envs interleave in the order they happened.
+ * bridge/replay.py reads and writes the same format.
+ */
+#ifndef ZENEDGE_REPLAY_LOG_H
+#define ZENEDGE_REPLAY_LOG_H
+
+#include <stdint.h>
+
+#define REPLAY_MAGIC        0x4C50525Au  /* "ZRPL" */
+#define REPLAY_VERSION      1
+#define REPLAY_NAME_LEN     32
+
+#define REPLAY_REC_RESET    1   /* An episode starts: obs is its first */
+#define REPLAY_REC_STEP     2   /* action applied: obs, reward, done */
+
+typedef struct {
+    uint32_t magic;             /* REPLAY_MAGIC */
+    uint16_t version;           /* REPLAY_VERSION */
+    uint16_t obs_dim;           /* Floats after every record */
+    uint64_t start_ns;          /* Recorder's monotonic clock at the start */
+    char name[REPLAY_NAME_LEN]; /* Environment recorded, NUL padded */
+} replay_hdr_t;
+
+typedef struct {
+    uint64_t t_ns;              /* Obs produced, since start_ns */
+    uint32_t env_ns;            /* Environment time spent producing it */
+    uint16_t env;               /* Vector slot */
+    uint8_t kind;               /* REPLAY_REC_* */
+    uint8_t done;               /* STEP: the episode ended */
+    uint32_t action;            /* STEP: what the kernel sent */
+    float reward;               /* STEP */
+    /* float obs[obs_dim] */
+} replay_rec_t;
+
+#define REPLAY_REC_SIZE(dim) (sizeof(replay_rec_t) + 4u * (dim))
+
+_Static_assert(sizeof(replay_hdr_t) == 48, "replay_hdr_t layout");
+_Static_assert(sizeof(replay_rec_t) == 24, "replay_rec_t layout");
+
+#endif /* ZENEDGE_REPLAY_LOG_H */
@@ -0,0 +1,514 @@
+/* tools/hostbench/hostbench.c
+ *
+ * Hosted microbenchmarks: the kernel's shared heap, kheap, job graph,
+ * flight recorder, SHA-256, CRC32C and vector math, built for Linux with
+ * tools/hostbench/shim.c standing in for the rest of the kernel, so a
+ * data structure change can be A/B timed in seconds instead of a QEMU
+ * boot.
+ *
+ * Build & run:
+ *   make hostbench && build/host/hostbench [options] [test prefix ...]
+ *
+ * Every test runs a fixed number of operations on inputs from a fixed
+ * seed, --repeat times after one warmup run, and reports ns per
+ * operation (min and median over the runs). --perf adds cycles and
+ * instructions per operation from perf_event_open(), and --cpu pins the
+ * process; under `perf stat`/`perf record`, name one test to profile
+ * only it.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "shim.h"
+#include "../../kernel/ipc/heap.h"
+#include "../../kernel/job/job_graph.h"
+#include "../../kernel/lib/crc32c.h"
+#include "../../kernel/lib/math.h"
+#include "../../kernel/lib/sha256.h"
+#include "../../kernel/mm/kheap.h"
+#include "../../kernel/time/time.h"
+#include "../../kernel/trace/flightrec.h"
+
+#define HEAP_DATA_BYTES  (4u << 20)   /* As the default ivshmem layout */
+#define HEAP_SLOTS       1024
+#define KHEAP_BYTES      (16u << 20)
+#define CHURN_LIVE       256          /* Live allocations in churn tests */
+#define BUF_BYTES        4096
+#define REPEAT_MAX       101
+
+typedef struct {
+    const char *name;
+    uint64_t ops;               /* Per run, before --scale */
+    uint32_t arg;
+    uint32_t bytes;             /* Per operation, for MB/s; 0 = none */
+    void (*setup)(uint32_t arg);
+    void (*run)(uint32_t arg, uint64_t ops);
+} test_t;
+
+static uint64_t rng = 0x2545F4914F6CDD1Dull;
+
+static void seed(void) { rng = 0x2545F4914F6CDD1Dull; }
+
+static uint32_t rand32(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng >> 16);
+}
+
+/* Log-uniform in [lo, hi): small sizes as common as large ones */
+static uint32_t rand_size(uint32_t lo_shift, uint32_t hi_shift) {
+    uint32_t shift = lo_shift + rand32() % (hi_shift - lo_shift);
+    return (1u << shift) + rand32() % (1u << shift);
+}
+
+static volatile uint32_t sink;   /* Keeps results alive */
+
+/* =============================================================================
+ * SHARED HEAP (kernel/ipc/heap.c)
+ * =============================================================================
+ */
+static uint8_t *heap_ctl_mem, *heap_data_mem;
+static uint16_t live_blobs[CHURN_LIVE];
+
+static void heap_setup(uint32_t arg) {
+    (void)arg;
+    uint32_t blocks = HEAP_DATA_BYTES / HEAP_BLOCK_SIZE;
+    size_t ctl = HEAP_BLOB_TABLE_OFFSET(blocks) + HEAP_SLOTS * sizeof(heap_blob_slot_t);
+    if (!heap_ctl_mem) {
+        heap_ctl_mem = aligned_alloc(4096, (ctl + 4095) & ~(size_t)4095);
+        heap_data_mem = aligned_alloc(4096, HEAP_DATA_BYTES);
+    }
+    memset(heap_ctl_mem, 0, ctl);
+    heap_init(heap_ctl_mem, HEAP_SLOTS, heap_data_mem, HEAP_DATA_BYTES);
+    memset(live_blobs, 0, sizeof(live_blobs));
+    seed();
+}
+
+static void heap_alloc_free(uint32_t size, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        uint16_t id = heap_alloc(size, BLOB_TYPE_RAW);
+        if (!id)
+            abort();
+        heap_free(id);
+    }
+}
+
+/* Replace a random live blob with one of a random size (64 B - 16 KiB) */
+static void heap_churn(uint32_t arg, uint64_t ops) {
+    (void)arg;
+    for (uint64_t i = 0; i < ops; i++) {
+        uint16_t *slot = &live_blobs[rand32() % CHURN_LIVE];
+        if (*slot)
+            heap_free(*slot);
+        *slot = heap_alloc(rand_size(6, 14), BLOB_TYPE_RAW);
+    }
+}
+
+/* =============================================================================
+ * KERNEL HEAP (kernel/mm/kheap.c)
+ * =============================================================================
+ */
+static uint8_t *kheap_mem;
+static void *live_ptrs[CHURN_LIVE];
+
+static void kheap_setup(uint32_t arg) {
+    (void)arg;
+    if (!kheap_mem)
+        kheap_mem = aligned_alloc(4096, KHEAP_BYTES);
+    kheap_init(kheap_mem, KHEAP_BYTES);
+    memset(live_ptrs, 0, sizeof(live_ptrs));
+    seed();
+}
+
+static void kmalloc_free(uint32_t size, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        void *p = kmalloc(size);
+        if (!p)
+            abort();
+        kfree(p);
+    }
+}
+
+/* Replace a random live allocation with one of a random size (16 B - 8 KiB) */
+static void kmalloc_churn(uint32_t arg, uint64_t ops) {
+    (void)arg;
+    for (uint64_t i = 0; i < ops; i++) {
+        void **slot = &live_ptrs[rand32() % CHURN_LIVE];
+        kfree(*slot);
+        *slot = kmalloc(rand_size(4, 13));
+    }
+}
+
+/* =============================================================================
+ * JOB GRAPH (kernel/job/job_graph.c)
+ * =============================================================================
+ * One operation: build a graph of arg steps, compile it and run it to
+ * completion through the ready queue, then free it.
+ */
+static job_graph_t graph;
+
+/* Helper: run every step, highest ranked first */
+static void graph_drain(job_graph_t *job) {
+    job_step_t *step;
+    while ((step = job_graph_take_ready(job)) != NULL)
+        job_graph_mark_completed(job, step->id);
+    sink += job->num_completed == job->num_steps;
+}
+
+/* Layers of 16 steps, each depending on two steps of the layer before */
+static void graph_layered(uint32_t steps, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        job_graph_init(&graph, 1);
+        for (uint32_t s = 0; s < steps; s++) {
+            job_graph_add_step(&graph, s + 1, STEP_TYPE_COMPUTE);
+            if (s >= 16) {
+                uint32_t base = s - s % 16 - 16;
+                job_graph_add_dep(&graph, s + 1, base + s % 16 + 1);
+                job_graph_add_dep(&graph, s + 1, base + (s * 7 + 3) % 16 + 1);
+            }
+        }
+        if (job_graph_compile(&graph) != 0)
+            abort();
+        graph_drain(&graph);
+        job_graph_free(&graph);
+    }
+}
+
+static void graph_chain(uint32_t steps, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        job_graph_init(&graph, 1);
+        for (uint32_t s = 0; s < steps; s++) {
+            job_graph_add_step(&graph, s + 1, STEP_TYPE_COMPUTE);
+            if (s)
+                job_graph_add_dep(&graph, s + 1, s);
+        }
+        if (job_graph_compile(&graph) != 0)
+            abort();
+        graph_drain(&graph);
+        job_graph_free(&graph);
+    }
+}
+
+/* =============================================================================
+ * FLIGHT RECORDER (kernel/trace/flightrec.c)
+ * =============================================================================
+ */
+static void flightrec_setup(uint32_t arg) {
+    (void)arg;
+    flightrec_init();
+}
+
+static void flightrec_events(uint32_t arg, uint64_t ops) {
+    (void)arg;
+    for (uint64_t i = 0; i < ops; i++)
+        flightrec_log(TRACE_EVT_STEP_START, 1, (uint32_t)i, (uint32_t)i);
+}
+
+static void flightrec_spans(uint32_t arg, uint64_t ops) {
+    (void)arg;
+    for (uint64_t i = 0; i < ops; i++) {
+        trace_span_t span = flightrec_begin_span(TRACE_EVT_STEP_START, 1, (uint32_t)i & 511);
+        flightrec_end_span(span, TRACE_EVT_STEP_END);
+    }
+}
+
+/* =============================================================================
+ * SHA-256, CRC32C, VECTOR MATH
+ * =============================================================================
+ */
+static uint8_t buf[BUF_BYTES];
+static float vec_a[BUF_BYTES / 4], vec_b[BUF_BYTES / 4], vec_y[BUF_BYTES / 4];
+
+static void buf_setup(uint32_t arg) {
+    (void)arg;
+    seed();
+    for (uint32_t i = 0; i < BUF_BYTES; i++)
+        buf[i] = (uint8_t)rand32();
+    for (uint32_t i = 0; i < BUF_BYTES / 4; i++) {
+        vec_a[i] = (float)(rand32() % 2001) / 1000.0f - 1.0f;
+        vec_b[i] = (float)(rand32() % 2001) / 1000.0f - 1.0f;
+    }
+}
+
+static void sha256_bytes(uint32_t len, uint64_t ops) {
+    uint8_t hash[32];
+    for (uint64_t i = 0; i < ops; i++) {
+        sha256_hash(buf, len, hash);
+        sink += hash[0];
+    }
+}
+
+static void crc32c_bytes(uint32_t len, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++)
+        sink += crc32c(0, buf, len);
+}
+
+static void vec_dot(uint32_t n, uint64_t ops) {
+    float acc = 0.0f;
+    for (uint64_t i = 0; i < ops; i++)
+        acc += math_vec_dot(vec_a, vec_b, (int)n);
+    sink += (uint32_t)acc;
+}
+
+/* 32 rows of 32: a small policy layer */
+static void vec_gemv(uint32_t n, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++)
+        math_vec_gemv(vec_a, 32, (int)n, (int)n, vec_b, vec_y);
+    sink += (uint32_t)vec_y[0];
+}
+
+static void vec_tanh(uint32_t n, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++) {
+        memcpy(vec_y, vec_a, n * sizeof(float));
+        math_vec_tanh(vec_y, (int)n);
+    }
+    sink += (uint32_t)vec_y[0];
+}
+
+static void vec_softmax(uint32_t n, uint64_t ops) {
+    for (uint64_t i = 0; i < ops; i++)
+        math_vec_softmax(vec_a, vec_y, (int)n);
+    sink += (uint32_t)vec_y[0];
+}
+
+static const test_t tests[] = {
+    { "heap/alloc_free/64",    200000, 64,    0, heap_setup, heap_alloc_free },
+    { "heap/alloc_free/4k",    200000, 4096,  0, heap_setup, heap_alloc_free },
+    { "heap/alloc_free/64k",   200000, 65536, 0, heap_setup, heap_alloc_free },
+    { "heap/churn",            200000, 0,     0, heap_setup, heap_churn },
+    { "kheap/kmalloc/16",      200000, 16,    0, kheap_setup, kmalloc_free },
+    { "kheap/kmalloc/256",     200000, 256,   0, kheap_setup, kmalloc_free },
+    { "kheap/kmalloc/4k",      200000, 4096,  0, kheap_setup, kmalloc_free },
+    { "kheap/churn",           200000, 0,     0, kheap_setup, kmalloc_churn },
+    { "job_graph/layered/256", 500,    256,   0, kheap_setup, graph_layered },
+    { "job_graph/chain/256",   500,    256,   0, kheap_setup, graph_chain },
+    { "flightrec/log",         500000, 0,     0, flightrec_setup, flightrec_events },
+    { "flightrec/span",        200000, 0,     0, flightrec_setup, flightrec_spans },
+    { "sha256/64",             200000, 64,    64, buf_setup, sha256_bytes },
+    { "sha256/4k",             10000,  4096,  4096, buf_setup, sha256_bytes },
+    { "crc32c/4k",             50000,  4096,  4096, buf_setup, crc32c_bytes },
+    { "math/dot/256",          500000, 256,   0, buf_setup, vec_dot },
+    { "math/gemv/32x32",       200000, 32,    0, buf_setup, vec_gemv },
+    { "math/tanh/256",         100000, 256,   0, buf_setup, vec_tanh },
+    { "math/softmax/64",       200000, 64,    0, buf_setup, vec_softmax },
+};
+#define TEST_COUNT (sizeof(tests) / sizeof(tests[0]))
+
+/* =============================================================================
+ * HARNESS
+ * =============================================================================
+ */
+static int perf_fd = -1;        /* Group leader: cycles, then instructions */
+
+static int perf_open(void) {
+    struct perf_event_attr attr;
+    uint64_t configs[2] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS };
+    for (int i = 0; i < 2; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i ? perf_fd : -1, 0);
+        if (fd < 0) {
+            if (perf_fd >= 0)
+                close(perf_fd);
+            perf_fd = -1;
+            return -1;
+        }
+        if (i == 0)
+            perf_fd = fd;
+    }
+    return 0;
+}
+
+/* Helper: cycles and instructions counted so far */
+static void perf_read(uint64_t out[2]) {
+    uint64_t v[3] = { 0, 0, 0 };   /* nr, cycles, instructions */
+    out[0] = out[1] = 0;
+    if (perf_fd >= 0 && read(perf_fd, v, sizeof(v)) == (ssize_t)sizeof(v)) {
+        out[0] = v[1];
+        out[1] = v[2];
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    double min_ns, med_ns;      /* Per operation */
+    double cycles, instr;       /* Per operation, median run; 0 without --perf */
+} result_t;
+
+static result_t run_test(const test_t *t, uint32_t repeat, double scale) {
+    uint64_t ops = (uint64_t)(t->ops * scale);
+    if (!ops)
+        ops = 1;
+    double ns[REPEAT_MAX], cyc[REPEAT_MAX], ins[REPEAT_MAX];
+
+    t->setup(t->arg);
+    t->run(t->arg, ops);            /* Warmup: caches, branch predictors */
+    if (perf_fd >= 0)
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    for (uint32_t r = 0; r < repeat; r++) {
+        uint64_t p0[2], p1[2];
+        perf_read(p0);
+        uint64_t t0 = now_ns();
+        t->run(t->arg, ops);
+        uint64_t t1 = now_ns();
+        perf_read(p1);
+        ns[r] = (double)(t1 - t0) / ops;
+        cyc[r] = (double)(p1[0] - p0[0]) / ops;
+        ins[r] = (double)(p1[1] - p0[1]) / ops;
+    }
+    if (perf_fd >= 0)
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    result_t res;
+    qsort(ns, repeat, sizeof(double), cmp_double);
+    qsort(cyc, repeat, sizeof(double), cmp_double);
+    qsort(ins, repeat, sizeof(double), cmp_double);
+    res.min_ns = ns[0];
+    res.med_ns = ns[repeat / 2];
+    res.cycles = cyc[repeat / 2];
+    res.instr = ins[repeat / 2];
+    return res;
+}
+
+static int selected(const char *name, int nfilters, char **filters) {
+    if (!nfilters)
+        return 1;
+    for (int i = 0; i < nfilters; i++)
+        if (strncmp(name, filters[i], strlen(filters[i])) == 0)
+            return 1;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] [test prefix ...]\n", prog);
+    fprintf(stderr, "  --list          Show the tests\n");
+    fprintf(stderr, "  --repeat <n>    Timed runs per test (default 11)\n");
+    fprintf(stderr, "  --scale <f>     Multiply operations per run\n");
+    fprintf(stderr, "  --perf          Cycles and instructions per op (perf_event_open)\n");
+    fprintf(stderr, "  --cpu <n>       Pin to CPU n\n");
+    fprintf(stderr, "  --json <file>   Also write the results as JSON (- = stdout)\n");
+    fprintf(stderr, "  --verbose       Show kernel console output\n");
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t repeat = 11;
+    double scale = 1.0;
+    int perf = 0, cpu = -1, verbose = 0, nfilters = 0;
+    const char *json = NULL;
+    char **filters = calloc((size_t)argc, sizeof(char *));
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(a, "--list") == 0) {
+            for (uint32_t t = 0; t < TEST_COUNT; t++)
+                printf("%s\n", tests[t].name);
+            return 0;
+        } else if (strcmp(a, "--perf") == 0) {
+            perf = 1;
+        } else if (strcmp(a, "--verbose") == 0) {
+            verbose = 1;
+        } else if (strcmp(a, "--repeat") == 0 && val) {
+            repeat = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(a, "--scale") == 0 && val) {
+            scale = strtod(argv[++i], NULL);
+        } else if (strcmp(a, "--cpu") == 0 && val) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(a, "--json") == 0 && val) {
+            json = argv[++i];
+        } else if (a[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            filters[nfilters++] = argv[i];
+        }
+    }
+    if (repeat < 1)
+        repeat = 1;
+    if (repeat > REPEAT_MAX)
+        repeat = REPEAT_MAX;
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            perror("[hostbench] sched_setaffinity");
+    }
+    shim_console_quiet(!verbose);
+    shim_init();
+    if (perf && perf_open() != 0)
+        fprintf(stderr, "[hostbench] perf counters unavailable (perf_event_paranoid?)\n");
+
+    /* The table goes to stderr when the JSON has stdout */
+    FILE *out = json && strcmp(json, "-") == 0 ? stderr : stdout;
+    fprintf(out, "hostbench: tsc %u kHz, sha256 %s, math %s, %u runs\n", time_get_tsc_khz(),
+           sha256_impl(), math_vec_isa_name(math_vec_isa()), repeat);
+    fprintf(out, "  %-24s %10s %10s", "test", "min ns/op", "p50 ns/op");
+    if (perf_fd >= 0)
+        fprintf(out, " %10s %8s", "cycles/op", "IPC");
+    fprintf(out, "\n");
+
+    FILE *jf = NULL;
+    if (json && !(jf = strcmp(json, "-") == 0 ? stdout : fopen(json, "w")))
+        perror("[hostbench] --json");
+    if (jf)
+        fprintf(jf, "{\"tsc_khz\": %u, \"sha256\": \"%s\", \"math\": \"%s\", \"repeat\": %u, "
+                "\"tests\": [", time_get_tsc_khz(), sha256_impl(),
+                math_vec_isa_name(math_vec_isa()), repeat);
+
+    int run = 0;
+    for (uint32_t i = 0; i < TEST_COUNT; i++) {
+        const test_t *t = &tests[i];
+        if (!selected(t->name, nfilters, filters))
+            continue;
+        result_t r = run_test(t, repeat, scale);
+        fprintf(out, "  %-24s %10.1f %10.1f", t->name, r.min_ns, r.med_ns);
+        if (perf_fd >= 0)
+            fprintf(out, " %10.1f %8.2f", r.cycles, r.cycles ? r.instr / r.cycles : 0.0);
+        if (t->bytes)
+            fprintf(out, "  %.0f MB/s", t->bytes * 1e3 / r.med_ns);
+        fprintf(out, "\n");
+        if (jf)
+            fprintf(jf, "%s\n  {\"name\": \"%s\", \"min_ns\": %.3f, \"p50_ns\": %.3f, "
+                    "\"cycles\": %.3f, \"instructions\": %.3f, \"bytes\": %u}",
+                    run ? "," : "", t->name, r.min_ns, r.med_ns, r.cycles, r.instr, t->bytes);
+        run++;
+    }
+    if (jf) {
+        fprintf(jf, "]}\n");
+        if (jf != stdout)
+            fclose(jf);
+    }
+    if (!run) {
+        fprintf(stderr, "[hostbench] no test matches (--list)\n");
+        return 1;
+    }
+    return 0;
+}
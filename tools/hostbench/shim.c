@@ -0,0 +1,180 @@
+/* tools/hostbench/shim.c
+ *
+ * The kernel services the hosted subsystems call (console, time, klog,
+ * fpu_features, pmu, vmm), done with Linux userspace facilities so
+ * kernel/ipc/heap.c, kernel/mm/kheap.c and friends link into an ordinary
+ * process. Everything is single-threaded, like the tests that use it.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <cpuid.h>
+#include <x86intrin.h>
+
+#include "shim.h"
+#include "../../kernel/console.h"
+#include "../../kernel/arch/fpu.h"
+#include "../../kernel/arch/pmu.h"
+#include "../../kernel/mm/vmm.h"
+#include "../../kernel/time/time.h"
+#include "../../kernel/trace/klog.h"
+
+/* =============================================================================
+ * CONSOLE
+ * =============================================================================
+ * Kernel output goes to stderr (or nowhere), out of the way of results.
+ */
+static int console_quiet;
+
+void shim_console_quiet(int on) { console_quiet = on; }
+
+void console_write(const char *str) {
+    if (!console_quiet)
+        fputs(str, stderr);
+}
+
+void console_putc(char c) {
+    if (!console_quiet)
+        fputc(c, stderr);
+}
+
+void print_hex32(uint32_t val) {
+    if (!console_quiet)
+        fprintf(stderr, "0x%08x", val);
+}
+
+void print_hex64(uint64_t val) {
+    if (!console_quiet)
+        fprintf(stderr, "0x%016llx", (unsigned long long)val);
+}
+
+void print_uint(uint32_t val) {
+    if (!console_quiet)
+        fprintf(stderr, "%u", val);
+}
+
+/* =============================================================================
+ * TIME
+ * =============================================================================
+ * The TSC, rated against CLOCK_MONOTONIC once at startup.
+ */
+static uint64_t tsc_boot;
+static uint64_t tsc_khz = 1000000;  /* Until shim_init() */
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+cycles_t time_cycles(void) { return __rdtsc(); }
+
+usec_t cycles_to_usec(cycles_t cycles) { return cycles * 1000 / tsc_khz; }
+
+cycles_t usec_to_cycles(usec_t usec) { return usec * tsc_khz / 1000; }
+
+usec_t time_usec(void) { return cycles_to_usec(__rdtsc() - tsc_boot); }
+
+uint32_t time_get_tsc_khz(void) { return (uint32_t)tsc_khz; }
+
+uint32_t time_get_cpu_mhz(void) { return (uint32_t)(tsc_khz / 1000); }
+
+/* =============================================================================
+ * KLOG
+ * =============================================================================
+ * Records are counted, not kept: a test that logs should not time stdio.
+ */
+uint8_t klog_levels[KLOG_SUBSYS_COUNT] = {
+    [0 ... KLOG_SUBSYS_COUNT - 1] = KLOG_LVL_WARN
+};
+
+static uint32_t klog_records;
+
+void klog_write(uint8_t subsys, uint8_t level, const char *fmt,
+                uint32_t a0, uint32_t a1, uint32_t a2) {
+    (void)subsys; (void)level; (void)fmt; (void)a0; (void)a1; (void)a2;
+    klog_records++;
+}
+
+uint32_t shim_klog_records(void) { return klog_records; }
+
+/* =============================================================================
+ * CPU FEATURES, PMU, PER-CPU, VMM
+ * =============================================================================
+ */
+static uint32_t features;
+
+/* What fpu_init() would find: the CPU has it and Linux enabled its state */
+static uint32_t detect_features(void) {
+    unsigned int a, b, c, d, ecx1, edx1, ebx7 = 0, ecx7 = 0, eax71 = 0;
+    uint32_t f = 0;
+    if (!__get_cpuid(1, &a, &b, &ecx1, &edx1))
+        return 0;
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, a, ebx7, ecx7, d);
+        __cpuid_count(7, 1, eax71, b, c, d);
+    }
+    if (edx1 & (1u << 26))
+        f |= FPU_FEAT_SSE2;
+    if (ecx1 & (1u << 19))
+        f |= FPU_FEAT_SSE41;
+    if (ebx7 & (1u << 29))
+        f |= FPU_FEAT_SHA;
+    if (!(ecx1 & (1u << 27)))           /* OSXSAVE */
+        return f;
+
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    uint64_t xcr0 = ((uint64_t)hi << 32) | lo;
+    f |= FPU_FEAT_XSAVE;
+    if ((ecx1 & (1u << 28)) && (xcr0 & (XCR0_SSE | XCR0_AVX)) == (XCR0_SSE | XCR0_AVX)) {
+        f |= FPU_FEAT_AVX;
+        if (ebx7 & (1u << 5))
+            f |= FPU_FEAT_AVX2;
+        if (ecx1 & (1u << 12))
+            f |= FPU_FEAT_FMA;
+        if (eax71 & (1u << 4))
+            f |= FPU_FEAT_AVX_VNNI;
+        if (ecx1 & (1u << 29))
+            f |= FPU_FEAT_F16C;
+        if ((ebx7 & (1u << 16)) && (xcr0 & XCR0_AVX512) == XCR0_AVX512) {
+            f |= FPU_FEAT_AVX512F;
+            if (ecx7 & (1u << 11))
+                f |= FPU_FEAT_AVX512_VNNI;
+            if (eax71 & (1u << 5))
+                f |= FPU_FEAT_AVX512_BF16;
+        }
+    }
+    return f;
+}
+
+uint32_t fpu_features(void) { return features; }
+
+/* No counters: flightrec spans carry none */
+uint32_t pmu_events(void) { return 0; }
+
+void pmu_read(pmu_snap_t *out) { memset(out, 0, sizeof(*out)); }
+
+void pmu_delta(const pmu_snap_t *start, pmu_snap_t *out) {
+    (void)start;
+    memset(out, 0, sizeof(*out));
+}
+
+volatile uint32_t percpu_ready;  /* Never set: one CPU, no %gs */
+
+paddr_t vmm_virt_to_phys(vaddr_t vaddr) { return (paddr_t)vaddr; }
+
+void shim_init(void) {
+    features = detect_features();
+
+    /* 50ms against CLOCK_MONOTONIC */
+    uint64_t ns0 = mono_ns(), tsc0 = __rdtsc();
+    while (mono_ns() - ns0 < 50000000ull) {
+    }
+    uint64_t ns1 = mono_ns(), tsc1 = __rdtsc();
+    tsc_khz = (tsc1 - tsc0) * 1000000ull / (ns1 - ns0);
+    if (!tsc_khz)
+        tsc_khz = 1;
+    tsc_boot = tsc1;
+}
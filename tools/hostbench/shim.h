@@ -0,0 +1,16 @@
+/* tools/hostbench/shim.h - Kernel services for the hosted build */
+#ifndef HOSTBENCH_SHIM_H
+#define HOSTBENCH_SHIM_H
+
+#include <stdint.h>
+
+/* Rate the TSC and detect CPU features; call before anything else */
+void shim_init(void);
+
+/* Drop kernel console output (it goes to stderr otherwise) */
+void shim_console_quiet(int on);
+
+/* KLOG records written so far */
+uint32_t shim_klog_records(void);
+
+#endif /* HOSTBENCH_SHIM_H */